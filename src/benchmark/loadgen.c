@@ -0,0 +1,982 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file loadgen.c
+ * @brief HTTP load generator for the benchmarks.  Unlike libcurl, it
+ *        only does what is needed to send a fixed GET request and
+ *        read a response with a Content-Length, so that it costs
+ *        much less CPU than the server it measures.
+ * @author Christian Grothoff
+ */
+
+#include "loadgen.h"
+#include <errno.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#if EPOLL_SUPPORT
+#include <sys/epoll.h>
+#endif
+#if LOADGEN_TLS
+#include <gnutls/gnutls.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/**
+ * Maximum size of the header of a response.
+ */
+#define LG_HEADER_MAX 4096
+
+/**
+ * Size of the buffer responses are read into.
+ */
+#define LG_READ_SIZE (64 * 1024)
+
+/**
+ * Maximum number of events handled per call to epoll_wait().
+ */
+#define LG_EVENTS 256
+
+
+/**
+ * States of a client connection.
+ */
+enum LgState
+{
+  LG_CLOSED = 0,
+  LG_CONNECTING,
+  LG_HANDSHAKE,
+  LG_SENDING,
+  LG_RECEIVING
+};
+
+
+/**
+ * A client connection.
+ */
+struct LgConn
+{
+  /**
+   * Socket, -1 if closed.
+   */
+  int fd;
+
+  /**
+   * What the connection is doing.
+   */
+  enum LgState state;
+
+  /**
+   * POLLIN and/or POLLOUT, whatever the connection waits for.
+   */
+  short events;
+
+  /**
+   * Non-zero if the server announced that it closes the connection.
+   */
+  int server_close;
+
+  /**
+   * Non-zero once the header of the response was received.
+   */
+  int headers_done;
+
+  /**
+   * Number of bytes of the request sent.
+   */
+  size_t sent;
+
+  /**
+   * Number of bytes in @e hdr.
+   */
+  size_t hdr_len;
+
+  /**
+   * Bytes of the body of the response still to receive.
+   */
+  uint64_t body_left;
+
+  /**
+   * When the current request started.
+   */
+  uint64_t start;
+
+#if LOADGEN_TLS
+  /**
+   * TLS session, NULL without TLS.
+   */
+  gnutls_session_t tls;
+#endif
+
+  /**
+   * Header of the response received so far.
+   */
+  char hdr[LG_HEADER_MAX];
+};
+
+
+/**
+ * State of a run of the load generator.
+ */
+struct Loadgen
+{
+  /**
+   * What to do.
+   */
+  const struct LoadgenConfig *cfg;
+
+  /**
+   * Where to store results.
+   */
+  struct LoadgenResult *res;
+
+  /**
+   * Array of cfg->connections connections.
+   */
+  struct LgConn *conns;
+
+  /**
+   * Address of the server.
+   */
+  struct sockaddr_in addr;
+
+  /**
+   * Number of connections in state #LG_CLOSED.
+   */
+  unsigned int closed;
+
+  /**
+   * Non-zero once no more requests should be made.
+   */
+  int stopping;
+
+  /**
+   * Number of bytes in @e request.
+   */
+  size_t request_len;
+
+  /**
+   * The request sent on every connection.
+   */
+  char request[1024];
+
+#if EPOLL_SUPPORT
+  /**
+   * epoll set of all connections.
+   */
+  int epfd;
+#else
+  /**
+   * Poll array, with the same index as @e conns.
+   */
+  struct pollfd *pfds;
+#endif
+
+#if LOADGEN_TLS
+  /**
+   * Client credentials (no certificate, server not verified).
+   */
+  gnutls_certificate_credentials_t xcred;
+
+  /**
+   * Session to resume, if cfg->tls_resume.
+   */
+  gnutls_datum_t session_data;
+#endif
+
+  /**
+   * Buffer to read responses into.
+   */
+  char buf[LG_READ_SIZE];
+};
+
+
+uint64_t
+loadgen_now (void)
+{
+  struct timespec ts;
+
+  if (0 != clock_gettime (CLOCK_MONOTONIC, &ts))
+    return 0;
+  return ((uint64_t) ts.tv_sec) * 1000000000LLU + ts.tv_nsec;
+}
+
+
+uint64_t
+loadgen_cpu_usec (int process)
+{
+  struct rusage ru;
+  int who;
+
+#ifdef RUSAGE_THREAD
+  who = process ? RUSAGE_SELF : RUSAGE_THREAD;
+#else
+  if (! process)
+    return 0;
+  who = RUSAGE_SELF;
+#endif
+  if (0 != getrusage (who, &ru))
+    return 0;
+  return ((uint64_t) ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000LLU
+    + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+
+/**
+ * Change what connection @a idx waits for.
+ *
+ * @param lg load generator
+ * @param idx index of the connection
+ * @param events POLLIN and/or POLLOUT, 0 for nothing
+ */
+static void
+watch (struct Loadgen *lg,
+       unsigned int idx,
+       short events)
+{
+  struct LgConn *c = &lg->conns[idx];
+#if EPOLL_SUPPORT
+  struct epoll_event ev;
+  int op;
+
+  if (events == c->events)
+    return;
+  if (0 == c->events)
+    op = EPOLL_CTL_ADD;
+  else if (0 == events)
+    op = EPOLL_CTL_DEL;
+  else
+    op = EPOLL_CTL_MOD;
+  ev.events = ((0 != (events & POLLIN)) ? EPOLLIN : 0)
+    | ((0 != (events & POLLOUT)) ? EPOLLOUT : 0);
+  ev.data.u32 = idx;
+  (void) epoll_ctl (lg->epfd, op, c->fd, &ev);
+#else
+  lg->pfds[idx].fd = (0 != events) ? c->fd : -1;
+  lg->pfds[idx].events = events;
+#endif
+  c->events = events;
+}
+
+
+/**
+ * Close connection @a idx.
+ *
+ * @param lg load generator
+ * @param idx index of the connection
+ * @param clean non-zero to end a TLS session properly (a session
+ *        that ends with an error cannot be resumed)
+ */
+static void
+conn_close (struct Loadgen *lg,
+            unsigned int idx,
+            int clean)
+{
+  struct LgConn *c = &lg->conns[idx];
+
+  if (LG_CLOSED == c->state)
+    return;
+  watch (lg, idx, 0);
+#if LOADGEN_TLS
+  if (NULL != c->tls)
+    {
+      if (clean)
+        (void) gnutls_bye (c->tls, GNUTLS_SHUT_WR);
+      gnutls_deinit (c->tls);
+      c->tls = NULL;
+    }
+#endif
+  (void) close (c->fd);
+  c->fd = -1;
+  c->state = LG_CLOSED;
+  lg->closed++;
+}
+
+
+/**
+ * Connection @a idx failed: count the error and close it.  It is
+ * opened again by the main loop.
+ *
+ * @param lg load generator
+ * @param idx index of the connection
+ */
+static void
+conn_fail (struct Loadgen *lg,
+           unsigned int idx)
+{
+  lg->res->errors++;
+  conn_close (lg, idx, 0);
+}
+
+
+/**
+ * Send (the rest of) the request on connection @a idx.
+ *
+ * @param lg load generator
+ * @param idx index of the connection
+ */
+static void
+do_send (struct Loadgen *lg,
+         unsigned int idx)
+{
+  struct LgConn *c = &lg->conns[idx];
+  ssize_t ret;
+
+  while (c->sent < lg->request_len)
+    {
+#if LOADGEN_TLS
+      if (NULL != c->tls)
+        {
+          ret = gnutls_record_send (c->tls,
+                                    &lg->request[c->sent],
+                                    lg->request_len - c->sent);
+          if ( (GNUTLS_E_AGAIN == ret) ||
+               (GNUTLS_E_INTERRUPTED == ret) )
+            {
+              watch (lg, idx, POLLOUT);
+              return;
+            }
+        }
+      else
+#endif
+        {
+          ret = send (c->fd,
+                      &lg->request[c->sent],
+                      lg->request_len - c->sent,
+                      MSG_NOSIGNAL);
+          if ( (0 > ret) &&
+               ( (EAGAIN == errno) ||
+                 (EWOULDBLOCK == errno) ||
+                 (EINTR == errno) ) )
+            {
+              watch (lg, idx, POLLOUT);
+              return;
+            }
+        }
+      if (0 >= ret)
+        {
+          conn_fail (lg, idx);
+          return;
+        }
+      c->sent += ret;
+    }
+  c->state = LG_RECEIVING;
+  c->headers_done = 0;
+  c->hdr_len = 0;
+  c->server_close = 0;
+  watch (lg, idx, POLLIN);
+}
+
+
+/**
+ * Start a session on the connected socket of connection @a idx.
+ *
+ * @param lg load generator
+ * @param idx index of the connection
+ */
+static void
+start_session (struct Loadgen *lg,
+               unsigned int idx);
+
+
+/**
+ * Open connection @a idx.
+ *
+ * @param lg load generator
+ * @param idx index of the connection
+ */
+static void
+conn_open (struct Loadgen *lg,
+           unsigned int idx)
+{
+  struct LgConn *c = &lg->conns[idx];
+  int fd;
+  int one = 1;
+
+  fd = socket (AF_INET, SOCK_STREAM, 0);
+  if (-1 == fd)
+    {
+      lg->res->errors++;
+      return;
+    }
+  if ( (0 != fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK)) ||
+       (0 != setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one))) )
+    {
+      (void) close (fd);
+      lg->res->errors++;
+      return;
+    }
+  if (! lg->cfg->keep_alive)
+    {
+      struct linger lin = { 1, 0 };
+
+      /* do not leave a TIME_WAIT socket behind for every request */
+      (void) setsockopt (fd, SOL_SOCKET, SO_LINGER, &lin, sizeof (lin));
+    }
+  c->fd = fd;
+  c->events = 0;
+  c->start = loadgen_now ();
+  c->sent = 0;
+  lg->closed--;
+  lg->res->connects++;
+  if (0 == connect (fd,
+                    (const struct sockaddr *) &lg->addr,
+                    sizeof (lg->addr)))
+    {
+      start_session (lg, idx);
+      return;
+    }
+  if (EINPROGRESS != errno)
+    {
+      c->state = LG_CONNECTING;
+      conn_fail (lg, idx);
+      return;
+    }
+  c->state = LG_CONNECTING;
+  watch (lg, idx, POLLOUT);
+}
+
+
+#if LOADGEN_TLS
+/**
+ * Continue the TLS handshake on connection @a idx.
+ *
+ * @param lg load generator
+ * @param idx index of the connection
+ */
+static void
+do_handshake (struct Loadgen *lg,
+              unsigned int idx)
+{
+  struct LgConn *c = &lg->conns[idx];
+  int ret;
+
+  ret = gnutls_handshake (c->tls);
+  if ( (GNUTLS_E_AGAIN == ret) ||
+       (GNUTLS_E_INTERRUPTED == ret) )
+    {
+      watch (lg, idx,
+             (0 != gnutls_record_get_direction (c->tls)) ? POLLOUT : POLLIN);
+      return;
+    }
+  if (GNUTLS_E_SUCCESS != ret)
+    {
+      conn_fail (lg, idx);
+      return;
+    }
+  if (0 != gnutls_session_is_resumed (c->tls))
+    lg->res->resumed++;
+  c->state = LG_SENDING;
+  do_send (lg, idx);
+}
+#endif
+
+
+static void
+start_session (struct Loadgen *lg,
+               unsigned int idx)
+{
+  struct LgConn *c = &lg->conns[idx];
+
+#if LOADGEN_TLS
+  if (lg->cfg->tls)
+    {
+      const char *prio = lg->cfg->tls_priorities;
+
+      if ( (GNUTLS_E_SUCCESS != gnutls_init (&c->tls, GNUTLS_CLIENT)) ||
+           (GNUTLS_E_SUCCESS !=
+            gnutls_priority_set_direct (c->tls,
+                                        (NULL != prio) ? prio : "NORMAL",
+                                        NULL)) ||
+           (GNUTLS_E_SUCCESS !=
+            gnutls_credentials_set (c->tls,
+                                    GNUTLS_CRD_CERTIFICATE,
+                                    lg->xcred)) )
+        {
+          conn_fail (lg, idx);
+          return;
+        }
+      gnutls_transport_set_int (c->tls, c->fd);
+      if ( (lg->cfg->tls_resume) &&
+           (NULL != lg->session_data.data) )
+        (void) gnutls_session_set_data (c->tls,
+                                        lg->session_data.data,
+                                        lg->session_data.size);
+      c->state = LG_HANDSHAKE;
+      do_handshake (lg, idx);
+      return;
+    }
+#endif
+  c->state = LG_SENDING;
+  do_send (lg, idx);
+}
+
+
+/**
+ * Remember the latency of a request.
+ *
+ * @param res results to add to
+ * @param ns latency in nanoseconds
+ */
+static void
+add_latency (struct LoadgenResult *res,
+             uint64_t ns)
+{
+  if (res->latency_len == res->latency_size)
+    {
+      size_t size = (0 == res->latency_size) ? 4096 : 2 * res->latency_size;
+      uint64_t *l = realloc (res->latency, size * sizeof (uint64_t));
+
+      if (NULL == l)
+        return;
+      res->latency = l;
+      res->latency_size = size;
+    }
+  res->latency[res->latency_len++] = ns;
+}
+
+
+/**
+ * The response on connection @a idx is complete.  Send the next
+ * request on it, or open a new connection.
+ *
+ * @param lg load generator
+ * @param idx index of the connection
+ */
+static void
+request_done (struct Loadgen *lg,
+              unsigned int idx)
+{
+  struct LgConn *c = &lg->conns[idx];
+  uint64_t now = loadgen_now ();
+
+  add_latency (lg->res, now - c->start);
+  lg->res->requests++;
+  if ( (0 != lg->cfg->max_requests) &&
+       (lg->res->requests >= lg->cfg->max_requests) )
+    lg->stopping = 1;
+#if LOADGEN_TLS
+  /* with TLS 1.3, the session ticket only arrives after the handshake */
+  if ( (NULL != c->tls) &&
+       (lg->cfg->tls_resume) &&
+       (0 == gnutls_session_is_resumed (c->tls)) )
+    {
+      gnutls_datum_t data;
+
+      if (GNUTLS_E_SUCCESS == gnutls_session_get_data2 (c->tls, &data))
+        {
+          if (NULL != lg->session_data.data)
+            gnutls_free (lg->session_data.data);
+          lg->session_data = data;
+        }
+    }
+#endif
+  if (lg->stopping)
+    {
+      conn_close (lg, idx, 1);
+      return;
+    }
+  if ( (lg->cfg->keep_alive) &&
+       (! c->server_close) )
+    {
+      c->start = now;
+      c->sent = 0;
+      c->state = LG_SENDING;
+      do_send (lg, idx);
+      return;
+    }
+  conn_close (lg, idx, 1);
+  conn_open (lg, idx);
+}
+
+
+/**
+ * The header of the response on connection @a idx is complete,
+ * check the status and get the length of the body.
+ *
+ * @param c connection
+ * @return 0 on success, -1 if the response cannot be handled
+ */
+static int
+parse_header (struct LgConn *c)
+{
+  const char *pos;
+  const char *end;
+  int have_length = 0;
+
+  if ( (c->hdr_len < 12) ||
+       (0 != strncmp (c->hdr, "HTTP/1.", 7)) ||
+       (0 != strncmp (&c->hdr[8], " 200", 4)) )
+    return -1;
+  pos = strstr (c->hdr, "\r\n");
+  while ( (NULL != pos) &&
+          (0 != strncmp (pos, "\r\n\r\n", 4)) )
+    {
+      pos += 2;
+      end = strstr (pos, "\r\n");
+      if (0 == strncasecmp (pos, "Content-Length:", 15))
+        {
+          c->body_left = strtoull (pos + 15, NULL, 10);
+          have_length = 1;
+        }
+      else if ( (0 == strncasecmp (pos, "Connection:", 11)) &&
+                (NULL != end) &&
+                (end - pos > 16) &&
+                (0 == strncasecmp (end - 5, "close", 5)) )
+        c->server_close = 1;
+      pos = end;
+    }
+  return have_length ? 0 : -1;
+}
+
+
+/**
+ * Receive (more of) the response on connection @a idx.
+ *
+ * @param lg load generator
+ * @param idx index of the connection
+ */
+static void
+do_recv (struct Loadgen *lg,
+         unsigned int idx)
+{
+  struct LgConn *c = &lg->conns[idx];
+  ssize_t got;
+  size_t off;
+  size_t body;
+  size_t scan;
+  char *eoh;
+
+  while (LG_RECEIVING == c->state)
+    {
+#if LOADGEN_TLS
+      if (NULL != c->tls)
+        {
+          got = gnutls_record_recv (c->tls, lg->buf, sizeof (lg->buf));
+          if ( (GNUTLS_E_AGAIN == got) ||
+               (GNUTLS_E_INTERRUPTED == got) )
+            return;
+        }
+      else
+#endif
+        {
+          got = recv (c->fd, lg->buf, sizeof (lg->buf), 0);
+          if ( (0 > got) &&
+               ( (EAGAIN == errno) ||
+                 (EWOULDBLOCK == errno) ||
+                 (EINTR == errno) ) )
+            return;
+        }
+      if (0 >= got)
+        {
+          conn_fail (lg, idx);
+          return;
+        }
+      off = 0;
+      if (! c->headers_done)
+        {
+          scan = (c->hdr_len > 3) ? c->hdr_len - 3 : 0;
+          off = (size_t) got;
+          if (off > sizeof (c->hdr) - 1 - c->hdr_len)
+            off = sizeof (c->hdr) - 1 - c->hdr_len;
+          memcpy (&c->hdr[c->hdr_len], lg->buf, off);
+          c->hdr_len += off;
+          c->hdr[c->hdr_len] = '\0';
+          eoh = strstr (&c->hdr[scan], "\r\n\r\n");
+          if (NULL == eoh)
+            {
+              if (c->hdr_len == sizeof (c->hdr) - 1)
+                conn_fail (lg, idx);
+              continue;
+            }
+          /* hand the bytes after the header back to the body */
+          off -= c->hdr_len - (eoh + 4 - c->hdr);
+          c->hdr_len = eoh + 4 - c->hdr;
+          c->hdr[c->hdr_len] = '\0';
+          c->headers_done = 1;
+          if (0 != parse_header (c))
+            {
+              conn_fail (lg, idx);
+              return;
+            }
+        }
+      body = (size_t) got - off;
+      if (body > c->body_left)
+        {
+          /* more data than we asked for */
+          conn_fail (lg, idx);
+          return;
+        }
+      c->body_left -= body;
+      lg->res->bytes += body;
+      if (0 == c->body_left)
+        request_done (lg, idx);
+    }
+}
+
+
+/**
+ * Handle readiness of connection @a idx.
+ *
+ * @param lg load generator
+ * @param idx index of the connection
+ */
+static void
+dispatch (struct Loadgen *lg,
+          unsigned int idx)
+{
+  struct LgConn *c = &lg->conns[idx];
+  int err;
+  socklen_t len;
+
+  switch (c->state)
+    {
+    case LG_CLOSED:
+      break;
+    case LG_CONNECTING:
+      len = sizeof (err);
+      if ( (0 != getsockopt (c->fd, SOL_SOCKET, SO_ERROR, &err, &len)) ||
+           (0 != err) )
+        {
+          conn_fail (lg, idx);
+          break;
+        }
+      start_session (lg, idx);
+      break;
+    case LG_HANDSHAKE:
+#if LOADGEN_TLS
+      do_handshake (lg, idx);
+#endif
+      break;
+    case LG_SENDING:
+      do_send (lg, idx);
+      break;
+    case LG_RECEIVING:
+      do_recv (lg, idx);
+      break;
+    }
+}
+
+
+/**
+ * Compare two latencies for qsort().
+ *
+ * @param a first latency
+ * @param b second latency
+ * @return -1, 0 or 1
+ */
+static int
+cmp_latency (const void *a,
+             const void *b)
+{
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+
+  return (x < y) ? -1 : (x > y);
+}
+
+
+int
+loadgen_raise_fd_limit (unsigned int need)
+{
+  struct rlimit rl;
+
+  if (0 != getrlimit (RLIMIT_NOFILE, &rl))
+    return -1;
+  if (rl.rlim_cur >= need)
+    return 0;
+  rl.rlim_cur = (rl.rlim_max > need) ? need : rl.rlim_max;
+  if ( (0 != setrlimit (RLIMIT_NOFILE, &rl)) ||
+       (rl.rlim_cur < need) )
+    return -1;
+  return 0;
+}
+
+
+int
+loadgen_run (const struct LoadgenConfig *cfg,
+             struct LoadgenResult *res)
+{
+  struct Loadgen *lg;
+  uint64_t start;
+  uint64_t deadline;
+  uint64_t now;
+  uint64_t cpu;
+  unsigned int i;
+  int n;
+  int ret = -1;
+#if EPOLL_SUPPORT
+  struct epoll_event events[LG_EVENTS];
+#endif
+
+  memset (res, 0, sizeof (*res));
+#if ! LOADGEN_TLS
+  if (cfg->tls)
+    return -1;
+#endif
+  if (0 == cfg->connections)
+    return -1;
+  lg = calloc (1, sizeof (struct Loadgen));
+  if (NULL == lg)
+    return -1;
+  lg->cfg = cfg;
+  lg->res = res;
+  lg->addr.sin_family = AF_INET;
+  lg->addr.sin_port = htons (cfg->port);
+  lg->addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  lg->request_len = snprintf (lg->request,
+                              sizeof (lg->request),
+                              "GET %s HTTP/1.1\r\n"
+                              "Host: 127.0.0.1\r\n"
+                              "%s"
+                              "\r\n",
+                              cfg->path,
+                              cfg->keep_alive ? "" : "Connection: close\r\n");
+  if (lg->request_len >= sizeof (lg->request))
+    goto cleanup;
+  (void) loadgen_raise_fd_limit (cfg->connections + 64);
+  lg->conns = calloc (cfg->connections, sizeof (struct LgConn));
+  if (NULL == lg->conns)
+    goto cleanup;
+#if EPOLL_SUPPORT
+  lg->epfd = epoll_create1 (EPOLL_CLOEXEC);
+  if (-1 == lg->epfd)
+    goto cleanup;
+#else
+  lg->pfds = calloc (cfg->connections, sizeof (struct pollfd));
+  if (NULL == lg->pfds)
+    goto cleanup;
+  for (i = 0; i < cfg->connections; i++)
+    lg->pfds[i].fd = -1;
+#endif
+#if LOADGEN_TLS
+  if (cfg->tls)
+    {
+      gnutls_global_init ();
+      gnutls_certificate_allocate_credentials (&lg->xcred);
+    }
+#endif
+  for (i = 0; i < cfg->connections; i++)
+    lg->conns[i].fd = -1;
+  lg->closed = cfg->connections;
+
+  cpu = loadgen_cpu_usec (0);
+  start = loadgen_now ();
+  deadline = start + cfg->duration_ms * 1000000LLU;
+  now = start;
+  for (i = 0; i < cfg->connections; i++)
+    conn_open (lg, i);
+  while ( (! lg->stopping) &&
+          (now < deadline) )
+    {
+      int timeout = (int) ((deadline - now) / 1000000LLU) + 1;
+
+      if (0 != lg->closed)
+        {
+          /* open connections that failed again; do not spin on a
+             server that refuses them */
+          for (i = 0; i < cfg->connections; i++)
+            if (LG_CLOSED == lg->conns[i].state)
+              conn_open (lg, i);
+          if (0 != lg->closed)
+            timeout = 1;
+        }
+#if EPOLL_SUPPORT
+      n = epoll_wait (lg->epfd, events, LG_EVENTS, timeout);
+      for (i = 0; (int) i < n; i++)
+        dispatch (lg, events[i].data.u32);
+#else
+      n = poll (lg->pfds, cfg->connections, timeout);
+      for (i = 0; (n > 0) && (i < cfg->connections); i++)
+        {
+          if (0 == lg->pfds[i].revents)
+            continue;
+          n--;
+          lg->pfds[i].revents = 0;
+          dispatch (lg, i);
+        }
+#endif
+      now = loadgen_now ();
+    }
+  res->elapsed_ns = now - start;
+  res->cpu_usec = loadgen_cpu_usec (0) - cpu;
+  if (0 != res->latency_len)
+    qsort (res->latency, res->latency_len, sizeof (uint64_t), &cmp_latency);
+  ret = 0;
+
+ cleanup:
+  if (NULL != lg->conns)
+    {
+      for (i = 0; i < cfg->connections; i++)
+        conn_close (lg, i, 0);
+      free (lg->conns);
+    }
+#if EPOLL_SUPPORT
+  if (0 < lg->epfd)
+    (void) close (lg->epfd);
+#else
+  free (lg->pfds);
+#endif
+#if LOADGEN_TLS
+  if (cfg->tls)
+    {
+      if (NULL != lg->session_data.data)
+        gnutls_free (lg->session_data.data);
+      gnutls_certificate_free_credentials (lg->xcred);
+      gnutls_global_deinit ();
+    }
+#endif
+  free (lg);
+  return ret;
+}
+
+
+uint64_t
+loadgen_percentile (const struct LoadgenResult *res,
+                    double p)
+{
+  size_t idx;
+
+  if (0 == res->latency_len)
+    return 0;
+  idx = (size_t) (p / 100.0 * (res->latency_len - 1) + 0.5);
+  if (idx >= res->latency_len)
+    idx = res->latency_len - 1;
+  return res->latency[idx];
+}
+
+
+void
+loadgen_free (struct LoadgenResult *res)
+{
+  free (res->latency);
+  res->latency = NULL;
+  res->latency_len = 0;
+  res->latency_size = 0;
+}
@@ -0,0 +1,225 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file loadgen.h
+ * @brief HTTP load generator for the benchmarks: many non-blocking
+ *        client connections driven by one epoll (or poll) loop
+ * @author Christian Grothoff
+ */
+
+#ifndef LOADGEN_H
+#define LOADGEN_H
+
+#include "MHD_config.h"
+#include "platform.h"
+#include <stdint.h>
+
+/**
+ * Does the load generator support HTTPS?  Its client uses GnuTLS,
+ * also if MHD uses OpenSSL.
+ */
+#if HTTPS_SUPPORT && ! LOADGEN_NO_TLS
+#define LOADGEN_TLS 1
+#else
+#define LOADGEN_TLS 0
+#endif
+
+/**
+ * What the load generator does.
+ */
+struct LoadgenConfig
+{
+  /**
+   * Port of the server on 127.0.0.1.
+   */
+  uint16_t port;
+
+  /**
+   * Number of concurrent client connections.
+   */
+  unsigned int connections;
+
+  /**
+   * Path to request.
+   */
+  const char *path;
+
+  /**
+   * Non-zero to send all requests of a connection over one
+   * keep-alive connection, zero to ask for "Connection: close" and
+   * connect again for every request.
+   */
+  int keep_alive;
+
+  /**
+   * How long to generate load, in milliseconds.
+   */
+  unsigned int duration_ms;
+
+  /**
+   * Stop after this many requests (0 for no limit).
+   */
+  uint64_t max_requests;
+
+  /**
+   * Non-zero to speak TLS (only if built with HTTPS support).
+   */
+  int tls;
+
+  /**
+   * TLS priority string for the client, NULL for "NORMAL".
+   */
+  const char *tls_priorities;
+
+  /**
+   * Non-zero to resume the TLS session of the previous connection
+   * when connecting again.
+   */
+  int tls_resume;
+};
+
+
+/**
+ * What the load generator measured.
+ */
+struct LoadgenResult
+{
+  /**
+   * Number of complete responses with status 200.
+   */
+  uint64_t requests;
+
+  /**
+   * Number of failed connections or requests.
+   */
+  uint64_t errors;
+
+  /**
+   * Number of connections opened.
+   */
+  uint64_t connects;
+
+  /**
+   * Number of TLS sessions that were resumed.
+   */
+  uint64_t resumed;
+
+  /**
+   * Number of response body bytes received.
+   */
+  uint64_t bytes;
+
+  /**
+   * Time the load was generated for, in nanoseconds.
+   */
+  uint64_t elapsed_ns;
+
+  /**
+   * CPU time (user and system) used by the load generator itself,
+   * in microseconds, or 0 if the platform cannot tell.
+   */
+  uint64_t cpu_usec;
+
+  /**
+   * Latency of each request in nanoseconds, from sending the
+   * request (or connecting, if the request opened a connection)
+   * to receiving the end of the response.  Sorted by
+   * #loadgen_run().
+   */
+  uint64_t *latency;
+
+  /**
+   * Number of entries in @e latency.
+   */
+  size_t latency_len;
+
+  /**
+   * Allocated length of @e latency.
+   */
+  size_t latency_size;
+};
+
+
+/**
+ * Generate load as described by @a cfg.  Blocks until the duration
+ * elapsed or the maximum number of requests was done.
+ *
+ * @param cfg what to do
+ * @param res where to store the results, free with #loadgen_free()
+ * @return 0 on success, -1 if the load generator could not run
+ */
+int
+loadgen_run (const struct LoadgenConfig *cfg,
+             struct LoadgenResult *res);
+
+
+/**
+ * Get a latency percentile from @a res.
+ *
+ * @param res results of #loadgen_run()
+ * @param p percentile, from 0 to 100
+ * @return latency in nanoseconds
+ */
+uint64_t
+loadgen_percentile (const struct LoadgenResult *res,
+                    double p);
+
+
+/**
+ * Release the memory of @a res.
+ *
+ * @param res results of #loadgen_run()
+ */
+void
+loadgen_free (struct LoadgenResult *res);
+
+
+/**
+ * Get the current time of the monotonic clock.
+ *
+ * @return time in nanoseconds
+ */
+uint64_t
+loadgen_now (void);
+
+
+/**
+ * Get the CPU time used by the calling thread, or by the whole
+ * process if @a process is non-zero.
+ *
+ * @param process non-zero for the whole process
+ * @return user and system time in microseconds, 0 if unknown
+ */
+uint64_t
+loadgen_cpu_usec (int process);
+
+
+/**
+ * Raise the limit on open file descriptors of the process to @a need,
+ * as far as the hard limit allows.
+ *
+ * @param need number of descriptors needed
+ * @return 0 if @a need descriptors can be opened, -1 if not
+ */
+int
+loadgen_raise_fd_limit (unsigned int need);
+
+#endif
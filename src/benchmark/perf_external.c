@@ -0,0 +1,821 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file perf_external.c
+ * @brief benchmark what it costs to drive MHD from an external event
+ *        loop.  For each way of integrating MHD into the event loop
+ *        of an application (MHD_get_fdset2() with select(), the epoll
+ *        descriptor of MHD_USE_EPOLL_LINUX_ONLY, and
+ *        MHD_OPTION_NOTIFY_SOCKET) and number N, opens N idle
+ *        keep-alive connections, makes requests on one active
+ *        connection next to them and measures the time each
+ *        iteration of the application's loop spends building the
+ *        fd sets, computing the timeout, waiting and dispatching
+ *        (see fileserver_example_external_select.c).  Results are
+ *        written to stdout as JSON.
+ * @author Christian Grothoff
+ */
+
+#include "loadgen.h"
+#include <microhttpd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#if EPOLL_SUPPORT
+#include <sys/epoll.h>
+#endif
+
+/**
+ * Number of client addresses; connections are spread over
+ * 127.0.0.1 to 127.0.0.ADDRESSES so that there are enough ports.
+ */
+#define ADDRESSES 96
+
+/**
+ * Number of connections opened per client address.
+ */
+#define PER_ADDRESS 25000
+
+/**
+ * Longest the application's loop waits, in milliseconds, so that it
+ * notices when it is to stop.
+ */
+#define MAX_WAIT_MS 100
+
+/**
+ * Number of loop iterations whose overhead is kept for the
+ * percentiles.
+ */
+#define MAX_SAMPLES (1024 * 1024)
+
+/**
+ * Number of events taken from the application's epoll at once.
+ */
+#define MAX_EVENTS 256
+
+/**
+ * Body of all responses.
+ */
+#define BODY "ok"
+
+
+/**
+ * How the application's event loop learns about the sockets of MHD.
+ */
+enum Integration
+{
+  /**
+   * MHD_get_fdset2(), MHD_get_timeout(), select() and
+   * MHD_run_from_select() in every iteration.
+   */
+  INTEGRATION_FDSET,
+
+  /**
+   * MHD_OPTION_NOTIFY_SOCKET: MHD registers its sockets with the
+   * epoll of the application, which calls MHD_run_socket().
+   */
+  INTEGRATION_NOTIFY
+};
+
+
+/**
+ * An integration to benchmark.
+ */
+struct Mode
+{
+  /**
+   * Name in the results.
+   */
+  const char *name;
+
+  /**
+   * Flags for MHD_start_daemon().
+   */
+  unsigned int flags;
+
+  /**
+   * How the loop drives MHD.
+   */
+  enum Integration integration;
+};
+
+
+/**
+ * Integrations to benchmark.
+ */
+static const struct Mode modes[] = {
+  /* sets beyond FD_SETSIZE, as the application would need them */
+  { "select", MHD_USE_LARGE_FD_SETS, INTEGRATION_FDSET },
+#if EPOLL_SUPPORT
+  /* the fd sets only hold the epoll descriptor of MHD */
+  { "epoll", MHD_USE_EPOLL_LINUX_ONLY, INTEGRATION_FDSET },
+  /* MHD_USE_POLL only lifts the FD_SETSIZE limit here, as the
+     application waits for the sockets */
+  { "notify_epoll", MHD_USE_POLL, INTEGRATION_NOTIFY },
+#endif
+  { NULL, 0, INTEGRATION_FDSET }
+};
+
+
+/**
+ * Options given on the command line.
+ */
+static struct
+{
+  unsigned int max_connections;
+  unsigned int probe_ms;
+  uint16_t port;
+  const char *filter;
+} opt = { 100000, 1000, 1300, NULL };
+
+
+/**
+ * What the application's loop measured.  Times are in nanoseconds.
+ */
+struct TickStats
+{
+  /**
+   * Number of iterations of the loop.
+   */
+  uint64_t ticks;
+
+  /**
+   * Number of iterations in which sockets were ready.
+   */
+  uint64_t busy_ticks;
+
+  /**
+   * Time spent clearing and filling the fd sets.
+   */
+  uint64_t fdset_ns;
+
+  /**
+   * Time spent in MHD_get_timeout().
+   */
+  uint64_t timeout_ns;
+
+  /**
+   * Time spent waiting in select() or epoll_wait().
+   */
+  uint64_t wait_ns;
+
+  /**
+   * Time spent in MHD_run_from_select() or MHD_run_socket().
+   */
+  uint64_t dispatch_ns;
+
+  /**
+   * Number of calls of the #MHD_NotifySocketCallback.
+   */
+  uint64_t notifications;
+
+  /**
+   * Time spent in the #MHD_NotifySocketCallback, part of
+   * @e dispatch_ns.
+   */
+  uint64_t notify_ns;
+
+  /**
+   * Overhead (everything but the wait) of the first #MAX_SAMPLES
+   * iterations.
+   */
+  uint32_t *samples;
+
+  /**
+   * Number of entries in @e samples.
+   */
+  unsigned int num_samples;
+};
+
+
+/**
+ * Response to all requests.
+ */
+static struct MHD_Response *response;
+
+/**
+ * Daemon of the current run.
+ */
+static struct MHD_Daemon *mhd;
+
+/**
+ * Integration of the current run.
+ */
+static const struct Mode *mode;
+
+/**
+ * Set to stop the application's loop.
+ */
+static volatile int stop;
+
+/**
+ * Protects @e stats.
+ */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Measurements of the application's loop since the last reset.
+ */
+static struct TickStats stats;
+
+/**
+ * Fd sets of the application, arrays of `fd_set`s for sockets
+ * beyond FD_SETSIZE (see #MHD_USE_LARGE_FD_SETS).
+ */
+static fd_set *rs;
+static fd_set *ws;
+static fd_set *es;
+
+/**
+ * Number of `fd_set`s in each of @e rs, @e ws and @e es.
+ */
+static unsigned int num_sets;
+
+#if EPOLL_SUPPORT
+/**
+ * Epoll of the application for #INTEGRATION_NOTIFY.
+ */
+static int epfd = -1;
+
+/**
+ * Events returned by the last epoll_wait(), their handles are
+ * cleared when MHD removes a socket while they are dispatched.
+ */
+static struct epoll_event events[MAX_EVENTS];
+
+/**
+ * Number of entries in @e events.
+ */
+static int num_events;
+
+/**
+ * Time spent in notify_cb(), only written by the loop.
+ */
+static uint64_t notify_ns;
+
+/**
+ * Number of calls of notify_cb(), only written by the loop.
+ */
+static uint64_t notifications;
+
+
+/**
+ * Register a socket of MHD with the application's epoll.
+ */
+static void
+notify_cb (void *cls,
+           MHD_socket sock,
+           unsigned int interest,
+           void *handle,
+           void **sock_cls)
+{
+  static int registered;
+  struct epoll_event ev;
+  uint64_t start = loadgen_now ();
+  int i;
+
+  memset (&ev, 0, sizeof (ev));
+  if (0 != (interest & MHD_SOCKET_INTEREST_READ))
+    ev.events |= EPOLLIN;
+  if (0 != (interest & MHD_SOCKET_INTEREST_WRITE))
+    ev.events |= EPOLLOUT;
+  ev.data.ptr = handle;
+  if (MHD_SOCKET_INTEREST_REMOVE == interest)
+    {
+      if (NULL != *sock_cls)
+        (void) epoll_ctl (epfd, EPOLL_CTL_DEL, sock, NULL);
+      /* the handle may be gone before its event is dispatched */
+      for (i = 0; i < num_events; i++)
+        if (handle == events[i].data.ptr)
+          events[i].data.ptr = NULL;
+    }
+  else if (NULL == *sock_cls)
+    {
+      if (0 == epoll_ctl (epfd, EPOLL_CTL_ADD, sock, &ev))
+        *sock_cls = &registered;
+    }
+  else
+    {
+      (void) epoll_ctl (epfd, EPOLL_CTL_MOD, sock, &ev);
+    }
+  notifications++;
+  notify_ns += loadgen_now () - start;
+}
+#endif
+
+
+static int
+ahc_ok (void *cls,
+        struct MHD_Connection *connection,
+        const char *url,
+        const char *method,
+        const char *version,
+        const char *upload_data, size_t *upload_data_size,
+        void **ptr)
+{
+  return MHD_queue_response (connection, MHD_HTTP_OK, response);
+}
+
+
+/**
+ * Run one iteration of the application's loop with the fd sets of
+ * MHD.
+ *
+ * @param t where to add the measurements
+ */
+static void
+tick_fdset (struct TickStats *t)
+{
+  MHD_UNSIGNED_LONG_LONG timeout;
+  MHD_socket max_fd = -1;
+  struct timeval tv;
+  uint64_t t0;
+  uint64_t t1;
+  uint64_t t2;
+  uint64_t t3;
+  uint64_t t4;
+  int ready;
+
+  t0 = loadgen_now ();
+  memset (rs, 0, num_sets * sizeof (fd_set));
+  memset (ws, 0, num_sets * sizeof (fd_set));
+  memset (es, 0, num_sets * sizeof (fd_set));
+  if (MHD_YES != MHD_get_fdset2 (mhd, rs, ws, es, &max_fd,
+                                 num_sets * FD_SETSIZE))
+    abort ();
+  t1 = loadgen_now ();
+  if ( (MHD_YES != MHD_get_timeout (mhd, &timeout)) ||
+       (timeout > MAX_WAIT_MS) )
+    timeout = MAX_WAIT_MS;
+  t2 = loadgen_now ();
+  tv.tv_sec = 0;
+  tv.tv_usec = timeout * 1000;
+  ready = select (max_fd + 1, rs, ws, es, &tv);
+  if ( (-1 == ready) &&
+       (EINTR != errno) )
+    abort ();
+  t3 = loadgen_now ();
+  MHD_run_from_select (mhd, rs, ws, es);
+  t4 = loadgen_now ();
+  t->fdset_ns += t1 - t0;
+  t->timeout_ns += t2 - t1;
+  t->wait_ns += t3 - t2;
+  t->dispatch_ns += t4 - t3;
+  if (0 < ready)
+    t->busy_ticks++;
+}
+
+
+#if EPOLL_SUPPORT
+/**
+ * Run one iteration of the application's loop with its epoll, in
+ * which MHD registered its sockets.
+ *
+ * @param t where to add the measurements
+ */
+static void
+tick_notify (struct TickStats *t)
+{
+  MHD_UNSIGNED_LONG_LONG timeout;
+  unsigned int ready;
+  uint64_t t1;
+  uint64_t t2;
+  uint64_t t3;
+  uint64_t t4;
+  int n;
+  int i;
+
+  t1 = loadgen_now ();
+  if ( (MHD_YES != MHD_get_timeout (mhd, &timeout)) ||
+       (timeout > MAX_WAIT_MS) )
+    timeout = MAX_WAIT_MS;
+  t2 = loadgen_now ();
+  n = epoll_wait (epfd, events, MAX_EVENTS, (int) timeout);
+  if ( (-1 == n) &&
+       (EINTR != errno) )
+    abort ();
+  t3 = loadgen_now ();
+  notifications = 0;
+  notify_ns = 0;
+  num_events = (0 < n) ? n : 0;
+  for (i = 0; i < num_events; i++)
+    {
+      if (NULL == events[i].data.ptr)
+        continue;
+      ready = 0;
+      if (0 != (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+        ready |= MHD_SOCKET_INTEREST_READ;
+      if (0 != (events[i].events & (EPOLLOUT | EPOLLERR)))
+        ready |= MHD_SOCKET_INTEREST_WRITE;
+      MHD_run_socket (mhd, events[i].data.ptr, ready);
+    }
+  num_events = 0;
+  if (0 == n)
+    MHD_run_socket (mhd, NULL, 0);
+  t4 = loadgen_now ();
+  t->timeout_ns += t2 - t1;
+  t->wait_ns += t3 - t2;
+  t->dispatch_ns += t4 - t3;
+  t->notifications += notifications;
+  t->notify_ns += notify_ns;
+  if (0 < n)
+    t->busy_ticks++;
+}
+#endif
+
+
+/**
+ * The application's event loop.
+ *
+ * @param cls unused
+ * @return NULL
+ */
+static void *
+loop (void *cls)
+{
+  struct TickStats t;
+  uint64_t overhead;
+
+  while (! stop)
+    {
+      memset (&t, 0, sizeof (t));
+#if EPOLL_SUPPORT
+      if (INTEGRATION_NOTIFY == mode->integration)
+        tick_notify (&t);
+      else
+#endif
+        tick_fdset (&t);
+      overhead = t.fdset_ns + t.timeout_ns + t.dispatch_ns;
+      pthread_mutex_lock (&lock);
+      stats.ticks++;
+      stats.busy_ticks += t.busy_ticks;
+      stats.fdset_ns += t.fdset_ns;
+      stats.timeout_ns += t.timeout_ns;
+      stats.wait_ns += t.wait_ns;
+      stats.dispatch_ns += t.dispatch_ns;
+      stats.notifications += t.notifications;
+      stats.notify_ns += t.notify_ns;
+      if (stats.num_samples < MAX_SAMPLES)
+        stats.samples[stats.num_samples++]
+          = (overhead > UINT32_MAX) ? UINT32_MAX : (uint32_t) overhead;
+      pthread_mutex_unlock (&lock);
+    }
+  return NULL;
+}
+
+
+/**
+ * Open client connection number @a i and send a request on it.
+ *
+ * @param i number of the connection
+ * @return the socket, -1 on error
+ */
+static int
+open_client (unsigned int i)
+{
+  static const char req[] = "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+  struct sockaddr_in addr;
+  int fd;
+
+  fd = socket (AF_INET, SOCK_STREAM, 0);
+  if (-1 == fd)
+    return -1;
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK + i / PER_ADDRESS);
+  if (0 != bind (fd, (struct sockaddr *) &addr, sizeof (addr)))
+    {
+      (void) close (fd);
+      return -1;
+    }
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  addr.sin_port = htons (opt.port);
+  if ( (0 != connect (fd, (struct sockaddr *) &addr, sizeof (addr))) ||
+       (sizeof (req) - 1 != (size_t) write (fd, req, sizeof (req) - 1)) )
+    {
+      (void) close (fd);
+      return -1;
+    }
+  return fd;
+}
+
+
+/**
+ * Read a response from @a fd (blocking).
+ *
+ * @param fd socket
+ * @return 0 on success, -1 on error
+ */
+static int
+read_response (int fd)
+{
+  char buf[1024];
+  size_t have = 0;
+  ssize_t got;
+
+  while (have < sizeof (buf) - 1)
+    {
+      got = read (fd, &buf[have], sizeof (buf) - 1 - have);
+      if (0 >= got)
+        return -1;
+      have += got;
+      buf[have] = '\0';
+      if (NULL != strstr (buf, "\r\n\r\n" BODY))
+        return 0;
+    }
+  return -1;
+}
+
+
+/**
+ * Compare two samples for qsort().
+ */
+static int
+cmp_u32 (const void *a,
+         const void *b)
+{
+  uint32_t x = *(const uint32_t *) a;
+  uint32_t y = *(const uint32_t *) b;
+
+  return (x < y) ? -1 : (x > y);
+}
+
+
+/**
+ * Make requests on one active connection for opt.probe_ms and print
+ * their latency and what the application's loop spent per iteration
+ * meanwhile.
+ *
+ * @param n number of idle connections
+ */
+static void
+probe (unsigned int n)
+{
+  struct LoadgenConfig cfg;
+  struct LoadgenResult res;
+  struct TickStats t;
+  double ticks;
+
+  pthread_mutex_lock (&lock);
+  stats.ticks = 0;
+  stats.busy_ticks = 0;
+  stats.fdset_ns = 0;
+  stats.timeout_ns = 0;
+  stats.wait_ns = 0;
+  stats.dispatch_ns = 0;
+  stats.notifications = 0;
+  stats.notify_ns = 0;
+  stats.num_samples = 0;
+  pthread_mutex_unlock (&lock);
+  memset (&cfg, 0, sizeof (cfg));
+  cfg.port = opt.port;
+  cfg.connections = 1;
+  cfg.path = "/";
+  cfg.keep_alive = 1;
+  cfg.duration_ms = opt.probe_ms;
+  if (0 != loadgen_run (&cfg, &res))
+    {
+      printf (",\n     \"probe\": null");
+      return;
+    }
+  pthread_mutex_lock (&lock);
+  t = stats;
+  qsort (t.samples, t.num_samples, sizeof (uint32_t), &cmp_u32);
+  ticks = (0 != t.ticks) ? (double) t.ticks : 1.0;
+  printf (",\n     \"probe\": {\"requests\": %llu, \"errors\": %llu,"
+          " \"p50_us\": %.1f, \"p99_us\": %.1f},\n"
+          "     \"ticks\": %llu, \"busy_ticks\": %llu,"
+          " \"ticks_per_request\": %.2f,\n"
+          "     \"us_per_tick\": {\"fdset\": %.2f, \"timeout\": %.2f,"
+          " \"dispatch\": %.2f, \"wait\": %.2f},\n"
+          "     \"overhead_us\": {\"p50\": %.2f, \"p99\": %.2f, \"max\": %.2f},\n"
+          "     \"fdset_ns_per_connection\": %.2f,"
+          " \"notifications_per_tick\": %.2f, \"notify_us_per_tick\": %.2f}",
+          (unsigned long long) res.requests,
+          (unsigned long long) res.errors,
+          loadgen_percentile (&res, 50) / 1000.0,
+          loadgen_percentile (&res, 99) / 1000.0,
+          (unsigned long long) t.ticks,
+          (unsigned long long) t.busy_ticks,
+          (0 != res.requests) ? (double) t.ticks / res.requests : 0.0,
+          t.fdset_ns / ticks / 1000.0,
+          t.timeout_ns / ticks / 1000.0,
+          t.dispatch_ns / ticks / 1000.0,
+          t.wait_ns / ticks / 1000.0,
+          (0 != t.num_samples) ? t.samples[t.num_samples / 2] / 1000.0 : 0.0,
+          (0 != t.num_samples)
+          ? t.samples[((uint64_t) t.num_samples * 99) / 100] / 1000.0 : 0.0,
+          (0 != t.num_samples) ? t.samples[t.num_samples - 1] / 1000.0 : 0.0,
+          t.fdset_ns / ticks / n,
+          t.notifications / ticks,
+          t.notify_ns / ticks / 1000.0);
+  pthread_mutex_unlock (&lock);
+  loadgen_free (&res);
+}
+
+
+/**
+ * Run the benchmark for one integration and number of connections
+ * and print its result.
+ *
+ * @param m integration
+ * @param n number of idle connections
+ * @param first non-zero if this is the first result printed
+ * @return 0 if the result was printed
+ */
+static int
+run (const struct Mode *m,
+     unsigned int n,
+     int first)
+{
+  pthread_t thread;
+  char name[128];
+  int *fds;
+  uint64_t start;
+  double open_idle;
+  unsigned int i;
+  unsigned int opened = 0;
+  int ret = -1;
+
+  snprintf (name, sizeof (name), "%s/%u", m->name, n);
+  if ( (NULL != opt.filter) &&
+       (NULL == strstr (name, opt.filter)) )
+    return -1;
+  if ( (n > ADDRESSES * PER_ADDRESS) ||
+       (0 != loadgen_raise_fd_limit (2 * n + 256)) )
+    {
+      fprintf (stderr, "%s: cannot open enough descriptors\n", name);
+      return -1;
+    }
+  /* client and server sockets are in one process */
+  num_sets = (2 * n + 256) / FD_SETSIZE + 1;
+  fds = malloc (n * sizeof (int));
+  rs = malloc (num_sets * sizeof (fd_set));
+  ws = malloc (num_sets * sizeof (fd_set));
+  es = malloc (num_sets * sizeof (fd_set));
+  if ( (NULL == fds) || (NULL == rs) || (NULL == ws) || (NULL == es) )
+    goto out;
+  mode = m;
+#if EPOLL_SUPPORT
+  if (INTEGRATION_NOTIFY == m->integration)
+    {
+      epfd = epoll_create1 (EPOLL_CLOEXEC);
+      if (-1 == epfd)
+        goto out;
+    }
+#endif
+#if EPOLL_SUPPORT
+  if (INTEGRATION_NOTIFY == m->integration)
+    mhd = MHD_start_daemon (m->flags | MHD_SUPPRESS_DATE_NO_CLOCK,
+                            opt.port,
+                            NULL, NULL, &ahc_ok, NULL,
+                            MHD_OPTION_CONNECTION_LIMIT, n + 16,
+                            MHD_OPTION_LISTEN_BACKLOG_SIZE,
+                            (unsigned int) 1024,
+                            MHD_OPTION_NOTIFY_SOCKET, &notify_cb, NULL,
+                            MHD_OPTION_END);
+  else
+#endif
+    mhd = MHD_start_daemon (m->flags | MHD_SUPPRESS_DATE_NO_CLOCK,
+                            opt.port,
+                            NULL, NULL, &ahc_ok, NULL,
+                            MHD_OPTION_CONNECTION_LIMIT, n + 16,
+                            MHD_OPTION_LISTEN_BACKLOG_SIZE,
+                            (unsigned int) 1024,
+                            MHD_OPTION_END);
+  if (NULL == mhd)
+    {
+      fprintf (stderr, "%s: failed to start daemon\n", name);
+      goto out;
+    }
+  stop = 0;
+  if (0 != pthread_create (&thread, NULL, &loop, NULL))
+    {
+      MHD_stop_daemon (mhd);
+      goto out;
+    }
+  fprintf (stderr, "%s...\n", name);
+
+  /* idle keep-alive connections: one request, then nothing */
+  start = loadgen_now ();
+  for (i = 0; i < n; i++)
+    {
+      fds[opened] = open_client (opened);
+      if ( (-1 == fds[opened]) ||
+           (0 != read_response (fds[opened])) )
+        {
+          fprintf (stderr, "%s: idle connection %u failed\n", name, i);
+          goto cleanup;
+        }
+      opened++;
+    }
+  open_idle = (loadgen_now () - start) / 1000000000.0;
+
+  printf ("%s    {\"name\": \"%s\", \"mode\": \"%s\", \"connections\": %u,\n"
+          "     \"open_idle_seconds\": %.3f",
+          first ? "" : ",\n",
+          name, m->name, n,
+          open_idle);
+  probe (n);
+  printf ("}");
+  fflush (stdout);
+  ret = 0;
+
+ cleanup:
+  for (i = 0; i < opened; i++)
+    (void) close (fds[i]);
+  start = loadgen_now ();
+  while ( (0 != MHD_get_daemon_info (mhd,
+                                     MHD_DAEMON_INFO_CURRENT_CONNECTIONS)
+           ->num_connections) &&
+          (loadgen_now () - start < 30 * 1000000000LLU) )
+    usleep (1000);
+  stop = 1;
+  pthread_join (thread, NULL);
+  MHD_stop_daemon (mhd);
+ out:
+#if EPOLL_SUPPORT
+  if (-1 != epfd)
+    (void) close (epfd);
+  epfd = -1;
+#endif
+  free (fds);
+  free (rs);
+  free (ws);
+  free (es);
+  return ret;
+}
+
+
+int
+main (int argc, char *const *argv)
+{
+  unsigned int m;
+  unsigned int n;
+  int c;
+  int first = 1;
+
+  while (-1 != (c = getopt (argc, argv, "n:d:p:f:h")))
+    {
+      switch (c)
+        {
+        case 'n':
+          opt.max_connections = atoi (optarg);
+          break;
+        case 'd':
+          opt.probe_ms = atoi (optarg);
+          break;
+        case 'p':
+          opt.port = atoi (optarg);
+          break;
+        case 'f':
+          opt.filter = optarg;
+          break;
+        default:
+          fprintf (stderr,
+                   "Usage: %s [-n MAX_CONNECTIONS] [-d PROBE_MILLISECONDS]"
+                   " [-p PORT] [-f FILTER]\n"
+                   "Runs each benchmark whose name (MODE/N) contains FILTER,"
+                   " for N = 1000, 10000, ...\n"
+                   "up to MAX_CONNECTIONS and prints the results as JSON.\n",
+                   argv[0]);
+          return 2;
+        }
+    }
+  if (0 == opt.probe_ms)
+    return 2;
+  signal (SIGPIPE, SIG_IGN);
+  stats.samples = malloc (MAX_SAMPLES * sizeof (uint32_t));
+  response = MHD_create_response_from_buffer (strlen (BODY), BODY,
+                                              MHD_RESPMEM_PERSISTENT);
+  if ( (NULL == stats.samples) ||
+       (NULL == response) )
+    return 1;
+  printf ("{\"version\": \"%s\", \"results\": [\n", MHD_get_version ());
+  for (m = 0; NULL != modes[m].name; m++)
+    for (n = 1000; n <= opt.max_connections; n *= 10)
+      if (0 == run (&modes[m], n, first))
+        first = 0;
+  printf ("\n]}\n");
+  MHD_destroy_response (response);
+  free (stats.samples);
+  return 0;
+}
@@ -0,0 +1,370 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file perf_http.c
+ * @brief benchmark GET throughput, latency and CPU cost of every
+ *        daemon mode.  The load is generated by loadgen.c in the
+ *        same process, so "server" CPU is the CPU of the process
+ *        minus that of the load generator thread.  Results are
+ *        written to stdout as JSON, so that runs of two versions
+ *        can be compared by a script.
+ * @author Christian Grothoff
+ */
+
+#include "loadgen.h"
+#include <microhttpd.h>
+#include <signal.h>
+#if LOADGEN_TLS
+#include "tls_test_keys.h"
+#endif
+
+#if defined(CPU_COUNT) && (CPU_COUNT+0) < 2
+#undef CPU_COUNT
+#endif
+#if !defined(CPU_COUNT)
+#define CPU_COUNT 2
+#endif
+
+/**
+ * Size of the "small" response.
+ */
+#define SMALL_SIZE 128
+
+/**
+ * Size of the "large" and "file" responses.
+ */
+#define LARGE_SIZE (1024 * 1024)
+
+
+/**
+ * A daemon mode to benchmark.
+ */
+struct Mode
+{
+  /**
+   * Name in the results.
+   */
+  const char *name;
+
+  /**
+   * Flags for MHD_start_daemon().
+   */
+  unsigned int flags;
+
+  /**
+   * Size of the thread pool, 0 for none.
+   */
+  unsigned int threads;
+};
+
+
+/**
+ * All daemon modes available on this platform.
+ */
+static const struct Mode modes[] = {
+  { "select", MHD_USE_SELECT_INTERNALLY, 0 },
+#ifdef HAVE_POLL
+  { "poll", MHD_USE_POLL_INTERNALLY, 0 },
+#endif
+#if EPOLL_SUPPORT
+  { "epoll", MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY, 0 },
+  { "epoll_turbo",
+    MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY | MHD_USE_EPOLL_TURBO, 0 },
+  { "epoll_pool2", MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY, 2 },
+  { "epoll_pool4", MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY, 4 },
+  { "epoll_poolN", MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY, CPU_COUNT },
+#else
+  { "select_pool2", MHD_USE_SELECT_INTERNALLY, 2 },
+  { "select_pool4", MHD_USE_SELECT_INTERNALLY, 4 },
+  { "select_poolN", MHD_USE_SELECT_INTERNALLY, CPU_COUNT },
+#endif
+  { "thread_per_connection",
+    MHD_USE_SELECT_INTERNALLY | MHD_USE_THREAD_PER_CONNECTION, 0 },
+  { NULL, 0, 0 }
+};
+
+
+/**
+ * Responses, indexed by the path of the request.
+ */
+static struct
+{
+  /**
+   * Path (and name in the results).
+   */
+  const char *path;
+
+  /**
+   * The response.
+   */
+  struct MHD_Response *response;
+} responses[] = {
+  { "/small", NULL },
+  { "/large", NULL },
+  { "/file", NULL },
+  { NULL, NULL }
+};
+
+
+/**
+ * Options given on the command line.
+ */
+static struct
+{
+  unsigned int duration_ms;
+  unsigned int connections;
+  uint16_t port;
+  const char *filter;
+} opt = { 3000, 64, 1190, NULL };
+
+
+static int
+ahc_bench (void *cls,
+           struct MHD_Connection *connection,
+           const char *url,
+           const char *method,
+           const char *version,
+           const char *upload_data, size_t *upload_data_size,
+           void **unused)
+{
+  unsigned int i;
+
+  if (0 != strcmp (method, MHD_HTTP_METHOD_GET))
+    return MHD_NO;
+  for (i = 0; NULL != responses[i].path; i++)
+    if (0 == strcmp (url, responses[i].path))
+      return MHD_queue_response (connection,
+                                 MHD_HTTP_OK,
+                                 responses[i].response);
+  return MHD_NO;
+}
+
+
+/**
+ * Create the responses.
+ *
+ * @return 0 on success
+ */
+static int
+create_responses (void)
+{
+  static char small[SMALL_SIZE];
+  static char large[LARGE_SIZE];
+  char name[] = "/tmp/perf_http_XXXXXX";
+  size_t off;
+  ssize_t ret;
+  int fd;
+
+  memset (small, 's', sizeof (small));
+  memset (large, 'l', sizeof (large));
+  fd = mkstemp (name);
+  if (-1 == fd)
+    return -1;
+  (void) unlink (name);
+  for (off = 0; off < sizeof (large); off += ret)
+    {
+      ret = write (fd, &large[off], sizeof (large) - off);
+      if (0 >= ret)
+        {
+          (void) close (fd);
+          return -1;
+        }
+    }
+  responses[0].response
+    = MHD_create_response_from_buffer (sizeof (small), small,
+                                       MHD_RESPMEM_PERSISTENT);
+  responses[1].response
+    = MHD_create_response_from_buffer (sizeof (large), large,
+                                       MHD_RESPMEM_PERSISTENT);
+  responses[2].response
+    = MHD_create_response_from_fd (sizeof (large), fd);
+  if ( (NULL == responses[0].response) ||
+       (NULL == responses[1].response) ||
+       (NULL == responses[2].response) )
+    return -1;
+  return 0;
+}
+
+
+/**
+ * Run one benchmark and print its result.
+ *
+ * @param mode daemon mode
+ * @param path path to request
+ * @param keep_alive non-zero for keep-alive connections
+ * @param tls non-zero for HTTPS
+ * @param first non-zero if this is the first result printed
+ * @return 0 if the result was printed
+ */
+static int
+run (const struct Mode *mode,
+     const char *path,
+     int keep_alive,
+     int tls,
+     int first)
+{
+  struct MHD_Daemon *d;
+  struct LoadgenConfig cfg;
+  struct LoadgenResult res;
+  char name[128];
+  uint64_t cpu;
+  uint64_t server_usec;
+  double secs;
+  unsigned int flags = mode->flags;
+
+  snprintf (name, sizeof (name), "%s/%s/%s/%s",
+            mode->name, &path[1],
+            keep_alive ? "keepalive" : "close",
+            tls ? "https" : "http");
+  if ( (NULL != opt.filter) &&
+       (NULL == strstr (name, opt.filter)) )
+    return -1;
+  if (tls)
+    flags |= MHD_USE_SSL;
+  d = MHD_start_daemon (flags | MHD_SUPPRESS_DATE_NO_CLOCK,
+                        opt.port,
+                        NULL, NULL, &ahc_bench, NULL,
+                        MHD_OPTION_CONNECTION_LIMIT,
+                        (unsigned int) (opt.connections + 16),
+                        MHD_OPTION_CONNECTION_TIMEOUT, (unsigned int) 120,
+                        MHD_OPTION_THREAD_POOL_SIZE, mode->threads,
+#if LOADGEN_TLS
+                        (tls ? MHD_OPTION_HTTPS_MEM_KEY : MHD_OPTION_END),
+                        srv_key_pem,
+                        MHD_OPTION_HTTPS_MEM_CERT, srv_self_signed_cert_pem,
+#endif
+                        MHD_OPTION_END);
+  if (NULL == d)
+    {
+      fprintf (stderr, "%s: failed to start daemon\n", name);
+      return -1;
+    }
+  fprintf (stderr, "%s...\n", name);
+  memset (&cfg, 0, sizeof (cfg));
+  cfg.port = opt.port;
+  cfg.connections = opt.connections;
+  cfg.path = path;
+  cfg.keep_alive = keep_alive;
+  cfg.duration_ms = opt.duration_ms;
+  cfg.tls = tls;
+  cpu = loadgen_cpu_usec (1);
+  if (0 != loadgen_run (&cfg, &res))
+    {
+      fprintf (stderr, "%s: failed to run load generator\n", name);
+      MHD_stop_daemon (d);
+      return -1;
+    }
+  server_usec = loadgen_cpu_usec (1) - cpu - res.cpu_usec;
+  MHD_stop_daemon (d);
+  secs = res.elapsed_ns / 1000000000.0;
+  if (0 == res.requests)
+    res.requests = 1; /* avoid dividing by zero below */
+  printf ("%s    {\"name\": \"%s\", \"mode\": \"%s\", \"threads\": %u,"
+          " \"response\": \"%s\", \"keep_alive\": %s, \"tls\": %s,\n"
+          "     \"connections\": %u, \"seconds\": %.3f,"
+          " \"requests\": %llu, \"errors\": %llu,\n"
+          "     \"req_per_sec\": %.1f, \"mb_per_sec\": %.2f,\n"
+          "     \"latency_us\": {\"p50\": %.1f, \"p90\": %.1f,"
+          " \"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f},\n"
+          "     \"cpu_us_per_req\": {\"server\": %.2f, \"client\": %.2f}}",
+          first ? "" : ",\n",
+          name, mode->name, mode->threads,
+          &path[1],
+          keep_alive ? "true" : "false",
+          tls ? "true" : "false",
+          opt.connections, secs,
+          (unsigned long long) res.requests,
+          (unsigned long long) res.errors,
+          res.requests / secs,
+          res.bytes / secs / (1024 * 1024),
+          loadgen_percentile (&res, 50) / 1000.0,
+          loadgen_percentile (&res, 90) / 1000.0,
+          loadgen_percentile (&res, 99) / 1000.0,
+          loadgen_percentile (&res, 99.9) / 1000.0,
+          loadgen_percentile (&res, 100) / 1000.0,
+          (double) server_usec / res.requests,
+          (double) res.cpu_usec / res.requests);
+  fflush (stdout);
+  loadgen_free (&res);
+  return 0;
+}
+
+
+int
+main (int argc, char *const *argv)
+{
+  unsigned int m;
+  unsigned int r;
+  int keep_alive;
+  int tls;
+  int c;
+  int first = 1;
+
+  while (-1 != (c = getopt (argc, argv, "d:c:p:f:h")))
+    {
+      switch (c)
+        {
+        case 'd':
+          opt.duration_ms = atoi (optarg);
+          break;
+        case 'c':
+          opt.connections = atoi (optarg);
+          break;
+        case 'p':
+          opt.port = atoi (optarg);
+          break;
+        case 'f':
+          opt.filter = optarg;
+          break;
+        default:
+          fprintf (stderr,
+                   "Usage: %s [-d MILLISECONDS] [-c CONNECTIONS]"
+                   " [-p PORT] [-f FILTER]\n"
+                   "Runs each benchmark whose name (MODE/RESPONSE/"
+                   "{keepalive,close}/{http,https})\n"
+                   "contains FILTER and prints the results as JSON.\n",
+                   argv[0]);
+          return 2;
+        }
+    }
+  if ( (0 == opt.duration_ms) ||
+       (0 == opt.connections) )
+    return 2;
+  signal (SIGPIPE, SIG_IGN);
+  if (0 != create_responses ())
+    {
+      fprintf (stderr, "Failed to create responses\n");
+      return 1;
+    }
+  printf ("{\"version\": \"%s\", \"cpu_count\": %u,"
+          " \"duration_ms\": %u, \"results\": [\n",
+          MHD_get_version (), (unsigned int) CPU_COUNT, opt.duration_ms);
+  for (tls = 0; tls <= (LOADGEN_TLS ? 1 : 0); tls++)
+    for (m = 0; NULL != modes[m].name; m++)
+      for (r = 0; NULL != responses[r].path; r++)
+        for (keep_alive = 1; keep_alive >= 0; keep_alive--)
+          if (0 == run (&modes[m], responses[r].path, keep_alive, tls, first))
+            first = 0;
+  printf ("\n]}\n");
+  for (r = 0; NULL != responses[r].path; r++)
+    MHD_destroy_response (responses[r].response);
+  return 0;
+}
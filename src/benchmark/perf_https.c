@@ -0,0 +1,425 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file perf_https.c
+ * @brief benchmark TLS: full and resumed handshakes per second and
+ *        the CPU they cost, and bulk transfer from buffer and file
+ *        responses, for several priority strings and daemon modes.
+ *        Results are written to stdout as JSON.
+ * @author Christian Grothoff
+ */
+
+#include "loadgen.h"
+#include <microhttpd.h>
+#include <signal.h>
+#include "tls_test_keys.h"
+
+#if defined(CPU_COUNT) && (CPU_COUNT+0) < 2
+#undef CPU_COUNT
+#endif
+#if !defined(CPU_COUNT)
+#define CPU_COUNT 2
+#endif
+
+/**
+ * Size of the bulk responses.
+ */
+#define BULK_SIZE (1024 * 1024)
+
+
+/**
+ * A daemon mode to benchmark.
+ */
+struct Mode
+{
+  /**
+   * Name in the results.
+   */
+  const char *name;
+
+  /**
+   * Flags for MHD_start_daemon().
+   */
+  unsigned int flags;
+
+  /**
+   * Size of the thread pool, 0 for none.
+   */
+  unsigned int threads;
+
+  /**
+   * Number of handshake threads, 0 for none.
+   */
+  unsigned int handshake_threads;
+};
+
+
+/**
+ * Daemon modes to benchmark.
+ */
+static const struct Mode modes[] = {
+  { "select", MHD_USE_SELECT_INTERNALLY, 0, 0 },
+#if EPOLL_SUPPORT
+  { "epoll", MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY, 0, 0 },
+  { "epoll_poolN", MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY, CPU_COUNT, 0 },
+  { "epoll_handshake2",
+    MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY | MHD_USE_SUSPEND_RESUME, 0, 2 },
+#else
+  { "select_poolN", MHD_USE_SELECT_INTERNALLY, CPU_COUNT, 0 },
+  { "select_handshake2",
+    MHD_USE_SELECT_INTERNALLY | MHD_USE_SUSPEND_RESUME, 0, 2 },
+#endif
+  { "thread_per_connection",
+    MHD_USE_SELECT_INTERNALLY | MHD_USE_THREAD_PER_CONNECTION, 0, 0 },
+  { NULL, 0, 0, 0 }
+};
+
+
+/**
+ * TLS priority strings to benchmark (used by client and server).
+ */
+static const char *priorities[] = {
+  "NORMAL",
+  "NORMAL:-VERS-TLS1.3",
+  "SECURE128",
+  "PERFORMANCE:-VERS-TLS1.3:-AES-128-GCM:-AES-256-GCM",
+  NULL
+};
+
+
+/**
+ * What to measure.
+ */
+enum Test
+{
+  /**
+   * A full handshake for every request.
+   */
+  TEST_FULL,
+
+  /**
+   * A resumed handshake for every request.
+   */
+  TEST_RESUMED,
+
+  /**
+   * Keep-alive requests for a buffer response.
+   */
+  TEST_BULK_BUFFER,
+
+  /**
+   * Keep-alive requests for a file response.
+   */
+  TEST_BULK_FD
+};
+
+
+/**
+ * Names of #Test values for the results.
+ */
+static const char *const test_names[] = {
+  "full", "resumed", "bulk_buffer", "bulk_fd"
+};
+
+
+/**
+ * Empty response for the handshake tests.
+ */
+static struct MHD_Response *empty;
+
+/**
+ * Bulk response from a buffer.
+ */
+static struct MHD_Response *bulk_buffer;
+
+/**
+ * Bulk response from a file.
+ */
+static struct MHD_Response *bulk_fd;
+
+
+/**
+ * Options given on the command line.
+ */
+static struct
+{
+  unsigned int duration_ms;
+  unsigned int connections;
+  uint16_t port;
+  const char *filter;
+} opt = { 1000, 16, 1191, NULL };
+
+
+static int
+ahc_bench (void *cls,
+           struct MHD_Connection *connection,
+           const char *url,
+           const char *method,
+           const char *version,
+           const char *upload_data, size_t *upload_data_size,
+           void **unused)
+{
+  struct MHD_Response *response;
+
+  if (0 != strcmp (method, MHD_HTTP_METHOD_GET))
+    return MHD_NO;
+  if (0 == strcmp (url, "/buffer"))
+    response = bulk_buffer;
+  else if (0 == strcmp (url, "/file"))
+    response = bulk_fd;
+  else
+    response = empty;
+  return MHD_queue_response (connection, MHD_HTTP_OK, response);
+}
+
+
+/**
+ * Create the responses.
+ *
+ * @return 0 on success
+ */
+static int
+create_responses (void)
+{
+  static char buf[BULK_SIZE];
+  char name[] = "/tmp/perf_https_XXXXXX";
+  size_t off;
+  ssize_t ret;
+  int fd;
+
+  memset (buf, 'b', sizeof (buf));
+  fd = mkstemp (name);
+  if (-1 == fd)
+    return -1;
+  (void) unlink (name);
+  for (off = 0; off < sizeof (buf); off += ret)
+    {
+      ret = write (fd, &buf[off], sizeof (buf) - off);
+      if (0 >= ret)
+        {
+          (void) close (fd);
+          return -1;
+        }
+    }
+  empty = MHD_create_response_from_buffer (0, "", MHD_RESPMEM_PERSISTENT);
+  bulk_buffer = MHD_create_response_from_buffer (sizeof (buf), buf,
+                                                 MHD_RESPMEM_PERSISTENT);
+  bulk_fd = MHD_create_response_from_fd (sizeof (buf), fd);
+  if ( (NULL == empty) ||
+       (NULL == bulk_buffer) ||
+       (NULL == bulk_fd) )
+    return -1;
+  return 0;
+}
+
+
+/**
+ * Run one benchmark and print its result.
+ *
+ * @param mode daemon mode
+ * @param prio TLS priority string
+ * @param test what to measure
+ * @param first non-zero if this is the first result printed
+ * @return 0 if the result was printed
+ */
+static int
+run (const struct Mode *mode,
+     const char *prio,
+     enum Test test,
+     int first)
+{
+  struct MHD_Daemon *d;
+  struct LoadgenConfig cfg;
+  struct LoadgenResult res;
+  char name[256];
+  uint64_t cpu;
+  uint64_t server_usec;
+  uint64_t handshakes;
+  double secs;
+
+  snprintf (name, sizeof (name), "%s/%s/%s",
+            mode->name, prio, test_names[test]);
+  if ( (NULL != opt.filter) &&
+       (NULL == strstr (name, opt.filter)) )
+    return -1;
+  d = MHD_start_daemon (mode->flags | MHD_USE_SSL | MHD_SUPPRESS_DATE_NO_CLOCK,
+                        opt.port,
+                        NULL, NULL, &ahc_bench, NULL,
+                        MHD_OPTION_CONNECTION_LIMIT,
+                        (unsigned int) (opt.connections + 16),
+                        MHD_OPTION_CONNECTION_TIMEOUT, (unsigned int) 120,
+                        MHD_OPTION_THREAD_POOL_SIZE, mode->threads,
+                        MHD_OPTION_HTTPS_MEM_KEY, srv_key_pem,
+                        MHD_OPTION_HTTPS_MEM_CERT, srv_self_signed_cert_pem,
+                        MHD_OPTION_HTTPS_PRIORITIES, prio,
+                        MHD_OPTION_HTTPS_SESSION_TICKETS,
+                        (unsigned int) ((TEST_RESUMED == test) ? MHD_YES : MHD_NO),
+                        MHD_OPTION_HTTPS_SESSION_CACHE_SIZE,
+                        (unsigned int) ((TEST_RESUMED == test) ? 1024 : 0),
+                        (0 != mode->handshake_threads)
+                        ? MHD_OPTION_HTTPS_HANDSHAKE_THREADS : MHD_OPTION_END,
+                        mode->handshake_threads,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    {
+      fprintf (stderr, "%s: failed to start daemon\n", name);
+      return -1;
+    }
+  fprintf (stderr, "%s...\n", name);
+  memset (&cfg, 0, sizeof (cfg));
+  cfg.port = opt.port;
+  cfg.connections = opt.connections;
+  switch (test)
+    {
+    case TEST_FULL:
+    case TEST_RESUMED:
+      cfg.path = "/";
+      break;
+    case TEST_BULK_BUFFER:
+      cfg.path = "/buffer";
+      break;
+    case TEST_BULK_FD:
+      cfg.path = "/file";
+      break;
+    }
+  cfg.keep_alive = (TEST_BULK_BUFFER == test) || (TEST_BULK_FD == test);
+  cfg.duration_ms = opt.duration_ms;
+  cfg.tls = 1;
+  cfg.tls_priorities = prio;
+  cfg.tls_resume = (TEST_RESUMED == test);
+  cpu = loadgen_cpu_usec (1);
+  if (0 != loadgen_run (&cfg, &res))
+    {
+      fprintf (stderr, "%s: failed to run load generator\n", name);
+      MHD_stop_daemon (d);
+      return -1;
+    }
+  server_usec = loadgen_cpu_usec (1) - cpu - res.cpu_usec;
+  MHD_stop_daemon (d);
+  secs = res.elapsed_ns / 1000000000.0;
+  /* without keep-alive, every complete request had a handshake */
+  handshakes = cfg.keep_alive ? res.connects : res.requests;
+  if (0 == res.requests)
+    res.requests = 1; /* avoid dividing by zero below */
+  if (0 == handshakes)
+    handshakes = 1;
+  printf ("%s    {\"name\": \"%s\", \"mode\": \"%s\", \"threads\": %u,"
+          " \"handshake_threads\": %u,\n"
+          "     \"priorities\": \"%s\", \"test\": \"%s\","
+          " \"connections\": %u, \"seconds\": %.3f,\n"
+          "     \"handshakes\": %llu, \"resumed\": %llu,"
+          " \"requests\": %llu, \"errors\": %llu,\n"
+          "     \"handshakes_per_sec\": %.1f, \"req_per_sec\": %.1f,"
+          " \"mb_per_sec\": %.2f,\n"
+          "     \"latency_us\": {\"p50\": %.1f, \"p90\": %.1f,"
+          " \"p99\": %.1f, \"max\": %.1f},\n"
+          "     \"cpu_us_per_handshake\": {\"server\": %.2f, \"client\": %.2f},\n"
+          "     \"cpu_us_per_req\": {\"server\": %.2f, \"client\": %.2f}}",
+          first ? "" : ",\n",
+          name, mode->name, mode->threads, mode->handshake_threads,
+          prio, test_names[test],
+          opt.connections, secs,
+          (unsigned long long) handshakes,
+          (unsigned long long) res.resumed,
+          (unsigned long long) res.requests,
+          (unsigned long long) res.errors,
+          handshakes / secs,
+          res.requests / secs,
+          res.bytes / secs / (1024 * 1024),
+          loadgen_percentile (&res, 50) / 1000.0,
+          loadgen_percentile (&res, 90) / 1000.0,
+          loadgen_percentile (&res, 99) / 1000.0,
+          loadgen_percentile (&res, 100) / 1000.0,
+          (double) server_usec / handshakes,
+          (double) res.cpu_usec / handshakes,
+          (double) server_usec / res.requests,
+          (double) res.cpu_usec / res.requests);
+  fflush (stdout);
+  loadgen_free (&res);
+  return 0;
+}
+
+
+int
+main (int argc, char *const *argv)
+{
+  const char *one[2] = { NULL, NULL };
+  const char **prios = priorities;
+  unsigned int m;
+  unsigned int p;
+  unsigned int t;
+  int c;
+  int first = 1;
+
+  while (-1 != (c = getopt (argc, argv, "d:c:p:f:P:h")))
+    {
+      switch (c)
+        {
+        case 'd':
+          opt.duration_ms = atoi (optarg);
+          break;
+        case 'c':
+          opt.connections = atoi (optarg);
+          break;
+        case 'p':
+          opt.port = atoi (optarg);
+          break;
+        case 'f':
+          opt.filter = optarg;
+          break;
+        case 'P':
+          one[0] = optarg;
+          prios = one;
+          break;
+        default:
+          fprintf (stderr,
+                   "Usage: %s [-d MILLISECONDS] [-c CONNECTIONS] [-p PORT]"
+                   " [-f FILTER] [-P PRIORITIES]\n"
+                   "Runs each benchmark whose name (MODE/PRIORITIES/"
+                   "{full,resumed,bulk_buffer,bulk_fd})\n"
+                   "contains FILTER and prints the results as JSON.\n",
+                   argv[0]);
+          return 2;
+        }
+    }
+  if ( (0 == opt.duration_ms) ||
+       (0 == opt.connections) )
+    return 2;
+  signal (SIGPIPE, SIG_IGN);
+  if (0 != create_responses ())
+    {
+      fprintf (stderr, "Failed to create responses\n");
+      return 1;
+    }
+  printf ("{\"version\": \"%s\", \"cpu_count\": %u,"
+          " \"duration_ms\": %u, \"results\": [\n",
+          MHD_get_version (), (unsigned int) CPU_COUNT, opt.duration_ms);
+  for (m = 0; NULL != modes[m].name; m++)
+    for (p = 0; NULL != prios[p]; p++)
+      for (t = TEST_FULL; t <= TEST_BULK_FD; t++)
+        if (0 == run (&modes[m], prios[p], (enum Test) t, first))
+          first = 0;
+  printf ("\n]}\n");
+  MHD_destroy_response (empty);
+  MHD_destroy_response (bulk_buffer);
+  MHD_destroy_response (bulk_fd);
+  return 0;
+}
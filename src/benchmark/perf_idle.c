@@ -0,0 +1,626 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file perf_idle.c
+ * @brief benchmark what idle connections cost.  For each event loop
+ *        and number N, opens N idle keep-alive connections and then
+ *        N connections whose requests are suspended (as a long-poll
+ *        server would, see minimal_example_comet.c), and measures
+ *        the resident memory per connection, the latency of requests
+ *        on one active connection and the time per event loop
+ *        iteration next to them, and how long it takes until a
+ *        resumed connection gets its response.  Results are written
+ *        to stdout as JSON.
+ * @author Christian Grothoff
+ */
+
+#include "loadgen.h"
+#include <microhttpd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+
+/**
+ * Number of connections resumed to measure the resume latency.
+ */
+#define RESUME_SAMPLES 100
+
+/**
+ * Number of client addresses; connections are spread over
+ * 127.0.0.1 to 127.0.0.ADDRESSES so that there are enough ports.
+ */
+#define ADDRESSES 96
+
+/**
+ * Number of connections opened per client address.
+ */
+#define PER_ADDRESS 25000
+
+/**
+ * Body of all responses.
+ */
+#define BODY "ok"
+
+
+/**
+ * An event loop to benchmark.
+ */
+struct Mode
+{
+  /**
+   * Name in the results.
+   */
+  const char *name;
+
+  /**
+   * Flags for MHD_start_daemon().
+   */
+  unsigned int flags;
+
+  /**
+   * Size of the thread pool, 0 for none.
+   */
+  unsigned int threads;
+
+  /**
+   * Non-zero if the mode uses select(), which limits the number of
+   * descriptors of the process.
+   */
+  int uses_select;
+
+  /**
+   * Non-zero if the mode needs a thread per connection.
+   */
+  int thread_per_connection;
+};
+
+
+/**
+ * Event loops to benchmark.
+ */
+static const struct Mode modes[] = {
+  { "select", MHD_USE_SELECT_INTERNALLY, 0, 1, 0 },
+#ifdef HAVE_POLL
+  { "poll", MHD_USE_POLL_INTERNALLY, 0, 0, 0 },
+#endif
+#if EPOLL_SUPPORT
+  { "epoll", MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY, 0, 0, 0 },
+  { "epoll_pool4", MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY, 4, 0, 0 },
+#endif
+#if IO_URING_SUPPORT
+  { "io_uring", MHD_USE_IO_URING_INTERNALLY_LINUX_ONLY, 0, 0, 0 },
+#endif
+#if KQUEUE_SUPPORT
+  { "kqueue", MHD_USE_KQUEUE_INTERNALLY, 0, 0, 0 },
+#endif
+#ifdef HAVE_POLL
+  /* select() in the connection threads would limit N to FD_SETSIZE */
+  { "thread_per_connection",
+    MHD_USE_POLL_INTERNALLY | MHD_USE_THREAD_PER_CONNECTION, 0, 0, 1 },
+#endif
+  { NULL, 0, 0, 0, 0 }
+};
+
+
+/**
+ * Options given on the command line.
+ */
+static struct
+{
+  unsigned int max_connections;
+  unsigned int max_threads;
+  unsigned int probe_ms;
+  uint16_t port;
+  const char *filter;
+} opt = { 10000, 1000, 1000, 1192, NULL };
+
+
+/**
+ * Response to all requests.
+ */
+static struct MHD_Response *response;
+
+/**
+ * Port of the current run.  Every run uses the next port, as the
+ * kernel may release the listen socket of an io_uring daemon only
+ * some time after the ring was closed.
+ */
+static uint16_t port;
+
+/**
+ * Protects @e suspended and @e num_suspended.
+ */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Suspended connections, indexed by the client address (see
+ * #client_key()).
+ */
+static struct MHD_Connection **suspended;
+
+/**
+ * Number of connections suspended so far.
+ */
+static unsigned int num_suspended;
+
+
+/**
+ * Get the index of a client socket address in #suspended.
+ *
+ * @param addr address of the client
+ * @return index
+ */
+static size_t
+client_key (const struct sockaddr_in *addr)
+{
+  return ((ntohl (addr->sin_addr.s_addr) & 0xFF) - 1) * 65536
+    + ntohs (addr->sin_port);
+}
+
+
+static int
+ahc_idle (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data, size_t *upload_data_size,
+          void **ptr)
+{
+  static int headers;
+  static int waiting;
+  const union MHD_ConnectionInfo *ci;
+
+  if (0 != strcmp (url, "/suspend"))
+    return MHD_queue_response (connection, MHD_HTTP_OK, response);
+  if (NULL == *ptr)
+    {
+      *ptr = &headers;
+      return MHD_YES;
+    }
+  if (&headers == *ptr)
+    {
+      /* hold the request until the benchmark resumes it */
+      *ptr = &waiting;
+      ci = MHD_get_connection_info (connection,
+                                    MHD_CONNECTION_INFO_CLIENT_ADDRESS);
+      pthread_mutex_lock (&lock);
+      suspended[client_key ((const struct sockaddr_in *) ci->client_addr)]
+        = connection;
+      num_suspended++;
+      pthread_mutex_unlock (&lock);
+      MHD_suspend_connection (connection);
+      return MHD_YES;
+    }
+  return MHD_queue_response (connection, MHD_HTTP_OK, response);
+}
+
+
+/**
+ * Get the resident memory of the process.
+ *
+ * @return bytes, 0 if unknown
+ */
+static uint64_t
+get_rss (void)
+{
+  unsigned long size;
+  unsigned long resident;
+  FILE *f;
+
+  f = fopen ("/proc/self/statm", "r");
+  if (NULL == f)
+    return 0;
+  if (2 != fscanf (f, "%lu %lu", &size, &resident))
+    resident = 0;
+  fclose (f);
+  return (uint64_t) resident * sysconf (_SC_PAGESIZE);
+}
+
+
+/**
+ * Open client connection number @a i and send a request on it.
+ *
+ * @param i number of the connection
+ * @param path path to request
+ * @return the socket, -1 on error
+ */
+static int
+open_client (unsigned int i,
+             const char *path)
+{
+  struct sockaddr_in addr;
+  char req[128];
+  size_t len;
+  int fd;
+
+  fd = socket (AF_INET, SOCK_STREAM, 0);
+  if (-1 == fd)
+    return -1;
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK + i / PER_ADDRESS);
+  if (0 != bind (fd, (struct sockaddr *) &addr, sizeof (addr)))
+    {
+      (void) close (fd);
+      return -1;
+    }
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  addr.sin_port = htons (port);
+  len = snprintf (req, sizeof (req),
+                  "GET %s HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n", path);
+  if ( (0 != connect (fd, (struct sockaddr *) &addr, sizeof (addr))) ||
+       (len != (size_t) write (fd, req, len)) )
+    {
+      (void) close (fd);
+      return -1;
+    }
+  return fd;
+}
+
+
+/**
+ * Read a response from @a fd (blocking).
+ *
+ * @param fd socket
+ * @return 0 on success, -1 on error
+ */
+static int
+read_response (int fd)
+{
+  char buf[1024];
+  size_t have = 0;
+  ssize_t got;
+
+  while (have < sizeof (buf) - 1)
+    {
+      got = read (fd, &buf[have], sizeof (buf) - 1 - have);
+      if (0 >= got)
+        return -1;
+      have += got;
+      buf[have] = '\0';
+      if (NULL != strstr (buf, "\r\n\r\n" BODY))
+        return 0;
+    }
+  return -1;
+}
+
+
+/**
+ * Compare two latencies for qsort().
+ */
+static int
+cmp_u64 (const void *a,
+         const void *b)
+{
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+
+  return (x < y) ? -1 : (x > y);
+}
+
+
+/**
+ * Make requests on one active connection for opt.probe_ms and print
+ * their latency and the time the event loops spent per iteration.
+ *
+ * @param d daemon
+ * @param label name of the JSON member to print
+ */
+static void
+probe (struct MHD_Daemon *d,
+       const char *label)
+{
+  struct LoadgenConfig cfg;
+  struct LoadgenResult res;
+  struct MHD_DaemonStats before;
+  const union MHD_DaemonInfo *info;
+  uint64_t iterations = 0;
+  uint64_t dispatch = 0;
+
+  memset (&before, 0, sizeof (before));
+  info = MHD_get_daemon_info (d, MHD_DAEMON_INFO_STATS);
+  if (NULL != info)
+    before = info->stats;
+  memset (&cfg, 0, sizeof (cfg));
+  cfg.port = port;
+  cfg.connections = 1;
+  cfg.path = "/";
+  cfg.keep_alive = 1;
+  cfg.duration_ms = opt.probe_ms;
+  if (0 != loadgen_run (&cfg, &res))
+    {
+      printf (",\n     \"%s\": null", label);
+      return;
+    }
+  info = MHD_get_daemon_info (d, MHD_DAEMON_INFO_STATS);
+  if (NULL != info)
+    {
+      iterations = info->stats.loop_iterations - before.loop_iterations;
+      dispatch = info->stats.loop_dispatch_usec - before.loop_dispatch_usec;
+    }
+  printf (",\n     \"%s\": {\"requests\": %llu, \"errors\": %llu,"
+          " \"p50_us\": %.1f, \"p99_us\": %.1f,"
+          " \"loop_iterations\": %llu, \"us_per_iteration\": %.2f}",
+          label,
+          (unsigned long long) res.requests,
+          (unsigned long long) res.errors,
+          loadgen_percentile (&res, 50) / 1000.0,
+          loadgen_percentile (&res, 99) / 1000.0,
+          (unsigned long long) iterations,
+          (0 != iterations) ? (double) dispatch / iterations : 0.0);
+  loadgen_free (&res);
+}
+
+
+/**
+ * Run the benchmark for one event loop and number of connections and
+ * print its result.
+ *
+ * @param mode event loop
+ * @param n number of idle and of suspended connections
+ * @param first non-zero if this is the first result printed
+ * @return 0 if the result was printed
+ */
+static int
+run (const struct Mode *mode,
+     unsigned int n,
+     int first)
+{
+  struct MHD_Daemon *d;
+  struct sockaddr_in addr;
+  socklen_t alen;
+  struct pollfd pfd;
+  uint64_t latency[RESUME_SAMPLES];
+  unsigned int samples = 0;
+  char name[128];
+  int *fds;
+  uint64_t rss0;
+  uint64_t rss1;
+  uint64_t rss2;
+  uint64_t start;
+  double open_idle;
+  double open_suspended;
+  unsigned int i;
+  unsigned int opened = 0;
+  int ret = -1;
+  int with_suspend = ! mode->thread_per_connection;
+  static unsigned int runs;
+
+  snprintf (name, sizeof (name), "%s/%u", mode->name, n);
+  if ( (NULL != opt.filter) &&
+       (NULL == strstr (name, opt.filter)) )
+    return -1;
+  if ( (mode->uses_select) &&
+       (4 * n + 64 > FD_SETSIZE) )
+    return -1; /* client and server sockets are in one process */
+  if ( (mode->thread_per_connection) &&
+       (n > opt.max_threads) )
+    return -1;
+  if ( (n > ADDRESSES * PER_ADDRESS / 2) ||
+       (0 != loadgen_raise_fd_limit (4 * n + 256)) )
+    {
+      fprintf (stderr, "%s: cannot open enough descriptors\n", name);
+      return -1;
+    }
+  fds = malloc (2 * n * sizeof (int));
+  if (NULL == fds)
+    return -1;
+  num_suspended = 0;
+  port = opt.port + runs++ % 100;
+  d = MHD_start_daemon (mode->flags
+                        | (with_suspend ? MHD_USE_SUSPEND_RESUME : 0)
+                        | MHD_SUPPRESS_DATE_NO_CLOCK,
+                        port,
+                        NULL, NULL, &ahc_idle, NULL,
+                        /* the limit is split among the workers, while
+                           SO_REUSEPORT spreads the clients unevenly */
+                        MHD_OPTION_CONNECTION_LIMIT,
+                        (2 * n + 16) * (0 == mode->threads ? 1 : mode->threads),
+                        MHD_OPTION_THREAD_POOL_SIZE, mode->threads,
+                        MHD_OPTION_LISTEN_BACKLOG_SIZE, (unsigned int) 1024,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    {
+      fprintf (stderr, "%s: failed to start daemon\n", name);
+      free (fds);
+      return -1;
+    }
+  fprintf (stderr, "%s...\n", name);
+
+  /* idle keep-alive connections: one request, then nothing */
+  rss0 = get_rss ();
+  start = loadgen_now ();
+  for (i = 0; i < n; i++)
+    {
+      fds[opened] = open_client (opened, "/");
+      if ( (-1 == fds[opened]) ||
+           (0 != read_response (fds[opened])) )
+        {
+          fprintf (stderr, "%s: idle connection %u failed\n", name, i);
+          goto cleanup;
+        }
+      opened++;
+    }
+  open_idle = (loadgen_now () - start) / 1000000000.0;
+  rss1 = get_rss ();
+
+  /* suspended connections: the request waits for a resume */
+  start = loadgen_now ();
+  for (i = 0; with_suspend && (i < n); i++)
+    {
+      fds[opened] = open_client (opened, "/suspend");
+      if (-1 == fds[opened])
+        {
+          fprintf (stderr, "%s: suspended connection %u failed\n", name, i);
+          goto cleanup;
+        }
+      opened++;
+      /* do not let the listen queue overflow */
+      while (num_suspended + 512 < i)
+        usleep (100);
+    }
+  while (with_suspend &&
+         (num_suspended < n) &&
+         (loadgen_now () - start < 60 * 1000000000LLU))
+    usleep (1000);
+  if (with_suspend &&
+      (num_suspended < n) )
+    {
+      fprintf (stderr, "%s: only %u of %u connections suspended\n",
+               name, num_suspended, n);
+      goto cleanup;
+    }
+  open_suspended = (loadgen_now () - start) / 1000000000.0;
+  rss2 = get_rss ();
+
+  printf ("%s    {\"name\": \"%s\", \"mode\": \"%s\", \"connections\": %u,\n"
+          "     \"open_idle_seconds\": %.3f, \"open_suspended_seconds\": %.3f,\n"
+          "     \"rss_per_idle_connection\": %.0f,"
+          " \"rss_per_suspended_connection\": %.0f",
+          first ? "" : ",\n",
+          name, mode->name, n,
+          open_idle, with_suspend ? open_suspended : 0.0,
+          (double) (rss1 - rss0) / n,
+          with_suspend ? (double) (rss2 - rss1) / n : 0.0);
+  probe (d, "probe_idle");
+  if (with_suspend)
+    {
+      probe (d, "probe_suspended");
+
+      /* resume connections spread over all suspended ones */
+      for (i = 0; (i < RESUME_SAMPLES) && (i < n); i++)
+        {
+          struct MHD_Connection *c;
+
+          pfd.fd = fds[n + (uint64_t) i * n / RESUME_SAMPLES];
+          pfd.events = POLLIN;
+          alen = sizeof (addr);
+          if (0 != getsockname (pfd.fd, (struct sockaddr *) &addr, &alen))
+            continue;
+          pthread_mutex_lock (&lock);
+          c = suspended[client_key (&addr)];
+          suspended[client_key (&addr)] = NULL;
+          pthread_mutex_unlock (&lock);
+          if (NULL == c)
+            continue;
+          start = loadgen_now ();
+          MHD_resume_connection (c);
+          if ( (1 != poll (&pfd, 1, 10000)) ||
+               (0 != read_response (pfd.fd)) )
+            continue;
+          latency[samples++] = loadgen_now () - start;
+        }
+      qsort (latency, samples, sizeof (uint64_t), &cmp_u64);
+      if (0 != samples)
+        printf (",\n     \"resume_latency_us\": {\"samples\": %u,"
+                " \"p50\": %.1f, \"p99\": %.1f, \"max\": %.1f}",
+                samples,
+                latency[samples / 2] / 1000.0,
+                latency[(samples * 99) / 100] / 1000.0,
+                latency[samples - 1] / 1000.0);
+    }
+  printf ("}");
+  fflush (stdout);
+  ret = 0;
+
+ cleanup:
+  /* MHD_stop_daemon() must not find suspended connections */
+  pthread_mutex_lock (&lock);
+  for (i = 0; i < ADDRESSES * 65536; i++)
+    if (NULL != suspended[i])
+      {
+        MHD_resume_connection (suspended[i]);
+        suspended[i] = NULL;
+      }
+  pthread_mutex_unlock (&lock);
+  for (i = 0; i < opened; i++)
+    (void) close (fds[i]);
+  start = loadgen_now ();
+  while ( (0 != MHD_get_daemon_info (d,
+                                     MHD_DAEMON_INFO_CURRENT_CONNECTIONS)
+           ->num_connections) &&
+          (loadgen_now () - start < 30 * 1000000000LLU) )
+    usleep (1000);
+  MHD_stop_daemon (d);
+  free (fds);
+  return ret;
+}
+
+
+int
+main (int argc, char *const *argv)
+{
+  unsigned int m;
+  unsigned int n;
+  int c;
+  int first = 1;
+
+  while (-1 != (c = getopt (argc, argv, "n:t:d:p:f:h")))
+    {
+      switch (c)
+        {
+        case 'n':
+          opt.max_connections = atoi (optarg);
+          break;
+        case 't':
+          opt.max_threads = atoi (optarg);
+          break;
+        case 'd':
+          opt.probe_ms = atoi (optarg);
+          break;
+        case 'p':
+          opt.port = atoi (optarg);
+          break;
+        case 'f':
+          opt.filter = optarg;
+          break;
+        default:
+          fprintf (stderr,
+                   "Usage: %s [-n MAX_CONNECTIONS] [-t MAX_THREADS]"
+                   " [-d PROBE_MILLISECONDS] [-p PORT] [-f FILTER]\n"
+                   "Runs each benchmark whose name (MODE/N) contains FILTER,"
+                   " for N = 100, 1000, ...\n"
+                   "up to MAX_CONNECTIONS and prints the results as JSON.\n",
+                   argv[0]);
+          return 2;
+        }
+    }
+  if (0 == opt.probe_ms)
+    return 2;
+  signal (SIGPIPE, SIG_IGN);
+  suspended = calloc (ADDRESSES * 65536, sizeof (struct MHD_Connection *));
+  response = MHD_create_response_from_buffer (strlen (BODY), BODY,
+                                              MHD_RESPMEM_PERSISTENT);
+  if ( (NULL == suspended) ||
+       (NULL == response) )
+    return 1;
+  printf ("{\"version\": \"%s\", \"results\": [\n", MHD_get_version ());
+  for (m = 0; NULL != modes[m].name; m++)
+    for (n = 100; n <= opt.max_connections; n *= 10)
+      if (0 == run (&modes[m], n, first))
+        first = 0;
+  printf ("\n]}\n");
+  MHD_destroy_response (response);
+  free (suspended);
+  return 0;
+}
@@ -0,0 +1,477 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file perf_postprocessor.c
+ * @brief benchmark MHD_post_process() on url-encoded and multipart
+ *        bodies of various shapes, delivered in pieces of various
+ *        sizes.  Reports MB/s and the number of allocations per
+ *        body as JSON.
+ * @author Christian Grothoff
+ */
+
+#include "MHD_config.h"
+#include "platform.h"
+#include "microhttpd.h"
+#include "internal.h"
+#include <time.h>
+
+/**
+ * Size of the bodies (roughly, before encoding).
+ */
+#define BODY_SIZE (1024 * 1024)
+
+
+#ifdef __GLIBC__
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+/**
+ * Number of calls to malloc(), calloc() and realloc().  These
+ * replace the functions of libc for the whole process, including
+ * libmicrohttpd.
+ */
+static uint64_t allocs;
+
+void *
+malloc (size_t size)
+{
+  allocs++;
+  return __libc_malloc (size);
+}
+
+void *
+calloc (size_t nmemb, size_t size)
+{
+  allocs++;
+  return __libc_calloc (nmemb, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+  allocs++;
+  return __libc_realloc (ptr, size);
+}
+
+#define HAVE_ALLOC_COUNT 1
+#else
+#define HAVE_ALLOC_COUNT 0
+static uint64_t allocs;
+#endif
+
+
+/**
+ * What the values of a body consist of.
+ */
+enum Payload
+{
+  /**
+   * Letters only.
+   */
+  PAYLOAD_TEXT,
+
+  /**
+   * Every letter percent-encoded (url-encoded only).
+   */
+  PAYLOAD_ESCAPED,
+
+  /**
+   * Pseudo-random bytes (multipart only).
+   */
+  PAYLOAD_BINARY,
+
+  /**
+   * Only dashes (multipart only).
+   */
+  PAYLOAD_DASHES,
+
+  /**
+   * "\r\n--" followed by all of the boundary but its last character,
+   * over and over (multipart only).
+   */
+  PAYLOAD_NEARMISS
+};
+
+
+/**
+ * Names of #Payload values for the results.
+ */
+static const char *const payload_names[] = {
+  "text", "escaped", "binary", "dashes", "nearmiss"
+};
+
+
+/**
+ * A body to benchmark.
+ */
+struct Case
+{
+  /**
+   * Non-zero for multipart/form-data, zero for url-encoding.
+   */
+  int multipart;
+
+  /**
+   * Number of fields (or parts).
+   */
+  unsigned int fields;
+
+  /**
+   * Length of the boundary (multipart only).
+   */
+  unsigned int boundary_len;
+
+  /**
+   * What the values consist of.
+   */
+  enum Payload payload;
+};
+
+
+/**
+ * Bodies to benchmark; each value is BODY_SIZE / fields bytes.
+ */
+static const struct Case cases[] = {
+  { 0, 1, 0, PAYLOAD_TEXT },
+  { 0, 64, 0, PAYLOAD_TEXT },
+  { 0, 4096, 0, PAYLOAD_TEXT },
+  { 0, 64, 0, PAYLOAD_ESCAPED },
+  { 1, 1, 40, PAYLOAD_TEXT },
+  { 1, 64, 40, PAYLOAD_TEXT },
+  { 1, 4096, 40, PAYLOAD_TEXT },
+  { 1, 1, 8, PAYLOAD_BINARY },
+  { 1, 1, 70, PAYLOAD_BINARY },
+  { 1, 1, 40, PAYLOAD_DASHES },
+  { 1, 1, 8, PAYLOAD_NEARMISS },
+  { 1, 1, 70, PAYLOAD_NEARMISS },
+  { 0, 0, 0, PAYLOAD_TEXT }
+};
+
+
+/**
+ * Sizes of the pieces the body is given to MHD_post_process() in,
+ * 0 for all at once.
+ */
+static const size_t splits[] = { 1, 61, 1460, 65536, 0 };
+
+
+/**
+ * Options given on the command line.
+ */
+static struct
+{
+  unsigned int duration_ms;
+  size_t buffer_size;
+  const char *filter;
+} opt = { 200, 4096, NULL };
+
+
+/**
+ * Get the current time of the monotonic clock.
+ *
+ * @return time in nanoseconds
+ */
+static uint64_t
+now_ns (void)
+{
+  struct timespec ts;
+
+  if (0 != clock_gettime (CLOCK_MONOTONIC, &ts))
+    return 0;
+  return ((uint64_t) ts.tv_sec) * 1000000000LLU + ts.tv_nsec;
+}
+
+
+/**
+ * Count the value bytes the post processor delivers.
+ */
+static int
+value_counter (void *cls,
+               enum MHD_ValueKind kind,
+               const char *key,
+               const char *filename,
+               const char *content_type,
+               const char *transfer_encoding,
+               const char *data, uint64_t off, size_t size)
+{
+  uint64_t *total = cls;
+
+  *total += size;
+  return MHD_YES;
+}
+
+
+/**
+ * Append @a len bytes of @a pl payload to @a body.
+ *
+ * @param body where to write
+ * @param len number of (decoded) bytes
+ * @param pl what to write
+ * @param boundary boundary of the body, for #PAYLOAD_NEARMISS
+ * @param seed state of the pseudo-random generator
+ * @return number of bytes written
+ */
+static size_t
+write_payload (char *body,
+               size_t len,
+               enum Payload pl,
+               const char *boundary,
+               uint32_t *seed)
+{
+  size_t blen = strlen (boundary);
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    {
+      switch (pl)
+        {
+        case PAYLOAD_TEXT:
+          body[i] = 'a' + i % 26;
+          break;
+        case PAYLOAD_ESCAPED:
+          sprintf (&body[3 * i], "%%%02X", 'a' + (unsigned int) (i % 26));
+          break;
+        case PAYLOAD_BINARY:
+          *seed = *seed * 1103515245 + 12345;
+          body[i] = (char) (*seed >> 16);
+          break;
+        case PAYLOAD_DASHES:
+          body[i] = '-';
+          break;
+        case PAYLOAD_NEARMISS:
+          {
+            size_t p = i % (blen + 3);
+
+            body[i] = (p < 4) ? "\r\n--"[p] : boundary[p - 4];
+          }
+          break;
+        }
+    }
+  return (PAYLOAD_ESCAPED == pl) ? 3 * len : len;
+}
+
+
+/**
+ * Build the body of case @a c.
+ *
+ * @param c case to build
+ * @param boundary boundary to use (multipart only)
+ * @param len set to the length of the body
+ * @param values set to the number of value bytes in the body
+ * @return the body, NULL on error
+ */
+static char *
+build_body (const struct Case *c,
+            const char *boundary,
+            size_t *len,
+            uint64_t *values)
+{
+  size_t vlen = BODY_SIZE / c->fields;
+  char *body;
+  size_t pos = 0;
+  unsigned int i;
+  uint32_t seed = 42;
+
+  body = malloc (3 * BODY_SIZE + c->fields * (256 + strlen (boundary)));
+  if (NULL == body)
+    return NULL;
+  for (i = 0; i < c->fields; i++)
+    {
+      if (c->multipart)
+        pos += sprintf (&body[pos],
+                        "--%s\r\n"
+                        "Content-Disposition: form-data; name=\"f%u\"\r\n"
+                        "\r\n",
+                        boundary, i);
+      else
+        pos += sprintf (&body[pos], "%sf%u=", (0 == i) ? "" : "&", i);
+      pos += write_payload (&body[pos], vlen, c->payload, boundary, &seed);
+      if (c->multipart)
+        pos += sprintf (&body[pos], "\r\n");
+    }
+  if (c->multipart)
+    pos += sprintf (&body[pos], "--%s--\r\n", boundary);
+  *len = pos;
+  *values = (uint64_t) vlen * c->fields;
+  return body;
+}
+
+
+/**
+ * Run one benchmark and print its result.
+ *
+ * @param c body to post process
+ * @param split size of the pieces to pass, 0 for all at once
+ * @param first non-zero if this is the first result printed
+ * @return 0 if the result was printed
+ */
+static int
+run (const struct Case *c,
+     size_t split,
+     int first)
+{
+  struct MHD_Connection connection;
+  struct MHD_HTTP_Header header;
+  struct MHD_PostProcessor *pp;
+  char name[128];
+  char boundary[128];
+  char content_type[256];
+  char *body;
+  size_t len;
+  size_t off;
+  size_t step;
+  uint64_t values;
+  uint64_t total;
+  uint64_t iterations = 0;
+  uint64_t start;
+  uint64_t elapsed;
+  uint64_t alloc_start;
+  int ok = 1;
+
+  if (c->multipart)
+    snprintf (name, sizeof (name), "multipart/%u/b%u/%s/%u",
+              c->fields, c->boundary_len,
+              payload_names[c->payload], (unsigned int) split);
+  else
+    snprintf (name, sizeof (name), "urlencoded/%u/%s/%u",
+              c->fields, payload_names[c->payload], (unsigned int) split);
+  if ( (NULL != opt.filter) &&
+       (NULL == strstr (name, opt.filter)) )
+    return -1;
+  memset (boundary, 'B', c->boundary_len);
+  boundary[c->boundary_len] = '\0';
+  if (c->boundary_len > 4)
+    memcpy (boundary, "----", 4);
+  if (c->multipart)
+    snprintf (content_type, sizeof (content_type), "%s; boundary=%s",
+              MHD_HTTP_POST_ENCODING_MULTIPART_FORMDATA, boundary);
+  else
+    snprintf (content_type, sizeof (content_type), "%s",
+              MHD_HTTP_POST_ENCODING_FORM_URLENCODED);
+  body = build_body (c, boundary, &len, &values);
+  if (NULL == body)
+    return -1;
+  memset (&connection, 0, sizeof (struct MHD_Connection));
+  memset (&header, 0, sizeof (struct MHD_HTTP_Header));
+  connection.headers_received = &header;
+  header.header = MHD_HTTP_HEADER_CONTENT_TYPE;
+  header.value = content_type;
+  header.header_size = strlen (header.header);
+  header.value_size = strlen (header.value);
+  header.kind = MHD_HEADER_KIND;
+  step = (0 == split) ? len : split;
+
+  alloc_start = allocs;
+  start = now_ns ();
+  do
+    {
+      total = 0;
+      pp = MHD_create_post_processor (&connection,
+                                      opt.buffer_size,
+                                      &value_counter, &total);
+      if (NULL == pp)
+        {
+          fprintf (stderr, "%s: failed to create post processor\n", name);
+          free (body);
+          return -1;
+        }
+      for (off = 0; off < len; off += step)
+        if (MHD_YES != MHD_post_process (pp,
+                                         &body[off],
+                                         (len - off < step) ? len - off : step))
+          ok = 0;
+      MHD_destroy_post_processor (pp);
+      if (total != values)
+        ok = 0;
+      iterations++;
+      elapsed = now_ns () - start;
+    }
+  while (elapsed < opt.duration_ms * 1000000LLU);
+
+  printf ("%s    {\"name\": \"%s\", \"encoding\": \"%s\", \"fields\": %u,"
+          " \"boundary_len\": %u, \"payload\": \"%s\", \"split\": %u,\n"
+          "     \"body_bytes\": %u, \"iterations\": %llu, \"ok\": %s,"
+          " \"mb_per_sec\": %.2f, \"allocs_per_body\": ",
+          first ? "" : ",\n",
+          name,
+          c->multipart ? "multipart" : "urlencoded",
+          c->fields, c->boundary_len, payload_names[c->payload],
+          (unsigned int) split,
+          (unsigned int) len,
+          (unsigned long long) iterations,
+          ok ? "true" : "false",
+          (double) len * iterations / (elapsed / 1000000000.0)
+          / (1024 * 1024));
+  if (HAVE_ALLOC_COUNT)
+    printf ("%.1f}", (double) (allocs - alloc_start) / iterations);
+  else
+    printf ("null}");
+  fflush (stdout);
+  free (body);
+  return 0;
+}
+
+
+int
+main (int argc, char *const *argv)
+{
+  unsigned int i;
+  unsigned int s;
+  int c;
+  int first = 1;
+
+  while (-1 != (c = getopt (argc, argv, "d:b:f:h")))
+    {
+      switch (c)
+        {
+        case 'd':
+          opt.duration_ms = atoi (optarg);
+          break;
+        case 'b':
+          opt.buffer_size = atoi (optarg);
+          break;
+        case 'f':
+          opt.filter = optarg;
+          break;
+        default:
+          fprintf (stderr,
+                   "Usage: %s [-d MILLISECONDS] [-b BUFFER_SIZE] [-f FILTER]\n"
+                   "Runs each benchmark whose name (ENCODING/FIELDS/"
+                   "[BOUNDARY/]PAYLOAD/SPLIT)\n"
+                   "contains FILTER and prints the results as JSON.\n",
+                   argv[0]);
+          return 2;
+        }
+    }
+  if (opt.buffer_size < 256)
+    return 2;
+  printf ("{\"version\": \"%s\", \"buffer_size\": %u,"
+          " \"duration_ms\": %u, \"results\": [\n",
+          MHD_get_version (), (unsigned int) opt.buffer_size,
+          opt.duration_ms);
+  for (i = 0; 0 != cases[i].fields; i++)
+    for (s = 0; s < sizeof (splits) / sizeof (splits[0]); s++)
+      if (0 == run (&cases[i], splits[s], first))
+        first = 0;
+  printf ("\n]}\n");
+  return 0;
+}
@@ -160,9 +160,11 @@ typedef intptr_t ssize_t;
 #ifdef SIZE_MAX
 #define MHD_CONTENT_READER_END_OF_STREAM SIZE_MAX
 #define MHD_CONTENT_READER_END_WITH_ERROR (SIZE_MAX - 1)
+#define MHD_CONTENT_READER_PENDING (SIZE_MAX - 2)
 #else
 #define MHD_CONTENT_READER_END_OF_STREAM ((size_t) -1LL)
 #define MHD_CONTENT_READER_END_WITH_ERROR (((size_t) -1LL) - 1)
+#define MHD_CONTENT_READER_PENDING (((size_t) -1LL) - 2)
 #endif
 
 #ifndef _MHD_EXTERN
@@ -297,6 +299,7 @@ _MHD_DEPR_MACRO("Macro MHD_LONG_LONG_PRINTF is deprecated, use MHD_UNSIGNED_LONG
 #define MHD_HTTP_CONTINUE 100
 #define MHD_HTTP_SWITCHING_PROTOCOLS 101
 #define MHD_HTTP_PROCESSING 102
+#define MHD_HTTP_EARLY_HINTS 103
 
 #define MHD_HTTP_OK 200
 #define MHD_HTTP_CREATED 201
@@ -391,6 +394,7 @@ MHD_get_reason_phrase_for (unsigned int code);
 #define MHD_HTTP_HEADER_ACCEPT_RANGES "Accept-Ranges"
 #define MHD_HTTP_HEADER_AGE "Age"
 #define MHD_HTTP_HEADER_ALLOW "Allow"
+#define MHD_HTTP_HEADER_ALT_SVC "Alt-Svc"
 #define MHD_HTTP_HEADER_AUTHORIZATION "Authorization"
 #define MHD_HTTP_HEADER_CACHE_CONTROL "Cache-Control"
 #define MHD_HTTP_HEADER_CONNECTION "Connection"
@@ -414,6 +418,7 @@ MHD_get_reason_phrase_for (unsigned int code);
 #define MHD_HTTP_HEADER_IF_RANGE "If-Range"
 #define MHD_HTTP_HEADER_IF_UNMODIFIED_SINCE "If-Unmodified-Since"
 #define MHD_HTTP_HEADER_LAST_MODIFIED "Last-Modified"
+#define MHD_HTTP_HEADER_LINK "Link"
 #define MHD_HTTP_HEADER_LOCATION "Location"
 #define MHD_HTTP_HEADER_MAX_FORWARDS "Max-Forwards"
 #define MHD_HTTP_HEADER_PRAGMA "Pragma"
@@ -448,6 +453,7 @@ MHD_get_reason_phrase_for (unsigned int code);
  */
 #define MHD_HTTP_VERSION_1_0 "HTTP/1.0"
 #define MHD_HTTP_VERSION_1_1 "HTTP/1.1"
+#define MHD_HTTP_VERSION_2 "HTTP/2"
 
 /** @} */ /* end of group versions */
 
@@ -656,7 +662,92 @@ enum MHD_FLAG
    * kernel >= 3.6.  On other systems, using this option cases #MHD_start_daemon
    * to fail.
    */
-  MHD_USE_TCP_FASTOPEN = 16384
+  MHD_USE_TCP_FASTOPEN = 16384,
+
+  /**
+   * Give each worker thread of the thread pool (see
+   * #MHD_OPTION_THREAD_POOL_SIZE) its own listen socket bound to the
+   * same address using SO_REUSEPORT, so that the kernel distributes
+   * incoming connections among the workers instead of all workers
+   * competing for the single shared accept queue.  Implies allowing
+   * listening address reuse (see #MHD_OPTION_LISTENING_ADDRESS_REUSE).
+   * Only available on platforms supporting SO_REUSEPORT (load
+   * balancing requires Linux >= 3.9); on other systems, using this
+   * option causes #MHD_start_daemon to fail.
+   */
+  MHD_USE_THREAD_POOL_REUSEPORT = 32768,
+
+  /**
+   * Use Linux io_uring instead of `epoll()` for the event loop.
+   * Readiness of the listen socket and of all connections is tracked
+   * with multishot poll requests that are queued on the ring and
+   * submitted together with the wait for completions, so registering
+   * and unregistering sockets does not cost a system call each.
+   * This is a readiness backend only: accepting, reading and writing
+   * still use the usual system calls once a socket is reported ready,
+   * no I/O is submitted to the ring.
+   * Requires Linux >= 5.13 at runtime and an internal thread (or
+   * thread pool), see #MHD_USE_IO_URING_INTERNALLY_LINUX_ONLY; it is
+   * incompatible with #MHD_USE_THREAD_PER_CONNECTION and with
+   * #MHD_add_connection().  Implies #MHD_USE_EPOLL_LINUX_ONLY and
+   * #MHD_USE_PIPE_FOR_SHUTDOWN.
+   */
+  MHD_USE_IO_URING_LINUX_ONLY = 65536 | MHD_USE_EPOLL_LINUX_ONLY | MHD_USE_PIPE_FOR_SHUTDOWN,
+
+  /**
+   * Run using an internal thread (or thread pool) doing io_uring.
+   * This option is only available on Linux; using the option on
+   * non-Linux systems will cause #MHD_start_daemon to fail.
+   */
+  MHD_USE_IO_URING_INTERNALLY_LINUX_ONLY = MHD_USE_SELECT_INTERNALLY | MHD_USE_IO_URING_LINUX_ONLY,
+
+  /**
+   * Use `kqueue()` instead of `select()` or `poll()` for the event
+   * loop.  This option is only available on FreeBSD, macOS and other
+   * systems with `kqueue()` and `EVFILT_USER`; using the option on
+   * other systems will cause #MHD_start_daemon to fail.  Using this
+   * option is not supported with #MHD_USE_THREAD_PER_CONNECTION.
+   */
+  MHD_USE_KQUEUE = 131072,
+
+  /**
+   * Run using an internal thread (or thread pool) doing `kqueue()`.
+   * This option is only available on systems with `kqueue()`; using
+   * the option on other systems will cause #MHD_start_daemon to fail.
+   */
+  MHD_USE_KQUEUE_INTERNALLY = MHD_USE_SELECT_INTERNALLY | MHD_USE_KQUEUE,
+
+  /**
+   * Speak HTTP/2 (RFC 7540) with clients that ask for it: with
+   * #MHD_USE_SSL, MHD offers "h2" via ALPN (if GnuTLS supports it);
+   * without, clients that start the connection with the HTTP/2
+   * preface ("prior knowledge") are served with HTTP/2.  Other
+   * clients are served with HTTP/1.x as before.  The requests of the
+   * streams of an HTTP/2 connection are passed to the
+   * #MHD_AccessHandlerCallback as connections of their own, with
+   * #MHD_HTTP_VERSION_2 as the version; they can be suspended and
+   * resumed independently.  Responses are sent without byte ranges
+   * and without #MHD_RO_COMPRESSION_LEVEL; upgrade responses are
+   * refused.  The access handler always runs in the thread of the
+   * event loop, even with #MHD_OPTION_HANDLER_THREADS.
+   * @see #MHD_OPTION_HTTP2_MAX_CONCURRENT_STREAMS
+   */
+  MHD_USE_HTTP2 = 262144,
+
+  /**
+   * Let the `select()` event loop handle sockets beyond FD_SETSIZE:
+   * its fd sets are allocated to cover the highest socket and kept up
+   * to date as connections come and go, rather than being rebuilt
+   * from fixed-size `fd_set`s.  The default connection limit is then
+   * derived from the limit on open files of the process instead of
+   * FD_SETSIZE.  Only available with POSIX sockets on systems whose
+   * `select()` accepts fd sets larger than `fd_set`; not supported
+   * with #MHD_USE_THREAD_PER_CONNECTION, #MHD_USE_POLL,
+   * #MHD_USE_EPOLL_LINUX_ONLY or #MHD_USE_KQUEUE.  With an external
+   * event loop, #MHD_get_fdset2() must be given sets of an
+   * `fd_setsize` above the highest socket.
+   */
+  MHD_USE_LARGE_FD_SETS = 524288
 
 };
 
@@ -705,6 +796,7 @@ enum MHD_OPTION
    * After how many seconds of inactivity should a
    * connection automatically be timed out? (followed
    * by an `unsigned int`; use zero for no timeout).
+   * See also #MHD_OPTION_CONNECTION_TIMEOUT_MS.
    */
   MHD_OPTION_CONNECTION_TIMEOUT = 3,
 
@@ -738,7 +830,11 @@ enum MHD_OPTION
    * Bind daemon to the supplied `struct sockaddr`. This option should
    * be followed by a `struct sockaddr *`.  If #MHD_USE_IPv6 is
    * specified, the `struct sockaddr*` should point to a `struct
-   * sockaddr_in6`, otherwise to a `struct sockaddr_in`.
+   * sockaddr_in6`, otherwise to a `struct sockaddr_in`.  A `struct
+   * sockaddr_un` (family AF_UNIX) makes the daemon listen on a Unix
+   * domain socket if #MHD_FEATURE_UNIX_SOCKETS is supported; the path
+   * must not exist yet and is not removed when the daemon stops.
+   * Cannot be combined with #MHD_USE_THREAD_POOL_REUSEPORT.
    */
   MHD_OPTION_SOCK_ADDR = 6,
 
@@ -795,7 +891,9 @@ enum MHD_OPTION
 
   /**
    * Memory pointer to a `const char *` specifying the
-   * cipher algorithm (default: "NORMAL").
+   * cipher algorithm (default: "NORMAL").  If MHD was built with
+   * OpenSSL ("configure --with-tls=openssl"), this is an OpenSSL
+   * cipher list instead (default: the one of OpenSSL).
    */
   MHD_OPTION_HTTPS_PRIORITIES = 11,
 
@@ -885,7 +983,9 @@ enum MHD_OPTION
   /**
    * Size of the internal array holding the map of the nonce and
    * the nonce counter. This option should be followed by an `unsigend int`
-   * argument.
+   * argument.  The array is organized in sets of four entries (the
+   * size is rounded up), a new nonce replaces the least recently used
+   * one of its set.
    */
   MHD_OPTION_NONCE_NC_SIZE = 18,
 
@@ -914,13 +1014,15 @@ enum MHD_OPTION
    * followed by a argument of type `gnutls_certificate_retrieve_function2 *`.
    * This option provides an
    * alternative to #MHD_OPTION_HTTPS_MEM_KEY,
-   * #MHD_OPTION_HTTPS_MEM_CERT.  You must use this version if
-   * multiple domains are to be hosted at the same IP address using
-   * TLS's Server Name Indication (SNI) extension.  In this case,
+   * #MHD_OPTION_HTTPS_MEM_CERT.  Use this version (or
+   * #MHD_OPTION_HTTPS_CERT_TABLE) if multiple domains are to be
+   * hosted at the same IP address using TLS's Server Name
+   * Indication (SNI) extension.  In this case,
    * the callback is expected to select the correct certificate
    * based on the SNI information provided.  The callback is expected
    * to access the SNI data using `gnutls_server_name_get()`.
-   * Using this option requires GnuTLS 3.0 or higher.
+   * Using this option requires GnuTLS 3.0 or higher (and MHD built
+   * with GnuTLS).
    */
   MHD_OPTION_HTTPS_CERT_CALLBACK = 22,
 
@@ -975,335 +1077,1523 @@ enum MHD_OPTION
    * value is used. This option should be followed by an `unsigned int`
    * argument.
    */
-  MHD_OPTION_LISTEN_BACKLOG_SIZE = 28
-};
+  MHD_OPTION_LISTEN_BACKLOG_SIZE = 28,
 
+  /**
+   * When using #MHD_USE_THREAD_POOL_REUSEPORT, setting this option to a
+   * non-zero value attaches a BPF program to the listen sockets which
+   * selects the worker by the number of the CPU that received the
+   * connection (worker = CPU % thread pool size), keeping the processing
+   * of a connection local to one CPU when the worker threads are pinned.
+   * Requires Linux >= 4.5; ignored (with a log message) if the kernel
+   * rejects the program.  This option should be followed by an
+   * `unsigned int` argument.
+   */
+  MHD_OPTION_LISTEN_REUSEPORT_CPU_STEERING = 29,
 
-/**
- * Entry in an #MHD_OPTION_ARRAY.
- */
-struct MHD_OptionItem
-{
   /**
-   * Which option is being given.  Use #MHD_OPTION_END
-   * to terminate the array.
+   * Maximum number of connections to accept from the listen socket
+   * each time it is reported as ready, instead of returning to the
+   * event loop after every accepted connection.  Accepting stops
+   * earlier if the backlog is drained or the connection limit is
+   * reached.  The listen socket is made non-blocking if the value is
+   * larger than one.  Defaults to 128 with #MHD_USE_EPOLL_LINUX_ONLY
+   * and to 1 otherwise.  This option should be followed by an
+   * `unsigned int` argument.
    */
-  enum MHD_OPTION option;
+  MHD_OPTION_ACCEPT_BATCH_SIZE = 30,
 
   /**
-   * Option value (for integer arguments, and for options requiring
-   * two pointer arguments); should be 0 for options that take no
-   * arguments or only a single pointer argument.
+   * Maximum number of connection memory pools (each of
+   * #MHD_OPTION_CONNECTION_MEMORY_LIMIT bytes) and connection objects
+   * that each thread keeps for reuse after connections are closed,
+   * saving the allocation and first-touch page faults for new
+   * connections.  Defaults to 8;
+   * 0 disables the cache.  Ignored with
+   * #MHD_USE_THREAD_PER_CONNECTION.  This option should be followed
+   * by an `unsigned int` argument.
    */
-  intptr_t value;
+  MHD_OPTION_CONNECTION_POOL_CACHE_SIZE = 31,
 
   /**
-   * Pointer option value (use NULL for options taking no arguments
-   * or only an integer option).
+   * Number of seconds after which a keep-alive connection that is
+   * waiting for its next request releases its memory pool.  A new
+   * pool is obtained once the client sends data again.  Only applies
+   * to connections using the daemon's default timeout.  The default
+   * (0) is to keep the pool.  Ignored with
+   * #MHD_USE_THREAD_PER_CONNECTION.  This option should be followed
+   * by an `unsigned int` argument.
    */
-  void *ptr_value;
+  MHD_OPTION_CONNECTION_IDLE_RELEASE_TIMEOUT = 32,
 
-};
+  /**
+   * If set to #MHD_YES, the cookies and the URI (GET) arguments of
+   * a request are only parsed (and unescaped) when the application
+   * first asks for values of kind #MHD_COOKIE_KIND or
+   * #MHD_GET_ARGUMENT_KIND, saving the work for requests that never
+   * look at them.  The unescape callback is then called at that
+   * time, and if there is not enough memory to store the values,
+   * they are silently missing instead of a
+   * #MHD_HTTP_REQUEST_ENTITY_TOO_LARGE response being generated.
+   * Defaults to #MHD_NO.  This option should be followed by an
+   * `unsigned int` argument.
+   */
+  MHD_OPTION_LAZY_VALUE_PARSING = 33,
 
+  /**
+   * If set to #MHD_YES, the chunks of a chunked upload that are
+   * available in the read buffer are decoded into one contiguous
+   * area first, and the #MHD_AccessHandlerCallback is called once
+   * for all of them instead of once per chunk.  This reduces the
+   * number of calls for clients sending many small chunks.
+   * Defaults to #MHD_NO.  This option should be followed by an
+   * `unsigned int` argument.
+   */
+  MHD_OPTION_COALESCE_CHUNKED_UPLOAD = 34,
 
-/**
- * The `enum MHD_ValueKind` specifies the source of
- * the key-value pairs in the HTTP protocol.
- */
-enum MHD_ValueKind
-{
+  /**
+   * If set to #MHD_YES, responses to pipelined HTTP/1.1 requests
+   * are kept corked (TCP_CORK / TCP_NOPUSH) while the next request
+   * is already completely in the read buffer, so that all responses
+   * to a batch of pipelined requests are pushed out with one flush
+   * after the last one instead of one flush per response.
+   * Defaults to #MHD_NO.  This option should be followed by an
+   * `unsigned int` argument.
+   */
+  MHD_OPTION_PIPELINE_CORK = 35,
 
   /**
-   * Response header
+   * If set to #MHD_YES, the daemon issues TLS session tickets
+   * (RFC 5077), so that clients can resume their sessions without
+   * a full handshake.  The tickets are encrypted with a key that is
+   * generated when the daemon is started and shared by all threads
+   * of the daemon; GnuTLS (3.6.4 or later) rotates the keys derived
+   * from it automatically.  Defaults to #MHD_NO.  This option should
+   * be followed by an `unsigned int` argument.
    */
-  MHD_RESPONSE_HEADER_KIND = 0,
+  MHD_OPTION_HTTPS_SESSION_TICKETS = 36,
 
   /**
-   * HTTP header.
+   * Number of TLS sessions to keep for clients resuming a session by
+   * its session ID (TLS 1.2 and earlier).  The cache is shared by all
+   * threads of the daemon, including those of the thread pool.
+   * Defaults to 0 (no session cache).  This option should be
+   * followed by an `unsigned int` argument.
    */
-  MHD_HEADER_KIND = 1,
+  MHD_OPTION_HTTPS_SESSION_CACHE_SIZE = 37,
 
   /**
-   * Cookies.  Note that the original HTTP header containing
-   * the cookie(s) will still be available and intact.
+   * Number of threads to run TLS handshakes on.  The public key
+   * operations of a full handshake are expensive; with this option
+   * they no longer delay the requests of the established connections
+   * handled by the same event loop.  Connections are suspended while
+   * their handshake runs on a handshake thread and are resumed to
+   * process their requests as usual.  Requires #MHD_USE_SSL and
+   * #MHD_USE_SUSPEND_RESUME with an internal select, poll or epoll
+   * thread (or thread pool); not supported with io_uring.
+   * Defaults to 0 (handshakes are
+   * run in the event loop).  This option should be followed by an
+   * `unsigned int` argument.
    */
-  MHD_COOKIE_KIND = 2,
+  MHD_OPTION_HTTPS_HANDSHAKE_THREADS = 38,
 
   /**
-   * POST data.  This is available only if a content encoding
-   * supported by MHD is used (currently only URL encoding),
-   * and only if the posted content fits within the available
-   * memory pool.  Note that in that case, the upload data
-   * given to the #MHD_AccessHandlerCallback will be
-   * empty (since it has already been processed).
+   * Enable dynamic sizing of TLS records.  At the beginning of a
+   * connection, and again after it was idle for a second, responses
+   * are sent in small TLS records that each fit into a single TCP
+   * segment, so that the client can decrypt and process the first
+   * bytes (typically the header and the beginning of an HTML page)
+   * without waiting for a full 16 KB record.  Once the given number
+   * of bytes was sent in small records, full-size records are used
+   * for throughput.  Also, the response header is sent in the same
+   * record as the beginning of an in-memory body.  This option
+   * should be followed by a `size_t` argument; 0 (the default)
+   * disables small records.
    */
-  MHD_POSTDATA_KIND = 4,
+  MHD_OPTION_HTTPS_DYNAMIC_RECORD_SIZE = 39,
 
   /**
-   * GET (URI) arguments.
+   * Number of threads to run the #MHD_AccessHandlerCallback on.  The
+   * event loop hands each call of the handler to these threads and
+   * keeps processing the other connections meanwhile, so that a slow
+   * handler (i.e. one waiting for a database) no longer delays them.
+   * The connection is suspended while the handler runs on a handler
+   * thread, and resumed to continue the request afterwards.  The
+   * handler may block, and may itself suspend the connection with
+   * #MHD_suspend_connection(); the #MHD_RequestCompletedCallback may
+   * also run on a handler thread.  Requires #MHD_USE_SUSPEND_RESUME
+   * with an internal select, poll or epoll thread (or thread pool);
+   * not supported with io_uring.  Defaults to 0 (the handler is run
+   * in the event loop).  This option should be followed by an
+   * `unsigned int` argument.
    */
-  MHD_GET_ARGUMENT_KIND = 8,
+  MHD_OPTION_HANDLER_THREADS = 40,
 
   /**
-   * HTTP footer (only for HTTP 1.1 chunked encodings).
+   * Maximum number of threads kept parked for new connections with
+   * #MHD_USE_THREAD_PER_CONNECTION.  Instead of exiting once its
+   * connection is closed, a thread waits for the next connection
+   * (unless this many threads wait already), so that no thread is
+   * created and joined per connection.  Defaults to 0 (a thread is
+   * created for each connection).  This option should be followed
+   * by an `unsigned int` argument.
    */
-  MHD_FOOTER_KIND = 16
-};
+  MHD_OPTION_THREAD_CACHE_SIZE = 41,
 
+  /**
+   * Number of seconds a parked thread (see
+   * #MHD_OPTION_THREAD_CACHE_SIZE) waits for a new connection before
+   * it exits; 0 to keep parked threads until the daemon is stopped.
+   * Defaults to 10.  This option should be followed by an `unsigned
+   * int` argument.
+   */
+  MHD_OPTION_THREAD_CACHE_TIMEOUT = 42,
 
-/**
- * The `enum MHD_RequestTerminationCode` specifies reasons
- * why a request has been terminated (or completed).
- * @ingroup request
- */
-enum MHD_RequestTerminationCode
-{
+  /**
+   * Pin each thread of the thread pool (or the internal select
+   * thread) to a CPU, so that its connections and memory pools stay
+   * on that CPU and (as the pools are first written to by the same
+   * thread) on its NUMA node.  This option should be followed by an
+   * `unsigned int` giving the number of entries of the array that
+   * follows as a `const unsigned int *`; worker i is pinned to the
+   * CPU at index (i % number of entries).  If the array is NULL,
+   * worker i is pinned to the i-th CPU (modulo their number) the
+   * process may run on.  The array is only read during
+   * #MHD_start_daemon().  With #MHD_USE_THREAD_POOL_REUSEPORT and
+   * #MHD_OPTION_LISTEN_REUSEPORT_CPU_STEERING, pin worker i to a CPU c
+   * with (c % pool size == i) so that each worker accepts the
+   * connections arriving on its own CPU.  Only available on platforms
+   * with `pthread_setaffinity_np()`.
+   */
+  MHD_OPTION_THREAD_POOL_CPU_AFFINITY = 43,
 
   /**
-   * We finished sending the response.
-   * @ingroup request
+   * Number of entries of a cache of H(A1) values kept by the daemon
+   * for #MHD_digest_auth_check(), so that H(A1) is not recomputed
+   * from the password for every request of a user.  Entries are
+   * selected by username and realm and only used if a keyed hash
+   * of the password matches as well; long values are not cached.
+   * The cache keeps no copies of the passwords.
+   * This option should be followed by an `unsigned int` argument,
+   * default is 0 (no cache).
    */
-  MHD_REQUEST_TERMINATED_COMPLETED_OK = 0,
+  MHD_OPTION_DIGEST_AUTH_HA1_CACHE_SIZE = 44,
 
   /**
-   * Error handling the connection (resources
-   * exhausted, other side closed connection,
-   * application error accepting request, etc.)
-   * @ingroup request
+   * Number of microseconds the internal thread(s) of a
+   * #MHD_USE_EPOLL_LINUX_ONLY daemon keep calling `epoll_wait()`
+   * with a zero timeout after the last event before they block
+   * again, trading CPU time for latency.  The value is also set as
+   * `SO_BUSY_POLL` (with `SO_PREFER_BUSY_POLL`) on accepted sockets
+   * and as the busy-poll time of the epoll instance (Linux >= 6.9)
+   * where supported; raising them above the system defaults may
+   * require `CAP_NET_ADMIN`, failures are ignored.  This option
+   * should be followed by an `unsigned int` argument, default is 0
+   * (block right away).
    */
-  MHD_REQUEST_TERMINATED_WITH_ERROR = 1,
+  MHD_OPTION_EPOLL_BUSY_POLL = 45,
 
   /**
-   * No activity on the connection for the number
-   * of seconds specified using
-   * #MHD_OPTION_CONNECTION_TIMEOUT.
-   * @ingroup request
+   * Only report connections on the listen socket once the client has
+   * sent data, using `TCP_DEFER_ACCEPT` (Linux) or the "dataready"
+   * accept filter (`SO_ACCEPTFILTER`, FreeBSD), and read from accepted
+   * connections right away instead of waiting for the event loop to
+   * report them as readable.  Saves one event loop iteration per
+   * connection for clients that send their request with the first
+   * packet.  This option should be followed by an `unsigned int`
+   * argument giving the number of seconds the kernel waits for data
+   * on Linux, default is 0 (report connections right after the
+   * handshake).  Ignored with #MHD_USE_THREAD_PER_CONNECTION.
    */
-  MHD_REQUEST_TERMINATED_TIMEOUT_REACHED = 2,
+  MHD_OPTION_TCP_DEFER_ACCEPT = 46,
 
   /**
-   * We had to close the session since MHD was being
-   * shut down.
-   * @ingroup request
+   * Integrate a daemon without internal threads into an existing
+   * event loop: MHD calls the given #MHD_NotifySocketCallback
+   * whenever the set of events it waits for on one of its sockets
+   * changes, and the application calls #MHD_run_socket() when one of
+   * these sockets is ready, instead of #MHD_get_fdset() and
+   * #MHD_run_from_select().  This option should be followed by two
+   * arguments: the callback of type #MHD_NotifySocketCallback and a
+   * closure for it.  Cannot be combined with flags that start
+   * internal threads, #MHD_USE_EPOLL_LINUX_ONLY or #MHD_USE_KQUEUE.
    */
-  MHD_REQUEST_TERMINATED_DAEMON_SHUTDOWN = 3,
+  MHD_OPTION_NOTIFY_SOCKET = 47,
 
   /**
-   * We tried to read additional data, but the other side closed the
-   * connection.  This error is similar to
-   * #MHD_REQUEST_TERMINATED_WITH_ERROR, but specific to the case where
-   * the connection died because the other side did not send expected
-   * data.
-   * @ingroup request
+   * Limit the rate at which the daemon sends data to all its clients
+   * together.  This option should be followed by an `unsigned int`
+   * argument giving the limit in bytes per second, default is 0 (no
+   * limit).  With a thread pool, each thread gets an equal share of
+   * the limit.  Connections that exceed their share are not watched
+   * by the event loop until they may send again.  Cannot be combined
+   * with #MHD_USE_THREAD_PER_CONNECTION.
+   * @see #MHD_CONNECTION_OPTION_SEND_RATE_LIMIT
    */
-  MHD_REQUEST_TERMINATED_READ_ERROR = 4,
+  MHD_OPTION_SEND_RATE_LIMIT = 48,
 
   /**
-   * The client terminated the connection by closing the socket
-   * for writing (TCP half-closed); MHD aborted sending the
-   * response according to RFC 2616, section 8.1.4.
-   * @ingroup request
+   * Limit the rate at which the daemon receives data from all its
+   * clients together.  This option should be followed by an
+   * `unsigned int` argument giving the limit in bytes per second,
+   * default is 0 (no limit).  Same rules as for
+   * #MHD_OPTION_SEND_RATE_LIMIT.
+   * @see #MHD_CONNECTION_OPTION_RECV_RATE_LIMIT
    */
-  MHD_REQUEST_TERMINATED_CLIENT_ABORT = 5
+  MHD_OPTION_RECV_RATE_LIMIT = 49,
 
-};
+  /**
+   * Maximum number of bytes written to a connection per iteration of
+   * the event loop, so that clients with fast links downloading big
+   * responses do not hold up the other connections of a thread.
+   * This option should be followed by a `size_t` argument, default
+   * is 0 (no limit, write as much as the socket takes).
+   */
+  MHD_OPTION_WRITE_QUANTUM = 50,
 
+  /**
+   * Reject new requests with a "503 Service Unavailable" response
+   * before the access handler is called while the daemon is
+   * overloaded: when the average time its event loop takes per
+   * iteration, or the average time the access handler takes to
+   * return (including the time waiting for a handler thread, see
+   * #MHD_OPTION_HANDLER_THREADS), exceeds the given number of
+   * milliseconds.  With a thread pool, each thread decides for its
+   * own connections.  This option should be followed by an `unsigned
+   * int` argument, default is 0 (never reject).  Cannot be combined
+   * with #MHD_USE_THREAD_PER_CONNECTION.
+   */
+  MHD_OPTION_OVERLOAD_LATENCY = 51,
 
-/**
- * The `enum MHD_ConnectionNotificationCode` specifies types
- * of connection notifications.
- * @ingroup request
- */
-enum MHD_ConnectionNotificationCode
-{
+  /**
+   * Seconds sent in the "Retry-After" header of the responses to
+   * requests rejected due to #MHD_OPTION_OVERLOAD_LATENCY.  This
+   * option should be followed by an `unsigned int` argument, default
+   * is 1.
+   */
+  MHD_OPTION_OVERLOAD_RETRY_AFTER = 52,
 
   /**
-   * A new connection has been started.
-   * @ingroup request
+   * Call a function after the headers of each request are parsed,
+   * before the access handler, to assign the request a priority
+   * class.  This option should be followed by two arguments: a
+   * function of type #MHD_PriorityCallback and a pointer to a
+   * closure for it.
+   * @see #MHD_CONNECTION_OPTION_PRIORITY
    */
-  MHD_CONNECTION_NOTIFY_STARTED = 0,
+  MHD_OPTION_PRIORITY_CALLBACK = 53,
 
   /**
-   * A connection is closed.
-   * @ingroup request
+   * Call a function periodically from each thread running an event
+   * loop, with the time the loop spent blocked and processing events
+   * since the previous call.  This option should be followed by two
+   * arguments: a function of type #MHD_LoopStatsCallback and a pointer
+   * to a closure for it.
+   * @see #MHD_OPTION_LOOP_STATS_INTERVAL
    */
-  MHD_CONNECTION_NOTIFY_CLOSED = 1
+  MHD_OPTION_LOOP_STATS_CALLBACK = 54,
 
-};
+  /**
+   * Milliseconds between the calls of the #MHD_OPTION_LOOP_STATS_CALLBACK.
+   * The callback is called at the end of the first event loop
+   * iteration after the interval passed, so the intervals of an idle
+   * loop are longer.  This option should be followed by an `unsigned
+   * int` argument, default is 1000.
+   */
+  MHD_OPTION_LOOP_STATS_INTERVAL = 55,
 
+  /**
+   * Log messages asynchronously: the threads of the daemon put them
+   * into a ring buffer without locking, and a background thread
+   * writes them to the logger (see #MHD_OPTION_EXTERNAL_LOGGER), so
+   * a slow logger does not block the event loop.  Messages are
+   * dropped (and counted, see #MHD_DAEMON_INFO_STATS) while the ring
+   * is full, and truncated to 255 bytes.  This option should be
+   * followed by an `unsigned int` argument with the number of
+   * messages the ring holds (rounded up to a power of two), default
+   * is 0 (log synchronously).  Requires atomic builtins.
+   */
+  MHD_OPTION_LOG_QUEUE_SIZE = 56,
 
-/**
- * Information about a connection.
- */
-union MHD_ConnectionInfo
-{
+  /**
+   * Maximum number of messages logged per second with the same
+   * format string; further messages (for example about failed
+   * accepts during a SYN flood) are suppressed and counted, see
+   * #MHD_DAEMON_INFO_STATS.  The limit is approximate.  This option
+   * should be followed by an `unsigned int` argument, default is 0
+   * (no limit).  Requires atomic builtins.
+   */
+  MHD_OPTION_LOG_RATE_LIMIT = 57,
 
   /**
-   * Cipher algorithm used, of type "enum gnutls_cipher_algorithm".
+   * Log every completed request into a buffer of binary records of
+   * the thread serving it, and pass the records to a function in
+   * batches.  This option should be followed by two arguments: a
+   * function of type #MHD_AccessLogCallback and a pointer to a
+   * closure for it.  Not supported with
+   * #MHD_USE_THREAD_PER_CONNECTION.
+   * @see #MHD_OPTION_ACCESS_LOG_BATCH_SIZE
+   * @see #MHD_OPTION_ACCESS_LOG_INTERVAL
    */
-  int /* enum gnutls_cipher_algorithm */ cipher_algorithm;
+  MHD_OPTION_ACCESS_LOG_CALLBACK = 58,
 
   /**
-   * Protocol used, of type "enum gnutls_protocol".
+   * Log every completed request like #MHD_OPTION_ACCESS_LOG_CALLBACK,
+   * but write the batches as lines of text to a file descriptor,
+   * with one writev() per batch.  Each line holds the time in
+   * seconds since the epoch, the client address, the method and URL
+   * in double quotes, the status code, the bytes of the response
+   * body and the microseconds from the first byte of the request to
+   * the complete response.  This option should be followed by an
+   * `int` argument, the file descriptor (which MHD does not close).
+   * It may be combined with #MHD_OPTION_ACCESS_LOG_CALLBACK.
    */
-  int /* enum gnutls_protocol */ protocol;
+  MHD_OPTION_ACCESS_LOG_FD = 59,
 
   /**
-   * Connect socket
+   * Number of records each thread buffers for the access log before
+   * it passes them on.  This option should be followed by an
+   * `unsigned int` argument, default is 256.
    */
-  MHD_socket connect_fd;
+  MHD_OPTION_ACCESS_LOG_BATCH_SIZE = 60,
 
   /**
-   * GNUtls session handle, of type "gnutls_session_t".
+   * Milliseconds after which a thread passes on the records it
+   * buffered for the access log even if its buffer is not full.  The
+   * records are passed on at the end of the first event loop iteration
+   * after the interval passed.  This option should be followed by an
+   * `unsigned int` argument, default is 1000.
    */
-  void * /* gnutls_session_t */ tls_session;
+  MHD_OPTION_ACCESS_LOG_INTERVAL = 61,
 
   /**
-   * GNUtls client certificate handle, of type "gnutls_x509_crt_t".
+   * Maximum number of streams a client may open concurrently on an
+   * HTTP/2 connection (see #MHD_USE_HTTP2).  Each stream uses a
+   * memory pool of #MHD_OPTION_CONNECTION_MEMORY_LIMIT bytes.  This
+   * option should be followed by an `unsigned int` argument, default
+   * is 100.
    */
-  void * /* gnutls_x509_crt_t */ client_cert;
+  MHD_OPTION_HTTP2_MAX_CONCURRENT_STREAMS = 62,
 
   /**
-   * Address information for the client.
+   * Enable a cache of complete responses in the daemon: responses
+   * the application marks as cacheable with #MHD_RO_CACHE_TTL are
+   * served again to later "GET" and "HEAD" requests for the same
+   * target (path and arguments), and the same values of the request
+   * headers listed in the "Vary" header of the response, without
+   * calling the access handler.  With #MHD_USE_SUSPEND_RESUME,
+   * requests arriving while the access handler runs for the same
+   * target wait for its response instead of calling the handler as
+   * well.  Only HTTP/1.x requests are served from the cache.  This
+   * option should be followed by an `unsigned int` argument, the
+   * maximum number of responses cached; default is 0 (disabled).
    */
-  struct sockaddr *client_addr;
+  MHD_OPTION_RESPONSE_CACHE_SIZE = 63,
 
   /**
-   * Which daemon manages this connection (useful in case there are many
-   * daemons running).
+   * Rebalance the connections of a thread pool: a thread with more
+   * than this many connections above the thread with the fewest
+   * hands some of its idle keep-alive connections (waiting for the
+   * next request) over to that thread.  Without this, a connection
+   * stays with the thread that accepted it, so a few long-lived
+   * connections may keep one thread busy while others are idle.
+   * Not supported with #MHD_USE_IO_URING_LINUX_ONLY.  This option
+   * should be followed by an `unsigned int` argument; default is 0
+   * (disabled).
    */
-  struct MHD_Daemon *daemon;
+  MHD_OPTION_CONNECTION_REBALANCE = 64,
 
   /**
-   * Socket-specific client context.  Points to the same address as
-   * the "socket_context" of the #MHD_NotifyConnectionCallback.
+   * Maximum number of events the internal thread(s) of a
+   * #MHD_USE_EPOLL_LINUX_ONLY daemon collect with one `epoll_wait()`
+   * call.  The batch starts at 128 events and doubles (up to this
+   * value) whenever `epoll_wait()` fills it; while more events are
+   * pending, the connections that are already ready are served
+   * between the calls collecting the rest.  Daemons with very many
+   * active connections per thread may want a higher value.  This
+   * option should be followed by an `unsigned int` argument; default
+   * is 4096.
    */
-  void **socket_context;
-};
+  MHD_OPTION_EPOLL_MAX_EVENTS = 65,
 
+  /**
+   * Like #MHD_OPTION_CONNECTION_TIMEOUT, but in milliseconds
+   * (followed by an `unsigned int`; use zero for no timeout).
+   * Timeouts are checked at a granularity of about 100 ms.
+   */
+  MHD_OPTION_CONNECTION_TIMEOUT_MS = 66,
 
-/**
- * Values of this enum are used to specify what
- * information about a connection is desired.
- * @ingroup request
- */
-enum MHD_ConnectionInfoType
-{
   /**
-   * What cipher algorithm is being used.
-   * Takes no extra arguments.
-   * @ingroup request
+   * Use a listen socket passed by systemd socket activation (or any
+   * other service manager following its protocol) instead of opening
+   * one.  This option should be followed by an `unsigned int` with
+   * the index of the socket among the ones passed (zero for the
+   * first).  Starting the daemon fails if the environment
+   * variables `LISTEN_PID` and `LISTEN_FDS` do not pass a socket with
+   * this index to this process.  The variables are left as they are,
+   * so that several daemons can pick their sockets.
    */
-  MHD_CONNECTION_INFO_CIPHER_ALGO,
+  MHD_OPTION_LISTEN_SOCKET_SYSTEMD = 67,
 
   /**
-   *
-   * Takes no extra arguments.
-   * @ingroup request
+   * Receive request bodies directly into memory (or a file
+   * descriptor) of the application instead of the memory pool of
+   * the connection.  This option should be followed by two
+   * arguments: a function of type #MHD_UploadBufferCallback and a
+   * pointer to a closure for it.  Only used for bodies with a
+   * "Content-Length" (not for chunked uploads).
    */
-  MHD_CONNECTION_INFO_PROTOCOL,
+  MHD_OPTION_UPLOAD_BUFFER_CALLBACK = 68,
 
   /**
-   * Obtain IP address of the client.  Takes no extra arguments.
-   * Returns essentially a `struct sockaddr **` (since the API returns
-   * a `union MHD_ConnectionInfo *` and that union contains a `struct
-   * sockaddr *`).
-   * @ingroup request
+   * Bound the memory of all connection pools of the daemon together
+   * (followed by a `size_t` with the number of bytes; default is 0
+   * for no bound).  Every pool takes
+   * #MHD_OPTION_CONNECTION_MEMORY_LIMIT bytes of the budget for as
+   * long as it exists.  While the budget is exhausted, no further
+   * connections are accepted (like at #MHD_OPTION_CONNECTION_LIMIT),
+   * the pools of connections waiting for their next request are
+   * released, and connections that need a pool again before enough
+   * of the budget was returned are closed.  Must be at least the
+   * memory limit of one connection.
    */
-  MHD_CONNECTION_INFO_CLIENT_ADDRESS,
+  MHD_OPTION_MEMORY_BUDGET = 69,
 
   /**
-   * Get the gnuTLS session handle.
-   * @ingroup request
+   * Number of bytes of the memory pool of a connection that
+   * #MHD_connection_alloc() leaves free for MHD (followed by a
+   * `size_t`).  The default is a quarter of
+   * #MHD_OPTION_CONNECTION_MEMORY_LIMIT.
    */
-  MHD_CONNECTION_INFO_GNUTLS_SESSION,
+  MHD_OPTION_CONNECTION_ALLOC_RESERVE = 70,
 
   /**
-   * Get the gnuTLS client certificate handle.  Dysfunctional (never
-   * implemented, deprecated).  Use #MHD_CONNECTION_INFO_GNUTLS_SESSION
-   * to get the `gnutls_session_t` and then call
-   * gnutls_certificate_get_peers().
+   * Maximum number of milliseconds from the first byte of a request
+   * until its headers are received completely (followed by an
+   * `unsigned int`; default is 0 for no limit).  Unlike
+   * #MHD_OPTION_CONNECTION_TIMEOUT, the deadline is not extended by
+   * activity, so a client cannot keep the connection (and its
+   * memory pool) by sending the headers a byte at a time.  Requests
+   * that miss it are closed and counted in `header_timeouts` of
+   * `struct MHD_DaemonStats`.
    */
-  MHD_CONNECTION_INFO_GNUTLS_CLIENT_CERT,
+  MHD_OPTION_HEADER_TIMEOUT_MS = 71,
 
   /**
-   * Get the `struct MHD_Daemon *` responsible for managing this connection.
-   * @ingroup request
+   * Minimum number of bytes per second that a connection must
+   * transfer while it receives the body of a request or sends a
+   * response (followed by an `unsigned int`; default is 0 for no
+   * minimum).  The rate is checked over windows of a few seconds,
+   * and only while MHD waits for the client: time spent by the
+   * application (for example while a content reader has no data yet)
+   * does not count.  Connections that are slower are closed and
+   * counted in `slow_transfers` of `struct MHD_DaemonStats`.
    */
-  MHD_CONNECTION_INFO_DAEMON,
+  MHD_OPTION_MIN_DATA_RATE = 72,
 
   /**
-   * Request the file descriptor for the listening socket.
-   * No extra arguments should be passed.
-   * @ingroup request
+   * Let #MHD_stop_daemon() drain the connections for up to this many
+   * milliseconds before it closes them (followed by an `unsigned
+   * int`; default is 0, which closes them at once).  While draining,
+   * no connections are accepted (if the daemon can be quiesced, see
+   * #MHD_quiesce_daemon()), responses in flight are sent with
+   * "Connection: close" and connections idle between requests are
+   * closed; #MHD_stop_daemon() returns as soon as no connection is
+   * left.  Only used with internal threads; with
+   * #MHD_USE_THREAD_PER_CONNECTION, idle connections are only
+   * closed at the end of the period.
    */
-  MHD_CONNECTION_INFO_CONNECTION_FD,
+  MHD_OPTION_SHUTDOWN_GRACE_MS = 73,
 
   /**
-   * Returns the client-specific pointer to a `void *` that was (possibly)
-   * set during a #MHD_NotifyConnectionCallback when the socket was
-   * first accepted.  Note that this is NOT the same as the "con_cls"
-   * argument of the #MHD_AccessHandlerCallback.  The "con_cls" is
-   * fresh for each HTTP request, while the "socket_context" is fresh
-   * for each socket.
+   * Certificates for several host names, selected by the name the
+   * client sent with Server Name Indication (SNI).  Followed by an
+   * `unsigned int` with the number of certificates and a pointer to
+   * an array of that many `struct MHD_HttpsCertificate`, which is
+   * only used while #MHD_start_daemon() runs.  The host names are
+   * taken from the DNS names of the subject alternative name
+   * extension (or the common name if there are none) of each
+   * certificate; wildcard names like "*.example.com" match a single
+   * label.  Certificates with different key types (e.g. ECDSA and
+   * RSA) for the same names are offered together and GnuTLS picks
+   * the one the client supports.  The table is built once and looked
+   * up with a hash of the name during each handshake.  Clients
+   * sending no or an unknown name get the certificate of
+   * #MHD_OPTION_HTTPS_MEM_CERT or #MHD_OPTION_HTTPS_CERT_CALLBACK,
+   * if any.  Requires #MHD_USE_SSL and MHD built with GnuTLS.
    */
-  MHD_CONNECTION_INFO_SOCKET_CONTEXT
+  MHD_OPTION_HTTPS_CERT_TABLE = 74,
 
-};
+  /**
+   * Number of entries of a cache of Basic authorization headers the
+   * application verified, see #MHD_basic_auth_check_cached() and
+   * #MHD_basic_auth_cache_verified(), so that an expensive password
+   * check (e.g. bcrypt) is not repeated for every request of a
+   * client.  The cache keeps SHA-256 hashes of the realm and the
+   * header, not the passwords.  This option should be followed by an
+   * `unsigned int` argument, default is 0 (no cache).
+   */
+  MHD_OPTION_BASIC_AUTH_CACHE_SIZE = 75,
 
+  /**
+   * Number of seconds an entry of the cache of
+   * #MHD_OPTION_BASIC_AUTH_CACHE_SIZE is accepted after it was
+   * verified; changed or revoked passwords take effect after this
+   * time.  This option should be followed by an `unsigned int`
+   * argument, default is 60.
+   */
+  MHD_OPTION_BASIC_AUTH_CACHE_TTL = 76,
 
-/**
- * Values of this enum are used to specify what
- * information about a deamon is desired.
- */
-enum MHD_DaemonInfoType
-{
   /**
-   * No longer supported (will return NULL).
+   * Serve the connections in this many worker processes (followed by
+   * an `unsigned int`; default is 0, which serves them in the calling
+   * process).  #MHD_start_daemon() binds the listen socket and forks
+   * a supervisor process, which forks the workers and restarts those
+   * that crash.  The workers accept with SO_REUSEPORT sockets and run
+   * the threads of the daemon (#MHD_USE_SELECT_INTERNALLY or
+   * #MHD_USE_THREAD_PER_CONNECTION is required, and the options like
+   * #MHD_OPTION_THREAD_POOL_SIZE or #MHD_OPTION_CONNECTION_LIMIT
+   * apply to each worker), so the callbacks run in the worker
+   * processes.  #MHD_OPTION_PER_IP_CONNECTION_LIMIT, the nonce table
+   * of digest authentication and the counters of
+   * #MHD_DAEMON_INFO_STATS are kept in shared memory and so hold
+   * for all workers.  #MHD_stop_daemon() stops the workers and waits
+   * for them.  Not supported on W32 or without SO_REUSEPORT; the
+   * daemon should be started before the application creates threads.
    */
-  MHD_DAEMON_INFO_KEY_SIZE,
+  MHD_OPTION_PREFORK_WORKERS = 77,
 
   /**
-   * No longer supported (will return NULL).
+   * Distribute new connections by load among the threads of a thread
+   * pool: a thread with more than this many connections above the
+   * average of the threads stops watching the listen socket (as it
+   * does at its share of #MHD_OPTION_CONNECTION_LIMIT) until the
+   * others caught up.  If #MHD_OPTION_OVERLOAD_LATENCY is set, a
+   * thread whose event loop lags more than twice as much as the
+   * average also leaves the new connections to the others.  Without
+   * this, new connections go to whichever thread wakes up first.
+   * With #MHD_USE_THREAD_POOL_REUSEPORT, connections the kernel
+   * assigned to a thread that stopped accepting wait in its backlog
+   * meanwhile.  This option should be followed by an `unsigned int`
+   * argument; default is 0 (disabled).
    */
-  MHD_DAEMON_INFO_MAC_KEY_SIZE,
+  MHD_OPTION_ACCEPT_FAIR_SHARE = 78,
 
   /**
-   * Request the file descriptor for the listening socket.
-   * No extra arguments should be passed.
+   * Advertise an alternative service, such as an HTTP/3 endpoint run
+   * next to this daemon, to HTTP/1.x clients: responses without an
+   * "Alt-Svc" header of their own get one with the given value, for
+   * example `h3=":443"; ma=86400`.  HTTP/2 responses do not get it.
+   * This option should be followed by a `const char *` argument,
+   * which must remain valid until the daemon is stopped and must not
+   * contain line breaks; default is NULL (no header).
    */
-  MHD_DAEMON_INFO_LISTEN_FD,
+  MHD_OPTION_ALT_SVC = 79,
 
   /**
-   * Request the file descriptor for the external epoll.
-   * No extra arguments should be passed.
+   * Size the read buffers of new requests by the sizes of the request
+   * headers seen before instead of starting them at half of
+   * #MHD_OPTION_CONNECTION_MEMORY_LIMIT.  Each thread of the daemon
+   * keeps a histogram of the header sizes in powers of two and starts
+   * read buffers at the size holding the given percentile of them (at
+   * least #MHD_OPTION_CONNECTION_MEMORY_INCREMENT), leaving the rest
+   * of the pool for the response and #MHD_connection_alloc().  Larger
+   * requests grow their buffer as usual.  This option should be
+   * followed by an `unsigned int` argument, the percentile from 1 to
+   * 100, for example 99; default is 0 (disabled).
    */
-  MHD_DAEMON_INFO_EPOLL_FD_LINUX_ONLY,
+  MHD_OPTION_ADAPTIVE_READ_BUFFER = 80,
 
   /**
-   * Request the number of current connections handled by the daemon.
-   * No extra arguments should be passed.
+   * Let requests whose headers do not fit into the memory pool of
+   * their connection (see #MHD_OPTION_CONNECTION_MEMORY_LIMIT) borrow
+   * memory for their read buffer from an arena of this many bytes
+   * instead of failing with "413 Request Entity Too Large" or "414
+   * Request-URI Too Long".  The memory is returned once the request
+   * is complete.  Each thread of the daemon has an arena of its own;
+   * the bodies of requests do not use it.  This option should be
+   * followed by a `size_t` argument; default is 0 (no arena).
+   */
+  MHD_OPTION_HEADER_OVERFLOW_ARENA = 81,
+
+  /**
+   * Read the chunks of chunked responses created with
+   * #MHD_create_response_from_callback() into a scratch buffer of
+   * this many bytes which each thread of the daemon shares among its
+   * connections, and send them from there right away.  Only what the
+   * socket did not take is copied into the memory pool of the
+   * connection, so connections streaming to fast clients hardly use
+   * their pool (or the block buffer of the response) for the body.  Ignored with #MHD_USE_THREAD_PER_CONNECTION
+   * and #MHD_USE_SSL.  This option should be followed by a `size_t`
+   * argument; default is 0 (chunks are read into the memory pool).
+   */
+  MHD_OPTION_WRITE_SCRATCH_BUFFER = 82,
+
+  /**
+   * Number of milliseconds after which a keep-alive connection that
+   * waits for its next request is parked with
+   * #MHD_USE_THREAD_PER_CONNECTION: a single thread of the daemon
+   * then polls all parked connections, and the thread of the
+   * connection goes back to the thread cache (see
+   * #MHD_OPTION_THREAD_CACHE_SIZE, which this option requires) until
+   * the client sends data again.  Idle clients thus do not hold a
+   * thread each.  Defaults to 0 (connections keep their thread).
+   * This option should be followed by an `unsigned int` argument.
+   */
+  MHD_OPTION_PARK_IDLE_CONNECTIONS = 83,
+
+  /**
+   * Sample slow requests: record the states each request goes
+   * through together with its I/O and the lag of the event loop, and
+   * pass the timeline of requests slower than
+   * #MHD_OPTION_SLOW_REQUEST_THRESHOLD_MS (or closed by a timeout) to
+   * a function.  This option should be followed by two arguments: a
+   * function of type #MHD_SlowRequestCallback and a pointer to a
+   * closure to pass to it.  Requests pay a timestamp per state change.
+   */
+  MHD_OPTION_SLOW_REQUEST_CALLBACK = 84,
+
+  /**
+   * Requests taking at least this many milliseconds from their first
+   * byte to the last byte of the response are passed to the
+   * #MHD_OPTION_SLOW_REQUEST_CALLBACK.  This option should be followed
+   * by an `unsigned int` argument; default is 0, which only passes
+   * requests closed because of a timeout.
+   */
+  MHD_OPTION_SLOW_REQUEST_THRESHOLD_MS = 85,
+
+  /**
+   * Decompress request bodies sent with "Content-Encoding: gzip" (or
+   * "x-gzip") or "deflate" while they are received, so that the
+   * access handler (and a #MHD_PostProcessor) gets the plain body.
+   * The "Content-Encoding" and "Content-Length" headers still
+   * describe the body as sent.  This option should be followed by an
+   * `unsigned int` argument: the maximum ratio of decompressed to
+   * received bytes (measured over at least the first kilobyte), as
+   * protection against small bodies that decompress to gigabytes.
+   * Requests exceeding it are answered with 413, corrupt or
+   * truncated bodies with 400.  Default is 0, which passes all bodies
+   * as received.  Requires zlib, see #MHD_FEATURE_COMPRESSION.
    */
-  MHD_DAEMON_INFO_CURRENT_CONNECTIONS
+  MHD_OPTION_INFLATE_REQUEST_BODY = 86
 };
 
 
 /**
- * Callback for serious error condition. The default action is to print
- * an error message and `abort()`.
- *
- * @param cls user specified value
- * @param file where the error occured
- * @param line where the error occured
- * @param reason error detail, may be NULL
- * @ingroup logging
+ * Certificate for #MHD_OPTION_HTTPS_CERT_TABLE.
  */
-typedef void
-(*MHD_PanicCallback) (void *cls,
-                      const char *file,
-                      unsigned int line,
-                      const char *reason);
-
+struct MHD_HttpsCertificate
+{
+  /**
+   * Certificate (chain) in PEM format.
+   */
+  const char *mem_cert;
+
+  /**
+   * Private key of the certificate in PEM format.
+   */
+  const char *mem_key;
+
+  /**
+   * Password of @e mem_key, NULL if it is not encrypted.
+   */
+  const char *key_password;
+};
+
+
+/**
+ * Entry in an #MHD_OPTION_ARRAY.
+ */
+struct MHD_OptionItem
+{
+  /**
+   * Which option is being given.  Use #MHD_OPTION_END
+   * to terminate the array.
+   */
+  enum MHD_OPTION option;
+
+  /**
+   * Option value (for integer arguments, and for options requiring
+   * two pointer arguments); should be 0 for options that take no
+   * arguments or only a single pointer argument.
+   */
+  intptr_t value;
+
+  /**
+   * Pointer option value (use NULL for options taking no arguments
+   * or only an integer option).
+   */
+  void *ptr_value;
+
+};
+
+
+/**
+ * The `enum MHD_ValueKind` specifies the source of
+ * the key-value pairs in the HTTP protocol.
+ */
+enum MHD_ValueKind
+{
+
+  /**
+   * Response header
+   */
+  MHD_RESPONSE_HEADER_KIND = 0,
+
+  /**
+   * HTTP header.
+   */
+  MHD_HEADER_KIND = 1,
+
+  /**
+   * Cookies.  Note that the original HTTP header containing
+   * the cookie(s) will still be available and intact.
+   */
+  MHD_COOKIE_KIND = 2,
+
+  /**
+   * POST data.  This is available only if a content encoding
+   * supported by MHD is used (currently only URL encoding),
+   * and only if the posted content fits within the available
+   * memory pool.  Note that in that case, the upload data
+   * given to the #MHD_AccessHandlerCallback will be
+   * empty (since it has already been processed).
+   */
+  MHD_POSTDATA_KIND = 4,
+
+  /**
+   * GET (URI) arguments.
+   */
+  MHD_GET_ARGUMENT_KIND = 8,
+
+  /**
+   * HTTP footer (only for HTTP 1.1 chunked encodings).
+   */
+  MHD_FOOTER_KIND = 16,
+
+  /**
+   * Parameters captured from the path by the route of the request
+   * (see #MHD_router_add()).
+   */
+  MHD_ROUTE_PARAMETER_KIND = 32
+};
+
+
+/**
+ * The `enum MHD_HeaderToken` identifies well-known header names.
+ * MHD classifies the names of request headers and footers when
+ * parsing them, so that they can be looked up using
+ * #MHD_lookup_connection_token_value() without comparing strings.
+ * @ingroup request
+ */
+enum MHD_HeaderToken
+{
+
+  /**
+   * Not a well-known header.
+   */
+  MHD_HEADER_TOKEN_NONE = 0,
+
+  /**
+   * #MHD_HTTP_HEADER_ACCEPT
+   */
+  MHD_HEADER_TOKEN_ACCEPT = 1,
+
+  /**
+   * #MHD_HTTP_HEADER_ACCEPT_ENCODING
+   */
+  MHD_HEADER_TOKEN_ACCEPT_ENCODING = 2,
+
+  /**
+   * #MHD_HTTP_HEADER_AUTHORIZATION
+   */
+  MHD_HEADER_TOKEN_AUTHORIZATION = 3,
+
+  /**
+   * #MHD_HTTP_HEADER_CONNECTION
+   */
+  MHD_HEADER_TOKEN_CONNECTION = 4,
+
+  /**
+   * #MHD_HTTP_HEADER_CONTENT_ENCODING
+   */
+  MHD_HEADER_TOKEN_CONTENT_ENCODING = 5,
+
+  /**
+   * #MHD_HTTP_HEADER_CONTENT_LENGTH
+   */
+  MHD_HEADER_TOKEN_CONTENT_LENGTH = 6,
+
+  /**
+   * #MHD_HTTP_HEADER_CONTENT_TYPE
+   */
+  MHD_HEADER_TOKEN_CONTENT_TYPE = 7,
+
+  /**
+   * #MHD_HTTP_HEADER_COOKIE
+   */
+  MHD_HEADER_TOKEN_COOKIE = 8,
+
+  /**
+   * #MHD_HTTP_HEADER_DATE
+   */
+  MHD_HEADER_TOKEN_DATE = 9,
+
+  /**
+   * #MHD_HTTP_HEADER_EXPECT
+   */
+  MHD_HEADER_TOKEN_EXPECT = 10,
+
+  /**
+   * #MHD_HTTP_HEADER_HOST
+   */
+  MHD_HEADER_TOKEN_HOST = 11,
+
+  /**
+   * #MHD_HTTP_HEADER_IF_MODIFIED_SINCE
+   */
+  MHD_HEADER_TOKEN_IF_MODIFIED_SINCE = 12,
+
+  /**
+   * #MHD_HTTP_HEADER_IF_NONE_MATCH
+   */
+  MHD_HEADER_TOKEN_IF_NONE_MATCH = 13,
+
+  /**
+   * #MHD_HTTP_HEADER_RANGE
+   */
+  MHD_HEADER_TOKEN_RANGE = 14,
+
+  /**
+   * #MHD_HTTP_HEADER_TRANSFER_ENCODING
+   */
+  MHD_HEADER_TOKEN_TRANSFER_ENCODING = 15,
+
+  /**
+   * #MHD_HTTP_HEADER_UPGRADE
+   */
+  MHD_HEADER_TOKEN_UPGRADE = 16,
+
+  /**
+   * #MHD_HTTP_HEADER_USER_AGENT
+   */
+  MHD_HEADER_TOKEN_USER_AGENT = 17
+};
+
+
+/**
+ * The `enum MHD_RequestTerminationCode` specifies reasons
+ * why a request has been terminated (or completed).
+ * @ingroup request
+ */
+enum MHD_RequestTerminationCode
+{
+
+  /**
+   * We finished sending the response.
+   * @ingroup request
+   */
+  MHD_REQUEST_TERMINATED_COMPLETED_OK = 0,
+
+  /**
+   * Error handling the connection (resources
+   * exhausted, other side closed connection,
+   * application error accepting request, etc.)
+   * @ingroup request
+   */
+  MHD_REQUEST_TERMINATED_WITH_ERROR = 1,
+
+  /**
+   * No activity on the connection for the number
+   * of seconds specified using
+   * #MHD_OPTION_CONNECTION_TIMEOUT.
+   * @ingroup request
+   */
+  MHD_REQUEST_TERMINATED_TIMEOUT_REACHED = 2,
+
+  /**
+   * We had to close the session since MHD was being
+   * shut down.
+   * @ingroup request
+   */
+  MHD_REQUEST_TERMINATED_DAEMON_SHUTDOWN = 3,
+
+  /**
+   * We tried to read additional data, but the other side closed the
+   * connection.  This error is similar to
+   * #MHD_REQUEST_TERMINATED_WITH_ERROR, but specific to the case where
+   * the connection died because the other side did not send expected
+   * data.
+   * @ingroup request
+   */
+  MHD_REQUEST_TERMINATED_READ_ERROR = 4,
+
+  /**
+   * The client terminated the connection by closing the socket
+   * for writing (TCP half-closed); MHD aborted sending the
+   * response according to RFC 2616, section 8.1.4.
+   * @ingroup request
+   */
+  MHD_REQUEST_TERMINATED_CLIENT_ABORT = 5
+
+};
+
+
+/**
+ * The `enum MHD_ConnectionNotificationCode` specifies types
+ * of connection notifications.
+ * @ingroup request
+ */
+enum MHD_ConnectionNotificationCode
+{
+
+  /**
+   * A new connection has been started.
+   * @ingroup request
+   */
+  MHD_CONNECTION_NOTIFY_STARTED = 0,
+
+  /**
+   * A connection is closed.
+   * @ingroup request
+   */
+  MHD_CONNECTION_NOTIFY_CLOSED = 1
+
+};
+
+
+/**
+ * Events a socket is waited for, see #MHD_OPTION_NOTIFY_SOCKET;
+ * values are combined with bitwise OR.
+ * @ingroup event
+ */
+enum MHD_SocketInterest
+{
+
+  /**
+   * The socket is not to be waited for right now (but stays open).
+   */
+  MHD_SOCKET_INTEREST_NONE = 0,
+
+  /**
+   * Wait for the socket to become readable.
+   */
+  MHD_SOCKET_INTEREST_READ = 1,
+
+  /**
+   * Wait for the socket to become writable.
+   */
+  MHD_SOCKET_INTEREST_WRITE = 2,
+
+  /**
+   * The socket is about to be closed (or handed back to the
+   * application), remove it from the event loop.  Never combined
+   * with other values.
+   */
+  MHD_SOCKET_INTEREST_REMOVE = 4
+
+};
+
+
+/**
+ * When the phases of the current request on a connection were
+ * reached, see #MHD_CONNECTION_INFO_REQUEST_TIMES.  All values are
+ * microseconds of a monotonic clock with an arbitrary origin, so only
+ * differences between them are meaningful.  Phases not reached (yet)
+ * are zero.  On a keep-alive connection all values except @e accepted
+ * are reset when the next request starts.
+ */
+struct MHD_RequestTimes
+{
+  /**
+   * The connection was accepted (or added with #MHD_add_connection()).
+   */
+  uint64_t accepted;
+
+  /**
+   * The first byte of the request was received.
+   */
+  uint64_t first_byte;
+
+  /**
+   * The request line and headers were parsed.
+   */
+  uint64_t headers_received;
+
+  /**
+   * The #MHD_AccessHandlerCallback was called for the first time.
+   */
+  uint64_t handler_called;
+
+  /**
+   * A response was queued with #MHD_queue_response().
+   */
+  uint64_t response_queued;
+
+  /**
+   * The response headers were sent.
+   */
+  uint64_t headers_sent;
+
+  /**
+   * The response body (and footers) were sent completely.
+   */
+  uint64_t body_sent;
+};
+
+
+/**
+ * Credentials of the peer process of an AF_UNIX connection, see
+ * #MHD_CONNECTION_INFO_PEER_CREDENTIALS.
+ */
+struct MHD_PeerCredentials
+{
+  /**
+   * Process ID of the peer, -1 if the platform does not report it.
+   */
+  int64_t pid;
+
+  /**
+   * Effective user ID of the peer.
+   */
+  uint32_t uid;
+
+  /**
+   * Effective group ID of the peer.
+   */
+  uint32_t gid;
+};
+
+
+/**
+ * Maximum length of the method in a `struct MHD_AccessLogRecord`,
+ * including the 0-terminator.
+ */
+#define MHD_ACCESS_LOG_METHOD_SIZE 16
+
+/**
+ * Maximum length of the URL in a `struct MHD_AccessLogRecord`,
+ * including the 0-terminator.  Longer URLs are truncated.
+ */
+#define MHD_ACCESS_LOG_URL_SIZE 256
+
+
+/**
+ * Record of a completed request, see #MHD_OPTION_ACCESS_LOG_CALLBACK.
+ */
+struct MHD_AccessLogRecord
+{
+  /**
+   * Seconds since the epoch when the response was sent completely.
+   */
+  uint64_t time;
+
+  /**
+   * When the phases of the request were reached.
+   */
+  struct MHD_RequestTimes times;
+
+  /**
+   * Bytes of the response body sent.
+   */
+  uint64_t bytes_sent;
+
+  /**
+   * HTTP status code of the response.
+   */
+  unsigned int status;
+
+  /**
+   * Length of @e addr.
+   */
+  socklen_t addr_len;
+
+  /**
+   * Address of the client.
+   */
+  struct sockaddr_storage addr;
+
+  /**
+   * HTTP method of the request, 0-terminated.
+   */
+  char method[MHD_ACCESS_LOG_METHOD_SIZE];
+
+  /**
+   * URL of the request (without arguments), 0-terminated.
+   */
+  char url[MHD_ACCESS_LOG_URL_SIZE];
+};
+
+
+/**
+ * Number of steps kept in a `struct MHD_SlowRequest`.
+ */
+#define MHD_SLOW_REQUEST_STEPS 32
+
+
+/**
+ * A state a request sampled by #MHD_OPTION_SLOW_REQUEST_CALLBACK went
+ * through.  The counters are totals of the request when the state was
+ * entered.
+ */
+struct MHD_SlowRequestStep
+{
+  /**
+   * Name of the state entered, for example "headers received".
+   */
+  const char *state;
+
+  /**
+   * When the state was entered, see `struct MHD_RequestTimes`.
+   */
+  uint64_t time;
+
+  /**
+   * Microseconds the event loop had been busy with the events of its
+   * iteration when the state was entered; 0 with
+   * #MHD_USE_THREAD_PER_CONNECTION.  A large lag means the request
+   * waited for other connections.
+   */
+  uint64_t loop_lag;
+
+  /**
+   * Bytes received from the client (encrypted bytes with HTTPS).
+   */
+  uint64_t bytes_received;
+
+  /**
+   * Bytes sent to the client (encrypted bytes with HTTPS).
+   */
+  uint64_t bytes_sent;
+
+  /**
+   * Calls reading from the socket that returned data.
+   */
+  unsigned int reads;
+
+  /**
+   * Calls writing to the socket that sent data.
+   */
+  unsigned int writes;
+
+  /**
+   * Bytes of the memory pool of the connection in use.
+   */
+  size_t pool_used;
+};
+
+
+/**
+ * Timeline of a slow request, see #MHD_OPTION_SLOW_REQUEST_CALLBACK.
+ */
+struct MHD_SlowRequest
+{
+  /**
+   * When the phases of the request were reached.
+   */
+  struct MHD_RequestTimes times;
+
+  /**
+   * Microseconds from the first byte of the request to the last byte
+   * of the response (or to the close of the connection).
+   */
+  uint64_t duration;
+
+  /**
+   * Microseconds the TLS handshake of the connection took after it
+   * was accepted, 0 without TLS.
+   */
+  uint64_t tls_handshake;
+
+  /**
+   * Bytes received from the client for the request.
+   */
+  uint64_t bytes_received;
+
+  /**
+   * Bytes sent to the client for the request.
+   */
+  uint64_t bytes_sent;
+
+  /**
+   * Calls reading from the socket that returned data.
+   */
+  unsigned int reads;
+
+  /**
+   * Calls writing to the socket that sent data.
+   */
+  unsigned int writes;
+
+  /**
+   * Times sendfile() failed and the body was sent with send()
+   * instead.
+   */
+  unsigned int sendfile_fallbacks;
+
+  /**
+   * Peak use of the memory pool of the connection in bytes.
+   */
+  size_t pool_peak;
+
+  /**
+   * HTTP method of the request, NULL if it was not received.
+   */
+  const char *method;
+
+  /**
+   * URL of the request, NULL if it was not received.
+   */
+  const char *url;
+
+  /**
+   * HTTP status code of the response, 0 if none was queued.
+   */
+  unsigned int status;
+
+  /**
+   * #MHD_YES if the connection was closed before the response was
+   * sent completely.
+   */
+  int aborted;
+
+  /**
+   * The reason the connection was closed if @e aborted.
+   */
+  enum MHD_RequestTerminationCode termination_code;
+
+  /**
+   * Number of entries in @e steps.
+   */
+  unsigned int num_steps;
+
+  /**
+   * Number of steps (of the beginning of the request) that did not
+   * fit into @e steps.
+   */
+  unsigned int steps_dropped;
+
+  /**
+   * The last states the request went through, oldest first.
+   */
+  struct MHD_SlowRequestStep steps[MHD_SLOW_REQUEST_STEPS];
+};
+
+
+/**
+ * Information about a connection.
+ */
+union MHD_ConnectionInfo
+{
+
+  /**
+   * Cipher algorithm used, of type "enum gnutls_cipher_algorithm"
+   * (with OpenSSL, the number of the cipher suite, 0xC02F for
+   * ECDHE-RSA-AES128-GCM-SHA256).
+   */
+  int /* enum gnutls_cipher_algorithm */ cipher_algorithm;
+
+  /**
+   * Protocol used, of type "enum gnutls_protocol" (with OpenSSL,
+   * the version number of the protocol, 0x0303 for TLS 1.2).
+   */
+  int /* enum gnutls_protocol */ protocol;
+
+  /**
+   * Connect socket
+   */
+  MHD_socket connect_fd;
+
+  /**
+   * GNUtls session handle, of type "gnutls_session_t" (with
+   * OpenSSL, of type "SSL *").
+   */
+  void * /* gnutls_session_t */ tls_session;
+
+  /**
+   * GNUtls client certificate handle, of type "gnutls_x509_crt_t".
+   */
+  void * /* gnutls_x509_crt_t */ client_cert;
+
+  /**
+   * Address information for the client.
+   */
+  struct sockaddr *client_addr;
+
+  /**
+   * Which daemon manages this connection (useful in case there are many
+   * daemons running).
+   */
+  struct MHD_Daemon *daemon;
+
+  /**
+   * Socket-specific client context.  Points to the same address as
+   * the "socket_context" of the #MHD_NotifyConnectionCallback.
+   */
+  void **socket_context;
+
+  /**
+   * Phase timestamps of the current request.
+   */
+  struct MHD_RequestTimes request_times;
+
+  /**
+   * Credentials of the peer of an AF_UNIX connection.
+   */
+  struct MHD_PeerCredentials peer_credentials;
+};
+
+
+/**
+ * Values of this enum are used to specify what
+ * information about a connection is desired.
+ * @ingroup request
+ */
+enum MHD_ConnectionInfoType
+{
+  /**
+   * What cipher algorithm is being used.
+   * Takes no extra arguments.
+   * @ingroup request
+   */
+  MHD_CONNECTION_INFO_CIPHER_ALGO,
+
+  /**
+   *
+   * Takes no extra arguments.
+   * @ingroup request
+   */
+  MHD_CONNECTION_INFO_PROTOCOL,
+
+  /**
+   * Obtain IP address of the client.  Takes no extra arguments.
+   * Returns essentially a `struct sockaddr **` (since the API returns
+   * a `union MHD_ConnectionInfo *` and that union contains a `struct
+   * sockaddr *`).  For connections to an AF_UNIX listen socket the
+   * address has the family AF_UNIX and usually no path, as clients
+   * rarely bind their sockets; use #MHD_CONNECTION_INFO_PEER_CREDENTIALS
+   * to identify the client instead.
+   * @ingroup request
+   */
+  MHD_CONNECTION_INFO_CLIENT_ADDRESS,
+
+  /**
+   * Get the gnuTLS session handle (the `SSL *` if MHD was built
+   * with OpenSSL).
+   * @ingroup request
+   */
+  MHD_CONNECTION_INFO_GNUTLS_SESSION,
+
+  /**
+   * Get the gnuTLS client certificate handle.  Dysfunctional (never
+   * implemented, deprecated).  Use #MHD_CONNECTION_INFO_GNUTLS_SESSION
+   * to get the `gnutls_session_t` and then call
+   * gnutls_certificate_get_peers().
+   */
+  MHD_CONNECTION_INFO_GNUTLS_CLIENT_CERT,
+
+  /**
+   * Get the `struct MHD_Daemon *` responsible for managing this connection.
+   * @ingroup request
+   */
+  MHD_CONNECTION_INFO_DAEMON,
+
+  /**
+   * Request the file descriptor for the listening socket.
+   * No extra arguments should be passed.
+   * @ingroup request
+   */
+  MHD_CONNECTION_INFO_CONNECTION_FD,
+
+  /**
+   * Returns the client-specific pointer to a `void *` that was (possibly)
+   * set during a #MHD_NotifyConnectionCallback when the socket was
+   * first accepted.  Note that this is NOT the same as the "con_cls"
+   * argument of the #MHD_AccessHandlerCallback.  The "con_cls" is
+   * fresh for each HTTP request, while the "socket_context" is fresh
+   * for each socket.
+   */
+  MHD_CONNECTION_INFO_SOCKET_CONTEXT,
+
+  /**
+   * Returns the `struct MHD_RequestTimes` with the phase timestamps of
+   * the current request.  Can be used from the
+   * #MHD_RequestCompletedCallback, where all phases the request went
+   * through are filled in.
+   * @ingroup request
+   */
+  MHD_CONNECTION_INFO_REQUEST_TIMES,
+
+  /**
+   * Returns the `struct MHD_PeerCredentials` of the client process
+   * (SO_PEERCRED or getpeereid()).  Only available for connections
+   * to AF_UNIX sockets on platforms that support it, NULL otherwise.
+   * @ingroup request
+   */
+  MHD_CONNECTION_INFO_PEER_CREDENTIALS
+
+};
+
+
+/**
+ * Values of this enum are used to specify what
+ * information about a deamon is desired.
+ */
+enum MHD_DaemonInfoType
+{
+  /**
+   * No longer supported (will return NULL).
+   */
+  MHD_DAEMON_INFO_KEY_SIZE,
+
+  /**
+   * No longer supported (will return NULL).
+   */
+  MHD_DAEMON_INFO_MAC_KEY_SIZE,
+
+  /**
+   * Request the file descriptor for the listening socket.
+   * No extra arguments should be passed.
+   */
+  MHD_DAEMON_INFO_LISTEN_FD,
+
+  /**
+   * Request the file descriptor for the external epoll.
+   * No extra arguments should be passed.
+   */
+  MHD_DAEMON_INFO_EPOLL_FD_LINUX_ONLY,
+
+  /**
+   * Request the number of current connections handled by the daemon.
+   * No extra arguments should be passed.
+   */
+  MHD_DAEMON_INFO_CURRENT_CONNECTIONS,
+
+  /**
+   * Request a snapshot of the statistics of the daemon, summed up
+   * over the threads of a thread pool, see `struct MHD_DaemonStats`.
+   * No extra arguments should be passed.
+   */
+  MHD_DAEMON_INFO_STATS
+};
+
+
+/**
+ * Callback for serious error condition. The default action is to print
+ * an error message and `abort()`.
+ *
+ * @param cls user specified value
+ * @param file where the error occured
+ * @param line where the error occured
+ * @param reason error detail, may be NULL
+ * @ingroup logging
+ */
+typedef void
+(*MHD_PanicCallback) (void *cls,
+                      const char *file,
+                      unsigned int line,
+                      const char *reason);
+
 /**
  * Allow or deny a client to connect.
  *
@@ -1412,6 +2702,217 @@ typedef void
                                  enum MHD_ConnectionNotificationCode toe);
 
 
+/**
+ * Priority classes of connections, see
+ * #MHD_CONNECTION_OPTION_PRIORITY.
+ */
+enum MHD_ConnectionPriority
+{
+
+  /**
+   * The default: connections are served in the order they become
+   * ready.
+   */
+  MHD_PRIORITY_NORMAL = 0,
+
+  /**
+   * Served before the connections of #MHD_PRIORITY_NORMAL that are
+   * ready at the same time (with epoll, kqueue and io_uring), and
+   * never rejected due to #MHD_OPTION_OVERLOAD_LATENCY.  Meant for
+   * health checks and control traffic that must not queue behind
+   * bulk traffic.
+   */
+  MHD_PRIORITY_HIGH = 1
+
+};
+
+
+/**
+ * Signature of the callback used by MHD to assign a request a
+ * priority class, see #MHD_OPTION_PRIORITY_CALLBACK.  It is called
+ * once the headers of a request are parsed, before the access handler
+ * and before the request may be rejected due to overload; the headers
+ * can be inspected with #MHD_lookup_connection_value().
+ *
+ * @param cls client-defined closure
+ * @param connection connection handle
+ * @param url the requested url
+ * @param method the HTTP method used (#MHD_HTTP_METHOD_GET, ...)
+ * @return the priority class for the connection, which stays in
+ *         effect until the next request of the connection
+ * @ingroup request
+ */
+typedef enum MHD_ConnectionPriority
+(*MHD_PriorityCallback) (void *cls,
+                         struct MHD_Connection *connection,
+                         const char *url,
+                         const char *method);
+
+
+/**
+ * Function called to obtain the destination for the next part of the
+ * body of a request, see #MHD_OPTION_UPLOAD_BUFFER_CALLBACK.  It is
+ * called whenever MHD is about to receive body data and has none
+ * buffered for the access handler, after the first call of the
+ * access handler for the request.
+ *
+ * The application either returns a buffer of `*size` bytes or, for
+ * a request received without TLS on a platform with splice(), sets
+ * @a fd to a (blocking) descriptor to which MHD moves up to `*size`
+ * bytes with splice(), without copying them through user space.
+ * Once the buffer is full (or the descriptor got `*size` bytes, or
+ * the body is complete), the access handler is called with
+ * `upload_data` pointing to the buffer, or NULL for a descriptor,
+ * and `*upload_data_size` the number of bytes received; it must
+ * process all of them and set `*upload_data_size` to zero.  The
+ * buffer must stay valid until then.
+ *
+ * @param cls client-defined closure
+ * @param connection connection handle
+ * @param con_cls value set by the access handler for this request
+ * @param remaining number of body bytes still to be received
+ * @param[in,out] size set to the size of the returned buffer, or the
+ *        maximum number of bytes to splice into @a fd
+ * @param[out] fd set to the descriptor to splice to, initially -1
+ * @return the buffer, NULL to splice to @a fd or (if @a fd is left
+ *         at -1) to receive this part into the memory pool as usual
+ * @ingroup request
+ */
+typedef void *
+(*MHD_UploadBufferCallback) (void *cls,
+                             struct MHD_Connection *connection,
+                             void **con_cls,
+                             uint64_t remaining,
+                             size_t *size,
+                             int *fd);
+
+
+/**
+ * Profile of one event loop thread over an interval, passed to the
+ * #MHD_LoopStatsCallback.  Times are in microseconds.
+ */
+struct MHD_LoopStats
+{
+  /**
+   * Index of the thread in the thread pool, 0 without a pool.
+   */
+  unsigned int worker;
+
+  /**
+   * Length of the interval.
+   */
+  uint64_t interval_usec;
+
+  /**
+   * Iterations of the event loop.
+   */
+  uint64_t iterations;
+
+  /**
+   * Returns from the wait system call (select(), poll(),
+   * epoll_wait(), kevent() or io_uring_enter()).
+   */
+  uint64_t wakeups;
+
+  /**
+   * Events returned by the wait system call, summed over all
+   * wakeups.
+   */
+  uint64_t events;
+
+  /**
+   * Time spent blocked in the wait system call.
+   */
+  uint64_t wait_usec;
+
+  /**
+   * Time spent processing the events.
+   */
+  uint64_t dispatch_usec;
+};
+
+
+/**
+ * Signature of the callback used by MHD to report the profile of an
+ * event loop thread, see #MHD_OPTION_LOOP_STATS_CALLBACK.  It is
+ * called from the thread running the loop (or from #MHD_run()), so
+ * it must return quickly.
+ *
+ * @param cls client-defined closure
+ * @param stats profile of the thread since the previous call
+ * @ingroup event
+ */
+typedef void
+(*MHD_LoopStatsCallback) (void *cls,
+                          const struct MHD_LoopStats *stats);
+
+
+/**
+ * Signature of the callback used by MHD to pass a batch of records of
+ * completed requests, see #MHD_OPTION_ACCESS_LOG_CALLBACK.  It is
+ * called from the thread that served the requests, so it must return
+ * quickly; the records are only valid during the call.
+ *
+ * @param cls client-defined closure
+ * @param records the records, oldest first
+ * @param num_records number of @a records
+ * @ingroup logging
+ */
+typedef void
+(*MHD_AccessLogCallback) (void *cls,
+                          const struct MHD_AccessLogRecord *records,
+                          unsigned int num_records);
+
+
+/**
+ * Signature of the callback used by MHD to pass the timeline of a
+ * slow request, see #MHD_OPTION_SLOW_REQUEST_CALLBACK.  It is called
+ * from the thread that served the request, so it must return
+ * quickly; @a request is only valid during the call.
+ *
+ * @param cls client-defined closure
+ * @param connection the connection of the request
+ * @param request timeline of the request
+ * @ingroup logging
+ */
+typedef void
+(*MHD_SlowRequestCallback) (void *cls,
+                            struct MHD_Connection *connection,
+                            const struct MHD_SlowRequest *request);
+
+
+/**
+ * Signature of the callback used by MHD to tell an application
+ * driving the event loop which events to wait for on one of the
+ * sockets of the daemon, see #MHD_OPTION_NOTIFY_SOCKET.  It is only
+ * called when the events change: with the first call for a socket
+ * the application starts watching it, after a call with
+ * #MHD_SOCKET_INTEREST_REMOVE it must forget about it.  The callback
+ * is invoked from #MHD_start_daemon() (for the listen socket and the
+ * wakeup pipe), #MHD_run_socket(), #MHD_run(),
+ * #MHD_run_from_select(), #MHD_suspend_connection(),
+ * #MHD_add_connection() and #MHD_stop_daemon(), and must not call
+ * back into MHD.
+ *
+ * @param cls client-defined closure
+ * @param sock the socket
+ * @param interest bitmask of `enum MHD_SocketInterest` values
+ * @param handle value to pass to #MHD_run_socket() when @a sock
+ *        is ready, the same for all calls for a socket
+ * @param sock_cls socket-specific pointer where the client can
+ *        keep its state for @a sock (for example the handle of its
+ *        event loop), NULL for the first call for a socket
+ * @see #MHD_OPTION_NOTIFY_SOCKET
+ * @ingroup event
+ */
+typedef void
+(*MHD_NotifySocketCallback) (void *cls,
+                             MHD_socket sock,
+                             unsigned int interest,
+                             void *handle,
+                             void **sock_cls);
+
+
 /**
  * Iterator over key-value pairs.  This iterator
  * can be used to iterate over all of the cookies,
@@ -1434,6 +2935,30 @@ typedef int
                          const char *value);
 
 
+/**
+ * Iterator over key-value pairs, with the sizes of keys and values.
+ * Keys and values are still 0-terminated, but may contain binary
+ * zeros before the end given by their size.
+ *
+ * @param cls closure
+ * @param kind kind of the header we are looking at
+ * @param key key for the value, can be an empty string
+ * @param key_size number of bytes in @a key
+ * @param value corresponding value, can be NULL
+ * @param value_size number of bytes in @a value, 0 if @a value is NULL
+ * @return #MHD_YES to continue iterating,
+ *         #MHD_NO to abort the iteration
+ * @ingroup request
+ */
+typedef int
+(*MHD_KeyValueIteratorN) (void *cls,
+                          enum MHD_ValueKind kind,
+                          const char *key,
+                          size_t key_size,
+                          const char *value,
+                          size_t value_size);
+
+
 /**
  * Callback used by libmicrohttpd in order to obtain content.  The
  * callback is to copy at most @a max bytes of content into @a buf.  The
@@ -1460,6 +2985,11 @@ typedef int
  *    this would cause busy-waiting); 0 in external select mode
  *    will cause this function to be called again once the external
  *    select calls MHD again;
+ *  #MHD_CONTENT_READER_PENDING (-3) if no data is available yet and
+ *    the application will call #MHD_response_data_ready() once
+ *    there is; MHD suspends the connection until then instead
+ *    of calling this function again (only with
+ *    #MHD_USE_SUSPEND_RESUME, otherwise this is the same as 0);
  *  #MHD_CONTENT_READER_END_OF_STREAM (-1) for the regular
  *    end of transmission (with chunked encoding, MHD will then
  *    terminate the chunk and send any HTTP footers that might be
@@ -1571,35 +3101,144 @@ MHD_start_daemon_va (unsigned int flags,
  * @return NULL on error, handle to daemon on success
  * @ingroup event
  */
-_MHD_EXTERN struct MHD_Daemon *
-MHD_start_daemon (unsigned int flags,
-		  uint16_t port,
-		  MHD_AcceptPolicyCallback apc, void *apc_cls,
-		  MHD_AccessHandlerCallback dh, void *dh_cls,
-		  ...);
+_MHD_EXTERN struct MHD_Daemon *
+MHD_start_daemon (unsigned int flags,
+		  uint16_t port,
+		  MHD_AcceptPolicyCallback apc, void *apc_cls,
+		  MHD_AccessHandlerCallback dh, void *dh_cls,
+		  ...);
+
+
+/**
+ * Stop accepting connections from the listening socket.  Allows
+ * clients to continue processing, but stops accepting new
+ * connections.  Note that the caller is responsible for closing the
+ * returned socket; however, if MHD is run using threads (anything but
+ * external select mode), it must not be closed until AFTER
+ * #MHD_stop_daemon has been called (as it is theoretically possible
+ * that an existing thread is still using it).
+ *
+ * Note that some thread modes require the caller to have passed
+ * #MHD_USE_PIPE_FOR_SHUTDOWN when using this API.  If this daemon is
+ * in one of those modes and this option was not given to
+ * #MHD_start_daemon, this function will return #MHD_INVALID_SOCKET.
+ *
+ * @param daemon daemon to stop accepting new connections for
+ * @return old listen socket on success, #MHD_INVALID_SOCKET if
+ *         the daemon was already not listening anymore
+ * @ingroup specialized
+ */
+_MHD_EXTERN MHD_socket
+MHD_quiesce_daemon (struct MHD_Daemon *daemon);
+
+
+/**
+ * Hand the listen socket of @a daemon over to another process for a
+ * restart without refusing connections.  The socket is sent over
+ * @a channel (a connected AF_UNIX socket) to the successor, which
+ * obtains it with #MHD_receive_listen_socket() and passes it to its
+ * daemon with #MHD_OPTION_LISTEN_SOCKET.  Afterwards @a daemon stops
+ * accepting connections like after #MHD_quiesce_daemon() and drains
+ * its connections: requests in progress are completed, but answered
+ * with "Connection: close", and idle keep-alive connections are
+ * closed.  Once #MHD_DAEMON_INFO_CURRENT_CONNECTIONS reports no
+ * connections, the daemon can be stopped.
+ *
+ * With #MHD_USE_THREAD_PER_CONNECTION, idle keep-alive connections
+ * are only closed by their timeout.
+ *
+ * @param daemon daemon to hand the listen socket over from
+ * @param channel connected AF_UNIX socket to the successor
+ * @return old listen socket on success (to be closed like the one
+ *         returned by #MHD_quiesce_daemon()), #MHD_INVALID_SOCKET
+ *         if the socket could not be sent (the daemon then keeps
+ *         accepting connections) or is not supported, see
+ *         #MHD_FEATURE_SOCKET_HANDOFF
+ * @ingroup specialized
+ */
+_MHD_EXTERN MHD_socket
+MHD_handoff_listen_socket (struct MHD_Daemon *daemon,
+                           MHD_socket channel);
+
+
+/**
+ * Receive a listen socket sent by #MHD_handoff_listen_socket() of
+ * the predecessor of this process.  Blocks until the socket arrives
+ * (unless @a channel is non-blocking).
+ *
+ * @param channel connected AF_UNIX socket to the predecessor
+ * @return the listen socket, #MHD_INVALID_SOCKET on error
+ * @ingroup specialized
+ */
+_MHD_EXTERN MHD_socket
+MHD_receive_listen_socket (MHD_socket channel);
+
+
+/**
+ * An IP address range for #MHD_set_ip_filter().
+ * @ingroup specialized
+ */
+struct MHD_IpFilterRule
+{
+  /**
+   * Network address, a `struct sockaddr_in` or a `struct
+   * sockaddr_in6`.  IPv4-mapped IPv6 addresses also match
+   * the respective IPv4 clients.
+   */
+  const struct sockaddr *addr;
+
+  /**
+   * Number of leading bits of @e addr to compare, at most
+   * 32 for IPv4 and 128 for IPv6.
+   */
+  unsigned int prefix_len;
+};
+
+
+/**
+ * How #MHD_set_ip_filter() treats clients that match a rule.
+ * @ingroup specialized
+ */
+enum MHD_IpFilterPolicy
+{
+  /**
+   * Drop connections from the listed ranges, accept all others.
+   */
+  MHD_IP_FILTER_DENY_LISTED = 0,
+
+  /**
+   * Accept connections from the listed ranges only.
+   */
+  MHD_IP_FILTER_ALLOW_LISTED = 1
+};
 
 
 /**
- * Stop accepting connections from the listening socket.  Allows
- * clients to continue processing, but stops accepting new
- * connections.  Note that the caller is responsible for closing the
- * returned socket; however, if MHD is run using threads (anything but
- * external select mode), it must not be closed until AFTER
- * #MHD_stop_daemon has been called (as it is theoretically possible
- * that an existing thread is still using it).
+ * Install a filter on the listen socket(s) of @a daemon that makes
+ * the kernel drop connection attempts by IP address before they are
+ * accepted, so blocked clients never cost an accept(), a connection
+ * structure or a call to the #MHD_AcceptPolicyCallback.  Calling this
+ * again atomically replaces the previous filter; an empty deny list
+ * removes it.  Connections that are already established are not
+ * affected.  Must not be called concurrently with #MHD_stop_daemon()
+ * or #MHD_quiesce_daemon().
  *
- * Note that some thread modes require the caller to have passed
- * #MHD_USE_PIPE_FOR_SHUTDOWN when using this API.  If this daemon is
- * in one of those modes and this option was not given to
- * #MHD_start_daemon, this function will return #MHD_INVALID_SOCKET.
+ * Limits per IP address (#MHD_OPTION_PER_IP_CONNECTION_LIMIT) still
+ * apply after accept().  Check #MHD_FEATURE_IP_FILTER for support.
  *
- * @param daemon daemon to stop accepting new connections for
- * @return old listen socket on success, #MHD_INVALID_SOCKET if
- *         the daemon was already not listening anymore
+ * @param daemon daemon to filter connections for
+ * @param policy whether @a rules list denied or allowed clients
+ * @param rules array of address ranges
+ * @param num_rules number of entries in @a rules
+ * @return #MHD_YES on success, #MHD_NO on error (invalid rules,
+ *         too many rules or no support on this platform)
  * @ingroup specialized
  */
-_MHD_EXTERN MHD_socket
-MHD_quiesce_daemon (struct MHD_Daemon *daemon);
+_MHD_EXTERN int
+MHD_set_ip_filter (struct MHD_Daemon *daemon,
+                   enum MHD_IpFilterPolicy policy,
+                   const struct MHD_IpFilterRule *rules,
+                   unsigned int num_rules);
 
 
 /**
@@ -1648,6 +3287,52 @@ MHD_add_connection (struct MHD_Daemon *daemon,
 		    socklen_t addrlen);
 
 
+/**
+ * A client connection to add with #MHD_add_connections().
+ */
+struct MHD_NewConnection
+{
+  /**
+   * Socket to manage (MHD will expect to receive an HTTP request
+   * from this socket next).
+   */
+  MHD_socket socket;
+
+  /**
+   * IP address of the client.
+   */
+  const struct sockaddr *addr;
+
+  /**
+   * Number of bytes in @e addr.
+   */
+  socklen_t addrlen;
+};
+
+
+/**
+ * Add a batch of client connections to the set of connections
+ * managed by MHD, like #MHD_add_connection() does for a single one,
+ * for example for sockets received in batches from another process.
+ * The connections are distributed over the threads of a thread pool
+ * and each thread is woken up only once for the whole batch.
+ *
+ * All given sockets are managed (and closed!) by MHD after this call
+ * and must no longer be used directly by the application afterwards.
+ *
+ * @param daemon daemon that manages the connections
+ * @param connections sockets and addresses of the clients
+ * @param count number of entries in @a connections
+ * @return number of connections added; the sockets of the others
+ *         were closed, `errno` is set for the last failure
+ * @ingroup specialized
+ */
+_MHD_EXTERN unsigned int
+MHD_add_connections (struct MHD_Daemon *daemon,
+                     const struct MHD_NewConnection *connections,
+                     unsigned int count);
+
+
 /**
  * Obtain the `select()` sets for this daemon.
  * Daemon's FDs will be added to fd_sets. To get only
@@ -1796,6 +3481,29 @@ MHD_run_from_select (struct MHD_Daemon *daemon,
 		     const fd_set *except_fd_set);
 
 
+/**
+ * Run webserver operations for one socket of a daemon started with
+ * #MHD_OPTION_NOTIFY_SOCKET, after the application's event loop
+ * reported it ready.  Only the given socket is looked at, so the
+ * cost does not depend on the number of connections.  The
+ * application must also call this function with a @a handle of
+ * NULL once the timeout returned by #MHD_get_timeout() expired, to
+ * handle timed-out connections.
+ *
+ * @param daemon daemon the socket belongs to
+ * @param handle value passed to the #MHD_NotifySocketCallback for
+ *        the socket, NULL to only handle timeouts
+ * @param ready bitmask of #MHD_SOCKET_INTEREST_READ and
+ *        #MHD_SOCKET_INTEREST_WRITE for the events that are ready
+ * @return #MHD_NO on serious errors, #MHD_YES on success
+ * @ingroup event
+ */
+_MHD_EXTERN int
+MHD_run_socket (struct MHD_Daemon *daemon,
+                void *handle,
+                unsigned int ready);
+
+
 
 
 /* **************** Connection handling functions ***************** */
@@ -1818,6 +3526,25 @@ MHD_get_connection_values (struct MHD_Connection *connection,
                            void *iterator_cls);
 
 
+/**
+ * Get all of the headers from the request, with the sizes of
+ * the keys and values.
+ *
+ * @param connection connection to get values from
+ * @param kind types of values to iterate over, can be a bitmask
+ * @param iterator callback to call on each header;
+ *        maybe NULL (then just count headers)
+ * @param iterator_cls extra argument to @a iterator
+ * @return number of entries iterated over
+ * @ingroup request
+ */
+_MHD_EXTERN int
+MHD_get_connection_values_n (struct MHD_Connection *connection,
+                             enum MHD_ValueKind kind,
+                             MHD_KeyValueIteratorN iterator,
+                             void *iterator_cls);
+
+
 /**
  * This function can be used to add an entry to the HTTP headers of a
  * connection (so that the #MHD_get_connection_values function will
@@ -1850,6 +3577,57 @@ MHD_set_connection_value (struct MHD_Connection *connection,
 			  const char *value);
 
 
+/**
+ * Like #MHD_set_connection_value(), but with the sizes of @a key
+ * and @a value given by the caller, so that they can contain
+ * binary zeros.  Both must still be 0-terminated (at the given
+ * size) and remain valid until the connection is closed.
+ *
+ * @param connection the connection for which a
+ *  value should be set
+ * @param kind kind of the value
+ * @param key key for the value
+ * @param key_size number of bytes in @a key (excluding the 0-terminator)
+ * @param value the value itself
+ * @param value_size number of bytes in @a value (excluding the 0-terminator)
+ * @return #MHD_NO if the operation could not be
+ *         performed due to insufficient memory;
+ *         #MHD_YES on success
+ * @ingroup request
+ */
+_MHD_EXTERN int
+MHD_set_connection_value_n (struct MHD_Connection *connection,
+                            enum MHD_ValueKind kind,
+                            const char *key,
+                            size_t key_size,
+                            const char *value,
+                            size_t value_size);
+
+
+/**
+ * Allocate memory for the current request from the memory pool of
+ * the connection, for example for the state of the access handler
+ * kept in `*con_cls`.  The memory does not need to be freed: it is
+ * released when the request is complete, after the
+ * #MHD_RequestCompletedCallback was called.  Allocations fail if
+ * they would leave less than #MHD_OPTION_CONNECTION_ALLOC_RESERVE
+ * bytes of the pool for MHD to receive the request and send the
+ * response.
+ *
+ * Like #MHD_set_connection_value(), this function MUST only be
+ * called from within callbacks for the connection.
+ *
+ * @param connection the connection of the request
+ * @param size number of bytes to allocate
+ * @return the memory (aligned for any type, not zeroed), NULL if
+ *         the pool does not have enough room
+ * @ingroup request
+ */
+_MHD_EXTERN void *
+MHD_connection_alloc (struct MHD_Connection *connection,
+                      size_t size);
+
+
 /**
  * Sets the global error handler to a different implementation.  @a cb
  * will only be called in the case of typically fatal, serious
@@ -1899,6 +3677,190 @@ MHD_lookup_connection_value (struct MHD_Connection *connection,
 			     const char *key);
 
 
+/**
+ * Get a particular header value and its size.  If multiple
+ * values match the kind, return the first of them.  Unlike
+ * #MHD_lookup_connection_value(), this avoids computing the
+ * length of @a key and of the value.
+ *
+ * @param connection connection to get values from
+ * @param kind what kind of value are we looking for
+ * @param key the header to look for, NULL to lookup 'trailing' value without a key
+ * @param key_size number of bytes in @a key
+ * @param[out] value_ptr set to the value (which may be NULL), can be NULL
+ * @param[out] value_size_ptr set to the number of bytes in the value,
+ *             can be NULL
+ * @return #MHD_YES if a value was found, #MHD_NO if not
+ * @ingroup request
+ */
+_MHD_EXTERN int
+MHD_lookup_connection_value_n (struct MHD_Connection *connection,
+                               enum MHD_ValueKind kind,
+                               const char *key,
+                               size_t key_size,
+                               const char **value_ptr,
+                               size_t *value_size_ptr);
+
+
+/**
+ * Get a particular well-known header value.  Like
+ * #MHD_lookup_connection_value(), but identifies the header by its
+ * token, avoiding string comparisons.  Only headers and footers
+ * are classified, so for other kinds this always returns NULL.
+ *
+ * @param connection connection to get values from
+ * @param kind what kind of value are we looking for
+ * @param token the header to look for
+ * @return NULL if no such item was found
+ * @ingroup request
+ */
+_MHD_EXTERN const char *
+MHD_lookup_connection_token_value (struct MHD_Connection *connection,
+                                   enum MHD_ValueKind kind,
+                                   enum MHD_HeaderToken token);
+
+
+/**
+ * Check if the client's cached copy of the requested resource is
+ * still valid, that is if the "If-None-Match" header of a GET or HEAD
+ * request matches @a etag or (without "If-None-Match") the resource
+ * was not modified since "If-Modified-Since".  This allows answering
+ * with #MHD_HTTP_NOT_MODIFIED without producing the body; see also
+ * #MHD_RF_CONDITIONAL.
+ *
+ * @param connection the connection identifying the client
+ * @param etag entity tag of the resource including the quotes
+ *        (i.e. "\"xyzzy\"" or "W/\"xyzzy\""), NULL for none
+ * @param last_modified HTTP-date of the last modification of the
+ *        resource, NULL for none
+ * @return #MHD_YES if the client's copy is valid, #MHD_NO if not
+ * @ingroup request
+ */
+_MHD_EXTERN int
+MHD_check_not_modified (struct MHD_Connection *connection,
+                        const char *etag,
+                        const char *last_modified);
+
+
+/**
+ * Methods a route is used for, see #MHD_router_add().
+ * @ingroup request
+ */
+enum MHD_RouteMethod
+{
+  MHD_ROUTE_GET = 1,
+  MHD_ROUTE_HEAD = 2,
+  MHD_ROUTE_POST = 4,
+  MHD_ROUTE_PUT = 8,
+  MHD_ROUTE_DELETE = 16,
+  MHD_ROUTE_OPTIONS = 32,
+  MHD_ROUTE_PATCH = 64,
+  MHD_ROUTE_CONNECT = 128,
+  MHD_ROUTE_TRACE = 256,
+
+  /**
+   * Methods other than the ones above.
+   */
+  MHD_ROUTE_OTHER = 512,
+
+  /**
+   * Any method.
+   */
+  MHD_ROUTE_ANY = 1023
+};
+
+
+/**
+ * Handle for a table of routes, which dispatches the requests to
+ * different access handlers depending on their path and method.
+ * @ingroup request
+ */
+struct MHD_Router;
+
+
+/**
+ * Create an empty routing table.  Use it by passing
+ * #MHD_router_access_handler and the router as the access handler
+ * and its closure to #MHD_start_daemon().
+ *
+ * @param fallback access handler for requests no route matches
+ * @param fallback_cls extra argument to @a fallback
+ * @return NULL on error (i.e. out of memory)
+ * @ingroup request
+ */
+_MHD_EXTERN struct MHD_Router *
+MHD_router_create (MHD_AccessHandlerCallback fallback,
+                   void *fallback_cls);
+
+
+/**
+ * Add a route to @a router.  The @a pattern is an absolute path whose
+ * segments are matched literally, except that a segment ":name"
+ * matches any non-empty segment and a final segment "*" matches the
+ * rest of the path (possibly empty).  The matched values are
+ * available to the handler with #MHD_lookup_connection_value() as
+ * #MHD_ROUTE_PARAMETER_KIND values under "name" and "*".  Literal
+ * segments take precedence over ":name" segments, which take
+ * precedence over "*".  Routes must not be added while the router is
+ * in use by a daemon.
+ *
+ * @param router router to add to
+ * @param methods methods the route is used for, a bitmask of
+ *        `enum MHD_RouteMethod`; #MHD_ROUTE_GET includes HEAD
+ * @param pattern path pattern, i.e. "/users/:id"
+ * @param handler access handler for the matching requests
+ * @param handler_cls extra argument to @a handler
+ * @return #MHD_YES on success, #MHD_NO on error (i.e. invalid
+ *         pattern, out of memory)
+ * @ingroup request
+ */
+_MHD_EXTERN int
+MHD_router_add (struct MHD_Router *router,
+                unsigned int methods,
+                const char *pattern,
+                MHD_AccessHandlerCallback handler,
+                void *handler_cls);
+
+
+/**
+ * Destroy a routing table.  Must not be called before the daemons
+ * using it were stopped.
+ *
+ * @param router router to destroy
+ * @ingroup request
+ */
+_MHD_EXTERN void
+MHD_router_destroy (struct MHD_Router *router);
+
+
+/**
+ * Access handler dispatching the requests of a connection to the
+ * handler of the matching route.  The route is looked up once per
+ * request; all further calls for the request go to the same handler.
+ *
+ * @param cls the `struct MHD_Router`
+ * @param connection the connection identifying the client
+ * @param url the requested url
+ * @param method the HTTP method used
+ * @param version the HTTP version string
+ * @param upload_data the data being uploaded
+ * @param upload_data_size set to the size of @a upload_data
+ * @param con_cls pointer for the handler of the route
+ * @return what the handler of the route returned; #MHD_NO if the
+ *         parameters do not fit into the memory of the connection
+ * @ingroup request
+ */
+_MHD_EXTERN int
+MHD_router_access_handler (void *cls,
+                           struct MHD_Connection *connection,
+                           const char *url,
+                           const char *method,
+                           const char *version,
+                           const char *upload_data,
+                           size_t *upload_data_size,
+                           void **con_cls);
+
+
 /**
  * Queue a response to be transmitted to the client (as soon as
  * possible but after #MHD_AccessHandlerCallback returns).
@@ -1916,6 +3878,35 @@ MHD_queue_response (struct MHD_Connection *connection,
 		    struct MHD_Response *response);
 
 
+/**
+ * Queue an interim (1xx) response, such as "103 Early Hints" with
+ * "Link" headers, to be transmitted to the client before the final
+ * response.  Only the headers of @a response are sent, its body is
+ * ignored; the response can be destroyed (or queued again) right
+ * away.  The interim response is sent as soon as possible, even
+ * while the application keeps the connection suspended, so that the
+ * client can start work while the final response is prepared.  Can
+ * be called several times, but only until the final response is
+ * queued with #MHD_queue_response().
+ *
+ * Interim responses are only sent to HTTP/1.1 clients; "100
+ * Continue" is sent automatically and "101 Switching Protocols"
+ * requires an 'upgrade' response.
+ *
+ * @param connection the connection identifying the client
+ * @param status_code HTTP status code (i.e. #MHD_HTTP_EARLY_HINTS)
+ * @param response response with the headers to transmit
+ * @return #MHD_NO on error (i.e. final response already queued,
+ *         HTTP/1.0 or HTTP/2 client, status code is not 1xx),
+ *         #MHD_YES if the interim response has been queued
+ * @ingroup response
+ */
+_MHD_EXTERN int
+MHD_queue_interim_response (struct MHD_Connection *connection,
+                            unsigned int status_code,
+                            struct MHD_Response *response);
+
+
 /**
  * Suspend handling of network data for a given connection.  This can
  * be used to dequeue a connection from MHD's event loop (external
@@ -1929,7 +3920,8 @@ MHD_queue_response (struct MHD_Connection *connection,
  * Suspended connections continue to count against the total number of
  * connections allowed (per daemon, as well as per IP, if such limits
  * are set).  Suspended connections will NOT time out; timeouts will
- * restart when the connection handling is resumed.  While a
+ * restart when the connection handling is resumed (see
+ * #MHD_suspend_connection_with_timeout() for a deadline).  While a
  * connection is suspended, MHD will not detect disconnects by the
  * client.
  *
@@ -1947,6 +3939,51 @@ _MHD_EXTERN void
 MHD_suspend_connection (struct MHD_Connection *connection);
 
 
+/**
+ * What to do with a connection when the deadline of
+ * #MHD_suspend_connection_with_timeout() expires.
+ */
+enum MHD_SuspendTimeoutAction
+{
+  /**
+   * Resume the connection as if #MHD_resume_connection() was called.
+   */
+  MHD_SUSPEND_TIMEOUT_RESUME = 0,
+
+  /**
+   * Close the connection; the #MHD_RequestCompletedCallback is called
+   * with #MHD_REQUEST_TERMINATED_TIMEOUT_REACHED.
+   */
+  MHD_SUSPEND_TIMEOUT_CLOSE = 1
+};
+
+
+/**
+ * Suspend handling of network data for a given connection like
+ * #MHD_suspend_connection(), but end the suspension after
+ * @a timeout_ms milliseconds unless the connection is resumed
+ * before.  The deadline is kept in the timer structure of the event
+ * loop (at a granularity of about 100 ms), so applications need no
+ * timers of their own for long-polling clients.
+ *
+ * The only safe time to call this function is from the
+ * #MHD_AccessHandlerCallback.
+ *
+ * @param connection the connection to suspend
+ * @param timeout_ms maximum duration of the suspension, 0 for none
+ * @param action what to do when the suspension times out
+ * @return #MHD_YES on success, #MHD_NO if the connection was
+ *         suspended without a deadline, because deadlines are not
+ *         supported for HTTP/2 streams, with
+ *         #MHD_OPTION_HANDLER_THREADS or with
+ *         #MHD_USE_THREAD_PER_CONNECTION
+ */
+_MHD_EXTERN int
+MHD_suspend_connection_with_timeout (struct MHD_Connection *connection,
+                                     unsigned int timeout_ms,
+                                     enum MHD_SuspendTimeoutAction action);
+
+
 /**
  * Resume handling of network data for suspended connection.  It is
  * safe to resume a suspended connection at any time.  Calling this
@@ -1959,6 +3996,97 @@ _MHD_EXTERN void
 MHD_resume_connection (struct MHD_Connection *connection);
 
 
+/**
+ * Signal that the content reader of the response queued on
+ * @a connection, which returned #MHD_CONTENT_READER_PENDING, has data
+ * available now.  MHD calls the content reader again soon.  Can be
+ * called from any thread, also before the content reader returned;
+ * calling it while MHD is not waiting for data only causes one more
+ * call of the content reader.
+ *
+ * @param connection the connection the response is sent on
+ * @ingroup response
+ */
+_MHD_EXTERN void
+MHD_response_data_ready (struct MHD_Connection *connection);
+
+
+/**
+ * Stop reading the upload of the request on @a connection until
+ * #MHD_resume_upload() is called, for example because the storage
+ * the data is forwarded to is busy.  Data passed in the current call
+ * of the #MHD_AccessHandlerCallback that it does not consume (by
+ * leaving it in `upload_data_size`) is passed again after the upload
+ * was resumed.  Meanwhile the socket is not watched and the
+ * connection does not time out.
+ *
+ * Only has an effect with #MHD_USE_SUSPEND_RESUME and when called
+ * from the #MHD_AccessHandlerCallback while it processes upload data.
+ *
+ * @param connection the connection receiving the upload
+ * @ingroup request
+ */
+_MHD_EXTERN void
+MHD_pause_upload (struct MHD_Connection *connection);
+
+
+/**
+ * Continue reading the upload of a connection paused with
+ * #MHD_pause_upload().  Can be called from any thread, also before
+ * the access handler that paused the upload returned.
+ *
+ * @param connection the connection receiving the upload
+ * @ingroup request
+ */
+_MHD_EXTERN void
+MHD_resume_upload (struct MHD_Connection *connection);
+
+
+/**
+ * Answer the request on @a connection asynchronously: the
+ * #MHD_AccessHandlerCallback calls this function and returns
+ * #MHD_YES right away, and the application later passes the
+ * response to #MHD_complete_response(), from any thread.  The
+ * connection is suspended meanwhile (see #MHD_suspend_connection());
+ * the event loop queues the response without calling the access
+ * handler again.
+ *
+ * Only possible with #MHD_USE_SUSPEND_RESUME, for HTTP/1.x requests
+ * whose upload (if any) was processed completely, that is from the
+ * call of the access handler with `*upload_data_size` being zero.
+ * As with suspended connections, all deferred requests must be
+ * completed before #MHD_stop_daemon() is called.
+ *
+ * @param connection the connection of the request
+ * @return #MHD_YES on success, #MHD_NO if the request cannot be
+ *         deferred (for example, because a response is queued)
+ * @ingroup request
+ */
+_MHD_EXTERN int
+MHD_defer_response (struct MHD_Connection *connection);
+
+
+/**
+ * Complete a request deferred with #MHD_defer_response() by queueing
+ * @a response for it (see #MHD_queue_response()).  Can be called from
+ * any thread, also before the access handler that deferred the
+ * request returned; it does not wait for the event loop of the
+ * connection, which queues the response.
+ *
+ * @param connection the connection of the deferred request
+ * @param status_code HTTP status code (i.e. #MHD_HTTP_OK)
+ * @param response response to transmit; MHD keeps a reference, so
+ *        the caller may destroy the response right away
+ * @return #MHD_YES on success, #MHD_NO if the request was not
+ *         deferred or was completed already
+ * @ingroup response
+ */
+_MHD_EXTERN int
+MHD_complete_response (struct MHD_Connection *connection,
+                       unsigned int status_code,
+                       struct MHD_Response *response);
+
+
 /* **************** Response manipulation functions ***************** */
 
 
@@ -1970,14 +4098,50 @@ enum MHD_ResponseFlags
   /**
    * Default: no special flags.
    */
-  MHD_RF_NONE = 0,
+  MHD_RF_NONE = 0,
+
+  /**
+   * Only respond in conservative HTTP 1.0-mode.   In particular,
+   * do not (automatically) sent "Connection" headers and always
+   * close the connection after generating the response.
+   */
+  MHD_RF_HTTP_VERSION_1_0_ONLY = 1,
+
+  /**
+   * Answer HTTP/1.1 GET requests with a "Range" header with only
+   * the requested ranges of the body (206 Partial Content, several
+   * ranges are sent as a multipart/byteranges body) or with 416 if
+   * none of the ranges are within the body.  "If-Range" is compared
+   * with the "ETag" and "Last-Modified" headers of the response.
+   * The response advertises "Accept-Ranges: bytes".  Only used for
+   * responses with code #MHD_HTTP_OK and of known size; the
+   * application must not set "Content-Length".
+   */
+  MHD_RF_ACCEPT_RANGES = 2,
+
+  /**
+   * Answer GET and HEAD requests with "If-None-Match" or
+   * "If-Modified-Since" with 304 Not Modified (and no body) if they
+   * match the "ETag" or "Last-Modified" header of the response.  The
+   * content reader callback is then not called.  Only used for
+   * responses with code #MHD_HTTP_OK.  See also
+   * #MHD_check_not_modified().
+   */
+  MHD_RF_CONDITIONAL = 4,
 
   /**
-   * Only respond in conservative HTTP 1.0-mode.   In particular,
-   * do not (automatically) sent "Connection" headers and always
-   * close the connection after generating the response.
+   * Call the content reader of a response of known size for the
+   * next block of the body on one of the threads of
+   * #MHD_OPTION_HANDLER_THREADS while the current block is being
+   * sent, so that readers doing disk or network I/O overlap with the
+   * transmission.  The block is read into the memory pool of the
+   * connection.  Only used if the response is queued on a single
+   * connection (i.e. the application destroyed it after queueing)
+   * and the daemon has handler threads; otherwise the reader is
+   * called by the event loop as usual.  Without the flag, the reader
+   * is only called once the previous block was sent.
    */
-  MHD_RF_HTTP_VERSION_1_0_ONLY = 1
+  MHD_RF_PREFETCH = 8
 
 };
 
@@ -1990,7 +4154,37 @@ enum MHD_ResponseOptions
   /**
    * End of the list of options.
    */
-  MHD_RO_END = 0
+  MHD_RO_END = 0,
+
+  /**
+   * Compress the body with "gzip" (or "deflate") if the client
+   * accepts it, followed by an `int` with the zlib compression level
+   * (1-9, 0 to disable compression).  Only used for responses
+   * created with #MHD_create_response_from_callback() and HTTP/1.1
+   * clients; compressed bodies are sent with chunked encoding.  The
+   * response gets a "Vary: Accept-Encoding" header.  Fails if MHD
+   * was built without zlib, see #MHD_FEATURE_COMPRESSION.
+   */
+  MHD_RO_COMPRESSION_LEVEL = 1,
+
+  /**
+   * Store the response in the cache of the daemon (see
+   * #MHD_OPTION_RESPONSE_CACHE_SIZE) when it is queued for a "GET"
+   * or "HEAD" request, followed by an `unsigned int` with the number
+   * of milliseconds it may be served from the cache (0 to not cache
+   * it).  The response must be able to be queued any number of
+   * times; the #MHD_RequestCompletedCallback is not called for
+   * requests served from the cache.
+   */
+  MHD_RO_CACHE_TTL = 2,
+
+  /**
+   * Number of milliseconds after the #MHD_RO_CACHE_TTL passed during
+   * which the cached response is still served while one request
+   * calls the access handler to refresh it, followed by an
+   * `unsigned int`; default is 0.
+   */
+  MHD_RO_CACHE_STALE_WHILE_REVALIDATE = 3
 };
 
 
@@ -2017,7 +4211,8 @@ MHD_set_response_options (struct MHD_Response *response,
  *                   MHD may still call @a crc using smaller chunks); this
  *                   is essentially the buffer size used for IO, clients
  *                   should pick a value that is appropriate for IO and
- *                   memory performance requirements
+ *                   memory performance requirements; it also limits
+ *                   the size of the chunks with chunked encoding
  * @param crc callback to use to obtain response data
  * @param crc_cls extra argument to @a crc
  * @param crfc callback to call to free @a crc_cls resources
@@ -2105,6 +4300,246 @@ MHD_create_response_from_buffer (size_t size,
 				 enum MHD_ResponseMemoryMode mode);
 
 
+/**
+ * Input/output vector type, one fragment of the body of a response
+ * created with #MHD_create_response_from_iovec().
+ */
+struct MHD_IoVec
+{
+  /**
+   * The pointer to the data of this fragment.
+   */
+  const void *iov_base;
+
+  /**
+   * The size in bytes of this fragment.
+   */
+  size_t iov_len;
+};
+
+
+/**
+ * Create a response object from an array of memory fragments.  The
+ * response object can be extended with header information and then
+ * be used any number of times.  The body of the response is the
+ * concatenation of all fragments; on plain connections the fragments
+ * are sent directly (using scatter/gather I/O where available)
+ * without concatenating them first.
+ *
+ * @param iov the array of fragments; the array itself is copied, the
+ *        memory the fragments point to must stay valid until
+ *        @a free_cb is called
+ * @param iovcnt number of elements in @a iov
+ * @param free_cb function to call when the response is destroyed
+ *        to release the fragments, can be NULL
+ * @param cls closure for @a free_cb
+ * @return NULL on error (i.e. invalid arguments, out of memory)
+ * @ingroup response
+ */
+_MHD_EXTERN struct MHD_Response *
+MHD_create_response_from_iovec (const struct MHD_IoVec *iov,
+                                unsigned int iovcnt,
+                                MHD_ContentReaderFreeCallback free_cb,
+                                void *cls);
+
+
+/**
+ * Handle for a stream of events sent to many clients at once, for
+ * example server-sent events.  Each event is copied once and sent
+ * to all subscribers from the same buffer.
+ */
+struct MHD_Broadcast;
+
+
+/**
+ * Create a broadcast: a stream of events that is sent to all
+ * connections a response created with
+ * #MHD_create_response_from_broadcast() for it was queued on.
+ *
+ * @param backlog number of the last events kept for subscribers that
+ *        are still busy sending older events; a subscriber that falls
+ *        further behind is disconnected
+ * @return NULL on error (i.e. invalid arguments, out of memory)
+ * @ingroup response
+ */
+_MHD_EXTERN struct MHD_Broadcast *
+MHD_broadcast_create (unsigned int backlog);
+
+
+/**
+ * Publish an event: append @a data to the body of the responses of
+ * all subscribers of @a bc.  The data is copied.  Can be called from
+ * any thread, but not while or after #MHD_stop_daemon() is called for
+ * a daemon with subscribers.
+ *
+ * @param bc broadcast to publish on
+ * @param data the data of the event
+ * @param size number of bytes in @a data, must not be 0
+ * @return #MHD_YES on success, #MHD_NO on error (i.e. invalid
+ *         arguments, out of memory)
+ * @ingroup response
+ */
+_MHD_EXTERN int
+MHD_broadcast_publish (struct MHD_Broadcast *bc,
+                       const void *data,
+                       size_t size);
+
+
+/**
+ * Destroy a broadcast.  Subscribers still send the events published
+ * so far, then their response ends.  The memory is released once the
+ * last response for @a bc is destroyed as well.  The same
+ * restrictions as for #MHD_broadcast_publish() apply.
+ *
+ * @param bc broadcast to destroy
+ * @ingroup response
+ */
+_MHD_EXTERN void
+MHD_broadcast_destroy (struct MHD_Broadcast *bc);
+
+
+/**
+ * Create a response whose body is the stream of events published on
+ * @a bc after the response was queued, for example for server-sent
+ * events.  The body has no known size: it is sent chunked to
+ * HTTP/1.1 clients; for HTTP/1.0 clients, the connection is closed
+ * after the last event.  The response can be queued on any number of
+ * connections; while a connection has sent all events, it is
+ * suspended if the daemon was started with #MHD_USE_SUSPEND_RESUME
+ * (recommended), otherwise it is polled.  Broadcast responses cannot
+ * be queued for HTTP/2 requests.
+ *
+ * @param bc broadcast to send
+ * @return NULL on error (i.e. invalid arguments, out of memory)
+ * @ingroup response
+ */
+_MHD_EXTERN struct MHD_Response *
+MHD_create_response_from_broadcast (struct MHD_Broadcast *bc);
+
+
+/**
+ * Handle for writing the body of a response created with
+ * #MHD_create_response_stream().  The body is pushed by the
+ * application instead of being pulled by MHD.
+ */
+struct MHD_ResponseStream;
+
+
+/**
+ * Results of #MHD_response_stream_write().
+ */
+enum MHD_StreamWriteResult
+{
+
+  /**
+   * The data was queued.
+   */
+  MHD_STREAM_WRITE_OK = 0,
+
+  /**
+   * The queue of the stream is full, the data was not queued.  Write
+   * it again after the #MHD_StreamWritableCallback of the stream was
+   * called.
+   */
+  MHD_STREAM_WRITE_FULL = 1,
+
+  /**
+   * The connection is done with the stream (closed, or the request
+   * was a "HEAD" request), the data was not queued.  The stream must
+   * still be closed with #MHD_response_stream_close().
+   */
+  MHD_STREAM_WRITE_CLOSED = 2,
+
+  /**
+   * Invalid arguments or out of memory, the data was not queued.
+   */
+  MHD_STREAM_WRITE_ERROR = 3
+
+};
+
+
+/**
+ * Called when a stream can take data again, or when the connection
+ * is done with it, see #MHD_create_response_stream().
+ *
+ * @param cls closure
+ */
+typedef void
+(*MHD_StreamWritableCallback) (void *cls);
+
+
+/**
+ * Create a response whose body the application writes with
+ * #MHD_response_stream_write() once it has the data, instead of MHD
+ * asking for it with a #MHD_ContentReaderCallback.  The body has no
+ * known size: it is sent chunked to HTTP/1.1 clients; for HTTP/1.0
+ * clients, the connection is closed after the stream was closed and
+ * all data was sent.  The response can be queued on one connection
+ * only.  While the connection has sent all data, it is suspended if
+ * the daemon was started with #MHD_USE_SUSPEND_RESUME (recommended),
+ * otherwise it is polled.  Stream responses cannot be queued for
+ * HTTP/2 requests.
+ *
+ * @param max_queued maximum number of bytes written but not sent
+ *        yet; writes beyond fail with #MHD_STREAM_WRITE_FULL
+ * @param wc called when the queue has room again after a write
+ *        failed with #MHD_STREAM_WRITE_FULL, and when the connection
+ *        is done with the stream (writes then fail with
+ *        #MHD_STREAM_WRITE_CLOSED); called from a thread of MHD
+ *        while the stream is locked, so it must not use the stream
+ *        itself but only signal the writer; may be NULL
+ * @param wc_cls closure for @a wc
+ * @param[out] stream set to the stream to write the body to, valid
+ *        until #MHD_response_stream_close() is called for it
+ * @return NULL on error (i.e. invalid arguments, out of memory)
+ * @ingroup response
+ */
+_MHD_EXTERN struct MHD_Response *
+MHD_create_response_stream (size_t max_queued,
+                            MHD_StreamWritableCallback wc,
+                            void *wc_cls,
+                            struct MHD_ResponseStream **stream);
+
+
+/**
+ * Append @a size bytes at @a data to the body of the response of
+ * @a stream.  Can be called from any thread, but not while or after
+ * #MHD_stop_daemon() is called for the daemon of the connection.
+ *
+ * @param stream stream to write to
+ * @param data the data to append
+ * @param size number of bytes in @a data, must not be 0
+ * @param free_cb called with @a free_cls once @a data was sent or
+ *        discarded, if this function returned #MHD_STREAM_WRITE_OK;
+ *        @a data is then sent without copying it.  If NULL, the data
+ *        is copied
+ * @param free_cls closure for @a free_cb
+ * @return #MHD_STREAM_WRITE_OK if the data was queued, otherwise
+ *         the caller keeps @a data and @a free_cb is not called
+ * @ingroup response
+ */
+_MHD_EXTERN enum MHD_StreamWriteResult
+MHD_response_stream_write (struct MHD_ResponseStream *stream,
+                           const void *data,
+                           size_t size,
+                           MHD_ContentReaderFreeCallback free_cb,
+                           void *free_cls);
+
+
+/**
+ * Close @a stream: the body of its response ends after the data
+ * written so far.  Must be called exactly once for each stream, also
+ * if the response was never queued; @a stream must not be used
+ * afterwards.  The same restrictions as for
+ * #MHD_response_stream_write() apply.
+ *
+ * @param stream stream to close
+ * @ingroup response
+ */
+_MHD_EXTERN void
+MHD_response_stream_close (struct MHD_ResponseStream *stream);
+
+
 /**
  * Create a response object.  The response object can be extended with
  * header information and then be used any number of times.
@@ -2139,6 +4574,46 @@ MHD_create_response_from_fd64 (uint64_t size,
                                int fd);
 
 
+/**
+ * Create a response object with the body read from a pipe (or a
+ * socket) until the end of the stream.  On Linux, the body is moved
+ * into the socket of the connection with splice(), without copying
+ * it into user space; it is then sent without chunked encoding and
+ * the connection is closed after the response.  The response object
+ * can be extended with header information, but can only be used once,
+ * as the data is consumed from @a fd.
+ *
+ * @param fd read end of a pipe or a socket providing the data; will
+ *        be closed when response is destroyed; fd should be in
+ *        'blocking' mode
+ * @return NULL on error (i.e. invalid arguments, out of memory)
+ * @ingroup response
+ */
+_MHD_EXTERN struct MHD_Response *
+MHD_create_response_from_pipe (int fd);
+
+
+/**
+ * Create a response object with a copy of @a buffer kept in a sealed
+ * in-memory file (memfd), for large bodies served to many clients.
+ * Plain connections then send the body with sendfile() from that
+ * file, shared read-only by all of them, instead of copying it
+ * through their write buffers; HTTPS connections copy it from a
+ * read-only mapping.  Where memfds are not available (see
+ * #MHD_FEATURE_MEMFD_RESPONSE), the response is created as with
+ * #MHD_RESPMEM_MUST_COPY.  The response object can be extended with
+ * header information and then be used any number of times.
+ *
+ * @param size size of the data portion of the response
+ * @param buffer @a size bytes with the data, copied right away
+ * @return NULL on error (i.e. invalid arguments, out of memory)
+ * @ingroup response
+ */
+_MHD_EXTERN struct MHD_Response *
+MHD_create_response_from_memfd (size_t size,
+                                const void *buffer);
+
+
 /**
  * Create a response object.  The response object can be extended with
  * header information and then be used any number of times.
@@ -2192,12 +4667,9 @@ MHD_create_response_from_fd_at_offset64 (uint64_t size,
                                          uint64_t offset);
 
 
-#if 0
 /**
  * Enumeration for actions MHD should perform on the underlying socket
- * of the upgrade.  This API is not finalized, and in particular
- * the final set of actions is yet to be decided. This is just an
- * idea for what we might want.
+ * of the upgrade.
  */
 enum MHD_UpgradeAction
 {
@@ -2206,93 +4678,85 @@ enum MHD_UpgradeAction
    * Close the socket, the application is done with it.
    *
    * Takes no extra arguments.
-   *
-   * NOTE: it is unclear if we want to have this in the
-   * "final" API, this is all just ideas.
-   */
-  MHD_UPGRADE_ACTION_CLOSE = 0,
-
-  /**
-   * Uncork the TCP write buffer (that is, tell the OS to transmit all
-   * bytes in the buffer now, and to not use TCP-CORKing).
-   *
-   * Takes no extra arguments.
-   *
-   * NOTE: it is unclear if we want to have this in the
-   * "final" API, this is all just ideas.
    */
-  MHD_UPGRADE_ACTION_CORK
+  MHD_UPGRADE_ACTION_CLOSE = 0
 
 };
 
 
+/**
+ * Handle given to the application to manage special
+ * actions relating to MHD responses that "upgrade"
+ * the HTTP protocol (i.e. to WebSockets).
+ */
+struct MHD_UpgradeResponseHandle;
+
+
 /**
  * This connection-specific callback is provided by MHD to
  * applications (unusual) during the #MHD_UpgradeHandler.
  * It allows applications to perform 'special' actions on
  * the underlying socket from the upgrade.
  *
- * @param cls the closure (from `upgrade_action_cls`)
+ * @param urh the handle identifying the connection to perform
+ *            the upgrade @a action on.
  * @param action which action should be performed
  * @param ... arguments to the action (depends on the action)
  * @return #MHD_NO on error, #MHD_YES on success
  */
-typedef int
-(*MHD_UpgradeActionCallback)(void *cls,
-                             enum MHD_UpgradeAction action,
-                             ...);
+_MHD_EXTERN int
+MHD_upgrade_action (struct MHD_UpgradeResponseHandle *urh,
+                    enum MHD_UpgradeAction action,
+                    ...);
+
 
 /**
  * Function called after a protocol "upgrade" response was sent
  * successfully and the socket should now be controlled by some
  * protocol other than HTTP.
  *
- * Any data received on the socket will be made available in
- * 'data_in'.  The function should update 'data_in_size' to
- * reflect the number of bytes consumed from 'data_in' (the remaining
- * bytes will be made available in the next call to the handler).
- *
- * Any data that should be transmitted on the socket should be
- * stored in 'data_out'.  '*data_out_size' is initially set to
- * the available buffer space in 'data_out'.  It should be set to
- * the number of bytes stored in 'data_out' (which can be zero).
- *
- * The return value is a BITMASK that indicates how the function
- * intends to interact with the event loop.  It can request to be
- * notified for reading, writing, request to UNCORK the send buffer
- * (which MHD is allowed to ignore, if it is not possible to uncork on
- * the local platform), to wait for the 'external' select loop to
- * trigger another round.  It is also possible to specify "no events"
- * to terminate the connection; in this case, the
- * #MHD_RequestCompletedCallback will be called and all resources of
- * the connection will be released.
+ * The application takes over the socket and may use it directly
+ * (from any thread) for bi-directional communication with the
+ * client; MHD no longer reads from or writes to it, and the
+ * connection no longer counts against the connection timeout.
+ * When done, the application must call #MHD_upgrade_action() with
+ * #MHD_UPGRADE_ACTION_CLOSE (and must not close @a sock itself);
+ * MHD will then call the #MHD_RequestCompletedCallback and release
+ * all resources of the connection, including the socket.  All
+ * upgraded connections must be closed this way before calling
+ * #MHD_stop_daemon().
  *
  * Except when in 'thread-per-connection' mode, implementations
  * of this function should never block (as it will still be called
  * from within the main event loop).
  *
- * @param cls closure
+ * @param cls closure, whatever was given to #MHD_create_response_for_upgrade().
  * @param connection original HTTP connection handle,
  *                   giving the function a last chance
  *                   to inspect the original HTTP request
+ * @param con_cls last value left in `*con_cls` in the `MHD_AccessHandlerCallback`
+ * @param extra_in if we happened to have read bytes after the
+ *                 HTTP header already (because the client sent
+ *                 more than the HTTP header of the request before
+ *                 we sent the upgrade response),
+ *                 these are the extra bytes already read from @a sock
+ *                 by MHD.  The application should treat these as if
+ *                 it had read them from @a sock.
+ * @param extra_in_size number of bytes in @a extra_in
  * @param sock socket to use for bi-directional communication
- *        with the client.  For HTTPS, this may not be a socket
- *        that is directly connected to the client and thus certain
- *        operations (TCP-specific setsockopt(), getsockopt(), etc.)
- *        may not work as expected (as the socket could be from a
- *        socketpair() or a TCP-loopback)
- * @param upgrade_action function that can be used to perform actions
- *        on the @a sock (like those that cannot be done explicitly).
- *        Applications must use this callback to perform the
- *        close() action on the @a sock.
- * @param upgrade_action_cls closure that must be passed to @a upgrade_action
+ *        with the client (already non-blocking where supported)
+ * @param urh argument for #MHD_upgrade_action()s on this @a connection.
+ *        Applications must eventually use this callback to (indirectly)
+ *        perform the close() action on the @a sock.
  */
 typedef void
 (*MHD_UpgradeHandler)(void *cls,
                       struct MHD_Connection *connection,
-                      MHD_SOCKET sock,
-                      MHD_UpgradeActionCallback upgrade_action,
-                      void *upgrade_action_cls);
+                      void *con_cls,
+                      const char *extra_in,
+                      size_t extra_in_size,
+                      MHD_socket sock,
+                      struct MHD_UpgradeResponseHandle *urh);
 
 
 /**
@@ -2320,14 +4784,18 @@ typedef void
  * information and then be used any number of times (as long as the
  * header information is not connection-specific).
  *
+ * Upgrade responses can only be queued with the status code
+ * #MHD_HTTP_SWITCHING_PROTOCOLS on daemons started with
+ * #MHD_USE_SUSPEND_RESUME, and are currently not supported for
+ * HTTPS connections.
+ *
  * @param upgrade_handler function to call with the 'upgraded' socket
  * @param upgrade_handler_cls closure for @a upgrade_handler
  * @return NULL on error (i.e. invalid arguments, out of memory)
  */
-struct MHD_Response *
+_MHD_EXTERN struct MHD_Response *
 MHD_create_response_for_upgrade (MHD_UpgradeHandler upgrade_handler,
 				 void *upgrade_handler_cls);
-#endif
 
 /**
  * Destroy a response object and associated resources.  Note that
@@ -2416,6 +4884,111 @@ MHD_get_response_header (struct MHD_Response *response,
 			 const char *key);
 
 
+/**
+ * Add an alternative encoding of the body of a response, such as a
+ * precompressed copy.  When the response is queued, MHD sends the
+ * variant with the highest quality in the "Accept-Encoding" header of
+ * the request instead of @a response (variants added first win ties;
+ * @a response itself is only sent if the client prefers "identity"
+ * explicitly).  The headers of @a response are copied to @a variant,
+ * which also gets a "Content-Encoding" header; @a response gets a
+ * "Vary: Accept-Encoding" header unless it already has a "Vary"
+ * header.  Variants must be added before the response is queued and
+ * after its headers were added.
+ *
+ * @param response response to add the variant to
+ * @param encoding content coding of the body of @a variant,
+ *        i.e. "gzip" or "br"
+ * @param variant response with the encoded body; @a response keeps
+ *        a reference, the caller must still destroy its own
+ * @return #MHD_NO on error (invalid arguments or out of memory)
+ * @ingroup response
+ */
+_MHD_EXTERN int
+MHD_add_response_variant (struct MHD_Response *response,
+                          const char *encoding,
+                          struct MHD_Response *variant);
+
+
+/* ********************** File cache functions ********************** */
+
+/**
+ * Handle for a cache of responses for static files.
+ */
+struct MHD_FileCache;
+
+
+/**
+ * Function called when the file cache creates a new response for a
+ * file, before the response is shared with other requests.  This is
+ * the place to add headers such as "Content-Type".
+ *
+ * @param cls closure
+ * @param path path of the file
+ * @param response response for the file
+ * @return #MHD_YES to use the response, #MHD_NO to fail
+ */
+typedef int
+(*MHD_FileCacheInitCallback) (void *cls,
+                              const char *path,
+                              struct MHD_Response *response);
+
+
+/**
+ * Create a cache of responses for static files.  The cache keeps
+ * the files open (or, for small files, their contents in memory), so
+ * that responses are not created with open(), fstat() and close()
+ * for every request.  The cache can be used from several threads.
+ *
+ * @param max_entries maximum number of files to cache; files
+ *        requested while the cache is full are not cached
+ * @param small_file_size files up to this size are kept in memory,
+ *        larger files are sent from the file descriptor (with
+ *        sendfile() if possible)
+ * @param revalidate_interval number of seconds after which the file
+ *        is checked with stat() for changes on the next request;
+ *        0 to check on every request
+ * @param init_cb function to call for each new response, can be NULL
+ * @param init_cb_cls closure for @a init_cb
+ * @return NULL on error (out of memory)
+ * @ingroup response
+ */
+_MHD_EXTERN struct MHD_FileCache *
+MHD_file_cache_create (unsigned int max_entries,
+                       size_t small_file_size,
+                       unsigned int revalidate_interval,
+                       MHD_FileCacheInitCallback init_cb,
+                       void *init_cb_cls);
+
+
+/**
+ * Obtain the response for the file at @a path.  The response is
+ * shared with other requests for the same file and must not be
+ * changed; the caller must release it with #MHD_destroy_response()
+ * after queueing it.
+ *
+ * @param cache cache to use
+ * @param path path of the file
+ * @return NULL if the file cannot be opened or is not a regular
+ *         file (with `errno` set), or on error
+ * @ingroup response
+ */
+_MHD_EXTERN struct MHD_Response *
+MHD_file_cache_get_response (struct MHD_FileCache *cache,
+                             const char *path);
+
+
+/**
+ * Destroy a file cache.  Responses obtained from the cache remain
+ * valid until they are destroyed.
+ *
+ * @param cache cache to destroy
+ * @ingroup response
+ */
+_MHD_EXTERN void
+MHD_file_cache_destroy (struct MHD_FileCache *cache);
+
+
 /* ********************** PostProcessor functions ********************** */
 
 /**
@@ -2443,10 +5016,168 @@ MHD_get_response_header (struct MHD_Response *response,
  *         otherwise a PP handle
  * @ingroup request
  */
-_MHD_EXTERN struct MHD_PostProcessor *
-MHD_create_post_processor (struct MHD_Connection *connection,
-			   size_t buffer_size,
-			   MHD_PostDataIterator iter, void *iter_cls);
+_MHD_EXTERN struct MHD_PostProcessor *
+MHD_create_post_processor (struct MHD_Connection *connection,
+			   size_t buffer_size,
+			   MHD_PostDataIterator iter, void *iter_cls);
+
+
+/**
+ * Value for a #MHD_PostSpoolOpenCallback to return to have MHD
+ * spool the file part into a new, already unlinked temporary file.
+ */
+#define MHD_POST_SPOOL_TEMP_FILE (-2)
+
+
+/**
+ * Decide where to write a file part of a multipart POST
+ * (a part with a filename), see #MHD_POST_PROCESSOR_OPTION_SPOOL.
+ *
+ * @param cls custom value given with the option
+ * @param key name of the form field
+ * @param filename name of the uploaded file
+ * @param content_type mime-type of the data, NULL if not known
+ * @param transfer_encoding encoding of the data, NULL if not known
+ * @return file descriptor to append the data to,
+ *         #MHD_POST_SPOOL_TEMP_FILE to use a temporary file, or
+ *         -1 to pass the data to the #MHD_PostDataIterator as usual
+ */
+typedef int
+(*MHD_PostSpoolOpenCallback) (void *cls,
+                              const char *key,
+                              const char *filename,
+                              const char *content_type,
+                              const char *transfer_encoding);
+
+
+/**
+ * Notification that a file part of a multipart POST was completely
+ * written to the file descriptor returned by the
+ * #MHD_PostSpoolOpenCallback.  Temporary files are closed by MHD
+ * after this callback returns, others are left to the application.
+ *
+ * @param cls custom value given with the option
+ * @param key name of the form field
+ * @param filename name of the uploaded file
+ * @param content_type mime-type of the data, NULL if not known
+ * @param transfer_encoding encoding of the data, NULL if not known
+ * @param fd file descriptor the data was written to
+ * @param size number of bytes written
+ * @return #MHD_YES to continue processing,
+ *         #MHD_NO to abort the post processing
+ */
+typedef int
+(*MHD_PostSpoolDoneCallback) (void *cls,
+                              const char *key,
+                              const char *filename,
+                              const char *content_type,
+                              const char *transfer_encoding,
+                              int fd,
+                              uint64_t size);
+
+
+/**
+ * A decoded field of an url-encoded POST body, see
+ * #MHD_POST_PROCESSOR_OPTION_BATCH.
+ */
+struct MHD_PostField
+{
+  /**
+   * Name of the field, 0-terminated.
+   */
+  const char *key;
+
+  /**
+   * Number of bytes in @e key.
+   */
+  size_t key_size;
+
+  /**
+   * Value of the field, 0-terminated, NULL if the field
+   * had no '='.
+   */
+  const char *value;
+
+  /**
+   * Number of bytes in @e value.
+   */
+  size_t value_size;
+};
+
+
+/**
+ * Receive the fields of an url-encoded POST body that were
+ * completed by a call to #MHD_post_process.  The fields are only
+ * valid until the callback returns.
+ *
+ * @param cls custom value given with the option
+ * @param fields array of decoded fields
+ * @param num_fields number of entries in @a fields
+ * @return #MHD_YES to continue processing,
+ *         #MHD_NO to abort the post processing
+ */
+typedef int
+(*MHD_PostBatchCallback) (void *cls,
+                          const struct MHD_PostField *fields,
+                          unsigned int num_fields);
+
+
+/**
+ * PostProcessor options.  Given to #MHD_set_post_processor_option
+ * to change how a particular PostProcessor works.
+ */
+enum MHD_POST_PROCESSOR_OPTION
+{
+
+  /**
+   * Pass multipart values to the #MHD_PostDataIterator as slices
+   * of the data given to #MHD_post_process whenever they do not
+   * straddle a boundary, instead of copying them to the internal
+   * buffer first.  Followed by an `int` (#MHD_YES or #MHD_NO).
+   * With this option, the iterator may be given data larger than
+   * the buffer size of the PostProcessor, and the data is not
+   * 0-terminated.  Has no effect for url-encoded data.
+   */
+  MHD_POST_PROCESSOR_OPTION_ZERO_COPY,
+
+  /**
+   * Write the data of multipart parts that carry a filename to a
+   * file instead of passing it to the #MHD_PostDataIterator.
+   * Followed by a #MHD_PostSpoolOpenCallback, a
+   * #MHD_PostSpoolDoneCallback and a `void *` closure for both.
+   * Has no effect for url-encoded data.
+   */
+  MHD_POST_PROCESSOR_OPTION_SPOOL,
+
+  /**
+   * Pass url-encoded fields to a #MHD_PostBatchCallback instead of
+   * the #MHD_PostDataIterator.  The callback is called at most once
+   * per call to #MHD_post_process (and once more when the
+   * PostProcessor is destroyed) with all fields completed by that
+   * call.  Incomplete fields are kept in the internal buffer, so no
+   * single field may be larger than its size.  Followed by a
+   * #MHD_PostBatchCallback and a `void *` closure for it.  Has no
+   * effect for multipart data.
+   */
+  MHD_POST_PROCESSOR_OPTION_BATCH
+
+};
+
+
+/**
+ * Set a custom option for the given PostProcessor.  Should be
+ * called before the first call to #MHD_post_process.
+ *
+ * @param pp the post processor
+ * @param option option to set
+ * @param ... arguments to the option, depending on the option type
+ * @return #MHD_YES on success, #MHD_NO if setting the option failed
+ * @ingroup request
+ */
+_MHD_EXTERN int
+MHD_set_post_processor_option (struct MHD_PostProcessor *pp,
+                               enum MHD_POST_PROCESSOR_OPTION option,
+                               ...);
 
 
 /**
@@ -2525,6 +5256,36 @@ MHD_digest_auth_check (struct MHD_Connection *connection,
 		       unsigned int nonce_timeout);
 
 
+/**
+ * Length of the binary output of the MD5 hash function.
+ */
+#define MHD_MD5_DIGEST_SIZE 16
+
+
+/**
+ * Authenticates the authorization header sent by the client, given
+ * the MD5 of "username:realm:password" (H(A1) of RFC 2617) instead
+ * of the password.  This way, applications need not keep (or
+ * compute H(A1) from) the plaintext password for every request.
+ *
+ * @param connection The MHD connection structure
+ * @param realm The realm presented to the client
+ * @param username The username needs to be authenticated
+ * @param digest The binary H(A1) of the user
+ * @param nonce_timeout The amount of time for a nonce to be
+ * 			invalid in seconds
+ * @return #MHD_YES if authenticated, #MHD_NO if not,
+ * 			#MHD_INVALID_NONCE if nonce is invalid
+ * @ingroup authentication
+ */
+_MHD_EXTERN int
+MHD_digest_auth_check_digest (struct MHD_Connection *connection,
+			      const char *realm,
+			      const char *username,
+			      const uint8_t digest[MHD_MD5_DIGEST_SIZE],
+			      unsigned int nonce_timeout);
+
+
 /**
  * Queues a response to request authentication from the client
  *
@@ -2561,6 +5322,58 @@ MHD_basic_auth_get_username_password (struct MHD_Connection *connection,
 				      char** password);
 
 
+/**
+ * Get the username and password from the basic authorization header
+ * sent by the client without allocating memory with malloc(): they
+ * are decoded into the memory pool of the connection and valid until
+ * the request is completed; the application must not free them.
+ *
+ * @param connection The MHD connection structure
+ * @param username set to the username
+ * @param password set to the password, may be NULL
+ * @return #MHD_YES on success, #MHD_NO if no (valid) credentials
+ *         were sent or the memory pool is full
+ * @ingroup authentication
+ */
+_MHD_EXTERN int
+MHD_basic_auth_get_credentials (struct MHD_Connection *connection,
+                                const char **username,
+                                const char **password);
+
+
+/**
+ * Check whether the basic authorization header of the request was
+ * recently verified for @a realm, see #MHD_basic_auth_cache_verified()
+ * and #MHD_OPTION_BASIC_AUTH_CACHE_SIZE.
+ *
+ * @param connection The MHD connection structure
+ * @param realm realm the credentials are checked for
+ * @return #MHD_YES if the same header was verified within
+ *         #MHD_OPTION_BASIC_AUTH_CACHE_TTL seconds, #MHD_NO if the
+ *         credentials must be checked
+ * @ingroup authentication
+ */
+_MHD_EXTERN int
+MHD_basic_auth_check_cached (struct MHD_Connection *connection,
+                             const char *realm);
+
+
+/**
+ * Remember that the application verified the basic authorization
+ * header of the request for @a realm, so that
+ * #MHD_basic_auth_check_cached() accepts it for the next
+ * #MHD_OPTION_BASIC_AUTH_CACHE_TTL seconds.  Does nothing without
+ * #MHD_OPTION_BASIC_AUTH_CACHE_SIZE.
+ *
+ * @param connection The MHD connection structure
+ * @param realm realm the credentials were checked for
+ * @ingroup authentication
+ */
+_MHD_EXTERN void
+MHD_basic_auth_cache_verified (struct MHD_Connection *connection,
+                               const char *realm);
+
+
 /**
  * Queues a response to request basic authentication from the client
  * The given response object is expected to include the payload for
@@ -2609,7 +5422,38 @@ enum MHD_CONNECTION_OPTION
    * as the number of seconds, given as an `unsigned int`.  Use
    * zero for no timeout.
    */
-  MHD_CONNECTION_OPTION_TIMEOUT
+  MHD_CONNECTION_OPTION_TIMEOUT,
+
+  /**
+   * Limit the rate at which data is sent to the client of the given
+   * connection, in addition to any #MHD_OPTION_SEND_RATE_LIMIT of the
+   * daemon.  Specified as the number of bytes per second, given as
+   * an `unsigned int`.  Use zero for no limit.
+   */
+  MHD_CONNECTION_OPTION_SEND_RATE_LIMIT,
+
+  /**
+   * Limit the rate at which data is received from the client of the
+   * given connection, in addition to any #MHD_OPTION_RECV_RATE_LIMIT
+   * of the daemon.  Specified as the number of bytes per second,
+   * given as an `unsigned int`.  Use zero for no limit.
+   */
+  MHD_CONNECTION_OPTION_RECV_RATE_LIMIT,
+
+  /**
+   * Set the priority class of the given connection, given as an
+   * `enum MHD_ConnectionPriority`.  Can be set for example from the
+   * #MHD_OPTION_NOTIFY_CONNECTION callback for all requests of a
+   * connection; a #MHD_PriorityCallback overrides it per request.
+   */
+  MHD_CONNECTION_OPTION_PRIORITY,
+
+  /**
+   * Like #MHD_CONNECTION_OPTION_TIMEOUT, but specified as the
+   * number of milliseconds, given as an `unsigned int`.  Use zero
+   * for no timeout.
+   */
+  MHD_CONNECTION_OPTION_TIMEOUT_MS
 
 };
 
@@ -2629,6 +5473,172 @@ MHD_set_connection_option (struct MHD_Connection *connection,
 			   ...);
 
 
+/**
+ * Statistics of an MHD daemon, see #MHD_DAEMON_INFO_STATS.  All
+ * values except @e suspended and @e parked count events since the
+ * daemon was started.
+ */
+struct MHD_DaemonStats
+{
+  /**
+   * Connections accepted from the listen socket.
+   */
+  uint64_t accepts;
+
+  /**
+   * Calls to accept() on the listen socket that failed for other
+   * reasons than no connection waiting.
+   */
+  uint64_t accept_errors;
+
+  /**
+   * Requests whose headers were received.
+   */
+  uint64_t requests;
+
+  /**
+   * Bytes received from clients (encrypted bytes with HTTPS).
+   */
+  uint64_t bytes_received;
+
+  /**
+   * Bytes sent to clients (encrypted bytes with HTTPS).
+   */
+  uint64_t bytes_sent;
+
+  /**
+   * Connections kept alive for another request after a response.
+   */
+  uint64_t keep_alive_reuses;
+
+  /**
+   * Connections closed because they were idle for too long.
+   */
+  uint64_t timeouts;
+
+  /**
+   * Connections currently suspended, by the application or while
+   * waiting for a handler or handshake thread.
+   */
+  uint64_t suspended;
+
+  /**
+   * TLS handshakes completed.
+   */
+  uint64_t tls_handshakes;
+
+  /**
+   * Requests rejected with "413 Request Entity Too Large" or "414
+   * Request-URI Too Long" because they did not fit into the memory
+   * pool of their connection.
+   */
+  uint64_t pool_exhaustions;
+
+  /**
+   * Allocations from the memory pool of a connection that failed
+   * while growing the read buffer.
+   */
+  uint64_t pool_fail_read_buffer;
+
+  /**
+   * Allocations from the memory pool of a connection that failed
+   * while storing the headers, cookies and other values of a
+   * request.
+   */
+  uint64_t pool_fail_headers;
+
+  /**
+   * Allocations from the memory pool of a connection that failed
+   * while preparing the write buffer of a response (the buffer is
+   * retried at half the size, each try counts).
+   */
+  uint64_t pool_fail_write_buffer;
+
+  /**
+   * Other allocations from the memory pool of a connection that
+   * failed, such as for byte ranges or upgrade handles.
+   */
+  uint64_t pool_fail_other;
+
+  /**
+   * Iterations of the event loops of the daemon.
+   */
+  uint64_t loop_iterations;
+
+  /**
+   * Returns from the wait system call of the event loops.
+   */
+  uint64_t loop_wakeups;
+
+  /**
+   * Events returned by the wait system call of the event loops.
+   */
+  uint64_t loop_events;
+
+  /**
+   * Microseconds the event loops spent blocked in their wait system
+   * call.
+   */
+  uint64_t loop_wait_usec;
+
+  /**
+   * Microseconds the event loops spent processing events.
+   */
+  uint64_t loop_dispatch_usec;
+
+  /**
+   * Log messages dropped because the ring of
+   * #MHD_OPTION_LOG_QUEUE_SIZE was full.
+   */
+  uint64_t log_dropped;
+
+  /**
+   * Log messages suppressed by #MHD_OPTION_LOG_RATE_LIMIT.
+   */
+  uint64_t log_suppressed;
+
+  /**
+   * Connections that switched to HTTP/2.
+   */
+  uint64_t http2_sessions;
+
+  /**
+   * Streams (requests) opened on HTTP/2 connections.
+   */
+  uint64_t http2_streams;
+
+  /**
+   * Idle connections handed over to another thread of the thread
+   * pool, see #MHD_OPTION_CONNECTION_REBALANCE.
+   */
+  uint64_t migrations;
+
+  /**
+   * Requests closed because their headers did not arrive within
+   * #MHD_OPTION_HEADER_TIMEOUT_MS.
+   */
+  uint64_t header_timeouts;
+
+  /**
+   * Connections closed because they transferred a body slower than
+   * #MHD_OPTION_MIN_DATA_RATE.
+   */
+  uint64_t slow_transfers;
+
+  /**
+   * Requests whose headers borrowed memory from the arena of
+   * #MHD_OPTION_HEADER_OVERFLOW_ARENA.
+   */
+  uint64_t header_overflows;
+
+  /**
+   * Connections currently parked without a thread, see
+   * #MHD_OPTION_PARK_IDLE_CONNECTIONS.
+   */
+  uint64_t parked;
+};
+
+
 /**
  * Information about an MHD daemon.
  */
@@ -2656,6 +5666,11 @@ union MHD_DaemonInfo
    * Number of active connections, for #MHD_DAEMON_INFO_CURRENT_CONNECTIONS.
    */
   unsigned int num_connections;
+
+  /**
+   * Statistics of the daemon, for #MHD_DAEMON_INFO_STATS.
+   */
+  struct MHD_DaemonStats stats;
 };
 
 
@@ -2676,6 +5691,156 @@ MHD_get_daemon_info (struct MHD_Daemon *daemon,
 		     ...);
 
 
+/**
+ * Number of buckets of a `struct MHD_LatencyHistogram`.  The first 32
+ * buckets hold one microsecond each; after that, every doubling of
+ * the latency is split into 16 buckets, so a value is off by at most
+ * 1/16th.  The last bucket also holds all latencies above its range
+ * (about 38 hours).
+ */
+#define MHD_LATENCY_BUCKETS 544
+
+
+/**
+ * Latencies measured by #MHD_get_latency_histogram().
+ */
+enum MHD_LatencyType
+{
+
+  /**
+   * Time from the first byte of a request to the response headers
+   * being sent.
+   */
+  MHD_LATENCY_FIRST_BYTE = 0,
+
+  /**
+   * Time from the first byte of a request to the complete response
+   * being sent.
+   */
+  MHD_LATENCY_TOTAL = 1
+
+};
+
+
+/**
+ * Histogram of request latencies in microseconds, see
+ * #MHD_LATENCY_BUCKETS for its layout.
+ */
+struct MHD_LatencyHistogram
+{
+  /**
+   * Number of requests measured.
+   */
+  uint64_t count;
+
+  /**
+   * Sum of all latencies measured, in microseconds.
+   */
+  uint64_t sum;
+
+  /**
+   * Number of requests per bucket, see #MHD_latency_bucket_limit().
+   */
+  uint64_t buckets[MHD_LATENCY_BUCKETS];
+};
+
+
+/**
+ * Get the histogram of the latency @a type of all requests completed
+ * by @a daemon, summed up over the threads of a thread pool.  The
+ * threads record into their histograms without locking while they are
+ * read, so @e count and the @e buckets need not match exactly.
+ *
+ * @param daemon daemon to get the histogram of
+ * @param type which latency to get
+ * @param[out] histogram set to the histogram
+ * @return #MHD_YES on success, #MHD_NO if @a type is unknown
+ * @ingroup specialized
+ */
+_MHD_EXTERN int
+MHD_get_latency_histogram (struct MHD_Daemon *daemon,
+                           enum MHD_LatencyType type,
+                           struct MHD_LatencyHistogram *histogram);
+
+
+/**
+ * Get the histogram of the peak memory pool usage of the connections
+ * closed by @a daemon, summed up over the threads of a thread pool.
+ * It has the layout of a latency histogram, with bytes instead of
+ * microseconds, so #MHD_latency_bucket_limit() and
+ * #MHD_latency_histogram_percentile() apply to it.  This helps to
+ * pick the #MHD_OPTION_CONNECTION_MEMORY_LIMIT.
+ *
+ * @param daemon daemon to get the histogram of
+ * @param[out] histogram set to the histogram
+ * @ingroup specialized
+ */
+_MHD_EXTERN void
+MHD_get_pool_usage_histogram (struct MHD_Daemon *daemon,
+                              struct MHD_LatencyHistogram *histogram);
+
+
+/**
+ * Add the histogram @a src to @a dst, for example to combine the
+ * histograms of several daemons.
+ *
+ * @param dst histogram to add to
+ * @param src histogram to add
+ * @ingroup specialized
+ */
+_MHD_EXTERN void
+MHD_latency_histogram_merge (struct MHD_LatencyHistogram *dst,
+                             const struct MHD_LatencyHistogram *src);
+
+
+/**
+ * Get the highest latency recorded in @a bucket of a
+ * `struct MHD_LatencyHistogram`.
+ *
+ * @param bucket index of the bucket, below #MHD_LATENCY_BUCKETS
+ * @return highest latency of the bucket in microseconds
+ * @ingroup specialized
+ */
+_MHD_EXTERN uint64_t
+MHD_latency_bucket_limit (unsigned int bucket);
+
+
+/**
+ * Get the latency below which @a percentile percent of the requests
+ * in @a histogram were completed, rounded up to the limit of its
+ * bucket.
+ *
+ * @param histogram histogram to evaluate
+ * @param percentile percentage of requests, for example 99.9
+ * @return latency in microseconds, 0 if @a histogram is empty
+ * @ingroup specialized
+ */
+_MHD_EXTERN uint64_t
+MHD_latency_histogram_percentile (const struct MHD_LatencyHistogram *histogram,
+                                  double percentile);
+
+
+/**
+ * Create a response with the statistics of @a daemon in the
+ * OpenMetrics text format, for Prometheus and compatible scrapers:
+ * the counters of #MHD_DAEMON_INFO_STATS, the open connections (also
+ * per thread of a thread pool), the memory of the pools with
+ * #MHD_OPTION_MEMORY_BUDGET and the histograms of
+ * #MHD_get_latency_histogram() and #MHD_get_pool_usage_histogram().
+ * Queue it from the access handler of any URL and destroy it as
+ * usual.  The values are read without locking, like for
+ * #MHD_DAEMON_INFO_STATS.  The text is rendered into a buffer that
+ * is reused by the next call once the response is destroyed, so the
+ * response must be destroyed before @a daemon is stopped.
+ *
+ * @param daemon daemon to export the statistics of
+ * @return NULL on error (out of memory)
+ * @ingroup specialized
+ */
+_MHD_EXTERN struct MHD_Response *
+MHD_create_metrics_response (struct MHD_Daemon *daemon);
+
+
 /**
  * Obtain the version of this library
  *
@@ -2798,7 +5963,58 @@ enum MHD_FEATURE
    * offsets larger than 2 GiB. If not supported value of size+offset is
    * limited to 2 GiB.
    */
-  MHD_FEATURE_LARGE_FILE = 15
+  MHD_FEATURE_LARGE_FILE = 15,
+
+  /**
+   * Get whether MHD supports "upgrading" connections to other
+   * protocols using #MHD_create_response_for_upgrade().
+   */
+  MHD_FEATURE_UPGRADE = 16,
+
+  /**
+   * Get whether io_uring is supported by this build.  If supported
+   * then flags #MHD_USE_IO_URING_LINUX_ONLY and
+   * #MHD_USE_IO_URING_INTERNALLY_LINUX_ONLY can be used (the running
+   * kernel may still lack the required features).
+   */
+  MHD_FEATURE_IO_URING = 17,
+
+  /**
+   * Get whether responses can be compressed on the fly with
+   * #MHD_RO_COMPRESSION_LEVEL and request bodies decompressed with
+   * #MHD_OPTION_INFLATE_REQUEST_BODY (MHD was built with zlib).
+   */
+  MHD_FEATURE_COMPRESSION = 18,
+
+  /**
+   * Get whether `kqueue()` is supported.  If supported then flags
+   * #MHD_USE_KQUEUE and #MHD_USE_KQUEUE_INTERNALLY can be used.
+   */
+  MHD_FEATURE_KQUEUE = 19,
+
+  /**
+   * Get whether the daemon can listen on Unix domain (AF_UNIX)
+   * sockets, see #MHD_OPTION_SOCK_ADDR.
+   */
+  MHD_FEATURE_UNIX_SOCKETS = 20,
+
+  /**
+   * Get whether listen sockets can be passed to another process with
+   * #MHD_handoff_listen_socket() and #MHD_receive_listen_socket().
+   */
+  MHD_FEATURE_SOCKET_HANDOFF = 21,
+
+  /**
+   * Get whether the kernel can filter connections by IP address
+   * before accept(), see #MHD_set_ip_filter().
+   */
+  MHD_FEATURE_IP_FILTER = 22,
+
+  /**
+   * Get whether #MHD_create_response_from_memfd() keeps the body in
+   * a sealed in-memory file rather than in a copy in memory.
+   */
+  MHD_FEATURE_MEMFD_RESPONSE = 23
 };
 
 
@@ -8,53 +8,113 @@
  */
 #include "base64.h"
 
-static const char base64_chars[] =
-  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-
-static const char base64_digits[] =
-  { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 62, 0, 0, 0, 63, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61,
-    0, 0, 0, -1, 0, 0, 0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13,
-    14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 0, 0, 0, 0, 0, 0, 26,
-    27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44,
-    45, 46, 47, 48, 49, 50, 51, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+/**
+ * Values of the base64 digits by character, 0xff for characters
+ * that are no digits (including the padding '=').
+ */
+static const uint8_t base64_values[256] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+    0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+
+/**
+ * Decode base64 without allocating memory.  Each group of four
+ * digits is looked up in the table and checked for invalid
+ * characters with a single comparison.
+ *
+ * @param src base64 to decode, need not be 0-terminated
+ * @param src_len length of @a src, a multiple of 4
+ * @param dest where to store the result, at least @a src_len / 4 * 3
+ *        bytes; not 0-terminated
+ * @return number of bytes stored in @a dest, (size_t) -1 if @a src
+ *         is no valid base64
+ */
+size_t
+BASE64DecodeTo (const char *src,
+                size_t src_len,
+                char *dest)
+{
+  const uint8_t *in = (const uint8_t *) src;
+  const uint8_t *end;
+  uint8_t *out = (uint8_t *) dest;
+  uint_fast32_t a;
+  uint_fast32_t b;
+  uint_fast32_t c;
+  uint_fast32_t d;
+
+  if (0 != src_len % 4)
+    return (size_t) -1;
+  if (0 == src_len)
+    return 0;
+  end = in + src_len - 4;
+  while (in < end)
+    {
+      a = base64_values[in[0]];
+      b = base64_values[in[1]];
+      c = base64_values[in[2]];
+      d = base64_values[in[3]];
+      if ((a | b | c | d) >= 64)
+        return (size_t) -1;
+      a = (a << 18) | (b << 12) | (c << 6) | d;
+      out[0] = (uint8_t) (a >> 16);
+      out[1] = (uint8_t) (a >> 8);
+      out[2] = (uint8_t) a;
+      in += 4;
+      out += 3;
+    }
+  /* the last group may end with one or two '=' */
+  a = base64_values[in[0]];
+  b = base64_values[in[1]];
+  c = ( ('=' == in[2]) && ('=' == in[3]) ) ? 0 : base64_values[in[2]];
+  d = ('=' == in[3]) ? 0 : base64_values[in[3]];
+  if ((a | b | c | d) >= 64)
+    return (size_t) -1;
+  *(out++) = (uint8_t) ((a << 2) | (b >> 4));
+  if ('=' != in[2])
+    *(out++) = (uint8_t) ((b << 4) | (c >> 2));
+  if ('=' != in[3])
+    *(out++) = (uint8_t) ((c << 6) | d);
+  return (size_t) (out - (uint8_t *) dest);
+}
 
 
 char *
 BASE64Decode(const char* src)
 {
   size_t in_len = strlen (src);
-  char* dest;
   char* result;
+  size_t len;
 
   if (in_len % 4)
     {
       /* Wrong base64 string length */
       return NULL;
     }
-  result = dest = malloc(in_len / 4 * 3 + 1);
+  result = malloc(in_len / 4 * 3 + 1);
   if (result == NULL)
     return NULL; /* out of memory */
-  while (*src) {
-    char a = base64_digits[(unsigned char)*(src++)];
-    char b = base64_digits[(unsigned char)*(src++)];
-    char c = base64_digits[(unsigned char)*(src++)];
-    char d = base64_digits[(unsigned char)*(src++)];
-    *(dest++) = (a << 2) | ((b & 0x30) >> 4);
-    if (c == (char)-1)
-      break;
-    *(dest++) = ((b & 0x0f) << 4) | ((c & 0x3c) >> 2);
-    if (d == (char)-1)
-      break;
-    *(dest++) = ((c & 0x03) << 6) | d;
-  }
-  *dest = 0;
+  len = BASE64DecodeTo (src, in_len, result);
+  if ((size_t) -1 == len)
+    {
+      free (result);
+      return NULL;
+    }
+  result[len] = 0;
   return result;
 }
 
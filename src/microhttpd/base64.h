@@ -11,6 +11,22 @@
 
 #include "platform.h"
 
+/**
+ * Decode base64 into a buffer of the caller.
+ *
+ * @param src base64 to decode, need not be 0-terminated
+ * @param src_len length of @a src, a multiple of 4
+ * @param dest where to store the result, at least @a src_len / 4 * 3
+ *        bytes; not 0-terminated
+ * @return number of bytes stored in @a dest, (size_t) -1 if @a src
+ *         is no valid base64
+ */
+size_t
+BASE64DecodeTo (const char *src,
+                size_t src_len,
+                char *dest);
+
+
 char *
 BASE64Decode(const char* src);
 
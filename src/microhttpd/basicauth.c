@@ -26,12 +26,21 @@
 #include <limits.h>
 #include "internal.h"
 #include "base64.h"
+#include "sha256.h"
+#include "memorypool.h"
+#include "mhd_mono_clock.h"
 
 /**
  * Beginning string for any valid Basic authentication header.
  */
 #define _BASIC_BASE		"Basic "
 
+/**
+ * Seconds entries of the cache of verified headers stay valid if
+ * #MHD_OPTION_BASIC_AUTH_CACHE_TTL was not given.
+ */
+#define DEFAULT_CACHE_TTL 60
+
 
 /**
  * Get the username and password from the basic authorization header sent by the client
@@ -51,9 +60,9 @@ MHD_basic_auth_get_username_password (struct MHD_Connection *connection,
   const char *separator;
   char *user;
   
-  if ( (NULL == (header = MHD_lookup_connection_value (connection, 
-						       MHD_HEADER_KIND,
-						       MHD_HTTP_HEADER_AUTHORIZATION))) ||
+  if ( (NULL == (header = MHD_lookup_connection_token_value (connection, 
+                                                             MHD_HEADER_KIND,
+                                                             MHD_HEADER_TOKEN_AUTHORIZATION))) ||
        (0 != strncmp (header, _BASIC_BASE, strlen(_BASIC_BASE))) )
     return NULL;
   header += strlen (_BASIC_BASE);
@@ -100,6 +109,273 @@ MHD_basic_auth_get_username_password (struct MHD_Connection *connection,
 }
 
 
+/**
+ * Get the username and password from the basic authorization header
+ * sent by the client, decoded into the memory pool of the connection.
+ *
+ * @param connection The MHD connection structure
+ * @param username set to the username
+ * @param password set to the password, may be NULL
+ * @return #MHD_YES on success, #MHD_NO if no (valid) credentials
+ *         were sent or the memory pool is full
+ * @ingroup authentication
+ */
+int
+MHD_basic_auth_get_credentials (struct MHD_Connection *connection,
+                                const char **username,
+                                const char **password)
+{
+  const char *header;
+  char *decode;
+  char *separator;
+  size_t len;
+
+  if ( (NULL == (header = MHD_lookup_connection_token_value (connection,
+                                                             MHD_HEADER_KIND,
+                                                             MHD_HEADER_TOKEN_AUTHORIZATION))) ||
+       (0 != strncmp (header, _BASIC_BASE, strlen (_BASIC_BASE))) )
+    return MHD_NO;
+  header += strlen (_BASIC_BASE);
+  len = strlen (header);
+  decode = MHD_pool_allocate (connection->pool,
+                              len / 4 * 3 + 1,
+                              MHD_YES);
+  if (NULL == decode)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (connection->daemon,
+                "Not enough memory to decode basic authentication\n");
+#endif
+      return MHD_NO;
+    }
+  len = BASE64DecodeTo (header,
+                        len,
+                        decode);
+  if ((size_t) -1 == len)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (connection->daemon,
+                "Error decoding basic authentication\n");
+#endif
+      return MHD_NO;
+    }
+  decode[len] = '\0';
+  /* Find user:password pattern */
+  if (NULL == (separator = strchr (decode, ':')))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (connection->daemon,
+                "Basic authentication doesn't contain ':' separator\n");
+#endif
+      return MHD_NO;
+    }
+  *separator = '\0';
+  *username = decode;
+  if (NULL != password)
+    *password = separator + 1;
+  return MHD_YES;
+}
+
+
+/**
+ * Entry of the cache of verified Basic authorization headers of a
+ * daemon, see #MHD_OPTION_BASIC_AUTH_CACHE_SIZE.
+ */
+struct MHD_BasicAuthCacheEntry
+{
+  /**
+   * Protects the entry.
+   */
+  MHD_mutex_ lock;
+
+  /**
+   * SHA-256 of the realm and the header value, see hash_header().
+   */
+  unsigned char digest[SHA256_DIGEST_SIZE];
+
+  /**
+   * Monotonic time (in seconds) until the entry is valid, 0 for
+   * unused entries.
+   */
+  time_t expires;
+};
+
+
+/**
+ * Create the cache of verified Basic authorization headers of a
+ * (master) daemon, if #MHD_OPTION_BASIC_AUTH_CACHE_SIZE was given.
+ *
+ * @param daemon daemon to create the cache for
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+int
+MHD_basic_auth_cache_init_ (struct MHD_Daemon *daemon)
+{
+  unsigned int i;
+
+  daemon->basic_auth_cache = NULL;
+  if (0 == daemon->basic_auth_cache_size)
+    return MHD_YES;
+  if (0 == daemon->basic_auth_cache_ttl)
+    daemon->basic_auth_cache_ttl = DEFAULT_CACHE_TTL;
+  daemon->basic_auth_cache = calloc (daemon->basic_auth_cache_size,
+                                     sizeof (struct MHD_BasicAuthCacheEntry));
+  if (NULL == daemon->basic_auth_cache)
+    return MHD_NO;
+  for (i = 0; i < daemon->basic_auth_cache_size; i++)
+    if (MHD_YES != MHD_mutex_create_ (&daemon->basic_auth_cache[i].lock))
+      {
+        while (i > 0)
+          (void) MHD_mutex_destroy_ (&daemon->basic_auth_cache[--i].lock);
+        free (daemon->basic_auth_cache);
+        daemon->basic_auth_cache = NULL;
+        return MHD_NO;
+      }
+  return MHD_YES;
+}
+
+
+/**
+ * Destroy the cache of verified Basic authorization headers of a
+ * (master) daemon.
+ *
+ * @param daemon daemon to destroy the cache of
+ */
+void
+MHD_basic_auth_cache_destroy_ (struct MHD_Daemon *daemon)
+{
+  unsigned int i;
+
+  if (NULL == daemon->basic_auth_cache)
+    return;
+  for (i = 0; i < daemon->basic_auth_cache_size; i++)
+    (void) MHD_mutex_destroy_ (&daemon->basic_auth_cache[i].lock);
+  free (daemon->basic_auth_cache);
+  daemon->basic_auth_cache = NULL;
+}
+
+
+/**
+ * Find the entry of the cache of verified headers for the Basic
+ * authorization header of @a connection.  Only a SHA-256 hash of
+ * the header is kept, so the cache holds no passwords.
+ *
+ * @param connection the connection
+ * @param realm realm the header is checked for
+ * @param digest set to the SHA-256 of @a realm and the header
+ * @return the entry, NULL if the daemon has no cache or the request
+ *         no Basic authorization header
+ */
+static struct MHD_BasicAuthCacheEntry *
+hash_header (struct MHD_Connection *connection,
+             const char *realm,
+             unsigned char digest[SHA256_DIGEST_SIZE])
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+  struct SHA256Context sha;
+  const char *header;
+  uint32_t hash;
+
+  if (NULL != daemon->master)
+    daemon = daemon->master;
+  if ( (NULL == daemon->basic_auth_cache) ||
+       (NULL == (header = MHD_lookup_connection_token_value (connection,
+                                                             MHD_HEADER_KIND,
+                                                             MHD_HEADER_TOKEN_AUTHORIZATION))) ||
+       (0 != strncmp (header, _BASIC_BASE, strlen (_BASIC_BASE))) )
+    return NULL;
+  SHA256Init (&sha);
+  SHA256Update (&sha, (const unsigned char *) realm, strlen (realm) + 1);
+  SHA256Update (&sha, (const unsigned char *) header, strlen (header));
+  SHA256Final (digest, &sha);
+  memcpy (&hash, digest, sizeof (hash));
+  return &daemon->basic_auth_cache[hash % daemon->basic_auth_cache_size];
+}
+
+
+/**
+ * Compare two digests in time independent of where they differ.
+ *
+ * @param a first digest
+ * @param b second digest
+ * @return non-zero if @a a and @a b are equal
+ */
+static int
+digest_equal (const unsigned char a[SHA256_DIGEST_SIZE],
+              const unsigned char b[SHA256_DIGEST_SIZE])
+{
+  unsigned char diff;
+  unsigned int i;
+
+  diff = 0;
+  for (i = 0; i < SHA256_DIGEST_SIZE; i++)
+    diff |= a[i] ^ b[i];
+  return 0 == diff;
+}
+
+
+/**
+ * Check whether the basic authorization header of the request was
+ * recently verified for @a realm, see #MHD_basic_auth_cache_verified().
+ *
+ * @param connection The MHD connection structure
+ * @param realm realm the credentials are checked for
+ * @return #MHD_YES if the same header was verified within
+ *         #MHD_OPTION_BASIC_AUTH_CACHE_TTL seconds, #MHD_NO if the
+ *         credentials must be checked
+ * @ingroup authentication
+ */
+int
+MHD_basic_auth_check_cached (struct MHD_Connection *connection,
+                             const char *realm)
+{
+  struct MHD_BasicAuthCacheEntry *entry;
+  unsigned char digest[SHA256_DIGEST_SIZE];
+  int ret;
+
+  if (NULL == (entry = hash_header (connection, realm, digest)))
+    return MHD_NO;
+  (void) MHD_mutex_lock_ (&entry->lock);
+  ret = ( (0 != entry->expires) &&
+          (entry->expires > MHD_monotonic_sec_counter ()) &&
+          (digest_equal (entry->digest, digest)) )
+    ? MHD_YES
+    : MHD_NO;
+  (void) MHD_mutex_unlock_ (&entry->lock);
+  return ret;
+}
+
+
+/**
+ * Remember that the application verified the basic authorization
+ * header of the request for @a realm, so that
+ * #MHD_basic_auth_check_cached() accepts it for the next
+ * #MHD_OPTION_BASIC_AUTH_CACHE_TTL seconds.  Does nothing without
+ * #MHD_OPTION_BASIC_AUTH_CACHE_SIZE.
+ *
+ * @param connection The MHD connection structure
+ * @param realm realm the credentials were checked for
+ * @ingroup authentication
+ */
+void
+MHD_basic_auth_cache_verified (struct MHD_Connection *connection,
+                               const char *realm)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+  struct MHD_BasicAuthCacheEntry *entry;
+  unsigned char digest[SHA256_DIGEST_SIZE];
+
+  if (NULL == (entry = hash_header (connection, realm, digest)))
+    return;
+  if (NULL != daemon->master)
+    daemon = daemon->master;
+  (void) MHD_mutex_lock_ (&entry->lock);
+  memcpy (entry->digest, digest, sizeof (digest));
+  entry->expires = MHD_monotonic_sec_counter () + daemon->basic_auth_cache_ttl;
+  (void) MHD_mutex_unlock_ (&entry->lock);
+}
+
+
 /**
  * Queues a response to request basic authentication from the client.
  * The given response object is expected to include the payload for
@@ -30,12 +30,28 @@
 #include "memorypool.h"
 #include "response.h"
 #include "mhd_mono_clock.h"
+#include "mhd_probes.h"
+#include "mhd_compress.h"
+#include "mhd_rate_limit.h"
+#include "mhd_access_log.h"
+#include "mhd_slow_request.h"
+#include "mhd_http2.h"
+#include "mhd_broadcast.h"
+#include "mhd_stream.h"
+#include "mhd_cache.h"
+#include "mhd_sendfile.h"
+#include "mhd_tls.h"
+#include "mhd_siphash.h"
 
 #if HAVE_NETINET_TCP_H
 /* for TCP_CORK */
 #include <netinet/tcp.h>
 #endif
 
+#if MHD_SENDFILE_WITH_HEADER_
+#include "mhd_limits.h"
+#endif
+
 #if defined(_WIN32) && defined(MHD_W32_MUTEX_)
 #ifndef WIN32_LEAN_AND_MEAN
 #define WIN32_LEAN_AND_MEAN 1
@@ -43,6 +59,12 @@
 #include <windows.h>
 #endif /* _WIN32 && MHD_W32_MUTEX_ */
 
+#ifndef LINUX
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#endif
+
 
 /**
  * Message to transmit when http 1.1 request is received
@@ -88,6 +110,19 @@
 #define REQUEST_MALFORMED ""
 #endif
 
+/**
+ * Response text used when a compressed request body decompresses
+ * to more than #MHD_OPTION_INFLATE_REQUEST_BODY allows.
+ *
+ * Intentionally empty here to keep our memory footprint
+ * minimal.
+ */
+#ifdef HAVE_MESSAGES
+#define REQUEST_INFLATE_TOO_BIG "<html><head><title>Request too big</title></head><body>Your compressed request body decompresses to more data than this webserver accepts.</body></html>"
+#else
+#define REQUEST_INFLATE_TOO_BIG ""
+#endif
+
 /**
  * Response text used when there is an internal server error.
  *
@@ -100,6 +135,19 @@
 #define INTERNAL_ERROR ""
 #endif
 
+/**
+ * Response text used when a request is rejected because the daemon
+ * is overloaded (see #MHD_OPTION_OVERLOAD_LATENCY).
+ *
+ * Intentionally empty here to keep our memory footprint
+ * minimal.
+ */
+#ifdef HAVE_MESSAGES
+#define SERVICE_OVERLOADED "<html><head><title>Service unavailable</title></head><body>The server is too busy to handle your request, please try again later.</body></html>"
+#else
+#define SERVICE_OVERLOADED ""
+#endif
+
 /**
  * Add extra debug messages with reasons for closing connections
  * (non-error reasons).
@@ -111,6 +159,14 @@
  */
 #define DEBUG_SEND_DATA MHD_NO
 
+/**
+ * Maximum number of times #MHD_connection_handle_idle() writes
+ * directly to the socket (without returning to the event loop) while
+ * working through pipelined requests, to be fair to other
+ * connections.
+ */
+#define MHD_PIPELINE_MAX_WRITES 64
+
 
 /**
  * Check whether is possible to force push socket buffer content as
@@ -125,8 +181,8 @@
  * If flushing IS NOT possible than MHD activates no buffering (no
  * delay sending) when it going to send formed fully completed logical
  * part of data and activate normal buffering after sending.
- * For idled keep-alive connection MHD always activate normal
- * buffering.
+ * The mode is only changed for the next response if it needs a
+ * different one, an idle keep-alive connection sends nothing.
  *
  * @param connection connection to check
  * @return #MHD_YES if force push is possible, #MHD_NO otherwise
@@ -142,6 +198,43 @@ socket_flush_possible(struct MHD_Connection *connection)
 }
 
 
+#if defined(TCP_NODELAY) || defined(TCP_CORK) || defined(TCP_NOPUSH)
+/**
+ * Set the boolean TCP option @a opt of the socket of @a connection,
+ * unless @a state shows that it already has the value.
+ *
+ * @param connection connection to be processed
+ * @param opt option to set, like TCP_NODELAY
+ * @param on #MHD_YES to enable the option, #MHD_NO to disable it
+ * @param[in,out] state value MHD last set the option to
+ * @return #MHD_YES on success, #MHD_NO otherwise
+ */
+static int
+socket_set_tcp_option (struct MHD_Connection *connection,
+                       int opt,
+                       int on,
+                       enum MHD_SocketOptionState *state)
+{
+  const _MHD_SOCKOPT_BOOL_TYPE val = (MHD_YES == on) ? 1 : 0;
+  const enum MHD_SocketOptionState want = (MHD_YES == on)
+    ? MHD_SOCKOPT_ON
+    : MHD_SOCKOPT_OFF;
+
+  if ( (want == *state) ||
+       (MHD_SOCKOPT_UNSUPPORTED == *state) )
+    return MHD_YES;
+  if (0 != setsockopt (connection->socket_fd, IPPROTO_TCP, opt, (const void*)&val,
+                       sizeof (val)))
+    {
+      *state = MHD_SOCKOPT_UNKNOWN;
+      return MHD_NO;
+    }
+  *state = want;
+  return MHD_YES;
+}
+#endif /* TCP_NODELAY || TCP_CORK || TCP_NOPUSH */
+
+
 /**
  * Activate extra buffering mode on connection socket to prevent
  * sending of partial packets.
@@ -154,33 +247,29 @@ socket_start_extra_buffering (struct MHD_Connection *connection)
 {
   int res = MHD_NO;
 #if defined(TCP_CORK) || defined(TCP_NOPUSH)
-  const _MHD_SOCKOPT_BOOL_TYPE on_val = 1;
-#if defined(TCP_NODELAY)
-  const _MHD_SOCKOPT_BOOL_TYPE off_val = 0;
-#endif /* TCP_NODELAY */
   if (!connection)
     return MHD_NO;
 #if defined(TCP_NOPUSH) && !defined(TCP_CORK)
   /* Buffer data before sending */
-  res = (0 == setsockopt (connection->socket_fd, IPPROTO_TCP, TCP_NOPUSH, (const void*)&on_val,
-                          sizeof (on_val))) ? MHD_YES : MHD_NO;
+  res = socket_set_tcp_option (connection, TCP_NOPUSH, MHD_YES,
+                               &connection->sk_cork);
 #if defined(TCP_NODELAY)
   /* Enable Nagle's algorithm */
   /* TCP_NODELAY may interfere with TCP_NOPUSH */
-  res &= (0 == setsockopt (connection->socket_fd, IPPROTO_TCP, TCP_NODELAY, (const void*)&off_val,
-                           sizeof (off_val))) ? MHD_YES : MHD_NO;
+  res &= socket_set_tcp_option (connection, TCP_NODELAY, MHD_NO,
+                                &connection->sk_nodelay);
 #endif /* TCP_NODELAY */
 #else /* TCP_CORK */
 #if defined(TCP_NODELAY)
   /* Enable Nagle's algorithm */
   /* TCP_NODELAY may prevent enabling TCP_CORK. Resulting buffering mode depends
      solely on TCP_CORK result, so ignoring return code here. */
-  (void)setsockopt (connection->socket_fd, IPPROTO_TCP, TCP_NODELAY, (const void*)&off_val,
-                    sizeof (off_val));
+  (void) socket_set_tcp_option (connection, TCP_NODELAY, MHD_NO,
+                                &connection->sk_nodelay);
 #endif /* TCP_NODELAY */
   /* Send only full packets */
-  res = (0 == setsockopt (connection->socket_fd, IPPROTO_TCP, TCP_CORK, (const void*)&on_val,
-                          sizeof (on_val))) ? MHD_YES : MHD_NO;
+  res = socket_set_tcp_option (connection, TCP_CORK, MHD_YES,
+                               &connection->sk_cork);
 #endif /* TCP_CORK */
 #endif /* TCP_CORK || TCP_NOPUSH */
   return res;
@@ -189,7 +278,9 @@ socket_start_extra_buffering (struct MHD_Connection *connection)
 
 /**
  * Activate no buffering mode (no delay sending) on connection socket
- * and push to client data pending in socket buffer.
+ * and push to client data pending in socket buffer.  Nothing is done
+ * if neither extra buffering nor Nagle's algorithm is active, as no
+ * data can be pending then.
  *
  * @param connection connection to be processed
  * @return #MHD_YES on success, #MHD_NO otherwise
@@ -199,33 +290,33 @@ socket_start_no_buffering_flush (struct MHD_Connection *connection)
 {
 #if defined(TCP_CORK) || defined(TCP_NOPUSH)
   int res = MHD_YES;
-  const _MHD_SOCKOPT_BOOL_TYPE off_val = 0;
-#if defined(TCP_NODELAY)
-  const _MHD_SOCKOPT_BOOL_TYPE on_val = 1;
-#endif /* TCP_NODELAY */
 #if !defined(TCP_CORK)
   const int dummy = 0;
+  int pushed;
 #endif /* !TCP_CORK */
   if (!connection)
     return MHD_NO;
 #if defined(TCP_CORK)
   /* Flush buffered data, allow partial packets */
-  res &= (0 == setsockopt (connection->socket_fd, IPPROTO_TCP, TCP_CORK, (const void*)&off_val,
-                          sizeof (off_val))) ? MHD_YES : MHD_NO;
+  res &= socket_set_tcp_option (connection, TCP_CORK, MHD_NO,
+                                &connection->sk_cork);
 #endif /* TCP_CORK */
 #if defined(TCP_NODELAY)
   /* Disable Nagle's algorithm */
-  res &= (0 == setsockopt (connection->socket_fd, IPPROTO_TCP, TCP_NODELAY, (const void*)&on_val,
-                           sizeof (on_val))) ? MHD_YES : MHD_NO;
+  res &= socket_set_tcp_option (connection, TCP_NODELAY, MHD_YES,
+                                &connection->sk_nodelay);
 #endif /* TCP_NODELAY */
 #if defined(TCP_NOPUSH) && !defined(TCP_CORK)
+  pushed = ( (MHD_SOCKOPT_OFF == connection->sk_cork) ||
+             (MHD_SOCKOPT_UNSUPPORTED == connection->sk_cork) );
   /* Send data without extra buffering, may flush pending data on some platforms */
-  res &= (0 == setsockopt (connection->socket_fd, IPPROTO_TCP, TCP_NOPUSH, (const void*)&off_val,
-                           sizeof (off_val))) ? MHD_YES : MHD_NO;
+  res &= socket_set_tcp_option (connection, TCP_NOPUSH, MHD_NO,
+                                &connection->sk_cork);
   /* Force flush data with zero send otherwise Darwin and some BSD systems
      will add 5 seconds delay. Not required with TCP_CORK as switching off
      TCP_CORK always flushes socket buffer. */
-  res &= (0 <= send (connection->socket_fd, (const void*)&dummy, 0, 0)) ? MHD_YES : MHD_NO;
+  if (! pushed)
+    res &= (0 <= send (connection->socket_fd, (const void*)&dummy, 0, 0)) ? MHD_YES : MHD_NO;
 #endif /* TCP_NOPUSH && !TCP_CORK*/
   return res;
 #else  /* !TCP_CORK && !TCP_NOPUSH */
@@ -245,26 +336,20 @@ socket_start_no_buffering (struct MHD_Connection *connection)
 {
 #if defined(TCP_NODELAY)
   int res = MHD_YES;
-  const _MHD_SOCKOPT_BOOL_TYPE on_val = 1;
-#if defined(TCP_CORK) || defined(TCP_NOPUSH)
-  const _MHD_SOCKOPT_BOOL_TYPE off_val = 0;
-#endif /* TCP_CORK || TCP_NOPUSH */
   if (!connection)
     return MHD_NO;
 #if defined(TCP_CORK)
   /* Allow partial packets */
-  res &= (0 == setsockopt (connection->socket_fd, IPPROTO_TCP, TCP_CORK, (const void*)&off_val,
-                          sizeof (off_val))) ? MHD_YES : MHD_NO;
+  res &= socket_set_tcp_option (connection, TCP_CORK, MHD_NO,
+                                &connection->sk_cork);
 #endif /* TCP_CORK */
-#if defined(TCP_NODELAY)
   /* Disable Nagle's algorithm for sending packets without delay */
-  res &= (0 == setsockopt (connection->socket_fd, IPPROTO_TCP, TCP_NODELAY, (const void*)&on_val,
-                           sizeof (on_val))) ? MHD_YES : MHD_NO;
-#endif /* TCP_NODELAY */
+  res &= socket_set_tcp_option (connection, TCP_NODELAY, MHD_YES,
+                                &connection->sk_nodelay);
 #if defined(TCP_NOPUSH) && !defined(TCP_CORK)
   /* Disable extra buffering */
-  res &= (0 == setsockopt (connection->socket_fd, IPPROTO_TCP, TCP_NOPUSH, (const void*)&off_val,
-                           sizeof (off_val))) ? MHD_YES : MHD_NO;
+  res &= socket_set_tcp_option (connection, TCP_NOPUSH, MHD_NO,
+                                &connection->sk_cork);
 #endif /* TCP_NOPUSH  && !TCP_CORK */
   return res;
 #else  /* !TCP_NODELAY */
@@ -284,7 +369,6 @@ socket_start_normal_buffering (struct MHD_Connection *connection)
 {
 #if defined(TCP_NODELAY)
   int res = MHD_YES;
-  const _MHD_SOCKOPT_BOOL_TYPE off_val = 0;
 #if defined(TCP_CORK)
   _MHD_SOCKOPT_BOOL_TYPE cork_val = 0;
   socklen_t param_size = sizeof (cork_val);
@@ -295,20 +379,22 @@ socket_start_normal_buffering (struct MHD_Connection *connection)
   /* Allow partial packets */
   /* Disabling TCP_CORK will flush partial packet even if TCP_CORK wasn't enabled before
      so try to check current value of TCP_CORK to prevent unrequested flushing */
-  if ( (0 != getsockopt (connection->socket_fd, IPPROTO_TCP, TCP_CORK, (void*)&cork_val, &param_size)) ||
-       (0 != cork_val))
-    res &= (0 == setsockopt (connection->socket_fd, IPPROTO_TCP, TCP_CORK, (const void*)&off_val,
-                             sizeof (off_val))) ? MHD_YES : MHD_NO;
+  if ( (MHD_SOCKOPT_UNKNOWN == connection->sk_cork) &&
+       (0 == getsockopt (connection->socket_fd, IPPROTO_TCP, TCP_CORK, (void*)&cork_val, &param_size)) &&
+       (0 == cork_val) )
+    connection->sk_cork = MHD_SOCKOPT_OFF;
+  res &= socket_set_tcp_option (connection, TCP_CORK, MHD_NO,
+                                &connection->sk_cork);
 #elif defined(TCP_NOPUSH)
   /* Disable extra buffering */
   /* No need to check current value as disabling TCP_NOPUSH will not flush partial
      packet if TCP_NOPUSH wasn't enabled before */
-  res &= (0 == setsockopt (connection->socket_fd, IPPROTO_TCP, TCP_NOPUSH, (const void*)&off_val,
-                           sizeof (off_val))) ? MHD_YES : MHD_NO;
+  res &= socket_set_tcp_option (connection, TCP_NOPUSH, MHD_NO,
+                                &connection->sk_cork);
 #endif /* TCP_NOPUSH && !TCP_CORK */
   /* Enable Nagle's algorithm for normal buffering */
-  res &= (0 == setsockopt (connection->socket_fd, IPPROTO_TCP, TCP_NODELAY, (const void*)&off_val,
-                           sizeof (off_val))) ? MHD_YES : MHD_NO;
+  res &= socket_set_tcp_option (connection, TCP_NODELAY, MHD_NO,
+                                &connection->sk_nodelay);
   return res;
 #else  /* !TCP_NODELAY */
   return MHD_NO;
@@ -316,6 +402,163 @@ socket_start_normal_buffering (struct MHD_Connection *connection)
 }
 
 
+/**
+ * Check if the response of this connection is sent without corking
+ * the socket: with sendfile(), the header is sent with MSG_MORE so
+ * that it is coalesced with the beginning of the body (see
+ * send_param_adapter()); the header and the body of an in-memory
+ * response are sent together with sendmsg() (see
+ * send_body_vectored()).  The socket then just needs TCP_NODELAY,
+ * instead of toggling TCP_CORK for every response.
+ *
+ * @param connection connection to check
+ * @return #MHD_YES if the socket is not corked for the response
+ */
+static int
+use_msg_more (struct MHD_Connection *connection)
+{
+#if LINUX && defined(MSG_MORE) && defined(TCP_NODELAY)
+  struct MHD_Response *response = connection->response;
+
+  if ( (NULL == response) ||
+       (MHD_YES == response->is_pipe) ||
+       (NULL != response->upgrade_handler) ||
+       (MHD_YES == connection->have_chunked_upload) )
+    return MHD_NO;
+#if HTTPS_SUPPORT
+  if (0 != (connection->daemon->options & MHD_USE_SSL))
+    return MHD_NO;
+#endif
+  if (-1 != response->fd)
+    return MHD_YES;
+  /* in memory; pipelined responses are corked together instead */
+  if ( ( (NULL != response->crc) &&
+         (NULL == response->data_iov) ) ||
+       (MHD_YES == connection->daemon->pipeline_cork) )
+    return MHD_NO;
+#if HAVE_ZLIB
+  if (NULL != connection->compressor)
+    return MHD_NO; /* written in pieces from the write buffer */
+#endif
+  return MHD_YES;
+#else
+  return MHD_NO;
+#endif
+}
+
+
+/**
+ * Prepare the socket for sending the response header: either
+ * enable extra buffering, or, if the response is sent without
+ * corking (see use_msg_more()), just make sure that TCP_NODELAY is
+ * on.
+ *
+ * @param connection connection to be processed
+ */
+static void
+socket_start_sending_header (struct MHD_Connection *connection)
+{
+  if ( (MHD_YES == connection->pipeline_corked) &&
+       (MHD_NO == use_msg_more (connection)) )
+    return; /* still corked from the previous pipelined response */
+  connection->pipeline_corked = MHD_NO;
+  if (MHD_YES == use_msg_more (connection))
+    {
+      /* nothing to cork, MSG_MORE and sendfile() coalesce */
+      socket_start_no_buffering (connection);
+      return;
+    }
+  if (MHD_NO != socket_flush_possible (connection))
+    socket_start_extra_buffering (connection);
+  else
+    socket_start_no_buffering (connection);
+}
+
+
+/**
+ * Check if the read buffer already contains the complete header of
+ * the next (pipelined) request.
+ *
+ * @param connection connection to check
+ * @return #MHD_YES if an empty line was received
+ */
+static int
+have_pipelined_request (struct MHD_Connection *connection)
+{
+  const char *buf = connection->read_buffer;
+  size_t i;
+
+  for (i = 1; i < connection->read_buffer_offset; i++)
+    {
+      if ('\n' != buf[i])
+        continue;
+      if ( ('\n' == buf[i - 1]) ||
+           ( (i >= 2) &&
+             ('\r' == buf[i - 1]) &&
+             ('\n' == buf[i - 2]) ) )
+        return MHD_YES;
+    }
+  return MHD_NO;
+}
+
+
+/**
+ * Check if the response that was just completely queued should stay
+ * corked because it is followed by the response to another pipelined
+ * request.  See #MHD_OPTION_PIPELINE_CORK.
+ *
+ * @param connection connection to check
+ * @return #MHD_YES to skip the flush
+ */
+static int
+keep_pipeline_corked (struct MHD_Connection *connection)
+{
+  if ( (MHD_YES != connection->daemon->pipeline_cork) ||
+       (MHD_NO == socket_flush_possible (connection)) ||
+       (MHD_YES == use_msg_more (connection)) ||
+       (MHD_YES == connection->read_closed) ||
+       (MHD_NO == have_pipelined_request (connection)) )
+    return MHD_NO;
+  return MHD_YES;
+}
+
+
+/**
+ * Check if the connection is waiting for the socket to become
+ * writable to continue sending the response.
+ *
+ * @param connection connection to check
+ * @return #MHD_YES if the connection is in a sending state
+ */
+static int
+is_sending_state (struct MHD_Connection *connection)
+{
+  switch (connection->state)
+    {
+    case MHD_CONNECTION_HEADERS_SENDING:
+    case MHD_CONNECTION_NORMAL_BODY_READY:
+    case MHD_CONNECTION_CHUNKED_BODY_READY:
+    case MHD_CONNECTION_FOOTERS_SENDING:
+      return MHD_YES;
+    default:
+      return MHD_NO;
+    }
+}
+
+
+/**
+ * Parse the values of the given kinds that were deferred by
+ * #MHD_OPTION_LAZY_VALUE_PARSING, if any.
+ *
+ * @param connection connection to parse values of
+ * @param kind kinds of values needed, can be a bitmask
+ */
+static void
+parse_lazy_values (struct MHD_Connection *connection,
+                   enum MHD_ValueKind kind);
+
+
+
 /**
  * Get all of the headers from the request.
  *
@@ -338,6 +581,7 @@ MHD_get_connection_values (struct MHD_Connection *connection,
 
   if (NULL == connection)
     return -1;
+  parse_lazy_values (connection, kind);
   ret = 0;
   for (pos = connection->headers_received; NULL != pos; pos = pos->next)
     if (0 != (pos->kind & kind))
@@ -354,6 +598,133 @@ MHD_get_connection_values (struct MHD_Connection *connection,
 }
 
 
+/**
+ * Get all of the headers from the request, with the sizes of
+ * the keys and values.
+ *
+ * @param connection connection to get values from
+ * @param kind types of values to iterate over, can be a bitmask
+ * @param iterator callback to call on each header;
+ *        maybe NULL (then just count headers)
+ * @param iterator_cls extra argument to @a iterator
+ * @return number of entries iterated over
+ * @ingroup request
+ */
+int
+MHD_get_connection_values_n (struct MHD_Connection *connection,
+                             enum MHD_ValueKind kind,
+                             MHD_KeyValueIteratorN iterator,
+                             void *iterator_cls)
+{
+  int ret;
+  struct MHD_HTTP_Header *pos;
+
+  if (NULL == connection)
+    return -1;
+  parse_lazy_values (connection, kind);
+  ret = 0;
+  for (pos = connection->headers_received; NULL != pos; pos = pos->next)
+    if (0 != (pos->kind & kind))
+      {
+	ret++;
+	if ( (NULL != iterator) &&
+             (MHD_YES != iterator (iterator_cls,
+                                   pos->kind,
+                                   pos->header,
+                                   pos->header_size,
+                                   pos->value,
+                                   pos->value_size)) )
+	  return ret;
+      }
+  return ret;
+}
+
+
+/**
+ * Compute the hash of a header name for the header index.  The
+ * names are chosen by the client, so the hash is keyed (per daemon)
+ * to keep clients from putting all of them into one chain.
+ *
+ * @param connection connection the index belongs to
+ * @param key header name, may be NULL
+ * @param key_size number of bytes in @a key
+ * @return hash value
+ */
+static size_t
+header_index_hash (struct MHD_Connection *connection,
+                   const char *key,
+                   size_t key_size)
+{
+  return (size_t) MHD_siphash_caseless_ (connection->daemon->header_index_key,
+                                         key,
+                                         (NULL == key) ? 0 : key_size);
+}
+
+
+/**
+ * Add @a pos to the header index.  As entries are never removed
+ * and are inserted in list order, probing finds equal names in the
+ * order of the list.
+ *
+ * @param connection connection with an index
+ * @param pos entry to add
+ */
+static void
+header_index_insert (struct MHD_Connection *connection,
+                     struct MHD_HTTP_Header *pos)
+{
+  size_t mask = connection->headers_index_size - 1;
+  size_t i;
+
+  i = header_index_hash (connection,
+                         pos->header,
+                         pos->header_size) & mask;
+  while (NULL != connection->headers_index[i])
+    i = (i + 1) & mask;
+  connection->headers_index[i] = pos;
+  connection->headers_index_last = pos;
+}
+
+
+/**
+ * Build the header index once the request has been parsed, sized
+ * for the entries received plus room for entries added later.  If
+ * the pool cannot provide the memory, this is remembered and
+ * lookups use the list.
+ *
+ * @param connection connection to build the index for
+ */
+static void
+header_index_build (struct MHD_Connection *connection)
+{
+  struct MHD_HTTP_Header *pos;
+  size_t size;
+
+  /* index the lazily parsed values now, so that the size fits them */
+  parse_lazy_values (connection,
+                     MHD_GET_ARGUMENT_KIND | MHD_COOKIE_KIND);
+  size = 16;
+  while ( (size < 4 * connection->headers_received_count) &&
+          (size < SIZE_MAX / (2 * sizeof (struct MHD_HTTP_Header *))) )
+    size *= 2;
+  connection->headers_index = MHD_pool_allocate (connection->pool,
+                                                 size * sizeof (struct MHD_HTTP_Header *),
+                                                 MHD_YES);
+  if (NULL == connection->headers_index)
+    {
+      MHD_STATS_ADD_ (connection->daemon, pool_fail_headers, 1);
+      connection->headers_index_failed = MHD_YES;
+      return;
+    }
+  memset (connection->headers_index,
+          0,
+          size * sizeof (struct MHD_HTTP_Header *));
+  connection->headers_index_size = size;
+  for (pos = connection->headers_received; NULL != pos; pos = pos->next)
+    header_index_insert (connection, pos);
+}
+
+
 /**
  * This function can be used to add an entry to the HTTP headers of a
  * connection (so that the #MHD_get_connection_values function will
@@ -373,26 +744,48 @@ MHD_get_connection_values (struct MHD_Connection *connection,
  *  value should be set
  * @param kind kind of the value
  * @param key key for the value
+ * @param key_size number of bytes in @a key (excluding the 0-terminator)
  * @param value the value itself
+ * @param value_size number of bytes in @a value (excluding the 0-terminator)
  * @return #MHD_NO if the operation could not be
  *         performed due to insufficient memory;
  *         #MHD_YES on success
  * @ingroup request
  */
 int
-MHD_set_connection_value (struct MHD_Connection *connection,
-                          enum MHD_ValueKind kind,
-                          const char *key, const char *value)
+MHD_set_connection_value_n (struct MHD_Connection *connection,
+                            enum MHD_ValueKind kind,
+                            const char *key,
+                            size_t key_size,
+                            const char *value,
+                            size_t value_size)
 {
   struct MHD_HTTP_Header *pos;
 
+  /* values parsed later must not end up behind this one */
+  parse_lazy_values (connection, kind);
   pos = MHD_pool_allocate (connection->pool,
                            sizeof (struct MHD_HTTP_Header), MHD_YES);
   if (NULL == pos)
-    return MHD_NO;
+    {
+      MHD_STATS_ADD_ (connection->daemon, pool_fail_headers, 1);
+      return MHD_NO;
+    }
   pos->header = (char *) key;
+  pos->header_size = key_size;
   pos->value = (char *) value;
+  pos->value_size = value_size;
   pos->kind = kind;
+  if ( (MHD_HEADER_KIND == kind) ||
+       (MHD_FOOTER_KIND == kind) )
+    pos->token = MHD_get_header_token_ (key,
+                                        key_size);
+  else
+    pos->token = MHD_HEADER_TOKEN_NONE;
+  if ( (MHD_HEADER_KIND == kind) &&
+       (MHD_HEADER_TOKEN_NONE != pos->token) &&
+       (NULL == connection->headers_by_token[pos->token]) )
+    connection->headers_by_token[pos->token] = pos;
   pos->next = NULL;
   /* append 'pos' to the linked list of headers */
   if (NULL == connection->headers_received_tail)
@@ -405,61 +798,371 @@ MHD_set_connection_value (struct MHD_Connection *connection,
       connection->headers_received_tail->next = pos;
       connection->headers_received_tail = pos;
     }
+  connection->headers_received_count++;
+  /* keep the load factor at or below one half; once an entry is
+     left out, all later ones must be too, to keep the list order */
+  if ( (NULL != connection->headers_index) &&
+       (connection->headers_index_last->next == pos) &&
+       (2 * connection->headers_received_count <= connection->headers_index_size) )
+    header_index_insert (connection, pos);
   return MHD_YES;
 }
 
 
 /**
- * Get a particular header value.  If multiple
- * values match the kind, return any one of them.
+ * This function can be used to add an entry to the HTTP headers of a
+ * connection (so that the #MHD_get_connection_values function will
+ * return them -- and the `struct MHD_PostProcessor` will also see
+ * them).  This maybe required in certain situations (see Mantis
+ * #1399) where (broken) HTTP implementations fail to supply values
+ * needed by the post processor (or other parts of the application).
  *
- * @param connection connection to get values from
- * @param kind what kind of value are we looking for
- * @param key the header to look for, NULL to lookup 'trailing' value without a key
- * @return NULL if no such item was found
+ * This function MUST only be called from within the
+ * #MHD_AccessHandlerCallback (otherwise, access maybe improperly
+ * synchronized).  Furthermore, the client must guarantee that the key
+ * and value arguments are 0-terminated strings that are NOT freed
+ * until the connection is closed.  (The easiest way to do this is by
+ * passing only arguments to permanently allocated strings.).
+ *
+ * @param connection the connection for which a
+ *  value should be set
+ * @param kind kind of the value
+ * @param key key for the value
+ * @param value the value itself
+ * @return #MHD_NO if the operation could not be
+ *         performed due to insufficient memory;
+ *         #MHD_YES on success
  * @ingroup request
  */
-const char *
-MHD_lookup_connection_value (struct MHD_Connection *connection,
-                             enum MHD_ValueKind kind, const char *key)
+int
+MHD_set_connection_value (struct MHD_Connection *connection,
+                          enum MHD_ValueKind kind,
+                          const char *key, const char *value)
 {
-  struct MHD_HTTP_Header *pos;
-
-  if (NULL == connection)
-    return NULL;
-  for (pos = connection->headers_received; NULL != pos; pos = pos->next)
-    if ((0 != (pos->kind & kind)) &&
-	( (key == pos->header) ||
-	  ( (NULL != pos->header) &&
-	    (NULL != key) &&
-        (MHD_str_equal_caseless_(key, pos->header)))))
-      return pos->value;
-  return NULL;
+  return MHD_set_connection_value_n (connection,
+                                     kind,
+                                     key,
+                                     (NULL == key) ? 0 : strlen (key),
+                                     value,
+                                     (NULL == value) ? 0 : strlen (value));
 }
 
 
 /**
- * Do we (still) need to send a 100 continue
- * message for this connection?
+ * Allocate memory for the current request from the memory pool of
+ * the connection.  The memory is taken from the end of the pool,
+ * like the headers, and released by the MHD_pool_reset() once the
+ * request is complete.
  *
- * @param connection connection to test
- * @return 0 if we don't need 100 CONTINUE, 1 if we do
+ * @param connection the connection of the request
+ * @param size number of bytes to allocate
+ * @return the memory, NULL if the pool does not have enough room
  */
-static int
-need_100_continue (struct MHD_Connection *connection)
+void *
+MHD_connection_alloc (struct MHD_Connection *connection,
+                      size_t size)
 {
-  const char *expect;
+  struct MemoryPool *pool = connection->pool;
 
-  return ( (NULL == connection->response) &&
-	   (NULL != connection->version) &&
-       (MHD_str_equal_caseless_(connection->version,
-			     MHD_HTTP_VERSION_1_1)) &&
-	   (NULL != (expect = MHD_lookup_connection_value (connection,
-							   MHD_HEADER_KIND,
-							   MHD_HTTP_HEADER_EXPECT))) &&
-	   (MHD_str_equal_caseless_(expect, "100-continue")) &&
-	   (connection->continue_message_write_offset <
-	    strlen (HTTP_100_CONTINUE)) );
+  if ( (NULL == pool) ||
+       (size > MHD_pool_get_free (pool)) ||
+       (MHD_pool_get_free (pool) - size < connection->daemon->alloc_reserve) )
+    return NULL;
+  return MHD_pool_allocate (pool,
+                            size,
+                            MHD_YES);
+}
+
+
+/**
+ * Check if @a pos is a value of @a kind named @a key.
+ *
+ * @param pos entry to check
+ * @param kind what kind of value are we looking for
+ * @param key the header to look for, NULL to lookup 'trailing' value without a key
+ * @param key_size number of bytes in @a key
+ * @return #MHD_YES if @a pos matches
+ */
+static int
+header_matches (const struct MHD_HTTP_Header *pos,
+                enum MHD_ValueKind kind,
+                const char *key,
+                size_t key_size)
+{
+  if (0 == (pos->kind & kind))
+    return MHD_NO;
+  if (key == pos->header)
+    return MHD_YES;
+  if ( (NULL != pos->header) &&
+       (NULL != key) &&
+       (key_size == pos->header_size) &&
+       (MHD_str_equal_caseless_n_ (key, pos->header, key_size)) )
+    return MHD_YES;
+  return MHD_NO;
+}
+
+
+/**
+ * Find the first value of the given kind(s) with the given key.
+ *
+ * @param connection connection to get values from
+ * @param kind what kind of value are we looking for
+ * @param key the header to look for, NULL to lookup 'trailing' value without a key
+ * @param key_size number of bytes in @a key
+ * @return NULL if no such item was found
+ */
+static struct MHD_HTTP_Header *
+find_connection_value (struct MHD_Connection *connection,
+                       enum MHD_ValueKind kind,
+                       const char *key,
+                       size_t key_size)
+{
+  struct MHD_HTTP_Header *pos;
+  size_t mask;
+  size_t i;
+
+  parse_lazy_values (connection, kind);
+  if ( (NULL == connection->headers_index) &&
+       (MHD_NO == connection->headers_index_failed) &&
+       (connection->headers_received_count > 4) &&
+       (NULL != connection->pool) )
+    header_index_build (connection);
+  if (NULL == connection->headers_index)
+    {
+      pos = connection->headers_received;
+    }
+  else
+    {
+      mask = connection->headers_index_size - 1;
+      i = header_index_hash (connection,
+                             key,
+                             key_size) & mask;
+      for (pos = connection->headers_index[i];
+           NULL != pos;
+           pos = connection->headers_index[i])
+        {
+          if (MHD_YES == header_matches (pos, kind, key, key_size))
+            return pos;
+          i = (i + 1) & mask;
+        }
+      /* entries added after the index was full */
+      pos = connection->headers_index_last->next;
+    }
+  for (; NULL != pos; pos = pos->next)
+    if (MHD_YES == header_matches (pos, kind, key, key_size))
+      return pos;
+  return NULL;
+}
+
+
+/**
+ * Get a particular header value.  If multiple
+ * values match the kind, return any one of them.
+ *
+ * @param connection connection to get values from
+ * @param kind what kind of value are we looking for
+ * @param key the header to look for, NULL to lookup 'trailing' value without a key
+ * @return NULL if no such item was found
+ * @ingroup request
+ */
+const char *
+MHD_lookup_connection_value (struct MHD_Connection *connection,
+                             enum MHD_ValueKind kind, const char *key)
+{
+  struct MHD_HTTP_Header *pos;
+
+  if (NULL == connection)
+    return NULL;
+  pos = find_connection_value (connection,
+                               kind,
+                               key,
+                               (NULL == key) ? 0 : strlen (key));
+  return (NULL == pos) ? NULL : pos->value;
+}
+
+
+/**
+ * Get a particular header value and its size.  If multiple
+ * values match the kind, return the first of them.
+ *
+ * @param connection connection to get values from
+ * @param kind what kind of value are we looking for
+ * @param key the header to look for, NULL to lookup 'trailing' value without a key
+ * @param key_size number of bytes in @a key
+ * @param[out] value_ptr set to the value (which may be NULL), can be NULL
+ * @param[out] value_size_ptr set to the number of bytes in the value,
+ *             can be NULL
+ * @return #MHD_YES if a value was found, #MHD_NO if not
+ * @ingroup request
+ */
+int
+MHD_lookup_connection_value_n (struct MHD_Connection *connection,
+                               enum MHD_ValueKind kind,
+                               const char *key,
+                               size_t key_size,
+                               const char **value_ptr,
+                               size_t *value_size_ptr)
+{
+  struct MHD_HTTP_Header *pos;
+
+  if (NULL == connection)
+    return MHD_NO;
+  pos = find_connection_value (connection,
+                               kind,
+                               key,
+                               key_size);
+  if (NULL == pos)
+    return MHD_NO;
+  if (NULL != value_ptr)
+    *value_ptr = pos->value;
+  if (NULL != value_size_ptr)
+    *value_size_ptr = pos->value_size;
+  return MHD_YES;
+}
+
+
+/**
+ * Get a particular well-known header value.  Like
+ * #MHD_lookup_connection_value(), but identifies the header by its
+ * token, avoiding string comparisons.  Only headers and footers
+ * are classified, so for other kinds this always returns NULL.
+ *
+ * @param connection connection to get values from
+ * @param kind what kind of value are we looking for
+ * @param token the header to look for
+ * @return NULL if no such item was found
+ * @ingroup request
+ */
+const char *
+MHD_lookup_connection_token_value (struct MHD_Connection *connection,
+                                   enum MHD_ValueKind kind,
+                                   enum MHD_HeaderToken token)
+{
+  struct MHD_HTTP_Header *pos;
+
+  if ( (NULL == connection) ||
+       (MHD_HEADER_TOKEN_NONE >= token) ||
+       (MHD_HEADER_TOKEN_COUNT_ <= token) )
+    return NULL;
+  if (MHD_HEADER_KIND == kind)
+    {
+      pos = connection->headers_by_token[token];
+      return (NULL == pos) ? NULL : pos->value;
+    }
+  for (pos = connection->headers_received; NULL != pos; pos = pos->next)
+    if ( (0 != (pos->kind & kind)) &&
+         (token == pos->token) )
+      return pos->value;
+  return NULL;
+}
+
+
+/**
+ * Do we (still) need to send a 100 continue
+ * message for this connection?
+ *
+ * @param connection connection to test
+ * @return 0 if we don't need 100 CONTINUE, 1 if we do
+ */
+static int
+need_100_continue (struct MHD_Connection *connection)
+{
+  const char *expect;
+
+  return ( (NULL == connection->response) &&
+	   (NULL != connection->version) &&
+       (MHD_str_equal_caseless_(connection->version,
+			     MHD_HTTP_VERSION_1_1)) &&
+	   (NULL != (expect = MHD_lookup_connection_token_value (connection,
+                                                                 MHD_HEADER_KIND,
+                                                                 MHD_HEADER_TOKEN_EXPECT))) &&
+	   (MHD_str_equal_caseless_(expect, "100-continue")) );
+}
+
+
+/**
+ * Append @a msg to the interim responses still to be sent to the
+ * client of @a connection.  If all previous ones were sent, @a msg
+ * is used as it is and must stay valid until it was sent.
+ *
+ * @param connection connection to append to
+ * @param msg interim response(s) to append
+ * @param len number of bytes in @a msg
+ * @return #MHD_YES on success, #MHD_NO on error (out of memory)
+ */
+static int
+append_continue_message (struct MHD_Connection *connection,
+                         const char *msg,
+                         size_t len)
+{
+  size_t left;
+  char *data;
+
+  left = connection->continue_message_size
+    - connection->continue_message_write_offset;
+  if (0 == left)
+    {
+      connection->continue_message = msg;
+      connection->continue_message_size = len;
+      connection->continue_message_write_offset = 0;
+      return MHD_YES;
+    }
+  data = MHD_pool_allocate (connection->pool,
+                            left + len,
+                            MHD_YES);
+  if (NULL == data)
+    return MHD_NO;
+  memcpy (data,
+          &connection->continue_message[connection->continue_message_write_offset],
+          left);
+  memcpy (&data[left],
+          msg,
+          len);
+  connection->continue_message = data;
+  connection->continue_message_size = left + len;
+  connection->continue_message_write_offset = 0;
+  return MHD_YES;
+}
+
+
+/**
+ * Try to send the interim responses of @a connection that were not
+ * sent yet.
+ *
+ * @param connection connection to send on
+ * @return #MHD_YES on success (possibly nothing was sent),
+ *         #MHD_NO on a hard error
+ */
+static int
+send_continue_message (struct MHD_Connection *connection)
+{
+  ssize_t ret;
+
+  ret = connection->send_cls (connection,
+                              &connection->continue_message
+                              [connection->continue_message_write_offset],
+                              connection->continue_message_size -
+                              connection->continue_message_write_offset);
+  if (ret < 0)
+    {
+      const int err = MHD_socket_errno_;
+      if ((err == EINTR) || (err == EAGAIN) || (EWOULDBLOCK == err))
+        return MHD_YES;
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (connection->daemon,
+                "Failed to send data: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+      return MHD_NO;
+    }
+#if DEBUG_SEND_DATA
+  fprintf (stderr,
+           "Sent interim response: `%.*s'\n",
+           (int) ret,
+           &connection->continue_message[connection->continue_message_write_offset]);
+#endif
+  connection->continue_message_write_offset += ret;
+  return MHD_YES;
 }
 
 
@@ -482,6 +1185,12 @@ MHD_connection_close_ (struct MHD_Connection *connection,
 	      (MHD_YES == connection->read_closed) ? SHUT_WR : SHUT_RDWR);
   connection->state = MHD_CONNECTION_CLOSED;
   connection->event_loop_info = MHD_EVENT_LOOP_INFO_CLEANUP;
+  MHD_rate_limit_remove_ (connection);
+  MHD_poll_set_update_ (connection);
+  if (0 == connection->request_times.body_sent)
+    MHD_slow_request_done_ (connection,
+                            MHD_YES,
+                            termination_code);
   if ( (NULL != daemon->notify_completed) &&
        (MHD_YES == connection->client_aware) )
     daemon->notify_completed (daemon->notify_completed_cls,
@@ -524,1920 +1233,6501 @@ connection_close_error (struct MHD_Connection *connection,
 
 
 /**
- * Prepare the response buffer of this connection for
- * sending.  Assumes that the response mutex is
- * already held.  If the transmission is complete,
- * this function may close the socket (and return
- * #MHD_NO).
+ * Call the content reader of the response of this connection for the
+ * body data from @e response_write_position on.  If the reader returns
+ * #MHD_CONTENT_READER_PENDING, the connection is marked to wait for
+ * #MHD_response_data_ready() (see MHD_connection_wait_for_data_()).
  *
- * @param connection the connection
- * @return #MHD_NO if readying the response failed (the
- *  lock on the response will have been released already
- *  in this case).
+ * @param connection connection we're processing
+ * @param buf where the reader writes the data
+ * @param max size of @a buf
+ * @return result of the reader, 0 if it returned
+ *         #MHD_CONTENT_READER_PENDING
  */
-static int
-try_ready_normal_body (struct MHD_Connection *connection)
+static ssize_t
+call_content_reader (struct MHD_Connection *connection,
+                     char *buf,
+                     size_t max)
 {
+  struct MHD_Response *response = connection->response;
   ssize_t ret;
-  struct MHD_Response *response;
-
-  response = connection->response;
-  if (NULL == response->crc)
-    return MHD_YES;
-  if ( (0 == response->total_size) ||
-       (connection->response_write_position == response->total_size) )
-    return MHD_YES; /* 0-byte response is always ready */
-  if ( (response->data_start <=
-	connection->response_write_position) &&
-       (response->data_size + response->data_start >
-	connection->response_write_position) )
-    return MHD_YES; /* response already ready */
-#if LINUX
-  if ( (MHD_INVALID_SOCKET != response->fd) &&
-       (0 == (connection->daemon->options & MHD_USE_SSL)) )
-    {
-      /* will use sendfile, no need to bother response crc */
-      return MHD_YES;
-    }
-#endif
 
   ret = response->crc (response->crc_cls,
                        connection->response_write_position,
-                       response->data,
-                       (size_t)MHD_MIN ((uint64_t)response->data_buffer_size,
-                                response->total_size -
-                                connection->response_write_position));
-  if ( (((ssize_t) MHD_CONTENT_READER_END_OF_STREAM) == ret) ||
-       (((ssize_t) MHD_CONTENT_READER_END_WITH_ERROR) == ret) )
-    {
-      /* either error or http 1.0 transfer, close socket! */
-      response->total_size = connection->response_write_position;
-      if (NULL != response->crc)
-        (void) MHD_mutex_unlock_ (&response->mutex);
-      if ( ((ssize_t)MHD_CONTENT_READER_END_OF_STREAM) == ret)
-	MHD_connection_close_ (connection,
-                               MHD_REQUEST_TERMINATED_COMPLETED_OK);
-      else
-	CONNECTION_CLOSE_ERROR (connection,
-				"Closing connection (stream error)\n");
-      return MHD_NO;
-    }
-  response->data_start = connection->response_write_position;
-  response->data_size = ret;
-  if (0 == ret)
+                       buf,
+                       max);
+  connection->data_pending = MHD_NO;
+  if (((ssize_t) MHD_CONTENT_READER_PENDING) == ret)
     {
-      connection->state = MHD_CONNECTION_NORMAL_BODY_UNREADY;
-      if (NULL != response->crc)
-        (void) MHD_mutex_unlock_ (&response->mutex);
-      return MHD_NO;
+      /* without the pipe, nobody could wake us up again */
+      if (0 != (connection->daemon->options & MHD_USE_SUSPEND_RESUME))
+        connection->data_pending = MHD_YES;
+      return 0;
     }
-  return MHD_YES;
+  return ret;
 }
 
 
 /**
- * Prepare the response buffer of this connection for sending.
- * Assumes that the response mutex is already held.  If the
- * transmission is complete, this function may close the socket (and
- * return MHD_NO).
+ * Check if the whole body of a chunked response was prepared
+ * for sending.
  *
- * @param connection the connection
- * @return #MHD_NO if readying the response failed
+ * @param connection connection we're processing
+ * @return #MHD_YES if no more chunks follow
  */
 static int
-try_ready_chunked_body (struct MHD_Connection *connection)
+chunked_body_done (struct MHD_Connection *connection)
+{
+#if HAVE_ZLIB
+  if (NULL != connection->compressor)
+    return connection->compress_done;
+#endif
+  if ( (0 == connection->response->total_size) ||
+       (connection->response_write_position ==
+        connection->response->total_size) )
+    return MHD_YES;
+  return MHD_NO;
+}
+
+
+#if HTTPS_SUPPORT
+/**
+ * Maximum payload of a TLS record.
+ */
+#define MHD_TLS_MAX_RECORD_SIZE 16384
+
+
+/**
+ * With #MHD_OPTION_HTTPS_DYNAMIC_RECORD_SIZE, send the remaining
+ * response header from the write buffer together with the beginning
+ * of the body of an in-memory response in one TLS record, instead of
+ * a record with only the header.  The record is assembled on the
+ * stack; if sending is interrupted, GnuTLS keeps the encrypted record
+ * and we assemble the same data again on the next call.
+ *
+ * @param connection connection we're processing
+ * @return #MHD_NO if the response does not qualify (use do_write()),
+ *         #MHD_YES if we tried to send (state may have changed)
+ */
+static int
+do_write_tls_header_and_body (struct MHD_Connection *connection)
 {
+  struct MHD_Response *response = connection->response;
+  char record[MHD_TLS_MAX_RECORD_SIZE];
+  size_t header_left;
+  size_t have;
+  size_t n;
+  uint64_t pos;
+  uint64_t left;
+  unsigned int i;
   ssize_t ret;
-  char *buf;
-  struct MHD_Response *response;
-  size_t size;
-  char cbuf[10];                /* 10: max strlen of "%x\r\n" */
-  int cblen;
 
-  response = connection->response;
-  if (0 == connection->write_buffer_size)
+  if ( (0 == (connection->daemon->options & MHD_USE_SSL)) ||
+       (0 == connection->daemon->tls_small_record_limit) ||
+       (NULL == response) ||
+       (NULL != response->upgrade_handler) ||
+       (MHD_YES == connection->have_chunked_upload) ||
+       (connection->response_write_position >= MHD_BODY_END_ (connection)) )
+    return MHD_NO;
+  if ( ( (NULL != response->crc) ||
+         (-1 != response->fd) ) &&
+       (NULL == response->data_iov) )
+    return MHD_NO;
+  header_left = connection->write_buffer_append_offset
+    - connection->write_buffer_send_offset;
+  if (header_left >= sizeof (record))
+    return MHD_NO;
+  memcpy (record,
+          &connection->write_buffer[connection->write_buffer_send_offset],
+          header_left);
+  have = header_left;
+  pos = connection->response_write_position;
+  left = MHD_BODY_END_ (connection) - pos;
+  if (NULL == response->data_iov)
     {
-      size = MHD_MIN(connection->daemon->pool_size, 2 * (0xFFFFFF + sizeof(cbuf) + 2));
-      do
+      n = (size_t) MHD_MIN ((uint64_t) (response->data_size - (size_t) pos),
+                            left);
+      if (n > sizeof (record) - have)
+        n = sizeof (record) - have;
+      memcpy (&record[have], &response->data[(size_t) pos], n);
+      have += n;
+    }
+  else
+    {
+      for (i = 0; i < response->data_iovcnt; i++)
         {
-          size /= 2;
-          if (size < 128)
-            {
-              /* not enough memory */
-              CONNECTION_CLOSE_ERROR (connection,
-				      "Closing connection (out of memory)\n");
-              return MHD_NO;
-            }
-          buf = MHD_pool_allocate (connection->pool, size, MHD_NO);
+          if (pos < response->data_iov[i].iov_len)
+            break;
+          pos -= response->data_iov[i].iov_len;
+        }
+      for (; (i < response->data_iovcnt) && (have < sizeof (record)) && (0 != left); i++)
+        {
+          n = (size_t) MHD_MIN ((uint64_t) (response->data_iov[i].iov_len - (size_t) pos),
+                                left);
+          if (n > sizeof (record) - have)
+            n = sizeof (record) - have;
+          memcpy (&record[have],
+                  (const char *) response->data_iov[i].iov_base + (size_t) pos,
+                  n);
+          have += n;
+          left -= n;
+          pos = 0;
         }
-      while (NULL == buf);
-      connection->write_buffer_size = size;
-      connection->write_buffer = buf;
-    }
-
-  if (0 == response->total_size)
-    ret = 0; /* response must be empty, don't bother calling crc */
-  else if ( (response->data_start <=
-	connection->response_write_position) &&
-       (response->data_start + response->data_size >
-	connection->response_write_position) )
-    {
-      /* difference between response_write_position and data_start is less
-         than data_size which is size_t type, no need to check for overflow */
-      const size_t data_write_offset = (size_t)(connection->response_write_position - response->data_start);
-      /* buffer already ready, use what is there for the chunk */
-      ret = response->data_size - data_write_offset;
-      if ( ((size_t) ret) > connection->write_buffer_size - sizeof (cbuf) - 2 )
-	ret = connection->write_buffer_size - sizeof (cbuf) - 2;
-      memcpy (&connection->write_buffer[sizeof (cbuf)],
-              &response->data[data_write_offset], ret);
-    }
-  else
-    {
-      /* buffer not in range, try to fill it */
-      ret = response->crc (response->crc_cls,
-                           connection->response_write_position,
-                           &connection->write_buffer[sizeof (cbuf)],
-                           connection->write_buffer_size - sizeof (cbuf) - 2);
     }
-  if ( ((ssize_t) MHD_CONTENT_READER_END_WITH_ERROR) == ret)
+  ret = connection->send_cls (connection,
+                              record,
+                              have);
+  if (ret < 0)
     {
-      /* error, close socket! */
-      response->total_size = connection->response_write_position;
-      CONNECTION_CLOSE_ERROR (connection,
-			      "Closing connection (error generating response)\n");
-      return MHD_NO;
+      const int err = MHD_socket_errno_;
+      if ((EINTR == err) || (EAGAIN == err) || (EWOULDBLOCK == err))
+        return MHD_YES;
+      CONNECTION_CLOSE_ERROR (connection, NULL);
+      return MHD_YES;
     }
-  if ( (((ssize_t) MHD_CONTENT_READER_END_OF_STREAM) == ret) ||
-       (0 == response->total_size) )
+#if DEBUG_SEND_DATA
+  fprintf (stderr,
+           "Sent %d bytes of response header and body\n",
+           (int) ret);
+#endif
+  if ((size_t) ret < header_left)
     {
-      /* end of message, signal other side! */
-      strcpy (connection->write_buffer, "0\r\n");
-      connection->write_buffer_append_offset = 3;
-      connection->write_buffer_send_offset = 0;
-      response->total_size = connection->response_write_position;
+      connection->write_buffer_send_offset += ret;
       return MHD_YES;
     }
-  if (0 == ret)
+  connection->write_buffer_send_offset = connection->write_buffer_append_offset;
+  connection->response_write_position += ret - header_left;
+  return MHD_YES;
+}
+#endif
+
+
+#if HAVE_SENDMSG
+/**
+ * Maximum number of iovec elements we pass to a single sendmsg().
+ */
+#define MHD_SENDMSG_MAX_IOV 32
+
+
+/**
+ * Shorten the iovec elements for a sendmsg() to the
+ * #MHD_OPTION_WRITE_QUANTUM of the daemon.
+ *
+ * @param connection connection the data is for
+ * @param iov elements to send
+ * @param[in,out] cnt number of elements
+ * @param total number of bytes in @a iov
+ * @return number of bytes left in @a iov
+ */
+static size_t
+apply_write_quantum (struct MHD_Connection *connection,
+                     struct iovec *iov,
+                     unsigned int *cnt,
+                     size_t total)
+{
+  const size_t quantum = connection->daemon->write_quantum;
+  size_t have;
+  unsigned int i;
+
+  if ( (0 == quantum) ||
+       (total <= quantum) )
+    return total;
+  have = 0;
+  for (i = 0; i < *cnt; i++)
     {
-      connection->state = MHD_CONNECTION_CHUNKED_BODY_UNREADY;
-      return MHD_NO;
+      if (iov[i].iov_len >= quantum - have)
+        {
+          iov[i].iov_len = quantum - have;
+          *cnt = i + 1;
+          break;
+        }
+      have += iov[i].iov_len;
     }
-  if (ret > 0xFFFFFF)
-    ret = 0xFFFFFF;
-  cblen = MHD_snprintf_(cbuf,
-	    sizeof (cbuf),
-	    "%X\r\n", (unsigned int) ret);
-  EXTRA_CHECK(cblen > 0);
-  EXTRA_CHECK(cblen < sizeof(cbuf));
-  memcpy (&connection->write_buffer[sizeof (cbuf) - cblen], cbuf, cblen);
-  memcpy (&connection->write_buffer[sizeof (cbuf) + ret], "\r\n", 2);
-  connection->response_write_position += ret;
-  connection->write_buffer_send_offset = sizeof (cbuf) - cblen;
-  connection->write_buffer_append_offset = sizeof (cbuf) + ret + 2;
-  return MHD_YES;
+  return quantum;
 }
 
 
 /**
- * Are we allowed to keep the given connection alive?  We can use the
- * TCP stream for a second request if the connection is HTTP 1.1 and
- * the "Connection" header either does not exist or is not set to
- * "close", or if the connection is HTTP 1.0 and the "Connection"
- * header is explicitly set to "keep-alive".  If no HTTP version is
- * specified (or if it is not 1.0 or 1.1), we definitively close the
- * connection.  If the "Connection" header is not exactly "close" or
- * "keep-alive", we proceed to use the default for the respective HTTP
- * version (which is conservative for HTTP 1.0, but might be a bit
- * optimistic for HTTP 1.1).
+ * Check if the (rest of the) body of the response of this connection
+ * can be sent directly from memory with sendmsg(), i.e. the response
+ * was created from a buffer or from an iovec and the connection is
+ * a plain connection using identity encoding.
  *
- * @param connection the connection to check for keepalive
- * @return #MHD_YES if (based on the request), a keepalive is
- *        legal
+ * @param connection connection to check
+ * @return #MHD_YES if send_body_vectored() can be used
  */
 static int
-keepalive_possible (struct MHD_Connection *connection)
+can_send_body_vectored (struct MHD_Connection *connection)
 {
-  const char *end;
+  struct MHD_Response *response = connection->response;
 
-  if (NULL == connection->version)
+  if ( (NULL == response) ||
+       (NULL != response->upgrade_handler) ||
+       (MHD_YES == connection->have_chunked_upload) ||
+       (connection->response_write_position >= MHD_BODY_END_ (connection)) )
     return MHD_NO;
-  if ( (NULL != connection->response) &&
-       (0 != (connection->response->flags & MHD_RF_HTTP_VERSION_1_0_ONLY) ) )
+  if ( ( (NULL != response->crc) ||
+         (-1 != response->fd) ) &&
+       (NULL == response->data_iov) )
     return MHD_NO;
-  end = MHD_lookup_connection_value (connection,
-                                     MHD_HEADER_KIND,
-                                     MHD_HTTP_HEADER_CONNECTION);
-  if (MHD_str_equal_caseless_(connection->version,
-                       MHD_HTTP_VERSION_1_1))
-  {
-    if (NULL == end)
-      return MHD_YES;
-    if ( (MHD_str_equal_caseless_ (end, "close")) ||
-         (MHD_str_equal_caseless_ (end, "upgrade")) )
-      return MHD_NO;
-   return MHD_YES;
-  }
-  if (MHD_str_equal_caseless_(connection->version,
-                       MHD_HTTP_VERSION_1_0))
-  {
-    if (NULL == end)
-      return MHD_NO;
-    if (MHD_str_equal_caseless_(end, "Keep-Alive"))
-      return MHD_YES;
+#if HTTPS_SUPPORT
+  if (0 != (connection->daemon->options & MHD_USE_SSL))
     return MHD_NO;
-  }
-  return MHD_NO;
+#endif
+  if ( (MHD_INVALID_SOCKET == connection->socket_fd) ||
+       (MHD_CONNECTION_CLOSED == connection->state) )
+    return MHD_NO;
+  if (MHD_YES == MHD_rate_limited_ (connection, MHD_YES))
+    return MHD_NO; /* send() is clamped to the allowance */
+  return MHD_YES;
 }
 
 
 /**
- * Produce HTTP "Date:" header.
+ * Send the remaining @a header_left bytes of the write buffer
+ * together with the body of the response from
+ * @e response_write_position on (up to the end of the current
+ * range), using a single sendmsg() and
+ * without copying the body.  The caller must have checked
+ * can_send_body_vectored().  Does not update any offsets.
  *
- * @param date where to write the header, with
- *        at least 128 bytes available space.
+ * @param connection connection we're processing
+ * @param header_left number of bytes of the write buffer to send
+ *        before the body, may be 0
+ * @return number of bytes sent, -1 on error (errno is set)
  */
-static void
-get_date_string (char *date)
+static ssize_t
+send_body_vectored (struct MHD_Connection *connection,
+                    size_t header_left)
 {
-  static const char *const days[] =
-    { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
-  static const char *const mons[] =
-    { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct",
-    "Nov", "Dec"
-  };
-  struct tm now;
-  time_t t;
-#if !defined(HAVE_C11_GMTIME_S) && !defined(HAVE_W32_GMTIME_S) && !defined(HAVE_GMTIME_R)
-  struct tm* pNow;
-#endif
+  struct MHD_Response *response = connection->response;
+  struct iovec iov[MHD_SENDMSG_MAX_IOV];
+  struct msghdr msg;
+  uint64_t pos;
+  uint64_t left;
+  size_t total;
+  size_t n;
+  unsigned int i;
+  unsigned int cnt;
+  int flags;
+  ssize_t ret;
 
-  date[0] = 0;
-  time (&t);
-#if defined(HAVE_C11_GMTIME_S)
-  if (NULL == gmtime_s (&t, &now))
-    return;
-#elif defined(HAVE_W32_GMTIME_S)
-  if (0 != gmtime_s (&now, &t))
-    return;
-#elif defined(HAVE_GMTIME_R)
-  if (NULL == gmtime_r(&t, &now))
-    return;
-#else
-  pNow = gmtime(&t);
-  if (NULL == pNow)
-    return;
-  now = *pNow;
+  cnt = 0;
+  total = 0;
+  if (0 != header_left)
+    {
+      iov[cnt].iov_base = &connection->write_buffer[connection->write_buffer_send_offset];
+      iov[cnt].iov_len = header_left;
+      total = header_left;
+      cnt++;
+    }
+  pos = connection->response_write_position;
+  left = MHD_BODY_END_ (connection) - pos;
+  if (NULL == response->data_iov)
+    {
+      n = (size_t) MHD_MIN ((uint64_t) (response->data_size - (size_t) pos),
+                            left);
+      if (n > SSIZE_MAX - total)
+        n = SSIZE_MAX - total; /* return value limit */
+      iov[cnt].iov_base = &response->data[(size_t) pos];
+      iov[cnt].iov_len = n;
+      total += n;
+      cnt++;
+    }
+  else
+    {
+      for (i = 0; i < response->data_iovcnt; i++)
+        {
+          if (pos < response->data_iov[i].iov_len)
+            break;
+          pos -= response->data_iov[i].iov_len;
+        }
+      for (; (i < response->data_iovcnt) && (cnt < MHD_SENDMSG_MAX_IOV) && (0 != left); i++)
+        {
+          n = (size_t) MHD_MIN ((uint64_t) (response->data_iov[i].iov_len - (size_t) pos),
+                                left);
+          if (0 == n)
+            continue;
+          if (n > SSIZE_MAX - total)
+            n = SSIZE_MAX - total; /* return value limit */
+          /* cast away 'const': iovec is also used for reading */
+          iov[cnt].iov_base = (char *) response->data_iov[i].iov_base + (size_t) pos;
+          iov[cnt].iov_len = n;
+          total += n;
+          cnt++;
+          pos = 0;
+          left -= n;
+          if (SSIZE_MAX == total)
+            break;
+        }
+    }
+  total = apply_write_quantum (connection,
+                               iov,
+                               &cnt,
+                               total);
+  memset (&msg, 0, sizeof (msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = cnt;
+  flags = MSG_NOSIGNAL;
+#ifdef MSG_MORE
+  if (connection->response_write_position
+      + (total - MHD_MIN (total, header_left)) < MHD_BODY_END_ (connection))
+    flags |= MSG_MORE; /* the rest of the body follows */
 #endif
-  sprintf (date,
-             "Date: %3s, %02u %3s %04u %02u:%02u:%02u GMT\r\n",
-             days[now.tm_wday % 7],
-             (unsigned int) now.tm_mday,
-             mons[now.tm_mon % 12],
-             (unsigned int) (1900 + now.tm_year),
-             (unsigned int) now.tm_hour,
-             (unsigned int) now.tm_min,
-             (unsigned int) now.tm_sec);
+  ret = sendmsg (connection->socket_fd,
+                 &msg,
+                 flags);
+#if MHD_EREADY_SUPPORT
+  if ( (0 > ret) || (total > (size_t) ret) )
+    {
+      /* partial write --- no longer write-ready */
+      connection->epoll_state &= ~MHD_EPOLL_STATE_WRITE_READY;
+    }
+#endif
+  /* Handle broken kernel / libc, returning -1 but not setting errno,
+     just like in send_param_adapter() */
+  if ( (0 > ret) && (0 == MHD_socket_errno_) )
+    MHD_set_socket_errno_(ECONNRESET);
+  if (0 < ret)
+    {
+      MHD_COUNT_IO_ (connection, bytes_sent, ret);
+      MHD_PROBE2 (write, connection, ret);
+    }
+#if DEBUG_SEND_DATA
+  if (ret > 0)
+    fprintf (stderr,
+             "Sent %d bytes of response header and body\n",
+             (int) ret);
+#endif
+  return ret;
 }
 
 
 /**
- * Try growing the read buffer.  We initially claim half the
- * available buffer space for the read buffer (the other half
- * being left for management data structures; the write
- * buffer can in the end take virtually everything as the
- * read buffer can be reduced to the minimum necessary at that
- * point.
+ * Try writing the remaining response header from the write buffer
+ * together with the body of an in-memory response using a single
+ * vectored send, without copying the body into the write buffer.
  *
- * @param connection the connection
- * @return #MHD_YES on success, #MHD_NO on failure
+ * @param connection connection we're processing
+ * @return #MHD_NO if the response does not qualify (use do_write()),
+ *         #MHD_YES if we tried to send (state may have changed)
  */
 static int
-try_grow_read_buffer (struct MHD_Connection *connection)
+do_write_header_and_body (struct MHD_Connection *connection)
 {
-  void *buf;
-  size_t new_size;
+  size_t header_left;
+  ssize_t ret;
 
-  if (0 == connection->read_buffer_size)
-    new_size = connection->daemon->pool_size / 2;
-  else
-    new_size = connection->read_buffer_size + MHD_BUF_INC_SIZE;
-  buf = MHD_pool_reallocate (connection->pool,
-                             connection->read_buffer,
-                             connection->read_buffer_size,
-                             new_size);
-  if (NULL == buf)
+  if (MHD_NO == can_send_body_vectored (connection))
     return MHD_NO;
-  /* we can actually grow the buffer, do it! */
-  connection->read_buffer = buf;
-  connection->read_buffer_size = new_size;
+  header_left = connection->write_buffer_append_offset
+    - connection->write_buffer_send_offset;
+  ret = send_body_vectored (connection,
+                            header_left);
+  if (ret < 0)
+    {
+      const int err = MHD_socket_errno_;
+      if ((EINTR == err) || (EAGAIN == err) || (EWOULDBLOCK == err))
+        return MHD_YES;
+      CONNECTION_CLOSE_ERROR (connection, NULL);
+      return MHD_YES;
+    }
+  if ((size_t) ret < header_left)
+    {
+      connection->write_buffer_send_offset += ret;
+      return MHD_YES;
+    }
+  connection->write_buffer_send_offset = connection->write_buffer_append_offset;
+  connection->response_write_position += ret - header_left;
   return MHD_YES;
 }
 
 
 /**
- * Allocate the connection's write buffer and fill it with all of the
- * headers (or footers, if we have already sent the body) from the
- * HTTPd's response.  If headers are missing in the response supplied
- * by the application, additional headers may be added here.
+ * Check if the chunks of the body of the response of this connection
+ * can be sent directly from the data buffer of the response, with
+ * the chunk framing in a separate buffer, instead of copying them
+ * into the write buffer.
  *
- * @param connection the connection
- * @return #MHD_YES on success, #MHD_NO on failure (out of memory)
+ * @param connection connection to check
+ * @return #MHD_YES if send_chunk_vectored() can be used
  */
 static int
-build_header_response (struct MHD_Connection *connection)
+can_send_chunk_vectored (struct MHD_Connection *connection)
 {
-  size_t size;
-  size_t off;
-  struct MHD_HTTP_Header *pos;
-  char code[256];
-  char date[128];
-  char content_length_buf[128];
-  size_t content_length_len;
-  char *data;
-  enum MHD_ValueKind kind;
-  const char *reason_phrase;
-  uint32_t rc;
-  const char *client_requested_close;
-  const char *response_has_close;
-  const char *response_has_keepalive;
-  const char *have_encoding;
-  const char *have_content_length;
-  int must_add_close;
-  int must_add_chunked_encoding;
-  int must_add_keep_alive;
-  int must_add_content_length;
+  struct MHD_Response *response = connection->response;
 
-  EXTRA_CHECK (NULL != connection->version);
-  if (0 == connection->version[0])
-    {
-      data = MHD_pool_allocate (connection->pool, 0, MHD_YES);
-      connection->write_buffer = data;
-      connection->write_buffer_append_offset = 0;
-      connection->write_buffer_send_offset = 0;
-      connection->write_buffer_size = 0;
-      return MHD_YES;
-    }
-  if (MHD_CONNECTION_FOOTERS_RECEIVED == connection->state)
-    {
-      rc = connection->responseCode & (~MHD_ICY_FLAG);
-      reason_phrase = MHD_get_reason_phrase_for (rc);
-      sprintf (code,
-               "%s %u %s\r\n",
-	       (0 != (connection->responseCode & MHD_ICY_FLAG))
-	       ? "ICY"
-	       : ( (MHD_str_equal_caseless_ (MHD_HTTP_VERSION_1_0,
-				     connection->version))
-		   ? MHD_HTTP_VERSION_1_0
-		   : MHD_HTTP_VERSION_1_1),
-	       rc,
-	       reason_phrase);
-      off = strlen (code);
-      /* estimate size */
-      size = off + 2;           /* +2 for extra "\r\n" at the end */
-      kind = MHD_HEADER_KIND;
-      if ( (0 == (connection->daemon->options & MHD_SUPPRESS_DATE_NO_CLOCK)) &&
-	   (NULL == MHD_get_response_header (connection->response,
-					     MHD_HTTP_HEADER_DATE)) )
-        get_date_string (date);
-      else
-        date[0] = '\0';
-      size += strlen (date);
-    }
-  else
-    {
-      /* 2 bytes for final CRLF of a Chunked-Body */
-      size = 2;
-      kind = MHD_FOOTER_KIND;
-      off = 0;
-    }
-
-  /* calculate extra headers we need to add, such as 'Connection: close',
-     first see what was explicitly requested by the application */
-  must_add_close = MHD_NO;
-  must_add_chunked_encoding = MHD_NO;
-  must_add_keep_alive = MHD_NO;
-  must_add_content_length = MHD_NO;
-  switch (connection->state)
-    {
-    case MHD_CONNECTION_FOOTERS_RECEIVED:
-      response_has_close = MHD_get_response_header (connection->response,
-                                                    MHD_HTTP_HEADER_CONNECTION);
-      response_has_keepalive = response_has_close;
-      if ( (NULL != response_has_close) &&
-           (!MHD_str_equal_caseless_ (response_has_close, "close")) )
-        response_has_close = NULL;
-      if ( (NULL != response_has_keepalive) &&
-           (!MHD_str_equal_caseless_ (response_has_keepalive, "Keep-Alive")) )
-        response_has_keepalive = NULL;
-      client_requested_close = MHD_lookup_connection_value (connection,
-                                                            MHD_HEADER_KIND,
-                                                            MHD_HTTP_HEADER_CONNECTION);
-      if ( (NULL != client_requested_close) &&
-           (!MHD_str_equal_caseless_ (client_requested_close, "close")) )
-        client_requested_close = NULL;
-
-      /* now analyze chunked encoding situation */
-      connection->have_chunked_upload = MHD_NO;
-
-      if ( (MHD_SIZE_UNKNOWN == connection->response->total_size) &&
-           (NULL == response_has_close) &&
-           (NULL == client_requested_close) )
-        {
-          /* size is unknown, and close was not explicitly requested;
-             need to either to HTTP 1.1 chunked encoding or
-             close the connection */
-          /* 'close' header doesn't exist yet, see if we need to add one;
-             if the client asked for a close, no need to start chunk'ing */
-          if ( (MHD_YES == keepalive_possible (connection)) &&
-               (MHD_str_equal_caseless_ (MHD_HTTP_VERSION_1_1,
-                                         connection->version) ) )
-            {
-              have_encoding = MHD_get_response_header (connection->response,
-                                                       MHD_HTTP_HEADER_TRANSFER_ENCODING);
-              if (NULL == have_encoding)
-                {
-                  must_add_chunked_encoding = MHD_YES;
-                  connection->have_chunked_upload = MHD_YES;
-                }
-              else if (MHD_str_equal_caseless_(have_encoding, "identity"))
-                {
-                  /* application forced identity encoding, can't do 'chunked' */
-                  must_add_close = MHD_YES;
-                }
-              else
-                {
-                  connection->have_chunked_upload = MHD_YES;
-                }
-            }
-          else
-            {
-              /* Keep alive or chunking not possible
-                 => set close header if not present */
-              if (NULL == response_has_close)
-                must_add_close = MHD_YES;
-            }
-        }
-
-      /* check for other reasons to add 'close' header */
-      if ( ( (NULL != client_requested_close) ||
-             (MHD_YES == connection->read_closed) ) &&
-           (NULL == response_has_close) &&
-           (0 == (connection->response->flags & MHD_RF_HTTP_VERSION_1_0_ONLY) ) )
-        must_add_close = MHD_YES;
-
-      /* check if we should add a 'content length' header */
-      have_content_length = MHD_get_response_header (connection->response,
-                                                     MHD_HTTP_HEADER_CONTENT_LENGTH);
+  if ( (NULL == response->crc) ||
+       (MHD_INVALID_SOCKET != response->fd) ||
+       (0 == response->total_size) ||
+       (connection->response_write_position >= response->total_size) )
+    return MHD_NO;
+#if HAVE_ZLIB
+  if (NULL != connection->compressor)
+    return MHD_NO;
+#endif
+#if HTTPS_SUPPORT
+  if (0 != (connection->daemon->options & MHD_USE_SSL))
+    return MHD_NO;
+#endif
+  if (MHD_INVALID_SOCKET == connection->socket_fd)
+    return MHD_NO;
+  if (MHD_YES == MHD_rate_limited_ (connection, MHD_YES))
+    return MHD_NO;
+  return MHD_YES;
+}
 
-      if ( (MHD_SIZE_UNKNOWN != connection->response->total_size) &&
-           (NULL == have_content_length) &&
-           ( (NULL == connection->method) ||
-             (! MHD_str_equal_caseless_ (connection->method,
-                                         MHD_HTTP_METHOD_CONNECT)) ) )
-        {
-          /*
-            Here we add a content-length if one is missing; however,
-            for 'connect' methods, the responses MUST NOT include a
-            content-length header *if* the response code is 2xx (in
-            which case we expect there to be no body).  Still,
-            as we don't know the response code here in some cases, we
-            simply only force adding a content-length header if this
-            is not a 'connect' or if the response is not empty
-            (which is kind of more sane, because if some crazy
-            application did return content with a 2xx status code,
-            then having a content-length might again be a good idea).
 
-            Note that the change from 'SHOULD NOT' to 'MUST NOT' is
-            a recent development of the HTTP 1.1 specification.
-          */
-          content_length_len
-            = sprintf (content_length_buf,
-                       MHD_HTTP_HEADER_CONTENT_LENGTH ": " MHD_UNSIGNED_LONG_LONG_PRINTF "\r\n",
-                       (MHD_UNSIGNED_LONG_LONG) connection->response->total_size);
-          must_add_content_length = MHD_YES;
-        }
+/**
+ * Make sure the data buffer of the response holds body data from
+ * @e response_write_position on, calling the content reader if the
+ * buffer holds a different part of the body (i.e. it was used by
+ * another connection).  Assumes that the response mutex is held.
+ *
+ * @param connection connection we're processing
+ * @param max maximum number of bytes needed
+ * @return number of bytes available from @e response_write_position
+ *         on (at most @a max), or the result of the content reader
+ */
+static ssize_t
+fill_chunk_data (struct MHD_Connection *connection,
+                 size_t max)
+{
+  struct MHD_Response *response = connection->response;
+  uint64_t pos = connection->response_write_position;
+  ssize_t ret;
 
-      /* check for adding keep alive */
-      if ( (NULL == response_has_keepalive) &&
-           (NULL == response_has_close) &&
-           (MHD_NO == must_add_close) &&
-           (0 == (connection->response->flags & MHD_RF_HTTP_VERSION_1_0_ONLY) ) &&
-           (MHD_YES == keepalive_possible (connection)) )
-        must_add_keep_alive = MHD_YES;
-      break;
-    case MHD_CONNECTION_BODY_SENT:
-      break;
-    default:
-      EXTRA_CHECK (0);
+  if ( (response->data_start <= pos) &&
+       (response->data_start + response->data_size > pos) )
+    {
+      /* difference is less than data_size, no overflow */
+      return (ssize_t) MHD_MIN ((size_t) (response->data_start +
+                                          response->data_size - pos),
+                                max);
     }
-
-  if (must_add_close)
-    size += strlen ("Connection: close\r\n");
-  if (must_add_keep_alive)
-    size += strlen ("Connection: Keep-Alive\r\n");
-  if (must_add_chunked_encoding)
-    size += strlen ("Transfer-Encoding: chunked\r\n");
-  if (must_add_content_length)
-    size += content_length_len;
-  EXTRA_CHECK (! (must_add_close && must_add_keep_alive) );
-  EXTRA_CHECK (! (must_add_chunked_encoding && must_add_content_length) );
-
-  for (pos = connection->response->first_header; NULL != pos; pos = pos->next)
-    if ( (pos->kind == kind) &&
-         (! ( (MHD_YES == must_add_close) &&
-              (pos->value == response_has_keepalive) &&
-              (MHD_str_equal_caseless_(pos->header,
-                                MHD_HTTP_HEADER_CONNECTION) ) ) ) )
-      size += strlen (pos->header) + strlen (pos->value) + 4; /* colon, space, linefeeds */
-  /* produce data */
-  data = MHD_pool_allocate (connection->pool, size + 1, MHD_NO);
-  if (NULL == data)
+  ret = call_content_reader (connection,
+                             response->data,
+                             (size_t) MHD_MIN ((uint64_t) MHD_MIN (max,
+                                                                   response->data_buffer_size),
+                                               response->total_size - pos));
+  if (ret > 0)
     {
-#ifdef HAVE_MESSAGES
-      MHD_DLOG (connection->daemon,
-                "Not enough memory for write!\n");
-#endif
-      return MHD_NO;
+      response->data_start = pos;
+      response->data_size = ret;
     }
-  if (MHD_CONNECTION_FOOTERS_RECEIVED == connection->state)
+  return ret;
+}
+
+
+/**
+ * Send (the rest of) the current chunk of a chunked body: the
+ * chunk-size line, the data straight from the data buffer of the
+ * response and the CRLF after it, using a single sendmsg().
+ *
+ * @param connection connection we're processing
+ */
+static void
+send_chunk_vectored (struct MHD_Connection *connection)
+{
+  struct MHD_Response *response = connection->response;
+  struct iovec iov[3];
+  struct msghdr msg;
+  size_t hlen = connection->chunk_header_len;
+  size_t data_sent;
+  size_t data_left;
+  size_t trailer_sent;
+  size_t total;
+  ssize_t got;
+  ssize_t ret;
+  unsigned int cnt;
+
+  (void) MHD_mutex_lock_ (&response->mutex);
+  data_sent = (connection->chunk_sent > hlen)
+    ? MHD_MIN (connection->chunk_sent - hlen, connection->chunk_size)
+    : 0;
+  data_left = connection->chunk_size - data_sent;
+  cnt = 0;
+  total = 0;
+  if (connection->chunk_sent < hlen)
     {
-      memcpy (data, code, off);
+      iov[cnt].iov_base = &connection->chunk_header[connection->chunk_sent];
+      iov[cnt].iov_len = hlen - connection->chunk_sent;
+      total += iov[cnt].iov_len;
+      cnt++;
     }
-  if (must_add_close)
+  got = 0;
+  if (0 != data_left)
     {
-      /* we must add the 'Connection: close' header */
-      memcpy (&data[off],
-              "Connection: close\r\n",
-	      strlen ("Connection: close\r\n"));
-      off += strlen ("Connection: close\r\n");
+      got = fill_chunk_data (connection,
+                             data_left);
+      if (got <= 0)
+        {
+          /* the size of the chunk was already sent */
+          (void) MHD_mutex_unlock_ (&response->mutex);
+          CONNECTION_CLOSE_ERROR (connection,
+                                  "Closing connection (error generating response)\n");
+          return;
+        }
+      iov[cnt].iov_base = &response->data[(size_t) (connection->response_write_position -
+                                                    response->data_start)];
+      iov[cnt].iov_len = got;
+      total += got;
+      cnt++;
     }
-  if (must_add_keep_alive)
+  if ((size_t) got == data_left)
     {
-      /* we must add the 'Connection: Keep-Alive' header */
-      memcpy (&data[off],
-              "Connection: Keep-Alive\r\n",
-	      strlen ("Connection: Keep-Alive\r\n"));
-      off += strlen ("Connection: Keep-Alive\r\n");
+      trailer_sent = (connection->chunk_sent > hlen + connection->chunk_size)
+        ? connection->chunk_sent - hlen - connection->chunk_size
+        : 0;
+      /* cast away 'const': iovec is also used for reading */
+      iov[cnt].iov_base = (char *) &"\r\n"[trailer_sent];
+      iov[cnt].iov_len = 2 - trailer_sent;
+      total += iov[cnt].iov_len;
+      cnt++;
     }
-  if (must_add_chunked_encoding)
+  total = apply_write_quantum (connection,
+                               iov,
+                               &cnt,
+                               total);
+  memset (&msg, 0, sizeof (msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = cnt;
+  ret = sendmsg (connection->socket_fd,
+                 &msg,
+                 MSG_NOSIGNAL);
+  (void) MHD_mutex_unlock_ (&response->mutex);
+#if MHD_EREADY_SUPPORT
+  if ( (0 > ret) || (total > (size_t) ret) )
     {
-      /* we must add the 'Transfer-Encoding: chunked' header */
-      memcpy (&data[off],
-              "Transfer-Encoding: chunked\r\n",
-	      strlen ("Transfer-Encoding: chunked\r\n"));
-      off += strlen ("Transfer-Encoding: chunked\r\n");
+      /* partial write --- no longer write-ready */
+      connection->epoll_state &= ~MHD_EPOLL_STATE_WRITE_READY;
     }
-  if (must_add_content_length)
+#endif
+  if (0 < ret)
     {
-      /* we must add the 'Content-Length' header */
-      memcpy (&data[off],
-              content_length_buf,
-	      content_length_len);
-      off += content_length_len;
+      MHD_COUNT_IO_ (connection, bytes_sent, ret);
+      MHD_PROBE2 (write, connection, ret);
     }
-  for (pos = connection->response->first_header; NULL != pos; pos = pos->next)
-    if ( (pos->kind == kind) &&
-         (! ( (pos->value == response_has_keepalive) &&
-              (MHD_YES == must_add_close) &&
-              (MHD_str_equal_caseless_(pos->header,
-                                MHD_HTTP_HEADER_CONNECTION) ) ) ) )
-      off += sprintf (&data[off],
-		      "%s: %s\r\n",
-		      pos->header,
-		      pos->value);
-  if (MHD_CONNECTION_FOOTERS_RECEIVED == connection->state)
+  if (0 > ret)
     {
-      strcpy (&data[off], date);
-      off += strlen (date);
+      const int err = MHD_socket_errno_;
+
+      if ((EINTR == err) || (EAGAIN == err) || (EWOULDBLOCK == err))
+        return;
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (connection->daemon,
+                "Failed to send data: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+      CONNECTION_CLOSE_ERROR (connection, NULL);
+      return;
     }
-  memcpy (&data[off], "\r\n", 2);
-  off += 2;
+  connection->chunk_sent += ret;
+  connection->response_write_position
+    += ( (connection->chunk_sent > hlen)
+         ? MHD_MIN (connection->chunk_sent - hlen, connection->chunk_size)
+         : 0) - data_sent;
+  if (connection->chunk_sent < hlen + connection->chunk_size + 2)
+    return;
+  connection->chunk_size = 0;
+  connection->chunk_sent = 0;
+  connection->state = (MHD_YES == chunked_body_done (connection))
+    ? MHD_CONNECTION_BODY_SENT
+    : MHD_CONNECTION_CHUNKED_BODY_UNREADY;
+}
+#endif
 
-  if (off != size)
-    mhd_panic (mhd_panic_cls, __FILE__, __LINE__, NULL);
-  connection->write_buffer = data;
-  connection->write_buffer_append_offset = size;
-  connection->write_buffer_send_offset = 0;
-  connection->write_buffer_size = size + 1;
-  return MHD_YES;
+
+#if HAVE_SENDMSG
+/**
+ * Check whether the body of the response of @a connection can be
+ * sent from several buffers with one sendmsg().
+ *
+ * @param connection connection we're processing
+ * @return #MHD_YES if send_segments() can be used
+ */
+static int
+can_send_segments (struct MHD_Connection *connection)
+{
+  return ( (MHD_INVALID_SOCKET != connection->socket_fd) &&
+#if HTTPS_SUPPORT
+           (0 == (connection->daemon->options & MHD_USE_SSL)) &&
+#endif
+           (MHD_NO == MHD_rate_limited_ (connection, MHD_YES)) )
+    ? MHD_YES
+    : MHD_NO;
 }
 
 
 /**
- * We encountered an error processing the request.
- * Handle it properly by stopping to read data
- * and sending the indicated response code and message.
+ * Send buffers of the body with one sendmsg(), up to the write
+ * quantum, and count the bytes sent.
  *
- * @param connection the connection
- * @param status_code the response code to send (400, 413 or 414)
- * @param message the error message to send
+ * @param connection connection we're processing
+ * @param iov the buffers, may be shortened
+ * @param cnt number of elements in @a iov
+ * @param total number of bytes in @a iov
+ * @param[out] err set to the error of sendmsg()
+ * @return as for sendmsg()
  */
-static void
-transmit_error_response (struct MHD_Connection *connection,
-                         unsigned int status_code,
-			 const char *message)
+static ssize_t
+send_segments (struct MHD_Connection *connection,
+               struct iovec *iov,
+               unsigned int cnt,
+               size_t total,
+               int *err)
 {
-  struct MHD_Response *response;
+  struct msghdr msg;
+  ssize_t ret;
 
-  if (NULL == connection->version)
+  total = apply_write_quantum (connection,
+                               iov,
+                               &cnt,
+                               total);
+  memset (&msg, 0, sizeof (msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = cnt;
+  ret = sendmsg (connection->socket_fd,
+                 &msg,
+                 MSG_NOSIGNAL);
+  *err = MHD_socket_errno_;
+#if MHD_EREADY_SUPPORT
+  if ( (0 > ret) || (total > (size_t) ret) )
     {
-      /* we were unable to process the full header line, so we don't
-	 really know what version the client speaks; assume 1.0 */
-      connection->version = MHD_HTTP_VERSION_1_0;
+      /* partial write --- no longer write-ready */
+      connection->epoll_state &= ~MHD_EPOLL_STATE_WRITE_READY;
     }
-  connection->state = MHD_CONNECTION_FOOTERS_RECEIVED;
-  connection->read_closed = MHD_YES;
-#ifdef HAVE_MESSAGES
-  MHD_DLOG (connection->daemon,
-            "Error %u (`%s') processing request, closing connection.\n",
-            status_code, message);
 #endif
-  EXTRA_CHECK (NULL == connection->response);
-  response = MHD_create_response_from_buffer (strlen (message),
-					      (void *) message,
-					      MHD_RESPMEM_PERSISTENT);
-  MHD_queue_response (connection, status_code, response);
-  EXTRA_CHECK (NULL != connection->response);
-  MHD_destroy_response (response);
-  if (MHD_NO == build_header_response (connection))
+  /* Handle broken kernel / libc, returning -1 but not setting
+     errno, just like in send_param_adapter() */
+  if ( (0 > ret) && (0 == *err) )
+    *err = ECONNRESET;
+  if (0 < ret)
     {
-      /* oops - close! */
-      CONNECTION_CLOSE_ERROR (connection,
-			      "Closing connection (failed to create response header)\n");
+      MHD_COUNT_IO_ (connection, bytes_sent, ret);
+      MHD_PROBE2 (write, connection, ret);
     }
-  else
+  return ret;
+}
+#endif
+
+
+/**
+ * Handle the result of sending body data that does not come from
+ * the write buffer.
+ *
+ * @param connection connection we're processing
+ * @param ret result of the send operation
+ * @param err error of the send operation
+ * @return #MHD_YES if data was sent, #MHD_NO if not (the connection
+ *         may have been closed)
+ */
+static int
+check_body_sent (struct MHD_Connection *connection,
+                 ssize_t ret,
+                 int err)
+{
+  if (0 <= ret)
     {
-      connection->state = MHD_CONNECTION_HEADERS_SENDING;
+      connection->response_write_position += ret;
+      return MHD_YES;
     }
+  if ((EINTR == err) || (EAGAIN == err) || (EWOULDBLOCK == err))
+    return MHD_NO;
+#ifdef HAVE_MESSAGES
+  MHD_DLOG (connection->daemon,
+            "Failed to send data: %s\n",
+            MHD_socket_last_strerr_ ());
+#endif
+  CONNECTION_CLOSE_ERROR (connection, NULL);
+  return MHD_NO;
 }
 
 
 /**
- * Update the 'event_loop_info' field of this connection based on the state
- * that the connection is now in.  May also close the connection or
- * perform other updates to the connection if needed to prepare for
- * the next round of the event loop.
+ * Send the current event of the broadcast of the response of this
+ * connection straight from the shared buffer of the event; with
+ * sendmsg(), together with the events published after it.
  *
- * @param connection connetion to get poll set for
+ * @param connection connection we're processing
  */
 static void
-MHD_connection_update_event_loop_info (struct MHD_Connection *connection)
+send_broadcast (struct MHD_Connection *connection)
 {
-  while (1)
-    {
-#if DEBUG_STATES
-      MHD_DLOG (connection->daemon,
-                "%s: state: %s\n",
-                __FUNCTION__,
-                MHD_state_to_string (connection->state));
+  struct MHD_BroadcastEvent *events[MHD_BROADCAST_MAX_EVENTS];
+  const char *data;
+  size_t len;
+  unsigned int count;
+  ssize_t ret;
+  int err;
+#if HAVE_SENDMSG
+  struct iovec iov[MHD_BROADCAST_MAX_EVENTS];
+  size_t total;
+  unsigned int i;
 #endif
-      switch (connection->state)
+
+#if HAVE_SENDMSG
+  if (MHD_YES == can_send_segments (connection))
+    {
+      count = MHD_broadcast_events_ (connection,
+                                     events,
+                                     MHD_BROADCAST_MAX_EVENTS);
+      total = 0;
+      for (i = 0; i < count; i++)
         {
-#if HTTPS_SUPPORT
-	case MHD_TLS_CONNECTION_INIT:
-	  if (0 == gnutls_record_get_direction (connection->tls_session))
-            connection->event_loop_info = MHD_EVENT_LOOP_INFO_READ;
-	  else
-            connection->event_loop_info = MHD_EVENT_LOOP_INFO_WRITE;
-	  break;
-#endif
-        case MHD_CONNECTION_INIT:
-        case MHD_CONNECTION_URL_RECEIVED:
-        case MHD_CONNECTION_HEADER_PART_RECEIVED:
-          /* while reading headers, we always grow the
-             read buffer if needed, no size-check required */
-          if ( (connection->read_buffer_offset == connection->read_buffer_size) &&
-	       (MHD_NO == try_grow_read_buffer (connection)) )
-            {
-              transmit_error_response (connection,
-                                       (connection->url != NULL)
-                                       ? MHD_HTTP_REQUEST_ENTITY_TOO_LARGE
-                                       : MHD_HTTP_REQUEST_URI_TOO_LONG,
-                                       REQUEST_TOO_BIG);
-              continue;
-            }
-	  if (MHD_NO == connection->read_closed)
-	    connection->event_loop_info = MHD_EVENT_LOOP_INFO_READ;
-	  else
-	    connection->event_loop_info = MHD_EVENT_LOOP_INFO_BLOCK;
-          break;
-        case MHD_CONNECTION_HEADERS_RECEIVED:
-          EXTRA_CHECK (0);
-          break;
-        case MHD_CONNECTION_HEADERS_PROCESSED:
-          EXTRA_CHECK (0);
-          break;
-        case MHD_CONNECTION_CONTINUE_SENDING:
-          connection->event_loop_info = MHD_EVENT_LOOP_INFO_WRITE;
-          break;
-        case MHD_CONNECTION_CONTINUE_SENT:
-          if (connection->read_buffer_offset == connection->read_buffer_size)
-            {
-              if ((MHD_YES != try_grow_read_buffer (connection)) &&
-                  (0 != (connection->daemon->options &
-                         (MHD_USE_SELECT_INTERNALLY |
-                          MHD_USE_THREAD_PER_CONNECTION))))
-                {
-                  /* failed to grow the read buffer, and the
-                     client which is supposed to handle the
-                     received data in a *blocking* fashion
-                     (in this mode) did not handle the data as
-                     it was supposed to!
-                     => we would either have to do busy-waiting
-                     (on the client, which would likely fail),
-                     or if we do nothing, we would just timeout
-                     on the connection (if a timeout is even
-                     set!).
-                     Solution: we kill the connection with an error */
-                  transmit_error_response (connection,
-                                           MHD_HTTP_INTERNAL_SERVER_ERROR,
-                                           INTERNAL_ERROR);
-                  continue;
-                }
-            }
-          if ( (connection->read_buffer_offset < connection->read_buffer_size) &&
-	       (MHD_NO == connection->read_closed) )
-	    connection->event_loop_info = MHD_EVENT_LOOP_INFO_READ;
-	  else
-	    connection->event_loop_info = MHD_EVENT_LOOP_INFO_BLOCK;
-          break;
-        case MHD_CONNECTION_BODY_RECEIVED:
-        case MHD_CONNECTION_FOOTER_PART_RECEIVED:
-          /* while reading footers, we always grow the
-             read buffer if needed, no size-check required */
-          if (MHD_YES == connection->read_closed)
-            {
-	      CONNECTION_CLOSE_ERROR (connection,
-				      NULL);
-              continue;
-            }
-	  connection->event_loop_info = MHD_EVENT_LOOP_INFO_READ;
-          /* transition to FOOTERS_RECEIVED
-             happens in read handler */
-          break;
-        case MHD_CONNECTION_FOOTERS_RECEIVED:
-	  connection->event_loop_info = MHD_EVENT_LOOP_INFO_BLOCK;
-          break;
-        case MHD_CONNECTION_HEADERS_SENDING:
-          /* headers in buffer, keep writing */
-	  connection->event_loop_info = MHD_EVENT_LOOP_INFO_WRITE;
-          break;
-        case MHD_CONNECTION_HEADERS_SENT:
-          EXTRA_CHECK (0);
-          break;
-        case MHD_CONNECTION_NORMAL_BODY_READY:
-	  connection->event_loop_info = MHD_EVENT_LOOP_INFO_WRITE;
-          break;
-        case MHD_CONNECTION_NORMAL_BODY_UNREADY:
-	  connection->event_loop_info = MHD_EVENT_LOOP_INFO_BLOCK;
-          break;
-        case MHD_CONNECTION_CHUNKED_BODY_READY:
-	  connection->event_loop_info = MHD_EVENT_LOOP_INFO_WRITE;
-          break;
-        case MHD_CONNECTION_CHUNKED_BODY_UNREADY:
-	  connection->event_loop_info = MHD_EVENT_LOOP_INFO_BLOCK;
-          break;
-        case MHD_CONNECTION_BODY_SENT:
-          EXTRA_CHECK (0);
-          break;
-        case MHD_CONNECTION_FOOTERS_SENDING:
-	  connection->event_loop_info = MHD_EVENT_LOOP_INFO_WRITE;
-          break;
-        case MHD_CONNECTION_FOOTERS_SENT:
-          EXTRA_CHECK (0);
-          break;
-        case MHD_CONNECTION_CLOSED:
-	  connection->event_loop_info = MHD_EVENT_LOOP_INFO_CLEANUP;
-          return;       /* do nothing, not even reading */
-        default:
-          EXTRA_CHECK (0);
+          data = MHD_broadcast_event_data_ (connection,
+                                            events[i],
+                                            (0 == i) ? connection->bc_offset : 0,
+                                            &len);
+          /* cast away 'const': iovec is also used for reading */
+          iov[i].iov_base = (char *) data;
+          iov[i].iov_len = len;
+          total += len;
         }
-      break;
+      ret = send_segments (connection,
+                           iov,
+                           count,
+                           total,
+                           &err);
+    }
+  else
+#endif
+    {
+      count = MHD_broadcast_events_ (connection,
+                                     events,
+                                     1);
+      data = MHD_broadcast_event_data_ (connection,
+                                        events[0],
+                                        connection->bc_offset,
+                                        &len);
+      ret = connection->send_cls (connection,
+                                  data,
+                                  len);
+      err = MHD_socket_errno_;
     }
+  (void) MHD_broadcast_sent_ (connection,
+                              events,
+                              count,
+                              (0 < ret) ? (size_t) ret : 0);
+  if (MHD_YES != check_body_sent (connection,
+                                  ret,
+                                  err))
+    return;
+  if (NULL == connection->bc_event)
+    connection->state = (MHD_YES == connection->have_chunked_upload)
+      ? MHD_CONNECTION_CHUNKED_BODY_UNREADY
+      : MHD_CONNECTION_NORMAL_BODY_UNREADY;
 }
 
 
 /**
- * Parse a single line of the HTTP header.  Advance
- * read_buffer (!) appropriately.  If the current line does not
- * fit, consider growing the buffer.  If the line is
- * far too long, close the connection.  If no line is
- * found (incomplete, buffer too small, line too long),
- * return NULL.  Otherwise return a pointer to the line.
+ * Send the data the application wrote to the stream of the response
+ * of this connection straight from its buffers; with sendmsg(),
+ * several buffers at once.
  *
  * @param connection connection we're processing
- * @return NULL if no full line is available
  */
-static char *
-get_next_header_line (struct MHD_Connection *connection)
+static void
+send_stream (struct MHD_Connection *connection)
 {
-  char *rbuf;
-  size_t pos;
+  const char *data[3 * MHD_STREAM_MAX_BUFFERS];
+  size_t len[3 * MHD_STREAM_MAX_BUFFERS];
+  unsigned int count;
+  ssize_t ret;
+  int err;
+#if HAVE_SENDMSG
+  struct iovec iov[3 * MHD_STREAM_MAX_BUFFERS];
+  size_t total;
+  unsigned int i;
+#endif
 
-  if (0 == connection->read_buffer_offset)
-    return NULL;
-  pos = 0;
-  rbuf = connection->read_buffer;
-  while ((pos < connection->read_buffer_offset - 1) &&
-         ('\r' != rbuf[pos]) && ('\n' != rbuf[pos]))
-    pos++;
-  if ( (pos == connection->read_buffer_offset - 1) &&
-       ('\n' != rbuf[pos]) )
+  count = MHD_stream_peek_ (connection,
+                            data,
+                            len,
+                            3 * MHD_STREAM_MAX_BUFFERS);
+  EXTRA_CHECK (0 != count);
+#if HAVE_SENDMSG
+  if (MHD_YES == can_send_segments (connection))
     {
-      /* not found, consider growing... */
-      if ( (connection->read_buffer_offset == connection->read_buffer_size) &&
-	   (MHD_NO ==
-	    try_grow_read_buffer (connection)) )
-	{
-	  transmit_error_response (connection,
-				   (NULL != connection->url)
-				   ? MHD_HTTP_REQUEST_ENTITY_TOO_LARGE
-				   : MHD_HTTP_REQUEST_URI_TOO_LONG,
-				   REQUEST_TOO_BIG);
-	}
-      return NULL;
+      total = 0;
+      for (i = 0; i < count; i++)
+        {
+          /* cast away 'const': iovec is also used for reading */
+          iov[i].iov_base = (char *) data[i];
+          iov[i].iov_len = len[i];
+          total += len[i];
+        }
+      ret = send_segments (connection,
+                           iov,
+                           count,
+                           total,
+                           &err);
     }
-  /* found, check if we have proper LFCR */
-  if (('\r' == rbuf[pos]) && ('\n' == rbuf[pos + 1]))
-    rbuf[pos++] = '\0';         /* skip both r and n */
-  rbuf[pos++] = '\0';
-  connection->read_buffer += pos;
-  connection->read_buffer_size -= pos;
-  connection->read_buffer_offset -= pos;
-  return rbuf;
+  else
+#endif
+    {
+      ret = connection->send_cls (connection,
+                                  data[0],
+                                  len[0]);
+      err = MHD_socket_errno_;
+    }
+  if (MHD_YES != check_body_sent (connection,
+                                  ret,
+                                  err))
+    return;
+  if (MHD_NO == MHD_stream_sent_ (connection,
+                                  (size_t) ret))
+    connection->state = (MHD_YES == connection->have_chunked_upload)
+      ? MHD_CONNECTION_CHUNKED_BODY_UNREADY
+      : MHD_CONNECTION_NORMAL_BODY_UNREADY;
 }
 
 
 /**
- * Add an entry to the HTTP headers of a connection.  If this fails,
- * transmit an error response (request too big).
+ * End a body that is pushed by the application (a broadcast or a
+ * stream) after all its data was sent: send the last chunk from the
+ * write buffer, the footers follow in the
+ * #MHD_CONNECTION_BODY_SENT state; without chunked encoding, close
+ * the connection.
  *
- * @param connection the connection for which a
- *  value should be set
- * @param kind kind of the value
- * @param key key for the value
- * @param value the value itself
- * @return #MHD_NO on failure (out of memory), #MHD_YES for success
+ * @param connection connection we're processing
  */
-static int
-connection_add_header (struct MHD_Connection *connection,
-                       const char *key,
-		       const char *value,
-		       enum MHD_ValueKind kind)
+static void
+queue_last_chunk (struct MHD_Connection *connection)
 {
-  if (MHD_NO ==
-      MHD_set_connection_value (connection,
-				kind,
-				key,
-				value))
+  char *buf;
+
+  if (MHD_NO == connection->have_chunked_upload)
     {
-#ifdef HAVE_MESSAGES
-      MHD_DLOG (connection->daemon,
-                "Not enough memory to allocate header record!\n");
-#endif
-      transmit_error_response (connection,
-			       MHD_HTTP_REQUEST_ENTITY_TOO_LARGE,
-                               REQUEST_TOO_BIG);
-      return MHD_NO;
+      MHD_connection_close_ (connection,
+                             MHD_REQUEST_TERMINATED_COMPLETED_OK);
+      return;
     }
-  return MHD_YES;
+  if (connection->write_buffer_size < 3)
+    {
+      buf = MHD_pool_allocate (connection->pool, 3, MHD_NO);
+      if (NULL == buf)
+        {
+          MHD_STATS_ADD_ (connection->daemon, pool_fail_write_buffer, 1);
+          CONNECTION_CLOSE_ERROR (connection,
+                                  "Closing connection (out of memory)\n");
+          return;
+        }
+      connection->write_buffer = buf;
+      connection->write_buffer_size = 3;
+    }
+  memcpy (connection->write_buffer, "0\r\n", 3);
+  connection->write_buffer_append_offset = 3;
+  connection->write_buffer_send_offset = 0;
+  connection->state = MHD_CONNECTION_CHUNKED_BODY_READY;
 }
 
 
 /**
- * Parse the cookie header (see RFC 2109).
+ * Make the next event of the broadcast of the response of this
+ * connection ready for sending, or wait for it.
  *
- * @param connection connection to parse header of
- * @return #MHD_YES for success, #MHD_NO for failure (malformed, out of memory)
+ * @param connection connection we're processing
+ * @return #MHD_YES if the state of the connection changed,
+ *         #MHD_NO if it waits for the next event
  */
 static int
-parse_cookie_header (struct MHD_Connection *connection)
+ready_broadcast (struct MHD_Connection *connection)
 {
-  const char *hdr;
-  char *cpy;
-  char *pos;
-  char *sce;
-  char *semicolon;
-  char *equals;
-  char *ekill;
-  char old;
-  int quotes;
+  const int park = (0 != (connection->daemon->options & MHD_USE_SUSPEND_RESUME))
+    ? MHD_YES
+    : MHD_NO;
 
-  hdr = MHD_lookup_connection_value (connection,
-				     MHD_HEADER_KIND,
-				     MHD_HTTP_HEADER_COOKIE);
-  if (NULL == hdr)
-    return MHD_YES;
-  cpy = MHD_pool_allocate (connection->pool, strlen (hdr) + 1, MHD_YES);
-  if (NULL == cpy)
+  if (connection->response_write_position ==
+      connection->response->total_size)
     {
-#ifdef HAVE_MESSAGES
-      MHD_DLOG (connection->daemon,
-                "Not enough memory to parse cookies!\n");
-#endif
-      transmit_error_response (connection, MHD_HTTP_REQUEST_ENTITY_TOO_LARGE,
-                               REQUEST_TOO_BIG);
-      return MHD_NO;
+      /* "HEAD" request */
+      connection->state = MHD_CONNECTION_BODY_SENT;
+      return MHD_YES;
     }
-  memcpy (cpy, hdr, strlen (hdr) + 1);
-  pos = cpy;
-  while (NULL != pos)
+  switch (MHD_broadcast_ready_ (connection,
+                                park))
     {
-      while (' ' == *pos)
-        pos++;                  /* skip spaces */
-
-      sce = pos;
-      while (((*sce) != '\0') &&
-             ((*sce) != ',') && ((*sce) != ';') && ((*sce) != '='))
-        sce++;
-      /* remove tailing whitespace (if any) from key */
-      ekill = sce - 1;
-      while ((*ekill == ' ') && (ekill >= pos))
-        *(ekill--) = '\0';
-      old = *sce;
-      *sce = '\0';
-      if (old != '=')
-        {
-          /* value part omitted, use empty string... */
-          if (MHD_NO ==
-              connection_add_header (connection, pos, "", MHD_COOKIE_KIND))
-            return MHD_NO;
-          if (old == '\0')
-            break;
-          pos = sce + 1;
-          continue;
-        }
-      equals = sce + 1;
-      quotes = 0;
-      semicolon = equals;
-      while ( ('\0' != semicolon[0]) &&
-              ( (0 != quotes) ||
-                ( (';' != semicolon[0]) &&
-                  (',' != semicolon[0]) ) ) )
-        {
-          if ('"' == semicolon[0])
-            quotes = (quotes + 1) & 1;
-          semicolon++;
-        }
-      if ('\0' == semicolon[0])
-        semicolon = NULL;
-      if (NULL != semicolon)
-        {
-          semicolon[0] = '\0';
-          semicolon++;
-        }
-      /* remove quotes */
-      if ( ('"' == equals[0]) &&
-           ('"' == equals[strlen (equals) - 1]) )
-        {
-          equals[strlen (equals) - 1] = '\0';
-          equals++;
-        }
-      if (MHD_NO ==
-	  connection_add_header (connection,
-				 pos,
-				 equals,
-				 MHD_COOKIE_KIND))
-        return MHD_NO;
-      pos = semicolon;
+    case MHD_BROADCAST_READY:
+      connection->state = (MHD_YES == connection->have_chunked_upload)
+        ? MHD_CONNECTION_CHUNKED_BODY_READY
+        : MHD_CONNECTION_NORMAL_BODY_READY;
+      /* Buffering for flushable socket was already enabled */
+      if (MHD_NO == socket_flush_possible (connection))
+        socket_start_no_buffering (connection);
+      return MHD_YES;
+    case MHD_BROADCAST_WAIT:
+      if (MHD_YES == park)
+        MHD_connection_wait_for_data_ (connection);
+      return MHD_NO;
+    case MHD_BROADCAST_END:
+      queue_last_chunk (connection);
+      return MHD_YES;
+    case MHD_BROADCAST_LAGGED:
+      CONNECTION_CLOSE_ERROR (connection,
+                              "Closing connection (client fell behind the broadcast)\n");
+      return MHD_YES;
     }
-  return MHD_YES;
+  return MHD_NO;
 }
 
 
 /**
- * Parse the first line of the HTTP HEADER.
+ * Make the data written to the stream of the response of this
+ * connection ready for sending, or wait for the next write.
  *
- * @param connection the connection (updated)
- * @param line the first line
- * @return #MHD_YES if the line is ok, #MHD_NO if it is malformed
+ * @param connection connection we're processing
+ * @return #MHD_YES if the state of the connection changed,
+ *         #MHD_NO if it waits for the next write
  */
 static int
-parse_initial_message_line (struct MHD_Connection *connection,
-                            char *line)
+ready_stream (struct MHD_Connection *connection)
 {
-  struct MHD_Daemon *daemon = connection->daemon;
-  char *uri;
-  char *http_version;
-  char *args;
-  unsigned int unused_num_headers;
+  const int park = (0 != (connection->daemon->options & MHD_USE_SUSPEND_RESUME))
+    ? MHD_YES
+    : MHD_NO;
 
-  if (NULL == (uri = strchr (line, ' ')))
-    return MHD_NO;              /* serious error */
-  uri[0] = '\0';
-  connection->method = line;
-  uri++;
-  while (' ' == uri[0])
-    uri++;
-  http_version = strchr (uri, ' ');
-  if (NULL != http_version)
+  if (connection->response_write_position ==
+      connection->response->total_size)
     {
-      http_version[0] = '\0';
-      http_version++;
+      /* "HEAD" request */
+      connection->state = MHD_CONNECTION_BODY_SENT;
+      return MHD_YES;
     }
-  if (NULL != daemon->uri_log_callback)
-    connection->client_context
-      = daemon->uri_log_callback (daemon->uri_log_callback_cls,
-				  uri,
-				  connection);
-  args = strchr (uri, '?');
-  if (NULL != args)
+  switch (MHD_stream_ready_ (connection,
+                             park))
     {
-      args[0] = '\0';
-      args++;
-      /* note that this call clobbers 'args' */
-      MHD_parse_arguments_ (connection,
-			    MHD_GET_ARGUMENT_KIND,
-			    args,
-			    &connection_add_header,
-			    &unused_num_headers);
+    case MHD_STREAM_READY:
+      connection->state = (MHD_YES == connection->have_chunked_upload)
+        ? MHD_CONNECTION_CHUNKED_BODY_READY
+        : MHD_CONNECTION_NORMAL_BODY_READY;
+      /* Buffering for flushable socket was already enabled */
+      if (MHD_NO == socket_flush_possible (connection))
+        socket_start_no_buffering (connection);
+      return MHD_YES;
+    case MHD_STREAM_WAIT:
+      if (MHD_YES == park)
+        MHD_connection_wait_for_data_ (connection);
+      return MHD_NO;
+    case MHD_STREAM_END:
+      queue_last_chunk (connection);
+      return MHD_YES;
     }
-  daemon->unescape_callback (daemon->unescape_callback_cls,
-			     connection,
-			     uri);
-  connection->url = uri;
-  if (NULL == http_version)
-    connection->version = "";
-  else
-    connection->version = http_version;
-  return MHD_YES;
+  return MHD_NO;
 }
 
 
 /**
- * Call the handler of the application for this
- * connection.  Handles chunking of the upload
- * as well as normal uploads.
+ * Release the broadcast state of @a connection (if its response is a
+ * broadcast response) before the response is destroyed.
  *
  * @param connection connection we're processing
  */
 static void
-call_connection_handler (struct MHD_Connection *connection)
+release_broadcast (struct MHD_Connection *connection)
 {
-  size_t processed;
+  if ( (NULL == connection->response) ||
+       (NULL == connection->response->broadcast) )
+    return;
+  MHD_broadcast_unsubscribe_ (connection);
+}
 
-  if (NULL != connection->response)
-    return;                     /* already queued a response */
-  processed = 0;
-  connection->client_aware = MHD_YES;
-  if (MHD_NO ==
-      connection->daemon->default_handler (connection->daemon-> default_handler_cls,
-					   connection,
-                                           connection->url,
-					   connection->method,
-					   connection->version,
-					   NULL, &processed,
-					   &connection->client_context))
+
+/**
+ * Detach the stream of the response of @a connection (if it is a
+ * stream response) before the response is destroyed.
+ *
+ * @param connection connection we're processing
+ */
+static void
+release_stream (struct MHD_Connection *connection)
+{
+  if ( (NULL == connection->response) ||
+       (NULL == connection->response->stream) )
+    return;
+  MHD_stream_detach_ (connection);
+}
+
+
+#if MHD_SENDFILE_WITH_HEADER_
+/**
+ * Try writing the remaining response header from the write buffer
+ * together with the body of a file-descriptor response using a
+ * single sendfile() (see MHD_sendfile_with_header_()).
+ *
+ * @param connection connection we're processing
+ * @return #MHD_NO if the response does not qualify (use do_write()),
+ *         #MHD_YES if we tried to send (state may have changed)
+ */
+static int
+do_write_header_and_file (struct MHD_Connection *connection)
+{
+  struct MHD_Response *response = connection->response;
+  size_t header_left;
+  uint64_t offsetu64;
+  uint64_t left;
+  ssize_t sent;
+
+  if ( (NULL == response) ||
+       (-1 == response->fd) ||
+       (MHD_YES == response->is_pipe) ||
+       (NULL != response->upgrade_handler) ||
+       (MHD_YES == connection->have_chunked_upload) ||
+       (connection->response_write_position >= MHD_BODY_END_ (connection)) )
+    return MHD_NO;
+#if HAVE_ZLIB
+  if (NULL != connection->compressor)
+    return MHD_NO;
+#endif
+#if HTTPS_SUPPORT
+  if (0 != (connection->daemon->options & MHD_USE_SSL))
+    return MHD_NO;
+#endif
+  if ( (MHD_INVALID_SOCKET == connection->socket_fd) ||
+       (MHD_YES == MHD_rate_limited_ (connection, MHD_YES)) )
+    return MHD_NO;
+  offsetu64 = connection->response_write_position + response->fd_off;
+  if (offsetu64 > (uint64_t) OFF_T_MAX)
+    return MHD_NO;
+  left = MHD_BODY_END_ (connection) - connection->response_write_position;
+  header_left = connection->write_buffer_append_offset
+    - connection->write_buffer_send_offset;
+  if (left > (uint64_t) (SSIZE_MAX - header_left))
+    left = SSIZE_MAX - header_left; /* return value limit */
+  if ( (0 != connection->daemon->write_quantum) &&
+       (left > connection->daemon->write_quantum) )
+    left = connection->daemon->write_quantum;
+  sent = MHD_sendfile_with_header_ (connection->socket_fd,
+                                    response->fd,
+                                    offsetu64,
+                                    (size_t) left,
+                                    &connection->write_buffer[connection->write_buffer_send_offset],
+                                    header_left);
+  if (0 >= sent)
     {
-      /* serious internal error, close connection */
-      CONNECTION_CLOSE_ERROR (connection,
-			      "Internal application error, closing connection.\n");
-      return;
+      const int err = MHD_socket_errno_;
+#if MHD_EREADY_SUPPORT
+      connection->epoll_state &= ~MHD_EPOLL_STATE_WRITE_READY;
+#endif
+      if ( (EINTR == err) || (EAGAIN == err) || (EWOULDBLOCK == err) ||
+           (EBUSY == err) )
+        return MHD_YES;
+      CONNECTION_CLOSE_ERROR (connection, NULL);
+      return MHD_YES;
+    }
+#if MHD_EREADY_SUPPORT
+  if (header_left + left > (uint64_t) sent)
+    {
+      /* partial write --- no longer write-ready */
+      connection->epoll_state &= ~MHD_EPOLL_STATE_WRITE_READY;
+    }
+#endif
+  MHD_COUNT_IO_ (connection, bytes_sent, sent);
+  MHD_PROBE2 (write, connection, sent);
+  if ((size_t) sent < header_left)
+    {
+      connection->write_buffer_send_offset += sent;
+      return MHD_YES;
     }
+  connection->write_buffer_send_offset = connection->write_buffer_append_offset;
+  connection->response_write_position += sent - header_left;
+  return MHD_YES;
+}
+#endif
+
+
+/**
+ * Ask the kernel to read the beginning of the body of a response
+ * from a file while the header is being sent, so that the first
+ * sendfile() (or file_reader()) finds it in the page cache.
+ *
+ * @param connection connection that starts sending a response
+ */
+static void
+hint_body_readahead (struct MHD_Connection *connection)
+{
+  struct MHD_Response *response = connection->response;
+  uint64_t left;
+
+  if ( (-1 == response->fd) ||
+       (MHD_YES == response->is_pipe) )
+    return;
+  left = MHD_BODY_END_ (connection) - connection->response_write_position;
+  if (left < MHD_FILE_READAHEAD_SIZE)
+    return;
+  MHD_file_readahead_ (response->fd,
+                       response->fd_off + connection->response_write_position,
+                       MHD_FILE_READAHEAD_SIZE);
+}
+
+
+/**
+ * Check if the body of the response of this connection is moved from
+ * the descriptor of a #MHD_create_response_from_pipe() response into
+ * the socket with splice() instead of being read by the content
+ * reader.  Such bodies are sent without chunked encoding.
+ *
+ * @param connection connection to check
+ * @return #MHD_YES if send_body_spliced() is used
+ */
+static int
+use_splice (struct MHD_Connection *connection)
+{
+#if HAVE_SPLICE
+  struct MHD_Response *response = connection->response;
+
+  if ( (NULL == response) ||
+       (MHD_NO == response->is_pipe) ||
+       (MHD_YES == connection->have_chunked_upload) )
+    return MHD_NO;
+#if HAVE_ZLIB
+  if (NULL != connection->compressor)
+    return MHD_NO;
+#endif
+#if HTTPS_SUPPORT
+  if (0 != (connection->daemon->options & MHD_USE_SSL))
+    return MHD_NO;
+#endif
+  return MHD_YES;
+#else
+  return MHD_NO;
+#endif
 }
 
 
+#if HAVE_SPLICE
+/**
+ * Maximum number of bytes moved from the descriptor of the response
+ * into the intermediate pipe at once; the default capacity of a pipe.
+ */
+#define MHD_SPLICE_BLOCK_SIZE (64 * 1024)
+
 
 /**
- * Call the handler of the application for this
- * connection.  Handles chunking of the upload
- * as well as normal uploads.
+ * Close the intermediate pipe used by send_body_spliced(), if any.
  *
- * @param connection connection we're processing
+ * @param connection connection to process
  */
 static void
-process_request_body (struct MHD_Connection *connection)
+release_splice_pipe (struct MHD_Connection *connection)
 {
-  size_t processed;
-  size_t available;
-  size_t used;
-  size_t i;
-  int instant_retry;
-  int malformed;
-  char *buffer_head;
-  char *end;
+  if (-1 == connection->splice_pipe[0])
+    return;
+  (void) close (connection->splice_pipe[0]);
+  (void) close (connection->splice_pipe[1]);
+  connection->splice_pipe[0] = -1;
+  connection->splice_pipe[1] = -1;
+  connection->splice_buffered = 0;
+}
 
-  if (NULL != connection->response)
-    return;                     /* already queued a response */
 
-  buffer_head = connection->read_buffer;
-  available = connection->read_buffer_offset;
-  do
+/**
+ * Send the next part of the body of a #MHD_create_response_from_pipe()
+ * response with splice(), without copying it into user space.  The
+ * data always goes through an intermediate pipe of the connection:
+ * this works for sockets as well as pipes, and waiting for data from
+ * the response (which blocks, just like the content reader would) is
+ * kept apart from writing to our non-blocking socket.  At the end of
+ * the stream the connection is closed.
+ *
+ * @param connection connection to process
+ */
+static void
+send_body_spliced (struct MHD_Connection *connection)
+{
+  struct MHD_Response *response = connection->response;
+  ssize_t ret;
+  size_t want;
+  int err;
+
+  if (0 == connection->splice_buffered)
     {
-      instant_retry = MHD_NO;
-      if ( (MHD_YES == connection->have_chunked_upload) &&
-           (MHD_SIZE_UNKNOWN == connection->remaining_upload_size) )
+      if ( (-1 == connection->splice_pipe[0]) &&
+           (0 != pipe (connection->splice_pipe)) )
         {
-          if ( (connection->current_chunk_offset == connection->current_chunk_size) &&
-               (0 != connection->current_chunk_offset) &&
-               (available >= 2) )
-            {
-              /* skip new line at the *end* of a chunk */
-              i = 0;
-              if ((buffer_head[i] == '\r') || (buffer_head[i] == '\n'))
-                i++;            /* skip 1st part of line feed */
-              if ((buffer_head[i] == '\r') || (buffer_head[i] == '\n'))
-                i++;            /* skip 2nd part of line feed */
-              if (i == 0)
-                {
-                  /* malformed encoding */
-                  CONNECTION_CLOSE_ERROR (connection,
-					  "Received malformed HTTP request (bad chunked encoding), closing connection.\n");
-                  return;
-                }
-              available -= i;
-              buffer_head += i;
-              connection->current_chunk_offset = 0;
-              connection->current_chunk_size = 0;
-            }
-          if (connection->current_chunk_offset <
-              connection->current_chunk_size)
-            {
-              /* we are in the middle of a chunk, give
-                 as much as possible to the client (without
-                 crossing chunk boundaries) */
-              processed =
-                connection->current_chunk_size -
-                connection->current_chunk_offset;
-              if (processed > available)
-                processed = available;
-              if (available > processed)
-                instant_retry = MHD_YES;
-            }
-          else
-            {
-              /* we need to read chunk boundaries */
-              i = 0;
-              while (i < available)
-                {
-                  if ((buffer_head[i] == '\r') || (buffer_head[i] == '\n'))
-                    break;
-                  i++;
-                  if (i >= 6)
-                    break;
-                }
-              /* take '\n' into account; if '\n'
-                 is the unavailable character, we
-                 will need to wait until we have it
-                 before going further */
-              if ((i + 1 >= available) &&
-                  !((i == 1) && (available == 2) && (buffer_head[0] == '0')))
-                break;          /* need more data... */
-              malformed = (i >= 6);
-              if (!malformed)
-                {
-                  buffer_head[i] = '\0';
-		  connection->current_chunk_size = strtoul (buffer_head, &end, 16);
-                  malformed = ('\0' != *end);
-                }
-              if (malformed)
-                {
-                  /* malformed encoding */
-                  CONNECTION_CLOSE_ERROR (connection,
-					  "Received malformed HTTP request (bad chunked encoding), closing connection.\n");
-                  return;
-                }
-              i++;
-              if ((i < available) &&
-                  ((buffer_head[i] == '\r') || (buffer_head[i] == '\n')))
-                i++;            /* skip 2nd part of line feed */
-
-              buffer_head += i;
-              available -= i;
-              connection->current_chunk_offset = 0;
-
-              if (available > 0)
-                instant_retry = MHD_YES;
-              if (0 == connection->current_chunk_size)
-                {
-                  connection->remaining_upload_size = 0;
-                  break;
-                }
-              continue;
-            }
+          connection->splice_pipe[0] = -1;
+          connection->splice_pipe[1] = -1;
+          CONNECTION_CLOSE_ERROR (connection,
+                                  "Failed to create pipe for splice()\n");
+          return;
         }
-      else
+      ret = splice (response->fd, NULL,
+                    connection->splice_pipe[1], NULL,
+                    MHD_SPLICE_BLOCK_SIZE,
+                    SPLICE_F_MOVE);
+      if (0 == ret)
         {
-          /* no chunked encoding, give all to the client */
-          if ( (0 != connection->remaining_upload_size) &&
-	       (MHD_SIZE_UNKNOWN != connection->remaining_upload_size) &&
-	       (connection->remaining_upload_size < available) )
-	    {
-              processed = (size_t)connection->remaining_upload_size;
-	    }
-          else
-	    {
-              /**
-               * 1. no chunked encoding, give all to the client
-               * 2. client may send large chunked data, but only a smaller part is available at one time.
-               */
-              processed = available;
-	    }
+          /* end of stream, close like for other bodies of unknown size */
+          response->total_size = connection->response_write_position;
+          MHD_connection_close_ (connection,
+                                 MHD_REQUEST_TERMINATED_COMPLETED_OK);
+          return;
         }
-      used = processed;
-      connection->client_aware = MHD_YES;
-      if (MHD_NO ==
-          connection->daemon->default_handler (connection->daemon->default_handler_cls,
-                                               connection,
-                                               connection->url,
-                                               connection->method,
-                                               connection->version,
-                                               buffer_head,
-                                               &processed,
-                                               &connection->client_context))
+      if (0 > ret)
         {
-          /* serious internal error, close connection */
-	  CONNECTION_CLOSE_ERROR (connection,
-				  "Internal application error, closing connection.\n");
+          if (EINTR == errno)
+            return;
+          CONNECTION_CLOSE_ERROR (connection,
+                                  "Closing connection (stream error)\n");
+          return;
+        }
+      connection->splice_buffered = (size_t) ret;
+    }
+  want = connection->splice_buffered;
+  if ( (0 != connection->daemon->write_quantum) &&
+       (want > connection->daemon->write_quantum) )
+    want = connection->daemon->write_quantum;
+  want = MHD_rate_limit_allowance_ (connection,
+                                    MHD_YES,
+                                    want);
+  if (0 == want)
+    return; /* throttled, the socket stays write-ready */
+  ret = splice (connection->splice_pipe[0], NULL,
+                connection->socket_fd, NULL,
+                want,
+                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if (0 > ret)
+    {
+      err = errno;
+      if ( (EINTR == err) || (EAGAIN == err) || (EWOULDBLOCK == err) )
+        {
+#if MHD_EREADY_SUPPORT
+          if (EINTR != err)
+            connection->epoll_state &= ~MHD_EPOLL_STATE_WRITE_READY;
+#endif
           return;
         }
-      if (processed > used)
-        mhd_panic (mhd_panic_cls, __FILE__, __LINE__
 #ifdef HAVE_MESSAGES
-		   , "API violation"
-#else
-		   , NULL
+      MHD_DLOG (connection->daemon,
+                "Failed to send data: %s\n",
+                MHD_strerror_ (err));
 #endif
-		   );
-      if (0 != processed)
-        instant_retry = MHD_NO; /* client did not process everything */
-      used -= processed;
-      if (connection->have_chunked_upload == MHD_YES)
-        connection->current_chunk_offset += used;
-      /* dh left "processed" bytes in buffer for next time... */
-      buffer_head += used;
-      available -= used;
-      if (connection->remaining_upload_size != MHD_SIZE_UNKNOWN)
-        connection->remaining_upload_size -= used;
+      CONNECTION_CLOSE_ERROR (connection, NULL);
+      return;
     }
-  while (MHD_YES == instant_retry);
-  if (available > 0)
-    memmove (connection->read_buffer, buffer_head, available);
-  connection->read_buffer_offset = available;
+#if MHD_EREADY_SUPPORT
+  if ((size_t) ret < want)
+    {
+      /* partial write --- no longer write-ready */
+      connection->epoll_state &= ~MHD_EPOLL_STATE_WRITE_READY;
+    }
+#endif
+  MHD_rate_limit_charge_ (connection, MHD_YES, (size_t) ret);
+  MHD_COUNT_IO_ (connection, bytes_sent, ret);
+  MHD_PROBE2 (write, connection, ret);
+  connection->splice_buffered -= (size_t) ret;
+  connection->response_write_position += ret;
 }
 
 
 /**
- * Try reading data from the socket into the
- * read buffer of the connection.
+ * Move up to @a want bytes of the body of the request from the socket
+ * into the descriptor the application provided with
+ * #MHD_OPTION_UPLOAD_BUFFER_CALLBACK, through the intermediate pipe
+ * of the connection.  The descriptor may block; what was taken from
+ * the socket is always written completely.
  *
- * @param connection connection we're processing
- * @return #MHD_YES if something changed,
- *         #MHD_NO if we were interrupted or if
- *                no space was available
+ * @param connection connection to process
+ * @param want maximum number of bytes to move
  */
-static int
-do_read (struct MHD_Connection *connection)
+static void
+splice_upload (struct MHD_Connection *connection,
+               size_t want)
 {
-  ssize_t bytes_read;
+  ssize_t ret;
+  ssize_t moved;
+  ssize_t n;
+  int err;
 
-  if (connection->read_buffer_size == connection->read_buffer_offset)
-    return MHD_NO;
-  bytes_read = connection->recv_cls (connection,
-                                     &connection->read_buffer
-                                     [connection->read_buffer_offset],
-                                     connection->read_buffer_size -
-                                     connection->read_buffer_offset);
-  if (bytes_read < 0)
+  if ( (-1 == connection->splice_pipe[0]) &&
+       (0 != pipe (connection->splice_pipe)) )
     {
-      const int err = MHD_socket_errno_;
-      if ((EINTR == err) || (EAGAIN == err) || (EWOULDBLOCK == err))
-	  return MHD_NO;
-      if (ECONNRESET == err)
+      connection->splice_pipe[0] = -1;
+      connection->splice_pipe[1] = -1;
+      CONNECTION_CLOSE_ERROR (connection,
+                              "Failed to create pipe for splice()\n");
+      return;
+    }
+  if (want > MHD_SPLICE_BLOCK_SIZE)
+    want = MHD_SPLICE_BLOCK_SIZE;
+  want = MHD_rate_limit_allowance_ (connection,
+                                    MHD_NO,
+                                    want);
+  if (0 == want)
+    return; /* throttled, the socket stays read-ready */
+  ret = splice (connection->socket_fd, NULL,
+                connection->splice_pipe[1], NULL,
+                want,
+                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if (0 > ret)
+    {
+      err = errno;
+      if ( (EINTR == err) || (EAGAIN == err) || (EWOULDBLOCK == err) )
         {
-           CONNECTION_CLOSE_ERROR (connection, NULL);
-	   return MHD_NO;
-	}
+#if MHD_EREADY_SUPPORT
+          if (EINTR != err)
+            connection->epoll_state &= ~MHD_EPOLL_STATE_READ_READY;
+#endif
+          return;
+        }
       CONNECTION_CLOSE_ERROR (connection, NULL);
-      return MHD_YES;
+      return;
     }
-  if (0 == bytes_read)
+  if (0 == ret)
     {
-      /* other side closed connection; RFC 2616, section 8.1.4 suggests
-	 we should then shutdown ourselves as well. */
+      /* other side closed connection */
       connection->read_closed = MHD_YES;
       MHD_connection_close_ (connection,
                              MHD_REQUEST_TERMINATED_CLIENT_ABORT);
-      return MHD_YES;
+      return;
     }
-  connection->read_buffer_offset += bytes_read;
-  return MHD_YES;
+#if MHD_EREADY_SUPPORT
+  if ((size_t) ret < want)
+    connection->epoll_state &= ~MHD_EPOLL_STATE_READ_READY;
+#endif
+  MHD_rate_limit_charge_ (connection, MHD_NO, (size_t) ret);
+  MHD_COUNT_IO_ (connection, bytes_received, ret);
+  MHD_PROBE2 (read, connection, ret);
+  moved = 0;
+  while (moved < ret)
+    {
+      n = splice (connection->splice_pipe[0], NULL,
+                  connection->upload_fd, NULL,
+                  ret - moved,
+                  SPLICE_F_MOVE);
+      if ( (0 > n) &&
+           (EINTR == errno) )
+        continue;
+      if (0 >= n)
+        {
+          CONNECTION_CLOSE_ERROR (connection,
+                                  "Failed to splice upload to the application\n");
+          return;
+        }
+      moved += n;
+    }
+  connection->upload_buffer_fill += (size_t) ret;
 }
+#endif
 
 
 /**
- * Try writing data to the socket from the
- * write buffer of the connection.
+ * Can the content reader of the response of this connection be
+ * called ahead on a handler thread (see #MHD_RF_PREFETCH)?
  *
- * @param connection connection we're processing
- * @return #MHD_YES if something changed,
- *         #MHD_NO if we were interrupted
+ * @param connection the connection
+ * @return #MHD_YES if blocks of the body may be read ahead
  */
 static int
-do_write (struct MHD_Connection *connection)
+can_prefetch (struct MHD_Connection *connection)
 {
-  ssize_t ret;
-  size_t max;
+  struct MHD_Response *response = connection->response;
 
-  max = connection->write_buffer_append_offset - connection->write_buffer_send_offset;
-  ret = connection->send_cls (connection,
-                              &connection->write_buffer
-                              [connection->write_buffer_send_offset],
-                              max);
+  if ( (0 == (response->flags & MHD_RF_PREFETCH)) ||
+       (NULL == connection->daemon->handler_pool) ||
+       (MHD_SIZE_UNKNOWN == response->total_size) )
+    return MHD_NO;
+  /* nobody else may call the reader meanwhile */
+  if (1 != response->reference_count)
+    return MHD_NO;
+  return MHD_YES;
+}
 
-  if (ret < 0)
+
+/**
+ * Take the block of the body read ahead by a handler thread (see
+ * #MHD_RF_PREFETCH) into the data buffer of the response, if it is
+ * the block needed next.
+ *
+ * @param connection the connection
+ * @param ret set to the result of the content reader for the block
+ * @return #MHD_YES if @a ret was set (0 while the block is still
+ *         being read), #MHD_NO if the content reader is to be
+ *         called by the caller
+ */
+static int
+take_prefetched_block (struct MHD_Connection *connection,
+                       ssize_t *ret)
+{
+  struct MHD_Response *response = connection->response;
+  enum MHD_PrefetchState state;
+
+#ifdef HAVE_ATOMIC_BUILTINS
+  state = __atomic_load_n (&connection->prefetch_state,
+                           __ATOMIC_ACQUIRE);
+#else
+  state = connection->prefetch_state;
+#endif
+  if (MHD_PREFETCH_BUSY == state)
     {
-      const int err = MHD_socket_errno_;
-      if ((EINTR == err) || (EAGAIN == err) || (EWOULDBLOCK == err))
-        return MHD_NO;
-      CONNECTION_CLOSE_ERROR (connection, NULL);
+      /* resumed by the handler thread once the block is there */
+      if (0 != (connection->daemon->options & MHD_USE_SUSPEND_RESUME))
+        connection->data_pending = MHD_YES;
+      *ret = 0;
       return MHD_YES;
     }
-#if DEBUG_SEND_DATA
-  fprintf (stderr,
-           "Sent response: `%.*s'\n",
-           ret,
-           &connection->write_buffer[connection->write_buffer_send_offset]);
-#endif
-  /* only increment if this wasn't a "sendfile" transmission without
-     buffer involvement! */
-  if (0 != max)
-    connection->write_buffer_send_offset += ret;
+  if (MHD_PREFETCH_IDLE == state)
+    return MHD_NO;
+  connection->prefetch_state = MHD_PREFETCH_IDLE;
+  if ( (connection->prefetch_pos != connection->response_write_position) ||
+       ( (connection->prefetch_ret <= 0) &&
+         (((ssize_t) MHD_CONTENT_READER_END_OF_STREAM) != connection->prefetch_ret) &&
+         (((ssize_t) MHD_CONTENT_READER_END_WITH_ERROR) != connection->prefetch_ret) ) )
+    return MHD_NO; /* a different range, or no data yet */
+  *ret = connection->prefetch_ret;
+  if (*ret > 0)
+    memcpy (response->data,
+            connection->prefetch_buf,
+            (size_t) *ret);
   return MHD_YES;
 }
 
 
 /**
- * Check if we are done sending the write-buffer.
- * If so, transition into "next_state".
+ * Let a handler thread read the block following the one in the
+ * data buffer of the response ahead (see #MHD_RF_PREFETCH).
  *
- * @param connection connection to check write status for
- * @param next_state the next state to transition to
- * @return #MHD_NO if we are not done, #MHD_YES if we are
+ * @param connection the connection
  */
-static int
-check_write_done (struct MHD_Connection *connection,
-                  enum MHD_CONNECTION_STATE next_state)
+static void
+prefetch_next_block (struct MHD_Connection *connection)
 {
-  if (connection->write_buffer_append_offset !=
-      connection->write_buffer_send_offset)
-    return MHD_NO;
-  connection->write_buffer_append_offset = 0;
-  connection->write_buffer_send_offset = 0;
-  connection->state = next_state;
-  MHD_pool_reallocate (connection->pool,
-		       connection->write_buffer,
-                       connection->write_buffer_size, 0);
-  connection->write_buffer = NULL;
-  connection->write_buffer_size = 0;
-  return MHD_YES;
+  struct MHD_Response *response = connection->response;
+  uint64_t next;
+
+  next = response->data_start + response->data_size;
+  if (next >= MHD_BODY_END_ (connection))
+    return;
+  if (NULL == connection->prefetch_buf)
+    {
+      connection->prefetch_buf = MHD_pool_allocate (connection->pool,
+                                                    response->data_buffer_size,
+                                                    MHD_NO);
+      if (NULL == connection->prefetch_buf)
+        return; /* read in the event loop */
+      connection->prefetch_buf_size = response->data_buffer_size;
+    }
+  connection->prefetch_pos = next;
+  (void) MHD_prefetch_submit_ (connection);
 }
 
 
 /**
- * We have received (possibly the beginning of) a line in the
- * header (or footer).  Validate (check for ":") and prepare
- * to process.
+ * Prepare the response buffer of this connection for
+ * sending.  Assumes that the response mutex is
+ * already held.  If the transmission is complete,
+ * this function may close the socket (and return
+ * #MHD_NO).
  *
- * @param connection connection we're processing
- * @param line line from the header to process
- * @return #MHD_YES on success, #MHD_NO on error (malformed @a line)
+ * @param connection the connection
+ * @return #MHD_NO if readying the response failed (the
+ *  lock on the response will have been released already
+ *  in this case).
  */
 static int
-process_header_line (struct MHD_Connection *connection, char *line)
+try_ready_normal_body (struct MHD_Connection *connection)
 {
-  char *colon;
+  ssize_t ret;
+  struct MHD_Response *response;
+  int prefetch;
 
-  /* line should be normal header line, find colon */
-  colon = strchr (line, ':');
-  if (NULL == colon)
+  response = connection->response;
+  if (NULL == response->crc)
+    return MHD_YES;
+  if ( (0 == response->total_size) ||
+       (connection->response_write_position == MHD_BODY_END_ (connection)) )
+    return MHD_YES; /* 0-byte response is always ready */
+  if ( (response->data_start <=
+	connection->response_write_position) &&
+       (response->data_size + response->data_start >
+	connection->response_write_position) )
+    return MHD_YES; /* response already ready */
+#if LINUX || MHD_SENDFILE_WITH_HEADER_
+  if ( (MHD_INVALID_SOCKET != response->fd) &&
+       (MHD_NO == response->is_pipe) &&
+       (0 == (connection->daemon->options & MHD_USE_SSL)) )
     {
-      /* error in header line, die hard */
-      CONNECTION_CLOSE_ERROR (connection,
-			      "Received malformed line (no colon), closing connection.\n");
+      /* will use sendfile, no need to bother response crc */
+      return MHD_YES;
+    }
+#endif
+#if HTTPS_SUPPORT && MHD_TLS_HAVE_SEND_FILE
+  if ( (MHD_INVALID_SOCKET != response->fd) &&
+       (MHD_NO == response->is_pipe) &&
+       (MHD_YES == connection->tls_ktls_send) )
+    {
+      /* will use sendfile through kTLS, see send_tls_adapter() */
+      return MHD_YES;
+    }
+#endif
+  if (MHD_YES == use_splice (connection))
+    {
+      /* will use splice, no need to bother response crc */
+      return MHD_YES;
+    }
+#if HAVE_SENDMSG
+  if ( (NULL != response->data_iov) &&
+       (MHD_YES == can_send_body_vectored (connection)) )
+    {
+      /* will send the fragments directly, no need to copy them */
+      return MHD_YES;
+    }
+#endif
+
+  prefetch = can_prefetch (connection);
+  if ( (MHD_NO == prefetch) ||
+       (MHD_NO == take_prefetched_block (connection,
+                                         &ret)) )
+    ret = call_content_reader (connection,
+                               response->data,
+                               (size_t)MHD_MIN ((uint64_t)response->data_buffer_size,
+                                                MHD_BODY_END_ (connection) -
+                                                connection->response_write_position));
+  if ( (((ssize_t) MHD_CONTENT_READER_END_OF_STREAM) == ret) ||
+       (((ssize_t) MHD_CONTENT_READER_END_WITH_ERROR) == ret) )
+    {
+      /* either error or http 1.0 transfer, close socket! */
+      response->total_size = connection->response_write_position;
+      if (NULL != response->crc)
+        (void) MHD_mutex_unlock_ (&response->mutex);
+      if ( ((ssize_t)MHD_CONTENT_READER_END_OF_STREAM) == ret)
+	MHD_connection_close_ (connection,
+                               MHD_REQUEST_TERMINATED_COMPLETED_OK);
+      else
+	CONNECTION_CLOSE_ERROR (connection,
+				"Closing connection (stream error)\n");
       return MHD_NO;
     }
-  /* zero-terminate header */
-  colon[0] = '\0';
-  colon++;                      /* advance to value */
-  while ((colon[0] != '\0') && ((colon[0] == ' ') || (colon[0] == '\t')))
-    colon++;
-  /* we do the actual adding of the connection
-     header at the beginning of the while
-     loop since we need to be able to inspect
-     the *next* header line (in case it starts
-     with a space...) */
-  connection->last = line;
-  connection->colon = colon;
+  response->data_start = connection->response_write_position;
+  response->data_size = ret;
+  if (0 == ret)
+    {
+      connection->state = MHD_CONNECTION_NORMAL_BODY_UNREADY;
+      if (NULL != response->crc)
+        (void) MHD_mutex_unlock_ (&response->mutex);
+      return MHD_NO;
+    }
+  if (MHD_YES == prefetch)
+    prefetch_next_block (connection);
   return MHD_YES;
 }
 
 
+#if HAVE_ZLIB
 /**
- * Process a header value that spans multiple lines.
- * The previous line(s) are in connection->last.
+ * Fill the write buffer of this connection with the next chunk of
+ * the compressed body, reading the body from the content reader as
+ * needed.  The last chunk is followed by the terminating empty chunk.
+ * Assumes that the response mutex is already held and that the write
+ * buffer was allocated.
  *
- * @param connection connection we're processing
- * @param line the current input line
- * @param kind if the line is complete, add a header
- *        of the given kind
- * @return #MHD_YES if the line was processed successfully
+ * @param connection the connection
+ * @return #MHD_NO if readying the response failed
  */
 static int
-process_broken_line (struct MHD_Connection *connection,
-                     char *line, enum MHD_ValueKind kind)
+try_ready_compressed_body (struct MHD_Connection *connection)
 {
-  char *last;
-  char *tmp;
-  size_t last_len;
-  size_t tmp_len;
-
-  last = connection->last;
-  if ((line[0] == ' ') || (line[0] == '\t'))
+  struct MHD_Response *response = connection->response;
+  char cbuf[10];                /* 10: max strlen of "%x\r\n" */
+  int cblen;
+  char *out;
+  const char *in;
+  size_t out_size;
+  size_t out_len;
+  size_t in_len;
+  size_t len;
+  size_t off;
+  ssize_t ret;
+  enum MHD_CompressFlush flush;
+  int finished;
+
+  out = &connection->write_buffer[sizeof (cbuf)];
+  /* 2 for the CRLF after the chunk, 3 for the empty last chunk */
+  out_size = connection->write_buffer_size - sizeof (cbuf) - 2 - 3;
+  if (out_size > 0xFFFFFF)
+    out_size = 0xFFFFFF;
+  out_len = 0;
+  finished = MHD_NO;
+  while ( (out_len < out_size) &&
+          (MHD_NO == finished) )
     {
-      /* value was continued on the next line, see
-         http://www.jmarshall.com/easy/http/ */
-      last_len = strlen (last);
-      /* skip whitespace at start of 2nd line */
-      tmp = line;
-      while ((tmp[0] == ' ') || (tmp[0] == '\t'))
-        tmp++;
-      tmp_len = strlen (tmp);
-      /* FIXME: we might be able to do this better (faster!), as most
-	 likely 'last' and 'line' should already be adjacent in
-	 memory; however, doing this right gets tricky if we have a
-	 value continued over multiple lines (in which case we need to
-	 record how often we have done this so we can check for
-	 adjaency); also, in the case where these are not adjacent
-	 (not sure how it can happen!), we would want to allocate from
-	 the end of the pool, so as to not destroy the read-buffer's
-	 ability to grow nicely. */
-      last = MHD_pool_reallocate (connection->pool,
-                                  last,
-                                  last_len + 1,
-                                  last_len + tmp_len + 1);
-      if (NULL == last)
+      in = NULL;
+      in_len = 0;
+      flush = MHD_COMPRESS_NO_FLUSH;
+      if (MHD_YES == connection->compress_input_done)
         {
-          transmit_error_response (connection,
-                                   MHD_HTTP_REQUEST_ENTITY_TOO_LARGE,
-                                   REQUEST_TOO_BIG);
+          flush = MHD_COMPRESS_FINISH;
+        }
+      else if (connection->response_write_position == response->total_size)
+        {
+          connection->compress_input_done = MHD_YES;
+          continue;
+        }
+      else if ( (response->data_start <=
+                 connection->response_write_position) &&
+                (response->data_start + response->data_size >
+                 connection->response_write_position) )
+        {
+          /* difference is less than data_size, see try_ready_chunked_body() */
+          in = &response->data[(size_t) (connection->response_write_position -
+                                         response->data_start)];
+          in_len = (size_t) (response->data_start + response->data_size -
+                             connection->response_write_position);
+        }
+      else
+        {
+          ret = call_content_reader (connection,
+                                     response->data,
+                                     (size_t) MHD_MIN ((uint64_t) response->data_buffer_size,
+                                                       response->total_size -
+                                                       connection->response_write_position));
+          if ( ((ssize_t) MHD_CONTENT_READER_END_WITH_ERROR) == ret)
+            {
+              CONNECTION_CLOSE_ERROR (connection,
+                                      "Closing connection (error generating response)\n");
+              return MHD_NO;
+            }
+          if ( ((ssize_t) MHD_CONTENT_READER_END_OF_STREAM) == ret)
+            {
+              connection->compress_input_done = MHD_YES;
+              continue;
+            }
+          if (0 == ret)
+            {
+              /* body stalls, push out what we have so far */
+              flush = MHD_COMPRESS_SYNC_FLUSH;
+            }
+          else
+            {
+              response->data_start = connection->response_write_position;
+              response->data_size = ret;
+              in = response->data;
+              in_len = ret;
+            }
+        }
+      len = out_size - out_len;
+      ret = MHD_compressor_run_ (connection->compressor,
+                                 in,
+                                 &in_len,
+                                 &out[out_len],
+                                 &len,
+                                 flush);
+      if (-1 == ret)
+        {
+          CONNECTION_CLOSE_ERROR (connection,
+                                  "Closing connection (compression failed)\n");
           return MHD_NO;
         }
-      memcpy (&last[last_len], tmp, tmp_len + 1);
-      connection->last = last;
-      return MHD_YES;           /* possibly more than 2 lines... */
+      connection->response_write_position += in_len;
+      out_len += len;
+      if (MHD_YES == ret)
+        finished = MHD_YES;
+      if (MHD_COMPRESS_SYNC_FLUSH == flush)
+        break;
     }
-  EXTRA_CHECK ((NULL != last) && (NULL != connection->colon));
-  if ((MHD_NO == connection_add_header (connection,
-                                        last,
-					connection->colon,
-					kind)))
+  if ( (0 == out_len) &&
+       (MHD_NO == finished) )
     {
-      transmit_error_response (connection, MHD_HTTP_REQUEST_ENTITY_TOO_LARGE,
-                               REQUEST_TOO_BIG);
+      connection->state = MHD_CONNECTION_CHUNKED_BODY_UNREADY;
       return MHD_NO;
     }
-  /* we still have the current line to deal with... */
-  if (0 != line[0])
+  off = sizeof (cbuf);
+  if (0 != out_len)
     {
-      if (MHD_NO == process_header_line (connection, line))
-        {
-          transmit_error_response (connection,
-                                   MHD_HTTP_BAD_REQUEST, REQUEST_MALFORMED);
-          return MHD_NO;
-        }
+      cblen = MHD_snprintf_(cbuf,
+                            sizeof (cbuf),
+                            "%X\r\n", (unsigned int) out_len);
+      EXTRA_CHECK(cblen > 0);
+      EXTRA_CHECK(cblen < sizeof(cbuf));
+      memcpy (&connection->write_buffer[sizeof (cbuf) - cblen], cbuf, cblen);
+      off -= cblen;
+      memcpy (&out[out_len], "\r\n", 2);
+    }
+  connection->write_buffer_send_offset = off;
+  connection->write_buffer_append_offset = sizeof (cbuf) + out_len
+    + ((0 != out_len) ? 2 : 0);
+  if (MHD_YES == finished)
+    {
+      memcpy (&connection->write_buffer[connection->write_buffer_append_offset],
+              "0\r\n",
+              3);
+      connection->write_buffer_append_offset += 3;
+      connection->compress_done = MHD_YES;
     }
   return MHD_YES;
 }
+#endif
 
 
 /**
- * Parse the various headers; figure out the size
- * of the upload and make sure the headers follow
- * the protocol.  Advance to the appropriate state.
+ * Can the next chunk of the response of @a connection be read into
+ * the scratch buffer of its daemon (see #MHD_OPTION_WRITE_SCRATCH_BUFFER)?
+ * Only plain sockets qualify (TLS must be able to resend the same
+ * buffer) and only if no other thread uses the scratch buffer.
  *
- * @param connection connection we're processing
+ * @param connection the connection
+ * @return #MHD_YES if the scratch buffer can be used
  */
-static void
-parse_connection_headers (struct MHD_Connection *connection)
+static int
+can_use_write_scratch (struct MHD_Connection *connection)
 {
-  const char *clen;
-  MHD_UNSIGNED_LONG_LONG cval;
-  struct MHD_Response *response;
-  const char *enc;
-  char *end;
+  struct MHD_Daemon *daemon = connection->daemon;
 
-  parse_cookie_header (connection);
-  if ( (0 != (MHD_USE_PEDANTIC_CHECKS & connection->daemon->options)) &&
-       (NULL != connection->version) &&
-       (MHD_str_equal_caseless_(MHD_HTTP_VERSION_1_1, connection->version)) &&
-       (NULL ==
-        MHD_lookup_connection_value (connection,
-                                     MHD_HEADER_KIND,
-                                     MHD_HTTP_HEADER_HOST)) )
-    {
-      /* die, http 1.1 request without host and we are pedantic */
-      connection->state = MHD_CONNECTION_FOOTERS_RECEIVED;
-      connection->read_closed = MHD_YES;
-#ifdef HAVE_MESSAGES
-      MHD_DLOG (connection->daemon,
-                "Received `%s' request without `%s' header.\n",
-                MHD_HTTP_VERSION_1_1, MHD_HTTP_HEADER_HOST);
+  if ( (0 == daemon->write_scratch_size) ||
+       (0 != (daemon->options & (MHD_USE_THREAD_PER_CONNECTION |
+                                 MHD_USE_SSL))) )
+    return MHD_NO;
+#if HAVE_ZLIB
+  if (NULL != connection->compressor)
+    return MHD_NO;
 #endif
-      EXTRA_CHECK (NULL == connection->response);
-      response =
-        MHD_create_response_from_buffer (strlen (REQUEST_LACKS_HOST),
-					 REQUEST_LACKS_HOST,
-					 MHD_RESPMEM_PERSISTENT);
-      MHD_queue_response (connection, MHD_HTTP_BAD_REQUEST, response);
-      MHD_destroy_response (response);
-      return;
-    }
-
-  connection->remaining_upload_size = 0;
-  enc = MHD_lookup_connection_value (connection,
-				     MHD_HEADER_KIND,
-				     MHD_HTTP_HEADER_TRANSFER_ENCODING);
-  if (NULL != enc)
-    {
-      connection->remaining_upload_size = MHD_SIZE_UNKNOWN;
-      if (MHD_str_equal_caseless_(enc, "chunked"))
-        connection->have_chunked_upload = MHD_YES;
-    }
-  else
+  if (NULL == daemon->write_scratch)
     {
-      clen = MHD_lookup_connection_value (connection,
-					  MHD_HEADER_KIND,
-					  MHD_HTTP_HEADER_CONTENT_LENGTH);
-      if (NULL != clen)
-        {
-          cval = strtoul (clen, &end, 10);
-          if ( ('\0' != *end) ||
-	     ( (LONG_MAX == cval) && (errno == ERANGE) ) )
-            {
-#ifdef HAVE_MESSAGES
-              MHD_DLOG (connection->daemon,
-                        "Failed to parse `%s' header `%s', closing connection.\n",
-                        MHD_HTTP_HEADER_CONTENT_LENGTH,
-                        clen);
-#endif
-	      CONNECTION_CLOSE_ERROR (connection, NULL);
-              return;
-            }
-          connection->remaining_upload_size = cval;
-        }
+      daemon->write_scratch = malloc (daemon->write_scratch_size);
+      if (NULL == daemon->write_scratch)
+        return MHD_NO;
     }
+  return MHD_YES;
 }
 
 
 /**
- * Update the 'last_activity' field of the connection to the current time
- * and move the connection to the head of the 'normal_timeout' list if
- * the timeout for the connection uses the default value.
+ * Send the chunk prepared in the scratch buffer of the daemon right
+ * away.  Whatever the socket does not take is copied into the memory
+ * pool of @a connection and becomes its write buffer.
  *
- * @param connection the connection that saw some activity
+ * @param connection the connection, its write buffer points to
+ *        the scratch buffer
+ * @return #MHD_NO if the connection was closed
  */
-static void
-update_last_activity (struct MHD_Connection *connection)
+static int
+send_write_scratch (struct MHD_Connection *connection)
 {
-  struct MHD_Daemon *daemon = connection->daemon;
+  const char *scratch = connection->write_buffer;
+  size_t off = connection->write_buffer_send_offset;
+  size_t len = connection->write_buffer_append_offset - off;
+  ssize_t ret;
+  char *spill;
 
-  connection->last_activity = MHD_monotonic_sec_counter();
-  if (connection->connection_timeout != daemon->connection_timeout)
-    return; /* custom timeout, no need to move it in "normal" DLL */
+  connection->write_buffer = NULL;
+  connection->write_buffer_size = 0;
+  connection->write_buffer_send_offset = 0;
+  connection->write_buffer_append_offset = 0;
+  ret = connection->send_cls (connection,
+                              &scratch[off],
+                              len);
+  if (ret < 0)
+    {
+      const int err = MHD_socket_errno_;
 
-  /* move connection to head of timeout list (by remove + add operation) */
-  if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
-       (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex)) )
-    MHD_PANIC ("Failed to acquire cleanup mutex\n");
-  XDLL_remove (daemon->normal_timeout_head,
-	       daemon->normal_timeout_tail,
-	       connection);
-  XDLL_insert (daemon->normal_timeout_head,
-	       daemon->normal_timeout_tail,
-	       connection);
-  if  ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
-	(MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex)) )
-    MHD_PANIC ("Failed to release cleanup mutex\n");
+      if ( (EINTR != err) && (EAGAIN != err) && (EWOULDBLOCK != err) )
+        {
+          CONNECTION_CLOSE_ERROR (connection, NULL);
+          return MHD_NO;
+        }
+      ret = 0;
+    }
+  if (len == (size_t) ret)
+    return MHD_YES;
+  spill = MHD_pool_allocate (connection->pool,
+                             len - ret,
+                             MHD_NO);
+  if (NULL == spill)
+    {
+      MHD_STATS_ADD_ (connection->daemon, pool_fail_write_buffer, 1);
+      CONNECTION_CLOSE_ERROR (connection,
+                              "Closing connection (out of memory)\n");
+      return MHD_NO;
+    }
+  memcpy (spill, &scratch[off + ret], len - ret);
+  connection->write_buffer = spill;
+  connection->write_buffer_size = len - ret;
+  connection->write_buffer_append_offset = len - ret;
+  return MHD_YES;
 }
 
 
 /**
- * This function handles a particular connection when it has been
- * determined that there is data to be read off a socket.
+ * Prepare the response buffer of this connection for sending.
+ * Assumes that the response mutex is already held.  If the
+ * transmission is complete, this function may close the socket (and
+ * return MHD_NO).
  *
- * @param connection connection to handle
- * @return always #MHD_YES (we should continue to process the
- *         connection)
+ * @param connection the connection
+ * @return #MHD_NO if readying the response failed
  */
-int
-MHD_connection_handle_read (struct MHD_Connection *connection)
+static int
+try_ready_chunked_body (struct MHD_Connection *connection)
 {
-  update_last_activity (connection);
-  if (MHD_CONNECTION_CLOSED == connection->state)
-    return MHD_YES;
-  /* make sure "read" has a reasonable number of bytes
-     in buffer to use per system call (if possible) */
-  if (connection->read_buffer_offset + connection->daemon->pool_increment >
-      connection->read_buffer_size)
-    try_grow_read_buffer (connection);
-  if (MHD_NO == do_read (connection))
-    return MHD_YES;
-  while (1)
+  ssize_t ret;
+  char *buf;
+  struct MHD_Response *response;
+  size_t size;
+  char cbuf[10];                /* 10: max strlen of "%x\r\n" */
+  int cblen;
+  int scratch;
+#if HAVE_SENDMSG
+  int vectored;
+#endif
+
+  response = connection->response;
+  scratch = MHD_NO;
+  if (0 == connection->write_buffer_size)
+    scratch = can_use_write_scratch (connection);
+#if HAVE_SENDMSG
+  ret = 0;
+  /* with the scratch buffer, the data buffer of the response is
+     not used (nor kept resident) for the chunks */
+  vectored = (MHD_YES == scratch) ? MHD_NO : can_send_chunk_vectored (connection);
+  if (MHD_YES == vectored)
     {
-#if DEBUG_STATES
-      MHD_DLOG (connection->daemon, "%s: state: %s\n",
-                __FUNCTION__,
-                MHD_state_to_string (connection->state));
+      /* the chunk is sent from the data buffer of the response,
+         only its framing is kept with the connection */
+      ret = fill_chunk_data (connection,
+                             0xFFFFFF);
+      if (0 == ret)
+        {
+          connection->state = MHD_CONNECTION_CHUNKED_BODY_UNREADY;
+          return MHD_NO;
+        }
+      if (ret > 0)
+        {
+          cblen = MHD_snprintf_ (connection->chunk_header,
+                                 sizeof (connection->chunk_header),
+                                 "%X\r\n", (unsigned int) ret);
+          EXTRA_CHECK(cblen > 0);
+          EXTRA_CHECK(cblen < sizeof(connection->chunk_header));
+          connection->chunk_header_len = cblen;
+          connection->chunk_size = ret;
+          connection->chunk_sent = 0;
+          return MHD_YES;
+        }
+      /* end of stream or error, handled below */
+    }
 #endif
-      switch (connection->state)
+  if (MHD_YES == scratch)
+    {
+      size = MHD_MIN (connection->daemon->write_scratch_size,
+                      0xFFFFFF + sizeof (cbuf) + 2);
+      /* what the socket does not take must fit into the pool,
+         including the rounding of the pool to its alignment */
+      if (MHD_pool_get_free (connection->pool) < 2 * sizeof (void *))
+        size = 0;
+      else
+        size = MHD_MIN (size,
+                        MHD_pool_get_free (connection->pool) - 2 * sizeof (void *));
+      if (size < 128)
         {
-        case MHD_CONNECTION_INIT:
-        case MHD_CONNECTION_URL_RECEIVED:
-        case MHD_CONNECTION_HEADER_PART_RECEIVED:
-        case MHD_CONNECTION_HEADERS_RECEIVED:
-        case MHD_CONNECTION_HEADERS_PROCESSED:
-        case MHD_CONNECTION_CONTINUE_SENDING:
-        case MHD_CONNECTION_CONTINUE_SENT:
-        case MHD_CONNECTION_BODY_RECEIVED:
-        case MHD_CONNECTION_FOOTER_PART_RECEIVED:
-          /* nothing to do but default action */
-          if (MHD_YES == connection->read_closed)
+          CONNECTION_CLOSE_ERROR (connection,
+                                  "Closing connection (out of memory)\n");
+          return MHD_NO;
+        }
+      /* borrowed until the chunk is sent, see send_write_scratch() */
+      connection->write_buffer = connection->daemon->write_scratch;
+      connection->write_buffer_size = size;
+    }
+  if (0 == connection->write_buffer_size)
+    {
+      size = MHD_MIN(connection->daemon->pool_size, 2 * (0xFFFFFF + sizeof(cbuf) + 2));
+      do
+        {
+          size /= 2;
+          if (size < 128)
             {
-	      MHD_connection_close_ (connection,
-                                     MHD_REQUEST_TERMINATED_READ_ERROR);
-              continue;
+              /* not enough memory */
+              CONNECTION_CLOSE_ERROR (connection,
+				      "Closing connection (out of memory)\n");
+              return MHD_NO;
             }
-          break;
-        case MHD_CONNECTION_CLOSED:
-          return MHD_YES;
-        default:
-          /* shrink read buffer to how much is actually used */
-          MHD_pool_reallocate (connection->pool,
-                               connection->read_buffer,
-                               connection->read_buffer_size + 1,
-                               connection->read_buffer_offset);
-          break;
+          buf = MHD_pool_allocate (connection->pool, size, MHD_NO);
+          if (NULL == buf)
+            MHD_STATS_ADD_ (connection->daemon, pool_fail_write_buffer, 1);
         }
-      break;
+      while (NULL == buf);
+      connection->write_buffer_size = size;
+      connection->write_buffer = buf;
+    }
+#if HAVE_ZLIB
+  if (NULL != connection->compressor)
+    return try_ready_compressed_body (connection);
+#endif
+
+#if HAVE_SENDMSG
+  if (MHD_YES == vectored)
+    {
+      /* 'ret' is already set */
     }
+  else
+#endif
+  if (0 == response->total_size)
+    ret = 0; /* response must be empty, don't bother calling crc */
+  else if ( (response->data_start <=
+	connection->response_write_position) &&
+       (response->data_start + response->data_size >
+	connection->response_write_position) )
+    {
+      /* difference between response_write_position and data_start is less
+         than data_size which is size_t type, no need to check for overflow */
+      const size_t data_write_offset = (size_t)(connection->response_write_position - response->data_start);
+      /* buffer already ready, use what is there for the chunk */
+      ret = response->data_size - data_write_offset;
+      if ( ((size_t) ret) > connection->write_buffer_size - sizeof (cbuf) - 2 )
+	ret = connection->write_buffer_size - sizeof (cbuf) - 2;
+      memcpy (&connection->write_buffer[sizeof (cbuf)],
+              &response->data[data_write_offset], ret);
+    }
+  else
+    {
+      /* buffer not in range, try to fill it */
+      ret = call_content_reader (connection,
+                                 &connection->write_buffer[sizeof (cbuf)],
+                                 connection->write_buffer_size - sizeof (cbuf) - 2);
+    }
+  if ( (MHD_YES == scratch) &&
+       ( (0 == ret) ||
+         (((ssize_t) MHD_CONTENT_READER_END_WITH_ERROR) == ret) ) )
+    {
+      /* other connections may use the scratch buffer meanwhile */
+      connection->write_buffer = NULL;
+      connection->write_buffer_size = 0;
+    }
+  if ( ((ssize_t) MHD_CONTENT_READER_END_WITH_ERROR) == ret)
+    {
+      /* error, close socket! */
+      response->total_size = connection->response_write_position;
+      CONNECTION_CLOSE_ERROR (connection,
+			      "Closing connection (error generating response)\n");
+      return MHD_NO;
+    }
+  if ( (((ssize_t) MHD_CONTENT_READER_END_OF_STREAM) == ret) ||
+       (0 == response->total_size) )
+    {
+      /* end of message, signal other side! */
+      strcpy (connection->write_buffer, "0\r\n");
+      connection->write_buffer_append_offset = 3;
+      connection->write_buffer_send_offset = 0;
+      response->total_size = connection->response_write_position;
+      if (MHD_YES == scratch)
+        return send_write_scratch (connection);
+      return MHD_YES;
+    }
+  if (0 == ret)
+    {
+      connection->state = MHD_CONNECTION_CHUNKED_BODY_UNREADY;
+      return MHD_NO;
+    }
+  if (ret > 0xFFFFFF)
+    ret = 0xFFFFFF;
+  cblen = MHD_snprintf_(cbuf,
+	    sizeof (cbuf),
+	    "%X\r\n", (unsigned int) ret);
+  EXTRA_CHECK(cblen > 0);
+  EXTRA_CHECK(cblen < sizeof(cbuf));
+  memcpy (&connection->write_buffer[sizeof (cbuf) - cblen], cbuf, cblen);
+  memcpy (&connection->write_buffer[sizeof (cbuf) + ret], "\r\n", 2);
+  connection->response_write_position += ret;
+  connection->write_buffer_send_offset = sizeof (cbuf) - cblen;
+  connection->write_buffer_append_offset = sizeof (cbuf) + ret + 2;
+  if (MHD_YES == scratch)
+    return send_write_scratch (connection);
   return MHD_YES;
 }
 
 
 /**
- * This function was created to handle writes to sockets when it has
- * been determined that the socket can be written to.
+ * Are we allowed to keep the given connection alive?  We can use the
+ * TCP stream for a second request if the connection is HTTP 1.1 and
+ * the "Connection" header either does not exist or is not set to
+ * "close", or if the connection is HTTP 1.0 and the "Connection"
+ * header is explicitly set to "keep-alive".  If no HTTP version is
+ * specified (or if it is not 1.0 or 1.1), we definitively close the
+ * connection.  If the "Connection" header is not exactly "close" or
+ * "keep-alive", we proceed to use the default for the respective HTTP
+ * version (which is conservative for HTTP 1.0, but might be a bit
+ * optimistic for HTTP 1.1).
  *
- * @param connection connection to handle
- * @return always #MHD_YES (we should continue to process the
- *         connection)
+ * @param connection the connection to check for keepalive
+ * @return #MHD_YES if (based on the request), a keepalive is
+ *        legal
  */
-int
-MHD_connection_handle_write (struct MHD_Connection *connection)
+static int
+keepalive_possible (struct MHD_Connection *connection)
 {
-  struct MHD_Response *response;
-  ssize_t ret;
+  const char *end;
 
-  update_last_activity (connection);
-  while (1)
-    {
-#if DEBUG_STATES
-      MHD_DLOG (connection->daemon, "%s: state: %s\n",
-                __FUNCTION__,
-                MHD_state_to_string (connection->state));
-#endif
-      switch (connection->state)
-        {
-        case MHD_CONNECTION_INIT:
-        case MHD_CONNECTION_URL_RECEIVED:
-        case MHD_CONNECTION_HEADER_PART_RECEIVED:
-        case MHD_CONNECTION_HEADERS_RECEIVED:
-          EXTRA_CHECK (0);
-          break;
-        case MHD_CONNECTION_HEADERS_PROCESSED:
-          break;
-        case MHD_CONNECTION_CONTINUE_SENDING:
-          ret = connection->send_cls (connection,
-                                      &HTTP_100_CONTINUE
-                                      [connection->continue_message_write_offset],
-                                      strlen (HTTP_100_CONTINUE) -
-                                      connection->continue_message_write_offset);
-          if (ret < 0)
-            {
-              const int err = MHD_socket_errno_;
-              if ((err == EINTR) || (err == EAGAIN) || (EWOULDBLOCK == err))
-                break;
-#ifdef HAVE_MESSAGES
-              MHD_DLOG (connection->daemon,
-                        "Failed to send data: %s\n",
-                        MHD_socket_last_strerr_ ());
-#endif
-	      CONNECTION_CLOSE_ERROR (connection, NULL);
-              return MHD_YES;
-            }
-#if DEBUG_SEND_DATA
-          fprintf (stderr,
-                   "Sent 100 continue response: `%.*s'\n",
-                   (int) ret,
-                   &HTTP_100_CONTINUE[connection->continue_message_write_offset]);
-#endif
-          connection->continue_message_write_offset += ret;
-          break;
-        case MHD_CONNECTION_CONTINUE_SENT:
-        case MHD_CONNECTION_BODY_RECEIVED:
-        case MHD_CONNECTION_FOOTER_PART_RECEIVED:
-        case MHD_CONNECTION_FOOTERS_RECEIVED:
-          EXTRA_CHECK (0);
-          break;
-        case MHD_CONNECTION_HEADERS_SENDING:
-          do_write (connection);
-	  if (connection->state != MHD_CONNECTION_HEADERS_SENDING)
- 	     break;
-          check_write_done (connection, MHD_CONNECTION_HEADERS_SENT);
-          break;
-        case MHD_CONNECTION_HEADERS_SENT:
-          EXTRA_CHECK (0);
-          break;
-        case MHD_CONNECTION_NORMAL_BODY_READY:
-          response = connection->response;
-          if (connection->response_write_position <
-              connection->response->total_size)
-          {
-            int err;
-            uint64_t data_write_offset;
-            if (NULL != response->crc)
-              (void) MHD_mutex_lock_ (&response->mutex);
-            if (MHD_YES != try_ready_normal_body (connection))
-              break;
-            data_write_offset = connection->response_write_position
-                                - response->data_start;
-            if (data_write_offset > (uint64_t)SIZE_MAX)
-              MHD_PANIC("Data offset exceeds limit");
-            ret = connection->send_cls (connection,
-                                        &response->data
-                                        [(size_t)data_write_offset],
-                                        response->data_size -
-                                        (size_t)data_write_offset);
-            err = MHD_socket_errno_;
-#if DEBUG_SEND_DATA
-            if (ret > 0)
-              fprintf (stderr,
-                       "Sent %d-byte DATA response: `%.*s'\n",
-                       (int) ret,
-                       (int) ret,
-                       &response->data[connection->response_write_position -
-                                       response->data_start]);
-#endif
-            if (NULL != response->crc)
-              (void) MHD_mutex_unlock_ (&response->mutex);
-            if (ret < 0)
-              {
-                if ((err == EINTR) || (err == EAGAIN) || (EWOULDBLOCK == err))
-                  return MHD_YES;
-#ifdef HAVE_MESSAGES
-                MHD_DLOG (connection->daemon,
-                          "Failed to send data: %s\n",
-                          MHD_socket_last_strerr_ ());
+  if (NULL == connection->version)
+    return MHD_NO;
+  if ( (NULL != connection->response) &&
+       (0 != (connection->response->flags & MHD_RF_HTTP_VERSION_1_0_ONLY) ) )
+    return MHD_NO;
+  if (MHD_YES == connection->daemon->draining)
+    return MHD_NO;
+  end = MHD_lookup_connection_token_value (connection,
+                                           MHD_HEADER_KIND,
+                                           MHD_HEADER_TOKEN_CONNECTION);
+  if (MHD_str_equal_caseless_(connection->version,
+                       MHD_HTTP_VERSION_1_1))
+  {
+    if (NULL == end)
+      return MHD_YES;
+    if ( (MHD_str_equal_caseless_ (end, "close")) ||
+         (MHD_str_equal_caseless_ (end, "upgrade")) )
+      return MHD_NO;
+   return MHD_YES;
+  }
+  if (MHD_str_equal_caseless_(connection->version,
+                       MHD_HTTP_VERSION_1_0))
+  {
+    if (NULL == end)
+      return MHD_NO;
+    if (MHD_str_equal_caseless_(end, "Keep-Alive"))
+      return MHD_YES;
+    return MHD_NO;
+  }
+  return MHD_NO;
+}
+
+
+/**
+ * Produce HTTP "Date:" header.
+ *
+ * @param date where to write the header, with
+ *        at least 128 bytes available space.
+ */
+static void
+get_date_string (char *date)
+{
+  static const char *const days[] =
+    { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+  static const char *const mons[] =
+    { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct",
+    "Nov", "Dec"
+  };
+  struct tm now;
+  time_t t;
+#if !defined(HAVE_C11_GMTIME_S) && !defined(HAVE_W32_GMTIME_S) && !defined(HAVE_GMTIME_R)
+  struct tm* pNow;
 #endif
-                CONNECTION_CLOSE_ERROR (connection, NULL);
-                return MHD_YES;
-              }
-            connection->response_write_position += ret;
-          }
-          if (connection->response_write_position ==
-              connection->response->total_size)
-            connection->state = MHD_CONNECTION_FOOTERS_SENT; /* have no footers */
-          break;
-        case MHD_CONNECTION_NORMAL_BODY_UNREADY:
-          EXTRA_CHECK (0);
-          break;
-        case MHD_CONNECTION_CHUNKED_BODY_READY:
-          do_write (connection);
-	  if (MHD_CONNECTION_CHUNKED_BODY_READY != connection->state)
-	     break;
-          check_write_done (connection,
-                            (connection->response->total_size ==
-                             connection->response_write_position) ?
-                            MHD_CONNECTION_BODY_SENT :
-                            MHD_CONNECTION_CHUNKED_BODY_UNREADY);
-          break;
-        case MHD_CONNECTION_CHUNKED_BODY_UNREADY:
-        case MHD_CONNECTION_BODY_SENT:
-          EXTRA_CHECK (0);
-          break;
-        case MHD_CONNECTION_FOOTERS_SENDING:
-          do_write (connection);
-	  if (connection->state != MHD_CONNECTION_FOOTERS_SENDING)
-	    break;
-          check_write_done (connection, MHD_CONNECTION_FOOTERS_SENT);
-          break;
-        case MHD_CONNECTION_FOOTERS_SENT:
-          EXTRA_CHECK (0);
-          break;
-        case MHD_CONNECTION_CLOSED:
-          return MHD_YES;
-        case MHD_TLS_CONNECTION_INIT:
-          EXTRA_CHECK (0);
-          break;
-        default:
-          EXTRA_CHECK (0);
-	  CONNECTION_CLOSE_ERROR (connection,
-                                  "Internal error\n");
-          return MHD_YES;
-        }
-      break;
+
+  date[0] = 0;
+  time (&t);
+#if defined(HAVE_C11_GMTIME_S)
+  if (NULL == gmtime_s (&t, &now))
+    return;
+#elif defined(HAVE_W32_GMTIME_S)
+  if (0 != gmtime_s (&now, &t))
+    return;
+#elif defined(HAVE_GMTIME_R)
+  if (NULL == gmtime_r(&t, &now))
+    return;
+#else
+  pNow = gmtime(&t);
+  if (NULL == pNow)
+    return;
+  now = *pNow;
+#endif
+  sprintf (date,
+             "Date: %3s, %02u %3s %04u %02u:%02u:%02u GMT\r\n",
+             days[now.tm_wday % 7],
+             (unsigned int) now.tm_mday,
+             mons[now.tm_mon % 12],
+             (unsigned int) (1900 + now.tm_year),
+             (unsigned int) now.tm_hour,
+             (unsigned int) now.tm_min,
+             (unsigned int) now.tm_sec);
+}
+
+
+/**
+ * Produce HTTP "Date:" header, re-using the daemon's cached string if
+ * it was generated during the current second.  In thread-per-connection
+ * mode the cache would be shared between threads, so there the header
+ * is always generated from scratch.
+ *
+ * @param daemon daemon the header is generated for
+ * @param date where to write the header, with
+ *        at least 128 bytes available space.
+ */
+void
+MHD_get_cached_date_string_ (struct MHD_Daemon *daemon,
+                             char *date)
+{
+  time_t now;
+
+  if (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
+    {
+      get_date_string (date);
+      return;
     }
-  return MHD_YES;
+  /* the header shows the wall clock, so the monotonic loop time
+     (with its own second boundaries) cannot tell when it changes */
+  now = time (NULL);
+  if ( ('\0' == daemon->date_cache[0]) ||
+       (now != daemon->date_cache_time) )
+    {
+      get_date_string (daemon->date_cache);
+      daemon->date_cache_len = strlen (daemon->date_cache);
+      daemon->date_cache_time = now;
+    }
+  memcpy (date,
+          daemon->date_cache,
+          daemon->date_cache_len + 1);
 }
 
 
 /**
- * Clean up the state of the given connection and move it into the
- * clean up queue for final disposal.
+ * Get the size the read buffer of a request starts at: half of the
+ * pool or, with #MHD_OPTION_ADAPTIVE_READ_BUFFER, the estimate of
+ * the header sizes seen by the daemon.
  *
- * @param connection handle for the connection to clean up
+ * @param connection the connection
+ * @return initial size of the read buffer
+ */
+static size_t
+initial_read_buffer_size (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+  size_t estimate;
+
+  if (0 == daemon->header_size_percentile)
+    return daemon->pool_size / 2;
+#ifdef HAVE_ATOMIC_BUILTINS
+  estimate = __atomic_load_n (&daemon->header_size_estimate,
+                              __ATOMIC_RELAXED);
+#else
+  estimate = daemon->header_size_estimate;
+#endif
+  if (0 == estimate)
+    return daemon->pool_size / 2;
+  /* the read handler grows the buffer below one read of
+     @e pool_increment bytes anyway */
+  estimate = MHD_MAX (estimate, daemon->pool_increment);
+  return MHD_MIN (estimate, daemon->pool_size / 2);
+}
+
+
+/**
+ * Count the header size of the request of @a connection in the
+ * histogram of its daemon and update the estimate of the initial
+ * read buffer size, see #MHD_OPTION_ADAPTIVE_READ_BUFFER.
+ *
+ * @param connection connection that received all request headers
  */
 static void
-cleanup_connection (struct MHD_Connection *connection)
+count_header_size (struct MHD_Connection *connection)
 {
   struct MHD_Daemon *daemon = connection->daemon;
+  unsigned int *counts = daemon->header_size_counts;
+  unsigned int samples;
+  unsigned int sum;
+  unsigned int i;
 
-  if (NULL != connection->response)
+  if (0 == daemon->header_size_percentile)
+    return;
+  i = 0;
+  while ( (i < MHD_HEADER_SIZE_CLASSES - 1) &&
+          (connection->header_size > ((size_t) 256 << i)) )
+    i++;
+#ifdef HAVE_ATOMIC_BUILTINS
+  __atomic_add_fetch (&counts[i], 1, __ATOMIC_RELAXED);
+  samples = __atomic_add_fetch (&daemon->header_size_samples, 1,
+                                __ATOMIC_RELAXED);
+#else
+  counts[i]++;
+  samples = ++daemon->header_size_samples;
+#endif
+  if (samples >= MHD_HEADER_SIZE_WINDOW)
     {
-      MHD_destroy_response (connection->response);
-      connection->response = NULL;
+      /* let older requests count half; counts of concurrent
+         requests may get lost, the estimate does not need them */
+      samples = 0;
+      for (i = 0; i < MHD_HEADER_SIZE_CLASSES; i++)
+        {
+#ifdef HAVE_ATOMIC_BUILTINS
+          sum = __atomic_load_n (&counts[i], __ATOMIC_RELAXED) / 2;
+          __atomic_store_n (&counts[i], sum, __ATOMIC_RELAXED);
+#else
+          sum = counts[i] / 2;
+          counts[i] = sum;
+#endif
+          samples += sum;
+        }
+#ifdef HAVE_ATOMIC_BUILTINS
+      __atomic_store_n (&daemon->header_size_samples, samples,
+                        __ATOMIC_RELAXED);
+#else
+      daemon->header_size_samples = samples;
+#endif
     }
-  if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
-       (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex)) )
-    MHD_PANIC ("Failed to acquire cleanup mutex\n");
-  if (connection->connection_timeout == daemon->connection_timeout)
-    XDLL_remove (daemon->normal_timeout_head,
-		 daemon->normal_timeout_tail,
-		 connection);
-  else
-    XDLL_remove (daemon->manual_timeout_head,
-		 daemon->manual_timeout_tail,
-		 connection);
-  if (MHD_YES == connection->suspended)
-    DLL_remove (daemon->suspended_connections_head,
-                daemon->suspended_connections_tail,
-                connection);
-  else
-    DLL_remove (daemon->connections_head,
-                daemon->connections_tail,
-                connection);
-  DLL_insert (daemon->cleanup_head,
-	      daemon->cleanup_tail,
-	      connection);
-  connection->suspended = MHD_NO;
-  connection->resuming = MHD_NO;
-  connection->in_idle = MHD_NO;
-  if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
-       (MHD_YES != MHD_mutex_unlock_(&daemon->cleanup_connection_mutex)) )
-    MHD_PANIC ("Failed to release cleanup mutex\n");
+  if (samples < MHD_HEADER_SIZE_MIN_SAMPLES)
+    return;
+  /* the smallest size class holding the percentile of the headers */
+  sum = 0;
+  for (i = 0; i < MHD_HEADER_SIZE_CLASSES - 1; i++)
+    {
+#ifdef HAVE_ATOMIC_BUILTINS
+      sum += __atomic_load_n (&counts[i], __ATOMIC_RELAXED);
+#else
+      sum += counts[i];
+#endif
+      if ((uint64_t) sum * 100 >=
+          (uint64_t) samples * daemon->header_size_percentile)
+        break;
+    }
+#ifdef HAVE_ATOMIC_BUILTINS
+  __atomic_store_n (&daemon->header_size_estimate,
+                    (size_t) 256 << i,
+                    __ATOMIC_RELAXED);
+#else
+  daemon->header_size_estimate = (size_t) 256 << i;
+#endif
 }
 
 
 /**
- * This function was created to handle per-connection processing that
- * has to happen even if the socket cannot be read or written to.
+ * Take @a size bytes from the header overflow arena of @a daemon.
  *
- * @param connection connection to handle
- * @return #MHD_YES if we should continue to process the
- *         connection (not dead yet), #MHD_NO if it died
+ * @param daemon daemon (or worker) lending the memory
+ * @param size number of bytes to take
+ * @return #MHD_YES on success, #MHD_NO if the arena is exhausted
  */
-int
-MHD_connection_handle_idle (struct MHD_Connection *connection)
+static int
+overflow_take (struct MHD_Daemon *daemon,
+               size_t size)
+{
+  if (size > daemon->header_overflow_limit)
+    return MHD_NO;
+#ifdef HAVE_ATOMIC_BUILTINS
+  if (__atomic_add_fetch (&daemon->header_overflow_used,
+                          size,
+                          __ATOMIC_RELAXED) <= daemon->header_overflow_limit)
+    return MHD_YES;
+  (void) __atomic_sub_fetch (&daemon->header_overflow_used,
+                             size,
+                             __ATOMIC_RELAXED);
+  return MHD_NO;
+#else
+  if (daemon->header_overflow_used + size > daemon->header_overflow_limit)
+    return MHD_NO;
+  daemon->header_overflow_used += size;
+  return MHD_YES;
+#endif
+}
+
+
+/**
+ * Move the read buffer of @a connection, which is receiving the
+ * headers of a request and ran out of pool, into a block borrowed
+ * from the header overflow arena of its daemon (see
+ * #MHD_OPTION_HEADER_OVERFLOW_ARENA).  The lines parsed so far stay
+ * where they are, so earlier blocks are kept until the request is
+ * complete.
+ *
+ * @param connection the connection
+ * @param new_size number of bytes the read buffer needs
+ * @return #MHD_YES on success, #MHD_NO if the arena is exhausted
+ *         (or not used)
+ */
+static int
+borrow_overflow (struct MHD_Connection *connection,
+                 size_t new_size)
 {
   struct MHD_Daemon *daemon = connection->daemon;
-  unsigned int timeout;
-  const char *end;
-  char *line;
-  int client_close;
+  struct MHD_OverflowBlock *block;
+  size_t size;
 
-  connection->in_idle = MHD_YES;
-  while (1)
+  if (0 == daemon->header_overflow_limit)
+    return MHD_NO;
+  /* take twice the buffer if possible, so that a large header does
+     not need a block per increment */
+  size = MHD_MAX (new_size,
+                  2 * connection->read_buffer_size);
+  if ( (MHD_NO == overflow_take (daemon,
+                                 size)) &&
+       (MHD_NO == overflow_take (daemon,
+                                 size = new_size)) )
+    return MHD_NO;
+  block = malloc (sizeof (struct MHD_OverflowBlock) + size);
+  if (NULL == block)
     {
-#if DEBUG_STATES
-      MHD_DLOG (daemon,
-                "%s: state: %s\n",
-                __FUNCTION__,
-                MHD_state_to_string (connection->state));
+#ifdef HAVE_ATOMIC_BUILTINS
+      (void) __atomic_sub_fetch (&daemon->header_overflow_used,
+                                 size,
+                                 __ATOMIC_RELAXED);
+#else
+      daemon->header_overflow_used -= size;
 #endif
-      switch (connection->state)
-        {
-        case MHD_CONNECTION_INIT:
-          line = get_next_header_line (connection);
-          /* Check for empty string, as we might want
-             to tolerate 'spurious' empty lines; also
-             NULL means we didn't get a full line yet. */
-          if ( (NULL == line) ||
-               (0 == line[0]) )
-            {
-              if (MHD_CONNECTION_INIT != connection->state)
-                continue;
+      return MHD_NO;
+    }
+  block->size = size;
+  block->next = connection->overflow;
+  memcpy (&block[1],
+          connection->read_buffer,
+          connection->read_buffer_offset);
+  if (NULL == connection->overflow)
+    {
+      /* the pool keeps what the buffer held for the headers */
+      (void) MHD_pool_reallocate (connection->pool,
+                                  connection->read_buffer,
+                                  connection->read_buffer_size,
+                                  0);
+      MHD_STATS_ADD_ (daemon, header_overflows, 1);
+    }
+  connection->overflow = block;
+  connection->read_buffer = (char *) &block[1];
+  connection->read_buffer_size = size;
+  return MHD_YES;
+}
+
+
+/**
+ * Return the blocks @a connection borrowed from the header overflow
+ * arena of its daemon, see #MHD_OPTION_HEADER_OVERFLOW_ARENA.  The
+ * read buffer must no longer be used afterwards.
+ *
+ * @param connection the connection
+ */
+void
+MHD_connection_overflow_release_ (struct MHD_Connection *connection)
+{
+  struct MHD_OverflowBlock *block;
+  size_t size;
+
+  size = 0;
+  while (NULL != (block = connection->overflow))
+    {
+      connection->overflow = block->next;
+      size += block->size;
+      free (block);
+    }
+  if (0 == size)
+    return;
+#ifdef HAVE_ATOMIC_BUILTINS
+  (void) __atomic_sub_fetch (&connection->daemon->header_overflow_used,
+                             size,
+                             __ATOMIC_RELAXED);
+#else
+  connection->daemon->header_overflow_used -= size;
+#endif
+}
+
+
+/**
+ * Try growing the read buffer.  We initially claim half the
+ * available buffer space for the read buffer (the other half
+ * being left for management data structures; the write
+ * buffer can in the end take virtually everything as the
+ * read buffer can be reduced to the minimum necessary at that
+ * point.  With #MHD_OPTION_ADAPTIVE_READ_BUFFER, the initial
+ * size follows the sizes of the request headers instead.
+ *
+ * @param connection the connection
+ * @return #MHD_YES on success, #MHD_NO on failure
+ */
+static int
+try_grow_read_buffer (struct MHD_Connection *connection)
+{
+  void *buf;
+  size_t new_size;
+
+  if (0 == connection->read_buffer_size)
+    new_size = initial_read_buffer_size (connection);
+  else
+    new_size = connection->read_buffer_size + MHD_BUF_INC_SIZE;
+  buf = MHD_pool_reallocate (connection->pool,
+                             connection->read_buffer,
+                             connection->read_buffer_size,
+                             new_size);
+  if (NULL == buf)
+    {
+      MHD_STATS_ADD_ (connection->daemon, pool_fail_read_buffer, 1);
+      if ( (MHD_CONNECTION_INIT == connection->state) ||
+           (MHD_CONNECTION_URL_RECEIVED == connection->state) ||
+           (MHD_CONNECTION_HEADER_PART_RECEIVED == connection->state) )
+        return borrow_overflow (connection,
+                                new_size);
+      return MHD_NO;
+    }
+  /* we can actually grow the buffer, do it! */
+  connection->read_buffer = buf;
+  connection->read_buffer_size = new_size;
+  return MHD_YES;
+}
+
+
+/**
+ * Length of the boundary of multipart/byteranges bodies.
+ */
+#define MHD_RANGE_BOUNDARY_LEN 19
+
+
+/**
+ * Format the boundary of the multipart/byteranges body of the
+ * response of @a connection.  The boundary only has to be unlikely to
+ * occur in the body, so we derive it from the response.
+ *
+ * @param connection connection that sends several ranges
+ * @param boundary buffer of at least #MHD_RANGE_BOUNDARY_LEN + 1 bytes
+ */
+static void
+format_range_boundary (struct MHD_Connection *connection,
+                       char *boundary)
+{
+  uint64_t id;
+
+  id = ((uint64_t) (uintptr_t) connection->response)
+    ^ (connection->response->total_size * 0x9E3779B97F4A7C15ULL);
+  sprintf (boundary,
+           "MHD%08X%08X",
+           (unsigned int) (id >> 32),
+           (unsigned int) (id & 0xFFFFFFFF));
+}
+
+
+/**
+ * Append @a len bytes of @a str at offset @a *off of @a buf, only
+ * advancing the offset if @a buf is NULL.
+ *
+ * @param buf buffer to write to, can be NULL
+ * @param off offset in @a buf, updated
+ * @param str data to append
+ * @param len number of bytes in @a str
+ */
+static void
+append_part_data (char *buf,
+                  size_t *off,
+                  const char *str,
+                  size_t len)
+{
+  if (NULL != buf)
+    memcpy (&buf[*off], str, len);
+  *off += len;
+}
+
+
+/**
+ * Format the header of the part of a multipart/byteranges body for
+ * range @a index of @a connection, including the delimiter that
+ * precedes it.
+ *
+ * @param connection connection that sends several ranges
+ * @param index index of the range in the ranges of @a connection
+ * @param buf buffer to write to, NULL to only compute the length
+ * @return length of the part header
+ */
+static size_t
+format_part_header (struct MHD_Connection *connection,
+                    unsigned int index,
+                    char *buf)
+{
+  const struct MHD_Range *range = &connection->ranges[index];
+  const char *content_type;
+  char boundary[MHD_RANGE_BOUNDARY_LEN + 1];
+  char content_range[96];
+  size_t content_range_len;
+  size_t off;
+
+  format_range_boundary (connection,
+                         boundary);
+  content_range_len
+    = sprintf (content_range,
+               "bytes " MHD_UNSIGNED_LONG_LONG_PRINTF "-" MHD_UNSIGNED_LONG_LONG_PRINTF "/" MHD_UNSIGNED_LONG_LONG_PRINTF,
+               (MHD_UNSIGNED_LONG_LONG) range->start,
+               (MHD_UNSIGNED_LONG_LONG) (range->end - 1),
+               (MHD_UNSIGNED_LONG_LONG) connection->response->total_size);
+  content_type = MHD_get_response_token_header_ (connection->response,
+                                                 MHD_HEADER_TOKEN_CONTENT_TYPE);
+  off = 0;
+  append_part_data (buf, &off, "\r\n--", 4);
+  append_part_data (buf, &off, boundary, MHD_RANGE_BOUNDARY_LEN);
+  append_part_data (buf, &off, "\r\n", 2);
+  if (NULL != content_type)
+    {
+      append_part_data (buf, &off,
+                        MHD_HTTP_HEADER_CONTENT_TYPE ": ",
+                        strlen (MHD_HTTP_HEADER_CONTENT_TYPE ": "));
+      append_part_data (buf, &off, content_type, strlen (content_type));
+      append_part_data (buf, &off, "\r\n", 2);
+    }
+  append_part_data (buf, &off,
+                    MHD_HTTP_HEADER_CONTENT_RANGE ": ",
+                    strlen (MHD_HTTP_HEADER_CONTENT_RANGE ": "));
+  append_part_data (buf, &off, content_range, content_range_len);
+  append_part_data (buf, &off, "\r\n\r\n", 4);
+  return off;
+}
+
+
+/**
+ * Length of the delimiter that ends a multipart/byteranges body.
+ */
+#define MHD_RANGE_CLOSE_DELIMITER_LEN (MHD_RANGE_BOUNDARY_LEN + 8)
+
+
+/**
+ * Format the delimiter that ends the multipart/byteranges body of
+ * @a connection.
+ *
+ * @param connection connection that sends several ranges
+ * @param buf buffer of at least #MHD_RANGE_CLOSE_DELIMITER_LEN + 1 bytes
+ */
+static void
+format_close_delimiter (struct MHD_Connection *connection,
+                        char *buf)
+{
+  char boundary[MHD_RANGE_BOUNDARY_LEN + 1];
+
+  format_range_boundary (connection,
+                         boundary);
+  sprintf (buf,
+           "\r\n--%s--\r\n",
+           boundary);
+}
+
+
+/**
+ * Compute the size of the body we send for the ranges of
+ * @a connection.
+ *
+ * @param connection connection that sends a 206 or 416 response
+ * @return value for the 'Content-Length' header
+ */
+static uint64_t
+get_ranges_body_size (struct MHD_Connection *connection)
+{
+  uint64_t size;
+  unsigned int i;
+
+  if (1 == connection->ranges_count)
+    return connection->ranges[0].end - connection->ranges[0].start;
+  size = 0;
+  for (i = 0; i < connection->ranges_count; i++)
+    size += format_part_header (connection, i, NULL)
+      + connection->ranges[i].end - connection->ranges[i].start;
+  if (0 != connection->ranges_count)
+    size += MHD_RANGE_CLOSE_DELIMITER_LEN;
+  return size;
+}
+
+
+/**
+ * Format the headers that describe the ranges we send (or that we can
+ * send ranges) for the response of @a connection.
+ *
+ * @param connection connection we're processing
+ * @param buf buffer of at least 256 bytes to write the headers to
+ * @return number of bytes written to @a buf
+ */
+static size_t
+format_range_headers (struct MHD_Connection *connection,
+                      char *buf)
+{
+  struct MHD_Response *response = connection->response;
+  char boundary[MHD_RANGE_BOUNDARY_LEN + 1];
+  size_t off;
+
+  off = 0;
+  if (0 == (response->flags & MHD_RF_ACCEPT_RANGES))
+    return 0;
+  if (NULL == MHD_get_response_header (response,
+                                       MHD_HTTP_HEADER_ACCEPT_RANGES))
+    off += sprintf (&buf[off],
+                    MHD_HTTP_HEADER_ACCEPT_RANGES ": bytes\r\n");
+  if (MHD_YES == connection->range_not_satisfiable)
+    off += sprintf (&buf[off],
+                    MHD_HTTP_HEADER_CONTENT_RANGE ": bytes */" MHD_UNSIGNED_LONG_LONG_PRINTF "\r\n",
+                    (MHD_UNSIGNED_LONG_LONG) response->total_size);
+  else if (1 == connection->ranges_count)
+    off += sprintf (&buf[off],
+                    MHD_HTTP_HEADER_CONTENT_RANGE ": bytes " MHD_UNSIGNED_LONG_LONG_PRINTF "-" MHD_UNSIGNED_LONG_LONG_PRINTF "/" MHD_UNSIGNED_LONG_LONG_PRINTF "\r\n",
+                    (MHD_UNSIGNED_LONG_LONG) connection->ranges[0].start,
+                    (MHD_UNSIGNED_LONG_LONG) (connection->ranges[0].end - 1),
+                    (MHD_UNSIGNED_LONG_LONG) response->total_size);
+  else if (1 < connection->ranges_count)
+    {
+      format_range_boundary (connection,
+                             boundary);
+      off += sprintf (&buf[off],
+                      MHD_HTTP_HEADER_CONTENT_TYPE ": multipart/byteranges; boundary=%s\r\n",
+                      boundary);
+    }
+  return off;
+}
+
+
+/**
+ * Format the status line of a response.
+ *
+ * @param code buffer of at least 256 bytes to write the line to
+ * @param response_code response code, possibly with #MHD_ICY_FLAG
+ * @param http_1_0 #MHD_YES to answer with HTTP/1.0
+ * @return number of bytes written to @a code
+ */
+static size_t
+format_status_line (char *code,
+                    unsigned int response_code,
+                    int http_1_0)
+{
+  uint32_t rc;
+
+  rc = response_code & (~MHD_ICY_FLAG);
+  return sprintf (code,
+                  "%s %u %s\r\n",
+                  (0 != (response_code & MHD_ICY_FLAG))
+                  ? "ICY"
+                  : ( (MHD_YES == http_1_0)
+                      ? MHD_HTTP_VERSION_1_0
+                      : MHD_HTTP_VERSION_1_1),
+                  rc,
+                  MHD_get_reason_phrase_for (rc));
+}
+
+
+/**
+ * Serialize the parts of the header of @a response that do not
+ * depend on the connection.
+ *
+ * @param response response to serialize
+ * @param response_code response code for the status line
+ * @param http_1_0 #MHD_YES for an HTTP/1.0 status line
+ * @return NULL on error (out of memory)
+ */
+static struct MHD_HeaderCache *
+create_header_cache (struct MHD_Response *response,
+                     unsigned int response_code,
+                     int http_1_0)
+{
+  struct MHD_HeaderCache *cache;
+  struct MHD_HTTP_Header *pos;
+  char code[256];
+  char content_length[128];
+  size_t status_len;
+  size_t content_length_len;
+  size_t headers_len;
+  char *data;
+
+  status_len = format_status_line (code,
+                                   response_code,
+                                   http_1_0);
+  content_length_len = 0;
+  if ( (MHD_SIZE_UNKNOWN != response->total_size) &&
+       (NULL == response->upgrade_handler) &&
+       (NULL == MHD_get_response_token_header_ (response,
+                                                MHD_HEADER_TOKEN_CONTENT_LENGTH)) )
+    content_length_len
+      = sprintf (content_length,
+                 MHD_HTTP_HEADER_CONTENT_LENGTH ": " MHD_UNSIGNED_LONG_LONG_PRINTF "\r\n",
+                 (MHD_UNSIGNED_LONG_LONG) response->total_size);
+  headers_len = 0;
+  for (pos = response->first_header; NULL != pos; pos = pos->next)
+    if (MHD_HEADER_KIND == pos->kind)
+      headers_len += pos->header_size + pos->value_size + 4; /* colon, space, linefeeds */
+  cache = malloc (sizeof (struct MHD_HeaderCache) +
+                  status_len + content_length_len + headers_len);
+  if (NULL == cache)
+    return NULL;
+  cache->code = response_code;
+  cache->http_1_0 = http_1_0;
+  cache->status_len = status_len;
+  cache->content_length_len = content_length_len;
+  cache->headers_len = headers_len;
+  data = (char *) &cache[1];
+  memcpy (data, code, status_len);
+  data += status_len;
+  memcpy (data, content_length, content_length_len);
+  data += content_length_len;
+  for (pos = response->first_header; NULL != pos; pos = pos->next)
+    if (MHD_HEADER_KIND == pos->kind)
+      {
+        memcpy (data, pos->header, pos->header_size);
+        data += pos->header_size;
+        *(data++) = ':';
+        *(data++) = ' ';
+        memcpy (data, pos->value, pos->value_size);
+        data += pos->value_size;
+        *(data++) = '\r';
+        *(data++) = '\n';
+      }
+  return cache;
+}
+
+
+/**
+ * Obtain the serialized header of the response of @a connection,
+ * creating it when the response is sent for the first time.  The
+ * status line is created for the response code and HTTP version of
+ * the first connection and must be checked by the caller.
+ *
+ * @param connection connection that sends the response
+ * @param http_1_0 #MHD_YES if the connection answers with HTTP/1.0
+ * @return NULL on error (out of memory)
+ */
+static const struct MHD_HeaderCache *
+get_header_cache (struct MHD_Connection *connection,
+                  int http_1_0)
+{
+  struct MHD_Response *response = connection->response;
+  struct MHD_HeaderCache *cache;
+
+#ifdef HAVE_ATOMIC_BUILTINS
+  /* pairs with the release store below */
+  cache = __atomic_load_n (&response->header_cache,
+                           __ATOMIC_ACQUIRE);
+  if (NULL != cache)
+    return cache;
+#endif
+  (void) MHD_mutex_lock_ (&response->mutex);
+  cache = response->header_cache;
+  if (NULL == cache)
+    {
+      cache = create_header_cache (response,
+                                   connection->responseCode,
+                                   http_1_0);
+#ifdef HAVE_ATOMIC_BUILTINS
+      __atomic_store_n (&response->header_cache,
+                        cache,
+                        __ATOMIC_RELEASE);
+#else
+      response->header_cache = cache;
+#endif
+    }
+  (void) MHD_mutex_unlock_ (&response->mutex);
+  return cache;
+}
+
+
+/**
+ * Allocate the connection's write buffer and fill it with all of the
+ * headers (or footers, if we have already sent the body) from the
+ * HTTPd's response.  If headers are missing in the response supplied
+ * by the application, additional headers may be added here.
+ *
+ * @param connection the connection
+ * @return #MHD_YES on success, #MHD_NO on failure (out of memory)
+ */
+static int
+build_header_response (struct MHD_Connection *connection)
+{
+  size_t size;
+  size_t off;
+  struct MHD_HTTP_Header *pos;
+  char code[256];
+  char date[128];
+  char content_length_buf[128];
+  const char *content_length;
+  size_t content_length_len;
+  char range_headers[256];
+  size_t range_headers_len;
+  size_t part_header_len;
+  int is_range_reply;
+  char *data;
+  enum MHD_ValueKind kind;
+  const struct MHD_HeaderCache *cache;
+  const char *status_line;
+  int http_1_0;
+  int use_cached_headers;
+  const char *client_requested_close;
+  const char *response_has_close;
+  const char *response_has_keepalive;
+  const char *have_encoding;
+  const char *have_content_length;
+  int must_add_close;
+  int must_add_chunked_encoding;
+  int must_add_keep_alive;
+  int must_add_content_length;
+  int must_add_alt_svc;
+
+  EXTRA_CHECK (NULL != connection->version);
+  if (0 == connection->version[0])
+    {
+      data = MHD_pool_allocate (connection->pool, 0, MHD_YES);
+      connection->write_buffer = data;
+      connection->write_buffer_append_offset = 0;
+      connection->write_buffer_send_offset = 0;
+      connection->write_buffer_size = 0;
+      return MHD_YES;
+    }
+  cache = NULL;
+  status_line = code;
+  range_headers_len = 0;
+  part_header_len = 0;
+  is_range_reply = ( (0 != connection->ranges_count) ||
+                     (MHD_YES == connection->range_not_satisfiable) )
+    ? MHD_YES : MHD_NO;
+  if (MHD_CONNECTION_FOOTERS_RECEIVED == connection->state)
+    {
+      http_1_0 = (MHD_str_equal_caseless_ (MHD_HTTP_VERSION_1_0,
+                                           connection->version))
+        ? MHD_YES : MHD_NO;
+      cache = get_header_cache (connection,
+                                http_1_0);
+      if ( (NULL != cache) &&
+           (cache->code == connection->responseCode) &&
+           (cache->http_1_0 == http_1_0) )
+        {
+          status_line = (const char *) &cache[1];
+          off = cache->status_len;
+        }
+      else
+        {
+          off = format_status_line (code,
+                                    connection->responseCode,
+                                    http_1_0);
+        }
+      /* estimate size */
+      size = off + 2;           /* +2 for extra "\r\n" at the end */
+      kind = MHD_HEADER_KIND;
+      if ( (0 == (connection->daemon->options & MHD_SUPPRESS_DATE_NO_CLOCK)) &&
+	   (NULL == MHD_get_response_token_header_ (connection->response,
+                                                    MHD_HEADER_TOKEN_DATE)) )
+        MHD_get_cached_date_string_ (connection->daemon,
+                                date);
+      else
+        date[0] = '\0';
+      size += strlen (date);
+      range_headers_len = format_range_headers (connection,
+                                                range_headers);
+      size += range_headers_len;
+      if (1 < connection->ranges_count)
+        {
+          /* the header of the first part follows right away */
+          part_header_len = format_part_header (connection,
+                                                0,
+                                                NULL);
+          size += part_header_len;
+        }
+    }
+  else
+    {
+      /* 2 bytes for final CRLF of a Chunked-Body */
+      size = 2;
+      kind = MHD_FOOTER_KIND;
+      off = 0;
+    }
+
+  /* calculate extra headers we need to add, such as 'Connection: close',
+     first see what was explicitly requested by the application */
+  must_add_close = MHD_NO;
+  must_add_chunked_encoding = MHD_NO;
+  must_add_keep_alive = MHD_NO;
+  must_add_content_length = MHD_NO;
+  must_add_alt_svc = ( (MHD_CONNECTION_FOOTERS_RECEIVED == connection->state) &&
+                       (NULL != connection->daemon->alt_svc) &&
+                       (NULL == MHD_get_response_header (connection->response,
+                                                         MHD_HTTP_HEADER_ALT_SVC)) )
+    ? MHD_YES : MHD_NO;
+  content_length = content_length_buf;
+  content_length_len = 0;
+  response_has_keepalive = NULL;
+  switch (connection->state)
+    {
+    case MHD_CONNECTION_FOOTERS_RECEIVED:
+      response_has_close = MHD_get_response_token_header_ (connection->response,
+                                                           MHD_HEADER_TOKEN_CONNECTION);
+      response_has_keepalive = response_has_close;
+      if ( (NULL != response_has_close) &&
+           (!MHD_str_equal_caseless_ (response_has_close, "close")) )
+        response_has_close = NULL;
+      if ( (NULL != response_has_keepalive) &&
+           (!MHD_str_equal_caseless_ (response_has_keepalive, "Keep-Alive")) )
+        response_has_keepalive = NULL;
+      client_requested_close = MHD_lookup_connection_token_value (connection,
+                                                                  MHD_HEADER_KIND,
+                                                                  MHD_HEADER_TOKEN_CONNECTION);
+      if ( (NULL != client_requested_close) &&
+           (!MHD_str_equal_caseless_ (client_requested_close, "close")) )
+        client_requested_close = NULL;
+
+      /* now analyze chunked encoding situation */
+      connection->have_chunked_upload = MHD_NO;
+
+      if (MHD_YES == connection->not_modified)
+        {
+          /* 304 has no body, no need to frame it */
+        }
+      else if (NULL != connection->compressor)
+        {
+          /* the compressed size is not known in advance; the
+             compressor is only used with HTTP 1.1, see
+             setup_compression() */
+          must_add_chunked_encoding = MHD_YES;
+          connection->have_chunked_upload = MHD_YES;
+        }
+      else if ( (MHD_SIZE_UNKNOWN == connection->response->total_size) &&
+           (NULL == response_has_close) &&
+           (NULL == client_requested_close) )
+        {
+          /* size is unknown, and close was not explicitly requested;
+             need to either to HTTP 1.1 chunked encoding or
+             close the connection */
+          /* 'close' header doesn't exist yet, see if we need to add one;
+             if the client asked for a close, no need to start chunk'ing */
+          /* bodies sent with splice() are not chunked */
+          if ( (MHD_YES == keepalive_possible (connection)) &&
+               (MHD_str_equal_caseless_ (MHD_HTTP_VERSION_1_1,
+                                         connection->version) ) &&
+               (MHD_NO == use_splice (connection)) )
+            {
+              have_encoding = MHD_get_response_token_header_ (connection->response,
+                                                              MHD_HEADER_TOKEN_TRANSFER_ENCODING);
+              if (NULL == have_encoding)
+                {
+                  must_add_chunked_encoding = MHD_YES;
+                  connection->have_chunked_upload = MHD_YES;
+                }
+              else if (MHD_str_equal_caseless_(have_encoding, "identity"))
+                {
+                  /* application forced identity encoding, can't do 'chunked' */
+                  must_add_close = MHD_YES;
+                }
+              else
+                {
+                  connection->have_chunked_upload = MHD_YES;
+                }
+            }
+          else
+            {
+              /* Keep alive or chunking not possible
+                 => set close header if not present */
+              if (NULL == response_has_close)
+                must_add_close = MHD_YES;
+            }
+        }
+
+      /* check for other reasons to add 'close' header */
+      if ( ( (NULL != client_requested_close) ||
+             (MHD_YES == connection->read_closed) ||
+             (MHD_YES == connection->daemon->draining) ) &&
+           (NULL == response_has_close) &&
+           (0 == (connection->response->flags & MHD_RF_HTTP_VERSION_1_0_ONLY) ) )
+        must_add_close = MHD_YES;
+
+      /* check if we should add a 'content length' header */
+      have_content_length = MHD_get_response_token_header_ (connection->response,
+                                                            MHD_HEADER_TOKEN_CONTENT_LENGTH);
+
+      if ( (MHD_SIZE_UNKNOWN != connection->response->total_size) &&
+           (NULL == have_content_length) &&
+           (NULL == connection->compressor) &&
+           (MHD_NO == connection->not_modified) &&
+           (NULL == connection->response->upgrade_handler) &&
+           ( (NULL == connection->method) ||
+             (! MHD_str_equal_caseless_ (connection->method,
+                                         MHD_HTTP_METHOD_CONNECT)) ) )
+        {
+          /*
+            Here we add a content-length if one is missing; however,
+            for 'connect' methods, the responses MUST NOT include a
+            content-length header *if* the response code is 2xx (in
+            which case we expect there to be no body).  Still,
+            as we don't know the response code here in some cases, we
+            simply only force adding a content-length header if this
+            is not a 'connect' or if the response is not empty
+            (which is kind of more sane, because if some crazy
+            application did return content with a 2xx status code,
+            then having a content-length might again be a good idea).
+
+            Note that the change from 'SHOULD NOT' to 'MUST NOT' is
+            a recent development of the HTTP 1.1 specification.
+          */
+          if (MHD_YES == is_range_reply)
+            {
+              content_length_len
+                = sprintf (content_length_buf,
+                           MHD_HTTP_HEADER_CONTENT_LENGTH ": " MHD_UNSIGNED_LONG_LONG_PRINTF "\r\n",
+                           (MHD_UNSIGNED_LONG_LONG) get_ranges_body_size (connection));
+            }
+          else if (NULL != cache)
+            {
+              content_length = ((const char *) &cache[1]) + cache->status_len;
+              content_length_len = cache->content_length_len;
+            }
+          else
+            {
+              content_length_len
+                = sprintf (content_length_buf,
+                           MHD_HTTP_HEADER_CONTENT_LENGTH ": " MHD_UNSIGNED_LONG_LONG_PRINTF "\r\n",
+                           (MHD_UNSIGNED_LONG_LONG) connection->response->total_size);
+            }
+          must_add_content_length = MHD_YES;
+        }
+
+      /* check for adding keep alive */
+      if ( (NULL == response_has_keepalive) &&
+           (NULL == response_has_close) &&
+           (MHD_NO == must_add_close) &&
+           (NULL == connection->response->upgrade_handler) &&
+           (0 == (connection->response->flags & MHD_RF_HTTP_VERSION_1_0_ONLY) ) &&
+           (MHD_YES == keepalive_possible (connection)) )
+        must_add_keep_alive = MHD_YES;
+      break;
+    case MHD_CONNECTION_BODY_SENT:
+      break;
+    default:
+      EXTRA_CHECK (0);
+    }
+
+  if (must_add_close)
+    size += strlen ("Connection: close\r\n");
+  if (must_add_keep_alive)
+    size += strlen ("Connection: Keep-Alive\r\n");
+  if (must_add_chunked_encoding)
+    size += strlen ("Transfer-Encoding: chunked\r\n");
+  if (must_add_content_length)
+    size += content_length_len;
+  if ( (NULL != connection->compressor) &&
+       (MHD_CONNECTION_FOOTERS_RECEIVED == connection->state) )
+    size += strlen (MHD_HTTP_HEADER_CONTENT_ENCODING ": \r\n")
+      + strlen (connection->compress_encoding);
+  if (must_add_alt_svc)
+    size += strlen (MHD_HTTP_HEADER_ALT_SVC ": \r\n")
+      + connection->daemon->alt_svc_len;
+  EXTRA_CHECK (! (must_add_close && must_add_keep_alive) );
+  EXTRA_CHECK (! (must_add_chunked_encoding && must_add_content_length) );
+
+  /* the cached headers can be used unless we must drop the
+     application's 'Connection: Keep-Alive' or its 'Content-Type'
+     (replaced by the one of the multipart/byteranges body) */
+  use_cached_headers = ( (NULL != cache) &&
+                         ( (MHD_NO == must_add_close) ||
+                           (NULL == response_has_keepalive) ) &&
+                         (1 >= connection->ranges_count) )
+    ? MHD_YES : MHD_NO;
+  if (MHD_YES == use_cached_headers)
+    size += cache->headers_len;
+  else
+    for (pos = connection->response->first_header; NULL != pos; pos = pos->next)
+      if ( (pos->kind == kind) &&
+           (! ( (MHD_YES == must_add_close) &&
+                (pos->value == response_has_keepalive) &&
+                (MHD_HEADER_TOKEN_CONNECTION == pos->token) ) ) &&
+           (! ( (1 < connection->ranges_count) &&
+                (MHD_HEADER_TOKEN_CONTENT_TYPE == pos->token) ) ) )
+        size += pos->header_size + pos->value_size + 4; /* colon, space, linefeeds */
+  /* produce data */
+  data = MHD_pool_allocate (connection->pool, size + 1, MHD_NO);
+  if (NULL == data)
+    {
+      MHD_STATS_ADD_ (connection->daemon, pool_fail_write_buffer, 1);
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (connection->daemon,
+                "Not enough memory for write!\n");
+#endif
+      return MHD_NO;
+    }
+  if (MHD_CONNECTION_FOOTERS_RECEIVED == connection->state)
+    {
+      memcpy (data, status_line, off);
+    }
+  if (must_add_close)
+    {
+      /* we must add the 'Connection: close' header */
+      memcpy (&data[off],
+              "Connection: close\r\n",
+	      strlen ("Connection: close\r\n"));
+      off += strlen ("Connection: close\r\n");
+    }
+  if (must_add_keep_alive)
+    {
+      /* we must add the 'Connection: Keep-Alive' header */
+      memcpy (&data[off],
+              "Connection: Keep-Alive\r\n",
+	      strlen ("Connection: Keep-Alive\r\n"));
+      off += strlen ("Connection: Keep-Alive\r\n");
+    }
+  if (must_add_chunked_encoding)
+    {
+      /* we must add the 'Transfer-Encoding: chunked' header */
+      memcpy (&data[off],
+              "Transfer-Encoding: chunked\r\n",
+	      strlen ("Transfer-Encoding: chunked\r\n"));
+      off += strlen ("Transfer-Encoding: chunked\r\n");
+    }
+  if (must_add_content_length)
+    {
+      /* we must add the 'Content-Length' header */
+      memcpy (&data[off],
+              content_length,
+	      content_length_len);
+      off += content_length_len;
+    }
+  if ( (NULL != connection->compressor) &&
+       (MHD_CONNECTION_FOOTERS_RECEIVED == connection->state) )
+    {
+      /* we must add the 'Content-Encoding' header */
+      off += sprintf (&data[off],
+                      MHD_HTTP_HEADER_CONTENT_ENCODING ": %s\r\n",
+                      connection->compress_encoding);
+    }
+  if (must_add_alt_svc)
+    {
+      /* advertise the alternative service of the daemon */
+      memcpy (&data[off],
+              MHD_HTTP_HEADER_ALT_SVC ": ",
+              strlen (MHD_HTTP_HEADER_ALT_SVC ": "));
+      off += strlen (MHD_HTTP_HEADER_ALT_SVC ": ");
+      memcpy (&data[off],
+              connection->daemon->alt_svc,
+              connection->daemon->alt_svc_len);
+      off += connection->daemon->alt_svc_len;
+      memcpy (&data[off], "\r\n", 2);
+      off += 2;
+    }
+  if (0 != range_headers_len)
+    {
+      memcpy (&data[off],
+              range_headers,
+              range_headers_len);
+      off += range_headers_len;
+    }
+  if (MHD_YES == use_cached_headers)
+    {
+      memcpy (&data[off],
+              ((const char *) &cache[1]) + cache->status_len + cache->content_length_len,
+              cache->headers_len);
+      off += cache->headers_len;
+    }
+  else
+    for (pos = connection->response->first_header; NULL != pos; pos = pos->next)
+      if ( (pos->kind == kind) &&
+           (! ( (pos->value == response_has_keepalive) &&
+                (MHD_YES == must_add_close) &&
+                (MHD_HEADER_TOKEN_CONNECTION == pos->token) ) ) &&
+           (! ( (1 < connection->ranges_count) &&
+                (MHD_HEADER_TOKEN_CONTENT_TYPE == pos->token) ) ) )
+        {
+          memcpy (&data[off], pos->header, pos->header_size);
+          off += pos->header_size;
+          data[off++] = ':';
+          data[off++] = ' ';
+          memcpy (&data[off], pos->value, pos->value_size);
+          off += pos->value_size;
+          data[off++] = '\r';
+          data[off++] = '\n';
+        }
+  if (MHD_CONNECTION_FOOTERS_RECEIVED == connection->state)
+    {
+      strcpy (&data[off], date);
+      off += strlen (date);
+    }
+  memcpy (&data[off], "\r\n", 2);
+  off += 2;
+  if (0 != part_header_len)
+    off += format_part_header (connection,
+                               0,
+                               &data[off]);
+
+  if (off != size)
+    mhd_panic (mhd_panic_cls, __FILE__, __LINE__, NULL);
+  if ( (MHD_CONNECTION_FOOTERS_RECEIVED == connection->state) &&
+       (connection->continue_message_write_offset <
+        connection->continue_message_size) )
+    {
+      /* interim responses that could not be sent yet go first */
+      off = connection->continue_message_size
+        - connection->continue_message_write_offset;
+      data = MHD_pool_reallocate (connection->pool,
+                                  data,
+                                  size + 1,
+                                  off + size + 1);
+      if (NULL == data)
+        {
+          MHD_STATS_ADD_ (connection->daemon, pool_fail_write_buffer, 1);
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (connection->daemon,
+                    "Not enough memory for write!\n");
+#endif
+          return MHD_NO;
+        }
+      memmove (&data[off],
+               data,
+               size);
+      memcpy (data,
+              &connection->continue_message[connection->continue_message_write_offset],
+              off);
+      size += off;
+      connection->continue_message_write_offset
+        = connection->continue_message_size;
+    }
+  connection->write_buffer = data;
+  connection->write_buffer_append_offset = size;
+  connection->write_buffer_send_offset = 0;
+  connection->write_buffer_size = size + 1;
+  return MHD_YES;
+}
+
+
+/**
+ * Status codes and bodies of the errors MHD reports itself, in the
+ * order of `error_responses` in `struct MHD_Daemon`.
+ */
+static const struct
+{
+  unsigned int status_code;
+  const char *message;
+} error_response_table[MHD_ERROR_RESPONSE_COUNT] = {
+  { MHD_HTTP_BAD_REQUEST, REQUEST_MALFORMED },
+  { MHD_HTTP_BAD_REQUEST, REQUEST_LACKS_HOST },
+  { MHD_HTTP_REQUEST_ENTITY_TOO_LARGE, REQUEST_TOO_BIG },
+  { MHD_HTTP_REQUEST_URI_TOO_LONG, REQUEST_TOO_BIG },
+  { MHD_HTTP_INTERNAL_SERVER_ERROR, INTERNAL_ERROR },
+  { MHD_HTTP_SERVICE_UNAVAILABLE, SERVICE_OVERLOADED }
+};
+
+
+/**
+ * Create the responses for the errors that MHD reports itself, so
+ * that they do not have to be allocated for every error.  Their
+ * headers are serialized right away.
+ *
+ * @param daemon daemon to create the responses for
+ * @return #MHD_YES on success, #MHD_NO on failure (out of memory)
+ */
+int
+MHD_connection_create_error_responses_ (struct MHD_Daemon *daemon)
+{
+  struct MHD_Response *response;
+  char retry_after[16];
+  unsigned int i;
+
+  for (i = 0; i < MHD_ERROR_RESPONSE_COUNT; i++)
+    {
+      response
+        = MHD_create_response_from_buffer (strlen (error_response_table[i].message),
+                                           (void *) error_response_table[i].message,
+                                           MHD_RESPMEM_PERSISTENT);
+      if (NULL == response)
+        {
+          MHD_connection_destroy_error_responses_ (daemon);
+          return MHD_NO;
+        }
+      if (MHD_HTTP_SERVICE_UNAVAILABLE == error_response_table[i].status_code)
+        {
+          /* only sent for overload, tell clients when to come back */
+          MHD_snprintf_ (retry_after,
+                         sizeof (retry_after),
+                         "%u",
+                         daemon->overload_retry_after);
+          if (MHD_NO == MHD_add_response_header (response,
+                                                 MHD_HTTP_HEADER_RETRY_AFTER,
+                                                 retry_after))
+            {
+              MHD_destroy_response (response);
+              MHD_connection_destroy_error_responses_ (daemon);
+              return MHD_NO;
+            }
+        }
+      /* no other thread knows the response yet */
+      response->header_cache
+        = create_header_cache (response,
+                               error_response_table[i].status_code,
+                               MHD_NO);
+      daemon->error_responses[i] = response;
+    }
+  return MHD_YES;
+}
+
+
+/**
+ * Release the responses created by
+ * #MHD_connection_create_error_responses_().
+ *
+ * @param daemon daemon to release the responses of
+ */
+void
+MHD_connection_destroy_error_responses_ (struct MHD_Daemon *daemon)
+{
+  unsigned int i;
+
+  for (i = 0; i < MHD_ERROR_RESPONSE_COUNT; i++)
+    {
+      if (NULL == daemon->error_responses[i])
+        continue;
+      MHD_destroy_response (daemon->error_responses[i]);
+      daemon->error_responses[i] = NULL;
+    }
+}
+
+
+/**
+ * Find the response created at startup for an error.
+ *
+ * @param daemon daemon of the connection with the error
+ * @param status_code the response code to send
+ * @param message the error message to send
+ * @return NULL if there is no such response
+ */
+static struct MHD_Response *
+get_error_response (struct MHD_Daemon *daemon,
+                    unsigned int status_code,
+                    const char *message)
+{
+  unsigned int i;
+
+  for (i = 0; i < MHD_ERROR_RESPONSE_COUNT; i++)
+    if ( (status_code == error_response_table[i].status_code) &&
+         ( (message == error_response_table[i].message) ||
+           (0 == strcmp (message,
+                         error_response_table[i].message)) ) )
+      return daemon->error_responses[i];
+  return NULL;
+}
+
+
+/**
+ * We encountered an error processing the request.
+ * Handle it properly by stopping to read data
+ * and sending the indicated response code and message.
+ *
+ * @param connection the connection
+ * @param status_code the response code to send (400, 413 or 414)
+ * @param message the error message to send
+ */
+static void
+transmit_error_response (struct MHD_Connection *connection,
+                         unsigned int status_code,
+			 const char *message)
+{
+  struct MHD_Response *response;
+
+  if (NULL == connection->version)
+    {
+      /* we were unable to process the full header line, so we don't
+	 really know what version the client speaks; assume 1.0 */
+      connection->version = MHD_HTTP_VERSION_1_0;
+    }
+  connection->state = MHD_CONNECTION_FOOTERS_RECEIVED;
+  connection->read_closed = MHD_YES;
+  if ( (MHD_HTTP_REQUEST_ENTITY_TOO_LARGE == status_code) ||
+       (MHD_HTTP_REQUEST_URI_TOO_LONG == status_code) )
+    MHD_STATS_ADD_ (connection->daemon, pool_exhaustions, 1);
+#ifdef HAVE_MESSAGES
+  MHD_DLOG (connection->daemon,
+            "Error %u (`%s') processing request, closing connection.\n",
+            status_code, message);
+#endif
+  EXTRA_CHECK (NULL == connection->response);
+  response = get_error_response (connection->daemon,
+                                 status_code,
+                                 message);
+  if (NULL != response)
+    {
+      MHD_queue_response (connection, status_code, response);
+    }
+  else
+    {
+      response = MHD_create_response_from_buffer (strlen (message),
+                                                  (void *) message,
+                                                  MHD_RESPMEM_PERSISTENT);
+      MHD_queue_response (connection, status_code, response);
+      MHD_destroy_response (response);
+    }
+  EXTRA_CHECK (NULL != connection->response);
+  if (MHD_NO == build_header_response (connection))
+    {
+      /* oops - close! */
+      CONNECTION_CLOSE_ERROR (connection,
+			      "Closing connection (failed to create response header)\n");
+    }
+  else
+    {
+      connection->state = MHD_CONNECTION_HEADERS_SENDING;
+    }
+}
+
+
+/**
+ * Check if the buffer (or descriptor) of the application the body
+ * is received into is to be passed to the access handler: it is
+ * full or holds the rest of the body.
+ *
+ * @param connection connection to check
+ * @return #MHD_YES if the access handler is to be called
+ */
+static int
+upload_buffer_ready (struct MHD_Connection *connection)
+{
+  return ( (0 != connection->upload_buffer_fill) &&
+           ( (connection->upload_buffer_fill == connection->upload_buffer_size) ||
+             (connection->upload_buffer_fill == connection->remaining_upload_size) ) )
+    ? MHD_YES : MHD_NO;
+}
+
+
+/**
+ * Update the 'event_loop_info' field of this connection based on the state
+ * that the connection is now in.  May also close the connection or
+ * perform other updates to the connection if needed to prepare for
+ * the next round of the event loop.
+ *
+ * @param connection connetion to get poll set for
+ */
+static void
+MHD_connection_update_event_loop_info (struct MHD_Connection *connection)
+{
+  int throttled;
+
+  while (1)
+    {
+#if DEBUG_STATES
+      MHD_DLOG (connection->daemon,
+                "%s: state: %s\n",
+                __FUNCTION__,
+                MHD_state_to_string (connection->state));
+#endif
+      switch (connection->state)
+        {
+#if HTTPS_SUPPORT
+	case MHD_TLS_CONNECTION_INIT:
+	  if (MHD_NO == MHD_tls_wants_write_ (connection))
+            connection->event_loop_info = MHD_EVENT_LOOP_INFO_READ;
+	  else
+            connection->event_loop_info = MHD_EVENT_LOOP_INFO_WRITE;
+	  break;
+#endif
+        case MHD_CONNECTION_INIT:
+        case MHD_CONNECTION_URL_RECEIVED:
+        case MHD_CONNECTION_HEADER_PART_RECEIVED:
+          /* while reading headers, we always grow the
+             read buffer if needed, no size-check required;
+             an idle connection without pool gets one once
+             data arrives */
+          if ( (NULL != connection->pool) &&
+               (connection->read_buffer_offset == connection->read_buffer_size) &&
+	       (MHD_NO == try_grow_read_buffer (connection)) )
+            {
+              transmit_error_response (connection,
+                                       (connection->url != NULL)
+                                       ? MHD_HTTP_REQUEST_ENTITY_TOO_LARGE
+                                       : MHD_HTTP_REQUEST_URI_TOO_LONG,
+                                       REQUEST_TOO_BIG);
+              continue;
+            }
+	  if (MHD_NO == connection->read_closed)
+	    connection->event_loop_info = MHD_EVENT_LOOP_INFO_READ;
+	  else
+	    connection->event_loop_info = MHD_EVENT_LOOP_INFO_BLOCK;
+          break;
+        case MHD_CONNECTION_HEADERS_RECEIVED:
+          EXTRA_CHECK (0);
+          break;
+        case MHD_CONNECTION_HEADERS_PROCESSED:
+          EXTRA_CHECK (0);
+          break;
+        case MHD_CONNECTION_CONTINUE_SENDING:
+          connection->event_loop_info = MHD_EVENT_LOOP_INFO_WRITE;
+          break;
+        case MHD_CONNECTION_CONTINUE_SENT:
+          if (MHD_YES == upload_buffer_ready (connection))
+            {
+              /* the access handler takes the buffer first */
+              connection->event_loop_info = MHD_EVENT_LOOP_INFO_BLOCK;
+              break;
+            }
+          if (connection->read_buffer_offset == connection->read_buffer_size)
+            {
+              if ((MHD_YES != try_grow_read_buffer (connection)) &&
+                  (0 != (connection->daemon->options &
+                         (MHD_USE_SELECT_INTERNALLY |
+                          MHD_USE_THREAD_PER_CONNECTION))))
+                {
+                  /* failed to grow the read buffer, and the
+                     client which is supposed to handle the
+                     received data in a *blocking* fashion
+                     (in this mode) did not handle the data as
+                     it was supposed to!
+                     => we would either have to do busy-waiting
+                     (on the client, which would likely fail),
+                     or if we do nothing, we would just timeout
+                     on the connection (if a timeout is even
+                     set!).
+                     Solution: we kill the connection with an error */
+                  transmit_error_response (connection,
+                                           MHD_HTTP_INTERNAL_SERVER_ERROR,
+                                           INTERNAL_ERROR);
+                  continue;
+                }
+            }
+          if ( (connection->read_buffer_offset < connection->read_buffer_size) &&
+	       (MHD_NO == connection->read_closed) )
+	    connection->event_loop_info = MHD_EVENT_LOOP_INFO_READ;
+	  else
+	    connection->event_loop_info = MHD_EVENT_LOOP_INFO_BLOCK;
+          break;
+        case MHD_CONNECTION_BODY_RECEIVED:
+        case MHD_CONNECTION_FOOTER_PART_RECEIVED:
+          /* while reading footers, we always grow the
+             read buffer if needed, no size-check required */
+          if (MHD_YES == connection->read_closed)
+            {
+	      CONNECTION_CLOSE_ERROR (connection,
+				      NULL);
+              continue;
+            }
+	  connection->event_loop_info = MHD_EVENT_LOOP_INFO_READ;
+          /* transition to FOOTERS_RECEIVED
+             happens in read handler */
+          break;
+        case MHD_CONNECTION_FOOTERS_RECEIVED:
+	  connection->event_loop_info = MHD_EVENT_LOOP_INFO_BLOCK;
+          break;
+        case MHD_CONNECTION_HEADERS_SENDING:
+          /* headers in buffer, keep writing */
+	  connection->event_loop_info = MHD_EVENT_LOOP_INFO_WRITE;
+          break;
+        case MHD_CONNECTION_HEADERS_SENT:
+          EXTRA_CHECK (0);
+          break;
+        case MHD_CONNECTION_NORMAL_BODY_READY:
+	  connection->event_loop_info = MHD_EVENT_LOOP_INFO_WRITE;
+          break;
+        case MHD_CONNECTION_NORMAL_BODY_UNREADY:
+	  connection->event_loop_info = MHD_EVENT_LOOP_INFO_BLOCK;
+          break;
+        case MHD_CONNECTION_CHUNKED_BODY_READY:
+	  connection->event_loop_info = MHD_EVENT_LOOP_INFO_WRITE;
+          break;
+        case MHD_CONNECTION_CHUNKED_BODY_UNREADY:
+	  connection->event_loop_info = MHD_EVENT_LOOP_INFO_BLOCK;
+          break;
+        case MHD_CONNECTION_BODY_SENT:
+          EXTRA_CHECK (0);
+          break;
+        case MHD_CONNECTION_FOOTERS_SENDING:
+	  connection->event_loop_info = MHD_EVENT_LOOP_INFO_WRITE;
+          break;
+        case MHD_CONNECTION_FOOTERS_SENT:
+          EXTRA_CHECK (0);
+          break;
+        case MHD_CONNECTION_UPGRADE:
+          /* socket is controlled by the application */
+	  connection->event_loop_info = MHD_EVENT_LOOP_INFO_BLOCK;
+          break;
+        case MHD_CONNECTION_HTTP2:
+          connection->event_loop_info = MHD_http2_event_loop_info_ (connection);
+          break;
+        case MHD_CONNECTION_CLOSED:
+	  connection->event_loop_info = MHD_EVENT_LOOP_INFO_CLEANUP;
+          break;       /* do nothing, not even reading */
+        default:
+          EXTRA_CHECK (0);
+        }
+      break;
+    }
+  if (MHD_EVENT_LOOP_INFO_READ == connection->event_loop_info)
+    throttled = MHD_rate_limit_check_ (connection, MHD_NO);
+  else if (MHD_EVENT_LOOP_INFO_WRITE == connection->event_loop_info)
+    throttled = MHD_rate_limit_check_ (connection, MHD_YES);
+  else
+    {
+      MHD_rate_limit_remove_ (connection);
+      throttled = MHD_NO;
+    }
+  if (MHD_YES == throttled)
+    connection->event_loop_info = MHD_EVENT_LOOP_INFO_THROTTLED;
+  MHD_poll_set_update_ (connection);
+  MHD_socket_interest_update_ (connection);
+}
+
+
+/**
+ * Parse a single line of the HTTP header.  Advance
+ * read_buffer (!) appropriately.  If the current line does not
+ * fit, consider growing the buffer.  If the line is
+ * far too long, close the connection.  If no line is
+ * found (incomplete, buffer too small, line too long),
+ * return NULL.  Otherwise return a pointer to the line.
+ *
+ * @param connection connection we're processing
+ * @param[out] line_len set to the length of the line (excluding
+ *             the 0-terminator) if a line is returned
+ * @return NULL if no full line is available
+ */
+static char *
+get_next_header_line (struct MHD_Connection *connection,
+                      size_t *line_len)
+{
+  char *rbuf;
+  char *cr;
+  char *lf;
+  size_t pos;
+  size_t end;
+
+  if (0 == connection->read_buffer_offset)
+    return NULL;
+  rbuf = connection->read_buffer;
+  /* the last byte is only checked for LF below, as a CR there may
+     still be followed by a LF */
+  end = connection->read_buffer_offset - 1;
+  pos = connection->read_buffer_scan_offset;
+  if (pos > end)
+    pos = 0;
+  /* find the first CR or LF; memchr() is much faster than looking
+     at each byte, and the CR search can stop at the first LF */
+  lf = memchr (&rbuf[pos], '\n', end - pos);
+  cr = memchr (&rbuf[pos], '\r',
+               (NULL == lf) ? end - pos : (size_t) (lf - &rbuf[pos]));
+  if (NULL != cr)
+    pos = cr - rbuf;
+  else if (NULL != lf)
+    pos = lf - rbuf;
+  else
+    pos = end;
+  if ( (pos == end) &&
+       ('\n' != rbuf[pos]) )
+    {
+      /* not found, continue here after the next read */
+      connection->read_buffer_scan_offset = pos;
+      /* consider growing... */
+      if ( (connection->read_buffer_offset == connection->read_buffer_size) &&
+	   (MHD_NO ==
+	    try_grow_read_buffer (connection)) )
+	{
+	  transmit_error_response (connection,
+				   (NULL != connection->url)
+				   ? MHD_HTTP_REQUEST_ENTITY_TOO_LARGE
+				   : MHD_HTTP_REQUEST_URI_TOO_LONG,
+				   REQUEST_TOO_BIG);
+	}
+      return NULL;
+    }
+  *line_len = pos;
+  /* found, check if we have proper LFCR */
+  if (('\r' == rbuf[pos]) && ('\n' == rbuf[pos + 1]))
+    rbuf[pos++] = '\0';         /* skip both r and n */
+  rbuf[pos++] = '\0';
+  connection->header_size += pos;
+  connection->read_buffer += pos;
+  connection->read_buffer_size -= pos;
+  connection->read_buffer_offset -= pos;
+  connection->read_buffer_scan_offset = 0;
+  return rbuf;
+}
+
+
+/**
+ * Add an entry to the HTTP headers of a connection.  If this fails,
+ * transmit an error response (request too big).
+ *
+ * @param connection the connection for which a
+ *  value should be set
+ * @param key key for the value
+ * @param key_size number of bytes in @a key
+ * @param value the value itself
+ * @param value_size number of bytes in @a value
+ * @param kind kind of the value
+ * @return #MHD_NO on failure (out of memory), #MHD_YES for success
+ */
+static int
+connection_add_header (struct MHD_Connection *connection,
+                       const char *key,
+                       size_t key_size,
+		       const char *value,
+                       size_t value_size,
+		       enum MHD_ValueKind kind)
+{
+  if (MHD_NO ==
+      MHD_set_connection_value_n (connection,
+                                  kind,
+                                  key,
+                                  key_size,
+                                  value,
+                                  value_size))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (connection->daemon,
+                "Not enough memory to allocate header record!\n");
+#endif
+      transmit_error_response (connection,
+			       MHD_HTTP_REQUEST_ENTITY_TOO_LARGE,
+                               REQUEST_TOO_BIG);
+      return MHD_NO;
+    }
+  return MHD_YES;
+}
+
+
+/**
+ * Add an extra value to the connection when parsing it on demand;
+ * unlike #connection_add_header(), failures do not generate an
+ * error response as the application may already be handling the
+ * request.
+ *
+ * @param connection the connection for which a value should be added
+ * @param key key for the value
+ * @param key_size number of bytes in @a key
+ * @param value the value itself
+ * @param value_size number of bytes in @a value
+ * @param kind types of the value
+ * @return #MHD_NO on failure (out of memory), #MHD_YES for success
+ */
+static int
+lazy_add_value (struct MHD_Connection *connection,
+                const char *key,
+                size_t key_size,
+                const char *value,
+                size_t value_size,
+                enum MHD_ValueKind kind)
+{
+  if (MHD_NO ==
+      MHD_set_connection_value_n (connection,
+                                  kind,
+                                  key,
+                                  key_size,
+                                  value,
+                                  value_size))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (connection->daemon,
+                "Not enough memory to allocate header record!\n");
+#endif
+      return MHD_NO;
+    }
+  return MHD_YES;
+}
+
+
+/**
+ * Parse the cookie header (see RFC 2109).
+ *
+ * @param connection connection to parse header of
+ * @param lazy #MHD_YES if the application asked for the cookies
+ *        (see #MHD_OPTION_LAZY_VALUE_PARSING), #MHD_NO if we are
+ *        parsing the request headers
+ * @return #MHD_YES for success, #MHD_NO for failure (malformed, out of memory)
+ */
+static int
+parse_cookie_header (struct MHD_Connection *connection,
+                     int lazy)
+{
+  MHD_ArgumentIterator_ add;
+  const char *hdr;
+  char *cpy;
+  char *pos;
+  char *sce;
+  char *semicolon;
+  char *equals;
+  char *ekill;
+  char old;
+  int quotes;
+
+  hdr = MHD_lookup_connection_token_value (connection,
+                                           MHD_HEADER_KIND,
+                                           MHD_HEADER_TOKEN_COOKIE);
+  if (NULL == hdr)
+    return MHD_YES;
+  add = (MHD_YES == lazy) ? &lazy_add_value : &connection_add_header;
+  cpy = MHD_pool_allocate (connection->pool, strlen (hdr) + 1, MHD_YES);
+  if (NULL == cpy)
+    {
+      MHD_STATS_ADD_ (connection->daemon, pool_fail_headers, 1);
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (connection->daemon,
+                "Not enough memory to parse cookies!\n");
+#endif
+      if (MHD_NO == lazy)
+        transmit_error_response (connection, MHD_HTTP_REQUEST_ENTITY_TOO_LARGE,
+                                 REQUEST_TOO_BIG);
+      return MHD_NO;
+    }
+  memcpy (cpy, hdr, strlen (hdr) + 1);
+  pos = cpy;
+  while (NULL != pos)
+    {
+      while (' ' == *pos)
+        pos++;                  /* skip spaces */
+
+      sce = pos;
+      while (((*sce) != '\0') &&
+             ((*sce) != ',') && ((*sce) != ';') && ((*sce) != '='))
+        sce++;
+      /* remove tailing whitespace (if any) from key */
+      ekill = sce - 1;
+      while ((*ekill == ' ') && (ekill >= pos))
+        *(ekill--) = '\0';
+      old = *sce;
+      *sce = '\0';
+      if (old != '=')
+        {
+          /* value part omitted, use empty string... */
+          if (MHD_NO ==
+              add (connection, pos, strlen (pos), "", 0, MHD_COOKIE_KIND))
+            return MHD_NO;
+          if (old == '\0')
+            break;
+          pos = sce + 1;
+          continue;
+        }
+      equals = sce + 1;
+      quotes = 0;
+      semicolon = equals;
+      while ( ('\0' != semicolon[0]) &&
+              ( (0 != quotes) ||
+                ( (';' != semicolon[0]) &&
+                  (',' != semicolon[0]) ) ) )
+        {
+          if ('"' == semicolon[0])
+            quotes = (quotes + 1) & 1;
+          semicolon++;
+        }
+      if ('\0' == semicolon[0])
+        semicolon = NULL;
+      if (NULL != semicolon)
+        {
+          semicolon[0] = '\0';
+          semicolon++;
+        }
+      /* remove quotes */
+      if ( ('"' == equals[0]) &&
+           ('"' == equals[strlen (equals) - 1]) )
+        {
+          equals[strlen (equals) - 1] = '\0';
+          equals++;
+        }
+      if (MHD_NO ==
+	  add (connection,
+               pos,
+               strlen (pos),
+               equals,
+               strlen (equals),
+               MHD_COOKIE_KIND))
+        return MHD_NO;
+      pos = semicolon;
+    }
+  return MHD_YES;
+}
+
+
+static void
+parse_lazy_values (struct MHD_Connection *connection,
+                   enum MHD_ValueKind kind)
+{
+  unsigned int unused_num_headers;
+  char *args;
+
+  if ( (0 != (kind & MHD_GET_ARGUMENT_KIND)) &&
+       (NULL != connection->lazy_args) )
+    {
+      args = connection->lazy_args;
+      connection->lazy_args = NULL;
+      /* note that this call clobbers 'args' */
+      MHD_parse_arguments_ (connection,
+                            MHD_GET_ARGUMENT_KIND,
+                            args,
+                            &lazy_add_value,
+                            &unused_num_headers);
+    }
+  if ( (0 != (kind & MHD_COOKIE_KIND)) &&
+       (MHD_YES == connection->lazy_cookies) )
+    {
+      connection->lazy_cookies = MHD_NO;
+      parse_cookie_header (connection,
+                           MHD_YES);
+    }
+}
+
+
+/**
+ * Set the URL of the request of @a connection from the request
+ * target @a uri: give it to the URI logger, split off and parse the
+ * arguments, and unescape it.
+ *
+ * @param connection the connection (updated)
+ * @param uri the request target, modified in place; must live as
+ *        long as the request
+ */
+void
+MHD_connection_set_target_ (struct MHD_Connection *connection,
+                            char *uri)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+  char *args;
+  unsigned int unused_num_headers;
+
+  if (NULL != daemon->uri_log_callback)
+    connection->client_context
+      = daemon->uri_log_callback (daemon->uri_log_callback_cls,
+				  uri,
+				  connection);
+  if (NULL != daemon->response_cache)
+    MHD_cache_set_key_ (connection,
+                        uri);
+  args = strchr (uri, '?');
+  if (NULL != args)
+    {
+      args[0] = '\0';
+      args++;
+      if (MHD_YES == daemon->lazy_value_parsing)
+        connection->lazy_args = args;
+      else
+        /* note that this call clobbers 'args' */
+        MHD_parse_arguments_ (connection,
+                              MHD_GET_ARGUMENT_KIND,
+                              args,
+                              &connection_add_header,
+                              &unused_num_headers);
+    }
+  daemon->unescape_callback (daemon->unescape_callback_cls,
+			     connection,
+			     uri);
+  connection->url = uri;
+}
+
+
+/**
+ * Parse the cookies of the request of @a connection, or note that
+ * they are to be parsed on demand (see
+ * #MHD_OPTION_LAZY_VALUE_PARSING).
+ *
+ * @param connection the connection (updated)
+ */
+void
+MHD_connection_parse_cookies_ (struct MHD_Connection *connection)
+{
+  if (MHD_YES == connection->daemon->lazy_value_parsing)
+    connection->lazy_cookies = MHD_YES;
+  else
+    parse_cookie_header (connection,
+                         MHD_NO);
+}
+
+
+/**
+ * Parse the first line of the HTTP HEADER.
+ *
+ * @param connection the connection (updated)
+ * @param line the first line
+ * @return #MHD_YES if the line is ok, #MHD_NO if it is malformed
+ */
+static int
+parse_initial_message_line (struct MHD_Connection *connection,
+                            char *line)
+{
+  char *uri;
+  char *http_version;
+
+  if (NULL == (uri = strchr (line, ' ')))
+    return MHD_NO;              /* serious error */
+  uri[0] = '\0';
+  connection->method = line;
+  uri++;
+  while (' ' == uri[0])
+    uri++;
+  http_version = strchr (uri, ' ');
+  if (NULL != http_version)
+    {
+      http_version[0] = '\0';
+      http_version++;
+    }
+  MHD_connection_set_target_ (connection,
+                              uri);
+  if (NULL == http_version)
+    connection->version = "";
+  else
+    connection->version = http_version;
+  return MHD_YES;
+}
+
+
+/**
+ * Call the handler of the application for this
+ * connection.  Handles chunking of the upload
+ * as well as normal uploads.
+ *
+ * @param connection connection we're processing
+ */
+static void
+call_connection_handler (struct MHD_Connection *connection)
+{
+  size_t processed;
+
+  if (NULL != connection->response)
+    return;                     /* already queued a response */
+  processed = 0;
+  connection->client_aware = MHD_YES;
+  if (0 == connection->request_times.handler_called)
+    connection->request_times.handler_called = MHD_monotonic_usec_counter ();
+  if (MHD_NO ==
+      connection->daemon->default_handler (connection->daemon-> default_handler_cls,
+					   connection,
+                                           connection->url,
+					   connection->method,
+					   connection->version,
+					   NULL, &processed,
+					   &connection->client_context))
+    {
+      /* serious internal error, close connection */
+      CONNECTION_CLOSE_ERROR (connection,
+			      "Internal application error, closing connection.\n");
+      return;
+    }
+}
+
+
+
+#if HAVE_ZLIB
+/**
+ * Size of the buffer in the memory pool a compressed request body is
+ * decompressed into, see #MHD_OPTION_INFLATE_REQUEST_BODY.  Less is
+ * used if the pool is short of memory.
+ */
+#define MHD_INFLATE_BUFFER_SIZE (8 * 1024)
+
+/**
+ * The ratio limit of #MHD_OPTION_INFLATE_REQUEST_BODY is applied
+ * to at least this many received bytes, as the first bytes of a
+ * stream decompress to more than the average.
+ */
+#define MHD_INFLATE_RATIO_BASE 1024
+
+
+/**
+ * Pass the decompressed bytes of the request body the access handler
+ * did not process yet to the handler.
+ *
+ * @param connection connection we're processing
+ * @return #MHD_YES if the handler processed some of them, #MHD_NO if
+ *         none, -1 if the connection was closed
+ */
+static int
+pass_inflated (struct MHD_Connection *connection)
+{
+  size_t available;
+  size_t processed;
+
+  available = connection->inflate_fill - connection->inflate_offset;
+  if (0 == available)
+    return MHD_YES;
+  processed = available;
+  connection->client_aware = MHD_YES;
+  if (MHD_NO ==
+      connection->daemon->default_handler (connection->daemon->default_handler_cls,
+                                           connection,
+                                           connection->url,
+                                           connection->method,
+                                           connection->version,
+                                           &connection->inflate_buffer[connection->inflate_offset],
+                                           &processed,
+                                           &connection->client_context))
+    {
+      /* serious internal error, close connection */
+      CONNECTION_CLOSE_ERROR (connection,
+                              "Internal application error, closing connection.\n");
+      return -1;
+    }
+  if (processed > available)
+    mhd_panic (mhd_panic_cls, __FILE__, __LINE__
+#ifdef HAVE_MESSAGES
+	       , "API violation"
+#else
+	       , NULL
+#endif
+	       );
+  if (processed == available)
+    return MHD_NO;
+  connection->inflate_offset += available - processed;
+  if (connection->inflate_offset == connection->inflate_fill)
+    {
+      connection->inflate_offset = 0;
+      connection->inflate_fill = 0;
+    }
+  return MHD_YES;
+}
+
+
+/**
+ * Decompress a part of the body of the request and pass the result
+ * to the access handler.  Decompressed bytes the handler does not
+ * process stay in @e inflate_buffer and are passed again together
+ * with the next decompressed bytes; the compressed bytes not
+ * decompressed then stay in the read buffer.
+ *
+ * @param connection connection we're processing
+ * @param data the compressed bytes
+ * @param[in,out] size number of bytes in @a data, set to the number
+ *        of bytes not consumed, like the access handler does
+ * @return #MHD_YES on success, #MHD_NO if the connection was closed
+ *         or an error response queued
+ */
+static int
+inflate_request_body (struct MHD_Connection *connection,
+                      const char *data,
+                      size_t *size)
+{
+  size_t in_len;
+  size_t out_len;
+  size_t room;
+  int progress;
+  int ret;
+
+  if (NULL == connection->inflate_buffer)
+    {
+      room = MHD_pool_get_free (connection->pool) / 2;
+      if (room > MHD_INFLATE_BUFFER_SIZE)
+        room = MHD_INFLATE_BUFFER_SIZE;
+      connection->inflate_buffer = MHD_pool_allocate (connection->pool,
+                                                      room,
+                                                      MHD_YES);
+      if ( (NULL == connection->inflate_buffer) ||
+           (0 == room) )
+        {
+          connection->inflate_buffer = NULL;
+          transmit_error_response (connection,
+                                   MHD_HTTP_REQUEST_ENTITY_TOO_LARGE,
+                                   REQUEST_TOO_BIG);
+          return MHD_NO;
+        }
+      connection->inflate_buffer_size = room;
+    }
+  while (1)
+    {
+      progress = MHD_NO;
+      if ( (0 != *size) &&
+           (MHD_NO == connection->inflate_done) )
+        {
+          /* append to the bytes the handler left, like the read
+             buffer does for a body passed as received */
+          if (0 != connection->inflate_offset)
+            {
+              memmove (connection->inflate_buffer,
+                       &connection->inflate_buffer[connection->inflate_offset],
+                       connection->inflate_fill - connection->inflate_offset);
+              connection->inflate_fill -= connection->inflate_offset;
+              connection->inflate_offset = 0;
+            }
+          in_len = *size;
+          out_len = connection->inflate_buffer_size - connection->inflate_fill;
+          ret = MHD_inflater_run_ (connection->inflater,
+                                   data,
+                                   &in_len,
+                                   &connection->inflate_buffer[connection->inflate_fill],
+                                   &out_len);
+          if (-1 == ret)
+            {
+              transmit_error_response (connection,
+                                       MHD_HTTP_BAD_REQUEST,
+                                       REQUEST_MALFORMED);
+              return MHD_NO;
+            }
+          data += in_len;
+          *size -= in_len;
+          connection->inflate_in += in_len;
+          connection->inflate_out += out_len;
+          connection->inflate_fill += out_len;
+          if (MHD_YES == ret)
+            connection->inflate_done = MHD_YES;
+          if (connection->inflate_out >
+              (uint64_t) connection->daemon->inflate_ratio
+              * MHD_MAX (connection->inflate_in, MHD_INFLATE_RATIO_BASE))
+            {
+              transmit_error_response (connection,
+                                       MHD_HTTP_REQUEST_ENTITY_TOO_LARGE,
+                                       REQUEST_INFLATE_TOO_BIG);
+              return MHD_NO;
+            }
+          if ( (0 != in_len) ||
+               (0 != out_len) )
+            progress = MHD_YES;
+        }
+      if (connection->inflate_fill == connection->inflate_offset)
+        {
+          if (MHD_NO == progress)
+            break;
+          continue;
+        }
+      ret = pass_inflated (connection);
+      if (-1 == ret)
+        return MHD_NO;
+      if (MHD_NO == ret)
+        break; /* handler waits for more data */
+    }
+  if ( (MHD_YES == connection->inflate_done) &&
+       (0 != *size) )
+    {
+      /* data after the end of the compressed stream */
+      transmit_error_response (connection,
+                               MHD_HTTP_BAD_REQUEST,
+                               REQUEST_MALFORMED);
+      return MHD_NO;
+    }
+  return MHD_YES;
+}
+#endif
+
+
+/**
+ * Check if the access handler did not process all of the
+ * decompressed bytes of the request body yet.
+ *
+ * @param connection connection to check
+ * @return #MHD_YES if bytes are left
+ */
+static int
+inflate_pending (struct MHD_Connection *connection)
+{
+#if HAVE_ZLIB
+  if (connection->inflate_fill != connection->inflate_offset)
+    return MHD_YES;
+#endif
+  return MHD_NO;
+}
+
+
+/**
+ * Call the handler of the application for a chunked upload with
+ * #MHD_OPTION_COALESCE_CHUNKED_UPLOAD.  All chunks in the read
+ * buffer are decoded in place into one contiguous area at the
+ * beginning of the buffer, which is then passed to the handler at
+ * once.  Decoded bytes the handler does not process stay at the
+ * beginning of the buffer (see @e chunk_decoded).
+ *
+ * @param connection connection we're processing
+ */
+static void
+process_coalesced_chunks (struct MHD_Connection *connection)
+{
+  char *head;
+  size_t available;
+  size_t decoded;
+  size_t src;
+  size_t processed;
+  size_t used;
+  size_t i;
+  size_t n;
+  size_t size;
+  char *end;
+  char c;
+
+  head = connection->read_buffer;
+  available = connection->read_buffer_offset;
+  decoded = connection->chunk_decoded;
+  src = decoded;
+  while (1)
+    {
+      /* decode as many chunks as we have */
+      while (src < available)
+        {
+          if ( (connection->current_chunk_offset == connection->current_chunk_size) &&
+               (0 != connection->current_chunk_offset) )
+            {
+              /* skip new line at the *end* of a chunk */
+              if (available - src < 2)
+                break;
+              i = src;
+              if ((head[i] == '\r') || (head[i] == '\n'))
+                i++;            /* skip 1st part of line feed */
+              if ((head[i] == '\r') || (head[i] == '\n'))
+                i++;            /* skip 2nd part of line feed */
+              if (i == src)
+                {
+                  /* malformed encoding */
+                  CONNECTION_CLOSE_ERROR (connection,
+					  "Received malformed HTTP request (bad chunked encoding), closing connection.\n");
+                  return;
+                }
+              src = i;
+              connection->current_chunk_offset = 0;
+              connection->current_chunk_size = 0;
+              continue;
+            }
+          if (connection->current_chunk_offset <
+              connection->current_chunk_size)
+            {
+              /* append chunk data to the decoded area */
+              n = connection->current_chunk_size -
+                connection->current_chunk_offset;
+              if (n > available - src)
+                n = available - src;
+              if (src != decoded)
+                memmove (&head[decoded], &head[src], n);
+              decoded += n;
+              src += n;
+              connection->current_chunk_offset += n;
+              continue;
+            }
+          /* we need to read chunk boundaries */
+          i = 0;
+          while (src + i < available)
+            {
+              if ((head[src + i] == '\r') || (head[src + i] == '\n'))
+                break;
+              i++;
+              if (i >= 6)
+                break;
+            }
+          if ((src + i + 1 >= available) &&
+              !((i == 1) && (available - src == 2) && (head[src] == '0')))
+            break;              /* need more data... */
+          if (i >= 6)
+            {
+              /* malformed encoding */
+              CONNECTION_CLOSE_ERROR (connection,
+                                      "Received malformed HTTP request (bad chunked encoding), closing connection.\n");
+              return;
+            }
+          c = head[src + i];
+          head[src + i] = '\0';
+          size = strtoul (&head[src], &end, 16);
+          head[src + i] = c;
+          if (end != &head[src + i])
+            {
+              /* malformed encoding */
+              CONNECTION_CLOSE_ERROR (connection,
+                                      "Received malformed HTTP request (bad chunked encoding), closing connection.\n");
+              return;
+            }
+          if ( (0 == size) &&
+               (0 != decoded) )
+            break; /* end of upload, first deliver what we have */
+          i++;
+          if ((src + i < available) &&
+              ((head[src + i] == '\r') || (head[src + i] == '\n')))
+            i++;                /* skip 2nd part of line feed */
+          src += i;
+          connection->current_chunk_size = size;
+          connection->current_chunk_offset = 0;
+          if (0 == size)
+            {
+              connection->remaining_upload_size = 0;
+              break;
+            }
+        }
+      /* close the gap left by the chunk framing */
+      if (src != decoded)
+        {
+          memmove (&head[decoded], &head[src], available - src);
+          available -= src - decoded;
+          src = decoded;
+        }
+      if (0 == decoded)
+        break;
+      processed = decoded;
+      connection->client_aware = MHD_YES;
+#if HAVE_ZLIB
+      if (NULL != connection->inflater)
+        {
+          if (MHD_NO == inflate_request_body (connection,
+                                              head,
+                                              &processed))
+            return;
+        }
+      else
+#endif
+      if (MHD_NO ==
+          connection->daemon->default_handler (connection->daemon->default_handler_cls,
+                                               connection,
+                                               connection->url,
+                                               connection->method,
+                                               connection->version,
+                                               head,
+                                               &processed,
+                                               &connection->client_context))
+        {
+          /* serious internal error, close connection */
+	  CONNECTION_CLOSE_ERROR (connection,
+				  "Internal application error, closing connection.\n");
+          return;
+        }
+      if (processed > decoded)
+        mhd_panic (mhd_panic_cls, __FILE__, __LINE__
+#ifdef HAVE_MESSAGES
+		   , "API violation"
+#else
+		   , NULL
+#endif
+		   );
+      used = decoded - processed;
+      head += used;
+      available -= used;
+      decoded -= used;
+      src -= used;
+      if ( (0 != processed) ||
+           (src == available) )
+        break; /* handler is not done, or nothing left to decode */
+    }
+  if ( (available > 0) &&
+       (head != connection->read_buffer) )
+    memmove (connection->read_buffer, head, available);
+  connection->read_buffer_offset = available;
+  connection->read_buffer_scan_offset = 0;
+  connection->chunk_decoded = decoded;
+}
+
+
+/**
+ * Pass the body received into the buffer (or descriptor) of the
+ * application to the access handler, which must process all of it.
+ *
+ * @param connection connection we're processing
+ */
+static void
+pass_upload_buffer (struct MHD_Connection *connection)
+{
+  size_t processed;
+  size_t used;
+
+  processed = connection->upload_buffer_fill;
+  used = processed;
+  connection->client_aware = MHD_YES;
+  if (MHD_NO ==
+      connection->daemon->default_handler (connection->daemon->default_handler_cls,
+                                           connection,
+                                           connection->url,
+                                           connection->method,
+                                           connection->version,
+                                           connection->upload_buffer,
+                                           &processed,
+                                           &connection->client_context))
+    {
+      /* serious internal error, close connection */
+      CONNECTION_CLOSE_ERROR (connection,
+                              "Internal application error, closing connection.\n");
+      return;
+    }
+  if (0 != processed)
+    {
+      /* the data is in the application's buffer, we cannot keep it */
+      CONNECTION_CLOSE_ERROR (connection,
+                              "Application did not process upload from its buffer, closing connection.\n");
+      return;
+    }
+  connection->remaining_upload_size -= used;
+  connection->upload_buffer = NULL;
+  connection->upload_fd = -1;
+  connection->upload_buffer_size = 0;
+  connection->upload_buffer_fill = 0;
+}
+
+
+/**
+ * Call the handler of the application for this
+ * connection.  Handles chunking of the upload
+ * as well as normal uploads.
+ *
+ * @param connection connection we're processing
+ */
+static void
+process_request_body (struct MHD_Connection *connection)
+{
+  size_t processed;
+  size_t available;
+  size_t used;
+  size_t i;
+  int instant_retry;
+  int malformed;
+  char *buffer_head;
+  char *end;
+
+  if (NULL != connection->response)
+    return;                     /* already queued a response */
+  if (MHD_YES == upload_buffer_ready (connection))
+    {
+      pass_upload_buffer (connection);
+      return;
+    }
+
+  if ( (MHD_YES == connection->have_chunked_upload) &&
+       (MHD_SIZE_UNKNOWN == connection->remaining_upload_size) &&
+       (MHD_YES == connection->daemon->coalesce_chunked_upload) )
+    {
+      process_coalesced_chunks (connection);
+      return;
+    }
+  buffer_head = connection->read_buffer;
+  available = connection->read_buffer_offset;
+  do
+    {
+      instant_retry = MHD_NO;
+      if ( (MHD_YES == connection->have_chunked_upload) &&
+           (MHD_SIZE_UNKNOWN == connection->remaining_upload_size) )
+        {
+          if ( (connection->current_chunk_offset == connection->current_chunk_size) &&
+               (0 != connection->current_chunk_offset) &&
+               (available >= 2) )
+            {
+              /* skip new line at the *end* of a chunk */
+              i = 0;
+              if ((buffer_head[i] == '\r') || (buffer_head[i] == '\n'))
+                i++;            /* skip 1st part of line feed */
+              if ((buffer_head[i] == '\r') || (buffer_head[i] == '\n'))
+                i++;            /* skip 2nd part of line feed */
+              if (i == 0)
+                {
+                  /* malformed encoding */
+                  CONNECTION_CLOSE_ERROR (connection,
+					  "Received malformed HTTP request (bad chunked encoding), closing connection.\n");
+                  return;
+                }
+              available -= i;
+              buffer_head += i;
+              connection->current_chunk_offset = 0;
+              connection->current_chunk_size = 0;
+            }
+          if (connection->current_chunk_offset <
+              connection->current_chunk_size)
+            {
+              /* we are in the middle of a chunk, give
+                 as much as possible to the client (without
+                 crossing chunk boundaries) */
+              processed =
+                connection->current_chunk_size -
+                connection->current_chunk_offset;
+              if (processed > available)
+                processed = available;
+              if (available > processed)
+                instant_retry = MHD_YES;
+            }
+          else
+            {
+              /* we need to read chunk boundaries */
+              i = 0;
+              while (i < available)
+                {
+                  if ((buffer_head[i] == '\r') || (buffer_head[i] == '\n'))
+                    break;
+                  i++;
+                  if (i >= 6)
+                    break;
+                }
+              /* take '\n' into account; if '\n'
+                 is the unavailable character, we
+                 will need to wait until we have it
+                 before going further */
+              if ((i + 1 >= available) &&
+                  !((i == 1) && (available == 2) && (buffer_head[0] == '0')))
+                break;          /* need more data... */
+              malformed = (i >= 6);
+              if (!malformed)
+                {
+                  buffer_head[i] = '\0';
+		  connection->current_chunk_size = strtoul (buffer_head, &end, 16);
+                  malformed = ('\0' != *end);
+                }
+              if (malformed)
+                {
+                  /* malformed encoding */
+                  CONNECTION_CLOSE_ERROR (connection,
+					  "Received malformed HTTP request (bad chunked encoding), closing connection.\n");
+                  return;
+                }
+              i++;
+              if ((i < available) &&
+                  ((buffer_head[i] == '\r') || (buffer_head[i] == '\n')))
+                i++;            /* skip 2nd part of line feed */
+
+              buffer_head += i;
+              available -= i;
+              connection->current_chunk_offset = 0;
+
+              if (available > 0)
+                instant_retry = MHD_YES;
+              if (0 == connection->current_chunk_size)
+                {
+                  connection->remaining_upload_size = 0;
+                  break;
+                }
+              continue;
+            }
+        }
+      else
+        {
+          /* no chunked encoding, give all to the client */
+          if ( (0 != connection->remaining_upload_size) &&
+	       (MHD_SIZE_UNKNOWN != connection->remaining_upload_size) &&
+	       (connection->remaining_upload_size < available) )
+	    {
+              processed = (size_t)connection->remaining_upload_size;
+	    }
+          else
+	    {
+              /**
+               * 1. no chunked encoding, give all to the client
+               * 2. client may send large chunked data, but only a smaller part is available at one time.
+               */
+              processed = available;
+	    }
+        }
+      used = processed;
+      connection->client_aware = MHD_YES;
+#if HAVE_ZLIB
+      if (NULL != connection->inflater)
+        {
+          if (MHD_NO == inflate_request_body (connection,
+                                              buffer_head,
+                                              &processed))
+            return;
+        }
+      else
+#endif
+      if (MHD_NO ==
+          connection->daemon->default_handler (connection->daemon->default_handler_cls,
+                                               connection,
+                                               connection->url,
+                                               connection->method,
+                                               connection->version,
+                                               buffer_head,
+                                               &processed,
+                                               &connection->client_context))
+        {
+          /* serious internal error, close connection */
+	  CONNECTION_CLOSE_ERROR (connection,
+				  "Internal application error, closing connection.\n");
+          return;
+        }
+      if (processed > used)
+        mhd_panic (mhd_panic_cls, __FILE__, __LINE__
+#ifdef HAVE_MESSAGES
+		   , "API violation"
+#else
+		   , NULL
+#endif
+		   );
+      if (0 != processed)
+        instant_retry = MHD_NO; /* client did not process everything */
+      used -= processed;
+      if (connection->have_chunked_upload == MHD_YES)
+        connection->current_chunk_offset += used;
+      /* dh left "processed" bytes in buffer for next time... */
+      buffer_head += used;
+      available -= used;
+      if (connection->remaining_upload_size != MHD_SIZE_UNKNOWN)
+        connection->remaining_upload_size -= used;
+    }
+  while (MHD_YES == instant_retry);
+  if (available > 0)
+    memmove (connection->read_buffer, buffer_head, available);
+  connection->read_buffer_offset = available;
+  connection->read_buffer_scan_offset = 0;
+}
+
+
+/**
+ * Add a value to a histogram of the daemon, see
+ * #MHD_LATENCY_BUCKETS for the layout of the buckets.
+ *
+ * @param histogram histogram to add to
+ * @param usec the value, a latency in microseconds or a size in bytes
+ */
+static void
+record_latency (struct MHD_LatencyHistogram *histogram,
+                uint64_t usec)
+{
+  uint64_t mantissa;
+  unsigned int shift;
+  unsigned int bucket;
+
+  mantissa = usec;
+  shift = 0;
+  while (mantissa >= 32)
+    {
+      mantissa >>= 1;
+      shift++;
+    }
+  bucket = shift * 16 + (unsigned int) mantissa;
+  if (bucket >= MHD_LATENCY_BUCKETS)
+    bucket = MHD_LATENCY_BUCKETS - 1;
+  MHD_LATENCY_ADD_ (histogram->buckets[bucket], 1);
+  MHD_LATENCY_ADD_ (histogram->sum, usec);
+  MHD_LATENCY_ADD_ (histogram->count, 1);
+}
+
+
+/**
+ * Remember the peak usage of the memory pool of @a connection before
+ * the pool is released.
+ *
+ * @param connection connection to update
+ */
+static void
+keep_pool_peak (struct MHD_Connection *connection)
+{
+  size_t peak;
+
+  if (NULL == connection->pool)
+    return;
+  peak = MHD_pool_get_peak (connection->pool);
+  if (peak > connection->pool_peak)
+    connection->pool_peak = peak;
+}
+
+
+/**
+ * Add a sample to one of the averages from which overload is
+ * detected (see #MHD_OPTION_OVERLOAD_LATENCY).
+ *
+ * @param avg average to update, times #MHD_OVERLOAD_AVG_SCALE
+ * @param sample the sample in milliseconds
+ */
+static void
+overload_sample (uint64_t *avg,
+                 uint64_t sample)
+{
+  *avg = *avg - *avg / MHD_OVERLOAD_AVG_SCALE + sample;
+}
+
+
+/**
+ * Check if the event loop lag or the handler latency of the daemon
+ * of @a connection exceeds #MHD_OPTION_OVERLOAD_LATENCY, so that
+ * the request must be rejected before the access handler is called.
+ *
+ * @param connection connection with a new request
+ * @return #MHD_YES if the request must be rejected
+ */
+static int
+is_overloaded (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+  const uint64_t limit
+    = (uint64_t) daemon->overload_latency * MHD_OVERLOAD_AVG_SCALE;
+
+  if ( (0 == daemon->overload_latency) ||
+       (MHD_PRIORITY_HIGH == connection->priority) )
+    return MHD_NO;
+  if ( (daemon->loop_lag_avg < limit) &&
+       (daemon->handler_latency_avg < limit) )
+    return MHD_NO;
+  /* the rejected request did not keep the handlers busy */
+  overload_sample (&daemon->handler_latency_avg,
+                   0);
+  return MHD_YES;
+}
+
+
+/**
+ * Queue the response passed to #MHD_complete_response() for a request
+ * deferred with #MHD_defer_response(), if it arrived already.
+ *
+ * @param connection connection with a deferred request
+ */
+static void
+queue_deferred_response (struct MHD_Connection *connection)
+{
+  struct MHD_Response *response;
+  enum MHD_DeferState state;
+
+#ifdef HAVE_ATOMIC_BUILTINS
+  state = __atomic_load_n (&connection->deferred,
+                           __ATOMIC_ACQUIRE);
+#else
+  if (MHD_YES != MHD_mutex_lock_ (&connection->daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  state = connection->deferred;
+  if (MHD_YES != MHD_mutex_unlock_ (&connection->daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+#endif
+  if (MHD_DEFER_COMPLETE != state)
+    return;
+  /* nobody else touches the request any more */
+  response = connection->deferred_response;
+  connection->deferred_response = NULL;
+  connection->deferred = MHD_DEFER_NONE;
+  if (MHD_NO == MHD_queue_response (connection,
+                                    connection->deferred_status,
+                                    response))
+    CONNECTION_CLOSE_ERROR (connection,
+                            "Closing connection (failed to queue deferred response)\n");
+  MHD_destroy_response (response);
+}
+
+
+/**
+ * Run a step of the request processing that calls the access handler
+ * of the application.  With #MHD_OPTION_HANDLER_THREADS, the step is
+ * handed to the handler threads instead and the connection suspended
+ * until it is done; the state machine then continues after the step.
+ *
+ * @param connection connection we're processing
+ * @param step the step to run
+ * @param done step a handler thread completed before this round of
+ *        the state machine, which is not run again (and cleared);
+ *        NULL if running @a step again is harmless
+ * @return #MHD_YES if the step is done, #MHD_NO if it was handed
+ *         to the handler threads
+ */
+static int
+run_handler_step (struct MHD_Connection *connection,
+                  MHD_HandlerStep step,
+                  MHD_HandlerStep *done)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+  uint64_t start;
+
+  if ( (NULL != done) &&
+       (step == *done) )
+    {
+      *done = NULL;
+      /* includes the time the step waited for a handler thread */
+      if (0 != daemon->overload_latency)
+        overload_sample (&daemon->handler_latency_avg,
+                         MHD_monotonic_msec_counter ()
+                         - connection->handler_start);
+      return MHD_YES;
+    }
+  if (MHD_DEFER_NONE != connection->deferred)
+    {
+      /* the handler is not called again for a deferred request */
+      queue_deferred_response (connection);
+      return MHD_YES;
+    }
+  start = 0;
+  if (0 != daemon->overload_latency)
+    start = MHD_monotonic_msec_counter ();
+  /* nothing to call the handler for if a response is queued */
+  if (NULL == connection->response)
+    {
+      connection->handler_start = start;
+      if (MHD_YES == MHD_handler_offload_ (connection,
+                                           step))
+        return MHD_NO;
+    }
+  step (connection);
+  if (0 != daemon->overload_latency)
+    overload_sample (&daemon->handler_latency_avg,
+                     MHD_monotonic_msec_counter () - start);
+  return MHD_YES;
+}
+
+
+/**
+ * Try reading data from the socket into the
+ * read buffer of the connection.
+ *
+ * @param connection connection we're processing
+ * @return #MHD_YES if something changed,
+ *         #MHD_NO if we were interrupted or if
+ *                no space was available
+ */
+static int
+do_read (struct MHD_Connection *connection)
+{
+  ssize_t bytes_read;
+
+  if (connection->read_buffer_size == connection->read_buffer_offset)
+    return MHD_NO;
+  bytes_read = connection->recv_cls (connection,
+                                     &connection->read_buffer
+                                     [connection->read_buffer_offset],
+                                     connection->read_buffer_size -
+                                     connection->read_buffer_offset);
+  if (bytes_read < 0)
+    {
+      const int err = MHD_socket_errno_;
+      if ((EINTR == err) || (EAGAIN == err) || (EWOULDBLOCK == err))
+	  return MHD_NO;
+      if (ECONNRESET == err)
+        {
+           CONNECTION_CLOSE_ERROR (connection, NULL);
+	   return MHD_NO;
+	}
+      CONNECTION_CLOSE_ERROR (connection, NULL);
+      return MHD_YES;
+    }
+  if (0 == bytes_read)
+    {
+      /* other side closed connection; RFC 2616, section 8.1.4 suggests
+	 we should then shutdown ourselves as well. */
+      connection->read_closed = MHD_YES;
+      MHD_connection_close_ (connection,
+                             MHD_REQUEST_TERMINATED_CLIENT_ABORT);
+      return MHD_YES;
+    }
+  if (0 == connection->request_times.first_byte)
+    connection->request_times.first_byte = MHD_monotonic_usec_counter ();
+  MHD_PROBE2 (read, connection, bytes_read);
+  connection->read_buffer_offset += bytes_read;
+  return MHD_YES;
+}
+
+
+/**
+ * Receive the body of the request directly into the buffer (or
+ * descriptor) of the application, see
+ * #MHD_OPTION_UPLOAD_BUFFER_CALLBACK, if the application provides
+ * one.  Body data that arrived together with the headers is passed
+ * from the read buffer first.
+ *
+ * @param connection connection we're processing
+ * @return #MHD_YES if the body is received this way (including
+ *         waiting for the access handler to take the buffer),
+ *         #MHD_NO to use the read buffer
+ */
+static int
+do_read_upload (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+  uint64_t left;
+  size_t want;
+  size_t size;
+  ssize_t bytes_read;
+  void *buf;
+  int fd;
+
+  if ( (NULL == daemon->upload_buffer_callback) ||
+#if HAVE_ZLIB
+       (NULL != connection->inflater) ||
+#endif
+       (MHD_CONNECTION_CONTINUE_SENT != connection->state) ||
+       (MHD_YES == connection->have_chunked_upload) ||
+       (MHD_SIZE_UNKNOWN == connection->remaining_upload_size) ||
+       (0 != connection->read_buffer_offset) ||
+       (NULL != connection->response) )
+    return MHD_NO;
+  if ( (NULL == connection->upload_buffer) &&
+       (-1 == connection->upload_fd) )
+    {
+      if (0 == connection->remaining_upload_size)
+        return MHD_NO;
+      size = 0;
+      fd = -1;
+      buf = daemon->upload_buffer_callback (daemon->upload_buffer_callback_cls,
+                                            connection,
+                                            &connection->client_context,
+                                            connection->remaining_upload_size,
+                                            &size,
+                                            &fd);
+      if (0 == size)
+        return MHD_NO;
+      if (NULL != buf)
+        connection->upload_buffer = buf;
+#if HAVE_SPLICE
+      else if ( (-1 != fd) &&
+                (0 == (daemon->options & MHD_USE_SSL)) )
+        connection->upload_fd = fd;
+#endif
+      else
+        return MHD_NO;
+      connection->upload_buffer_size = size;
+      connection->upload_buffer_fill = 0;
+    }
+  left = connection->remaining_upload_size - connection->upload_buffer_fill;
+  want = connection->upload_buffer_size - connection->upload_buffer_fill;
+  if (want > left)
+    want = (size_t) left;
+  if (0 == want)
+    return MHD_YES; /* waiting for the access handler */
+#if HAVE_SPLICE
+  if (-1 != connection->upload_fd)
+    {
+      splice_upload (connection,
+                     want);
+      return MHD_YES;
+    }
+#endif
+  bytes_read = connection->recv_cls (connection,
+                                     &connection->upload_buffer
+                                     [connection->upload_buffer_fill],
+                                     want);
+  if (bytes_read < 0)
+    {
+      const int err = MHD_socket_errno_;
+      if ((EINTR == err) || (EAGAIN == err) || (EWOULDBLOCK == err))
+        return MHD_YES;
+      CONNECTION_CLOSE_ERROR (connection, NULL);
+      return MHD_YES;
+    }
+  if (0 == bytes_read)
+    {
+      /* other side closed connection */
+      connection->read_closed = MHD_YES;
+      MHD_connection_close_ (connection,
+                             MHD_REQUEST_TERMINATED_CLIENT_ABORT);
+      return MHD_YES;
+    }
+  MHD_PROBE2 (read, connection, bytes_read);
+  connection->upload_buffer_fill += bytes_read;
+  return MHD_YES;
+}
+
+
+/**
+ * Try writing data to the socket from the
+ * write buffer of the connection.
+ *
+ * @param connection connection we're processing
+ * @return #MHD_YES if something changed,
+ *         #MHD_NO if we were interrupted
+ */
+static int
+do_write (struct MHD_Connection *connection)
+{
+  ssize_t ret;
+  size_t max;
+
+  max = connection->write_buffer_append_offset - connection->write_buffer_send_offset;
+  ret = connection->send_cls (connection,
+                              &connection->write_buffer
+                              [connection->write_buffer_send_offset],
+                              max);
+
+  if (ret < 0)
+    {
+      const int err = MHD_socket_errno_;
+      if ((EINTR == err) || (EAGAIN == err) || (EWOULDBLOCK == err))
+        return MHD_NO;
+      CONNECTION_CLOSE_ERROR (connection, NULL);
+      return MHD_YES;
+    }
+#if DEBUG_SEND_DATA
+  fprintf (stderr,
+           "Sent response: `%.*s'\n",
+           ret,
+           &connection->write_buffer[connection->write_buffer_send_offset]);
+#endif
+  /* only increment if this wasn't a "sendfile" transmission without
+     buffer involvement! */
+  if (0 != max)
+    connection->write_buffer_send_offset += ret;
+  return MHD_YES;
+}
+
+
+/**
+ * Check if we are done sending the write-buffer.
+ * If so, transition into "next_state".
+ *
+ * @param connection connection to check write status for
+ * @param next_state the next state to transition to
+ * @return #MHD_NO if we are not done, #MHD_YES if we are
+ */
+static int
+check_write_done (struct MHD_Connection *connection,
+                  enum MHD_CONNECTION_STATE next_state)
+{
+  if (connection->write_buffer_append_offset !=
+      connection->write_buffer_send_offset)
+    return MHD_NO;
+  connection->write_buffer_append_offset = 0;
+  connection->write_buffer_send_offset = 0;
+  connection->state = next_state;
+  MHD_pool_reallocate (connection->pool,
+		       connection->write_buffer,
+                       connection->write_buffer_size, 0);
+  connection->write_buffer = NULL;
+  connection->write_buffer_size = 0;
+  return MHD_YES;
+}
+
+
+/**
+ * The body of the response (or the current range of it) was sent
+ * completely.  For a multipart/byteranges body, prepare sending the
+ * header of the next part (reusing the vectored send of headers and
+ * body) or the delimiter that ends the body.
+ *
+ * @param connection connection we're processing
+ */
+static void
+body_part_sent (struct MHD_Connection *connection)
+{
+  size_t len;
+  char *buf;
+  int last;
+
+  last = (connection->range_current + 1 >= connection->ranges_count)
+    ? MHD_YES : MHD_NO;
+  if ( (MHD_YES == last) &&
+       (connection->ranges_count <= 1) )
+    {
+      connection->state = MHD_CONNECTION_FOOTERS_SENT; /* have no footers */
+      return;
+    }
+  if (MHD_YES == last)
+    {
+      len = MHD_RANGE_CLOSE_DELIMITER_LEN;
+    }
+  else
+    {
+      connection->range_current++;
+      connection->response_write_position
+        = connection->ranges[connection->range_current].start;
+      len = format_part_header (connection,
+                                connection->range_current,
+                                NULL);
+    }
+  buf = MHD_pool_allocate (connection->pool,
+                           len + 1,
+                           MHD_NO);
+  if (NULL == buf)
+    {
+      MHD_STATS_ADD_ (connection->daemon, pool_fail_write_buffer, 1);
+      CONNECTION_CLOSE_ERROR (connection,
+                              "Closing connection (out of memory)\n");
+      return;
+    }
+  connection->write_buffer = buf;
+  connection->write_buffer_size = len + 1;
+  connection->write_buffer_send_offset = 0;
+  connection->write_buffer_append_offset = len;
+  if (MHD_YES == last)
+    {
+      format_close_delimiter (connection,
+                              buf);
+      connection->state = MHD_CONNECTION_FOOTERS_SENDING;
+    }
+  else
+    {
+      (void) format_part_header (connection,
+                                 connection->range_current,
+                                 buf);
+      connection->state = MHD_CONNECTION_HEADERS_SENDING;
+    }
+}
+
+
+/**
+ * We have received (possibly the beginning of) a line in the
+ * header (or footer).  Validate (check for ":") and prepare
+ * to process.
+ *
+ * @param connection connection we're processing
+ * @param line line from the header to process
+ * @param line_len length of @a line
+ * @return #MHD_YES on success, #MHD_NO on error (malformed @a line)
+ */
+static int
+process_header_line (struct MHD_Connection *connection,
+                     char *line,
+                     size_t line_len)
+{
+  char *colon;
+
+  /* line should be normal header line, find colon */
+  colon = memchr (line, ':', line_len);
+  if (NULL == colon)
+    {
+      /* error in header line, die hard */
+      CONNECTION_CLOSE_ERROR (connection,
+			      "Received malformed line (no colon), closing connection.\n");
+      return MHD_NO;
+    }
+  /* zero-terminate header */
+  colon[0] = '\0';
+  connection->last_size = colon - line;
+  colon++;                      /* advance to value */
+  while ((colon[0] != '\0') && ((colon[0] == ' ') || (colon[0] == '\t')))
+    colon++;
+  /* we do the actual adding of the connection
+     header at the beginning of the while
+     loop since we need to be able to inspect
+     the *next* header line (in case it starts
+     with a space...) */
+  connection->last = line;
+  connection->colon = colon;
+  connection->colon_size = line_len - (colon - line);
+  return MHD_YES;
+}
+
+
+/**
+ * Process a header value that spans multiple lines.
+ * The previous line(s) are in connection->last.
+ *
+ * @param connection connection we're processing
+ * @param line the current input line
+ * @param line_len length of @a line
+ * @param kind if the line is complete, add a header
+ *        of the given kind
+ * @return #MHD_YES if the line was processed successfully
+ */
+static int
+process_broken_line (struct MHD_Connection *connection,
+                     char *line,
+                     size_t line_len,
+                     enum MHD_ValueKind kind)
+{
+  char *last;
+  char *tmp;
+  size_t last_len;
+  size_t tmp_len;
+
+  last = connection->last;
+  if ((line[0] == ' ') || (line[0] == '\t'))
+    {
+      /* value was continued on the next line, see
+         http://www.jmarshall.com/easy/http/ */
+      last_len = strlen (last);
+      /* skip whitespace at start of 2nd line */
+      tmp = line;
+      while ((tmp[0] == ' ') || (tmp[0] == '\t'))
+        tmp++;
+      tmp_len = strlen (tmp);
+      /* FIXME: we might be able to do this better (faster!), as most
+	 likely 'last' and 'line' should already be adjacent in
+	 memory; however, doing this right gets tricky if we have a
+	 value continued over multiple lines (in which case we need to
+	 record how often we have done this so we can check for
+	 adjaency); also, in the case where these are not adjacent
+	 (not sure how it can happen!), we would want to allocate from
+	 the end of the pool, so as to not destroy the read-buffer's
+	 ability to grow nicely. */
+      last = MHD_pool_reallocate (connection->pool,
+                                  last,
+                                  last_len + 1,
+                                  last_len + tmp_len + 1);
+      if (NULL == last)
+        {
+          MHD_STATS_ADD_ (connection->daemon, pool_fail_headers, 1);
+          transmit_error_response (connection,
+                                   MHD_HTTP_REQUEST_ENTITY_TOO_LARGE,
+                                   REQUEST_TOO_BIG);
+          return MHD_NO;
+        }
+      memcpy (&last[last_len], tmp, tmp_len + 1);
+      connection->last = last;
+      connection->last_size = last_len + tmp_len;
+      connection->colon_size = strlen (connection->colon);
+      return MHD_YES;           /* possibly more than 2 lines... */
+    }
+  EXTRA_CHECK ((NULL != last) && (NULL != connection->colon));
+  if ((MHD_NO == connection_add_header (connection,
+                                        last,
+                                        connection->last_size,
+					connection->colon,
+                                        connection->colon_size,
+					kind)))
+    {
+      transmit_error_response (connection, MHD_HTTP_REQUEST_ENTITY_TOO_LARGE,
+                               REQUEST_TOO_BIG);
+      return MHD_NO;
+    }
+  /* we still have the current line to deal with... */
+  if (0 != line[0])
+    {
+      if (MHD_NO == process_header_line (connection, line, line_len))
+        {
+          transmit_error_response (connection,
+                                   MHD_HTTP_BAD_REQUEST, REQUEST_MALFORMED);
+          return MHD_NO;
+        }
+    }
+  return MHD_YES;
+}
+
+
+#if HAVE_ZLIB
+/**
+ * Set up @a connection to decompress the body of the request if it
+ * is sent with a content coding MHD can decompress, see
+ * #MHD_OPTION_INFLATE_REQUEST_BODY.  Other codings are passed to the
+ * access handler as received.
+ *
+ * @param connection connection we're processing
+ */
+static void
+setup_inflater (struct MHD_Connection *connection)
+{
+  const char *enc;
+  int gzip;
+
+  enc = MHD_lookup_connection_token_value (connection,
+                                           MHD_HEADER_KIND,
+                                           MHD_HEADER_TOKEN_CONTENT_ENCODING);
+  if (NULL == enc)
+    return;
+  if ( (MHD_str_equal_caseless_ (enc, "gzip")) ||
+       (MHD_str_equal_caseless_ (enc, "x-gzip")) )
+    gzip = MHD_YES;
+  else if (MHD_str_equal_caseless_ (enc, "deflate"))
+    gzip = MHD_NO;
+  else
+    return;
+  connection->inflater = MHD_inflater_get_ (connection->daemon,
+                                            gzip);
+  if (NULL == connection->inflater)
+    CONNECTION_CLOSE_ERROR (connection,
+                            "Closing connection (out of memory)\n");
+}
+#endif
+
+
+/**
+ * Parse the various headers; figure out the size
+ * of the upload and make sure the headers follow
+ * the protocol.  Advance to the appropriate state.
+ *
+ * @param connection connection we're processing
+ */
+static void
+parse_connection_headers (struct MHD_Connection *connection)
+{
+  const char *clen;
+  MHD_UNSIGNED_LONG_LONG cval;
+  struct MHD_Response *response;
+  const char *enc;
+  char *end;
+
+  MHD_connection_parse_cookies_ (connection);
+  if ( (0 != (MHD_USE_PEDANTIC_CHECKS & connection->daemon->options)) &&
+       (NULL != connection->version) &&
+       (MHD_str_equal_caseless_(MHD_HTTP_VERSION_1_1, connection->version)) &&
+       (NULL ==
+        MHD_lookup_connection_token_value (connection,
+                                           MHD_HEADER_KIND,
+                                           MHD_HEADER_TOKEN_HOST)) )
+    {
+      /* die, http 1.1 request without host and we are pedantic */
+      connection->state = MHD_CONNECTION_FOOTERS_RECEIVED;
+      connection->read_closed = MHD_YES;
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (connection->daemon,
+                "Received `%s' request without `%s' header.\n",
+                MHD_HTTP_VERSION_1_1, MHD_HTTP_HEADER_HOST);
+#endif
+      EXTRA_CHECK (NULL == connection->response);
+      response = get_error_response (connection->daemon,
+                                     MHD_HTTP_BAD_REQUEST,
+                                     REQUEST_LACKS_HOST);
+      if (NULL != response)
+        {
+          MHD_queue_response (connection, MHD_HTTP_BAD_REQUEST, response);
+          return;
+        }
+      response =
+        MHD_create_response_from_buffer (strlen (REQUEST_LACKS_HOST),
+					 REQUEST_LACKS_HOST,
+					 MHD_RESPMEM_PERSISTENT);
+      MHD_queue_response (connection, MHD_HTTP_BAD_REQUEST, response);
+      MHD_destroy_response (response);
+      return;
+    }
+
+  connection->remaining_upload_size = 0;
+  enc = MHD_lookup_connection_token_value (connection,
+                                           MHD_HEADER_KIND,
+                                           MHD_HEADER_TOKEN_TRANSFER_ENCODING);
+  if (NULL != enc)
+    {
+      connection->remaining_upload_size = MHD_SIZE_UNKNOWN;
+      if (MHD_str_equal_caseless_(enc, "chunked"))
+        connection->have_chunked_upload = MHD_YES;
+    }
+  else
+    {
+      clen = MHD_lookup_connection_token_value (connection,
+                                                MHD_HEADER_KIND,
+                                                MHD_HEADER_TOKEN_CONTENT_LENGTH);
+      if (NULL != clen)
+        {
+          cval = strtoul (clen, &end, 10);
+          if ( ('\0' != *end) ||
+	     ( (LONG_MAX == cval) && (errno == ERANGE) ) )
+            {
+#ifdef HAVE_MESSAGES
+              MHD_DLOG (connection->daemon,
+                        "Failed to parse `%s' header `%s', closing connection.\n",
+                        MHD_HTTP_HEADER_CONTENT_LENGTH,
+                        clen);
+#endif
+	      CONNECTION_CLOSE_ERROR (connection, NULL);
+              return;
+            }
+          connection->remaining_upload_size = cval;
+        }
+    }
+#if HAVE_ZLIB
+  if ( (0 != connection->daemon->inflate_ratio) &&
+       (0 != connection->remaining_upload_size) )
+    setup_inflater (connection);
+#endif
+}
+
+
+/**
+ * Add a connection to the data structure used to find timed-out
+ * connections: the sorted list for connections with the daemon's
+ * default timeout, otherwise the timer wheel.  Connections with a
+ * custom timeout of zero never time out and are not tracked.  The
+ * caller must hold the cleanup mutex if required.
+ *
+ * @param connection connection to add
+ */
+void
+MHD_connection_timeout_insert_ (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+  uint64_t deadline;
+  unsigned int slot;
+
+  if (connection->connection_timeout == daemon->connection_timeout)
+    {
+      XDLL_insert (daemon->normal_timeout_head,
+                   daemon->normal_timeout_tail,
+                   connection);
+      if (NULL == daemon->idle_release_next)
+        daemon->idle_release_next = connection;
+      return;
+    }
+  if (0 == connection->connection_timeout)
+    return; /* never times out */
+  /* the tick at (or after) the deadline */
+  deadline = (connection->last_activity + connection->connection_timeout
+              + MHD_TIMER_WHEEL_TICK - 1) / MHD_TIMER_WHEEL_TICK;
+  if (deadline <= daemon->timer_wheel_time)
+    deadline = daemon->timer_wheel_time + 1; /* slot already processed */
+  slot = (unsigned int) (deadline % MHD_TIMER_WHEEL_SIZE);
+  connection->timer_wheel_slot = slot;
+  XDLL_insert (daemon->timer_wheel_head[slot],
+               daemon->timer_wheel_tail[slot],
+               connection);
+  daemon->timer_wheel_count++;
+}
+
+
+/**
+ * Remove a connection from the timeout data structure, see
+ * #MHD_connection_timeout_insert_().
+ *
+ * @param connection connection to remove
+ */
+void
+MHD_connection_timeout_remove_ (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+  unsigned int slot;
+
+  if (connection->connection_timeout == daemon->connection_timeout)
+    {
+      if (connection == daemon->idle_release_next)
+        daemon->idle_release_next = connection->prevX;
+      XDLL_remove (daemon->normal_timeout_head,
+                   daemon->normal_timeout_tail,
+                   connection);
+      return;
+    }
+  if (0 == connection->connection_timeout)
+    return; /* never times out, not tracked */
+  slot = connection->timer_wheel_slot;
+  XDLL_remove (daemon->timer_wheel_head[slot],
+               daemon->timer_wheel_tail[slot],
+               connection);
+  daemon->timer_wheel_count--;
+}
+
+
+/**
+ * Arm the guard of @a connection against slow clients for
+ * @a deadline, moving it to the matching slot of the guard wheel of
+ * its daemon; 0 disarms it.  With #MHD_USE_THREAD_PER_CONNECTION,
+ * there is no wheel: the thread of the connection waits for the
+ * deadline itself.
+ *
+ * @param connection connection to arm the guard of
+ * @param deadline time to check the connection at, see #MHD_loop_time_()
+ */
+static void
+guard_set (struct MHD_Connection *connection,
+           uint64_t deadline)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+  uint64_t tick;
+  unsigned int slot;
+
+  if (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
+    {
+      connection->guard_deadline = deadline;
+      return;
+    }
+  if (0 != connection->guard_deadline)
+    {
+      slot = connection->guard_slot;
+      GDLL_remove (daemon->guard_wheel_head[slot],
+                   daemon->guard_wheel_tail[slot],
+                   connection);
+      daemon->guard_wheel_count--;
+    }
+  connection->guard_deadline = deadline;
+  if (0 == deadline)
+    return;
+  tick = (deadline + MHD_TIMER_WHEEL_TICK - 1) / MHD_TIMER_WHEEL_TICK;
+  if (tick <= daemon->guard_wheel_time)
+    tick = daemon->guard_wheel_time + 1; /* slot already processed */
+  slot = (unsigned int) (tick % MHD_TIMER_WHEEL_SIZE);
+  connection->guard_slot = slot;
+  GDLL_insert (daemon->guard_wheel_head[slot],
+               daemon->guard_wheel_tail[slot],
+               connection);
+  daemon->guard_wheel_count++;
+}
+
+
+/**
+ * Disarm the guard of @a connection against slow clients and
+ * remove it from the guard wheel of its daemon, for example when
+ * the connection is suspended or closed.  The guard is armed again
+ * by the idle handler for the phase the request is in then.
+ *
+ * @param connection connection to remove
+ */
+void
+MHD_connection_guard_remove_ (struct MHD_Connection *connection)
+{
+  if (0 != connection->guard_deadline)
+    guard_set (connection,
+               0);
+  connection->guard_phase = MHD_GUARD_NONE;
+}
+
+
+/**
+ * Put the suspended @a connection into the guard wheel of its
+ * daemon, so that the suspension ends at @a deadline (see
+ * #MHD_suspend_connection_with_timeout()).  Must be called from the
+ * event loop of the connection.
+ *
+ * @param connection suspended connection
+ * @param deadline end of the suspension, see #MHD_loop_time_()
+ */
+void
+MHD_connection_suspend_deadline_ (struct MHD_Connection *connection,
+                                  uint64_t deadline)
+{
+  guard_set (connection,
+             deadline);
+  connection->guard_phase = MHD_GUARD_SUSPEND;
+}
+
+
+/**
+ * Determine what the guard against slow clients should watch in
+ * the current state of @a connection.
+ *
+ * @param connection connection to check
+ * @return phase of the guard
+ */
+static enum MHD_GuardPhase
+guard_phase (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+
+  switch (connection->state)
+    {
+    case MHD_CONNECTION_INIT:
+      if (0 == connection->read_buffer_offset)
+        return MHD_GUARD_NONE; /* waiting for the next request */
+      /* fall through */
+    case MHD_CONNECTION_URL_RECEIVED:
+    case MHD_CONNECTION_HEADER_PART_RECEIVED:
+      return (0 != daemon->header_timeout) ? MHD_GUARD_HEADER : MHD_GUARD_NONE;
+    case MHD_CONNECTION_CONTINUE_SENDING:
+    case MHD_CONNECTION_CONTINUE_SENT:
+    case MHD_CONNECTION_BODY_RECEIVED:
+    case MHD_CONNECTION_FOOTER_PART_RECEIVED:
+    case MHD_CONNECTION_HEADERS_SENDING:
+    case MHD_CONNECTION_NORMAL_BODY_READY:
+    case MHD_CONNECTION_NORMAL_BODY_UNREADY:
+    case MHD_CONNECTION_CHUNKED_BODY_READY:
+    case MHD_CONNECTION_CHUNKED_BODY_UNREADY:
+    case MHD_CONNECTION_FOOTERS_SENDING:
+      return (0 != daemon->min_data_rate) ? MHD_GUARD_RATE : MHD_GUARD_NONE;
+    default:
+      return MHD_GUARD_NONE;
+    }
+}
+
+
+/**
+ * Enforce #MHD_OPTION_HEADER_TIMEOUT_MS and #MHD_OPTION_MIN_DATA_RATE
+ * for @a connection: arm the guard when the request enters a new
+ * phase, and check it once its deadline passed.  Called by the idle
+ * handler, which the guard wheel runs for connections that have no
+ * events, so the read and write paths only count bytes.
+ *
+ * @param connection connection to check
+ * @return #MHD_NO if the connection was closed
+ */
+static int
+check_guard (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+  enum MHD_GuardPhase phase;
+  uint64_t now;
+
+  phase = guard_phase (connection);
+  now = MHD_loop_time_ (daemon);
+  if (phase != connection->guard_phase)
+    {
+      connection->guard_phase = phase;
+      connection->guard_bytes = connection->io_bytes;
+      switch (phase)
+        {
+        case MHD_GUARD_HEADER:
+          guard_set (connection,
+                     now + daemon->header_timeout);
+          break;
+        case MHD_GUARD_RATE:
+          guard_set (connection,
+                     now + MHD_DATA_RATE_WINDOW);
+          break;
+        default:
+          guard_set (connection,
+                     0);
+          break;
+        }
+      return MHD_YES;
+    }
+  if ( (0 == connection->guard_deadline) ||
+       (connection->guard_deadline > now) )
+    return MHD_YES;
+  if (MHD_GUARD_HEADER == phase)
+    {
+      MHD_STATS_ADD_ (daemon, header_timeouts, 1);
+      MHD_connection_close_ (connection,
+                             MHD_REQUEST_TERMINATED_TIMEOUT_REACHED);
+      return MHD_NO;
+    }
+  /* only count windows in which we waited for the client */
+  if ( ( (MHD_EVENT_LOOP_INFO_READ == connection->event_loop_info) ||
+         (MHD_EVENT_LOOP_INFO_WRITE == connection->event_loop_info) ) &&
+       (connection->io_bytes - connection->guard_bytes <
+        (uint64_t) daemon->min_data_rate * MHD_DATA_RATE_WINDOW / 1000) )
+    {
+      MHD_STATS_ADD_ (daemon, slow_transfers, 1);
+      MHD_connection_close_ (connection,
+                             MHD_REQUEST_TERMINATED_TIMEOUT_REACHED);
+      return MHD_NO;
+    }
+  connection->guard_bytes = connection->io_bytes;
+  guard_set (connection,
+             now + MHD_DATA_RATE_WINDOW);
+  return MHD_YES;
+}
+
+
+/**
+ * Update the 'last_activity' field of the connection to the current time
+ * and move the connection to the head of the 'normal_timeout' list if
+ * the timeout for the connection uses the default value.
+ *
+ * @param connection the connection that saw some activity
+ */
+static void
+update_last_activity (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+
+  connection->last_activity = MHD_loop_time_ (daemon);
+  if (connection->connection_timeout != daemon->connection_timeout)
+    return; /* custom timeout, no need to move it in "normal" DLL */
+
+  /* move connection to head of timeout list (by remove + add operation) */
+  if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
+       (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex)) )
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  MHD_connection_timeout_remove_ (connection);
+  MHD_connection_timeout_insert_ (connection);
+  if  ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
+	(MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex)) )
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+}
+
+
+/**
+ * This function handles a particular connection when it has been
+ * determined that there is data to be read off a socket.
+ *
+ * @param connection connection to handle
+ * @return always #MHD_YES (we should continue to process the
+ *         connection)
+ */
+int
+MHD_connection_handle_read (struct MHD_Connection *connection)
+{
+  update_last_activity (connection);
+  if (MHD_CONNECTION_CLOSED == connection->state)
+    return MHD_YES;
+  /* the first read may come before the first idle pass */
+  MHD_SLOW_REQUEST_STEP_ (connection);
+  if (MHD_CONNECTION_HTTP2 == connection->state)
+    {
+      /* the session has buffers of its own */
+      MHD_http2_handle_read_ (connection);
+      return MHD_YES;
+    }
+  if (MHD_YES == do_read_upload (connection))
+    return MHD_YES;
+  if (NULL == connection->pool)
+    {
+      /* pool was released while the connection was idle */
+      if ( (MHD_NO == MHD_memory_budget_take_ (connection->daemon)) &&
+           ( (MHD_NO == MHD_memory_budget_reclaim_ (connection->daemon)) ||
+             (MHD_NO == MHD_memory_budget_take_ (connection->daemon)) ) )
+        {
+          CONNECTION_CLOSE_ERROR (connection,
+                                  "Closing connection (memory budget exhausted)\n");
+          return MHD_YES;
+        }
+      connection->pool = MHD_pool_create_cached (&connection->daemon->pool_cache,
+                                                 &connection->daemon->pool_cache_len,
+                                                 connection->daemon->pool_size);
+      if (NULL == connection->pool)
+        {
+          MHD_memory_budget_return_ (connection->daemon);
+          CONNECTION_CLOSE_ERROR (connection,
+                                  "Closing connection (out of memory)\n");
+          return MHD_YES;
+        }
+    }
+  /* make sure "read" has a reasonable number of bytes
+     in buffer to use per system call (if possible) */
+  if (connection->read_buffer_offset + connection->daemon->pool_increment >
+      connection->read_buffer_size)
+    try_grow_read_buffer (connection);
+  if (MHD_NO == do_read (connection))
+    return MHD_YES;
+  while (1)
+    {
+#if DEBUG_STATES
+      MHD_DLOG (connection->daemon, "%s: state: %s\n",
+                __FUNCTION__,
+                MHD_state_to_string (connection->state));
+#endif
+      switch (connection->state)
+        {
+        case MHD_CONNECTION_INIT:
+        case MHD_CONNECTION_URL_RECEIVED:
+        case MHD_CONNECTION_HEADER_PART_RECEIVED:
+        case MHD_CONNECTION_HEADERS_RECEIVED:
+        case MHD_CONNECTION_HEADERS_PROCESSED:
+        case MHD_CONNECTION_CONTINUE_SENDING:
+        case MHD_CONNECTION_CONTINUE_SENT:
+        case MHD_CONNECTION_BODY_RECEIVED:
+        case MHD_CONNECTION_FOOTER_PART_RECEIVED:
+          /* nothing to do but default action */
+          if (MHD_YES == connection->read_closed)
+            {
+	      MHD_connection_close_ (connection,
+                                     MHD_REQUEST_TERMINATED_READ_ERROR);
+              continue;
+            }
+          break;
+        case MHD_CONNECTION_CLOSED:
+          return MHD_YES;
+        default:
+          /* shrink read buffer to how much is actually used */
+          if (NULL == connection->overflow)
+            MHD_pool_reallocate (connection->pool,
+                                 connection->read_buffer,
+                                 connection->read_buffer_size + 1,
+                                 connection->read_buffer_offset);
+          break;
+        }
+      break;
+    }
+  return MHD_YES;
+}
+
+
+/**
+ * This function was created to handle writes to sockets when it has
+ * been determined that the socket can be written to.
+ *
+ * @param connection connection to handle
+ * @return always #MHD_YES (we should continue to process the
+ *         connection)
+ */
+int
+MHD_connection_handle_write (struct MHD_Connection *connection)
+{
+  struct MHD_Response *response;
+  ssize_t ret;
+
+  update_last_activity (connection);
+  while (1)
+    {
+#if DEBUG_STATES
+      MHD_DLOG (connection->daemon, "%s: state: %s\n",
+                __FUNCTION__,
+                MHD_state_to_string (connection->state));
+#endif
+      switch (connection->state)
+        {
+        case MHD_CONNECTION_INIT:
+        case MHD_CONNECTION_URL_RECEIVED:
+        case MHD_CONNECTION_HEADER_PART_RECEIVED:
+        case MHD_CONNECTION_HEADERS_RECEIVED:
+          EXTRA_CHECK (0);
+          break;
+        case MHD_CONNECTION_HEADERS_PROCESSED:
+          break;
+        case MHD_CONNECTION_CONTINUE_SENDING:
+          if (MHD_NO == send_continue_message (connection))
+            {
+	      CONNECTION_CLOSE_ERROR (connection, NULL);
+              return MHD_YES;
+            }
+          break;
+        case MHD_CONNECTION_CONTINUE_SENT:
+        case MHD_CONNECTION_BODY_RECEIVED:
+        case MHD_CONNECTION_FOOTER_PART_RECEIVED:
+        case MHD_CONNECTION_FOOTERS_RECEIVED:
+          EXTRA_CHECK (0);
+          break;
+        case MHD_CONNECTION_HEADERS_SENDING:
+#if HTTPS_SUPPORT
+          if (MHD_NO == do_write_tls_header_and_body (connection))
+#endif
+#if HAVE_SENDMSG
+          if (MHD_NO == do_write_header_and_body (connection))
+#endif
+#if MHD_SENDFILE_WITH_HEADER_
+          if (MHD_NO == do_write_header_and_file (connection))
+#endif
+            do_write (connection);
+	  if (connection->state != MHD_CONNECTION_HEADERS_SENDING)
+ 	     break;
+          check_write_done (connection, MHD_CONNECTION_HEADERS_SENT);
+          break;
+        case MHD_CONNECTION_HEADERS_SENT:
+          EXTRA_CHECK (0);
+          break;
+        case MHD_CONNECTION_NORMAL_BODY_READY:
+          response = connection->response;
+          if (NULL != response->broadcast)
+            {
+              send_broadcast (connection);
+              break;
+            }
+          if (NULL != response->stream)
+            {
+              send_stream (connection);
+              break;
+            }
+          if (connection->response_write_position <
+              MHD_BODY_END_ (connection))
+          {
+            int err;
+            uint64_t data_write_offset;
+#if HAVE_SPLICE
+            if (MHD_YES == use_splice (connection))
+              {
+                send_body_spliced (connection);
+                break;
+              }
+#endif
+#if HAVE_SENDMSG
+            if ( (NULL != response->data_iov) &&
+                 (MHD_YES == can_send_body_vectored (connection)) )
+              {
+                /* no need to copy the fragments */
+                ret = send_body_vectored (connection,
+                                          0);
+                err = MHD_socket_errno_;
+              }
+            else
+#endif
+              {
+                if (NULL != response->crc)
+                  (void) MHD_mutex_lock_ (&response->mutex);
+                if (MHD_YES != try_ready_normal_body (connection))
+                  break;
+                data_write_offset = connection->response_write_position
+                                    - response->data_start;
+                if (data_write_offset > (uint64_t)SIZE_MAX)
+                  MHD_PANIC("Data offset exceeds limit");
+                ret = connection->send_cls (connection,
+                                            &response->data
+                                            [(size_t)data_write_offset],
+                                            (size_t) MHD_MIN ((uint64_t) (response->data_size -
+                                                                          (size_t)data_write_offset),
+                                                              MHD_BODY_END_ (connection) -
+                                                              connection->response_write_position));
+                err = MHD_socket_errno_;
+#if DEBUG_SEND_DATA
+                if (ret > 0)
+                  fprintf (stderr,
+                           "Sent %d-byte DATA response: `%.*s'\n",
+                           (int) ret,
+                           (int) ret,
+                           &response->data[connection->response_write_position -
+                                           response->data_start]);
+#endif
+                if (NULL != response->crc)
+                  (void) MHD_mutex_unlock_ (&response->mutex);
+              }
+            if (ret < 0)
+              {
+                if ((err == EINTR) || (err == EAGAIN) || (EWOULDBLOCK == err))
+                  return MHD_YES;
+#ifdef HAVE_MESSAGES
+                MHD_DLOG (connection->daemon,
+                          "Failed to send data: %s\n",
+                          MHD_socket_last_strerr_ ());
+#endif
+                CONNECTION_CLOSE_ERROR (connection, NULL);
+                return MHD_YES;
+              }
+            connection->response_write_position += ret;
+          }
+          if (connection->response_write_position ==
+              MHD_BODY_END_ (connection))
+            body_part_sent (connection);
+          break;
+        case MHD_CONNECTION_NORMAL_BODY_UNREADY:
+          EXTRA_CHECK (0);
+          break;
+        case MHD_CONNECTION_CHUNKED_BODY_READY:
+          if ( (NULL != connection->response->broadcast) ||
+               (NULL != connection->response->stream) )
+            {
+              if (NULL != connection->bc_event)
+                {
+                  send_broadcast (connection);
+                  break;
+                }
+              if ( (NULL != connection->response->stream) &&
+                   (MHD_NO == MHD_stream_ended_ (connection)) )
+                {
+                  send_stream (connection);
+                  break;
+                }
+              /* the last chunk */
+              do_write (connection);
+              if (MHD_CONNECTION_CHUNKED_BODY_READY != connection->state)
+                break;
+              check_write_done (connection,
+                                MHD_CONNECTION_BODY_SENT);
+              break;
+            }
+#if HAVE_SENDMSG
+          if (0 != connection->chunk_size)
+            {
+              send_chunk_vectored (connection);
+              break;
+            }
+#endif
+          /* nothing is left when the chunk went out from the scratch
+             buffer right away */
+          if (connection->write_buffer_send_offset !=
+              connection->write_buffer_append_offset)
+            do_write (connection);
+	  if (MHD_CONNECTION_CHUNKED_BODY_READY != connection->state)
+	     break;
+          check_write_done (connection,
+                            (MHD_YES == chunked_body_done (connection)) ?
+                            MHD_CONNECTION_BODY_SENT :
+                            MHD_CONNECTION_CHUNKED_BODY_UNREADY);
+          break;
+        case MHD_CONNECTION_CHUNKED_BODY_UNREADY:
+        case MHD_CONNECTION_BODY_SENT:
+          EXTRA_CHECK (0);
+          break;
+        case MHD_CONNECTION_FOOTERS_SENDING:
+          do_write (connection);
+	  if (connection->state != MHD_CONNECTION_FOOTERS_SENDING)
+	    break;
+          check_write_done (connection, MHD_CONNECTION_FOOTERS_SENT);
+          break;
+        case MHD_CONNECTION_FOOTERS_SENT:
+        case MHD_CONNECTION_UPGRADE:
+          EXTRA_CHECK (0);
+          break;
+        case MHD_CONNECTION_HTTP2:
+          MHD_http2_handle_write_ (connection);
+          break;
+        case MHD_CONNECTION_CLOSED:
+          return MHD_YES;
+        case MHD_TLS_CONNECTION_INIT:
+          EXTRA_CHECK (0);
+          break;
+        default:
+          EXTRA_CHECK (0);
+	  CONNECTION_CLOSE_ERROR (connection,
+                                  "Internal error\n");
+          return MHD_YES;
+        }
+      break;
+    }
+  return MHD_YES;
+}
+
+
+#if HAVE_ZLIB
+/**
+ * Return the compressor of @a connection (if any) to the daemon.
+ *
+ * @param connection connection we're processing
+ */
+static void
+release_compressor (struct MHD_Connection *connection)
+{
+  if (NULL == connection->compressor)
+    return;
+  MHD_compressor_release_ (connection->daemon,
+                           connection->compressor);
+  connection->compressor = NULL;
+  connection->compress_encoding = NULL;
+  connection->compress_input_done = MHD_NO;
+  connection->compress_done = MHD_NO;
+}
+
+
+/**
+ * Return the decompressor of @a connection (if any) to the daemon.
+ * Its buffer is in the memory pool, which is reset with the request.
+ *
+ * @param connection connection we're processing
+ */
+static void
+release_inflater (struct MHD_Connection *connection)
+{
+  if (NULL == connection->inflater)
+    return;
+  MHD_inflater_release_ (connection->daemon,
+                         connection->inflater);
+  connection->inflater = NULL;
+  connection->inflate_buffer = NULL;
+  connection->inflate_buffer_size = 0;
+  connection->inflate_offset = 0;
+  connection->inflate_fill = 0;
+  connection->inflate_in = 0;
+  connection->inflate_out = 0;
+  connection->inflate_done = MHD_NO;
+}
+#endif
+
+
+/**
+ * Clean up the state of the given connection and move it into the
+ * clean up queue for final disposal.
+ *
+ * @param connection handle for the connection to clean up
+ */
+static void
+cleanup_connection (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+
+#if HAVE_ZLIB
+  release_compressor (connection);
+  release_inflater (connection);
+#endif
+#if HAVE_SPLICE
+  release_splice_pipe (connection);
+#endif
+  release_broadcast (connection);
+  release_stream (connection);
+  if (NULL != connection->daemon->response_cache)
+    MHD_cache_release_ (connection);
+  /* a handler thread reading ahead still uses the response; it is
+     released by MHD_cleanup_connections() then */
+  if ( (NULL != connection->response) &&
+       (MHD_NO == MHD_prefetch_busy_ (connection)) )
+    {
+      MHD_destroy_response (connection->response);
+      connection->response = NULL;
+    }
+  if ( (0 != (daemon->options & (MHD_USE_THREAD_PER_CONNECTION | MHD_USE_SUSPEND_RESUME))) &&
+       (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex)) )
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  if (MHD_YES != connection->suspended)
+    {
+      MHD_connection_timeout_remove_ (connection);
+      MHD_connection_guard_remove_ (connection);
+    }
+  if ( (MHD_YES == connection->suspended) &&
+       (MHD_YES == connection->resuming) )
+    MHD_collect_resumed_connections_ (daemon);
+  if ( (MHD_YES == connection->suspended) &&
+       (MHD_YES == connection->resuming) )
+    DLL_remove (daemon->resumed_connections_head,
+                daemon->resumed_connections_tail,
+                connection);
+  else if (MHD_YES == connection->suspended)
+    DLL_remove (daemon->suspended_connections_head,
+                daemon->suspended_connections_tail,
+                connection);
+  else
+    {
+      DLL_remove (daemon->connections_head,
+                  daemon->connections_tail,
+                  connection);
+      MHD_poll_set_remove_ (connection);
+    }
+  DLL_insert (daemon->cleanup_head,
+	      daemon->cleanup_tail,
+	      connection);
+  connection->suspended = MHD_NO;
+  connection->resuming = MHD_NO;
+  connection->in_idle = MHD_NO;
+  if ( (0 != (daemon->options & (MHD_USE_THREAD_PER_CONNECTION | MHD_USE_SUSPEND_RESUME))) &&
+       (MHD_YES != MHD_mutex_unlock_(&daemon->cleanup_connection_mutex)) )
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+}
+
+
+/**
+ * The headers of an upgrade response were sent: suspend the
+ * connection, so that MHD no longer touches the socket and the
+ * connection cannot time out, and pass control over the socket to the
+ * application's #MHD_UpgradeHandler.  Once the application is done,
+ * #MHD_upgrade_action() resumes the connection to close it.
+ *
+ * @param connection connection to upgrade
+ */
+static void
+connection_upgrade (struct MHD_Connection *connection)
+{
+  struct MHD_Response *response = connection->response;
+  struct MHD_UpgradeResponseHandle *urh;
+
+  urh = MHD_pool_allocate (connection->pool,
+                           sizeof (struct MHD_UpgradeResponseHandle),
+                           MHD_YES);
+  if (NULL == urh)
+    {
+      MHD_STATS_ADD_ (connection->daemon, pool_fail_other, 1);
+      CONNECTION_CLOSE_ERROR (connection,
+                              "Not enough memory for upgrade handle\n");
+      return;
+    }
+  urh->connection = connection;
+  urh->was_closed = MHD_NO;
+  connection->urh = urh;
+  connection->state = MHD_CONNECTION_UPGRADE;
+  MHD_suspend_connection (connection);
+  response->upgrade_handler (response->upgrade_handler_cls,
+                             connection,
+                             connection->client_context,
+                             connection->read_buffer,
+                             connection->read_buffer_offset,
+                             connection->socket_fd,
+                             urh);
+}
+
+
+/**
+ * This function was created to handle per-connection processing that
+ * has to happen even if the socket cannot be read or written to.
+ *
+ * @param connection connection to handle
+ * @return #MHD_YES if we should continue to process the
+ *         connection (not dead yet), #MHD_NO if it died
+ */
+int
+MHD_connection_handle_idle (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+  unsigned int timeout;
+  const char *end;
+  char *line;
+  size_t line_len;
+  int client_close;
+  int msg_more;
+  unsigned int pipeline_writes;
+  enum MHD_CONNECTION_STATE old_state;
+  size_t old_send_offset;
+  uint64_t old_write_position;
+  MHD_HandlerStep done_step;
+  enum MHD_CacheResult cached;
+
+  connection->in_idle = MHD_YES;
+  pipeline_writes = 0;
+  /* the first round after a handler thread ran a step continues
+     right after it */
+  done_step = (MHD_YES == connection->handler_step_done)
+    ? connection->handler_step
+    : NULL;
+  connection->handler_step_done = MHD_NO;
+  if (MHD_YES == connection->suspend_expired)
+    {
+      /* resumed by the deadline of MHD_suspend_connection_with_timeout() */
+      connection->suspend_expired = MHD_NO;
+      MHD_connection_close_ (connection,
+                             MHD_REQUEST_TERMINATED_TIMEOUT_REACHED);
+    }
+  while (1)
+    {
+      MHD_PROBE_STATE_CHANGE (connection);
+      MHD_SLOW_REQUEST_STEP_ (connection);
+#if DEBUG_STATES
+      MHD_DLOG (daemon,
+                "%s: state: %s\n",
+                __FUNCTION__,
+                MHD_state_to_string (connection->state));
+#endif
+      switch (connection->state)
+        {
+        case MHD_CONNECTION_INIT:
+          if ( (0 != (daemon->options & MHD_USE_HTTP2)) &&
+               (MHD_NO == connection->h2_checked) &&
+               (0 != connection->read_buffer_offset) )
+            {
+              switch (MHD_http2_check_preface_ (connection->read_buffer,
+                                                connection->read_buffer_offset))
+                {
+                case MHD_HTTP2_PREFACE_FOUND:
+                  connection->h2_checked = MHD_YES;
+                  if (MHD_NO == MHD_http2_start_ (connection))
+                    CONNECTION_CLOSE_ERROR (connection,
+                                            "Closing connection (out of memory)\n");
+                  continue;
+                case MHD_HTTP2_PREFACE_PARTIAL:
+                  if (MHD_YES == connection->read_closed)
+                    {
+                      CONNECTION_CLOSE_ERROR (connection,
+                                              NULL);
+                      continue;
+                    }
+                  break;
+                case MHD_HTTP2_PREFACE_NONE:
+                  connection->h2_checked = MHD_YES;
+                  break;
+                }
+              if (MHD_NO == connection->h2_checked)
+                break; /* need more data */
+            }
+          line = get_next_header_line (connection,
+                                      &line_len);
+          /* Check for empty string, as we might want
+             to tolerate 'spurious' empty lines; also
+             NULL means we didn't get a full line yet. */
+          if ( (NULL == line) ||
+               (0 == line[0]) )
+            {
+              if (MHD_CONNECTION_INIT != connection->state)
+                continue;
+              if (MHD_YES == connection->read_closed)
+                {
+		  CONNECTION_CLOSE_ERROR (connection,
+					  NULL);
+                  continue;
+                }
+              break;
+            }
+          if (MHD_NO == parse_initial_message_line (connection, line))
+            CONNECTION_CLOSE_ERROR (connection, NULL);
+          else
+            connection->state = MHD_CONNECTION_URL_RECEIVED;
+          continue;
+        case MHD_CONNECTION_URL_RECEIVED:
+          line = get_next_header_line (connection,
+                                      &line_len);
+          if (NULL == line)
+            {
+              if (MHD_CONNECTION_URL_RECEIVED != connection->state)
+                continue;
+              if (MHD_YES == connection->read_closed)
+                {
+		  CONNECTION_CLOSE_ERROR (connection,
+					  NULL);
+                  continue;
+                }
+              break;
+            }
+          if (0 == line[0])
+            {
+              connection->state = MHD_CONNECTION_HEADERS_RECEIVED;
+              continue;
+            }
+          if (MHD_NO == process_header_line (connection, line, line_len))
+            {
+              transmit_error_response (connection,
+                                       MHD_HTTP_BAD_REQUEST,
+                                       REQUEST_MALFORMED);
+              break;
+            }
+          connection->state = MHD_CONNECTION_HEADER_PART_RECEIVED;
+          continue;
+        case MHD_CONNECTION_HEADER_PART_RECEIVED:
+          line = get_next_header_line (connection,
+                                      &line_len);
+          if (NULL == line)
+            {
+              if (connection->state != MHD_CONNECTION_HEADER_PART_RECEIVED)
+                continue;
+              if (MHD_YES == connection->read_closed)
+                {
+		  CONNECTION_CLOSE_ERROR (connection,
+					  NULL);
+                  continue;
+                }
+              break;
+            }
+          if (MHD_NO ==
+              process_broken_line (connection, line, line_len, MHD_HEADER_KIND))
+            continue;
+          if (0 == line[0])
+            {
+              connection->state = MHD_CONNECTION_HEADERS_RECEIVED;
+              continue;
+            }
+          continue;
+        case MHD_CONNECTION_HEADERS_RECEIVED:
+          count_header_size (connection);
+          parse_connection_headers (connection);
+          if (MHD_CONNECTION_CLOSED == connection->state)
+            continue;
+          connection->request_times.headers_received
+            = MHD_monotonic_usec_counter ();
+          MHD_STATS_ADD_ (connection->daemon, requests, 1);
+          if (NULL != connection->daemon->priority_callback)
+            connection->priority
+              = connection->daemon->priority_callback (connection->daemon->priority_callback_cls,
+                                                       connection,
+                                                       connection->url,
+                                                       connection->method);
+          if (MHD_YES == is_overloaded (connection))
+            {
+              /* shed the load before the access handler is asked */
+              transmit_error_response (connection,
+                                       MHD_HTTP_SERVICE_UNAVAILABLE,
+                                       SERVICE_OVERLOADED);
+              continue;
+            }
+          connection->state = MHD_CONNECTION_HEADERS_PROCESSED;
+          continue;
+        case MHD_CONNECTION_HEADERS_PROCESSED:
+          cached = MHD_CACHE_MISS;
+          if (NULL != connection->daemon->response_cache)
+            cached = MHD_cache_lookup_ (connection);
+          if (MHD_CACHE_WAIT == cached)
+            {
+              /* another request produces the response */
+              MHD_connection_wait_for_data_ (connection);
+              if (MHD_YES == connection->suspended)
+                break;
+              continue;
+            }
+          if ( (MHD_CACHE_HIT != cached) &&
+               (MHD_NO == run_handler_step (connection,
+                                            &call_connection_handler,
+                                            &done_step)) ) /* first call */
+            break;
+          if (MHD_CONNECTION_CLOSED == connection->state)
+            continue;
+          if ( (need_100_continue (connection)) &&
+               (MHD_NO == append_continue_message (connection,
+                                                   HTTP_100_CONTINUE,
+                                                   strlen (HTTP_100_CONTINUE))) )
+            {
+              CONNECTION_CLOSE_ERROR (connection,
+                                      "Closing connection (out of memory)\n");
+              continue;
+            }
+          if ( (NULL == connection->response) &&
+               (connection->continue_message_write_offset <
+                connection->continue_message_size) )
+            {
+              connection->state = MHD_CONNECTION_CONTINUE_SENDING;
+              if (MHD_NO != socket_flush_possible (connection))
+                socket_start_extra_buffering (connection);
+              else
+                socket_start_no_buffering (connection);
+
+              break;
+            }
+          if ( (NULL != connection->response) &&
+	       ( (MHD_str_equal_caseless_ (connection->method,
+				   MHD_HTTP_METHOD_POST)) ||
+		 (MHD_str_equal_caseless_ (connection->method,
+				   MHD_HTTP_METHOD_PUT))) )
+            {
+              /* we refused (no upload allowed!) */
+              connection->remaining_upload_size = 0;
+              /* force close, in case client still tries to upload... */
+              connection->read_closed = MHD_YES;
+            }
+          connection->state = (0 == connection->remaining_upload_size)
+            ? MHD_CONNECTION_FOOTERS_RECEIVED : MHD_CONNECTION_CONTINUE_SENT;
+          continue;
+        case MHD_CONNECTION_CONTINUE_SENDING:
+          if (connection->continue_message_write_offset ==
+              connection->continue_message_size)
+            {
+              connection->state = MHD_CONNECTION_CONTINUE_SENT;
+              if (MHD_NO != socket_flush_possible (connection))
+                socket_start_no_buffering_flush (connection);
+              else
+                socket_start_normal_buffering (connection);
+
+              continue;
+            }
+          break;
+        case MHD_CONNECTION_CONTINUE_SENT:
+          if (MHD_YES == connection->upload_paused)
+            {
+              /* neither read nor call the handler until
+                 MHD_resume_upload() */
+              connection->upload_paused = MHD_NO;
+              MHD_connection_wait_for_data_ (connection);
+              break;
+            }
+          if ( (0 != connection->read_buffer_offset) ||
+               (MHD_YES == upload_buffer_ready (connection)) ||
+               (MHD_YES == inflate_pending (connection)) )
+            {
+              if (MHD_NO == run_handler_step (connection,
+                                              &process_request_body,
+                                              NULL)) /* loop call */
+                break;
+              if ( (MHD_CONNECTION_CLOSED == connection->state) ||
+                   (MHD_YES == connection->upload_paused) )
+                continue;
+            }
+          if ( (MHD_NO == inflate_pending (connection)) &&
+               ((0 == connection->remaining_upload_size) ||
+                ((connection->remaining_upload_size == MHD_SIZE_UNKNOWN) &&
+                 (0 == connection->read_buffer_offset) &&
+                 (MHD_YES == connection->read_closed))) )
+            {
+#if HAVE_ZLIB
+              if ( (NULL != connection->inflater) &&
+                   (MHD_NO == connection->inflate_done) &&
+                   (0 != connection->inflate_in) &&
+                   (NULL == connection->response) )
+                {
+                  /* the compressed stream is truncated */
+                  transmit_error_response (connection,
+                                           MHD_HTTP_BAD_REQUEST,
+                                           REQUEST_MALFORMED);
+                  continue;
+                }
+#endif
+              if ((MHD_YES == connection->have_chunked_upload) &&
+                  (MHD_NO == connection->read_closed))
+                connection->state = MHD_CONNECTION_BODY_RECEIVED;
+              else
+                connection->state = MHD_CONNECTION_FOOTERS_RECEIVED;
+              continue;
+            }
+          break;
+        case MHD_CONNECTION_BODY_RECEIVED:
+          line = get_next_header_line (connection,
+                                      &line_len);
+          if (NULL == line)
+            {
+              if (connection->state != MHD_CONNECTION_BODY_RECEIVED)
+                continue;
+              if (MHD_YES == connection->read_closed)
+                {
+		  CONNECTION_CLOSE_ERROR (connection,
+					  NULL);
+                  continue;
+                }
+              break;
+            }
+          if (0 == line[0])
+            {
+              connection->state = MHD_CONNECTION_FOOTERS_RECEIVED;
+              continue;
+            }
+          if (MHD_NO == process_header_line (connection, line, line_len))
+            {
+              transmit_error_response (connection,
+                                       MHD_HTTP_BAD_REQUEST,
+                                       REQUEST_MALFORMED);
+              break;
+            }
+          connection->state = MHD_CONNECTION_FOOTER_PART_RECEIVED;
+          continue;
+        case MHD_CONNECTION_FOOTER_PART_RECEIVED:
+          line = get_next_header_line (connection,
+                                      &line_len);
+          if (NULL == line)
+            {
+              if (connection->state != MHD_CONNECTION_FOOTER_PART_RECEIVED)
+                continue;
               if (MHD_YES == connection->read_closed)
                 {
 		  CONNECTION_CLOSE_ERROR (connection,
@@ -2446,603 +7736,1401 @@ MHD_connection_handle_idle (struct MHD_Connection *connection)
                 }
               break;
             }
-          if (MHD_NO == parse_initial_message_line (connection, line))
-            CONNECTION_CLOSE_ERROR (connection, NULL);
+          if (MHD_NO ==
+              process_broken_line (connection, line, line_len, MHD_FOOTER_KIND))
+            continue;
+          if (0 == line[0])
+            {
+              connection->state = MHD_CONNECTION_FOOTERS_RECEIVED;
+              continue;
+            }
+          continue;
+        case MHD_CONNECTION_FOOTERS_RECEIVED:
+          /* called again until a response is queued, as when the
+             handler suspended the connection itself */
+          if (MHD_NO == run_handler_step (connection,
+                                          &call_connection_handler,
+                                          NULL)) /* "final" call */
+            break;
+          if (connection->state == MHD_CONNECTION_CLOSED)
+            continue;
+          if (NULL == connection->response)
+            break;              /* try again next time */
+          if (MHD_NO == build_header_response (connection))
+            {
+              /* oops - close! */
+	      CONNECTION_CLOSE_ERROR (connection,
+				      "Closing connection (failed to create response header)\n");
+              continue;
+            }
+          connection->state = MHD_CONNECTION_HEADERS_SENDING;
+          socket_start_sending_header (connection);
+          hint_body_readahead (connection);
+          break;
+        case MHD_CONNECTION_HEADERS_SENDING:
+          /* no default action */
+          break;
+        case MHD_CONNECTION_HEADERS_SENT:
+          if (0 == connection->request_times.headers_sent)
+            connection->request_times.headers_sent
+              = MHD_monotonic_usec_counter ();
+          if (NULL != connection->response->upgrade_handler)
+            {
+              /* push out the headers before giving up the socket */
+              connection->pipeline_corked = MHD_NO;
+              if (MHD_NO != socket_flush_possible (connection))
+                socket_start_no_buffering_flush (connection);
+              socket_start_normal_buffering (connection);
+              connection_upgrade (connection);
+              continue;
+            }
+          /* Some clients may take some actions right after header receive */
+          if (MHD_YES == use_msg_more (connection))
+            {
+              /* header is pushed out together with the body */
+            }
+          else if (MHD_YES == keep_pipeline_corked (connection))
+            {
+              /* more pipelined responses follow, flush them all at once */
+            }
+          else if (0 != connection->range_current)
+            {
+              /* header of the next part of a multipart/byteranges body,
+                 the body is flushed at the end */
+            }
+          else if (MHD_NO != socket_flush_possible (connection))
+            {
+              socket_start_no_buffering_flush (connection);
+              socket_start_extra_buffering (connection);
+            }
+          else
+            socket_start_normal_buffering (connection);
+
+          if (connection->have_chunked_upload)
+            connection->state = MHD_CONNECTION_CHUNKED_BODY_UNREADY;
+          else
+            connection->state = MHD_CONNECTION_NORMAL_BODY_UNREADY;
+          continue;
+        case MHD_CONNECTION_NORMAL_BODY_READY:
+          /* nothing to do here */
+          break;
+        case MHD_CONNECTION_NORMAL_BODY_UNREADY:
+          if (NULL != connection->response->broadcast)
+            {
+              if (MHD_YES == ready_broadcast (connection))
+                continue;
+              break;
+            }
+          if (NULL != connection->response->stream)
+            {
+              if (MHD_YES == ready_stream (connection))
+                continue;
+              break;
+            }
+          if (MHD_YES == connection->data_pending)
+            {
+              /* the reader asked to wait when it was called from
+                 MHD_connection_handle_write() */
+              connection->data_pending = MHD_NO;
+              MHD_connection_wait_for_data_ (connection);
+              break;
+            }
+          if (NULL != connection->response->crc)
+            (void) MHD_mutex_lock_ (&connection->response->mutex);
+          if (0 == connection->response->total_size)
+            {
+              if (NULL != connection->response->crc)
+                (void) MHD_mutex_unlock_ (&connection->response->mutex);
+              connection->state = MHD_CONNECTION_BODY_SENT;
+              continue;
+            }
+          if (MHD_YES == try_ready_normal_body (connection))
+            {
+	      if (NULL != connection->response->crc)
+	        (void) MHD_mutex_unlock_ (&connection->response->mutex);
+              if (connection->response_write_position ==
+                  MHD_BODY_END_ (connection))
+                {
+                  /* body was already sent together with the header */
+                  body_part_sent (connection);
+                  continue;
+                }
+              connection->state = MHD_CONNECTION_NORMAL_BODY_READY;
+              /* Buffering for flushable socket was already enabled*/
+              if (MHD_NO == socket_flush_possible (connection))
+                socket_start_no_buffering (connection); 
+
+              break;
+            }
+          /* not ready, no socket action */
+          if (MHD_YES == connection->data_pending)
+            {
+              connection->data_pending = MHD_NO;
+              MHD_connection_wait_for_data_ (connection);
+            }
+          break;
+        case MHD_CONNECTION_CHUNKED_BODY_READY:
+          /* nothing to do here */
+          break;
+        case MHD_CONNECTION_CHUNKED_BODY_UNREADY:
+          if (NULL != connection->response->broadcast)
+            {
+              if (MHD_YES == ready_broadcast (connection))
+                continue;
+              break;
+            }
+          if (NULL != connection->response->stream)
+            {
+              if (MHD_YES == ready_stream (connection))
+                continue;
+              break;
+            }
+          if (MHD_YES == connection->data_pending)
+            {
+              /* the reader asked to wait when it was called from
+                 MHD_connection_handle_write() */
+              connection->data_pending = MHD_NO;
+              MHD_connection_wait_for_data_ (connection);
+              break;
+            }
+          if (NULL != connection->response->crc)
+            (void) MHD_mutex_lock_ (&connection->response->mutex);
+          if (MHD_YES == chunked_body_done (connection))
+            {
+              if (NULL != connection->response->crc)
+                (void) MHD_mutex_unlock_ (&connection->response->mutex);
+              connection->state = MHD_CONNECTION_BODY_SENT;
+              continue;
+            }
+          if (MHD_YES == try_ready_chunked_body (connection))
+            {
+              if (NULL != connection->response->crc)
+                (void) MHD_mutex_unlock_ (&connection->response->mutex);
+              connection->state = MHD_CONNECTION_CHUNKED_BODY_READY;
+              /* Buffering for flushable socket was already enabled */
+              if (MHD_NO == socket_flush_possible (connection))
+                socket_start_no_buffering (connection); 
+
+              continue;
+            }
+          if (NULL != connection->response->crc)
+            (void) MHD_mutex_unlock_ (&connection->response->mutex);
+          if (MHD_YES == connection->data_pending)
+            {
+              connection->data_pending = MHD_NO;
+              MHD_connection_wait_for_data_ (connection);
+            }
+          break;
+        case MHD_CONNECTION_BODY_SENT:
+          if (MHD_NO == build_header_response (connection))
+            {
+              /* oops - close! */
+	      CONNECTION_CLOSE_ERROR (connection,
+				      "Closing connection (failed to create response header)\n");
+              continue;
+            }
+          if ( (MHD_NO == connection->have_chunked_upload) ||
+               (connection->write_buffer_send_offset ==
+                connection->write_buffer_append_offset) )
+            connection->state = MHD_CONNECTION_FOOTERS_SENT;
           else
-            connection->state = MHD_CONNECTION_URL_RECEIVED;
+            connection->state = MHD_CONNECTION_FOOTERS_SENDING;
           continue;
-        case MHD_CONNECTION_URL_RECEIVED:
-          line = get_next_header_line (connection);
-          if (NULL == line)
+        case MHD_CONNECTION_FOOTERS_SENDING:
+          /* no default action */
+          break;
+        case MHD_CONNECTION_FOOTERS_SENT:
+          connection->request_times.body_sent = MHD_monotonic_usec_counter ();
+          if (0 != connection->request_times.first_byte)
             {
-              if (MHD_CONNECTION_URL_RECEIVED != connection->state)
-                continue;
-              if (MHD_YES == connection->read_closed)
-                {
-		  CONNECTION_CLOSE_ERROR (connection,
-					  NULL);
-                  continue;
-                }
-              break;
+              record_latency (&daemon->latency[MHD_LATENCY_FIRST_BYTE],
+                              connection->request_times.headers_sent
+                              - connection->request_times.first_byte);
+              record_latency (&daemon->latency[MHD_LATENCY_TOTAL],
+                              connection->request_times.body_sent
+                              - connection->request_times.first_byte);
+              if (MHD_access_log_enabled_ (daemon))
+                MHD_access_log_add_ (connection);
+              MHD_slow_request_done_ (connection,
+                                      MHD_NO,
+                                      MHD_REQUEST_TERMINATED_COMPLETED_OK);
             }
-          if (0 == line[0])
+          msg_more = use_msg_more (connection);
+          connection->pipeline_corked = keep_pipeline_corked (connection);
+          if (MHD_YES == msg_more)
             {
-              connection->state = MHD_CONNECTION_HEADERS_RECEIVED;
-              continue;
+              /* nothing corked, TCP_NODELAY is already on */
             }
-          if (MHD_NO == process_header_line (connection, line))
+          else if (MHD_YES == connection->pipeline_corked)
             {
-              transmit_error_response (connection,
-                                       MHD_HTTP_BAD_REQUEST,
-                                       REQUEST_MALFORMED);
-              break;
+              /* the next pipelined response is sent right away */
             }
-          connection->state = MHD_CONNECTION_HEADER_PART_RECEIVED;
-          continue;
-        case MHD_CONNECTION_HEADER_PART_RECEIVED:
-          line = get_next_header_line (connection);
-          if (NULL == line)
+          else if (MHD_NO != socket_flush_possible (connection))
+            socket_start_no_buffering_flush (connection);
+          else
+            socket_start_normal_buffering (connection);
+
+          end =
+            MHD_get_response_token_header_ (connection->response,
+                                            MHD_HEADER_TOKEN_CONNECTION);
+          client_close = ((NULL != end) && (MHD_str_equal_caseless_(end, "close")));
+#if HAVE_ZLIB
+          release_compressor (connection);
+          release_inflater (connection);
+#endif
+          release_broadcast (connection);
+          release_stream (connection);
+          if (NULL != daemon->response_cache)
+            MHD_cache_release_ (connection);
+          MHD_destroy_response (connection->response);
+          connection->response = NULL;
+          if ( (NULL != daemon->notify_completed) &&
+               (MHD_YES == connection->client_aware) )
+          {
+	    daemon->notify_completed (daemon->notify_completed_cls,
+				      connection,
+				      &connection->client_context,
+				      MHD_REQUEST_TERMINATED_COMPLETED_OK);
+            connection->client_aware = MHD_NO;
+          }
+          end =
+            MHD_lookup_connection_token_value (connection,
+                                               MHD_HEADER_KIND,
+                                               MHD_HEADER_TOKEN_CONNECTION);
+          if ( (MHD_YES == connection->read_closed) ||
+               (client_close) ||
+               ( (NULL != end) &&
+		 (MHD_str_equal_caseless_ (end, "close")) ) )
             {
-              if (connection->state != MHD_CONNECTION_HEADER_PART_RECEIVED)
-                continue;
-              if (MHD_YES == connection->read_closed)
-                {
-		  CONNECTION_CLOSE_ERROR (connection,
-					  NULL);
-                  continue;
-                }
-              break;
+              connection->read_closed = MHD_YES;
+              connection->read_buffer_offset = 0;
             }
-          if (MHD_NO ==
-              process_broken_line (connection, line, MHD_HEADER_KIND))
-            continue;
-          if (0 == line[0])
+          /* pipelined data that came with a request in the
+             overflow arena may not fit into the pool */
+          if ( (NULL != connection->overflow) &&
+               (connection->read_buffer_offset > daemon->pool_size / 2) )
             {
-              connection->state = MHD_CONNECTION_HEADERS_RECEIVED;
-              continue;
+              connection->read_closed = MHD_YES;
+              connection->read_buffer_offset = 0;
+            }
+          if (((MHD_YES == connection->read_closed) &&
+               (0 == connection->read_buffer_offset)) ||
+              (MHD_NO == keepalive_possible (connection)))
+            {
+              /* have to close for some reason */
+              MHD_connection_close_ (connection,
+                                     MHD_REQUEST_TERMINATED_COMPLETED_OK);
+              keep_pool_peak (connection);
+              MHD_pool_destroy_cached (&connection->daemon->pool_cache,
+                                       &connection->daemon->pool_cache_len,
+                                       connection->daemon->pool_cache_max,
+                                       connection->pool);
+              MHD_memory_budget_return_ (connection->daemon);
+              MHD_connection_overflow_release_ (connection);
+              connection->pool = NULL;
+              connection->read_buffer = NULL;
+              connection->read_buffer_size = 0;
+              connection->read_buffer_offset = 0;
+              connection->read_buffer_scan_offset = 0;
+            }
+          else
+            {
+              size_t size;
+
+              /* can try to keep-alive; the socket options are left
+                 as they are until the next response needs others */
+              MHD_STATS_ADD_ (connection->daemon, keep_alive_reuses, 1);
+              connection->kept_alive = MHD_YES;
+              connection->version = NULL;
+              connection->state = MHD_CONNECTION_INIT;
+              /* Reset the read buffer to the starting size,
+                 preserving the bytes we have already read. */
+              size = MHD_MAX (initial_read_buffer_size (connection),
+                              connection->read_buffer_offset);
+              connection->read_buffer
+                = MHD_pool_reset (connection->pool,
+                                  connection->read_buffer,
+                                  connection->read_buffer_offset,
+                                  size);
+              connection->read_buffer_size = size;
+              connection->read_buffer_scan_offset = 0;
+              connection->header_size = 0;
+              MHD_connection_overflow_release_ (connection);
             }
+	  connection->client_aware = MHD_NO;
+          connection->client_context = NULL;
+          connection->route = NULL;
+          connection->cache_key = NULL;
+          connection->cache_pass = MHD_NO;
+          connection->continue_message = NULL;
+          connection->continue_message_size = 0;
+          connection->continue_message_write_offset = 0;
+          connection->prefetch_buf = NULL;
+          connection->prefetch_buf_size = 0;
+          connection->responseCode = 0;
+          connection->headers_received = NULL;
+	  connection->headers_received_tail = NULL;
+          connection->headers_received_count = 0;
+          connection->headers_index = NULL;
+          connection->headers_index_size = 0;
+          connection->headers_index_last = NULL;
+          connection->headers_index_failed = MHD_NO;
+          memset (connection->headers_by_token,
+                  0,
+                  sizeof (connection->headers_by_token));
+          connection->lazy_args = NULL;
+          connection->lazy_cookies = MHD_NO;
+          connection->response_write_position = 0;
+          connection->ranges = NULL;
+          connection->ranges_count = 0;
+          connection->range_current = 0;
+          connection->range_not_satisfiable = MHD_NO;
+          connection->not_modified = MHD_NO;
+          connection->chunk_size = 0;
+          connection->chunk_sent = 0;
+          connection->have_chunked_upload = MHD_NO;
+          connection->chunk_decoded = 0;
+          connection->upload_paused = MHD_NO;
+          connection->upload_buffer = NULL;
+          connection->upload_fd = -1;
+          connection->upload_buffer_size = 0;
+          connection->upload_buffer_fill = 0;
+          connection->method = NULL;
+          connection->url = NULL;
+          connection->write_buffer = NULL;
+          connection->write_buffer_size = 0;
+          connection->write_buffer_send_offset = 0;
+          connection->write_buffer_append_offset = 0;
+          /* the next request starts now, or when its first byte
+             arrives; the connection stays accepted */
+          connection->request_times.first_byte
+            = (0 != connection->read_buffer_offset)
+            ? MHD_monotonic_usec_counter () : 0;
+          connection->request_times.headers_received = 0;
+          connection->request_times.handler_called = 0;
+          connection->request_times.response_queued = 0;
+          connection->request_times.headers_sent = 0;
+          connection->request_times.body_sent = 0;
+          MHD_slow_request_reset_ (connection);
           continue;
-        case MHD_CONNECTION_HEADERS_RECEIVED:
-          parse_connection_headers (connection);
-          if (MHD_CONNECTION_CLOSED == connection->state)
-            continue;
-          connection->state = MHD_CONNECTION_HEADERS_PROCESSED;
+        case MHD_CONNECTION_UPGRADE:
+          if ( (MHD_YES == connection->suspended) ||
+               (MHD_NO == connection->urh->was_closed) )
+            break; /* application is still using the socket */
+          MHD_connection_close_ (connection,
+                                 MHD_REQUEST_TERMINATED_COMPLETED_OK);
           continue;
-        case MHD_CONNECTION_HEADERS_PROCESSED:
-          call_connection_handler (connection); /* first call */
-          if (MHD_CONNECTION_CLOSED == connection->state)
+        case MHD_CONNECTION_HTTP2:
+          /* suspended streams keep the connection from timing out,
+             like a suspended connection */
+          if (MHD_YES == MHD_http2_has_suspended_ (connection,
+                                                   MHD_NO))
+            update_last_activity (connection);
+          /* frames are coalesced in the write buffer; the small ones
+             (WINDOW_UPDATE, SETTINGS ACK) must not wait for an ACK */
+          socket_start_no_buffering (connection);
+          MHD_http2_handle_idle_ (connection);
+          if (MHD_CONNECTION_HTTP2 != connection->state)
             continue;
-          if (need_100_continue (connection))
-            {
-              connection->state = MHD_CONNECTION_CONTINUE_SENDING;
-              if (MHD_NO != socket_flush_possible (connection))
-                socket_start_extra_buffering (connection);
-              else
-                socket_start_no_buffering (connection);
+          break;
+        case MHD_CONNECTION_CLOSED:
+	  cleanup_connection (connection);
+	  return MHD_NO;
+        default:
+          EXTRA_CHECK (0);
+          break;
+        }
+      /* If the next request was pipelined, do not wait for the event
+         loop to report the socket as writable: try to send the response
+         right away, so that the following request is processed in
+         this round as well. */
+      if ( (0 != connection->read_buffer_offset) &&
+           (MHD_YES == is_sending_state (connection)) &&
+           (pipeline_writes < MHD_PIPELINE_MAX_WRITES) )
+        {
+          pipeline_writes++;
+          old_state = connection->state;
+          old_send_offset = connection->write_buffer_send_offset;
+          old_write_position = connection->response_write_position;
+          MHD_connection_handle_write (connection);
+          if ( (old_state != connection->state) ||
+               (old_send_offset != connection->write_buffer_send_offset) ||
+               (old_write_position != connection->response_write_position) )
+            continue;
+        }
+      break;
+    }
+  MHD_PROBE_STATE_CHANGE (connection);
+  MHD_SLOW_REQUEST_STEP_ (connection);
+  if ( (MHD_YES == connection->pipeline_corked) &&
+       (MHD_NO == is_sending_state (connection)) )
+    {
+      /* waiting for the application or the client, push out what
+         we have so far */
+      connection->pipeline_corked = MHD_NO;
+      socket_start_no_buffering_flush (connection);
+      socket_start_normal_buffering (connection);
+    }
+  if (MHD_YES == connection->handler_offloaded)
+    {
+      /* suspended until a handler thread ran the step */
+      connection->in_idle = MHD_NO;
+      return MHD_YES;
+    }
+  timeout = connection->connection_timeout;
+  if ( (0 != timeout) &&
+       (connection->last_activity + timeout <= MHD_loop_time_ (connection->daemon)) )
+    {
+      MHD_STATS_ADD_ (connection->daemon, timeouts, 1);
+      MHD_connection_close_ (connection,
+                             MHD_REQUEST_TERMINATED_TIMEOUT_REACHED);
+      connection->in_idle = MHD_NO;
+      return MHD_YES;
+    }
+  if ( ( (0 != daemon->header_timeout) ||
+         (0 != daemon->min_data_rate) ) &&
+       (MHD_YES != connection->suspended) &&
+       (MHD_NO == check_guard (connection)) )
+    {
+      connection->in_idle = MHD_NO;
+      return MHD_YES;
+    }
+  MHD_connection_update_event_loop_info (connection);
+#if MHD_EREADY_SUPPORT
+  switch (connection->event_loop_info)
+    {
+    case MHD_EVENT_LOOP_INFO_READ:
+      if ( (0 != (connection->epoll_state & MHD_EPOLL_STATE_READ_READY)) &&
+           (0 == (connection->epoll_state & MHD_EPOLL_STATE_SUSPENDED)) &&
+	   (0 == (connection->epoll_state & MHD_EPOLL_STATE_IN_EREADY_EDLL)) )
+	{
+	  EDLL_insert (daemon->eready_head,
+		       daemon->eready_tail,
+		       connection);
+	  connection->epoll_state |= MHD_EPOLL_STATE_IN_EREADY_EDLL;
+	}
+      break;
+    case MHD_EVENT_LOOP_INFO_WRITE:
+      if ( (0 != (connection->epoll_state & MHD_EPOLL_STATE_WRITE_READY)) &&
+           (0 == (connection->epoll_state & MHD_EPOLL_STATE_SUSPENDED)) &&
+	   (0 == (connection->epoll_state & MHD_EPOLL_STATE_IN_EREADY_EDLL)) )
+	{
+	  EDLL_insert (daemon->eready_head,
+		       daemon->eready_tail,
+		       connection);
+	  connection->epoll_state |= MHD_EPOLL_STATE_IN_EREADY_EDLL;
+	}
+      break;
+    case MHD_EVENT_LOOP_INFO_BLOCK:
+      /* we should look at this connection again in the next iteration
+	 of the event loop, as we're waiting on the application */
+      if ( (0 == (connection->epoll_state & MHD_EPOLL_STATE_IN_EREADY_EDLL) &&
+           (0 == (connection->epoll_state & MHD_EPOLL_STATE_SUSPENDED))) )
+	{
+	  EDLL_insert (daemon->eready_head,
+		       daemon->eready_tail,
+		       connection);
+	  connection->epoll_state |= MHD_EPOLL_STATE_IN_EREADY_EDLL;
+	}
+      break;
+    case MHD_EVENT_LOOP_INFO_CLEANUP:
+      /* This connection is finished, nothing left to do */
+      break;
+    case MHD_EVENT_LOOP_INFO_THROTTLED:
+      /* MHD_rate_limit_process_() calls us again */
+      break;
+    }
+#endif
+#if EPOLL_SUPPORT
+  return MHD_connection_epoll_update_ (connection);
+#else
+  return MHD_YES;
+#endif
+}
+
+
+/**
+ * Release the memory pool of a connection that is waiting for the
+ * next request without having received any part of it.  The pool
+ * is obtained again when data arrives.
+ *
+ * @param connection connection to release the pool of
+ * @return #MHD_YES if the pool was released, #MHD_NO if the
+ *         connection is not idle (or has no pool)
+ */
+int
+MHD_connection_release_pool_ (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+
+  if ( (MHD_CONNECTION_INIT != connection->state) ||
+       (NULL == connection->pool) ||
+       (0 != connection->read_buffer_offset) ||
+       (MHD_YES == connection->suspended) ||
+       (NULL != connection->response) )
+    return MHD_NO;
+  keep_pool_peak (connection);
+  MHD_pool_destroy_cached (&daemon->pool_cache,
+                           &daemon->pool_cache_len,
+                           daemon->pool_cache_max,
+                           connection->pool);
+  MHD_memory_budget_return_ (daemon);
+  connection->pool = NULL;
+  connection->read_buffer = NULL;
+  connection->read_buffer_size = 0;
+  return MHD_YES;
+}
+
+
+/**
+ * Add the peak usage of the memory pools of @a connection to the
+ * histogram of its daemon (see #MHD_get_pool_usage_histogram()).
+ * Called once the connection is closed, before its pool is released.
+ *
+ * @param connection connection that was closed
+ */
+void
+MHD_connection_record_pool_peak_ (struct MHD_Connection *connection)
+{
+  keep_pool_peak (connection);
+  record_latency (&connection->daemon->pool_usage,
+                  connection->pool_peak);
+}
+
+
+#if EPOLL_SUPPORT
+/**
+ * Perform epoll() processing, possibly moving the connection back into
+ * the epoll() set if needed.
+ *
+ * @param connection connection to process
+ * @return #MHD_YES if we should continue to process the
+ *         connection (not dead yet), #MHD_NO if it died
+ */
+int
+MHD_connection_epoll_update_ (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+
+  if ( (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY)) &&
+       (0 == (connection->epoll_state & MHD_EPOLL_STATE_IN_EPOLL_SET)) &&
+       (0 == (connection->epoll_state & MHD_EPOLL_STATE_SUSPENDED)) &&
+       ( (0 == (connection->epoll_state & MHD_EPOLL_STATE_WRITE_READY)) ||
+	 ( (0 == (connection->epoll_state & MHD_EPOLL_STATE_READ_READY)) &&
+	   ( (MHD_EVENT_LOOP_INFO_READ == connection->event_loop_info) ||
+	     (connection->read_buffer_size > connection->read_buffer_offset) ) &&
+	   (MHD_NO == connection->read_closed) ) ) )
+    {
+      /* add to epoll set */
+      struct epoll_event event;
 
-              break;
-            }
-          if ( (NULL != connection->response) &&
-	       ( (MHD_str_equal_caseless_ (connection->method,
-				   MHD_HTTP_METHOD_POST)) ||
-		 (MHD_str_equal_caseless_ (connection->method,
-				   MHD_HTTP_METHOD_PUT))) )
+#if IO_URING_SUPPORT
+      if (MHD_USE_IO_URING_LINUX_ONLY == (daemon->options & MHD_USE_IO_URING_LINUX_ONLY))
+        {
+          /* re-arm the multishot poll, which the kernel terminated */
+          if (MHD_YES != MHD_io_uring_poll_add_ (&daemon->uring,
+                                                 connection->socket_fd,
+                                                 EPOLLIN | EPOLLOUT,
+                                                 (uint64_t) (uintptr_t) connection))
             {
-              /* we refused (no upload allowed!) */
-              connection->remaining_upload_size = 0;
-              /* force close, in case client still tries to upload... */
-              connection->read_closed = MHD_YES;
+#ifdef HAVE_MESSAGES
+              if (0 != (daemon->options & MHD_USE_DEBUG))
+                MHD_DLOG (daemon,
+                          "io_uring submission queue is full\n");
+#endif
+              connection->state = MHD_CONNECTION_CLOSED;
+              cleanup_connection (connection);
+              return MHD_NO;
             }
-          connection->state = (0 == connection->remaining_upload_size)
-            ? MHD_CONNECTION_FOOTERS_RECEIVED : MHD_CONNECTION_CONTINUE_SENT;
-          continue;
-        case MHD_CONNECTION_CONTINUE_SENDING:
-          if (connection->continue_message_write_offset ==
-              strlen (HTTP_100_CONTINUE))
-            {
-              connection->state = MHD_CONNECTION_CONTINUE_SENT;
-              if (MHD_NO != socket_flush_possible (connection))
-                socket_start_no_buffering_flush (connection);
-              else
-                socket_start_normal_buffering (connection);
+          connection->epoll_state |= MHD_EPOLL_STATE_IN_EPOLL_SET;
+          connection->in_idle = MHD_NO;
+          return MHD_YES;
+        }
+#endif
+      event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+      event.data.ptr = connection;
+      if (0 != epoll_ctl (daemon->epoll_fd,
+			  EPOLL_CTL_ADD,
+			  connection->socket_fd,
+			  &event))
+	{
+#ifdef HAVE_MESSAGES
+	  if (0 != (daemon->options & MHD_USE_DEBUG))
+	    MHD_DLOG (daemon,
+		      "Call to epoll_ctl failed: %s\n",
+		      MHD_socket_last_strerr_ ());
+#endif
+	  connection->state = MHD_CONNECTION_CLOSED;
+	  cleanup_connection (connection);
+	  return MHD_NO;
+	}
+      connection->epoll_state |= MHD_EPOLL_STATE_IN_EPOLL_SET;
+    }
+  connection->in_idle = MHD_NO;
+  return MHD_YES;
+}
+#endif
 
-              continue;
-            }
-          break;
-        case MHD_CONNECTION_CONTINUE_SENT:
-          if (0 != connection->read_buffer_offset)
-            {
-              process_request_body (connection);     /* loop call */
-              if (MHD_CONNECTION_CLOSED == connection->state)
-                continue;
-            }
-          if ((0 == connection->remaining_upload_size) ||
-              ((connection->remaining_upload_size == MHD_SIZE_UNKNOWN) &&
-               (0 == connection->read_buffer_offset) &&
-               (MHD_YES == connection->read_closed)))
-            {
-              if ((MHD_YES == connection->have_chunked_upload) &&
-                  (MHD_NO == connection->read_closed))
-                connection->state = MHD_CONNECTION_BODY_RECEIVED;
-              else
-                connection->state = MHD_CONNECTION_FOOTERS_RECEIVED;
-              continue;
-            }
-          break;
-        case MHD_CONNECTION_BODY_RECEIVED:
-          line = get_next_header_line (connection);
-          if (NULL == line)
-            {
-              if (connection->state != MHD_CONNECTION_BODY_RECEIVED)
-                continue;
-              if (MHD_YES == connection->read_closed)
-                {
-		  CONNECTION_CLOSE_ERROR (connection,
-					  NULL);
-                  continue;
-                }
-              break;
-            }
-          if (0 == line[0])
-            {
-              connection->state = MHD_CONNECTION_FOOTERS_RECEIVED;
-              continue;
-            }
-          if (MHD_NO == process_header_line (connection, line))
-            {
-              transmit_error_response (connection,
-                                       MHD_HTTP_BAD_REQUEST,
-                                       REQUEST_MALFORMED);
-              break;
-            }
-          connection->state = MHD_CONNECTION_FOOTER_PART_RECEIVED;
-          continue;
-        case MHD_CONNECTION_FOOTER_PART_RECEIVED:
-          line = get_next_header_line (connection);
-          if (NULL == line)
-            {
-              if (connection->state != MHD_CONNECTION_FOOTER_PART_RECEIVED)
-                continue;
-              if (MHD_YES == connection->read_closed)
-                {
-		  CONNECTION_CLOSE_ERROR (connection,
-					  NULL);
-                  continue;
-                }
-              break;
-            }
-          if (MHD_NO ==
-              process_broken_line (connection, line, MHD_FOOTER_KIND))
-            continue;
-          if (0 == line[0])
-            {
-              connection->state = MHD_CONNECTION_FOOTERS_RECEIVED;
-              continue;
-            }
-          continue;
-        case MHD_CONNECTION_FOOTERS_RECEIVED:
-          call_connection_handler (connection); /* "final" call */
-          if (connection->state == MHD_CONNECTION_CLOSED)
-            continue;
-          if (NULL == connection->response)
-            break;              /* try again next time */
-          if (MHD_NO == build_header_response (connection))
-            {
-              /* oops - close! */
-	      CONNECTION_CLOSE_ERROR (connection,
-				      "Closing connection (failed to create response header)\n");
-              continue;
-            }
-          connection->state = MHD_CONNECTION_HEADERS_SENDING;
-          if (MHD_NO != socket_flush_possible (connection))
-            socket_start_extra_buffering (connection);
-          else
-            socket_start_no_buffering (connection);
 
-          break;
-        case MHD_CONNECTION_HEADERS_SENDING:
-          /* no default action */
-          break;
-        case MHD_CONNECTION_HEADERS_SENT:
-          /* Some clients may take some actions right after header receive */
-          if (MHD_NO != socket_flush_possible (connection))
-            {
-              socket_start_no_buffering_flush (connection);
-              socket_start_extra_buffering (connection);
-            }
-          else
-            socket_start_normal_buffering (connection);
+/**
+ * Set callbacks for this connection to those for HTTP.
+ *
+ * @param connection connection to initialize
+ */
+void
+MHD_set_http_callbacks_ (struct MHD_Connection *connection)
+{
+  connection->read_handler = &MHD_connection_handle_read;
+  connection->write_handler = &MHD_connection_handle_write;
+  connection->idle_handler = &MHD_connection_handle_idle;
+}
+
+
+/**
+ * Ask the kernel for the credentials of the peer of an AF_UNIX
+ * connection and store them in @a connection.
+ *
+ * @param connection connection to query
+ * @return #MHD_YES on success, #MHD_NO if the connection is not an
+ *         AF_UNIX connection or the platform cannot tell
+ */
+static int
+get_peer_credentials (struct MHD_Connection *connection)
+{
+#if MHD_UNIX_SOCKETS && (defined(SO_PEERCRED) || HAVE_GETPEEREID)
+  struct MHD_PeerCredentials *creds = &connection->peer_credentials;
+#if defined(SO_PEERCRED)
+  struct ucred cred;
+  socklen_t len = sizeof (cred);
+#else
+  uid_t uid;
+  gid_t gid;
+#endif
+
+  if ( (NULL == connection->addr) ||
+       (AF_UNIX != connection->addr->sa_family) )
+    return MHD_NO;
+#if defined(SO_PEERCRED)
+  if (0 != getsockopt (connection->socket_fd,
+                       SOL_SOCKET, SO_PEERCRED,
+                       &cred, &len))
+    return MHD_NO;
+  creds->pid = (int64_t) cred.pid;
+  creds->uid = (uint32_t) cred.uid;
+  creds->gid = (uint32_t) cred.gid;
+#else
+  if (0 != getpeereid (connection->socket_fd, &uid, &gid))
+    return MHD_NO;
+  creds->pid = -1;
+  creds->uid = (uint32_t) uid;
+  creds->gid = (uint32_t) gid;
+#endif
+  return MHD_YES;
+#else
+  return MHD_NO;
+#endif
+}
+
+
+/**
+ * Obtain information about the given connection.
+ *
+ * @param connection what connection to get information about
+ * @param info_type what information is desired?
+ * @param ... depends on @a info_type
+ * @return NULL if this information is not available
+ *         (or if the @a info_type is unknown)
+ * @ingroup specialized
+ */
+const union MHD_ConnectionInfo *
+MHD_get_connection_info (struct MHD_Connection *connection,
+                         enum MHD_ConnectionInfoType info_type, ...)
+{
+  switch (info_type)
+    {
+#if HTTPS_SUPPORT
+    case MHD_CONNECTION_INFO_CIPHER_ALGO:
+      if (connection->tls_session == NULL)
+	return NULL;
+      connection->cipher = MHD_tls_get_cipher_ (connection);
+      return (const union MHD_ConnectionInfo *) &connection->cipher;
+    case MHD_CONNECTION_INFO_PROTOCOL:
+      if (connection->tls_session == NULL)
+	return NULL;
+      connection->protocol = MHD_tls_get_protocol_ (connection);
+      return (const union MHD_ConnectionInfo *) &connection->protocol;
+    case MHD_CONNECTION_INFO_GNUTLS_SESSION:
+      if (connection->tls_session == NULL)
+	return NULL;
+      return (const union MHD_ConnectionInfo *) &connection->tls_session;
+#endif
+    case MHD_CONNECTION_INFO_CLIENT_ADDRESS:
+      return (const union MHD_ConnectionInfo *) &connection->addr;
+    case MHD_CONNECTION_INFO_DAEMON:
+      return (const union MHD_ConnectionInfo *) &connection->daemon;
+    case MHD_CONNECTION_INFO_CONNECTION_FD:
+      return (const union MHD_ConnectionInfo *) &connection->socket_fd;
+    case MHD_CONNECTION_INFO_SOCKET_CONTEXT:
+      return (const union MHD_ConnectionInfo *) &connection->socket_context;
+    case MHD_CONNECTION_INFO_REQUEST_TIMES:
+      return (const union MHD_ConnectionInfo *) &connection->request_times;
+    case MHD_CONNECTION_INFO_PEER_CREDENTIALS:
+      if (MHD_NO == get_peer_credentials (connection))
+        return NULL;
+      return (const union MHD_ConnectionInfo *) &connection->peer_credentials;
+    default:
+      return NULL;
+    };
+}
+
+
+/**
+ * Set a custom option for the given connection, overriding defaults.
+ *
+ * @param connection connection to modify
+ * @param option option to set
+ * @param ... arguments to the option, depending on the option type
+ * @return #MHD_YES on success, #MHD_NO if setting the option failed
+ * @ingroup specialized
+ */
+int
+MHD_set_connection_option (struct MHD_Connection *connection,
+			   enum MHD_CONNECTION_OPTION option,
+			   ...)
+{
+  va_list ap;
+  struct MHD_Daemon *daemon;
+
+  /* the options of an HTTP/2 request apply to its connection */
+  if (NULL != connection->h2_stream)
+    connection = MHD_http2_parent_ (connection);
+  daemon = connection->daemon;
+  switch (option)
+    {
+    case MHD_CONNECTION_OPTION_TIMEOUT:
+    case MHD_CONNECTION_OPTION_TIMEOUT_MS:
+      if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
+	   (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex)) )
+	MHD_PANIC ("Failed to acquire cleanup mutex\n");
+      if (MHD_YES != connection->suspended)
+        MHD_connection_timeout_remove_ (connection);
+      va_start (ap, option);
+      connection->connection_timeout = va_arg (ap, unsigned int);
+      if (MHD_CONNECTION_OPTION_TIMEOUT == option)
+        connection->connection_timeout *= 1000;
+      va_end (ap);
+      if (MHD_YES != connection->suspended)
+        MHD_connection_timeout_insert_ (connection);
+      if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
+	   (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex)) )
+	MHD_PANIC ("Failed to release cleanup mutex\n");
+      return MHD_YES;
+    case MHD_CONNECTION_OPTION_SEND_RATE_LIMIT:
+      va_start (ap, option);
+      MHD_bucket_init_ (&connection->send_bucket,
+                        va_arg (ap, unsigned int));
+      va_end (ap);
+      return MHD_YES;
+    case MHD_CONNECTION_OPTION_RECV_RATE_LIMIT:
+      va_start (ap, option);
+      MHD_bucket_init_ (&connection->recv_bucket,
+                        va_arg (ap, unsigned int));
+      va_end (ap);
+      return MHD_YES;
+    case MHD_CONNECTION_OPTION_PRIORITY:
+      va_start (ap, option);
+      connection->priority = (enum MHD_ConnectionPriority) va_arg (ap, int);
+      va_end (ap);
+      return MHD_YES;
+    default:
+      return MHD_NO;
+    }
+}
 
-          if (connection->have_chunked_upload)
-            connection->state = MHD_CONNECTION_CHUNKED_BODY_UNREADY;
-          else
-            connection->state = MHD_CONNECTION_NORMAL_BODY_UNREADY;
-          continue;
-        case MHD_CONNECTION_NORMAL_BODY_READY:
-          /* nothing to do here */
-          break;
-        case MHD_CONNECTION_NORMAL_BODY_UNREADY:
-          if (NULL != connection->response->crc)
-            (void) MHD_mutex_lock_ (&connection->response->mutex);
-          if (0 == connection->response->total_size)
-            {
-              if (NULL != connection->response->crc)
-                (void) MHD_mutex_unlock_ (&connection->response->mutex);
-              connection->state = MHD_CONNECTION_BODY_SENT;
-              continue;
-            }
-          if (MHD_YES == try_ready_normal_body (connection))
-            {
-	      if (NULL != connection->response->crc)
-	        (void) MHD_mutex_unlock_ (&connection->response->mutex);
-              connection->state = MHD_CONNECTION_NORMAL_BODY_READY;
-              /* Buffering for flushable socket was already enabled*/
-              if (MHD_NO == socket_flush_possible (connection))
-                socket_start_no_buffering (connection); 
 
-              break;
-            }
-          /* not ready, no socket action */
-          break;
-        case MHD_CONNECTION_CHUNKED_BODY_READY:
-          /* nothing to do here */
-          break;
-        case MHD_CONNECTION_CHUNKED_BODY_UNREADY:
-          if (NULL != connection->response->crc)
-            (void) MHD_mutex_lock_ (&connection->response->mutex);
-          if ( (0 == connection->response->total_size) ||
-               (connection->response_write_position ==
-                connection->response->total_size) )
-            {
-              if (NULL != connection->response->crc)
-                (void) MHD_mutex_unlock_ (&connection->response->mutex);
-              connection->state = MHD_CONNECTION_BODY_SENT;
-              continue;
-            }
-          if (MHD_YES == try_ready_chunked_body (connection))
-            {
-              if (NULL != connection->response->crc)
-                (void) MHD_mutex_unlock_ (&connection->response->mutex);
-              connection->state = MHD_CONNECTION_CHUNKED_BODY_READY;
-              /* Buffering for flushable socket was already enabled */
-              if (MHD_NO == socket_flush_possible (connection))
-                socket_start_no_buffering (connection); 
+/**
+ * Skip optional whitespace in a header value.
+ *
+ * @param pos position in the value
+ * @return first character that is not whitespace
+ */
+static const char *
+skip_ows (const char *pos)
+{
+  while ( (' ' == *pos) || ('\t' == *pos) )
+    pos++;
+  return pos;
+}
 
-              continue;
-            }
-          if (NULL != connection->response->crc)
-            (void) MHD_mutex_unlock_ (&connection->response->mutex);
-          break;
-        case MHD_CONNECTION_BODY_SENT:
-          if (MHD_NO == build_header_response (connection))
-            {
-              /* oops - close! */
-	      CONNECTION_CLOSE_ERROR (connection,
-				      "Closing connection (failed to create response header)\n");
-              continue;
-            }
-          if ( (MHD_NO == connection->have_chunked_upload) ||
-               (connection->write_buffer_send_offset ==
-                connection->write_buffer_append_offset) )
-            connection->state = MHD_CONNECTION_FOOTERS_SENT;
-          else
-            connection->state = MHD_CONNECTION_FOOTERS_SENDING;
-          continue;
-        case MHD_CONNECTION_FOOTERS_SENDING:
-          /* no default action */
-          break;
-        case MHD_CONNECTION_FOOTERS_SENT:
-          if (MHD_NO != socket_flush_possible (connection))
-            socket_start_no_buffering_flush (connection);
-          else
-            socket_start_normal_buffering (connection);
 
-          end =
-            MHD_get_response_header (connection->response,
-				     MHD_HTTP_HEADER_CONNECTION);
-          client_close = ((NULL != end) && (MHD_str_equal_caseless_(end, "close")));
-          MHD_destroy_response (connection->response);
-          connection->response = NULL;
-          if ( (NULL != daemon->notify_completed) &&
-               (MHD_YES == connection->client_aware) )
-          {
-	    daemon->notify_completed (daemon->notify_completed_cls,
-				      connection,
-				      &connection->client_context,
-				      MHD_REQUEST_TERMINATED_COMPLETED_OK);
-            connection->client_aware = MHD_NO;
-          }
-          end =
-            MHD_lookup_connection_value (connection,
-					 MHD_HEADER_KIND,
-                                         MHD_HTTP_HEADER_CONNECTION);
-          if ( (MHD_YES == connection->read_closed) ||
-               (client_close) ||
-               ( (NULL != end) &&
-		 (MHD_str_equal_caseless_ (end, "close")) ) )
-            {
-              connection->read_closed = MHD_YES;
-              connection->read_buffer_offset = 0;
-            }
-          if (((MHD_YES == connection->read_closed) &&
-               (0 == connection->read_buffer_offset)) ||
-              (MHD_NO == keepalive_possible (connection)))
-            {
-              /* have to close for some reason */
-              MHD_connection_close_ (connection,
-                                     MHD_REQUEST_TERMINATED_COMPLETED_OK);
-              MHD_pool_destroy (connection->pool);
-              connection->pool = NULL;
-              connection->read_buffer = NULL;
-              connection->read_buffer_size = 0;
-              connection->read_buffer_offset = 0;
-            }
-          else
+/**
+ * Find the quality the client gives to a content coding in its
+ * "Accept-Encoding" header (RFC 7231, section 5.3.4).
+ *
+ * @param accept value of the "Accept-Encoding" header
+ * @param coding content coding to look for
+ * @param dflt quality to return if neither @a coding nor "*" are listed
+ * @return quality in thousandths, 0 if @a coding is not acceptable
+ */
+static unsigned int
+get_coding_quality (const char *accept,
+                    const char *coding,
+                    unsigned int dflt)
+{
+  const char *pos;
+  const char *name;
+  size_t name_len;
+  size_t coding_len;
+  unsigned int q;
+  unsigned int scale;
+  int have_star;
+  unsigned int star;
+
+  coding_len = strlen (coding);
+  have_star = MHD_NO;
+  star = 0;
+  pos = accept;
+  while ('\0' != *pos)
+    {
+      pos = skip_ows (pos);
+      if (',' == *pos)
+        {
+          pos++;
+          continue;
+        }
+      name = pos;
+      while ( ('\0' != *pos) && (',' != *pos) && (';' != *pos) &&
+              (' ' != *pos) && ('\t' != *pos) )
+        pos++;
+      name_len = pos - name;
+      q = 1000;
+      pos = skip_ows (pos);
+      while (';' == *pos)
+        {
+          pos = skip_ows (pos + 1);
+          if ( ( ('q' == *pos) || ('Q' == *pos) ) &&
+               ('=' == pos[1]) )
             {
-              /* can try to keep-alive */
-              if (MHD_NO != socket_flush_possible (connection))
-                socket_start_normal_buffering (connection);
-              connection->version = NULL;
-              connection->state = MHD_CONNECTION_INIT;
-              /* Reset the read buffer to the starting size,
-                 preserving the bytes we have already read. */
-              connection->read_buffer
-                = MHD_pool_reset (connection->pool,
-                                  connection->read_buffer,
-                                  connection->read_buffer_offset,
-                                  connection->daemon->pool_size / 2);
-              connection->read_buffer_size
-                = connection->daemon->pool_size / 2;
+              pos += 2;
+              q = ('1' == *pos) ? 1000 : 0;
+              if ( ('0' <= *pos) && ('9' >= *pos) )
+                pos++;
+              if ('.' == *pos)
+                {
+                  pos++;
+                  for (scale = 100; ('0' <= *pos) && ('9' >= *pos); pos++)
+                    {
+                      q += scale * (*pos - '0');
+                      scale /= 10;
+                    }
+                }
+              if (q > 1000)
+                q = 1000;
             }
-	  connection->client_aware = MHD_NO;
-          connection->client_context = NULL;
-          connection->continue_message_write_offset = 0;
-          connection->responseCode = 0;
-          connection->headers_received = NULL;
-	  connection->headers_received_tail = NULL;
-          connection->response_write_position = 0;
-          connection->have_chunked_upload = MHD_NO;
-          connection->method = NULL;
-          connection->url = NULL;
-          connection->write_buffer = NULL;
-          connection->write_buffer_size = 0;
-          connection->write_buffer_send_offset = 0;
-          connection->write_buffer_append_offset = 0;
-          continue;
-        case MHD_CONNECTION_CLOSED:
-	  cleanup_connection (connection);
-	  return MHD_NO;
-        default:
-          EXTRA_CHECK (0);
-          break;
+          while ( ('\0' != *pos) && (',' != *pos) && (';' != *pos) )
+            pos++;
+        }
+      while ( ('\0' != *pos) && (',' != *pos) )
+        pos++;
+      if ( (name_len == coding_len) &&
+           (MHD_str_equal_caseless_n_ (name, coding, coding_len)) )
+        return q;
+      if ( (1 == name_len) &&
+           ('*' == *name) )
+        {
+          have_star = MHD_YES;
+          star = q;
         }
-      break;
     }
-  timeout = connection->connection_timeout;
-  if ( (0 != timeout) &&
-       (timeout <= (MHD_monotonic_sec_counter() - connection->last_activity)) )
+  return (MHD_YES == have_star) ? star : dflt;
+}
+
+
+/**
+ * Select the encoding of @a response to send, according to the
+ * "Accept-Encoding" header of the request.
+ *
+ * @param connection connection we're processing
+ * @param response response queued by the application
+ * @return @a response or one of its variants
+ */
+static struct MHD_Response *
+select_variant (struct MHD_Connection *connection,
+                struct MHD_Response *response)
+{
+  const struct MHD_ResponseVariant *rv;
+  struct MHD_Response *best;
+  const char *accept;
+  unsigned int best_q;
+  unsigned int q;
+
+  accept = MHD_lookup_connection_token_value (connection,
+                                              MHD_HEADER_KIND,
+                                              MHD_HEADER_TOKEN_ACCEPT_ENCODING);
+  if (NULL == accept)
+    return response;
+  best = NULL;
+  best_q = 0;
+  for (rv = response->variants; NULL != rv; rv = rv->next)
     {
-      MHD_connection_close_ (connection,
-                             MHD_REQUEST_TERMINATED_TIMEOUT_REACHED);
-      connection->in_idle = MHD_NO;
-      return MHD_YES;
+      q = get_coding_quality (accept,
+                              rv->encoding,
+                              0);
+      if (q > best_q)
+        {
+          best = rv->response;
+          best_q = q;
+        }
     }
-  MHD_connection_update_event_loop_info (connection);
-#if EPOLL_SUPPORT
-  switch (connection->event_loop_info)
+  if ( (NULL == best) ||
+       (get_coding_quality (accept,
+                            "identity",
+                            0) > best_q) )
+    return response;
+  return best;
+}
+
+
+/**
+ * Maximum number of ranges of a "Range" header we answer with a
+ * multipart/byteranges body; for more ranges we send the full body.
+ */
+#define MHD_MAX_RANGES 16
+
+
+/**
+ * Parse a decimal number of a "Range" header.
+ *
+ * @param pos position in the header, updated
+ * @param val where to store the number
+ * @return #MHD_YES if a number was parsed
+ */
+static int
+parse_range_number (const char **pos,
+                    uint64_t *val)
+{
+  const char *p = *pos;
+  uint64_t v;
+
+  if ( ('0' > *p) || ('9' < *p) )
+    return MHD_NO;
+  v = 0;
+  while ( ('0' <= *p) && ('9' >= *p) )
     {
-    case MHD_EVENT_LOOP_INFO_READ:
-      if ( (0 != (connection->epoll_state & MHD_EPOLL_STATE_READ_READY)) &&
-           (0 == (connection->epoll_state & MHD_EPOLL_STATE_SUSPENDED)) &&
-	   (0 == (connection->epoll_state & MHD_EPOLL_STATE_IN_EREADY_EDLL)) )
-	{
-	  EDLL_insert (daemon->eready_head,
-		       daemon->eready_tail,
-		       connection);
-	  connection->epoll_state |= MHD_EPOLL_STATE_IN_EREADY_EDLL;
-	}
-      break;
-    case MHD_EVENT_LOOP_INFO_WRITE:
-      if ( (0 != (connection->epoll_state & MHD_EPOLL_STATE_WRITE_READY)) &&
-           (0 == (connection->epoll_state & MHD_EPOLL_STATE_SUSPENDED)) &&
-	   (0 == (connection->epoll_state & MHD_EPOLL_STATE_IN_EREADY_EDLL)) )
-	{
-	  EDLL_insert (daemon->eready_head,
-		       daemon->eready_tail,
-		       connection);
-	  connection->epoll_state |= MHD_EPOLL_STATE_IN_EREADY_EDLL;
-	}
-      break;
-    case MHD_EVENT_LOOP_INFO_BLOCK:
-      /* we should look at this connection again in the next iteration
-	 of the event loop, as we're waiting on the application */
-      if ( (0 == (connection->epoll_state & MHD_EPOLL_STATE_IN_EREADY_EDLL) &&
-           (0 == (connection->epoll_state & MHD_EPOLL_STATE_SUSPENDED))) )
-	{
-	  EDLL_insert (daemon->eready_head,
-		       daemon->eready_tail,
-		       connection);
-	  connection->epoll_state |= MHD_EPOLL_STATE_IN_EREADY_EDLL;
-	}
-      break;
-    case MHD_EVENT_LOOP_INFO_CLEANUP:
-      /* This connection is finished, nothing left to do */
-      break;
+      if (v > (UINT64_MAX - (uint64_t) (*p - '0')) / 10)
+        return MHD_NO; /* overflow */
+      v = v * 10 + (uint64_t) (*p - '0');
+      p++;
     }
-  return MHD_connection_epoll_update_ (connection);
-#else
+  *val = v;
+  *pos = p;
+  return MHD_YES;
+}
+
+
+/**
+ * Check if the "If-Range" header of the request (if any) allows
+ * answering with only a part of the body of @a response.
+ *
+ * @param connection connection we're processing
+ * @param response response to send
+ * @return #MHD_YES if ranges may be sent
+ */
+static int
+if_range_matches (struct MHD_Connection *connection,
+                  struct MHD_Response *response)
+{
+  const char *if_range;
+  const char *validator;
+
+  if_range = MHD_lookup_connection_value (connection,
+                                          MHD_HEADER_KIND,
+                                          MHD_HTTP_HEADER_IF_RANGE);
+  if (NULL == if_range)
+    return MHD_YES;
+  /* weak entity tags ("W/...") never match, RFC 7233, section 3.2 */
+  if ('"' == if_range[0])
+    validator = MHD_get_response_header (response,
+                                         MHD_HTTP_HEADER_ETAG);
+  else
+    validator = MHD_get_response_header (response,
+                                         MHD_HTTP_HEADER_LAST_MODIFIED);
+  if ( (NULL == validator) ||
+       (0 != strcmp (validator, if_range)) )
+    return MHD_NO;
   return MHD_YES;
-#endif
 }
 
 
-#if EPOLL_SUPPORT
 /**
- * Perform epoll() processing, possibly moving the connection back into
- * the epoll() set if needed.
+ * Set up @a connection to send only the ranges of the body of
+ * @a response requested with the "Range" header (RFC 7233), or to
+ * answer with 416 if none of them are within the body.  Invalid or
+ * unsupported "Range" headers are ignored and the full body is sent.
  *
- * @param connection connection to process
- * @return #MHD_YES if we should continue to process the
- *         connection (not dead yet), #MHD_NO if it died
+ * @param connection connection we're processing
+ * @param response response to send with code #MHD_HTTP_OK
  */
-int
-MHD_connection_epoll_update_ (struct MHD_Connection *connection)
+static void
+setup_ranges (struct MHD_Connection *connection,
+              struct MHD_Response *response)
 {
-  struct MHD_Daemon *daemon = connection->daemon;
-
-  if ( (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY)) &&
-       (0 == (connection->epoll_state & MHD_EPOLL_STATE_IN_EPOLL_SET)) &&
-       (0 == (connection->epoll_state & MHD_EPOLL_STATE_SUSPENDED)) &&
-       ( (0 == (connection->epoll_state & MHD_EPOLL_STATE_WRITE_READY)) ||
-	 ( (0 == (connection->epoll_state & MHD_EPOLL_STATE_READ_READY)) &&
-	   ( (MHD_EVENT_LOOP_INFO_READ == connection->event_loop_info) ||
-	     (connection->read_buffer_size > connection->read_buffer_offset) ) &&
-	   (MHD_NO == connection->read_closed) ) ) )
+  struct MHD_Range ranges[MHD_MAX_RANGES];
+  const char *pos;
+  uint64_t total_size = response->total_size;
+  uint64_t first;
+  uint64_t last;
+  unsigned int count;
+  int have_spec;
+
+  if ( (0 == (response->flags & MHD_RF_ACCEPT_RANGES)) ||
+       (MHD_SIZE_UNKNOWN == total_size) ||
+       (NULL != response->upgrade_handler) ||
+       (NULL == connection->method) ||
+       (! MHD_str_equal_caseless_ (connection->method,
+                                   MHD_HTTP_METHOD_GET)) ||
+       (! MHD_str_equal_caseless_ (connection->version,
+                                   MHD_HTTP_VERSION_1_1)) ||
+       (NULL != MHD_get_response_token_header_ (response,
+                                                MHD_HEADER_TOKEN_CONTENT_LENGTH)) ||
+       (NULL != MHD_get_response_token_header_ (response,
+                                                MHD_HEADER_TOKEN_TRANSFER_ENCODING)) )
+    return;
+  pos = MHD_lookup_connection_token_value (connection,
+                                           MHD_HEADER_KIND,
+                                           MHD_HEADER_TOKEN_RANGE);
+  if ( (NULL == pos) ||
+       (! MHD_str_equal_caseless_n_ (pos, "bytes=", strlen ("bytes="))) ||
+       (MHD_NO == if_range_matches (connection,
+                                    response)) )
+    return;
+  pos += strlen ("bytes=");
+  count = 0;
+  have_spec = MHD_NO;
+  while (1)
     {
-      /* add to epoll set */
-      struct epoll_event event;
+      while ( (' ' == *pos) || ('\t' == *pos) )
+        pos++;
+      if ('-' == *pos)
+        {
+          /* suffix range: the last bytes of the body */
+          pos++;
+          if (MHD_NO == parse_range_number (&pos, &last))
+            return;
+          have_spec = MHD_YES;
+          if ( (0 != last) &&
+               (0 != total_size) )
+            {
+              if (MHD_MAX_RANGES == count)
+                return;
+              ranges[count].start = (last < total_size) ? total_size - last : 0;
+              ranges[count].end = total_size;
+              count++;
+            }
+        }
+      else if (MHD_YES == parse_range_number (&pos, &first))
+        {
+          if ('-' != *pos)
+            return;
+          pos++;
+          if (MHD_NO == parse_range_number (&pos, &last))
+            last = UINT64_MAX;
+          else if (last < first)
+            return;
+          have_spec = MHD_YES;
+          if (first < total_size)
+            {
+              if (MHD_MAX_RANGES == count)
+                return;
+              ranges[count].start = first;
+              ranges[count].end = (last < total_size) ? last + 1 : total_size;
+              count++;
+            }
+        }
+      while ( (' ' == *pos) || ('\t' == *pos) )
+        pos++;
+      if ('\0' == *pos)
+        break;
+      if (',' != *pos)
+        return;
+      pos++;
+    }
+  if (MHD_NO == have_spec)
+    return;
+  if (0 == count)
+    {
+      connection->range_not_satisfiable = MHD_YES;
+      connection->responseCode = MHD_HTTP_REQUESTED_RANGE_NOT_SATISFIABLE;
+      connection->response_write_position = total_size;
+      return;
+    }
+  connection->ranges = MHD_pool_allocate (connection->pool,
+                                          count * sizeof (struct MHD_Range),
+                                          MHD_YES);
+  if (NULL == connection->ranges)
+    {
+      MHD_STATS_ADD_ (connection->daemon, pool_fail_other, 1);
+      return; /* send the full body */
+    }
+  memcpy (connection->ranges,
+          ranges,
+          count * sizeof (struct MHD_Range));
+  connection->ranges_count = count;
+  connection->range_current = 0;
+  connection->responseCode = MHD_HTTP_PARTIAL_CONTENT;
+  connection->response_write_position = ranges[0].start;
+}
 
-      event.events = EPOLLIN | EPOLLOUT | EPOLLET;
-      event.data.ptr = connection;
-      if (0 != epoll_ctl (daemon->epoll_fd,
-			  EPOLL_CTL_ADD,
-			  connection->socket_fd,
-			  &event))
-	{
+
+#if HAVE_ZLIB
+/**
+ * Set up @a connection to compress the body of @a response on the
+ * fly if the response asked for it with #MHD_RO_COMPRESSION_LEVEL and
+ * the client accepts "gzip" or "deflate".  If no compressor can be
+ * obtained, the body is sent as it is.
+ *
+ * @param connection connection we're processing
+ * @param response response to send
+ */
+static void
+setup_compression (struct MHD_Connection *connection,
+                   struct MHD_Response *response)
+{
+  const char *accept;
+  unsigned int q_gzip;
+  unsigned int q_deflate;
+  unsigned int code = connection->responseCode;
+  int gzip;
+
+  if ( (0 == response->compression_level) ||
+       (NULL == response->crc) ||
+       (NULL != response->broadcast) ||
+       (NULL != response->stream) ||
+       (0 == response->total_size) ||
+       (NULL != response->upgrade_handler) ||
+       (code < 200) ||
+       (code >= 600) ||
+       (MHD_HTTP_NO_CONTENT == code) ||
+       (MHD_HTTP_NOT_MODIFIED == code) ||
+       (0 != connection->ranges_count) ||
+       (MHD_YES == connection->range_not_satisfiable) ||
+       (NULL == connection->method) ||
+       (MHD_str_equal_caseless_ (connection->method,
+                                 MHD_HTTP_METHOD_HEAD)) ||
+       (! MHD_str_equal_caseless_ (connection->version,
+                                   MHD_HTTP_VERSION_1_1)) ||
+       (NULL != MHD_get_response_token_header_ (response,
+                                                MHD_HEADER_TOKEN_CONTENT_ENCODING)) ||
+       (NULL != MHD_get_response_token_header_ (response,
+                                                MHD_HEADER_TOKEN_CONTENT_LENGTH)) ||
+       (NULL != MHD_get_response_token_header_ (response,
+                                                MHD_HEADER_TOKEN_TRANSFER_ENCODING)) )
+    return;
+  accept = MHD_lookup_connection_token_value (connection,
+                                              MHD_HEADER_KIND,
+                                              MHD_HEADER_TOKEN_ACCEPT_ENCODING);
+  if (NULL == accept)
+    return;
+  q_gzip = get_coding_quality (accept,
+                               "gzip",
+                               0);
+  q_deflate = get_coding_quality (accept,
+                                  "deflate",
+                                  0);
+  if ( (0 == q_gzip) &&
+       (0 == q_deflate) )
+    return;
+  gzip = (q_gzip >= q_deflate) ? MHD_YES : MHD_NO;
+  connection->compressor = MHD_compressor_get_ (connection->daemon,
+                                                response->compression_level,
+                                                gzip);
+  if (NULL == connection->compressor)
+    {
 #ifdef HAVE_MESSAGES
-	  if (0 != (daemon->options & MHD_USE_DEBUG))
-	    MHD_DLOG (daemon,
-		      "Call to epoll_ctl failed: %s\n",
-		      MHD_socket_last_strerr_ ());
+      MHD_DLOG (connection->daemon,
+                "Failed to set up compression, sending body uncompressed\n");
 #endif
-	  connection->state = MHD_CONNECTION_CLOSED;
-	  cleanup_connection (connection);
-	  return MHD_NO;
-	}
-      connection->epoll_state |= MHD_EPOLL_STATE_IN_EPOLL_SET;
+      return;
     }
-  connection->in_idle = MHD_NO;
-  return MHD_YES;
+  connection->compress_encoding = (MHD_YES == gzip) ? "gzip" : "deflate";
+  connection->compress_input_done = MHD_NO;
+  connection->compress_done = MHD_NO;
 }
 #endif
 
 
 /**
- * Set callbacks for this connection to those for HTTP.
+ * Parse an HTTP-date in the preferred IMF-fixdate format
+ * ("Sun, 06 Nov 1994 08:49:37 GMT", RFC 7231, section 7.1.1.1).
  *
- * @param connection connection to initialize
+ * @param date the string to parse
+ * @param[out] t set to the seconds since the epoch
+ * @return #MHD_YES on success, #MHD_NO if @a date is not an IMF-fixdate
  */
-void
-MHD_set_http_callbacks_ (struct MHD_Connection *connection)
+static int
+parse_http_date (const char *date,
+                 uint64_t *t)
 {
-  connection->read_handler = &MHD_connection_handle_read;
-  connection->write_handler = &MHD_connection_handle_write;
-  connection->idle_handler = &MHD_connection_handle_idle;
+  static const char mons[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+  unsigned int day;
+  unsigned int mon;
+  unsigned int year;
+  unsigned int hour;
+  unsigned int min;
+  unsigned int sec;
+  unsigned int i;
+  unsigned int y;
+  unsigned int m;
+  uint64_t days;
+
+  if ( (29 != strlen (date)) ||
+       (',' != date[3]) ||
+       (' ' != date[4]) ||
+       (' ' != date[7]) ||
+       (' ' != date[11]) ||
+       (' ' != date[16]) ||
+       (':' != date[19]) ||
+       (':' != date[22]) ||
+       (0 != strcmp (&date[25], " GMT")) )
+    return MHD_NO;
+  for (i = 0; i < 29; i++)
+    if ( ( (5 == i) || (6 == i) ||
+           ( (12 <= i) && (15 >= i) ) ||
+           (17 == i) || (18 == i) ||
+           (20 == i) || (21 == i) ||
+           (23 == i) || (24 == i) ) &&
+         ( ('0' > date[i]) || ('9' < date[i]) ) )
+      return MHD_NO;
+  for (mon = 0; mon < 12; mon++)
+    if (0 == strncmp (&mons[mon * 3], &date[8], 3))
+      break;
+  if (12 == mon)
+    return MHD_NO;
+  day = (date[5] - '0') * 10 + (date[6] - '0');
+  year = (date[12] - '0') * 1000 + (date[13] - '0') * 100
+    + (date[14] - '0') * 10 + (date[15] - '0');
+  hour = (date[17] - '0') * 10 + (date[18] - '0');
+  min = (date[20] - '0') * 10 + (date[21] - '0');
+  sec = (date[23] - '0') * 10 + (date[24] - '0');
+  if ( (1970 > year) ||
+       (1 > day) || (31 < day) ||
+       (23 < hour) || (59 < min) || (60 < sec) )
+    return MHD_NO;
+  /* days since 1970-01-01, counting years from March */
+  y = (mon < 2) ? year - 1 : year;
+  m = (mon < 2) ? mon + 10 : mon - 2;
+  days = (uint64_t) y * 365 + y / 4 - y / 100 + y / 400
+    + (153 * m + 2) / 5 + day - 1 - 719468;
+  *t = ((days * 24 + hour) * 60 + min) * 60 + sec;
+  return MHD_YES;
 }
 
 
 /**
- * Obtain information about the given connection.
+ * Check if an "If-None-Match" header matches an entity tag using
+ * the weak comparison (RFC 7232, section 2.3.2).
  *
- * @param connection what connection to get information about
- * @param info_type what information is desired?
- * @param ... depends on @a info_type
- * @return NULL if this information is not available
- *         (or if the @a info_type is unknown)
- * @ingroup specialized
+ * @param if_none_match value of the "If-None-Match" header
+ * @param etag entity tag of the resource, NULL for none
+ * @return #MHD_YES if one of the entity tags matches
  */
-const union MHD_ConnectionInfo *
-MHD_get_connection_info (struct MHD_Connection *connection,
-                         enum MHD_ConnectionInfoType info_type, ...)
+static int
+etag_list_matches (const char *if_none_match,
+                   const char *etag)
 {
-  switch (info_type)
+  const char *pos;
+  const char *end;
+  size_t len;
+
+  pos = skip_ows (if_none_match);
+  if ( ('*' == pos[0]) &&
+       ('\0' == skip_ows (&pos[1])[0]) )
+    return MHD_YES;
+  if (NULL == etag)
+    return MHD_NO;
+  if (0 == strncmp (etag, "W/", 2))
+    etag += 2;
+  len = strlen (etag);
+  while ('\0' != *pos)
     {
-#if HTTPS_SUPPORT
-    case MHD_CONNECTION_INFO_CIPHER_ALGO:
-      if (connection->tls_session == NULL)
-	return NULL;
-      connection->cipher = gnutls_cipher_get (connection->tls_session);
-      return (const union MHD_ConnectionInfo *) &connection->cipher;
-    case MHD_CONNECTION_INFO_PROTOCOL:
-      if (connection->tls_session == NULL)
-	return NULL;
-      connection->protocol = gnutls_protocol_get_version (connection->tls_session);
-      return (const union MHD_ConnectionInfo *) &connection->protocol;
-    case MHD_CONNECTION_INFO_GNUTLS_SESSION:
-      if (connection->tls_session == NULL)
-	return NULL;
-      return (const union MHD_ConnectionInfo *) &connection->tls_session;
-#endif
-    case MHD_CONNECTION_INFO_CLIENT_ADDRESS:
-      return (const union MHD_ConnectionInfo *) &connection->addr;
-    case MHD_CONNECTION_INFO_DAEMON:
-      return (const union MHD_ConnectionInfo *) &connection->daemon;
-    case MHD_CONNECTION_INFO_CONNECTION_FD:
-      return (const union MHD_ConnectionInfo *) &connection->socket_fd;
-    case MHD_CONNECTION_INFO_SOCKET_CONTEXT:
-      return (const union MHD_ConnectionInfo *) &connection->socket_context;
-    default:
-      return NULL;
-    };
+      if (0 == strncmp (pos, "W/", 2))
+        pos += 2;
+      if ('"' != *pos)
+        return MHD_NO;
+      end = strchr (&pos[1], '"');
+      if (NULL == end)
+        return MHD_NO;
+      end++;
+      if ( ((size_t) (end - pos) == len) &&
+           (0 == strncmp (pos, etag, len)) )
+        return MHD_YES;
+      pos = skip_ows (end);
+      if (',' == *pos)
+        pos = skip_ows (&pos[1]);
+      else if ('\0' != *pos)
+        return MHD_NO;
+    }
+  return MHD_NO;
 }
 
 
 /**
- * Set a custom option for the given connection, overriding defaults.
+ * Check if the client's cached copy of the requested resource is
+ * still valid, that is if the "If-None-Match" header of a GET or HEAD
+ * request matches @a etag or (without "If-None-Match") the resource
+ * was not modified since "If-Modified-Since".  This allows answering
+ * with #MHD_HTTP_NOT_MODIFIED without producing the body; see also
+ * #MHD_RF_CONDITIONAL.
  *
- * @param connection connection to modify
- * @param option option to set
- * @param ... arguments to the option, depending on the option type
- * @return #MHD_YES on success, #MHD_NO if setting the option failed
- * @ingroup specialized
+ * @param connection the connection identifying the client
+ * @param etag entity tag of the resource including the quotes
+ *        (i.e. "\"xyzzy\"" or "W/\"xyzzy\""), NULL for none
+ * @param last_modified HTTP-date of the last modification of the
+ *        resource, NULL for none
+ * @return #MHD_YES if the client's copy is valid, #MHD_NO if not
+ * @ingroup request
  */
 int
-MHD_set_connection_option (struct MHD_Connection *connection,
-			   enum MHD_CONNECTION_OPTION option,
-			   ...)
+MHD_check_not_modified (struct MHD_Connection *connection,
+                        const char *etag,
+                        const char *last_modified)
 {
-  va_list ap;
-  struct MHD_Daemon *daemon;
-
-  daemon = connection->daemon;
-  switch (option)
+  const char *header;
+  uint64_t since;
+  uint64_t modified;
+
+  if ( (NULL == connection->method) ||
+       ( (! MHD_str_equal_caseless_ (connection->method,
+                                     MHD_HTTP_METHOD_GET)) &&
+         (! MHD_str_equal_caseless_ (connection->method,
+                                     MHD_HTTP_METHOD_HEAD)) ) )
+    return MHD_NO;
+  /* "If-None-Match" takes precedence, RFC 7232, section 3.3 */
+  header = MHD_lookup_connection_token_value (connection,
+                                              MHD_HEADER_KIND,
+                                              MHD_HEADER_TOKEN_IF_NONE_MATCH);
+  if (NULL != header)
+    return etag_list_matches (header,
+                              etag);
+  header = MHD_lookup_connection_token_value (connection,
+                                              MHD_HEADER_KIND,
+                                              MHD_HEADER_TOKEN_IF_MODIFIED_SINCE);
+  if ( (NULL == header) ||
+       (NULL == last_modified) )
+    return MHD_NO;
+  if ( (MHD_YES == parse_http_date (header,
+                                    &since)) &&
+       (MHD_YES == parse_http_date (last_modified,
+                                    &modified)) )
     {
-    case MHD_CONNECTION_OPTION_TIMEOUT:
-      if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
-	   (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex)) )
-	MHD_PANIC ("Failed to acquire cleanup mutex\n");
-      if (MHD_YES != connection->suspended)
-        {
-          if (connection->connection_timeout == daemon->connection_timeout)
-            XDLL_remove (daemon->normal_timeout_head,
-                         daemon->normal_timeout_tail,
-                         connection);
-          else
-            XDLL_remove (daemon->manual_timeout_head,
-                         daemon->manual_timeout_tail,
-                         connection);
-        }
-      va_start (ap, option);
-      connection->connection_timeout = va_arg (ap, unsigned int);
-      va_end (ap);
-      if (MHD_YES != connection->suspended)
-        {
-          if (connection->connection_timeout == daemon->connection_timeout)
-            XDLL_insert (daemon->normal_timeout_head,
-                         daemon->normal_timeout_tail,
-                         connection);
-          else
-            XDLL_insert (daemon->manual_timeout_head,
-                         daemon->manual_timeout_tail,
-                         connection);
-        }
-      if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
-	   (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex)) )
-	MHD_PANIC ("Failed to release cleanup mutex\n");
-      return MHD_YES;
-    default:
-      return MHD_NO;
+      /* dates in the future are invalid, RFC 7232, section 3.3 */
+      if (since > (uint64_t) time (NULL))
+        return MHD_NO;
+      return (modified <= since) ? MHD_YES : MHD_NO;
     }
+  /* not in the preferred format, the client may still have
+     copied the date verbatim */
+  return (0 == strcmp (header, last_modified)) ? MHD_YES : MHD_NO;
 }
 
 
@@ -3068,9 +9156,86 @@ MHD_queue_response (struct MHD_Connection *connection,
        ( (MHD_CONNECTION_HEADERS_PROCESSED != connection->state) &&
 	 (MHD_CONNECTION_FOOTERS_RECEIVED != connection->state) ) )
     return MHD_NO;
+  if (NULL != response->upgrade_handler)
+    {
+      if (MHD_USE_SUSPEND_RESUME !=
+          (connection->daemon->options & MHD_USE_SUSPEND_RESUME))
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (connection->daemon,
+                    "Attempted 'upgrade' connection on daemon without MHD_USE_SUSPEND_RESUME option!\n");
+#endif
+          return MHD_NO;
+        }
+      if (MHD_HTTP_SWITCHING_PROTOCOLS != status_code)
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (connection->daemon,
+                    "Application used invalid status code for 'upgrade' response!\n");
+#endif
+          return MHD_NO;
+        }
+#if HTTPS_SUPPORT
+      if (0 != (connection->daemon->options & MHD_USE_SSL))
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (connection->daemon,
+                    "'Upgrade' responses are not supported for HTTPS connections!\n");
+#endif
+          return MHD_NO;
+        }
+#endif
+      if (NULL != connection->h2_stream)
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (connection->daemon,
+                    "'Upgrade' responses are not supported for HTTP/2 requests!\n");
+#endif
+          return MHD_NO;
+        }
+    }
+  if ( (NULL != response->broadcast) &&
+       (NULL != connection->h2_stream) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (connection->daemon,
+                "Broadcast responses are not supported for HTTP/2 requests!\n");
+#endif
+      return MHD_NO;
+    }
+  if (NULL != response->stream)
+    {
+      if (NULL != connection->h2_stream)
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (connection->daemon,
+                    "Stream responses are not supported for HTTP/2 requests!\n");
+#endif
+          return MHD_NO;
+        }
+      if (MHD_YES != MHD_stream_attach_ (connection,
+                                         response))
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (connection->daemon,
+                    "Stream response was already queued!\n");
+#endif
+          return MHD_NO;
+        }
+    }
+  if (NULL != connection->cache_entry)
+    MHD_cache_store_ (connection,
+                      status_code,
+                      response);
+  if (NULL != response->variants)
+    response = select_variant (connection,
+                               response);
   MHD_increment_response_rc (response);
   connection->response = response;
+  if (NULL != response->broadcast)
+    MHD_broadcast_subscribe_ (connection);
   connection->responseCode = status_code;
+  connection->request_times.response_queued = MHD_monotonic_usec_counter ();
   if ( (NULL != connection->method) &&
        (MHD_str_equal_caseless_ (connection->method, MHD_HTTP_METHOD_HEAD)) )
     {
@@ -3078,6 +9243,33 @@ MHD_queue_response (struct MHD_Connection *connection,
          have already sent the full message body */
       connection->response_write_position = response->total_size;
     }
+  if ( (MHD_HTTP_OK == status_code) &&
+       (0 != (response->flags & MHD_RF_CONDITIONAL)) &&
+       (MHD_YES == MHD_check_not_modified (connection,
+                                           MHD_get_response_header (response,
+                                                                    MHD_HTTP_HEADER_ETAG),
+                                           MHD_get_response_header (response,
+                                                                    MHD_HTTP_HEADER_LAST_MODIFIED))) )
+    {
+      /* the client has the body already, send only the headers */
+      connection->not_modified = MHD_YES;
+      connection->responseCode = MHD_HTTP_NOT_MODIFIED;
+      connection->response_write_position = response->total_size;
+    }
+  else if ( (MHD_HTTP_OK == status_code) &&
+            (NULL == connection->h2_stream) )
+    setup_ranges (connection,
+                  response);
+  if (NULL != connection->h2_stream)
+    {
+      /* sent by the session of the stream, without compression */
+      return MHD_YES;
+    }
+#if HAVE_ZLIB
+  setup_compression (connection,
+                     response);
+#endif
+  MHD_connection_set_send_adapter_ (connection);
   if ( (MHD_CONNECTION_HEADERS_PROCESSED == connection->state) &&
        (NULL != connection->method) &&
        ( (MHD_str_equal_caseless_ (connection->method,
@@ -3090,10 +9282,97 @@ MHD_queue_response (struct MHD_Connection *connection,
       connection->read_closed = MHD_YES;
       connection->state = MHD_CONNECTION_FOOTERS_RECEIVED;
     }
-  if (MHD_NO == connection->in_idle)
+  /* a handler thread must leave the connection to the event loop */
+  if ( (MHD_NO == connection->handler_offloaded) &&
+       (MHD_NO == connection->in_idle) )
     (void) MHD_connection_handle_idle (connection);
   return MHD_YES;
 }
 
 
+/**
+ * Queue an interim (1xx) response, such as "103 Early Hints" with
+ * "Link" headers, to be transmitted to the client before the final
+ * response.  Only the headers of @a response are sent.
+ *
+ * @param connection the connection identifying the client
+ * @param status_code HTTP status code (i.e. #MHD_HTTP_EARLY_HINTS)
+ * @param response response with the headers to transmit
+ * @return #MHD_NO on error (i.e. final response already queued,
+ *         HTTP/1.0 or HTTP/2 client, status code is not 1xx),
+ *         #MHD_YES if the interim response has been queued
+ * @ingroup response
+ */
+int
+MHD_queue_interim_response (struct MHD_Connection *connection,
+                            unsigned int status_code,
+                            struct MHD_Response *response)
+{
+  struct MHD_HTTP_Header *pos;
+  char code[256];
+  char *data;
+  size_t size;
+  size_t off;
+
+  /* 100 is sent by us, 101 needs an 'upgrade' response */
+  if ( (NULL == connection) ||
+       (NULL == response) ||
+       (NULL != connection->response) ||
+       (MHD_HTTP_PROCESSING > status_code) ||
+       (MHD_HTTP_OK <= status_code) ||
+       (NULL != connection->h2_stream) ||
+       (MHD_CONNECTION_HEADERS_PROCESSED > connection->state) ||
+       (MHD_CONNECTION_FOOTERS_RECEIVED < connection->state) )
+    return MHD_NO;
+  /* HTTP/1.0 clients do not expect them */
+  if ( (NULL == connection->version) ||
+       (! MHD_str_equal_caseless_ (connection->version,
+                                   MHD_HTTP_VERSION_1_1)) )
+    return MHD_NO;
+  off = format_status_line (code,
+                            status_code,
+                            MHD_NO);
+  size = off + 2;               /* +2 for the "\r\n" at the end */
+  for (pos = response->first_header; NULL != pos; pos = pos->next)
+    if (MHD_HEADER_KIND == pos->kind)
+      size += pos->header_size + pos->value_size + 4; /* colon, space, linefeeds */
+  data = MHD_pool_allocate (connection->pool,
+                            size,
+                            MHD_YES);
+  if (NULL == data)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (connection->daemon,
+                "Not enough memory for interim response!\n");
+#endif
+      return MHD_NO;
+    }
+  memcpy (data, code, off);
+  for (pos = response->first_header; NULL != pos; pos = pos->next)
+    if (MHD_HEADER_KIND == pos->kind)
+      {
+        memcpy (&data[off], pos->header, pos->header_size);
+        off += pos->header_size;
+        data[off++] = ':';
+        data[off++] = ' ';
+        memcpy (&data[off], pos->value, pos->value_size);
+        off += pos->value_size;
+        data[off++] = '\r';
+        data[off++] = '\n';
+      }
+  data[off++] = '\r';
+  data[off++] = '\n';
+  if (MHD_NO == append_continue_message (connection,
+                                         data,
+                                         size))
+    return MHD_NO;
+  /* send it right away, the application may suspend the connection
+     for a while; a handler thread must leave it to the event loop,
+     which sends it after the handler returned */
+  if (MHD_NO == connection->handler_offloaded)
+    (void) send_continue_message (connection);
+  return MHD_YES;
+}
+
+
 /* end of connection.c */
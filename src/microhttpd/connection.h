@@ -93,6 +93,149 @@ MHD_connection_close_ (struct MHD_Connection *connection,
                        enum MHD_RequestTerminationCode termination_code);
 
 
+/**
+ * Set the URL of the request of @a connection from the request
+ * target @a uri: give it to the URI logger, split off and parse the
+ * arguments, and unescape it.
+ *
+ * @param connection the connection (updated)
+ * @param uri the request target, modified in place; must live as
+ *        long as the request
+ */
+void
+MHD_connection_set_target_ (struct MHD_Connection *connection,
+                            char *uri);
+
+
+/**
+ * Parse the cookies of the request of @a connection, or note that
+ * they are to be parsed on demand (see
+ * #MHD_OPTION_LAZY_VALUE_PARSING).
+ *
+ * @param connection the connection (updated)
+ */
+void
+MHD_connection_parse_cookies_ (struct MHD_Connection *connection);
+
+
+/**
+ * Produce HTTP "Date:" header, re-using the daemon's cached string if
+ * it was generated during the current second.
+ *
+ * @param daemon daemon the header is generated for
+ * @param date where to write the header (including the "Date: "
+ *        prefix and the CRLF), with at least 128 bytes available space
+ */
+void
+MHD_get_cached_date_string_ (struct MHD_Daemon *daemon,
+                             char *date);
+
+
+/**
+ * Add a connection to the data structure used to find timed-out
+ * connections: the sorted list for connections with the daemon's
+ * default timeout, otherwise the timer wheel.  Connections with a
+ * custom timeout of zero never time out and are not tracked.  The
+ * caller must hold the cleanup mutex if required.
+ *
+ * @param connection connection to add
+ */
+void
+MHD_connection_timeout_insert_ (struct MHD_Connection *connection);
+
+
+/**
+ * Remove a connection from the timeout data structure, see
+ * #MHD_connection_timeout_insert_().
+ *
+ * @param connection connection to remove
+ */
+void
+MHD_connection_timeout_remove_ (struct MHD_Connection *connection);
+
+
+/**
+ * Disarm the guard of @a connection against slow clients and
+ * remove it from the guard wheel of its daemon, for example when
+ * the connection is suspended or closed.  The guard is armed again
+ * by the idle handler for the phase the request is in then.
+ *
+ * @param connection connection to remove
+ */
+void
+MHD_connection_guard_remove_ (struct MHD_Connection *connection);
+
+
+/**
+ * Put the suspended @a connection into the guard wheel of its
+ * daemon, so that the suspension ends at @a deadline (see
+ * #MHD_suspend_connection_with_timeout()).  Must be called from the
+ * event loop of the connection.
+ *
+ * @param connection suspended connection
+ * @param deadline end of the suspension, see #MHD_loop_time_()
+ */
+void
+MHD_connection_suspend_deadline_ (struct MHD_Connection *connection,
+                                  uint64_t deadline);
+
+
+/**
+ * Release the memory pool of a connection that is waiting for the
+ * next request without having received any part of it.  The pool
+ * is obtained again when data arrives.
+ *
+ * @param connection connection to release the pool of
+ * @return #MHD_YES if the pool was released, #MHD_NO if the
+ *         connection is not idle (or has no pool)
+ */
+int
+MHD_connection_release_pool_ (struct MHD_Connection *connection);
+
+
+/**
+ * Add the peak usage of the memory pools of @a connection to the
+ * histogram of its daemon (see #MHD_get_pool_usage_histogram()).
+ * Called once the connection is closed, before its pool is released.
+ *
+ * @param connection connection that was closed
+ */
+void
+MHD_connection_record_pool_peak_ (struct MHD_Connection *connection);
+
+
+/**
+ * Return the blocks @a connection borrowed from the header overflow
+ * arena of its daemon, see #MHD_OPTION_HEADER_OVERFLOW_ARENA.  The
+ * read buffer must no longer be used afterwards.
+ *
+ * @param connection the connection
+ */
+void
+MHD_connection_overflow_release_ (struct MHD_Connection *connection);
+
+
+/**
+ * Create the responses for the errors that MHD reports itself, so
+ * that they do not have to be allocated for every error.
+ *
+ * @param daemon daemon to create the responses for
+ * @return #MHD_YES on success, #MHD_NO on failure (out of memory)
+ */
+int
+MHD_connection_create_error_responses_ (struct MHD_Daemon *daemon);
+
+
+/**
+ * Release the responses created by
+ * #MHD_connection_create_error_responses_().
+ *
+ * @param daemon daemon to release the responses of
+ */
+void
+MHD_connection_destroy_error_responses_ (struct MHD_Daemon *daemon);
+
+
 #if EPOLL_SUPPORT
 /**
  * Perform epoll processing, possibly moving the connection back into
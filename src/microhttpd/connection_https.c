@@ -32,11 +32,13 @@
 #include "memorypool.h"
 #include "response.h"
 #include "mhd_mono_clock.h"
-#include <gnutls/gnutls.h>
+#include "mhd_probes.h"
+#include "mhd_http2.h"
+#include "mhd_tls.h"
 
 
 /**
- * Give gnuTLS chance to work on the TLS handshake.
+ * Give the TLS library a chance to work on the TLS handshake.
  *
  * @param connection connection to handshake on
  * @return #MHD_YES on error or if the handshake is progressing
@@ -48,23 +50,67 @@ run_tls_handshake (struct MHD_Connection *connection)
 {
   int ret;
 
-  connection->last_activity = MHD_monotonic_sec_counter();
   if (connection->state == MHD_TLS_CONNECTION_INIT)
     {
-      ret = gnutls_handshake (connection->tls_session);
-      if (ret == GNUTLS_E_SUCCESS)
+      if (MHD_YES == connection->tls_handshake_offloaded)
+	{
+	  /* the handshake thread owns the connection until it is
+	     resumed, and we may still be in the same round of the
+	     event loop */
+	  if (MHD_YES == connection->suspended)
+	    return MHD_YES;
+	  connection->tls_handshake_offloaded = MHD_NO;
+	  connection->last_activity = MHD_loop_time_ (connection->daemon);
+	  if (MHD_YES == connection->tls_handshake_done)
+	    ret = connection->tls_handshake_result;
+	  else
+	    ret = MHD_tls_handshake_ (connection);
+	}
+      else if (MHD_YES == MHD_tls_handshake_offload_ (connection))
+	{
+	  return MHD_YES;
+	}
+      else
+	{
+	  connection->last_activity = MHD_loop_time_ (connection->daemon);
+	  ret = MHD_tls_handshake_ (connection);
+	}
+      if (MHD_TLS_OK == ret)
 	{
 	  /* set connection state to enable HTTP processing */
 	  connection->state = MHD_CONNECTION_INIT;
+          MHD_STATS_ADD_ (connection->daemon, tls_handshakes, 1);
+          if (NULL != connection->daemon->slow_request_callback)
+            connection->tls_handshake_usec = MHD_monotonic_usec_counter ()
+              - connection->request_times.accepted;
+          MHD_PROBE2 (tls_handshake_done, connection, ret);
+	  connection->tls_ktls_send = MHD_tls_ktls_send_ (connection);
+	  if ( (0 != (connection->daemon->options & MHD_USE_HTTP2)) &&
+	       (MHD_YES == MHD_tls_alpn_h2_ (connection)) )
+	    {
+	      connection->h2_checked = MHD_YES;
+	      if (MHD_NO == MHD_http2_start_ (connection))
+		MHD_connection_close_ (connection,
+				       MHD_REQUEST_TERMINATED_WITH_ERROR);
+	    }
 	  return MHD_YES;
 	}
-      if ( (ret == GNUTLS_E_AGAIN) ||
-	   (ret == GNUTLS_E_INTERRUPTED) )
+      if (MHD_TLS_AGAIN == ret)
 	{
 	  /* handshake not done */
 	  return MHD_YES;
 	}
+      if (MHD_TLS_TIMEDOUT == ret)
+	{
+	  /* the handshake thread enforced the connection timeout */
+          MHD_STATS_ADD_ (connection->daemon, timeouts, 1);
+          MHD_PROBE2 (tls_handshake_done, connection, ret);
+	  MHD_connection_close_ (connection,
+				 MHD_REQUEST_TERMINATED_TIMEOUT_REACHED);
+	  return MHD_YES;
+	}
       /* handshake failed */
+      MHD_PROBE2 (tls_handshake_done, connection, ret);
 #ifdef HAVE_MESSAGES
       MHD_DLOG (connection->daemon,
 		"Error: received handshake message out of context\n");
@@ -73,6 +119,7 @@ run_tls_handshake (struct MHD_Connection *connection)
                              MHD_REQUEST_TERMINATED_WITH_ERROR);
       return MHD_YES;
     }
+  connection->last_activity = MHD_loop_time_ (connection->daemon);
   return MHD_NO;
 }
 
@@ -132,7 +179,7 @@ MHD_tls_connection_handle_write (struct MHD_Connection *connection)
 static int
 MHD_tls_connection_handle_idle (struct MHD_Connection *connection)
 {
-  unsigned int timeout;
+  uint64_t timeout;
 
 #if DEBUG_STATES
   MHD_DLOG (connection->daemon,
@@ -140,21 +187,32 @@ MHD_tls_connection_handle_idle (struct MHD_Connection *connection)
             __FUNCTION__,
             MHD_state_to_string (connection->state));
 #endif
+  if ( (MHD_YES == connection->tls_handshake_offloaded) &&
+       (MHD_YES == connection->suspended) )
+    return MHD_YES;
   timeout = connection->connection_timeout;
-  if ( (timeout != 0) && (timeout <= (MHD_monotonic_sec_counter() - connection->last_activity)))
-    MHD_connection_close_ (connection,
-                           MHD_REQUEST_TERMINATED_TIMEOUT_REACHED);
+  if ( (timeout != 0) &&
+       (connection->last_activity + timeout <= MHD_loop_time_ (connection->daemon)) )
+    {
+      MHD_STATS_ADD_ (connection->daemon, timeouts, 1);
+      MHD_connection_close_ (connection,
+                             MHD_REQUEST_TERMINATED_TIMEOUT_REACHED);
+    }
   switch (connection->state)
     {
       /* on newly created connections we might reach here before any reply has been received */
     case MHD_TLS_CONNECTION_INIT:
+      /* apply the result of a handshake thread right away */
+      if (MHD_YES == connection->tls_handshake_offloaded)
+	(void) run_tls_handshake (connection);
       break;
       /* close connection if necessary */
     case MHD_CONNECTION_CLOSED:
-      gnutls_bye (connection->tls_session, GNUTLS_SHUT_RDWR);
+      MHD_tls_bye_ (connection);
       return MHD_connection_handle_idle (connection);
     default:
-      if ( (0 != gnutls_record_check_pending (connection->tls_session)) &&
+      /* the receive function tracks whether the TLS library holds data */
+      if ( (MHD_YES == connection->tls_read_ready) &&
 	   (MHD_YES != MHD_tls_connection_handle_read (connection)) )
 	return MHD_YES;
       return MHD_connection_handle_idle (connection);
@@ -32,16 +32,24 @@
 #include "mhd_limits.h"
 #include "autoinit_funcs.h"
 #include "mhd_mono_clock.h"
-
-#if HAVE_SEARCH_H
-#include <search.h>
-#else
-#include "tsearch.h"
-#endif
+#include "mhd_probes.h"
+#include "mhd_compress.h"
+#include "mhd_rate_limit.h"
+#include "mhd_log.h"
+#include "mhd_access_log.h"
+#include "mhd_metrics.h"
+#include "mhd_slow_request.h"
+#include "mhd_http2.h"
+#include "mhd_broadcast.h"
+#include "mhd_stream.h"
+#include "mhd_cache.h"
+#include "mhd_sendfile.h"
+#include "mhd_prefork.h"
+#include "mhd_siphash.h"
 
 #if HTTPS_SUPPORT
 #include "connection_https.h"
-#include <gcrypt.h>
+#include "mhd_tls.h"
 #endif
 
 #if defined(HAVE_POLL_H) && defined(HAVE_POLL)
@@ -52,6 +60,15 @@
 #include <sys/sendfile.h>
 #endif
 
+#if EPOLL_SUPPORT
+/* for EPIOCSPARAMS */
+#include <sys/ioctl.h>
+#endif
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+#include <sched.h>
+#endif
+
 #ifndef _MHD_FD_SETSIZE_IS_DEFAULT
 #include "sysfdsetsize.h"
 #endif /* !_MHD_FD_SETSIZE_IS_DEFAULT */
@@ -82,6 +99,24 @@
  */
 #define MHD_POOL_SIZE_DEFAULT (32 * 1024)
 
+/**
+ * Default number of connections accepted per readiness
+ * notification of the listen socket with epoll().
+ */
+#define MHD_ACCEPT_BATCH_SIZE_EPOLL_DEFAULT 128
+
+/**
+ * Default number of unused connection memory pools
+ * kept per thread.
+ */
+#define MHD_POOL_CACHE_SIZE_DEFAULT 8
+
+/**
+ * Default number of seconds a thread of the thread cache stays
+ * parked before it exits (see #MHD_OPTION_THREAD_CACHE_TIMEOUT).
+ */
+#define MHD_THREAD_CACHE_TIMEOUT_DEFAULT 10
+
 #ifdef TCP_FASTOPEN
 /**
  * Default TCP fastopen queue size.
@@ -89,6 +124,27 @@
 #define MHD_TCP_FASTOPEN_QUEUE_SIZE_DEFAULT 10
 #endif
 
+#if HTTPS_SUPPORT
+/**
+ * Maximum payload of the small TLS records sent with
+ * #MHD_OPTION_HTTPS_DYNAMIC_RECORD_SIZE; together with the record
+ * overhead it fits into one TCP segment for the usual MTU of 1500.
+ */
+#define MHD_TLS_SMALL_RECORD_SIZE 1360
+
+/**
+ * After how many milliseconds without sending do we go back to small
+ * TLS records (the congestion window has likely shrunk)?
+ */
+#define MHD_TLS_RECORD_IDLE_RESET 1000
+#endif
+
+/**
+ * How many microseconds does #MHD_stop_daemon() sleep between two
+ * checks whether the connections are drained?
+ */
+#define MHD_SHUTDOWN_DRAIN_INTERVAL (10 * 1000)
+
 /**
  * Print extra messages with reasons for closing
  * sockets? (only adds non-error messages).
@@ -115,6 +171,33 @@
 #define EPOLL_CLOEXEC 0
 #endif
 
+#ifndef SO_REUSEPORT
+#ifdef LINUX
+/* Supported since Linux 3.9, but often not present (or commented out)
+   in the headers at this time; but 15 is reserved for this and
+   thus should be safe to use. */
+#define SO_REUSEPORT 15
+#endif
+#endif
+
+#if defined(LINUX) && defined(SO_ATTACH_FILTER)
+#include <linux/filter.h>
+/**
+ * Can the listen socket filter connection attempts by IP address?
+ */
+#define MHD_IP_FILTER 1
+#else
+#define MHD_IP_FILTER 0
+#endif
+
+#if defined(HAVE_SYS_EVENTFD_H) && defined(HAVE_EVENTFD)
+#include <sys/eventfd.h>
+/**
+ * Use an eventfd instead of a pipe to wake up threads.
+ */
+#define MHD_ITC_EVENTFD_ 1
+#endif
+
 
 /**
  * Default implementation of the panic function,
@@ -173,11 +256,28 @@ MHD_get_master (struct MHD_Daemon *daemon)
 }
 
 
+/**
+ * Number of independently locked shards of the table of per-IP
+ * connection counts.  Must be a power of two.
+ */
+#define MHD_IP_COUNT_SHARDS 64
+
+/**
+ * Number of hash buckets in each shard.  Must be a power of two.
+ */
+#define MHD_IP_COUNT_BUCKETS 64
+
+
 /**
  * Maintain connection count for single address.
  */
 struct MHD_IPCount
 {
+  /**
+   * Next entry in the same hash bucket.
+   */
+  struct MHD_IPCount *next;
+
   /**
    * Address family. AF_INET or AF_INET6 for now.
    */
@@ -208,14 +308,34 @@ struct MHD_IPCount
 
 
 /**
- * Lock shared structure for IP connection counts and connection DLLs.
+ * One shard of the table of per-IP connection counts.  Addresses
+ * are spread over the shards by their hash, so that connections
+ * from different clients accepted by different threads rarely
+ * contend for the same lock.
+ */
+struct MHD_IPCountShard
+{
+  /**
+   * Mutex for the entries of this shard.
+   */
+  MHD_mutex_ mutex;
+
+  /**
+   * Hash buckets with the entries of this shard.
+   */
+  struct MHD_IPCount *buckets[MHD_IP_COUNT_BUCKETS];
+};
+
+
+/**
+ * Lock a shard of the table of IP connection counts.
  *
- * @param daemon handle to daemon where lock is
+ * @param shard shard to lock
  */
 static void
-MHD_ip_count_lock (struct MHD_Daemon *daemon)
+MHD_ip_count_lock (struct MHD_IPCountShard *shard)
 {
-  if (MHD_YES != MHD_mutex_lock_(&daemon->per_ip_connection_mutex))
+  if (MHD_YES != MHD_mutex_lock_(&shard->mutex))
     {
       MHD_PANIC ("Failed to acquire IP connection limit mutex\n");
     }
@@ -223,14 +343,14 @@ MHD_ip_count_lock (struct MHD_Daemon *daemon)
 
 
 /**
- * Unlock shared structure for IP connection counts and connection DLLs.
+ * Unlock a shard of the table of IP connection counts.
  *
- * @param daemon handle to daemon where lock is
+ * @param shard shard to unlock
  */
 static void
-MHD_ip_count_unlock (struct MHD_Daemon *daemon)
+MHD_ip_count_unlock (struct MHD_IPCountShard *shard)
 {
-  if (MHD_YES != MHD_mutex_unlock_(&daemon->per_ip_connection_mutex))
+  if (MHD_YES != MHD_mutex_unlock_(&shard->mutex))
     {
       MHD_PANIC ("Failed to release IP connection limit mutex\n");
     }
@@ -238,58 +358,139 @@ MHD_ip_count_unlock (struct MHD_Daemon *daemon)
 
 
 /**
- * Tree comparison function for IP addresses (supplied to tsearch() family).
- * We compare everything in the struct up through the beginning of the
- * 'count' field.
+ * Create the table of IP connection counts of a (master) daemon,
+ * if a per-IP connection limit was set.
  *
- * @param a1 first address to compare
- * @param a2 second address to compare
- * @return -1, 0 or 1 depending on result of compare
+ * @param daemon daemon to create the table for
+ * @return #MHD_YES on success, #MHD_NO on error
  */
 static int
-MHD_ip_addr_compare (const void *a1, const void *a2)
+MHD_ip_count_init (struct MHD_Daemon *daemon)
+{
+  unsigned int i;
+
+  daemon->per_ip_connection_count = NULL;
+  /* worker processes count in their shared memory */
+  if ( (0 == daemon->per_ip_connection_limit) ||
+       (NULL != daemon->prefork) )
+    return MHD_YES;
+  daemon->per_ip_connection_count =
+    calloc (MHD_IP_COUNT_SHARDS, sizeof (struct MHD_IPCountShard));
+  if (NULL == daemon->per_ip_connection_count)
+    return MHD_NO;
+  MHD_siphash_key_ (daemon->per_ip_connection_key);
+  for (i = 0; i < MHD_IP_COUNT_SHARDS; i++)
+    {
+      if (MHD_YES != MHD_mutex_create_ (&daemon->per_ip_connection_count[i].mutex))
+        {
+          while (i > 0)
+            (void) MHD_mutex_destroy_ (&daemon->per_ip_connection_count[--i].mutex);
+          free (daemon->per_ip_connection_count);
+          daemon->per_ip_connection_count = NULL;
+          return MHD_NO;
+        }
+    }
+  return MHD_YES;
+}
+
+
+/**
+ * Destroy the table of IP connection counts of a (master) daemon.
+ *
+ * @param daemon daemon to destroy the table of
+ */
+static void
+MHD_ip_count_destroy (struct MHD_Daemon *daemon)
 {
-  return memcmp (a1, a2, offsetof (struct MHD_IPCount, count));
+  struct MHD_IPCountShard *shard;
+  struct MHD_IPCount *pos;
+  unsigned int i;
+  unsigned int j;
+
+  if (NULL == daemon->per_ip_connection_count)
+    return;
+  for (i = 0; i < MHD_IP_COUNT_SHARDS; i++)
+    {
+      shard = &daemon->per_ip_connection_count[i];
+      for (j = 0; j < MHD_IP_COUNT_BUCKETS; j++)
+        while (NULL != (pos = shard->buckets[j]))
+          {
+            shard->buckets[j] = pos->next;
+            free (pos);
+          }
+      (void) MHD_mutex_destroy_ (&shard->mutex);
+    }
+  free (daemon->per_ip_connection_count);
+  daemon->per_ip_connection_count = NULL;
 }
 
 
 /**
- * Parse address and initialize 'key' using the address.
+ * Find the raw bytes of the IP address in a socket address.
  *
  * @param addr address to parse
  * @param addrlen number of bytes in addr
- * @param key where to store the parsed address
- * @return #MHD_YES on success and #MHD_NO otherwise (e.g., invalid address type)
+ * @param[out] family set to the address family
+ * @param[out] len set to the number of bytes of the IP address
+ * @return the IP address, NULL for other address types
  */
-static int
-MHD_ip_addr_to_key (const struct sockaddr *addr,
-		    socklen_t addrlen,
-		    struct MHD_IPCount *key)
+static const void *
+MHD_ip_addr_bytes (const struct sockaddr *addr,
+                   socklen_t addrlen,
+                   int *family,
+                   size_t *len)
 {
-  memset(key, 0, sizeof(*key));
-
   /* IPv4 addresses */
-  if (sizeof (struct sockaddr_in) == addrlen)
+  if ( (sizeof (struct sockaddr_in) == addrlen) &&
+       (AF_INET == addr->sa_family) )
     {
       const struct sockaddr_in *addr4 = (const struct sockaddr_in*) addr;
-      key->family = AF_INET;
-      memcpy (&key->addr.ipv4, &addr4->sin_addr, sizeof(addr4->sin_addr));
-      return MHD_YES;
+      *family = AF_INET;
+      *len = sizeof (addr4->sin_addr);
+      return &addr4->sin_addr;
     }
 
 #if HAVE_INET6
   /* IPv6 addresses */
-  if (sizeof (struct sockaddr_in6) == addrlen)
+  if ( (sizeof (struct sockaddr_in6) == addrlen) &&
+       (AF_INET6 == addr->sa_family) )
     {
       const struct sockaddr_in6 *addr6 = (const struct sockaddr_in6*) addr;
-      key->family = AF_INET6;
-      memcpy (&key->addr.ipv6, &addr6->sin6_addr, sizeof(addr6->sin6_addr));
-      return MHD_YES;
+      *family = AF_INET6;
+      *len = sizeof (addr6->sin6_addr);
+      return &addr6->sin6_addr;
     }
 #endif
 
   /* Some other address */
-  return MHD_NO;
+  return NULL;
+}
+
+
+/**
+ * Find the hash bucket for an IP address (SipHash of the address
+ * bytes, keyed per daemon).
+ *
+ * @param daemon master daemon with the table
+ * @param ip the IP address
+ * @param len number of bytes in @a ip
+ * @param[out] shard set to the shard with the bucket
+ * @return the bucket
+ */
+static struct MHD_IPCount **
+MHD_ip_addr_bucket (struct MHD_Daemon *daemon,
+                    const void *ip,
+                    size_t len,
+                    struct MHD_IPCountShard **shard)
+{
+  uint64_t hash;
+
+  hash = MHD_siphash_ (daemon->per_ip_connection_key,
+                       ip,
+                       len);
+  *shard = &daemon->per_ip_connection_count[hash & (MHD_IP_COUNT_SHARDS - 1)];
+  return &(*shard)->buckets[(hash / MHD_IP_COUNT_SHARDS) &
+                            (MHD_IP_COUNT_BUCKETS - 1)];
 }
 
 
@@ -307,53 +508,57 @@ MHD_ip_limit_add (struct MHD_Daemon *daemon,
 		  const struct sockaddr *addr,
 		  socklen_t addrlen)
 {
-  struct MHD_IPCount *key;
-  void **nodep;
-  void *node;
+  struct MHD_IPCountShard *shard;
+  struct MHD_IPCount **bucket;
+  struct MHD_IPCount *pos;
+  const void *ip;
+  size_t len;
+  int family;
   int result;
 
   daemon = MHD_get_master (daemon);
   /* Ignore if no connection limit assigned */
   if (0 == daemon->per_ip_connection_limit)
     return MHD_YES;
-
-  if (NULL == (key = malloc (sizeof(*key))))
-    return MHD_NO;
-
-  /* Initialize key */
-  if (MHD_NO == MHD_ip_addr_to_key (addr, addrlen, key))
-    {
-      /* Allow unhandled address types through */
-      free (key);
-      return MHD_YES;
-    }
-  MHD_ip_count_lock (daemon);
+  /* Allow unhandled address types through */
+  if (NULL == (ip = MHD_ip_addr_bytes (addr, addrlen, &family, &len)))
+    return MHD_YES;
+#if PREFORK_SUPPORT
+  if (NULL != daemon->prefork)
+    return MHD_prefork_ip_limit_add_ (daemon, family, ip, len);
+#endif
+  bucket = MHD_ip_addr_bucket (daemon, ip, len, &shard);
+  MHD_ip_count_lock (shard);
 
   /* Search for the IP address */
-  if (NULL == (nodep = tsearch (key,
-				&daemon->per_ip_connection_count,
-				&MHD_ip_addr_compare)))
+  for (pos = *bucket; NULL != pos; pos = pos->next)
+    if ( (family == pos->family) &&
+         (0 == memcmp (&pos->addr, ip, len)) )
+      break;
+  if (NULL == pos)
     {
+      if (NULL == (pos = malloc (sizeof (struct MHD_IPCount))))
+        {
 #ifdef HAVE_MESSAGES
-      MHD_DLOG (daemon,
-		"Failed to add IP connection count node\n");
+          MHD_DLOG (daemon,
+                    "Failed to add IP connection count node\n");
 #endif
-      MHD_ip_count_unlock (daemon);
-      free (key);
-      return MHD_NO;
+          MHD_ip_count_unlock (shard);
+          return MHD_NO;
+        }
+      pos->family = family;
+      memcpy (&pos->addr, ip, len);
+      pos->count = 0;
+      pos->next = *bucket;
+      *bucket = pos;
     }
-  node = *nodep;
-  /* If we got an existing node back, free the one we created */
-  if (node != key)
-    free(key);
-  key = (struct MHD_IPCount *) node;
   /* Test if there is room for another connection; if so,
    * increment count */
-  result = (key->count < daemon->per_ip_connection_limit) ? MHD_YES : MHD_NO;
+  result = (pos->count < daemon->per_ip_connection_limit) ? MHD_YES : MHD_NO;
   if (MHD_YES == result)
-    ++key->count;
+    ++pos->count;
 
-  MHD_ip_count_unlock (daemon);
+  MHD_ip_count_unlock (shard);
   return result;
 }
 
@@ -371,49 +576,230 @@ MHD_ip_limit_del (struct MHD_Daemon *daemon,
 		  const struct sockaddr *addr,
 		  socklen_t addrlen)
 {
-  struct MHD_IPCount search_key;
-  struct MHD_IPCount *found_key;
-  void **nodep;
+  struct MHD_IPCountShard *shard;
+  struct MHD_IPCount **bucket;
+  struct MHD_IPCount *pos;
+  const void *ip;
+  size_t len;
+  int family;
 
   daemon = MHD_get_master (daemon);
   /* Ignore if no connection limit assigned */
   if (0 == daemon->per_ip_connection_limit)
     return;
-  /* Initialize search key */
-  if (MHD_NO == MHD_ip_addr_to_key (addr, addrlen, &search_key))
+  if (NULL == (ip = MHD_ip_addr_bytes (addr, addrlen, &family, &len)))
     return;
-
-  MHD_ip_count_lock (daemon);
+#if PREFORK_SUPPORT
+  if (NULL != daemon->prefork)
+    {
+      MHD_prefork_ip_limit_del_ (daemon, family, ip, len);
+      return;
+    }
+#endif
+  bucket = MHD_ip_addr_bucket (daemon, ip, len, &shard);
+  MHD_ip_count_lock (shard);
 
   /* Search for the IP address */
-  if (NULL == (nodep = tfind (&search_key,
-			      &daemon->per_ip_connection_count,
-			      &MHD_ip_addr_compare)))
+  while ( (NULL != (pos = *bucket)) &&
+          ( (family != pos->family) ||
+            (0 != memcmp (&pos->addr, ip, len)) ) )
+    bucket = &pos->next;
+  if (NULL == pos)
     {
       /* Something's wrong if we couldn't find an IP address
        * that was previously added */
       MHD_PANIC ("Failed to find previously-added IP address\n");
     }
-  found_key = (struct MHD_IPCount *) *nodep;
   /* Validate existing count for IP address */
-  if (0 == found_key->count)
+  if (0 == pos->count)
     {
       MHD_PANIC ("Previously-added IP address had 0 count\n");
     }
   /* Remove the node entirely if count reduces to 0 */
-  if (0 == --found_key->count)
+  if (0 == --pos->count)
+    {
+      *bucket = pos->next;
+      free (pos);
+    }
+
+  MHD_ip_count_unlock (shard);
+}
+
+
+/**
+ * Create a channel to wake up a thread blocked in select(), poll()
+ * or epoll_wait(): a pipe (or a pair of sockets), or on Linux an
+ * eventfd, which needs fewer system calls to drain and does not
+ * fill up.
+ *
+ * @param itc where to store the read end and the write end
+ * @return 0 on success, -1 on error (see errno)
+ */
+static int
+MHD_itc_create_ (MHD_pipe itc[2])
+{
+#ifdef MHD_ITC_EVENTFD_
+  itc[0] = eventfd (0, EFD_NONBLOCK);
+  if (-1 == itc[0])
+    return -1;
+  /* a separate descriptor for the write end, so that it can be
+     added to an epoll set containing the read end (see
+     epoll_shutdown()) */
+  itc[1] = dup (itc[0]);
+  if (-1 == itc[1])
     {
-      tdelete (found_key,
-	       &daemon->per_ip_connection_count,
-	       &MHD_ip_addr_compare);
-      free (found_key);
+      (void) close (itc[0]);
+      return -1;
     }
+  return 0;
+#else
+  return MHD_pipe_ (itc);
+#endif
+}
+
+
+/**
+ * Make the read end of a wake up channel readable.
+ *
+ * @param fd write end of the channel
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+static int
+MHD_itc_activate_ (MHD_pipe fd)
+{
+#ifdef MHD_ITC_EVENTFD_
+  uint64_t one = 1;
+
+  return (sizeof (one) == write (fd, &one, sizeof (one))) ? MHD_YES : MHD_NO;
+#else
+  return (1 == MHD_pipe_write_ (fd, "w", 1)) ? MHD_YES : MHD_NO;
+#endif
+}
+
+
+/**
+ * Consume the pending wake ups of a channel whose read end was
+ * reported readable.
+ *
+ * @param fd read end of the channel
+ */
+static void
+MHD_itc_clear_ (MHD_pipe fd)
+{
+#ifdef MHD_ITC_EVENTFD_
+  uint64_t cnt;
+
+  /* resets the counter, however often it was signalled */
+  (void) read (fd, &cnt, sizeof (cnt));
+#else
+  char buf[64];
+
+  (void) MHD_pipe_read_ (fd, buf, sizeof (buf));
+#endif
+}
+
+
+/**
+ * Wake up the event loop of @a daemon (if it has a control pipe),
+ * unless it was signalled already and did not clear the pipe yet.
+ * The caller must change the state the event loop is to notice
+ * before calling this function.
+ *
+ * @param daemon daemon to wake up
+ * @return #MHD_YES on success, #MHD_NO if signalling failed
+ */
+static int
+MHD_daemon_wakeup_ (struct MHD_Daemon *daemon)
+{
+  if (MHD_INVALID_PIPE_ == daemon->wpipe[1])
+    return MHD_YES;
+#ifdef HAVE_ATOMIC_BUILTINS
+  if (MHD_YES == __atomic_exchange_n (&daemon->wpipe_pending,
+                                      MHD_YES,
+                                      __ATOMIC_ACQ_REL))
+    return MHD_YES;
+#endif
+  return MHD_itc_activate_ (daemon->wpipe[1]);
+}
+
 
-  MHD_ip_count_unlock (daemon);
+/**
+ * Clear the control pipe of @a daemon after it was reported readable.
+ * The event loop must check its state (resumed connections, added
+ * connections, shutdown) after calling this function and before it
+ * blocks again.
+ *
+ * @param daemon daemon to clear the control pipe of
+ */
+static void
+MHD_daemon_wakeup_clear_ (struct MHD_Daemon *daemon)
+{
+  MHD_itc_clear_ (daemon->wpipe[0]);
+#ifdef HAVE_ATOMIC_BUILTINS
+  /* after draining: a signaller that still sees MHD_YES changed
+     its state before, and we synchronize with it here */
+  (void) __atomic_exchange_n (&daemon->wpipe_pending,
+                              MHD_NO,
+                              __ATOMIC_ACQ_REL);
+#endif
 }
 
 
 #if HTTPS_SUPPORT
+/**
+ * Add @a connection to the connections of its daemon for which the
+ * TLS library may hold decrypted data.  Only for connections that
+ * are not suspended.
+ *
+ * @param connection connection with 'tls_read_ready' set
+ */
+static void
+tls_ready_insert (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+
+  if (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
+    return; /* the connection's thread does not block itself */
+  /* at the head, so that the event loop does not visit a
+     connection again that becomes ready while it is visited */
+  connection->tls_ready_prev = NULL;
+  connection->tls_ready_next = daemon->tls_ready_head;
+  if (NULL == daemon->tls_ready_tail)
+    daemon->tls_ready_tail = connection;
+  else
+    daemon->tls_ready_head->tls_ready_prev = connection;
+  daemon->tls_ready_head = connection;
+}
+
+
+/**
+ * Remove @a connection from the connections of its daemon for
+ * which the TLS library may hold decrypted data, if it is there.
+ *
+ * @param connection connection to remove
+ */
+static void
+tls_ready_remove (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+
+  if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) ||
+       ( (NULL == connection->tls_ready_prev) &&
+         (connection != daemon->tls_ready_head) ) )
+    return;
+  if (NULL == connection->tls_ready_prev)
+    daemon->tls_ready_head = connection->tls_ready_next;
+  else
+    connection->tls_ready_prev->tls_ready_next = connection->tls_ready_next;
+  if (NULL == connection->tls_ready_next)
+    daemon->tls_ready_tail = connection->tls_ready_prev;
+  else
+    connection->tls_ready_next->tls_ready_prev = connection->tls_ready_prev;
+  connection->tls_ready_next = NULL;
+  connection->tls_ready_prev = NULL;
+}
+
+
 /**
  * Callback for receiving data from the socket.
  *
@@ -429,31 +815,35 @@ recv_tls_adapter (struct MHD_Connection *connection, void *other, size_t i)
 
   if (MHD_YES == connection->tls_read_ready)
     {
-      connection->daemon->num_tls_read_ready--;
+      tls_ready_remove (connection);
       connection->tls_read_ready = MHD_NO;
     }
-  res = gnutls_record_recv (connection->tls_session, other, i);
-  if ( (GNUTLS_E_AGAIN == res) ||
-       (GNUTLS_E_INTERRUPTED == res) )
+  res = MHD_tls_recv_ (connection, other, i);
+  if (MHD_TLS_AGAIN == res)
     {
       MHD_set_socket_errno_ (EINTR);
-#if EPOLL_SUPPORT
+#if MHD_EREADY_SUPPORT
       connection->epoll_state &= ~MHD_EPOLL_STATE_READ_READY;
 #endif
       return -1;
     }
   if (res < 0)
     {
-      /* Likely 'GNUTLS_E_INVALID_SESSION' (client communication
+      /* Likely an invalid session (client communication
 	 disrupted); set errno to something caller will interpret
 	 correctly as a hard error */
       MHD_set_socket_errno_ (ECONNRESET);
-      return res;
+      return -1;
     }
-  if ((size_t)res == i)
+  /* a full buffer may have left data in the socket (not signalled
+     again in edge-triggered mode), a short read further records
+     that the TLS library already decrypted */
+  if ( ((size_t)res == i) ||
+       (MHD_YES == MHD_tls_pending_ (connection)) )
     {
       connection->tls_read_ready = MHD_YES;
-      connection->daemon->num_tls_read_ready++;
+      if (MHD_YES != connection->suspended)
+        tls_ready_insert (connection);
     }
   return res;
 }
@@ -471,145 +861,142 @@ static ssize_t
 send_tls_adapter (struct MHD_Connection *connection,
                   const void *other, size_t i)
 {
-  int res;
+  ssize_t res;
+  uint64_t now = 0;
+
+#if MHD_TLS_HAVE_SEND_FILE
+  if ( (MHD_YES == connection->tls_ktls_send) &&
+       (connection->write_buffer_append_offset ==
+        connection->write_buffer_send_offset) &&
+       (NULL != connection->response) &&
+       (-1 != connection->response->fd) &&
+       (MHD_NO == connection->response->is_pipe) )
+    {
+      /* the kernel encrypts, so we can use sendfile */
+      uint64_t offsetu64;
+      uint64_t left;
+      off_t offset;
+      ssize_t ret;
 
-  res = gnutls_record_send (connection->tls_session, other, i);
-  if ( (GNUTLS_E_AGAIN == res) ||
-       (GNUTLS_E_INTERRUPTED == res) )
+      offsetu64 = connection->response_write_position + connection->response->fd_off;
+      left = MHD_BODY_END_ (connection) - connection->response_write_position;
+      if (left > SSIZE_MAX)
+        left = SSIZE_MAX;
+      offset = (off_t) offsetu64;
+      if ( (sizeof (off_t) < sizeof (uint64_t)) &&
+           (offsetu64 > (uint64_t) INT32_MAX) )
+        {
+          MHD_set_socket_errno_ (ECONNRESET);
+          return -1;
+        }
+      ret = MHD_tls_send_file_ (connection,
+                                connection->response->fd,
+                                &offset,
+                                (size_t) left);
+      if (MHD_TLS_AGAIN == ret)
+        {
+          MHD_set_socket_errno_ (EINTR);
+#if MHD_EREADY_SUPPORT
+          connection->epoll_state &= ~MHD_EPOLL_STATE_WRITE_READY;
+#endif
+          return -1;
+        }
+      if (ret < 0)
+        {
+          MHD_set_socket_errno_ (ECONNRESET);
+          return -1;
+        }
+      MHD_COUNT_IO_ (connection, bytes_sent, ret);
+      MHD_PROBE2 (write, connection, ret);
+      return ret;
+    }
+#endif
+  if (0 != connection->daemon->tls_small_record_limit)
+    {
+      now = MHD_loop_time_ (connection->daemon);
+      if (0 != connection->tls_record_pending)
+        {
+          /* the TLS library wants the interrupted record again */
+          if (i > connection->tls_record_pending)
+            i = connection->tls_record_pending;
+        }
+      else
+        {
+          if (now - connection->tls_last_send > MHD_TLS_RECORD_IDLE_RESET)
+            connection->tls_small_record_bytes = 0;
+          if ( (connection->tls_small_record_bytes <
+                connection->daemon->tls_small_record_limit) &&
+               (i > MHD_TLS_SMALL_RECORD_SIZE) )
+            i = MHD_TLS_SMALL_RECORD_SIZE;
+        }
+    }
+  res = MHD_tls_send_ (connection, other, i);
+  if (MHD_TLS_AGAIN == res)
     {
+      connection->tls_record_pending = i;
       MHD_set_socket_errno_ (EINTR);
-#if EPOLL_SUPPORT
+#if MHD_EREADY_SUPPORT
       connection->epoll_state &= ~MHD_EPOLL_STATE_WRITE_READY;
 #endif
       return -1;
     }
+  connection->tls_record_pending = 0;
   if (res < 0)
     {
-      /* some other GNUTLS error, should set 'errno'; as we do not
-         really understand the error (not listed in GnuTLS
-         documentation explicitly), we set 'errno' to something that
-         will cause the connection to fail. */
+      /* some other TLS error, should set 'errno'; as we do not
+         really understand the error, we set 'errno' to something
+         that will cause the connection to fail. */
       MHD_set_socket_errno_ (ECONNRESET);
       return -1;
     }
+  if (0 != connection->daemon->tls_small_record_limit)
+    {
+      if (connection->tls_small_record_bytes <
+          connection->daemon->tls_small_record_limit)
+        connection->tls_small_record_bytes += res;
+      connection->tls_last_send = now;
+    }
   return res;
 }
+#endif
 
 
+#ifdef MHD_POSIX_SOCKETS
 /**
- * Read and setup our certificate and key.
+ * Add @a fd to @a set, which may be larger than an `fd_set`: an
+ * array of `fd_set`s, each for the next FD_SETSIZE sockets.  The
+ * bitmaps of the array are contiguous, so select() sees a single
+ * bitmap (see #MHD_USE_LARGE_FD_SETS), and FD_SET() is never passed
+ * a socket beyond FD_SETSIZE.
  *
- * @param daemon handle to daemon to initialize
- * @return 0 on success
+ * @param fd socket to add
+ * @param set first `fd_set` of the array
  */
-static int
-MHD_init_daemon_certificate (struct MHD_Daemon *daemon)
-{
-  gnutls_datum_t key;
-  gnutls_datum_t cert;
-  int ret;
-
-#if GNUTLS_VERSION_MAJOR >= 3
-  if (NULL != daemon->cert_callback)
-    {
-      gnutls_certificate_set_retrieve_function2 (daemon->x509_cred,
-                                                 daemon->cert_callback);
-    }
-#endif
-  if (NULL != daemon->https_mem_trust)
-    {
-      cert.data = (unsigned char *) daemon->https_mem_trust;
-      cert.size = strlen (daemon->https_mem_trust);
-      if (gnutls_certificate_set_x509_trust_mem (daemon->x509_cred, &cert,
-						 GNUTLS_X509_FMT_PEM) < 0)
-	{
-#ifdef HAVE_MESSAGES
-	  MHD_DLOG(daemon,
-		   "Bad trust certificate format\n");
-#endif
-	  return -1;
-	}
-    }
-
-  if (MHD_YES == daemon->have_dhparams)
-    {
-      gnutls_certificate_set_dh_params (daemon->x509_cred,
-                                        daemon->https_mem_dhparams);
-    }
-  /* certificate & key loaded from memory */
-  if ( (NULL != daemon->https_mem_cert) &&
-       (NULL != daemon->https_mem_key) )
-    {
-      key.data = (unsigned char *) daemon->https_mem_key;
-      key.size = strlen (daemon->https_mem_key);
-      cert.data = (unsigned char *) daemon->https_mem_cert;
-      cert.size = strlen (daemon->https_mem_cert);
-
-      if (NULL != daemon->https_key_password) {
-#if GNUTLS_VERSION_NUMBER >= 0x030111
-        ret = gnutls_certificate_set_x509_key_mem2 (daemon->x509_cred,
-                                                    &cert, &key,
-                                                    GNUTLS_X509_FMT_PEM,
-                                                    daemon->https_key_password,
-                                                    0);
-#else
-#ifdef HAVE_MESSAGES
-	MHD_DLOG (daemon,
-                  "Failed to setup x509 certificate/key: pre 3.X.X version " \
-		  "of GnuTLS does not support setting key password");
-#endif
-	return -1;
-#endif
-      }
-      else
-        ret = gnutls_certificate_set_x509_key_mem (daemon->x509_cred,
-                                                   &cert, &key,
-                                                   GNUTLS_X509_FMT_PEM);
-#ifdef HAVE_MESSAGES
-      if (0 != ret)
-        MHD_DLOG (daemon,
-                  "GnuTLS failed to setup x509 certificate/key: %s\n",
-                  gnutls_strerror (ret));
-#endif
-      return ret;
-    }
-#if GNUTLS_VERSION_MAJOR >= 3
-  if (NULL != daemon->cert_callback)
-    return 0;
-#endif
-#ifdef HAVE_MESSAGES
-  MHD_DLOG (daemon,
-            "You need to specify a certificate and key location\n");
-#endif
-  return -1;
-}
+#define MHD_FD_SET_LARGE_(fd,set) \
+  FD_SET ((fd) % FD_SETSIZE, &(set)[(fd) / FD_SETSIZE])
 
+/**
+ * Remove @a fd from @a set, see #MHD_FD_SET_LARGE_().
+ *
+ * @param fd socket to remove
+ * @param set first `fd_set` of the array
+ */
+#define MHD_FD_CLR_LARGE_(fd,set) \
+  FD_CLR ((fd) % FD_SETSIZE, &(set)[(fd) / FD_SETSIZE])
 
 /**
- * Initialize security aspects of the HTTPS daemon
+ * Check for @a fd in @a set, see #MHD_FD_SET_LARGE_().
  *
- * @param daemon handle to daemon to initialize
- * @return 0 on success
+ * @param fd socket to check for
+ * @param set first `fd_set` of the array
  */
-static int
-MHD_TLS_init (struct MHD_Daemon *daemon)
-{
-  switch (daemon->cred_type)
-    {
-    case GNUTLS_CRD_CERTIFICATE:
-      if (0 !=
-          gnutls_certificate_allocate_credentials (&daemon->x509_cred))
-        return GNUTLS_E_MEMORY_ERROR;
-      return MHD_init_daemon_certificate (daemon);
-    default:
-#ifdef HAVE_MESSAGES
-      MHD_DLOG (daemon,
-                "Error: invalid credentials type %d specified.\n",
-                daemon->cred_type);
-#endif
-      return -1;
-    }
-}
+#define MHD_FD_ISSET_LARGE_(fd,set) \
+  FD_ISSET ((fd) % FD_SETSIZE, &(set)[(fd) / FD_SETSIZE])
+#else
+/* a WinSock fd_set is a list of sockets, not a bitmap */
+#define MHD_FD_SET_LARGE_(fd,set) FD_SET ((fd), (set))
+#define MHD_FD_CLR_LARGE_(fd,set) FD_CLR ((fd), (set))
+#define MHD_FD_ISSET_LARGE_(fd,set) FD_ISSET ((fd), (set))
 #endif
 
 
@@ -643,7 +1030,8 @@ add_to_fd_set (MHD_socket fd,
   if (fd >= (MHD_socket)fd_setsize)
     return MHD_NO;
 #endif /* ! MHD_WINSOCK_SOCKETS */
-  FD_SET (fd, set);
+  /* @a fd_setsize may exceed FD_SETSIZE */
+  MHD_FD_SET_LARGE_ (fd, set);
   if ( (NULL != max_fd) && (MHD_INVALID_SOCKET != fd) &&
        ((fd > *max_fd) || (MHD_INVALID_SOCKET == *max_fd)) )
     *max_fd = fd;
@@ -731,6 +1119,14 @@ MHD_get_fdset2 (struct MHD_Daemon *daemon,
 
       return add_to_fd_set (daemon->epoll_fd, read_fd_set, max_fd, fd_setsize);
     }
+#endif
+#if KQUEUE_SUPPORT
+  if (0 != (daemon->options & MHD_USE_KQUEUE))
+    {
+      /* we're in kqueue mode, the kqueue FD is readable whenever
+	 an event is pending */
+      return add_to_fd_set (daemon->kqueue_fd, read_fd_set, max_fd, fd_setsize);
+    }
 #endif
   if (MHD_INVALID_SOCKET != daemon->socket_fd &&
       MHD_YES != add_to_fd_set (daemon->socket_fd, read_fd_set, max_fd, fd_setsize))
@@ -756,6 +1152,9 @@ MHD_get_fdset2 (struct MHD_Daemon *daemon,
 	      MHD_YES != add_to_fd_set (pos->socket_fd, read_fd_set, max_fd, fd_setsize))
             result = MHD_NO;
 	  break;
+	case MHD_EVENT_LOOP_INFO_THROTTLED:
+	  /* not watched until the rate limit allows more data */
+	  break;
 	case MHD_EVENT_LOOP_INFO_CLEANUP:
 	  /* this should never happen */
 	  break;
@@ -773,9 +1172,83 @@ MHD_get_fdset2 (struct MHD_Daemon *daemon,
 }
 
 
+/**
+ * Last steps of the thread handling @a con in
+ * #MHD_USE_THREAD_PER_CONNECTION mode once the connection is in
+ * cleanup: release the response and close the socket.
+ *
+ * @param con the connection
+ */
+static void
+finish_connection_thread (struct MHD_Connection *con)
+{
+  if (NULL != con->response)
+    {
+      MHD_destroy_response (con->response);
+      con->response = NULL;
+    }
+
+  if (NULL != con->daemon->notify_connection)
+    con->daemon->notify_connection (con->daemon->notify_connection_cls,
+                                    con,
+                                    &con->socket_context,
+                                    MHD_CONNECTION_NOTIFY_CLOSED);
+  if (MHD_INVALID_SOCKET != con->socket_fd)
+    {
+#ifdef WINDOWS
+      shutdown (con->socket_fd, SHUT_WR);
+#endif
+      if (0 != MHD_socket_close_ (con->socket_fd))
+        MHD_PANIC ("close failed\n");
+      con->socket_fd = MHD_INVALID_SOCKET;
+    }
+}
+
+
+/**
+ * Check whether the thread handling @a con may leave it to the
+ * thread parking idle connections (see
+ * #MHD_OPTION_PARK_IDLE_CONNECTIONS): it must wait for the next
+ * request with nothing buffered, and not have timed out yet.
+ *
+ * @param con connection handled by a thread of the thread cache
+ * @return milliseconds until the connection is to be parked (0 to
+ *         park it now), UINT64_MAX if it cannot be parked
+ */
+static uint64_t
+park_delay_left (struct MHD_Connection *con)
+{
+  struct MHD_Daemon *daemon = con->daemon;
+  uint64_t now;
+
+  if ( (0 == daemon->park_idle_delay) ||
+       (MHD_YES != con->thread_cached) ||
+       (MHD_CONNECTION_INIT != con->state) ||
+       (MHD_EVENT_LOOP_INFO_READ != con->event_loop_info) ||
+       (0 != con->read_buffer_offset) ||
+       (0 != con->guard_deadline) ||
+       (NULL != con->h2) )
+    return UINT64_MAX;
+#if HTTPS_SUPPORT
+  if (MHD_YES == con->tls_read_ready)
+    return UINT64_MAX;
+#endif
+  now = MHD_loop_time_ (daemon);
+  /* the thread closes connections that timed out itself */
+  if ( (0 != daemon->connection_timeout) &&
+       (con->last_activity + daemon->connection_timeout <= now) )
+    return UINT64_MAX;
+  if (con->last_activity + daemon->park_idle_delay <= now)
+    return 0;
+  return con->last_activity + daemon->park_idle_delay - now;
+}
+
+
 /**
  * Main function of the thread that handles an individual
  * connection when #MHD_USE_THREAD_PER_CONNECTION is set.
+ * Returns without closing the connection once it is to be parked,
+ * see park_delay_left().
  *
  * @param data the `struct MHD_Connection` this thread will handle
  * @return always 0
@@ -790,11 +1263,11 @@ MHD_handle_connection (void *data)
   MHD_socket maxsock;
   struct timeval tv;
   struct timeval *tvp;
-  unsigned int timeout;
-  time_t now;
+  uint64_t timeout;
+  uint64_t now;
+  uint64_t park_left;
 #if WINDOWS
   MHD_pipe spipe = con->daemon->wpipe[0];
-  char tmp;
 #ifdef HAVE_POLL
   int extra_slot;
 #endif /* HAVE_POLL */
@@ -822,24 +1295,69 @@ MHD_handle_connection (void *data)
 #endif
       if (NULL == tvp && timeout > 0)
 	{
-	  now = MHD_monotonic_sec_counter();
-	  if (now - con->last_activity > timeout)
-	    tv.tv_sec = 0;
+	  now = MHD_loop_time_ (con->daemon);
+	  if (con->last_activity + timeout <= now)
+	    {
+	      tv.tv_sec = 0;
+	      tv.tv_usec = 0;
+	    }
           else
             {
-              const time_t seconds_left = timeout - (now - con->last_activity);
+              const uint64_t msec_left = con->last_activity + timeout - now;
 #ifndef _WIN32
-              tv.tv_sec = seconds_left;
+              tv.tv_sec = (time_t) (msec_left / 1000);
 #else  /* _WIN32 */
-              if (seconds_left > TIMEVAL_TV_SEC_MAX)
+              if (msec_left / 1000 > TIMEVAL_TV_SEC_MAX)
                 tv.tv_sec = TIMEVAL_TV_SEC_MAX;
               else
-                tv.tv_sec = (_MHD_TIMEVAL_TV_SEC_TYPE)seconds_left;
+                tv.tv_sec = (_MHD_TIMEVAL_TV_SEC_TYPE) (msec_left / 1000);
 #endif /* _WIN32 */
+	      tv.tv_usec = (msec_left % 1000) * 1000;
             }
-	  tv.tv_usec = 0;
 	  tvp = &tv;
 	}
+      if (MHD_EVENT_LOOP_INFO_THROTTLED == con->event_loop_info)
+        {
+          /* sleep until the rate limit allows more data */
+          const uint64_t now_ms = MHD_monotonic_msec_counter ();
+          const uint64_t left = (con->throttle_wake > now_ms)
+            ? con->throttle_wake - now_ms : 0;
+
+          if ( (NULL == tvp) ||
+               ((uint64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000 > left) )
+            {
+              tv.tv_sec = (_MHD_TIMEVAL_TV_SEC_TYPE) (left / 1000);
+              tv.tv_usec = (left % 1000) * 1000;
+              tvp = &tv;
+            }
+        }
+      if (0 != con->guard_deadline)
+        {
+          /* wake up when the guard against slow clients is due */
+          const uint64_t now_ms = MHD_monotonic_msec_counter ();
+          const uint64_t left = (con->guard_deadline > now_ms)
+            ? con->guard_deadline - now_ms : 0;
+
+          if ( (NULL == tvp) ||
+               ((uint64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000 > left) )
+            {
+              tv.tv_sec = (_MHD_TIMEVAL_TV_SEC_TYPE) (left / 1000);
+              tv.tv_usec = (left % 1000) * 1000;
+              tvp = &tv;
+            }
+        }
+      park_left = park_delay_left (con);
+      if (UINT64_MAX != park_left)
+        {
+          /* wake up when the connection is to be parked */
+          if ( (NULL == tvp) ||
+               ((uint64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000 > park_left) )
+            {
+              tv.tv_sec = (_MHD_TIMEVAL_TV_SEC_TYPE) (park_left / 1000);
+              tv.tv_usec = (park_left % 1000) * 1000;
+              tvp = &tv;
+            }
+        }
       if (0 == (con->daemon->options & MHD_USE_POLL))
 	{
 	  /* use select */
@@ -872,6 +1390,9 @@ MHD_handle_connection (void *data)
 	      tv.tv_usec = 0;
 	      tvp = &tv;
 	      break;
+	    case MHD_EVENT_LOOP_INFO_THROTTLED:
+	      /* only wait for the timeout */
+	      break;
 	    case MHD_EVENT_LOOP_INFO_CLEANUP:
 	      /* how did we get here!? */
 	      goto exit;
@@ -910,7 +1431,7 @@ MHD_handle_connection (void *data)
           /* drain signaling pipe */
           if ( (MHD_INVALID_PIPE_ != spipe) &&
                (FD_ISSET (spipe, &rs)) )
-            (void) MHD_pipe_read_ (spipe, &tmp, sizeof (tmp));
+            MHD_itc_clear_ (spipe);
 #endif
 	  /* call appropriate connection handler if necessary */
 	  if ( (FD_ISSET (con->socket_fd, &rs))
@@ -947,6 +1468,9 @@ MHD_handle_connection (void *data)
 	      tv.tv_usec = 0;
 	      tvp = &tv;
 	      break;
+	    case MHD_EVENT_LOOP_INFO_THROTTLED:
+	      /* only wait for the timeout */
+	      break;
 	    case MHD_EVENT_LOOP_INFO_CLEANUP:
 	      /* how did we get here!? */
 	      goto exit;
@@ -961,13 +1485,14 @@ MHD_handle_connection (void *data)
               extra_slot = 1;
             }
 #endif
-	  if (MHD_sys_poll_ (p,
+	  num_ready = MHD_sys_poll_ (p,
 #if WINDOWS
-                    1 + extra_slot,
+                                     1 + extra_slot,
 #else
-                    1,
+                                     1,
 #endif
-		    (NULL == tvp) ? -1 : tv.tv_sec * 1000) < 0)
+                                     (NULL == tvp) ? -1 : tv.tv_sec * 1000 + tv.tv_usec / 1000);
+	  if (num_ready < 0)
 	    {
 	      if (EINTR == MHD_socket_errno_)
 		continue;
@@ -982,7 +1507,7 @@ MHD_handle_connection (void *data)
           /* drain signaling pipe */
           if ( (MHD_INVALID_PIPE_ != spipe) &&
                (0 != (p[1].revents & (POLLERR | POLLHUP))) )
-            (void) MHD_pipe_read_ (spipe, &tmp, sizeof (tmp));
+            MHD_itc_clear_ (spipe);
 #endif
 	  if ( (0 != (p[0].revents & POLLIN))
 #if HTTPS_SUPPORT
@@ -999,6 +1524,14 @@ MHD_handle_connection (void *data)
 	    goto exit;
 	}
 #endif
+      if ( (0 == num_ready) &&
+           (0 == park_delay_left (con)) )
+        {
+          /* idle since the last request; the thread of the cache
+             hands the connection to the thread parking connections */
+          con->parked = MHD_YES;
+          return (MHD_THRD_RTRN_TYPE_) 0;
+        }
     }
   if (MHD_CONNECTION_IN_CLEANUP != con->state)
     {
@@ -1014,26 +1547,7 @@ MHD_handle_connection (void *data)
       con->idle_handler (con);
     }
 exit:
-  if (NULL != con->response)
-    {
-      MHD_destroy_response (con->response);
-      con->response = NULL;
-    }
-
-  if (NULL != con->daemon->notify_connection)
-    con->daemon->notify_connection (con->daemon->notify_connection_cls,
-                                    con,
-                                    &con->socket_context,
-                                    MHD_CONNECTION_NOTIFY_CLOSED);
-  if (MHD_INVALID_SOCKET != con->socket_fd)
-    {
-#ifdef WINDOWS
-      shutdown (con->socket_fd, SHUT_WR);
-#endif
-      if (0 != MHD_socket_close_ (con->socket_fd))
-        MHD_PANIC ("close failed\n");
-      con->socket_fd = MHD_INVALID_SOCKET;
-    }
+  finish_connection_thread (con);
   return (MHD_THRD_RTRN_TYPE_) 0;
 }
 
@@ -1052,8 +1566,8 @@ recv_param_adapter (struct MHD_Connection *connection,
 		    size_t i)
 {
   ssize_t ret;
-#if EPOLL_SUPPORT
-  const size_t requested_size = i;
+#if MHD_EREADY_SUPPORT
+  size_t requested_size = i;
 #endif
 
   if ( (MHD_INVALID_SOCKET == connection->socket_fd) ||
@@ -1069,106 +1583,113 @@ recv_param_adapter (struct MHD_Connection *connection,
   if (i > INT_MAX)
     i = INT_MAX; /* return value limit */
 #endif /* MHD_WINSOCK_SOCKETS */
+  if (MHD_YES == MHD_rate_limited_ (connection, MHD_NO))
+    {
+      i = MHD_rate_limit_allowance_ (connection, MHD_NO, i);
+      if (0 == i)
+        {
+          /* the socket stays read-ready */
+          MHD_set_socket_errno_ (EAGAIN);
+          return -1;
+        }
+#if MHD_EREADY_SUPPORT
+      requested_size = i;
+#endif
+    }
 
   ret = (ssize_t)recv (connection->socket_fd, other, (_MHD_socket_funcs_size)i, MSG_NOSIGNAL);
-#if EPOLL_SUPPORT
+#if MHD_EREADY_SUPPORT
   if ( (0 > ret) || (requested_size > (size_t) ret))
     {
       /* partial read --- no longer read-ready */
       connection->epoll_state &= ~MHD_EPOLL_STATE_READ_READY;
     }
 #endif
+  if (0 < ret)
+    {
+      MHD_rate_limit_charge_ (connection, MHD_NO, (size_t) ret);
+      MHD_COUNT_IO_ (connection, bytes_received, ret);
+    }
   return ret;
 }
 
 
 /**
- * Callback for writing data to the socket.
+ * Compute how many bytes may be sent on @a connection at once: the
+ * limit of the return value, the write quantum and the rate limit.
  *
  * @param connection the MHD connection structure
- * @param other data to write
- * @param i number of bytes to write
- * @return actual number of bytes written
+ * @param[out] limit set to the number of bytes that may be sent
+ * @return #MHD_NO if nothing can be sent now (errno is set then)
  */
-static ssize_t
-send_param_adapter (struct MHD_Connection *connection,
-                    const void *other,
-		    size_t i)
+static int
+send_limit (struct MHD_Connection *connection,
+            size_t *limit)
 {
-  ssize_t ret;
-#if EPOLL_SUPPORT
-  const size_t requested_size = i;
-#endif
-#if LINUX
-  MHD_socket fd;
-#endif
-
   if ( (MHD_INVALID_SOCKET == connection->socket_fd) ||
        (MHD_CONNECTION_CLOSED == connection->state) )
     {
       MHD_set_socket_errno_ (ENOTCONN);
-      return -1;
+      return MHD_NO;
     }
 #ifdef MHD_POSIX_SOCKETS
-  if (i > SSIZE_MAX)
-    i = SSIZE_MAX; /* return value limit */
+  *limit = SSIZE_MAX; /* return value limit */
 #else  /* MHD_WINSOCK_SOCKETS */
-  if (i > INT_MAX)
-    i = INT_MAX; /* return value limit */
+  *limit = INT_MAX; /* return value limit */
 #endif /* MHD_WINSOCK_SOCKETS */
+  if ( (0 != connection->daemon->write_quantum) &&
+       (*limit > connection->daemon->write_quantum) )
+    *limit = connection->daemon->write_quantum;
+  if (MHD_YES == MHD_rate_limited_ (connection, MHD_YES))
+    {
+      *limit = MHD_rate_limit_allowance_ (connection, MHD_YES, *limit);
+      if (0 == *limit)
+        {
+          /* the socket stays write-ready */
+          MHD_set_socket_errno_ (EAGAIN);
+          return MHD_NO;
+        }
+    }
+  return MHD_YES;
+}
 
-  if (0 != (connection->daemon->options & MHD_USE_SSL))
-    return (ssize_t)send (connection->socket_fd, other, (_MHD_socket_funcs_size)i, MSG_NOSIGNAL);
-#if LINUX
-  if ( (connection->write_buffer_append_offset ==
-	connection->write_buffer_send_offset) &&
+
+/**
+ * Send @a i bytes from @a other with send() and account for them.
+ *
+ * @param connection the MHD connection structure
+ * @param other data to write
+ * @param i number of bytes to write, within the limit of send_limit()
+ * @return actual number of bytes written
+ */
+static ssize_t
+send_buffer (struct MHD_Connection *connection,
+             const void *other,
+             size_t i)
+{
+  ssize_t ret;
+  int flags;
+
+  flags = MSG_NOSIGNAL;
+#if LINUX && defined(MSG_MORE)
+  if ( (MHD_CONNECTION_HEADERS_SENDING == connection->state) &&
        (NULL != connection->response) &&
-       (-1 != (fd = connection->response->fd)) )
+       ( (-1 != connection->response->fd) ||
+         (NULL == connection->response->crc) ||
+         (NULL != connection->response->data_iov) ) &&
+       (MHD_NO == connection->response->is_pipe) &&
+       (NULL == connection->response->upgrade_handler) &&
+       (connection->response_write_position <
+        MHD_BODY_END_ (connection)) )
     {
-      /* can use sendfile */
-      uint64_t left;
-      uint64_t offsetu64;
-      int err;
-#ifndef HAVE_SENDFILE64
-      off_t offset;
-#else  /* HAVE_SENDFILE64 */
-      off64_t offset;
-#endif /* HAVE_SENDFILE64 */
-      offsetu64 = connection->response_write_position + connection->response->fd_off;
-      left = connection->response->total_size - connection->response_write_position;
-#ifndef HAVE_SENDFILE64
-      offset = (off_t) offsetu64;
-      if ( (offsetu64 <= (uint64_t) OFF_T_MAX) &&
-           (0 < (ret = sendfile (connection->socket_fd, fd, &offset, left))) )
-#else  /* HAVE_SENDFILE64 */
-      offset = (off64_t) offsetu64;
-      if ( (offsetu64 <= (uint64_t) OFF64_T_MAX) &&
-	   (0 < (ret = sendfile64 (connection->socket_fd, fd, &offset, left))) )
-#endif /* HAVE_SENDFILE64 */
-	{
-#if EPOLL_SUPPORT
-          if (requested_size > (size_t) ret)
-	    {
-	      /* partial write --- no longer write-ready */
-	      connection->epoll_state &= ~MHD_EPOLL_STATE_WRITE_READY;
-	    }
-#endif
-	  return ret;
-	}
-      err = MHD_socket_errno_;
-      if ( (EINTR == err) || (EAGAIN == err) || (EWOULDBLOCK == err) )
-	return 0;
-      if ( (EINVAL == err) || (EBADF == err) )
-	return -1;
-      /* None of the 'usual' sendfile errors occurred, so we should try
-	 to fall back to 'SEND'; see also this thread for info on
-	 odd libc/Linux behavior with sendfile:
-	 http://lists.gnu.org/archive/html/libmicrohttpd/2011-02/msg00015.html */
+      /* the body follows right away (sendfile() or memory): let the
+         kernel coalesce the header with the beginning of the body */
+      flags |= MSG_MORE;
     }
 #endif
-  ret = (ssize_t)send (connection->socket_fd, other, (_MHD_socket_funcs_size)i, MSG_NOSIGNAL);
-#if EPOLL_SUPPORT
-  if ( (0 > ret) || (requested_size > (size_t) ret) )
+  ret = (ssize_t)send (connection->socket_fd, other, (_MHD_socket_funcs_size)i, flags);
+#if MHD_EREADY_SUPPORT
+  if ( (0 > ret) || (i > (size_t) ret) )
     {
       /* partial write --- no longer write-ready */
       connection->epoll_state &= ~MHD_EPOLL_STATE_WRITE_READY;
@@ -1179,49 +1700,236 @@ send_param_adapter (struct MHD_Connection *connection,
      http://lists.gnu.org/archive/html/libmicrohttpd/2014-10/msg00023.html */
   if ( (0 > ret) && (0 == MHD_socket_errno_) )
     MHD_set_socket_errno_(ECONNRESET);
+  if (0 < ret)
+    {
+      MHD_rate_limit_charge_ (connection, MHD_YES, (size_t) ret);
+      MHD_COUNT_IO_ (connection, bytes_sent, ret);
+      MHD_PROBE2 (write, connection, ret);
+    }
   return ret;
 }
 
 
 /**
- * Signature of main function for a thread.
+ * Callback for writing data to the socket of a plain connection
+ * whose response is not sent from a file.
  *
- * @param cls closure argument for the function
- * @return termination code from the thread
+ * @param connection the MHD connection structure
+ * @param other data to write
+ * @param i number of bytes to write
+ * @return actual number of bytes written
  */
-typedef MHD_THRD_RTRN_TYPE_ (MHD_THRD_CALL_SPEC_ *ThreadStartRoutine)(void *cls);
+static ssize_t
+send_param_adapter (struct MHD_Connection *connection,
+                    const void *other,
+		    size_t i)
+{
+  size_t limit;
+
+  if (MHD_NO == send_limit (connection, &limit))
+    return -1;
+  if (i > limit)
+    i = limit;
+  return send_buffer (connection, other, i);
+}
 
 
+#if LINUX || MHD_SENDFILE_WITH_HEADER_
 /**
- * Create a thread and set the attributes according to our options.
+ * Callback for writing data to the socket of a plain connection
+ * whose response is sent from a file: once the header is out, the
+ * body goes from the file to the socket with sendfile().
  *
- * @param thread handle to initialize
- * @param daemon daemon with options
- * @param start_routine main function of thread
- * @param arg argument for start_routine
- * @return 0 on success
+ * @param connection the MHD connection structure
+ * @param other data to write
+ * @param i number of bytes to write
+ * @return actual number of bytes written
  */
-static int
-create_thread (MHD_thread_handle_ *thread,
-	       const struct MHD_Daemon *daemon,
-	       ThreadStartRoutine start_routine,
-	       void *arg)
+static ssize_t
+send_file_param_adapter (struct MHD_Connection *connection,
+                         const void *other,
+                         size_t i)
 {
-#if defined(MHD_USE_POSIX_THREADS)
-  pthread_attr_t attr;
-  pthread_attr_t *pattr;
-  int ret;
+  ssize_t ret;
+  size_t limit;
+  MHD_socket fd;
+  uint64_t left;
+  uint64_t offsetu64;
+  int err;
+#if LINUX
+#ifndef HAVE_SENDFILE64
+  off_t offset;
+#else  /* HAVE_SENDFILE64 */
+  off64_t offset;
+#endif /* HAVE_SENDFILE64 */
+#endif
 
-  if (0 != daemon->thread_stack_size)
+  if (MHD_NO == send_limit (connection, &limit))
+    return -1;
+  if (i > limit)
+    i = limit;
+  /* the response stays until the next one is queued */
+  if ( (connection->write_buffer_append_offset !=
+	connection->write_buffer_send_offset) ||
+       (NULL == connection->response) ||
+       (-1 == (fd = connection->response->fd)) ||
+       (MHD_NO != connection->response->is_pipe) )
+    return send_buffer (connection, other, i);
+  offsetu64 = connection->response_write_position + connection->response->fd_off;
+  left = MHD_BODY_END_ (connection) - connection->response_write_position;
+  if (left > limit)
+    left = limit;
+#if LINUX
+#ifndef HAVE_SENDFILE64
+  offset = (off_t) offsetu64;
+  if ( (offsetu64 <= (uint64_t) OFF_T_MAX) &&
+       (0 < (ret = sendfile (connection->socket_fd, fd, &offset, left))) )
+#else  /* HAVE_SENDFILE64 */
+  offset = (off64_t) offsetu64;
+  if ( (offsetu64 <= (uint64_t) OFF64_T_MAX) &&
+       (0 < (ret = sendfile64 (connection->socket_fd, fd, &offset, left))) )
+#endif /* HAVE_SENDFILE64 */
+#else
+  /* the header is sent together with the body by
+     do_write_header_and_file() */
+  if ( (offsetu64 <= (uint64_t) OFF_T_MAX) &&
+       (0 < (ret = MHD_sendfile_with_header_ (connection->socket_fd,
+                                              fd,
+                                              offsetu64,
+                                              (size_t) left,
+                                              NULL,
+                                              0))) )
+#endif
     {
-      if (0 != (ret = pthread_attr_init (&attr)))
-	goto ERR;
-      if (0 != (ret = pthread_attr_setstacksize (&attr, daemon->thread_stack_size)))
-	{
-	  pthread_attr_destroy (&attr);
-	  goto ERR;
-	}
-      pattr = &attr;
+#if MHD_EREADY_SUPPORT
+      if (left > (uint64_t) ret)
+        {
+          /* partial write --- no longer write-ready */
+          connection->epoll_state &= ~MHD_EPOLL_STATE_WRITE_READY;
+        }
+#endif
+      MHD_rate_limit_charge_ (connection, MHD_YES, (size_t) ret);
+      MHD_COUNT_IO_ (connection, bytes_sent, ret);
+      MHD_PROBE2 (write, connection, ret);
+      return ret;
+    }
+  err = MHD_socket_errno_;
+  if ( (EINTR == err) || (EAGAIN == err) || (EWOULDBLOCK == err) || (EBUSY == err) )
+    return 0;
+  if ( (EINVAL == err) || (EBADF == err) )
+    return -1;
+  /* None of the 'usual' sendfile errors occurred, so we should try
+     to fall back to 'SEND'; see also this thread for info on
+     odd libc/Linux behavior with sendfile:
+     http://lists.gnu.org/archive/html/libmicrohttpd/2011-02/msg00015.html */
+  MHD_PROBE2 (sendfile_fallback, connection, err);
+  if (NULL != connection->slow_request)
+    connection->slow_request->sendfile_fallbacks++;
+  return send_buffer (connection, other, i);
+}
+#endif
+
+
+#if HTTPS_SUPPORT
+/**
+ * Callback for the TLS library to write encrypted data to the socket.
+ *
+ * @param connection the MHD connection structure
+ * @param other data to write
+ * @param i number of bytes to write
+ * @return actual number of bytes written
+ */
+static ssize_t
+send_tls_transport (struct MHD_Connection *connection,
+                    const void *other,
+                    size_t i)
+{
+  ssize_t ret;
+  size_t limit;
+
+  if (MHD_NO == send_limit (connection, &limit))
+    return -1;
+  if (i > limit)
+    i = limit;
+  ret = (ssize_t)send (connection->socket_fd, other, (_MHD_socket_funcs_size)i, MSG_NOSIGNAL);
+  if (0 < ret)
+    {
+      MHD_rate_limit_charge_ (connection, MHD_YES, (size_t) ret);
+      MHD_COUNT_IO_ (connection, bytes_sent, ret);
+      MHD_PROBE2 (write, connection, ret);
+    }
+  return ret;
+}
+#endif
+
+
+/**
+ * Choose the function sending the data of @a connection for the
+ * response it just queued.  Plain connections get one that sends the
+ * body with sendfile() for responses from files, and one that just
+ * uses send() otherwise, so that neither checks on every call.
+ *
+ * @param connection connection with a new response
+ */
+void
+MHD_connection_set_send_adapter_ (struct MHD_Connection *connection)
+{
+#if LINUX || MHD_SENDFILE_WITH_HEADER_
+  struct MHD_Response *response = connection->response;
+
+  if ( (&send_param_adapter != connection->send_cls) &&
+       (&send_file_param_adapter != connection->send_cls) )
+    return; /* TLS */
+  if ( (-1 != response->fd) &&
+       (MHD_NO == response->is_pipe) )
+    connection->send_cls = &send_file_param_adapter;
+  else
+    connection->send_cls = &send_param_adapter;
+#else
+  (void) connection;
+#endif
+}
+
+
+/**
+ * Signature of main function for a thread.
+ *
+ * @param cls closure argument for the function
+ * @return termination code from the thread
+ */
+typedef MHD_THRD_RTRN_TYPE_ (MHD_THRD_CALL_SPEC_ *ThreadStartRoutine)(void *cls);
+
+
+/**
+ * Create a thread and set the attributes according to our options.
+ *
+ * @param thread handle to initialize
+ * @param daemon daemon with options
+ * @param start_routine main function of thread
+ * @param arg argument for start_routine
+ * @return 0 on success
+ */
+static int
+create_thread (MHD_thread_handle_ *thread,
+	       const struct MHD_Daemon *daemon,
+	       ThreadStartRoutine start_routine,
+	       void *arg)
+{
+#if defined(MHD_USE_POSIX_THREADS)
+  pthread_attr_t attr;
+  pthread_attr_t *pattr;
+  int ret;
+
+  if (0 != daemon->thread_stack_size)
+    {
+      if (0 != (ret = pthread_attr_init (&attr)))
+	goto ERR;
+      if (0 != (ret = pthread_attr_setstacksize (&attr, daemon->thread_stack_size)))
+	{
+	  pthread_attr_destroy (&attr);
+	  goto ERR;
+	}
+      pattr = &attr;
     }
   else
     {
@@ -1256,2391 +1964,9551 @@ create_thread (MHD_thread_handle_ *thread,
 }
 
 
+#ifdef HAVE_POLL
 /**
- * Add another client connection to the set of connections
- * managed by MHD.  This API is usually not needed (since
- * MHD will accept inbound connections on the server socket).
- * Use this API in special cases, for example if your HTTP
- * server is behind NAT and needs to connect out to the
- * HTTP client.
- *
- * The given client socket will be managed (and closed!) by MHD after
- * this call and must no longer be used directly by the application
- * afterwards.
- *
- * Per-IP connection limits are ignored when using this API.
+ * A thread kept by #MHD_OPTION_THREAD_CACHE_SIZE to handle one
+ * connection after the other in #MHD_USE_THREAD_PER_CONNECTION mode.
+ */
+struct MHD_ConnectionThread
+{
+  /**
+   * Next thread in the list of all threads of the cache.
+   */
+  struct MHD_ConnectionThread *next;
+
+  /**
+   * Previous thread in the list of all threads of the cache.
+   */
+  struct MHD_ConnectionThread *prev;
+
+  /**
+   * Next thread in the stack of parked threads, or in the list of
+   * threads that exited and are still to be joined.
+   */
+  struct MHD_ConnectionThread *idle_next;
+
+  /**
+   * The cache this thread belongs to.
+   */
+  struct MHD_ThreadCache *cache;
+
+  /**
+   * Connection handed to the thread, NULL while it is parked.
+   */
+  struct MHD_Connection *connection;
+
+  /**
+   * Handle of the thread.
+   */
+  MHD_thread_handle_ pid;
+
+  /**
+   * Pipe to wake up the thread while it is parked.
+   */
+  MHD_pipe wpipe[2];
+
+  /**
+   * #MHD_YES while the thread is on the stack of parked threads.
+   */
+  int idle;
+};
+
+
+/**
+ * Threads kept for reuse by a daemon in #MHD_USE_THREAD_PER_CONNECTION
+ * mode (see #MHD_OPTION_THREAD_CACHE_SIZE).
+ */
+struct MHD_ThreadCache
+{
+  /**
+   * Protects all fields of the cache and its threads.
+   */
+  MHD_mutex_ mutex;
+
+  /**
+   * Head of the list of all threads not yet joined.
+   */
+  struct MHD_ConnectionThread *head;
+
+  /**
+   * Tail of the list of all threads not yet joined.
+   */
+  struct MHD_ConnectionThread *tail;
+
+  /**
+   * Stack of parked threads; the thread parked last is reused first,
+   * so that threads that are not needed time out.
+   */
+  struct MHD_ConnectionThread *idle;
+
+  /**
+   * Threads that exited and are still to be joined.
+   */
+  struct MHD_ConnectionThread *dead;
+
+  /**
+   * Number of threads on the @e idle stack.
+   */
+  unsigned int num_idle;
+
+  /**
+   * Connections parked by their threads and not yet taken by the
+   * thread parking them (see #MHD_OPTION_PARK_IDLE_CONNECTIONS).
+   */
+  struct MHD_Connection **parked;
+
+  /**
+   * Number of connections in @e parked.
+   */
+  unsigned int num_parked;
+
+  /**
+   * Number of entries allocated for @e parked.
+   */
+  unsigned int parked_size;
+
+  /**
+   * Handle of the thread polling the parked connections.
+   */
+  MHD_thread_handle_ park_pid;
+
+  /**
+   * Pipe to wake up the thread polling the parked connections.
+   */
+  MHD_pipe park_wpipe[2];
+
+  /**
+   * #MHD_YES if the thread polling the parked connections runs.
+   */
+  int park_started;
+
+  /**
+   * #MHD_YES once the thread polling the parked connections is to
+   * hand them all back; no connections are parked from then on.
+   */
+  int park_shutdown;
+
+  /**
+   * #MHD_YES once the daemon is shutting down.
+   */
+  int shutdown;
+
+  /**
+   * Daemon the cache belongs to.
+   */
+  struct MHD_Daemon *daemon;
+};
+
+
+/**
+ * Hand @a connection, which its thread left idle, to the thread
+ * polling parked connections.
  *
- * @param daemon daemon that manages the connection
- * @param client_socket socket to manage (MHD will expect
- *        to receive an HTTP request from this socket next).
- * @param addr IP address of the client
- * @param addrlen number of bytes in @a addr
- * @param external_add perform additional operations needed due
- *        to the application calling us directly
- * @return #MHD_YES on success, #MHD_NO if this daemon could
- *        not handle the connection (i.e. malloc failed, etc).
- *        The socket will be closed in any case; 'errno' is
- *        set to indicate further details about the error.
+ * @param cache cache of the thread handling @a connection
+ * @param connection the connection to park
+ * @return #MHD_YES on success, #MHD_NO if the connection must stay
+ *         with its thread (shutdown or out of memory)
  */
 static int
-internal_add_connection (struct MHD_Daemon *daemon,
-			 MHD_socket client_socket,
-			 const struct sockaddr *addr,
-			 socklen_t addrlen,
-			 int external_add)
+park_connection (struct MHD_ThreadCache *cache,
+                 struct MHD_Connection *connection)
 {
-  struct MHD_Connection *connection;
-  int res_thread_create;
-  unsigned int i;
-  int eno;
-  struct MHD_Daemon *worker;
-#if OSX
-  static int on = 1;
-#endif
+  struct MHD_Connection **parked;
+  unsigned int size;
 
-  if (NULL != daemon->worker_pool)
+  if (MHD_YES != MHD_mutex_lock_ (&cache->mutex))
+    MHD_PANIC ("Failed to acquire thread cache mutex\n");
+  if (MHD_YES == cache->park_shutdown)
     {
-      /* have a pool, try to find a pool with capacity; we use the
-	 socket as the initial offset into the pool for load
-	 balancing */
-      for (i=0;i<daemon->worker_pool_size;i++)
-        {
-          worker = &daemon->worker_pool[(i + client_socket) % daemon->worker_pool_size];
-          if (worker->connections < worker->connection_limit)
-            return internal_add_connection (worker,
-                                            client_socket,
-                                            addr, addrlen,
-                                            external_add);
-        }
-      /* all pools are at their connection limit, must refuse */
-      if (0 != MHD_socket_close_ (client_socket))
-	MHD_PANIC ("close failed\n");
-#if ENFILE
-      errno = ENFILE;
-#endif
+      if (MHD_YES != MHD_mutex_unlock_ (&cache->mutex))
+        MHD_PANIC ("Failed to release thread cache mutex\n");
       return MHD_NO;
     }
-
-#ifndef MHD_WINSOCK_SOCKETS
-  if ( (client_socket >= FD_SETSIZE) &&
-       (0 == (daemon->options & (MHD_USE_POLL | MHD_USE_EPOLL_LINUX_ONLY))) )
+  if (cache->num_parked == cache->parked_size)
     {
-#ifdef HAVE_MESSAGES
-      MHD_DLOG (daemon,
-		"Socket descriptor larger than FD_SETSIZE: %d > %d\n",
-		client_socket,
-		FD_SETSIZE);
-#endif
-      if (0 != MHD_socket_close_ (client_socket))
-	MHD_PANIC ("close failed\n");
-#if EINVAL
-      errno = EINVAL;
-#endif
-      return MHD_NO;
+      size = 2 * cache->parked_size + 8;
+      parked = realloc (cache->parked,
+                        size * sizeof (struct MHD_Connection *));
+      if (NULL == parked)
+        {
+          if (MHD_YES != MHD_mutex_unlock_ (&cache->mutex))
+            MHD_PANIC ("Failed to release thread cache mutex\n");
+          return MHD_NO;
+        }
+      cache->parked = parked;
+      cache->parked_size = size;
     }
-#endif
+  cache->parked[cache->num_parked++] = connection;
+  MHD_STATS_ADD_ (cache->daemon, parked, 1);
+  if (MHD_YES != MHD_mutex_unlock_ (&cache->mutex))
+    MHD_PANIC ("Failed to release thread cache mutex\n");
+  if (MHD_YES != MHD_itc_activate_ (cache->park_wpipe[1]))
+    MHD_PANIC ("Failed to signal thread via pipe\n");
+  return MHD_YES;
+}
 
 
-#ifdef HAVE_MESSAGES
-#if DEBUG_CONNECT
-  MHD_DLOG (daemon,
-            "Accepted connection on socket %d\n",
-            client_socket);
-#endif
-#endif
-  if ( (daemon->connections == daemon->connection_limit) ||
-       (MHD_NO == MHD_ip_limit_add (daemon, addr, addrlen)) )
+/**
+ * Main function of a thread of the thread cache: handle the
+ * connection it was handed, then park until it gets another one or
+ * was idle for #MHD_Daemon::thread_cache_timeout seconds.
+ *
+ * @param cls the `struct MHD_ConnectionThread`
+ * @return always 0
+ */
+static MHD_THRD_RTRN_TYPE_ MHD_THRD_CALL_SPEC_
+MHD_connection_thread (void *cls)
+{
+  struct MHD_ConnectionThread *ct = cls;
+  struct MHD_ThreadCache *cache = ct->cache;
+  struct MHD_Daemon *daemon = cache->daemon;
+  struct MHD_ConnectionThread **prev;
+  struct MHD_Connection *connection;
+  struct pollfd p;
+  int timeout;
+  int num_ready;
+  int parked;
+
+  timeout = (0 == daemon->thread_cache_timeout)
+    ? -1 : (int) daemon->thread_cache_timeout * 1000;
+  if (MHD_YES != MHD_mutex_lock_ (&cache->mutex))
+    MHD_PANIC ("Failed to acquire thread cache mutex\n");
+  while (1)
     {
-      /* above connection limit - reject */
-#ifdef HAVE_MESSAGES
-      MHD_DLOG (daemon,
-                "Server reached connection limit (closing inbound connection)\n");
-#endif
-      if (0 != MHD_socket_close_ (client_socket))
-	MHD_PANIC ("close failed\n");
-#if ENFILE
-      errno = ENFILE;
+      connection = ct->connection;
+      if (NULL != connection)
+        {
+          if (MHD_YES != MHD_mutex_unlock_ (&cache->mutex))
+            MHD_PANIC ("Failed to release thread cache mutex\n");
+          parked = MHD_NO;
+          (void) MHD_handle_connection (connection);
+          while (MHD_YES == connection->parked)
+            {
+              if (MHD_YES == park_connection (cache, connection))
+                {
+                  parked = MHD_YES;
+                  break;
+                }
+              connection->parked = MHD_NO;
+              (void) MHD_handle_connection (connection);
+            }
+          if (MHD_NO == parked)
+            {
+              /* only now may the daemon free the connection */
+              if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+                MHD_PANIC ("Failed to acquire cleanup mutex\n");
+              connection->thread_joined = MHD_YES;
+              if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+                MHD_PANIC ("Failed to release cleanup mutex\n");
+              (void) MHD_daemon_wakeup_ (daemon);
+            }
+          /* a parked connection may already be handled by another
+             thread, it must not be touched here */
+          if (MHD_YES != MHD_mutex_lock_ (&cache->mutex))
+            MHD_PANIC ("Failed to acquire thread cache mutex\n");
+          ct->connection = NULL;
+          if ( (MHD_YES == cache->shutdown) ||
+               (cache->num_idle >= daemon->thread_cache_size) )
+            break;
+          ct->idle_next = cache->idle;
+          cache->idle = ct;
+          ct->idle = MHD_YES;
+          cache->num_idle++;
+        }
+      if (MHD_YES != MHD_mutex_unlock_ (&cache->mutex))
+        MHD_PANIC ("Failed to release thread cache mutex\n");
+      p.fd = ct->wpipe[0];
+      p.events = POLLIN;
+      p.revents = 0;
+      num_ready = MHD_sys_poll_ (&p, 1, timeout);
+      if ( (num_ready < 0) &&
+           (EINTR != MHD_socket_errno_) )
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "poll failed: %s\n",
+                    MHD_socket_last_strerr_ ());
 #endif
-      return MHD_NO;
+        }
+      if (0 != (p.revents & POLLIN))
+        MHD_itc_clear_ (ct->wpipe[0]);
+      if (MHD_YES != MHD_mutex_lock_ (&cache->mutex))
+        MHD_PANIC ("Failed to acquire thread cache mutex\n");
+      if (NULL != ct->connection)
+        continue;
+      if ( (MHD_YES == cache->shutdown) ||
+           (0 == num_ready) )
+        {
+          /* idle for too long (or shutting down), leave the stack */
+          for (prev = &cache->idle; ct != *prev; prev = &(*prev)->idle_next) ;
+          *prev = ct->idle_next;
+          ct->idle = MHD_NO;
+          cache->num_idle--;
+          break;
+        }
     }
+  ct->idle_next = cache->dead;
+  cache->dead = ct;
+  if (MHD_YES != MHD_mutex_unlock_ (&cache->mutex))
+    MHD_PANIC ("Failed to release thread cache mutex\n");
+  return (MHD_THRD_RTRN_TYPE_) 0;
+}
 
-  /* apply connection acceptance policy if present */
-  if ( (NULL != daemon->apc) &&
-       (MHD_NO == daemon->apc (daemon->apc_cls,
-			       addr, addrlen)) )
+
+/**
+ * Join the threads of the cache of @a daemon that exited.
+ * Must be called with the mutex of the cache held.
+ *
+ * @param cache cache to collect exited threads of
+ */
+static void
+join_dead_threads (struct MHD_ThreadCache *cache)
+{
+  struct MHD_ConnectionThread *ct;
+
+  while (NULL != (ct = cache->dead))
     {
-#if DEBUG_CLOSE
-#ifdef HAVE_MESSAGES
-      MHD_DLOG (daemon,
-                "Connection rejected, closing connection\n");
-#endif
-#endif
-      if (0 != MHD_socket_close_ (client_socket))
-	MHD_PANIC ("close failed\n");
-      MHD_ip_limit_del (daemon, addr, addrlen);
-#if EACCESS
-      errno = EACCESS;
-#endif
-      return MHD_NO;
+      cache->dead = ct->idle_next;
+      /* the thread is done with the cache, it only returns */
+      if (0 != MHD_join_thread_ (ct->pid))
+        MHD_PANIC ("Failed to join a thread\n");
+      DLL_remove (cache->head,
+                  cache->tail,
+                  ct);
+      if (0 != MHD_pipe_close_ (ct->wpipe[0]))
+        MHD_PANIC ("close failed\n");
+      if (0 != MHD_pipe_close_ (ct->wpipe[1]))
+        MHD_PANIC ("close failed\n");
+      free (ct);
     }
-
-#if OSX
-#ifdef SOL_SOCKET
-#ifdef SO_NOSIGPIPE
-  setsockopt (client_socket,
-	      SOL_SOCKET, SO_NOSIGPIPE,
-	      &on, sizeof (on));
-#endif
-#endif
+}
 #endif
 
-  if (NULL == (connection = malloc (sizeof (struct MHD_Connection))))
+
+/**
+ * Start handling @a connection on its own thread, reusing a parked
+ * thread of the thread cache of @a daemon if there is one.
+ *
+ * @param daemon daemon in #MHD_USE_THREAD_PER_CONNECTION mode
+ * @param connection the new connection
+ * @return 0 on success, error code of the thread creation otherwise
+ */
+static int
+start_connection_thread (struct MHD_Daemon *daemon,
+                         struct MHD_Connection *connection)
+{
+#ifdef HAVE_POLL
+  struct MHD_ThreadCache *cache = daemon->thread_cache;
+  struct MHD_ConnectionThread *ct;
+  int res_thread_create;
+
+  if (NULL == cache)
+    return create_thread (&connection->pid,
+                          daemon,
+                          &MHD_handle_connection,
+                          connection);
+  /* a cached thread is not joined, it tells the daemon when it is
+     done with the connection */
+  connection->thread_cached = MHD_YES;
+  if (MHD_YES != MHD_mutex_lock_ (&cache->mutex))
+    MHD_PANIC ("Failed to acquire thread cache mutex\n");
+  join_dead_threads (cache);
+  if (NULL != (ct = cache->idle))
     {
-      eno = errno;
-#ifdef HAVE_MESSAGES
-      MHD_DLOG (daemon,
-		"Error allocating memory: %s\n",
-		MHD_strerror_ (errno));
-#endif
-      if (0 != MHD_socket_close_ (client_socket))
-	MHD_PANIC ("close failed\n");
-      MHD_ip_limit_del (daemon, addr, addrlen);
-      errno = eno;
-      return MHD_NO;
+      cache->idle = ct->idle_next;
+      ct->idle = MHD_NO;
+      cache->num_idle--;
+      ct->connection = connection;
+      if (MHD_YES != MHD_mutex_unlock_ (&cache->mutex))
+        MHD_PANIC ("Failed to release thread cache mutex\n");
+      if (MHD_YES != MHD_itc_activate_ (ct->wpipe[1]))
+        MHD_PANIC ("Failed to signal thread via pipe\n");
+      return 0;
     }
-  memset (connection,
-          0,
-          sizeof (struct MHD_Connection));
-  connection->pool = MHD_pool_create (daemon->pool_size);
-  if (NULL == connection->pool)
+  if (MHD_YES != MHD_mutex_unlock_ (&cache->mutex))
+    MHD_PANIC ("Failed to release thread cache mutex\n");
+  ct = malloc (sizeof (struct MHD_ConnectionThread));
+  if (NULL == ct)
+    return ENOMEM;
+  memset (ct, 0, sizeof (struct MHD_ConnectionThread));
+  ct->cache = cache;
+  ct->connection = connection;
+  ct->idle = MHD_NO;
+  if (0 != MHD_itc_create_ (ct->wpipe))
     {
-#ifdef HAVE_MESSAGES
-      MHD_DLOG (daemon,
-		"Error allocating memory: %s\n",
-		MHD_strerror_ (errno));
-#endif
-      if (0 != MHD_socket_close_ (client_socket))
-	MHD_PANIC ("close failed\n");
-      MHD_ip_limit_del (daemon, addr, addrlen);
-      free (connection);
-#if ENOMEM
-      errno = ENOMEM;
-#endif
-      return MHD_NO;
+      res_thread_create = errno;
+      free (ct);
+      return res_thread_create;
     }
-
-  connection->connection_timeout = daemon->connection_timeout;
-  if (NULL == (connection->addr = malloc (addrlen)))
+  /* insert before starting, the thread may exit right away */
+  if (MHD_YES != MHD_mutex_lock_ (&cache->mutex))
+    MHD_PANIC ("Failed to acquire thread cache mutex\n");
+  DLL_insert (cache->head,
+              cache->tail,
+              ct);
+  res_thread_create = create_thread (&ct->pid,
+                                     daemon,
+                                     &MHD_connection_thread,
+                                     ct);
+  if (0 != res_thread_create)
+    DLL_remove (cache->head,
+                cache->tail,
+                ct);
+  if (MHD_YES != MHD_mutex_unlock_ (&cache->mutex))
+    MHD_PANIC ("Failed to release thread cache mutex\n");
+  if (0 != res_thread_create)
     {
-      eno = errno;
-#ifdef HAVE_MESSAGES
-      MHD_DLOG (daemon,
-		"Error allocating memory: %s\n",
-		MHD_strerror_ (errno));
-#endif
-      if (0 != MHD_socket_close_ (client_socket))
-	MHD_PANIC ("close failed\n");
-      MHD_ip_limit_del (daemon, addr, addrlen);
-      MHD_pool_destroy (connection->pool);
-      free (connection);
-      errno = eno;
-      return MHD_NO;
+      if (0 != MHD_pipe_close_ (ct->wpipe[0]))
+        MHD_PANIC ("close failed\n");
+      if (0 != MHD_pipe_close_ (ct->wpipe[1]))
+        MHD_PANIC ("close failed\n");
+      free (ct);
     }
-  memcpy (connection->addr, addr, addrlen);
-  connection->addr_len = addrlen;
-  connection->socket_fd = client_socket;
-  connection->daemon = daemon;
-  connection->last_activity = MHD_monotonic_sec_counter();
-
-  /* set default connection handlers  */
-  MHD_set_http_callbacks_ (connection);
-  connection->recv_cls = &recv_param_adapter;
-  connection->send_cls = &send_param_adapter;
-
-  if (0 == (connection->daemon->options & MHD_USE_EPOLL_TURBO))
-    {
-      /* non-blocking sockets are required on most systems and for GNUtls;
-	 however, they somehow cause serious problems on CYGWIN (#1824);
-	 in turbo mode, we assume that non-blocking was already set
-	 by 'accept4' or whoever calls 'MHD_add_connection' */
-#ifdef CYGWIN
-      if (0 != (daemon->options & MHD_USE_SSL))
-#endif
-	{
-	  /* make socket non-blocking */
-#if !defined(MHD_WINSOCK_SOCKETS)
-	  int flags = fcntl (connection->socket_fd, F_GETFL);
-	  if ( (-1 == flags) ||
-	       (0 != fcntl (connection->socket_fd, F_SETFL, flags | O_NONBLOCK)) )
-	    {
-#ifdef HAVE_MESSAGES
-	      MHD_DLOG (daemon,
-			"Failed to make socket non-blocking: %s\n",
-			MHD_socket_last_strerr_ ());
-#endif
-	    }
+  return res_thread_create;
 #else
-	  unsigned long flags = 1;
-	  if (0 != ioctlsocket (connection->socket_fd, FIONBIO, &flags))
-	    {
-#ifdef HAVE_MESSAGES
-	      MHD_DLOG (daemon,
-			"Failed to make socket non-blocking: %s\n",
-			MHD_socket_last_strerr_ ());
+  return create_thread (&connection->pid,
+                        daemon,
+                        &MHD_handle_connection,
+                        connection);
 #endif
-	    }
-#endif
-	}
-    }
+}
 
-#if HTTPS_SUPPORT
-  if (0 != (daemon->options & MHD_USE_SSL))
-    {
-      connection->recv_cls = &recv_tls_adapter;
-      connection->send_cls = &send_tls_adapter;
-      connection->state = MHD_TLS_CONNECTION_INIT;
-      MHD_set_https_callbacks (connection);
-      gnutls_init (&connection->tls_session, GNUTLS_SERVER);
-      gnutls_priority_set (connection->tls_session,
-			   daemon->priority_cache);
-      switch (daemon->cred_type)
-        {
-          /* set needed credentials for certificate authentication. */
-        case GNUTLS_CRD_CERTIFICATE:
-          gnutls_credentials_set (connection->tls_session,
-				  GNUTLS_CRD_CERTIFICATE,
-				  daemon->x509_cred);
-          break;
-        default:
-#ifdef HAVE_MESSAGES
-          MHD_DLOG (connection->daemon,
-                    "Failed to setup TLS credentials: unknown credential type %d\n",
-                    daemon->cred_type);
-#endif
-          if (0 != MHD_socket_close_ (client_socket))
-	    MHD_PANIC ("close failed\n");
-          MHD_ip_limit_del (daemon, addr, addrlen);
-          free (connection->addr);
-          free (connection);
-          MHD_PANIC ("Unknown credential type");
-#if EINVAL
-	  errno = EINVAL;
-#endif
- 	  return MHD_NO;
-        }
-      gnutls_transport_set_ptr (connection->tls_session,
-				(gnutls_transport_ptr_t) connection);
-      gnutls_transport_set_pull_function (connection->tls_session,
-					  (gnutls_pull_func) &recv_param_adapter);
-      gnutls_transport_set_push_function (connection->tls_session,
-					  (gnutls_push_func) &send_param_adapter);
 
-      if (daemon->https_mem_trust)
-	  gnutls_certificate_server_set_request (connection->tls_session,
-						 GNUTLS_CERT_REQUEST);
-    }
+#ifdef HAVE_POLL
+/**
+ * Hand a parked @a connection back to a thread of the thread cache,
+ * or close it if no thread can be started.
+ *
+ * @param daemon daemon in #MHD_USE_THREAD_PER_CONNECTION mode
+ * @param connection connection taken from the parked ones
+ */
+static void
+unpark_connection (struct MHD_Daemon *daemon,
+                   struct MHD_Connection *connection)
+{
+  connection->parked = MHD_NO;
+  MHD_STATS_SUB_ (daemon, parked, 1);
+  if (0 == start_connection_thread (daemon,
+                                    connection))
+    return;
+#ifdef HAVE_MESSAGES
+  MHD_DLOG (daemon,
+            "Failed to create a thread for a parked connection\n");
 #endif
-
-  if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
-       (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex)) )
+  MHD_connection_close_ (connection,
+                         MHD_REQUEST_TERMINATED_WITH_ERROR);
+  connection->idle_handler (connection);
+  finish_connection_thread (connection);
+  if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
     MHD_PANIC ("Failed to acquire cleanup mutex\n");
-  XDLL_insert (daemon->normal_timeout_head,
-	       daemon->normal_timeout_tail,
-	       connection);
-  DLL_insert (daemon->connections_head,
-	      daemon->connections_tail,
-	      connection);
-  if  ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
-	(MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex)) )
+  connection->thread_joined = MHD_YES;
+  if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
     MHD_PANIC ("Failed to release cleanup mutex\n");
+  (void) MHD_daemon_wakeup_ (daemon);
+}
 
-  if (NULL != daemon->notify_connection)
-    daemon->notify_connection (daemon->notify_connection_cls,
-                               connection,
-                               &connection->socket_context,
-                               MHD_CONNECTION_NOTIFY_STARTED);
 
-  /* attempt to create handler thread */
-  if (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
+/**
+ * Main function of the thread polling the connections parked by
+ * the threads of the thread cache (see
+ * #MHD_OPTION_PARK_IDLE_CONNECTIONS).  A connection is handed back
+ * to a thread once the client sends data (or closes it), or when it
+ * timed out so that the thread closes it.  On shutdown, all parked
+ * connections are handed back.
+ *
+ * @param cls the `struct MHD_ThreadCache`
+ * @return always 0
+ */
+static MHD_THRD_RTRN_TYPE_ MHD_THRD_CALL_SPEC_
+MHD_park_thread (void *cls)
+{
+  struct MHD_ThreadCache *cache = cls;
+  struct MHD_Daemon *daemon = cache->daemon;
+  struct MHD_Connection **cons;
+  struct MHD_Connection *pos;
+  struct pollfd *p;
+  void *grown;
+  unsigned int num;
+  unsigned int size;
+  unsigned int i;
+  uint64_t now;
+  uint64_t left;
+  int timeout;
+  int stop;
+
+  num = 0;
+  size = 8;
+  cons = malloc (size * sizeof (struct MHD_Connection *));
+  p = malloc ((1 + size) * sizeof (struct pollfd));
+  stop = ( (NULL == cons) || (NULL == p) ) ? MHD_YES : MHD_NO;
+  while (1)
     {
-      res_thread_create = create_thread (&connection->pid,
-                                         daemon,
-					 &MHD_handle_connection,
-                                         connection);
-      if (0 != res_thread_create)
+      if (MHD_YES != MHD_mutex_lock_ (&cache->mutex))
+        MHD_PANIC ("Failed to acquire thread cache mutex\n");
+      if (MHD_YES == stop)
+        cache->park_shutdown = MHD_YES;
+      stop = cache->park_shutdown;
+      if ( (MHD_NO == stop) &&
+           (num + cache->num_parked > size) &&
+           (NULL != (grown = realloc (cons,
+                                      (num + cache->num_parked)
+                                      * sizeof (struct MHD_Connection *)))) )
+        {
+          cons = grown;
+          grown = realloc (p,
+                           (1 + num + cache->num_parked)
+                           * sizeof (struct pollfd));
+          if (NULL != grown)
+            {
+              p = grown;
+              size = num + cache->num_parked;
+            }
+        }
+      while ( (MHD_NO == stop) &&
+              (num < size) &&
+              (0 != cache->num_parked) )
+        cons[num++] = cache->parked[--cache->num_parked];
+      /* out of memory (or shutting down), hand back what is left */
+      while (0 != cache->num_parked)
+        {
+          pos = cache->parked[--cache->num_parked];
+          if (MHD_YES != MHD_mutex_unlock_ (&cache->mutex))
+            MHD_PANIC ("Failed to release thread cache mutex\n");
+          unpark_connection (daemon,
+                             pos);
+          if (MHD_YES != MHD_mutex_lock_ (&cache->mutex))
+            MHD_PANIC ("Failed to acquire thread cache mutex\n");
+        }
+      if (MHD_YES != MHD_mutex_unlock_ (&cache->mutex))
+        MHD_PANIC ("Failed to release thread cache mutex\n");
+      if (MHD_YES == stop)
+        break;
+
+      p[0].fd = cache->park_wpipe[0];
+      p[0].events = POLLIN;
+      p[0].revents = 0;
+      timeout = -1;
+      now = MHD_loop_time_ (daemon);
+      for (i = 0; i < num; i++)
+        {
+          p[1 + i].fd = cons[i]->socket_fd;
+          p[1 + i].events = POLLIN;
+          p[1 + i].revents = 0;
+          if (0 == daemon->connection_timeout)
+            continue;
+          left = cons[i]->last_activity + daemon->connection_timeout;
+          left = (left > now) ? left - now : 0;
+          if (left > INT_MAX)
+            left = INT_MAX;
+          if ( (-1 == timeout) ||
+               ((int) left < timeout) )
+            timeout = (int) left;
+        }
+      if ( (MHD_sys_poll_ (p, 1 + num, timeout) < 0) &&
+           (EINTR != MHD_socket_errno_) )
         {
-	  eno = errno;
 #ifdef HAVE_MESSAGES
           MHD_DLOG (daemon,
-                    "Failed to create a thread: %s\n",
-                    MHD_strerror_ (res_thread_create));
+                    "poll failed: %s\n",
+                    MHD_socket_last_strerr_ ());
 #endif
-	  goto cleanup;
+        }
+      if (0 != (p[0].revents & POLLIN))
+        MHD_itc_clear_ (cache->park_wpipe[0]);
+      /* backwards, as the last connection takes the slot of one
+         handed back */
+      now = MHD_loop_time_ (daemon);
+      for (i = num; i > 0; i--)
+        {
+          pos = cons[i - 1];
+          if ( (0 == p[i].revents) &&
+               ( (0 == daemon->connection_timeout) ||
+                 (pos->last_activity + daemon->connection_timeout > now) ) )
+            continue;
+          cons[i - 1] = cons[--num];
+          unpark_connection (daemon,
+                             pos);
         }
     }
-  else
-    if ( (MHD_YES == external_add) &&
-	 (MHD_INVALID_PIPE_ != daemon->wpipe[1]) &&
-	 (1 != MHD_pipe_write_ (daemon->wpipe[1], "n", 1)) )
-      {
-#ifdef HAVE_MESSAGES
-	MHD_DLOG (daemon,
-		  "failed to signal new connection via pipe");
-#endif
-      }
-#if EPOLL_SUPPORT
-  if (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY))
-    {
-      if (0 == (daemon->options & MHD_USE_EPOLL_TURBO))
-	{
-	  struct epoll_event event;
+  for (i = 0; i < num; i++)
+    unpark_connection (daemon,
+                       cons[i]);
+  free (cons);
+  free (p);
+  return (MHD_THRD_RTRN_TYPE_) 0;
+}
 
-	  event.events = EPOLLIN | EPOLLOUT | EPOLLET;
-	  event.data.ptr = connection;
-	  if (0 != epoll_ctl (daemon->epoll_fd,
-			      EPOLL_CTL_ADD,
-			      client_socket,
-			      &event))
-	    {
-	      eno = errno;
-#ifdef HAVE_MESSAGES
-              MHD_DLOG (daemon,
-                        "Call to epoll_ctl failed: %s\n",
-                        MHD_socket_last_strerr_ ());
-#endif
-	      goto cleanup;
-	    }
-	  connection->epoll_state |= MHD_EPOLL_STATE_IN_EPOLL_SET;
-	}
-      else
-	{
-	  connection->epoll_state |= MHD_EPOLL_STATE_READ_READY | MHD_EPOLL_STATE_WRITE_READY
-	    | MHD_EPOLL_STATE_IN_EREADY_EDLL;
-	  EDLL_insert (daemon->eready_head,
-		       daemon->eready_tail,
-		       connection);
-	}
+
+/**
+ * Check if @a daemon keeps a poll set for MHD_poll_all().
+ *
+ * @param daemon daemon to check
+ * @return non-zero if the poll set is used
+ */
+#define POLL_SET_USED(daemon) \
+  ( (0 != ((daemon)->options & MHD_USE_POLL)) && \
+    (0 == ((daemon)->options & MHD_USE_THREAD_PER_CONNECTION)) )
+
+
+/**
+ * Make sure the poll set of @a daemon has room for @a num
+ * connections, allocating it (with the entries for the listen socket
+ * and the wakeup pipe) if needed.
+ *
+ * @param daemon daemon to grow the poll set of
+ * @param num number of connections the poll set must have room for
+ * @return #MHD_YES on success, #MHD_NO if we are out of memory
+ */
+static int
+poll_set_reserve (struct MHD_Daemon *daemon,
+                  unsigned int num)
+{
+  struct pollfd *fds;
+  struct MHD_Connection **conns;
+  unsigned int size;
+
+  if (daemon->poll_fds_size >= 2 + num)
+    return MHD_YES;
+  size = (0 == daemon->poll_fds_size) ? 32 : daemon->poll_fds_size;
+  while (size < 2 + num)
+    size *= 2;
+  fds = realloc (daemon->poll_fds,
+                 size * sizeof (struct pollfd));
+  if (NULL == fds)
+    return MHD_NO;
+  daemon->poll_fds = fds;
+  conns = realloc (daemon->poll_conns,
+                   size * sizeof (struct MHD_Connection *));
+  if (NULL == conns)
+    return MHD_NO;
+  daemon->poll_conns = conns;
+  if (0 == daemon->poll_fds_size)
+    {
+      memset (fds, 0, 2 * sizeof (struct pollfd));
+      fds[0].fd = MHD_INVALID_SOCKET;
+      fds[0].events = POLLIN;
+      fds[1].fd = daemon->wpipe[0];
+      fds[1].events = POLLIN;
+      conns[0] = NULL;
+      conns[1] = NULL;
+      daemon->poll_fds_used = 2;
     }
-#endif
-  daemon->connections++;
+  daemon->poll_fds_size = size;
   return MHD_YES;
- cleanup:
-  if (NULL != daemon->notify_connection)
-    daemon->notify_connection (daemon->notify_connection_cls,
-                               connection,
-                               &connection->socket_context,
-                               MHD_CONNECTION_NOTIFY_CLOSED);
-  if (0 != MHD_socket_close_ (client_socket))
-    MHD_PANIC ("close failed\n");
-  MHD_ip_limit_del (daemon, addr, addrlen);
-  if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
-       (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex)) )
-    MHD_PANIC ("Failed to acquire cleanup mutex\n");
-  DLL_remove (daemon->connections_head,
-	      daemon->connections_tail,
-	      connection);
-  XDLL_remove (daemon->normal_timeout_head,
-	       daemon->normal_timeout_tail,
-	       connection);
-  if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
-       (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex)) )
-    MHD_PANIC ("Failed to release cleanup mutex\n");
-  MHD_pool_destroy (connection->pool);
-  free (connection->addr);
-  free (connection);
-#if EINVAL
-  errno = eno;
-#endif
-  return MHD_NO;
 }
 
 
 /**
- * Suspend handling of network data for a given connection.  This can
- * be used to dequeue a connection from MHD's event loop (external
- * select, internal select or thread pool; not applicable to
- * thread-per-connection!) for a while.
- *
- * If you use this API in conjunction with a internal select or a
- * thread pool, you must set the option #MHD_USE_PIPE_FOR_SHUTDOWN to
- * ensure that a resumed connection is immediately processed by MHD.
- *
- * Suspended connections continue to count against the total number of
- * connections allowed (per daemon, as well as per IP, if such limits
- * are set).  Suspended connections will NOT time out; timeouts will
- * restart when the connection handling is resumed.  While a
- * connection is suspended, MHD will not detect disconnects by the
- * client.
- *
- * The only safe time to suspend a connection is from the
- * #MHD_AccessHandlerCallback.
- *
- * Finally, it is an API violation to call #MHD_stop_daemon while
- * having suspended connections (this will at least create memory and
- * socket leaks or lead to undefined behavior).  You must explicitly
- * resume all connections before stopping the daemon.
+ * Set the events of the entry of @a connection in the poll set
+ * according to its 'event_loop_info'.
  *
- * @param connection the connection to suspend
+ * @param connection connection in the poll set
  */
-void
-MHD_suspend_connection (struct MHD_Connection *connection)
+static void
+poll_set_events (struct MHD_Connection *connection)
 {
-  struct MHD_Daemon *daemon;
+  struct MHD_Daemon *daemon = connection->daemon;
+  struct pollfd *p = &daemon->poll_fds[connection->poll_slot];
 
-  daemon = connection->daemon;
-  if (MHD_USE_SUSPEND_RESUME != (daemon->options & MHD_USE_SUSPEND_RESUME))
-    MHD_PANIC ("Cannot suspend connections without enabling MHD_USE_SUSPEND_RESUME!\n");
-  if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
-       (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex)) )
-    MHD_PANIC ("Failed to acquire cleanup mutex\n");
-  DLL_remove (daemon->connections_head,
-              daemon->connections_tail,
-              connection);
-  DLL_insert (daemon->suspended_connections_head,
-              daemon->suspended_connections_tail,
-              connection);
-  if (connection->connection_timeout == daemon->connection_timeout)
-    XDLL_remove (daemon->normal_timeout_head,
-                 daemon->normal_timeout_tail,
-                 connection);
-  else
-    XDLL_remove (daemon->manual_timeout_head,
-                 daemon->manual_timeout_tail,
-                 connection);
-#if EPOLL_SUPPORT
-  if (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY))
+  p->events = 0;
+  switch (connection->event_loop_info)
     {
-      if (0 != (connection->epoll_state & MHD_EPOLL_STATE_IN_EREADY_EDLL))
-        {
-          EDLL_remove (daemon->eready_head,
-                       daemon->eready_tail,
-                       connection);
-          connection->epoll_state &= ~MHD_EPOLL_STATE_IN_EREADY_EDLL;
-        }
-      if (0 != (connection->epoll_state & MHD_EPOLL_STATE_IN_EPOLL_SET))
-        {
-          if (0 != epoll_ctl (daemon->epoll_fd,
-                              EPOLL_CTL_DEL,
-                              connection->socket_fd,
-                              NULL))
-            MHD_PANIC ("Failed to remove FD from epoll set\n");
-          connection->epoll_state &= ~MHD_EPOLL_STATE_IN_EPOLL_SET;
-        }
-      connection->epoll_state |= MHD_EPOLL_STATE_SUSPENDED;
+    case MHD_EVENT_LOOP_INFO_READ:
+      p->events |= POLLIN;
+      break;
+    case MHD_EVENT_LOOP_INFO_WRITE:
+      p->events |= POLLOUT;
+      if (connection->read_buffer_size > connection->read_buffer_offset)
+        p->events |= POLLIN;
+      break;
+    case MHD_EVENT_LOOP_INFO_BLOCK:
+      if (connection->read_buffer_size > connection->read_buffer_offset)
+        p->events |= POLLIN;
+      break;
+    case MHD_EVENT_LOOP_INFO_THROTTLED:
+      break;
+    case MHD_EVENT_LOOP_INFO_CLEANUP:
+      daemon->poll_cleanup = MHD_YES; /* clean up immediately */
+      break;
     }
-#endif
-  connection->suspended = MHD_YES;
-  if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
-       (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex)) )
-    MHD_PANIC ("Failed to release cleanup mutex\n");
 }
 
 
 /**
- * Resume handling of network data for suspended connection.  It is
- * safe to resume a suspended connection at any time.  Calling this function
- * on a connection that was not previously suspended will result
- * in undefined behavior.
+ * Add @a connection to the poll set of its daemon, if the daemon
+ * uses one.  The caller must have made room for it with
+ * poll_set_reserve().
  *
- * @param connection the connection to resume
+ * @param connection connection to add
  */
-void
-MHD_resume_connection (struct MHD_Connection *connection)
+static void
+poll_set_insert (struct MHD_Connection *connection)
 {
-  struct MHD_Daemon *daemon;
+  struct MHD_Daemon *daemon = connection->daemon;
+  unsigned int slot;
 
-  daemon = connection->daemon;
-  if (MHD_USE_SUSPEND_RESUME != (daemon->options & MHD_USE_SUSPEND_RESUME))
-    MHD_PANIC ("Cannot resume connections without enabling MHD_USE_SUSPEND_RESUME!\n");
-  if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
-       (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex)) )
-    MHD_PANIC ("Failed to acquire cleanup mutex\n");
-  connection->resuming = MHD_YES;
-  daemon->resuming = MHD_YES;
-  if ( (MHD_INVALID_PIPE_ != daemon->wpipe[1]) &&
-       (1 != MHD_pipe_write_ (daemon->wpipe[1], "r", 1)) )
-    {
-#ifdef HAVE_MESSAGES
-      MHD_DLOG (daemon,
-                "failed to signal resume via pipe");
-#endif
-    }
-  if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
-       (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex)) )
-    MHD_PANIC ("Failed to release cleanup mutex\n");
+  if (! POLL_SET_USED (daemon))
+    return;
+  slot = daemon->poll_fds_used++;
+  daemon->poll_fds[slot].fd = connection->socket_fd;
+  daemon->poll_fds[slot].revents = 0;
+  daemon->poll_conns[slot] = connection;
+  connection->poll_slot = slot;
+  poll_set_events (connection);
 }
+#endif
 
 
+#ifdef MHD_POSIX_SOCKETS
 /**
- * Run through the suspended connections and move any that are no
- * longer suspended back to the active state.
+ * Make sure the fd sets of @a daemon (see #MHD_USE_LARGE_FD_SETS)
+ * cover socket @a fd.
  *
- * @param daemon daemon context
- * @return #MHD_YES if a connection was actually resumed
+ * @param daemon daemon to grow the fd sets of
+ * @param fd socket the fd sets must have room for
+ * @return #MHD_YES on success, #MHD_NO if we are out of memory
  */
 static int
-resume_suspended_connections (struct MHD_Daemon *daemon)
+fd_sets_reserve (struct MHD_Daemon *daemon,
+                 MHD_socket fd)
 {
-  struct MHD_Connection *pos;
-  struct MHD_Connection *next = NULL;
-  int ret;
-
-  ret = MHD_NO;
-  if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
-       (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex)) )
-    MHD_PANIC ("Failed to acquire cleanup mutex\n");
-  if (MHD_YES == daemon->resuming)
-    next = daemon->suspended_connections_head;
+  fd_set *sets;
+  unsigned int chunks;
 
-  while (NULL != (pos = next))
+  if ((unsigned int) fd / FD_SETSIZE < daemon->fd_sets_chunks)
+    return MHD_YES;
+  chunks = (0 == daemon->fd_sets_chunks) ? 1 : daemon->fd_sets_chunks;
+  while ((unsigned int) fd / FD_SETSIZE >= chunks)
+    chunks *= 2;
+  sets = malloc (4 * chunks * sizeof (fd_set));
+  if (NULL == sets)
+    return MHD_NO;
+  memset (sets, 0, 4 * chunks * sizeof (fd_set));
+  if (NULL != daemon->fd_sets)
     {
-      next = pos->next;
-      if (MHD_NO == pos->resuming)
-        continue;
-      ret = MHD_YES;
-      DLL_remove (daemon->suspended_connections_head,
-                  daemon->suspended_connections_tail,
-                  pos);
-      DLL_insert (daemon->connections_head,
-                  daemon->connections_tail,
-                  pos);
-      if (pos->connection_timeout == daemon->connection_timeout)
-        XDLL_insert (daemon->normal_timeout_head,
-                     daemon->normal_timeout_tail,
-                     pos);
-      else
-        XDLL_insert (daemon->manual_timeout_head,
-                     daemon->manual_timeout_tail,
-                     pos);
-#if EPOLL_SUPPORT
-      if (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY))
-        {
-          if (0 != (pos->epoll_state & MHD_EPOLL_STATE_IN_EREADY_EDLL))
-            MHD_PANIC ("Resumed connection was already in EREADY set\n");
-          /* we always mark resumed connections as ready, as we
-             might have missed the edge poll event during suspension */
-          EDLL_insert (daemon->eready_head,
-                       daemon->eready_tail,
-                       pos);
-          pos->epoll_state |= MHD_EPOLL_STATE_IN_EREADY_EDLL;
-          pos->epoll_state &= ~MHD_EPOLL_STATE_SUSPENDED;
-        }
-#endif
-      pos->suspended = MHD_NO;
-      pos->resuming = MHD_NO;
+      memcpy (sets,
+              daemon->fd_sets,
+              daemon->fd_sets_chunks * sizeof (fd_set));
+      memcpy (&sets[chunks],
+              &daemon->fd_sets[daemon->fd_sets_chunks],
+              daemon->fd_sets_chunks * sizeof (fd_set));
+      free (daemon->fd_sets);
     }
-  daemon->resuming = MHD_NO;
-  if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
-       (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex)) )
-    MHD_PANIC ("Failed to release cleanup mutex\n");
-  return ret;
+  daemon->fd_sets = sets;
+  daemon->fd_sets_chunks = chunks;
+  return MHD_YES;
 }
 
 
 /**
- * Change socket options to be non-blocking, non-inheritable.
+ * Set the bits of the socket of @a connection in the fd sets of its
+ * daemon according to its 'event_loop_info', or clear them if
+ * @a keep is #MHD_NO, and keep @e fd_sets_max up to date.
  *
- * @param daemon daemon context
- * @param sock socket to manipulate
+ * @param connection connection in the fd sets
+ * @param keep #MHD_NO if the connection leaves the fd sets
  */
 static void
-make_nonblocking_noninheritable (struct MHD_Daemon *daemon,
-				 MHD_socket sock)
+fd_sets_events (struct MHD_Connection *connection,
+                int keep)
 {
-#ifdef MHD_WINSOCK_SOCKETS
-  DWORD dwFlags;
-  unsigned long flags = 1;
-
-  if (0 != ioctlsocket (sock, FIONBIO, &flags))
+  struct MHD_Daemon *daemon = connection->daemon;
+  fd_set *rs = daemon->fd_sets;
+  fd_set *ws = &daemon->fd_sets[daemon->fd_sets_chunks];
+  MHD_socket fd = connection->socket_fd;
+  int want_read;
+  int want_write;
+
+  want_read = MHD_NO;
+  want_write = MHD_NO;
+  if (MHD_YES == keep)
     {
-#ifdef HAVE_MESSAGES
-      MHD_DLOG (daemon,
-		"Failed to make socket non-blocking: %s\n",
-		MHD_socket_last_strerr_ ());
-#endif
+      switch (connection->event_loop_info)
+        {
+        case MHD_EVENT_LOOP_INFO_READ:
+          want_read = MHD_YES;
+          break;
+        case MHD_EVENT_LOOP_INFO_WRITE:
+          want_write = MHD_YES;
+          /* fall through */
+        case MHD_EVENT_LOOP_INFO_BLOCK:
+          if (connection->read_buffer_size > connection->read_buffer_offset)
+            want_read = MHD_YES;
+          break;
+        case MHD_EVENT_LOOP_INFO_THROTTLED:
+        case MHD_EVENT_LOOP_INFO_CLEANUP:
+          break;
+        }
     }
-  if (!GetHandleInformation ((HANDLE) sock, &dwFlags) ||
-      ((dwFlags != (dwFlags & ~HANDLE_FLAG_INHERIT)) &&
-       !SetHandleInformation ((HANDLE) sock, HANDLE_FLAG_INHERIT, 0)))
+  if (MHD_YES == want_read)
+    MHD_FD_SET_LARGE_ (fd, rs);
+  else
+    MHD_FD_CLR_LARGE_ (fd, rs);
+  if (MHD_YES == want_write)
+    MHD_FD_SET_LARGE_ (fd, ws);
+  else
+    MHD_FD_CLR_LARGE_ (fd, ws);
+  if ( (MHD_YES == want_read) ||
+       (MHD_YES == want_write) )
     {
-#ifdef HAVE_MESSAGES
-      MHD_DLOG (daemon,
-		"Failed to make socket non-inheritable: %u\n",
-		(unsigned int) GetLastError ());
-#endif
+      if ( (MHD_INVALID_SOCKET == daemon->fd_sets_max) ||
+           (fd > daemon->fd_sets_max) )
+        daemon->fd_sets_max = fd;
+      return;
     }
-#else
-  int flags;
-  int nonblock;
-
-  nonblock = O_NONBLOCK;
-#ifdef CYGWIN
-  if (0 == (daemon->options & MHD_USE_SSL))
-    nonblock = 0;
-#endif
-  flags = fcntl (sock, F_GETFD);
-  if ( ( (-1 == flags) ||
-	 ( (flags != (flags | FD_CLOEXEC)) &&
-	   (0 != fcntl (sock, F_SETFD, flags | nonblock | FD_CLOEXEC)) ) ) )
+  if (fd != daemon->fd_sets_max)
+    return;
+  /* the highest socket left, look for the next one */
+  while (fd > 0)
     {
-#ifdef HAVE_MESSAGES
-      MHD_DLOG (daemon,
-		"Failed to make socket non-inheritable: %s\n",
-		MHD_socket_last_strerr_ ());
-#endif
+      fd--;
+      if ( (MHD_FD_ISSET_LARGE_ (fd, rs)) ||
+           (MHD_FD_ISSET_LARGE_ (fd, ws)) )
+        {
+          daemon->fd_sets_max = fd;
+          return;
+        }
     }
-#endif
+  daemon->fd_sets_max = MHD_INVALID_SOCKET;
 }
 
 
 /**
- * Add another client connection to the set of connections managed by
- * MHD.  This API is usually not needed (since MHD will accept inbound
- * connections on the server socket).  Use this API in special cases,
- * for example if your HTTP server is behind NAT and needs to connect
- * out to the HTTP client, or if you are building a proxy.
- *
- * If you use this API in conjunction with a internal select or a
- * thread pool, you must set the option
- * #MHD_USE_PIPE_FOR_SHUTDOWN to ensure that the freshly added
- * connection is immediately processed by MHD.
+ * Add @a connection to the fd sets of its daemon, if the daemon uses
+ * #MHD_USE_LARGE_FD_SETS.  The caller must have made room for it
+ * with fd_sets_reserve().
  *
- * The given client socket will be managed (and closed!) by MHD after
- * this call and must no longer be used directly by the application
- * afterwards.
- *
- * Per-IP connection limits are ignored when using this API.
- *
- * @param daemon daemon that manages the connection
- * @param client_socket socket to manage (MHD will expect
- *        to receive an HTTP request from this socket next).
- * @param addr IP address of the client
- * @param addrlen number of bytes in @a addr
- * @return #MHD_YES on success, #MHD_NO if this daemon could
- *        not handle the connection (i.e. malloc() failed, etc).
- *        The socket will be closed in any case; `errno` is
- *        set to indicate further details about the error.
- * @ingroup specialized
+ * @param connection connection to add
  */
-int
-MHD_add_connection (struct MHD_Daemon *daemon,
-		    MHD_socket client_socket,
-		    const struct sockaddr *addr,
-		    socklen_t addrlen)
+static void
+fd_sets_insert (struct MHD_Connection *connection)
 {
-  make_nonblocking_noninheritable (daemon,
-				   client_socket);
-  return internal_add_connection (daemon,
-				  client_socket,
-				  addr, addrlen,
-				  MHD_YES);
+  if (0 == (connection->daemon->options & MHD_USE_LARGE_FD_SETS))
+    return;
+  connection->in_fd_sets = MHD_YES;
+  fd_sets_events (connection,
+                  MHD_YES);
 }
+#endif
 
 
 /**
- * Accept an incoming connection and create the MHD_Connection object for
- * it.  This function also enforces policy by way of checking with the
- * accept policy callback.
+ * Update the events of the entry of @a connection in the poll set
+ * (or the fd sets of #MHD_USE_LARGE_FD_SETS) of its daemon after its
+ * 'event_loop_info' changed.  Does nothing if the connection is in
+ * neither.
  *
- * @param daemon handle with the listen socket
- * @return #MHD_YES on success (connections denied by policy or due
- *         to 'out of memory' and similar errors) are still considered
- *         successful as far as #MHD_accept_connection() is concerned);
- *         a return code of #MHD_NO only refers to the actual
- *         accept() system call.
+ * @param connection the connection to update
  */
-static int
-MHD_accept_connection (struct MHD_Daemon *daemon)
+void
+MHD_poll_set_update_ (struct MHD_Connection *connection)
 {
-#if HAVE_INET6
-  struct sockaddr_in6 addrstorage;
-#else
-  struct sockaddr_in addrstorage;
-#endif
-  struct sockaddr *addr = (struct sockaddr *) &addrstorage;
-  socklen_t addrlen;
-  MHD_socket s;
-  MHD_socket fd;
-  int nonblock;
-
-  addrlen = sizeof (addrstorage);
-  memset (addr, 0, sizeof (addrstorage));
-  if (MHD_INVALID_SOCKET == (fd = daemon->socket_fd))
-    return MHD_NO;
-#ifdef HAVE_SOCK_NONBLOCK
-  nonblock = SOCK_NONBLOCK;
-#else
-  nonblock = 0;
-#endif
-#ifdef CYGWIN
-  if (0 == (daemon->options & MHD_USE_SSL))
-    nonblock = 0;
-#endif
-#if HAVE_ACCEPT4
-  s = accept4 (fd, addr, &addrlen, SOCK_CLOEXEC | nonblock);
-#else
-  s = accept (fd, addr, &addrlen);
-#endif
-  if ((MHD_INVALID_SOCKET == s) || (addrlen <= 0))
-    {
-#ifdef HAVE_MESSAGES
-      const int err = MHD_socket_errno_;
-      /* This could be a common occurance with multiple worker threads */
-      if ( (EINVAL == err) &&
-           (MHD_INVALID_SOCKET == daemon->socket_fd) )
-        return MHD_NO; /* can happen during shutdown */
-      if ((EAGAIN != err) && (EWOULDBLOCK != err))
-        MHD_DLOG (daemon,
-		  "Error accepting connection: %s\n",
-		  MHD_socket_last_strerr_ ());
-#endif
-      if (MHD_INVALID_SOCKET != s)
-        {
-          if (0 != MHD_socket_close_ (s))
-	    MHD_PANIC ("close failed\n");
-          /* just in case */
-        }
-      return MHD_NO;
-    }
-#if !defined(HAVE_ACCEPT4) || HAVE_ACCEPT4+0 == 0 || !defined(HAVE_SOCK_NONBLOCK) || SOCK_CLOEXEC+0 == 0
-  make_nonblocking_noninheritable (daemon, s);
-#endif
-#ifdef HAVE_MESSAGES
-#if DEBUG_CONNECT
-  MHD_DLOG (daemon,
-            "Accepted connection on socket %d\n",
-            s);
+#ifdef HAVE_POLL
+  if (0 != connection->poll_slot)
+    poll_set_events (connection);
 #endif
+#ifdef MHD_POSIX_SOCKETS
+  if (MHD_YES == connection->in_fd_sets)
+    fd_sets_events (connection,
+                    MHD_YES);
 #endif
-  (void) internal_add_connection (daemon, s,
-				  addr, addrlen,
-				  MHD_NO);
-  return MHD_YES;
 }
 
 
 /**
- * Free resources associated with all closed connections.
- * (destroy responses, free buffers, etc.).  All closed
- * connections are kept in the "cleanup" doubly-linked list.
+ * Remove @a connection from the poll set (or the fd sets of
+ * #MHD_USE_LARGE_FD_SETS) of its daemon, if it is in one.  Must be
+ * called from the thread running the event loop.
  *
- * @param daemon daemon to clean up
+ * @param connection the connection to remove
  */
-static void
-MHD_cleanup_connections (struct MHD_Daemon *daemon)
+void
+MHD_poll_set_remove_ (struct MHD_Connection *connection)
 {
-  struct MHD_Connection *pos;
+#ifdef HAVE_POLL
+  struct MHD_Daemon *daemon = connection->daemon;
+  unsigned int slot = connection->poll_slot;
+  unsigned int last;
+#endif
 
-  if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
-       (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex)) )
-    MHD_PANIC ("Failed to acquire cleanup mutex\n");
-  while (NULL != (pos = daemon->cleanup_head))
+#ifdef MHD_POSIX_SOCKETS
+  if (MHD_YES == connection->in_fd_sets)
     {
-      DLL_remove (daemon->cleanup_head,
-		  daemon->cleanup_tail,
-		  pos);
-      if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
-	   (MHD_NO == pos->thread_joined) )
-	{
-	  if (0 != MHD_join_thread_ (pos->pid))
-	    {
-	      MHD_PANIC ("Failed to join a thread\n");
-	    }
-	}
-      MHD_pool_destroy (pos->pool);
-#if HTTPS_SUPPORT
-      if (NULL != pos->tls_session)
-	gnutls_deinit (pos->tls_session);
-#endif
-      daemon->connections--;
-      if (NULL != daemon->notify_connection)
-        daemon->notify_connection (daemon->notify_connection_cls,
-                                   pos,
-                                   &pos->socket_context,
-                                   MHD_CONNECTION_NOTIFY_CLOSED);
-      MHD_ip_limit_del (daemon, pos->addr, pos->addr_len);
-#if EPOLL_SUPPORT
-      if (0 != (pos->epoll_state & MHD_EPOLL_STATE_IN_EREADY_EDLL))
-	{
-	  EDLL_remove (daemon->eready_head,
-		       daemon->eready_tail,
-		       pos);
-	  pos->epoll_state &= ~MHD_EPOLL_STATE_IN_EREADY_EDLL;
-	}
-      if ( (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY)) &&
-	   (MHD_INVALID_SOCKET != daemon->epoll_fd) &&
-	   (0 != (pos->epoll_state & MHD_EPOLL_STATE_IN_EPOLL_SET)) )
-	{
-	  /* epoll documentation suggests that closing a FD
-	     automatically removes it from the epoll set; however,
-	     this is not true as if we fail to do manually remove it,
-	     we are still seeing an event for this fd in epoll,
-	     causing grief (use-after-free...) --- at least on my
-	     system. */
-	  if (0 != epoll_ctl (daemon->epoll_fd,
-			      EPOLL_CTL_DEL,
-			      pos->socket_fd,
-			      NULL))
-	    MHD_PANIC ("Failed to remove FD from epoll set\n");
-	  pos->epoll_state &= ~MHD_EPOLL_STATE_IN_EPOLL_SET;
-	}
-#endif
-      if (NULL != pos->response)
-	{
-	  MHD_destroy_response (pos->response);
-	  pos->response = NULL;
-	}
-      if (MHD_INVALID_SOCKET != pos->socket_fd)
-	{
-#ifdef WINDOWS
-	  shutdown (pos->socket_fd, SHUT_WR);
+      fd_sets_events (connection,
+                      MHD_NO);
+      connection->in_fd_sets = MHD_NO;
+    }
 #endif
-	  if (0 != MHD_socket_close_ (pos->socket_fd))
-	    MHD_PANIC ("close failed\n");
-	}
-      if (NULL != pos->addr)
-	free (pos->addr);
-      free (pos);
+#ifdef HAVE_POLL
+  if (0 == slot)
+    return;
+  last = --daemon->poll_fds_used;
+  if (slot != last)
+    {
+      /* also moves the 'revents' of the last entry, so this may be
+         called while dispatching the results of poll() */
+      daemon->poll_fds[slot] = daemon->poll_fds[last];
+      daemon->poll_conns[slot] = daemon->poll_conns[last];
+      daemon->poll_conns[slot]->poll_slot = slot;
     }
-  if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
-       (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex)) )
-    MHD_PANIC ("Failed to release cleanup mutex\n");
+  connection->poll_slot = 0;
+#endif
 }
 
 
 /**
- * Obtain timeout value for `select()` for this daemon (only needed if
- * connection timeout is used).  The returned value is how long
- * `select()` or `poll()` should at most block, not the timeout value set
- * for connections.  This function MUST NOT be called if MHD is
- * running with #MHD_USE_THREAD_PER_CONNECTION.
+ * Tell the #MHD_NotifySocketCallback of the daemon of @a connection
+ * (if any) about the events to wait for on its socket after its
+ * 'event_loop_info' changed or it was suspended.  Does nothing if
+ * the events did not change.
  *
- * @param daemon daemon to query for timeout
- * @param timeout set to the timeout (in milliseconds)
- * @return #MHD_YES on success, #MHD_NO if timeouts are
- *        not used (or no connections exist that would
- *        necessiate the use of a timeout right now).
- * @ingroup event
+ * @param connection the connection to update
  */
-int
-MHD_get_timeout (struct MHD_Daemon *daemon,
-		 MHD_UNSIGNED_LONG_LONG *timeout)
+void
+MHD_socket_interest_update_ (struct MHD_Connection *connection)
 {
-  time_t earliest_deadline;
-  time_t now;
-  struct MHD_Connection *pos;
-  int have_timeout;
+  struct MHD_Daemon *daemon = connection->daemon;
+  unsigned int interest;
 
-  if (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
-    {
-#ifdef HAVE_MESSAGES
-      MHD_DLOG (daemon,
-                "Illegal call to MHD_get_timeout\n");
-#endif
-      return MHD_NO;
-    }
+  if ( (NULL == daemon->notify_socket) ||
+       (MHD_INVALID_SOCKET == connection->socket_fd) )
+    return;
+  interest = MHD_SOCKET_INTEREST_NONE;
+  if (MHD_NO == connection->suspended)
+    switch (connection->event_loop_info)
+      {
+      case MHD_EVENT_LOOP_INFO_READ:
+        interest = MHD_SOCKET_INTEREST_READ;
+        break;
+      case MHD_EVENT_LOOP_INFO_WRITE:
+        interest = MHD_SOCKET_INTEREST_WRITE;
+        if (connection->read_buffer_size > connection->read_buffer_offset)
+          interest |= MHD_SOCKET_INTEREST_READ;
+        break;
+      case MHD_EVENT_LOOP_INFO_BLOCK:
+        if (connection->read_buffer_size > connection->read_buffer_offset)
+          interest = MHD_SOCKET_INTEREST_READ;
+        break;
+      case MHD_EVENT_LOOP_INFO_THROTTLED:
+        break; /* not watched until the rate limit allows more data */
+      case MHD_EVENT_LOOP_INFO_CLEANUP:
+        return; /* removed by MHD_cleanup_connections() right after */
+      }
+  if (interest == connection->socket_interest)
+    return;
+  connection->socket_interest = interest;
+  daemon->notify_socket (daemon->notify_socket_cls,
+                         connection->socket_fd,
+                         interest,
+                         connection,
+                         &connection->socket_interest_cls);
+}
 
-#if HTTPS_SUPPORT
-  if (0 != daemon->num_tls_read_ready)
-    {
-      /* if there is any TLS connection with data ready for
-	 reading, we must not block in the event loop */
-      *timeout = 0;
-      return MHD_YES;
-    }
-#endif
 
-  have_timeout = MHD_NO;
-  earliest_deadline = 0; /* avoid compiler warnings */
-  for (pos = daemon->manual_timeout_head; NULL != pos; pos = pos->nextX)
-    {
-      if (0 != pos->connection_timeout)
-	{
-	  if ( (! have_timeout) ||
-	       (earliest_deadline > pos->last_activity + pos->connection_timeout) )
-	    earliest_deadline = pos->last_activity + pos->connection_timeout;
-#if HTTPS_SUPPORT
-	  if (  (0 != (daemon->options & MHD_USE_SSL)) &&
-		(0 != gnutls_record_check_pending (pos->tls_session)) )
-	    earliest_deadline = 0;
-#endif
-	  have_timeout = MHD_YES;
-	}
-    }
-  /* normal timeouts are sorted, so we only need to look at the 'head' */
-  pos = daemon->normal_timeout_head;
-  if ( (NULL != pos) &&
-       (0 != pos->connection_timeout) )
-    {
-      if ( (! have_timeout) ||
-	   (earliest_deadline > pos->last_activity + pos->connection_timeout) )
-	earliest_deadline = pos->last_activity + pos->connection_timeout;
-#if HTTPS_SUPPORT
-      if (  (0 != (daemon->options & MHD_USE_SSL)) &&
-	    (0 != gnutls_record_check_pending (pos->tls_session)) )
-	earliest_deadline = 0;
-#endif
-      have_timeout = MHD_YES;
-    }
+/**
+ * Tell the #MHD_NotifySocketCallback of the daemon of @a connection
+ * (if any) that its socket is about to be closed.
+ *
+ * @param connection the connection to remove
+ */
+static void
+socket_interest_remove (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
 
-  if (MHD_NO == have_timeout)
-    return MHD_NO;
-  now = MHD_monotonic_sec_counter();
-  if (earliest_deadline < now)
-    *timeout = 0;
-  else
-    {
-      const time_t second_left = earliest_deadline - now;
-      if (second_left > ULLONG_MAX / 1000)
-        *timeout = ULLONG_MAX;
-      else
-        *timeout = 1000 * second_left;
-  }
-  return MHD_YES;
+  if ( (NULL == daemon->notify_socket) ||
+       (MHD_SOCKET_INTEREST_REMOVE == connection->socket_interest) )
+    return;
+  connection->socket_interest = MHD_SOCKET_INTEREST_REMOVE;
+  daemon->notify_socket (daemon->notify_socket_cls,
+                         connection->socket_fd,
+                         MHD_SOCKET_INTEREST_REMOVE,
+                         connection,
+                         &connection->socket_interest_cls);
 }
 
 
 /**
- * Run webserver operations. This method should be called by clients
- * in combination with #MHD_get_fdset if the client-controlled select
- * method is used.
+ * Tell the #MHD_NotifySocketCallback of @a daemon (if any) about
+ * its listen socket and the read end of its wakeup pipe.
  *
- * You can use this function instead of #MHD_run if you called
- * `select()` on the result from #MHD_get_fdset.  File descriptors in
- * the sets that are not controlled by MHD will be ignored.  Calling
- * this function instead of #MHD_run is more efficient as MHD will
- * not have to call `select()` again to determine which operations are
- * ready.
- *
- * @param daemon daemon to run select loop for
- * @param read_fd_set read set
- * @param write_fd_set write set
- * @param except_fd_set except set (not used, can be NULL)
- * @return #MHD_NO on serious errors, #MHD_YES on success
- * @ingroup event
+ * @param daemon daemon to report the sockets of
+ * @param interest #MHD_SOCKET_INTEREST_READ when starting,
+ *        #MHD_SOCKET_INTEREST_REMOVE when stopping
  */
-int
-MHD_run_from_select (struct MHD_Daemon *daemon,
-		     const fd_set *read_fd_set,
-		     const fd_set *write_fd_set,
-		     const fd_set *except_fd_set)
+static void
+daemon_socket_interest (struct MHD_Daemon *daemon,
+                        unsigned int interest)
 {
-  MHD_socket ds;
-  char tmp;
-  struct MHD_Connection *pos;
-  struct MHD_Connection *next;
-  unsigned int mask = MHD_USE_SUSPEND_RESUME | MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY |
-    MHD_USE_SELECT_INTERNALLY | MHD_USE_POLL_INTERNALLY | MHD_USE_THREAD_PER_CONNECTION;
+  if (NULL == daemon->notify_socket)
+    return;
+  if (MHD_INVALID_SOCKET != daemon->socket_fd)
+    daemon->notify_socket (daemon->notify_socket_cls,
+                           daemon->socket_fd,
+                           interest,
+                           &daemon->socket_fd,
+                           &daemon->listen_socket_interest_cls);
+  if (MHD_INVALID_PIPE_ != daemon->wpipe[0])
+    daemon->notify_socket (daemon->notify_socket_cls,
+                           (MHD_socket) daemon->wpipe[0],
+                           interest,
+                           &daemon->wpipe[0],
+                           &daemon->wpipe_socket_interest_cls);
+}
 
-  /* Resuming external connections when using an extern mainloop  */
-  if (MHD_USE_SUSPEND_RESUME == (daemon->options & mask))
-    resume_suspended_connections (daemon);
 
-#if EPOLL_SUPPORT
-  if (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY))
-    {
-      /* we're in epoll mode, the epoll FD stands for
-	 the entire event set! */
-      if (daemon->epoll_fd >= FD_SETSIZE)
-	return MHD_NO; /* poll fd too big, fail hard */
-      if (FD_ISSET (daemon->epoll_fd, read_fd_set))
-	return MHD_run (daemon);
-      return MHD_YES;
-    }
-#endif
+/**
+ * Free the poll set (and the fd sets) of @a daemon.
+ *
+ * @param daemon daemon to free the poll set of
+ */
+static void
+free_poll_set (struct MHD_Daemon *daemon)
+{
+#ifdef HAVE_POLL
+  free (daemon->poll_fds);
+  daemon->poll_fds = NULL;
+  free (daemon->poll_conns);
+  daemon->poll_conns = NULL;
+  daemon->poll_fds_used = 0;
+  daemon->poll_fds_size = 0;
+#endif
+  free (daemon->fd_sets);
+  daemon->fd_sets = NULL;
+  daemon->fd_sets_chunks = 0;
+  daemon->fd_sets_max = MHD_INVALID_SOCKET;
+}
 
-  /* select connection thread handling type */
-  if ( (MHD_INVALID_SOCKET != (ds = daemon->socket_fd)) &&
-       (FD_ISSET (ds, read_fd_set)) )
-    (void) MHD_accept_connection (daemon);
-  /* drain signaling pipe to avoid spinning select */
-  if ( (MHD_INVALID_PIPE_ != daemon->wpipe[0]) &&
-       (FD_ISSET (daemon->wpipe[0], read_fd_set)) )
-    (void) MHD_pipe_read_ (daemon->wpipe[0], &tmp, sizeof (tmp));
 
-  if (0 == (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
+/**
+ * Wake up the workers of the thread pool of @a daemon that stopped
+ * accepting because they were above their fair share (see
+ * above_fair_share()): a connection added to @a daemon raises the
+ * average, so they are to check their share again.
+ *
+ * @param daemon worker that added a connection
+ */
+static void
+wake_paused_workers (struct MHD_Daemon *daemon)
+{
+  struct MHD_Daemon *master = daemon->master;
+  struct MHD_Daemon *worker;
+  unsigned int i;
+
+  if ( (NULL == master) ||
+       (0 == daemon->accept_fair_share) )
+    return;
+  for (i = 0; i < master->worker_pool_size; i++)
     {
-      /* do not have a thread per connection, process all connections now */
-      next = daemon->connections_head;
-      while (NULL != (pos = next))
-        {
-	  next = pos->next;
-          ds = pos->socket_fd;
-          if (MHD_INVALID_SOCKET == ds)
-	    continue;
-	  switch (pos->event_loop_info)
-	    {
-	    case MHD_EVENT_LOOP_INFO_READ:
-	      if ( (FD_ISSET (ds, read_fd_set))
-#if HTTPS_SUPPORT
-		   || (MHD_YES == pos->tls_read_ready)
+      worker = &master->worker_pool[i];
+#ifdef HAVE_ATOMIC_BUILTINS
+      if (MHD_YES != __atomic_exchange_n (&worker->accept_paused,
+                                          MHD_NO,
+                                          __ATOMIC_ACQ_REL))
+        continue;
+#else
+      if (MHD_YES != worker->accept_paused)
+        continue;
+      worker->accept_paused = MHD_NO;
 #endif
-		   )
-		pos->read_handler (pos);
-	      break;
-	    case MHD_EVENT_LOOP_INFO_WRITE:
-	      if ( (FD_ISSET (ds, read_fd_set)) &&
-		   (pos->read_buffer_size > pos->read_buffer_offset) )
-		pos->read_handler (pos);
-	      if (FD_ISSET (ds, write_fd_set))
-		pos->write_handler (pos);
-	      break;
-	    case MHD_EVENT_LOOP_INFO_BLOCK:
-	      if ( (FD_ISSET (ds, read_fd_set)) &&
-		   (pos->read_buffer_size > pos->read_buffer_offset) )
-		pos->read_handler (pos);
-	      break;
-	    case MHD_EVENT_LOOP_INFO_CLEANUP:
-	      /* should never happen */
-	      break;
-	    }
-	  pos->idle_handler (pos);
-        }
+      (void) MHD_daemon_wakeup_ (worker);
     }
-  MHD_cleanup_connections (daemon);
-  return MHD_YES;
 }
 
 
 /**
- * Main internal select() call.  Will compute select sets, call select()
- * and then #MHD_run_from_select with the result.
+ * Insert a new connection into the connection lists and the event
+ * loop of @a daemon.  Must be called by the thread running the event
+ * loop (or by the application driving it).
  *
- * @param daemon daemon to run select() loop for
- * @param may_block #MHD_YES if blocking, #MHD_NO if non-blocking
- * @return #MHD_NO on serious errors, #MHD_YES on success
+ * @param daemon daemon that manages the connection
+ * @param connection the new connection
+ * @param external_add #MHD_YES if the application added the
+ *        connection (see #MHD_add_connection())
+ * @return #MHD_YES on success, #MHD_NO if this daemon could not
+ *        handle the connection; it was closed and freed in that
+ *        case and 'errno' is set to indicate further details
  */
 static int
-MHD_select (struct MHD_Daemon *daemon,
-	    int may_block)
+insert_connection (struct MHD_Daemon *daemon,
+                   struct MHD_Connection *connection,
+                   int external_add)
 {
-  int num_ready;
-  fd_set rs;
-  fd_set ws;
-  fd_set es;
-  MHD_socket maxsock;
-  struct timeval timeout;
-  struct timeval *tv;
-  MHD_UNSIGNED_LONG_LONG ltimeout;
-  int err_state;
+  int res_thread_create;
+  int eno;
 
-  timeout.tv_sec = 0;
-  timeout.tv_usec = 0;
-  if (MHD_YES == daemon->shutdown)
-    return MHD_NO;
-  FD_ZERO (&rs);
-  FD_ZERO (&ws);
-  FD_ZERO (&es);
-  maxsock = MHD_INVALID_SOCKET;
-  err_state = MHD_NO;
-  if (0 == (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
-    {
-      if ( (MHD_USE_SUSPEND_RESUME == (daemon->options & MHD_USE_SUSPEND_RESUME)) &&
-           (MHD_YES == resume_suspended_connections (daemon)) )
-        may_block = MHD_NO;
+  if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
+       (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex)) )
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  MHD_connection_timeout_insert_ (connection);
+  DLL_insert (daemon->connections_head,
+	      daemon->connections_tail,
+	      connection);
+  if  ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
+	(MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex)) )
+    MHD_PANIC ("Failed to release cleanup mutex\n");
 
-      /* single-threaded, go over everything */
-      if (MHD_NO == MHD_get_fdset2 (daemon, &rs, &ws, &es, &maxsock, FD_SETSIZE))
-        {
+  /* a connection handed over by another worker was started there */
+  if ( (NULL != daemon->notify_connection) &&
+       (MHD_NO == connection->migrating) )
+    daemon->notify_connection (daemon->notify_connection_cls,
+                               connection,
+                               &connection->socket_context,
+                               MHD_CONNECTION_NOTIFY_STARTED);
+  connection->migrating = MHD_NO;
+
+#ifdef HAVE_POLL
+  /* make room for all connections, also the suspended ones, so that
+     resuming a connection never needs to grow the poll set */
+  if ( (POLL_SET_USED (daemon)) &&
+       (MHD_YES != poll_set_reserve (daemon,
+                                     daemon->connections + 1)) )
+    {
+      eno = ENOMEM;
 #ifdef HAVE_MESSAGES
-        MHD_DLOG (daemon, "Could not obtain daemon fdsets");
+      MHD_DLOG (daemon,
+                "Error allocating memory: %s\n",
+                MHD_strerror_ (eno));
 #endif
-          err_state = MHD_YES;
-        }
-
-      /* If we're at the connection limit, no need to
-         accept new connections; however, make sure
-         we do not miss the shutdown, so only do this
-         optimization if we have a shutdown signaling
-         pipe. */
-      if ( (MHD_INVALID_SOCKET != daemon->socket_fd) &&
-           (daemon->connections == daemon->connection_limit) &&
-           (0 != (daemon->options & MHD_USE_PIPE_FOR_SHUTDOWN)) )
-        FD_CLR (daemon->socket_fd, &rs);
+      goto cleanup;
     }
-  else
+  poll_set_insert (connection);
+#endif
+#ifdef MHD_POSIX_SOCKETS
+  if ( (0 != (daemon->options & MHD_USE_LARGE_FD_SETS)) &&
+       (MHD_YES != fd_sets_reserve (daemon,
+                                    connection->socket_fd)) )
     {
-      /* accept only, have one thread per connection */
-      if ( (MHD_INVALID_SOCKET != daemon->socket_fd) &&
-           (MHD_YES != add_to_fd_set (daemon->socket_fd,
-                                      &rs,
-                                      &maxsock,
-                                      FD_SETSIZE)) )
-        {
+      eno = ENOMEM;
 #ifdef HAVE_MESSAGES
-          MHD_DLOG (daemon, "Could not add listen socket to fdset");
+      MHD_DLOG (daemon,
+                "Error allocating memory: %s\n",
+                MHD_strerror_ (eno));
 #endif
-          return MHD_NO;
-        }
+      goto cleanup;
     }
-  if ( (MHD_INVALID_PIPE_ != daemon->wpipe[0]) &&
-       (MHD_YES != add_to_fd_set (daemon->wpipe[0],
-                                  &rs,
-                                  &maxsock,
-                                  FD_SETSIZE)) )
+  fd_sets_insert (connection);
+#endif
+
+  /* attempt to create handler thread */
+  if (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
     {
-#if defined(MHD_WINSOCK_SOCKETS)
-      /* fdset limit reached, new connections
-         cannot be handled. Remove listen socket FD
-         from fdset and retry to add pipe FD. */
-      if (MHD_INVALID_SOCKET != daemon->socket_fd)
+      res_thread_create = start_connection_thread (daemon,
+                                                   connection);
+      if (0 != res_thread_create)
         {
-          FD_CLR (daemon->socket_fd, &rs);
-          if (MHD_YES != add_to_fd_set (daemon->wpipe[0],
-                                        &rs,
-                                        &maxsock,
-                                        FD_SETSIZE))
-            {
-#endif /* MHD_WINSOCK_SOCKETS */
+	  eno = errno;
 #ifdef HAVE_MESSAGES
-              MHD_DLOG (daemon,
-                        "Could not add control pipe FD to fdset");
+          MHD_DLOG (daemon,
+                    "Failed to create a thread: %s\n",
+                    MHD_strerror_ (res_thread_create));
 #endif
-              err_state = MHD_YES;
-#if defined(MHD_WINSOCK_SOCKETS)
-            }
+	  goto cleanup;
         }
-#endif /* MHD_WINSOCK_SOCKETS */
-    }
-
-  tv = NULL;
-  if (MHD_YES == err_state)
-    may_block = MHD_NO;
-  if (MHD_NO == may_block)
-    {
-      timeout.tv_usec = 0;
-      timeout.tv_sec = 0;
-      tv = &timeout;
-    }
-  else if ( (0 == (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
-	    (MHD_YES == MHD_get_timeout (daemon, &ltimeout)) )
-    {
-      /* ltimeout is in ms */
-      timeout.tv_usec = (ltimeout % 1000) * 1000;
-      if (ltimeout / 1000 > TIMEVAL_TV_SEC_MAX)
-        timeout.tv_sec = TIMEVAL_TV_SEC_MAX;
-      else
-        timeout.tv_sec = (_MHD_TIMEVAL_TV_SEC_TYPE)(ltimeout / 1000);
-      tv = &timeout;
     }
-  num_ready = MHD_SYS_select_ (maxsock + 1, &rs, &ws, &es, tv);
-  if (MHD_YES == daemon->shutdown)
-    return MHD_NO;
-  if (num_ready < 0)
+#if EPOLL_SUPPORT
+  if (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY))
     {
-      if (EINTR == MHD_socket_errno_)
-        return (MHD_NO == err_state) ? MHD_YES : MHD_NO;
+      if (0 == (daemon->options & MHD_USE_EPOLL_TURBO))
+	{
+	  struct epoll_event event;
+
+#if IO_URING_SUPPORT
+	  if (MHD_USE_IO_URING_LINUX_ONLY == (daemon->options & MHD_USE_IO_URING_LINUX_ONLY))
+	    {
+	      if (MHD_YES != MHD_io_uring_poll_add_ (&daemon->uring,
+						     connection->socket_fd,
+						     EPOLLIN | EPOLLOUT,
+						     (uint64_t) (uintptr_t) connection))
+		{
+		  eno = ENOBUFS;
 #ifdef HAVE_MESSAGES
-      MHD_DLOG (daemon,
-                "select failed: %s\n",
-                MHD_socket_last_strerr_ ());
+		  MHD_DLOG (daemon,
+			    "io_uring submission queue is full\n");
 #endif
-      return MHD_NO;
-    }
-  if (MHD_YES == MHD_run_from_select (daemon, &rs, &ws, &es))
-    return (MHD_NO == err_state) ? MHD_YES : MHD_NO;
-  return MHD_NO;
-}
-
-
-#ifdef HAVE_POLL
-/**
- * Process all of our connections and possibly the server
- * socket using poll().
- *
- * @param daemon daemon to run poll loop for
- * @param may_block #MHD_YES if blocking, #MHD_NO if non-blocking
- * @return #MHD_NO on serious errors, #MHD_YES on success
- */
-static int
-MHD_poll_all (struct MHD_Daemon *daemon,
-	      int may_block)
-{
-  unsigned int num_connections;
-  struct MHD_Connection *pos;
-  struct MHD_Connection *next;
-
-  if ( (MHD_USE_SUSPEND_RESUME == (daemon->options & MHD_USE_SUSPEND_RESUME)) &&
-       (MHD_YES == resume_suspended_connections (daemon)) )
-    may_block = MHD_NO;
-
-  /* count number of connections and thus determine poll set size */
-  num_connections = 0;
-  for (pos = daemon->connections_head; NULL != pos; pos = pos->next)
-    num_connections++;
-  {
-    MHD_UNSIGNED_LONG_LONG ltimeout;
-    unsigned int i;
-    int timeout;
-    unsigned int poll_server;
-    int poll_listen;
-    int poll_pipe;
-    char tmp;
-    struct pollfd *p;
-
-    p = malloc(sizeof (struct pollfd) * (2 + num_connections));
-    if (NULL == p)
-      {
+		  goto cleanup;
+		}
+	      connection->epoll_state |= MHD_EPOLL_STATE_IN_EPOLL_SET;
+	      daemon->connections++;
+	      wake_paused_workers (daemon);
+	      return MHD_YES;
+	    }
+#endif
+	  event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+	  event.data.ptr = connection;
+	  if (0 != epoll_ctl (daemon->epoll_fd,
+			      EPOLL_CTL_ADD,
+			      connection->socket_fd,
+			      &event))
+	    {
+	      eno = errno;
 #ifdef HAVE_MESSAGES
-        MHD_DLOG(daemon,
-                 "Error allocating memory: %s\n",
-                 MHD_strerror_(errno));
+              MHD_DLOG (daemon,
+                        "Call to epoll_ctl failed: %s\n",
+                        MHD_socket_last_strerr_ ());
 #endif
-        return MHD_NO;
-      }
-    memset (p, 0, sizeof (struct pollfd) * (2 + num_connections));
-    poll_server = 0;
-    poll_listen = -1;
-    if ( (MHD_INVALID_SOCKET != daemon->socket_fd) &&
-	 (daemon->connections < daemon->connection_limit) )
-      {
-	/* only listen if we are not at the connection limit */
-	p[poll_server].fd = daemon->socket_fd;
-	p[poll_server].events = POLLIN;
-	p[poll_server].revents = 0;
-	poll_listen = (int) poll_server;
-	poll_server++;
-      }
-    poll_pipe = -1;
-    if (MHD_INVALID_PIPE_ != daemon->wpipe[0])
-      {
-	p[poll_server].fd = daemon->wpipe[0];
-	p[poll_server].events = POLLIN;
-	p[poll_server].revents = 0;
-        poll_pipe = (int) poll_server;
-	poll_server++;
-      }
-    if (may_block == MHD_NO)
-      timeout = 0;
-    else if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) ||
-	      (MHD_YES != MHD_get_timeout (daemon, &ltimeout)) )
-      timeout = -1;
-    else
-      timeout = (ltimeout > INT_MAX) ? INT_MAX : (int) ltimeout;
-
-    i = 0;
-    for (pos = daemon->connections_head; NULL != pos; pos = pos->next)
-      {
-	p[poll_server+i].fd = pos->socket_fd;
-	switch (pos->event_loop_info)
-	  {
-	  case MHD_EVENT_LOOP_INFO_READ:
-	    p[poll_server+i].events |= POLLIN;
-	    break;
-	  case MHD_EVENT_LOOP_INFO_WRITE:
-	    p[poll_server+i].events |= POLLOUT;
-	    if (pos->read_buffer_size > pos->read_buffer_offset)
-	      p[poll_server+i].events |= POLLIN;
-	    break;
-	  case MHD_EVENT_LOOP_INFO_BLOCK:
-	    if (pos->read_buffer_size > pos->read_buffer_offset)
-	      p[poll_server+i].events |= POLLIN;
-	    break;
-	  case MHD_EVENT_LOOP_INFO_CLEANUP:
-	    timeout = 0; /* clean up "pos" immediately */
-	    break;
-	  }
-	i++;
-      }
-    if (0 == poll_server + num_connections)
-      {
-        free(p);
-        return MHD_YES;
-      }
-    if (MHD_sys_poll_(p, poll_server + num_connections, timeout) < 0)
-      {
-	if (EINTR == MHD_socket_errno_)
-      {
-        free(p);
-        return MHD_YES;
-      }
+	      goto cleanup;
+	    }
+	  connection->epoll_state |= MHD_EPOLL_STATE_IN_EPOLL_SET;
+	}
+      else
+	{
+	  connection->epoll_state |= MHD_EPOLL_STATE_READ_READY | MHD_EPOLL_STATE_WRITE_READY
+	    | MHD_EPOLL_STATE_IN_EREADY_EDLL;
+	  EDLL_insert (daemon->eready_head,
+		       daemon->eready_tail,
+		       connection);
+	}
+    }
+#endif
+#if KQUEUE_SUPPORT
+  if (0 != (daemon->options & MHD_USE_KQUEUE))
+    {
+      struct kevent changes[2];
+
+      /* one registration for the lifetime of the connection; closing
+         the socket removes both filters from the kqueue */
+      EV_SET (&changes[0], connection->socket_fd, EVFILT_READ, EV_ADD | EV_CLEAR,
+              0, 0, connection);
+      EV_SET (&changes[1], connection->socket_fd, EVFILT_WRITE, EV_ADD | EV_CLEAR,
+              0, 0, connection);
+      if (0 != kevent (daemon->kqueue_fd,
+                       changes, 2,
+                       NULL, 0,
+                       NULL))
+        {
+          eno = errno;
 #ifdef HAVE_MESSAGES
-	MHD_DLOG (daemon,
-		  "poll failed: %s\n",
-		  MHD_socket_last_strerr_ ());
+          MHD_DLOG (daemon,
+                    "Call to kevent failed: %s\n",
+                    MHD_socket_last_strerr_ ());
 #endif
-        free(p);
-	return MHD_NO;
-      }
-    /* handle shutdown */
-    if (MHD_YES == daemon->shutdown)
-      {
-        free(p);
-        return MHD_NO;
-      }
-    i = 0;
-    next = daemon->connections_head;
-    while (NULL != (pos = next))
-      {
-	next = pos->next;
-	switch (pos->event_loop_info)
-	  {
-	  case MHD_EVENT_LOOP_INFO_READ:
-	    /* first, sanity checks */
-	    if (i >= num_connections)
-	      break; /* connection list changed somehow, retry later ... */
-	    if (p[poll_server+i].fd != pos->socket_fd)
-	      break; /* fd mismatch, something else happened, retry later ... */
-	    /* normal handling */
-	    if (0 != (p[poll_server+i].revents & POLLIN))
-	      pos->read_handler (pos);
-	    pos->idle_handler (pos);
-	    i++;
-	    break;
-	  case MHD_EVENT_LOOP_INFO_WRITE:
-	    /* first, sanity checks */
-	    if (i >= num_connections)
-	      break; /* connection list changed somehow, retry later ... */
-	    if (p[poll_server+i].fd != pos->socket_fd)
-	      break; /* fd mismatch, something else happened, retry later ... */
-	    /* normal handling */
-	    if (0 != (p[poll_server+i].revents & POLLIN))
-	      pos->read_handler (pos);
-	    if (0 != (p[poll_server+i].revents & POLLOUT))
-	      pos->write_handler (pos);
-	    pos->idle_handler (pos);
-	    i++;
-	    break;
-	  case MHD_EVENT_LOOP_INFO_BLOCK:
-	    if (0 != (p[poll_server+i].revents & POLLIN))
-	      pos->read_handler (pos);
-	    pos->idle_handler (pos);
-	    break;
-	  case MHD_EVENT_LOOP_INFO_CLEANUP:
-	    pos->idle_handler (pos);
-	    break;
-	  }
-      }
-    /* handle 'listen' FD */
-    if ( (-1 != poll_listen) &&
-	 (0 != (p[poll_listen].revents & POLLIN)) )
-      (void) MHD_accept_connection (daemon);
-
-    /* handle pipe FD */
-    if ( (-1 != poll_pipe) &&
-         (0 != (p[poll_pipe].revents & POLLIN)) )
-      (void) MHD_pipe_read_ (daemon->wpipe[0], &tmp, sizeof (tmp));
-
-    free(p);
-  }
+          goto cleanup;
+        }
+      connection->epoll_state |= MHD_EPOLL_STATE_IN_EPOLL_SET;
+    }
+#endif
+  daemon->connections++;
+  wake_paused_workers (daemon);
+  MHD_socket_interest_update_ (connection);
+  if ( (0 != daemon->defer_accept) &&
+       (MHD_NO == external_add) &&
+       (0 == (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) )
+    {
+      /* the listen socket only reported the connection once data
+         arrived, so read the request now instead of waiting for the
+         event loop to report the socket as readable */
+      connection->read_handler (connection);
+      connection->idle_handler (connection);
+    }
   return MHD_YES;
+ cleanup:
+  if (NULL != daemon->notify_connection)
+    daemon->notify_connection (daemon->notify_connection_cls,
+                               connection,
+                               &connection->socket_context,
+                               MHD_CONNECTION_NOTIFY_CLOSED);
+  socket_interest_remove (connection);
+  if (0 != MHD_socket_close_ (connection->socket_fd))
+    MHD_PANIC ("close failed\n");
+  MHD_ip_limit_del (daemon, connection->addr, connection->addr_len);
+  if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
+       (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex)) )
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  DLL_remove (daemon->connections_head,
+	      daemon->connections_tail,
+	      connection);
+  MHD_poll_set_remove_ (connection);
+  MHD_connection_timeout_remove_ (connection);
+  if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
+       (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex)) )
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+  MHD_pool_destroy (connection->pool);
+  MHD_memory_budget_return_ (daemon);
+  MHD_connection_overflow_release_ (connection);
+  MHD_slow_request_free_ (connection);
+#if HTTPS_SUPPORT
+  MHD_tls_session_deinit_ (connection);
+#endif
+  if ((struct sockaddr *) &connection->addr_storage != connection->addr)
+    free (connection->addr);
+  free (connection);
+#if EINVAL
+  errno = eno;
+#endif
+  return MHD_NO;
 }
 
 
 /**
- * Process only the listen socket using poll().
+ * Take the memory of one connection pool from the budget of
+ * @a daemon (see #MHD_OPTION_MEMORY_BUDGET) before creating the
+ * pool.  Safe to call from any thread.
  *
- * @param daemon daemon to run poll loop for
- * @param may_block #MHD_YES if blocking, #MHD_NO if non-blocking
- * @return #MHD_NO on serious errors, #MHD_YES on success
+ * @param daemon daemon (or worker) the pool is for
+ * @return #MHD_YES on success (or if there is no budget),
+ *         #MHD_NO if the budget is exhausted
  */
-static int
-MHD_poll_listen_socket (struct MHD_Daemon *daemon,
-			int may_block)
+int
+MHD_memory_budget_take_ (struct MHD_Daemon *daemon)
 {
-  struct pollfd p[2];
-  int timeout;
-  unsigned int poll_count;
-  int poll_listen;
+  struct MHD_Daemon *master;
 
-  memset (&p, 0, sizeof (p));
-  poll_count = 0;
-  poll_listen = -1;
-  if (MHD_INVALID_SOCKET != daemon->socket_fd)
-    {
-      p[poll_count].fd = daemon->socket_fd;
-      p[poll_count].events = POLLIN;
-      p[poll_count].revents = 0;
-      poll_listen = poll_count;
-      poll_count++;
-    }
-  if (MHD_INVALID_PIPE_ != daemon->wpipe[0])
-    {
-      p[poll_count].fd = daemon->wpipe[0];
-      p[poll_count].events = POLLIN;
-      p[poll_count].revents = 0;
-      poll_count++;
-    }
-  if (MHD_NO == may_block)
-    timeout = 0;
-  else
-    timeout = -1;
-  if (0 == poll_count)
+  if (0 == daemon->memory_budget)
     return MHD_YES;
-  if (MHD_sys_poll_(p, poll_count, timeout) < 0)
-    {
-      if (EINTR == MHD_socket_errno_)
-	return MHD_YES;
-#ifdef HAVE_MESSAGES
-      MHD_DLOG (daemon,
-                "poll failed: %s\n",
-                MHD_socket_last_strerr_ ());
-#endif
-      return MHD_NO;
-    }
-  /* handle shutdown */
-  if (MHD_YES == daemon->shutdown)
+  master = (NULL != daemon->master) ? daemon->master : daemon;
+#ifdef HAVE_ATOMIC_BUILTINS
+  if (__atomic_add_fetch (&master->memory_used,
+                          daemon->pool_size,
+                          __ATOMIC_RELAXED) <= daemon->memory_budget)
+    return MHD_YES;
+  (void) __atomic_sub_fetch (&master->memory_used,
+                             daemon->pool_size,
+                             __ATOMIC_RELAXED);
+  return MHD_NO;
+#else
+  if (master->memory_used + daemon->pool_size > daemon->memory_budget)
     return MHD_NO;
-  if ( (-1 != poll_listen) &&
-       (0 != (p[poll_listen].revents & POLLIN)) )
-    (void) MHD_accept_connection (daemon);
+  master->memory_used += daemon->pool_size;
   return MHD_YES;
+#endif
 }
+
+
+/**
+ * Return the memory taken with MHD_memory_budget_take_() after
+ * destroying (or caching) the pool.  If the budget was exhausted,
+ * the other workers of a thread pool may have stopped accepting,
+ * so they are woken up to notice the free memory; @a daemon itself
+ * checks again before it waits for events.
+ *
+ * @param daemon daemon (or worker) the pool was for
+ */
+void
+MHD_memory_budget_return_ (struct MHD_Daemon *daemon)
+{
+  struct MHD_Daemon *master;
+  size_t used;
+  unsigned int i;
+
+  if (0 == daemon->memory_budget)
+    return;
+  master = (NULL != daemon->master) ? daemon->master : daemon;
+#ifdef HAVE_ATOMIC_BUILTINS
+  used = __atomic_sub_fetch (&master->memory_used,
+                             daemon->pool_size,
+                             __ATOMIC_RELAXED);
+#else
+  used = (master->memory_used -= daemon->pool_size);
 #endif
+  if ( (NULL == master->worker_pool) ||
+       (used + 2 * daemon->pool_size <= daemon->memory_budget) )
+    return;
+  for (i = 0; i < master->worker_pool_size; i++)
+    if (daemon != &master->worker_pool[i])
+      (void) MHD_daemon_wakeup_ (&master->worker_pool[i]);
+}
 
 
 /**
- * Do poll()-based processing.
+ * Check if the budget of @a daemon is too small for another pool.
  *
- * @param daemon daemon to run poll()-loop for
- * @param may_block #MHD_YES if blocking, #MHD_NO if non-blocking
- * @return #MHD_NO on serious errors, #MHD_YES on success
+ * @param daemon daemon (or worker) to check
+ * @return #MHD_YES if no further pool can be created
  */
-static int
-MHD_poll (struct MHD_Daemon *daemon,
-	  int may_block)
+int
+MHD_memory_budget_exhausted_ (struct MHD_Daemon *daemon)
 {
-#ifdef HAVE_POLL
-  if (MHD_YES == daemon->shutdown)
+  struct MHD_Daemon *master;
+  size_t used;
+
+  if (0 == daemon->memory_budget)
     return MHD_NO;
-  if (0 == (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
-    return MHD_poll_all (daemon, may_block);
-  else
-    return MHD_poll_listen_socket (daemon, may_block);
+  master = (NULL != daemon->master) ? daemon->master : daemon;
+#ifdef HAVE_ATOMIC_BUILTINS
+  used = __atomic_load_n (&master->memory_used,
+                          __ATOMIC_RELAXED);
 #else
-  return MHD_NO;
+  used = master->memory_used;
 #endif
+  return (used + daemon->pool_size > daemon->memory_budget) ? MHD_YES : MHD_NO;
 }
 
 
-#if EPOLL_SUPPORT
-
 /**
- * How many events to we process at most per epoll() call?  Trade-off
- * between required stack-size and number of system calls we have to
- * make; 128 should be way enough to avoid more than one system call
- * for most scenarios, and still be moderate in stack size
- * consumption.  Embedded systems might want to choose a smaller value
- * --- but why use epoll() on such a system in the first place?
+ * Average lag of an event loop in milliseconds up to which a worker
+ * is not considered lagging, see above_fair_share().
  */
-#define MAX_EVENTS 128
+#define MHD_ACCEPT_MIN_LAG 5
 
 
 /**
- * Do epoll()-based processing (this function is allowed to
- * block if @a may_block is set to #MHD_YES).
+ * Check if the worker @a daemon of a thread pool is loaded above its
+ * fair share, see #MHD_OPTION_ACCEPT_FAIR_SHARE: it has more than
+ * the allowed number of connections above the average of the
+ * workers or, if the lag of the event loops is measured (see
+ * #MHD_OPTION_OVERLOAD_LATENCY), its event loop lags more than twice
+ * the average.  Some worker is always below the average, so the
+ * pool as a whole keeps accepting.
  *
- * @param daemon daemon to run poll loop for
- * @param may_block #MHD_YES if blocking, #MHD_NO if non-blocking
- * @return #MHD_NO on serious errors, #MHD_YES on success
+ * @param daemon daemon (or worker) to check
+ * @return #MHD_YES if the worker is to leave accepting to the others
  */
 static int
-MHD_epoll (struct MHD_Daemon *daemon,
-	   int may_block)
+above_fair_share (struct MHD_Daemon *daemon)
 {
-  struct MHD_Connection *pos;
-  struct MHD_Connection *next;
-  struct epoll_event events[MAX_EVENTS];
-  struct epoll_event event;
-  int timeout_ms;
-  MHD_UNSIGNED_LONG_LONG timeout_ll;
-  int num_events;
+  struct MHD_Daemon *master = daemon->master;
+  uint64_t total;
+  uint64_t lag_total;
   unsigned int i;
-  unsigned int series_length;
-  char tmp;
 
-  if (-1 == daemon->epoll_fd)
-    return MHD_NO; /* we're down! */
-  if (MHD_YES == daemon->shutdown)
+  if ( (NULL == master) ||
+       (0 == daemon->accept_fair_share) )
     return MHD_NO;
-  if ( (MHD_INVALID_SOCKET != daemon->socket_fd) &&
-       (daemon->connections < daemon->connection_limit) &&
-       (MHD_NO == daemon->listen_socket_in_epoll) )
-    {
-      event.events = EPOLLIN;
-      event.data.ptr = daemon;
-      if (0 != epoll_ctl (daemon->epoll_fd,
-			  EPOLL_CTL_ADD,
-			  daemon->socket_fd,
-			  &event))
-	{
-#ifdef HAVE_MESSAGES
-          MHD_DLOG (daemon,
-                    "Call to epoll_ctl failed: %s\n",
-                    MHD_socket_last_strerr_ ());
+  /* announce the pause before reading the counts, so that a worker
+     adding a connection meanwhile wakes us up to check again */
+#ifdef HAVE_ATOMIC_BUILTINS
+  __atomic_store_n (&daemon->accept_paused, MHD_YES, __ATOMIC_SEQ_CST);
+#else
+  daemon->accept_paused = MHD_YES;
 #endif
-	  return MHD_NO;
-	}
-      daemon->listen_socket_in_epoll = MHD_YES;
-    }
-  if ( (MHD_YES == daemon->listen_socket_in_epoll) &&
-       (daemon->connections == daemon->connection_limit) )
+  /* the counts of the other workers may be slightly outdated */
+  total = 0;
+  lag_total = 0;
+  for (i = 0; i < master->worker_pool_size; i++)
     {
-      /* we're at the connection limit, disable listen socket
-	 for event loop for now */
-      if (0 != epoll_ctl (daemon->epoll_fd,
-			  EPOLL_CTL_DEL,
-			  daemon->socket_fd,
-			  NULL))
-	MHD_PANIC ("Failed to remove listen FD from epoll set\n");
-      daemon->listen_socket_in_epoll = MHD_NO;
+#ifdef HAVE_ATOMIC_BUILTINS
+      total += __atomic_load_n (&master->worker_pool[i].connections,
+                                __ATOMIC_RELAXED);
+      lag_total += __atomic_load_n (&master->worker_pool[i].loop_lag_avg,
+                                    __ATOMIC_RELAXED);
+#else
+      total += master->worker_pool[i].connections;
+      lag_total += master->worker_pool[i].loop_lag_avg;
+#endif
     }
-  if (MHD_YES == may_block)
-    {
-      if (MHD_YES == MHD_get_timeout (daemon,
-				      &timeout_ll))
-	{
-	  if (timeout_ll >= (MHD_UNSIGNED_LONG_LONG) INT_MAX)
-	    timeout_ms = INT_MAX;
-	  else
-	    timeout_ms = (int) timeout_ll;
-	}
-      else
-	timeout_ms = -1;
-    }
-  else
-    timeout_ms = 0;
-
-  /* drain 'epoll' event queue; need to iterate as we get at most
-     MAX_EVENTS in one system call here; in practice this should
-     pretty much mean only one round, but better an extra loop here
-     than unfair behavior... */
-  num_events = MAX_EVENTS;
-  while (MAX_EVENTS == num_events)
-    {
-      /* update event masks */
-      num_events = epoll_wait (daemon->epoll_fd,
-			       events, MAX_EVENTS, timeout_ms);
-      if (-1 == num_events)
-	{
-	  if (EINTR == MHD_socket_errno_)
-	    return MHD_YES;
-#ifdef HAVE_MESSAGES
-          MHD_DLOG (daemon,
-                    "Call to epoll_wait failed: %s\n",
-                    MHD_socket_last_strerr_ ());
+  if ( (uint64_t) daemon->connections * master->worker_pool_size >
+       total + (uint64_t) daemon->accept_fair_share * master->worker_pool_size)
+    return MHD_YES;
+  if ( (0 != daemon->overload_latency) &&
+       (daemon->loop_lag_avg >= MHD_ACCEPT_MIN_LAG * MHD_OVERLOAD_AVG_SCALE) &&
+       (daemon->loop_lag_avg * master->worker_pool_size > 2 * lag_total) )
+    return MHD_YES;
+#ifdef HAVE_ATOMIC_BUILTINS
+  __atomic_store_n (&daemon->accept_paused, MHD_NO, __ATOMIC_RELAXED);
+#else
+  daemon->accept_paused = MHD_NO;
 #endif
-	  return MHD_NO;
-	}
-      for (i=0;i<(unsigned int) num_events;i++)
-	{
-	  if (NULL == events[i].data.ptr)
-	    continue; /* shutdown signal! */
-          if ( (MHD_INVALID_PIPE_ != daemon->wpipe[0]) &&
-               (daemon->wpipe[0] == events[i].data.fd) )
-            {
-              (void) MHD_pipe_read_ (daemon->wpipe[0], &tmp, sizeof (tmp));
-              continue;
-            }
-	  if (daemon != events[i].data.ptr)
-	    {
-	      /* this is an event relating to a 'normal' connection,
-		 remember the event and if appropriate mark the
-		 connection as 'eready'. */
-	      pos = events[i].data.ptr;
-	      if (0 != (events[i].events & EPOLLIN))
-		{
-		  pos->epoll_state |= MHD_EPOLL_STATE_READ_READY;
-		  if ( ( (MHD_EVENT_LOOP_INFO_READ == pos->event_loop_info) ||
-			 (pos->read_buffer_size > pos->read_buffer_offset) ) &&
-		       (0 == (pos->epoll_state & MHD_EPOLL_STATE_IN_EREADY_EDLL) ) )
-		    {
-		      EDLL_insert (daemon->eready_head,
-				   daemon->eready_tail,
-				   pos);
-		      pos->epoll_state |= MHD_EPOLL_STATE_IN_EREADY_EDLL;
-		    }
-		}
-	      if (0 != (events[i].events & EPOLLOUT))
-		{
-		  pos->epoll_state |= MHD_EPOLL_STATE_WRITE_READY;
-		  if ( (MHD_EVENT_LOOP_INFO_WRITE == pos->event_loop_info) &&
-		       (0 == (pos->epoll_state & MHD_EPOLL_STATE_IN_EREADY_EDLL) ) )
-		    {
-		      EDLL_insert (daemon->eready_head,
-				   daemon->eready_tail,
-				   pos);
-		      pos->epoll_state |= MHD_EPOLL_STATE_IN_EREADY_EDLL;
-		    }
-		}
-	    }
-	  else /* must be listen socket */
-	    {
-	      /* run 'accept' until it fails or we are not allowed to take
-		 on more connections */
-	      series_length = 0;
-	      while ( (MHD_YES == MHD_accept_connection (daemon)) &&
-		      (daemon->connections < daemon->connection_limit) &&
-		      (series_length < 128) )
-                series_length++;
-	    }
-	}
-    }
-
-  /* we handle resumes here because we may have ready connections
-     that will not be placed into the epoll list immediately. */
-  if ( (MHD_USE_SUSPEND_RESUME == (daemon->options & MHD_USE_SUSPEND_RESUME)) &&
-       (MHD_YES == resume_suspended_connections (daemon)) )
-    may_block = MHD_NO;
-
-  /* process events for connections */
-  while (NULL != (pos = daemon->eready_tail))
-    {
-      EDLL_remove (daemon->eready_head,
-		   daemon->eready_tail,
-		   pos);
-      pos->epoll_state &= ~MHD_EPOLL_STATE_IN_EREADY_EDLL;
-      if (MHD_EVENT_LOOP_INFO_READ == pos->event_loop_info)
-	pos->read_handler (pos);
-      if (MHD_EVENT_LOOP_INFO_WRITE == pos->event_loop_info)
-	pos->write_handler (pos);
-      pos->idle_handler (pos);
-    }
-
-  /* Finally, handle timed-out connections; we need to do this here
-     as the epoll mechanism won't call the 'idle_handler' on everything,
-     as the other event loops do.  As timeouts do not get an explicit
-     event, we need to find those connections that might have timed out
-     here.
-
-     Connections with custom timeouts must all be looked at, as we
-     do not bother to sort that (presumably very short) list. */
-  next = daemon->manual_timeout_head;
-  while (NULL != (pos = next))
-    {
-      next = pos->nextX;
-      pos->idle_handler (pos);
-    }
-  /* Connections with the default timeout are sorted by prepending
-     them to the head of the list whenever we touch the connection;
-     thus it sufficies to iterate from the tail until the first
-     connection is NOT timed out */
-  next = daemon->normal_timeout_tail;
-  while (NULL != (pos = next))
-    {
-      next = pos->prevX;
-      pos->idle_handler (pos);
-      if (MHD_CONNECTION_CLOSED != pos->state)
-	break; /* sorted by timeout, no need to visit the rest! */
-    }
-  return MHD_YES;
+  return MHD_NO;
 }
-#endif
 
 
 /**
- * Run webserver operations (without blocking unless in client
- * callbacks).  This method should be called by clients in combination
- * with #MHD_get_fdset if the client-controlled select method is used.
- *
- * This function is a convenience method, which is useful if the
- * fd_sets from #MHD_get_fdset were not directly passed to `select()`;
- * with this function, MHD will internally do the appropriate `select()`
- * call itself again.  While it is always safe to call #MHD_run (in
- * external select mode), you should call #MHD_run_from_select if
- * performance is important (as it saves an expensive call to
- * `select()`).
+ * Check if @a daemon may not accept further connections right now,
+ * because of its connection limit, its memory budget or its share
+ * of the load of the thread pool.
  *
- * @param daemon daemon to run
- * @return #MHD_YES on success, #MHD_NO if this
- *         daemon was not started with the right
- *         options for this call.
- * @ingroup event
+ * @param daemon daemon (or worker) to check
+ * @return #MHD_YES if accepting is to pause
  */
-int
-MHD_run (struct MHD_Daemon *daemon)
+static int
+at_connection_limit (struct MHD_Daemon *daemon)
 {
-  if ( (MHD_YES == daemon->shutdown) ||
-       (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) ||
-       (0 != (daemon->options & MHD_USE_SELECT_INTERNALLY)) )
-    return MHD_NO;
-  if (0 != (daemon->options & MHD_USE_POLL))
-  {
-    MHD_poll (daemon, MHD_NO);
-    MHD_cleanup_connections (daemon);
-  }
-#if EPOLL_SUPPORT
-  else if (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY))
-  {
-    MHD_epoll (daemon, MHD_NO);
-    MHD_cleanup_connections (daemon);
-  }
-#endif
-  else
-  {
-    MHD_select (daemon, MHD_NO);
-    /* MHD_select does MHD_cleanup_connections already */
-  }
-  return MHD_YES;
+  if (daemon->connections >= daemon->connection_limit)
+    return MHD_YES;
+  if (MHD_YES == above_fair_share (daemon))
+    return MHD_YES;
+  return MHD_memory_budget_exhausted_ (daemon);
 }
 
 
 /**
- * Thread that runs the select loop until the daemon
- * is explicitly shut down.
+ * Add another client connection to the set of connections
+ * managed by MHD.  This API is usually not needed (since
+ * MHD will accept inbound connections on the server socket).
+ * Use this API in special cases, for example if your HTTP
+ * server is behind NAT and needs to connect out to the
+ * HTTP client.
  *
- * @param cls 'struct MHD_Deamon' to run select loop in a thread for
- * @return always 0 (on shutdown)
+ * The given client socket will be managed (and closed!) by MHD after
+ * this call and must no longer be used directly by the application
+ * afterwards.
+ *
+ * Per-IP connection limits are ignored when using this API.
+ *
+ * @param daemon daemon that manages the connection
+ * @param client_socket socket to manage (MHD will expect
+ *        to receive an HTTP request from this socket next).
+ * @param addr IP address of the client
+ * @param addrlen number of bytes in @a addr
+ * @param external_add perform additional operations needed due
+ *        to the application calling us directly
+ * @param[out] added_to if not NULL, set to the daemon (worker) that
+ *        got the connection, which is then not woken up by this
+ *        function; the caller must call MHD_daemon_wakeup_() on it
+ * @return #MHD_YES on success, #MHD_NO if this daemon could
+ *        not handle the connection (i.e. malloc failed, etc).
+ *        The socket will be closed in any case; 'errno' is
+ *        set to indicate further details about the error.
  */
-static MHD_THRD_RTRN_TYPE_ MHD_THRD_CALL_SPEC_
-MHD_select_thread (void *cls)
+static int
+internal_add_connection (struct MHD_Daemon *daemon,
+			 MHD_socket client_socket,
+			 const struct sockaddr *addr,
+			 socklen_t addrlen,
+			 int external_add,
+                         struct MHD_Daemon **added_to)
 {
-  struct MHD_Daemon *daemon = cls;
+  struct MHD_Connection *connection;
+  unsigned int i;
+  int eno;
+  struct MHD_Daemon *worker;
+#if OSX || (EPOLL_SUPPORT && defined(SO_PREFER_BUSY_POLL))
+  static int on = 1;
+#endif
 
-  while (MHD_YES != daemon->shutdown)
+  if (NULL != daemon->worker_pool)
     {
-      if (0 != (daemon->options & MHD_USE_POLL))
-	MHD_poll (daemon, MHD_YES);
-#if EPOLL_SUPPORT
-      else if (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY))
-	MHD_epoll (daemon, MHD_YES);
+      /* have a pool, try to find a pool with capacity; we use the
+	 socket as the initial offset into the pool for load
+	 balancing */
+      for (i=0;i<daemon->worker_pool_size;i++)
+        {
+          worker = &daemon->worker_pool[(i + client_socket) % daemon->worker_pool_size];
+          if (worker->connections < worker->connection_limit)
+            return internal_add_connection (worker,
+                                            client_socket,
+                                            addr, addrlen,
+                                            external_add,
+                                            added_to);
+        }
+      /* all pools are at their connection limit, must refuse */
+      if (0 != MHD_socket_close_ (client_socket))
+	MHD_PANIC ("close failed\n");
+#if ENFILE
+      errno = ENFILE;
 #endif
-      else
-	MHD_select (daemon, MHD_YES);
-      MHD_cleanup_connections (daemon);
+      return MHD_NO;
     }
-  return (MHD_THRD_RTRN_TYPE_)0;
-}
-
 
-/**
- * Process escape sequences ('%HH') Updates val in place; the
- * result should be UTF-8 encoded and cannot be larger than the input.
- * The result must also still be 0-terminated.
- *
- * @param cls closure (use NULL)
- * @param connection handle to connection, not used
- * @param val value to unescape (modified in the process)
- * @return length of the resulting val (strlen(val) maybe
- *  shorter afterwards due to elimination of escape sequences)
- */
-static size_t
-unescape_wrapper (void *cls,
-                  struct MHD_Connection *connection,
-                  char *val)
-{
-  return MHD_http_unescape (val);
-}
+#ifndef MHD_WINSOCK_SOCKETS
+  if ( (client_socket >= FD_SETSIZE) &&
+       (0 == (daemon->options & (MHD_USE_POLL | MHD_USE_EPOLL_LINUX_ONLY | MHD_USE_KQUEUE | MHD_USE_LARGE_FD_SETS))) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+		"Socket descriptor larger than FD_SETSIZE: %d > %d\n",
+		client_socket,
+		FD_SETSIZE);
+#endif
+      if (0 != MHD_socket_close_ (client_socket))
+	MHD_PANIC ("close failed\n");
+#if EINVAL
+      errno = EINVAL;
+#endif
+      return MHD_NO;
+    }
+#endif
+
+
+#ifdef HAVE_MESSAGES
+#if DEBUG_CONNECT
+  MHD_DLOG (daemon,
+            "Accepted connection on socket %d\n",
+            client_socket);
+#endif
+#endif
+  if ( (daemon->connections == daemon->connection_limit) ||
+       (MHD_NO == MHD_ip_limit_add (daemon, addr, addrlen)) )
+    {
+      /* above connection limit - reject */
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Server reached connection limit (closing inbound connection)\n");
+#endif
+      if (0 != MHD_socket_close_ (client_socket))
+	MHD_PANIC ("close failed\n");
+#if ENFILE
+      errno = ENFILE;
+#endif
+      return MHD_NO;
+    }
+
+  /* apply connection acceptance policy if present */
+  if ( (NULL != daemon->apc) &&
+       (MHD_NO == daemon->apc (daemon->apc_cls,
+			       addr, addrlen)) )
+    {
+#if DEBUG_CLOSE
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Connection rejected, closing connection\n");
+#endif
+#endif
+      if (0 != MHD_socket_close_ (client_socket))
+	MHD_PANIC ("close failed\n");
+      MHD_ip_limit_del (daemon, addr, addrlen);
+#if EACCESS
+      errno = EACCESS;
+#endif
+      return MHD_NO;
+    }
+
+#if OSX
+#ifdef SOL_SOCKET
+#ifdef SO_NOSIGPIPE
+  setsockopt (client_socket,
+	      SOL_SOCKET, SO_NOSIGPIPE,
+	      &on, sizeof (on));
+#endif
+#endif
+#endif
+#if EPOLL_SUPPORT && defined(SO_BUSY_POLL)
+  if (0 != daemon->busy_poll_usec)
+    {
+      const int usec = (daemon->busy_poll_usec > INT_MAX)
+        ? INT_MAX : (int) daemon->busy_poll_usec;
+
+      /* best effort, values above net.core.busy_read need CAP_NET_ADMIN */
+      (void) setsockopt (client_socket,
+                         SOL_SOCKET, SO_BUSY_POLL,
+                         &usec, sizeof (usec));
+#ifdef SO_PREFER_BUSY_POLL
+      (void) setsockopt (client_socket,
+                         SOL_SOCKET, SO_PREFER_BUSY_POLL,
+                         &on, sizeof (on));
+#endif
+    }
+#endif
+
+  /* external adds may come from other threads than our event loop */
+  if ( (MHD_NO == external_add) &&
+       (NULL != (connection = daemon->connection_cache)) )
+    {
+      daemon->connection_cache = connection->next;
+      daemon->connection_cache_len--;
+    }
+  else if (NULL == (connection = malloc (sizeof (struct MHD_Connection))))
+    {
+      eno = errno;
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+		"Error allocating memory: %s\n",
+		MHD_strerror_ (errno));
+#endif
+      if (0 != MHD_socket_close_ (client_socket))
+	MHD_PANIC ("close failed\n");
+      MHD_ip_limit_del (daemon, addr, addrlen);
+      errno = eno;
+      return MHD_NO;
+    }
+  memset (connection,
+          0,
+          sizeof (struct MHD_Connection));
+  if ( (MHD_NO == MHD_memory_budget_take_ (daemon)) &&
+       ( (MHD_YES == external_add) ||
+         (MHD_NO == MHD_memory_budget_reclaim_ (daemon)) ||
+         (MHD_NO == MHD_memory_budget_take_ (daemon)) ) )
+    {
+      /* no memory for its pool - reject */
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Server reached memory budget (closing inbound connection)\n");
+#endif
+      if (0 != MHD_socket_close_ (client_socket))
+	MHD_PANIC ("close failed\n");
+      MHD_ip_limit_del (daemon, addr, addrlen);
+      free (connection);
+#if ENOMEM
+      errno = ENOMEM;
+#endif
+      return MHD_NO;
+    }
+  if (MHD_NO == external_add)
+    connection->pool = MHD_pool_create_cached (&daemon->pool_cache,
+                                               &daemon->pool_cache_len,
+                                               daemon->pool_size);
+  else
+    connection->pool = MHD_pool_create (daemon->pool_size);
+  if (NULL == connection->pool)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+		"Error allocating memory: %s\n",
+		MHD_strerror_ (errno));
+#endif
+      if (0 != MHD_socket_close_ (client_socket))
+	MHD_PANIC ("close failed\n");
+      MHD_ip_limit_del (daemon, addr, addrlen);
+      MHD_memory_budget_return_ (daemon);
+      free (connection);
+#if ENOMEM
+      errno = ENOMEM;
+#endif
+      return MHD_NO;
+    }
+
+  connection->connection_timeout = daemon->connection_timeout;
+  if (addrlen <= sizeof (connection->addr_storage))
+    connection->addr = (struct sockaddr *) &connection->addr_storage;
+  else if (NULL == (connection->addr = malloc (addrlen)))
+    {
+      eno = errno;
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+		"Error allocating memory: %s\n",
+		MHD_strerror_ (errno));
+#endif
+      if (0 != MHD_socket_close_ (client_socket))
+	MHD_PANIC ("close failed\n");
+      MHD_ip_limit_del (daemon, addr, addrlen);
+      MHD_pool_destroy (connection->pool);
+      MHD_memory_budget_return_ (daemon);
+      free (connection);
+      errno = eno;
+      return MHD_NO;
+    }
+  memcpy (connection->addr, addr, addrlen);
+  connection->addr_len = addrlen;
+#if MHD_UNIX_SOCKETS
+  if ( (addrlen >= offsetof (struct sockaddr_un, sun_path)) &&
+       (AF_UNIX == addr->sa_family) )
+    {
+      /* no TCP options to manage */
+      connection->sk_nodelay = MHD_SOCKOPT_UNSUPPORTED;
+      connection->sk_cork = MHD_SOCKOPT_UNSUPPORTED;
+    }
+#endif
+  connection->socket_fd = client_socket;
+  connection->socket_interest = MHD_SOCKET_INTEREST_REMOVE;
+  connection->upload_fd = -1;
+#if HAVE_SPLICE
+  connection->splice_pipe[0] = -1;
+  connection->splice_pipe[1] = -1;
+#endif
+  connection->daemon = daemon;
+  /* may run outside of the event loop, the cached time may be old */
+  connection->last_activity = MHD_monotonic_msec_counter ();
+  connection->request_times.accepted = MHD_monotonic_usec_counter ();
+  MHD_PROBE2 (accept, connection, client_socket);
+
+  /* set default connection handlers  */
+  MHD_set_http_callbacks_ (connection);
+  connection->recv_cls = &recv_param_adapter;
+  connection->send_cls = &send_param_adapter;
+
+  if (0 == (connection->daemon->options & MHD_USE_EPOLL_TURBO))
+    {
+      /* non-blocking sockets are required on most systems and for GNUtls;
+	 however, they somehow cause serious problems on CYGWIN (#1824);
+	 in turbo mode, we assume that non-blocking was already set
+	 by 'accept4' or whoever calls 'MHD_add_connection' */
+#ifdef CYGWIN
+      if (0 != (daemon->options & MHD_USE_SSL))
+#endif
+	{
+	  /* make socket non-blocking */
+#if !defined(MHD_WINSOCK_SOCKETS)
+	  int flags = fcntl (connection->socket_fd, F_GETFL);
+	  if ( (-1 == flags) ||
+	       (0 != fcntl (connection->socket_fd, F_SETFL, flags | O_NONBLOCK)) )
+	    {
+#ifdef HAVE_MESSAGES
+	      MHD_DLOG (daemon,
+			"Failed to make socket non-blocking: %s\n",
+			MHD_socket_last_strerr_ ());
+#endif
+	    }
+#else
+	  unsigned long flags = 1;
+	  if (0 != ioctlsocket (connection->socket_fd, FIONBIO, &flags))
+	    {
+#ifdef HAVE_MESSAGES
+	      MHD_DLOG (daemon,
+			"Failed to make socket non-blocking: %s\n",
+			MHD_socket_last_strerr_ ());
+#endif
+	    }
+#endif
+	}
+    }
+
+#if HTTPS_SUPPORT
+  if (0 != (daemon->options & MHD_USE_SSL))
+    {
+      connection->recv_cls = &recv_tls_adapter;
+      connection->send_cls = &send_tls_adapter;
+      connection->state = MHD_TLS_CONNECTION_INIT;
+      MHD_set_https_callbacks (connection);
+      if (MHD_YES != MHD_tls_session_init_ (connection,
+                                            &recv_param_adapter,
+                                            &send_tls_transport))
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Failed to set up TLS session\n");
+#endif
+          if (0 != MHD_socket_close_ (client_socket))
+	    MHD_PANIC ("close failed\n");
+          MHD_ip_limit_del (daemon, addr, addrlen);
+          MHD_pool_destroy (connection->pool);
+          MHD_memory_budget_return_ (daemon);
+          if ((struct sockaddr *) &connection->addr_storage != connection->addr)
+            free (connection->addr);
+          free (connection);
+#if ENOMEM
+	  errno = ENOMEM;
+#endif
+ 	  return MHD_NO;
+        }
+      MHD_PROBE1 (tls_handshake_start, connection);
+    }
+#endif
+
+  if ( (MHD_YES == external_add) &&
+       (0 != (daemon->options & MHD_USE_SELECT_INTERNALLY)) &&
+       (0 == (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) )
+    {
+      /* the connection lists belong to the thread of the event loop,
+         which takes the connection over once woken up */
+      if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+        MHD_PANIC ("Failed to acquire cleanup mutex\n");
+      connection->next = NULL;
+      if (NULL == daemon->added_connections_tail)
+        daemon->added_connections_head = connection;
+      else
+        daemon->added_connections_tail->next = connection;
+      daemon->added_connections_tail = connection;
+#ifdef HAVE_ATOMIC_BUILTINS
+      __atomic_store_n (&daemon->adding,
+                        MHD_YES,
+                        __ATOMIC_RELEASE);
+#else
+      daemon->adding = MHD_YES;
+#endif
+      if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+        MHD_PANIC ("Failed to release cleanup mutex\n");
+    }
+  else if (MHD_YES != insert_connection (daemon,
+                                         connection,
+                                         external_add))
+    return MHD_NO;
+  if ( (MHD_NO == external_add) ||
+       (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) )
+    return MHD_YES;
+  if (NULL != added_to)
+    *added_to = daemon;
+  else if (MHD_YES != MHD_daemon_wakeup_ (daemon))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "failed to signal new connection via pipe");
+#endif
+    }
+  return MHD_YES;
+}
+
+
+/**
+ * Take over the connections the application added since the last
+ * call (see #MHD_add_connection()).
+ *
+ * @param daemon daemon context
+ */
+static void
+insert_added_connections (struct MHD_Daemon *daemon)
+{
+  struct MHD_Connection *pos;
+  struct MHD_Connection *next;
+
+#ifdef HAVE_ATOMIC_BUILTINS
+  if (MHD_NO == __atomic_load_n (&daemon->adding,
+                                 __ATOMIC_ACQUIRE))
+    return; /* fast path, an add also signals the pipe */
+#else
+  if (MHD_NO == daemon->adding)
+    return;
+#endif
+  if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  pos = daemon->added_connections_head;
+  daemon->added_connections_head = NULL;
+  daemon->added_connections_tail = NULL;
+#ifdef HAVE_ATOMIC_BUILTINS
+  __atomic_store_n (&daemon->adding,
+                    MHD_NO,
+                    __ATOMIC_RELAXED);
+#else
+  daemon->adding = MHD_NO;
+#endif
+  if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+  for (; NULL != pos; pos = next)
+    {
+      next = pos->next;
+      pos->next = NULL;
+      (void) insert_connection (daemon,
+                                pos,
+                                MHD_YES);
+    }
+}
+
+
+static void
+MHD_cleanup_connections (struct MHD_Daemon *daemon);
+
+
+/**
+ * Close the connections that are idle between two requests after
+ * the daemon started draining, see #MHD_handoff_listen_socket() and
+ * #MHD_OPTION_SHUTDOWN_GRACE_MS.
+ * Connections that did not receive a request yet are left alone,
+ * their first request is answered (and then closed).
+ *
+ * @param daemon daemon context
+ */
+static void
+drain_idle_connections (struct MHD_Daemon *daemon)
+{
+  struct MHD_Connection *pos;
+  struct MHD_Connection *next;
+  int closed;
+
+#ifdef HAVE_ATOMIC_BUILTINS
+  if (MHD_NO == __atomic_exchange_n (&daemon->drain_pending,
+                                     MHD_NO,
+                                     __ATOMIC_ACQ_REL))
+    return;
+#else
+  if (MHD_NO == daemon->drain_pending)
+    return;
+  daemon->drain_pending = MHD_NO;
+#endif
+  if (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
+    return; /* owned by their threads, closed by their timeout */
+  closed = MHD_NO;
+  next = daemon->connections_head;
+  while (NULL != (pos = next))
+    {
+      next = pos->next;
+      if ( (MHD_CONNECTION_INIT != pos->state) ||
+           (MHD_NO == pos->kept_alive) ||
+           (0 != pos->read_buffer_offset) ||
+           (MHD_YES == pos->in_idle) )
+        continue;
+      MHD_connection_close_ (pos,
+                             MHD_REQUEST_TERMINATED_COMPLETED_OK);
+      pos->idle_handler (pos);
+      closed = MHD_YES;
+    }
+  /* take them out of the epoll set before the next wait reports them */
+  if (MHD_YES == closed)
+    MHD_cleanup_connections (daemon);
+}
+
+
+/**
+ * Release the pools of connections that wait for their next request
+ * while the memory budget is exhausted (see #MHD_OPTION_MEMORY_BUDGET),
+ * least recently active first, until there is room for another
+ * pool.  Connections with a custom timeout are not in the list
+ * walked and keep their pools.  Must be called from the thread
+ * running the event loop of @a daemon.
+ *
+ * @param daemon daemon (or worker) to release pools of
+ * @return #MHD_YES if there is room for another pool now
+ */
+int
+MHD_memory_budget_reclaim_ (struct MHD_Daemon *daemon)
+{
+  struct MHD_Connection *pos;
+  struct MHD_Connection *prev;
+
+  if (MHD_NO == MHD_memory_budget_exhausted_ (daemon))
+    return MHD_YES;
+  if (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
+    return MHD_NO; /* owned by their threads */
+  prev = daemon->normal_timeout_tail;
+  while (NULL != (pos = prev))
+    {
+      prev = pos->prevX;
+      if ( (MHD_YES == MHD_connection_release_pool_ (pos)) &&
+           (MHD_NO == MHD_memory_budget_exhausted_ (daemon)) )
+        return MHD_YES;
+    }
+  return MHD_NO;
+}
+
+
+/**
+ * Reclaim memory for new connections once per iteration of the event
+ * loop, see MHD_memory_budget_reclaim_().  Runs at most once per
+ * millisecond, as connections hardly become idle any faster.
+ *
+ * @param daemon daemon context
+ */
+static void
+reclaim_memory_budget (struct MHD_Daemon *daemon)
+{
+  uint64_t now;
+
+  if (MHD_NO == MHD_memory_budget_exhausted_ (daemon))
+    return;
+  now = MHD_loop_time_ (daemon);
+  if (now == daemon->budget_reclaim_time)
+    return;
+  daemon->budget_reclaim_time = now;
+  (void) MHD_memory_budget_reclaim_ (daemon);
+}
+
+
+/**
+ * Maximum number of connections a worker hands over to another one
+ * at once, see rebalance_connections().
+ */
+#define MHD_REBALANCE_BATCH 16
+
+/**
+ * Maximum number of connections a worker looks at when searching
+ * for idle connections to hand over.
+ */
+#define MHD_REBALANCE_SCAN 64
+
+
+/**
+ * Check if @a connection waits for the next request, so that it can
+ * be handed over to another worker without losing anything but its
+ * place in the event loop.
+ *
+ * @param connection connection to check
+ * @return #MHD_YES if @a connection is idle
+ */
+static int
+connection_is_idle (struct MHD_Connection *connection)
+{
+  if ( (MHD_CONNECTION_INIT != connection->state) ||
+       (0 != connection->read_buffer_offset) ||
+       (MHD_YES == connection->read_closed) ||
+       (MHD_YES == connection->suspended) ||
+       (0 != connection->throttle_wake) )
+    return MHD_NO;
+#if HTTPS_SUPPORT
+  /* the TLS library may hold the next request already */
+  if (MHD_YES == connection->tls_read_ready)
+    return MHD_NO;
+#endif
+  return MHD_YES;
+}
+
+
+/**
+ * Remove an idle @a connection from the lists and the event loop of
+ * its worker, to hand it over to another one.  Must be called by the
+ * thread running the event loop of the worker.
+ *
+ * @param connection connection to remove
+ */
+static void
+detach_connection (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+
+  DLL_remove (daemon->connections_head,
+              daemon->connections_tail,
+              connection);
+  MHD_connection_timeout_remove_ (connection);
+  MHD_connection_guard_remove_ (connection);
+  MHD_poll_set_remove_ (connection);
+#if MHD_EREADY_SUPPORT
+  if (0 != (connection->epoll_state & MHD_EPOLL_STATE_IN_EREADY_EDLL))
+    EDLL_remove (daemon->eready_head,
+                 daemon->eready_tail,
+                 connection);
+#endif
+#if EPOLL_SUPPORT
+  if ( (0 != (connection->epoll_state & MHD_EPOLL_STATE_IN_EPOLL_SET)) &&
+       (-1 != daemon->epoll_fd) )
+    {
+      if (0 != epoll_ctl (daemon->epoll_fd,
+                          EPOLL_CTL_DEL,
+                          connection->socket_fd,
+                          NULL))
+        MHD_PANIC ("Failed to remove FD from epoll set\n");
+    }
+#endif
+#if KQUEUE_SUPPORT
+  if ( (0 != (connection->epoll_state & MHD_EPOLL_STATE_IN_EPOLL_SET)) &&
+       (-1 != daemon->kqueue_fd) )
+    {
+      struct kevent changes[2];
+
+      EV_SET (&changes[0], connection->socket_fd, EVFILT_READ, EV_DELETE,
+              0, 0, connection);
+      EV_SET (&changes[1], connection->socket_fd, EVFILT_WRITE, EV_DELETE,
+              0, 0, connection);
+      if (0 != kevent (daemon->kqueue_fd,
+                       changes, 2,
+                       NULL, 0,
+                       NULL))
+        MHD_PANIC ("Failed to remove FD from kqueue\n");
+    }
+#endif
+#if MHD_EREADY_SUPPORT
+  /* the new event loop reports the socket again if it is ready */
+  connection->epoll_state = MHD_EPOLL_STATE_UNREADY;
+#endif
+  daemon->connections--;
+}
+
+
+/**
+ * Hand idle connections of a worker of a thread pool over to the
+ * worker with the fewest connections if the difference exceeds
+ * #MHD_OPTION_CONNECTION_REBALANCE.  The other worker takes them
+ * over like connections added by the application, see
+ * insert_added_connections().  Called before the event loop waits
+ * for events, as idle connections cause none.
+ *
+ * @param daemon worker daemon
+ */
+static void
+rebalance_connections (struct MHD_Daemon *daemon)
+{
+  struct MHD_Daemon *master = daemon->master;
+  struct MHD_Daemon *target;
+  struct MHD_Connection *idle[MHD_REBALANCE_BATCH];
+  struct MHD_Connection *pos;
+  unsigned int count;
+  unsigned int min;
+  unsigned int moves;
+  unsigned int found;
+  unsigned int scanned;
+  unsigned int i;
+  int pending;
+
+  if ( (NULL == master) ||
+       (0 == daemon->rebalance_threshold) )
+    return;
+#if IO_URING_SUPPORT
+  if (MHD_USE_IO_URING_LINUX_ONLY == (daemon->options & MHD_USE_IO_URING_LINUX_ONLY))
+    return;
+#endif
+  /* the counts of the other workers may be slightly outdated */
+  target = NULL;
+  min = daemon->connections;
+  for (i = 0; i < master->worker_pool_size; i++)
+    {
+#ifdef HAVE_ATOMIC_BUILTINS
+      count = __atomic_load_n (&master->worker_pool[i].connections,
+                               __ATOMIC_RELAXED);
+#else
+      count = master->worker_pool[i].connections;
+#endif
+      if (count < min)
+        {
+          min = count;
+          target = &master->worker_pool[i];
+        }
+    }
+  if ( (NULL == target) ||
+       (daemon->connections - min <= daemon->rebalance_threshold) ||
+       (min >= target->connection_limit) )
+    return;
+  /* connections handed over before are not counted until taken
+     over, wait for them */
+#ifdef HAVE_ATOMIC_BUILTINS
+  pending = __atomic_load_n (&target->adding,
+                             __ATOMIC_RELAXED);
+#else
+  pending = target->adding;
+#endif
+  if (MHD_YES == pending)
+    return;
+  moves = MHD_MIN ((daemon->connections - min) / 2,
+                   target->connection_limit - min);
+  moves = MHD_MIN (moves, MHD_REBALANCE_BATCH);
+
+  /* the connections inactive for the longest time are at the end of
+     the list of connections with the default timeout */
+  found = 0;
+  scanned = 0;
+  for (pos = daemon->normal_timeout_tail;
+       (NULL != pos) && (found < moves) && (scanned < MHD_REBALANCE_SCAN);
+       pos = pos->prevX)
+    {
+      scanned++;
+      if (MHD_YES == connection_is_idle (pos))
+        idle[found++] = pos;
+    }
+  if (0 == found)
+    return;
+
+  if (MHD_YES != MHD_mutex_lock_ (&target->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  if (MHD_YES == target->shutdown)
+    {
+      /* close_all_connections() may have run for it already */
+      if (MHD_YES != MHD_mutex_unlock_ (&target->cleanup_connection_mutex))
+        MHD_PANIC ("Failed to release cleanup mutex\n");
+      return;
+    }
+  for (i = 0; i < found; i++)
+    {
+      pos = idle[i];
+      detach_connection (pos);
+      pos->daemon = target;
+      pos->migrating = MHD_YES;
+      pos->next = NULL;
+      if (NULL == target->added_connections_tail)
+        target->added_connections_head = pos;
+      else
+        target->added_connections_tail->next = pos;
+      target->added_connections_tail = pos;
+    }
+#ifdef HAVE_ATOMIC_BUILTINS
+  __atomic_store_n (&target->adding,
+                    MHD_YES,
+                    __ATOMIC_RELEASE);
+#else
+  target->adding = MHD_YES;
+#endif
+  if (MHD_YES != MHD_mutex_unlock_ (&target->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+  MHD_STATS_ADD_ (daemon, migrations, found);
+  if (MHD_YES != MHD_daemon_wakeup_ (target))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to signal migrated connections via pipe\n");
+#endif
+    }
+}
+
+
+/**
+ * Dequeue a connection from the event loop of its daemon.  Assumes
+ * that the cleanup mutex of the daemon is held.
+ *
+ * @param connection the connection to suspend
+ */
+static void
+suspend_connection (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+
+  if (NULL != connection->h2_stream)
+    {
+      /* the session skips the stream until it is resumed */
+      connection->suspended = MHD_YES;
+      MHD_STATS_ADD_ (daemon, suspended, 1);
+      MHD_PROBE1 (suspend, connection);
+      return;
+    }
+  DLL_remove (daemon->connections_head,
+              daemon->connections_tail,
+              connection);
+  DLL_insert (daemon->suspended_connections_head,
+              daemon->suspended_connections_tail,
+              connection);
+  MHD_poll_set_remove_ (connection);
+  MHD_connection_timeout_remove_ (connection);
+  MHD_connection_guard_remove_ (connection);
+#if HTTPS_SUPPORT
+  /* must not keep the event loop from blocking while suspended */
+  if (MHD_YES == connection->tls_read_ready)
+    tls_ready_remove (connection);
+#endif
+#if MHD_EREADY_SUPPORT
+  if (0 != (daemon->options & (MHD_USE_EPOLL_LINUX_ONLY | MHD_USE_KQUEUE)))
+    {
+      if (0 != (connection->epoll_state & MHD_EPOLL_STATE_IN_EREADY_EDLL))
+        {
+          EDLL_remove (daemon->eready_head,
+                       daemon->eready_tail,
+                       connection);
+          connection->epoll_state &= ~MHD_EPOLL_STATE_IN_EREADY_EDLL;
+        }
+#if EPOLL_SUPPORT
+      /* with io_uring and kqueue, the poll request stays armed (we may
+         be called from any thread, the ring is only used by the event
+         loop); readiness is recorded but ignored while suspended */
+      if ( (0 != (connection->epoll_state & MHD_EPOLL_STATE_IN_EPOLL_SET)) &&
+           (-1 != daemon->epoll_fd) )
+        {
+          if (0 != epoll_ctl (daemon->epoll_fd,
+                              EPOLL_CTL_DEL,
+                              connection->socket_fd,
+                              NULL))
+            MHD_PANIC ("Failed to remove FD from epoll set\n");
+          connection->epoll_state &= ~MHD_EPOLL_STATE_IN_EPOLL_SET;
+        }
+#endif
+      connection->epoll_state |= MHD_EPOLL_STATE_SUSPENDED;
+    }
+#endif
+  connection->suspended = MHD_YES;
+  MHD_STATS_ADD_ (daemon, suspended, 1);
+  MHD_PROBE1 (suspend, connection);
+  MHD_socket_interest_update_ (connection);
+}
+
+
+static void
+resume_connection (struct MHD_Connection *connection);
+
+
+/**
+ * Resume the stream of a suspended HTTP/2 request: mark it and make
+ * the event loop run its connection.  Assumes that the cleanup mutex
+ * of the daemon is held.
+ *
+ * @param request the request of the stream to resume
+ */
+static void
+resume_stream (struct MHD_Connection *request)
+{
+  struct MHD_Daemon *daemon = request->daemon;
+  struct MHD_Connection *parent;
+
+  if ( (MHD_YES != request->suspended) ||
+       (MHD_YES == request->resuming) )
+    return;
+  request->resuming = MHD_YES;
+  parent = MHD_http2_parent_ (request);
+  if (MHD_YES == parent->suspended)
+    {
+      /* the connection was parked, see MHD_http2_park_() */
+      resume_connection (parent);
+      return;
+    }
+  if (MHD_NO == parent->h2_woken)
+    {
+      parent->h2_woken = MHD_YES;
+      parent->h2_wake_next = daemon->h2_wake_head;
+      daemon->h2_wake_head = parent;
+    }
+#ifdef HAVE_ATOMIC_BUILTINS
+  __atomic_store_n (&daemon->resuming,
+                    MHD_YES,
+                    __ATOMIC_RELEASE);
+#else
+  daemon->resuming = MHD_YES;
+#endif
+  if (MHD_YES != MHD_daemon_wakeup_ (daemon))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "failed to signal resume via pipe");
+#endif
+    }
+}
+
+
+/**
+ * Queue a suspended connection (not an HTTP/2 stream) for
+ * resume_suspended_connections(), without waking up the event loop.
+ * Assumes that the cleanup mutex of the daemon is held, unless
+ * #HAVE_ATOMIC_BUILTINS.
+ *
+ * @param connection the connection to resume
+ * @return #MHD_YES if this call queued @a connection, #MHD_NO if it
+ *         was not suspended or resumed already
+ */
+static int
+queue_resume (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+  int ret;
+#ifdef HAVE_ATOMIC_BUILTINS
+  struct MHD_Connection *head;
+
+  /* push to the resume queue; the event loop is the only consumer,
+     so there is no ABA problem */
+  ret = MHD_NO;
+  if ( (MHD_YES == connection->suspended) &&
+       (MHD_NO == __atomic_exchange_n (&connection->resuming,
+                                       MHD_YES,
+                                       __ATOMIC_ACQ_REL)) )
+    {
+      head = __atomic_load_n (&daemon->resume_queue,
+                              __ATOMIC_RELAXED);
+      do
+        connection->resume_next = head;
+      while (! __atomic_compare_exchange_n (&daemon->resume_queue,
+                                            &head,
+                                            connection,
+                                            1,
+                                            __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED));
+      ret = MHD_YES;
+    }
+  __atomic_store_n (&daemon->resuming,
+                    MHD_YES,
+                    __ATOMIC_RELEASE);
+#else
+  ret = MHD_NO;
+  if ( (MHD_YES == connection->suspended) &&
+       (MHD_NO == connection->resuming) )
+    {
+      /* queue for resume_suspended_connections(), so that it does
+         not have to search the (possibly long) suspended list */
+      DLL_remove (daemon->suspended_connections_head,
+                  daemon->suspended_connections_tail,
+                  connection);
+      DLL_insert (daemon->resumed_connections_head,
+                  daemon->resumed_connections_tail,
+                  connection);
+      connection->resuming = MHD_YES;
+      ret = MHD_YES;
+    }
+  daemon->resuming = MHD_YES;
+#endif
+  return ret;
+}
+
+
+/**
+ * Queue a suspended connection for resume_suspended_connections() and
+ * wake up the event loop.  Assumes that the cleanup mutex of the
+ * daemon is held, unless #HAVE_ATOMIC_BUILTINS.
+ *
+ * @param connection the connection to resume
+ */
+static void
+resume_connection (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+
+  if (NULL != connection->h2_stream)
+    {
+      resume_stream (connection);
+      return;
+    }
+  queue_resume (connection);
+  if (MHD_YES != MHD_daemon_wakeup_ (daemon))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "failed to signal resume via pipe");
+#endif
+    }
+}
+
+
+/**
+ * Move the connections from the resume queue of @a daemon to its
+ * list of resumed connections.  Assumes that the cleanup mutex of
+ * the daemon is held.
+ *
+ * @param daemon daemon to collect the resumed connections of
+ */
+void
+MHD_collect_resumed_connections_ (struct MHD_Daemon *daemon)
+{
+#ifdef HAVE_ATOMIC_BUILTINS
+  struct MHD_Connection *pos;
+  struct MHD_Connection *next;
+
+  pos = __atomic_exchange_n (&daemon->resume_queue,
+                             NULL,
+                             __ATOMIC_ACQUIRE);
+  /* the queue is LIFO, inserting at the head restores the order
+     of the resumes */
+  while (NULL != pos)
+    {
+      next = pos->resume_next;
+      DLL_remove (daemon->suspended_connections_head,
+                  daemon->suspended_connections_tail,
+                  pos);
+      DLL_insert (daemon->resumed_connections_head,
+                  daemon->resumed_connections_tail,
+                  pos);
+      pos = next;
+    }
+#endif
+}
+
+
+/**
+ * Park an HTTP/2 connection that has nothing to do but wait for its
+ * suspended streams: it is suspended like a connection, until one of
+ * the streams is resumed.
+ *
+ * @param connection connection in #MHD_CONNECTION_HTTP2 state
+ * @return #MHD_YES if the connection was suspended, #MHD_NO if a
+ *         stream was resumed meanwhile
+ */
+int
+MHD_http2_park_ (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+  int ret;
+
+  if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  ret = MHD_http2_has_suspended_ (connection,
+                                  MHD_YES);
+  if (MHD_YES == ret)
+    suspend_connection (connection);
+  if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+  return ret;
+}
+
+
+/**
+ * Suspend handling of network data for a given connection.  This can
+ * be used to dequeue a connection from MHD's event loop (external
+ * select, internal select or thread pool; not applicable to
+ * thread-per-connection!) for a while.
+ *
+ * If you use this API in conjunction with a internal select or a
+ * thread pool, you must set the option #MHD_USE_PIPE_FOR_SHUTDOWN to
+ * ensure that a resumed connection is immediately processed by MHD.
+ *
+ * Suspended connections continue to count against the total number of
+ * connections allowed (per daemon, as well as per IP, if such limits
+ * are set).  Suspended connections will NOT time out; timeouts will
+ * restart when the connection handling is resumed.  Use
+ * #MHD_suspend_connection_with_timeout() to limit the duration of
+ * the suspension.  While a
+ * connection is suspended, MHD will not detect disconnects by the
+ * client.
+ *
+ * The only safe time to suspend a connection is from the
+ * #MHD_AccessHandlerCallback.
+ *
+ * Finally, it is an API violation to call #MHD_stop_daemon while
+ * having suspended connections (this will at least create memory and
+ * socket leaks or lead to undefined behavior).  You must explicitly
+ * resume all connections before stopping the daemon.
+ *
+ * @param connection the connection to suspend
+ */
+void
+MHD_suspend_connection (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon;
+
+  daemon = connection->daemon;
+  if (MHD_USE_SUSPEND_RESUME != (daemon->options & MHD_USE_SUSPEND_RESUME))
+    MHD_PANIC ("Cannot suspend connections without enabling MHD_USE_SUSPEND_RESUME!\n");
+  /* always lock: MHD_resume_connection() may be called from any
+     thread and moves the connection out of the suspended list */
+  if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  /* on a handler thread, the connection is suspended already */
+  if (MHD_YES == connection->handler_offloaded)
+    connection->handler_suspended = MHD_YES;
+  else
+    suspend_connection (connection);
+  if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+}
+
+
+/**
+ * Suspend handling of network data for a given connection like
+ * #MHD_suspend_connection(), but end the suspension after
+ * @a timeout_ms milliseconds unless the connection is resumed
+ * before.  Depending on @a action, the connection is then resumed
+ * (and the access handler called again as after
+ * #MHD_resume_connection()) or closed (the
+ * #MHD_RequestCompletedCallback is called with
+ * #MHD_REQUEST_TERMINATED_TIMEOUT_REACHED).  The deadline is kept in
+ * the timer structure of the event loop at a granularity of about
+ * 100 ms; nothing is visited for connections whose deadline did not
+ * expire.
+ *
+ * The only safe time to call this function is from the
+ * #MHD_AccessHandlerCallback.
+ *
+ * @param connection the connection to suspend
+ * @param timeout_ms maximum duration of the suspension, 0 for none
+ * @param action what to do when the suspension times out
+ * @return #MHD_YES on success, #MHD_NO if the connection was
+ *         suspended without a deadline, because deadlines are not
+ *         supported for HTTP/2 streams, with
+ *         #MHD_OPTION_HANDLER_THREADS or with
+ *         #MHD_USE_THREAD_PER_CONNECTION
+ */
+int
+MHD_suspend_connection_with_timeout (struct MHD_Connection *connection,
+                                     unsigned int timeout_ms,
+                                     enum MHD_SuspendTimeoutAction action)
+{
+  struct MHD_Daemon *daemon;
+  int ret;
+
+  daemon = connection->daemon;
+  if (MHD_USE_SUSPEND_RESUME != (daemon->options & MHD_USE_SUSPEND_RESUME))
+    MHD_PANIC ("Cannot suspend connections without enabling MHD_USE_SUSPEND_RESUME!\n");
+  if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  ret = (0 == timeout_ms) ? MHD_YES : MHD_NO;
+  if (MHD_YES == connection->handler_offloaded)
+    {
+      connection->handler_suspended = MHD_YES;
+    }
+  else
+    {
+      suspend_connection (connection);
+      if ( (0 != timeout_ms) &&
+           (NULL == connection->h2_stream) &&
+           (0 == (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) )
+        {
+          connection->suspend_close =
+            (MHD_SUSPEND_TIMEOUT_CLOSE == action) ? MHD_YES : MHD_NO;
+          MHD_connection_suspend_deadline_ (connection,
+                                            MHD_loop_time_ (daemon) + timeout_ms);
+          ret = MHD_YES;
+        }
+    }
+  if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+  return ret;
+}
+
+
+/**
+ * Resume handling of network data for suspended connection.  It is
+ * safe to resume a suspended connection at any time.  Calling this function
+ * on a connection that was not previously suspended will result
+ * in undefined behavior.  Does not lock if #HAVE_ATOMIC_BUILTINS, unless
+ * #MHD_OPTION_HANDLER_THREADS is used.
+ *
+ * @param connection the connection to resume
+ */
+void
+MHD_resume_connection (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon;
+
+  daemon = connection->daemon;
+  if (MHD_USE_SUSPEND_RESUME != (daemon->options & MHD_USE_SUSPEND_RESUME))
+    MHD_PANIC ("Cannot resume connections without enabling MHD_USE_SUSPEND_RESUME!\n");
+#ifdef HAVE_ATOMIC_BUILTINS
+  /* streams of HTTP/2 connections are tracked under the mutex */
+  if ( (NULL == daemon->handler_pool) &&
+       (NULL == connection->h2_stream) )
+    {
+      resume_connection (connection);
+      return;
+    }
+#endif
+  if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  /* a handler thread resumes the connection when it is done */
+  if (MHD_YES == connection->handler_offloaded)
+    connection->handler_suspended = MHD_NO;
+  else
+    resume_connection (connection);
+  if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+}
+
+
+/**
+ * Suspend a connection whose content reader returned
+ * #MHD_CONTENT_READER_PENDING until the application calls
+ * #MHD_response_data_ready(), unless it did so already.
+ *
+ * @param connection the connection waiting for body data
+ */
+void
+MHD_connection_wait_for_data_ (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+
+  if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  if (MHD_YES == connection->data_ready)
+    {
+      /* data arrived while the reader was returning */
+      connection->data_ready = MHD_NO;
+    }
+  else if (MHD_PREFETCH_DONE != connection->prefetch_state)
+    {
+      suspend_connection (connection);
+      connection->waiting_for_data = MHD_YES;
+    }
+  if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+}
+
+
+/**
+ * Signal that the content reader of the response queued on
+ * @a connection, which returned #MHD_CONTENT_READER_PENDING, has data
+ * available now.  MHD calls the content reader again soon.  Can be
+ * called from any thread, also before the content reader returned;
+ * calling it while MHD is not waiting for data only causes one more
+ * call of the content reader.
+ *
+ * @param connection the connection the response is sent on
+ * @ingroup response
+ */
+void
+MHD_response_data_ready (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+
+  if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  if (MHD_YES == connection->waiting_for_data)
+    {
+      connection->waiting_for_data = MHD_NO;
+      resume_connection (connection);
+    }
+  else
+    {
+      connection->data_ready = MHD_YES;
+    }
+  if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+}
+
+
+/**
+ * Stop reading the upload of the request on @a connection until
+ * #MHD_resume_upload() is called.  The data passed in the current
+ * call that is not consumed stays in the read buffer and is passed
+ * again after the upload was resumed.  Only has an effect with
+ * #MHD_USE_SUSPEND_RESUME and if called from the
+ * #MHD_AccessHandlerCallback while it processes upload data.
+ *
+ * While paused, the socket is not watched, so the kernel's receive
+ * window throttles the client instead of MHD waking up for data it
+ * cannot use; like suspended connections, the connection does not
+ * time out meanwhile.
+ *
+ * @param connection the connection receiving the upload
+ */
+void
+MHD_pause_upload (struct MHD_Connection *connection)
+{
+  /* without the pipe, nobody could wake us up again */
+  if (0 != (connection->daemon->options & MHD_USE_SUSPEND_RESUME))
+    connection->upload_paused = MHD_YES;
+}
+
+
+/**
+ * Continue reading the upload of a connection paused with
+ * #MHD_pause_upload().  Can be called from any thread, also before
+ * the access handler that paused the upload returned.
+ *
+ * @param connection the connection receiving the upload
+ */
+void
+MHD_resume_upload (struct MHD_Connection *connection)
+{
+  /* the same wakeup as for a response waiting for data */
+  MHD_response_data_ready (connection);
+}
+
+
+/**
+ * Answer the request on @a connection asynchronously: the
+ * #MHD_AccessHandlerCallback calls this function and returns
+ * #MHD_YES right away, and the application later passes the
+ * response to #MHD_complete_response(), from any thread.  The
+ * connection is suspended meanwhile; the event loop queues the
+ * response without calling the access handler again.
+ *
+ * @param connection the connection of the request
+ * @return #MHD_YES on success, #MHD_NO if the request cannot be
+ *         deferred (for example, because a response is queued)
+ */
+int
+MHD_defer_response (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+
+  if ( (MHD_USE_SUSPEND_RESUME != (daemon->options & MHD_USE_SUSPEND_RESUME)) ||
+       (NULL != connection->response) ||
+       (NULL != connection->h2_stream) ||
+       (MHD_DEFER_NONE != connection->deferred) )
+    return MHD_NO;
+  /* the handler must not be called for upload data meanwhile */
+  if ( (MHD_CONNECTION_FOOTERS_RECEIVED != connection->state) &&
+       ( (MHD_CONNECTION_HEADERS_PROCESSED != connection->state) ||
+         (0 != connection->remaining_upload_size) ) )
+    return MHD_NO;
+  /* published to other threads with the suspension below, before
+     the application can pass on the connection */
+  connection->deferred = MHD_DEFER_WAITING;
+  MHD_suspend_connection (connection);
+  return MHD_YES;
+}
+
+
+/**
+ * Complete a request deferred with #MHD_defer_response() by queueing
+ * @a response for it.  Can be called from any thread, also before the
+ * access handler that deferred the request returned.  Does not lock
+ * if #HAVE_ATOMIC_BUILTINS, unless #MHD_OPTION_HANDLER_THREADS is
+ * used.
+ *
+ * @param connection the connection of the deferred request
+ * @param status_code HTTP status code (i.e. #MHD_HTTP_OK)
+ * @param response response to transmit, MHD keeps a reference
+ * @return #MHD_YES on success, #MHD_NO if the request was not
+ *         deferred or was completed already
+ */
+int
+MHD_complete_response (struct MHD_Connection *connection,
+                       unsigned int status_code,
+                       struct MHD_Response *response)
+{
+#ifdef HAVE_ATOMIC_BUILTINS
+  enum MHD_DeferState expected;
+#else
+  struct MHD_Daemon *daemon;
+#endif
+
+  if ( (NULL == connection) ||
+       (NULL == response) )
+    return MHD_NO;
+  /* claim the request, so that only one caller stores a response */
+#ifdef HAVE_ATOMIC_BUILTINS
+  expected = MHD_DEFER_WAITING;
+  if (! __atomic_compare_exchange_n (&connection->deferred,
+                                     &expected,
+                                     MHD_DEFER_COMPLETING,
+                                     0,
+                                     __ATOMIC_ACQUIRE,
+                                     __ATOMIC_RELAXED))
+    return MHD_NO;
+#else
+  daemon = connection->daemon;
+  if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  if (MHD_DEFER_WAITING != connection->deferred)
+    {
+      if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+        MHD_PANIC ("Failed to release cleanup mutex\n");
+      return MHD_NO;
+    }
+  connection->deferred = MHD_DEFER_COMPLETING;
+  if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+#endif
+  MHD_increment_response_rc (response);
+  connection->deferred_response = response;
+  connection->deferred_status = status_code;
+  /* the connection stays suspended until resumed below, so it
+     cannot go away before */
+#ifdef HAVE_ATOMIC_BUILTINS
+  __atomic_store_n (&connection->deferred,
+                    MHD_DEFER_COMPLETE,
+                    __ATOMIC_RELEASE);
+#else
+  if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  connection->deferred = MHD_DEFER_COMPLETE;
+  if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+#endif
+  MHD_resume_connection (connection);
+  return MHD_YES;
+}
+
+
+/**
+ * Call #MHD_response_data_ready() for all connections in the list
+ * @a head (linked by @e bc_next), locking the cleanup mutex and
+ * waking up the event loop only once per daemon.
+ *
+ * @param head first connection of the list, may be NULL
+ */
+void
+MHD_connections_data_ready_ (struct MHD_Connection *head)
+{
+  struct MHD_Daemon *daemon;
+  struct MHD_Connection *pos;
+  struct MHD_Connection *next;
+  struct MHD_Connection *rest;
+  struct MHD_Connection **rest_tail;
+  int woken;
+
+  while (NULL != head)
+    {
+      /* handle the connections of the daemon of the first one, leave
+         the others in order for the next round */
+      daemon = head->daemon;
+      rest = NULL;
+      rest_tail = &rest;
+      woken = MHD_NO;
+      if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+        MHD_PANIC ("Failed to acquire cleanup mutex\n");
+      for (pos = head; NULL != pos; pos = next)
+        {
+          /* once woken up, the connection may wait again */
+          next = pos->bc_next;
+          if (daemon != pos->daemon)
+            {
+              pos->bc_next = NULL;
+              *rest_tail = pos;
+              rest_tail = &pos->bc_next;
+              continue;
+            }
+          if (MHD_YES == pos->waiting_for_data)
+            {
+              pos->waiting_for_data = MHD_NO;
+              queue_resume (pos);
+              woken = MHD_YES;
+            }
+          else
+            {
+              pos->data_ready = MHD_YES;
+            }
+        }
+      if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+        MHD_PANIC ("Failed to release cleanup mutex\n");
+      if ( (MHD_YES == woken) &&
+           (MHD_YES != MHD_daemon_wakeup_ (daemon)) )
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "failed to signal resume via pipe");
+#endif
+        }
+      head = rest;
+    }
+}
+
+
+/**
+ * Move the connections that were resumed since the last call back
+ * to the active state.  Only the list of resumed connections is
+ * visited, so the cost does not depend on the number of connections
+ * that remain suspended.
+ *
+ * @param daemon daemon context
+ * @return #MHD_YES if a connection was actually resumed
+ */
+static int
+resume_suspended_connections (struct MHD_Daemon *daemon)
+{
+  struct MHD_Connection *pos;
+  int ret;
+
+  ret = MHD_NO;
+#ifdef HAVE_ATOMIC_BUILTINS
+  if (MHD_NO == __atomic_load_n (&daemon->resuming,
+                                 __ATOMIC_ACQUIRE))
+    return MHD_NO; /* fast path, a resume also signals the pipe */
+  /* clear before taking the queue, a later resume sets it again */
+  __atomic_store_n (&daemon->resuming,
+                    MHD_NO,
+                    __ATOMIC_RELAXED);
+#else
+  if (MHD_NO == daemon->resuming)
+    return MHD_NO; /* fast path, a resume also signals the pipe */
+#endif
+  if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  MHD_collect_resumed_connections_ (daemon);
+  daemon->socket_resumed_head = NULL;
+  while (NULL != (pos = daemon->resumed_connections_head))
+    {
+      ret = MHD_YES;
+      DLL_remove (daemon->resumed_connections_head,
+                  daemon->resumed_connections_tail,
+                  pos);
+      DLL_insert (daemon->connections_head,
+                  daemon->connections_tail,
+                  pos);
+      if (NULL != daemon->notify_socket)
+        {
+          /* processed by MHD_run_socket() */
+          pos->resumed_next = daemon->socket_resumed_head;
+          daemon->socket_resumed_head = pos;
+        }
+      MHD_connection_timeout_insert_ (pos);
+      /* the deadline of MHD_suspend_connection_with_timeout() */
+      MHD_connection_guard_remove_ (pos);
+#ifdef HAVE_POLL
+      poll_set_insert (pos);
+#endif
+#ifdef MHD_POSIX_SOCKETS
+      /* the fd sets never shrink, so they still cover the socket */
+      fd_sets_insert (pos);
+#endif
+#if HTTPS_SUPPORT
+      if (MHD_YES == pos->tls_read_ready)
+        tls_ready_insert (pos);
+#endif
+#if MHD_EREADY_SUPPORT
+      if (0 != (daemon->options & (MHD_USE_EPOLL_LINUX_ONLY | MHD_USE_KQUEUE)))
+        {
+          if (0 != (pos->epoll_state & MHD_EPOLL_STATE_IN_EREADY_EDLL))
+            MHD_PANIC ("Resumed connection was already in EREADY set\n");
+          /* we always mark resumed connections as ready, as we
+             might have missed the edge poll event during suspension */
+          EDLL_insert (daemon->eready_head,
+                       daemon->eready_tail,
+                       pos);
+          pos->epoll_state |= MHD_EPOLL_STATE_IN_EREADY_EDLL;
+          pos->epoll_state &= ~MHD_EPOLL_STATE_SUSPENDED;
+        }
+#endif
+      pos->suspended = MHD_NO;
+      MHD_STATS_SUB_ (daemon, suspended, 1);
+      MHD_PROBE1 (resume, pos);
+#ifdef HAVE_ATOMIC_BUILTINS
+      __atomic_store_n (&pos->resuming,
+                        MHD_NO,
+                        __ATOMIC_RELEASE);
+#else
+      pos->resuming = MHD_NO;
+#endif
+      if (NULL != pos->h2)
+        MHD_http2_resume_streams_ (pos);
+    }
+  /* HTTP/2 connections with resumed streams */
+  while (NULL != (pos = daemon->h2_wake_head))
+    {
+      daemon->h2_wake_head = pos->h2_wake_next;
+      pos->h2_wake_next = NULL;
+      pos->h2_woken = MHD_NO;
+      MHD_http2_resume_streams_ (pos);
+      ret = MHD_YES;
+      if (NULL != daemon->notify_socket)
+        {
+          pos->resumed_next = daemon->socket_resumed_head;
+          daemon->socket_resumed_head = pos;
+        }
+#if MHD_EREADY_SUPPORT
+      if ( (0 != (daemon->options & (MHD_USE_EPOLL_LINUX_ONLY | MHD_USE_KQUEUE))) &&
+           (0 == (pos->epoll_state & MHD_EPOLL_STATE_IN_EREADY_EDLL)) )
+        {
+          EDLL_insert (daemon->eready_head,
+                       daemon->eready_tail,
+                       pos);
+          pos->epoll_state |= MHD_EPOLL_STATE_IN_EREADY_EDLL;
+        }
+#endif
+    }
+#ifndef HAVE_ATOMIC_BUILTINS
+  daemon->resuming = MHD_NO;
+#endif
+  if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+  return ret;
+}
+
+
+#ifdef HAVE_POLL
+/**
+ * A thread running the access handler (see
+ * #MHD_OPTION_HANDLER_THREADS).
+ */
+struct MHD_HandlerThread
+{
+  /**
+   * Handle of the thread.
+   */
+  MHD_thread_handle_ pid;
+
+  /**
+   * Pipe to wake up the thread with.
+   */
+  MHD_pipe wpipe[2];
+
+  /**
+   * Pool the thread belongs to.
+   */
+  struct MHD_HandlerPool *pool;
+
+  /**
+   * Next thread in the list of idle threads of the pool.
+   */
+  struct MHD_HandlerThread *idle_next;
+
+  /**
+   * #MHD_YES if the thread is in the list of idle threads.
+   */
+  int idle;
+};
+#endif
+
+
+/**
+ * Threads running the access handler for a daemon and its worker
+ * daemons.  The threads take the connections from a common queue,
+ * so that a slow handler only keeps its own thread busy.
+ */
+struct MHD_HandlerPool
+{
+  /**
+   * Protects @e queue_head, @e queue_tail, @e prefetch_head,
+   * @e prefetch_tail, @e idle and @e shutdown.
+   */
+  MHD_mutex_ mutex;
+
+#ifdef HAVE_POLL
+  /**
+   * Array of @e num_threads threads.
+   */
+  struct MHD_HandlerThread *threads;
+#endif
+
+  /**
+   * Number of threads in @e threads.
+   */
+  unsigned int num_threads;
+
+  /**
+   * Head of the queue of connections waiting for a thread, linked
+   * by their 'handler_next' field.
+   */
+  struct MHD_Connection *queue_head;
+
+  /**
+   * Tail of the queue of connections waiting for a thread.
+   */
+  struct MHD_Connection *queue_tail;
+
+  /**
+   * Head of the queue of connections with a block of the body to
+   * read ahead (see #MHD_RF_PREFETCH), linked by their
+   * 'prefetch_next' field.  Served after @e queue_head.
+   */
+  struct MHD_Connection *prefetch_head;
+
+  /**
+   * Tail of the queue of connections with a block to read ahead.
+   */
+  struct MHD_Connection *prefetch_tail;
+
+#ifdef HAVE_POLL
+  /**
+   * Threads waiting for connections, linked by @e idle_next.
+   */
+  struct MHD_HandlerThread *idle;
+#endif
+
+  /**
+   * #MHD_YES if the threads must terminate once the queue is empty;
+   * connections are no longer accepted then.
+   */
+  int shutdown;
+
+  /**
+   * Daemon owning the threads (for logging).
+   */
+  struct MHD_Daemon *daemon;
+};
+
+
+/**
+ * Run the step of the request processing of a connection that was
+ * handed to the handler threads, and hand the connection back to its
+ * daemon.
+ *
+ * @param connection the connection
+ */
+static void
+run_offloaded_step (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+
+  connection->handler_next = NULL;
+  /* the connection may have timed out meanwhile */
+  if (MHD_CONNECTION_CLOSED != connection->state)
+    connection->handler_step (connection);
+  connection->handler_step_done = MHD_YES;
+  if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  connection->handler_offloaded = MHD_NO;
+  if (MHD_YES == connection->handler_suspended)
+    connection->handler_suspended = MHD_NO; /* resumed by the application */
+  else
+    resume_connection (connection);
+  if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+}
+
+
+#ifdef HAVE_POLL
+/**
+ * Call the content reader for the block of the body of a connection
+ * to read ahead (see #MHD_RF_PREFETCH), then hand the block back to
+ * the event loop of the connection.
+ *
+ * @param connection the connection
+ */
+static void
+run_prefetch (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+  struct MHD_Response *response = connection->response;
+  ssize_t ret;
+  int resumed;
+
+  connection->prefetch_next = NULL;
+  /* the event loop neither calls the reader nor touches the buffer
+     meanwhile, and no other connection uses the response */
+  ret = response->crc (response->crc_cls,
+                       connection->prefetch_pos,
+                       connection->prefetch_buf,
+                       connection->prefetch_buf_size);
+  connection->prefetch_ret = ret;
+  resumed = MHD_NO;
+  if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  if (MHD_YES == connection->waiting_for_data)
+    {
+      connection->waiting_for_data = MHD_NO;
+      resume_connection (connection);
+      resumed = MHD_YES;
+    }
+  /* last access to the connection, which may be cleaned up as soon
+     as it is done (see MHD_prefetch_busy_()) */
+#ifdef HAVE_ATOMIC_BUILTINS
+  __atomic_store_n (&connection->prefetch_state,
+                    MHD_PREFETCH_DONE,
+                    __ATOMIC_RELEASE);
+#else
+  connection->prefetch_state = MHD_PREFETCH_DONE;
+#endif
+  if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+  /* a closed connection may wait for its cleanup */
+  if (MHD_NO == resumed)
+    (void) MHD_daemon_wakeup_ (daemon);
+}
+
+
+/**
+ * Main function of a handler thread: run the steps of the
+ * connections in the queue of the pool (and read ahead the blocks
+ * in its prefetch queue), until the daemon shuts down and the
+ * queues are empty.
+ *
+ * @param cls the `struct MHD_HandlerThread`
+ * @return always 0 (on shutdown)
+ */
+static MHD_THRD_RTRN_TYPE_ MHD_THRD_CALL_SPEC_
+MHD_handler_thread (void *cls)
+{
+  struct MHD_HandlerThread *ht = cls;
+  struct MHD_HandlerPool *pool = ht->pool;
+  struct MHD_HandlerThread **prev;
+  struct MHD_Connection *pos;
+  struct MHD_Connection *prefetch;
+  struct pollfd p;
+
+  while (1)
+    {
+      if (MHD_YES != MHD_mutex_lock_ (&pool->mutex))
+        MHD_PANIC ("Failed to acquire handler thread mutex\n");
+      pos = pool->queue_head;
+      prefetch = NULL;
+      if (NULL != pos)
+        {
+          pool->queue_head = pos->handler_next;
+          if (NULL == pool->queue_head)
+            pool->queue_tail = NULL;
+        }
+      else if (NULL != (prefetch = pool->prefetch_head))
+        {
+          pool->prefetch_head = prefetch->prefetch_next;
+          if (NULL == pool->prefetch_head)
+            pool->prefetch_tail = NULL;
+        }
+      if ( (NULL != pos) ||
+           (NULL != prefetch) )
+        {
+          if (MHD_YES == ht->idle)
+            {
+              /* woken up by something else, do not take a wakeup
+                 meant for an idle thread */
+              for (prev = &pool->idle; ht != *prev; prev = &(*prev)->idle_next) ;
+              *prev = ht->idle_next;
+              ht->idle = MHD_NO;
+            }
+        }
+      else if (MHD_YES == pool->shutdown)
+        {
+          if (MHD_YES != MHD_mutex_unlock_ (&pool->mutex))
+            MHD_PANIC ("Failed to release handler thread mutex\n");
+          break;
+        }
+      else if (MHD_NO == ht->idle)
+        {
+          ht->idle_next = pool->idle;
+          pool->idle = ht;
+          ht->idle = MHD_YES;
+        }
+      if (MHD_YES != MHD_mutex_unlock_ (&pool->mutex))
+        MHD_PANIC ("Failed to release handler thread mutex\n");
+      if (NULL != pos)
+        {
+          run_offloaded_step (pos);
+          continue;
+        }
+      if (NULL != prefetch)
+        {
+          run_prefetch (prefetch);
+          continue;
+        }
+      p.fd = ht->wpipe[0];
+      p.events = POLLIN;
+      p.revents = 0;
+      if (MHD_sys_poll_ (&p, 1, -1) < 0)
+        {
+          if (EINTR == MHD_socket_errno_)
+            continue;
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (pool->daemon,
+                    "poll failed: %s\n",
+                    MHD_socket_last_strerr_ ());
+#endif
+          continue;
+        }
+      if (0 != (p.revents & POLLIN))
+        MHD_itc_clear_ (ht->wpipe[0]);
+    }
+  return (MHD_THRD_RTRN_TYPE_) 0;
+}
+#endif
+
+
+/**
+ * Suspend a connection and hand a step of its request processing to
+ * the handler threads of the daemon (see #MHD_OPTION_HANDLER_THREADS).
+ * The connection is only queued here; submit_handler_steps() passes
+ * it to the threads once the event loop is done with it.
+ *
+ * @param connection the connection to run @a step for
+ * @param step the step to run
+ * @return #MHD_YES if the step was handed to the handler threads,
+ *         #MHD_NO if it must be run by the caller
+ */
+int
+MHD_handler_offload_ (struct MHD_Connection *connection,
+                      MHD_HandlerStep step)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+
+  if (NULL == daemon->handler_pool)
+    return MHD_NO;
+  if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  suspend_connection (connection);
+  connection->handler_offloaded = MHD_YES;
+  if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+  connection->handler_step = step;
+  connection->handler_next = daemon->handler_pending;
+  daemon->handler_pending = connection;
+  return MHD_YES;
+}
+
+
+/**
+ * Let a handler thread of the daemon call the content reader for the
+ * block at @e prefetch_pos of the connection (see #MHD_RF_PREFETCH).
+ * Once the block is read, @e prefetch_state becomes
+ * #MHD_PREFETCH_DONE and the connection is resumed if it waits for
+ * data (see MHD_connection_wait_for_data_()).
+ *
+ * @param connection the connection, with @e prefetch_buf and
+ *        @e prefetch_pos set
+ * @return #MHD_YES if a handler thread will read the block,
+ *         #MHD_NO if the daemon has no (more) handler threads
+ */
+int
+MHD_prefetch_submit_ (struct MHD_Connection *connection)
+{
+  struct MHD_HandlerPool *pool = connection->daemon->handler_pool;
+#ifdef HAVE_POLL
+  struct MHD_HandlerThread *ht;
+#endif
+
+  if (NULL == pool)
+    return MHD_NO;
+  if (MHD_YES != MHD_mutex_lock_ (&pool->mutex))
+    MHD_PANIC ("Failed to acquire handler thread mutex\n");
+  if (MHD_YES == pool->shutdown)
+    {
+      if (MHD_YES != MHD_mutex_unlock_ (&pool->mutex))
+        MHD_PANIC ("Failed to release handler thread mutex\n");
+      return MHD_NO;
+    }
+  /* only the event loop of the connection changes the state from
+     idle, no need for the cleanup mutex */
+  connection->prefetch_state = MHD_PREFETCH_BUSY;
+  connection->prefetch_next = NULL;
+  if (NULL == pool->prefetch_tail)
+    pool->prefetch_head = connection;
+  else
+    pool->prefetch_tail->prefetch_next = connection;
+  pool->prefetch_tail = connection;
+#ifdef HAVE_POLL
+  if (NULL != (ht = pool->idle))
+    {
+      pool->idle = ht->idle_next;
+      ht->idle = MHD_NO;
+      if (MHD_YES != MHD_itc_activate_ (ht->wpipe[1]))
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (connection->daemon,
+                    "failed to signal handler thread via pipe");
+#endif
+        }
+    }
+#endif
+  if (MHD_YES != MHD_mutex_unlock_ (&pool->mutex))
+    MHD_PANIC ("Failed to release handler thread mutex\n");
+  return MHD_YES;
+}
+
+
+/**
+ * Check if a handler thread still reads ahead a block of the body
+ * of a closed connection into its memory pool (see #MHD_RF_PREFETCH);
+ * neither the response nor the pool may be released before it is
+ * done.
+ *
+ * @param connection the closed connection
+ * @return #MHD_YES if the connection is still in use
+ */
+int
+MHD_prefetch_busy_ (struct MHD_Connection *connection)
+{
+  enum MHD_PrefetchState state;
+
+#ifdef HAVE_ATOMIC_BUILTINS
+  state = __atomic_load_n (&connection->prefetch_state,
+                           __ATOMIC_ACQUIRE);
+#else
+  state = connection->prefetch_state;
+#endif
+  return (MHD_PREFETCH_BUSY == state) ? MHD_YES : MHD_NO;
+}
+
+
+/**
+ * Pass the connections suspended for the handler threads in this
+ * round of the event loop to the threads.  Called by the event loop
+ * before it waits for events.  After the threads were stopped, the
+ * steps are run right here.
+ *
+ * @param daemon daemon context
+ */
+static void
+submit_handler_steps (struct MHD_Daemon *daemon)
+{
+  struct MHD_HandlerPool *pool = daemon->handler_pool;
+  struct MHD_Connection *head;
+  struct MHD_Connection *pos;
+  struct MHD_Connection *next;
+#ifdef HAVE_POLL
+  struct MHD_HandlerThread *ht;
+#endif
+
+  if (NULL == daemon->handler_pending)
+    return;
+  /* restore the order in which the connections were suspended */
+  head = NULL;
+  for (pos = daemon->handler_pending; NULL != pos; pos = next)
+    {
+      next = pos->handler_next;
+      pos->handler_next = head;
+      head = pos;
+    }
+  daemon->handler_pending = NULL;
+  if (MHD_YES != MHD_mutex_lock_ (&pool->mutex))
+    MHD_PANIC ("Failed to acquire handler thread mutex\n");
+  if (MHD_YES == pool->shutdown)
+    {
+      if (MHD_YES != MHD_mutex_unlock_ (&pool->mutex))
+        MHD_PANIC ("Failed to release handler thread mutex\n");
+      while (NULL != (pos = head))
+        {
+          head = pos->handler_next;
+          run_offloaded_step (pos);
+        }
+      return;
+    }
+  for (pos = head; NULL != pos; pos = pos->handler_next)
+    {
+      if (NULL == pool->queue_tail)
+        pool->queue_head = pos;
+      else
+        pool->queue_tail->handler_next = pos;
+      pool->queue_tail = pos;
+#ifdef HAVE_POLL
+      /* wake up one idle thread per connection */
+      if (NULL != (ht = pool->idle))
+        {
+          pool->idle = ht->idle_next;
+          ht->idle = MHD_NO;
+          if (MHD_YES != MHD_itc_activate_ (ht->wpipe[1]))
+            {
+#ifdef HAVE_MESSAGES
+              MHD_DLOG (daemon,
+                        "failed to signal handler thread via pipe");
+#endif
+            }
+        }
+#endif
+    }
+  if (MHD_YES != MHD_mutex_unlock_ (&pool->mutex))
+    MHD_PANIC ("Failed to release handler thread mutex\n");
+}
+
+
+#if HTTPS_SUPPORT
+#ifdef HAVE_POLL
+/**
+ * A thread running TLS handshakes (see
+ * #MHD_OPTION_HTTPS_HANDSHAKE_THREADS).
+ */
+struct MHD_HandshakeThread
+{
+  /**
+   * Handle of the thread.
+   */
+  MHD_thread_handle_ pid;
+
+  /**
+   * Protects @e queue_head and @e shutdown.
+   */
+  MHD_mutex_ mutex;
+
+  /**
+   * Pipe to wake up the thread with.
+   */
+  MHD_pipe wpipe[2];
+
+  /**
+   * Connections submitted to the thread that it did not pick up
+   * yet, linked by their 'handshake_next' field.
+   */
+  struct MHD_Connection *queue_head;
+
+  /**
+   * Daemon owning the thread (for logging).
+   */
+  struct MHD_Daemon *daemon;
+
+  /**
+   * #MHD_YES if the thread must terminate (or did so); connections
+   * are no longer accepted then.
+   */
+  int shutdown;
+};
+
+
+/**
+ * Threads running TLS handshakes of a daemon and its worker daemons.
+ */
+struct MHD_HandshakePool
+{
+  /**
+   * Array of @e num_threads threads.
+   */
+  struct MHD_HandshakeThread *threads;
+
+  /**
+   * Number of threads in @e threads.
+   */
+  unsigned int num_threads;
+};
+
+
+/**
+ * Hand a connection back to its daemon after its handshake thread
+ * is done with it.
+ *
+ * @param connection the connection
+ * @param done #MHD_YES if @a result is the result of the handshake,
+ *             #MHD_NO if the thread did not complete the handshake
+ * @param result result of #MHD_tls_handshake_()
+ */
+static void
+finish_offloaded_handshake (struct MHD_Connection *connection,
+                            int done,
+                            int result)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+
+  connection->handshake_next = NULL;
+  connection->tls_handshake_done = done;
+  connection->tls_handshake_result = result;
+  connection->last_activity = MHD_monotonic_msec_counter ();
+  if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  resume_connection (connection);
+  if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+}
+
+
+/**
+ * Main function of a handshake thread: poll() the sockets of the
+ * connections submitted to it and advance their handshakes, until
+ * the daemon shuts down.
+ *
+ * @param cls the `struct MHD_HandshakeThread`
+ * @return always 0 (on shutdown)
+ */
+static MHD_THRD_RTRN_TYPE_ MHD_THRD_CALL_SPEC_
+MHD_handshake_thread (void *cls)
+{
+  struct MHD_HandshakeThread *ht = cls;
+  struct MHD_Connection *active;
+  struct MHD_Connection *pos;
+  struct MHD_Connection *next;
+  struct MHD_Connection **prev;
+  struct pollfd *p;
+  struct pollfd *np;
+  unsigned int num;
+  unsigned int alloc;
+  unsigned int i;
+  uint64_t now;
+  uint64_t left;
+  int timeout;
+  int ret;
+
+  active = NULL;
+  p = NULL;
+  alloc = 0;
+  while (1)
+    {
+      if (MHD_YES != MHD_mutex_lock_ (&ht->mutex))
+        MHD_PANIC ("Failed to acquire handshake thread mutex\n");
+      if (MHD_YES == ht->shutdown)
+        {
+          if (MHD_YES != MHD_mutex_unlock_ (&ht->mutex))
+            MHD_PANIC ("Failed to release handshake thread mutex\n");
+          break;
+        }
+      while (NULL != (pos = ht->queue_head))
+        {
+          ht->queue_head = pos->handshake_next;
+          pos->handshake_next = active;
+          active = pos;
+        }
+      if (MHD_YES != MHD_mutex_unlock_ (&ht->mutex))
+        MHD_PANIC ("Failed to release handshake thread mutex\n");
+
+      num = 1;
+      for (pos = active; NULL != pos; pos = pos->handshake_next)
+        num++;
+      if (num > alloc)
+        {
+          np = realloc (p, num * sizeof (struct pollfd));
+          if (NULL == np)
+            {
+#ifdef HAVE_MESSAGES
+              MHD_DLOG (ht->daemon,
+                        "Error allocating memory: %s\n",
+                        MHD_strerror_ (errno));
+#endif
+              break;
+            }
+          p = np;
+          alloc = num;
+        }
+      p[0].fd = ht->wpipe[0];
+      p[0].events = POLLIN;
+      p[0].revents = 0;
+      timeout = -1;
+      now = MHD_monotonic_msec_counter ();
+      i = 1;
+      for (pos = active; NULL != pos; pos = pos->handshake_next)
+        {
+          p[i].fd = pos->socket_fd;
+          p[i].events = (MHD_YES == MHD_tls_wants_write_ (pos))
+            ? POLLOUT
+            : POLLIN;
+          p[i].revents = 0;
+          if (0 != pos->connection_timeout)
+            {
+              if (pos->last_activity + pos->connection_timeout <= now)
+                left = 0;
+              else
+                left = pos->last_activity + pos->connection_timeout - now;
+              if (left > INT_MAX)
+                left = INT_MAX;
+              if ( (-1 == timeout) ||
+                   (left < (uint64_t) timeout) )
+                timeout = (int) left;
+            }
+          i++;
+        }
+      if (MHD_sys_poll_ (p, num, timeout) < 0)
+        {
+          if (EINTR == MHD_socket_errno_)
+            continue;
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (ht->daemon,
+                    "poll failed: %s\n",
+                    MHD_socket_last_strerr_ ());
+#endif
+          break;
+        }
+      if (0 != (p[0].revents & POLLIN))
+        MHD_itc_clear_ (ht->wpipe[0]);
+      now = MHD_monotonic_msec_counter ();
+      prev = &active;
+      i = 1;
+      for (pos = active; NULL != pos; pos = next)
+        {
+          next = pos->handshake_next;
+          if (0 != p[i++].revents)
+            {
+              ret = MHD_tls_handshake_ (pos);
+              if (MHD_TLS_AGAIN == ret)
+                {
+                  pos->last_activity = now;
+                  prev = &pos->handshake_next;
+                  continue;
+                }
+            }
+          else if ( (0 != pos->connection_timeout) &&
+                    (pos->last_activity + pos->connection_timeout <= now) )
+            {
+              ret = MHD_TLS_TIMEDOUT;
+            }
+          else
+            {
+              prev = &pos->handshake_next;
+              continue;
+            }
+          *prev = next;
+          finish_offloaded_handshake (pos,
+                                      MHD_YES,
+                                      ret);
+        }
+    }
+  free (p);
+
+  /* do not accept new connections and hand back those we have,
+     their daemons complete the handshakes themselves */
+  if (MHD_YES != MHD_mutex_lock_ (&ht->mutex))
+    MHD_PANIC ("Failed to acquire handshake thread mutex\n");
+  ht->shutdown = MHD_YES;
+  while (NULL != (pos = ht->queue_head))
+    {
+      ht->queue_head = pos->handshake_next;
+      pos->handshake_next = active;
+      active = pos;
+    }
+  if (MHD_YES != MHD_mutex_unlock_ (&ht->mutex))
+    MHD_PANIC ("Failed to release handshake thread mutex\n");
+  while (NULL != (pos = active))
+    {
+      active = pos->handshake_next;
+      finish_offloaded_handshake (pos,
+                                  MHD_NO,
+                                  MHD_TLS_OK);
+    }
+  return (MHD_THRD_RTRN_TYPE_) 0;
+}
+#endif
+
+
+/**
+ * Suspend a connection in #MHD_TLS_CONNECTION_INIT and hand its TLS
+ * handshake to one of the handshake threads of the daemon.
+ *
+ * @param connection the connection to run the handshake for
+ * @return #MHD_YES if a handshake thread took the connection,
+ *         #MHD_NO if the handshake must be run by the caller
+ */
+int
+MHD_tls_handshake_offload_ (struct MHD_Connection *connection)
+{
+#ifdef HAVE_POLL
+  struct MHD_Daemon *daemon = connection->daemon;
+  struct MHD_HandshakePool *pool = daemon->handshake_pool;
+  struct MHD_HandshakeThread *ht;
+
+  if (NULL == pool)
+    return MHD_NO;
+  ht = &pool->threads[(unsigned int) connection->socket_fd % pool->num_threads];
+  if (MHD_YES != MHD_mutex_lock_ (&ht->mutex))
+    MHD_PANIC ("Failed to acquire handshake thread mutex\n");
+  if (MHD_YES == ht->shutdown)
+    {
+      if (MHD_YES != MHD_mutex_unlock_ (&ht->mutex))
+        MHD_PANIC ("Failed to release handshake thread mutex\n");
+      return MHD_NO;
+    }
+  if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  suspend_connection (connection);
+  if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+  connection->tls_handshake_offloaded = MHD_YES;
+  connection->tls_handshake_done = MHD_NO;
+  connection->handshake_next = ht->queue_head;
+  ht->queue_head = connection;
+  /* signal while holding the mutex, the pipe is closed after
+     shutdown */
+  if (MHD_YES != MHD_itc_activate_ (ht->wpipe[1]))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "failed to signal handshake thread via pipe");
+#endif
+    }
+  if (MHD_YES != MHD_mutex_unlock_ (&ht->mutex))
+    MHD_PANIC ("Failed to release handshake thread mutex\n");
+  return MHD_YES;
+#else
+  return MHD_NO;
+#endif
+}
+#endif
+
+
+/**
+ * Change socket options to be non-blocking, non-inheritable.
+ *
+ * @param daemon daemon context
+ * @param sock socket to manipulate
+ */
+static void
+make_nonblocking_noninheritable (struct MHD_Daemon *daemon,
+				 MHD_socket sock)
+{
+#ifdef MHD_WINSOCK_SOCKETS
+  DWORD dwFlags;
+  unsigned long flags = 1;
+
+  if (0 != ioctlsocket (sock, FIONBIO, &flags))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+		"Failed to make socket non-blocking: %s\n",
+		MHD_socket_last_strerr_ ());
+#endif
+    }
+  if (!GetHandleInformation ((HANDLE) sock, &dwFlags) ||
+      ((dwFlags != (dwFlags & ~HANDLE_FLAG_INHERIT)) &&
+       !SetHandleInformation ((HANDLE) sock, HANDLE_FLAG_INHERIT, 0)))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+		"Failed to make socket non-inheritable: %u\n",
+		(unsigned int) GetLastError ());
+#endif
+    }
+#else
+  int flags;
+  int nonblock;
+
+  nonblock = O_NONBLOCK;
+#ifdef CYGWIN
+  if (0 == (daemon->options & MHD_USE_SSL))
+    nonblock = 0;
+#endif
+  flags = fcntl (sock, F_GETFD);
+  if ( ( (-1 == flags) ||
+	 ( (flags != (flags | FD_CLOEXEC)) &&
+	   (0 != fcntl (sock, F_SETFD, flags | nonblock | FD_CLOEXEC)) ) ) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+		"Failed to make socket non-inheritable: %s\n",
+		MHD_socket_last_strerr_ ());
+#endif
+    }
+#endif
+}
+
+
+/**
+ * Add another client connection to the set of connections managed by
+ * MHD.  This API is usually not needed (since MHD will accept inbound
+ * connections on the server socket).  Use this API in special cases,
+ * for example if your HTTP server is behind NAT and needs to connect
+ * out to the HTTP client, or if you are building a proxy.
+ *
+ * If you use this API in conjunction with a internal select or a
+ * thread pool, you must set the option
+ * #MHD_USE_PIPE_FOR_SHUTDOWN to ensure that the freshly added
+ * connection is immediately processed by MHD.
+ *
+ * The given client socket will be managed (and closed!) by MHD after
+ * this call and must no longer be used directly by the application
+ * afterwards.
+ *
+ * Per-IP connection limits are ignored when using this API.
+ *
+ * @param daemon daemon that manages the connection
+ * @param client_socket socket to manage (MHD will expect
+ *        to receive an HTTP request from this socket next).
+ * @param addr IP address of the client
+ * @param addrlen number of bytes in @a addr
+ * @return #MHD_YES on success, #MHD_NO if this daemon could
+ *        not handle the connection (i.e. malloc() failed, etc).
+ *        The socket will be closed in any case; `errno` is
+ *        set to indicate further details about the error.
+ * @ingroup specialized
+ */
+int
+MHD_add_connection (struct MHD_Daemon *daemon,
+		    MHD_socket client_socket,
+		    const struct sockaddr *addr,
+		    socklen_t addrlen)
+{
+#if IO_URING_SUPPORT
+  if (MHD_USE_IO_URING_LINUX_ONLY == (daemon->options & MHD_USE_IO_URING_LINUX_ONLY))
+    {
+      /* the ring may only be used by the thread running the event loop */
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "MHD_add_connection is not supported with MHD_USE_IO_URING_LINUX_ONLY\n");
+#endif
+      if (0 != MHD_socket_close_ (client_socket))
+        MHD_PANIC ("close failed\n");
+      errno = EINVAL;
+      return MHD_NO;
+    }
+#endif
+  make_nonblocking_noninheritable (daemon,
+				   client_socket);
+  return internal_add_connection (daemon,
+				  client_socket,
+				  addr, addrlen,
+				  MHD_YES,
+                                  NULL);
+}
+
+
+/**
+ * Add a batch of client connections to the set of connections
+ * managed by MHD, see #MHD_add_connection().  The connections are
+ * distributed over the threads of a thread pool like accepted ones,
+ * and each thread is woken up only once for the whole batch.
+ *
+ * @param daemon daemon that manages the connections
+ * @param connections sockets and addresses of the clients
+ * @param count number of entries in @a connections
+ * @return number of connections added; the sockets of the others are
+ *         closed as well
+ * @ingroup specialized
+ */
+unsigned int
+MHD_add_connections (struct MHD_Daemon *daemon,
+                     const struct MHD_NewConnection *connections,
+                     unsigned int count)
+{
+  struct MHD_Daemon *added_to;
+  struct MHD_Daemon *last;
+  char *woken;
+  unsigned int workers;
+  unsigned int added;
+  unsigned int i;
+
+#if IO_URING_SUPPORT
+  if (MHD_USE_IO_URING_LINUX_ONLY == (daemon->options & MHD_USE_IO_URING_LINUX_ONLY))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "MHD_add_connections is not supported with MHD_USE_IO_URING_LINUX_ONLY\n");
+#endif
+      for (i = 0; i < count; i++)
+        if (0 != MHD_socket_close_ (connections[i].socket))
+          MHD_PANIC ("close failed\n");
+      errno = EINVAL;
+      return 0;
+    }
+#endif
+  /* remember which daemons got connections, to wake each of them
+     up once at the end */
+  workers = (NULL != daemon->worker_pool) ? daemon->worker_pool_size : 1;
+  woken = calloc (workers, 1);
+  last = NULL;
+  added = 0;
+  for (i = 0; i < count; i++)
+    {
+      make_nonblocking_noninheritable (daemon,
+                                       connections[i].socket);
+      added_to = NULL;
+      if (MHD_YES != internal_add_connection (daemon,
+                                              connections[i].socket,
+                                              connections[i].addr,
+                                              connections[i].addrlen,
+                                              MHD_YES,
+                                              &added_to))
+        continue;
+      added++;
+      if ( (NULL == added_to) ||
+           (last == added_to) )
+        continue;
+      last = added_to;
+      if (NULL == woken)
+        {
+          /* out of memory, wake up right away */
+          (void) MHD_daemon_wakeup_ (added_to);
+          continue;
+        }
+      woken[(NULL != daemon->worker_pool)
+            ? (unsigned int) (added_to - daemon->worker_pool)
+            : 0] = 1;
+    }
+  if (NULL != woken)
+    {
+      for (i = 0; i < workers; i++)
+        if ( (0 != woken[i]) &&
+             (MHD_YES != MHD_daemon_wakeup_ ((NULL != daemon->worker_pool)
+                                             ? &daemon->worker_pool[i]
+                                             : daemon)) )
+          {
+#ifdef HAVE_MESSAGES
+            MHD_DLOG (daemon,
+                      "failed to signal new connection via pipe");
+#endif
+          }
+      free (woken);
+    }
+  return added;
+}
+
+
+/**
+ * Accept an incoming connection and create the MHD_Connection object for
+ * it.  This function also enforces policy by way of checking with the
+ * accept policy callback.
+ *
+ * @param daemon handle with the listen socket
+ * @return #MHD_YES on success (connections denied by policy or due
+ *         to 'out of memory' and similar errors) are still considered
+ *         successful as far as #MHD_accept_connection() is concerned);
+ *         a return code of #MHD_NO only refers to the actual
+ *         accept() system call.
+ */
+static int
+MHD_accept_connection (struct MHD_Daemon *daemon)
+{
+  struct sockaddr_storage addrstorage;
+  struct sockaddr *addr = (struct sockaddr *) &addrstorage;
+  socklen_t addrlen;
+  MHD_socket s;
+  MHD_socket fd;
+  int nonblock;
+
+  addrlen = sizeof (addrstorage);
+  memset (addr, 0, sizeof (addrstorage));
+  if (MHD_INVALID_SOCKET == (fd = daemon->socket_fd))
+    return MHD_NO;
+#ifdef HAVE_SOCK_NONBLOCK
+  nonblock = SOCK_NONBLOCK;
+#else
+  nonblock = 0;
+#endif
+#ifdef CYGWIN
+  if (0 == (daemon->options & MHD_USE_SSL))
+    nonblock = 0;
+#endif
+#if HAVE_ACCEPT4
+  s = accept4 (fd, addr, &addrlen, SOCK_CLOEXEC | nonblock);
+#else
+  s = accept (fd, addr, &addrlen);
+#endif
+#if MHD_UNIX_SOCKETS
+  /* unnamed AF_UNIX peers may come without any address */
+  if ( (MHD_INVALID_SOCKET != s) &&
+       (MHD_YES == daemon->listen_unix) &&
+       (addrlen < offsetof (struct sockaddr_un, sun_path)) )
+    {
+      addr->sa_family = AF_UNIX;
+      addrlen = offsetof (struct sockaddr_un, sun_path);
+    }
+#endif
+  if ((MHD_INVALID_SOCKET == s) || (addrlen <= 0))
+    {
+      const int err = MHD_socket_errno_;
+      /* This could be a common occurance with multiple worker threads */
+      if ( (EINVAL == err) &&
+           (MHD_INVALID_SOCKET == daemon->socket_fd) )
+        return MHD_NO; /* can happen during shutdown */
+      if ((EAGAIN != err) && (EWOULDBLOCK != err))
+        {
+          MHD_STATS_ADD_ (daemon, accept_errors, 1);
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Error accepting connection: %s\n",
+                    MHD_socket_last_strerr_ ());
+#endif
+        }
+      if (MHD_INVALID_SOCKET != s)
+        {
+          if (0 != MHD_socket_close_ (s))
+	    MHD_PANIC ("close failed\n");
+          /* just in case */
+        }
+      return MHD_NO;
+    }
+#if !defined(HAVE_ACCEPT4) || HAVE_ACCEPT4+0 == 0 || !defined(HAVE_SOCK_NONBLOCK) || SOCK_CLOEXEC+0 == 0
+  make_nonblocking_noninheritable (daemon, s);
+#endif
+#ifdef HAVE_MESSAGES
+#if DEBUG_CONNECT
+  MHD_DLOG (daemon,
+            "Accepted connection on socket %d\n",
+            s);
+#endif
+#endif
+  MHD_STATS_ADD_ (daemon, accepts, 1);
+  (void) internal_add_connection (daemon, s,
+				  addr, addrlen,
+				  MHD_NO,
+                                  NULL);
+  return MHD_YES;
+}
+
+
+/**
+ * Accept a series of incoming connections after the listen socket
+ * was reported as ready.  Stops after #MHD_Daemon::accept_batch_size
+ * connections, when the accept() call fails (typically because the
+ * backlog has been drained) or when the connection limit is reached.
+ *
+ * @param daemon handle with the listen socket
+ */
+static void
+MHD_accept_connections (struct MHD_Daemon *daemon)
+{
+  unsigned int series_length;
+
+  series_length = 0;
+  while ( (MHD_YES == MHD_accept_connection (daemon)) &&
+          (MHD_NO == at_connection_limit (daemon)) &&
+          (++series_length < daemon->accept_batch_size) )
+    ;
+}
+
+
+/**
+ * Free resources associated with all closed connections.
+ * (destroy responses, free buffers, etc.).  All closed
+ * connections are kept in the "cleanup" doubly-linked list.
+ *
+ * @param daemon daemon to clean up
+ */
+static void
+MHD_cleanup_connections (struct MHD_Daemon *daemon)
+{
+  struct MHD_Connection *pos;
+  struct MHD_Connection *busy;
+
+  busy = NULL;
+  if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
+       (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex)) )
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  while (NULL != (pos = daemon->cleanup_head))
+    {
+      DLL_remove (daemon->cleanup_head,
+		  daemon->cleanup_tail,
+		  pos);
+      if ( ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
+             (MHD_NO == pos->thread_joined) &&
+             (MHD_YES == pos->thread_cached) ) ||
+           (MHD_YES == MHD_prefetch_busy_ (pos)) )
+        {
+          /* the cached thread is still finishing up with it, or a
+             handler thread reads a block into its pool */
+          pos->next = busy;
+          busy = pos;
+          continue;
+        }
+      if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
+	   (MHD_NO == pos->thread_joined) )
+	{
+	  if (0 != MHD_join_thread_ (pos->pid))
+	    {
+	      MHD_PANIC ("Failed to join a thread\n");
+	    }
+	}
+      if (NULL != pos->h2)
+        {
+          MHD_http2_destroy_ (pos);
+          if (0 == (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
+            {
+              struct MHD_Connection **prev;
+
+              /* a stream may have been resumed while the connection
+                 was closing; no more streams can be resumed now */
+              if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+                MHD_PANIC ("Failed to acquire cleanup mutex\n");
+              if (MHD_YES == pos->h2_woken)
+                {
+                  prev = &daemon->h2_wake_head;
+                  while (pos != *prev)
+                    prev = &(*prev)->h2_wake_next;
+                  *prev = pos->h2_wake_next;
+                  pos->h2_woken = MHD_NO;
+                }
+              if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+                MHD_PANIC ("Failed to release cleanup mutex\n");
+            }
+        }
+      MHD_connection_record_pool_peak_ (pos);
+      MHD_pool_destroy_cached (&daemon->pool_cache,
+                               &daemon->pool_cache_len,
+                               daemon->pool_cache_max,
+                               pos->pool);
+      if (NULL != pos->pool)
+        MHD_memory_budget_return_ (daemon);
+      MHD_connection_overflow_release_ (pos);
+      MHD_slow_request_free_ (pos);
+#if HTTPS_SUPPORT
+      MHD_tls_session_deinit_ (pos);
+#endif
+      daemon->connections--;
+      if (NULL != daemon->notify_connection)
+        daemon->notify_connection (daemon->notify_connection_cls,
+                                   pos,
+                                   &pos->socket_context,
+                                   MHD_CONNECTION_NOTIFY_CLOSED);
+      socket_interest_remove (pos);
+      MHD_rate_limit_remove_ (pos);
+#if HTTPS_SUPPORT
+      if (MHD_YES == pos->tls_read_ready)
+        tls_ready_remove (pos);
+#endif
+      MHD_ip_limit_del (daemon, pos->addr, pos->addr_len);
+#if MHD_EREADY_SUPPORT
+      if (0 != (pos->epoll_state & MHD_EPOLL_STATE_IN_EREADY_EDLL))
+	{
+	  EDLL_remove (daemon->eready_head,
+		       daemon->eready_tail,
+		       pos);
+	  pos->epoll_state &= ~MHD_EPOLL_STATE_IN_EREADY_EDLL;
+	}
+#endif
+#if EPOLL_SUPPORT
+      if ( (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY)) &&
+	   (MHD_INVALID_SOCKET != daemon->epoll_fd) &&
+	   (0 != (pos->epoll_state & MHD_EPOLL_STATE_IN_EPOLL_SET)) )
+	{
+	  /* epoll documentation suggests that closing a FD
+	     automatically removes it from the epoll set; however,
+	     this is not true as if we fail to do manually remove it,
+	     we are still seeing an event for this fd in epoll,
+	     causing grief (use-after-free...) --- at least on my
+	     system. */
+	  if (0 != epoll_ctl (daemon->epoll_fd,
+			      EPOLL_CTL_DEL,
+			      pos->socket_fd,
+			      NULL))
+	    MHD_PANIC ("Failed to remove FD from epoll set\n");
+	  pos->epoll_state &= ~MHD_EPOLL_STATE_IN_EPOLL_SET;
+	}
+#endif
+#if IO_URING_SUPPORT
+      if ( (MHD_USE_IO_URING_LINUX_ONLY == (daemon->options & MHD_USE_IO_URING_LINUX_ONLY)) &&
+           (0 != (pos->epoll_state & MHD_EPOLL_STATE_IN_EPOLL_SET)) )
+        {
+          /* the kernel reports the poll request on this socket until
+             the cancellation completes, so 'pos' must stay valid */
+          if (MHD_YES != MHD_io_uring_poll_remove_ (&daemon->uring,
+                                                    (uint64_t) (uintptr_t) pos))
+            MHD_PANIC ("Failed to remove FD from io_uring\n");
+          pos->epoll_state &= ~MHD_EPOLL_STATE_IN_EPOLL_SET;
+          pos->epoll_state |= MHD_EPOLL_STATE_URING_ZOMBIE;
+        }
+#endif
+      if (NULL != pos->response)
+	{
+          if (NULL != pos->response->broadcast)
+            MHD_broadcast_unsubscribe_ (pos);
+          if (NULL != pos->response->stream)
+            MHD_stream_detach_ (pos);
+	  MHD_destroy_response (pos->response);
+	  pos->response = NULL;
+	}
+      /* completed, but closed before the response was queued */
+      if (NULL != pos->deferred_response)
+        {
+          MHD_destroy_response (pos->deferred_response);
+          pos->deferred_response = NULL;
+        }
+      if (MHD_INVALID_SOCKET != pos->socket_fd)
+	{
+#ifdef WINDOWS
+	  shutdown (pos->socket_fd, SHUT_WR);
+#endif
+	  if (0 != MHD_socket_close_ (pos->socket_fd))
+	    MHD_PANIC ("close failed\n");
+	}
+      if ((struct sockaddr *) &pos->addr_storage != pos->addr)
+	free (pos->addr);
+#if IO_URING_SUPPORT
+      if (0 != (pos->epoll_state & MHD_EPOLL_STATE_URING_ZOMBIE))
+        {
+          pos->addr = NULL;
+          DLL_insert (daemon->uring_zombie_head,
+                      daemon->uring_zombie_tail,
+                      pos);
+          continue;
+        }
+#endif
+      if (daemon->connection_cache_len < daemon->pool_cache_max)
+        {
+          pos->next = daemon->connection_cache;
+          daemon->connection_cache = pos;
+          daemon->connection_cache_len++;
+          continue;
+        }
+      free (pos);
+    }
+  while (NULL != (pos = busy))
+    {
+      busy = pos->next;
+      DLL_insert (daemon->cleanup_head,
+                  daemon->cleanup_tail,
+                  pos);
+    }
+  if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
+       (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex)) )
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+}
+
+
+/**
+ * Advance the timer wheel of @a daemon to the current time, running
+ * the idle handler of each connection with a custom timeout that
+ * expired.  Entries are rescheduled lazily: activity on a connection
+ * does not move it in the wheel, instead connections found in a slot
+ * that are not yet expired are re-inserted at their current deadline.
+ *
+ * @param daemon daemon to advance the timer wheel for
+ */
+static void
+process_timer_wheel (struct MHD_Daemon *daemon)
+{
+  struct MHD_Connection *pos;
+  struct MHD_Connection *next;
+  unsigned int slot;
+  uint64_t now;
+  uint64_t tick;
+  uint64_t t;
+
+  if (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
+    return; /* connection threads check their own timeouts */
+  now = MHD_loop_time_ (daemon);
+  tick = now / MHD_TIMER_WHEEL_TICK;
+  if (tick <= daemon->timer_wheel_time)
+    return;
+  t = daemon->timer_wheel_time + 1;
+  if (tick - t >= MHD_TIMER_WHEEL_SIZE)
+    t = tick - MHD_TIMER_WHEEL_SIZE + 1; /* each slot needs one visit */
+  for (; t <= tick; t++)
+    {
+      if (0 == daemon->timer_wheel_count)
+        break;
+      daemon->timer_wheel_time = t;
+      slot = (unsigned int) (t % MHD_TIMER_WHEEL_SIZE);
+      next = daemon->timer_wheel_head[slot];
+      while (NULL != (pos = next))
+        {
+          next = pos->nextX;
+          if (pos->last_activity + pos->connection_timeout > now)
+            {
+              /* not yet expired, move to the slot of its deadline */
+              MHD_connection_timeout_remove_ (pos);
+              MHD_connection_timeout_insert_ (pos);
+              continue;
+            }
+          pos->idle_handler (pos);
+          if ( (MHD_CONNECTION_CLOSED != pos->state) &&
+               (MHD_YES != pos->suspended) )
+            {
+              MHD_connection_timeout_remove_ (pos);
+              MHD_connection_timeout_insert_ (pos);
+            }
+        }
+    }
+  daemon->timer_wheel_time = tick;
+}
+
+
+/**
+ * End the suspension of @a connection because the deadline of
+ * #MHD_suspend_connection_with_timeout() expired.  The connection is
+ * resumed, to be closed by its idle handler if so requested, unless
+ * the application resumed it already.
+ *
+ * @param connection suspended connection
+ */
+static void
+expire_suspension (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+
+  if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to acquire cleanup mutex\n");
+  if ( (MHD_YES == queue_resume (connection)) &&
+       (MHD_YES == connection->suspend_close) )
+    connection->suspend_expired = MHD_YES;
+  if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+    MHD_PANIC ("Failed to release cleanup mutex\n");
+  /* the event loop may be about to block on the sockets only */
+  if (MHD_YES != MHD_daemon_wakeup_ (daemon))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "failed to signal resume via pipe");
+#endif
+    }
+}
+
+
+/**
+ * Advance the guard wheel of @a daemon to the current time, running
+ * the idle handler of each connection whose guard against slow
+ * clients is due; the idle handler closes the connection or arms the
+ * guard again.  Suspended connections whose deadline expired are
+ * resumed.
+ *
+ * @param daemon daemon to advance the guard wheel for
+ */
+static void
+process_guard_wheel (struct MHD_Daemon *daemon)
+{
+  struct MHD_Connection *pos;
+  struct MHD_Connection *next;
+  unsigned int slot;
+  uint64_t now;
+  uint64_t tick;
+  uint64_t t;
+
+  if (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
+    return; /* connection threads check their own guards */
+  now = MHD_loop_time_ (daemon);
+  tick = now / MHD_TIMER_WHEEL_TICK;
+  if (tick <= daemon->guard_wheel_time)
+    return;
+  t = daemon->guard_wheel_time + 1;
+  if (tick - t >= MHD_TIMER_WHEEL_SIZE)
+    t = tick - MHD_TIMER_WHEEL_SIZE + 1; /* each slot needs one visit */
+  for (; t <= tick; t++)
+    {
+      if (0 == daemon->guard_wheel_count)
+        break;
+      daemon->guard_wheel_time = t;
+      slot = (unsigned int) (t % MHD_TIMER_WHEEL_SIZE);
+      next = daemon->guard_wheel_head[slot];
+      while (NULL != (pos = next))
+        {
+          next = pos->nextG;
+          if (pos->guard_deadline > now)
+            continue; /* a later round of the wheel */
+          if (MHD_GUARD_SUSPEND == pos->guard_phase)
+            {
+              MHD_connection_guard_remove_ (pos);
+              expire_suspension (pos);
+              continue;
+            }
+          pos->idle_handler (pos);
+        }
+    }
+  daemon->guard_wheel_time = tick;
+}
+
+
+/**
+ * Release the memory pools of connections that have been waiting
+ * for their next request for longer than the idle release timeout.
+ * As the 'normal_timeout' list is sorted by last activity, we only
+ * need to advance from where we stopped last time until the first
+ * connection that was active more recently.
+ *
+ * @param daemon daemon to release idle pools for
+ */
+static void
+process_idle_release (struct MHD_Daemon *daemon)
+{
+  struct MHD_Connection *pos;
+  uint64_t now;
+
+  if (0 == daemon->idle_release_timeout)
+    return;
+  now = MHD_loop_time_ (daemon);
+  while ( (NULL != (pos = daemon->idle_release_next)) &&
+          (pos->last_activity + daemon->idle_release_timeout <= now) )
+    {
+      daemon->idle_release_next = pos->prevX;
+      (void) MHD_connection_release_pool_ (pos);
+    }
+}
+
+
+/**
+ * Handle timed-out connections for event loops that do not call the
+ * 'idle_handler' of every connection in each iteration.
+ *
+ * @param daemon daemon to handle timeouts for
+ */
+static void
+process_timed_out_connections (struct MHD_Daemon *daemon)
+{
+  struct MHD_Connection *pos;
+  struct MHD_Connection *next;
+
+  /* Connections with custom timeouts are kept in the timer wheel. */
+  process_timer_wheel (daemon);
+  process_guard_wheel (daemon);
+  process_idle_release (daemon);
+  /* Connections with the default timeout are sorted by prepending
+     them to the head of the list whenever we touch the connection;
+     thus it sufficies to iterate from the tail until the first
+     connection is NOT timed out */
+  next = daemon->normal_timeout_tail;
+  while (NULL != (pos = next))
+    {
+      next = pos->prevX;
+      pos->idle_handler (pos);
+      if (MHD_CONNECTION_CLOSED != pos->state)
+	break; /* sorted by timeout, no need to visit the rest! */
+    }
+}
+
+
+/**
+ * Obtain timeout value for `select()` for this daemon (only needed if
+ * connection timeout is used).  The returned value is how long
+ * `select()` or `poll()` should at most block, not the timeout value set
+ * for connections.  This function MUST NOT be called if MHD is
+ * running with #MHD_USE_THREAD_PER_CONNECTION.
+ *
+ * @param daemon daemon to query for timeout
+ * @param timeout set to the timeout (in milliseconds)
+ * @return #MHD_YES on success, #MHD_NO if timeouts are
+ *        not used (or no connections exist that would
+ *        necessiate the use of a timeout right now).
+ * @ingroup event
+ */
+int
+MHD_get_timeout (struct MHD_Daemon *daemon,
+		 MHD_UNSIGNED_LONG_LONG *timeout)
+{
+  uint64_t earliest_deadline;
+  uint64_t now;
+  struct MHD_Connection *pos;
+  int have_timeout;
+  uint64_t throttle;
+
+  if (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Illegal call to MHD_get_timeout\n");
+#endif
+      return MHD_NO;
+    }
+
+#if HTTPS_SUPPORT
+  if (NULL != daemon->tls_ready_head)
+    {
+      /* if there is any TLS connection with data ready for
+	 reading, we must not block in the event loop */
+      *timeout = 0;
+      return MHD_YES;
+    }
+#endif
+
+#if MHD_EREADY_SUPPORT
+  if ( (0 != (daemon->options & (MHD_USE_EPOLL_LINUX_ONLY | MHD_USE_KQUEUE))) &&
+       (NULL != daemon->eready_head) )
+    {
+      /* the timeout processing may make connections ready again,
+         e.g. a connection whose rate limit allows more data */
+      *timeout = 0;
+      return MHD_YES;
+    }
+  /* other event loops do not run the 'eready' list, for them it only
+     remembers connections that waited for the application; those
+     still waiting (and not suspended) are polled */
+  if (0 == (daemon->options & (MHD_USE_EPOLL_LINUX_ONLY | MHD_USE_KQUEUE)))
+    for (pos = daemon->eready_head; NULL != pos; pos = pos->nextE)
+      if ( (MHD_EVENT_LOOP_INFO_BLOCK == pos->event_loop_info) &&
+           (MHD_YES != pos->suspended) )
+        {
+          *timeout = 0;
+          return MHD_YES;
+        }
+#endif
+
+  have_timeout = MHD_NO;
+  earliest_deadline = 0; /* avoid compiler warnings */
+  if (0 != daemon->timer_wheel_count)
+    {
+      uint64_t t;
+
+      /* the first non-empty slot after the current wheel time gives
+         a lower bound on the earliest custom deadline; waking up
+         early merely causes the entries to be rescheduled */
+      for (t = daemon->timer_wheel_time + 1;
+           t <= daemon->timer_wheel_time + MHD_TIMER_WHEEL_SIZE;
+           t++)
+        if (NULL != daemon->timer_wheel_head[t % MHD_TIMER_WHEEL_SIZE])
+          break;
+      earliest_deadline = t * MHD_TIMER_WHEEL_TICK;
+      have_timeout = MHD_YES;
+    }
+  if (0 != daemon->guard_wheel_count)
+    {
+      uint64_t t;
+
+      /* likewise for the guards against slow clients */
+      for (t = daemon->guard_wheel_time + 1;
+           t <= daemon->guard_wheel_time + MHD_TIMER_WHEEL_SIZE;
+           t++)
+        if (NULL != daemon->guard_wheel_head[t % MHD_TIMER_WHEEL_SIZE])
+          break;
+      if ( (! have_timeout) ||
+           (earliest_deadline > t * MHD_TIMER_WHEEL_TICK) )
+        earliest_deadline = t * MHD_TIMER_WHEEL_TICK;
+      have_timeout = MHD_YES;
+    }
+  /* normal timeouts are sorted with the most recently active
+     connection at the head, so we only need to look at the 'tail' */
+  pos = daemon->normal_timeout_tail;
+  if ( (NULL != pos) &&
+       (0 != pos->connection_timeout) )
+    {
+      if ( (! have_timeout) ||
+	   (earliest_deadline > pos->last_activity + pos->connection_timeout) )
+	earliest_deadline = pos->last_activity + pos->connection_timeout;
+      have_timeout = MHD_YES;
+    }
+  pos = daemon->idle_release_next;
+  if ( (NULL != pos) &&
+       (0 != daemon->idle_release_timeout) )
+    {
+      if ( (! have_timeout) ||
+	   (earliest_deadline > pos->last_activity + daemon->idle_release_timeout) )
+	earliest_deadline = pos->last_activity + daemon->idle_release_timeout;
+      have_timeout = MHD_YES;
+    }
+
+  if (MHD_NO == have_timeout)
+    {
+      if (MHD_NO == MHD_rate_limit_timeout_ (daemon,
+                                             &throttle))
+        return MHD_NO;
+      *timeout = (MHD_UNSIGNED_LONG_LONG) throttle;
+      return MHD_YES;
+    }
+  /* the loop is about to wait, the cached time may be old */
+  now = MHD_monotonic_msec_counter ();
+  daemon->loop_time = now;
+  if (earliest_deadline < now)
+    *timeout = 0;
+  else
+    *timeout = (MHD_UNSIGNED_LONG_LONG) (earliest_deadline - now);
+  /* throttled connections may continue before that */
+  if ( (MHD_YES == MHD_rate_limit_timeout_ (daemon,
+                                            &throttle)) &&
+       (throttle < *timeout) )
+    *timeout = (MHD_UNSIGNED_LONG_LONG) throttle;
+  return MHD_YES;
+}
+
+
+/**
+ * Run webserver operations. This method should be called by clients
+ * in combination with #MHD_get_fdset if the client-controlled select
+ * method is used.
+ *
+ * You can use this function instead of #MHD_run if you called
+ * `select()` on the result from #MHD_get_fdset.  File descriptors in
+ * the sets that are not controlled by MHD will be ignored.  Calling
+ * this function instead of #MHD_run is more efficient as MHD will
+ * not have to call `select()` again to determine which operations are
+ * ready.
+ *
+ * @param daemon daemon to run select loop for
+ * @param read_fd_set read set
+ * @param write_fd_set write set
+ * @param except_fd_set except set (not used, can be NULL)
+ * @return #MHD_NO on serious errors, #MHD_YES on success
+ * @ingroup event
+ */
+int
+MHD_run_from_select (struct MHD_Daemon *daemon,
+		     const fd_set *read_fd_set,
+		     const fd_set *write_fd_set,
+		     const fd_set *except_fd_set)
+{
+  MHD_socket ds;
+  struct MHD_Connection *pos;
+  struct MHD_Connection *next;
+  unsigned int mask = MHD_USE_SUSPEND_RESUME | MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY |
+    MHD_USE_SELECT_INTERNALLY | MHD_USE_POLL_INTERNALLY | MHD_USE_THREAD_PER_CONNECTION;
+
+  /* called by the application's event loop, which did not take the
+     time for this iteration */
+  if (0 == (daemon->options & (MHD_USE_SELECT_INTERNALLY | MHD_USE_THREAD_PER_CONNECTION)))
+    daemon->loop_time = MHD_monotonic_msec_counter ();
+  /* Resuming external connections when using an extern mainloop  */
+  if (MHD_USE_SUSPEND_RESUME == (daemon->options & mask))
+    resume_suspended_connections (daemon);
+
+#if EPOLL_SUPPORT
+  if (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY))
+    {
+      /* we're in epoll mode, the epoll FD stands for
+	 the entire event set! */
+      if (daemon->epoll_fd >= FD_SETSIZE)
+	return MHD_NO; /* poll fd too big, fail hard */
+      /* connections left ready by the last run do not make the
+         epoll FD readable, but MHD_get_timeout() returned 0 for them */
+      if ( (FD_ISSET (daemon->epoll_fd, read_fd_set)) ||
+           (NULL != daemon->eready_head) )
+	return MHD_run (daemon);
+      return MHD_YES;
+    }
+#endif
+#if KQUEUE_SUPPORT
+  if (0 != (daemon->options & MHD_USE_KQUEUE))
+    {
+      /* same for the kqueue FD in kqueue mode */
+      if (daemon->kqueue_fd >= FD_SETSIZE)
+	return MHD_NO; /* kqueue fd too big, fail hard */
+      if ( (FD_ISSET (daemon->kqueue_fd, read_fd_set)) ||
+           (NULL != daemon->eready_head) )
+	return MHD_run (daemon);
+      return MHD_YES;
+    }
+#endif
+
+  /* select connection thread handling type */
+  if ( (MHD_INVALID_SOCKET != (ds = daemon->socket_fd)) &&
+       (MHD_FD_ISSET_LARGE_ (ds, read_fd_set)) )
+    MHD_accept_connections (daemon);
+  /* drain signaling pipe to avoid spinning select */
+  if ( (MHD_INVALID_PIPE_ != daemon->wpipe[0]) &&
+       (MHD_FD_ISSET_LARGE_ (daemon->wpipe[0], read_fd_set)) )
+    MHD_daemon_wakeup_clear_ (daemon);
+
+  if (0 == (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
+    {
+      /* do not have a thread per connection, process all connections now */
+      next = daemon->connections_head;
+      while (NULL != (pos = next))
+        {
+	  next = pos->next;
+          ds = pos->socket_fd;
+          if (MHD_INVALID_SOCKET == ds)
+	    continue;
+	  switch (pos->event_loop_info)
+	    {
+	    case MHD_EVENT_LOOP_INFO_READ:
+	      if ( (MHD_FD_ISSET_LARGE_ (ds, read_fd_set))
+#if HTTPS_SUPPORT
+		   || (MHD_YES == pos->tls_read_ready)
+#endif
+		   )
+		pos->read_handler (pos);
+	      break;
+	    case MHD_EVENT_LOOP_INFO_WRITE:
+	      if ( (MHD_FD_ISSET_LARGE_ (ds, read_fd_set)) &&
+		   (pos->read_buffer_size > pos->read_buffer_offset) )
+		pos->read_handler (pos);
+	      if (MHD_FD_ISSET_LARGE_ (ds, write_fd_set))
+		pos->write_handler (pos);
+	      break;
+	    case MHD_EVENT_LOOP_INFO_BLOCK:
+	      if ( (MHD_FD_ISSET_LARGE_ (ds, read_fd_set)) &&
+		   (pos->read_buffer_size > pos->read_buffer_offset) )
+		pos->read_handler (pos);
+	      break;
+	    case MHD_EVENT_LOOP_INFO_THROTTLED:
+	      /* the idle handler checks the rate limit again */
+	      break;
+	    case MHD_EVENT_LOOP_INFO_CLEANUP:
+	      /* should never happen */
+	      break;
+	    }
+	  pos->idle_handler (pos);
+        }
+      process_timer_wheel (daemon);
+      process_guard_wheel (daemon);
+      process_idle_release (daemon);
+    }
+  MHD_cleanup_connections (daemon);
+  return MHD_YES;
+}
+
+
+/**
+ * Run webserver operations for one socket of a daemon started with
+ * #MHD_OPTION_NOTIFY_SOCKET, after the application's event loop
+ * reported it ready.  Only the given socket is looked at, so the
+ * cost does not depend on the number of connections.  The
+ * application must also call this function with a @a handle of
+ * NULL once the timeout returned by #MHD_get_timeout() expired, to
+ * handle timed-out connections.
+ *
+ * @param daemon daemon the socket belongs to
+ * @param handle value passed to the #MHD_NotifySocketCallback for
+ *        the socket, NULL to only handle timeouts
+ * @param ready bitmask of #MHD_SOCKET_INTEREST_READ and
+ *        #MHD_SOCKET_INTEREST_WRITE for the events that are ready
+ * @return #MHD_NO on serious errors, #MHD_YES on success
+ * @ingroup event
+ */
+int
+MHD_run_socket (struct MHD_Daemon *daemon,
+                void *handle,
+                unsigned int ready)
+{
+  struct MHD_Connection *pos;
+  struct MHD_Connection *next;
+
+  if ( (NULL == daemon->notify_socket) ||
+       (MHD_YES == daemon->shutdown) )
+    return MHD_NO;
+  if (handle == (void *) &daemon->socket_fd)
+    {
+      if ( (MHD_INVALID_SOCKET != daemon->socket_fd) &&
+           (0 != (ready & MHD_SOCKET_INTEREST_READ)) )
+        MHD_accept_connections (daemon);
+    }
+  else if (handle == (void *) &daemon->wpipe[0])
+    {
+      if ( (MHD_INVALID_PIPE_ != daemon->wpipe[0]) &&
+           (0 != (ready & MHD_SOCKET_INTEREST_READ)) )
+        MHD_daemon_wakeup_clear_ (daemon);
+    }
+  else if (NULL != handle)
+    {
+      pos = handle;
+      if ( (MHD_NO == pos->suspended) &&
+           (MHD_CONNECTION_CLOSED != pos->state) )
+        {
+          if ( (0 != (ready & MHD_SOCKET_INTEREST_READ)) &&
+               ( (MHD_EVENT_LOOP_INFO_READ == pos->event_loop_info) ||
+                 (pos->read_buffer_size > pos->read_buffer_offset) ) )
+            pos->read_handler (pos);
+          if ( (0 != (ready & MHD_SOCKET_INTEREST_WRITE)) &&
+               (MHD_EVENT_LOOP_INFO_WRITE == pos->event_loop_info) )
+            pos->write_handler (pos);
+          pos->idle_handler (pos);
+        }
+    }
+  else
+    {
+#if HTTPS_SUPPORT
+      /* data already decrypted by the TLS library does not make the
+         socket readable again, see MHD_get_timeout() */
+      if (NULL != daemon->tls_ready_head)
+        {
+          next = daemon->tls_ready_head;
+          while (NULL != (pos = next))
+            {
+              next = pos->tls_ready_next;
+              pos->read_handler (pos);
+              pos->idle_handler (pos);
+            }
+        }
+#endif
+      MHD_rate_limit_process_ (daemon);
+      process_timed_out_connections (daemon);
+    }
+  /* Resuming connections of the application's main loop; unlike
+     with MHD_run_from_select(), they are not visited anyway */
+  if (MHD_USE_SUSPEND_RESUME == (daemon->options & MHD_USE_SUSPEND_RESUME))
+    {
+      (void) resume_suspended_connections (daemon);
+      next = daemon->socket_resumed_head;
+      daemon->socket_resumed_head = NULL;
+      while (NULL != (pos = next))
+        {
+          next = pos->resumed_next;
+          pos->idle_handler (pos);
+          MHD_socket_interest_update_ (pos);
+        }
+    }
+  MHD_cleanup_connections (daemon);
+  return MHD_YES;
+}
+
+
+/**
+ * Note that the event loop of @a daemon returned from waiting for
+ * events (see #MHD_OPTION_OVERLOAD_LATENCY).  Only the first return
+ * of an iteration counts.
+ *
+ * @param daemon daemon (or worker) running the event loop
+ */
+static void
+overload_loop_woke (struct MHD_Daemon *daemon)
+{
+  if ( (0 != daemon->overload_latency) &&
+       (0 == daemon->loop_wake) )
+    daemon->loop_wake = MHD_monotonic_msec_counter ();
+}
+
+
+/**
+ * Add the time the event loop of @a daemon took to process the
+ * events of this iteration to its average lag.
+ *
+ * @param daemon daemon (or worker) running the event loop
+ */
+static void
+overload_loop_done (struct MHD_Daemon *daemon)
+{
+  if (0 == daemon->loop_wake)
+    return;
+  daemon->loop_lag_avg = daemon->loop_lag_avg
+    - daemon->loop_lag_avg / MHD_OVERLOAD_AVG_SCALE
+    + (MHD_monotonic_msec_counter () - daemon->loop_wake);
+  daemon->loop_wake = 0;
+}
+
+
+/**
+ * Note that the event loop of @a daemon starts an iteration.
+ *
+ * @param daemon daemon (or worker) running the event loop
+ */
+static void
+loop_begin (struct MHD_Daemon *daemon)
+{
+  daemon->loop_start = MHD_monotonic_usec_counter ();
+  daemon->loop_waited = 0;
+  if (0 == daemon->loop_report_time)
+    daemon->loop_report_time = daemon->loop_start;
+}
+
+
+/**
+ * Get the current time for the timeouts of the connections of
+ * @a daemon: the time cached by the current iteration of its event
+ * loop, so that reading and writing need not query the clock.
+ * With #MHD_USE_THREAD_PER_CONNECTION, the clock is read.
+ *
+ * @param daemon daemon (or worker) to get the time for
+ * @return milliseconds, see #MHD_monotonic_msec_counter()
+ */
+uint64_t
+MHD_loop_time_ (struct MHD_Daemon *daemon)
+{
+  if (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
+    return MHD_monotonic_msec_counter ();
+  return daemon->loop_time;
+}
+
+
+/**
+ * Note that the event loop of @a daemon is about to wait for events.
+ *
+ * @param daemon daemon (or worker) running the event loop
+ */
+static void
+loop_wait (struct MHD_Daemon *daemon)
+{
+  daemon->loop_wait_start = MHD_monotonic_usec_counter ();
+}
+
+
+/**
+ * Note that the event loop of @a daemon returned from waiting for
+ * events, count the time it waited and take the time for the
+ * timeouts of this iteration (see #MHD_loop_time_()).
+ *
+ * @param daemon daemon (or worker) running the event loop
+ * @param events number of events returned, negative on error
+ */
+static void
+loop_woke (struct MHD_Daemon *daemon,
+           int events)
+{
+  uint64_t waited;
+
+  daemon->loop_woke_usec = MHD_monotonic_usec_counter ();
+  waited = daemon->loop_woke_usec - daemon->loop_wait_start;
+  daemon->loop_waited += waited;
+  daemon->loop_time = MHD_monotonic_msec_counter ();
+  MHD_STATS_ADD_ (daemon, loop_wakeups, 1);
+  MHD_STATS_ADD_ (daemon, loop_wait_usec, waited);
+  if (0 < events)
+    MHD_STATS_ADD_ (daemon, loop_events, events);
+  overload_loop_woke (daemon);
+}
+
+
+/**
+ * Finish an iteration of the event loop of @a daemon: count the time
+ * it spent processing events and call the
+ * #MHD_OPTION_LOOP_STATS_CALLBACK if its interval passed.
+ *
+ * @param daemon daemon (or worker) running the event loop
+ */
+static void
+loop_done (struct MHD_Daemon *daemon)
+{
+  struct MHD_LoopStats now;
+  uint64_t end;
+  uint64_t busy;
+
+  overload_loop_done (daemon);
+  end = MHD_monotonic_usec_counter ();
+  if (NULL != daemon->access_log)
+    MHD_access_log_flush_ (daemon,
+                           end,
+                           MHD_NO);
+  busy = end - daemon->loop_start;
+  if (busy > daemon->loop_waited)
+    MHD_STATS_ADD_ (daemon, loop_dispatch_usec, busy - daemon->loop_waited);
+  MHD_STATS_ADD_ (daemon, loop_iterations, 1);
+  if ( (NULL == daemon->loop_stats_callback) ||
+       (end - daemon->loop_report_time <
+        (uint64_t) daemon->loop_stats_interval * 1000) )
+    return;
+  /* only this thread updates the loop counters */
+  now.worker = (NULL != daemon->master)
+    ? (unsigned int) (daemon - daemon->master->worker_pool)
+    : 0;
+  now.interval_usec = end - daemon->loop_report_time;
+  now.iterations = daemon->stats->loop_iterations;
+  now.wakeups = daemon->stats->loop_wakeups;
+  now.events = daemon->stats->loop_events;
+  now.wait_usec = daemon->stats->loop_wait_usec;
+  now.dispatch_usec = daemon->stats->loop_dispatch_usec;
+  daemon->loop_report.worker = now.worker;
+  daemon->loop_report.interval_usec = now.interval_usec;
+  daemon->loop_report.iterations =
+    now.iterations - daemon->loop_report.iterations;
+  daemon->loop_report.wakeups =
+    now.wakeups - daemon->loop_report.wakeups;
+  daemon->loop_report.events =
+    now.events - daemon->loop_report.events;
+  daemon->loop_report.wait_usec =
+    now.wait_usec - daemon->loop_report.wait_usec;
+  daemon->loop_report.dispatch_usec =
+    now.dispatch_usec - daemon->loop_report.dispatch_usec;
+  daemon->loop_stats_callback (daemon->loop_stats_callback_cls,
+                               &daemon->loop_report);
+  daemon->loop_report = now;
+  daemon->loop_report_time = end;
+}
+
+
+#ifdef MHD_POSIX_SOCKETS
+/**
+ * select() loop for #MHD_USE_LARGE_FD_SETS: the fd sets of the
+ * connections are kept up to date as they change, so only they are
+ * copied for select() (up to the highest socket), with the listen
+ * socket and the wakeup pipe added.
+ *
+ * @param daemon daemon to run select() loop for
+ * @param may_block #MHD_YES if blocking, #MHD_NO if non-blocking
+ * @return #MHD_NO on serious errors, #MHD_YES on success
+ */
+static int
+MHD_select_large (struct MHD_Daemon *daemon,
+                  int may_block)
+{
+  MHD_UNSIGNED_LONG_LONG ltimeout;
+  struct timeval timeout;
+  struct timeval *tv;
+  fd_set *rs;
+  fd_set *ws;
+  MHD_socket listen_fd;
+  MHD_socket maxsock;
+  unsigned int chunks;
+  int num_ready;
+  int accept_ready;
+  int ret;
+
+  if (MHD_YES == daemon->shutdown)
+    return MHD_NO;
+  submit_handler_steps (daemon);
+  insert_added_connections (daemon);
+  rebalance_connections (daemon);
+  drain_idle_connections (daemon);
+  reclaim_memory_budget (daemon);
+  if ( (MHD_USE_SUSPEND_RESUME == (daemon->options & MHD_USE_SUSPEND_RESUME)) &&
+       (MHD_YES == resume_suspended_connections (daemon)) )
+    may_block = MHD_NO;
+
+  /* only listen if we are not at the connection limit, see MHD_select() */
+  listen_fd = daemon->socket_fd;
+  if ( (MHD_INVALID_SOCKET != listen_fd) &&
+       (MHD_YES == at_connection_limit (daemon)) &&
+       (MHD_INVALID_PIPE_ != daemon->wpipe[0]) )
+    listen_fd = MHD_INVALID_SOCKET;
+  maxsock = daemon->fd_sets_max;
+  if ( (MHD_INVALID_SOCKET != listen_fd) &&
+       ( (MHD_INVALID_SOCKET == maxsock) ||
+         (listen_fd > maxsock) ) )
+    maxsock = listen_fd;
+  if ( (MHD_INVALID_PIPE_ != daemon->wpipe[0]) &&
+       ( (MHD_INVALID_SOCKET == maxsock) ||
+         (daemon->wpipe[0] > maxsock) ) )
+    maxsock = daemon->wpipe[0];
+  if (MHD_INVALID_SOCKET == maxsock)
+    return MHD_YES;
+  if (MHD_YES != fd_sets_reserve (daemon,
+                                  maxsock))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Error allocating memory: %s\n",
+                MHD_strerror_ (errno));
+#endif
+      return MHD_NO;
+    }
+  chunks = (unsigned int) maxsock / FD_SETSIZE + 1;
+  rs = &daemon->fd_sets[2 * daemon->fd_sets_chunks];
+  ws = &daemon->fd_sets[3 * daemon->fd_sets_chunks];
+  memcpy (rs,
+          daemon->fd_sets,
+          chunks * sizeof (fd_set));
+  memcpy (ws,
+          &daemon->fd_sets[daemon->fd_sets_chunks],
+          chunks * sizeof (fd_set));
+  if (MHD_INVALID_SOCKET != listen_fd)
+    MHD_FD_SET_LARGE_ (listen_fd, rs);
+  if (MHD_INVALID_PIPE_ != daemon->wpipe[0])
+    MHD_FD_SET_LARGE_ (daemon->wpipe[0], rs);
+
+  tv = NULL;
+  if (MHD_NO == may_block)
+    {
+      timeout.tv_usec = 0;
+      timeout.tv_sec = 0;
+      tv = &timeout;
+    }
+  else if (MHD_YES == MHD_get_timeout (daemon, &ltimeout))
+    {
+      /* ltimeout is in ms */
+      timeout.tv_usec = (ltimeout % 1000) * 1000;
+      if (ltimeout / 1000 > TIMEVAL_TV_SEC_MAX)
+        timeout.tv_sec = TIMEVAL_TV_SEC_MAX;
+      else
+        timeout.tv_sec = (_MHD_TIMEVAL_TV_SEC_TYPE)(ltimeout / 1000);
+      tv = &timeout;
+    }
+  loop_wait (daemon);
+  num_ready = MHD_SYS_select_ (maxsock + 1, rs, ws, NULL, tv);
+  loop_woke (daemon, num_ready);
+  if (MHD_YES == daemon->shutdown)
+    return MHD_NO;
+  if (num_ready < 0)
+    {
+      if (EINTR == MHD_socket_errno_)
+        return MHD_YES;
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "select failed: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+      return MHD_NO;
+    }
+  /* accepting may grow the fd sets and so move the copies, hence
+     new connections are accepted once the others were handled */
+  accept_ready = ( (MHD_INVALID_SOCKET != listen_fd) &&
+                   (MHD_FD_ISSET_LARGE_ (listen_fd, rs)) );
+  if (accept_ready)
+    MHD_FD_CLR_LARGE_ (listen_fd, rs);
+  ret = MHD_run_from_select (daemon, rs, ws, NULL);
+  if (accept_ready)
+    MHD_accept_connections (daemon);
+  return ret;
+}
+#endif
+
+
+/**
+ * Main internal select() call.  Will compute select sets, call select()
+ * and then #MHD_run_from_select with the result.
+ *
+ * @param daemon daemon to run select() loop for
+ * @param may_block #MHD_YES if blocking, #MHD_NO if non-blocking
+ * @return #MHD_NO on serious errors, #MHD_YES on success
+ */
+static int
+MHD_select (struct MHD_Daemon *daemon,
+	    int may_block)
+{
+  int num_ready;
+  fd_set rs;
+  fd_set ws;
+  fd_set es;
+  MHD_socket maxsock;
+  struct timeval timeout;
+  struct timeval *tv;
+  MHD_UNSIGNED_LONG_LONG ltimeout;
+  int err_state;
+
+#ifdef MHD_POSIX_SOCKETS
+  if (0 != (daemon->options & MHD_USE_LARGE_FD_SETS))
+    return MHD_select_large (daemon,
+                             may_block);
+#endif
+  timeout.tv_sec = 0;
+  timeout.tv_usec = 0;
+  if (MHD_YES == daemon->shutdown)
+    return MHD_NO;
+  FD_ZERO (&rs);
+  FD_ZERO (&ws);
+  FD_ZERO (&es);
+  maxsock = MHD_INVALID_SOCKET;
+  err_state = MHD_NO;
+  if (0 == (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
+    {
+      submit_handler_steps (daemon);
+      insert_added_connections (daemon);
+      rebalance_connections (daemon);
+      drain_idle_connections (daemon);
+      reclaim_memory_budget (daemon);
+      if ( (MHD_USE_SUSPEND_RESUME == (daemon->options & MHD_USE_SUSPEND_RESUME)) &&
+           (MHD_YES == resume_suspended_connections (daemon)) )
+        may_block = MHD_NO;
+
+      /* single-threaded, go over everything */
+      if (MHD_NO == MHD_get_fdset2 (daemon, &rs, &ws, &es, &maxsock, FD_SETSIZE))
+        {
+#ifdef HAVE_MESSAGES
+        MHD_DLOG (daemon, "Could not obtain daemon fdsets");
+#endif
+          err_state = MHD_YES;
+        }
+
+      /* If we're at the connection limit, no need to
+         accept new connections; however, make sure
+         we do not miss the shutdown, so only do this
+         optimization if we have a shutdown signaling
+         pipe (workers of a pool may have one without
+         #MHD_USE_PIPE_FOR_SHUTDOWN). */
+      if ( (MHD_INVALID_SOCKET != daemon->socket_fd) &&
+           (MHD_YES == at_connection_limit (daemon)) &&
+           (MHD_INVALID_PIPE_ != daemon->wpipe[0]) )
+        FD_CLR (daemon->socket_fd, &rs);
+    }
+  else
+    {
+      /* accept only, have one thread per connection */
+      if ( (MHD_INVALID_SOCKET != daemon->socket_fd) &&
+           (MHD_YES != add_to_fd_set (daemon->socket_fd,
+                                      &rs,
+                                      &maxsock,
+                                      FD_SETSIZE)) )
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon, "Could not add listen socket to fdset");
+#endif
+          return MHD_NO;
+        }
+    }
+  if ( (MHD_INVALID_PIPE_ != daemon->wpipe[0]) &&
+       (MHD_YES != add_to_fd_set (daemon->wpipe[0],
+                                  &rs,
+                                  &maxsock,
+                                  FD_SETSIZE)) )
+    {
+#if defined(MHD_WINSOCK_SOCKETS)
+      /* fdset limit reached, new connections
+         cannot be handled. Remove listen socket FD
+         from fdset and retry to add pipe FD. */
+      if (MHD_INVALID_SOCKET != daemon->socket_fd)
+        {
+          FD_CLR (daemon->socket_fd, &rs);
+          if (MHD_YES != add_to_fd_set (daemon->wpipe[0],
+                                        &rs,
+                                        &maxsock,
+                                        FD_SETSIZE))
+            {
+#endif /* MHD_WINSOCK_SOCKETS */
+#ifdef HAVE_MESSAGES
+              MHD_DLOG (daemon,
+                        "Could not add control pipe FD to fdset");
+#endif
+              err_state = MHD_YES;
+#if defined(MHD_WINSOCK_SOCKETS)
+            }
+        }
+#endif /* MHD_WINSOCK_SOCKETS */
+    }
+
+  tv = NULL;
+  if (MHD_YES == err_state)
+    may_block = MHD_NO;
+  if (MHD_NO == may_block)
+    {
+      timeout.tv_usec = 0;
+      timeout.tv_sec = 0;
+      tv = &timeout;
+    }
+  else if ( (0 == (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
+	    (MHD_YES == MHD_get_timeout (daemon, &ltimeout)) )
+    {
+      /* ltimeout is in ms */
+      timeout.tv_usec = (ltimeout % 1000) * 1000;
+      if (ltimeout / 1000 > TIMEVAL_TV_SEC_MAX)
+        timeout.tv_sec = TIMEVAL_TV_SEC_MAX;
+      else
+        timeout.tv_sec = (_MHD_TIMEVAL_TV_SEC_TYPE)(ltimeout / 1000);
+      tv = &timeout;
+    }
+  loop_wait (daemon);
+  num_ready = MHD_SYS_select_ (maxsock + 1, &rs, &ws, &es, tv);
+  loop_woke (daemon, num_ready);
+  if (MHD_YES == daemon->shutdown)
+    return MHD_NO;
+  if (num_ready < 0)
+    {
+      if (EINTR == MHD_socket_errno_)
+        return (MHD_NO == err_state) ? MHD_YES : MHD_NO;
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "select failed: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+      return MHD_NO;
+    }
+  if (MHD_YES == MHD_run_from_select (daemon, &rs, &ws, &es))
+    return (MHD_NO == err_state) ? MHD_YES : MHD_NO;
+  return MHD_NO;
+}
+
+
+#ifdef HAVE_POLL
+/**
+ * Process all of our connections and possibly the server
+ * socket using poll().
+ *
+ * @param daemon daemon to run poll loop for
+ * @param may_block #MHD_YES if blocking, #MHD_NO if non-blocking
+ * @return #MHD_NO on serious errors, #MHD_YES on success
+ */
+static int
+MHD_poll_all (struct MHD_Daemon *daemon,
+	      int may_block)
+{
+  MHD_UNSIGNED_LONG_LONG ltimeout;
+  struct MHD_Connection *pos;
+  struct MHD_Connection *next;
+  struct pollfd *p;
+  int timeout;
+  int num_ready;
+
+  submit_handler_steps (daemon);
+  insert_added_connections (daemon);
+  rebalance_connections (daemon);
+  drain_idle_connections (daemon);
+  reclaim_memory_budget (daemon);
+  if ( (MHD_USE_SUSPEND_RESUME == (daemon->options & MHD_USE_SUSPEND_RESUME)) &&
+       (MHD_YES == resume_suspended_connections (daemon)) )
+    may_block = MHD_NO;
+
+  /* the entries of the connections are kept up to date as their
+     'event_loop_info' changes, only the listen socket is set here */
+  if (MHD_YES != poll_set_reserve (daemon, 0))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG(daemon,
+               "Error allocating memory: %s\n",
+               MHD_strerror_(errno));
+#endif
+      return MHD_NO;
+    }
+  p = daemon->poll_fds;
+  if ( (MHD_INVALID_SOCKET != daemon->socket_fd) &&
+       (MHD_NO == at_connection_limit (daemon)) )
+    p[0].fd = daemon->socket_fd; /* only listen if we are not at the connection limit */
+  else
+    p[0].fd = MHD_INVALID_SOCKET;
+  if (may_block == MHD_NO)
+    timeout = 0;
+  else if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) ||
+            (MHD_YES != MHD_get_timeout (daemon, &ltimeout)) )
+    timeout = -1;
+  else
+    timeout = (ltimeout > INT_MAX) ? INT_MAX : (int) ltimeout;
+  if (MHD_YES == daemon->poll_cleanup)
+    timeout = 0; /* clean up closed connections immediately */
+  daemon->poll_cleanup = MHD_NO;
+
+  if ( (MHD_INVALID_SOCKET == p[0].fd) &&
+       (MHD_INVALID_PIPE_ == daemon->wpipe[0]) &&
+       (2 == daemon->poll_fds_used) )
+    return MHD_YES;
+  loop_wait (daemon);
+  num_ready = MHD_sys_poll_(p, daemon->poll_fds_used, timeout);
+  loop_woke (daemon, num_ready);
+  if (num_ready < 0)
+    {
+      if (EINTR == MHD_socket_errno_)
+        return MHD_YES;
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "poll failed: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+      return MHD_NO;
+    }
+  /* handle shutdown */
+  if (MHD_YES == daemon->shutdown)
+    return MHD_NO;
+  /* the handlers may remove connections from the poll set, which
+     moves entries, and adding connections may move the poll set, so
+     look up the entry of each connection again */
+  next = daemon->connections_head;
+  while (NULL != (pos = next))
+    {
+      next = pos->next;
+      switch (pos->event_loop_info)
+        {
+        case MHD_EVENT_LOOP_INFO_READ:
+          if (0 != (daemon->poll_fds[pos->poll_slot].revents & POLLIN))
+            pos->read_handler (pos);
+          pos->idle_handler (pos);
+          break;
+        case MHD_EVENT_LOOP_INFO_WRITE:
+          if (0 != (daemon->poll_fds[pos->poll_slot].revents & POLLIN))
+            pos->read_handler (pos);
+          if ( (0 != pos->poll_slot) &&
+               (0 != (daemon->poll_fds[pos->poll_slot].revents & POLLOUT)) )
+            pos->write_handler (pos);
+          pos->idle_handler (pos);
+          break;
+        case MHD_EVENT_LOOP_INFO_BLOCK:
+          if (0 != (daemon->poll_fds[pos->poll_slot].revents & POLLIN))
+            pos->read_handler (pos);
+          pos->idle_handler (pos);
+          break;
+        case MHD_EVENT_LOOP_INFO_THROTTLED:
+        case MHD_EVENT_LOOP_INFO_CLEANUP:
+          pos->idle_handler (pos);
+          break;
+        }
+    }
+  process_timer_wheel (daemon);
+  process_guard_wheel (daemon);
+  process_idle_release (daemon);
+  /* handle 'listen' FD */
+  if ( (MHD_INVALID_SOCKET != daemon->poll_fds[0].fd) &&
+       (0 != (daemon->poll_fds[0].revents & POLLIN)) )
+    MHD_accept_connections (daemon);
+
+  /* handle pipe FD */
+  if ( (MHD_INVALID_PIPE_ != daemon->wpipe[0]) &&
+       (0 != (daemon->poll_fds[1].revents & POLLIN)) )
+    MHD_daemon_wakeup_clear_ (daemon);
+  return MHD_YES;
+}
+
+
+/**
+ * Process only the listen socket using poll().
+ *
+ * @param daemon daemon to run poll loop for
+ * @param may_block #MHD_YES if blocking, #MHD_NO if non-blocking
+ * @return #MHD_NO on serious errors, #MHD_YES on success
+ */
+static int
+MHD_poll_listen_socket (struct MHD_Daemon *daemon,
+			int may_block)
+{
+  struct pollfd p[2];
+  int timeout;
+  unsigned int poll_count;
+  int poll_listen;
+  int num_ready;
+
+  memset (&p, 0, sizeof (p));
+  poll_count = 0;
+  poll_listen = -1;
+  if (MHD_INVALID_SOCKET != daemon->socket_fd)
+    {
+      p[poll_count].fd = daemon->socket_fd;
+      p[poll_count].events = POLLIN;
+      p[poll_count].revents = 0;
+      poll_listen = poll_count;
+      poll_count++;
+    }
+  if (MHD_INVALID_PIPE_ != daemon->wpipe[0])
+    {
+      p[poll_count].fd = daemon->wpipe[0];
+      p[poll_count].events = POLLIN;
+      p[poll_count].revents = 0;
+      poll_count++;
+    }
+  if (MHD_NO == may_block)
+    timeout = 0;
+  else
+    timeout = -1;
+  if (0 == poll_count)
+    return MHD_YES;
+  loop_wait (daemon);
+  num_ready = MHD_sys_poll_(p, poll_count, timeout);
+  loop_woke (daemon, num_ready);
+  if (num_ready < 0)
+    {
+      if (EINTR == MHD_socket_errno_)
+	return MHD_YES;
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "poll failed: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+      return MHD_NO;
+    }
+  /* handle shutdown */
+  if (MHD_YES == daemon->shutdown)
+    return MHD_NO;
+  if ( (-1 != poll_listen) &&
+       (0 != (p[poll_listen].revents & POLLIN)) )
+    MHD_accept_connections (daemon);
+  return MHD_YES;
+}
+#endif
+
+
+/**
+ * Do poll()-based processing.
+ *
+ * @param daemon daemon to run poll()-loop for
+ * @param may_block #MHD_YES if blocking, #MHD_NO if non-blocking
+ * @return #MHD_NO on serious errors, #MHD_YES on success
+ */
+static int
+MHD_poll (struct MHD_Daemon *daemon,
+	  int may_block)
+{
+#ifdef HAVE_POLL
+  if (MHD_YES == daemon->shutdown)
+    return MHD_NO;
+  if (0 == (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
+    return MHD_poll_all (daemon, may_block);
+  else
+    return MHD_poll_listen_socket (daemon, may_block);
+#else
+  return MHD_NO;
+#endif
+}
+
+
+#if MHD_EREADY_SUPPORT
+
+/**
+ * How many events to we process at most per epoll() call?  Trade-off
+ * between required stack-size and number of system calls we have to
+ * make; 128 should be way enough to avoid more than one system call
+ * for most scenarios, and still be moderate in stack size
+ * consumption.  Embedded systems might want to choose a smaller value
+ * --- but why use epoll() on such a system in the first place?
+ */
+#define MAX_EVENTS 128
+
+#if EPOLL_SUPPORT
+/**
+ * Default limit for the number of events collected by one
+ * epoll_wait() call, see #MHD_OPTION_EPOLL_MAX_EVENTS.
+ */
+#define MHD_EPOLL_MAX_EVENTS_DEFAULT 4096
+
+/**
+ * Maximum number of epoll_wait() calls in one iteration of the
+ * epoll() loop; events still pending afterwards are collected by the
+ * next iteration.
+ */
+#define MHD_EPOLL_MAX_ROUNDS 16
+#endif
+
+#if IO_URING_SUPPORT
+/**
+ * Size of the io_uring submission queue.  Multishot poll requests
+ * only occupy an entry until they are submitted, so this only bounds
+ * the number of requests queued per event loop iteration (if it is
+ * exceeded, we submit early).
+ */
+#define MHD_IO_URING_ENTRIES 256
+#endif
+
+
+/**
+ * Run the handlers of (at most @a max of) the connections in the
+ * 'eready' list.
+ *
+ * @param daemon daemon to process connections of
+ * @param max maximum number of connections to process
+ */
+static void
+run_eready_connections (struct MHD_Daemon *daemon,
+                        unsigned int max)
+{
+  struct MHD_Connection *pos;
+  struct MHD_Connection *next;
+  unsigned int num_ready;
+  unsigned int num_high;
+  unsigned int i;
+
+  /* process events for connections; connections that are still
+     ready afterwards are put back at the head of the list, so each
+     connection gets one turn per iteration (round-robin) and a
+     fast client cannot keep the others from being served */
+  num_ready = 0;
+  num_high = 0;
+  for (pos = daemon->eready_head; NULL != pos; pos = pos->nextE)
+    {
+      num_ready++;
+      if (MHD_PRIORITY_HIGH == pos->priority)
+        num_high++;
+    }
+  /* move connections of #MHD_PRIORITY_HIGH to the tail, keeping
+     their order, so that they are served first */
+  if ( (0 != num_high) &&
+       (num_high != num_ready) )
+    {
+      next = daemon->eready_head;
+      for (i = 0; i < num_ready; i++)
+        {
+          pos = next;
+          next = pos->nextE;
+          if (MHD_PRIORITY_HIGH != pos->priority)
+            continue;
+          EDLL_remove (daemon->eready_head,
+                       daemon->eready_tail,
+                       pos);
+          EDLL_insert_tail (daemon->eready_head,
+                            daemon->eready_tail,
+                            pos);
+        }
+    }
+  if (num_ready > max)
+    num_ready = max;
+  while ( (0 != num_ready--) &&
+          (NULL != (pos = daemon->eready_tail)) )
+    {
+      EDLL_remove (daemon->eready_head,
+		   daemon->eready_tail,
+		   pos);
+      pos->epoll_state &= ~MHD_EPOLL_STATE_IN_EREADY_EDLL;
+      if (MHD_EVENT_LOOP_INFO_READ == pos->event_loop_info)
+	pos->read_handler (pos);
+      if (MHD_EVENT_LOOP_INFO_WRITE == pos->event_loop_info)
+	pos->write_handler (pos);
+      pos->idle_handler (pos);
+    }
+}
+
+
+/**
+ * Run the handlers of the connections in the 'eready' list and
+ * handle timed-out connections, after the event loop recorded the
+ * readiness of the sockets in the connections' 'epoll_state'.
+ *
+ * @param daemon daemon to process connections of
+ */
+static void
+process_eready_connections (struct MHD_Daemon *daemon)
+{
+  /* we handle resumes here because we may have ready connections
+     that will not be placed into the epoll list immediately. */
+  if (MHD_USE_SUSPEND_RESUME == (daemon->options & MHD_USE_SUSPEND_RESUME))
+    (void) resume_suspended_connections (daemon);
+  MHD_rate_limit_process_ (daemon);
+  run_eready_connections (daemon,
+                          UINT_MAX);
+
+  /* Finally, handle timed-out connections; we need to do this here
+     as the epoll mechanism won't call the 'idle_handler' on everything,
+     as the other event loops do.  As timeouts do not get an explicit
+     event, we need to find those connections that might have timed out
+     here. */
+  process_timed_out_connections (daemon);
+}
+#endif
+
+
+#if EPOLL_SUPPORT
+/**
+ * Get the monotonic time in microseconds for the busy-poll window
+ * of #MHD_epoll() (see #MHD_OPTION_EPOLL_BUSY_POLL).
+ *
+ * @return current time, 0 if no monotonic clock is available
+ */
+static uint64_t
+busy_poll_now (void)
+{
+  struct timespec ts;
+
+  if (0 != clock_gettime (CLOCK_MONOTONIC, &ts))
+    return 0;
+  return ((uint64_t) ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/**
+ * Do epoll()-based processing (this function is allowed to
+ * block if @a may_block is set to #MHD_YES).
+ *
+ * @param daemon daemon to run poll loop for
+ * @param may_block #MHD_YES if blocking, #MHD_NO if non-blocking
+ * @return #MHD_NO on serious errors, #MHD_YES on success
+ */
+static int
+MHD_epoll (struct MHD_Daemon *daemon,
+	   int may_block)
+{
+  struct MHD_Connection *pos;
+  struct epoll_event *events;
+  struct epoll_event event;
+  int timeout_ms;
+  MHD_UNSIGNED_LONG_LONG timeout_ll;
+  int num_events;
+  unsigned int i;
+  unsigned int round;
+
+  if (-1 == daemon->epoll_fd)
+    return MHD_NO; /* we're down! */
+  if (MHD_YES == daemon->shutdown)
+    return MHD_NO;
+  if (NULL == daemon->epoll_events)
+    {
+      daemon->epoll_events_size = MHD_MIN (MAX_EVENTS,
+                                           daemon->epoll_max_events);
+      daemon->epoll_events = malloc (daemon->epoll_events_size
+                                     * sizeof (struct epoll_event));
+      if (NULL == daemon->epoll_events)
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Failed to allocate memory for epoll events\n");
+#endif
+          return MHD_NO;
+        }
+    }
+  submit_handler_steps (daemon);
+  insert_added_connections (daemon);
+  rebalance_connections (daemon);
+  drain_idle_connections (daemon);
+  reclaim_memory_budget (daemon);
+  if ( (MHD_INVALID_SOCKET != daemon->socket_fd) &&
+       (MHD_NO == at_connection_limit (daemon)) &&
+       (MHD_NO == daemon->listen_socket_in_epoll) )
+    {
+      event.events = EPOLLIN;
+      event.data.ptr = daemon;
+      if (0 != epoll_ctl (daemon->epoll_fd,
+			  EPOLL_CTL_ADD,
+			  daemon->socket_fd,
+			  &event))
+	{
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Call to epoll_ctl failed: %s\n",
+                    MHD_socket_last_strerr_ ());
+#endif
+	  return MHD_NO;
+	}
+      daemon->listen_socket_in_epoll = MHD_YES;
+    }
+  if ( (MHD_YES == daemon->listen_socket_in_epoll) &&
+       (MHD_YES == at_connection_limit (daemon)) )
+    {
+      /* we're at the connection limit, disable listen socket
+	 for event loop for now */
+      if (0 != epoll_ctl (daemon->epoll_fd,
+			  EPOLL_CTL_DEL,
+			  daemon->socket_fd,
+			  NULL))
+	MHD_PANIC ("Failed to remove listen FD from epoll set\n");
+      daemon->listen_socket_in_epoll = MHD_NO;
+    }
+  if (MHD_YES == may_block)
+    {
+      if (MHD_YES == MHD_get_timeout (daemon,
+				      &timeout_ll))
+	{
+	  if (timeout_ll >= (MHD_UNSIGNED_LONG_LONG) INT_MAX)
+	    timeout_ms = INT_MAX;
+	  else
+	    timeout_ms = (int) timeout_ll;
+	}
+      else
+	timeout_ms = -1;
+      if ( (0 != timeout_ms) &&
+           (0 != daemon->busy_poll_usec) &&
+           (busy_poll_now () - daemon->busy_poll_last_event <
+            daemon->busy_poll_usec) )
+	timeout_ms = 0; /* busy polling: our caller will call us again */
+    }
+  else
+    timeout_ms = 0;
+
+  /* drain 'epoll' event queue; need to iterate as we get at most
+     @e epoll_events_size events in one system call here.  If the
+     array was filled, it is grown (up to #MHD_OPTION_EPOLL_MAX_EVENTS)
+     and the connections that are ready already get a turn before the
+     next round collects more, so they are not kept waiting while a
+     large backlog of events is drained. */
+  for (round = 0; ; round++)
+    {
+      events = daemon->epoll_events;
+      /* update event masks */
+      loop_wait (daemon);
+      num_events = epoll_wait (daemon->epoll_fd,
+			       events,
+			       (int) daemon->epoll_events_size,
+			       timeout_ms);
+      loop_woke (daemon, num_events);
+      /* only collect events that are already pending in further
+         rounds, blocking would delay the ready connections */
+      timeout_ms = 0;
+      if (-1 == num_events)
+	{
+	  if (EINTR == MHD_socket_errno_)
+	    return MHD_YES;
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Call to epoll_wait failed: %s\n",
+                    MHD_socket_last_strerr_ ());
+#endif
+	  return MHD_NO;
+	}
+      if ( (0 != num_events) &&
+           (0 != daemon->busy_poll_usec) )
+        daemon->busy_poll_last_event = busy_poll_now ();
+      for (i=0;i<(unsigned int) num_events;i++)
+	{
+	  if (NULL == events[i].data.ptr)
+	    continue; /* shutdown signal! */
+          if ( (MHD_INVALID_PIPE_ != daemon->wpipe[0]) &&
+               (daemon->wpipe[0] == events[i].data.fd) )
+            {
+              MHD_daemon_wakeup_clear_ (daemon);
+              continue;
+            }
+	  if (daemon != events[i].data.ptr)
+	    {
+	      /* this is an event relating to a 'normal' connection,
+		 remember the event and if appropriate mark the
+		 connection as 'eready'. */
+	      pos = events[i].data.ptr;
+	      if (0 != (events[i].events & EPOLLIN))
+		{
+		  pos->epoll_state |= MHD_EPOLL_STATE_READ_READY;
+		  if ( ( (MHD_EVENT_LOOP_INFO_READ == pos->event_loop_info) ||
+			 (pos->read_buffer_size > pos->read_buffer_offset) ) &&
+		       (0 == (pos->epoll_state & MHD_EPOLL_STATE_IN_EREADY_EDLL) ) )
+		    {
+		      EDLL_insert (daemon->eready_head,
+				   daemon->eready_tail,
+				   pos);
+		      pos->epoll_state |= MHD_EPOLL_STATE_IN_EREADY_EDLL;
+		    }
+		}
+	      if (0 != (events[i].events & EPOLLOUT))
+		{
+		  pos->epoll_state |= MHD_EPOLL_STATE_WRITE_READY;
+		  if ( (MHD_EVENT_LOOP_INFO_WRITE == pos->event_loop_info) &&
+		       (0 == (pos->epoll_state & MHD_EPOLL_STATE_IN_EREADY_EDLL) ) )
+		    {
+		      EDLL_insert (daemon->eready_head,
+				   daemon->eready_tail,
+				   pos);
+		      pos->epoll_state |= MHD_EPOLL_STATE_IN_EREADY_EDLL;
+		    }
+		}
+	    }
+	  else /* must be listen socket */
+	    {
+	      /* run 'accept' until it fails or we are not allowed to take
+		 on more connections */
+	      MHD_accept_connections (daemon);
+	    }
+	}
+      if ( (daemon->epoll_events_size != (unsigned int) num_events) ||
+           (MHD_EPOLL_MAX_ROUNDS - 1 == round) )
+        break;
+      if (daemon->epoll_events_size < daemon->epoll_max_events)
+        {
+          unsigned int size;
+
+          size = MHD_MIN (daemon->epoll_events_size * 2,
+                          daemon->epoll_max_events);
+          events = realloc (daemon->epoll_events,
+                            size * sizeof (struct epoll_event));
+          if (NULL != events)
+            {
+              daemon->epoll_events = events;
+              daemon->epoll_events_size = size;
+            }
+        }
+      run_eready_connections (daemon,
+                              (unsigned int) num_events);
+      /* connections closed by the handlers are still in the epoll
+         set; the next round must not report events for them */
+      MHD_cleanup_connections (daemon);
+    }
+
+  process_eready_connections (daemon);
+  return MHD_YES;
+}
+#endif
+
+
+#if KQUEUE_SUPPORT
+/**
+ * Do kqueue()-based processing (this function is allowed to
+ * block if @a may_block is set to #MHD_YES).  Sockets are registered
+ * edge-triggered (#EV_CLEAR) and their readiness is tracked in the
+ * same 'epoll_state' bookkeeping as #MHD_epoll().  Changes of the
+ * listen socket and the timer for the next timeout are submitted by
+ * the same system call that waits for events.
+ *
+ * @param daemon daemon to run the kqueue loop for
+ * @param may_block #MHD_YES if blocking, #MHD_NO if non-blocking
+ * @return #MHD_NO on serious errors, #MHD_YES on success
+ */
+static int
+MHD_kqueue (struct MHD_Daemon *daemon,
+            int may_block)
+{
+  struct MHD_Connection *pos;
+  struct kevent events[MAX_EVENTS];
+  struct kevent changes[2];
+  struct timespec zero;
+  const struct timespec *timeout;
+  MHD_UNSIGNED_LONG_LONG timeout_ll;
+  int num_changes;
+  int num_events;
+  unsigned int i;
+
+  if (-1 == daemon->kqueue_fd)
+    return MHD_NO; /* we're down! */
+  if (MHD_YES == daemon->shutdown)
+    return MHD_NO;
+  submit_handler_steps (daemon);
+  insert_added_connections (daemon);
+  rebalance_connections (daemon);
+  drain_idle_connections (daemon);
+  reclaim_memory_budget (daemon);
+  num_changes = 0;
+  if ( (MHD_INVALID_SOCKET != daemon->socket_fd) &&
+       (MHD_NO == at_connection_limit (daemon)) &&
+       (MHD_NO == daemon->listen_socket_in_kqueue) )
+    {
+      EV_SET (&changes[num_changes++], daemon->socket_fd, EVFILT_READ,
+              EV_ADD, 0, 0, daemon);
+      daemon->listen_socket_in_kqueue = MHD_YES;
+    }
+  if ( (MHD_YES == daemon->listen_socket_in_kqueue) &&
+       (MHD_INVALID_SOCKET != daemon->socket_fd) &&
+       (MHD_YES == at_connection_limit (daemon)) )
+    {
+      /* we're at the connection limit, disable listen socket
+	 for event loop for now */
+      EV_SET (&changes[num_changes++], daemon->socket_fd, EVFILT_READ,
+              EV_DELETE, 0, 0, daemon);
+      daemon->listen_socket_in_kqueue = MHD_NO;
+    }
+  zero.tv_sec = 0;
+  zero.tv_nsec = 0;
+  timeout = &zero;
+  if (MHD_YES == may_block)
+    {
+      if (MHD_YES == MHD_get_timeout (daemon,
+				      &timeout_ll))
+	{
+          if (0 != timeout_ll)
+            {
+              /* one-shot timer, re-adding it replaces the one of
+                 the previous iteration */
+              if (timeout_ll >= (MHD_UNSIGNED_LONG_LONG) INT_MAX)
+                timeout_ll = INT_MAX;
+              EV_SET (&changes[num_changes++], 0, EVFILT_TIMER,
+                      EV_ADD | EV_ONESHOT, 0, (intptr_t) timeout_ll, NULL);
+              timeout = NULL;
+            }
+	}
+      else
+	timeout = NULL;
+    }
+
+  /* drain the kqueue; need to iterate as we get at most MAX_EVENTS
+     in one system call here, just like with epoll() */
+  num_events = MAX_EVENTS;
+  while (MAX_EVENTS == num_events)
+    {
+      loop_wait (daemon);
+      num_events = kevent (daemon->kqueue_fd,
+                           changes, num_changes,
+                           events, MAX_EVENTS,
+                           timeout);
+      loop_woke (daemon, num_events);
+      /* changes are applied by the first call, and only collect
+         events that are already pending in further rounds */
+      num_changes = 0;
+      timeout = &zero;
+      if (-1 == num_events)
+	{
+	  if (EINTR == MHD_socket_errno_)
+	    return MHD_YES;
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Call to kevent failed: %s\n",
+                    MHD_socket_last_strerr_ ());
+#endif
+	  return MHD_NO;
+	}
+      for (i=0;i<(unsigned int) num_events;i++)
+	{
+          if (0 != (events[i].flags & EV_ERROR))
+            {
+#ifdef HAVE_MESSAGES
+              MHD_DLOG (daemon,
+                        "Failed to change kqueue filter: %s\n",
+                        MHD_strerror_ ((int) events[i].data));
+#endif
+              continue;
+            }
+	  if (EVFILT_USER == events[i].filter)
+	    continue; /* shutdown signal! */
+	  if (EVFILT_TIMER == events[i].filter)
+	    continue; /* timeouts are handled below */
+          if ((void *) daemon->wpipe == events[i].udata)
+            {
+              MHD_daemon_wakeup_clear_ (daemon);
+              continue;
+            }
+	  if ((void *) daemon == events[i].udata)
+	    {
+	      /* listen socket; run 'accept' until it fails or we are
+		 not allowed to take on more connections */
+              if (MHD_INVALID_SOCKET != daemon->socket_fd)
+                MHD_accept_connections (daemon);
+	      continue;
+	    }
+	  /* this is an event relating to a 'normal' connection,
+	     remember the event and if appropriate mark the
+	     connection as 'eready'. */
+	  pos = events[i].udata;
+	  if (EVFILT_READ == events[i].filter)
+	    pos->epoll_state |= MHD_EPOLL_STATE_READ_READY;
+	  else
+	    pos->epoll_state |= MHD_EPOLL_STATE_WRITE_READY;
+          if ( (0 != (pos->epoll_state & MHD_EPOLL_STATE_SUSPENDED)) ||
+               (0 != (pos->epoll_state & MHD_EPOLL_STATE_IN_EREADY_EDLL)) )
+            continue;
+	  if ( ( (EVFILT_READ == events[i].filter) &&
+		 ( (MHD_EVENT_LOOP_INFO_READ == pos->event_loop_info) ||
+		   (pos->read_buffer_size > pos->read_buffer_offset) ) ) ||
+	       ( (EVFILT_WRITE == events[i].filter) &&
+		 (MHD_EVENT_LOOP_INFO_WRITE == pos->event_loop_info) ) )
+	    {
+	      EDLL_insert (daemon->eready_head,
+			   daemon->eready_tail,
+			   pos);
+	      pos->epoll_state |= MHD_EPOLL_STATE_IN_EREADY_EDLL;
+	    }
+	}
+    }
+
+  process_eready_connections (daemon);
+  return MHD_YES;
+}
+#endif
+
+
+#if IO_URING_SUPPORT
+/**
+ * Do io_uring-based processing (this function is allowed to
+ * block if @a may_block is set to #MHD_YES).  Readiness is tracked
+ * with one multishot poll request per socket, using the same
+ * 'epoll_state' bookkeeping as #MHD_epoll(); all requests queued
+ * since the last iteration are submitted by the same system call
+ * that waits for completions.
+ *
+ * @param daemon daemon to run the io_uring loop for
+ * @param may_block #MHD_YES if blocking, #MHD_NO if non-blocking
+ * @return #MHD_NO on serious errors, #MHD_YES on success
+ */
+static int
+MHD_io_uring (struct MHD_Daemon *daemon,
+              int may_block)
+{
+  struct MHD_Connection *pos;
+  struct io_uring_cqe *cqe;
+  MHD_UNSIGNED_LONG_LONG timeout_ll;
+  uint64_t user_data;
+  unsigned int flags;
+  unsigned int num_cqes;
+  int timeout_ms;
+  int res;
+
+  if (-1 == daemon->uring.fd)
+    return MHD_NO; /* we're down! */
+  if (MHD_YES == daemon->shutdown)
+    return MHD_NO;
+  drain_idle_connections (daemon);
+  reclaim_memory_budget (daemon);
+  if ( (MHD_INVALID_SOCKET != daemon->socket_fd) &&
+       (MHD_NO == at_connection_limit (daemon)) &&
+       (MHD_NO == daemon->listen_socket_in_epoll) )
+    {
+      if (MHD_YES != MHD_io_uring_poll_add_ (&daemon->uring,
+                                             daemon->socket_fd,
+                                             EPOLLIN,
+                                             (uint64_t) (uintptr_t) daemon))
+	{
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "io_uring submission queue is full\n");
+#endif
+	  return MHD_NO;
+	}
+      daemon->listen_socket_in_epoll = MHD_YES;
+    }
+  if ( (MHD_YES == daemon->listen_socket_in_epoll) &&
+       ( (MHD_YES == at_connection_limit (daemon)) ||
+         (MHD_INVALID_SOCKET == daemon->socket_fd) ) )
+    {
+      /* we're at the connection limit (or were quiesced), disable
+	 listen socket for event loop for now */
+      if (MHD_YES != MHD_io_uring_poll_remove_ (&daemon->uring,
+                                                (uint64_t) (uintptr_t) daemon))
+	MHD_PANIC ("Failed to remove listen FD from io_uring\n");
+      daemon->listen_socket_in_epoll = MHD_NO;
+    }
+  if ( (MHD_INVALID_PIPE_ != daemon->wpipe[0]) &&
+       (MHD_NO == daemon->wpipe_in_uring) )
+    {
+      if (MHD_YES != MHD_io_uring_poll_add_ (&daemon->uring,
+                                             daemon->wpipe[0],
+                                             EPOLLIN,
+                                             (uint64_t) (uintptr_t) daemon->wpipe))
+	{
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "io_uring submission queue is full\n");
+#endif
+	  return MHD_NO;
+	}
+      daemon->wpipe_in_uring = MHD_YES;
+    }
+  if (MHD_YES == may_block)
+    {
+      if (MHD_YES == MHD_get_timeout (daemon,
+				      &timeout_ll))
+	{
+	  if (timeout_ll >= (MHD_UNSIGNED_LONG_LONG) INT_MAX)
+	    timeout_ms = INT_MAX;
+	  else
+	    timeout_ms = (int) timeout_ll;
+	}
+      else
+	timeout_ms = -1;
+    }
+  else
+    timeout_ms = 0;
+
+  loop_wait (daemon);
+  if (MHD_YES != MHD_io_uring_enter_ (&daemon->uring,
+                                      timeout_ms))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Call to io_uring_enter failed: %s\n",
+                MHD_strerror_ (errno));
+#endif
+      return MHD_NO;
+    }
+  loop_woke (daemon, 0);
+  num_cqes = 0;
+  while (NULL != (cqe = MHD_io_uring_peek_cqe_ (&daemon->uring)))
+    {
+      num_cqes++;
+      user_data = cqe->user_data;
+      res = cqe->res;
+      flags = cqe->flags;
+      MHD_io_uring_cqe_seen_ (&daemon->uring);
+      if (MHD_IO_URING_DATA_IGNORE == user_data)
+        continue; /* completion of a cancellation request */
+      if ((uint64_t) (uintptr_t) daemon->wpipe == user_data)
+        {
+          if (res > 0)
+            MHD_daemon_wakeup_clear_ (daemon);
+          if (0 == (flags & IORING_CQE_F_MORE))
+            daemon->wpipe_in_uring = MHD_NO; /* re-arm next time */
+          continue;
+        }
+      if ((uint64_t) (uintptr_t) daemon == user_data)
+        {
+          /* listen socket; run 'accept' until it fails or we are
+             not allowed to take on more connections */
+          if ( (res > 0) &&
+               (MHD_YES == daemon->listen_socket_in_epoll) &&
+               (MHD_INVALID_SOCKET != daemon->socket_fd) )
+            MHD_accept_connections (daemon);
+          if ( (0 == (flags & IORING_CQE_F_MORE)) &&
+               (-ECANCELED != res) )
+            daemon->listen_socket_in_epoll = MHD_NO; /* re-arm next time */
+          continue;
+        }
+      pos = (struct MHD_Connection *) (uintptr_t) user_data;
+      if (0 != (pos->epoll_state & MHD_EPOLL_STATE_URING_ZOMBIE))
+        {
+          /* connection was cleaned up, free it once the
+             cancelled poll request is gone */
+          if (0 == (flags & IORING_CQE_F_MORE))
+            {
+              DLL_remove (daemon->uring_zombie_head,
+                          daemon->uring_zombie_tail,
+                          pos);
+              free (pos);
+            }
+          continue;
+        }
+      if (0 == (flags & IORING_CQE_F_MORE))
+        {
+          /* the kernel terminated the multishot request, let the
+             handlers find out what is going on with the socket;
+             MHD_connection_epoll_update_() arms a new request */
+          pos->epoll_state &= ~MHD_EPOLL_STATE_IN_EPOLL_SET;
+          if (res <= 0)
+            res = EPOLLIN | EPOLLOUT;
+        }
+      if (res <= 0)
+        continue;
+      /* this is an event relating to a 'normal' connection,
+         remember the event and if appropriate mark the
+         connection as 'eready'. */
+      if (0 != (res & EPOLLIN))
+        pos->epoll_state |= MHD_EPOLL_STATE_READ_READY;
+      if (0 != (res & EPOLLOUT))
+        pos->epoll_state |= MHD_EPOLL_STATE_WRITE_READY;
+      if ( (0 != (pos->epoll_state & MHD_EPOLL_STATE_SUSPENDED)) ||
+           (0 != (pos->epoll_state & MHD_EPOLL_STATE_IN_EREADY_EDLL)) )
+        continue;
+      if ( ( (0 != (res & EPOLLIN)) &&
+             ( (MHD_EVENT_LOOP_INFO_READ == pos->event_loop_info) ||
+               (pos->read_buffer_size > pos->read_buffer_offset) ) ) ||
+           ( (0 != (res & EPOLLOUT)) &&
+             (MHD_EVENT_LOOP_INFO_WRITE == pos->event_loop_info) ) ||
+           (0 == (pos->epoll_state & MHD_EPOLL_STATE_IN_EPOLL_SET)) )
+        {
+          EDLL_insert (daemon->eready_head,
+                       daemon->eready_tail,
+                       pos);
+          pos->epoll_state |= MHD_EPOLL_STATE_IN_EREADY_EDLL;
+        }
+    }
+  if (0 != num_cqes)
+    MHD_STATS_ADD_ (daemon, loop_events, num_cqes);
+
+  process_eready_connections (daemon);
+  return MHD_YES;
+}
+#endif
+
+
+/**
+ * Run webserver operations (without blocking unless in client
+ * callbacks).  This method should be called by clients in combination
+ * with #MHD_get_fdset if the client-controlled select method is used.
+ *
+ * This function is a convenience method, which is useful if the
+ * fd_sets from #MHD_get_fdset were not directly passed to `select()`;
+ * with this function, MHD will internally do the appropriate `select()`
+ * call itself again.  While it is always safe to call #MHD_run (in
+ * external select mode), you should call #MHD_run_from_select if
+ * performance is important (as it saves an expensive call to
+ * `select()`).
+ *
+ * @param daemon daemon to run
+ * @return #MHD_YES on success, #MHD_NO if this
+ *         daemon was not started with the right
+ *         options for this call.
+ * @ingroup event
+ */
+int
+MHD_run (struct MHD_Daemon *daemon)
+{
+  if ( (MHD_YES == daemon->shutdown) ||
+       (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) ||
+       (0 != (daemon->options & MHD_USE_SELECT_INTERNALLY)) )
+    return MHD_NO;
+  loop_begin (daemon);
+  if (0 != (daemon->options & MHD_USE_POLL))
+  {
+    MHD_poll (daemon, MHD_NO);
+    MHD_cleanup_connections (daemon);
+  }
+#if EPOLL_SUPPORT
+  else if (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY))
+  {
+    MHD_epoll (daemon, MHD_NO);
+    MHD_cleanup_connections (daemon);
+  }
+#endif
+#if KQUEUE_SUPPORT
+  else if (0 != (daemon->options & MHD_USE_KQUEUE))
+  {
+    MHD_kqueue (daemon, MHD_NO);
+    MHD_cleanup_connections (daemon);
+  }
+#endif
+  else
+  {
+    MHD_select (daemon, MHD_NO);
+    /* MHD_select does MHD_cleanup_connections already */
+  }
+  loop_done (daemon);
+  return MHD_YES;
+}
+
+
+/**
+ * Determine the CPU to pin the thread of worker @a i to (see
+ * #MHD_OPTION_THREAD_POOL_CPU_AFFINITY).
+ *
+ * @param daemon master daemon
+ * @param i index of the worker
+ * @return the CPU, -1 if it cannot be determined
+ */
+static int
+get_worker_cpu (struct MHD_Daemon *daemon,
+                unsigned int i)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+  cpu_set_t set;
+  unsigned int num_cpus;
+  int cpu;
+
+  if ( (NULL != daemon->worker_cpus) &&
+       (0 != daemon->num_worker_cpus) )
+    return (int) daemon->worker_cpus[i % daemon->num_worker_cpus];
+  CPU_ZERO (&set);
+  if ( (0 != sched_getaffinity (0, sizeof (set), &set)) ||
+       (0 == (num_cpus = CPU_COUNT (&set))) )
+    return -1;
+  i %= num_cpus;
+  for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    if ( (CPU_ISSET (cpu, &set)) &&
+         (0 == i--) )
+      return cpu;
+#endif
+  return -1;
+}
+
+
+/**
+ * Pin the calling thread to the CPU of @a daemon.
+ *
+ * @param daemon daemon (or worker) run by the calling thread
+ */
+static void
+pin_thread (struct MHD_Daemon *daemon)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+  cpu_set_t set;
+  int ret;
+
+  if (daemon->worker_cpu >= CPU_SETSIZE)
+    ret = EINVAL;
+  else
+    {
+      CPU_ZERO (&set);
+      CPU_SET (daemon->worker_cpu, &set);
+      ret = pthread_setaffinity_np (pthread_self (), sizeof (set), &set);
+    }
+  if (0 != ret)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to pin thread to CPU %d: %s\n",
+                daemon->worker_cpu,
+                MHD_strerror_ (ret));
+#endif
+    }
+#endif
+}
+
+
+static void
+close_all_connections (struct MHD_Daemon *daemon);
+
+
+static void
+free_worker (struct MHD_Daemon *worker);
+
+
+/**
+ * Thread that runs the select loop until the daemon
+ * is explicitly shut down.
+ *
+ * @param cls 'struct MHD_Deamon' to run select loop in a thread for
+ * @return always 0 (on shutdown)
+ */
+static MHD_THRD_RTRN_TYPE_ MHD_THRD_CALL_SPEC_
+MHD_select_thread (void *cls)
+{
+  struct MHD_Daemon *daemon = cls;
+
+  /* before the thread allocates anything: memory is placed on the
+     NUMA node of the CPU that first writes to it */
+  if (-1 != daemon->worker_cpu)
+    pin_thread (daemon);
+  while (MHD_YES != daemon->shutdown)
+    {
+      loop_begin (daemon);
+      if (0 != (daemon->options & MHD_USE_POLL))
+	MHD_poll (daemon, MHD_YES);
+#if IO_URING_SUPPORT
+      else if (MHD_USE_IO_URING_LINUX_ONLY == (daemon->options & MHD_USE_IO_URING_LINUX_ONLY))
+	MHD_io_uring (daemon, MHD_YES);
+#endif
+#if EPOLL_SUPPORT
+      else if (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY))
+	MHD_epoll (daemon, MHD_YES);
+#endif
+#if KQUEUE_SUPPORT
+      else if (0 != (daemon->options & MHD_USE_KQUEUE))
+	MHD_kqueue (daemon, MHD_YES);
+#endif
+      else
+	MHD_select (daemon, MHD_YES);
+      MHD_cleanup_connections (daemon);
+      loop_done (daemon);
+    }
+  /* workers close their connections in parallel, the master only
+     collects the threads */
+  if (NULL != daemon->master)
+    close_all_connections (daemon);
+  return (MHD_THRD_RTRN_TYPE_)0;
+}
+
+
+#ifdef DAUTH_SUPPORT
+/**
+ * Free the nonce-nc map of a (master) daemon and its locks, unless
+ * they are in the shared memory of #MHD_OPTION_PREFORK_WORKERS.
+ *
+ * @param daemon daemon to free the map of
+ */
+static void
+nonce_nc_free (struct MHD_Daemon *daemon)
+{
+  unsigned int i;
+
+  if ( (NULL == daemon->prefork) &&
+       (NULL != daemon->nnc_locks) )
+    {
+      for (i = 0; i < MHD_NONCE_NC_LOCKS; i++)
+        (void) MHD_mutex_destroy_ (&daemon->nnc_locks->locks[i]);
+      free (daemon->nnc_locks);
+      free (daemon->nnc);
+    }
+  daemon->nnc_locks = NULL;
+  daemon->nnc = NULL;
+}
+
+
+/**
+ * Create the nonce-nc map of a (master) daemon for digest
+ * authentication, rounding its size up to full sets, and its
+ * H(A1) cache.
+ *
+ * @param daemon daemon to create the map for
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+static int
+MHD_nonce_nc_init (struct MHD_Daemon *daemon)
+{
+  unsigned int i;
+  size_t sets;
+
+  daemon->nnc = NULL;
+  daemon->nnc_locks = NULL;
+#if PREFORK_SUPPORT
+  if (NULL != daemon->prefork)
+    MHD_prefork_nonce_nc_ (daemon);
+  else
+#endif
+    {
+      daemon->nnc_locks = calloc (1, sizeof (struct MHD_NonceNcLocks));
+      if (NULL == daemon->nnc_locks)
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Failed to allocate memory for nonce-nc map: %s\n",
+                    MHD_strerror_ (errno));
+#endif
+          return MHD_NO;
+        }
+      if (daemon->nonce_nc_size > 0)
+        {
+          sets = (daemon->nonce_nc_size / MHD_NONCE_NC_WAYS) +
+            ((0 != daemon->nonce_nc_size % MHD_NONCE_NC_WAYS) ? 1 : 0);
+          daemon->nnc = calloc (sets * MHD_NONCE_NC_WAYS,
+                                sizeof (struct MHD_NonceNc));
+          if (NULL == daemon->nnc)
+            {
+#ifdef HAVE_MESSAGES
+              MHD_DLOG (daemon,
+                        "Failed to allocate memory for nonce-nc map: %s\n",
+                        MHD_strerror_ (errno));
+#endif
+              free (daemon->nnc_locks);
+              daemon->nnc_locks = NULL;
+              return MHD_NO;
+            }
+        }
+      for (i = 0; i < MHD_NONCE_NC_LOCKS; i++)
+        {
+          if (MHD_YES != MHD_mutex_create_ (&daemon->nnc_locks->locks[i]))
+            {
+#ifdef HAVE_MESSAGES
+              MHD_DLOG (daemon,
+                        "MHD failed to initialize nonce-nc mutex\n");
+#endif
+              while (i > 0)
+                (void) MHD_mutex_destroy_ (&daemon->nnc_locks->locks[--i]);
+              free (daemon->nnc_locks);
+              daemon->nnc_locks = NULL;
+              free (daemon->nnc);
+              daemon->nnc = NULL;
+              return MHD_NO;
+            }
+        }
+    }
+  if (MHD_YES != MHD_digest_ha1_cache_init_ (daemon))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to allocate H(A1) cache: %s\n",
+                MHD_strerror_ (errno));
+#endif
+      nonce_nc_free (daemon);
+      return MHD_NO;
+    }
+  return MHD_YES;
+}
+
+
+/**
+ * Destroy the nonce-nc map and the H(A1) cache of a (master) daemon.
+ *
+ * @param daemon daemon to destroy the map of
+ */
+static void
+MHD_nonce_nc_destroy (struct MHD_Daemon *daemon)
+{
+  MHD_digest_ha1_cache_destroy_ (daemon);
+  nonce_nc_free (daemon);
+}
+#endif
+
+
+/**
+ * Start a webserver on the given port.  Variadic version of
+ * #MHD_start_daemon_va.
+ *
+ * @param flags combination of `enum MHD_FLAG` values
+ * @param port port to bind to
+ * @param apc callback to call to check which clients
+ *        will be allowed to connect; you can pass NULL
+ *        in which case connections from any IP will be
+ *        accepted
+ * @param apc_cls extra argument to @a apc
+ * @param dh handler called for all requests (repeatedly)
+ * @param dh_cls extra argument to @a dh
+ * @return NULL on error, handle to daemon on success
+ * @ingroup event
+ */
+struct MHD_Daemon *
+MHD_start_daemon (unsigned int flags,
+                  uint16_t port,
+                  MHD_AcceptPolicyCallback apc,
+                  void *apc_cls,
+                  MHD_AccessHandlerCallback dh, void *dh_cls, ...)
+{
+  struct MHD_Daemon *daemon;
+  va_list ap;
+
+  va_start (ap, dh_cls);
+  daemon = MHD_start_daemon_va (flags, port, apc, apc_cls, dh, dh_cls, ap);
+  va_end (ap);
+  return daemon;
+}
+
+
+/**
+ * Stop accepting connections from the listening socket.  Allows
+ * clients to continue processing, but stops accepting new
+ * connections.  Note that the caller is responsible for closing the
+ * returned socket; however, if MHD is run using threads (anything but
+ * external select mode), it must not be closed until AFTER
+ * #MHD_stop_daemon has been called (as it is theoretically possible
+ * that an existing thread is still using it).
+ *
+ * Note that some thread modes require the caller to have passed
+ * #MHD_USE_PIPE_FOR_SHUTDOWN when using this API.  If this daemon is
+ * in one of those modes and this option was not given to
+ * #MHD_start_daemon, this function will return #MHD_INVALID_SOCKET.
+ *
+ * @param daemon daemon to stop accepting new connections for
+ * @return old listen socket on success, #MHD_INVALID_SOCKET if
+ *         the daemon was already not listening anymore
+ * @ingroup specialized
+ */
+MHD_socket
+MHD_quiesce_daemon (struct MHD_Daemon *daemon)
+{
+  unsigned int i;
+  MHD_socket ret;
+
+  ret = daemon->socket_fd;
+  if (MHD_INVALID_SOCKET == ret)
+    return MHD_INVALID_SOCKET;
+  if ( (MHD_INVALID_PIPE_ == daemon->wpipe[1]) &&
+       (0 != (daemon->options & (MHD_USE_SELECT_INTERNALLY | MHD_USE_THREAD_PER_CONNECTION))) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+		"Using MHD_quiesce_daemon in this mode requires MHD_USE_PIPE_FOR_SHUTDOWN\n");
+#endif
+      return MHD_INVALID_SOCKET;
+    }
+
+  if (NULL != daemon->worker_pool)
+    for (i = 0; i < daemon->worker_pool_size; i++)
+      {
+        struct MHD_Daemon *worker = &daemon->worker_pool[i];
+        MHD_socket wfd = worker->socket_fd;
+
+	worker->socket_fd = MHD_INVALID_SOCKET;
+#if EPOLL_SUPPORT
+	if ( (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY)) &&
+	     (-1 != worker->epoll_fd) &&
+	     (MHD_YES == worker->listen_socket_in_epoll) )
+	  {
+	    if (0 != epoll_ctl (worker->epoll_fd,
+				EPOLL_CTL_DEL,
+				wfd,
+				NULL))
+	      MHD_PANIC ("Failed to remove listen FD from epoll set\n");
+	    worker->listen_socket_in_epoll = MHD_NO;
+	  }
+#endif
+#if KQUEUE_SUPPORT
+	if ( (0 != (daemon->options & MHD_USE_KQUEUE)) &&
+	     (-1 != worker->kqueue_fd) &&
+	     (MHD_YES == worker->listen_socket_in_kqueue) )
+	  {
+            struct kevent change;
+
+            EV_SET (&change, wfd, EVFILT_READ, EV_DELETE, 0, 0, worker);
+	    if (0 != kevent (worker->kqueue_fd,
+                             &change, 1,
+                             NULL, 0,
+                             NULL))
+	      MHD_PANIC ("Failed to remove listen FD from kqueue\n");
+	    worker->listen_socket_in_kqueue = MHD_NO;
+	  }
+#endif
+#if IO_URING_SUPPORT
+        /* only the worker's thread may use its ring, wake it up so
+           that it removes the listen socket itself */
+	if ( (MHD_USE_IO_URING_LINUX_ONLY == (daemon->options & MHD_USE_IO_URING_LINUX_ONLY)) &&
+	     (MHD_INVALID_PIPE_ != worker->wpipe[1]) &&
+	     (MHD_YES != MHD_itc_activate_ (worker->wpipe[1])) )
+	  MHD_PANIC ("failed to signal quiesce via pipe");
+#endif
+#ifdef HAVE_LISTEN_SHUTDOWN
+        /* Leave the SO_REUSEPORT group so that the kernel stops
+           queueing connections for this worker; the socket itself
+           is closed by #MHD_stop_daemon(). */
+        if ( (MHD_INVALID_SOCKET != worker->worker_socket_fd) &&
+             (wfd == worker->worker_socket_fd) )
+          (void) shutdown (wfd, SHUT_RDWR);
+#endif
+      }
+  if (NULL != daemon->notify_socket)
+    daemon->notify_socket (daemon->notify_socket_cls,
+                           ret,
+                           MHD_SOCKET_INTEREST_REMOVE,
+                           &daemon->socket_fd,
+                           &daemon->listen_socket_interest_cls);
+  daemon->socket_fd = MHD_INVALID_SOCKET;
+#if EPOLL_SUPPORT
+  if ( (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY)) &&
+       (-1 != daemon->epoll_fd) &&
+       (MHD_YES == daemon->listen_socket_in_epoll) )
+    {
+      if (0 != epoll_ctl (daemon->epoll_fd,
+			  EPOLL_CTL_DEL,
+			  ret,
+			  NULL))
+	MHD_PANIC ("Failed to remove listen FD from epoll set\n");
+      daemon->listen_socket_in_epoll = MHD_NO;
+    }
+#endif
+#if KQUEUE_SUPPORT
+  if ( (0 != (daemon->options & MHD_USE_KQUEUE)) &&
+       (-1 != daemon->kqueue_fd) &&
+       (MHD_YES == daemon->listen_socket_in_kqueue) )
+    {
+      struct kevent change;
+
+      EV_SET (&change, ret, EVFILT_READ, EV_DELETE, 0, 0, daemon);
+      if (0 != kevent (daemon->kqueue_fd,
+                       &change, 1,
+                       NULL, 0,
+                       NULL))
+	MHD_PANIC ("Failed to remove listen FD from kqueue\n");
+      daemon->listen_socket_in_kqueue = MHD_NO;
+    }
+#endif
+#if IO_URING_SUPPORT
+  if ( (MHD_USE_IO_URING_LINUX_ONLY == (daemon->options & MHD_USE_IO_URING_LINUX_ONLY)) &&
+       (NULL == daemon->worker_pool) &&
+       (MHD_INVALID_PIPE_ != daemon->wpipe[1]) &&
+       (MHD_YES != MHD_itc_activate_ (daemon->wpipe[1])) )
+    MHD_PANIC ("failed to signal quiesce via pipe");
+#endif
+  return ret;
+}
+
+
+/**
+ * Make @a daemon stop offering keep-alive and close its idle
+ * connections, see #MHD_handoff_listen_socket() and
+ * #MHD_OPTION_SHUTDOWN_GRACE_MS.
+ *
+ * @param daemon daemon (or worker) to drain
+ */
+static void
+start_draining (struct MHD_Daemon *daemon)
+{
+  daemon->draining = MHD_YES;
+#ifdef HAVE_ATOMIC_BUILTINS
+  __atomic_store_n (&daemon->drain_pending,
+                    MHD_YES,
+                    __ATOMIC_RELEASE);
+#else
+  daemon->drain_pending = MHD_YES;
+#endif
+  if (MHD_YES != MHD_daemon_wakeup_ (daemon))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to signal draining via pipe\n");
+#endif
+    }
+}
+
+
+/**
+ * Hand the listen socket of @a daemon over to another process for a
+ * restart without refusing connections.  The socket is sent over
+ * @a channel, then the daemon is quiesced and drained.
+ *
+ * @param daemon daemon to hand the listen socket over from
+ * @param channel connected AF_UNIX socket to the successor
+ * @return old listen socket on success, #MHD_INVALID_SOCKET on error
+ * @ingroup specialized
+ */
+MHD_socket
+MHD_handoff_listen_socket (struct MHD_Daemon *daemon,
+                           MHD_socket channel)
+{
+#if MHD_SOCKET_HANDOFF
+  union
+  {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE (sizeof (int))];
+  } control;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  char byte;
+  ssize_t sent;
+  MHD_socket ret;
+  unsigned int i;
+
+  if (MHD_INVALID_SOCKET == daemon->socket_fd)
+    return MHD_INVALID_SOCKET;
+  /* check before sending, the daemon must not keep accepting once
+     the successor has the socket */
+  if ( (MHD_INVALID_PIPE_ == daemon->wpipe[1]) &&
+       (0 != (daemon->options & (MHD_USE_SELECT_INTERNALLY | MHD_USE_THREAD_PER_CONNECTION))) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+		"Using MHD_handoff_listen_socket in this mode requires MHD_USE_PIPE_FOR_SHUTDOWN\n");
+#endif
+      return MHD_INVALID_SOCKET;
+    }
+  byte = 0;
+  iov.iov_base = &byte;
+  iov.iov_len = 1;
+  memset (&msg, 0, sizeof (msg));
+  memset (&control, 0, sizeof (control));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof (control.buf);
+  cmsg = CMSG_FIRSTHDR (&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN (sizeof (int));
+  memcpy (CMSG_DATA (cmsg),
+          &daemon->socket_fd,
+          sizeof (int));
+  do
+    sent = sendmsg (channel, &msg, MSG_NOSIGNAL);
+  while ( (0 > sent) &&
+          (EINTR == errno) );
+  if (1 != sent)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to send listen socket: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+      return MHD_INVALID_SOCKET;
+    }
+  ret = MHD_quiesce_daemon (daemon);
+  start_draining (daemon);
+  if (NULL != daemon->worker_pool)
+    for (i = 0; i < daemon->worker_pool_size; i++)
+      start_draining (&daemon->worker_pool[i]);
+  return ret;
+#else
+#ifdef HAVE_MESSAGES
+  MHD_DLOG (daemon,
+            "Passing listen sockets is not supported on this platform\n");
+#endif
+  return MHD_INVALID_SOCKET;
+#endif
+}
+
+
+/**
+ * Receive a listen socket sent by #MHD_handoff_listen_socket().
+ *
+ * @param channel connected AF_UNIX socket to the predecessor
+ * @return the listen socket, #MHD_INVALID_SOCKET on error
+ * @ingroup specialized
+ */
+MHD_socket
+MHD_receive_listen_socket (MHD_socket channel)
+{
+#if MHD_SOCKET_HANDOFF
+  union
+  {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE (sizeof (int))];
+  } control;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  char byte;
+  ssize_t got;
+  int flags;
+  int fd;
+
+  iov.iov_base = &byte;
+  iov.iov_len = 1;
+  memset (&msg, 0, sizeof (msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof (control.buf);
+  flags = 0;
+#ifdef MSG_CMSG_CLOEXEC
+  flags |= MSG_CMSG_CLOEXEC;
+#endif
+  do
+    got = recvmsg (channel, &msg, flags);
+  while ( (0 > got) &&
+          (EINTR == errno) );
+  if (1 != got)
+    return MHD_INVALID_SOCKET;
+  fd = MHD_INVALID_SOCKET;
+  for (cmsg = CMSG_FIRSTHDR (&msg); NULL != cmsg; cmsg = CMSG_NXTHDR (&msg, cmsg))
+    if ( (SOL_SOCKET == cmsg->cmsg_level) &&
+         (SCM_RIGHTS == cmsg->cmsg_type) &&
+         (CMSG_LEN (sizeof (int)) <= cmsg->cmsg_len) )
+      {
+        memcpy (&fd,
+                CMSG_DATA (cmsg),
+                sizeof (int));
+        break;
+      }
+  if (0 != (msg.msg_flags & MSG_CTRUNC))
+    {
+      /* more descriptors than expected, those were closed */
+      if (MHD_INVALID_SOCKET != fd)
+        (void) MHD_socket_close_ (fd);
+      return MHD_INVALID_SOCKET;
+    }
+#ifndef MSG_CMSG_CLOEXEC
+  if (MHD_INVALID_SOCKET != fd)
+    (void) fcntl (fd, F_SETFD, FD_CLOEXEC);
+#endif
+  return fd;
+#else
+  return MHD_INVALID_SOCKET;
+#endif
+}
+
+
+#if MHD_IP_FILTER
+/**
+ * Normalized IP filter rule: the address as (up to) four words in
+ * host byte order together with the mask of the bits to compare.
+ */
+struct IpFilterRange
+{
+  /**
+   * Masked address words.
+   */
+  uint32_t val[4];
+
+  /**
+   * Masks for the address words.
+   */
+  uint32_t mask[4];
+};
+
+
+/**
+ * Append an instruction to the filter program.
+ *
+ * @param prog program to extend
+ * @param pos[in,out] number of instructions in @a prog so far
+ * @param code opcode
+ * @param jt jump offset if true
+ * @param jf jump offset if false
+ * @param k constant operand
+ * @return #MHD_YES on success, #MHD_NO if the program is too long
+ */
+static int
+ip_filter_emit (struct sock_filter *prog,
+                unsigned int *pos,
+                uint16_t code,
+                uint8_t jt,
+                uint8_t jf,
+                uint32_t k)
+{
+  if (BPF_MAXINSNS <= *pos)
+    return MHD_NO;
+  prog[*pos].code = code;
+  prog[*pos].jt = jt;
+  prog[*pos].jf = jf;
+  prog[*pos].k = k;
+  (*pos)++;
+  return MHD_YES;
+}
+
+
+/**
+ * Convert @a rule into an address range.
+ *
+ * @param rule rule given by the application
+ * @param range[out] set to the normalized range
+ * @return 4 for IPv4 ranges, 6 for IPv6 ranges, 0 if @a rule is invalid
+ */
+static int
+ip_filter_range (const struct MHD_IpFilterRule *rule,
+                 struct IpFilterRange *range)
+{
+  const unsigned char *bytes;
+  unsigned int words;
+  unsigned int prefix;
+  unsigned int i;
+  int version;
+
+  if (NULL == rule->addr)
+    return 0;
+  prefix = rule->prefix_len;
+  if (AF_INET == rule->addr->sa_family)
+    {
+      bytes = (const unsigned char *)
+        &((const struct sockaddr_in *) rule->addr)->sin_addr;
+      words = 1;
+      version = 4;
+    }
+#if HAVE_INET6
+  else if (AF_INET6 == rule->addr->sa_family)
+    {
+      static const unsigned char v4mapped[12] =
+        { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+
+      bytes = (const unsigned char *)
+        &((const struct sockaddr_in6 *) rule->addr)->sin6_addr;
+      words = 4;
+      version = 6;
+      if ( (96 <= prefix) &&
+           (0 == memcmp (bytes, v4mapped, sizeof (v4mapped))) )
+        {
+          /* IPv4 clients arrive as IPv4 packets even on dual-stack sockets */
+          bytes += sizeof (v4mapped);
+          prefix -= 96;
+          words = 1;
+          version = 4;
+        }
+    }
+#endif
+  else
+    return 0;
+  if (prefix > 32 * words)
+    return 0;
+  memset (range, 0, sizeof (struct IpFilterRange));
+  for (i = 0; i < words; i++)
+    {
+      if (prefix >= 32)
+        range->mask[i] = 0xFFFFFFFFU;
+      else if (prefix > 0)
+        range->mask[i] = ~(0xFFFFFFFFU >> prefix);
+      prefix = (prefix >= 32) ? prefix - 32 : 0;
+      range->val[i] = (((uint32_t) bytes[4 * i] << 24) |
+                       ((uint32_t) bytes[4 * i + 1] << 16) |
+                       ((uint32_t) bytes[4 * i + 2] << 8) |
+                       (uint32_t) bytes[4 * i + 3]) & range->mask[i];
+    }
+  return version;
+}
+
+
+/**
+ * Build the classic BPF program for #MHD_set_ip_filter().  The
+ * program loads the source address from the network header of the
+ * SYN and compares it to each range of the matching IP version.
+ *
+ * @param ranges normalized ranges
+ * @param versions IP version of each range
+ * @param num number of ranges
+ * @param match value to return for packets matching a range
+ * @param prog[out] buffer of #BPF_MAXINSNS instructions
+ * @param len[out] set to the number of instructions used
+ * @return #MHD_YES on success, #MHD_NO if the program is too long
+ */
+static int
+ip_filter_build (const struct IpFilterRange *ranges,
+                 const int *versions,
+                 unsigned int num,
+                 uint32_t match,
+                 struct sock_filter *prog,
+                 unsigned int *len)
+{
+  const uint32_t nomatch = (0 == match) ? 0xFFFFFFFFU : 0;
+  unsigned int pos;
+  unsigned int ja4;
+  unsigned int ja6;
+  unsigned int i;
+  unsigned int w;
+  unsigned int left;
+
+  pos = 0;
+  /* A = IP version */
+  ip_filter_emit (prog, &pos, BPF_LD | BPF_B | BPF_ABS, 0, 0, SKF_NET_OFF);
+  ip_filter_emit (prog, &pos, BPF_ALU | BPF_RSH | BPF_K, 0, 0, 4);
+  ip_filter_emit (prog, &pos, BPF_JMP | BPF_JEQ | BPF_K, 0, 1, 4);
+  ja4 = pos;
+  ip_filter_emit (prog, &pos, BPF_JMP | BPF_JA, 0, 0, 0);
+  ip_filter_emit (prog, &pos, BPF_JMP | BPF_JEQ | BPF_K, 0, 1, 6);
+  ja6 = pos;
+  ip_filter_emit (prog, &pos, BPF_JMP | BPF_JA, 0, 0, 0);
+  /* not IP, nothing to filter */
+  ip_filter_emit (prog, &pos, BPF_RET | BPF_K, 0, 0, 0xFFFFFFFFU);
+
+  /* IPv4: M[0] = source address */
+  prog[ja4].k = pos - ja4 - 1;
+  ip_filter_emit (prog, &pos, BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_NET_OFF + 12);
+  ip_filter_emit (prog, &pos, BPF_ST, 0, 0, 0);
+  for (i = 0; i < num; i++)
+    {
+      if (4 != versions[i])
+        continue;
+      ip_filter_emit (prog, &pos, BPF_LD | BPF_MEM, 0, 0, 0);
+      ip_filter_emit (prog, &pos, BPF_ALU | BPF_AND | BPF_K, 0, 0,
+                      ranges[i].mask[0]);
+      ip_filter_emit (prog, &pos, BPF_JMP | BPF_JEQ | BPF_K, 0, 1,
+                      ranges[i].val[0]);
+      if (MHD_NO ==
+          ip_filter_emit (prog, &pos, BPF_RET | BPF_K, 0, 0, match))
+        return MHD_NO;
+    }
+  ip_filter_emit (prog, &pos, BPF_RET | BPF_K, 0, 0, nomatch);
+
+  /* IPv6: compare the source address word by word */
+  prog[ja6].k = pos - ja6 - 1;
+  for (i = 0; i < num; i++)
+    {
+      if (6 != versions[i])
+        continue;
+      left = 0;
+      for (w = 0; w < 4; w++)
+        if (0 != ranges[i].mask[w])
+          left++;
+      for (w = 0; w < 4; w++)
+        {
+          if (0 == ranges[i].mask[w])
+            continue;
+          left--;
+          ip_filter_emit (prog, &pos, BPF_LD | BPF_W | BPF_ABS, 0, 0,
+                          SKF_NET_OFF + 8 + 4 * w);
+          ip_filter_emit (prog, &pos, BPF_ALU | BPF_AND | BPF_K, 0, 0,
+                          ranges[i].mask[w]);
+          /* on mismatch skip the rest of this rule and its return */
+          ip_filter_emit (prog, &pos, BPF_JMP | BPF_JEQ | BPF_K,
+                          0, 3 * left + 1, ranges[i].val[w]);
+        }
+      if (MHD_NO ==
+          ip_filter_emit (prog, &pos, BPF_RET | BPF_K, 0, 0, match))
+        return MHD_NO;
+    }
+  if (MHD_NO ==
+      ip_filter_emit (prog, &pos, BPF_RET | BPF_K, 0, 0, nomatch))
+    return MHD_NO;
+  *len = pos;
+  return MHD_YES;
+}
+
+
+/**
+ * Attach @a fprog to @a fd, or detach the filter of @a fd
+ * if @a fprog is NULL.
+ *
+ * @param daemon daemon for logging
+ * @param fd listen socket
+ * @param fprog program to attach, NULL to detach
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+static int
+ip_filter_attach (struct MHD_Daemon *daemon,
+                  MHD_socket fd,
+                  const struct sock_fprog *fprog)
+{
+  int dummy = 0;
+
+  if (MHD_INVALID_SOCKET == fd)
+    return MHD_YES;
+  if (NULL == fprog)
+    {
+      if ( (0 == setsockopt (fd, SOL_SOCKET, SO_DETACH_FILTER,
+                             &dummy, sizeof (dummy))) ||
+           (ENOENT == errno) )
+        return MHD_YES;
+    }
+  else if (0 == setsockopt (fd, SOL_SOCKET, SO_ATTACH_FILTER,
+                            fprog, sizeof (struct sock_fprog)))
+    return MHD_YES;
+#ifdef HAVE_MESSAGES
+  MHD_DLOG (daemon,
+            "Failed to set IP filter on listen socket: %s\n",
+            MHD_socket_last_strerr_ ());
+#endif
+  return MHD_NO;
+}
+#endif
+
+
+/**
+ * Install a filter on the listen socket(s) of @a daemon that makes
+ * the kernel drop connection attempts by IP address before they
+ * are accepted.
+ *
+ * @param daemon daemon to filter connections for
+ * @param policy whether @a rules list denied or allowed clients
+ * @param rules array of address ranges
+ * @param num_rules number of entries in @a rules
+ * @return #MHD_YES on success, #MHD_NO on error
+ * @ingroup specialized
+ */
+int
+MHD_set_ip_filter (struct MHD_Daemon *daemon,
+                   enum MHD_IpFilterPolicy policy,
+                   const struct MHD_IpFilterRule *rules,
+                   unsigned int num_rules)
+{
+#if MHD_IP_FILTER
+  struct IpFilterRange *ranges;
+  int *versions;
+  struct sock_filter *code;
+  struct sock_fprog fprog;
+  const struct sock_fprog *attach;
+  unsigned int len;
+  unsigned int i;
+  int ret;
+
+  if ( (NULL == daemon) ||
+       ( (0 != num_rules) && (NULL == rules) ) ||
+       ( (MHD_IP_FILTER_DENY_LISTED != policy) &&
+         (MHD_IP_FILTER_ALLOW_LISTED != policy) ) )
+    return MHD_NO;
+  /* each rule takes at least four instructions */
+  if (num_rules > BPF_MAXINSNS / 4)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Too many IP filter rules\n");
+#endif
+      return MHD_NO;
+    }
+  ranges = NULL;
+  versions = NULL;
+  code = NULL;
+  attach = NULL;
+  ret = MHD_NO;
+  if ( (MHD_IP_FILTER_DENY_LISTED != policy) ||
+       (0 != num_rules) )
+    {
+      ranges = malloc (sizeof (struct IpFilterRange) * (num_rules + 1));
+      versions = malloc (sizeof (int) * (num_rules + 1));
+      code = malloc (sizeof (struct sock_filter) * BPF_MAXINSNS);
+      if ( (NULL == ranges) ||
+           (NULL == versions) ||
+           (NULL == code) )
+        goto cleanup;
+      for (i = 0; i < num_rules; i++)
+        {
+          versions[i] = ip_filter_range (&rules[i], &ranges[i]);
+          if (0 == versions[i])
+            {
+#ifdef HAVE_MESSAGES
+              MHD_DLOG (daemon,
+                        "Invalid IP filter rule #%u\n",
+                        i);
+#endif
+              goto cleanup;
+            }
+        }
+      if (MHD_NO == ip_filter_build (ranges,
+                                     versions,
+                                     num_rules,
+                                     (MHD_IP_FILTER_DENY_LISTED == policy)
+                                     ? 0 : 0xFFFFFFFFU,
+                                     code,
+                                     &len))
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Too many IP filter rules\n");
+#endif
+          goto cleanup;
+        }
+      fprog.len = (unsigned short) len;
+      fprog.filter = code;
+      attach = &fprog;
+    }
+  ret = ip_filter_attach (daemon, daemon->socket_fd, attach);
+  if (NULL != daemon->worker_pool)
+    for (i = 0; i < daemon->worker_pool_size; i++)
+      if ( (MHD_YES == ret) &&
+           (daemon->worker_pool[i].worker_socket_fd != daemon->socket_fd) )
+        ret = ip_filter_attach (daemon,
+                                daemon->worker_pool[i].worker_socket_fd,
+                                attach);
+ cleanup:
+  free (ranges);
+  free (versions);
+  free (code);
+  return ret;
+#else
+#ifdef HAVE_MESSAGES
+  MHD_DLOG (daemon,
+            "Filtering by IP address is not supported on this platform\n");
+#endif
+  return MHD_NO;
+#endif
+}
+
+
+/**
+ * First file descriptor passed by systemd socket activation.
+ */
+#define MHD_SD_LISTEN_FDS_START 3
+
+
+/**
+ * Find a listen socket passed by systemd socket activation, see
+ * #MHD_OPTION_LISTEN_SOCKET_SYSTEMD.
+ *
+ * @param daemon daemon that will use the socket
+ * @param index index of the socket among the passed ones
+ * @return the socket, #MHD_INVALID_SOCKET if there is none
+ */
+static MHD_socket
+get_systemd_listen_socket (struct MHD_Daemon *daemon,
+                           unsigned int index)
+{
+#ifndef MHD_WINSOCK_SOCKETS
+  const char *env;
+  char *end;
+  unsigned long num_fds;
+  int fd;
+  int type;
+  socklen_t len;
+
+  env = getenv ("LISTEN_PID");
+  if ( (NULL == env) ||
+       (strtoul (env, &end, 10) != (unsigned long) getpid ()) ||
+       ('\0' != *end) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "No sockets passed to this process by systemd\n");
+#endif
+      return MHD_INVALID_SOCKET;
+    }
+  env = getenv ("LISTEN_FDS");
+  num_fds = 0;
+  if (NULL != env)
+    num_fds = strtoul (env, &end, 10);
+  if ( (NULL == env) ||
+       ('\0' != *end) ||
+       (index >= num_fds) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "systemd did not pass socket %u\n",
+                index);
+#endif
+      return MHD_INVALID_SOCKET;
+    }
+  fd = MHD_SD_LISTEN_FDS_START + (int) index;
+  len = sizeof (type);
+  if ( (0 != getsockopt (fd, SOL_SOCKET, SO_TYPE, &type, &len)) ||
+       (SOCK_STREAM != type) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "File descriptor %d passed by systemd is not a stream socket\n",
+                fd);
+#endif
+      return MHD_INVALID_SOCKET;
+    }
+  /* passed inheritable, our children must not keep it open */
+  (void) fcntl (fd, F_SETFD, FD_CLOEXEC);
+  return fd;
+#else
+#ifdef HAVE_MESSAGES
+  MHD_DLOG (daemon,
+            "systemd socket activation is not supported on this platform\n");
+#endif
+  return MHD_INVALID_SOCKET;
+#endif
+}
+
+
+/**
+ * Signature of the MHD custom logger function.
+ *
+ * @param cls closure
+ * @param format format string
+ * @param va arguments to the format string (fprintf-style)
+ */
+typedef void (*VfprintfFunctionPointerType)(void *cls,
+					    const char *format,
+					    va_list va);
+
+
+/**
+ * Parse a list of options given as varargs.
+ *
+ * @param daemon the daemon to initialize
+ * @param servaddr where to store the server's listen address
+ * @param ap the options
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+static int
+parse_options_va (struct MHD_Daemon *daemon,
+		  const struct sockaddr **servaddr,
+		  va_list ap);
+
+
+#if HTTPS_SUPPORT
+/**
+ * Stop the threads for #MHD_OPTION_HTTPS_HANDSHAKE_THREADS; they
+ * hand back the connections with incomplete handshakes to their
+ * daemons.  The worker daemons may still look at the threads
+ * afterwards, and find them shut down, so this does not release
+ * them.
+ *
+ * @param daemon the (master) daemon
+ */
+static void
+stop_handshake_threads (struct MHD_Daemon *daemon)
+{
+#ifdef HAVE_POLL
+  struct MHD_HandshakePool *pool = daemon->handshake_pool;
+  struct MHD_HandshakeThread *ht;
+  unsigned int i;
+
+  if (NULL == pool)
+    return;
+  for (i = 0; i < pool->num_threads; i++)
+    {
+      ht = &pool->threads[i];
+      if (MHD_YES != MHD_mutex_lock_ (&ht->mutex))
+        MHD_PANIC ("Failed to acquire handshake thread mutex\n");
+      ht->shutdown = MHD_YES;
+      if (MHD_YES != MHD_itc_activate_ (ht->wpipe[1]))
+        MHD_PANIC ("failed to signal shutdown via pipe");
+      if (MHD_YES != MHD_mutex_unlock_ (&ht->mutex))
+        MHD_PANIC ("Failed to release handshake thread mutex\n");
+    }
+  for (i = 0; i < pool->num_threads; i++)
+    if (0 != MHD_join_thread_ (pool->threads[i].pid))
+      MHD_PANIC ("Failed to join a thread\n");
+#endif
+}
+
+
+/**
+ * Release the threads for #MHD_OPTION_HTTPS_HANDSHAKE_THREADS after
+ * stop_handshake_threads() and after the worker daemons stopped.
+ *
+ * @param daemon the (master) daemon
+ */
+static void
+free_handshake_threads (struct MHD_Daemon *daemon)
+{
+#ifdef HAVE_POLL
+  struct MHD_HandshakePool *pool = daemon->handshake_pool;
+  unsigned int i;
+
+  if (NULL == pool)
+    return;
+  for (i = 0; i < pool->num_threads; i++)
+    {
+      if (0 != MHD_pipe_close_ (pool->threads[i].wpipe[0]))
+        MHD_PANIC ("close failed\n");
+      if (0 != MHD_pipe_close_ (pool->threads[i].wpipe[1]))
+        MHD_PANIC ("close failed\n");
+      (void) MHD_mutex_destroy_ (&pool->threads[i].mutex);
+    }
+  free (pool->threads);
+  free (pool);
+  daemon->handshake_pool = NULL;
+#endif
+}
+
+
+/**
+ * Start the threads for #MHD_OPTION_HTTPS_HANDSHAKE_THREADS.
+ *
+ * @param daemon the (master) daemon
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+static int
+start_handshake_threads (struct MHD_Daemon *daemon)
+{
+#ifdef HAVE_POLL
+  struct MHD_HandshakePool *pool;
+  struct MHD_HandshakeThread *ht;
+  unsigned int i;
+  int res_thread_create;
+
+  /* resumed connections must wake up the event loop */
+  if ( (MHD_USE_SUSPEND_RESUME != (daemon->options & MHD_USE_SUSPEND_RESUME)) ||
+       (0 == (daemon->options & MHD_USE_SELECT_INTERNALLY)) ||
+       (MHD_USE_IO_URING_LINUX_ONLY == (daemon->options & MHD_USE_IO_URING_LINUX_ONLY)) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "TLS handshake threads require MHD_USE_SUSPEND_RESUME and an internal select thread, and are not supported with io_uring\n");
+#endif
+      return MHD_NO;
+    }
+  pool = malloc (sizeof (struct MHD_HandshakePool));
+  if (NULL == pool)
+    return MHD_NO;
+  pool->threads = calloc (daemon->handshake_thread_count,
+                          sizeof (struct MHD_HandshakeThread));
+  if (NULL == pool->threads)
+    {
+      free (pool);
+      return MHD_NO;
+    }
+  pool->num_threads = 0;
+  daemon->handshake_pool = pool;
+  for (i = 0; i < daemon->handshake_thread_count; i++)
+    {
+      ht = &pool->threads[i];
+      ht->daemon = daemon;
+      ht->shutdown = MHD_NO;
+      if (MHD_YES != MHD_mutex_create_ (&ht->mutex))
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "MHD failed to initialize handshake thread mutex\n");
+#endif
+          break;
+        }
+      if (0 != MHD_itc_create_ (ht->wpipe))
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Failed to create handshake thread pipe: %s\n",
+                    MHD_pipe_last_strerror_ ());
+#endif
+          (void) MHD_mutex_destroy_ (&ht->mutex);
+          break;
+        }
+      if (0 != (res_thread_create =
+                create_thread (&ht->pid, daemon, &MHD_handshake_thread, ht)))
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Failed to create handshake thread: %s\n",
+                    MHD_strerror_ (res_thread_create));
+#endif
+          if (0 != MHD_pipe_close_ (ht->wpipe[0]))
+            MHD_PANIC ("close failed\n");
+          if (0 != MHD_pipe_close_ (ht->wpipe[1]))
+            MHD_PANIC ("close failed\n");
+          (void) MHD_mutex_destroy_ (&ht->mutex);
+          break;
+        }
+      pool->num_threads++;
+    }
+  if (pool->num_threads == daemon->handshake_thread_count)
+    return MHD_YES;
+  stop_handshake_threads (daemon);
+  free_handshake_threads (daemon);
+  return MHD_NO;
+#else
+#ifdef HAVE_MESSAGES
+  MHD_DLOG (daemon,
+            "TLS handshake threads are not supported on this platform\n");
+#endif
+  return MHD_NO;
+#endif
+}
+#endif
+
+
+/**
+ * Main function of the thread writing the log messages queued due to
+ * #MHD_OPTION_LOG_QUEUE_SIZE.
+ *
+ * @param cls the `struct MHD_LogQueue`
+ * @return always 0
+ */
+#ifdef HAVE_MESSAGES
+static MHD_THRD_RTRN_TYPE_ MHD_THRD_CALL_SPEC_
+log_thread (void *cls)
+{
+  MHD_log_queue_run_ (cls);
+  return (MHD_THRD_RTRN_TYPE_) 0;
+}
+#endif
+
+
+/**
+ * Create the log queue for #MHD_OPTION_LOG_QUEUE_SIZE and
+ * #MHD_OPTION_LOG_RATE_LIMIT, and start its thread.  Until then (and
+ * without these options), messages are logged synchronously.
+ *
+ * @param daemon the (master) daemon
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+static int
+start_log_thread (struct MHD_Daemon *daemon)
+{
+#ifdef HAVE_MESSAGES
+  struct MHD_LogQueue *queue;
+
+  if ( (0 == daemon->log_queue_size) &&
+       (0 == daemon->log_rate_limit) )
+    return MHD_YES;
+  queue = MHD_log_queue_create_ (daemon->log_queue_size,
+                                 daemon->log_rate_limit,
+                                 daemon->custom_error_log,
+                                 daemon->custom_error_log_cls);
+  if (NULL == queue)
+    {
+      MHD_DLOG (daemon,
+                "Failed to create the log queue (requires atomic builtins)\n");
+      return MHD_NO;
+    }
+  if (MHD_YES == MHD_log_queue_is_async_ (queue))
+    {
+      if (0 != create_thread (&daemon->log_thread,
+                              daemon,
+                              &log_thread,
+                              queue))
+        {
+          MHD_DLOG (daemon,
+                    "Failed to create log thread: %s\n",
+                    MHD_strerror_ (errno));
+          MHD_log_queue_destroy_ (queue);
+          return MHD_NO;
+        }
+      daemon->have_log_thread = MHD_YES;
+    }
+  daemon->log_queue = queue;
+#endif
+  return MHD_YES;
+}
+
+
+/**
+ * Write the messages left in the log queue, stop its thread and
+ * destroy it.  Messages logged afterwards are written synchronously.
+ *
+ * @param daemon the (master) daemon
+ */
+static void
+stop_log_thread (struct MHD_Daemon *daemon)
+{
+#ifdef HAVE_MESSAGES
+  struct MHD_LogQueue *queue = daemon->log_queue;
+
+  if (NULL == queue)
+    return;
+  if (MHD_YES == daemon->have_log_thread)
+    {
+      MHD_log_queue_stop_ (queue);
+      if (0 != MHD_join_thread_ (daemon->log_thread))
+        MHD_PANIC ("Failed to join a thread\n");
+      daemon->have_log_thread = MHD_NO;
+    }
+  daemon->log_queue = NULL;
+  MHD_log_queue_destroy_ (queue);
+#endif
+}
+
+
+/**
+ * Stop the threads for #MHD_OPTION_HANDLER_THREADS once they ran the
+ * steps in their queue.  The worker daemons may still hand steps to
+ * the pool afterwards, and run them themselves when they find it shut
+ * down, so this does not release it.
+ *
+ * @param daemon the (master) daemon
+ */
+static void
+stop_handler_threads (struct MHD_Daemon *daemon)
+{
+#ifdef HAVE_POLL
+  struct MHD_HandlerPool *pool = daemon->handler_pool;
+  unsigned int i;
+
+  if (NULL == pool)
+    return;
+  if (MHD_YES != MHD_mutex_lock_ (&pool->mutex))
+    MHD_PANIC ("Failed to acquire handler thread mutex\n");
+  pool->shutdown = MHD_YES;
+  for (i = 0; i < pool->num_threads; i++)
+    if (MHD_YES != MHD_itc_activate_ (pool->threads[i].wpipe[1]))
+      MHD_PANIC ("failed to signal shutdown via pipe");
+  if (MHD_YES != MHD_mutex_unlock_ (&pool->mutex))
+    MHD_PANIC ("Failed to release handler thread mutex\n");
+  for (i = 0; i < pool->num_threads; i++)
+    if (0 != MHD_join_thread_ (pool->threads[i].pid))
+      MHD_PANIC ("Failed to join a thread\n");
+#endif
+}
+
+
+/**
+ * Release the threads for #MHD_OPTION_HANDLER_THREADS after
+ * stop_handler_threads() and after the worker daemons stopped.
+ *
+ * @param daemon the (master) daemon
+ */
+static void
+free_handler_threads (struct MHD_Daemon *daemon)
+{
+#ifdef HAVE_POLL
+  struct MHD_HandlerPool *pool = daemon->handler_pool;
+  unsigned int i;
+
+  if (NULL == pool)
+    return;
+  for (i = 0; i < pool->num_threads; i++)
+    {
+      if (0 != MHD_pipe_close_ (pool->threads[i].wpipe[0]))
+        MHD_PANIC ("close failed\n");
+      if (0 != MHD_pipe_close_ (pool->threads[i].wpipe[1]))
+        MHD_PANIC ("close failed\n");
+    }
+  (void) MHD_mutex_destroy_ (&pool->mutex);
+  free (pool->threads);
+  free (pool);
+  daemon->handler_pool = NULL;
+#endif
+}
+
+
+/**
+ * Start the threads for #MHD_OPTION_HANDLER_THREADS.
+ *
+ * @param daemon the (master) daemon
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+static int
+start_handler_threads (struct MHD_Daemon *daemon)
+{
+#ifdef HAVE_POLL
+  struct MHD_HandlerPool *pool;
+  struct MHD_HandlerThread *ht;
+  unsigned int i;
+  int res_thread_create;
+
+  /* resumed connections must wake up the event loop */
+  if ( (MHD_USE_SUSPEND_RESUME != (daemon->options & MHD_USE_SUSPEND_RESUME)) ||
+       (0 == (daemon->options & MHD_USE_SELECT_INTERNALLY)) ||
+       (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) ||
+       (MHD_USE_IO_URING_LINUX_ONLY == (daemon->options & MHD_USE_IO_URING_LINUX_ONLY)) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Handler threads require MHD_USE_SUSPEND_RESUME and an internal select thread, and are not supported with io_uring\n");
+#endif
+      return MHD_NO;
+    }
+  pool = malloc (sizeof (struct MHD_HandlerPool));
+  if (NULL == pool)
+    return MHD_NO;
+  memset (pool, 0, sizeof (struct MHD_HandlerPool));
+  pool->threads = calloc (daemon->handler_thread_count,
+                          sizeof (struct MHD_HandlerThread));
+  if (NULL == pool->threads)
+    {
+      free (pool);
+      return MHD_NO;
+    }
+  if (MHD_YES != MHD_mutex_create_ (&pool->mutex))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "MHD failed to initialize handler thread mutex\n");
+#endif
+      free (pool->threads);
+      free (pool);
+      return MHD_NO;
+    }
+  pool->shutdown = MHD_NO;
+  pool->daemon = daemon;
+  daemon->handler_pool = pool;
+  for (i = 0; i < daemon->handler_thread_count; i++)
+    {
+      ht = &pool->threads[i];
+      ht->pool = pool;
+      ht->idle = MHD_NO;
+      if (0 != MHD_itc_create_ (ht->wpipe))
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Failed to create handler thread pipe: %s\n",
+                    MHD_pipe_last_strerror_ ());
+#endif
+          break;
+        }
+      if (0 != (res_thread_create =
+                create_thread (&ht->pid, daemon, &MHD_handler_thread, ht)))
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Failed to create handler thread: %s\n",
+                    MHD_strerror_ (res_thread_create));
+#endif
+          if (0 != MHD_pipe_close_ (ht->wpipe[0]))
+            MHD_PANIC ("close failed\n");
+          if (0 != MHD_pipe_close_ (ht->wpipe[1]))
+            MHD_PANIC ("close failed\n");
+          break;
+        }
+      pool->num_threads++;
+    }
+  if (pool->num_threads == daemon->handler_thread_count)
+    return MHD_YES;
+  stop_handler_threads (daemon);
+  free_handler_threads (daemon);
+  return MHD_NO;
+#else
+#ifdef HAVE_MESSAGES
+  MHD_DLOG (daemon,
+            "Handler threads are not supported on this platform\n");
+#endif
+  return MHD_NO;
+#endif
+}
+
+
+/**
+ * Stop the threads of the thread cache of @a daemon (see
+ * #MHD_OPTION_THREAD_CACHE_SIZE).  Threads still handling a
+ * connection exit once it is closed, which the daemon must have
+ * triggered by shutting down the sockets.
+ *
+ * @param daemon daemon to stop the thread cache of
+ */
+static void
+stop_thread_cache (struct MHD_Daemon *daemon)
+{
+#ifdef HAVE_POLL
+  struct MHD_ThreadCache *cache = daemon->thread_cache;
+  struct MHD_ConnectionThread *ct;
+
+  if (NULL == cache)
+    return;
+  if (MHD_YES == cache->park_started)
+    {
+      /* the parked connections go back to threads first */
+      if (MHD_YES != MHD_mutex_lock_ (&cache->mutex))
+        MHD_PANIC ("Failed to acquire thread cache mutex\n");
+      cache->park_shutdown = MHD_YES;
+      if (MHD_YES != MHD_mutex_unlock_ (&cache->mutex))
+        MHD_PANIC ("Failed to release thread cache mutex\n");
+      if (MHD_YES != MHD_itc_activate_ (cache->park_wpipe[1]))
+        MHD_PANIC ("failed to signal shutdown via pipe");
+      if (0 != MHD_join_thread_ (cache->park_pid))
+        MHD_PANIC ("Failed to join a thread\n");
+      cache->park_started = MHD_NO;
+    }
+  if (MHD_YES != MHD_mutex_lock_ (&cache->mutex))
+    MHD_PANIC ("Failed to acquire thread cache mutex\n");
+  cache->shutdown = MHD_YES;
+  for (ct = cache->idle; NULL != ct; ct = ct->idle_next)
+    if (MHD_YES != MHD_itc_activate_ (ct->wpipe[1]))
+      MHD_PANIC ("failed to signal shutdown via pipe");
+  if (MHD_YES != MHD_mutex_unlock_ (&cache->mutex))
+    MHD_PANIC ("Failed to release thread cache mutex\n");
+  /* no new threads are added from now on */
+  for (ct = cache->head; NULL != ct; ct = ct->next)
+    if (0 != MHD_join_thread_ (ct->pid))
+      MHD_PANIC ("Failed to join a thread\n");
+  while (NULL != (ct = cache->head))
+    {
+      DLL_remove (cache->head,
+                  cache->tail,
+                  ct);
+      if (0 != MHD_pipe_close_ (ct->wpipe[0]))
+        MHD_PANIC ("close failed\n");
+      if (0 != MHD_pipe_close_ (ct->wpipe[1]))
+        MHD_PANIC ("close failed\n");
+      free (ct);
+    }
+  cache->dead = NULL;
+#endif
+}
+
+
+/**
+ * Release the thread cache of @a daemon after stop_thread_cache().
+ *
+ * @param daemon daemon to release the thread cache of
+ */
+static void
+free_thread_cache (struct MHD_Daemon *daemon)
+{
+#ifdef HAVE_POLL
+  struct MHD_ThreadCache *cache = daemon->thread_cache;
+
+  if (NULL == cache)
+    return;
+  if (MHD_INVALID_PIPE_ != cache->park_wpipe[0])
+    {
+      if (0 != MHD_pipe_close_ (cache->park_wpipe[0]))
+        MHD_PANIC ("close failed\n");
+      if (0 != MHD_pipe_close_ (cache->park_wpipe[1]))
+        MHD_PANIC ("close failed\n");
+    }
+  free (cache->parked);
+  (void) MHD_mutex_destroy_ (&cache->mutex);
+  free (cache);
+  daemon->thread_cache = NULL;
+#endif
+}
+
+
+/**
+ * Set up the thread cache for #MHD_OPTION_THREAD_CACHE_SIZE.  Its
+ * threads are only started for connections, except for the one
+ * polling parked connections (see #MHD_OPTION_PARK_IDLE_CONNECTIONS).
+ *
+ * @param daemon daemon to set up the thread cache for
+ * @return #MHD_YES on success
+ */
+static int
+start_thread_cache (struct MHD_Daemon *daemon)
+{
+#ifdef HAVE_POLL
+  struct MHD_ThreadCache *cache;
+  int res_thread_create;
+
+  if (0 == (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "The thread cache requires MHD_USE_THREAD_PER_CONNECTION\n");
+#endif
+      return MHD_NO;
+    }
+  if (0 == daemon->thread_cache_size)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Parking idle connections requires MHD_OPTION_THREAD_CACHE_SIZE\n");
+#endif
+      return MHD_NO;
+    }
+  cache = malloc (sizeof (struct MHD_ThreadCache));
+  if (NULL == cache)
+    return MHD_NO;
+  memset (cache, 0, sizeof (struct MHD_ThreadCache));
+  if (MHD_YES != MHD_mutex_create_ (&cache->mutex))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "MHD failed to initialize thread cache mutex\n");
+#endif
+      free (cache);
+      return MHD_NO;
+    }
+  cache->shutdown = MHD_NO;
+  cache->daemon = daemon;
+  cache->park_wpipe[0] = MHD_INVALID_PIPE_;
+  cache->park_wpipe[1] = MHD_INVALID_PIPE_;
+  daemon->thread_cache = cache;
+  if (0 == daemon->park_idle_delay)
+    return MHD_YES;
+  if (0 != MHD_itc_create_ (cache->park_wpipe))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to create pipe for parked connections: %s\n",
+                MHD_strerror_ (errno));
+#endif
+      cache->park_wpipe[0] = MHD_INVALID_PIPE_;
+      free_thread_cache (daemon);
+      return MHD_NO;
+    }
+  res_thread_create = create_thread (&cache->park_pid,
+                                     daemon,
+                                     &MHD_park_thread,
+                                     cache);
+  if (0 != res_thread_create)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to create thread for parked connections: %s\n",
+                MHD_strerror_ (res_thread_create));
+#endif
+      free_thread_cache (daemon);
+      return MHD_NO;
+    }
+  cache->park_started = MHD_YES;
+  return MHD_YES;
+#else
+#ifdef HAVE_MESSAGES
+  MHD_DLOG (daemon,
+            "The thread cache is not supported on this platform\n");
+#endif
+  return MHD_NO;
+#endif
+}
+
+
+/**
+ * Parse a list of options given as varargs.
+ *
+ * @param daemon the daemon to initialize
+ * @param servaddr where to store the server's listen address
+ * @param ... the options
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+static int
+parse_options (struct MHD_Daemon *daemon,
+	       const struct sockaddr **servaddr,
+	       ...)
+{
+  va_list ap;
+  int ret;
+
+  va_start (ap, servaddr);
+  ret = parse_options_va (daemon, servaddr, ap);
+  va_end (ap);
+  return ret;
+}
+
+
+/**
+ * Parse a list of options given as varargs.
+ *
+ * @param daemon the daemon to initialize
+ * @param servaddr where to store the server's listen address
+ * @param ap the options
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+static int
+parse_options_va (struct MHD_Daemon *daemon,
+		  const struct sockaddr **servaddr,
+		  va_list ap)
+{
+  enum MHD_OPTION opt;
+  struct MHD_OptionItem *oa;
+  unsigned int i;
+  const char *pstr;
+#if HTTPS_SUPPORT
+  unsigned int uv;
+#endif
+
+  while (MHD_OPTION_END != (opt = (enum MHD_OPTION) va_arg (ap, int)))
+    {
+      switch (opt)
+        {
+        case MHD_OPTION_CONNECTION_MEMORY_LIMIT:
+          daemon->pool_size = va_arg (ap, size_t);
+          break;
+        case MHD_OPTION_CONNECTION_MEMORY_INCREMENT:
+          daemon->pool_increment= va_arg (ap, size_t);
+          break;
+        case MHD_OPTION_WRITE_QUANTUM:
+          daemon->write_quantum = va_arg (ap, size_t);
+          break;
+        case MHD_OPTION_MEMORY_BUDGET:
+          daemon->memory_budget = va_arg (ap, size_t);
+          break;
+        case MHD_OPTION_CONNECTION_ALLOC_RESERVE:
+          daemon->alloc_reserve = va_arg (ap, size_t);
+          break;
+        case MHD_OPTION_OVERLOAD_LATENCY:
+          daemon->overload_latency = va_arg (ap, unsigned int);
+          break;
+        case MHD_OPTION_OVERLOAD_RETRY_AFTER:
+          daemon->overload_retry_after = va_arg (ap, unsigned int);
+          break;
+        case MHD_OPTION_CONNECTION_LIMIT:
+          daemon->connection_limit = va_arg (ap, unsigned int);
+          break;
+        case MHD_OPTION_CONNECTION_TIMEOUT:
+          daemon->connection_timeout = 1000LLU * va_arg (ap, unsigned int);
+          break;
+        case MHD_OPTION_CONNECTION_TIMEOUT_MS:
+          daemon->connection_timeout = va_arg (ap, unsigned int);
+          break;
+        case MHD_OPTION_HEADER_TIMEOUT_MS:
+          daemon->header_timeout = va_arg (ap, unsigned int);
+          break;
+        case MHD_OPTION_MIN_DATA_RATE:
+          daemon->min_data_rate = va_arg (ap, unsigned int);
+          break;
+        case MHD_OPTION_SHUTDOWN_GRACE_MS:
+          daemon->shutdown_grace = va_arg (ap, unsigned int);
+          break;
+        case MHD_OPTION_LISTEN_SOCKET_SYSTEMD:
+          daemon->socket_fd = get_systemd_listen_socket (daemon,
+                                                         va_arg (ap, unsigned int));
+          if (MHD_INVALID_SOCKET == daemon->socket_fd)
+            return MHD_NO;
+          break;
+        case MHD_OPTION_NOTIFY_COMPLETED:
+          daemon->notify_completed =
+            va_arg (ap, MHD_RequestCompletedCallback);
+          daemon->notify_completed_cls = va_arg (ap, void *);
+          break;
+        case MHD_OPTION_NOTIFY_CONNECTION:
+          daemon->notify_connection =
+            va_arg (ap, MHD_NotifyConnectionCallback);
+          daemon->notify_connection_cls = va_arg (ap, void *);
+          break;
+        case MHD_OPTION_NOTIFY_SOCKET:
+          daemon->notify_socket =
+            va_arg (ap, MHD_NotifySocketCallback);
+          daemon->notify_socket_cls = va_arg (ap, void *);
+          break;
+        case MHD_OPTION_PER_IP_CONNECTION_LIMIT:
+          daemon->per_ip_connection_limit = va_arg (ap, unsigned int);
+          break;
+        case MHD_OPTION_SOCK_ADDR:
+          *servaddr = va_arg (ap, const struct sockaddr *);
+          break;
+        case MHD_OPTION_URI_LOG_CALLBACK:
+          daemon->uri_log_callback =
+            va_arg (ap, LogCallback);
+          daemon->uri_log_callback_cls = va_arg (ap, void *);
+          break;
+        case MHD_OPTION_PRIORITY_CALLBACK:
+          daemon->priority_callback =
+            va_arg (ap, MHD_PriorityCallback);
+          daemon->priority_callback_cls = va_arg (ap, void *);
+          break;
+        case MHD_OPTION_UPLOAD_BUFFER_CALLBACK:
+          daemon->upload_buffer_callback =
+            va_arg (ap, MHD_UploadBufferCallback);
+          daemon->upload_buffer_callback_cls = va_arg (ap, void *);
+          break;
+        case MHD_OPTION_LOOP_STATS_CALLBACK:
+          daemon->loop_stats_callback =
+            va_arg (ap, MHD_LoopStatsCallback);
+          daemon->loop_stats_callback_cls = va_arg (ap, void *);
+          break;
+        case MHD_OPTION_LOOP_STATS_INTERVAL:
+          daemon->loop_stats_interval = va_arg (ap, unsigned int);
+          break;
+        case MHD_OPTION_ACCESS_LOG_CALLBACK:
+          daemon->access_log_callback =
+            va_arg (ap, MHD_AccessLogCallback);
+          daemon->access_log_callback_cls = va_arg (ap, void *);
+          break;
+        case MHD_OPTION_ACCESS_LOG_FD:
+          daemon->access_log_fd = va_arg (ap, int);
+          break;
+        case MHD_OPTION_SLOW_REQUEST_CALLBACK:
+          daemon->slow_request_callback =
+            va_arg (ap, MHD_SlowRequestCallback);
+          daemon->slow_request_callback_cls = va_arg (ap, void *);
+          break;
+        case MHD_OPTION_SLOW_REQUEST_THRESHOLD_MS:
+          daemon->slow_request_threshold = va_arg (ap, unsigned int);
+          break;
+        case MHD_OPTION_ACCESS_LOG_BATCH_SIZE:
+          daemon->access_log_size = va_arg (ap, unsigned int);
+          if (0 == daemon->access_log_size)
+            daemon->access_log_size = 1;
+          break;
+        case MHD_OPTION_ACCESS_LOG_INTERVAL:
+          daemon->access_log_interval = va_arg (ap, unsigned int);
+          break;
+        case MHD_OPTION_HTTP2_MAX_CONCURRENT_STREAMS:
+          daemon->http2_max_streams = va_arg (ap, unsigned int);
+          if (0 == daemon->http2_max_streams)
+            daemon->http2_max_streams = 1;
+          break;
+        case MHD_OPTION_RESPONSE_CACHE_SIZE:
+          daemon->response_cache_size = va_arg (ap, unsigned int);
+          break;
+        case MHD_OPTION_CONNECTION_REBALANCE:
+          daemon->rebalance_threshold = va_arg (ap, unsigned int);
+          break;
+        case MHD_OPTION_LOG_QUEUE_SIZE:
+#ifdef HAVE_MESSAGES
+          daemon->log_queue_size = va_arg (ap, unsigned int);
+#else
+          va_arg (ap, unsigned int);
+#endif
+          break;
+        case MHD_OPTION_LOG_RATE_LIMIT:
+#ifdef HAVE_MESSAGES
+          daemon->log_rate_limit = va_arg (ap, unsigned int);
+#else
+          va_arg (ap, unsigned int);
+#endif
+          break;
+        case MHD_OPTION_THREAD_POOL_SIZE:
+          daemon->worker_pool_size = va_arg (ap, unsigned int);
+	  if (daemon->worker_pool_size >= (SIZE_MAX / sizeof (struct MHD_Daemon)))
+	    {
+#ifdef HAVE_MESSAGES
+	      MHD_DLOG (daemon,
+			"Specified thread pool size (%u) too big\n",
+			daemon->worker_pool_size);
+#endif
+	      return MHD_NO;
+	    }
+          break;
+#if HTTPS_SUPPORT
+        case MHD_OPTION_HTTPS_MEM_KEY:
+	  if (0 != (daemon->options & MHD_USE_SSL))
+	    daemon->https_mem_key = va_arg (ap, const char *);
+#ifdef HAVE_MESSAGES
+	  else
+	    MHD_DLOG (daemon,
+		      "MHD HTTPS option %d passed to MHD but MHD_USE_SSL not set\n",
+		      opt);
+#endif
+          break;
+        case MHD_OPTION_HTTPS_KEY_PASSWORD:
+	  if (0 != (daemon->options & MHD_USE_SSL))
+	    daemon->https_key_password = va_arg (ap, const char *);
+#ifdef HAVE_MESSAGES
+	  else
+	    MHD_DLOG (daemon,
+		      "MHD HTTPS option %d passed to MHD but MHD_USE_SSL not set\n",
+		      opt);
+#endif
+          break;
+        case MHD_OPTION_HTTPS_MEM_CERT:
+	  if (0 != (daemon->options & MHD_USE_SSL))
+	    daemon->https_mem_cert = va_arg (ap, const char *);
+#ifdef HAVE_MESSAGES
+	  else
+	    MHD_DLOG (daemon,
+		      "MHD HTTPS option %d passed to MHD but MHD_USE_SSL not set\n",
+		      opt);
+#endif
+          break;
+        case MHD_OPTION_HTTPS_MEM_TRUST:
+	  if (0 != (daemon->options & MHD_USE_SSL))
+	    daemon->https_mem_trust = va_arg (ap, const char *);
+#ifdef HAVE_MESSAGES
+	  else
+	    MHD_DLOG (daemon,
+		      "MHD HTTPS option %d passed to MHD but MHD_USE_SSL not set\n",
+		      opt);
+#endif
+          break;
+	case MHD_OPTION_HTTPS_CRED_TYPE:
+	  daemon->cred_type = va_arg (ap, int);
+	  break;
+        case MHD_OPTION_HTTPS_MEM_DHPARAMS:
+          if (0 != (daemon->options & MHD_USE_SSL))
+            {
+              if (MHD_YES != MHD_tls_set_dh_params_ (daemon,
+                                                     va_arg (ap, const char *)))
+                return MHD_NO;
+            }
+          else
+            {
+#ifdef HAVE_MESSAGES
+              MHD_DLOG (daemon,
+                        "MHD HTTPS option %d passed to MHD but MHD_USE_SSL not set\n",
+                        opt);
+#endif
+              return MHD_NO;
+            }
+          break;
+        case MHD_OPTION_HTTPS_PRIORITIES:
+	  pstr = va_arg (ap, const char*);
+	  if ( (0 != (daemon->options & MHD_USE_SSL)) &&
+	       (MHD_YES != MHD_tls_set_priorities_ (daemon,
+						    pstr)) )
+	    return MHD_NO;
+          break;
+        case MHD_OPTION_HTTPS_CERT_CALLBACK:
+#if HTTPS_OPENSSL || GNUTLS_VERSION_MAJOR < 3
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "MHD_OPTION_HTTPS_CERT_CALLBACK requires building MHD with GnuTLS >= 3.0\n");
+#endif
+          return MHD_NO;
+#else
+          if (0 != (daemon->options & MHD_USE_SSL))
+            daemon->cert_callback = va_arg (ap, gnutls_certificate_retrieve_function2 *);
+          break;
+#endif
+        case MHD_OPTION_HTTPS_SESSION_TICKETS:
+          uv = va_arg (ap, unsigned int);
+          if (0 == (daemon->options & MHD_USE_SSL))
+            {
+#ifdef HAVE_MESSAGES
+              MHD_DLOG (daemon,
+                        "MHD HTTPS option %d passed to MHD but MHD_USE_SSL not set\n",
+                        opt);
+#endif
+              break;
+            }
+          if (MHD_YES != MHD_tls_set_session_tickets_ (daemon,
+                                                       (MHD_NO == uv)
+                                                       ? MHD_NO
+                                                       : MHD_YES))
+            return MHD_NO;
+          break;
+        case MHD_OPTION_HTTPS_CERT_TABLE:
+          uv = va_arg (ap, unsigned int);
+          daemon->https_cert_table = va_arg (ap, const struct MHD_HttpsCertificate *);
+          daemon->https_cert_table_size = uv;
+          if (0 == (daemon->options & MHD_USE_SSL))
+            {
+#ifdef HAVE_MESSAGES
+              MHD_DLOG (daemon,
+                        "MHD HTTPS option %d passed to MHD but MHD_USE_SSL not set\n",
+                        opt);
+#endif
+              daemon->https_cert_table_size = 0;
+            }
+          break;
+        case MHD_OPTION_HTTPS_SESSION_CACHE_SIZE:
+          uv = va_arg (ap, unsigned int);
+          if (0 == (daemon->options & MHD_USE_SSL))
+            {
+#ifdef HAVE_MESSAGES
+              MHD_DLOG (daemon,
+                        "MHD HTTPS option %d passed to MHD but MHD_USE_SSL not set\n",
+                        opt);
+#endif
+              break;
+            }
+          if (MHD_YES != MHD_tls_set_session_cache_ (daemon,
+                                                     uv))
+            return MHD_NO;
+          break;
+        case MHD_OPTION_HTTPS_HANDSHAKE_THREADS:
+          uv = va_arg (ap, unsigned int);
+          if (0 == (daemon->options & MHD_USE_SSL))
+            {
+#ifdef HAVE_MESSAGES
+              MHD_DLOG (daemon,
+                        "MHD HTTPS option %d passed to MHD but MHD_USE_SSL not set\n",
+                        opt);
+#endif
+              break;
+            }
+          daemon->handshake_thread_count = uv;
+          break;
+        case MHD_OPTION_HTTPS_DYNAMIC_RECORD_SIZE:
+          if (0 != (daemon->options & MHD_USE_SSL))
+            daemon->tls_small_record_limit = va_arg (ap, size_t);
+          else
+            {
+              (void) va_arg (ap, size_t);
+#ifdef HAVE_MESSAGES
+              MHD_DLOG (daemon,
+                        "MHD HTTPS option %d passed to MHD but MHD_USE_SSL not set\n",
+                        opt);
+#endif
+            }
+          break;
+#endif
+#ifdef DAUTH_SUPPORT
+	case MHD_OPTION_DIGEST_AUTH_RANDOM:
+	  daemon->digest_auth_rand_size = va_arg (ap, size_t);
+	  daemon->digest_auth_random = va_arg (ap, const char *);
+	  break;
+	case MHD_OPTION_NONCE_NC_SIZE:
+	  daemon->nonce_nc_size = va_arg (ap, unsigned int);
+	  break;
+	case MHD_OPTION_DIGEST_AUTH_HA1_CACHE_SIZE:
+	  daemon->ha1_cache_size = va_arg (ap, unsigned int);
+	  break;
+#endif
+#ifdef BAUTH_SUPPORT
+	case MHD_OPTION_BASIC_AUTH_CACHE_SIZE:
+	  daemon->basic_auth_cache_size = va_arg (ap, unsigned int);
+	  break;
+	case MHD_OPTION_BASIC_AUTH_CACHE_TTL:
+	  daemon->basic_auth_cache_ttl = va_arg (ap, unsigned int);
+	  break;
+#endif
+	case MHD_OPTION_PREFORK_WORKERS:
+	  daemon->prefork_workers = va_arg (ap, unsigned int);
+	  break;
+	case MHD_OPTION_ACCEPT_FAIR_SHARE:
+	  daemon->accept_fair_share = va_arg (ap, unsigned int);
+	  break;
+	case MHD_OPTION_INFLATE_REQUEST_BODY:
+	  daemon->inflate_ratio = va_arg (ap, unsigned int);
+#if ! HAVE_ZLIB
+	  if (0 != daemon->inflate_ratio)
+	    {
+#ifdef HAVE_MESSAGES
+	      MHD_DLOG (daemon,
+			"MHD_OPTION_INFLATE_REQUEST_BODY passed to MHD compiled without zlib\n");
+#endif
+	      return MHD_NO;
+	    }
+#endif
+	  break;
+	case MHD_OPTION_ADAPTIVE_READ_BUFFER:
+	  daemon->header_size_percentile = va_arg (ap, unsigned int);
+	  if (daemon->header_size_percentile > 100)
+	    {
+#ifdef HAVE_MESSAGES
+	      MHD_DLOG (daemon,
+			"Percentile %u for MHD_OPTION_ADAPTIVE_READ_BUFFER is above 100\n",
+			daemon->header_size_percentile);
+#endif
+	      return MHD_NO;
+	    }
+	  break;
+	case MHD_OPTION_HEADER_OVERFLOW_ARENA:
+	  daemon->header_overflow_limit = va_arg (ap, size_t);
+	  break;
+	case MHD_OPTION_WRITE_SCRATCH_BUFFER:
+	  daemon->write_scratch_size = va_arg (ap, size_t);
+	  break;
+	case MHD_OPTION_ALT_SVC:
+	  pstr = va_arg (ap, const char *);
+	  if ( (NULL != pstr) &&
+	       (NULL != strpbrk (pstr, "\r\n")) )
+	    {
+#ifdef HAVE_MESSAGES
+	      MHD_DLOG (daemon,
+			"Line break in value of MHD_OPTION_ALT_SVC\n");
+#endif
+	      return MHD_NO;
+	    }
+	  daemon->alt_svc = pstr;
+	  daemon->alt_svc_len = (NULL != pstr) ? strlen (pstr) : 0;
+	  break;
+	case MHD_OPTION_LISTEN_SOCKET:
+	  daemon->socket_fd = va_arg (ap, MHD_socket);
+	  break;
+        case MHD_OPTION_EXTERNAL_LOGGER:
+#ifdef HAVE_MESSAGES
+          daemon->custom_error_log =
+            va_arg (ap, VfprintfFunctionPointerType);
+          daemon->custom_error_log_cls = va_arg (ap, void *);
+#else
+          va_arg (ap, VfprintfFunctionPointerType);
+          va_arg (ap, void *);
+#endif
+          break;
+        case MHD_OPTION_THREAD_STACK_SIZE:
+          daemon->thread_stack_size = va_arg (ap, size_t);
+          break;
+#ifdef TCP_FASTOPEN
+        case MHD_OPTION_TCP_FASTOPEN_QUEUE_SIZE:
+          daemon->fastopen_queue_size = va_arg (ap, unsigned int);
+          break;
+#endif
+	case MHD_OPTION_LISTENING_ADDRESS_REUSE:
+	  daemon->listening_address_reuse = va_arg (ap, unsigned int) ? 1 : -1;
+	  break;
+	case MHD_OPTION_LISTEN_BACKLOG_SIZE:
+	  daemon->listen_backlog_size = va_arg (ap, unsigned int);
+	  break;
+	case MHD_OPTION_LISTEN_REUSEPORT_CPU_STEERING:
+	  daemon->reuseport_cpu_steering = va_arg (ap, unsigned int);
+	  break;
+	case MHD_OPTION_ACCEPT_BATCH_SIZE:
+	  daemon->accept_batch_size = va_arg (ap, unsigned int);
+	  break;
+	case MHD_OPTION_EPOLL_BUSY_POLL:
+#if EPOLL_SUPPORT
+	  daemon->busy_poll_usec = va_arg (ap, unsigned int);
+#else
+	  (void) va_arg (ap, unsigned int);
+#endif
+	  break;
+	case MHD_OPTION_EPOLL_MAX_EVENTS:
+#if EPOLL_SUPPORT
+	  daemon->epoll_max_events = va_arg (ap, unsigned int);
+	  if (0 == daemon->epoll_max_events)
+	    daemon->epoll_max_events = MHD_EPOLL_MAX_EVENTS_DEFAULT;
+#else
+	  (void) va_arg (ap, unsigned int);
+#endif
+	  break;
+	case MHD_OPTION_TCP_DEFER_ACCEPT:
+	  daemon->defer_accept = va_arg (ap, unsigned int);
+	  break;
+	case MHD_OPTION_SEND_RATE_LIMIT:
+	  MHD_bucket_init_ (&daemon->send_bucket,
+                            va_arg (ap, unsigned int));
+	  break;
+	case MHD_OPTION_RECV_RATE_LIMIT:
+	  MHD_bucket_init_ (&daemon->recv_bucket,
+                            va_arg (ap, unsigned int));
+	  break;
+	case MHD_OPTION_CONNECTION_POOL_CACHE_SIZE:
+	  daemon->pool_cache_max = va_arg (ap, unsigned int);
+	  break;
+	case MHD_OPTION_CONNECTION_IDLE_RELEASE_TIMEOUT:
+	  daemon->idle_release_timeout = 1000LLU * va_arg (ap, unsigned int);
+	  break;
+	case MHD_OPTION_LAZY_VALUE_PARSING:
+	  daemon->lazy_value_parsing = va_arg (ap, unsigned int);
+	  break;
+	case MHD_OPTION_COALESCE_CHUNKED_UPLOAD:
+	  daemon->coalesce_chunked_upload = va_arg (ap, unsigned int);
+	  break;
+	case MHD_OPTION_PIPELINE_CORK:
+	  daemon->pipeline_cork = va_arg (ap, unsigned int);
+	  break;
+	case MHD_OPTION_HANDLER_THREADS:
+	  daemon->handler_thread_count = va_arg (ap, unsigned int);
+	  break;
+	case MHD_OPTION_THREAD_CACHE_SIZE:
+	  daemon->thread_cache_size = va_arg (ap, unsigned int);
+	  break;
+	case MHD_OPTION_THREAD_CACHE_TIMEOUT:
+	  daemon->thread_cache_timeout = va_arg (ap, unsigned int);
+	  break;
+	case MHD_OPTION_PARK_IDLE_CONNECTIONS:
+	  daemon->park_idle_delay = va_arg (ap, unsigned int);
+	  break;
+	case MHD_OPTION_THREAD_POOL_CPU_AFFINITY:
+	  daemon->num_worker_cpus = va_arg (ap, unsigned int);
+	  daemon->worker_cpus = va_arg (ap, const unsigned int *);
+	  daemon->pin_workers = MHD_YES;
+	  break;
+	case MHD_OPTION_ARRAY:
+	  oa = va_arg (ap, struct MHD_OptionItem*);
+	  i = 0;
+	  while (MHD_OPTION_END != (opt = oa[i].option))
+	    {
+	      switch (opt)
+		{
+		  /* all options taking 'size_t' */
+		case MHD_OPTION_CONNECTION_MEMORY_LIMIT:
+		case MHD_OPTION_CONNECTION_MEMORY_INCREMENT:
+		case MHD_OPTION_THREAD_STACK_SIZE:
+		case MHD_OPTION_HTTPS_DYNAMIC_RECORD_SIZE:
+		case MHD_OPTION_WRITE_QUANTUM:
+		case MHD_OPTION_MEMORY_BUDGET:
+		case MHD_OPTION_CONNECTION_ALLOC_RESERVE:
+		case MHD_OPTION_HEADER_OVERFLOW_ARENA:
+		case MHD_OPTION_WRITE_SCRATCH_BUFFER:
+		  if (MHD_YES != parse_options (daemon,
+						servaddr,
+						opt,
+						(size_t) oa[i].value,
+						MHD_OPTION_END))
+		    return MHD_NO;
+		  break;
+		  /* all options taking 'unsigned int' */
+		case MHD_OPTION_NONCE_NC_SIZE:
+		case MHD_OPTION_DIGEST_AUTH_HA1_CACHE_SIZE:
+		case MHD_OPTION_CONNECTION_LIMIT:
+		case MHD_OPTION_CONNECTION_TIMEOUT:
+		case MHD_OPTION_PER_IP_CONNECTION_LIMIT:
+		case MHD_OPTION_THREAD_POOL_SIZE:
+                case MHD_OPTION_TCP_FASTOPEN_QUEUE_SIZE:
+		case MHD_OPTION_LISTENING_ADDRESS_REUSE:
+		case MHD_OPTION_LISTEN_BACKLOG_SIZE:
+		case MHD_OPTION_LISTEN_REUSEPORT_CPU_STEERING:
+		case MHD_OPTION_ACCEPT_BATCH_SIZE:
+		case MHD_OPTION_EPOLL_BUSY_POLL:
+		case MHD_OPTION_TCP_DEFER_ACCEPT:
+		case MHD_OPTION_SEND_RATE_LIMIT:
+		case MHD_OPTION_RECV_RATE_LIMIT:
+		case MHD_OPTION_OVERLOAD_LATENCY:
+		case MHD_OPTION_OVERLOAD_RETRY_AFTER:
+		case MHD_OPTION_LOOP_STATS_INTERVAL:
+		case MHD_OPTION_LOG_QUEUE_SIZE:
+		case MHD_OPTION_LOG_RATE_LIMIT:
+		case MHD_OPTION_ACCESS_LOG_BATCH_SIZE:
+		case MHD_OPTION_ACCESS_LOG_INTERVAL:
+		case MHD_OPTION_HTTP2_MAX_CONCURRENT_STREAMS:
+		case MHD_OPTION_RESPONSE_CACHE_SIZE:
+		case MHD_OPTION_CONNECTION_REBALANCE:
+		case MHD_OPTION_EPOLL_MAX_EVENTS:
+		case MHD_OPTION_CONNECTION_TIMEOUT_MS:
+		case MHD_OPTION_HEADER_TIMEOUT_MS:
+		case MHD_OPTION_MIN_DATA_RATE:
+		case MHD_OPTION_SHUTDOWN_GRACE_MS:
+		case MHD_OPTION_LISTEN_SOCKET_SYSTEMD:
+		case MHD_OPTION_CONNECTION_POOL_CACHE_SIZE:
+		case MHD_OPTION_CONNECTION_IDLE_RELEASE_TIMEOUT:
+		case MHD_OPTION_LAZY_VALUE_PARSING:
+		case MHD_OPTION_COALESCE_CHUNKED_UPLOAD:
+		case MHD_OPTION_PIPELINE_CORK:
+		case MHD_OPTION_HTTPS_SESSION_TICKETS:
+		case MHD_OPTION_HTTPS_SESSION_CACHE_SIZE:
+		case MHD_OPTION_HTTPS_HANDSHAKE_THREADS:
+		case MHD_OPTION_HANDLER_THREADS:
+		case MHD_OPTION_THREAD_CACHE_SIZE:
+		case MHD_OPTION_THREAD_CACHE_TIMEOUT:
+		case MHD_OPTION_PARK_IDLE_CONNECTIONS:
+		case MHD_OPTION_SLOW_REQUEST_THRESHOLD_MS:
+		case MHD_OPTION_BASIC_AUTH_CACHE_SIZE:
+		case MHD_OPTION_BASIC_AUTH_CACHE_TTL:
+		case MHD_OPTION_PREFORK_WORKERS:
+		case MHD_OPTION_ACCEPT_FAIR_SHARE:
+		case MHD_OPTION_ADAPTIVE_READ_BUFFER:
+		case MHD_OPTION_INFLATE_REQUEST_BODY:
+		  if (MHD_YES != parse_options (daemon,
+						servaddr,
+						opt,
+						(unsigned int) oa[i].value,
+						MHD_OPTION_END))
+		    return MHD_NO;
+		  break;
+		  /* all options taking 'enum' or 'int' */
+		case MHD_OPTION_HTTPS_CRED_TYPE:
+		case MHD_OPTION_ACCESS_LOG_FD:
+		  if (MHD_YES != parse_options (daemon,
+						servaddr,
+						opt,
+						(int) oa[i].value,
+						MHD_OPTION_END))
+		    return MHD_NO;
+		  break;
+                  /* all options taking 'MHD_socket' */
+                case MHD_OPTION_LISTEN_SOCKET:
+                  if (MHD_YES != parse_options (daemon,
+                                                servaddr,
+                                                opt,
+                                                (MHD_socket) oa[i].value,
+                                                MHD_OPTION_END))
+                    return MHD_NO;
+                  break;
+		  /* all options taking one pointer */
+		case MHD_OPTION_SOCK_ADDR:
+		case MHD_OPTION_HTTPS_MEM_KEY:
+		case MHD_OPTION_HTTPS_KEY_PASSWORD:
+		case MHD_OPTION_HTTPS_MEM_CERT:
+		case MHD_OPTION_HTTPS_MEM_TRUST:
+	        case MHD_OPTION_HTTPS_MEM_DHPARAMS:
+		case MHD_OPTION_HTTPS_PRIORITIES:
+		case MHD_OPTION_ALT_SVC:
+		case MHD_OPTION_ARRAY:
+                case MHD_OPTION_HTTPS_CERT_CALLBACK:
+		  if (MHD_YES != parse_options (daemon,
+						servaddr,
+						opt,
+						oa[i].ptr_value,
+						MHD_OPTION_END))
+		    return MHD_NO;
+		  break;
+		  /* all options taking two pointers */
+		case MHD_OPTION_NOTIFY_COMPLETED:
+		case MHD_OPTION_NOTIFY_CONNECTION:
+		case MHD_OPTION_NOTIFY_SOCKET:
+		case MHD_OPTION_URI_LOG_CALLBACK:
+		case MHD_OPTION_PRIORITY_CALLBACK:
+		case MHD_OPTION_UPLOAD_BUFFER_CALLBACK:
+		case MHD_OPTION_LOOP_STATS_CALLBACK:
+		case MHD_OPTION_ACCESS_LOG_CALLBACK:
+		case MHD_OPTION_SLOW_REQUEST_CALLBACK:
+		case MHD_OPTION_EXTERNAL_LOGGER:
+		case MHD_OPTION_UNESCAPE_CALLBACK:
+		  if (MHD_YES != parse_options (daemon,
+						servaddr,
+						opt,
+						(void *) oa[i].value,
+						oa[i].ptr_value,
+						MHD_OPTION_END))
+		    return MHD_NO;
+		  break;
+		  /* options taking size_t-number followed by pointer */
+		case MHD_OPTION_DIGEST_AUTH_RANDOM:
+		  if (MHD_YES != parse_options (daemon,
+						servaddr,
+						opt,
+						(size_t) oa[i].value,
+						oa[i].ptr_value,
+						MHD_OPTION_END))
+		    return MHD_NO;
+		  break;
+		  /* options taking unsigned int-number followed by pointer */
+		case MHD_OPTION_THREAD_POOL_CPU_AFFINITY:
+		case MHD_OPTION_HTTPS_CERT_TABLE:
+		  if (MHD_YES != parse_options (daemon,
+						servaddr,
+						opt,
+						(unsigned int) oa[i].value,
+						oa[i].ptr_value,
+						MHD_OPTION_END))
+		    return MHD_NO;
+		  break;
+		default:
+		  return MHD_NO;
+		}
+	      i++;
+	    }
+	  break;
+        case MHD_OPTION_UNESCAPE_CALLBACK:
+          daemon->unescape_callback =
+            va_arg (ap, UnescapeCallback);
+          daemon->unescape_callback_cls = va_arg (ap, void *);
+          break;
+        default:
+#ifdef HAVE_MESSAGES
+          if (((opt >= MHD_OPTION_HTTPS_MEM_KEY) &&
+              (opt <= MHD_OPTION_HTTPS_PRIORITIES)) || (opt == MHD_OPTION_HTTPS_MEM_TRUST))
+            {
+              MHD_DLOG (daemon,
+			"MHD HTTPS option %d passed to MHD compiled without HTTPS support\n",
+			opt);
+            }
+          else
+            {
+              MHD_DLOG (daemon,
+			"Invalid option %d! (Did you terminate the list with MHD_OPTION_END?)\n",
+			opt);
+            }
+#endif
+	  return MHD_NO;
+        }
+    }
+  return MHD_YES;
+}
 
 
 /**
- * Start a webserver on the given port.  Variadic version of
- * #MHD_start_daemon_va.
+ * Create a listen socket, if possible with SOCK_CLOEXEC flag set.
  *
- * @param flags combination of `enum MHD_FLAG` values
- * @param port port to bind to
- * @param apc callback to call to check which clients
- *        will be allowed to connect; you can pass NULL
- *        in which case connections from any IP will be
- *        accepted
- * @param apc_cls extra argument to @a apc
- * @param dh handler called for all requests (repeatedly)
- * @param dh_cls extra argument to @a dh
- * @return NULL on error, handle to daemon on success
- * @ingroup event
+ * @param daemon daemon for which we create the socket
+ * @param domain socket domain (i.e. PF_INET)
+ * @param type socket type (usually SOCK_STREAM)
+ * @param protocol desired protocol, 0 for default
  */
-struct MHD_Daemon *
-MHD_start_daemon (unsigned int flags,
-                  uint16_t port,
-                  MHD_AcceptPolicyCallback apc,
-                  void *apc_cls,
-                  MHD_AccessHandlerCallback dh, void *dh_cls, ...)
+static MHD_socket
+create_socket (struct MHD_Daemon *daemon,
+	       int domain, int type, int protocol)
 {
-  struct MHD_Daemon *daemon;
-  va_list ap;
+  int ctype = type | SOCK_CLOEXEC;
+  MHD_socket fd;
 
-  va_start (ap, dh_cls);
-  daemon = MHD_start_daemon_va (flags, port, apc, apc_cls, dh, dh_cls, ap);
-  va_end (ap);
-  return daemon;
+  /* use SOCK_STREAM rather than ai_socktype: some getaddrinfo
+   * implementations do not set ai_socktype, e.g. RHL6.2. */
+  fd = socket (domain, ctype, protocol);
+  if ( (MHD_INVALID_SOCKET == fd) && (EINVAL == MHD_socket_errno_) && (0 != SOCK_CLOEXEC) )
+  {
+    ctype = type;
+    fd = socket(domain, type, protocol);
+  }
+  if (MHD_INVALID_SOCKET == fd)
+    return MHD_INVALID_SOCKET;
+  if (type == ctype)
+    make_nonblocking_noninheritable (daemon, fd);
+  return fd;
+}
+
+
+/**
+ * Have the kernel defer reporting connections on the (listening)
+ * socket @a fd until the client has sent data, see
+ * #MHD_OPTION_TCP_DEFER_ACCEPT.  Failures are logged but otherwise
+ * ignored, the connections are then handled as usual.
+ *
+ * @param daemon daemon the listen socket belongs to
+ * @param fd listen socket, must already be listening for BSD
+ *        accept filters
+ */
+static void
+set_defer_accept (struct MHD_Daemon *daemon,
+                  MHD_socket fd)
+{
+#if defined(TCP_DEFER_ACCEPT)
+  int secs;
+
+  if (0 == daemon->defer_accept)
+    return;
+  secs = (int) daemon->defer_accept;
+  if (0 != setsockopt (fd,
+                       IPPROTO_TCP, TCP_DEFER_ACCEPT,
+                       &secs,
+                       sizeof (secs)))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "setsockopt failed: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+    }
+#elif defined(SO_ACCEPTFILTER)
+  struct accept_filter_arg afa;
+
+  if (0 == daemon->defer_accept)
+    return;
+  memset (&afa, 0, sizeof (afa));
+  strcpy (afa.af_name, "dataready");
+  if (0 != setsockopt (fd,
+                       SOL_SOCKET, SO_ACCEPTFILTER,
+                       &afa,
+                       sizeof (afa)))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to set accept filter: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+    }
+#else
+  (void) daemon;
+  (void) fd;
+#endif
+}
+
+
+#ifdef SO_REUSEPORT
+/**
+ * Create an additional listen socket for a worker of a daemon
+ * started with #MHD_USE_THREAD_POOL_REUSEPORT.  The socket is bound
+ * to the same address as the listen socket of the master daemon,
+ * so that the kernel distributes incoming connections among all
+ * sockets of the resulting SO_REUSEPORT group.
+ *
+ * @param daemon master daemon (must have a listen socket)
+ * @return new (non-blocking) listen socket, #MHD_INVALID_SOCKET on error
+ */
+static MHD_socket
+create_reuseport_socket (struct MHD_Daemon *daemon)
+{
+  const _MHD_SOCKOPT_BOOL_TYPE on = 1;
+  struct sockaddr_storage addrstorage;
+  struct sockaddr *addr = (struct sockaddr *) &addrstorage;
+  socklen_t addrlen;
+  MHD_socket fd;
+  int sk_flags;
+
+  addrlen = sizeof (addrstorage);
+  memset (addr, 0, sizeof (addrstorage));
+  if (0 != getsockname (daemon->socket_fd, addr, &addrlen))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to get listen socket address: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+      return MHD_INVALID_SOCKET;
+    }
+  fd = create_socket (daemon,
+                      addr->sa_family, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == fd)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Call to socket failed: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+      return MHD_INVALID_SOCKET;
+    }
+  if (0 > setsockopt (fd,
+                      SOL_SOCKET,
+                      SO_REUSEADDR,
+                      (void*)&on, sizeof (on)))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "setsockopt failed: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+    }
+  if (0 > setsockopt (fd,
+                      SOL_SOCKET,
+                      SO_REUSEPORT,
+                      (void*)&on, sizeof (on)))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "setsockopt failed: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+      goto fail;
+    }
+#if HAVE_INET6 && defined(IPPROTO_IPV6) && defined(IPV6_V6ONLY)
+  if (AF_INET6 == addr->sa_family)
+    {
+      const _MHD_SOCKOPT_BOOL_TYPE v6_only =
+        (MHD_USE_DUAL_STACK != (daemon->options & MHD_USE_DUAL_STACK));
+
+      if (0 > setsockopt (fd,
+                          IPPROTO_IPV6, IPV6_V6ONLY,
+                          (const void*)&v6_only, sizeof (v6_only)))
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "setsockopt failed: %s\n",
+                    MHD_socket_last_strerr_ ());
+#endif
+        }
+    }
+#endif
+  if (-1 == bind (fd, addr, addrlen))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to bind worker listen socket: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+      goto fail;
+    }
+#ifdef TCP_FASTOPEN
+  if ( (0 != (daemon->options & MHD_USE_TCP_FASTOPEN)) &&
+       (0 != setsockopt (fd,
+                         IPPROTO_TCP, TCP_FASTOPEN,
+                         &daemon->fastopen_queue_size,
+                         sizeof (daemon->fastopen_queue_size))) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "setsockopt failed: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+    }
+#endif
+  /* Accept must be non-blocking, just like for the shared socket. */
+  sk_flags = fcntl (fd, F_GETFL);
+  if ( (sk_flags < 0) ||
+       (0 != fcntl (fd, F_SETFL, sk_flags | O_NONBLOCK)) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to make listen socket non-blocking: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+      goto fail;
+    }
+  if (listen (fd, daemon->listen_backlog_size) < 0)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to listen for connections: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+      goto fail;
+    }
+  set_defer_accept (daemon, fd);
+  return fd;
+
+ fail:
+  if (0 != MHD_socket_close_ (fd))
+    MHD_PANIC ("close failed\n");
+  return MHD_INVALID_SOCKET;
+}
+#endif
+
+
+#if defined(LINUX) && defined(SO_ATTACH_REUSEPORT_CBPF)
+/**
+ * Attach a classic BPF program to the SO_REUSEPORT group of the
+ * listen sockets of the thread pool which selects the socket by
+ * the number of the CPU that processed the incoming connection.
+ * Failures are not fatal, the kernel then falls back to hashing.
+ *
+ * @param daemon master daemon started with #MHD_USE_THREAD_POOL_REUSEPORT
+ */
+static void
+attach_reuseport_cpu_steering (struct MHD_Daemon *daemon)
+{
+  struct sock_filter code[] = {
+    /* A = raw_smp_processor_id () */
+    { BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+    /* A = A % number of workers */
+    { BPF_ALU | BPF_MOD | BPF_K, 0, 0, daemon->worker_pool_size },
+    /* return A */
+    { BPF_RET | BPF_A, 0, 0, 0 }
+  };
+  struct sock_fprog prog;
+
+  prog.len = sizeof (code) / sizeof (code[0]);
+  prog.filter = code;
+  if (0 != setsockopt (daemon->socket_fd,
+                       SOL_SOCKET,
+                       SO_ATTACH_REUSEPORT_CBPF,
+                       &prog, sizeof (prog)))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to attach CPU steering program: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+    }
+}
+#endif
+
+
+#if EPOLL_SUPPORT
+/**
+ * Setup epoll() FD for the daemon and initialize it to listen
+ * on the listen FD.
+ *
+ * @param daemon daemon to initialize for epoll()
+ * @return #MHD_YES on success, #MHD_NO on failure
+ */
+static int
+setup_epoll_to_listen (struct MHD_Daemon *daemon)
+{
+  struct epoll_event event;
+
+#ifdef HAVE_EPOLL_CREATE1
+  daemon->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+#else  /* !HAVE_EPOLL_CREATE1 */
+  daemon->epoll_fd = epoll_create (MAX_EVENTS);
+#endif /* !HAVE_EPOLL_CREATE1 */
+  if (-1 == daemon->epoll_fd)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Call to epoll_create1 failed: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+      return MHD_NO;
+    }
+#ifndef HAVE_EPOLL_CREATE1
+  else
+    {
+      int fdflags = fcntl (daemon->epoll_fd, F_GETFD);
+      if (0 > fdflags || 0 > fcntl (daemon->epoll_fd, F_SETFD, fdflags | FD_CLOEXEC))
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Failed to change flags on epoll fd: %s\n",
+                    MHD_socket_last_strerr_ ());
+#endif /* HAVE_MESSAGES */
+        }
+    }
+#endif /* !HAVE_EPOLL_CREATE1 */
+  if (0 == EPOLL_CLOEXEC)
+    make_nonblocking_noninheritable (daemon,
+				     daemon->epoll_fd);
+#ifdef EPIOCSPARAMS
+  if (0 != daemon->busy_poll_usec)
+    {
+      struct epoll_params params;
+
+      /* let epoll_wait() busy poll the NAPI contexts of our sockets
+         (Linux >= 6.9), best effort like SO_BUSY_POLL */
+      memset (&params, 0, sizeof (params));
+      params.busy_poll_usecs = daemon->busy_poll_usec;
+      params.prefer_busy_poll = 1;
+      (void) ioctl (daemon->epoll_fd, EPIOCSPARAMS, &params);
+    }
+#endif
+  if (MHD_INVALID_SOCKET == daemon->socket_fd)
+    return MHD_YES; /* non-listening daemon */
+  event.events = EPOLLIN;
+  event.data.ptr = daemon;
+  if (0 != epoll_ctl (daemon->epoll_fd,
+		      EPOLL_CTL_ADD,
+		      daemon->socket_fd,
+		      &event))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Call to epoll_ctl failed: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif
+      return MHD_NO;
+    }
+  if (MHD_INVALID_PIPE_ != daemon->wpipe[0])
+    {
+      event.events = EPOLLIN | EPOLLET;
+      event.data.ptr = NULL;
+      event.data.fd = daemon->wpipe[0];
+      if (0 != epoll_ctl (daemon->epoll_fd,
+                          EPOLL_CTL_ADD,
+                          daemon->wpipe[0],
+                          &event))
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Call to epoll_ctl failed: %s\n",
+                    MHD_socket_last_strerr_ ());
+#endif
+          return MHD_NO;
+        }
+    }
+  daemon->listen_socket_in_epoll = MHD_YES;
+  return MHD_YES;
 }
+#endif
 
 
+#if KQUEUE_SUPPORT
 /**
- * Stop accepting connections from the listening socket.  Allows
- * clients to continue processing, but stops accepting new
- * connections.  Note that the caller is responsible for closing the
- * returned socket; however, if MHD is run using threads (anything but
- * external select mode), it must not be closed until AFTER
- * #MHD_stop_daemon has been called (as it is theoretically possible
- * that an existing thread is still using it).
- *
- * Note that some thread modes require the caller to have passed
- * #MHD_USE_PIPE_FOR_SHUTDOWN when using this API.  If this daemon is
- * in one of those modes and this option was not given to
- * #MHD_start_daemon, this function will return #MHD_INVALID_SOCKET.
+ * Setup kqueue() FD for the daemon and initialize it to listen
+ * on the listen FD, the signalling pipe and the user event used
+ * to signal shutdown.
  *
- * @param daemon daemon to stop accepting new connections for
- * @return old listen socket on success, #MHD_INVALID_SOCKET if
- *         the daemon was already not listening anymore
- * @ingroup specialized
+ * @param daemon daemon to initialize for kqueue()
+ * @return #MHD_YES on success, #MHD_NO on failure
  */
-MHD_socket
-MHD_quiesce_daemon (struct MHD_Daemon *daemon)
+static int
+setup_kqueue_to_listen (struct MHD_Daemon *daemon)
 {
-  unsigned int i;
-  MHD_socket ret;
+  struct kevent changes[3];
+  int num_changes;
+  int fdflags;
 
-  ret = daemon->socket_fd;
-  if (MHD_INVALID_SOCKET == ret)
-    return MHD_INVALID_SOCKET;
-  if ( (MHD_INVALID_PIPE_ == daemon->wpipe[1]) &&
-       (0 != (daemon->options & (MHD_USE_SELECT_INTERNALLY | MHD_USE_THREAD_PER_CONNECTION))) )
+  daemon->kqueue_fd = kqueue ();
+  if (-1 == daemon->kqueue_fd)
     {
 #ifdef HAVE_MESSAGES
       MHD_DLOG (daemon,
-		"Using MHD_quiesce_daemon in this mode requires MHD_USE_PIPE_FOR_SHUTDOWN\n");
+                "Call to kqueue failed: %s\n",
+                MHD_socket_last_strerr_ ());
 #endif
-      return MHD_INVALID_SOCKET;
+      return MHD_NO;
     }
-
-  if (NULL != daemon->worker_pool)
-    for (i = 0; i < daemon->worker_pool_size; i++)
-      {
-	daemon->worker_pool[i].socket_fd = MHD_INVALID_SOCKET;
-#if EPOLL_SUPPORT
-	if ( (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY)) &&
-	     (-1 != daemon->worker_pool[i].epoll_fd) &&
-	     (MHD_YES == daemon->worker_pool[i].listen_socket_in_epoll) )
-	  {
-	    if (0 != epoll_ctl (daemon->worker_pool[i].epoll_fd,
-				EPOLL_CTL_DEL,
-				ret,
-				NULL))
-	      MHD_PANIC ("Failed to remove listen FD from epoll set\n");
-	    daemon->worker_pool[i].listen_socket_in_epoll = MHD_NO;
-	  }
-#endif
-      }
-  daemon->socket_fd = MHD_INVALID_SOCKET;
-#if EPOLL_SUPPORT
-  if ( (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY)) &&
-       (-1 != daemon->epoll_fd) &&
-       (MHD_YES == daemon->listen_socket_in_epoll) )
+  fdflags = fcntl (daemon->kqueue_fd, F_GETFD);
+  if (0 > fdflags || 0 > fcntl (daemon->kqueue_fd, F_SETFD, fdflags | FD_CLOEXEC))
     {
-      if (0 != epoll_ctl (daemon->epoll_fd,
-			  EPOLL_CTL_DEL,
-			  ret,
-			  NULL))
-	MHD_PANIC ("Failed to remove listen FD from epoll set\n");
-      daemon->listen_socket_in_epoll = MHD_NO;
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to change flags on kqueue fd: %s\n",
+                MHD_socket_last_strerr_ ());
+#endif /* HAVE_MESSAGES */
     }
+  num_changes = 0;
+  EV_SET (&changes[num_changes++], 0, EVFILT_USER, EV_ADD | EV_CLEAR,
+          0, 0, NULL);
+  if (MHD_INVALID_PIPE_ != daemon->wpipe[0])
+    EV_SET (&changes[num_changes++], daemon->wpipe[0], EVFILT_READ,
+            EV_ADD | EV_CLEAR, 0, 0, daemon->wpipe);
+  daemon->listen_socket_in_kqueue = MHD_NO;
+  if (MHD_INVALID_SOCKET != daemon->socket_fd)
+    {
+      EV_SET (&changes[num_changes++], daemon->socket_fd, EVFILT_READ,
+              EV_ADD, 0, 0, daemon);
+      daemon->listen_socket_in_kqueue = MHD_YES;
+    }
+  if (0 != kevent (daemon->kqueue_fd,
+                   changes, num_changes,
+                   NULL, 0,
+                   NULL))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Call to kevent failed: %s\n",
+                MHD_socket_last_strerr_ ());
 #endif
-  return ret;
+      return MHD_NO;
+    }
+  return MHD_YES;
 }
+#endif
 
 
+#if IO_URING_SUPPORT
 /**
- * Signature of the MHD custom logger function.
+ * Setup the io_uring instance for the daemon.  The listen socket
+ * and the signalling pipe are added by #MHD_io_uring().
  *
- * @param cls closure
- * @param format format string
- * @param va arguments to the format string (fprintf-style)
+ * @param daemon daemon to initialize for io_uring
+ * @return #MHD_YES on success, #MHD_NO on failure
  */
-typedef void (*VfprintfFunctionPointerType)(void *cls,
-					    const char *format,
-					    va_list va);
+static int
+setup_io_uring (struct MHD_Daemon *daemon)
+{
+  if (MHD_YES != MHD_io_uring_init_ (&daemon->uring,
+                                     MHD_IO_URING_ENTRIES))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to set up io_uring: %s\n",
+                MHD_strerror_ (errno));
+#endif
+      return MHD_NO;
+    }
+  daemon->listen_socket_in_epoll = MHD_NO;
+  daemon->wpipe_in_uring = MHD_NO;
+  return MHD_YES;
+}
 
 
 /**
- * Parse a list of options given as varargs.
+ * Destroy the io_uring instance of the daemon and free the
+ * connections that were waiting for their poll request to be
+ * cancelled.
  *
- * @param daemon the daemon to initialize
- * @param servaddr where to store the server's listen address
- * @param ap the options
- * @return #MHD_YES on success, #MHD_NO on error
+ * @param daemon daemon to clean up
  */
-static int
-parse_options_va (struct MHD_Daemon *daemon,
-		  const struct sockaddr **servaddr,
-		  va_list ap);
+static void
+close_io_uring (struct MHD_Daemon *daemon)
+{
+  struct MHD_Connection *pos;
+
+  MHD_io_uring_deinit_ (&daemon->uring);
+  while (NULL != (pos = daemon->uring_zombie_head))
+    {
+      DLL_remove (daemon->uring_zombie_head,
+                  daemon->uring_zombie_tail,
+                  pos);
+      free (pos);
+    }
+}
+#endif
 
 
 /**
- * Parse a list of options given as varargs.
+ * Create the epoll set, io_uring or kqueue of a daemon without
+ * thread pool (the workers of a pool create their own), if it uses
+ * one, and add its listen socket.
  *
- * @param daemon the daemon to initialize
- * @param servaddr where to store the server's listen address
- * @param ... the options
- * @return #MHD_YES on success, #MHD_NO on error
+ * @param daemon daemon with its listen socket and control pipe
+ * @return #MHD_YES on success, #MHD_NO on error (logged)
  */
 static int
-parse_options (struct MHD_Daemon *daemon,
-	       const struct sockaddr **servaddr,
-	       ...)
+setup_event_loop (struct MHD_Daemon *daemon)
 {
-  va_list ap;
-  int ret;
-
-  va_start (ap, servaddr);
-  ret = parse_options_va (daemon, servaddr, ap);
-  va_end (ap);
-  return ret;
+#if EPOLL_SUPPORT
+  if ( (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY)) &&
+       (0 == daemon->worker_pool_size) &&
+       (0 == (daemon->options & MHD_USE_NO_LISTEN_SOCKET)) )
+    {
+#if IO_URING_SUPPORT
+      if (MHD_USE_IO_URING_LINUX_ONLY == (daemon->options & MHD_USE_IO_URING_LINUX_ONLY))
+        return setup_io_uring (daemon);
+#endif
+      return setup_epoll_to_listen (daemon);
+    }
+#endif
+#if KQUEUE_SUPPORT
+  if ( (0 != (daemon->options & MHD_USE_KQUEUE)) &&
+       (0 == daemon->worker_pool_size) )
+    return setup_kqueue_to_listen (daemon);
+#endif
+  (void) daemon;
+  return MHD_YES;
 }
 
 
+#if PREFORK_SUPPORT
 /**
- * Parse a list of options given as varargs.
+ * Complete the copy of the daemon in a worker process of
+ * #MHD_OPTION_PREFORK_WORKERS: count in the shared statistics, give
+ * all but the first worker a listen socket of their own, replace the
+ * control pipe inherited from the master and create what the master
+ * left to the workers.
  *
- * @param daemon the daemon to initialize
- * @param servaddr where to store the server's listen address
- * @param ap the options
- * @return #MHD_YES on success, #MHD_NO on error
+ * @param daemon the (master) daemon in the worker process
+ * @return #MHD_YES on success, #MHD_NO on error (logged)
  */
 static int
-parse_options_va (struct MHD_Daemon *daemon,
-		  const struct sockaddr **servaddr,
-		  va_list ap)
+setup_prefork_worker (struct MHD_Daemon *daemon)
 {
-  enum MHD_OPTION opt;
-  struct MHD_OptionItem *oa;
-  unsigned int i;
-#if HTTPS_SUPPORT
-  int ret;
-  const char *pstr;
-#endif
+  MHD_socket fd;
 
-  while (MHD_OPTION_END != (opt = (enum MHD_OPTION) va_arg (ap, int)))
+  daemon->stats = MHD_prefork_stats_ (daemon, 0);
+  /* like the workers of #MHD_USE_THREAD_POOL_REUSEPORT, the first
+     worker keeps the socket that is already part of the group */
+  if (0 != MHD_prefork_worker_ (daemon))
     {
-      switch (opt)
+      fd = create_reuseport_socket (daemon);
+      if (MHD_INVALID_SOCKET == fd)
+        return MHD_NO;
+      if (0 != MHD_socket_close_ (daemon->socket_fd))
+        MHD_PANIC ("close failed\n");
+      daemon->socket_fd = fd;
+      if ( (0 == (daemon->options & (MHD_USE_POLL | MHD_USE_EPOLL_LINUX_ONLY | MHD_USE_KQUEUE | MHD_USE_LARGE_FD_SETS))) &&
+           (fd >= FD_SETSIZE) )
         {
-        case MHD_OPTION_CONNECTION_MEMORY_LIMIT:
-          daemon->pool_size = va_arg (ap, size_t);
-          break;
-        case MHD_OPTION_CONNECTION_MEMORY_INCREMENT:
-          daemon->pool_increment= va_arg (ap, size_t);
-          break;
-        case MHD_OPTION_CONNECTION_LIMIT:
-          daemon->connection_limit = va_arg (ap, unsigned int);
-          break;
-        case MHD_OPTION_CONNECTION_TIMEOUT:
-          daemon->connection_timeout = va_arg (ap, unsigned int);
-          break;
-        case MHD_OPTION_NOTIFY_COMPLETED:
-          daemon->notify_completed =
-            va_arg (ap, MHD_RequestCompletedCallback);
-          daemon->notify_completed_cls = va_arg (ap, void *);
-          break;
-        case MHD_OPTION_NOTIFY_CONNECTION:
-          daemon->notify_connection =
-            va_arg (ap, MHD_NotifyConnectionCallback);
-          daemon->notify_connection_cls = va_arg (ap, void *);
-          break;
-        case MHD_OPTION_PER_IP_CONNECTION_LIMIT:
-          daemon->per_ip_connection_limit = va_arg (ap, unsigned int);
-          break;
-        case MHD_OPTION_SOCK_ADDR:
-          *servaddr = va_arg (ap, const struct sockaddr *);
-          break;
-        case MHD_OPTION_URI_LOG_CALLBACK:
-          daemon->uri_log_callback =
-            va_arg (ap, LogCallback);
-          daemon->uri_log_callback_cls = va_arg (ap, void *);
-          break;
-        case MHD_OPTION_THREAD_POOL_SIZE:
-          daemon->worker_pool_size = va_arg (ap, unsigned int);
-	  if (daemon->worker_pool_size >= (SIZE_MAX / sizeof (struct MHD_Daemon)))
-	    {
 #ifdef HAVE_MESSAGES
-	      MHD_DLOG (daemon,
-			"Specified thread pool size (%u) too big\n",
-			daemon->worker_pool_size);
+          MHD_DLOG (daemon,
+                    "Socket descriptor larger than FD_SETSIZE: %d > %d\n",
+                    fd,
+                    FD_SETSIZE);
 #endif
-	      return MHD_NO;
-	    }
-          break;
-#if HTTPS_SUPPORT
-        case MHD_OPTION_HTTPS_MEM_KEY:
-	  if (0 != (daemon->options & MHD_USE_SSL))
-	    daemon->https_mem_key = va_arg (ap, const char *);
+          return MHD_NO;
+        }
+    }
+  /* a pipe shared with the other processes would wake all of them */
+  if (MHD_INVALID_PIPE_ != daemon->wpipe[1])
+    {
+      if (0 != MHD_pipe_close_ (daemon->wpipe[0]))
+        MHD_PANIC ("close failed\n");
+      if (0 != MHD_pipe_close_ (daemon->wpipe[1]))
+        MHD_PANIC ("close failed\n");
+      if (0 != MHD_itc_create_ (daemon->wpipe))
+        {
 #ifdef HAVE_MESSAGES
-	  else
-	    MHD_DLOG (daemon,
-		      "MHD HTTPS option %d passed to MHD but MHD_USE_SSL not set\n",
-		      opt);
+          MHD_DLOG (daemon,
+                    "Failed to create control pipe: %s\n",
+                    MHD_strerror_ (errno));
 #endif
-          break;
-        case MHD_OPTION_HTTPS_KEY_PASSWORD:
-	  if (0 != (daemon->options & MHD_USE_SSL))
-	    daemon->https_key_password = va_arg (ap, const char *);
+          daemon->wpipe[0] = MHD_INVALID_PIPE_;
+          daemon->wpipe[1] = MHD_INVALID_PIPE_;
+          return MHD_NO;
+        }
+    }
+  if (MHD_YES != start_log_thread (daemon))
+    return MHD_NO;
+  return setup_event_loop (daemon);
+}
+#endif
+
+
+/**
+ * Maximum number of workers of a thread pool that are started by one
+ * thread, see start_workers().
+ */
+#define MHD_WORKER_START_BATCH 8
+
+
+/**
+ * Thread of a worker daemon: waits until all workers of the pool
+ * are started and only then runs the event loop.
+ *
+ * @param cls the `struct MHD_Daemon` of the worker
+ * @return always 0
+ */
+static MHD_THRD_RTRN_TYPE_ MHD_THRD_CALL_SPEC_
+worker_thread (void *cls)
+{
+  struct MHD_Daemon *d = cls;
+  int failed;
+
+  if (MHD_YES != MHD_mutex_lock_ (&d->master->startup_lock))
+    MHD_PANIC ("Failed to acquire startup mutex\n");
+  failed = d->master->startup_failed;
+  if (MHD_YES != MHD_mutex_unlock_ (&d->master->startup_lock))
+    MHD_PANIC ("Failed to release startup mutex\n");
+  if (MHD_YES == failed)
+    return (MHD_THRD_RTRN_TYPE_) 0;
+  return MHD_select_thread (d);
+}
+
+
+/**
+ * Set up the worker daemon @a i of the thread pool of @a daemon and
+ * start its thread.  On failure, everything created for the worker
+ * is released again.
+ *
+ * @param daemon master daemon
+ * @param i index of the worker in the pool
+ * @param started set to 1 at index @a i if the worker was started
+ */
+static void
+start_worker (struct MHD_Daemon *daemon,
+              unsigned int i,
+              char *started)
+{
+  struct MHD_Daemon *d = &daemon->worker_pool[i];
+  int res_thread_create;
+
+  /* Create copy of the Daemon object for each worker */
+  memcpy (d, daemon, sizeof (struct MHD_Daemon));
+  d->stats = &d->stats_storage;
+#if PREFORK_SUPPORT
+  if (NULL != daemon->prefork)
+    d->stats = MHD_prefork_stats_ (daemon, i + 1);
+#endif
+  /* Adjust pooling params for worker daemons; note that memcpy()
+     has already copied MHD_USE_SELECT_INTERNALLY thread model into
+     the worker threads. */
+  d->master = daemon;
+  d->worker_pool_size = 0;
+  d->worker_pool = NULL;
+  if (MHD_YES == daemon->pin_workers)
+    d->worker_cpu = get_worker_cpu (daemon, i);
+  /* each worker gets its share of the rate limits */
+  if (0 != daemon->send_bucket.rate)
+    MHD_bucket_init_ (&d->send_bucket,
+                      MHD_MAX (1, daemon->send_bucket.rate
+                               / daemon->worker_pool_size));
+  if (0 != daemon->recv_bucket.rate)
+    MHD_bucket_init_ (&d->recv_bucket,
+                      MHD_MAX (1, daemon->recv_bucket.rate
+                               / daemon->worker_pool_size));
+#ifdef SO_REUSEPORT
+  /* The first worker keeps using the master's listen socket,
+     which is already part of the SO_REUSEPORT group. */
+  if ( (0 != (daemon->options & MHD_USE_THREAD_POOL_REUSEPORT)) &&
+       (0 != i) )
+    {
+      d->worker_socket_fd = create_reuseport_socket (daemon);
+      if (MHD_INVALID_SOCKET == d->worker_socket_fd)
+        return;
+#ifndef MHD_WINSOCK_SOCKETS
+      if ( (0 == (daemon->options & (MHD_USE_POLL | MHD_USE_EPOLL_LINUX_ONLY | MHD_USE_KQUEUE | MHD_USE_LARGE_FD_SETS))) &&
+           (d->worker_socket_fd >= FD_SETSIZE) )
+        {
 #ifdef HAVE_MESSAGES
-	  else
-	    MHD_DLOG (daemon,
-		      "MHD HTTPS option %d passed to MHD but MHD_USE_SSL not set\n",
-		      opt);
+          MHD_DLOG (daemon,
+                    "Socket descriptor larger than FD_SETSIZE: %d > %d\n",
+                    d->worker_socket_fd,
+                    FD_SETSIZE);
 #endif
-          break;
-        case MHD_OPTION_HTTPS_MEM_CERT:
-	  if (0 != (daemon->options & MHD_USE_SSL))
-	    daemon->https_mem_cert = va_arg (ap, const char *);
-#ifdef HAVE_MESSAGES
-	  else
-	    MHD_DLOG (daemon,
-		      "MHD HTTPS option %d passed to MHD but MHD_USE_SSL not set\n",
-		      opt);
+          goto close_socket;
+        }
 #endif
-          break;
-        case MHD_OPTION_HTTPS_MEM_TRUST:
-	  if (0 != (daemon->options & MHD_USE_SSL))
-	    daemon->https_mem_trust = va_arg (ap, const char *);
-#ifdef HAVE_MESSAGES
-	  else
-	    MHD_DLOG (daemon,
-		      "MHD HTTPS option %d passed to MHD but MHD_USE_SSL not set\n",
-		      opt);
+      d->socket_fd = d->worker_socket_fd;
+    }
 #endif
-          break;
-	case MHD_OPTION_HTTPS_CRED_TYPE:
-	  daemon->cred_type = (gnutls_credentials_type_t) va_arg (ap, int);
-	  break;
-        case MHD_OPTION_HTTPS_MEM_DHPARAMS:
-          if (0 != (daemon->options & MHD_USE_SSL))
-            {
-              const char *arg = va_arg (ap, const char *);
-              gnutls_datum_t dhpar;
 
-              if (gnutls_dh_params_init (&daemon->https_mem_dhparams) < 0)
-                {
+  /* each worker needs a pipe of its own: with a shared one,
+     a worker may consume the wake up meant for another */
+  if ( (MHD_INVALID_PIPE_ != daemon->wpipe[1]) ||
+       (MHD_USE_SUSPEND_RESUME == (daemon->options & MHD_USE_SUSPEND_RESUME)) ||
+       (MHD_USE_IO_URING_LINUX_ONLY == (daemon->options & MHD_USE_IO_URING_LINUX_ONLY)) ||
+       (0 != daemon->rebalance_threshold) ||
+       (0 != daemon->accept_fair_share) )
+    {
+      if (0 != MHD_itc_create_ (d->wpipe))
+        {
 #ifdef HAVE_MESSAGES
-                  MHD_DLOG(daemon,
-                           "Error initializing DH parameters\n");
+          MHD_DLOG (daemon,
+                    "Failed to create worker control pipe: %s\n",
+                    MHD_pipe_last_strerror_() );
 #endif
-                  return MHD_NO;
-                }
-              dhpar.data = (unsigned char *) arg;
-              dhpar.size = strlen (arg);
-              if (gnutls_dh_params_import_pkcs3 (daemon->https_mem_dhparams, &dhpar,
-                                                 GNUTLS_X509_FMT_PEM) < 0)
-                {
+          d->wpipe[0] = MHD_INVALID_PIPE_;
+          d->wpipe[1] = MHD_INVALID_PIPE_;
+          goto close_socket;
+        }
+#ifndef MHD_WINSOCK_SOCKETS
+      if ( (0 == (daemon->options & (MHD_USE_POLL | MHD_USE_EPOLL_LINUX_ONLY | MHD_USE_KQUEUE | MHD_USE_LARGE_FD_SETS))) &&
+           (d->wpipe[0] >= FD_SETSIZE) )
+        {
 #ifdef HAVE_MESSAGES
-                  MHD_DLOG(daemon,
-                           "Bad Diffie-Hellman parameters format\n");
+          MHD_DLOG (daemon,
+                    "File descriptor for worker control pipe exceeds maximum value\n");
 #endif
-                  gnutls_dh_params_deinit (daemon->https_mem_dhparams);
-                  return MHD_NO;
-                }
-              daemon->have_dhparams = MHD_YES;
-            }
-          else
-            {
-#ifdef HAVE_MESSAGES
-              MHD_DLOG (daemon,
-                        "MHD HTTPS option %d passed to MHD but MHD_USE_SSL not set\n",
-                        opt);
+          goto close_pipe;
+        }
 #endif
-              return MHD_NO;
-            }
-          break;
-        case MHD_OPTION_HTTPS_PRIORITIES:
-	  if (0 != (daemon->options & MHD_USE_SSL))
-	    {
-	      gnutls_priority_deinit (daemon->priority_cache);
-	      ret = gnutls_priority_init (&daemon->priority_cache,
-					  pstr = va_arg (ap, const char*),
-					  NULL);
-	      if (GNUTLS_E_SUCCESS != ret)
-	      {
-#ifdef HAVE_MESSAGES
-		MHD_DLOG (daemon,
-			  "Setting priorities to `%s' failed: %s\n",
-			  pstr,
-			  gnutls_strerror (ret));
-#endif
-		daemon->priority_cache = NULL;
-		return MHD_NO;
-	      }
-	    }
-          break;
-        case MHD_OPTION_HTTPS_CERT_CALLBACK:
-#if GNUTLS_VERSION_MAJOR < 3
-#ifdef HAVE_MESSAGES
-          MHD_DLOG (daemon,
-                    "MHD_OPTION_HTTPS_CERT_CALLBACK requires building MHD with GnuTLS >= 3.0\n");
+    }
+
+  /* Divide available connections evenly amongst the threads.
+   * Thread indexes in [0, leftover) each get one of the
+   * leftover connections. */
+  d->connection_limit = daemon->connection_limit / daemon->worker_pool_size;
+  if (i < daemon->connection_limit % daemon->worker_pool_size)
+    ++d->connection_limit;
+#if IO_URING_SUPPORT
+  if ( (MHD_USE_IO_URING_LINUX_ONLY == (daemon->options & MHD_USE_IO_URING_LINUX_ONLY)) &&
+       (MHD_YES != setup_io_uring (d)) )
+    goto close_pipe;
 #endif
-          return MHD_NO;
-#else
-          if (0 != (daemon->options & MHD_USE_SSL))
-            daemon->cert_callback = va_arg (ap, gnutls_certificate_retrieve_function2 *);
-          break;
+#if EPOLL_SUPPORT
+  if ( (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY)) &&
+       (MHD_USE_IO_URING_LINUX_ONLY != (daemon->options & MHD_USE_IO_URING_LINUX_ONLY)) &&
+       (MHD_YES != setup_epoll_to_listen (d)) )
+    goto close_event_set;
 #endif
+#if KQUEUE_SUPPORT
+  if ( (0 != (daemon->options & MHD_USE_KQUEUE)) &&
+       (MHD_YES != setup_kqueue_to_listen (d)) )
+    goto close_event_set;
 #endif
-#ifdef DAUTH_SUPPORT
-	case MHD_OPTION_DIGEST_AUTH_RANDOM:
-	  daemon->digest_auth_rand_size = va_arg (ap, size_t);
-	  daemon->digest_auth_random = va_arg (ap, const char *);
-	  break;
-	case MHD_OPTION_NONCE_NC_SIZE:
-	  daemon->nonce_nc_size = va_arg (ap, unsigned int);
-	  break;
+  /* Must init cleanup connection mutex for each worker */
+  if (MHD_YES != MHD_mutex_create_ (&d->cleanup_connection_mutex))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+               "MHD failed to initialize cleanup connection mutex for thread worker %u\n", i);
 #endif
-	case MHD_OPTION_LISTEN_SOCKET:
-	  daemon->socket_fd = va_arg (ap, MHD_socket);
-	  break;
-        case MHD_OPTION_EXTERNAL_LOGGER:
+      goto close_event_set;
+    }
+
+  /* Spawn the worker thread */
+  if (0 != (res_thread_create =
+            create_thread (&d->pid, daemon, &worker_thread, d)))
+    {
 #ifdef HAVE_MESSAGES
-          daemon->custom_error_log =
-            va_arg (ap, VfprintfFunctionPointerType);
-          daemon->custom_error_log_cls = va_arg (ap, void *);
-#else
-          va_arg (ap, VfprintfFunctionPointerType);
-          va_arg (ap, void *);
+      MHD_DLOG (daemon,
+                "Failed to create pool thread: %s\n",
+                MHD_strerror_ (res_thread_create));
 #endif
-          break;
-        case MHD_OPTION_THREAD_STACK_SIZE:
-          daemon->thread_stack_size = va_arg (ap, size_t);
-          break;
-#ifdef TCP_FASTOPEN
-        case MHD_OPTION_TCP_FASTOPEN_QUEUE_SIZE:
-          daemon->fastopen_queue_size = va_arg (ap, unsigned int);
-          break;
+      (void) MHD_mutex_destroy_ (&d->cleanup_connection_mutex);
+      goto close_event_set;
+    }
+  started[i] = 1;
+  return;
+
+ close_event_set:
+#if EPOLL_SUPPORT
+  if ( (-1 != d->epoll_fd) &&
+       (0 != MHD_socket_close_ (d->epoll_fd)) )
+    MHD_PANIC ("close failed\n");
+  free (d->epoll_events);
 #endif
-	case MHD_OPTION_LISTENING_ADDRESS_REUSE:
-	  daemon->listening_address_reuse = va_arg (ap, unsigned int) ? 1 : -1;
-	  break;
-	case MHD_OPTION_LISTEN_BACKLOG_SIZE:
-	  daemon->listen_backlog_size = va_arg (ap, unsigned int);
-	  break;
-	case MHD_OPTION_ARRAY:
-	  oa = va_arg (ap, struct MHD_OptionItem*);
-	  i = 0;
-	  while (MHD_OPTION_END != (opt = oa[i].option))
-	    {
-	      switch (opt)
-		{
-		  /* all options taking 'size_t' */
-		case MHD_OPTION_CONNECTION_MEMORY_LIMIT:
-		case MHD_OPTION_CONNECTION_MEMORY_INCREMENT:
-		case MHD_OPTION_THREAD_STACK_SIZE:
-		  if (MHD_YES != parse_options (daemon,
-						servaddr,
-						opt,
-						(size_t) oa[i].value,
-						MHD_OPTION_END))
-		    return MHD_NO;
-		  break;
-		  /* all options taking 'unsigned int' */
-		case MHD_OPTION_NONCE_NC_SIZE:
-		case MHD_OPTION_CONNECTION_LIMIT:
-		case MHD_OPTION_CONNECTION_TIMEOUT:
-		case MHD_OPTION_PER_IP_CONNECTION_LIMIT:
-		case MHD_OPTION_THREAD_POOL_SIZE:
-                case MHD_OPTION_TCP_FASTOPEN_QUEUE_SIZE:
-		case MHD_OPTION_LISTENING_ADDRESS_REUSE:
-		case MHD_OPTION_LISTEN_BACKLOG_SIZE:
-		  if (MHD_YES != parse_options (daemon,
-						servaddr,
-						opt,
-						(unsigned int) oa[i].value,
-						MHD_OPTION_END))
-		    return MHD_NO;
-		  break;
-		  /* all options taking 'enum' */
-		case MHD_OPTION_HTTPS_CRED_TYPE:
-		  if (MHD_YES != parse_options (daemon,
-						servaddr,
-						opt,
-						(int) oa[i].value,
-						MHD_OPTION_END))
-		    return MHD_NO;
-		  break;
-                  /* all options taking 'MHD_socket' */
-                case MHD_OPTION_LISTEN_SOCKET:
-                  if (MHD_YES != parse_options (daemon,
-                                                servaddr,
-                                                opt,
-                                                (MHD_socket) oa[i].value,
-                                                MHD_OPTION_END))
-                    return MHD_NO;
-                  break;
-		  /* all options taking one pointer */
-		case MHD_OPTION_SOCK_ADDR:
-		case MHD_OPTION_HTTPS_MEM_KEY:
-		case MHD_OPTION_HTTPS_KEY_PASSWORD:
-		case MHD_OPTION_HTTPS_MEM_CERT:
-		case MHD_OPTION_HTTPS_MEM_TRUST:
-	        case MHD_OPTION_HTTPS_MEM_DHPARAMS:
-		case MHD_OPTION_HTTPS_PRIORITIES:
-		case MHD_OPTION_ARRAY:
-                case MHD_OPTION_HTTPS_CERT_CALLBACK:
-		  if (MHD_YES != parse_options (daemon,
-						servaddr,
-						opt,
-						oa[i].ptr_value,
-						MHD_OPTION_END))
-		    return MHD_NO;
-		  break;
-		  /* all options taking two pointers */
-		case MHD_OPTION_NOTIFY_COMPLETED:
-		case MHD_OPTION_NOTIFY_CONNECTION:
-		case MHD_OPTION_URI_LOG_CALLBACK:
-		case MHD_OPTION_EXTERNAL_LOGGER:
-		case MHD_OPTION_UNESCAPE_CALLBACK:
-		  if (MHD_YES != parse_options (daemon,
-						servaddr,
-						opt,
-						(void *) oa[i].value,
-						oa[i].ptr_value,
-						MHD_OPTION_END))
-		    return MHD_NO;
-		  break;
-		  /* options taking size_t-number followed by pointer */
-		case MHD_OPTION_DIGEST_AUTH_RANDOM:
-		  if (MHD_YES != parse_options (daemon,
-						servaddr,
-						opt,
-						(size_t) oa[i].value,
-						oa[i].ptr_value,
-						MHD_OPTION_END))
-		    return MHD_NO;
-		  break;
-		default:
-		  return MHD_NO;
-		}
-	      i++;
-	    }
-	  break;
-        case MHD_OPTION_UNESCAPE_CALLBACK:
-          daemon->unescape_callback =
-            va_arg (ap, UnescapeCallback);
-          daemon->unescape_callback_cls = va_arg (ap, void *);
-          break;
-        default:
-#ifdef HAVE_MESSAGES
-          if (((opt >= MHD_OPTION_HTTPS_MEM_KEY) &&
-              (opt <= MHD_OPTION_HTTPS_PRIORITIES)) || (opt == MHD_OPTION_HTTPS_MEM_TRUST))
-            {
-              MHD_DLOG (daemon,
-			"MHD HTTPS option %d passed to MHD compiled without HTTPS support\n",
-			opt);
-            }
-          else
-            {
-              MHD_DLOG (daemon,
-			"Invalid option %d! (Did you terminate the list with MHD_OPTION_END?)\n",
-			opt);
-            }
+#if KQUEUE_SUPPORT
+  if ( (-1 != d->kqueue_fd) &&
+       (0 != close (d->kqueue_fd)) )
+    MHD_PANIC ("close failed\n");
 #endif
-	  return MHD_NO;
-        }
+#if IO_URING_SUPPORT
+  if (MHD_USE_IO_URING_LINUX_ONLY == (daemon->options & MHD_USE_IO_URING_LINUX_ONLY))
+    close_io_uring (d);
+#endif
+ close_pipe:
+  if (MHD_INVALID_PIPE_ != d->wpipe[1])
+    {
+      if (0 != MHD_pipe_close_ (d->wpipe[0]))
+        MHD_PANIC ("close failed\n");
+      if (0 != MHD_pipe_close_ (d->wpipe[1]))
+        MHD_PANIC ("close failed\n");
     }
-  return MHD_YES;
+ close_socket:
+  if ( (MHD_INVALID_SOCKET != d->worker_socket_fd) &&
+       (0 != MHD_socket_close_ (d->worker_socket_fd)) )
+    MHD_PANIC ("close failed\n");
 }
 
 
 /**
- * Create a listen socket, if possible with SOCK_CLOEXEC flag set.
+ * Range of the workers of a thread pool to start.
+ */
+struct MHD_WorkerRange
+{
+  /**
+   * Master daemon.
+   */
+  struct MHD_Daemon *daemon;
+
+  /**
+   * Per-worker flags, see start_worker().
+   */
+  char *started;
+
+  /**
+   * Index of the first worker of the range.
+   */
+  unsigned int first;
+
+  /**
+   * Number of workers in the range.
+   */
+  unsigned int count;
+};
+
+
+static void
+start_workers (struct MHD_Daemon *daemon,
+               unsigned int first,
+               unsigned int count,
+               char *started);
+
+
+/**
+ * Thread starting a range of the workers of a thread pool.
  *
- * @param daemon daemon for which we create the socket
- * @param domain socket domain (i.e. PF_INET)
- * @param type socket type (usually SOCK_STREAM)
- * @param protocol desired protocol, 0 for default
+ * @param cls the `struct MHD_WorkerRange`
+ * @return always 0
  */
-static MHD_socket
-create_socket (struct MHD_Daemon *daemon,
-	       int domain, int type, int protocol)
+static MHD_THRD_RTRN_TYPE_ MHD_THRD_CALL_SPEC_
+start_workers_thread (void *cls)
 {
-  int ctype = type | SOCK_CLOEXEC;
-  MHD_socket fd;
+  struct MHD_WorkerRange *range = cls;
 
-  /* use SOCK_STREAM rather than ai_socktype: some getaddrinfo
-   * implementations do not set ai_socktype, e.g. RHL6.2. */
-  fd = socket (domain, ctype, protocol);
-  if ( (MHD_INVALID_SOCKET == fd) && (EINVAL == MHD_socket_errno_) && (0 != SOCK_CLOEXEC) )
-  {
-    ctype = type;
-    fd = socket(domain, type, protocol);
-  }
-  if (MHD_INVALID_SOCKET == fd)
-    return MHD_INVALID_SOCKET;
-  if (type == ctype)
-    make_nonblocking_noninheritable (daemon, fd);
-  return fd;
+  start_workers (range->daemon,
+                 range->first,
+                 range->count,
+                 range->started);
+  return (MHD_THRD_RTRN_TYPE_) 0;
 }
 
 
-#if EPOLL_SUPPORT
 /**
- * Setup epoll() FD for the daemon and initialize it to listen
- * on the listen FD.
+ * Start the workers [@a first, @a first + @a count) of the thread
+ * pool of @a daemon.  Setting up a worker and creating its thread
+ * costs a few dozen microseconds, so for large pools the upper half
+ * of the range is handed to a helper thread, which splits it again,
+ * and both halves are started concurrently.  Failures are recorded
+ * in @a started only; the caller cleans up.
  *
- * @param daemon daemon to initialize for epoll()
- * @return #MHD_YES on success, #MHD_NO on failure
+ * @param daemon master daemon
+ * @param first index of the first worker to start
+ * @param count number of workers to start
+ * @param started set to 1 for each worker that was started
  */
-static int
-setup_epoll_to_listen (struct MHD_Daemon *daemon)
+static void
+start_workers (struct MHD_Daemon *daemon,
+               unsigned int first,
+               unsigned int count,
+               char *started)
 {
-  struct epoll_event event;
+  struct MHD_WorkerRange upper;
+  MHD_thread_handle_ helper;
+  unsigned int i;
 
-#ifdef HAVE_EPOLL_CREATE1
-  daemon->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
-#else  /* !HAVE_EPOLL_CREATE1 */
-  daemon->epoll_fd = epoll_create (MAX_EVENTS);
-#endif /* !HAVE_EPOLL_CREATE1 */
-  if (-1 == daemon->epoll_fd)
-    {
-#ifdef HAVE_MESSAGES
-      MHD_DLOG (daemon,
-                "Call to epoll_create1 failed: %s\n",
-                MHD_socket_last_strerr_ ());
-#endif
-      return MHD_NO;
-    }
-#ifndef HAVE_EPOLL_CREATE1
-  else
-    {
-      int fdflags = fcntl (daemon->epoll_fd, F_GETFD);
-      if (0 > fdflags || 0 > fcntl (daemon->epoll_fd, F_SETFD, fdflags | FD_CLOEXEC))
-        {
-#ifdef HAVE_MESSAGES
-          MHD_DLOG (daemon,
-                    "Failed to change flags on epoll fd: %s\n",
-                    MHD_socket_last_strerr_ ());
-#endif /* HAVE_MESSAGES */
-        }
-    }
-#endif /* !HAVE_EPOLL_CREATE1 */
-  if (0 == EPOLL_CLOEXEC)
-    make_nonblocking_noninheritable (daemon,
-				     daemon->epoll_fd);
-  if (MHD_INVALID_SOCKET == daemon->socket_fd)
-    return MHD_YES; /* non-listening daemon */
-  event.events = EPOLLIN;
-  event.data.ptr = daemon;
-  if (0 != epoll_ctl (daemon->epoll_fd,
-		      EPOLL_CTL_ADD,
-		      daemon->socket_fd,
-		      &event))
+  if (count <= MHD_WORKER_START_BATCH)
     {
-#ifdef HAVE_MESSAGES
-      MHD_DLOG (daemon,
-                "Call to epoll_ctl failed: %s\n",
-                MHD_socket_last_strerr_ ());
-#endif
-      return MHD_NO;
+      for (i = first; i < first + count; i++)
+        start_worker (daemon, i, started);
+      return;
     }
-  if ( (MHD_INVALID_PIPE_ != daemon->wpipe[0]) &&
-       (MHD_USE_SUSPEND_RESUME == (daemon->options & MHD_USE_SUSPEND_RESUME)) )
+  upper.daemon = daemon;
+  upper.started = started;
+  upper.first = first + count / 2;
+  upper.count = count - count / 2;
+  if (0 != create_thread (&helper, daemon, &start_workers_thread, &upper))
     {
-      event.events = EPOLLIN | EPOLLET;
-      event.data.ptr = NULL;
-      event.data.fd = daemon->wpipe[0];
-      if (0 != epoll_ctl (daemon->epoll_fd,
-                          EPOLL_CTL_ADD,
-                          daemon->wpipe[0],
-                          &event))
-        {
-#ifdef HAVE_MESSAGES
-          MHD_DLOG (daemon,
-                    "Call to epoll_ctl failed: %s\n",
-                    MHD_socket_last_strerr_ ());
-#endif
-          return MHD_NO;
-        }
+      /* start them ourselves */
+      for (i = first; i < first + count; i++)
+        start_worker (daemon, i, started);
+      return;
     }
-  daemon->listen_socket_in_epoll = MHD_YES;
-  return MHD_YES;
+  start_workers (daemon, first, count / 2, started);
+  if (0 != MHD_join_thread_ (helper))
+    MHD_PANIC ("Failed to join a thread\n");
 }
-#endif
 
 
 /**
@@ -3702,21 +11570,27 @@ MHD_start_daemon_va (unsigned int flags,
   if (NULL == (daemon = malloc (sizeof (struct MHD_Daemon))))
     return NULL;
   memset (daemon, 0, sizeof (struct MHD_Daemon));
+  daemon->stats = &daemon->stats_storage;
 #if EPOLL_SUPPORT
   daemon->epoll_fd = -1;
+  daemon->epoll_max_events = MHD_EPOLL_MAX_EVENTS_DEFAULT;
 #endif
-  /* try to open listen socket */
-#if HTTPS_SUPPORT
-  if (0 != (flags & MHD_USE_SSL))
-    {
-      gnutls_priority_init (&daemon->priority_cache,
-			    "NORMAL",
-			    NULL);
-    }
+#if KQUEUE_SUPPORT
+  daemon->kqueue_fd = -1;
+#endif
+#if IO_URING_SUPPORT
+  daemon->uring.fd = -1;
 #endif
+  /* try to open listen socket */
   daemon->socket_fd = MHD_INVALID_SOCKET;
+  daemon->worker_socket_fd = MHD_INVALID_SOCKET;
   daemon->listening_address_reuse = 0;
+  daemon->listen_unix = MHD_NO;
   daemon->options = flags;
+  daemon->loop_time = MHD_monotonic_msec_counter ();
+  daemon->timer_wheel_time = daemon->loop_time / MHD_TIMER_WHEEL_TICK;
+  daemon->guard_wheel_time = daemon->timer_wheel_time;
+  MHD_siphash_key_ (daemon->header_index_key);
 #if defined(MHD_WINSOCK_SOCKETS) || defined(CYGWIN)
   /* Winsock is broken with respect to 'shutdown';
      this disables us calling 'shutdown' on W32. */
@@ -3729,10 +11603,21 @@ MHD_start_daemon_va (unsigned int flags,
   daemon->default_handler_cls = dh_cls;
   daemon->connections = 0;
   daemon->connection_limit = MHD_MAX_CONNECTIONS_DEFAULT;
+  daemon->fd_sets_max = MHD_INVALID_SOCKET;
   daemon->pool_size = MHD_POOL_SIZE_DEFAULT;
+  daemon->pool_cache_max = MHD_POOL_CACHE_SIZE_DEFAULT;
   daemon->pool_increment = MHD_BUF_INC_SIZE;
-  daemon->unescape_callback = &unescape_wrapper;
+  daemon->alloc_reserve = SIZE_MAX; /* set from pool_size below */
+  daemon->unescape_callback = &MHD_default_unescape_;
   daemon->connection_timeout = 0;       /* no timeout */
+  daemon->thread_cache_timeout = MHD_THREAD_CACHE_TIMEOUT_DEFAULT;
+  daemon->overload_retry_after = 1;
+  daemon->loop_stats_interval = 1000;
+  daemon->access_log_fd = -1;
+  daemon->access_log_size = 256;
+  daemon->access_log_interval = 1000;
+  daemon->http2_max_streams = MHD_HTTP2_MAX_STREAMS_DEFAULT;
+  daemon->worker_cpu = -1;
   daemon->wpipe[0] = MHD_INVALID_PIPE_;
   daemon->wpipe[1] = MHD_INVALID_PIPE_;
 #ifdef SOMAXCONN
@@ -3751,7 +11636,7 @@ MHD_start_daemon_va (unsigned int flags,
 #endif
   if (0 == (flags & (MHD_USE_SELECT_INTERNALLY | MHD_USE_THREAD_PER_CONNECTION)))
     use_pipe = 0; /* useless if we are using 'external' select */
-  if ( (use_pipe) && (0 != MHD_pipe_ (daemon->wpipe)) )
+  if ( (use_pipe) && (0 != MHD_itc_create_ (daemon->wpipe)) )
     {
 #ifdef HAVE_MESSAGES
       MHD_DLOG (daemon,
@@ -3762,7 +11647,7 @@ MHD_start_daemon_va (unsigned int flags,
       return NULL;
     }
 #ifndef MHD_WINSOCK_SOCKETS
-  if ( (0 == (flags & (MHD_USE_POLL | MHD_USE_EPOLL_LINUX_ONLY))) &&
+  if ( (0 == (flags & (MHD_USE_POLL | MHD_USE_EPOLL_LINUX_ONLY | MHD_USE_KQUEUE | MHD_USE_LARGE_FD_SETS))) &&
        (1 == use_pipe) &&
        (daemon->wpipe[0] >= FD_SETSIZE) )
     {
@@ -3786,7 +11671,7 @@ MHD_start_daemon_va (unsigned int flags,
 #if HTTPS_SUPPORT
   if (0 != (flags & MHD_USE_SSL))
     {
-      daemon->cred_type = GNUTLS_CRD_CERTIFICATE;
+      daemon->cred_type = MHD_TLS_CRD_CERTIFICATE;
     }
 #endif
 
@@ -3794,63 +11679,83 @@ MHD_start_daemon_va (unsigned int flags,
   if (MHD_YES != parse_options_va (daemon, &servaddr, ap))
     {
 #if HTTPS_SUPPORT
-      if ( (0 != (flags & MHD_USE_SSL)) &&
-	   (NULL != daemon->priority_cache) )
-	gnutls_priority_deinit (daemon->priority_cache);
+      MHD_tls_daemon_deinit_ (daemon);
 #endif
       free (daemon);
       return NULL;
     }
-#ifdef DAUTH_SUPPORT
-  if (daemon->nonce_nc_size > 0)
+#if PREFORK_SUPPORT
+  if ( (0 != daemon->prefork_workers) &&
+       (MHD_YES != MHD_prefork_init_ (daemon)) )
+#else
+  if (0 != daemon->prefork_workers)
+#endif
     {
-      if ( ( (size_t) (daemon->nonce_nc_size * sizeof (struct MHD_NonceNc))) /
-	   sizeof(struct MHD_NonceNc) != daemon->nonce_nc_size)
-	{
-#ifdef HAVE_MESSAGES
-	  MHD_DLOG (daemon,
-		    "Specified value for NC_SIZE too large\n");
+#if defined(HAVE_MESSAGES) && ! PREFORK_SUPPORT
+      MHD_DLOG (daemon,
+                "MHD_OPTION_PREFORK_WORKERS is not supported on this platform\n");
 #endif
 #if HTTPS_SUPPORT
-	  if (0 != (flags & MHD_USE_SSL))
-	    gnutls_priority_deinit (daemon->priority_cache);
-#endif
-	  free (daemon);
-	  return NULL;
-	}
-      daemon->nnc = malloc (daemon->nonce_nc_size * sizeof (struct MHD_NonceNc));
-      if (NULL == daemon->nnc)
-	{
-#ifdef HAVE_MESSAGES
-	  MHD_DLOG (daemon,
-		    "Failed to allocate memory for nonce-nc map: %s\n",
-		    MHD_strerror_ (errno));
+      MHD_tls_daemon_deinit_ (daemon);
 #endif
+      free (daemon);
+      return NULL;
+    }
+#ifdef DAUTH_SUPPORT
+  if (MHD_YES != MHD_nonce_nc_init (daemon))
+    {
 #if HTTPS_SUPPORT
-	  if (0 != (flags & MHD_USE_SSL))
-	    gnutls_priority_deinit (daemon->priority_cache);
+      MHD_tls_daemon_deinit_ (daemon);
 #endif
-	  free (daemon);
-	  return NULL;
-	}
+      MHD_prefork_destroy_ (daemon);
+      free (daemon);
+      return NULL;
     }
-
-  if (MHD_YES != MHD_mutex_create_ (&daemon->nnc_lock))
+#endif
+#ifdef BAUTH_SUPPORT
+  if (MHD_YES != MHD_basic_auth_cache_init_ (daemon))
     {
 #ifdef HAVE_MESSAGES
       MHD_DLOG (daemon,
-		"MHD failed to initialize nonce-nc mutex\n");
+                "Failed to allocate Basic authentication cache: %s\n",
+                MHD_strerror_ (errno));
+#endif
+#ifdef DAUTH_SUPPORT
+      MHD_nonce_nc_destroy (daemon);
 #endif
 #if HTTPS_SUPPORT
-      if (0 != (flags & MHD_USE_SSL))
-	gnutls_priority_deinit (daemon->priority_cache);
+      MHD_tls_daemon_deinit_ (daemon);
 #endif
-      free (daemon->nnc);
+      MHD_prefork_destroy_ (daemon);
       free (daemon);
       return NULL;
     }
 #endif
 
+  /* worker processes start their own */
+  if ( (NULL == daemon->prefork) &&
+       (MHD_YES != start_log_thread (daemon)) )
+    goto free_and_fail;
+
+  if (MHD_YES != MHD_connection_create_error_responses_ (daemon))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+		"Failed to allocate memory for error responses\n");
+#endif
+      goto free_and_fail;
+    }
+  if ( (0 != daemon->response_cache_size) &&
+       (NULL == (daemon->response_cache
+                 = MHD_cache_create_ (daemon->response_cache_size))) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+		"Failed to create the response cache\n");
+#endif
+      goto free_and_fail;
+    }
+
   /* Thread pooling currently works only with internal select thread model */
   if ( (0 == (flags & MHD_USE_SELECT_INTERNALLY)) &&
        (daemon->worker_pool_size > 0) )
@@ -3859,17 +11764,191 @@ MHD_start_daemon_va (unsigned int flags,
       MHD_DLOG (daemon,
 		"MHD thread pooling only works with MHD_USE_SELECT_INTERNALLY\n");
 #endif
-      goto free_and_fail;
+      goto free_and_fail;
+    }
+
+  if ( (MHD_USE_SUSPEND_RESUME == (flags & MHD_USE_SUSPEND_RESUME)) &&
+       (0 != (flags & MHD_USE_THREAD_PER_CONNECTION)) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Combining MHD_USE_THREAD_PER_CONNECTION and MHD_USE_SUSPEND_RESUME is not supported.\n");
+#endif
+      goto free_and_fail;
+    }
+
+  if (SIZE_MAX == daemon->alloc_reserve)
+    daemon->alloc_reserve = daemon->pool_size / 4;
+
+  if ( (0 != daemon->memory_budget) &&
+       (daemon->memory_budget < daemon->pool_size) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Memory budget is smaller than the memory limit of a connection\n");
+#endif
+      goto free_and_fail;
+    }
+
+  if ( (MHD_access_log_enabled_ (daemon)) &&
+       (0 != (flags & MHD_USE_THREAD_PER_CONNECTION)) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "The access log is not supported with MHD_USE_THREAD_PER_CONNECTION\n");
+#endif
+      goto free_and_fail;
+    }
+
+  if ( (NULL != daemon->notify_socket) &&
+       (0 != (flags & (MHD_USE_SELECT_INTERNALLY | MHD_USE_THREAD_PER_CONNECTION |
+                       MHD_USE_EPOLL_LINUX_ONLY | MHD_USE_KQUEUE))) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "MHD_OPTION_NOTIFY_SOCKET requires an external event loop without epoll or kqueue\n");
+#endif
+      goto free_and_fail;
+    }
+
+  if ( ( (0 != daemon->send_bucket.rate) ||
+         (0 != daemon->recv_bucket.rate) ) &&
+       (0 != (flags & MHD_USE_THREAD_PER_CONNECTION)) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Daemon rate limits are not supported with MHD_USE_THREAD_PER_CONNECTION\n");
+#endif
+      goto free_and_fail;
+    }
+
+  /* there is no event loop to watch, and the handler latency would
+     be updated by all connection threads */
+  if ( (0 != daemon->overload_latency) &&
+       (0 != (flags & MHD_USE_THREAD_PER_CONNECTION)) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "MHD_OPTION_OVERLOAD_LATENCY is not supported with MHD_USE_THREAD_PER_CONNECTION\n");
+#endif
+      goto free_and_fail;
+    }
+
+  /* connection threads release their pools concurrently */
+  if (0 != (flags & MHD_USE_THREAD_PER_CONNECTION))
+    {
+      daemon->pool_cache_max = 0;
+      daemon->idle_release_timeout = 0;
+    }
+
+  if (0 == daemon->accept_batch_size)
+    daemon->accept_batch_size =
+      (0 != (flags & (MHD_USE_EPOLL_LINUX_ONLY | MHD_USE_KQUEUE)))
+      ? MHD_ACCEPT_BATCH_SIZE_EPOLL_DEFAULT
+      : 1;
+
+#ifdef MHD_WINSOCK_SOCKETS
+  /* a WinSock fd_set is a list of up to FD_SETSIZE sockets rather than
+     a bitmap indexed by the descriptor, and every worker of the pool
+     has its own; so without an explicit limit each worker may take
+     as many connections as a single-threaded daemon */
+  if ( (MHD_MAX_CONNECTIONS_DEFAULT == daemon->connection_limit) &&
+       (daemon->worker_pool_size > 1) &&
+       (0 == (flags & MHD_USE_THREAD_PER_CONNECTION)) )
+    daemon->connection_limit = MHD_MAX_CONNECTIONS_DEFAULT * daemon->worker_pool_size;
+#endif
+#if defined(MHD_POSIX_SOCKETS) && defined(_SC_OPEN_MAX)
+  /* with large fd sets, it is the limit on open files that counts */
+  if ( (MHD_MAX_CONNECTIONS_DEFAULT == daemon->connection_limit) &&
+       (0 != (flags & MHD_USE_LARGE_FD_SETS)) )
+    {
+      long open_max = sysconf (_SC_OPEN_MAX);
+
+      if (open_max > (long) UINT_MAX)
+        open_max = (long) UINT_MAX;
+      if (open_max - 4 > (long) MHD_MAX_CONNECTIONS_DEFAULT)
+        daemon->connection_limit = (unsigned int) (open_max - 4);
+    }
+#endif
+
+  if ( (NULL != servaddr) &&
+       (AF_INET != servaddr->sa_family) &&
+       (AF_INET6 != servaddr->sa_family) )
+    {
+#if MHD_UNIX_SOCKETS
+      if (AF_UNIX == servaddr->sa_family)
+        daemon->listen_unix = MHD_YES;
+      else
+#endif
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Unsupported address family %d for the listen socket\n",
+                    (int) servaddr->sa_family);
+#endif
+          goto free_and_fail;
+        }
+    }
+  if ( (0 != (flags & MHD_USE_THREAD_POOL_REUSEPORT)) &&
+       (MHD_YES == daemon->listen_unix) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "MHD_USE_THREAD_POOL_REUSEPORT cannot be used with AF_UNIX sockets\n");
+#endif
+      goto free_and_fail;
+    }
+  if (0 != (flags & MHD_USE_THREAD_POOL_REUSEPORT))
+    {
+#ifndef SO_REUSEPORT
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "MHD_USE_THREAD_POOL_REUSEPORT requires SO_REUSEPORT, which is not supported on this platform\n");
+#endif
+      goto free_and_fail;
+#else
+      /* the listen socket must join the SO_REUSEPORT group */
+      if (daemon->listening_address_reuse < 0)
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "MHD_USE_THREAD_POOL_REUSEPORT cannot be combined with disallowing listening address reuse\n");
+#endif
+          goto free_and_fail;
+        }
+      daemon->listening_address_reuse = 1;
+#endif
     }
-
-  if ( (MHD_USE_SUSPEND_RESUME == (flags & MHD_USE_SUSPEND_RESUME)) &&
-       (0 != (flags & MHD_USE_THREAD_PER_CONNECTION)) )
+  if (NULL != daemon->prefork)
     {
+      if (0 == (flags & (MHD_USE_SELECT_INTERNALLY | MHD_USE_THREAD_PER_CONNECTION)))
+        {
 #ifdef HAVE_MESSAGES
-      MHD_DLOG (daemon,
-                "Combining MHD_USE_THREAD_PER_CONNECTION and MHD_USE_SUSPEND_RESUME is not supported.\n");
+          MHD_DLOG (daemon,
+                    "MHD_OPTION_PREFORK_WORKERS requires MHD_USE_SELECT_INTERNALLY or MHD_USE_THREAD_PER_CONNECTION\n");
 #endif
-      goto free_and_fail;
+          goto free_and_fail;
+        }
+      /* the workers need SO_REUSEPORT sockets of their own */
+      if ( (MHD_YES == daemon->listen_unix) ||
+           (MHD_INVALID_SOCKET != daemon->socket_fd) ||
+           (0 != (flags & MHD_USE_NO_LISTEN_SOCKET)) )
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "MHD_OPTION_PREFORK_WORKERS requires a TCP listen socket created by MHD\n");
+#endif
+          goto free_and_fail;
+        }
+      if (daemon->listening_address_reuse < 0)
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "MHD_OPTION_PREFORK_WORKERS cannot be combined with disallowing listening address reuse\n");
+#endif
+          goto free_and_fail;
+        }
+      daemon->listening_address_reuse = 1;
     }
 
 #ifdef __SYMBIAN32__
@@ -3886,6 +11965,12 @@ MHD_start_daemon_va (unsigned int flags,
        (0 == (daemon->options & MHD_USE_NO_LISTEN_SOCKET)) )
     {
       /* try to open listen socket */
+#if MHD_UNIX_SOCKETS
+      if (MHD_YES == daemon->listen_unix)
+	socket_fd = create_socket (daemon,
+				   PF_UNIX, SOCK_STREAM, 0);
+      else
+#endif
       if (0 != (flags & MHD_USE_IPv6))
 	socket_fd = create_socket (daemon,
 				   PF_INET6, SOCK_STREAM, 0);
@@ -3903,7 +11988,13 @@ MHD_start_daemon_va (unsigned int flags,
 	}
 
       /* Apply the socket options according to listening_address_reuse. */
-      if (0 == daemon->listening_address_reuse)
+      if (MHD_YES == daemon->listen_unix)
+        {
+          /* AF_UNIX sockets have no address reuse; binding fails if
+             the path exists, stale paths must be removed by the
+             application */
+        }
+      else if (0 == daemon->listening_address_reuse)
         {
           /* No user requirement, use "traditional" default SO_REUSEADDR,
            and do not fail if it doesn't work */
@@ -3941,15 +12032,23 @@ MHD_start_daemon_va (unsigned int flags,
               goto free_and_fail;
             }
 #else
-#ifndef SO_REUSEPORT
-#ifdef LINUX
-/* Supported since Linux 3.9, but often not present (or commented out)
-   in the headers at this time; but 15 is reserved for this and
-   thus should be safe to use. */
-#define SO_REUSEPORT 15
-#endif
-#endif
 #ifdef SO_REUSEPORT
+          /* With per-worker listen sockets, also allow binding while
+             connections of a previous instance are in TIME_WAIT, as
+             would happen without MHD_USE_THREAD_POOL_REUSEPORT. */
+          if ( ( (0 != (flags & MHD_USE_THREAD_POOL_REUSEPORT)) ||
+                 (NULL != daemon->prefork) ) &&
+               (0 > setsockopt (socket_fd,
+                                SOL_SOCKET,
+                                SO_REUSEADDR,
+                                (void*)&on, sizeof (on))) )
+            {
+#ifdef HAVE_MESSAGES
+              MHD_DLOG (daemon,
+                        "setsockopt failed: %s\n",
+                        MHD_socket_last_strerr_ ());
+#endif
+            }
           if (0 > setsockopt (socket_fd,
                               SOL_SOCKET,
                               SO_REUSEPORT,
@@ -4004,6 +12103,11 @@ MHD_start_daemon_va (unsigned int flags,
         }
 
       /* check for user supplied sockaddr */
+#if MHD_UNIX_SOCKETS
+      if (MHD_YES == daemon->listen_unix)
+        addrlen = sizeof (struct sockaddr_un);
+      else
+#endif
 #if HAVE_INET6
       if (0 != (flags & MHD_USE_IPv6))
 	addrlen = sizeof (struct sockaddr_in6);
@@ -4037,7 +12141,8 @@ MHD_start_daemon_va (unsigned int flags,
 	}
       daemon->socket_fd = socket_fd;
 
-      if (0 != (flags & MHD_USE_IPv6))
+      if ( (0 != (flags & MHD_USE_IPv6)) &&
+           (MHD_NO == daemon->listen_unix) )
 	{
 #ifdef IPPROTO_IPV6
 #ifdef IPV6_V6ONLY
@@ -4063,6 +12168,15 @@ MHD_start_daemon_va (unsigned int flags,
       if (-1 == bind (socket_fd, servaddr, addrlen))
 	{
 #ifdef HAVE_MESSAGES
+#if MHD_UNIX_SOCKETS
+          if (MHD_YES == daemon->listen_unix)
+            MHD_DLOG (daemon,
+                      "Failed to bind to `%.*s': %s\n",
+                      (int) sizeof (((const struct sockaddr_un *) servaddr)->sun_path),
+                      ((const struct sockaddr_un *) servaddr)->sun_path,
+                      MHD_socket_last_strerr_ ());
+          else
+#endif
           MHD_DLOG (daemon,
                     "Failed to bind to port %u: %s\n",
                     (unsigned int) port,
@@ -4073,7 +12187,8 @@ MHD_start_daemon_va (unsigned int flags,
 	  goto free_and_fail;
 	}
 #ifdef TCP_FASTOPEN
-      if (0 != (flags & MHD_USE_TCP_FASTOPEN))
+      if ( (0 != (flags & MHD_USE_TCP_FASTOPEN)) &&
+           (MHD_NO == daemon->listen_unix) )
       {
         if (0 == daemon->fastopen_queue_size)
           daemon->fastopen_queue_size = MHD_TCP_FASTOPEN_QUEUE_SIZE_DEFAULT;
@@ -4090,8 +12205,8 @@ MHD_start_daemon_va (unsigned int flags,
         }
       }
 #endif
-#if EPOLL_SUPPORT
-      if (0 != (flags & MHD_USE_EPOLL_LINUX_ONLY))
+#if MHD_EREADY_SUPPORT
+      if (0 != (flags & (MHD_USE_EPOLL_LINUX_ONLY | MHD_USE_KQUEUE)))
 	{
 	  int sk_flags = fcntl (socket_fd, F_GETFL);
 	  if (0 != fcntl (socket_fd, F_SETFL, sk_flags | O_NONBLOCK))
@@ -4118,14 +12233,30 @@ MHD_start_daemon_va (unsigned int flags,
 	    MHD_PANIC ("close failed\n");
 	  goto free_and_fail;
 	}
+      if (MHD_NO == daemon->listen_unix)
+        set_defer_accept (daemon, socket_fd);
     }
   else
     {
       socket_fd = daemon->socket_fd;
+#if MHD_UNIX_SOCKETS
+      if (MHD_INVALID_SOCKET != socket_fd)
+        {
+          struct sockaddr_storage listen_addr;
+          socklen_t listen_addr_len = sizeof (listen_addr);
+
+          /* an AF_UNIX socket given with MHD_OPTION_LISTEN_SOCKET */
+          if ( (0 == getsockname (socket_fd,
+                                  (struct sockaddr *) &listen_addr,
+                                  &listen_addr_len)) &&
+               (AF_UNIX == ((struct sockaddr *) &listen_addr)->sa_family) )
+            daemon->listen_unix = MHD_YES;
+        }
+#endif
     }
 #ifndef MHD_WINSOCK_SOCKETS
   if ( (socket_fd >= FD_SETSIZE) &&
-       (0 == (flags & (MHD_USE_POLL | MHD_USE_EPOLL_LINUX_ONLY)) ) )
+       (0 == (flags & (MHD_USE_POLL | MHD_USE_EPOLL_LINUX_ONLY | MHD_USE_KQUEUE | MHD_USE_LARGE_FD_SETS)) ) )
     {
 #ifdef HAVE_MESSAGES
       MHD_DLOG (daemon,
@@ -4139,6 +12270,33 @@ MHD_start_daemon_va (unsigned int flags,
     }
 #endif
 
+  /* accepting more than one connection per readiness notification
+     requires accept() to fail once the backlog is drained */
+  if ( (MHD_INVALID_SOCKET != socket_fd) &&
+       (daemon->accept_batch_size > 1) )
+    {
+#if !defined(MHD_WINSOCK_SOCKETS)
+      int sk_flags = fcntl (socket_fd, F_GETFL);
+
+      if ( (sk_flags < 0) ||
+           (0 != fcntl (socket_fd, F_SETFL, sk_flags | O_NONBLOCK)) )
+#else
+      unsigned long sk_flags = 1;
+
+      if (SOCKET_ERROR == ioctlsocket (socket_fd, FIONBIO, &sk_flags))
+#endif /* MHD_WINSOCK_SOCKETS */
+	{
+#ifdef HAVE_MESSAGES
+	  MHD_DLOG (daemon,
+		    "Failed to make listen socket non-blocking: %s\n",
+		    MHD_socket_last_strerr_ ());
+#endif
+	  if (0 != MHD_socket_close_ (socket_fd))
+	    MHD_PANIC ("close failed\n");
+	  goto free_and_fail;
+	}
+    }
+
 #if EPOLL_SUPPORT
   if ( (0 != (flags & MHD_USE_EPOLL_LINUX_ONLY)) &&
        (0 == daemon->worker_pool_size) &&
@@ -4152,8 +12310,6 @@ MHD_start_daemon_va (unsigned int flags,
 #endif
 	  goto free_and_fail;
 	}
-      if (MHD_YES != setup_epoll_to_listen (daemon))
-	goto free_and_fail;
     }
 #else
   if (0 != (flags & MHD_USE_EPOLL_LINUX_ONLY))
@@ -4165,12 +12321,81 @@ MHD_start_daemon_va (unsigned int flags,
       goto free_and_fail;
     }
 #endif
+#if IO_URING_SUPPORT
+  if ( (MHD_USE_IO_URING_LINUX_ONLY == (flags & MHD_USE_IO_URING_LINUX_ONLY)) &&
+       (0 == (flags & MHD_USE_SELECT_INTERNALLY)) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+		"MHD_USE_IO_URING_LINUX_ONLY requires MHD_USE_SELECT_INTERNALLY.\n");
+#endif
+      goto free_and_fail;
+    }
+#else
+  if (MHD_USE_IO_URING_LINUX_ONLY == (flags & MHD_USE_IO_URING_LINUX_ONLY))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+		"io_uring is not supported on this platform by this build.\n");
+#endif
+      goto free_and_fail;
+    }
+#endif
+#if KQUEUE_SUPPORT
+  if (0 != (flags & MHD_USE_KQUEUE))
+    {
+      if (0 != (flags & (MHD_USE_THREAD_PER_CONNECTION | MHD_USE_POLL | MHD_USE_EPOLL_LINUX_ONLY)))
+	{
+#ifdef HAVE_MESSAGES
+	  MHD_DLOG (daemon,
+		    "MHD_USE_KQUEUE cannot be combined with MHD_USE_THREAD_PER_CONNECTION, MHD_USE_POLL or MHD_USE_EPOLL_LINUX_ONLY.\n");
+#endif
+	  goto free_and_fail;
+	}
+    }
+#else
+  if (0 != (flags & MHD_USE_KQUEUE))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+		"kqueue is not supported on this platform by this build.\n");
+#endif
+      goto free_and_fail;
+    }
+#endif
+  if (0 != (flags & MHD_USE_LARGE_FD_SETS))
+    {
+#ifdef MHD_POSIX_SOCKETS
+      /* the fd sets are arrays of fd_set, which must be plain bitmaps */
+      if (8 * sizeof (fd_set) != FD_SETSIZE)
+#endif
+	{
+#ifdef HAVE_MESSAGES
+	  MHD_DLOG (daemon,
+		    "MHD_USE_LARGE_FD_SETS is not supported on this platform.\n");
+#endif
+	  goto free_and_fail;
+	}
+      if (0 != (flags & (MHD_USE_THREAD_PER_CONNECTION | MHD_USE_POLL |
+                         MHD_USE_EPOLL_LINUX_ONLY | MHD_USE_KQUEUE)))
+	{
+#ifdef HAVE_MESSAGES
+	  MHD_DLOG (daemon,
+		    "MHD_USE_LARGE_FD_SETS cannot be combined with MHD_USE_THREAD_PER_CONNECTION, MHD_USE_POLL, MHD_USE_EPOLL_LINUX_ONLY or MHD_USE_KQUEUE.\n");
+#endif
+	  goto free_and_fail;
+	}
+    }
+  /* worker processes create their own */
+  if ( (NULL == daemon->prefork) &&
+       (MHD_YES != setup_event_loop (daemon)) )
+    goto free_and_fail;
 
-  if (MHD_YES != MHD_mutex_create_ (&daemon->per_ip_connection_mutex))
+  if (MHD_YES != MHD_ip_count_init (daemon))
     {
 #ifdef HAVE_MESSAGES
       MHD_DLOG (daemon,
-               "MHD failed to initialize IP connection limit mutex\n");
+               "MHD failed to initialize IP connection limit table\n");
 #endif
       if ( (MHD_INVALID_SOCKET != socket_fd) &&
 	   (0 != MHD_socket_close_ (socket_fd)) )
@@ -4192,7 +12417,8 @@ MHD_start_daemon_va (unsigned int flags,
 
 #if HTTPS_SUPPORT
   /* initialize HTTPS daemon certificate aspects & send / recv functions */
-  if ((0 != (flags & MHD_USE_SSL)) && (0 != MHD_TLS_init (daemon)))
+  if ( (0 != (flags & MHD_USE_SSL)) &&
+       (MHD_YES != MHD_tls_daemon_init_ (daemon)) )
     {
 #ifdef HAVE_MESSAGES
       MHD_DLOG (daemon,
@@ -4202,10 +12428,95 @@ MHD_start_daemon_va (unsigned int flags,
 	   (0 != MHD_socket_close_ (socket_fd)) )
 	MHD_PANIC ("close failed\n");
       (void) MHD_mutex_destroy_ (&daemon->cleanup_connection_mutex);
-      (void) MHD_mutex_destroy_ (&daemon->per_ip_connection_mutex);
+      MHD_ip_count_destroy (daemon);
+      goto free_and_fail;
+    }
+#endif
+#if PREFORK_SUPPORT
+  if (NULL != daemon->prefork)
+    {
+      if (MHD_YES != MHD_prefork_start_ (daemon))
+        {
+          if (0 != MHD_socket_close_ (socket_fd))
+            MHD_PANIC ("close failed\n");
+          (void) MHD_mutex_destroy_ (&daemon->cleanup_connection_mutex);
+          MHD_ip_count_destroy (daemon);
+          goto free_and_fail;
+        }
+      if (MHD_YES == MHD_prefork_is_master_ (daemon))
+        {
+          /* the first worker accepts on the inherited listen socket,
+             the master serves no connections */
+          if (0 != MHD_socket_close_ (socket_fd))
+            MHD_PANIC ("close failed\n");
+          daemon->socket_fd = MHD_INVALID_SOCKET;
+          goto started;
+        }
+      if (MHD_YES != setup_prefork_worker (daemon))
+        goto free_and_fail;
+      socket_fd = daemon->socket_fd;
+    }
+#endif
+#if HTTPS_SUPPORT
+  if ( (0 != daemon->handshake_thread_count) &&
+       (MHD_YES != start_handshake_threads (daemon)) )
+    {
+      if ( (MHD_INVALID_SOCKET != socket_fd) &&
+	   (0 != MHD_socket_close_ (socket_fd)) )
+	MHD_PANIC ("close failed\n");
+      (void) MHD_mutex_destroy_ (&daemon->cleanup_connection_mutex);
+      MHD_ip_count_destroy (daemon);
+      goto free_and_fail;
+    }
+#endif
+  if ( (0 != daemon->handler_thread_count) &&
+       (MHD_YES != start_handler_threads (daemon)) )
+    {
+      if ( (MHD_INVALID_SOCKET != socket_fd) &&
+	   (0 != MHD_socket_close_ (socket_fd)) )
+	MHD_PANIC ("close failed\n");
+      (void) MHD_mutex_destroy_ (&daemon->cleanup_connection_mutex);
+      MHD_ip_count_destroy (daemon);
+      goto free_and_fail;
+    }
+  if ( ( (0 != daemon->thread_cache_size) ||
+         (0 != daemon->park_idle_delay) ) &&
+       (MHD_YES != start_thread_cache (daemon)) )
+    {
+      if ( (MHD_INVALID_SOCKET != socket_fd) &&
+	   (0 != MHD_socket_close_ (socket_fd)) )
+	MHD_PANIC ("close failed\n");
+      (void) MHD_mutex_destroy_ (&daemon->cleanup_connection_mutex);
+      MHD_ip_count_destroy (daemon);
       goto free_and_fail;
     }
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+  if ( (MHD_YES == daemon->pin_workers) &&
+       ( (0 == (flags & MHD_USE_SELECT_INTERNALLY)) ||
+         (0 != (flags & MHD_USE_THREAD_PER_CONNECTION)) ) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Pinning threads to CPUs requires an internal select thread or a thread pool\n");
+#endif
+#else
+  if (MHD_YES == daemon->pin_workers)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Pinning threads to CPUs is not supported on this platform\n");
 #endif
+#endif
+      if ( (MHD_INVALID_SOCKET != socket_fd) &&
+	   (0 != MHD_socket_close_ (socket_fd)) )
+	MHD_PANIC ("close failed\n");
+      (void) MHD_mutex_destroy_ (&daemon->cleanup_connection_mutex);
+      MHD_ip_count_destroy (daemon);
+      goto free_and_fail;
+    }
+  if ( (MHD_YES == daemon->pin_workers) &&
+       (0 == daemon->worker_pool_size) )
+    daemon->worker_cpu = get_worker_cpu (daemon, 0);
   if ( ( (0 != (flags & MHD_USE_THREAD_PER_CONNECTION)) ||
 	 ( (0 != (flags & MHD_USE_SELECT_INTERNALLY)) &&
 	   (0 == daemon->worker_pool_size)) ) &&
@@ -4219,7 +12530,7 @@ MHD_start_daemon_va (unsigned int flags,
 		MHD_strerror_ (res_thread_create));
 #endif
       (void) MHD_mutex_destroy_ (&daemon->cleanup_connection_mutex);
-      (void) MHD_mutex_destroy_ (&daemon->per_ip_connection_mutex);
+      MHD_ip_count_destroy (daemon);
       if ( (MHD_INVALID_SOCKET != socket_fd) &&
 	   (0 != MHD_socket_close_ (socket_fd)) )
 	MHD_PANIC ("close failed\n");
@@ -4234,15 +12545,7 @@ MHD_start_daemon_va (unsigned int flags,
       unsigned long sk_flags;
 #endif
 
-      /* Coarse-grained count of connections per thread (note error
-       * due to integer division). Also keep track of how many
-       * connections are leftover after an equal split. */
-      unsigned int conns_per_thread = daemon->connection_limit
-                                      / daemon->worker_pool_size;
-      unsigned int leftover_conns = daemon->connection_limit
-                                    % daemon->worker_pool_size;
-
-      i = 0; /* we need this in case fcntl or malloc fails */
+      char *started;
 
       /* Accept must be non-blocking. Multiple children may wake up
        * to handle a new connection, but only one will win the race.
@@ -4264,133 +12567,119 @@ MHD_start_daemon_va (unsigned int flags,
                                     * daemon->worker_pool_size);
       if (NULL == daemon->worker_pool)
         goto thread_failed;
+      started = calloc (daemon->worker_pool_size, 1);
+      if (NULL == started)
+        goto thread_failed;
+      if (MHD_YES != MHD_mutex_create_ (&daemon->startup_lock))
+        {
+          free (started);
+          goto thread_failed;
+        }
+      daemon->startup_failed = MHD_NO;
+      if (MHD_YES != MHD_mutex_lock_ (&daemon->startup_lock))
+        MHD_PANIC ("Failed to acquire startup mutex\n");
 
       /* Start the workers in the pool */
+      start_workers (daemon,
+                     0,
+                     daemon->worker_pool_size,
+                     started);
       for (i = 0; i < daemon->worker_pool_size; ++i)
+        if (0 == started[i])
+          daemon->startup_failed = MHD_YES;
+      if (MHD_YES != MHD_mutex_unlock_ (&daemon->startup_lock))
+        MHD_PANIC ("Failed to release startup mutex\n");
+      if (MHD_YES == daemon->startup_failed)
         {
-          /* Create copy of the Daemon object for each worker */
-          struct MHD_Daemon *d = &daemon->worker_pool[i];
-
-          memcpy (d, daemon, sizeof (struct MHD_Daemon));
-          /* Adjust pooling params for worker daemons; note that memcpy()
-             has already copied MHD_USE_SELECT_INTERNALLY thread model into
-             the worker threads. */
-          d->master = daemon;
-          d->worker_pool_size = 0;
-          d->worker_pool = NULL;
-
-          if ( (MHD_USE_SUSPEND_RESUME == (flags & MHD_USE_SUSPEND_RESUME)) &&
-               (0 != MHD_pipe_ (d->wpipe)) )
-            {
-#ifdef HAVE_MESSAGES
-              MHD_DLOG (daemon,
-                        "Failed to create worker control pipe: %s\n",
-                        MHD_pipe_last_strerror_() );
-#endif
-              goto thread_failed;
-            }
-#ifndef MHD_WINSOCK_SOCKETS
-          if ( (0 == (flags & (MHD_USE_POLL | MHD_USE_EPOLL_LINUX_ONLY))) &&
-               (MHD_USE_SUSPEND_RESUME == (flags & MHD_USE_SUSPEND_RESUME)) &&
-               (d->wpipe[0] >= FD_SETSIZE) )
-            {
-#ifdef HAVE_MESSAGES
-              MHD_DLOG (daemon,
-                        "File descriptor for worker control pipe exceeds maximum value\n");
-#endif
-              if (0 != MHD_pipe_close_ (d->wpipe[0]))
-                MHD_PANIC ("close failed\n");
-              if (0 != MHD_pipe_close_ (d->wpipe[1]))
-                MHD_PANIC ("close failed\n");
-              goto thread_failed;
-            }
-#endif
-
-          /* Divide available connections evenly amongst the threads.
-           * Thread indexes in [0, leftover_conns) each get one of the
-           * leftover connections. */
-          d->connection_limit = conns_per_thread;
-          if (i < leftover_conns)
-            ++d->connection_limit;
-#if EPOLL_SUPPORT
-	  if ( (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY)) &&
-	       (MHD_YES != setup_epoll_to_listen (d)) )
-	    goto thread_failed;
-#endif
-          /* Must init cleanup connection mutex for each worker */
-          if (MHD_YES != MHD_mutex_create_ (&d->cleanup_connection_mutex))
-            {
-#ifdef HAVE_MESSAGES
-              MHD_DLOG (daemon,
-                       "MHD failed to initialize cleanup connection mutex for thread worker %d\n", i);
-#endif
-              goto thread_failed;
-            }
-
-          /* Spawn the worker thread */
-          if (0 != (res_thread_create =
-		    create_thread (&d->pid, daemon, &MHD_select_thread, d)))
+          /* the workers that were started exit without running
+             their event loop */
+          for (i = 0; i < daemon->worker_pool_size; ++i)
             {
-#ifdef HAVE_MESSAGES
-              MHD_DLOG (daemon,
-                        "Failed to create pool thread: %s\n",
-			MHD_strerror_ (res_thread_create));
-#endif
-              /* Free memory for this worker; cleanup below handles
-               * all previously-created workers. */
-              (void) MHD_mutex_destroy_ (&d->cleanup_connection_mutex);
-              goto thread_failed;
+              if (0 == started[i])
+                continue;
+              if (0 != MHD_join_thread_ (daemon->worker_pool[i].pid))
+                MHD_PANIC ("Failed to join a thread\n");
+              free_worker (&daemon->worker_pool[i]);
             }
+          free (started);
+          (void) MHD_mutex_destroy_ (&daemon->startup_lock);
+          goto thread_failed;
         }
+      free (started);
+#if defined(LINUX) && defined(SO_ATTACH_REUSEPORT_CBPF)
+      if ( (0 != (flags & MHD_USE_THREAD_POOL_REUSEPORT)) &&
+           (0 != daemon->reuseport_cpu_steering) )
+        attach_reuseport_cpu_steering (daemon);
+#endif
     }
+#if PREFORK_SUPPORT
+ started:
+#endif
 #if HTTPS_SUPPORT
   /* API promises to never use the password after initialization,
      so we additionally NULL it here to not deref a dangling pointer. */
   daemon->https_key_password = NULL;
+  daemon->https_cert_table = NULL;
+  daemon->https_cert_table_size = 0;
 #endif /* HTTPS_SUPPORT */
-
+  daemon_socket_interest (daemon,
+                          MHD_SOCKET_INTEREST_READ);
+#if PREFORK_SUPPORT
+  if ( (NULL != daemon->prefork) &&
+       (MHD_YES != MHD_prefork_is_master_ (daemon)) )
+    MHD_prefork_worker_run_ (daemon);
+#endif
   return daemon;
 
 thread_failed:
-  /* If no worker threads created, then shut down normally. Calling
-     MHD_stop_daemon (as we do below) doesn't work here since it
-     assumes a 0-sized thread pool means we had been in the default
+  /* No worker thread is left running here, see start_workers(), so
+     shut down without MHD_stop_daemon, which assumes a 0-sized
+     thread pool means we had been in the default
      MHD_USE_SELECT_INTERNALLY mode. */
-  if (0 == i)
-    {
-      if ( (MHD_INVALID_SOCKET != socket_fd) &&
-	   (0 != MHD_socket_close_ (socket_fd)) )
-	MHD_PANIC ("close failed\n");
-      (void) MHD_mutex_destroy_ (&daemon->cleanup_connection_mutex);
-      (void) MHD_mutex_destroy_ (&daemon->per_ip_connection_mutex);
-      if (NULL != daemon->worker_pool)
-        free (daemon->worker_pool);
-      goto free_and_fail;
-    }
-
-  /* Shutdown worker threads we've already created. Pretend
-     as though we had fully initialized our daemon, but
-     with a smaller number of threads than had been
-     requested. */
-  daemon->worker_pool_size = i;
-  MHD_stop_daemon (daemon);
-  return NULL;
+  if ( (MHD_INVALID_SOCKET != socket_fd) &&
+       (0 != MHD_socket_close_ (socket_fd)) )
+    MHD_PANIC ("close failed\n");
+  (void) MHD_mutex_destroy_ (&daemon->cleanup_connection_mutex);
+  MHD_ip_count_destroy (daemon);
+  if (NULL != daemon->worker_pool)
+    free (daemon->worker_pool);
+  goto free_and_fail;
 
  free_and_fail:
+  /* a worker process must not return to the application */
+  MHD_prefork_startup_failed_ ();
   /* clean up basic memory state in 'daemon' and return NULL to
      indicate failure */
 #if EPOLL_SUPPORT
   if (-1 != daemon->epoll_fd)
     close (daemon->epoll_fd);
 #endif
+#if KQUEUE_SUPPORT
+  if (-1 != daemon->kqueue_fd)
+    close (daemon->kqueue_fd);
+#endif
+#if IO_URING_SUPPORT
+  close_io_uring (daemon);
+#endif
 #ifdef DAUTH_SUPPORT
-  free (daemon->nnc);
-  (void) MHD_mutex_destroy_ (&daemon->nnc_lock);
+  MHD_nonce_nc_destroy (daemon);
 #endif
-#if HTTPS_SUPPORT
-  if (0 != (flags & MHD_USE_SSL))
-    gnutls_priority_deinit (daemon->priority_cache);
+#ifdef BAUTH_SUPPORT
+  MHD_basic_auth_cache_destroy_ (daemon);
 #endif
+#if HTTPS_SUPPORT
+  stop_handshake_threads (daemon);
+  free_handshake_threads (daemon);
+  MHD_tls_daemon_deinit_ (daemon);
+#endif
+  stop_handler_threads (daemon);
+  free_handler_threads (daemon);
+  stop_thread_cache (daemon);
+  free_thread_cache (daemon);
+  MHD_connection_destroy_error_responses_ (daemon);
+  MHD_cache_destroy_ (daemon->response_cache);
+  stop_log_thread (daemon);
+  MHD_prefork_destroy_ (daemon);
   free (daemon);
   return NULL;
 }
@@ -4411,17 +12700,12 @@ close_connection (struct MHD_Connection *pos)
                          MHD_REQUEST_TERMINATED_DAEMON_SHUTDOWN);
   if (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
     return; /* must let thread to the rest */
-  if (pos->connection_timeout == pos->daemon->connection_timeout)
-    XDLL_remove (daemon->normal_timeout_head,
-		 daemon->normal_timeout_tail,
-		 pos);
-  else
-    XDLL_remove (daemon->manual_timeout_head,
-		 daemon->manual_timeout_tail,
-		 pos);
+  MHD_connection_timeout_remove_ (pos);
+  MHD_connection_guard_remove_ (pos);
   DLL_remove (daemon->connections_head,
 	      daemon->connections_tail,
 	      pos);
+  MHD_poll_set_remove_ (pos);
   pos->event_loop_info = MHD_EVENT_LOOP_INFO_CLEANUP;
   DLL_insert (daemon->cleanup_head,
 	      daemon->cleanup_tail,
@@ -4440,13 +12724,37 @@ static void
 close_all_connections (struct MHD_Daemon *daemon)
 {
   struct MHD_Connection *pos;
+  struct MHD_Connection *next;
 
+  /* connections added after the event loop stopped */
+  insert_added_connections (daemon);
+  /* connections waiting for body data were suspended by MHD,
+     not by the application, so they are closed like active ones */
+  if (0 != (daemon->options & MHD_USE_SUSPEND_RESUME))
+    {
+      /* the handler threads are stopped, this runs the steps */
+      submit_handler_steps (daemon);
+      if (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex))
+        MHD_PANIC ("Failed to acquire cleanup mutex\n");
+      for (pos = daemon->suspended_connections_head; NULL != pos; pos = next)
+        {
+          next = pos->next;
+          if (MHD_NO == pos->waiting_for_data)
+            continue;
+          pos->waiting_for_data = MHD_NO;
+          resume_connection (pos);
+        }
+      if (MHD_YES != MHD_mutex_unlock_ (&daemon->cleanup_connection_mutex))
+        MHD_PANIC ("Failed to release cleanup mutex\n");
+      (void) resume_suspended_connections (daemon);
+    }
   /* first, make sure all threads are aware of shutdown; need to
      traverse DLLs in peace... */
   if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
        (MHD_YES != MHD_mutex_lock_ (&daemon->cleanup_connection_mutex)) )
     MHD_PANIC ("Failed to acquire cleanup mutex\n");
-  if (NULL != daemon->suspended_connections_head)
+  if ( (NULL != daemon->suspended_connections_head) ||
+       (NULL != daemon->resumed_connections_head) )
     MHD_PANIC ("MHD_stop_daemon() called while we have suspended connections.\n");
   for (pos = daemon->connections_head; NULL != pos; pos = pos->next)
     {
@@ -4455,7 +12763,7 @@ close_all_connections (struct MHD_Daemon *daemon)
 #if MHD_WINSOCK_SOCKETS
       if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
            (MHD_INVALID_PIPE_ != daemon->wpipe[1]) &&
-           (1 != MHD_pipe_write_ (daemon->wpipe[1], "e", 1)) )
+           (MHD_YES != MHD_itc_activate_ (daemon->wpipe[1])) )
         MHD_PANIC ("Failed to signal shutdown via pipe");
 #endif
     }
@@ -4464,6 +12772,7 @@ close_all_connections (struct MHD_Daemon *daemon)
     MHD_PANIC ("Failed to release cleanup mutex\n");
 
   /* now, collect per-connection threads */
+  stop_thread_cache (daemon);
   if (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
     {
       pos = daemon->connections_head;
@@ -4482,15 +12791,82 @@ close_all_connections (struct MHD_Daemon *daemon)
         pos = pos->next;
       }
     }
-  /* now that we're alone, move everyone to cleanup */
-  while (NULL != (pos = daemon->connections_head))
-  {
-    if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
-         (MHD_YES != pos->thread_joined) )
-      MHD_PANIC ("Failed to join a thread\n");
-    close_connection (pos);
-  }
-  MHD_cleanup_connections (daemon);
+  /* now that we're alone, move everyone to cleanup */
+  while (NULL != (pos = daemon->connections_head))
+  {
+    if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
+         (MHD_YES != pos->thread_joined) )
+      MHD_PANIC ("Failed to join a thread\n");
+    close_connection (pos);
+  }
+  MHD_cleanup_connections (daemon);
+}
+
+
+/**
+ * Free the connection objects kept for reuse by @a daemon.
+ *
+ * @param daemon daemon to flush the connection cache of
+ */
+static void
+flush_connection_cache (struct MHD_Daemon *daemon)
+{
+  struct MHD_Connection *pos;
+
+  while (NULL != (pos = daemon->connection_cache))
+    {
+      daemon->connection_cache = pos->next;
+      free (pos);
+    }
+  daemon->connection_cache_len = 0;
+}
+
+
+/**
+ * Release everything a worker daemon of a thread pool holds; its
+ * thread must have been joined.
+ *
+ * @param worker worker daemon to clean up
+ */
+static void
+free_worker (struct MHD_Daemon *worker)
+{
+  /* only picks up what was added after the thread stopped */
+  close_all_connections (worker);
+  MHD_pool_cache_flush (&worker->pool_cache,
+                        &worker->pool_cache_len);
+  flush_connection_cache (worker);
+  free_poll_set (worker);
+  MHD_access_log_free_ (worker);
+  free (worker->write_scratch);
+#if HAVE_ZLIB
+  MHD_compressor_cache_flush_ (worker);
+#endif
+  (void) MHD_mutex_destroy_ (&worker->cleanup_connection_mutex);
+  if ( (MHD_INVALID_SOCKET != worker->worker_socket_fd) &&
+       (0 != MHD_socket_close_ (worker->worker_socket_fd)) )
+    MHD_PANIC ("close failed\n");
+#if EPOLL_SUPPORT
+  if ( (-1 != worker->epoll_fd) &&
+       (0 != MHD_socket_close_ (worker->epoll_fd)) )
+    MHD_PANIC ("close failed\n");
+  free (worker->epoll_events);
+#endif
+#if KQUEUE_SUPPORT
+  if ( (-1 != worker->kqueue_fd) &&
+       (0 != close (worker->kqueue_fd)) )
+    MHD_PANIC ("close failed\n");
+#endif
+#if IO_URING_SUPPORT
+  close_io_uring (worker);
+#endif
+  if (MHD_INVALID_PIPE_ != worker->wpipe[1])
+    {
+      if (0 != MHD_pipe_close_ (worker->wpipe[0]))
+        MHD_PANIC ("close failed\n");
+      if (0 != MHD_pipe_close_ (worker->wpipe[1]))
+        MHD_PANIC ("close failed\n");
+    }
 }
 
 
@@ -4521,6 +12897,87 @@ epoll_shutdown (struct MHD_Daemon *daemon)
 #endif
 
 
+#if KQUEUE_SUPPORT
+/**
+ * Shutdown kqueue()-event loop by triggering its user event.
+ *
+ * @param daemon daemon of which the kqueue() instance must be signalled
+ */
+static void
+kqueue_shutdown (struct MHD_Daemon *daemon)
+{
+  struct kevent change;
+
+  EV_SET (&change, 0, EVFILT_USER, 0, NOTE_TRIGGER, 0, NULL);
+  if (0 != kevent (daemon->kqueue_fd,
+                   &change, 1,
+                   NULL, 0,
+                   NULL))
+    MHD_PANIC ("Failed to trigger kqueue user event to signal termination\n");
+}
+#endif
+
+
+/**
+ * Count the connections of @a daemon and its workers.
+ *
+ * @param daemon master daemon
+ * @return number of open connections
+ */
+static unsigned int
+count_connections (struct MHD_Daemon *daemon)
+{
+  unsigned int count;
+  unsigned int i;
+
+  if (NULL == daemon->worker_pool)
+    return daemon->connections;
+  count = 0;
+  for (i = 0; i < daemon->worker_pool_size; i++)
+    count += daemon->worker_pool[i].connections;
+  return count;
+}
+
+
+/**
+ * Give the connections of @a daemon #MHD_OPTION_SHUTDOWN_GRACE_MS to
+ * complete before they are closed: stop accepting, stop offering
+ * keep-alive, close the idle connections and wait until none is left
+ * or the period is over.
+ *
+ * @param daemon daemon to drain
+ * @return the listen socket taken from the daemon, to be closed by
+ *         the caller, #MHD_INVALID_SOCKET if there is none
+ */
+static MHD_socket
+drain_for_shutdown (struct MHD_Daemon *daemon)
+{
+  MHD_socket fd;
+  uint64_t deadline;
+  unsigned int i;
+
+  fd = MHD_INVALID_SOCKET;
+  if ( (0 == daemon->shutdown_grace) ||
+       (0 == (daemon->options & (MHD_USE_SELECT_INTERNALLY | MHD_USE_THREAD_PER_CONNECTION))) )
+    return fd;
+  /* without a pipe the threads would not learn that the socket is
+     gone; new connections are then still accepted, but closed after
+     their first request */
+  if (MHD_INVALID_PIPE_ != daemon->wpipe[1])
+    fd = MHD_quiesce_daemon (daemon);
+  if (NULL == daemon->worker_pool)
+    start_draining (daemon);
+  else
+    for (i = 0; i < daemon->worker_pool_size; i++)
+      start_draining (&daemon->worker_pool[i]);
+  deadline = MHD_monotonic_msec_counter () + daemon->shutdown_grace;
+  while ( (0 != count_connections (daemon)) &&
+          (MHD_monotonic_msec_counter () < deadline) )
+    usleep (MHD_SHUTDOWN_DRAIN_INTERVAL);
+  return fd;
+}
+
+
 /**
  * Shutdown an HTTP daemon.
  *
@@ -4531,13 +12988,33 @@ void
 MHD_stop_daemon (struct MHD_Daemon *daemon)
 {
   MHD_socket fd;
+  MHD_socket quiesced;
   unsigned int i;
 
   if (NULL == daemon)
     return;
 
+#if PREFORK_SUPPORT
+  if (MHD_YES == MHD_prefork_is_master_ (daemon))
+    {
+      /* the workers drain their connections themselves */
+      MHD_prefork_stop_ (daemon);
+      daemon->shutdown_grace = 0;
+    }
+#endif
+  /* while the handshake and handler threads still run */
+  quiesced = drain_for_shutdown (daemon);
+
+#if HTTPS_SUPPORT
+  /* connections with incomplete handshakes are handed back */
+  stop_handshake_threads (daemon);
+#endif
+  /* the handler threads complete the steps handed to them */
+  stop_handler_threads (daemon);
   if (0 != (MHD_USE_SUSPEND_RESUME & daemon->options))
     resume_suspended_connections (daemon);
+  daemon_socket_interest (daemon,
+                          MHD_SOCKET_INTEREST_REMOVE);
   daemon->shutdown = MHD_YES;
   fd = daemon->socket_fd;
   daemon->socket_fd = MHD_INVALID_SOCKET;
@@ -4549,17 +13026,29 @@ MHD_stop_daemon (struct MHD_Daemon *daemon)
 	{
 	  daemon->worker_pool[i].shutdown = MHD_YES;
 	  daemon->worker_pool[i].socket_fd = MHD_INVALID_SOCKET;
+#ifdef HAVE_LISTEN_SHUTDOWN
+          /* workers with their own listen socket are not woken up
+             by shutting down the master's listen socket below */
+          if ( (MHD_INVALID_SOCKET != daemon->worker_pool[i].worker_socket_fd) &&
+               (MHD_INVALID_PIPE_ == daemon->worker_pool[i].wpipe[1]) &&
+               (0 == (daemon->options & MHD_USE_PIPE_FOR_SHUTDOWN)) )
+            (void) shutdown (daemon->worker_pool[i].worker_socket_fd, SHUT_RDWR);
+#endif
 #if EPOLL_SUPPORT
 	  if ( (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY)) &&
 	       (-1 != daemon->worker_pool[i].epoll_fd) &&
 	       (MHD_INVALID_SOCKET == fd) )
 	    epoll_shutdown (&daemon->worker_pool[i]);
+#endif
+#if KQUEUE_SUPPORT
+	  if (-1 != daemon->worker_pool[i].kqueue_fd)
+	    kqueue_shutdown (&daemon->worker_pool[i]);
 #endif
 	}
     }
   if (MHD_INVALID_PIPE_ != daemon->wpipe[1])
     {
-      if (1 != MHD_pipe_write_ (daemon->wpipe[1], "e", 1))
+      if (MHD_YES != MHD_itc_activate_ (daemon->wpipe[1]))
 	MHD_PANIC ("failed to signal shutdown via pipe");
     }
 #ifdef HAVE_LISTEN_SHUTDOWN
@@ -4577,6 +13066,10 @@ MHD_stop_daemon (struct MHD_Daemon *daemon)
        (MHD_INVALID_SOCKET == fd) )
     epoll_shutdown (daemon);
 #endif
+#if KQUEUE_SUPPORT
+  if (-1 != daemon->kqueue_fd)
+    kqueue_shutdown (daemon);
+#endif
 
 #if DEBUG_CLOSE
 #ifdef HAVE_MESSAGES
@@ -4586,7 +13079,8 @@ MHD_stop_daemon (struct MHD_Daemon *daemon)
 #endif
 
 
-  /* Signal workers to stop and clean them up */
+  /* Signal all workers to stop before joining any of them, each
+     closes its own connections */
   if (NULL != daemon->worker_pool)
     {
       /* MHD_USE_NO_LISTEN_SOCKET disables thread pools, hence we need to check */
@@ -4594,37 +13088,30 @@ MHD_stop_daemon (struct MHD_Daemon *daemon)
 	{
 	  if (MHD_INVALID_PIPE_ != daemon->worker_pool[i].wpipe[1])
 	    {
-	      if (1 != MHD_pipe_write_ (daemon->worker_pool[i].wpipe[1], "e", 1))
+	      if (MHD_YES != MHD_itc_activate_ (daemon->worker_pool[i].wpipe[1]))
 		MHD_PANIC ("failed to signal shutdown via pipe");
 	    }
+	}
+      for (i = 0; i < daemon->worker_pool_size; ++i)
+	{
 	  if (0 != MHD_join_thread_ (daemon->worker_pool[i].pid))
 	      MHD_PANIC ("Failed to join a thread\n");
-	  close_all_connections (&daemon->worker_pool[i]);
-	  (void) MHD_mutex_destroy_ (&daemon->worker_pool[i].cleanup_connection_mutex);
-#if EPOLL_SUPPORT
-	  if ( (-1 != daemon->worker_pool[i].epoll_fd) &&
-	       (0 != MHD_socket_close_ (daemon->worker_pool[i].epoll_fd)) )
-	    MHD_PANIC ("close failed\n");
-#endif
-          if ( (MHD_USE_SUSPEND_RESUME == (daemon->options & MHD_USE_SUSPEND_RESUME)) )
-            {
-              if (MHD_INVALID_PIPE_ != daemon->worker_pool[i].wpipe[1])
-                {
-	           if (0 != MHD_pipe_close_ (daemon->worker_pool[i].wpipe[0]))
-	             MHD_PANIC ("close failed\n");
-	           if (0 != MHD_pipe_close_ (daemon->worker_pool[i].wpipe[1]))
-	             MHD_PANIC ("close failed\n");
-                }
-	    }
+	  free_worker (&daemon->worker_pool[i]);
 	}
+      (void) MHD_mutex_destroy_ (&daemon->startup_lock);
       free (daemon->worker_pool);
     }
   else
     {
       /* clean up master threads */
-      if ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) ||
-           ( (0 != (daemon->options & MHD_USE_SELECT_INTERNALLY)) &&
-             (0 == daemon->worker_pool_size) ) )
+      if ( ( (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) ||
+             ( (0 != (daemon->options & MHD_USE_SELECT_INTERNALLY)) &&
+               (0 == daemon->worker_pool_size) ) )
+#if PREFORK_SUPPORT
+           /* the master of the worker processes has no thread */
+           && (MHD_YES != MHD_prefork_is_master_ (daemon))
+#endif
+           )
 	{
 	  if (0 != MHD_join_thread_ (daemon->pid))
 	    {
@@ -4633,37 +13120,56 @@ MHD_stop_daemon (struct MHD_Daemon *daemon)
 	}
     }
   close_all_connections (daemon);
+  MHD_pool_cache_flush (&daemon->pool_cache,
+                        &daemon->pool_cache_len);
+  flush_connection_cache (daemon);
+  free_poll_set (daemon);
+  MHD_access_log_free_ (daemon);
+  free (daemon->write_scratch);
+  MHD_metrics_free_ (daemon);
+#if HAVE_ZLIB
+  MHD_compressor_cache_flush_ (daemon);
+#endif
   if ( (MHD_INVALID_SOCKET != fd) &&
        (0 != MHD_socket_close_ (fd)) )
     MHD_PANIC ("close failed\n");
+  if ( (MHD_INVALID_SOCKET != quiesced) &&
+       (0 != MHD_socket_close_ (quiesced)) )
+    MHD_PANIC ("close failed\n");
 
   /* TLS clean up */
 #if HTTPS_SUPPORT
-  if (MHD_YES == daemon->have_dhparams)
-    {
-      gnutls_dh_params_deinit (daemon->https_mem_dhparams);
-      daemon->have_dhparams = MHD_NO;
-    }
-  if (0 != (daemon->options & MHD_USE_SSL))
-    {
-      gnutls_priority_deinit (daemon->priority_cache);
-      if (daemon->x509_cred)
-        gnutls_certificate_free_credentials (daemon->x509_cred);
-    }
+  free_handshake_threads (daemon);
+  MHD_tls_daemon_deinit_ (daemon);
 #endif
+  free_handler_threads (daemon);
+  free_thread_cache (daemon);
 #if EPOLL_SUPPORT
   if ( (0 != (daemon->options & MHD_USE_EPOLL_LINUX_ONLY)) &&
        (-1 != daemon->epoll_fd) &&
        (0 != MHD_socket_close_ (daemon->epoll_fd)) )
     MHD_PANIC ("close failed\n");
+  free (daemon->epoll_events);
+#endif
+#if KQUEUE_SUPPORT
+  if ( (-1 != daemon->kqueue_fd) &&
+       (0 != close (daemon->kqueue_fd)) )
+    MHD_PANIC ("close failed\n");
+#endif
+#if IO_URING_SUPPORT
+  close_io_uring (daemon);
 #endif
 
 #ifdef DAUTH_SUPPORT
-  free (daemon->nnc);
-  (void) MHD_mutex_destroy_ (&daemon->nnc_lock);
+  MHD_nonce_nc_destroy (daemon);
+#endif
+#ifdef BAUTH_SUPPORT
+  MHD_basic_auth_cache_destroy_ (daemon);
 #endif
-  (void) MHD_mutex_destroy_ (&daemon->per_ip_connection_mutex);
+  MHD_ip_count_destroy (daemon);
   (void) MHD_mutex_destroy_ (&daemon->cleanup_connection_mutex);
+  MHD_connection_destroy_error_responses_ (daemon);
+  MHD_cache_destroy_ (daemon->response_cache);
 
   if (MHD_INVALID_PIPE_ != daemon->wpipe[1])
     {
@@ -4672,10 +13178,105 @@ MHD_stop_daemon (struct MHD_Daemon *daemon)
       if (0 != MHD_pipe_close_ (daemon->wpipe[1]))
 	MHD_PANIC ("close failed\n");
     }
+  stop_log_thread (daemon);
+  MHD_prefork_destroy_ (daemon);
   free (daemon);
 }
 
 
+/**
+ * Read the counter @a field of the statistics of @a daemon, see
+ * #MHD_STATS_ADD_().
+ *
+ * @param daemon daemon (or worker) to read
+ * @param field member of `struct MHD_DaemonStats`
+ */
+#ifdef HAVE_ATOMIC_BUILTINS
+#define STATS_GET(daemon,field) \
+  __atomic_load_n (&(daemon)->stats->field, __ATOMIC_RELAXED)
+#else
+#define STATS_GET(daemon,field) ((daemon)->stats->field)
+#endif
+
+
+/**
+ * Add the statistics of @a daemon to @a sum.
+ *
+ * @param sum statistics to add to
+ * @param daemon daemon (or worker) to read the statistics of
+ */
+static void
+add_stats (struct MHD_DaemonStats *sum,
+           struct MHD_Daemon *daemon)
+{
+  sum->accepts += STATS_GET (daemon, accepts);
+  sum->accept_errors += STATS_GET (daemon, accept_errors);
+  sum->requests += STATS_GET (daemon, requests);
+  sum->bytes_received += STATS_GET (daemon, bytes_received);
+  sum->bytes_sent += STATS_GET (daemon, bytes_sent);
+  sum->keep_alive_reuses += STATS_GET (daemon, keep_alive_reuses);
+  sum->timeouts += STATS_GET (daemon, timeouts);
+  sum->suspended += STATS_GET (daemon, suspended);
+  sum->tls_handshakes += STATS_GET (daemon, tls_handshakes);
+  sum->pool_exhaustions += STATS_GET (daemon, pool_exhaustions);
+  sum->pool_fail_read_buffer += STATS_GET (daemon, pool_fail_read_buffer);
+  sum->pool_fail_headers += STATS_GET (daemon, pool_fail_headers);
+  sum->pool_fail_write_buffer += STATS_GET (daemon, pool_fail_write_buffer);
+  sum->pool_fail_other += STATS_GET (daemon, pool_fail_other);
+  sum->loop_iterations += STATS_GET (daemon, loop_iterations);
+  sum->loop_wakeups += STATS_GET (daemon, loop_wakeups);
+  sum->loop_events += STATS_GET (daemon, loop_events);
+  sum->loop_wait_usec += STATS_GET (daemon, loop_wait_usec);
+  sum->loop_dispatch_usec += STATS_GET (daemon, loop_dispatch_usec);
+  sum->http2_sessions += STATS_GET (daemon, http2_sessions);
+  sum->http2_streams += STATS_GET (daemon, http2_streams);
+  sum->migrations += STATS_GET (daemon, migrations);
+  sum->header_timeouts += STATS_GET (daemon, header_timeouts);
+  sum->slow_transfers += STATS_GET (daemon, slow_transfers);
+  sum->header_overflows += STATS_GET (daemon, header_overflows);
+  sum->parked += STATS_GET (daemon, parked);
+}
+
+
+/**
+ * Sum up the statistics of @a daemon over its workers (and worker
+ * processes), as returned for #MHD_DAEMON_INFO_STATS.
+ *
+ * @param daemon the (master) daemon
+ * @param[out] sum set to the statistics
+ */
+void
+MHD_collect_stats_ (struct MHD_Daemon *daemon,
+                    struct MHD_DaemonStats *sum)
+{
+  unsigned int i;
+
+  memset (sum,
+          0,
+          sizeof (struct MHD_DaemonStats));
+#if PREFORK_SUPPORT
+  /* the counters of all threads of all worker processes */
+  if (NULL != daemon->prefork)
+    MHD_prefork_add_stats_ (daemon,
+                            sum);
+  else
+#endif
+  add_stats (sum,
+             daemon);
+  if ( (NULL != daemon->worker_pool) &&
+       (NULL == daemon->prefork) )
+    for (i=0;i<daemon->worker_pool_size;i++)
+      add_stats (sum,
+                 &daemon->worker_pool[i]);
+#ifdef HAVE_MESSAGES
+  /* the workers share the log queue */
+  if (NULL != daemon->log_queue)
+    MHD_log_queue_stats_ (daemon->log_queue,
+                          sum);
+#endif
+}
+
+
 /**
  * Obtain information about the given daemon
  * (not fully implemented!).
@@ -4719,12 +13320,200 @@ MHD_get_daemon_info (struct MHD_Daemon *daemon,
             }
         }
       return (const union MHD_DaemonInfo *) &daemon->connections;
+    case MHD_DAEMON_INFO_STATS:
+      MHD_collect_stats_ (daemon,
+                          &daemon->stats_snapshot);
+      return (const union MHD_DaemonInfo *) &daemon->stats_snapshot;
     default:
       return NULL;
     };
 }
 
 
+#ifdef HAVE_ATOMIC_BUILTINS
+#define LATENCY_GET(counter) \
+  __atomic_load_n (&(counter), __ATOMIC_RELAXED)
+#else
+#define LATENCY_GET(counter) (counter)
+#endif
+
+
+/**
+ * Add @a histogram, which threads may be updating, to @a sum.
+ *
+ * @param sum histogram to add to
+ * @param histogram histogram to read
+ */
+static void
+add_histogram (struct MHD_LatencyHistogram *sum,
+               struct MHD_LatencyHistogram *histogram)
+{
+  unsigned int i;
+
+  sum->count += LATENCY_GET (histogram->count);
+  sum->sum += LATENCY_GET (histogram->sum);
+  for (i = 0; i < MHD_LATENCY_BUCKETS; i++)
+    sum->buckets[i] += LATENCY_GET (histogram->buckets[i]);
+}
+
+
+/**
+ * Get the histogram of the latency @a type of all requests completed
+ * by @a daemon, summed up over the threads of a thread pool.  The
+ * threads record into their histograms without locking while they are
+ * read, so @e count and the @e buckets need not match exactly.
+ *
+ * @param daemon daemon to get the histogram of
+ * @param type which latency to get
+ * @param[out] histogram set to the histogram
+ * @return #MHD_YES on success, #MHD_NO if @a type is unknown
+ * @ingroup specialized
+ */
+int
+MHD_get_latency_histogram (struct MHD_Daemon *daemon,
+                           enum MHD_LatencyType type,
+                           struct MHD_LatencyHistogram *histogram)
+{
+  unsigned int i;
+
+  if ( (MHD_LATENCY_FIRST_BYTE != type) &&
+       (MHD_LATENCY_TOTAL != type) )
+    return MHD_NO;
+  memset (histogram,
+          0,
+          sizeof (struct MHD_LatencyHistogram));
+  add_histogram (histogram,
+                 &daemon->latency[type]);
+  if (NULL != daemon->worker_pool)
+    for (i=0;i<daemon->worker_pool_size;i++)
+      add_histogram (histogram,
+                     &daemon->worker_pool[i].latency[type]);
+  return MHD_YES;
+}
+
+
+/**
+ * Get the histogram of the peak memory pool usage of the connections
+ * closed by @a daemon, summed up over the threads of a thread pool.
+ * It has the layout of a latency histogram, with bytes instead of
+ * microseconds, so #MHD_latency_bucket_limit() and
+ * #MHD_latency_histogram_percentile() apply to it.  This helps to
+ * pick the #MHD_OPTION_CONNECTION_MEMORY_LIMIT.
+ *
+ * @param daemon daemon to get the histogram of
+ * @param[out] histogram set to the histogram
+ * @ingroup specialized
+ */
+void
+MHD_get_pool_usage_histogram (struct MHD_Daemon *daemon,
+                              struct MHD_LatencyHistogram *histogram)
+{
+  unsigned int i;
+
+  memset (histogram,
+          0,
+          sizeof (struct MHD_LatencyHistogram));
+  add_histogram (histogram,
+                 &daemon->pool_usage);
+  if (NULL != daemon->worker_pool)
+    for (i=0;i<daemon->worker_pool_size;i++)
+      add_histogram (histogram,
+                     &daemon->worker_pool[i].pool_usage);
+}
+
+
+/**
+ * Add the histogram @a src to @a dst, for example to combine the
+ * histograms of several daemons.
+ *
+ * @param dst histogram to add to
+ * @param src histogram to add
+ * @ingroup specialized
+ */
+void
+MHD_latency_histogram_merge (struct MHD_LatencyHistogram *dst,
+                             const struct MHD_LatencyHistogram *src)
+{
+  unsigned int i;
+
+  dst->count += src->count;
+  dst->sum += src->sum;
+  for (i = 0; i < MHD_LATENCY_BUCKETS; i++)
+    dst->buckets[i] += src->buckets[i];
+}
+
+
+/**
+ * Get the highest latency recorded in @a bucket of a
+ * `struct MHD_LatencyHistogram`.
+ *
+ * @param bucket index of the bucket, below #MHD_LATENCY_BUCKETS
+ * @return highest latency of the bucket in microseconds
+ * @ingroup specialized
+ */
+uint64_t
+MHD_latency_bucket_limit (unsigned int bucket)
+{
+  unsigned int shift;
+
+  if (bucket < 32)
+    return bucket;
+  if (bucket >= MHD_LATENCY_BUCKETS - 1)
+    return UINT64_MAX;
+  shift = bucket / 16 - 1;
+  return (((uint64_t) (16 + bucket % 16) + 1) << shift) - 1;
+}
+
+
+/**
+ * Get the latency below which @a percentile percent of the requests
+ * in @a histogram were completed, rounded up to the limit of its
+ * bucket.
+ *
+ * @param histogram histogram to evaluate
+ * @param percentile percentage of requests, for example 99.9
+ * @return latency in microseconds, 0 if @a histogram is empty
+ * @ingroup specialized
+ */
+uint64_t
+MHD_latency_histogram_percentile (const struct MHD_LatencyHistogram *histogram,
+                                  double percentile)
+{
+  uint64_t total;
+  uint64_t seen;
+  uint64_t rank;
+  unsigned int i;
+
+  /* count the buckets, @e count may be ahead of them */
+  total = 0;
+  for (i = 0; i < MHD_LATENCY_BUCKETS; i++)
+    total += histogram->buckets[i];
+  if (0 == total)
+    return 0;
+  /* nearest rank: the smallest one covering the percentile */
+  if (percentile >= 100.0)
+    rank = total;
+  else if (percentile <= 0.0)
+    rank = 1;
+  else
+    {
+      rank = (uint64_t) (total * percentile / 100.0);
+      if ((double) rank < total * percentile / 100.0)
+        rank++;
+      if (0 == rank)
+        rank = 1;
+    }
+  seen = 0;
+  for (i = 0; i < MHD_LATENCY_BUCKETS; i++)
+    {
+      seen += histogram->buckets[i];
+      if (seen >= rank)
+        return MHD_latency_bucket_limit (i);
+    }
+  return MHD_latency_bucket_limit (MHD_LATENCY_BUCKETS - 1);
+}
+
+
 /**
  * Sets the global error handler to a different implementation.  @a cb
  * will only be called in the case of typically fatal, serious
@@ -4806,7 +13595,7 @@ MHD_is_feature_supported(enum MHD_FEATURE feature)
       return MHD_NO;
 #endif
     case MHD_FEATURE_HTTPS_CERT_CALLBACK:
-#if HTTPS_SUPPORT && GNUTLS_VERSION_MAJOR >= 3
+#if HTTPS_SUPPORT && ! HTTPS_OPENSSL && GNUTLS_VERSION_MAJOR >= 3
       return MHD_YES;
 #else
       return MHD_NO;
@@ -4872,7 +13661,51 @@ MHD_is_feature_supported(enum MHD_FEATURE feature)
       return MHD_NO;
 #endif
     case MHD_FEATURE_HTTPS_KEY_PASSWORD:
-#if HTTPS_SUPPORT && GNUTLS_VERSION_NUMBER >= 0x030111
+#if HTTPS_SUPPORT && (HTTPS_OPENSSL || GNUTLS_VERSION_NUMBER >= 0x030111)
+      return MHD_YES;
+#else
+      return MHD_NO;
+#endif
+    case MHD_FEATURE_UPGRADE:
+      return MHD_YES;
+    case MHD_FEATURE_IO_URING:
+#if IO_URING_SUPPORT
+      return MHD_YES;
+#else
+      return MHD_NO;
+#endif
+    case MHD_FEATURE_KQUEUE:
+#if KQUEUE_SUPPORT
+      return MHD_YES;
+#else
+      return MHD_NO;
+#endif
+    case MHD_FEATURE_UNIX_SOCKETS:
+#if MHD_UNIX_SOCKETS
+      return MHD_YES;
+#else
+      return MHD_NO;
+#endif
+    case MHD_FEATURE_SOCKET_HANDOFF:
+#if MHD_SOCKET_HANDOFF
+      return MHD_YES;
+#else
+      return MHD_NO;
+#endif
+    case MHD_FEATURE_IP_FILTER:
+#if MHD_IP_FILTER
+      return MHD_YES;
+#else
+      return MHD_NO;
+#endif
+    case MHD_FEATURE_MEMFD_RESPONSE:
+#if HAVE_MEMFD_CREATE && HAVE_MMAP
+      return MHD_YES;
+#else
+      return MHD_NO;
+#endif
+    case MHD_FEATURE_COMPRESSION:
+#if HAVE_ZLIB
       return MHD_YES;
 #else
       return MHD_NO;
@@ -4888,62 +13721,6 @@ MHD_is_feature_supported(enum MHD_FEATURE feature)
 }
 
 
-#if HTTPS_SUPPORT && GCRYPT_VERSION_NUMBER < 0x010600
-#if defined(MHD_USE_POSIX_THREADS)
-GCRY_THREAD_OPTION_PTHREAD_IMPL;
-#elif defined(MHD_W32_MUTEX_)
-
-static int
-gcry_w32_mutex_init (void **ppmtx)
-{
-  *ppmtx = malloc (sizeof (MHD_mutex_));
-
-  if (NULL == *ppmtx)
-    return ENOMEM;
-  if (MHD_YES != MHD_mutex_create_ ((MHD_mutex_*)*ppmtx))
-    {
-      free (*ppmtx);
-      *ppmtx = NULL;
-      return EPERM;
-    }
-
-  return 0;
-}
-
-
-static int
-gcry_w32_mutex_destroy (void **ppmtx)
-{
-  int res = (MHD_YES == MHD_mutex_destroy_ ((MHD_mutex_*)*ppmtx)) ? 0 : 1;
-  free (*ppmtx);
-  return res;
-}
-
-
-static int
-gcry_w32_mutex_lock (void **ppmtx)
-{
-  return (MHD_YES == MHD_mutex_lock_ ((MHD_mutex_*)*ppmtx)) ? 0 : 1;
-}
-
-
-static int
-gcry_w32_mutex_unlock (void **ppmtx)
-{
-  return (MHD_YES == MHD_mutex_unlock_ ((MHD_mutex_*)*ppmtx)) ? 0 : 1;
-}
-
-
-static struct gcry_thread_cbs gcry_threads_w32 = {
-  (GCRY_THREAD_OPTION_USER | (GCRY_THREAD_OPTION_VERSION << 8)),
-  NULL, gcry_w32_mutex_init, gcry_w32_mutex_destroy,
-  gcry_w32_mutex_lock, gcry_w32_mutex_unlock,
-  NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL };
-
-#endif /* defined(MHD_W32_MUTEX_) */
-#endif /* HTTPS_SUPPORT && GCRYPT_VERSION_NUMBER < 0x010600 */
-
-
 /**
  * Initialize do setup work.
  */
@@ -4964,22 +13741,10 @@ MHD_init(void)
     MHD_PANIC ("Winsock version 2.2 is not available\n");
 #endif
 #if HTTPS_SUPPORT
-#if GCRYPT_VERSION_NUMBER < 0x010600
-#if defined(MHD_USE_POSIX_THREADS)
-  if (0 != gcry_control (GCRYCTL_SET_THREAD_CBS, &gcry_threads_pthread))
-    MHD_PANIC ("Failed to initialise multithreading in libgcrypt\n");
-#elif defined(MHD_W32_MUTEX_)
-  if (0 != gcry_control (GCRYCTL_SET_THREAD_CBS, &gcry_threads_w32))
-    MHD_PANIC ("Failed to initialise multithreading in libgcrypt\n");
-#endif /* defined(MHD_W32_MUTEX_) */
-  gcry_check_version (NULL);
-#else
-  if (NULL == gcry_check_version ("1.6.0"))
-    MHD_PANIC ("libgcrypt is too old. MHD was compiled for libgcrypt 1.6.0 or newer\n");
-#endif
-  gnutls_global_init ();
+  MHD_tls_global_init_ ();
 #endif
   MHD_monotonic_sec_counter_init();
+  MHD_init_mem_pools_ ();
 }
 
 
@@ -4987,7 +13752,7 @@ void
 MHD_fini(void)
 {
 #if HTTPS_SUPPORT
-  gnutls_global_deinit ();
+  MHD_tls_global_deinit_ ();
 #endif
 #ifdef _WIN32
   if (mhd_winsock_inited_)
@@ -27,6 +27,8 @@
 #include "internal.h"
 #include "md5.h"
 #include "mhd_mono_clock.h"
+#include "mhd_prefork.h"
+#include "mhd_siphash.h"
 
 #if defined(_WIN32) && defined(MHD_W32_MUTEX_)
 #ifndef WIN32_LEAN_AND_MEAN
@@ -76,39 +78,31 @@ cvthex (const unsigned char *bin,
 	size_t len,
 	char *hex)
 {
+  static const char digits[] = "0123456789abcdef";
   size_t i;
-  unsigned int j;
 
   for (i = 0; i < len; ++i)
     {
-      j = (bin[i] >> 4) & 0x0f;
-      hex[i * 2] = (char)((j <= 9) ? (j + '0') : (j - 10 + 'a'));
-      j = bin[i] & 0x0f;
-      hex[i * 2 + 1] = (char)((j <= 9) ? (j + '0') : (j - 10 + 'a'));
+      hex[i * 2] = digits[bin[i] >> 4];
+      hex[i * 2 + 1] = digits[bin[i] & 0x0f];
     }
   hex[len * 2] = '\0';
 }
 
 
 /**
- * calculate H(A1) as per RFC2617 spec and store the
- * result in 'sessionkey'.
+ * calculate H(A1) as per RFC2617 spec (for the "md5" algorithm) and
+ * store the result in 'sessionkey'.
  *
- * @param alg The hash algorithm used, can be "md5" or "md5-sess"
  * @param username A `char *' pointer to the username value
  * @param realm A `char *' pointer to the realm value
  * @param password A `char *' pointer to the password value
- * @param nonce A `char *' pointer to the nonce value
- * @param cnonce A `char *' pointer to the cnonce value
  * @param sessionkey pointer to buffer of HASH_MD5_HEX_LEN+1 bytes
  */
 static void
-digest_calc_ha1 (const char *alg,
-		 const char *username,
+digest_calc_ha1 (const char *username,
 		 const char *realm,
 		 const char *password,
-		 const char *nonce,
-		 const char *cnonce,
 		 char sessionkey[HASH_MD5_HEX_LEN + 1])
 {
   struct MD5Context md5;
@@ -121,17 +115,166 @@ digest_calc_ha1 (const char *alg,
   MD5Update (&md5, (const unsigned char*)":", 1);
   MD5Update (&md5, (const unsigned char*)password, strlen (password));
   MD5Final (ha1, &md5);
-  if (MHD_str_equal_caseless_(alg, "md5-sess"))
+  cvthex (ha1, sizeof (ha1), sessionkey);
+}
+
+
+/**
+ * Entry of the cache of H(A1) values of a daemon, see
+ * #MHD_OPTION_DIGEST_AUTH_HA1_CACHE_SIZE.
+ */
+struct MHD_HA1CacheEntry
+{
+  /**
+   * Protects the entry.
+   */
+  MHD_mutex_ lock;
+
+  /**
+   * Username the entry is for, empty for unused entries.
+   */
+  char username[MAX_USERNAME_LENGTH];
+
+  /**
+   * Realm the entry is for.
+   */
+  char realm[MAX_REALM_LENGTH];
+
+  /**
+   * Keyed hash of the password H(A1) was calculated from, so that
+   * the entry is not used after the password changed.  Anyone who
+   * can read it can also try passwords against @e ha1.
+   */
+  uint64_t password_hash;
+
+  /**
+   * H(A1) of the entry, in hex.
+   */
+  char ha1[HASH_MD5_HEX_LEN + 1];
+};
+
+
+/**
+ * Create the H(A1) cache of a (master) daemon, if
+ * #MHD_OPTION_DIGEST_AUTH_HA1_CACHE_SIZE was given.
+ *
+ * @param daemon daemon to create the cache for
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+int
+MHD_digest_ha1_cache_init_ (struct MHD_Daemon *daemon)
+{
+  unsigned int i;
+
+  daemon->ha1_cache = NULL;
+  if (0 == daemon->ha1_cache_size)
+    return MHD_YES;
+  daemon->ha1_cache = calloc (daemon->ha1_cache_size,
+                              sizeof (struct MHD_HA1CacheEntry));
+  if (NULL == daemon->ha1_cache)
+    return MHD_NO;
+  MHD_siphash_key_ (daemon->ha1_cache_key);
+  for (i = 0; i < daemon->ha1_cache_size; i++)
+    if (MHD_YES != MHD_mutex_create_ (&daemon->ha1_cache[i].lock))
+      {
+        while (i > 0)
+          (void) MHD_mutex_destroy_ (&daemon->ha1_cache[--i].lock);
+        free (daemon->ha1_cache);
+        daemon->ha1_cache = NULL;
+        return MHD_NO;
+      }
+  return MHD_YES;
+}
+
+
+/**
+ * Destroy the H(A1) cache of a (master) daemon, wiping the
+ * H(A1) values kept in it.
+ *
+ * @param daemon daemon to destroy the cache of
+ */
+void
+MHD_digest_ha1_cache_destroy_ (struct MHD_Daemon *daemon)
+{
+  unsigned int i;
+
+  if (NULL == daemon->ha1_cache)
+    return;
+  for (i = 0; i < daemon->ha1_cache_size; i++)
+    (void) MHD_mutex_destroy_ (&daemon->ha1_cache[i].lock);
+  memset (daemon->ha1_cache,
+          0,
+          daemon->ha1_cache_size * sizeof (struct MHD_HA1CacheEntry));
+  free (daemon->ha1_cache);
+  daemon->ha1_cache = NULL;
+}
+
+
+/**
+ * Calculate H(A1) (with "md5") for the given credentials, using the
+ * H(A1) cache of the daemon if it has one.
+ *
+ * @param daemon daemon of the connection
+ * @param username the username
+ * @param realm the realm
+ * @param password the password
+ * @param ha1 set to H(A1) in hex
+ */
+static void
+get_ha1 (struct MHD_Daemon *daemon,
+         const char *username,
+         const char *realm,
+         const char *password,
+         char ha1[HASH_MD5_HEX_LEN + 1])
+{
+  struct MHD_HA1CacheEntry *entry;
+  const char *pos;
+  uint32_t hash;
+  uint64_t password_hash;
+
+  if (NULL != daemon->master)
+    daemon = daemon->master;
+  if ( (NULL == daemon->ha1_cache) ||
+       (strlen (username) >= MAX_USERNAME_LENGTH) ||
+       (strlen (realm) >= MAX_REALM_LENGTH) )
     {
-      MD5Init (&md5);
-      MD5Update (&md5, (const unsigned char*)ha1, sizeof (ha1));
-      MD5Update (&md5, (const unsigned char*)":", 1);
-      MD5Update (&md5, (const unsigned char*)nonce, strlen (nonce));
-      MD5Update (&md5, (const unsigned char*)":", 1);
-      MD5Update (&md5, (const unsigned char*)cnonce, strlen (cnonce));
-      MD5Final (ha1, &md5);
+      digest_calc_ha1 (username,
+                       realm,
+                       password,
+                       ha1);
+      return;
     }
-  cvthex (ha1, sizeof (ha1), sessionkey);
+  password_hash = MHD_siphash_ (daemon->ha1_cache_key,
+                                password,
+                                strlen (password));
+  /* FNV-1a hash of "username:realm" selects the entry */
+  hash = 2166136261U;
+  for (pos = username; '\0' != *pos; pos++)
+    hash = (hash ^ (unsigned char) *pos) * 16777619U;
+  hash = (hash ^ (unsigned char) ':') * 16777619U;
+  for (pos = realm; '\0' != *pos; pos++)
+    hash = (hash ^ (unsigned char) *pos) * 16777619U;
+  entry = &daemon->ha1_cache[hash % daemon->ha1_cache_size];
+  (void) MHD_mutex_lock_ (&entry->lock);
+  if ( (0 == strcmp (entry->username, username)) &&
+       (0 == strcmp (entry->realm, realm)) &&
+       (entry->password_hash == password_hash) )
+    {
+      memcpy (ha1, entry->ha1, sizeof (entry->ha1));
+      (void) MHD_mutex_unlock_ (&entry->lock);
+      return;
+    }
+  (void) MHD_mutex_unlock_ (&entry->lock);
+  digest_calc_ha1 (username,
+                   realm,
+                   password,
+                   ha1);
+  (void) MHD_mutex_lock_ (&entry->lock);
+  strcpy (entry->username, username);
+  strcpy (entry->realm, realm);
+  entry->password_hash = password_hash;
+  memcpy (entry->ha1, ha1, sizeof (entry->ha1));
+  (void) MHD_mutex_unlock_ (&entry->lock);
 }
 
 
@@ -309,49 +452,77 @@ check_nonce_nc (struct MHD_Connection *connection,
 		const char *nonce,
 		unsigned long int nc)
 {
+  struct MHD_Daemon *daemon = connection->daemon;
+  struct MHD_NonceNc *set;
+  struct MHD_NonceNc *entry;
+  MHD_mutex_ *lock;
+  unsigned long int *uses;
+  uint32_t hash;
+  uint32_t sets;
   uint32_t off;
-  uint32_t mod;
   const char *np;
+  unsigned int i;
 
-  mod = connection->daemon->nonce_nc_size;
-  if (0 == mod)
+  /* the map and its locks are shared with the worker daemons */
+  if (NULL != daemon->master)
+    daemon = daemon->master;
+  if (0 == daemon->nonce_nc_size)
     return MHD_NO; /* no array! */
-  /* super-fast xor-based "hash" function for HT lookup in nonce array */
-  off = 0;
-  np = nonce;
-  while ('\0' != *np)
+  sets = (daemon->nonce_nc_size + MHD_NONCE_NC_WAYS - 1) / MHD_NONCE_NC_WAYS;
+  /* FNV-1a hash of the nonce selects the set */
+  hash = 2166136261U;
+  for (np = nonce; '\0' != *np; np++)
     {
-      off = (off << 8) | (*np ^ (off >> 24));
-      np++;
+      hash ^= (unsigned char) *np;
+      hash *= 16777619U;
     }
-  off = off % mod;
+  off = hash % sets;
+  set = &daemon->nnc[off * MHD_NONCE_NC_WAYS];
+  lock = &daemon->nnc_locks->locks[off % MHD_NONCE_NC_LOCKS];
+  uses = &daemon->nnc_locks->uses[off % MHD_NONCE_NC_LOCKS];
   /*
    * Look for the nonce, if it does exist and its corresponding
-   * nonce counter is less than the current nonce counter by 1,
-   * then only increase the nonce counter by one.
+   * nonce counter is less than the current nonce counter,
+   * then update the nonce counter.
    */
-
-  (void) MHD_mutex_lock_ (&connection->daemon->nnc_lock);
+  MHD_prefork_mutex_lock_ (lock);
+  entry = NULL;
+  for (i = 0; i < MHD_NONCE_NC_WAYS; i++)
+    if (0 == strcmp (set[i].nonce, nonce))
+      {
+        entry = &set[i];
+        break;
+      }
   if (0 == nc)
     {
-      strcpy(connection->daemon->nnc[off].nonce,
-	     nonce);
-      connection->daemon->nnc[off].nc = 0;
-      (void) MHD_mutex_unlock_ (&connection->daemon->nnc_lock);
+      if (NULL == entry)
+        {
+          /* replace the least recently used entry of the set */
+          entry = &set[0];
+          for (i = 1; i < MHD_NONCE_NC_WAYS; i++)
+            if (set[i].last_use < entry->last_use)
+              entry = &set[i];
+          strcpy (entry->nonce,
+                  nonce);
+        }
+      entry->nc = 0;
+      entry->last_use = ++(*uses);
+      (void) MHD_mutex_unlock_ (lock);
       return MHD_YES;
     }
-  if ( (nc <= connection->daemon->nnc[off].nc) ||
-       (0 != strcmp(connection->daemon->nnc[off].nonce, nonce)) )
+  if ( (NULL == entry) ||
+       (nc <= entry->nc) )
     {
-      (void) MHD_mutex_unlock_ (&connection->daemon->nnc_lock);
+      (void) MHD_mutex_unlock_ (lock);
 #ifdef HAVE_MESSAGES
       MHD_DLOG (connection->daemon,
 		"Stale nonce received.  If this happens a lot, you should probably increase the size of the nonce array.\n");
 #endif
       return MHD_NO;
     }
-  connection->daemon->nnc[off].nc = nc;
-  (void) MHD_mutex_unlock_ (&connection->daemon->nnc_lock);
+  entry->nc = nc;
+  entry->last_use = ++(*uses);
+  (void) MHD_mutex_unlock_ (lock);
   return MHD_YES;
 }
 
@@ -371,9 +542,9 @@ MHD_digest_auth_get_username(struct MHD_Connection *connection)
   char user[MAX_USERNAME_LENGTH];
   const char *header;
 
-  if (NULL == (header = MHD_lookup_connection_value (connection,
-						     MHD_HEADER_KIND,
-						     MHD_HTTP_HEADER_AUTHORIZATION)))
+  if (NULL == (header = MHD_lookup_connection_token_value (connection,
+                                                           MHD_HEADER_KIND,
+                                                           MHD_HEADER_TOKEN_AUTHORIZATION)))
     return NULL;
   if (0 != strncmp (header, _BASE, strlen (_BASE)))
     return NULL;
@@ -442,7 +613,9 @@ calculate_nonce (uint32_t nonce_time,
  *
  * @param connection the connection
  * @param key the key
+ * @param key_size number of bytes in @a key
  * @param value the value, can be NULL
+ * @param value_size number of bytes in @a value
  * @param kind type of the header
  * @return #MHD_YES if the key-value pair is in the headers,
  *         #MHD_NO if not
@@ -450,7 +623,9 @@ calculate_nonce (uint32_t nonce_time,
 static int
 test_header (struct MHD_Connection *connection,
 	     const char *key,
+	     size_t key_size,
 	     const char *value,
+	     size_t value_size,
 	     enum MHD_ValueKind kind)
 {
   struct MHD_HTTP_Header *pos;
@@ -459,14 +634,16 @@ test_header (struct MHD_Connection *connection,
     {
       if (kind != pos->kind)
 	continue;
-      if (0 != strcmp (key, pos->header))
+      if ( (key_size != pos->header_size) ||
+           (0 != memcmp (key, pos->header, key_size)) )
 	continue;
       if ( (NULL == value) &&
 	   (NULL == pos->value) )
 	return MHD_YES;
       if ( (NULL == value) ||
 	   (NULL == pos->value) ||
-	   (0 != strcmp (value, pos->value)) )
+	   (value_size != pos->value_size) ||
+	   (0 != memcmp (value, pos->value, value_size)) )
 	continue;
       return MHD_YES;
     }
@@ -488,11 +665,17 @@ static int
 check_argument_match (struct MHD_Connection *connection,
 		      const char *args)
 {
-  struct MHD_HTTP_Header *pos;
   char *argb;
   unsigned int num_headers;
+  int num_args;
   int ret;
 
+  /* count first, this also parses the arguments if that was deferred
+     (#MHD_OPTION_LAZY_VALUE_PARSING) */
+  num_args = MHD_get_connection_values (connection,
+                                        MHD_GET_ARGUMENT_KIND,
+                                        NULL,
+                                        NULL);
   argb = strdup (args);
   if (NULL == argb)
     {
@@ -511,13 +694,7 @@ check_argument_match (struct MHD_Connection *connection,
   if (MHD_YES != ret)
     return MHD_NO;
   /* also check that the number of headers matches */
-  for (pos = connection->headers_received; NULL != pos; pos = pos->next)
-    {
-      if (MHD_GET_ARGUMENT_KIND != pos->kind)
-	continue;
-      num_headers--;
-    }
-  if (0 != num_headers)
+  if (num_headers != (unsigned int) num_args)
     {
       /* argument count mismatch */
       return MHD_NO;
@@ -527,24 +704,28 @@ check_argument_match (struct MHD_Connection *connection,
 
 
 /**
- * Authenticates the authorization header sent by the client
+ * Authenticates the authorization header sent by the client, given
+ * either the password or H(A1) of the user.
  *
  * @param connection The MHD connection structure
  * @param realm The realm presented to the client
  * @param username The username needs to be authenticated
- * @param password The password used in the authentication
+ * @param password The password used in the authentication,
+ *        NULL if @a digest is given
+ * @param digest H(A1) of the user (binary), NULL if @a password
+ *        is given
  * @param nonce_timeout The amount of time for a nonce to be
  * 			invalid in seconds
  * @return #MHD_YES if authenticated, #MHD_NO if not,
  * 			#MHD_INVALID_NONCE if nonce is invalid
- * @ingroup authentication
  */
-int
-MHD_digest_auth_check (struct MHD_Connection *connection,
-		       const char *realm,
-		       const char *username,
-		       const char *password,
-		       unsigned int nonce_timeout)
+static int
+digest_auth_check_all (struct MHD_Connection *connection,
+                       const char *realm,
+                       const char *username,
+                       const char *password,
+                       const uint8_t *digest,
+                       unsigned int nonce_timeout)
 {
   size_t len;
   const char *header;
@@ -563,9 +744,9 @@ MHD_digest_auth_check (struct MHD_Connection *connection,
   size_t left; /* number of characters left in 'header' for 'uri' */
   unsigned long int nci;
 
-  header = MHD_lookup_connection_value (connection,
-					MHD_HEADER_KIND,
-					MHD_HTTP_HEADER_AUTHORIZATION);
+  header = MHD_lookup_connection_token_value (connection,
+                                              MHD_HEADER_KIND,
+                                              MHD_HEADER_TOKEN_AUTHORIZATION);
   if (NULL == header)
     return MHD_NO;
   if (0 != strncmp(header, _BASE, strlen(_BASE)))
@@ -705,13 +886,14 @@ MHD_digest_auth_check (struct MHD_Connection *connection,
       return MHD_NO;
     }
 
-    digest_calc_ha1("md5",
-		    username,
-		    realm,
-		    password,
-		    nonce,
-		    cnonce,
-		    ha1);
+    if (NULL != digest)
+      cvthex (digest, MD5_DIGEST_SIZE, ha1);
+    else
+      get_ha1 (connection->daemon,
+               username,
+               realm,
+               password,
+               ha1);
     digest_calc_response (ha1,
 			  nonce,
 			  nc,
@@ -765,6 +947,66 @@ MHD_digest_auth_check (struct MHD_Connection *connection,
 }
 
 
+/**
+ * Authenticates the authorization header sent by the client
+ *
+ * @param connection The MHD connection structure
+ * @param realm The realm presented to the client
+ * @param username The username needs to be authenticated
+ * @param password The password used in the authentication
+ * @param nonce_timeout The amount of time for a nonce to be
+ * 			invalid in seconds
+ * @return #MHD_YES if authenticated, #MHD_NO if not,
+ * 			#MHD_INVALID_NONCE if nonce is invalid
+ * @ingroup authentication
+ */
+int
+MHD_digest_auth_check (struct MHD_Connection *connection,
+		       const char *realm,
+		       const char *username,
+		       const char *password,
+		       unsigned int nonce_timeout)
+{
+  return digest_auth_check_all (connection,
+                                realm,
+                                username,
+                                password,
+                                NULL,
+                                nonce_timeout);
+}
+
+
+/**
+ * Authenticates the authorization header sent by the client, given
+ * the binary MD5 of "username:realm:password" (H(A1)) instead of the
+ * password.
+ *
+ * @param connection The MHD connection structure
+ * @param realm The realm presented to the client
+ * @param username The username needs to be authenticated
+ * @param digest H(A1) of the user
+ * @param nonce_timeout The amount of time for a nonce to be
+ * 			invalid in seconds
+ * @return #MHD_YES if authenticated, #MHD_NO if not,
+ * 			#MHD_INVALID_NONCE if nonce is invalid
+ * @ingroup authentication
+ */
+int
+MHD_digest_auth_check_digest (struct MHD_Connection *connection,
+			      const char *realm,
+			      const char *username,
+			      const uint8_t digest[MHD_MD5_DIGEST_SIZE],
+			      unsigned int nonce_timeout)
+{
+  return digest_auth_check_all (connection,
+                                realm,
+                                username,
+                                NULL,
+                                digest,
+                                nonce_timeout);
+}
+
+
 /**
  * Queues a response to request authentication from the client
  *
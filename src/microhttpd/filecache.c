@@ -0,0 +1,487 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/filecache.c
+ * @brief  cache of shared responses for static files
+ * @author Christian Grothoff
+ */
+
+#include "internal.h"
+#include "response.h"
+#include "mhd_mono_clock.h"
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#if defined(_WIN32) && defined(MHD_W32_MUTEX_)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN 1
+#endif /* !WIN32_LEAN_AND_MEAN */
+#include <windows.h>
+#endif /* _WIN32 && MHD_W32_MUTEX_ */
+#if defined(_WIN32)
+#include <io.h> /* for read(), close() */
+#endif /* _WIN32 */
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+
+/**
+ * A cached file.
+ */
+struct FileCacheEntry
+{
+  /**
+   * Next entry in the same bucket.
+   */
+  struct FileCacheEntry *next;
+
+  /**
+   * Path of the file, allocated together with the entry.
+   */
+  const char *path;
+
+  /**
+   * Response for the file; the cache holds one reference.
+   */
+  struct MHD_Response *response;
+
+  /**
+   * When did we last check the file with stat()?
+   */
+  time_t checked;
+
+  /**
+   * Modification time of the file that @e response was created from.
+   */
+  time_t mtime;
+
+  /**
+   * Size of the file that @e response was created from.
+   */
+  uint64_t size;
+
+  /**
+   * Inode of the file that @e response was created from.
+   */
+  uint64_t ino;
+
+  /**
+   * Device of the file that @e response was created from.
+   */
+  uint64_t dev;
+};
+
+
+/**
+ * Handle for a cache of responses for static files.
+ */
+struct MHD_FileCache
+{
+  /**
+   * Hash table of the cached files.
+   */
+  struct FileCacheEntry **buckets;
+
+  /**
+   * Function to call for each new response, can be NULL.
+   */
+  MHD_FileCacheInitCallback init_cb;
+
+  /**
+   * Closure for @e init_cb.
+   */
+  void *init_cb_cls;
+
+  /**
+   * Files up to this size are kept in memory.
+   */
+  size_t small_file_size;
+
+  /**
+   * Number of elements in @e buckets.
+   */
+  unsigned int num_buckets;
+
+  /**
+   * Number of entries in the cache.
+   */
+  unsigned int num_entries;
+
+  /**
+   * Maximum number of entries in the cache.
+   */
+  unsigned int max_entries;
+
+  /**
+   * Seconds after which cached files are checked for changes.
+   */
+  unsigned int revalidate_interval;
+
+  /**
+   * Protects @e buckets and @e num_entries.
+   */
+  MHD_mutex_ lock;
+};
+
+
+/**
+ * Compute the bucket of @a path.
+ *
+ * @param cache cache to use
+ * @param path path to hash
+ * @return index into the buckets of @a cache
+ */
+static unsigned int
+hash_path (const struct MHD_FileCache *cache,
+           const char *path)
+{
+  uint32_t hash;
+
+  /* FNV-1a */
+  hash = 2166136261U;
+  while ('\0' != *path)
+    {
+      hash ^= (unsigned char) *(path++);
+      hash *= 16777619U;
+    }
+  return hash % cache->num_buckets;
+}
+
+
+/**
+ * Read a small file completely and create a response from its
+ * contents.
+ *
+ * @param fd file to read
+ * @param size size of the file
+ * @return NULL on error
+ */
+static struct MHD_Response *
+create_memory_response (int fd,
+                        size_t size)
+{
+  struct MHD_Response *response;
+  char *buf;
+  size_t off;
+  ssize_t got;
+
+  buf = malloc ((0 == size) ? 1 : size);
+  if (NULL == buf)
+    return NULL;
+  off = 0;
+  while (off < size)
+    {
+#ifndef _WIN32
+      got = read (fd, &buf[off], size - off);
+#else  /* _WIN32 */
+      got = read (fd, &buf[off], (unsigned int) (size - off));
+#endif /* _WIN32 */
+      if (got <= 0)
+        {
+          if ( (got < 0) &&
+               (EINTR == errno) )
+            continue;
+          free (buf);
+          return NULL;
+        }
+      off += got;
+    }
+  response = MHD_create_response_from_buffer (size,
+                                              buf,
+                                              MHD_RESPMEM_MUST_FREE);
+  if (NULL == response)
+    free (buf);
+  return response;
+}
+
+
+/**
+ * Open the file at @a path and create a new cache entry for it.
+ *
+ * @param cache cache to create the entry for
+ * @param path path of the file
+ * @return NULL on error (`errno` is set)
+ */
+static struct FileCacheEntry *
+create_entry (struct MHD_FileCache *cache,
+              const char *path)
+{
+  struct FileCacheEntry *entry;
+  struct stat sb;
+  size_t path_len;
+  int fd;
+  int err;
+
+  fd = open (path, O_RDONLY | O_BINARY | O_CLOEXEC);
+  if (-1 == fd)
+    return NULL;
+  if (0 != fstat (fd, &sb))
+    {
+      err = errno;
+      (void) close (fd);
+      errno = err;
+      return NULL;
+    }
+  if (! S_ISREG (sb.st_mode))
+    {
+      (void) close (fd);
+      errno = EISDIR;
+      return NULL;
+    }
+  path_len = strlen (path);
+  entry = malloc (sizeof (struct FileCacheEntry) + path_len + 1);
+  if (NULL == entry)
+    {
+      (void) close (fd);
+      errno = ENOMEM;
+      return NULL;
+    }
+  memcpy (&entry[1], path, path_len + 1);
+  entry->path = (const char *) &entry[1];
+  entry->next = NULL;
+  entry->checked = MHD_monotonic_sec_counter ();
+  entry->mtime = sb.st_mtime;
+  entry->size = (uint64_t) sb.st_size;
+  entry->ino = (uint64_t) sb.st_ino;
+  entry->dev = (uint64_t) sb.st_dev;
+  if (entry->size <= cache->small_file_size)
+    {
+      entry->response = create_memory_response (fd,
+                                                (size_t) entry->size);
+      (void) close (fd);
+    }
+  else
+    {
+      /* the response closes the file once it is destroyed */
+      entry->response = MHD_create_response_from_fd64 (entry->size,
+                                                       fd);
+      if (NULL == entry->response)
+        (void) close (fd);
+    }
+  if (NULL == entry->response)
+    {
+      free (entry);
+      errno = ENOMEM;
+      return NULL;
+    }
+  if ( (NULL != cache->init_cb) &&
+       (MHD_YES != cache->init_cb (cache->init_cb_cls,
+                                   entry->path,
+                                   entry->response)) )
+    {
+      MHD_destroy_response (entry->response);
+      free (entry);
+      errno = EPERM;
+      return NULL;
+    }
+  return entry;
+}
+
+
+/**
+ * Check if the file of @a entry changed since the response was
+ * created.
+ *
+ * @param entry entry to check
+ * @return #MHD_YES if the response is still valid
+ */
+static int
+entry_valid (const struct FileCacheEntry *entry)
+{
+  struct stat sb;
+
+  if (0 != stat (entry->path, &sb))
+    return MHD_NO;
+  if ( (entry->mtime != sb.st_mtime) ||
+       (entry->size != (uint64_t) sb.st_size) ||
+       (entry->ino != (uint64_t) sb.st_ino) ||
+       (entry->dev != (uint64_t) sb.st_dev) )
+    return MHD_NO;
+  return MHD_YES;
+}
+
+
+/**
+ * Create a cache of responses for static files.  The cache keeps
+ * the files open (or, for small files, their contents in memory), so
+ * that responses are not created with open(), fstat() and close()
+ * for every request.  The cache can be used from several threads.
+ *
+ * @param max_entries maximum number of files to cache; files
+ *        requested while the cache is full are not cached
+ * @param small_file_size files up to this size are kept in memory,
+ *        larger files are sent from the file descriptor (with
+ *        sendfile() if possible)
+ * @param revalidate_interval number of seconds after which the file
+ *        is checked with stat() for changes on the next request;
+ *        0 to check on every request
+ * @param init_cb function to call for each new response, can be NULL
+ * @param init_cb_cls closure for @a init_cb
+ * @return NULL on error (out of memory)
+ * @ingroup response
+ */
+struct MHD_FileCache *
+MHD_file_cache_create (unsigned int max_entries,
+                       size_t small_file_size,
+                       unsigned int revalidate_interval,
+                       MHD_FileCacheInitCallback init_cb,
+                       void *init_cb_cls)
+{
+  struct MHD_FileCache *cache;
+
+  cache = malloc (sizeof (struct MHD_FileCache));
+  if (NULL == cache)
+    return NULL;
+  memset (cache, 0, sizeof (struct MHD_FileCache));
+  cache->num_buckets = (max_entries < 16) ? 16 : max_entries;
+  cache->buckets = calloc (cache->num_buckets,
+                           sizeof (struct FileCacheEntry *));
+  if (NULL == cache->buckets)
+    {
+      free (cache);
+      return NULL;
+    }
+  if (MHD_YES != MHD_mutex_create_ (&cache->lock))
+    {
+      free (cache->buckets);
+      free (cache);
+      return NULL;
+    }
+  cache->max_entries = max_entries;
+  cache->small_file_size = small_file_size;
+  cache->revalidate_interval = revalidate_interval;
+  cache->init_cb = init_cb;
+  cache->init_cb_cls = init_cb_cls;
+  return cache;
+}
+
+
+/**
+ * Obtain the response for the file at @a path.  The response is
+ * shared with other requests for the same file and must not be
+ * changed; the caller must release it with #MHD_destroy_response()
+ * after queueing it.
+ *
+ * @param cache cache to use
+ * @param path path of the file
+ * @return NULL if the file cannot be opened or is not a regular
+ *         file (with `errno` set), or on error
+ * @ingroup response
+ */
+struct MHD_Response *
+MHD_file_cache_get_response (struct MHD_FileCache *cache,
+                             const char *path)
+{
+  struct FileCacheEntry *entry;
+  struct FileCacheEntry *prev;
+  struct MHD_Response *response;
+  unsigned int bucket;
+  time_t now;
+
+  bucket = hash_path (cache, path);
+  now = MHD_monotonic_sec_counter ();
+  (void) MHD_mutex_lock_ (&cache->lock);
+  prev = NULL;
+  for (entry = cache->buckets[bucket]; NULL != entry; entry = entry->next)
+    {
+      if (0 == strcmp (entry->path, path))
+        break;
+      prev = entry;
+    }
+  if ( (NULL != entry) &&
+       (now - entry->checked >= (time_t) cache->revalidate_interval) )
+    {
+      if (MHD_YES == entry_valid (entry))
+        {
+          entry->checked = now;
+        }
+      else
+        {
+          /* file changed, connections still sending the old
+             response keep their reference */
+          if (NULL == prev)
+            cache->buckets[bucket] = entry->next;
+          else
+            prev->next = entry->next;
+          cache->num_entries--;
+          MHD_destroy_response (entry->response);
+          free (entry);
+          entry = NULL;
+        }
+    }
+  if (NULL == entry)
+    {
+      entry = create_entry (cache,
+                            path);
+      if (NULL == entry)
+        {
+          (void) MHD_mutex_unlock_ (&cache->lock);
+          return NULL;
+        }
+      if (cache->num_entries >= cache->max_entries)
+        {
+          /* cache is full, hand out the only reference */
+          (void) MHD_mutex_unlock_ (&cache->lock);
+          response = entry->response;
+          free (entry);
+          return response;
+        }
+      entry->next = cache->buckets[bucket];
+      cache->buckets[bucket] = entry;
+      cache->num_entries++;
+    }
+  response = entry->response;
+  MHD_increment_response_rc (response);
+  (void) MHD_mutex_unlock_ (&cache->lock);
+  return response;
+}
+
+
+/**
+ * Destroy a file cache.  Responses obtained from the cache remain
+ * valid until they are destroyed.
+ *
+ * @param cache cache to destroy
+ * @ingroup response
+ */
+void
+MHD_file_cache_destroy (struct MHD_FileCache *cache)
+{
+  struct FileCacheEntry *entry;
+  unsigned int i;
+
+  for (i = 0; i < cache->num_buckets; i++)
+    while (NULL != (entry = cache->buckets[i]))
+      {
+        cache->buckets[i] = entry->next;
+        MHD_destroy_response (entry->response);
+        free (entry);
+      }
+  (void) MHD_mutex_destroy_ (&cache->lock);
+  free (cache->buckets);
+  free (cache);
+}
+
+/* end of filecache.c */
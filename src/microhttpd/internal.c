@@ -25,9 +25,8 @@
  */
 
 #include "internal.h"
+#include "mhd_log.h"
 
-#ifdef HAVE_MESSAGES
-#if DEBUG_STATES
 /**
  * State to string dictionary.
  */
@@ -74,6 +73,10 @@ MHD_state_to_string (enum MHD_CONNECTION_STATE state)
       return "footers sending";
     case MHD_CONNECTION_FOOTERS_SENT:
       return "footers sent";
+    case MHD_CONNECTION_UPGRADE:
+      return "upgraded";
+    case MHD_CONNECTION_HTTP2:
+      return "http/2";
     case MHD_CONNECTION_CLOSED:
       return "closed";
     case MHD_TLS_CONNECTION_INIT:
@@ -82,8 +85,6 @@ MHD_state_to_string (enum MHD_CONNECTION_STATE state)
       return "unrecognized connection state";
     }
 }
-#endif
-#endif
 
 #ifdef HAVE_MESSAGES
 /**
@@ -98,7 +99,10 @@ MHD_DLOG (const struct MHD_Daemon *daemon, const char *format, ...)
   if (0 == (daemon->options & MHD_USE_DEBUG))
     return;
   va_start (va, format);
-  daemon->custom_error_log (daemon->custom_error_log_cls, format, va);
+  if (NULL != daemon->log_queue)
+    MHD_log_queue_add_ (daemon->log_queue, format, va);
+  else
+    daemon->custom_error_log (daemon->custom_error_log_cls, format, va);
   va_end (va);
 }
 #endif
@@ -120,54 +124,153 @@ MHD_unescape_plus (char *arg)
 
 
 /**
- * Process escape sequences ('%HH') Updates val in place; the
- * result should be UTF-8 encoded and cannot be larger than the input.
- * The result must also still be 0-terminated.
+ * Get the value of a hexadecimal digit.
+ *
+ * @param c character to convert
+ * @return value of @a c, -1 if @a c is not a hexadecimal digit
+ */
+static int
+hex_value (char c)
+{
+  if ( (c >= '0') && (c <= '9') )
+    return c - '0';
+  if ( (c >= 'a') && (c <= 'f') )
+    return c - 'a' + 10;
+  if ( (c >= 'A') && (c <= 'F') )
+    return c - 'A' + 10;
+  return -1;
+}
+
+
+/**
+ * Process escape sequences ('%HH') and, if requested, convert '+'
+ * to ' ', in a single pass.  Runs of characters without escapes
+ * are found with strcspn() (which the C library vectorizes) and
+ * moved as a whole.
  *
  * @param val value to unescape (modified in the process)
- * @return length of the resulting val (strlen(val) maybe
- *  shorter afterwards due to elimination of escape sequences)
+ * @param reject characters that start an escape, "%" or "%+"
+ * @return length of the resulting val
  */
-size_t
-MHD_http_unescape (char *val)
+static size_t
+unescape (char *val,
+          const char *reject)
 {
   char *rpos = val;
   char *wpos = val;
-  char *end;
-  unsigned int num;
-  char buf3[3];
+  size_t run;
+  int hi;
+  int lo;
 
-  while ('\0' != *rpos)
+  while (1)
     {
+      run = strcspn (rpos, reject);
+      if (wpos != rpos)
+        memmove (wpos, rpos, run);
+      wpos += run;
+      rpos += run;
       switch (*rpos)
-	{
-	case '%':
+        {
+        case '\0':
+          *wpos = '\0'; /* add 0-terminator */
+          return wpos - val; /* = strlen(val) */
+        case '+':
+          *wpos++ = ' ';
+          rpos++;
+          break;
+        default: /* '%' */
           if ( ('\0' == rpos[1]) ||
                ('\0' == rpos[2]) )
-          {
-            *wpos = '\0';
-            return wpos - val;
-          }
-	  buf3[0] = rpos[1];
-	  buf3[1] = rpos[2];
-	  buf3[2] = '\0';
-	  num = strtoul (buf3, &end, 16);
-	  if ('\0' == *end)
-	    {
-	      *wpos = (char)((unsigned char) num);
-	      wpos++;
-	      rpos += 3;
-	      break;
-	    }
-	  /* intentional fall through! */
-	default:
-	  *wpos = *rpos;
-	  wpos++;
-	  rpos++;
-	}
+            {
+              *wpos = '\0';
+              return wpos - val;
+            }
+          hi = hex_value (rpos[1]);
+          lo = hex_value (rpos[2]);
+          if ( (hi < 0) || (lo < 0) )
+            {
+              /* not an escape sequence, keep the '%' */
+              *wpos++ = *rpos++;
+              break;
+            }
+          *wpos++ = (char) ((unsigned char) ((hi << 4) | lo));
+          rpos += 3;
+          break;
+        }
     }
-  *wpos = '\0'; /* add 0-terminator */
-  return wpos - val; /* = strlen(val) */
+}
+
+
+/**
+ * Process escape sequences ('%HH') Updates val in place; the
+ * result should be UTF-8 encoded and cannot be larger than the input.
+ * The result must also still be 0-terminated.
+ *
+ * @param val value to unescape (modified in the process)
+ * @return length of the resulting val (strlen(val) maybe
+ *  shorter afterwards due to elimination of escape sequences)
+ */
+size_t
+MHD_http_unescape (char *val)
+{
+  return unescape (val, "%");
+}
+
+
+/**
+ * Convert all occurences of '+' to ' ' and process escape sequences
+ * ('%HH'), in a single pass.  Same as #MHD_unescape_plus() followed
+ * by #MHD_http_unescape().
+ *
+ * @param val value to unescape (modified in the process)
+ * @return length of the resulting val
+ */
+size_t
+MHD_http_unescape_plus_ (char *val)
+{
+  return unescape (val, "%+");
+}
+
+
+/**
+ * Default #MHD_UnescapeCallback, uses #MHD_http_unescape().
+ *
+ * @param cls closure (use NULL)
+ * @param connection handle to connection, not used
+ * @param val value to unescape (modified in the process)
+ * @return length of the resulting val (strlen(val) maybe
+ *  shorter afterwards due to elimination of escape sequences)
+ */
+size_t
+MHD_default_unescape_ (void *cls,
+                       struct MHD_Connection *connection,
+                       char *val)
+{
+  return MHD_http_unescape (val);
+}
+
+
+/**
+ * Unescape an URI argument (key or value): convert '+' to ' ' and
+ * call the unescape callback of the daemon.  With the default
+ * callback, both are done in a single pass.
+ *
+ * @param connection connection the argument belongs to
+ * @param arg argument to unescape (modified in the process)
+ * @return length of the resulting @a arg
+ */
+static size_t
+unescape_argument (struct MHD_Connection *connection,
+                   char *arg)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+
+  if (&MHD_default_unescape_ == daemon->unescape_callback)
+    return MHD_http_unescape_plus_ (arg);
+  MHD_unescape_plus (arg);
+  return daemon->unescape_callback (daemon->unescape_callback_cls,
+                                    connection,
+                                    arg);
 }
 
 
@@ -192,9 +295,10 @@ MHD_parse_arguments_ (struct MHD_Connection *connection,
 		      MHD_ArgumentIterator_ cb,
 		      unsigned int *num_headers)
 {
-  struct MHD_Daemon *daemon = connection->daemon;
   char *equals;
   char *amper;
+  size_t key_size;
+  size_t value_size;
 
   *num_headers = 0;
   while ( (NULL != args) &&
@@ -208,13 +312,12 @@ MHD_parse_arguments_ (struct MHD_Connection *connection,
 	  if (NULL == equals)
 	    {
 	      /* last argument, without '=' */
-              MHD_unescape_plus (args);
-	      daemon->unescape_callback (daemon->unescape_callback_cls,
-					 connection,
-					 args);
+              key_size = unescape_argument (connection, args);
 	      if (MHD_YES != cb (connection,
 				 args,
+				 key_size,
 				 NULL,
+				 0,
 				 kind))
 		return MHD_NO;
 	      (*num_headers)++;
@@ -223,17 +326,13 @@ MHD_parse_arguments_ (struct MHD_Connection *connection,
 	  /* got 'foo=bar' */
 	  equals[0] = '\0';
 	  equals++;
-          MHD_unescape_plus (args);
-	  daemon->unescape_callback (daemon->unescape_callback_cls,
-				     connection,
-				     args);
-          MHD_unescape_plus (equals);
-	  daemon->unescape_callback (daemon->unescape_callback_cls,
-				     connection,
-				     equals);
-	  if (MHD_YES != cb (connection, 
+          key_size = unescape_argument (connection, args);
+          value_size = unescape_argument (connection, equals);
+	  if (MHD_YES != cb (connection,
 			     args,
+			     key_size,
 			     equals,
+			     value_size,
 			     kind))
 	    return MHD_NO;
 	  (*num_headers)++;
@@ -246,13 +345,12 @@ MHD_parse_arguments_ (struct MHD_Connection *connection,
 	   (equals >= amper) )
 	{
 	  /* got 'foo&bar' or 'foo&bar=val', add key 'foo' with NULL for value */
-          MHD_unescape_plus (args);
-	  daemon->unescape_callback (daemon->unescape_callback_cls,
-				     connection,
-				     args);
+          key_size = unescape_argument (connection, args);
 	  if (MHD_YES != cb (connection,
 			     args,
+			     key_size,
 			     NULL,
+			     0,
 			     kind))
 	    return MHD_NO;
 	  /* continue with 'bar' */
@@ -264,17 +362,13 @@ MHD_parse_arguments_ (struct MHD_Connection *connection,
 	 so we got regular 'foo=value&bar...'-kind of argument */
       equals[0] = '\0';
       equals++;
-      MHD_unescape_plus (args);
-      daemon->unescape_callback (daemon->unescape_callback_cls,
-				 connection,
-				 args);
-      MHD_unescape_plus (equals);
-      daemon->unescape_callback (daemon->unescape_callback_cls,
-				 connection,
-				 equals);
+      key_size = unescape_argument (connection, args);
+      value_size = unescape_argument (connection, equals);
       if (MHD_YES != cb (connection,
 			 args,
-			 equals, 
+			 key_size,
+			 equals,
+			 value_size,
 			 kind))
         return MHD_NO;
       (*num_headers)++;
@@ -283,4 +377,96 @@ MHD_parse_arguments_ (struct MHD_Connection *connection,
   return MHD_YES;
 }
 
+
+/**
+ * Well-known header names, indexed by #header_token_hash().
+ */
+static const struct
+{
+  /**
+   * Header name, NULL for unused slots.
+   */
+  const char *name;
+
+  /**
+   * Token of @e name.
+   */
+  enum MHD_HeaderToken token;
+} header_tokens[32] = {
+  { NULL, MHD_HEADER_TOKEN_NONE },
+  { NULL, MHD_HEADER_TOKEN_NONE },
+  { NULL, MHD_HEADER_TOKEN_NONE },
+  { NULL, MHD_HEADER_TOKEN_NONE },
+  { NULL, MHD_HEADER_TOKEN_NONE },
+  { MHD_HTTP_HEADER_TRANSFER_ENCODING, MHD_HEADER_TOKEN_TRANSFER_ENCODING },
+  { NULL, MHD_HEADER_TOKEN_NONE },
+  { MHD_HTTP_HEADER_ACCEPT, MHD_HEADER_TOKEN_ACCEPT },
+  { MHD_HTTP_HEADER_DATE, MHD_HEADER_TOKEN_DATE },
+  { MHD_HTTP_HEADER_COOKIE, MHD_HEADER_TOKEN_COOKIE },
+  { NULL, MHD_HEADER_TOKEN_NONE },
+  { MHD_HTTP_HEADER_EXPECT, MHD_HEADER_TOKEN_EXPECT },
+  { MHD_HTTP_HEADER_HOST, MHD_HEADER_TOKEN_HOST },
+  { MHD_HTTP_HEADER_CONNECTION, MHD_HEADER_TOKEN_CONNECTION },
+  { MHD_HTTP_HEADER_AUTHORIZATION, MHD_HEADER_TOKEN_AUTHORIZATION },
+  { MHD_HTTP_HEADER_CONTENT_TYPE, MHD_HEADER_TOKEN_CONTENT_TYPE },
+  { MHD_HTTP_HEADER_ACCEPT_ENCODING, MHD_HEADER_TOKEN_ACCEPT_ENCODING },
+  { MHD_HTTP_HEADER_CONTENT_LENGTH, MHD_HEADER_TOKEN_CONTENT_LENGTH },
+  { NULL, MHD_HEADER_TOKEN_NONE },
+  { MHD_HTTP_HEADER_CONTENT_ENCODING, MHD_HEADER_TOKEN_CONTENT_ENCODING },
+  { NULL, MHD_HEADER_TOKEN_NONE },
+  { NULL, MHD_HEADER_TOKEN_NONE },
+  { MHD_HTTP_HEADER_IF_NONE_MATCH, MHD_HEADER_TOKEN_IF_NONE_MATCH },
+  { MHD_HTTP_HEADER_RANGE, MHD_HEADER_TOKEN_RANGE },
+  { NULL, MHD_HEADER_TOKEN_NONE },
+  { NULL, MHD_HEADER_TOKEN_NONE },
+  { MHD_HTTP_HEADER_IF_MODIFIED_SINCE, MHD_HEADER_TOKEN_IF_MODIFIED_SINCE },
+  { NULL, MHD_HEADER_TOKEN_NONE },
+  { MHD_HTTP_HEADER_UPGRADE, MHD_HEADER_TOKEN_UPGRADE },
+  { NULL, MHD_HEADER_TOKEN_NONE },
+  { NULL, MHD_HEADER_TOKEN_NONE },
+  { MHD_HTTP_HEADER_USER_AGENT, MHD_HEADER_TOKEN_USER_AGENT }
+};
+
+
+/**
+ * Perfect hash of the well-known header names in #header_tokens,
+ * combining the length of a name with its first character.
+ *
+ * @param name header name
+ * @param len length of @a name, must be at least 1
+ * @return slot in #header_tokens
+ */
+static unsigned int
+header_token_hash (const char *name,
+                   size_t len)
+{
+  return (unsigned int) ((len + (((unsigned char) name[0]) | 0x20)) & 31);
+}
+
+
+/**
+ * Classify a header name.
+ *
+ * @param name header name, may be NULL
+ * @param name_size number of bytes in @a name
+ * @return token of @a name, #MHD_HEADER_TOKEN_NONE if it
+ *         is not a well-known header name
+ */
+enum MHD_HeaderToken
+MHD_get_header_token_ (const char *name,
+                       size_t name_size)
+{
+  unsigned int slot;
+
+  if ( (NULL == name) ||
+       (0 == name_size) )
+    return MHD_HEADER_TOKEN_NONE;
+  slot = header_token_hash (name, name_size);
+  if ( (NULL == header_tokens[slot].name) ||
+       (! MHD_str_equal_caseless_ (name,
+                                   header_tokens[slot].name)) )
+    return MHD_HEADER_TOKEN_NONE;
+  return header_tokens[slot].token;
+}
+
 /* end of internal.c */
@@ -31,14 +31,29 @@
 #include "microhttpd.h"
 #include "platform_interface.h"
 #if HTTPS_SUPPORT
+#if HTTPS_OPENSSL
+#include <openssl/ssl.h>
+#else
 #include <gnutls/gnutls.h>
 #if GNUTLS_VERSION_MAJOR >= 3
 #include <gnutls/abstract.h>
 #endif
+#if HAVE_GNUTLS_TRANSPORT_IS_KTLS_ENABLED
+#include <gnutls/socket.h>
+#endif
+#endif
 #endif
 #if EPOLL_SUPPORT
 #include <sys/epoll.h>
 #endif
+#if IO_URING_SUPPORT
+#include "mhd_io_uring.h"
+#endif
+#if KQUEUE_SUPPORT
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
 #if HAVE_NETINET_TCP_H
 /* for TCP_FASTOPEN */
 #include <netinet/tcp.h>
@@ -51,6 +66,31 @@
  */
 #define EXTRA_CHECKS MHD_NO
 
+/**
+ * Do we have an edge-triggered event loop (epoll() or kqueue()) that
+ * tracks the readiness of connections in their 'epoll_state' and
+ * runs the connections of the 'eready' list?
+ */
+#define MHD_EREADY_SUPPORT (EPOLL_SUPPORT || KQUEUE_SUPPORT)
+
+/**
+ * Can the daemon listen on Unix domain (AF_UNIX) sockets?
+ */
+#if HAVE_SYS_UN_H && defined(AF_UNIX)
+#define MHD_UNIX_SOCKETS 1
+#else
+#define MHD_UNIX_SOCKETS 0
+#endif
+
+/**
+ * Can listen sockets be passed to other processes (SCM_RIGHTS)?
+ */
+#if MHD_UNIX_SOCKETS && defined(SCM_RIGHTS)
+#define MHD_SOCKET_HANDOFF 1
+#else
+#define MHD_SOCKET_HANDOFF 0
+#endif
+
 #define MHD_MAX(a,b) (((a)<(b)) ? (b) : (a))
 #define MHD_MIN(a,b) (((a)<(b)) ? (a) : (b))
 
@@ -65,6 +105,45 @@
 #define MHD_BUF_INC_SIZE 1024
 
 
+/**
+ * Number of size classes in the histogram of request header sizes
+ * kept for #MHD_OPTION_ADAPTIVE_READ_BUFFER; class i counts headers
+ * of up to 256 << i bytes, the last class all larger ones.
+ */
+#define MHD_HEADER_SIZE_CLASSES 16
+
+/**
+ * Number of requests whose header sizes must have been seen before
+ * #MHD_OPTION_ADAPTIVE_READ_BUFFER sizes read buffers by them.
+ */
+#define MHD_HEADER_SIZE_MIN_SAMPLES 16
+
+/**
+ * Number of samples in the histogram of header sizes after which
+ * all counts are halved, so that the estimate follows changes in
+ * the traffic.
+ */
+#define MHD_HEADER_SIZE_WINDOW 1024
+
+
+/**
+ * Number of slots (of #MHD_TIMER_WHEEL_TICK each) in the timer wheel
+ * used for connections with custom timeouts.
+ */
+#define MHD_TIMER_WHEEL_SIZE 256
+
+/**
+ * Width of a slot of the timer wheel, in milliseconds.
+ */
+#define MHD_TIMER_WHEEL_TICK 100
+
+/**
+ * Length of the windows, in milliseconds, over which
+ * #MHD_OPTION_MIN_DATA_RATE is enforced.
+ */
+#define MHD_DATA_RATE_WINDOW 5000
+
+
 /**
  * Handler for fatal errors.
  */
@@ -102,6 +181,97 @@ extern void *mhd_panic_cls;
 #endif
 
 
+#ifdef HAVE_ATOMIC_BUILTINS
+/**
+ * Add @a n to the counter @a field of the statistics of @a daemon
+ * (see #MHD_DAEMON_INFO_STATS).  The counters of a daemon are
+ * updated by its own thread, but also by connection, handler and
+ * handshake threads; nothing is ordered by them, so relaxed atomics
+ * suffice.
+ *
+ * @param daemon daemon (or worker) to count for
+ * @param field member of `struct MHD_DaemonStats`
+ * @param n value to add
+ */
+#define MHD_STATS_ADD_(daemon,field,n) \
+  ((void) __atomic_add_fetch (&(daemon)->stats->field, (uint64_t) (n), __ATOMIC_RELAXED))
+
+/**
+ * Subtract @a n from the counter @a field of the statistics of
+ * @a daemon.
+ *
+ * @param daemon daemon (or worker) to count for
+ * @param field member of `struct MHD_DaemonStats`
+ * @param n value to subtract
+ */
+#define MHD_STATS_SUB_(daemon,field,n) \
+  ((void) __atomic_sub_fetch (&(daemon)->stats->field, (uint64_t) (n), __ATOMIC_RELAXED))
+
+/**
+ * Add @a n to the counter @a counter of a latency histogram (see
+ * #MHD_get_latency_histogram()), like #MHD_STATS_ADD_().
+ *
+ * @param counter `uint64_t` to add to
+ * @param n value to add
+ */
+#define MHD_LATENCY_ADD_(counter,n) \
+  ((void) __atomic_add_fetch (&(counter), (uint64_t) (n), __ATOMIC_RELAXED))
+#else
+#define MHD_STATS_ADD_(daemon,field,n) \
+  ((void) ((daemon)->stats->field += (uint64_t) (n)))
+#define MHD_STATS_SUB_(daemon,field,n) \
+  ((void) ((daemon)->stats->field -= (uint64_t) (n)))
+#define MHD_LATENCY_ADD_(counter,n) \
+  ((void) ((counter) += (uint64_t) (n)))
+#endif
+
+/**
+ * Count @a n bytes transferred on @a connection, in the statistics of
+ * its daemon, for #MHD_OPTION_MIN_DATA_RATE and for the timeline of
+ * #MHD_OPTION_SLOW_REQUEST_CALLBACK.
+ *
+ * @param connection connection the bytes were transferred on
+ * @param field `bytes_sent` or `bytes_received`
+ * @param n number of bytes
+ */
+#define MHD_COUNT_IO_(connection,field,n) do { \
+  MHD_STATS_ADD_ ((connection)->daemon, field, n); \
+  (connection)->io_bytes += (uint64_t) (n); \
+  if (NULL != (connection)->slow_request) { \
+    (connection)->slow_request->field += (uint64_t) (n); \
+    (connection)->slow_request->field ## _calls++; } } while (0)
+
+
+/**
+ * Value of a boolean TCP option of the socket of a connection, as
+ * last set by MHD.  Used to skip setsockopt() calls that would not
+ * change anything.
+ */
+enum MHD_SocketOptionState
+{
+  /**
+   * Not set by MHD yet, or setting it failed.
+   */
+  MHD_SOCKOPT_UNKNOWN = 0,
+
+  /**
+   * The option is disabled.
+   */
+  MHD_SOCKOPT_OFF = 1,
+
+  /**
+   * The option is enabled.
+   */
+  MHD_SOCKOPT_ON = 2,
+
+  /**
+   * The socket has no such option (not a TCP socket, for example
+   * an AF_UNIX socket); MHD never tries to set it.
+   */
+  MHD_SOCKOPT_UNSUPPORTED = 3
+};
+
+
 /**
  * State of the socket with respect to epoll (bitmask).
  */
@@ -139,7 +309,14 @@ enum MHD_EpollState
     /**
      * Is this connection currently suspended?
      */
-    MHD_EPOLL_STATE_SUSPENDED = 16
+    MHD_EPOLL_STATE_SUSPENDED = 16,
+
+    /**
+     * The connection was cleaned up, but the io_uring poll request
+     * for its socket is still being cancelled; the connection is
+     * freed once the final completion of that request arrives.
+     */
+    MHD_EPOLL_STATE_URING_ZOMBIE = 32
   };
 
 
@@ -166,10 +343,97 @@ enum MHD_ConnectionEventLoopInfo
     /**
      * We are finished and are awaiting cleanup.
      */
-    MHD_EVENT_LOOP_INFO_CLEANUP = 3
+    MHD_EVENT_LOOP_INFO_CLEANUP = 3,
+
+    /**
+     * We are waiting for a rate limit to allow more data (see
+     * `struct MHD_TokenBucket`), the socket is not watched until
+     * then.
+     */
+    MHD_EVENT_LOOP_INFO_THROTTLED = 4
   };
 
 
+/**
+ * What the guard of a connection against slow clients watches (see
+ * #MHD_OPTION_HEADER_TIMEOUT_MS and #MHD_OPTION_MIN_DATA_RATE).  The
+ * guard wheel also holds the deadlines of suspended connections.
+ */
+enum MHD_GuardPhase
+{
+  /**
+   * Nothing to watch: the connection is idle, or waiting for the
+   * application.
+   */
+  MHD_GUARD_NONE = 0,
+
+  /**
+   * The headers of a request are being received.
+   */
+  MHD_GUARD_HEADER = 1,
+
+  /**
+   * A body is being received or a response sent.
+   */
+  MHD_GUARD_RATE = 2,
+
+  /**
+   * The connection is suspended with a deadline, see
+   * #MHD_suspend_connection_with_timeout().
+   */
+  MHD_GUARD_SUSPEND = 3
+};
+
+
+/**
+ * State of a request answered with #MHD_defer_response().
+ */
+enum MHD_DeferState
+{
+  /**
+   * The request was not deferred.
+   */
+  MHD_DEFER_NONE = 0,
+
+  /**
+   * Waiting for #MHD_complete_response().
+   */
+  MHD_DEFER_WAITING = 1,
+
+  /**
+   * #MHD_complete_response() is storing the response.
+   */
+  MHD_DEFER_COMPLETING = 2,
+
+  /**
+   * The response is stored and is to be queued by the event loop.
+   */
+  MHD_DEFER_COMPLETE = 3
+};
+
+
+/**
+ * State of the block of the body read ahead for #MHD_RF_PREFETCH.
+ */
+enum MHD_PrefetchState
+{
+  /**
+   * No block is being read ahead.
+   */
+  MHD_PREFETCH_IDLE = 0,
+
+  /**
+   * A handler thread was asked to read the block, or reads it.
+   */
+  MHD_PREFETCH_BUSY = 1,
+
+  /**
+   * The block was read and can be taken by the event loop.
+   */
+  MHD_PREFETCH_DONE = 2
+};
+
+
 /**
  * Maximum length of a nonce in digest authentication.  32(MD5 Hex) +
  * 8(Timestamp Hex) + 1(NULL); hence 41 should suffice, but Opera
@@ -179,6 +443,19 @@ enum MHD_ConnectionEventLoopInfo
 #define MAX_NONCE_LENGTH 129
 
 
+/**
+ * Number of entries in each set of the nonce-nc map; a nonce may be
+ * stored in any entry of the set selected by its hash.
+ */
+#define MHD_NONCE_NC_WAYS 4
+
+/**
+ * Number of locks protecting the sets of the nonce-nc map; set i is
+ * protected by lock (i % MHD_NONCE_NC_LOCKS).
+ */
+#define MHD_NONCE_NC_LOCKS 16
+
+
 /**
  * A structure representing the internal holder of the
  * nonce-nc map.
@@ -192,6 +469,13 @@ struct MHD_NonceNc
    */
   unsigned long int nc;
 
+  /**
+   * Value of the use counter of the lock of the set when the entry
+   * was last used; the least recently used entry of a set is
+   * replaced by new nonces.
+   */
+  unsigned long int last_use;
+
   /**
    * Nonce value:
    */
@@ -199,6 +483,26 @@ struct MHD_NonceNc
 
 };
 
+
+/**
+ * Locks of the sets of the nonce-nc map, with their use counters.
+ */
+struct MHD_NonceNcLocks
+{
+
+  /**
+   * Lock i protects the sets with an index equal to i modulo
+   * #MHD_NONCE_NC_LOCKS.
+   */
+  MHD_mutex_ locks[MHD_NONCE_NC_LOCKS];
+
+  /**
+   * Use counters of the sets protected by each lock.
+   */
+  unsigned long int uses[MHD_NONCE_NC_LOCKS];
+
+};
+
 #ifdef HAVE_MESSAGES
 /**
  * fprintf()-like helper function for logging debug
@@ -210,6 +514,65 @@ MHD_DLOG (const struct MHD_Daemon *daemon,
 #endif
 
 
+/**
+ * Number of values in `enum MHD_HeaderToken`.
+ */
+#define MHD_HEADER_TOKEN_COUNT_ (MHD_HEADER_TOKEN_USER_AGENT + 1)
+
+
+/**
+ * A range of the body of a response requested by the client.
+ */
+struct MHD_Range
+{
+  /**
+   * Offset of the first byte of the range.
+   */
+  uint64_t start;
+
+  /**
+   * Offset after the last byte of the range.
+   */
+  uint64_t end;
+};
+
+
+/**
+ * Offset in the body of the response of connection @a c up to which
+ * we send: the end of the current range of a 206 response or the
+ * end of the body.
+ */
+#define MHD_BODY_END_(c) ( (0 != (c)->ranges_count)                \
+                           ? (c)->ranges[(c)->range_current].end    \
+                           : (c)->response->total_size )
+
+
+/**
+ * Block borrowed from the header overflow arena of a daemon for the
+ * read buffer of a request whose headers do not fit into the memory
+ * pool, see #MHD_OPTION_HEADER_OVERFLOW_ARENA.  The data follows the
+ * struct.
+ */
+struct MHD_OverflowBlock
+{
+  /**
+   * Block borrowed before, whose data may still hold header lines of
+   * the request.
+   */
+  struct MHD_OverflowBlock *next;
+
+  /**
+   * Number of bytes of data, charged to the arena.
+   */
+  size_t size;
+
+  /**
+   * Unused, aligns the data for any type.
+   */
+  size_t pad;
+};
+
+
 /**
  * Header or cookie in HTTP request or response.
  */
@@ -226,17 +589,135 @@ struct MHD_HTTP_Header
    */
   char *header;
 
+  /**
+   * Number of bytes in @e header, not including the 0-terminator.
+   */
+  size_t header_size;
+
   /**
    * The value of the header.
    */
   char *value;
 
+  /**
+   * Number of bytes in @e value, not including the 0-terminator.
+   */
+  size_t value_size;
+
   /**
    * Type of the header (where in the HTTP
    * protocol is this header from).
    */
   enum MHD_ValueKind kind;
 
+  /**
+   * Token of @e header if it is a well-known header name
+   * (only set for headers, footers and response headers).
+   */
+  enum MHD_HeaderToken token;
+
+};
+
+
+/**
+ * Number of error responses MHD creates at startup, see
+ * #MHD_connection_create_error_responses_().
+ */
+#define MHD_ERROR_RESPONSE_COUNT 6
+
+
+/**
+ * Weight of the averages from which overload is detected, see
+ * #MHD_OPTION_OVERLOAD_LATENCY: each new sample counts for
+ * 1/#MHD_OVERLOAD_AVG_SCALE.
+ */
+#define MHD_OVERLOAD_AVG_SCALE 8
+
+
+/**
+ * Serialized form of the parts of the response header that are the
+ * same for all connections sending a response: the status line,
+ * the 'Content-Length' header and the headers added by the
+ * application.  The data follows the struct in memory, in this order.
+ */
+struct MHD_HeaderCache
+{
+  /**
+   * Response code (including #MHD_ICY_FLAG) of the status line.
+   */
+  unsigned int code;
+
+  /**
+   * #MHD_YES if the status line is for HTTP/1.0.
+   */
+  int http_1_0;
+
+  /**
+   * Number of bytes in the status line (including CRLF).
+   */
+  size_t status_len;
+
+  /**
+   * Number of bytes in the 'Content-Length' header line, 0 if
+   * MHD must not add one for this response.
+   */
+  size_t content_length_len;
+
+  /**
+   * Number of bytes of the headers added by the application.
+   */
+  size_t headers_len;
+
+};
+
+
+/**
+ * Block of memory from which the headers and footers of a response
+ * are allocated, each entry together with its name and value.  The
+ * blocks are only freed with the response; the memory of a deleted
+ * header is not reused.  The data follows the struct in memory.
+ */
+struct MHD_HeaderArena
+{
+  /**
+   * Block allocated before this one, NULL for the first.
+   */
+  struct MHD_HeaderArena *next;
+
+  /**
+   * Number of bytes of data in the block.
+   */
+  size_t size;
+
+  /**
+   * Number of bytes of data allocated.
+   */
+  size_t used;
+
+};
+
+
+/**
+ * Alternative encoding of the body of a response, see
+ * #MHD_add_response_variant().
+ */
+struct MHD_ResponseVariant
+{
+  /**
+   * Next variant, in the order they were added.
+   */
+  struct MHD_ResponseVariant *next;
+
+  /**
+   * Content coding of @e response, allocated together with
+   * this struct.
+   */
+  const char *encoding;
+
+  /**
+   * Response with the encoded body; we hold one reference.
+   */
+  struct MHD_Response *response;
 };
 
 
@@ -253,6 +734,12 @@ struct MHD_Response
    */
   struct MHD_HTTP_Header *first_header;
 
+  /**
+   * Memory of the entries in @e first_header, most recently
+   * allocated block first; NULL if no header was added yet.
+   */
+  struct MHD_HeaderArena *header_arena;
+
   /**
    * Buffer pointing to data that we are supposed
    * to send as a response.
@@ -278,8 +765,9 @@ struct MHD_Response
   MHD_ContentReaderFreeCallback crfc;
 
   /**
-   * Mutex to synchronize access to @e data, @e size and
-   * @e reference_count.
+   * Mutex to synchronize access to @e data and @e size of responses
+   * created with a content reader callback, and to @e reference_count
+   * if atomic operations are not available.
    */
   MHD_mutex_ mutex;
 
@@ -312,7 +800,7 @@ struct MHD_Response
 
   /**
    * Reference count for this response.  Free once the counter hits
-   * zero.
+   * zero.  Updated atomically if #HAVE_ATOMIC_BUILTINS.
    */
   unsigned int reference_count;
 
@@ -322,10 +810,153 @@ struct MHD_Response
   int fd;
 
   /**
-   * Flags set for the MHD response.
+   * #MHD_YES if @e fd is the read end of a pipe or a socket given to
+   * #MHD_create_response_from_pipe(): the body is read until the end
+   * of the stream and can only be sent once.
+   */
+  int is_pipe;
+
+  /**
+   * Read-only mapping of @e fd if this response was created with
+   * #MHD_create_response_from_memfd(), NULL otherwise.
+   */
+  void *memfd_map;
+
+  /**
+   * Fragments of the body if this response was created with
+   * #MHD_create_response_from_iovec(), otherwise NULL.
+   */
+  struct MHD_IoVec *data_iov;
+
+  /**
+   * Number of elements in @e data_iov.
+   */
+  unsigned int data_iovcnt;
+
+  /**
+   * Application function to call to release the fragments
+   * in @e data_iov, can be NULL.
+   */
+  MHD_ContentReaderFreeCallback data_iov_free_cb;
+
+  /**
+   * Closure for @e data_iov_free_cb.
+   */
+  void *data_iov_free_cls;
+
+  /**
+   * Flags set for the MHD response.
    */
   enum MHD_ResponseFlags flags;
 
+  /**
+   * Application function to call once we are done sending the headers
+   * of the response; NULL unless this is a response created with
+   * #MHD_create_response_for_upgrade().
+   */
+  MHD_UpgradeHandler upgrade_handler;
+
+  /**
+   * Closure for @e upgrade_handler.
+   */
+  void *upgrade_handler_cls;
+
+  /**
+   * Broadcast sent as the body if this response was created with
+   * #MHD_create_response_from_broadcast(), otherwise NULL.
+   */
+  struct MHD_Broadcast *broadcast;
+
+  /**
+   * Stream written by the application as the body if this response
+   * was created with #MHD_create_response_stream(), otherwise NULL.
+   */
+  struct MHD_ResponseStream *stream;
+
+  /**
+   * Serialized header, created when the response is first sent and
+   * discarded whenever a header is added or removed; NULL if not yet
+   * created.  Set under @e mutex, read atomically if
+   * #HAVE_ATOMIC_BUILTINS.
+   */
+  struct MHD_HeaderCache *header_cache;
+
+  /**
+   * Alternative encodings of the body, one of them is sent
+   * instead of this response if the client accepts it; NULL if
+   * there are none.
+   */
+  struct MHD_ResponseVariant *variants;
+
+  /**
+   * zlib compression level for the body if the client accepts it,
+   * 0 to send the body as is.  See #MHD_RO_COMPRESSION_LEVEL.
+   */
+  int compression_level;
+
+  /**
+   * Milliseconds the response may be served from the response cache
+   * of the daemon, 0 if it is not cached.  See #MHD_RO_CACHE_TTL.
+   */
+  unsigned int cache_ttl;
+
+  /**
+   * Milliseconds after @e cache_ttl during which the response may
+   * still be served while it is being refreshed.  See
+   * #MHD_RO_CACHE_STALE_WHILE_REVALIDATE.
+   */
+  unsigned int cache_stale;
+
+};
+
+
+/**
+ * Token bucket limiting the rate at which data is sent or received,
+ * see #MHD_OPTION_SEND_RATE_LIMIT and
+ * #MHD_CONNECTION_OPTION_SEND_RATE_LIMIT.
+ */
+struct MHD_TokenBucket
+{
+
+  /**
+   * Bytes per second, 0 for no limit.
+   */
+  uint64_t rate;
+
+  /**
+   * Number of bytes that can be transferred right now, at most a
+   * tenth of a second worth of data.
+   */
+  uint64_t tokens;
+
+  /**
+   * #MHD_monotonic_msec_counter() value up to which tokens were
+   * added.
+   */
+  uint64_t last_refill;
+
+};
+
+
+/**
+ * Handle given to the application to manage special actions relating
+ * to MHD responses that "upgrade" the HTTP protocol (i.e. to
+ * WebSockets).  Allocated from the memory pool of the connection.
+ */
+struct MHD_UpgradeResponseHandle
+{
+  /**
+   * The connection for which this is an upgrade handle.  Note that
+   * because a response may be shared over many connections, this may
+   * not be the only upgrade handle for the response of this connection.
+   */
+  struct MHD_Connection *connection;
+
+  /**
+   * Set to #MHD_YES after the application finished with the socket
+   * by #MHD_UPGRADE_ACTION_CLOSE.
+   */
+  int was_closed;
 };
 
 
@@ -447,12 +1078,24 @@ enum MHD_CONNECTION_STATE
   MHD_CONNECTION_FOOTERS_SENT = MHD_CONNECTION_FOOTERS_SENDING + 1,
 
   /**
-   * 19: This connection is to be closed.
+   * 19: The headers of an upgrade response were sent and the socket
+   * is now controlled by the application (connection is suspended).
+   */
+  MHD_CONNECTION_UPGRADE = MHD_CONNECTION_FOOTERS_SENT + 1,
+
+  /**
+   * 20: The connection speaks HTTP/2; the requests are processed by
+   * its session (see #MHD_USE_HTTP2).
    */
-  MHD_CONNECTION_CLOSED = MHD_CONNECTION_FOOTERS_SENT + 1,
+  MHD_CONNECTION_HTTP2 = MHD_CONNECTION_UPGRADE + 1,
 
   /**
-   * 20: This connection is finished (only to be freed)
+   * 21: This connection is to be closed.
+   */
+  MHD_CONNECTION_CLOSED = MHD_CONNECTION_HTTP2 + 1,
+
+  /**
+   * 22: This connection is finished (only to be freed)
    */
   MHD_CONNECTION_IN_CLEANUP = MHD_CONNECTION_CLOSED + 1,
 
@@ -475,12 +1118,15 @@ enum MHD_CONNECTION_STATE
 #define DEBUG_STATES MHD_NO
 
 
-#ifdef HAVE_MESSAGES
-#if DEBUG_STATES
+/**
+ * Get the name of a connection state, for debugging and
+ * #MHD_OPTION_SLOW_REQUEST_CALLBACK.
+ *
+ * @param state the state
+ * @return name of @a state
+ */
 const char *
 MHD_state_to_string (enum MHD_CONNECTION_STATE state);
-#endif
-#endif
 
 /**
  * Function to receive plaintext data.
@@ -511,22 +1157,76 @@ typedef ssize_t
 
 
 /**
- * State kept for each HTTP request.
+ * A step of the request processing that calls the access handler of
+ * the application (see #MHD_OPTION_HANDLER_THREADS).
+ *
+ * @param connection connection we're processing
  */
-struct MHD_Connection
+typedef void
+(*MHD_HandlerStep) (struct MHD_Connection *connection);
+
+
+/**
+ * Timeline of the current request of a connection, see
+ * #MHD_OPTION_SLOW_REQUEST_CALLBACK.  Allocated when the first
+ * request of the connection starts, and only used by the thread
+ * processing the connection.
+ */
+struct MHD_SlowRequestState
 {
+  /**
+   * Bytes received for the request (counted with #MHD_COUNT_IO_()).
+   */
+  uint64_t bytes_received;
 
-#if EPOLL_SUPPORT
   /**
-   * Next pointer for the EDLL listing connections that are epoll-ready.
+   * Bytes sent for the request.
    */
-  struct MHD_Connection *nextE;
+  uint64_t bytes_sent;
 
   /**
-   * Previous pointer for the EDLL listing connections that are epoll-ready.
+   * Calls that received data for the request.
    */
-  struct MHD_Connection *prevE;
-#endif
+  unsigned int bytes_received_calls;
+
+  /**
+   * Calls that sent data for the request.
+   */
+  unsigned int bytes_sent_calls;
+
+  /**
+   * Times sendfile() fell back to send() for the request.
+   */
+  unsigned int sendfile_fallbacks;
+
+  /**
+   * Number of steps recorded for the request; the last
+   * #MHD_SLOW_REQUEST_STEPS of them are in @e steps.
+   */
+  unsigned int num_steps;
+
+  /**
+   * State of the connection at the last step.
+   */
+  enum MHD_CONNECTION_STATE state;
+
+  /**
+   * Ring of the last steps of the request.
+   */
+  struct MHD_SlowRequestStep steps[MHD_SLOW_REQUEST_STEPS];
+};
+
+
+/**
+ * State kept for each HTTP request.
+ */
+struct MHD_Connection
+{
+
+  /* Fields used for every connection in each iteration of the
+     event loop come first, so that walking the connections of a
+     daemon touches as few cache lines as possible; the state of
+     the request follows, rarely used fields come last. */
 
   /**
    * Next pointer for the DLL describing our IO state.
@@ -541,9 +1241,9 @@ struct MHD_Connection
   /**
    * Next pointer for the XDLL organizing connections by timeout.
    * This DLL can be either the
-   * 'manual_timeout_head/manual_timeout_tail' or the
-   * 'normal_timeout_head/normal_timeout_tail', depending on whether a
-   * custom timeout is set for the connection.
+   * 'normal_timeout_head/normal_timeout_tail' or one of the slots of
+   * the daemon's 'timer_wheel', depending on whether a custom timeout
+   * is set for the connection.
    */
   struct MHD_Connection *nextX;
 
@@ -552,115 +1252,115 @@ struct MHD_Connection
    */
   struct MHD_Connection *prevX;
 
+  /**
+   * Last time this connection had any activity
+   * (reading or writing), see #MHD_loop_time_().
+   */
+  uint64_t last_activity;
+
+  /**
+   * After how many milliseconds of inactivity should
+   * this connection time out?  Zero for no timeout.
+   */
+  uint64_t connection_timeout;
+
   /**
    * Reference to the MHD_Daemon struct.
    */
   struct MHD_Daemon *daemon;
 
   /**
-   * Linked list of parsed headers.
+   * Socket for this connection.  Set to #MHD_INVALID_SOCKET if
+   * this connection has died (daemon should clean
+   * up in that case).
    */
-  struct MHD_HTTP_Header *headers_received;
+  MHD_socket socket_fd;
 
   /**
-   * Tail of linked list of parsed headers.
+   * What is this connection waiting for?
    */
-  struct MHD_HTTP_Header *headers_received_tail;
+  enum MHD_ConnectionEventLoopInfo event_loop_info;
 
   /**
-   * Response to transmit (initially NULL).
+   * State in the FSM for this connection.
    */
-  struct MHD_Response *response;
+  enum MHD_CONNECTION_STATE state;
 
   /**
-   * The memory pool is created whenever we first read
-   * from the TCP stream and destroyed at the end of
-   * each request (and re-created for the next request).
-   * In the meantime, this pointer is NULL.  The
-   * pool is used for all connection-related data
-   * except for the response (which maybe shared between
-   * connections) and the IP address (which persists
-   * across individual requests).
+   * Index of the entry of this connection in the poll set of the
+   * daemon (see @e poll_fds of `struct MHD_Daemon`), 0 if the
+   * connection is not in the poll set.
    */
-  struct MemoryPool *pool;
+  unsigned int poll_slot;
 
   /**
-   * We allow the main application to associate some pointer with the
-   * HTTP request, which is passed to each #MHD_AccessHandlerCallback
-   * and some other API calls.  Here is where we store it.  (MHD does
-   * not know or care what it is).
+   * #MHD_YES if the socket of this connection is in the fd sets of
+   * the daemon (see @e fd_sets of `struct MHD_Daemon`).
    */
-  void *client_context;
+  int in_fd_sets;
 
+#if MHD_EREADY_SUPPORT
   /**
-   * We allow the main application to associate some pointer with the
-   * TCP connection (which may span multiple HTTP requests).  Here is
-   * where we store it.  (MHD does not know or care what it is).
-   * The location is given to the #MHD_NotifyConnectionCallback and
-   * also accessible via #MHD_CONNECTION_INFO_SOCKET_CONTEXT.
+   * What is the state of this socket in relation to epoll?
    */
-  void *socket_context;
+  enum MHD_EpollState epoll_state;
 
   /**
-   * Request method.  Should be GET/POST/etc.  Allocated
-   * in pool.
+   * Next pointer for the EDLL listing connections that are epoll-ready.
    */
-  char *method;
+  struct MHD_Connection *nextE;
 
   /**
-   * Requested URL (everything after "GET" only).  Allocated
-   * in pool.
+   * Previous pointer for the EDLL listing connections that are epoll-ready.
    */
-  char *url;
+  struct MHD_Connection *prevE;
+#endif
 
   /**
-   * HTTP version string (i.e. http/1.1).  Allocated
-   * in pool.
+   * Has this socket been closed for reading (i.e.  other side closed
+   * the connection)?  If so, we must completely close the connection
+   * once we are done sending our response (and stop trying to read
+   * from this socket).
    */
-  char *version;
+  int read_closed;
 
   /**
-   * Buffer for reading requests.   Allocated
-   * in pool.  Actually one byte larger than
-   * @e read_buffer_size (if non-NULL) to allow for
-   * 0-termination.
+   * Is the connection suspended?
    */
-  char *read_buffer;
+  int suspended;
 
   /**
-   * Buffer for writing response (headers only).  Allocated
-   * in pool.
+   * Handler used for processing read connection operations
    */
-  char *write_buffer;
+  int (*read_handler) (struct MHD_Connection *connection);
 
   /**
-   * Last incomplete header line during parsing of headers.
-   * Allocated in pool.  Only valid if state is
-   * either #MHD_CONNECTION_HEADER_PART_RECEIVED or
-   * #MHD_CONNECTION_FOOTER_PART_RECEIVED.
+   * Handler used for processing write connection operations
    */
-  char *last;
+  int (*write_handler) (struct MHD_Connection *connection);
 
   /**
-   * Position after the colon on the last incomplete header
-   * line during parsing of headers.
-   * Allocated in pool.  Only valid if state is
-   * either #MHD_CONNECTION_HEADER_PART_RECEIVED or
-   * #MHD_CONNECTION_FOOTER_PART_RECEIVED.
+   * Handler used for processing idle connection operations
    */
-  char *colon;
+  int (*idle_handler) (struct MHD_Connection *connection);
 
   /**
-   * Foreign address (of length @e addr_len).  MALLOCED (not
-   * in pool!).
+   * Function used for reading HTTP request stream.
    */
-  struct sockaddr *addr;
+  ReceiveCallback recv_cls;
 
   /**
-   * Thread handle for this connection (if we are using
-   * one thread per connection).
+   * Function used for writing HTTP response stream.
    */
-  MHD_thread_handle_ pid;
+  TransmitCallback send_cls;
+
+  /**
+   * Buffer for reading requests.   Allocated
+   * in pool.  Actually one byte larger than
+   * @e read_buffer_size (if non-NULL) to allow for
+   * 0-termination.
+   */
+  char *read_buffer;
 
   /**
    * Size of @e read_buffer (in bytes).  This value indicates
@@ -676,6 +1376,12 @@ struct MHD_Connection
    */
   size_t read_buffer_offset;
 
+  /**
+   * Buffer for writing response (headers only).  Allocated
+   * in pool.
+   */
+  char *write_buffer;
+
   /**
    * Size of @e write_buffer (in bytes).
    */
@@ -693,10 +1399,9 @@ struct MHD_Connection
   size_t write_buffer_append_offset;
 
   /**
-   * How many more bytes of the body do we expect
-   * to read? #MHD_SIZE_UNKNOWN for unknown.
+   * Response to transmit (initially NULL).
    */
-  uint64_t remaining_upload_size;
+  struct MHD_Response *response;
 
   /**
    * Current write position in the actual response
@@ -706,606 +1411,2440 @@ struct MHD_Connection
   uint64_t response_write_position;
 
   /**
-   * Position in the 100 CONTINUE message that
-   * we need to send when receiving http 1.1 requests.
+   * The memory pool is created whenever we first read
+   * from the TCP stream and destroyed at the end of
+   * each request (and re-created for the next request).
+   * In the meantime, this pointer is NULL.  The
+   * pool is used for all connection-related data
+   * except for the response (which maybe shared between
+   * connections) and the IP address (which persists
+   * across individual requests).
    */
-  size_t continue_message_write_offset;
+  struct MemoryPool *pool;
 
   /**
-   * Length of the foreign address.
+   * Slot of the daemon's timer wheel this connection is in; only
+   * valid if the connection has a non-zero custom timeout.
    */
-  socklen_t addr_len;
+  unsigned int timer_wheel_slot;
 
   /**
-   * Last time this connection had any activity
-   * (reading or writing).
+   * Bytes received and sent on this connection, for
+   * #MHD_OPTION_MIN_DATA_RATE.
    */
-  time_t last_activity;
+  uint64_t io_bytes;
 
   /**
-   * After how many seconds of inactivity should
-   * this connection time out?  Zero for no timeout.
+   * Timeline of the current request, see
+   * #MHD_OPTION_SLOW_REQUEST_CALLBACK; NULL if not sampled.
    */
-  unsigned int connection_timeout;
+  struct MHD_SlowRequestState *slow_request;
 
   /**
-   * Did we ever call the "default_handler" on this connection?  (this
-   * flag will determine if we call the #MHD_OPTION_NOTIFY_COMPLETED
-   * handler when the connection closes down).
+   * Microseconds the TLS handshake took, for
+   * #MHD_OPTION_SLOW_REQUEST_CALLBACK.
    */
-  int client_aware;
+  uint64_t tls_handshake_usec;
 
   /**
-   * Socket for this connection.  Set to #MHD_INVALID_SOCKET if
-   * this connection has died (daemon should clean
-   * up in that case).
+   * Next pointer for the XDLL of the slot of the daemon's guard
+   * wheel this connection is in.
    */
-  MHD_socket socket_fd;
+  struct MHD_Connection *nextG;
 
   /**
-   * Has this socket been closed for reading (i.e.  other side closed
-   * the connection)?  If so, we must completely close the connection
-   * once we are done sending our response (and stop trying to read
-   * from this socket).
+   * Previous pointer for the XDLL of the guard wheel slot.
    */
-  int read_closed;
+  struct MHD_Connection *prevG;
 
   /**
-   * Set to #MHD_YES if the thread has been joined.
+   * When the guard against slow clients checks this connection next
+   * (see #MHD_loop_time_()); 0 if it is not armed (and not in the
+   * guard wheel of the daemon).
    */
-  int thread_joined;
+  uint64_t guard_deadline;
 
   /**
-   * Are we currently inside the "idle" handler (to avoid recursively
-   * invoking it).
+   * Value of @e io_bytes at the start of the current window of
+   * #MHD_OPTION_MIN_DATA_RATE.
    */
-  int in_idle;
+  uint64_t guard_bytes;
 
-#if EPOLL_SUPPORT
   /**
-   * What is the state of this socket in relation to epoll?
+   * What the guard watches, see @e guard_deadline.
    */
-  enum MHD_EpollState epoll_state;
-#endif
+  enum MHD_GuardPhase guard_phase;
 
   /**
-   * State in the FSM for this connection.
+   * Slot of the daemon's guard wheel this connection is in; only
+   * valid if @e guard_deadline is not 0.
    */
-  enum MHD_CONNECTION_STATE state;
+  unsigned int guard_slot;
 
   /**
-   * What is this connection waiting for?
+   * Events last reported for this connection to the
+   * #MHD_NotifySocketCallback of the daemon (see
+   * #MHD_OPTION_NOTIFY_SOCKET), #MHD_SOCKET_INTEREST_REMOVE if the
+   * socket was not reported yet.
    */
-  enum MHD_ConnectionEventLoopInfo event_loop_info;
+  unsigned int socket_interest;
 
   /**
-   * HTTP response code.  Only valid if response object
-   * is already set.
+   * State the application keeps for the socket of this connection,
+   * see #MHD_NotifySocketCallback.
    */
-  unsigned int responseCode;
+  void *socket_interest_cls;
 
   /**
-   * Set to #MHD_YES if the response's content reader
-   * callback failed to provide data the last time
-   * we tried to read from it.  In that case, the
-   * write socket should be marked as unready until
-   * the CRC call succeeds.
+   * Priority class of this connection, see
+   * #MHD_CONNECTION_OPTION_PRIORITY.
    */
-  int response_unready;
+  enum MHD_ConnectionPriority priority;
 
   /**
-   * Are we receiving with chunked encoding?  This will be set to
-   * #MHD_YES after we parse the headers and are processing the body
-   * with chunks.  After we are done with the body and we are
-   * processing the footers; once the footers are also done, this will
-   * be set to #MHD_NO again (before the final call to the handler).
+   * Limit for the data sent on this connection (in addition to the
+   * one of the daemon), see #MHD_CONNECTION_OPTION_SEND_RATE_LIMIT.
    */
-  int have_chunked_upload;
+  struct MHD_TokenBucket send_bucket;
 
   /**
-   * If we are receiving with chunked encoding, where are we right
-   * now?  Set to 0 if we are waiting to receive the chunk size;
-   * otherwise, this is the size of the current chunk.  A value of
-   * zero is also used when we're at the end of the chunks.
+   * Limit for the data received on this connection, see
+   * #MHD_CONNECTION_OPTION_RECV_RATE_LIMIT.
    */
-  size_t current_chunk_size;
+  struct MHD_TokenBucket recv_bucket;
 
   /**
-   * If we are receiving with chunked encoding, where are we currently
-   * with respect to the current chunk (at what offset / position)?
+   * #MHD_monotonic_msec_counter() value at which the rate limit
+   * allows more data, 0 if the connection is not throttled.
    */
-  size_t current_chunk_offset;
+  uint64_t throttle_wake;
 
   /**
-   * Handler used for processing read connection operations
+   * Next connection in the DLL of throttled connections of the
+   * daemon (not used with #MHD_USE_THREAD_PER_CONNECTION).
    */
-  int (*read_handler) (struct MHD_Connection *connection);
+  struct MHD_Connection *throttle_next;
 
   /**
-   * Handler used for processing write connection operations
+   * Previous connection in the DLL of throttled connections.
    */
-  int (*write_handler) (struct MHD_Connection *connection);
+  struct MHD_Connection *throttle_prev;
 
   /**
-   * Handler used for processing idle connection operations
+   * Next connection in the list of connections resumed during an
+   * iteration of an event loop driven by #MHD_run_socket(), which
+   * need to be processed once before waiting for their sockets.
    */
-  int (*idle_handler) (struct MHD_Connection *connection);
+  struct MHD_Connection *resumed_next;
 
   /**
-   * Function used for reading HTTP request stream.
+   * #MHD_YES while the connection is handed over to another worker
+   * of the thread pool, see #MHD_OPTION_CONNECTION_REBALANCE.
    */
-  ReceiveCallback recv_cls;
+  int migrating;
 
   /**
-   * Function used for writing HTTP response stream.
+   * Linked list of parsed headers.
    */
-  TransmitCallback send_cls;
+  struct MHD_HTTP_Header *headers_received;
 
-#if HTTPS_SUPPORT
   /**
-   * State required for HTTPS/SSL/TLS support.
+   * Tail of linked list of parsed headers.
    */
-  gnutls_session_t tls_session;
+  struct MHD_HTTP_Header *headers_received_tail;
 
   /**
-   * Memory location to return for protocol session info.
+   * Open-addressing hash table (in the pool) indexing the entries
+   * of @e headers_received by their case-insensitive name, built
+   * on the first lookup.  NULL if not (yet) available, lookups then
+   * walk the list.
    */
-  int protocol;
+  struct MHD_HTTP_Header **headers_index;
 
   /**
-   * Memory location to return for protocol session info.
+   * Number of slots in @e headers_index (a power of two).
    */
-  int cipher;
+  size_t headers_index_size;
 
   /**
-   * Could it be that we are ready to read due to TLS buffers
-   * even though the socket is not?
+   * Last entry of @e headers_received in @e headers_index.  Entries
+   * added once the index is half full are not indexed; lookups walk
+   * the list after this one for them.
    */
-  int tls_read_ready;
-#endif
+  struct MHD_HTTP_Header *headers_index_last;
 
   /**
-   * Is the connection suspended?
+   * #MHD_YES if the pool could not provide @e headers_index for
+   * the current request, so that it is not tried again.
    */
-  int suspended;
+  int headers_index_failed;
 
   /**
-   * Is the connection wanting to resume?
+   * Number of entries in @e headers_received.
    */
-  int resuming;
-};
+  size_t headers_received_count;
 
-/**
- * Signature of function called to log URI accesses.
- *
- * @param cls closure
- * @param uri uri being accessed
- * @param con connection handle
- * @return new closure
- */
-typedef void *
-(*LogCallback)(void *cls,
-               const char *uri,
-               struct MHD_Connection *con);
+  /**
+   * First header (of kind #MHD_HEADER_KIND) received for each
+   * well-known header token, NULL if there was none.
+   */
+  struct MHD_HTTP_Header *headers_by_token[MHD_HEADER_TOKEN_COUNT_];
 
-/**
- * Signature of function called to unescape URIs.  See also
- * #MHD_http_unescape().
- *
- * @param cls closure
- * @param conn connection handle
- * @param uri 0-terminated string to unescape (should be updated)
- * @return length of the resulting string
- */
-typedef size_t
-(*UnescapeCallback)(void *cls,
-                    struct MHD_Connection *conn,
-                    char *uri);
+  /**
+   * URI arguments (after the '?') that still need to be parsed, NULL
+   * if there are none or they were parsed already.  Only used with
+   * #MHD_OPTION_LAZY_VALUE_PARSING.
+   */
+  char *lazy_args;
 
+  /**
+   * #MHD_YES if the cookie header still needs to be parsed.  Only
+   * used with #MHD_OPTION_LAZY_VALUE_PARSING.
+   */
+  int lazy_cookies;
 
-/**
- * State kept for each MHD daemon.  All connections are kept in two
- * doubly-linked lists.  The first one reflects the state of the
- * connection in terms of what operations we are waiting for (read,
- * write, locally blocked, cleanup) whereas the second is about its
- * timeout state (default or custom).
- */
-struct MHD_Daemon
-{
+  /**
+   * Handle for the application after an upgrade response was sent,
+   * NULL unless the connection is in #MHD_CONNECTION_UPGRADE state.
+   */
+  struct MHD_UpgradeResponseHandle *urh;
 
   /**
-   * Callback function for all requests.
+   * HTTP/2 session of the connection, NULL unless the connection is
+   * in #MHD_CONNECTION_HTTP2 state.
    */
-  MHD_AccessHandlerCallback default_handler;
+  struct MHD_Http2Session *h2;
 
   /**
-   * Closure argument to default_handler.
+   * Stream of an HTTP/2 session this request was received on, NULL
+   * for HTTP/1.x.  The connection object then only represents the
+   * request; the socket belongs to the connection of the session.
    */
-  void *default_handler_cls;
+  struct MHD_Http2Stream *h2_stream;
 
   /**
-   * Head of doubly-linked list of our current, active connections.
+   * Next connection in the @e h2_wake list of the daemon.
    */
-  struct MHD_Connection *connections_head;
+  struct MHD_Connection *h2_wake_next;
 
   /**
-   * Tail of doubly-linked list of our current, active connections.
+   * #MHD_YES if the connection is in the @e h2_wake list of the
+   * daemon.  Protected by the cleanup mutex of the daemon.
    */
-  struct MHD_Connection *connections_tail;
+  int h2_woken;
 
   /**
-   * Head of doubly-linked list of our current but suspended connections.
+   * #MHD_YES once we know that the client does not start the
+   * connection with the HTTP/2 preface.
    */
-  struct MHD_Connection *suspended_connections_head;
+  int h2_checked;
 
   /**
-   * Tail of doubly-linked list of our current but suspended connections.
+   * Highest peak usage of the memory pools the connection released
+   * so far (its pool may be released while idle and obtained again),
+   * see #MHD_get_pool_usage_histogram().
    */
-  struct MHD_Connection *suspended_connections_tail;
+  size_t pool_peak;
 
   /**
-   * Head of doubly-linked list of connections to clean up.
+   * We allow the main application to associate some pointer with the
+   * HTTP request, which is passed to each #MHD_AccessHandlerCallback
+   * and some other API calls.  Here is where we store it.  (MHD does
+   * not know or care what it is).
    */
-  struct MHD_Connection *cleanup_head;
+  void *client_context;
 
   /**
-   * Tail of doubly-linked list of connections to clean up.
+   * Route of the request chosen by #MHD_router_access_handler(),
+   * NULL if the request was not routed (yet).
    */
-  struct MHD_Connection *cleanup_tail;
+  const struct MHD_Route *route;
 
-#if EPOLL_SUPPORT
   /**
-   * Head of EDLL of connections ready for processing (in epoll mode).
+   * We allow the main application to associate some pointer with the
+   * TCP connection (which may span multiple HTTP requests).  Here is
+   * where we store it.  (MHD does not know or care what it is).
+   * The location is given to the #MHD_NotifyConnectionCallback and
+   * also accessible via #MHD_CONNECTION_INFO_SOCKET_CONTEXT.
    */
-  struct MHD_Connection *eready_head;
+  void *socket_context;
 
   /**
-   * Tail of EDLL of connections ready for processing (in epoll mode)
+   * Request method.  Should be GET/POST/etc.  Allocated
+   * in pool.
    */
-  struct MHD_Connection *eready_tail;
-#endif
+  char *method;
 
   /**
-   * Head of the XDLL of ALL connections with a default ('normal')
-   * timeout, sorted by timeout (earliest at the tail, most recently
-   * used connection at the head).  MHD can just look at the tail of
-   * this list to determine the timeout for all of its elements;
-   * whenever there is an event of a connection, the connection is
-   * moved back to the tail of the list.
-   *
-   * All connections by default start in this list; if a custom
-   * timeout that does not match @e connection_timeout is set, they
-   * are moved to the @e manual_timeout_head-XDLL.
+   * Requested URL (everything after "GET" only).  Allocated
+   * in pool.
    */
-  struct MHD_Connection *normal_timeout_head;
+  char *url;
 
   /**
-   * Tail of the XDLL of ALL connections with a default timeout,
-   * sorted by timeout (earliest timeout at the tail).
+   * HTTP version string (i.e. http/1.1).  Allocated
+   * in pool.
    */
-  struct MHD_Connection *normal_timeout_tail;
+  char *version;
 
   /**
-   * Head of the XDLL of ALL connections with a non-default/custom
-   * timeout, unsorted.  MHD will do a O(n) scan over this list to
-   * determine the current timeout.
+   * Last incomplete header line during parsing of headers.
+   * Allocated in pool.  Only valid if state is
+   * either #MHD_CONNECTION_HEADER_PART_RECEIVED or
+   * #MHD_CONNECTION_FOOTER_PART_RECEIVED.
    */
-  struct MHD_Connection *manual_timeout_head;
+  char *last;
 
   /**
-   * Tail of the XDLL of ALL connections with a non-default/custom
-   * timeout, unsorted.
+   * Position after the colon on the last incomplete header
+   * line during parsing of headers.
+   * Allocated in pool.  Only valid if state is
+   * either #MHD_CONNECTION_HEADER_PART_RECEIVED or
+   * #MHD_CONNECTION_FOOTER_PART_RECEIVED.
    */
-  struct MHD_Connection *manual_timeout_tail;
+  char *colon;
 
   /**
-   * Function to call to check if we should accept or reject an
-   * incoming request.  May be NULL.
+   * Number of bytes in @e last (not including the 0-terminator).
+   * Only valid if @e last is.
    */
-  MHD_AcceptPolicyCallback apc;
+  size_t last_size;
 
   /**
-   * Closure argument to apc.
+   * Number of bytes in @e colon (not including the 0-terminator).
+   * Only valid if @e colon is.
    */
-  void *apc_cls;
+  size_t colon_size;
 
   /**
-   * Function to call when we are done processing
-   * a particular request.  May be NULL.
+   * Number of bytes at the beginning of @e read_buffer that are
+   * known not to contain the end of the current header line, so
+   * that we do not scan them again after the next read.
    */
-  MHD_RequestCompletedCallback notify_completed;
+  size_t read_buffer_scan_offset;
 
   /**
-   * Closure argument to @e notify_completed.
+   * Number of bytes of the request line and the headers of the
+   * current request consumed so far.
    */
-  void *notify_completed_cls;
+  size_t header_size;
 
   /**
-   * Function to call when we are starting/stopping
-   * a connection.  May be NULL.
+   * Blocks borrowed from the header overflow arena of the daemon for
+   * the current request, the one holding @e read_buffer first; NULL
+   * if the request fits into @e pool.
    */
-  MHD_NotifyConnectionCallback notify_connection;
+  struct MHD_OverflowBlock *overflow;
 
   /**
-   * Closure argument to @e notify_connection.
+   * How many more bytes of the body do we expect
+   * to read? #MHD_SIZE_UNKNOWN for unknown.
    */
-  void *notify_connection_cls;
+  uint64_t remaining_upload_size;
 
   /**
-   * Function to call with the full URI at the
-   * beginning of request processing.  May be NULL.
-   * <p>
-   * Returns the initial pointer to internal state
-   * kept by the client for the request.
+   * Ranges of the body that we send in a 206 response, allocated
+   * from the pool; NULL if we send the whole body.  See
+   * #MHD_RF_ACCEPT_RANGES.
    */
-  LogCallback uri_log_callback;
+  struct MHD_Range *ranges;
 
   /**
-   * Closure argument to @e uri_log_callback.
+   * Number of elements in @e ranges; more than one range is sent as
+   * a multipart/byteranges body.
    */
-  void *uri_log_callback_cls;
+  unsigned int ranges_count;
 
   /**
-   * Function to call when we unescape escape sequences.
+   * Index of the range in @e ranges that we are sending.
    */
-  UnescapeCallback unescape_callback;
+  unsigned int range_current;
 
   /**
-   * Closure for @e unescape_callback.
+   * #MHD_YES if we answer with 416 because none of the ranges
+   * requested by the client are within the body.
    */
-  void *unescape_callback_cls;
+  int range_not_satisfiable;
 
-#ifdef HAVE_MESSAGES
   /**
-   * Function for logging error messages (if we
-   * support error reporting).
+   * #MHD_YES if we answer with 304 instead of the body because the
+   * client's cached copy is still valid (see #MHD_RF_CONDITIONAL).
    */
-  void (*custom_error_log) (void *cls, const char *fmt, va_list va);
+  int not_modified;
 
   /**
-   * Closure argument to @e custom_error_log.
+   * Chunk-size line of the chunk of a chunked body that is sent
+   * directly from the data buffer of the response.
    */
-  void *custom_error_log_cls;
-#endif
+  char chunk_header[10];
 
   /**
-   * Pointer to master daemon (NULL if this is the master)
+   * Length of @e chunk_header.
    */
-  struct MHD_Daemon *master;
+  size_t chunk_header_len;
 
   /**
-   * Worker daemons (one per thread)
+   * Number of bytes of the body in the chunk sent from the data
+   * buffer of the response, 0 if the chunk is in the write buffer.
    */
-  struct MHD_Daemon *worker_pool;
+  size_t chunk_size;
 
   /**
-   * Table storing number of connections per IP
+   * Number of bytes of that chunk (its @e chunk_header, data and
+   * trailing CRLF) that were already sent.
    */
-  void *per_ip_connection_count;
+  size_t chunk_sent;
 
   /**
-   * Size of the per-connection memory pools.
+   * Compressor for the body of the response, NULL if we send the
+   * body as is.  Compressed bodies are always sent chunked.
    */
-  size_t pool_size;
+  struct MHD_Compressor *compressor;
 
   /**
-   * Increment for growth of the per-connection memory pools.
+   * Content coding produced by @e compressor, "gzip" or "deflate".
    */
-  size_t pool_increment;
+  const char *compress_encoding;
 
   /**
-   * Size of threads created by MHD.
+   * #MHD_YES once the compressor got all of the body.
    */
-  size_t thread_stack_size;
+  int compress_input_done;
 
   /**
-   * Number of worker daemons
+   * #MHD_YES once the last chunk of the compressed body was queued.
    */
-  unsigned int worker_pool_size;
+  int compress_done;
 
   /**
-   * The select thread handle (if we have internal select)
+   * Interim (1xx) responses to send before the final response: the
+   * ones queued with #MHD_queue_interim_response() followed by the
+   * 100 CONTINUE message if the client expects it.  NULL if none.
    */
-  MHD_thread_handle_ pid;
+  const char *continue_message;
 
   /**
-   * Mutex for per-IP connection counts.
+   * Number of bytes in @e continue_message.
    */
-  MHD_mutex_ per_ip_connection_mutex;
+  size_t continue_message_size;
 
   /**
-   * Mutex for (modifying) access to the "cleanup" connection DLL.
+   * Position in @e continue_message up to which it was sent.
    */
-  MHD_mutex_ cleanup_connection_mutex;
+  size_t continue_message_write_offset;
 
   /**
-   * Listen socket.
+   * Did we ever call the "default_handler" on this connection?  (this
+   * flag will determine if we call the #MHD_OPTION_NOTIFY_COMPLETED
+   * handler when the connection closes down).
    */
-  MHD_socket socket_fd;
+  int client_aware;
 
   /**
-   * Whether to allow/disallow/ignore reuse of listening address.
-   * The semantics is the following:
-   * 0: ignore (user did not ask for neither allow/disallow, use SO_REUSEADDR)
-   * >0: allow (use SO_REUSEPORT on most platforms, SO_REUSEADDR on Windows)
-   * <0: disallow (mostly no action, SO_EXCLUSIVEADDRUSE on Windows)
+   * #MHD_YES if the connection was kept alive after a request, so
+   * that it may be idle waiting for the next one.
+   */
+  int kept_alive;
+
+  /**
+   * Value of TCP_NODELAY of the socket.
+   */
+  enum MHD_SocketOptionState sk_nodelay;
+
+  /**
+   * Value of TCP_CORK (or TCP_NOPUSH) of the socket.
+   */
+  enum MHD_SocketOptionState sk_cork;
+
+  /**
+   * #MHD_YES if the socket was left corked after a response because
+   * the next pipelined request was already buffered; the
+   * data is flushed after the last response of the batch.  See
+   * #MHD_OPTION_PIPELINE_CORK.
+   */
+  int pipeline_corked;
+
+  /**
+   * Are we currently inside the "idle" handler (to avoid recursively
+   * invoking it).
+   */
+  int in_idle;
+
+  /**
+   * HTTP response code.  Only valid if response object
+   * is already set.
+   */
+  unsigned int responseCode;
+
+  /**
+   * Set to #MHD_YES if the response's content reader
+   * callback failed to provide data the last time
+   * we tried to read from it.  In that case, the
+   * write socket should be marked as unready until
+   * the CRC call succeeds.
+   */
+  int response_unready;
+
+  /**
+   * Are we receiving with chunked encoding?  This will be set to
+   * #MHD_YES after we parse the headers and are processing the body
+   * with chunks.  After we are done with the body and we are
+   * processing the footers; once the footers are also done, this will
+   * be set to #MHD_NO again (before the final call to the handler).
+   */
+  int have_chunked_upload;
+
+  /**
+   * If we are receiving with chunked encoding, where are we right
+   * now?  Set to 0 if we are waiting to receive the chunk size;
+   * otherwise, this is the size of the current chunk.  A value of
+   * zero is also used when we're at the end of the chunks.
+   */
+  size_t current_chunk_size;
+
+  /**
+   * If we are receiving with chunked encoding, where are we currently
+   * with respect to the current chunk (at what offset / position)?
+   */
+  size_t current_chunk_offset;
+
+  /**
+   * With #MHD_OPTION_COALESCE_CHUNKED_UPLOAD, number of bytes at
+   * the beginning of the read buffer that were already decoded
+   * from chunks but not yet processed by the handler.  In this
+   * mode, @e current_chunk_offset counts the decoded bytes of the
+   * current chunk instead of the processed ones.
+   */
+  size_t chunk_decoded;
+
+  /**
+   * Buffer of the application the body is received into, see
+   * #MHD_OPTION_UPLOAD_BUFFER_CALLBACK; NULL if none.
+   */
+  char *upload_buffer;
+
+  /**
+   * Descriptor of the application the body is spliced into instead
+   * of @e upload_buffer; -1 if none.
+   */
+  int upload_fd;
+
+  /**
+   * Size of @e upload_buffer, or the number of bytes to splice into
+   * @e upload_fd.
+   */
+  size_t upload_buffer_size;
+
+  /**
+   * Number of bytes received into @e upload_buffer (or spliced into
+   * @e upload_fd) and not yet passed to the access handler.
+   */
+  size_t upload_buffer_fill;
+
+  /**
+   * Decompressor for the body of the request, NULL if the body is
+   * passed as received; see #MHD_OPTION_INFLATE_REQUEST_BODY.
+   */
+  struct MHD_Inflater *inflater;
+
+  /**
+   * Buffer in the memory pool for the decompressed body, allocated
+   * when the first bytes of the body arrive.
+   */
+  char *inflate_buffer;
+
+  /**
+   * Size of @e inflate_buffer.
+   */
+  size_t inflate_buffer_size;
+
+  /**
+   * Offset of the first byte in @e inflate_buffer the access handler
+   * did not process yet.
+   */
+  size_t inflate_offset;
+
+  /**
+   * Number of decompressed bytes in @e inflate_buffer.
+   */
+  size_t inflate_fill;
+
+  /**
+   * Number of bytes of the body passed to @e inflater so far.
+   */
+  uint64_t inflate_in;
+
+  /**
+   * Number of bytes @e inflater produced so far.
+   */
+  uint64_t inflate_out;
+
+  /**
+   * #MHD_YES once @e inflater reached the end of the compressed
+   * stream.
+   */
+  int inflate_done;
+
+#if HTTPS_SUPPORT
+  /**
+   * State required for HTTPS/SSL/TLS support.
+   */
+#if HTTPS_OPENSSL
+  SSL *tls_session;
+
+  /**
+   * Function OpenSSL receives encrypted data with.
+   */
+  ReceiveCallback tls_pull;
+
+  /**
+   * Function OpenSSL sends encrypted data with.
+   */
+  TransmitCallback tls_push;
+#else
+  gnutls_session_t tls_session;
+#endif
+
+  /**
+   * Memory location to return for protocol session info.
+   */
+  int protocol;
+
+  /**
+   * Memory location to return for protocol session info.
+   */
+  int cipher;
+
+  /**
+   * Could it be that we are ready to read due to TLS buffers
+   * even though the socket is not?
+   */
+  int tls_read_ready;
+
+  /**
+   * Next pointer for the DLL of connections with @e tls_read_ready
+   * set (not used with #MHD_USE_THREAD_PER_CONNECTION).
+   */
+  struct MHD_Connection *tls_ready_next;
+
+  /**
+   * Previous pointer for the DLL of connections with
+   * @e tls_read_ready set.
+   */
+  struct MHD_Connection *tls_ready_prev;
+
+  /**
+   * #MHD_YES if the kernel encrypts the data we send (kTLS), so that
+   * bodies of responses from files can be sent with sendfile().
+   */
+  int tls_ktls_send;
+
+  /**
+   * Number of bytes sent in small TLS records since the connection
+   * was started or was last idle.  See
+   * #MHD_OPTION_HTTPS_DYNAMIC_RECORD_SIZE.
+   */
+  size_t tls_small_record_bytes;
+
+  /**
+   * Size the last TLS record we tried to send was limited to, if
+   * sending it was interrupted, 0 otherwise; it must be retried
+   * with the same data.
+   */
+  size_t tls_record_pending;
+
+  /**
+   * When did we last send TLS data (see #MHD_loop_time_())?
+   */
+  uint64_t tls_last_send;
+
+  /**
+   * #MHD_YES if the TLS handshake was handed to a handshake thread
+   * (see #MHD_OPTION_HTTPS_HANDSHAKE_THREADS).  The connection is
+   * suspended until the handshake thread is done with it.
+   */
+  int tls_handshake_offloaded;
+
+  /**
+   * Set by the handshake thread: #MHD_YES if it completed the
+   * handshake (successfully or not), #MHD_NO if it gave up on the
+   * connection without a result (i.e. during shutdown).
+   */
+  int tls_handshake_done;
+
+  /**
+   * Result of #MHD_tls_handshake_() on the handshake thread, valid
+   * if @e tls_handshake_done is #MHD_YES.
+   */
+  int tls_handshake_result;
+
+  /**
+   * Next connection in the list of a handshake thread.
+   */
+  struct MHD_Connection *handshake_next;
+#endif
+
+  /**
+   * Is the connection wanting to resume?  Set atomically if
+   * #HAVE_ATOMIC_BUILTINS.
+   */
+  int resuming;
+
+  /**
+   * Next connection in the @e resume_queue of the daemon.
+   */
+  struct MHD_Connection *resume_next;
+
+  /**
+   * #MHD_YES if the content reader returned
+   * #MHD_CONTENT_READER_PENDING in this round of the event loop.
+   */
+  int data_pending;
+
+  /**
+   * #MHD_YES if the access handler called #MHD_pause_upload() and
+   * the connection is to wait for #MHD_resume_upload().
+   */
+  int upload_paused;
+
+  /**
+   * Is the connection suspended until #MHD_response_data_ready() or
+   * #MHD_resume_upload() is called?  Protected by the cleanup mutex
+   * of the daemon.
+   */
+  int waiting_for_data;
+
+  /**
+   * #MHD_YES if #MHD_response_data_ready() or #MHD_resume_upload()
+   * was called while we were not waiting for data.  Protected by the cleanup mutex of the
+   * daemon.
+   */
+  int data_ready;
+
+  /**
+   * State of a request answered with #MHD_defer_response().  Set
+   * atomically if #HAVE_ATOMIC_BUILTINS, otherwise protected by the
+   * cleanup mutex of the daemon.
+   */
+  enum MHD_DeferState deferred;
+
+  /**
+   * Response passed to #MHD_complete_response(), with a reference
+   * held; valid once @e deferred is #MHD_DEFER_COMPLETE.
+   */
+  struct MHD_Response *deferred_response;
+
+  /**
+   * Status code passed to #MHD_complete_response().
+   */
+  unsigned int deferred_status;
+
+  /**
+   * Event of the broadcast of the response being sent (see
+   * #MHD_create_response_from_broadcast()), a reference is held;
+   * NULL if none.
+   */
+  struct MHD_BroadcastEvent *bc_event;
+
+  /**
+   * Number of bytes of @e bc_event that were sent.
+   */
+  size_t bc_offset;
+
+  /**
+   * Sequence number of the event of the broadcast to send after
+   * @e bc_event.
+   */
+  uint64_t bc_seq;
+
+  /**
+   * Next connection waiting for an event of the broadcast, or for
+   * the entry of the response cache in @e cache_entry.  Protected
+   * by the mutex of the broadcast while @e bc_waiting is set, or
+   * by the mutex of the cache while @e cache_waiting is set.
+   */
+  struct MHD_Connection *bc_next;
+
+  /**
+   * Previous connection waiting for an event of the broadcast, or
+   * for the entry of the response cache.
+   */
+  struct MHD_Connection *bc_prev;
+
+  /**
+   * #MHD_YES if the connection is in the list of connections waiting
+   * for the next event of the broadcast.  Protected by the mutex of
+   * the broadcast.
+   */
+  int bc_waiting;
+
+  /**
+   * Copy of the request target (path and arguments) to look up the
+   * request in the response cache of the daemon, NULL if the cache
+   * is not used.  Allocated from the pool.
+   */
+  char *cache_key;
+
+  /**
+   * Entry of the response cache the request fills with its response
+   * or waits for, NULL if none.  Protected by the mutex of the cache.
+   */
+  struct MHD_CacheEntry *cache_entry;
+
+  /**
+   * #MHD_YES if the connection is in the list of connections waiting
+   * for @e cache_entry.  Protected by the mutex of the cache.
+   */
+  int cache_waiting;
+
+  /**
+   * #MHD_YES if the request bypasses the response cache, as the
+   * response of the request it waited for could not be cached.
+   */
+  int cache_pass;
+
+  /**
+   * Step of the request processing last handed to the handler
+   * threads (see #MHD_OPTION_HANDLER_THREADS), NULL if none.
+   */
+  MHD_HandlerStep handler_step;
+
+  /**
+   * Next connection in the queue of the handler threads, or in the
+   * @e handler_pending list of the daemon.
+   */
+  struct MHD_Connection *handler_next;
+
+  /**
+   * #MHD_YES while @e handler_step waits for or runs on a handler
+   * thread.  Protected by the cleanup mutex of the daemon.
+   */
+  int handler_offloaded;
+
+  /**
+   * Buffer in the memory pool the next block of the body is read
+   * into by a handler thread (see #MHD_RF_PREFETCH), NULL if none.
+   */
+  char *prefetch_buf;
+
+  /**
+   * Size of @e prefetch_buf.
+   */
+  size_t prefetch_buf_size;
+
+  /**
+   * Position in the body of the block in @e prefetch_buf.
+   */
+  uint64_t prefetch_pos;
+
+  /**
+   * Result of the content reader for the block in @e prefetch_buf.
+   */
+  ssize_t prefetch_ret;
+
+  /**
+   * State of @e prefetch_buf, changed under the cleanup mutex of the
+   * daemon and read atomically if #HAVE_ATOMIC_BUILTINS.
+   */
+  enum MHD_PrefetchState prefetch_state;
+
+  /**
+   * Next connection in the prefetch queue of the handler threads.
+   */
+  struct MHD_Connection *prefetch_next;
+
+  /**
+   * #MHD_YES if the access handler running on a handler thread
+   * suspended the connection; it then stays suspended after the
+   * handler thread is done, until it is resumed again.  Protected by
+   * the cleanup mutex of the daemon.
+   */
+  int handler_suspended;
+
+  /**
+   * #MHD_YES if the connection is to be closed when the deadline of
+   * #MHD_suspend_connection_with_timeout() expires, #MHD_NO if it is
+   * to be resumed.
+   */
+  int suspend_close;
+
+  /**
+   * #MHD_YES if the deadline of a suspension with @e suspend_close
+   * expired; the idle handler closes the connection once it is
+   * resumed.
+   */
+  int suspend_expired;
+
+  /**
+   * #MHD_YES if a handler thread completed @e handler_step; the event
+   * loop then continues after the step instead of running it.
+   */
+  int handler_step_done;
+
+  /**
+   * #MHD_monotonic_msec_counter() value at which @e handler_step was
+   * handed to the handler threads, for the handler latency of
+   * #MHD_OPTION_OVERLOAD_LATENCY.
+   */
+  uint64_t handler_start;
+
+  /**
+   * Phase timestamps of the current request, returned by
+   * #MHD_CONNECTION_INFO_REQUEST_TIMES.
+   */
+  struct MHD_RequestTimes request_times;
+
+#if defined(MHD_USE_DTRACE_PROBES) && defined(HAVE_SYS_SDT_H)
+  /**
+   * State last reported by the "state_change" probe.
+   */
+  enum MHD_CONNECTION_STATE probe_state;
+#endif
+
+#if HAVE_SPLICE
+  /**
+   * Pipe used to splice the body of a #MHD_create_response_from_pipe()
+   * response into our socket, created on first use; -1 if none.
+   */
+  int splice_pipe[2];
+
+  /**
+   * Number of bytes of the body in @e splice_pipe that were not yet
+   * sent.
+   */
+  size_t splice_buffered;
+#endif
+
+  /**
+   * Thread handle for this connection (if we are using
+   * one thread per connection).
+   */
+  MHD_thread_handle_ pid;
+
+  /**
+   * Set to #MHD_YES if the thread has been joined, or (with
+   * @e thread_cached) once the thread is done with the connection.
+   */
+  int thread_joined;
+
+  /**
+   * #MHD_YES if the connection is handled by a thread of the thread
+   * cache, which is not joined.  See #MHD_OPTION_THREAD_CACHE_SIZE.
+   */
+  int thread_cached;
+
+  /**
+   * #MHD_YES if the thread left the connection idle between two
+   * requests to be polled by the thread parking idle connections.
+   * See #MHD_OPTION_PARK_IDLE_CONNECTIONS.
+   */
+  int parked;
+
+  /**
+   * Foreign address (of length @e addr_len).  Points to
+   * @e addr_storage unless the address is too large for it,
+   * in which case it is MALLOCED (not in pool!).
+   */
+  struct sockaddr *addr;
+
+  /**
+   * Length of the foreign address.
+   */
+  socklen_t addr_len;
+
+  /**
+   * Storage for @e addr, avoids allocating it separately.
+   */
+  struct sockaddr_storage addr_storage;
+
+  /**
+   * Credentials of the peer of an AF_UNIX connection, filled in
+   * when #MHD_CONNECTION_INFO_PEER_CREDENTIALS is requested.
+   */
+  struct MHD_PeerCredentials peer_credentials;
+};
+
+/**
+ * Signature of function called to log URI accesses.
+ *
+ * @param cls closure
+ * @param uri uri being accessed
+ * @param con connection handle
+ * @return new closure
+ */
+typedef void *
+(*LogCallback)(void *cls,
+               const char *uri,
+               struct MHD_Connection *con);
+
+/**
+ * Signature of function called to unescape URIs.  See also
+ * #MHD_http_unescape().
+ *
+ * @param cls closure
+ * @param conn connection handle
+ * @param uri 0-terminated string to unescape (should be updated)
+ * @return length of the resulting string
+ */
+typedef size_t
+(*UnescapeCallback)(void *cls,
+                    struct MHD_Connection *conn,
+                    char *uri);
+
+
+/**
+ * State kept for each MHD daemon.  All connections are kept in two
+ * doubly-linked lists.  The first one reflects the state of the
+ * connection in terms of what operations we are waiting for (read,
+ * write, locally blocked, cleanup) whereas the second is about its
+ * timeout state (default or custom).
+ */
+struct MHD_Daemon
+{
+
+  /**
+   * Callback function for all requests.
+   */
+  MHD_AccessHandlerCallback default_handler;
+
+  /**
+   * Closure argument to default_handler.
+   */
+  void *default_handler_cls;
+
+  /**
+   * Head of doubly-linked list of our current, active connections.
+   */
+  struct MHD_Connection *connections_head;
+
+  /**
+   * Tail of doubly-linked list of our current, active connections.
+   */
+  struct MHD_Connection *connections_tail;
+
+  /**
+   * Head of doubly-linked list of our current but suspended connections.
+   */
+  struct MHD_Connection *suspended_connections_head;
+
+  /**
+   * Tail of doubly-linked list of our current but suspended connections.
+   */
+  struct MHD_Connection *suspended_connections_tail;
+
+  /**
+   * Head of doubly-linked list of suspended connections for which
+   * #MHD_resume_connection() was called, but which were not yet
+   * moved back to the active connections.  Protected by
+   * @e cleanup_connection_mutex, like the suspended list.
+   */
+  struct MHD_Connection *resumed_connections_head;
+
+  /**
+   * Tail of doubly-linked list of resumed connections.
+   */
+  struct MHD_Connection *resumed_connections_tail;
+
+  /**
+   * Singly-linked stack (via @e resume_next) of connections that
+   * were resumed without taking @e cleanup_connection_mutex; they
+   * are still in the suspended list.  Pushed to and taken by the
+   * event loop with atomic operations, only used if
+   * #HAVE_ATOMIC_BUILTINS.
+   */
+  struct MHD_Connection *resume_queue;
+
+  /**
+   * Singly-linked list (via @e h2_wake_next) of HTTP/2 connections
+   * with streams that were resumed.  Protected by
+   * @e cleanup_connection_mutex.
+   */
+  struct MHD_Connection *h2_wake_head;
+
+  /**
+   * Maximum number of concurrent streams of an HTTP/2 connection,
+   * see #MHD_OPTION_HTTP2_MAX_CONCURRENT_STREAMS.
+   */
+  unsigned int http2_max_streams;
+
+  /**
+   * Cache of complete responses, NULL if disabled.  Shared by the
+   * worker daemons of a thread pool.  See
+   * #MHD_OPTION_RESPONSE_CACHE_SIZE.
+   */
+  struct MHD_ResponseCache *response_cache;
+
+  /**
+   * Maximum number of entries of @e response_cache, 0 to disable it.
+   */
+  unsigned int response_cache_size;
+
+  /**
+   * Difference in the number of connections of the workers of a
+   * thread pool above which idle connections are moved to the worker
+   * with the fewest, 0 to never move them.  See
+   * #MHD_OPTION_CONNECTION_REBALANCE.
+   */
+  unsigned int rebalance_threshold;
+
+  /**
+   * Number of connections a worker of a thread pool may have above
+   * the average of the workers before it stops accepting, 0 to
+   * accept regardless.  See #MHD_OPTION_ACCEPT_FAIR_SHARE.
+   */
+  unsigned int accept_fair_share;
+
+  /**
+   * #MHD_YES while this worker stopped accepting because it was above
+   * its fair share; cleared by the worker waking it up.  Accessed
+   * atomically if #HAVE_ATOMIC_BUILTINS.
+   */
+  int accept_paused;
+
+  /**
+   * Value of the "Alt-Svc" header added to HTTP/1.x responses, NULL
+   * for none.  See #MHD_OPTION_ALT_SVC.
+   */
+  const char *alt_svc;
+
+  /**
+   * Number of bytes in @e alt_svc.
+   */
+  size_t alt_svc_len;
+
+  /**
+   * Number of threads to run the access handler on, 0 to run it in
+   * the event loop.  See #MHD_OPTION_HANDLER_THREADS.
+   */
+  unsigned int handler_thread_count;
+
+  /**
+   * Threads running the access handler, shared by the master daemon
+   * and its worker daemons; NULL if @e handler_thread_count is 0.
+   */
+  struct MHD_HandlerPool *handler_pool;
+
+  /**
+   * Connections suspended for the handler threads in this round of the
+   * event loop, linked by their @e handler_next field.  They are handed
+   * to the threads before the event loop waits for events again, once
+   * it no longer looks at them.
+   */
+  struct MHD_Connection *handler_pending;
+
+  /**
+   * Maximum number of parked threads kept for new connections in
+   * #MHD_USE_THREAD_PER_CONNECTION mode, 0 to start a thread for
+   * each connection.  See #MHD_OPTION_THREAD_CACHE_SIZE.
+   */
+  unsigned int thread_cache_size;
+
+  /**
+   * Seconds a parked thread waits for a connection before it exits,
+   * 0 to wait forever.  See #MHD_OPTION_THREAD_CACHE_TIMEOUT.
+   */
+  unsigned int thread_cache_timeout;
+
+  /**
+   * Milliseconds a connection waits for its next request before it is
+   * parked without a thread, 0 to never park connections.  See
+   * #MHD_OPTION_PARK_IDLE_CONNECTIONS.
+   */
+  unsigned int park_idle_delay;
+
+  /**
+   * Threads kept for new connections; NULL if @e thread_cache_size
+   * is 0.
+   */
+  struct MHD_ThreadCache *thread_cache;
+
+  /**
+   * CPUs to pin the threads of the thread pool to, NULL for the CPUs
+   * of the process.  Only valid during #MHD_start_daemon().  See
+   * #MHD_OPTION_THREAD_POOL_CPU_AFFINITY.
+   */
+  const unsigned int *worker_cpus;
+
+  /**
+   * Number of entries in @e worker_cpus.
+   */
+  unsigned int num_worker_cpus;
+
+  /**
+   * #MHD_YES if #MHD_OPTION_THREAD_POOL_CPU_AFFINITY was given.
+   */
+  int pin_workers;
+
+  /**
+   * CPU the thread of this daemon pins itself to, -1 for none.
+   */
+  int worker_cpu;
+
+  /**
+   * Head of doubly-linked list of connections to clean up.
+   */
+  struct MHD_Connection *cleanup_head;
+
+  /**
+   * Tail of doubly-linked list of connections to clean up.
+   */
+  struct MHD_Connection *cleanup_tail;
+
+#if MHD_EREADY_SUPPORT
+  /**
+   * Head of EDLL of connections ready for processing (in epoll mode).
+   */
+  struct MHD_Connection *eready_head;
+
+  /**
+   * Tail of EDLL of connections ready for processing (in epoll mode)
+   */
+  struct MHD_Connection *eready_tail;
+#endif
+
+  /**
+   * Head of the XDLL of ALL connections with a default ('normal')
+   * timeout, sorted by timeout (earliest at the tail, most recently
+   * used connection at the head).  MHD can just look at the tail of
+   * this list to determine the timeout for all of its elements;
+   * whenever there is an event of a connection, the connection is
+   * moved back to the tail of the list.
+   *
+   * All connections by default start in this list; if a custom
+   * timeout that does not match @e connection_timeout is set, they
+   * are moved to the @e timer_wheel_head.
+   */
+  struct MHD_Connection *normal_timeout_head;
+
+  /**
+   * Tail of the XDLL of ALL connections with a default timeout,
+   * sorted by timeout (earliest timeout at the tail).
+   */
+  struct MHD_Connection *normal_timeout_tail;
+
+  /**
+   * Hashed timer wheel for connections with a non-default/custom
+   * (non-zero) timeout: heads of the XDLLs of the connections whose
+   * timeout (as of the time they were inserted) expires in a tick
+   * (of #MHD_TIMER_WHEEL_TICK milliseconds) congruent to the slot
+   * index modulo #MHD_TIMER_WHEEL_SIZE.  As
+   * activity does not move connections in the wheel, connections
+   * found in a slot that did not time out yet are re-inserted for
+   * their current deadline.
+   */
+  struct MHD_Connection *timer_wheel_head[MHD_TIMER_WHEEL_SIZE];
+
+  /**
+   * Tails of the XDLLs of the timer wheel.
+   */
+  struct MHD_Connection *timer_wheel_tail[MHD_TIMER_WHEEL_SIZE];
+
+  /**
+   * All slots of the timer wheel for ticks up to (and including)
+   * this one have been processed.
+   */
+  uint64_t timer_wheel_time;
+
+  /**
+   * Number of connections in the timer wheel.
+   */
+  unsigned int timer_wheel_count;
+
+  /**
+   * Timer wheel for the guards of connections against slow clients
+   * (see `guard_deadline` of `struct MHD_Connection`), laid out like
+   * @e timer_wheel_head.  Connections are moved when their guard is
+   * armed for a new deadline, which happens at most once per phase
+   * of a request or window of #MHD_OPTION_MIN_DATA_RATE.
+   */
+  struct MHD_Connection *guard_wheel_head[MHD_TIMER_WHEEL_SIZE];
+
+  /**
+   * Tails of the XDLLs of the guard wheel.
+   */
+  struct MHD_Connection *guard_wheel_tail[MHD_TIMER_WHEEL_SIZE];
+
+  /**
+   * All slots of the guard wheel for ticks up to (and including)
+   * this one have been processed.
+   */
+  uint64_t guard_wheel_time;
+
+  /**
+   * Number of connections in the guard wheel.
+   */
+  unsigned int guard_wheel_count;
+
+  /**
+   * Oldest connection in the 'normal_timeout' list that was not yet
+   * checked for being idle longer than @e idle_release_timeout; all
+   * connections after it (towards the tail) were checked.  NULL if
+   * all connections were checked.
+   */
+  struct MHD_Connection *idle_release_next;
+
+  /**
+   * Poll set for #MHD_USE_POLL (without #MHD_USE_THREAD_PER_CONNECTION),
+   * kept across iterations of the event loop.  Entry 0 is for the
+   * listen socket and entry 1 for the wakeup pipe (with an invalid fd
+   * if not polled), followed by one entry for each connection in the
+   * 'connections_head' list.  Entries of connections are updated when
+   * their 'event_loop_info' changes; removing a connection moves the
+   * last entry into its slot.
+   */
+  struct pollfd *poll_fds;
+
+  /**
+   * Connections of the entries of @e poll_fds (NULL for the first
+   * two entries).
+   */
+  struct MHD_Connection **poll_conns;
+
+  /**
+   * Number of entries used in @e poll_fds.
+   */
+  unsigned int poll_fds_used;
+
+  /**
+   * Number of entries allocated for @e poll_fds and @e poll_conns.
+   */
+  unsigned int poll_fds_size;
+
+  /**
+   * #MHD_YES if a connection in the poll set was closed since the
+   * last poll(), so that the next one must not block.
+   */
+  int poll_cleanup;
+
+  /**
+   * Fd sets of the connections with #MHD_USE_LARGE_FD_SETS, kept up
+   * to date as their 'event_loop_info' changes like the poll set:
+   * @e fd_sets_chunks `fd_set`s (each for the next FD_SETSIZE
+   * sockets) to wait for reading, as many to wait for writing, then
+   * room for the copies of both passed to select().  NULL until the
+   * first connection is added.
+   */
+  fd_set *fd_sets;
+
+  /**
+   * Number of `fd_set`s in each of the four parts of @e fd_sets.
+   */
+  unsigned int fd_sets_chunks;
+
+  /**
+   * Highest socket in @e fd_sets, #MHD_INVALID_SOCKET if none.
+   */
+  MHD_socket fd_sets_max;
+
+  /**
+   * After how many milliseconds of inactivity between requests a
+   * connection releases its memory pool, 0 to never release it.
+   * See #MHD_OPTION_CONNECTION_IDLE_RELEASE_TIMEOUT.
+   */
+  uint64_t idle_release_timeout;
+
+  /**
+   * #MHD_YES to parse cookies and URI arguments only on demand.
+   * See #MHD_OPTION_LAZY_VALUE_PARSING.
+   */
+  unsigned int lazy_value_parsing;
+
+  /**
+   * #MHD_YES to pass several chunks of a chunked upload to the
+   * handler at once.  See #MHD_OPTION_COALESCE_CHUNKED_UPLOAD.
+   */
+  unsigned int coalesce_chunked_upload;
+
+  /**
+   * #MHD_YES to flush responses to pipelined requests only after
+   * the last one.  See #MHD_OPTION_PIPELINE_CORK.
+   */
+  unsigned int pipeline_cork;
+
+  /**
+   * Responses for the errors MHD reports itself (malformed requests,
+   * requests too big), created when the daemon is started and shared
+   * with all connections (and the workers of a thread pool).
+   */
+  struct MHD_Response *error_responses[MHD_ERROR_RESPONSE_COUNT];
+
+  /**
+   * Function to call to check if we should accept or reject an
+   * incoming request.  May be NULL.
+   */
+  MHD_AcceptPolicyCallback apc;
+
+  /**
+   * Closure argument to apc.
+   */
+  void *apc_cls;
+
+  /**
+   * Function to call when we are done processing
+   * a particular request.  May be NULL.
+   */
+  MHD_RequestCompletedCallback notify_completed;
+
+  /**
+   * Closure argument to @e notify_completed.
+   */
+  void *notify_completed_cls;
+
+  /**
+   * Function to call when we are starting/stopping
+   * a connection.  May be NULL.
+   */
+  MHD_NotifyConnectionCallback notify_connection;
+
+  /**
+   * Closure argument to @e notify_connection.
+   */
+  void *notify_connection_cls;
+
+  /**
+   * Function to call when the events to wait for on one of our
+   * sockets change, see #MHD_OPTION_NOTIFY_SOCKET.  May be NULL.
+   */
+  MHD_NotifySocketCallback notify_socket;
+
+  /**
+   * Closure argument to @e notify_socket.
+   */
+  void *notify_socket_cls;
+
+  /**
+   * State the application keeps for the listen socket, see
+   * #MHD_NotifySocketCallback.
+   */
+  void *listen_socket_interest_cls;
+
+  /**
+   * State the application keeps for the read end of the wakeup
+   * pipe, see #MHD_NotifySocketCallback.
+   */
+  void *wpipe_socket_interest_cls;
+
+  /**
+   * Connections resumed by the last call of
+   * resume_suspended_connections(), linked by @e resumed_next, if
+   * #MHD_OPTION_NOTIFY_SOCKET is used.
+   */
+  struct MHD_Connection *socket_resumed_head;
+
+  /**
+   * Limit for the data sent by all connections of this daemon, see
+   * #MHD_OPTION_SEND_RATE_LIMIT.  Workers of a thread pool each get
+   * their share of the limit.
+   */
+  struct MHD_TokenBucket send_bucket;
+
+  /**
+   * Limit for the data received by all connections of this daemon,
+   * see #MHD_OPTION_RECV_RATE_LIMIT.
+   */
+  struct MHD_TokenBucket recv_bucket;
+
+  /**
+   * Head of the DLL of connections waiting for a rate limit, see
+   * #MHD_EVENT_LOOP_INFO_THROTTLED.
+   */
+  struct MHD_Connection *throttled_head;
+
+  /**
+   * Tail of the DLL of connections waiting for a rate limit.
+   */
+  struct MHD_Connection *throttled_tail;
+
+  /**
+   * Function to call with the full URI at the
+   * beginning of request processing.  May be NULL.
+   * <p>
+   * Returns the initial pointer to internal state
+   * kept by the client for the request.
+   */
+  LogCallback uri_log_callback;
+
+  /**
+   * Closure argument to @e uri_log_callback.
+   */
+  void *uri_log_callback_cls;
+
+  /**
+   * Function to call to assign requests a priority class once their
+   * headers are parsed, see #MHD_OPTION_PRIORITY_CALLBACK.  May be
+   * NULL.
+   */
+  MHD_PriorityCallback priority_callback;
+
+  /**
+   * Closure argument to @e priority_callback.
+   */
+  void *priority_callback_cls;
+
+  /**
+   * Function to call for the destination of request bodies, see
+   * #MHD_OPTION_UPLOAD_BUFFER_CALLBACK.  May be NULL.
+   */
+  MHD_UploadBufferCallback upload_buffer_callback;
+
+  /**
+   * Closure argument to @e upload_buffer_callback.
+   */
+  void *upload_buffer_callback_cls;
+
+  /**
+   * Function to call when we unescape escape sequences.
+   */
+  UnescapeCallback unescape_callback;
+
+  /**
+   * Closure for @e unescape_callback.
+   */
+  void *unescape_callback_cls;
+
+#ifdef HAVE_MESSAGES
+  /**
+   * Function for logging error messages (if we
+   * support error reporting).
+   */
+  void (*custom_error_log) (void *cls, const char *fmt, va_list va);
+
+  /**
+   * Closure argument to @e custom_error_log.
+   */
+  void *custom_error_log_cls;
+
+  /**
+   * Queue for #MHD_OPTION_LOG_QUEUE_SIZE and
+   * #MHD_OPTION_LOG_RATE_LIMIT, shared with the workers of a thread
+   * pool; NULL to log synchronously without limits.
+   */
+  struct MHD_LogQueue *log_queue;
+
+  /**
+   * Thread writing the messages of @e log_queue.
+   */
+  MHD_thread_handle_ log_thread;
+
+  /**
+   * #MHD_YES if @e log_thread runs.
+   */
+  int have_log_thread;
+
+  /**
+   * Size of the ring of @e log_queue, see #MHD_OPTION_LOG_QUEUE_SIZE.
+   */
+  unsigned int log_queue_size;
+
+  /**
+   * See #MHD_OPTION_LOG_RATE_LIMIT.
+   */
+  unsigned int log_rate_limit;
+#endif
+
+  /**
+   * Pointer to master daemon (NULL if this is the master)
+   */
+  struct MHD_Daemon *master;
+
+  /**
+   * Worker daemons (one per thread)
+   */
+  struct MHD_Daemon *worker_pool;
+
+  /**
+   * Held by the master while the threads of the worker daemons are
+   * started, which only run their event loop once it is released,
+   * and only if @e startup_failed is not #MHD_YES.
+   */
+  MHD_mutex_ startup_lock;
+
+  /**
+   * #MHD_YES if starting one of the worker daemons failed, so the
+   * others exit without running their event loop.
+   */
+  int startup_failed;
+
+  /**
+   * Table storing number of connections per IP, an array of
+   * shards (only allocated in the master daemon, and only if
+   * @e per_ip_connection_limit is non-zero).
+   */
+  struct MHD_IPCountShard *per_ip_connection_count;
+
+  /**
+   * Key of the hash of @e per_ip_connection_count.
+   */
+  uint64_t per_ip_connection_key[2];
+
+  /**
+   * Key of the hash of the header index of the connections (see
+   * `struct MHD_Connection`), shared with the worker daemons.
+   */
+  uint64_t header_index_key[2];
+
+  /**
+   * Size of the per-connection memory pools.
+   */
+  size_t pool_size;
+
+  /**
+   * Increment for growth of the per-connection memory pools.
+   */
+  size_t pool_increment;
+
+  /**
+   * Percentile of the request header sizes seen by this daemon (or
+   * worker) at which new read buffers are sized, 0 to start them at
+   * half of @e pool_size.  See #MHD_OPTION_ADAPTIVE_READ_BUFFER.
+   */
+  unsigned int header_size_percentile;
+
+  /**
+   * Histogram of the request header sizes, see
+   * #MHD_HEADER_SIZE_CLASSES.  Accessed atomically if
+   * #HAVE_ATOMIC_BUILTINS, as connections with a thread of their
+   * own count in it.
+   */
+  unsigned int header_size_counts[MHD_HEADER_SIZE_CLASSES];
+
+  /**
+   * Sum of @e header_size_counts.
+   */
+  unsigned int header_size_samples;
+
+  /**
+   * Initial size of read buffers derived from @e header_size_counts,
+   * 0 while there were too few samples.
+   */
+  size_t header_size_estimate;
+
+  /**
+   * Size of the arena this daemon (or worker) lends to requests
+   * whose headers do not fit into their memory pool, 0 for none.
+   * See #MHD_OPTION_HEADER_OVERFLOW_ARENA.
+   */
+  size_t header_overflow_limit;
+
+  /**
+   * Bytes of the arena lent out.  Accessed atomically if
+   * #HAVE_ATOMIC_BUILTINS.
+   */
+  size_t header_overflow_used;
+
+  /**
+   * Buffer the chunks of chunked callback responses are read into
+   * before they are sent, shared by the connections of this daemon
+   * (or worker); allocated on first use.  See
+   * #MHD_OPTION_WRITE_SCRATCH_BUFFER.
+   */
+  char *write_scratch;
+
+  /**
+   * Size of @e write_scratch, 0 if chunks are read into the memory
+   * pools of the connections.
+   */
+  size_t write_scratch_size;
+
+  /**
+   * Bound for the memory of all pools, see #MHD_OPTION_MEMORY_BUDGET;
+   * 0 for none.
+   */
+  size_t memory_budget;
+
+  /**
+   * Memory taken from @e memory_budget by existing pools (only
+   * used in the master daemon, updated by all workers).
+   */
+  size_t memory_used;
+
+  /**
+   * Loop time (see #MHD_loop_time_()) at which idle pools were last
+   * released because the budget was exhausted.
+   */
+  uint64_t budget_reclaim_time;
+
+  /**
+   * Bytes of a pool that MHD_connection_alloc() leaves free, see
+   * #MHD_OPTION_CONNECTION_ALLOC_RESERVE.
+   */
+  size_t alloc_reserve;
+
+  /**
+   * Size of threads created by MHD.
+   */
+  size_t thread_stack_size;
+
+  /**
+   * Number of worker daemons
+   */
+  unsigned int worker_pool_size;
+
+  /**
+   * Number of worker processes, see #MHD_OPTION_PREFORK_WORKERS.
+   */
+  unsigned int prefork_workers;
+
+  /**
+   * Worker processes and their shared memory, NULL without
+   * #MHD_OPTION_PREFORK_WORKERS.  Shared with the worker daemons.
+   */
+  struct MHD_Prefork *prefork;
+
+  /**
+   * The select thread handle (if we have internal select)
+   */
+  MHD_thread_handle_ pid;
+
+  /**
+   * Mutex for (modifying) access to the "cleanup" connection DLL.
+   */
+  MHD_mutex_ cleanup_connection_mutex;
+
+  /**
+   * Listen socket.
+   */
+  MHD_socket socket_fd;
+
+  /**
+   * Listen socket owned by this worker daemon, see
+   * #MHD_USE_THREAD_POOL_REUSEPORT; #MHD_INVALID_SOCKET if
+   * the worker shares the listen socket of the master daemon.
+   * Kept separately from @e socket_fd, as that one is reset on
+   * shutdown while the worker thread may still be using it.
+   */
+  MHD_socket worker_socket_fd;
+
+  /**
+   * Non-zero to attach a BPF program distributing new connections
+   * among the workers' listen sockets by CPU, see
+   * #MHD_OPTION_LISTEN_REUSEPORT_CPU_STEERING.
+   */
+  unsigned int reuseport_cpu_steering;
+
+  /**
+   * Whether to allow/disallow/ignore reuse of listening address.
+   * The semantics is the following:
+   * 0: ignore (user did not ask for neither allow/disallow, use SO_REUSEADDR)
+   * >0: allow (use SO_REUSEPORT on most platforms, SO_REUSEADDR on Windows)
+   * <0: disallow (mostly no action, SO_EXCLUSIVEADDRUSE on Windows)
+   */
+  int listening_address_reuse;
+
+  /**
+   * #MHD_YES if the listen socket is a Unix domain (AF_UNIX) socket;
+   * its connections have no TCP options and no IP address.
+   */
+  int listen_unix;
+
+#if EPOLL_SUPPORT
+  /**
+   * File descriptor associated with our epoll loop.
+   */
+  int epoll_fd;
+
+  /**
+   * MHD_YES if the listen socket is in the 'epoll' set,
+   * MHD_NO if not.
+   */
+  int listen_socket_in_epoll;
+#endif
+
+#if KQUEUE_SUPPORT
+  /**
+   * File descriptor associated with our kqueue loop.
+   */
+  int kqueue_fd;
+
+  /**
+   * MHD_YES if the listen socket is in the kqueue set,
+   * MHD_NO if not.
+   */
+  int listen_socket_in_kqueue;
+#endif
+
+#if IO_URING_SUPPORT
+  /**
+   * Ring used by the io_uring event loop, in place of @e epoll_fd.
+   */
+  struct MHD_IoUring uring;
+
+  /**
+   * MHD_YES if the read end of @e wpipe is being polled via
+   * @e uring, MHD_NO if not.
+   */
+  int wpipe_in_uring;
+
+  /**
+   * Head of DLL of connections that were cleaned up but must not
+   * be freed until their poll request on @e uring completes.
+   */
+  struct MHD_Connection *uring_zombie_head;
+
+  /**
+   * Tail of DLL of connections that were cleaned up but must not
+   * be freed until their poll request on @e uring completes.
+   */
+  struct MHD_Connection *uring_zombie_tail;
+#endif
+
+  /**
+   * Pipe we use to signal shutdown, unless
+   * 'HAVE_LISTEN_SHUTDOWN' is defined AND we have a listen
+   * socket (which we can then 'shutdown' to stop listening).
+   * MHD can be build with usage of socketpair instead of
+   * pipe (forced on W32).  On Linux, both entries are
+   * descriptors of the same eventfd.
+   */
+  MHD_pipe wpipe[2];
+
+  /**
+   * #MHD_YES if @e wpipe was signalled and the event loop did not
+   * clear it yet, so that signalling it again can be skipped.
+   * Only used if #HAVE_ATOMIC_BUILTINS.
+   */
+  int wpipe_pending;
+
+  /**
+   * Are we shutting down?
+   */
+  int shutdown;
+
+  /*
+   * Do we need to process resuming connections?  Accessed
+   * atomically if #HAVE_ATOMIC_BUILTINS.
+   */
+  int resuming;
+
+  /**
+   * Connections added by the application (see #MHD_add_connection())
+   * that the event loop of this daemon has yet to take over, linked
+   * by their @e next field.  Protected by @e cleanup_connection_mutex.
+   */
+  struct MHD_Connection *added_connections_head;
+
+  /**
+   * Last connection in @e added_connections_head.
+   */
+  struct MHD_Connection *added_connections_tail;
+
+  /**
+   * Are there connections in @e added_connections_head?  Accessed
+   * atomically if #HAVE_ATOMIC_BUILTINS.
+   */
+  int adding;
+
+  /**
+   * #MHD_YES once the listen socket was handed over to another
+   * process with #MHD_handoff_listen_socket(), or while
+   * #MHD_stop_daemon() drains the connections: keep-alive is no
+   * longer offered.
+   */
+  int draining;
+
+  /**
+   * #MHD_YES if the event loop still has to close the idle keep-alive
+   * connections after draining started.  Accessed atomically if
+   * #HAVE_ATOMIC_BUILTINS.
+   */
+  int drain_pending;
+
+  /**
+   * Number of active parallel connections.
+   */
+  unsigned int connections;
+
+  /**
+   * Statistics of this daemon (or worker), updated with
+   * #MHD_STATS_ADD_(); points to @e stats_storage, or to a slot of
+   * the shared memory of #MHD_OPTION_PREFORK_WORKERS.
+   */
+  struct MHD_DaemonStats *stats;
+
+  /**
+   * Statistics of this daemon (or worker) unless they are shared.
+   */
+  struct MHD_DaemonStats stats_storage;
+
+  /**
+   * Statistics summed up over the workers for the last
+   * #MHD_DAEMON_INFO_STATS request.
+   */
+  struct MHD_DaemonStats stats_snapshot;
+
+  /**
+   * Buffer of the last response of #MHD_create_metrics_response()
+   * that was destroyed, kept for the next one (master daemon only).
+   */
+  struct MHD_MetricsBuffer *metrics_cache;
+
+  /**
+   * Latency histograms of the requests completed by this daemon (or
+   * worker), indexed by `enum MHD_LatencyType`.  Updated with
+   * #MHD_LATENCY_ADD_().
+   */
+  struct MHD_LatencyHistogram latency[2];
+
+  /**
+   * Histogram of the peak memory pool usage in bytes of the
+   * connections closed by this daemon (or worker).  Updated with
+   * #MHD_LATENCY_ADD_().
+   */
+  struct MHD_LatencyHistogram pool_usage;
+
+  /**
+   * Limit on the number of parallel connections.
+   */
+  unsigned int connection_limit;
+
+  /**
+   * After how many milliseconds of inactivity should
+   * connections time out?  Zero for no timeout.
+   */
+  uint64_t connection_timeout;
+
+  /**
+   * Milliseconds from the first byte of a request to the end of its
+   * headers, see #MHD_OPTION_HEADER_TIMEOUT_MS.  Zero for no limit.
+   */
+  uint64_t header_timeout;
+
+  /**
+   * Bytes per second, see #MHD_OPTION_MIN_DATA_RATE.  Zero for no
+   * minimum.
+   */
+  unsigned int min_data_rate;
+
+  /**
+   * Milliseconds #MHD_stop_daemon() drains connections for, see
+   * #MHD_OPTION_SHUTDOWN_GRACE_MS.  Zero to close them at once.
+   */
+  unsigned int shutdown_grace;
+
+  /**
+   * #MHD_monotonic_msec_counter() value taken once per iteration of
+   * the event loop, see #MHD_loop_time_().
+   */
+  uint64_t loop_time;
+
+  /**
+   * Maximum number of connections per IP, or 0 for
+   * unlimited.
+   */
+  unsigned int per_ip_connection_limit;
+
+  /**
+   * Daemon's flags (bitfield).
+   */
+  enum MHD_FLAG options;
+
+  /**
+   * Listen port.
+   */
+  uint16_t port;
+
+#if HTTPS_SUPPORT
+  /**
+   * What kind of credentials are we offering for SSL/TLS?  Only
+   * #MHD_TLS_CRD_CERTIFICATE is supported.
+   */
+  int cred_type;
+
+  /**
+   * Pointer to our SSL/TLS key (in ASCII) in memory.
+   */
+  const char *https_mem_key;
+
+  /**
+   * Pointer to our SSL/TLS certificate (in ASCII) in memory.
+   */
+  const char *https_mem_cert;
+
+  /**
+   * Pointer to 0-terminated HTTPS passphrase in memory.
+   */
+  const char *https_key_password;
+
+  /**
+   * Pointer to our SSL/TLS certificate authority (in ASCII) in memory.
+   */
+  const char *https_mem_trust;
+
+  /**
+   * Certificates given with #MHD_OPTION_HTTPS_CERT_TABLE, only valid
+   * while #MHD_start_daemon() runs.
+   */
+  const struct MHD_HttpsCertificate *https_cert_table;
+
+  /**
+   * Number of entries in @e https_cert_table.
+   */
+  unsigned int https_cert_table_size;
+
+#if HTTPS_OPENSSL
+  /**
+   * Context with our credentials and settings, shared by the master
+   * daemon and its worker daemons.
+   */
+  SSL_CTX *tls_ctx;
+
+  /**
+   * Cipher list given with #MHD_OPTION_HTTPS_PRIORITIES, only valid
+   * while #MHD_start_daemon() runs; NULL for the default.
+   */
+  const char *tls_cipher_list;
+
+  /**
+   * Diffie-Hellman parameters, NULL if none were given.
+   */
+  EVP_PKEY *tls_dh_params;
+
+  /**
+   * #MHD_YES if session tickets are enabled.  See
+   * #MHD_OPTION_HTTPS_SESSION_TICKETS.
+   */
+  int tls_session_tickets;
+
+  /**
+   * Number of sessions to cache, 0 for no cache.  See
+   * #MHD_OPTION_HTTPS_SESSION_CACHE_SIZE.
+   */
+  unsigned int tls_session_cache_size;
+#else
+  /**
+   * Desired cipher algorithms.
+   */
+  gnutls_priority_t priority_cache;
+
+  /**
+   * Server x509 credentials
+   */
+  gnutls_certificate_credentials_t x509_cred;
+
+#if GNUTLS_VERSION_MAJOR >= 3
+  /**
+   * Function that can be used to obtain the certificate.  Needed
+   * for SNI support.  See #MHD_OPTION_HTTPS_CERT_CALLBACK.
+   */
+  gnutls_certificate_retrieve_function2 *cert_callback;
+#endif
+
+  /**
+   * Our Diffie-Hellman parameters in memory.
+   */
+  gnutls_dh_params_t https_mem_dhparams;
+
+  /**
+   * #MHD_YES if we have initialized @e https_mem_dhparams.
+   */
+  int have_dhparams;
+
+  /**
+   * Key to encrypt TLS session tickets with, data is NULL if tickets
+   * are not used.  See #MHD_OPTION_HTTPS_SESSION_TICKETS.
+   */
+  gnutls_datum_t tls_ticket_key;
+
+  /**
+   * Cache of TLS sessions shared by the master daemon and its worker
+   * daemons, NULL if none.  See #MHD_OPTION_HTTPS_SESSION_CACHE_SIZE.
+   */
+  struct MHD_TlsSessionCache *tls_session_cache;
+
+  /**
+   * Credentials by host name built from @e https_cert_table, shared
+   * by the master daemon and its worker daemons; NULL if none.
+   */
+  struct MHD_TlsSniTable *sni_table;
+#endif
+
+  /**
+   * Number of threads to run TLS handshakes on, 0 to run them in
+   * the event loop.  See #MHD_OPTION_HTTPS_HANDSHAKE_THREADS.
+   */
+  unsigned int handshake_thread_count;
+
+  /**
+   * Number of bytes to send in small TLS records at the beginning of
+   * a connection and after idle periods, 0 for no small records.
+   * See #MHD_OPTION_HTTPS_DYNAMIC_RECORD_SIZE.
+   */
+  size_t tls_small_record_limit;
+
+  /**
+   * Threads running TLS handshakes, shared by the master daemon and
+   * its worker daemons; NULL if @e handshake_thread_count is 0.
+   */
+  struct MHD_HandshakePool *handshake_pool;
+
+  /**
+   * Head of the DLL of connections that are not suspended and have
+   * 'tls_read_ready' set to #MHD_YES, i.e. for which the TLS library may hold
+   * decrypted data that does not make the socket readable.  The
+   * event loop must not block while it is not empty, and it visits
+   * just these connections instead of probing all sessions.
+   */
+  struct MHD_Connection *tls_ready_head;
+
+  /**
+   * Tail of the DLL of connections with 'tls_read_ready' set.
+   */
+  struct MHD_Connection *tls_ready_tail;
+
+#endif
+
+#ifdef DAUTH_SUPPORT
+
+  /**
+   * Character array of random values.
+   */
+  const char *digest_auth_random;
+
+  /**
+   * An array that contains the map nonce-nc, made of sets of
+   * #MHD_NONCE_NC_WAYS entries.  Shared with the worker daemons.
+   */
+  struct MHD_NonceNc *nnc;
+
+  /**
+   * Locks for synchronizing access to the sets of `nnc', only
+   * those of the master daemon are used.
+   */
+  struct MHD_NonceNcLocks *nnc_locks;
+
+  /**
+   * Size of `digest_auth_random.
+   */
+  size_t digest_auth_rand_size;
+
+  /**
+   * Size of the nonce-nc array.
+   */
+  unsigned int nonce_nc_size;
+
+  /**
+   * Cache of H(A1) values for #MHD_digest_auth_check(), only the one
+   * of the master daemon is used.
+   */
+  struct MHD_HA1CacheEntry *ha1_cache;
+
+  /**
+   * Key of the hashes of the passwords in `ha1_cache`.
+   */
+  uint64_t ha1_cache_key[2];
+
+  /**
+   * Number of entries of `ha1_cache`.
+   */
+  unsigned int ha1_cache_size;
+
+#endif
+
+#ifdef BAUTH_SUPPORT
+  /**
+   * Cache of verified Basic authorization headers, see
+   * #MHD_basic_auth_check_cached(); only the one of the master
+   * daemon is used.
+   */
+  struct MHD_BasicAuthCacheEntry *basic_auth_cache;
+
+  /**
+   * Number of entries of `basic_auth_cache`.
+   */
+  unsigned int basic_auth_cache_size;
+
+  /**
+   * Seconds an entry of `basic_auth_cache` stays valid.
+   */
+  unsigned int basic_auth_cache_ttl;
+#endif
+
+#ifdef TCP_FASTOPEN
+  /**
+   * The queue size for incoming SYN + DATA packets.
+   */
+  unsigned int fastopen_queue_size;
+#endif
+
+  /**
+   * The size of queue for listen socket.
+   */
+  unsigned int listen_backlog_size;
+
+  /**
+   * Maximum number of connections to accept from the listen socket
+   * per readiness notification, see #MHD_OPTION_ACCEPT_BATCH_SIZE.
+   */
+  unsigned int accept_batch_size;
+
+  /**
+   * Seconds to wait for data before connections are reported on the
+   * listen socket, 0 for off, see #MHD_OPTION_TCP_DEFER_ACCEPT.
+   */
+  unsigned int defer_accept;
+
+  /**
+   * Maximum number of bytes to write to a connection per iteration
+   * of the event loop, 0 for no limit, see #MHD_OPTION_WRITE_QUANTUM.
+   */
+  size_t write_quantum;
+
+  /**
+   * Milliseconds of average event loop lag or handler latency from
+   * which new requests are rejected, 0 for off, see
+   * #MHD_OPTION_OVERLOAD_LATENCY.
+   */
+  unsigned int overload_latency;
+
+  /**
+   * Seconds clients are asked to wait before retrying a request
+   * rejected due to overload, see #MHD_OPTION_OVERLOAD_RETRY_AFTER.
+   */
+  unsigned int overload_retry_after;
+
+  /**
+   * #MHD_monotonic_msec_counter() value at which the event loop
+   * returned from waiting for events, 0 while it is waiting (or not
+   * watched).  The time until this iteration is done is its lag.
+   */
+  uint64_t loop_wake;
+
+  /**
+   * Average lag of the event loop of this daemon (or worker) in
+   * milliseconds, times #MHD_OVERLOAD_AVG_SCALE.
+   */
+  uint64_t loop_lag_avg;
+
+  /**
+   * Average time the access handler takes to return in milliseconds,
+   * times #MHD_OVERLOAD_AVG_SCALE.  Requests rejected due to
+   * overload count as handled at once, so that new requests are
+   * tried again when the handlers keep being avoided.
+   */
+  uint64_t handler_latency_avg;
+
+  /**
+   * Function to call with the profile of the event loop of this
+   * daemon (or worker), see #MHD_OPTION_LOOP_STATS_CALLBACK.
+   */
+  MHD_LoopStatsCallback loop_stats_callback;
+
+  /**
+   * Closure for @e loop_stats_callback.
+   */
+  void *loop_stats_callback_cls;
+
+  /**
+   * Milliseconds between calls of @e loop_stats_callback.
+   */
+  unsigned int loop_stats_interval;
+
+  /**
+   * #MHD_monotonic_usec_counter() value at which the current event
+   * loop iteration started.
+   */
+  uint64_t loop_start;
+
+  /**
+   * #MHD_monotonic_usec_counter() value at which the event loop
+   * started waiting for events.
    */
-  int listening_address_reuse;
+  uint64_t loop_wait_start;
 
-#if EPOLL_SUPPORT
   /**
-   * File descriptor associated with our epoll loop.
+   * #MHD_monotonic_usec_counter() value at which the event loop
+   * returned from waiting for events, for the lag of the steps of
+   * #MHD_OPTION_SLOW_REQUEST_CALLBACK.
    */
-  int epoll_fd;
+  uint64_t loop_woke_usec;
 
   /**
-   * MHD_YES if the listen socket is in the 'epoll' set,
-   * MHD_NO if not.
+   * Microseconds the current event loop iteration waited for events.
    */
-  int listen_socket_in_epoll;
-#endif
+  uint64_t loop_waited;
 
   /**
-   * Pipe we use to signal shutdown, unless
-   * 'HAVE_LISTEN_SHUTDOWN' is defined AND we have a listen
-   * socket (which we can then 'shutdown' to stop listening).
-   * MHD can be build with usage of socketpair instead of
-   * pipe (forced on W32).
+   * #MHD_monotonic_usec_counter() value of the last call of
+   * @e loop_stats_callback (or of the first iteration).
    */
-  MHD_pipe wpipe[2];
+  uint64_t loop_report_time;
 
   /**
-   * Are we shutting down?
+   * Counters of @e stats at the last call of @e loop_stats_callback,
+   * the next call reports the difference.
    */
-  int shutdown;
+  struct MHD_LoopStats loop_report;
 
-  /*
-   * Do we need to process resuming connections?
+  /**
+   * Function to pass batches of access log records to, see
+   * #MHD_OPTION_ACCESS_LOG_CALLBACK.
    */
-  int resuming;
+  MHD_AccessLogCallback access_log_callback;
 
   /**
-   * Number of active parallel connections.
+   * Closure for @e access_log_callback.
    */
-  unsigned int connections;
+  void *access_log_callback_cls;
 
   /**
-   * Limit on the number of parallel connections.
+   * Function to pass the timelines of slow requests to, see
+   * #MHD_OPTION_SLOW_REQUEST_CALLBACK.
    */
-  unsigned int connection_limit;
+  MHD_SlowRequestCallback slow_request_callback;
 
   /**
-   * After how many seconds of inactivity should
-   * connections time out?  Zero for no timeout.
+   * Closure for @e slow_request_callback.
    */
-  unsigned int connection_timeout;
+  void *slow_request_callback_cls;
 
   /**
-   * Maximum number of connections per IP, or 0 for
-   * unlimited.
+   * Milliseconds from which requests are slow, see
+   * #MHD_OPTION_SLOW_REQUEST_THRESHOLD_MS.
    */
-  unsigned int per_ip_connection_limit;
+  unsigned int slow_request_threshold;
 
   /**
-   * Daemon's flags (bitfield).
+   * File descriptor to write the access log to, -1 for none; see
+   * #MHD_OPTION_ACCESS_LOG_FD.
    */
-  enum MHD_FLAG options;
+  int access_log_fd;
 
   /**
-   * Listen port.
+   * Number of records in @e access_log, see
+   * #MHD_OPTION_ACCESS_LOG_BATCH_SIZE.
    */
-  uint16_t port;
+  unsigned int access_log_size;
 
-#if HTTPS_SUPPORT
   /**
-   * Desired cipher algorithms.
+   * Milliseconds between flushes of @e access_log, see
+   * #MHD_OPTION_ACCESS_LOG_INTERVAL.
    */
-  gnutls_priority_t priority_cache;
+  unsigned int access_log_interval;
 
   /**
-   * What kind of credentials are we offering
-   * for SSL/TLS?
+   * Records of the access log of this daemon (or worker) not yet
+   * passed on; allocated by the thread of the event loop when the
+   * first request completes, and only used by that thread.
    */
-  gnutls_credentials_type_t cred_type;
+  struct MHD_AccessLogRecord *access_log;
 
   /**
-   * Server x509 credentials
+   * Number of records used in @e access_log.
    */
-  gnutls_certificate_credentials_t x509_cred;
+  unsigned int access_log_used;
 
   /**
-   * Diffie-Hellman parameters
+   * #MHD_monotonic_usec_counter() value of the last flush of
+   * @e access_log.
    */
-  gnutls_dh_params_t dh_params;
+  uint64_t access_log_flushed;
 
-#if GNUTLS_VERSION_MAJOR >= 3
+#if EPOLL_SUPPORT
   /**
-   * Function that can be used to obtain the certificate.  Needed
-   * for SNI support.  See #MHD_OPTION_HTTPS_CERT_CALLBACK.
+   * Number of microseconds the epoll() loop keeps polling without
+   * blocking after the last event, see #MHD_OPTION_EPOLL_BUSY_POLL;
+   * 0 to block right away.
    */
-  gnutls_certificate_retrieve_function2 *cert_callback;
-#endif
+  unsigned int busy_poll_usec;
 
   /**
-   * Pointer to our SSL/TLS key (in ASCII) in memory.
+   * Monotonic time (in microseconds) of the last iteration of the
+   * epoll() loop that returned events.
    */
-  const char *https_mem_key;
+  uint64_t busy_poll_last_event;
 
   /**
-   * Pointer to our SSL/TLS certificate (in ASCII) in memory.
+   * Array receiving the events of epoll_wait(), allocated by the
+   * first iteration of the epoll() loop; NULL before.
    */
-  const char *https_mem_cert;
+  struct epoll_event *epoll_events;
 
   /**
-   * Pointer to 0-terminated HTTPS passphrase in memory.
+   * Number of entries in @e epoll_events, doubled whenever
+   * epoll_wait() fills the array, up to @e epoll_max_events.
    */
-  const char *https_key_password;
+  unsigned int epoll_events_size;
 
   /**
-   * Pointer to our SSL/TLS certificate authority (in ASCII) in memory.
+   * Limit for @e epoll_events_size, see #MHD_OPTION_EPOLL_MAX_EVENTS.
    */
-  const char *https_mem_trust;
+  unsigned int epoll_max_events;
+#endif
 
   /**
-   * Our Diffie-Hellman parameters in memory.
+   * Unused memory pools kept for new connections of this daemon
+   * (or worker), see #MHD_OPTION_CONNECTION_POOL_CACHE_SIZE.  Only
+   * accessed by the thread running the event loop.
    */
-  gnutls_dh_params_t https_mem_dhparams;
+  struct MemoryPool *pool_cache;
 
   /**
-   * #MHD_YES if we have initialized @e https_mem_dhparams.
+   * Number of pools in @e pool_cache.
    */
-  int have_dhparams;
+  unsigned int pool_cache_len;
 
   /**
-   * For how many connections do we have 'tls_read_ready' set to MHD_YES?
-   * Used to avoid O(n) traversal over all connections when determining
-   * event-loop timeout (as it needs to be zero if there is any connection
-   * which might have ready data within TLS).
+   * Maximum number of pools to keep in @e pool_cache,
+   * 0 with #MHD_USE_THREAD_PER_CONNECTION.
    */
-  unsigned int num_tls_read_ready;
+  unsigned int pool_cache_max;
 
-#endif
+  /**
+   * Idle compressors for responses with #MHD_RO_COMPRESSION_LEVEL,
+   * kept for reuse (not used with #MHD_USE_THREAD_PER_CONNECTION).
+   */
+  struct MHD_Compressor *compressor_cache;
 
-#ifdef DAUTH_SUPPORT
+  /**
+   * Number of compressors in @e compressor_cache.
+   */
+  unsigned int compressor_cache_len;
 
   /**
-   * Character array of random values.
+   * Idle decompressors for request bodies, kept for reuse (not used
+   * with #MHD_USE_THREAD_PER_CONNECTION).
    */
-  const char *digest_auth_random;
+  struct MHD_Inflater *inflater_cache;
 
   /**
-   * An array that contains the map nonce-nc.
+   * Number of decompressors in @e inflater_cache.
    */
-  struct MHD_NonceNc *nnc;
+  unsigned int inflater_cache_len;
 
   /**
-   * A rw-lock for synchronizing access to `nnc'.
+   * Maximum ratio of decompressed to received bytes of a request
+   * body, 0 to pass bodies as received; see
+   * #MHD_OPTION_INFLATE_REQUEST_BODY.
    */
-  MHD_mutex_ nnc_lock;
+  unsigned int inflate_ratio;
 
   /**
-   * Size of `digest_auth_random.
+   * Connection objects of closed connections kept for reuse, linked
+   * via their @e next field.  Bounded by @e pool_cache_max and only
+   * accessed by the thread running the event loop.
    */
-  size_t digest_auth_rand_size;
+  struct MHD_Connection *connection_cache;
 
   /**
-   * Size of the nonce-nc array.
+   * Number of connections in @e connection_cache.
    */
-  unsigned int nonce_nc_size;
+  unsigned int connection_cache_len;
 
-#endif
+  /**
+   * Cached "Date:" header line (including the trailing CRLF), shared
+   * by all connections of this daemon; empty if not yet generated.
+   */
+  char date_cache[128];
 
-#ifdef TCP_FASTOPEN
   /**
-   * The queue size for incoming SYN + DATA packets.
+   * Length of the string in @e date_cache.
    */
-  unsigned int fastopen_queue_size;
-#endif
+  size_t date_cache_len;
 
   /**
-   * The size of queue for listen socket.
+   * Wall-clock second (`time()`) @e date_cache was generated in.
    */
-  unsigned int listen_backlog_size;
+  time_t date_cache_time;
 };
 
 
@@ -1423,6 +3962,24 @@ struct MHD_Daemon
   (head) = (element); } while (0)
 
 
+/**
+ * Insert an element at the tail of a EDLL. Assumes that head, tail
+ * and element are structs with prevE and nextE fields.
+ *
+ * @param head pointer to the head of the EDLL
+ * @param tail pointer to the tail of the EDLL
+ * @param element element to insert
+ */
+#define EDLL_insert_tail(head,tail,element) do { \
+  (element)->prevE = (tail); \
+  (element)->nextE = NULL; \
+  if ((head) == NULL) \
+    (head) = element; \
+  else \
+    (tail)->nextE = element; \
+  (tail) = (element); } while (0)
+
+
 /**
  * Remove an element from a EDLL. Assumes
  * that head, tail and element are structs
@@ -1445,6 +4002,46 @@ struct MHD_Daemon
   (element)->prevE = NULL; } while (0)
 
 
+/**
+ * Insert an element at the head of a GDLL. Assumes that head, tail and
+ * element are structs with prevG and nextG fields.
+ *
+ * @param head pointer to the head of the GDLL
+ * @param tail pointer to the tail of the GDLL
+ * @param element element to insert
+ */
+#define GDLL_insert(head,tail,element) do { \
+  (element)->nextG = (head); \
+  (element)->prevG = NULL; \
+  if (NULL == (tail)) \
+    (tail) = element; \
+  else \
+    (head)->prevG = element; \
+  (head) = (element); } while (0)
+
+
+/**
+ * Remove an element from a GDLL. Assumes
+ * that head, tail and element are structs
+ * with prevG and nextG fields.
+ *
+ * @param head pointer to the head of the GDLL
+ * @param tail pointer to the tail of the GDLL
+ * @param element element to remove
+ */
+#define GDLL_remove(head,tail,element) do { \
+  if (NULL == (element)->prevG) \
+    (head) = (element)->nextG;  \
+  else \
+    (element)->prevG->nextG = (element)->nextG; \
+  if (NULL == (element)->nextG) \
+    (tail) = (element)->prevG;  \
+  else \
+    (element)->nextG->prevG = (element)->prevG; \
+  (element)->nextG = NULL; \
+  (element)->prevG = NULL; } while (0)
+
+
 /**
  * Convert all occurences of '+' to ' '.
  *
@@ -1460,7 +4057,9 @@ MHD_unescape_plus (char *arg);
  *
  * @param connection context of the iteration
  * @param key 0-terminated key string, never NULL
+ * @param key_size number of bytes in @a key
  * @param value 0-terminated value string, may be NULL
+ * @param value_size number of bytes in @a value
  * @param kind origin of the key-value pair
  * @return #MHD_YES on success (continue to iterate)
  *         #MHD_NO to signal failure (and abort iteration)
@@ -1468,7 +4067,9 @@ MHD_unescape_plus (char *arg);
 typedef int
 (*MHD_ArgumentIterator_)(struct MHD_Connection *connection,
 			 const char *key,
+			 size_t key_size,
 			 const char *value,
+			 size_t value_size,
 			 enum MHD_ValueKind kind);
 
 
@@ -1494,4 +4095,309 @@ MHD_parse_arguments_ (struct MHD_Connection *connection,
 		      unsigned int *num_headers);
 
 
+/**
+ * Convert all occurences of '+' to ' ' and process escape sequences
+ * ('%HH'), in a single pass.  Same as #MHD_unescape_plus() followed
+ * by #MHD_http_unescape().
+ *
+ * @param val value to unescape (modified in the process)
+ * @return length of the resulting val
+ */
+size_t
+MHD_http_unescape_plus_ (char *val);
+
+
+/**
+ * Default #MHD_UnescapeCallback, uses #MHD_http_unescape().
+ *
+ * @param cls closure (use NULL)
+ * @param connection handle to connection, not used
+ * @param val value to unescape (modified in the process)
+ * @return length of the resulting val (strlen(val) maybe
+ *  shorter afterwards due to elimination of escape sequences)
+ */
+size_t
+MHD_default_unescape_ (void *cls,
+                       struct MHD_Connection *connection,
+                       char *val);
+
+
+/**
+ * Classify a header name.
+ *
+ * @param name header name, may be NULL
+ * @param name_size number of bytes in @a name
+ * @return token of @a name, #MHD_HEADER_TOKEN_NONE if it
+ *         is not a well-known header name
+ */
+enum MHD_HeaderToken
+MHD_get_header_token_ (const char *name,
+                       size_t name_size);
+
+
+/**
+ * Suspend a connection whose content reader returned
+ * #MHD_CONTENT_READER_PENDING until the application calls
+ * #MHD_response_data_ready(), unless it did so already.
+ *
+ * @param connection the connection waiting for body data
+ */
+void
+MHD_connection_wait_for_data_ (struct MHD_Connection *connection);
+
+
+/**
+ * Call #MHD_response_data_ready() for all connections in the list
+ * @a head (linked by @e bc_next), locking the cleanup mutex and
+ * waking up the event loop only once per daemon.
+ *
+ * @param head first connection of the list, may be NULL
+ */
+void
+MHD_connections_data_ready_ (struct MHD_Connection *head);
+
+
+/**
+ * Suspend the connection of an HTTP/2 session that is to be closed
+ * while the application still holds suspended streams of it: the
+ * streams must stay valid until they are resumed, which then resumes
+ * the connection as well.
+ *
+ * @param connection connection in #MHD_CONNECTION_HTTP2 state
+ * @return #MHD_YES if the connection was suspended, #MHD_NO if no
+ *         stream is suspended (any more)
+ */
+int
+MHD_http2_park_ (struct MHD_Connection *connection);
+
+
+/**
+ * Move the connections from the resume queue of @a daemon to its
+ * list of resumed connections.  Assumes that the cleanup mutex of
+ * the daemon is held.
+ *
+ * @param daemon daemon to collect the resumed connections of
+ */
+void
+MHD_collect_resumed_connections_ (struct MHD_Daemon *daemon);
+
+
+/**
+ * Take the memory of one connection pool from the budget of
+ * @a daemon (see #MHD_OPTION_MEMORY_BUDGET) before creating the
+ * pool.  Safe to call from any thread.
+ *
+ * @param daemon daemon (or worker) the pool is for
+ * @return #MHD_YES on success (or if there is no budget),
+ *         #MHD_NO if the budget is exhausted
+ */
+int
+MHD_memory_budget_take_ (struct MHD_Daemon *daemon);
+
+
+/**
+ * Return the memory taken with MHD_memory_budget_take_() after
+ * destroying (or caching) the pool.
+ *
+ * @param daemon daemon (or worker) the pool was for
+ */
+void
+MHD_memory_budget_return_ (struct MHD_Daemon *daemon);
+
+
+/**
+ * Check if the budget of @a daemon is too small for another pool.
+ *
+ * @param daemon daemon (or worker) to check
+ * @return #MHD_YES if no further pool can be created
+ */
+int
+MHD_memory_budget_exhausted_ (struct MHD_Daemon *daemon);
+
+
+/**
+ * Release the pools of connections that wait for their next request
+ * (least recently active first) until the budget of @a daemon has
+ * room for another pool.  Must be called from the thread running the
+ * event loop of @a daemon.
+ *
+ * @param daemon daemon (or worker) to release pools of
+ * @return #MHD_YES if there is room for another pool now
+ */
+int
+MHD_memory_budget_reclaim_ (struct MHD_Daemon *daemon);
+
+
+/**
+ * Get the current time for the timeouts of the connections of
+ * @a daemon: the time cached by the current iteration of its event
+ * loop, so that reading and writing need not query the clock.
+ * With #MHD_USE_THREAD_PER_CONNECTION, the clock is read.
+ *
+ * @param daemon daemon (or worker) to get the time for
+ * @return milliseconds, see #MHD_monotonic_msec_counter()
+ */
+uint64_t
+MHD_loop_time_ (struct MHD_Daemon *daemon);
+
+
+/**
+ * Update the events of the entry of @a connection in the poll set
+ * (or the fd sets of #MHD_USE_LARGE_FD_SETS) of its daemon after its
+ * 'event_loop_info' changed.  Does nothing if the connection is in
+ * neither.
+ *
+ * @param connection the connection to update
+ */
+void
+MHD_poll_set_update_ (struct MHD_Connection *connection);
+
+
+/**
+ * Remove @a connection from the poll set (or the fd sets of
+ * #MHD_USE_LARGE_FD_SETS) of its daemon, if it is in one.  Must be
+ * called from the thread running the event loop.
+ *
+ * @param connection the connection to remove
+ */
+void
+MHD_poll_set_remove_ (struct MHD_Connection *connection);
+
+
+/**
+ * Tell the #MHD_NotifySocketCallback of the daemon of @a connection
+ * (if any) about the events to wait for on its socket after its
+ * 'event_loop_info' changed or it was suspended.  Does nothing if
+ * the events did not change.
+ *
+ * @param connection the connection to update
+ */
+void
+MHD_socket_interest_update_ (struct MHD_Connection *connection);
+
+
+/**
+ * Choose the function sending the data of @a connection for the
+ * response it just queued: plain connections use sendfile() only
+ * for responses from files.  Does nothing for TLS connections.
+ *
+ * @param connection connection with a new response
+ */
+void
+MHD_connection_set_send_adapter_ (struct MHD_Connection *connection);
+
+
+/**
+ * Suspend a connection and hand a step of its request processing to
+ * the handler threads of the daemon (see #MHD_OPTION_HANDLER_THREADS).
+ *
+ * @param connection the connection to run @a step for
+ * @param step the step to run
+ * @return #MHD_YES if the step was handed to the handler threads,
+ *         #MHD_NO if it must be run by the caller
+ */
+int
+MHD_handler_offload_ (struct MHD_Connection *connection,
+                      MHD_HandlerStep step);
+
+
+/**
+ * Let a handler thread of the daemon call the content reader for the
+ * block at @e prefetch_pos of the connection (see #MHD_RF_PREFETCH).
+ * Once the block is read, @e prefetch_state becomes
+ * #MHD_PREFETCH_DONE and the connection is resumed if it waits for
+ * data (see MHD_connection_wait_for_data_()).
+ *
+ * @param connection the connection, with @e prefetch_buf and
+ *        @e prefetch_pos set
+ * @return #MHD_YES if a handler thread will read the block,
+ *         #MHD_NO if the daemon has no (more) handler threads
+ */
+int
+MHD_prefetch_submit_ (struct MHD_Connection *connection);
+
+
+/**
+ * Check if a handler thread still reads ahead a block of the body
+ * of a closed connection into its memory pool (see #MHD_RF_PREFETCH);
+ * neither the response nor the pool may be released before it is
+ * done.
+ *
+ * @param connection the closed connection
+ * @return #MHD_YES if the connection is still in use
+ */
+int
+MHD_prefetch_busy_ (struct MHD_Connection *connection);
+
+
+/**
+ * Sum up the statistics of @a daemon over its workers (and worker
+ * processes), as returned for #MHD_DAEMON_INFO_STATS.
+ *
+ * @param daemon the (master) daemon
+ * @param[out] sum set to the statistics
+ */
+void
+MHD_collect_stats_ (struct MHD_Daemon *daemon,
+                    struct MHD_DaemonStats *sum);
+
+
+#if HTTPS_SUPPORT
+/**
+ * Suspend a connection in #MHD_TLS_CONNECTION_INIT and hand its TLS
+ * handshake to one of the handshake threads of the daemon.
+ *
+ * @param connection the connection to run the handshake for
+ * @return #MHD_YES if a handshake thread took the connection,
+ *         #MHD_NO if the handshake must be run by the caller
+ */
+int
+MHD_tls_handshake_offload_ (struct MHD_Connection *connection);
+#endif
+
+#ifdef DAUTH_SUPPORT
+/**
+ * Create the H(A1) cache of a (master) daemon, if
+ * #MHD_OPTION_DIGEST_AUTH_HA1_CACHE_SIZE was given.
+ *
+ * @param daemon daemon to create the cache for
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+int
+MHD_digest_ha1_cache_init_ (struct MHD_Daemon *daemon);
+
+
+/**
+ * Destroy the H(A1) cache of a (master) daemon, wiping the
+ * passwords kept in it.
+ *
+ * @param daemon daemon to destroy the cache of
+ */
+void
+MHD_digest_ha1_cache_destroy_ (struct MHD_Daemon *daemon);
+#endif
+
+#ifdef BAUTH_SUPPORT
+/**
+ * Create the cache of verified Basic authorization headers of a
+ * (master) daemon, if #MHD_OPTION_BASIC_AUTH_CACHE_SIZE was given.
+ *
+ * @param daemon daemon to create the cache for
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+int
+MHD_basic_auth_cache_init_ (struct MHD_Daemon *daemon);
+
+
+/**
+ * Destroy the cache of verified Basic authorization headers of a
+ * (master) daemon.
+ *
+ * @param daemon daemon to destroy the cache of
+ */
+void
+MHD_basic_auth_cache_destroy_ (struct MHD_Daemon *daemon);
+#endif
+
+
 #endif
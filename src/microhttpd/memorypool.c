@@ -23,6 +23,7 @@
  * @author Christian Grothoff
  */
 #include "memorypool.h"
+#include "mhd_probes.h"
 
 /* define MAP_ANONYMOUS for Mac OS X */
 #if defined(MAP_ANON) && !defined(MAP_ANONYMOUS)
@@ -31,6 +32,21 @@
 #ifndef MAP_FAILED
 #define MAP_FAILED ((void*)-1)
 #endif
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+/**
+ * Dirty areas of mmap'ed pools at least this large are handed back
+ * to the kernel on reset instead of being zeroed, so that a pool only
+ * keeps as much memory committed as its connection currently needs.
+ */
+#define MHD_POOL_RELEASE_THRESHOLD (16 * 1024)
+
+/**
+ * Size of a memory page, 0 if unknown (or pages cannot be released).
+ */
+static size_t MHD_sys_page_size_;
 
 /**
  * Align to 2x word size (as GNU libc does).
@@ -70,15 +86,106 @@ struct MemoryPool
    */
   size_t end;
 
+  /**
+   * Highest value @e pos had since the pool was last cleared;
+   * memory between this offset and @e end is known to be zero.
+   */
+  size_t dirty;
+
+  /**
+   * Highest number of bytes allocated at the same time since the
+   * pool was created or put into a pool cache.
+   */
+  size_t peak;
+
   /**
    * #MHD_NO if pool was malloc'ed, #MHD_YES if mmapped (VirtualAlloc'ed for W32).
    */
   int is_mmap;
+
+  /**
+   * Next unused pool in a pool cache, see #MHD_pool_destroy_cached().
+   */
+  struct MemoryPool *next;
 };
 
 
 /**
- * Create a memory pool.
+ * Initialize values for memory pools.
+ */
+void
+MHD_init_mem_pools_ (void)
+{
+#if defined(MADV_DONTNEED) && defined(_SC_PAGESIZE) && !defined(_WIN32)
+  long result;
+
+  result = sysconf (_SC_PAGESIZE);
+  MHD_sys_page_size_ = (result > 0) ? (size_t) result : 0;
+#else
+  MHD_sys_page_size_ = 0;
+#endif
+}
+
+
+/**
+ * Update the peak usage of @a pool after an allocation.
+ *
+ * @param pool memory pool that was allocated from
+ */
+static void
+update_peak (struct MemoryPool *pool)
+{
+  size_t used;
+
+  used = pool->pos + (pool->size - pool->end);
+  if (used > pool->peak)
+    pool->peak = used;
+}
+
+
+/**
+ * Zero the bytes from @a from to @a to of @a pool.  Large areas of
+ * mmap'ed pools are returned to the kernel instead, which gives us
+ * zero-filled pages again on the next access.
+ *
+ * @param pool memory pool to clear
+ * @param from offset of the first byte to zero
+ * @param to offset after the last byte to zero
+ */
+static void
+clear_area (struct MemoryPool *pool,
+            size_t from,
+            size_t to)
+{
+#if defined(MADV_DONTNEED) && !defined(_WIN32)
+  size_t first;
+  size_t last;
+
+  if ( (MHD_YES == pool->is_mmap) &&
+       (0 != MHD_sys_page_size_) &&
+       (to - from >= MHD_POOL_RELEASE_THRESHOLD) )
+    {
+      first = (from + MHD_sys_page_size_ - 1) & ~(MHD_sys_page_size_ - 1);
+      last = to & ~(MHD_sys_page_size_ - 1);
+      if ( (first < last) &&
+           (0 == madvise (&pool->memory[first],
+                          last - first,
+                          MADV_DONTNEED)) )
+        {
+          memset (&pool->memory[from], 0, first - from);
+          memset (&pool->memory[last], 0, to - last);
+          return;
+        }
+    }
+#endif
+  memset (&pool->memory[from], 0, to - from);
+}
+
+
+/**
+ * Create a memory pool.  Memory of large pools is only committed
+ * as it is used, and returned by #MHD_pool_reset() once no longer
+ * needed.
  *
  * @param max maximum size of the pool
  * @return NULL on error
@@ -97,7 +204,7 @@ MHD_pool_create (size_t max)
   else
 #if defined(MAP_ANONYMOUS) && !defined(_WIN32)
     pool->memory = mmap (NULL, max, PROT_READ | PROT_WRITE,
-			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
 #elif defined(_WIN32)
     pool->memory = VirtualAlloc(NULL, max, MEM_COMMIT | MEM_RESERVE,
         PAGE_READWRITE);
@@ -114,18 +221,104 @@ MHD_pool_create (size_t max)
           return NULL;
         }
       pool->is_mmap = MHD_NO;
+      /* malloc'ed memory is not zeroed, clear on first reset */
+      pool->dirty = max;
     }
   else
     {
       pool->is_mmap = MHD_YES;
+      pool->dirty = 0;
     }
   pool->pos = 0;
   pool->end = max;
   pool->size = max;
+  pool->peak = 0;
+  pool->next = NULL;
   return pool;
 }
 
 
+/**
+ * Create a memory pool, reusing a pool from @a cache if possible.
+ * All pools in the cache must have been created with the same
+ * @a max.
+ *
+ * @param cache head of the list of unused pools
+ * @param cache_len number of pools in @a cache
+ * @param max maximum size of the pool
+ * @return NULL on error
+ */
+struct MemoryPool *
+MHD_pool_create_cached (struct MemoryPool **cache,
+                        unsigned int *cache_len,
+                        size_t max)
+{
+  struct MemoryPool *pool;
+
+  if (NULL == (pool = *cache))
+    return MHD_pool_create (max);
+  *cache = pool->next;
+  (*cache_len)--;
+  pool->next = NULL;
+  return pool;
+}
+
+
+/**
+ * Put a memory pool into @a cache for reuse by
+ * #MHD_pool_create_cached(), or destroy it if the cache
+ * already holds @a cache_max pools.  The pool's contents are
+ * cleared, but its memory is kept mapped.
+ *
+ * @param cache head of the list of unused pools
+ * @param cache_len number of pools in @a cache
+ * @param cache_max maximum number of pools to keep in @a cache
+ * @param pool memory pool to release, may be NULL
+ */
+void
+MHD_pool_destroy_cached (struct MemoryPool **cache,
+                         unsigned int *cache_len,
+                         unsigned int cache_max,
+                         struct MemoryPool *pool)
+{
+  if (NULL == pool)
+    return;
+  if (*cache_len >= cache_max)
+    {
+      MHD_pool_destroy (pool);
+      return;
+    }
+  (void) MHD_pool_reset (pool, NULL, 0, 0);
+  pool->pos = 0;
+  pool->dirty = 0;
+  pool->peak = 0;
+  pool->next = *cache;
+  *cache = pool;
+  (*cache_len)++;
+}
+
+
+/**
+ * Destroy all memory pools in @a cache.
+ *
+ * @param cache head of the list of unused pools
+ * @param cache_len number of pools in @a cache
+ */
+void
+MHD_pool_cache_flush (struct MemoryPool **cache,
+                      unsigned int *cache_len)
+{
+  struct MemoryPool *pool;
+
+  while (NULL != (pool = *cache))
+    {
+      *cache = pool->next;
+      MHD_pool_destroy (pool);
+    }
+  *cache_len = 0;
+}
+
+
 /**
  * Destroy a memory pool.
  *
@@ -172,7 +365,10 @@ MHD_pool_allocate (struct MemoryPool *pool,
   if ( (0 == asize) && (0 != size) )
     return NULL; /* size too close to SIZE_MAX */
   if ((pool->pos + asize > pool->end) || (pool->pos + asize < pool->pos))
-    return NULL;
+    {
+      MHD_PROBE2 (pool_exhausted, pool, size);
+      return NULL;
+    }
   if (from_end == MHD_YES)
     {
       ret = &pool->memory[pool->end - asize];
@@ -182,7 +378,10 @@ MHD_pool_allocate (struct MemoryPool *pool,
     {
       ret = &pool->memory[pool->pos];
       pool->pos += asize;
+      if (pool->pos > pool->dirty)
+        pool->dirty = pool->pos;
     }
+  update_peak (pool);
   return ret;
 }
 
@@ -212,6 +411,7 @@ MHD_pool_reallocate (struct MemoryPool *pool,
 {
   void *ret;
   size_t asize;
+  size_t new_pos;
 
   asize = ROUND_TO_ALIGN (new_size);
   if ( (0 == asize) && (0 != new_size) )
@@ -222,16 +422,24 @@ MHD_pool_reallocate (struct MemoryPool *pool,
   if ( (pool->pos >= old_size) &&
        (&pool->memory[pool->pos - old_size] == old) )
     {
-      /* was the previous allocation - optimize! */
-      if (pool->pos + asize - old_size <= pool->end)
+      /* was the previous allocation - optimize!  The block may
+         start unaligned (e.g. a read buffer whose head was
+         consumed), so align its new end rather than its size, or
+         it would no longer end at @e pos for the next call */
+      new_pos = ROUND_TO_ALIGN (pool->pos - old_size + new_size);
+      if ( (new_pos >= pool->pos - old_size) &&
+           (new_pos <= pool->end) )
         {
-          /* fits */
-          pool->pos += asize - old_size;
-          if (asize < old_size)      /* shrinking - zero again! */
-            memset (&pool->memory[pool->pos], 0, old_size - asize);
+          /* fits; when shrinking, the released tail stays
+             below @e dirty and is zeroed on the next reset */
+          pool->pos = new_pos;
+          if (pool->pos > pool->dirty)
+            pool->dirty = pool->pos;
+          update_peak (pool);
           return old;
         }
       /* does not fit */
+      MHD_PROBE2 (pool_exhausted, pool, new_size);
       return NULL;
     }
   if (asize <= old_size)
@@ -243,13 +451,46 @@ MHD_pool_reallocate (struct MemoryPool *pool,
       ret = &pool->memory[pool->pos];
       memmove (ret, old, old_size);
       pool->pos += asize;
+      if (pool->pos > pool->dirty)
+        pool->dirty = pool->pos;
+      update_peak (pool);
       return ret;
     }
   /* does not fit */
+  MHD_PROBE2 (pool_exhausted, pool, new_size);
   return NULL;
 }
 
 
+/**
+ * Get the highest number of bytes that were allocated from @a pool
+ * at the same time since it was created (or taken from a pool
+ * cache).  Resets with #MHD_pool_reset() do not lower it.
+ *
+ * @param pool memory pool to inspect
+ * @return peak usage of @a pool in bytes
+ */
+size_t
+MHD_pool_get_peak (struct MemoryPool *pool)
+{
+  return pool->peak;
+}
+
+
+/**
+ * Get the number of bytes that can still be allocated from @a pool
+ * (before rounding to the alignment).
+ *
+ * @param pool memory pool to inspect
+ * @return number of free bytes in @a pool
+ */
+size_t
+MHD_pool_get_free (struct MemoryPool *pool)
+{
+  return pool->end - pool->pos;
+}
+
+
 /**
  * Clear all entries from the memory pool except
  * for @a keep of the given @a size. The pointer
@@ -279,13 +520,20 @@ MHD_pool_reset (struct MemoryPool *pool,
           keep = pool->memory;
         }
     }
+  /* technically not needed, but safer to zero out; only
+     clear what was used since the last reset */
+  if (MHD_MIN (pool->dirty, pool->end) > copy_bytes)
+    clear_area (pool,
+                copy_bytes,
+                MHD_MIN (pool->dirty, pool->end));
+  if (pool->size > MHD_MAX (pool->end, copy_bytes))
+    clear_area (pool,
+                MHD_MAX (pool->end, copy_bytes),
+                pool->size);
   pool->end = pool->size;
-  /* technically not needed, but safer to zero out */
-  memset (&pool->memory[copy_bytes],
-	  0,
-	  pool->size - copy_bytes);
   if (NULL != keep)
     pool->pos = ROUND_TO_ALIGN (new_size);
+  pool->dirty = MHD_MAX (pool->pos, copy_bytes);
   return keep;
 }
 
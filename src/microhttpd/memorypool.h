@@ -39,7 +39,16 @@ struct MemoryPool;
 
 
 /**
- * Create a memory pool.
+ * Initialize values for memory pools.
+ */
+void
+MHD_init_mem_pools_ (void);
+
+
+/**
+ * Create a memory pool.  Memory of large pools is only committed
+ * as it is used, and returned by #MHD_pool_reset() once no longer
+ * needed.
  *
  * @param max maximum size of the pool
  * @return NULL on error
@@ -57,6 +66,51 @@ void
 MHD_pool_destroy (struct MemoryPool *pool);
 
 
+/**
+ * Create a memory pool, reusing a pool from @a cache if possible.
+ * All pools in the cache must have been created with the same
+ * @a max.
+ *
+ * @param cache head of the list of unused pools
+ * @param cache_len number of pools in @a cache
+ * @param max maximum size of the pool
+ * @return NULL on error
+ */
+struct MemoryPool *
+MHD_pool_create_cached (struct MemoryPool **cache,
+                        unsigned int *cache_len,
+                        size_t max);
+
+
+/**
+ * Put a memory pool into @a cache for reuse by
+ * #MHD_pool_create_cached(), or destroy it if the cache
+ * already holds @a cache_max pools.  The pool's contents are
+ * cleared, but its memory is kept mapped.
+ *
+ * @param cache head of the list of unused pools
+ * @param cache_len number of pools in @a cache
+ * @param cache_max maximum number of pools to keep in @a cache
+ * @param pool memory pool to release, may be NULL
+ */
+void
+MHD_pool_destroy_cached (struct MemoryPool **cache,
+                         unsigned int *cache_len,
+                         unsigned int cache_max,
+                         struct MemoryPool *pool);
+
+
+/**
+ * Destroy all memory pools in @a cache.
+ *
+ * @param cache head of the list of unused pools
+ * @param cache_len number of pools in @a cache
+ */
+void
+MHD_pool_cache_flush (struct MemoryPool **cache,
+                      unsigned int *cache_len);
+
+
 /**
  * Allocate size bytes from the pool.
  *
@@ -97,6 +151,17 @@ MHD_pool_reallocate (struct MemoryPool *pool,
 		     size_t new_size);
 
 
+/**
+ * Get the number of bytes that can still be allocated from @a pool
+ * (before rounding to the alignment).
+ *
+ * @param pool memory pool to inspect
+ * @return number of free bytes in @a pool
+ */
+size_t
+MHD_pool_get_free (struct MemoryPool *pool);
+
+
 /**
  * Clear all entries from the memory pool except
  * for @a keep of the given @a copy_bytes.  The pointer
@@ -110,6 +175,10 @@ MHD_pool_reallocate (struct MemoryPool *pool,
  *                 (should be larger or equal to @a copy_bytes)
  * @return addr new address of @a keep (if it had to change)
  */
+size_t
+MHD_pool_get_peak (struct MemoryPool *pool);
+
+
 void *
 MHD_pool_reset (struct MemoryPool *pool,
 		void *keep,
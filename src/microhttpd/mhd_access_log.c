@@ -0,0 +1,270 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_access_log.c
+ * @brief  batched access log of completed requests
+ * @author Christian Grothoff
+ *
+ * Each daemon (and each worker of a thread pool) fills its own
+ * buffer of fixed-size records from the thread of its event loop, so
+ * logging a request copies a few fields and takes no lock.  The
+ * buffer is passed on as one batch: to the callback as it is, and to
+ * the file descriptor as lines of text formatted into the second half
+ * of the same allocation and written with one system call.
+ */
+
+#include "mhd_access_log.h"
+#include "mhd_mono_clock.h"
+
+/**
+ * Maximum length of a line of the access log written to a file
+ * descriptor.
+ */
+#define MHD_ACCESS_LOG_LINE_SIZE \
+  (MHD_ACCESS_LOG_URL_SIZE + MHD_ACCESS_LOG_METHOD_SIZE + 128)
+
+
+/**
+ * Format the client address of @a record.
+ *
+ * @param record record to format the address of
+ * @param buf where to write the address
+ * @param buf_size size of @a buf, at least 40
+ */
+static void
+format_address (const struct MHD_AccessLogRecord *record,
+                char *buf,
+                size_t buf_size)
+{
+  const struct sockaddr_in *sin;
+  const unsigned char *a;
+#if HAVE_INET6
+  const struct sockaddr_in6 *sin6;
+#endif
+
+  if ( (AF_INET == record->addr.ss_family) &&
+       (record->addr_len >= (socklen_t) sizeof (struct sockaddr_in)) )
+    {
+      sin = (const struct sockaddr_in *) &record->addr;
+      a = (const unsigned char *) &sin->sin_addr;
+      snprintf (buf, buf_size,
+                "%u.%u.%u.%u",
+                a[0], a[1], a[2], a[3]);
+      return;
+    }
+#if HAVE_INET6
+  if ( (AF_INET6 == record->addr.ss_family) &&
+       (record->addr_len >= (socklen_t) sizeof (struct sockaddr_in6)) )
+    {
+      sin6 = (const struct sockaddr_in6 *) &record->addr;
+      a = (const unsigned char *) &sin6->sin6_addr;
+      snprintf (buf, buf_size,
+                "%x:%x:%x:%x:%x:%x:%x:%x",
+                (a[0] << 8) | a[1], (a[2] << 8) | a[3],
+                (a[4] << 8) | a[5], (a[6] << 8) | a[7],
+                (a[8] << 8) | a[9], (a[10] << 8) | a[11],
+                (a[12] << 8) | a[13], (a[14] << 8) | a[15]);
+      return;
+    }
+#endif
+  snprintf (buf, buf_size, "-");
+}
+
+
+/**
+ * Write the records of the access log of @a daemon as lines of text
+ * to its file descriptor.
+ *
+ * @param daemon daemon (or worker) to write the access log of
+ */
+static void
+write_lines (struct MHD_Daemon *daemon)
+{
+  const struct MHD_AccessLogRecord *record;
+  char *text;
+  char addr[64];
+  size_t off;
+  ssize_t ret;
+  unsigned int i;
+  int len;
+
+  text = (char *) &daemon->access_log[daemon->access_log_size];
+  off = 0;
+  for (i = 0; i < daemon->access_log_used; i++)
+    {
+      record = &daemon->access_log[i];
+      format_address (record,
+                      addr,
+                      sizeof (addr));
+      len = snprintf (&text[off],
+                      MHD_ACCESS_LOG_LINE_SIZE,
+                      "%llu %s \"%s %s\" %u %llu %llu\n",
+                      (unsigned long long) record->time,
+                      addr,
+                      record->method,
+                      record->url,
+                      record->status,
+                      (unsigned long long) record->bytes_sent,
+                      (unsigned long long) (record->times.body_sent
+                                            - record->times.first_byte));
+      if (len < 0)
+        continue;
+      if (len >= MHD_ACCESS_LOG_LINE_SIZE)
+        {
+          /* keep the line terminated */
+          len = MHD_ACCESS_LOG_LINE_SIZE - 1;
+          text[off + len - 1] = '\n';
+        }
+      off += len;
+    }
+  i = 0;
+  while (off > i)
+    {
+      ret = write (daemon->access_log_fd,
+                   &text[i],
+                   off - i);
+      if (ret < 0)
+        {
+          if (EINTR == errno)
+            continue;
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Failed to write access log: %s\n",
+                    MHD_strerror_ (errno));
+#endif
+          return;
+        }
+      i += ret;
+    }
+}
+
+
+/**
+ * Pass the records of the access log of @a daemon to the callback
+ * and file descriptor, if the interval passed (or if @a force is
+ * #MHD_YES).
+ *
+ * @param daemon daemon (or worker) to flush the access log of
+ * @param now #MHD_monotonic_usec_counter() value
+ * @param force #MHD_YES to flush regardless of the interval
+ */
+void
+MHD_access_log_flush_ (struct MHD_Daemon *daemon,
+                       uint64_t now,
+                       int force)
+{
+  if (0 == daemon->access_log_used)
+    {
+      daemon->access_log_flushed = now;
+      return;
+    }
+  if ( (MHD_YES != force) &&
+       (now - daemon->access_log_flushed <
+        (uint64_t) daemon->access_log_interval * 1000) )
+    return;
+  if (NULL != daemon->access_log_callback)
+    daemon->access_log_callback (daemon->access_log_callback_cls,
+                                 daemon->access_log,
+                                 daemon->access_log_used);
+  if (-1 != daemon->access_log_fd)
+    write_lines (daemon);
+  daemon->access_log_used = 0;
+  daemon->access_log_flushed = now;
+}
+
+
+/**
+ * Add a record of the request that @a connection just completed to
+ * the access log of its daemon, and flush the log if it is full.
+ * Must be called from the thread running the event loop.
+ *
+ * @param connection connection that sent a response completely
+ */
+void
+MHD_access_log_add_ (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+  struct MHD_AccessLogRecord *record;
+  size_t len;
+
+  if (NULL == daemon->access_log)
+    {
+      /* records, followed by the text of the lines of a batch */
+      daemon->access_log = malloc (daemon->access_log_size *
+                                   (sizeof (struct MHD_AccessLogRecord)
+                                    + ((-1 != daemon->access_log_fd)
+                                       ? MHD_ACCESS_LOG_LINE_SIZE
+                                       : 0)));
+      if (NULL == daemon->access_log)
+        return;
+      daemon->access_log_used = 0;
+      daemon->access_log_flushed = MHD_monotonic_usec_counter ();
+    }
+  record = &daemon->access_log[daemon->access_log_used++];
+  record->time = (uint64_t) time (NULL);
+  record->times = connection->request_times;
+  record->bytes_sent = connection->response_write_position;
+  record->status = connection->responseCode;
+  record->addr_len = MHD_MIN (connection->addr_len,
+                              (socklen_t) sizeof (record->addr));
+  memcpy (&record->addr,
+          connection->addr,
+          record->addr_len);
+  record->method[0] = '\0';
+  if (NULL != connection->method)
+    {
+      len = MHD_MIN (strlen (connection->method),
+                     MHD_ACCESS_LOG_METHOD_SIZE - 1);
+      memcpy (record->method, connection->method, len);
+      record->method[len] = '\0';
+    }
+  record->url[0] = '\0';
+  if (NULL != connection->url)
+    {
+      len = MHD_MIN (strlen (connection->url),
+                     MHD_ACCESS_LOG_URL_SIZE - 1);
+      memcpy (record->url, connection->url, len);
+      record->url[len] = '\0';
+    }
+  if (daemon->access_log_used == daemon->access_log_size)
+    MHD_access_log_flush_ (daemon,
+                           record->times.body_sent,
+                           MHD_YES);
+}
+
+
+/**
+ * Flush the access log of @a daemon and free its buffer.
+ *
+ * @param daemon daemon (or worker) that stopped
+ */
+void
+MHD_access_log_free_ (struct MHD_Daemon *daemon)
+{
+  if (NULL == daemon->access_log)
+    return;
+  MHD_access_log_flush_ (daemon,
+                         MHD_monotonic_usec_counter (),
+                         MHD_YES);
+  free (daemon->access_log);
+  daemon->access_log = NULL;
+}
+
+/* end of mhd_access_log.c */
@@ -0,0 +1,77 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_access_log.h
+ * @brief  batched access log of completed requests
+ * @author Christian Grothoff
+ */
+
+#ifndef MHD_ACCESS_LOG_H
+#define MHD_ACCESS_LOG_H 1
+#include "internal.h"
+
+
+/**
+ * Check if @a daemon keeps an access log.
+ *
+ * @param daemon daemon (or worker) to check
+ * @return #MHD_YES if #MHD_OPTION_ACCESS_LOG_CALLBACK or
+ *         #MHD_OPTION_ACCESS_LOG_FD was given
+ */
+#define MHD_access_log_enabled_(daemon) \
+  ( (NULL != (daemon)->access_log_callback) || \
+    (-1 != (daemon)->access_log_fd) )
+
+
+/**
+ * Add a record of the request that @a connection just completed to
+ * the access log of its daemon, and flush the log if it is full.
+ * Must be called from the thread running the event loop.
+ *
+ * @param connection connection that sent a response completely
+ */
+void
+MHD_access_log_add_ (struct MHD_Connection *connection);
+
+
+/**
+ * Pass the records of the access log of @a daemon to the callback
+ * and file descriptor, if the interval passed (or if @a force is
+ * #MHD_YES).
+ *
+ * @param daemon daemon (or worker) to flush the access log of
+ * @param now #MHD_monotonic_usec_counter() value
+ * @param force #MHD_YES to flush regardless of the interval
+ */
+void
+MHD_access_log_flush_ (struct MHD_Daemon *daemon,
+                       uint64_t now,
+                       int force);
+
+
+/**
+ * Flush the access log of @a daemon and free its buffer.
+ *
+ * @param daemon daemon (or worker) that stopped
+ */
+void
+MHD_access_log_free_ (struct MHD_Daemon *daemon);
+
+#endif
@@ -0,0 +1,663 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_broadcast.c
+ * @brief  responses sending the same stream of events to many
+ *         clients, see #MHD_create_response_from_broadcast()
+ * @author Christian Grothoff
+ *
+ * A published event is copied once, together with its chunk framing,
+ * into a reference counted buffer.  The broadcast keeps the last
+ * events in a ring, so that a subscriber that is busy sending can
+ * catch up later; each subscriber holds a reference to the event it
+ * is sending and sends the events straight from the shared buffers.
+ * Subscribers that sent all events wait (suspended) in a list of the
+ * broadcast, which a publisher takes over as a whole and wakes up
+ * with one lock of each daemon involved.
+ */
+
+#include "mhd_broadcast.h"
+
+
+/**
+ * Maximum length of the chunk-size line of an event: 16 hex digits
+ * and CRLF.
+ */
+#define MHD_BROADCAST_HEADER_MAX 18
+
+
+/**
+ * An event published on a broadcast.
+ */
+struct MHD_BroadcastEvent
+{
+
+  /**
+   * Number of references: one of the ring of the broadcast while it
+   * holds the event and one per subscriber sending it.  Protected by
+   * the mutex of the broadcast.
+   */
+  unsigned int rc;
+
+  /**
+   * Number of bytes of the chunk-size line at the start of @e data.
+   */
+  size_t header_len;
+
+  /**
+   * Size of the payload of the event.
+   */
+  size_t size;
+
+  /**
+   * The chunk-size line, the payload and the CRLF after it.
+   */
+  char *data;
+};
+
+
+/**
+ * A stream of events sent to all its subscribers.
+ */
+struct MHD_Broadcast
+{
+
+  /**
+   * Protects all the fields below, the reference counts of the
+   * events and the broadcast fields of the subscribed connections.
+   */
+  MHD_mutex_ mutex;
+
+  /**
+   * The last @e backlog events, the event with sequence number
+   * @e seq is at index @e seq modulo @e backlog.
+   */
+  struct MHD_BroadcastEvent **ring;
+
+  /**
+   * Head of the list of connections waiting for the next event.
+   */
+  struct MHD_Connection *waiting_head;
+
+  /**
+   * Tail of the list of connections waiting for the next event.
+   */
+  struct MHD_Connection *waiting_tail;
+
+  /**
+   * Sequence number of the oldest event in @e ring.
+   */
+  uint64_t first_seq;
+
+  /**
+   * Sequence number of the next event to be published.
+   */
+  uint64_t next_seq;
+
+  /**
+   * Size of @e ring.
+   */
+  unsigned int backlog;
+
+  /**
+   * Number of references: one of the application until
+   * #MHD_broadcast_destroy() and one per response.
+   */
+  unsigned int refs;
+
+  /**
+   * #MHD_YES once #MHD_broadcast_destroy() was called.
+   */
+  int closed;
+};
+
+
+/**
+ * Drop a reference to @a event.  Assumes that the mutex of the
+ * broadcast is held.
+ *
+ * @param event event to release
+ */
+static void
+event_release (struct MHD_BroadcastEvent *event)
+{
+  if (0 == --event->rc)
+    free (event);
+}
+
+
+/**
+ * Free a broadcast that has no references any more.
+ *
+ * @param bc broadcast to free
+ */
+static void
+broadcast_free (struct MHD_Broadcast *bc)
+{
+  uint64_t seq;
+
+  for (seq = bc->first_seq; seq < bc->next_seq; seq++)
+    event_release (bc->ring[seq % bc->backlog]);
+  free (bc->ring);
+  (void) MHD_mutex_destroy_ (&bc->mutex);
+  free (bc);
+}
+
+
+/**
+ * Drop a reference to @a bc.
+ *
+ * @param bc broadcast to release
+ */
+static void
+broadcast_release (struct MHD_Broadcast *bc)
+{
+  unsigned int refs;
+
+  (void) MHD_mutex_lock_ (&bc->mutex);
+  refs = --bc->refs;
+  (void) MHD_mutex_unlock_ (&bc->mutex);
+  if (0 == refs)
+    broadcast_free (bc);
+}
+
+
+/**
+ * Take over the list of connections waiting for the next event of
+ * @a bc.  Assumes that the mutex of the broadcast is held.
+ *
+ * @param bc broadcast
+ * @return the waiting connections, linked by @e bc_next
+ */
+static struct MHD_Connection *
+take_waiting (struct MHD_Broadcast *bc)
+{
+  struct MHD_Connection *head = bc->waiting_head;
+  struct MHD_Connection *pos;
+
+  for (pos = head; NULL != pos; pos = pos->bc_next)
+    pos->bc_waiting = MHD_NO;
+  bc->waiting_head = NULL;
+  bc->waiting_tail = NULL;
+  return head;
+}
+
+
+/**
+ * Create a broadcast: a stream of events that is sent to all
+ * connections a response created with
+ * #MHD_create_response_from_broadcast() for it was queued on.
+ *
+ * @param backlog number of the last events kept for subscribers that
+ *        are still busy sending older events; a subscriber that falls
+ *        further behind is disconnected
+ * @return NULL on error (i.e. invalid arguments, out of memory)
+ * @ingroup response
+ */
+struct MHD_Broadcast *
+MHD_broadcast_create (unsigned int backlog)
+{
+  struct MHD_Broadcast *bc;
+
+  if (0 == backlog)
+    return NULL;
+  if (NULL == (bc = malloc (sizeof (struct MHD_Broadcast))))
+    return NULL;
+  memset (bc, 0, sizeof (struct MHD_Broadcast));
+  if (NULL == (bc->ring = calloc (backlog,
+                                  sizeof (struct MHD_BroadcastEvent *))))
+    {
+      free (bc);
+      return NULL;
+    }
+  if (MHD_YES != MHD_mutex_create_ (&bc->mutex))
+    {
+      free (bc->ring);
+      free (bc);
+      return NULL;
+    }
+  bc->backlog = backlog;
+  bc->refs = 1;
+  return bc;
+}
+
+
+/**
+ * Publish an event: append @a data to the body of the responses of
+ * all subscribers of @a bc.  The data is copied.  Can be called from
+ * any thread, but not while or after #MHD_stop_daemon() is called for
+ * a daemon with subscribers.
+ *
+ * @param bc broadcast to publish on
+ * @param data the data of the event
+ * @param size number of bytes in @a data, must not be 0
+ * @return #MHD_YES on success, #MHD_NO on error (i.e. invalid
+ *         arguments, out of memory)
+ * @ingroup response
+ */
+int
+MHD_broadcast_publish (struct MHD_Broadcast *bc,
+                       const void *data,
+                       size_t size)
+{
+  struct MHD_BroadcastEvent *event;
+  struct MHD_Connection *waiting;
+  char hex[MHD_BROADCAST_HEADER_MAX];
+  size_t len;
+  size_t n;
+
+  if ( (NULL == bc) ||
+       (NULL == data) ||
+       (0 == size) ||
+       (size > SIZE_MAX - sizeof (struct MHD_BroadcastEvent)
+               - MHD_BROADCAST_HEADER_MAX - 2) )
+    return MHD_NO;
+  event = malloc (sizeof (struct MHD_BroadcastEvent)
+                  + MHD_BROADCAST_HEADER_MAX + size + 2);
+  if (NULL == event)
+    return MHD_NO;
+  event->data = (char *) &event[1];
+  /* chunk-size line, the size in hex (without leading zeros) */
+  len = 0;
+  n = size;
+  do
+    {
+      hex[len++] = "0123456789ABCDEF"[n & 0xF];
+      n >>= 4;
+    }
+  while (0 != n);
+  for (n = 0; n < len; n++)
+    event->data[n] = hex[len - 1 - n];
+  memcpy (&event->data[len],
+          "\r\n",
+          2);
+  event->header_len = len + 2;
+  event->size = size;
+  memcpy (&event->data[event->header_len],
+          data,
+          size);
+  memcpy (&event->data[event->header_len + size],
+          "\r\n",
+          2);
+  event->rc = 1;
+  (void) MHD_mutex_lock_ (&bc->mutex);
+  if (MHD_YES == bc->closed)
+    {
+      (void) MHD_mutex_unlock_ (&bc->mutex);
+      free (event);
+      return MHD_NO;
+    }
+  if (bc->next_seq - bc->first_seq == bc->backlog)
+    {
+      event_release (bc->ring[bc->first_seq % bc->backlog]);
+      bc->first_seq++;
+    }
+  bc->ring[bc->next_seq % bc->backlog] = event;
+  bc->next_seq++;
+  waiting = take_waiting (bc);
+  (void) MHD_mutex_unlock_ (&bc->mutex);
+  MHD_connections_data_ready_ (waiting);
+  return MHD_YES;
+}
+
+
+/**
+ * Destroy a broadcast.  Subscribers still send the events published
+ * so far, then their response ends.  The memory is released once the
+ * last response for @a bc is destroyed as well.  The same
+ * restrictions as for #MHD_broadcast_publish() apply.
+ *
+ * @param bc broadcast to destroy
+ * @ingroup response
+ */
+void
+MHD_broadcast_destroy (struct MHD_Broadcast *bc)
+{
+  struct MHD_Connection *waiting;
+  unsigned int refs;
+
+  if (NULL == bc)
+    return;
+  (void) MHD_mutex_lock_ (&bc->mutex);
+  bc->closed = MHD_YES;
+  waiting = take_waiting (bc);
+  refs = --bc->refs;
+  (void) MHD_mutex_unlock_ (&bc->mutex);
+  /* the waiting connections hold references */
+  MHD_connections_data_ready_ (waiting);
+  if (0 == refs)
+    broadcast_free (bc);
+}
+
+
+/**
+ * Content reader of broadcast responses, never called as the events
+ * are sent directly from the broadcast.
+ *
+ * @param cls the broadcast
+ * @param pos position in the body
+ * @param buf where to store the data
+ * @param max size of @a buf
+ * @return #MHD_CONTENT_READER_END_WITH_ERROR
+ */
+static ssize_t
+broadcast_reader (void *cls,
+                  uint64_t pos,
+                  char *buf,
+                  size_t max)
+{
+  (void) cls;
+  (void) pos;
+  (void) buf;
+  (void) max;
+  return MHD_CONTENT_READER_END_WITH_ERROR;
+}
+
+
+/**
+ * Release the reference of a response to its broadcast.
+ *
+ * @param cls the broadcast
+ */
+static void
+broadcast_response_free (void *cls)
+{
+  broadcast_release (cls);
+}
+
+
+/**
+ * Create a response whose body is the stream of events published on
+ * @a bc after the response was queued, for example for server-sent
+ * events.  The body has no known size: it is sent chunked to
+ * HTTP/1.1 clients; for HTTP/1.0 clients, the connection is closed
+ * after the last event.  The response can be queued on any number of
+ * connections; while a connection has sent all events, it is
+ * suspended if the daemon was started with #MHD_USE_SUSPEND_RESUME
+ * (recommended), otherwise it is polled.  Broadcast responses cannot
+ * be queued for HTTP/2 requests.
+ *
+ * @param bc broadcast to send
+ * @return NULL on error (i.e. invalid arguments, out of memory)
+ * @ingroup response
+ */
+struct MHD_Response *
+MHD_create_response_from_broadcast (struct MHD_Broadcast *bc)
+{
+  struct MHD_Response *response;
+
+  if (NULL == bc)
+    return NULL;
+  response = MHD_create_response_from_callback (MHD_SIZE_UNKNOWN,
+                                                1,
+                                                &broadcast_reader,
+                                                bc,
+                                                &broadcast_response_free);
+  if (NULL == response)
+    return NULL;
+  response->broadcast = bc;
+  (void) MHD_mutex_lock_ (&bc->mutex);
+  bc->refs++;
+  (void) MHD_mutex_unlock_ (&bc->mutex);
+  return response;
+}
+
+
+/**
+ * Subscribe the connection @a connection to the broadcast of its
+ * response: it receives the events published from now on.
+ *
+ * @param connection connection the response was queued on
+ */
+void
+MHD_broadcast_subscribe_ (struct MHD_Connection *connection)
+{
+  struct MHD_Broadcast *bc = connection->response->broadcast;
+
+  (void) MHD_mutex_lock_ (&bc->mutex);
+  connection->bc_event = NULL;
+  connection->bc_offset = 0;
+  connection->bc_seq = bc->next_seq;
+  (void) MHD_mutex_unlock_ (&bc->mutex);
+}
+
+
+/**
+ * Take the next event of the broadcast of the response of
+ * @a connection as its current event, if there is none yet.
+ *
+ * @param connection subscribed connection
+ * @param park #MHD_YES to register the connection for a wakeup
+ *        with #MHD_response_data_ready() on the next event if
+ *        there is none now
+ * @return what the connection should do next
+ */
+enum MHD_BroadcastState
+MHD_broadcast_ready_ (struct MHD_Connection *connection,
+                      int park)
+{
+  struct MHD_Broadcast *bc = connection->response->broadcast;
+  enum MHD_BroadcastState ret;
+
+  (void) MHD_mutex_lock_ (&bc->mutex);
+  if (NULL != connection->bc_event)
+    {
+      ret = MHD_BROADCAST_READY;
+    }
+  else if (connection->bc_seq < bc->first_seq)
+    {
+      ret = MHD_BROADCAST_LAGGED;
+    }
+  else if (connection->bc_seq < bc->next_seq)
+    {
+      connection->bc_event = bc->ring[connection->bc_seq % bc->backlog];
+      connection->bc_event->rc++;
+      connection->bc_offset = 0;
+      connection->bc_seq++;
+      ret = MHD_BROADCAST_READY;
+    }
+  else if (MHD_YES == bc->closed)
+    {
+      ret = MHD_BROADCAST_END;
+    }
+  else
+    {
+      if ( (MHD_YES == park) &&
+           (MHD_NO == connection->bc_waiting) )
+        {
+          connection->bc_next = NULL;
+          connection->bc_prev = bc->waiting_tail;
+          if (NULL == bc->waiting_tail)
+            bc->waiting_head = connection;
+          else
+            bc->waiting_tail->bc_next = connection;
+          bc->waiting_tail = connection;
+          connection->bc_waiting = MHD_YES;
+        }
+      ret = MHD_BROADCAST_WAIT;
+    }
+  (void) MHD_mutex_unlock_ (&bc->mutex);
+  return ret;
+}
+
+
+/**
+ * Get the current event of @a connection and, up to @a max in total,
+ * the events published after it, so that they can be sent together.
+ * The connection must have a current event (see
+ * MHD_broadcast_ready_()).  A reference to each returned event is
+ * held until MHD_broadcast_sent_() is called.
+ *
+ * @param connection subscribed connection
+ * @param[out] events where to store the events
+ * @param max size of @a events, at least 1
+ * @return number of events stored in @a events
+ */
+unsigned int
+MHD_broadcast_events_ (struct MHD_Connection *connection,
+                       struct MHD_BroadcastEvent **events,
+                       unsigned int max)
+{
+  struct MHD_Broadcast *bc = connection->response->broadcast;
+  uint64_t seq;
+  unsigned int cnt;
+
+  /* the current event is referenced by the connection already */
+  events[0] = connection->bc_event;
+  cnt = 1;
+  if (1 == max)
+    return cnt;
+  (void) MHD_mutex_lock_ (&bc->mutex);
+  for (seq = connection->bc_seq;
+       (cnt < max) && (seq < bc->next_seq) && (seq >= bc->first_seq);
+       seq++)
+    {
+      events[cnt] = bc->ring[seq % bc->backlog];
+      events[cnt]->rc++;
+      cnt++;
+    }
+  (void) MHD_mutex_unlock_ (&bc->mutex);
+  return cnt;
+}
+
+
+/**
+ * Get the bytes of @a event to send to @a connection, with the
+ * chunk framing if the body of the response is chunked.
+ *
+ * @param connection subscribed connection
+ * @param event event to send
+ * @param offset number of bytes of @a event already sent
+ * @param[out] len set to the number of bytes left to send
+ * @return pointer to the bytes left to send
+ */
+const char *
+MHD_broadcast_event_data_ (struct MHD_Connection *connection,
+                           const struct MHD_BroadcastEvent *event,
+                           size_t offset,
+                           size_t *len)
+{
+  if (MHD_YES == connection->have_chunked_upload)
+    {
+      *len = event->header_len + event->size + 2 - offset;
+      return &event->data[offset];
+    }
+  *len = event->size - offset;
+  return &event->data[event->header_len + offset];
+}
+
+
+/**
+ * Account for @a sent bytes of the events returned by
+ * MHD_broadcast_events_() and release them.  The first event not
+ * sent completely stays the current event of the connection.
+ *
+ * @param connection subscribed connection
+ * @param events the events returned by MHD_broadcast_events_()
+ * @param count number of events in @a events
+ * @param sent number of bytes sent, may be 0
+ * @return #MHD_YES if the connection still has a current event,
+ *         #MHD_NO if all events were sent
+ */
+int
+MHD_broadcast_sent_ (struct MHD_Connection *connection,
+                     struct MHD_BroadcastEvent **events,
+                     unsigned int count,
+                     size_t sent)
+{
+  struct MHD_Broadcast *bc = connection->response->broadcast;
+  size_t offset;
+  size_t left;
+  unsigned int i;
+
+  offset = connection->bc_offset;
+  i = 0;
+  while (i < count)
+    {
+      (void) MHD_broadcast_event_data_ (connection,
+                                        events[i],
+                                        offset,
+                                        &left);
+      if (sent < left)
+        break;
+      sent -= left;
+      offset = 0;
+      i++;
+    }
+  (void) MHD_mutex_lock_ (&bc->mutex);
+  if (i < count)
+    {
+      /* the first event that was not completely sent becomes the
+         current one, the connection keeps its reference */
+      connection->bc_event = events[i];
+      connection->bc_offset = offset + sent;
+      connection->bc_seq += i;
+      events[i] = NULL;
+    }
+  else
+    {
+      connection->bc_event = NULL;
+      connection->bc_offset = 0;
+      connection->bc_seq += count - 1;
+    }
+  for (i = 0; i < count; i++)
+    if (NULL != events[i])
+      event_release (events[i]);
+  (void) MHD_mutex_unlock_ (&bc->mutex);
+  return (NULL != connection->bc_event) ? MHD_YES : MHD_NO;
+}
+
+
+/**
+ * Release the current event of @a connection and stop waiting for
+ * the next one.  Called when the response is done with.
+ *
+ * @param connection connection the response was queued on
+ */
+void
+MHD_broadcast_unsubscribe_ (struct MHD_Connection *connection)
+{
+  struct MHD_Broadcast *bc = connection->response->broadcast;
+
+  (void) MHD_mutex_lock_ (&bc->mutex);
+  if (NULL != connection->bc_event)
+    {
+      event_release (connection->bc_event);
+      connection->bc_event = NULL;
+    }
+  if (MHD_YES == connection->bc_waiting)
+    {
+      if (NULL == connection->bc_prev)
+        bc->waiting_head = connection->bc_next;
+      else
+        connection->bc_prev->bc_next = connection->bc_next;
+      if (NULL == connection->bc_next)
+        bc->waiting_tail = connection->bc_prev;
+      else
+        connection->bc_next->bc_prev = connection->bc_prev;
+      connection->bc_next = NULL;
+      connection->bc_prev = NULL;
+      connection->bc_waiting = MHD_NO;
+    }
+  (void) MHD_mutex_unlock_ (&bc->mutex);
+}
+
+
+/* end of mhd_broadcast.c */
@@ -0,0 +1,154 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_broadcast.h
+ * @brief  responses sending the same stream of events to many
+ *         clients, see #MHD_create_response_from_broadcast()
+ * @author Christian Grothoff
+ */
+
+#ifndef MHD_BROADCAST_H
+#define MHD_BROADCAST_H 1
+#include "internal.h"
+
+/**
+ * Maximum number of events of a broadcast sent with one system call.
+ */
+#define MHD_BROADCAST_MAX_EVENTS 32
+
+
+/**
+ * What a subscriber of a broadcast should do next.
+ */
+enum MHD_BroadcastState
+{
+  /**
+   * An event is ready to be sent, see MHD_broadcast_events_().
+   */
+  MHD_BROADCAST_READY = 0,
+
+  /**
+   * All events were sent, wait for the next one.
+   */
+  MHD_BROADCAST_WAIT = 1,
+
+  /**
+   * All events were sent and the broadcast was destroyed, the body
+   * is complete.
+   */
+  MHD_BROADCAST_END = 2,
+
+  /**
+   * The subscriber fell behind by more than the backlog of the
+   * broadcast and missed events.
+   */
+  MHD_BROADCAST_LAGGED = 3
+};
+
+
+/**
+ * Subscribe the connection @a connection to the broadcast of its
+ * response: it receives the events published from now on.
+ *
+ * @param connection connection the response was queued on
+ */
+void
+MHD_broadcast_subscribe_ (struct MHD_Connection *connection);
+
+
+/**
+ * Take the next event of the broadcast of the response of
+ * @a connection as its current event, if there is none yet.
+ *
+ * @param connection subscribed connection
+ * @param park #MHD_YES to register the connection for a wakeup
+ *        with #MHD_response_data_ready() on the next event if
+ *        there is none now
+ * @return what the connection should do next
+ */
+enum MHD_BroadcastState
+MHD_broadcast_ready_ (struct MHD_Connection *connection,
+                      int park);
+
+
+/**
+ * Get the current event of @a connection and, up to @a max in total,
+ * the events published after it, so that they can be sent together.
+ * The connection must have a current event (see
+ * MHD_broadcast_ready_()).  A reference to each returned event is
+ * held until MHD_broadcast_sent_() is called.
+ *
+ * @param connection subscribed connection
+ * @param[out] events where to store the events
+ * @param max size of @a events, at least 1
+ * @return number of events stored in @a events
+ */
+unsigned int
+MHD_broadcast_events_ (struct MHD_Connection *connection,
+                       struct MHD_BroadcastEvent **events,
+                       unsigned int max);
+
+
+/**
+ * Get the bytes of @a event to send to @a connection, with the
+ * chunk framing if the body of the response is chunked.
+ *
+ * @param connection subscribed connection
+ * @param event event to send
+ * @param offset number of bytes of @a event already sent
+ * @param[out] len set to the number of bytes left to send
+ * @return pointer to the bytes left to send
+ */
+const char *
+MHD_broadcast_event_data_ (struct MHD_Connection *connection,
+                           const struct MHD_BroadcastEvent *event,
+                           size_t offset,
+                           size_t *len);
+
+
+/**
+ * Account for @a sent bytes of the events returned by
+ * MHD_broadcast_events_() and release them.  The first event not
+ * sent completely stays the current event of the connection.
+ *
+ * @param connection subscribed connection
+ * @param events the events returned by MHD_broadcast_events_()
+ * @param count number of events in @a events
+ * @param sent number of bytes sent, may be 0
+ * @return #MHD_YES if the connection still has a current event,
+ *         #MHD_NO if all events were sent
+ */
+int
+MHD_broadcast_sent_ (struct MHD_Connection *connection,
+                     struct MHD_BroadcastEvent **events,
+                     unsigned int count,
+                     size_t sent);
+
+
+/**
+ * Release the current event of @a connection and stop waiting for
+ * the next one.  Called when the response is done with.
+ *
+ * @param connection connection the response was queued on
+ */
+void
+MHD_broadcast_unsubscribe_ (struct MHD_Connection *connection);
+
+#endif
@@ -0,0 +1,806 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_cache.c
+ * @brief  cache of complete responses of a daemon, see
+ *         #MHD_OPTION_RESPONSE_CACHE_SIZE
+ * @author Christian Grothoff
+ *
+ * The entries are kept in a hash table by request target and in a
+ * list by last use, to evict the least recently used one when the
+ * cache is full.  An entry holds a reference to the response, which
+ * also keeps its serialized header (see get_header_cache()), so that
+ * a hit only queues the response again.
+ *
+ * The first request that misses creates an entry without response
+ * and becomes its "leader": the response it queues is stored in the
+ * entry.  Requests for the same target arriving meanwhile wait
+ * (suspended) in a list of the entry and are woken up together once
+ * the leader queued its response or gave up; if that response could
+ * not be cached, they call the access handler themselves.  A stale
+ * entry within its stale-while-revalidate window gets a leader as
+ * well, while the other requests are still served the old response.
+ */
+
+#include "mhd_cache.h"
+#include "memorypool.h"
+#include "mhd_mono_clock.h"
+#include "response.h"
+
+
+/**
+ * A cached response.
+ */
+struct MHD_CacheEntry
+{
+
+  /**
+   * Next entry in the same bucket.
+   */
+  struct MHD_CacheEntry *next;
+
+  /**
+   * More recently used entry.
+   */
+  struct MHD_CacheEntry *lru_prev;
+
+  /**
+   * Less recently used entry.
+   */
+  struct MHD_CacheEntry *lru_next;
+
+  /**
+   * The request target.
+   */
+  char *key;
+
+  /**
+   * Hash of @e key.
+   */
+  uint32_t hash;
+
+  /**
+   * The response, NULL until the leader queued one.
+   */
+  struct MHD_Response *response;
+
+  /**
+   * HTTP status code of @e response.
+   */
+  unsigned int status_code;
+
+  /**
+   * Time (monotonic milliseconds) until which the response is fresh.
+   */
+  uint64_t expires;
+
+  /**
+   * Time until which the response may be served while it is being
+   * refreshed.
+   */
+  uint64_t stale_until;
+
+  /**
+   * Names of the request headers the response varies by (the value
+   * of its "Vary" header), NULL if none.
+   */
+  char *vary;
+
+  /**
+   * Values of the headers in @e vary of the request the response
+   * was produced for, each followed by a newline.
+   */
+  char *vary_values;
+
+  /**
+   * Connection whose response is to be stored in the entry, NULL if
+   * none.
+   */
+  struct MHD_Connection *leader;
+
+  /**
+   * First connection waiting for the response, linked by @e bc_next.
+   */
+  struct MHD_Connection *waiting_head;
+
+  /**
+   * Last connection waiting for the response.
+   */
+  struct MHD_Connection *waiting_tail;
+};
+
+
+/**
+ * Cache of complete responses.
+ */
+struct MHD_ResponseCache
+{
+
+  /**
+   * Protects all entries and the cache fields of the connections.
+   */
+  MHD_mutex_ mutex;
+
+  /**
+   * Hash table of the entries.
+   */
+  struct MHD_CacheEntry **buckets;
+
+  /**
+   * Number of buckets, a power of two.
+   */
+  unsigned int buckets_count;
+
+  /**
+   * Most recently used entry.
+   */
+  struct MHD_CacheEntry *lru_head;
+
+  /**
+   * Least recently used entry.
+   */
+  struct MHD_CacheEntry *lru_tail;
+
+  /**
+   * Number of entries.
+   */
+  unsigned int count;
+
+  /**
+   * Maximum number of entries.
+   */
+  unsigned int size;
+};
+
+
+/**
+ * Compute the hash of a request target (FNV-1a).
+ *
+ * @param key the request target
+ * @return the hash
+ */
+static uint32_t
+key_hash (const char *key)
+{
+  uint32_t hash = 2166136261U;
+
+  while ('\0' != *key)
+    {
+      hash ^= (unsigned char) *key++;
+      hash *= 16777619U;
+    }
+  return hash;
+}
+
+
+/**
+ * Get the next header name of a "Vary" header value.
+ *
+ * @param[in,out] pos position in the value, moved past the name
+ * @param[out] len set to the length of the name
+ * @return the name, NULL at the end of the value
+ */
+static const char *
+next_vary_name (const char **pos,
+                size_t *len)
+{
+  const char *name;
+
+  name = *pos;
+  while ( (',' == *name) ||
+          (' ' == *name) ||
+          ('\t' == *name) )
+    name++;
+  if ('\0' == *name)
+    return NULL;
+  *len = 0;
+  while ( ('\0' != name[*len]) &&
+          (',' != name[*len]) &&
+          (' ' != name[*len]) &&
+          ('\t' != name[*len]) )
+    (*len)++;
+  *pos = &name[*len];
+  return name;
+}
+
+
+/**
+ * Get the values of the headers named in @a vary of the request of
+ * @a connection.
+ *
+ * @param connection connection with the request
+ * @param vary names of the headers
+ * @return the values, each followed by a newline; NULL on error (out
+ *         of memory)
+ */
+static char *
+get_vary_values (struct MHD_Connection *connection,
+                 const char *vary)
+{
+  const char *pos;
+  const char *name;
+  const char *value;
+  size_t name_len;
+  size_t value_len;
+  size_t size;
+  char *values;
+
+  size = 1;
+  pos = vary;
+  while (NULL != (name = next_vary_name (&pos, &name_len)))
+    if (MHD_YES == MHD_lookup_connection_value_n (connection,
+                                                  MHD_HEADER_KIND,
+                                                  name,
+                                                  name_len,
+                                                  &value,
+                                                  &value_len))
+      size += value_len + 1;
+    else
+      size++;
+  if (NULL == (values = malloc (size)))
+    return NULL;
+  size = 0;
+  pos = vary;
+  while (NULL != (name = next_vary_name (&pos, &name_len)))
+    {
+      if ( (MHD_YES == MHD_lookup_connection_value_n (connection,
+                                                      MHD_HEADER_KIND,
+                                                      name,
+                                                      name_len,
+                                                      &value,
+                                                      &value_len)) &&
+           (NULL != value) )
+        {
+          memcpy (&values[size], value, value_len);
+          size += value_len;
+        }
+      values[size++] = '\n';
+    }
+  values[size] = '\0';
+  return values;
+}
+
+
+/**
+ * Check if the request of @a connection has the same values of the
+ * headers the response of @a entry varies by.
+ *
+ * @param connection connection with the request
+ * @param entry entry with a response
+ * @return #MHD_YES if the response can be used for the request
+ */
+static int
+vary_matches (struct MHD_Connection *connection,
+              const struct MHD_CacheEntry *entry)
+{
+  const char *pos;
+  const char *name;
+  const char *value;
+  const char *expected;
+  size_t name_len;
+  size_t value_len;
+
+  if (NULL == entry->vary)
+    return MHD_YES;
+  expected = entry->vary_values;
+  pos = entry->vary;
+  while (NULL != (name = next_vary_name (&pos, &name_len)))
+    {
+      if ( (MHD_YES != MHD_lookup_connection_value_n (connection,
+                                                      MHD_HEADER_KIND,
+                                                      name,
+                                                      name_len,
+                                                      &value,
+                                                      &value_len)) ||
+           (NULL == value) )
+        value_len = 0;
+      if ( (0 != strncmp (expected, value, value_len)) ||
+           ('\n' != expected[value_len]) )
+        return MHD_NO;
+      expected += value_len + 1;
+    }
+  return MHD_YES;
+}
+
+
+/**
+ * Take the list of connections waiting for @a entry.
+ *
+ * @param entry the entry
+ * @param pass #MHD_YES if the connections are to bypass the cache
+ * @return the connections, linked by @e bc_next
+ */
+static struct MHD_Connection *
+take_waiting (struct MHD_CacheEntry *entry,
+              int pass)
+{
+  struct MHD_Connection *head = entry->waiting_head;
+  struct MHD_Connection *pos;
+
+  for (pos = head; NULL != pos; pos = pos->bc_next)
+    {
+      pos->cache_waiting = MHD_NO;
+      pos->cache_entry = NULL;
+      pos->cache_pass = pass;
+    }
+  entry->waiting_head = NULL;
+  entry->waiting_tail = NULL;
+  return head;
+}
+
+
+/**
+ * Move @a entry to the front of the list by last use.
+ *
+ * @param cache the cache
+ * @param entry entry that was used
+ */
+static void
+touch_entry (struct MHD_ResponseCache *cache,
+             struct MHD_CacheEntry *entry)
+{
+  if (cache->lru_head == entry)
+    return;
+  entry->lru_prev->lru_next = entry->lru_next;
+  if (NULL == entry->lru_next)
+    cache->lru_tail = entry->lru_prev;
+  else
+    entry->lru_next->lru_prev = entry->lru_prev;
+  entry->lru_prev = NULL;
+  entry->lru_next = cache->lru_head;
+  cache->lru_head->lru_prev = entry;
+  cache->lru_head = entry;
+}
+
+
+/**
+ * Remove @a entry from @a cache and free it, except for its response.
+ *
+ * @param cache the cache
+ * @param entry entry without leader and waiting connections
+ * @return the response of the entry, to be destroyed by the caller
+ *         once the mutex is released; NULL if none
+ */
+static struct MHD_Response *
+remove_entry (struct MHD_ResponseCache *cache,
+              struct MHD_CacheEntry *entry)
+{
+  struct MHD_CacheEntry **pos;
+  struct MHD_Response *response;
+
+  for (pos = &cache->buckets[entry->hash & (cache->buckets_count - 1)];
+       *pos != entry;
+       pos = &(*pos)->next)
+    ;
+  *pos = entry->next;
+  if (NULL == entry->lru_prev)
+    cache->lru_head = entry->lru_next;
+  else
+    entry->lru_prev->lru_next = entry->lru_next;
+  if (NULL == entry->lru_next)
+    cache->lru_tail = entry->lru_prev;
+  else
+    entry->lru_next->lru_prev = entry->lru_prev;
+  cache->count--;
+  response = entry->response;
+  free (entry->vary);
+  free (entry->vary_values);
+  free (entry->key);
+  free (entry);
+  return response;
+}
+
+
+/**
+ * Create a response cache.
+ *
+ * @param size maximum number of entries
+ * @return NULL on error (out of memory)
+ */
+struct MHD_ResponseCache *
+MHD_cache_create_ (unsigned int size)
+{
+  struct MHD_ResponseCache *cache;
+
+  if (NULL == (cache = calloc (1, sizeof (struct MHD_ResponseCache))))
+    return NULL;
+  cache->size = size;
+  cache->buckets_count = 1;
+  while ( (cache->buckets_count < size) &&
+          (cache->buckets_count < (1U << 20)) )
+    cache->buckets_count *= 2;
+  cache->buckets = calloc (cache->buckets_count,
+                           sizeof (struct MHD_CacheEntry *));
+  if (NULL == cache->buckets)
+    {
+      free (cache);
+      return NULL;
+    }
+  if (MHD_YES != MHD_mutex_create_ (&cache->mutex))
+    {
+      free (cache->buckets);
+      free (cache);
+      return NULL;
+    }
+  return cache;
+}
+
+
+/**
+ * Destroy a response cache, after all connections using it were
+ * closed.
+ *
+ * @param cache cache to destroy, may be NULL
+ */
+void
+MHD_cache_destroy_ (struct MHD_ResponseCache *cache)
+{
+  struct MHD_Response *response;
+
+  if (NULL == cache)
+    return;
+  while (NULL != cache->lru_head)
+    {
+      response = remove_entry (cache,
+                               cache->lru_head);
+      if (NULL != response)
+        MHD_destroy_response (response);
+    }
+  (void) MHD_mutex_destroy_ (&cache->mutex);
+  free (cache->buckets);
+  free (cache);
+}
+
+
+/**
+ * Remember the request target of @a connection to look it up in the
+ * response cache, if the daemon has one.
+ *
+ * @param connection connection with a new request
+ * @param uri the request target
+ */
+void
+MHD_cache_set_key_ (struct MHD_Connection *connection,
+                    const char *uri)
+{
+  size_t len;
+
+  if ( (NULL == connection->daemon->response_cache) ||
+       (NULL != connection->h2_stream) )
+    return;
+  len = strlen (uri);
+  connection->cache_key = MHD_pool_allocate (connection->pool,
+                                             len + 1,
+                                             MHD_YES);
+  if (NULL != connection->cache_key)
+    memcpy (connection->cache_key,
+            uri,
+            len + 1);
+}
+
+
+/**
+ * Look up the request of @a connection in the response cache before
+ * the access handler is called.
+ *
+ * @param connection connection with the request
+ * @return what to do with the request
+ */
+enum MHD_CacheResult
+MHD_cache_lookup_ (struct MHD_Connection *connection)
+{
+  struct MHD_ResponseCache *cache = connection->daemon->response_cache;
+  struct MHD_CacheEntry *entry;
+  struct MHD_CacheEntry *match;
+  struct MHD_CacheEntry *pending;
+  struct MHD_Response *response;
+  struct MHD_Response *expired;
+  struct MHD_Response *evicted;
+  unsigned int status_code;
+  uint32_t hash;
+  uint64_t now;
+
+  if ( (NULL == cache) ||
+       (NULL == connection->cache_key) ||
+       (MHD_YES == connection->cache_pass) ||
+       (NULL != connection->response) ||
+       (0 != connection->remaining_upload_size) ||
+       ( (! MHD_str_equal_caseless_ (connection->method,
+                                     MHD_HTTP_METHOD_GET)) &&
+         (! MHD_str_equal_caseless_ (connection->method,
+                                     MHD_HTTP_METHOD_HEAD)) ) )
+    return MHD_CACHE_MISS;
+  hash = key_hash (connection->cache_key);
+  now = MHD_monotonic_msec_counter ();
+  expired = NULL;
+  (void) MHD_mutex_lock_ (&cache->mutex);
+  if (MHD_YES == connection->cache_waiting)
+    {
+      /* woken up for another reason */
+      (void) MHD_mutex_unlock_ (&cache->mutex);
+      return MHD_CACHE_WAIT;
+    }
+  if (NULL != connection->cache_entry)
+    {
+      /* this request fills the entry, the handler is called again */
+      (void) MHD_mutex_unlock_ (&cache->mutex);
+      return MHD_CACHE_MISS;
+    }
+  match = NULL;
+  pending = NULL;
+  for (entry = cache->buckets[hash & (cache->buckets_count - 1)];
+       NULL != entry;
+       entry = entry->next)
+    {
+      if ( (hash != entry->hash) ||
+           (0 != strcmp (entry->key, connection->cache_key)) )
+        continue;
+      if (NULL == entry->response)
+        pending = entry;
+      else if (MHD_YES == vary_matches (connection, entry))
+        {
+          match = entry;
+          break;
+        }
+    }
+  if (NULL != match)
+    {
+      if ( (now < match->expires) ||
+           ( (now < match->stale_until) &&
+             (NULL != match->leader) ) )
+        {
+          touch_entry (cache, match);
+          response = match->response;
+          status_code = match->status_code;
+          MHD_increment_response_rc (response);
+          (void) MHD_mutex_unlock_ (&cache->mutex);
+          (void) MHD_queue_response (connection,
+                                     status_code,
+                                     response);
+          MHD_destroy_response (response);
+          return MHD_CACHE_HIT;
+        }
+      if ( (now < match->stale_until) ||
+           (NULL != match->leader) )
+        {
+          /* refresh it, unless another request does already */
+          if (NULL == match->leader)
+            {
+              match->leader = connection;
+              connection->cache_entry = match;
+            }
+          (void) MHD_mutex_unlock_ (&cache->mutex);
+          return MHD_CACHE_MISS;
+        }
+      expired = remove_entry (cache,
+                              match);
+    }
+  if (NULL != pending)
+    {
+      if (0 == (connection->daemon->options & MHD_USE_SUSPEND_RESUME))
+        {
+          (void) MHD_mutex_unlock_ (&cache->mutex);
+          if (NULL != expired)
+            MHD_destroy_response (expired);
+          return MHD_CACHE_MISS;
+        }
+      connection->bc_next = NULL;
+      connection->bc_prev = pending->waiting_tail;
+      if (NULL == pending->waiting_tail)
+        pending->waiting_head = connection;
+      else
+        pending->waiting_tail->bc_next = connection;
+      pending->waiting_tail = connection;
+      connection->cache_waiting = MHD_YES;
+      connection->cache_entry = pending;
+      (void) MHD_mutex_unlock_ (&cache->mutex);
+      if (NULL != expired)
+        MHD_destroy_response (expired);
+      return MHD_CACHE_WAIT;
+    }
+  /* make room for the entry this request is to fill; the cache
+     never holds more than 'size' entries, so one eviction is enough */
+  evicted = NULL;
+  if (cache->count >= cache->size)
+    {
+      for (entry = cache->lru_tail; NULL != entry; entry = entry->lru_prev)
+        if ( (NULL == entry->leader) &&
+             (NULL != entry->response) )
+          break;
+      if (NULL != entry)
+        evicted = remove_entry (cache,
+                                entry);
+    }
+  entry = NULL;
+  if (cache->count < cache->size)
+    entry = calloc (1, sizeof (struct MHD_CacheEntry));
+  if ( (NULL != entry) &&
+       (NULL == (entry->key = strdup (connection->cache_key))) )
+    {
+      free (entry);
+      entry = NULL;
+    }
+  if (NULL != entry)
+    {
+      entry->hash = hash;
+      entry->leader = connection;
+      entry->next = cache->buckets[hash & (cache->buckets_count - 1)];
+      cache->buckets[hash & (cache->buckets_count - 1)] = entry;
+      entry->lru_next = cache->lru_head;
+      if (NULL == cache->lru_head)
+        cache->lru_tail = entry;
+      else
+        cache->lru_head->lru_prev = entry;
+      cache->lru_head = entry;
+      cache->count++;
+      connection->cache_entry = entry;
+    }
+  (void) MHD_mutex_unlock_ (&cache->mutex);
+  if (NULL != expired)
+    MHD_destroy_response (expired);
+  if (NULL != evicted)
+    MHD_destroy_response (evicted);
+  return MHD_CACHE_MISS;
+}
+
+
+/**
+ * Store @a response in the entry of the cache the request of
+ * @a connection is to fill (if any) and wake up the requests waiting
+ * for it.
+ *
+ * @param connection connection the response is queued on
+ * @param status_code HTTP status code of the response
+ * @param response the response
+ */
+void
+MHD_cache_store_ (struct MHD_Connection *connection,
+                  unsigned int status_code,
+                  struct MHD_Response *response)
+{
+  struct MHD_ResponseCache *cache = connection->daemon->response_cache;
+  struct MHD_CacheEntry *entry = connection->cache_entry;
+  struct MHD_Connection *waiting;
+  struct MHD_Response *old;
+  const char *vary;
+  char *vary_copy;
+  char *vary_values;
+  uint64_t now;
+  int cacheable;
+
+  if ( (NULL == entry) ||
+       (MHD_YES == connection->cache_waiting) )
+    return;
+  vary = MHD_get_response_header (response,
+                                  MHD_HTTP_HEADER_VARY);
+  cacheable = ( (0 != response->cache_ttl) &&
+                (NULL == response->upgrade_handler) &&
+                (NULL == response->broadcast) &&
+                (NULL == response->stream) &&
+                ( (NULL == vary) ||
+                  (NULL == strchr (vary, '*')) ) );
+  vary_copy = NULL;
+  vary_values = NULL;
+  if ( (cacheable) &&
+       (NULL != vary) )
+    {
+      vary_copy = strdup (vary);
+      vary_values = get_vary_values (connection,
+                                     vary);
+      if ( (NULL == vary_copy) ||
+           (NULL == vary_values) )
+        {
+          free (vary_copy);
+          free (vary_values);
+          cacheable = 0;
+        }
+    }
+  now = MHD_monotonic_msec_counter ();
+  (void) MHD_mutex_lock_ (&cache->mutex);
+  entry->leader = NULL;
+  connection->cache_entry = NULL;
+  if (! cacheable)
+    {
+      /* the waiting requests go to the access handler */
+      waiting = take_waiting (entry,
+                              MHD_YES);
+      if (NULL == entry->response)
+        (void) remove_entry (cache,
+                             entry);
+      (void) MHD_mutex_unlock_ (&cache->mutex);
+      MHD_connections_data_ready_ (waiting);
+      return;
+    }
+  old = entry->response;
+  MHD_increment_response_rc (response);
+  entry->response = response;
+  entry->status_code = status_code;
+  entry->expires = now + response->cache_ttl;
+  entry->stale_until = entry->expires + response->cache_stale;
+  free (entry->vary);
+  free (entry->vary_values);
+  entry->vary = vary_copy;
+  entry->vary_values = vary_values;
+  touch_entry (cache, entry);
+  waiting = take_waiting (entry,
+                          MHD_NO);
+  (void) MHD_mutex_unlock_ (&cache->mutex);
+  MHD_connections_data_ready_ (waiting);
+  if (NULL != old)
+    MHD_destroy_response (old);
+}
+
+
+/**
+ * Release the entry of the cache @a connection fills or waits for,
+ * when the request is done with.
+ *
+ * @param connection connection of the request
+ */
+void
+MHD_cache_release_ (struct MHD_Connection *connection)
+{
+  struct MHD_ResponseCache *cache = connection->daemon->response_cache;
+  struct MHD_CacheEntry *entry;
+  struct MHD_Connection *waiting;
+
+  if (NULL == connection->cache_entry)
+    return;
+  waiting = NULL;
+  (void) MHD_mutex_lock_ (&cache->mutex);
+  entry = connection->cache_entry;
+  if (NULL == entry)
+    {
+      /* woken up meanwhile */
+      (void) MHD_mutex_unlock_ (&cache->mutex);
+      return;
+    }
+  connection->cache_entry = NULL;
+  if (MHD_YES == connection->cache_waiting)
+    {
+      if (NULL == connection->bc_prev)
+        entry->waiting_head = connection->bc_next;
+      else
+        connection->bc_prev->bc_next = connection->bc_next;
+      if (NULL == connection->bc_next)
+        entry->waiting_tail = connection->bc_prev;
+      else
+        connection->bc_next->bc_prev = connection->bc_prev;
+      connection->bc_next = NULL;
+      connection->bc_prev = NULL;
+      connection->cache_waiting = MHD_NO;
+    }
+  else if (connection == entry->leader)
+    {
+      /* gave up without a response */
+      entry->leader = NULL;
+      if (NULL == entry->response)
+        {
+          waiting = take_waiting (entry,
+                                  MHD_YES);
+          (void) remove_entry (cache,
+                               entry);
+        }
+    }
+  (void) MHD_mutex_unlock_ (&cache->mutex);
+  MHD_connections_data_ready_ (waiting);
+}
+
+/* end of mhd_cache.c */
@@ -0,0 +1,124 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_cache.h
+ * @brief  cache of complete responses of a daemon, see
+ *         #MHD_OPTION_RESPONSE_CACHE_SIZE
+ * @author Christian Grothoff
+ */
+
+#ifndef MHD_CACHE_H
+#define MHD_CACHE_H 1
+#include "internal.h"
+
+
+/**
+ * Result of looking up a request in the response cache.
+ */
+enum MHD_CacheResult
+{
+  /**
+   * Not in the cache, the access handler is to be called.
+   */
+  MHD_CACHE_MISS = 0,
+
+  /**
+   * The cached response was queued on the connection.
+   */
+  MHD_CACHE_HIT = 1,
+
+  /**
+   * The response is being produced for another request; the
+   * connection waits for it, see MHD_connection_wait_for_data_(),
+   * and looks it up again once woken up.
+   */
+  MHD_CACHE_WAIT = 2
+};
+
+
+/**
+ * Create a response cache.
+ *
+ * @param size maximum number of entries
+ * @return NULL on error (out of memory)
+ */
+struct MHD_ResponseCache *
+MHD_cache_create_ (unsigned int size);
+
+
+/**
+ * Destroy a response cache, after all connections using it were
+ * closed.
+ *
+ * @param cache cache to destroy, may be NULL
+ */
+void
+MHD_cache_destroy_ (struct MHD_ResponseCache *cache);
+
+
+/**
+ * Remember the request target of @a connection to look it up in the
+ * response cache, if the daemon has one.  Called before the target
+ * is split and unescaped.
+ *
+ * @param connection connection with a new request
+ * @param uri the request target
+ */
+void
+MHD_cache_set_key_ (struct MHD_Connection *connection,
+                    const char *uri);
+
+
+/**
+ * Look up the request of @a connection in the response cache before
+ * the access handler is called.
+ *
+ * @param connection connection with the request
+ * @return what to do with the request
+ */
+enum MHD_CacheResult
+MHD_cache_lookup_ (struct MHD_Connection *connection);
+
+
+/**
+ * Store @a response in the entry of the cache the request of
+ * @a connection is to fill (if any) and wake up the requests waiting
+ * for it.  Called when the application queues @a response.
+ *
+ * @param connection connection the response is queued on
+ * @param status_code HTTP status code of the response
+ * @param response the response
+ */
+void
+MHD_cache_store_ (struct MHD_Connection *connection,
+                  unsigned int status_code,
+                  struct MHD_Response *response);
+
+
+/**
+ * Release the entry of the cache @a connection fills or waits for,
+ * when the request is done with.
+ *
+ * @param connection connection of the request
+ */
+void
+MHD_cache_release_ (struct MHD_Connection *connection);
+
+#endif
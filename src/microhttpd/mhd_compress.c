@@ -0,0 +1,365 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_compress.c
+ * @brief  zlib compressors for responses and decompressors for
+ *         request bodies, reused between the requests of a daemon
+ * @author Christian Grothoff
+ */
+
+#include "mhd_compress.h"
+#include <zlib.h>
+
+
+/**
+ * A zlib stream that compresses the body of one response.
+ */
+struct MHD_Compressor
+{
+  /**
+   * Next idle compressor of the daemon.
+   */
+  struct MHD_Compressor *next;
+
+  /**
+   * The zlib stream.
+   */
+  z_stream strm;
+
+  /**
+   * Compression level @e strm is set up for.
+   */
+  int level;
+
+  /**
+   * #MHD_YES if @e strm produces the "gzip" format.
+   */
+  int gzip;
+};
+
+
+/**
+ * A zlib stream that decompresses the body of one request.
+ */
+struct MHD_Inflater
+{
+  /**
+   * Next idle decompressor of the daemon.
+   */
+  struct MHD_Inflater *next;
+
+  /**
+   * The zlib stream.
+   */
+  z_stream strm;
+};
+
+
+/**
+ * Window bits for inflateInit2() for the given format.
+ *
+ * @param gzip #MHD_YES for the "gzip" format, #MHD_NO for "deflate"
+ * @return window bits to use
+ */
+static int
+inflate_window_bits (int gzip)
+{
+  /* window bits + 16 selects the gzip wrapper */
+  return (MHD_YES == gzip) ? 15 + 16 : 15;
+}
+
+
+/**
+ * Obtain a compressor, reusing an idle one of @a daemon if possible.
+ *
+ * @param daemon daemon the compressor is used by
+ * @param level compression level (1-9)
+ * @param gzip #MHD_YES for the "gzip" format, #MHD_NO for "deflate"
+ * @return NULL on error (out of memory)
+ */
+struct MHD_Compressor *
+MHD_compressor_get_ (struct MHD_Daemon *daemon,
+                     int level,
+                     int gzip)
+{
+  struct MHD_Compressor *comp;
+  struct MHD_Compressor **prev;
+
+  for (prev = &daemon->compressor_cache; NULL != (comp = *prev); prev = &comp->next)
+    {
+      if (comp->gzip != gzip)
+        continue;
+      *prev = comp->next;
+      daemon->compressor_cache_len--;
+      /* no data was compressed since the reset, so the level can
+         be changed without flushing */
+      if ( (comp->level != level) &&
+           (Z_OK == deflateParams (&comp->strm,
+                                   level,
+                                   Z_DEFAULT_STRATEGY)) )
+        comp->level = level;
+      comp->next = NULL;
+      return comp;
+    }
+  comp = malloc (sizeof (struct MHD_Compressor));
+  if (NULL == comp)
+    return NULL;
+  memset (comp, 0, sizeof (struct MHD_Compressor));
+  /* window bits + 16 selects the gzip wrapper */
+  if (Z_OK != deflateInit2 (&comp->strm,
+                            level,
+                            Z_DEFLATED,
+                            (MHD_YES == gzip) ? 15 + 16 : 15,
+                            8,
+                            Z_DEFAULT_STRATEGY))
+    {
+      free (comp);
+      return NULL;
+    }
+  comp->level = level;
+  comp->gzip = gzip;
+  return comp;
+}
+
+
+/**
+ * Compress data.
+ *
+ * @param comp compressor to use
+ * @param in input data, can be NULL if @a in_len is 0
+ * @param[in,out] in_len number of bytes in @a in, set to the number
+ *        of bytes consumed
+ * @param out buffer for the compressed data
+ * @param[in,out] out_len size of @a out, set to the number of bytes
+ *        produced
+ * @param flush how much of the output to produce
+ * @return #MHD_YES if the stream is finished (only with
+ *         #MHD_COMPRESS_FINISH), #MHD_NO if not, -1 on error
+ */
+int
+MHD_compressor_run_ (struct MHD_Compressor *comp,
+                     const char *in,
+                     size_t *in_len,
+                     char *out,
+                     size_t *out_len,
+                     enum MHD_CompressFlush flush)
+{
+  z_stream *strm = &comp->strm;
+  int zflush;
+  int ret;
+
+  switch (flush)
+    {
+    case MHD_COMPRESS_SYNC_FLUSH:
+      zflush = Z_SYNC_FLUSH;
+      break;
+    case MHD_COMPRESS_FINISH:
+      zflush = Z_FINISH;
+      break;
+    default:
+      zflush = Z_NO_FLUSH;
+      break;
+    }
+  /* zlib counts in 'uInt', just compress less at once */
+  strm->next_in = (Bytef *) in;
+  strm->avail_in = (uInt) MHD_MIN (*in_len, (size_t) UINT_MAX);
+  strm->next_out = (Bytef *) out;
+  strm->avail_out = (uInt) MHD_MIN (*out_len, (size_t) UINT_MAX);
+  ret = deflate (strm,
+                 zflush);
+  *in_len = (size_t) (strm->next_in - (Bytef *) in);
+  *out_len = (size_t) (strm->next_out - (Bytef *) out);
+  strm->next_in = NULL;
+  strm->next_out = NULL;
+  if (Z_STREAM_END == ret)
+    return MHD_YES;
+  if ( (Z_OK == ret) ||
+       (Z_BUF_ERROR == ret) ) /* no progress possible, not fatal */
+    return MHD_NO;
+  return -1;
+}
+
+
+/**
+ * Release a compressor obtained with #MHD_compressor_get_(),
+ * keeping it for reuse if @a daemon has room for it.
+ *
+ * @param daemon daemon the compressor was used by
+ * @param comp compressor to release
+ */
+void
+MHD_compressor_release_ (struct MHD_Daemon *daemon,
+                         struct MHD_Compressor *comp)
+{
+  /* connection threads release their compressors concurrently, and
+     handler threads obtain them concurrently */
+  if ( (0 == (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
+       (NULL == daemon->handler_pool) &&
+       (daemon->compressor_cache_len < MHD_COMPRESSOR_CACHE_SIZE) &&
+       (Z_OK == deflateReset (&comp->strm)) )
+    {
+      comp->next = daemon->compressor_cache;
+      daemon->compressor_cache = comp;
+      daemon->compressor_cache_len++;
+      return;
+    }
+  (void) deflateEnd (&comp->strm);
+  free (comp);
+}
+
+
+/**
+ * Obtain a decompressor, reusing an idle one of @a daemon if
+ * possible.
+ *
+ * @param daemon daemon the decompressor is used by
+ * @param gzip #MHD_YES for the "gzip" format, #MHD_NO for "deflate"
+ * @return NULL on error (out of memory)
+ */
+struct MHD_Inflater *
+MHD_inflater_get_ (struct MHD_Daemon *daemon,
+                   int gzip)
+{
+  struct MHD_Inflater *inf;
+
+  while (NULL != (inf = daemon->inflater_cache))
+    {
+      daemon->inflater_cache = inf->next;
+      daemon->inflater_cache_len--;
+      inf->next = NULL;
+      /* the window is kept, only the format may change */
+      if (Z_OK == inflateReset2 (&inf->strm,
+                                 inflate_window_bits (gzip)))
+        return inf;
+      (void) inflateEnd (&inf->strm);
+      free (inf);
+    }
+  inf = malloc (sizeof (struct MHD_Inflater));
+  if (NULL == inf)
+    return NULL;
+  memset (inf, 0, sizeof (struct MHD_Inflater));
+  if (Z_OK != inflateInit2 (&inf->strm,
+                            inflate_window_bits (gzip)))
+    {
+      free (inf);
+      return NULL;
+    }
+  return inf;
+}
+
+
+/**
+ * Decompress data.
+ *
+ * @param inf decompressor to use
+ * @param in compressed data
+ * @param[in,out] in_len number of bytes in @a in, set to the number
+ *        of bytes consumed
+ * @param out buffer for the decompressed data
+ * @param[in,out] out_len size of @a out, set to the number of bytes
+ *        produced
+ * @return #MHD_YES if the end of the stream was reached, #MHD_NO if
+ *         not, -1 on error (corrupt data)
+ */
+int
+MHD_inflater_run_ (struct MHD_Inflater *inf,
+                   const char *in,
+                   size_t *in_len,
+                   char *out,
+                   size_t *out_len)
+{
+  z_stream *strm = &inf->strm;
+  int ret;
+
+  /* zlib counts in 'uInt', just decompress less at once */
+  strm->next_in = (Bytef *) in;
+  strm->avail_in = (uInt) MHD_MIN (*in_len, (size_t) UINT_MAX);
+  strm->next_out = (Bytef *) out;
+  strm->avail_out = (uInt) MHD_MIN (*out_len, (size_t) UINT_MAX);
+  ret = inflate (strm,
+                 Z_NO_FLUSH);
+  *in_len = (size_t) (strm->next_in - (Bytef *) in);
+  *out_len = (size_t) (strm->next_out - (Bytef *) out);
+  strm->next_in = NULL;
+  strm->next_out = NULL;
+  if (Z_STREAM_END == ret)
+    return MHD_YES;
+  if ( (Z_OK == ret) ||
+       (Z_BUF_ERROR == ret) ) /* no progress possible, not fatal */
+    return MHD_NO;
+  return -1;
+}
+
+
+/**
+ * Release a decompressor obtained with #MHD_inflater_get_(),
+ * keeping it for reuse if @a daemon has room for it.
+ *
+ * @param daemon daemon the decompressor was used by
+ * @param inf decompressor to release
+ */
+void
+MHD_inflater_release_ (struct MHD_Daemon *daemon,
+                       struct MHD_Inflater *inf)
+{
+  /* as for the compressors, the cache is not shared between
+     threads */
+  if ( (0 == (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
+       (NULL == daemon->handler_pool) &&
+       (daemon->inflater_cache_len < MHD_INFLATER_CACHE_SIZE) )
+    {
+      inf->next = daemon->inflater_cache;
+      daemon->inflater_cache = inf;
+      daemon->inflater_cache_len++;
+      return;
+    }
+  (void) inflateEnd (&inf->strm);
+  free (inf);
+}
+
+
+/**
+ * Destroy the idle compressors and decompressors of @a daemon.
+ *
+ * @param daemon daemon to clean up
+ */
+void
+MHD_compressor_cache_flush_ (struct MHD_Daemon *daemon)
+{
+  struct MHD_Compressor *comp;
+  struct MHD_Inflater *inf;
+
+  while (NULL != (comp = daemon->compressor_cache))
+    {
+      daemon->compressor_cache = comp->next;
+      (void) deflateEnd (&comp->strm);
+      free (comp);
+    }
+  daemon->compressor_cache_len = 0;
+  while (NULL != (inf = daemon->inflater_cache))
+    {
+      daemon->inflater_cache = inf->next;
+      (void) inflateEnd (&inf->strm);
+      free (inf);
+    }
+  daemon->inflater_cache_len = 0;
+}
+
+/* end of mhd_compress.c */
@@ -0,0 +1,175 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_compress.h
+ * @brief  zlib compressors for responses and decompressors for
+ *         request bodies, reused between the requests of a daemon
+ * @author Christian Grothoff
+ */
+
+#ifndef MHD_COMPRESS_H
+#define MHD_COMPRESS_H 1
+#include "internal.h"
+
+#if HAVE_ZLIB
+
+/**
+ * Maximum number of idle compressors a daemon keeps for reuse.
+ */
+#define MHD_COMPRESSOR_CACHE_SIZE 16
+
+/**
+ * Maximum number of idle decompressors a daemon keeps for reuse.
+ */
+#define MHD_INFLATER_CACHE_SIZE 16
+
+
+/**
+ * How much of the pending output should be produced by
+ * #MHD_compressor_run_().
+ */
+enum MHD_CompressFlush
+{
+  /**
+   * Compress as much as possible, keeping incomplete blocks.
+   */
+  MHD_COMPRESS_NO_FLUSH = 0,
+
+  /**
+   * Also output all data received so far, for when the body
+   * stalls.
+   */
+  MHD_COMPRESS_SYNC_FLUSH = 1,
+
+  /**
+   * No more input follows, finish the stream.
+   */
+  MHD_COMPRESS_FINISH = 2
+};
+
+
+/**
+ * Obtain a compressor, reusing an idle one of @a daemon if possible.
+ *
+ * @param daemon daemon the compressor is used by
+ * @param level compression level (1-9)
+ * @param gzip #MHD_YES for the "gzip" format, #MHD_NO for "deflate"
+ * @return NULL on error (out of memory)
+ */
+struct MHD_Compressor *
+MHD_compressor_get_ (struct MHD_Daemon *daemon,
+                     int level,
+                     int gzip);
+
+
+/**
+ * Compress data.
+ *
+ * @param comp compressor to use
+ * @param in input data, can be NULL if @a in_len is 0
+ * @param[in,out] in_len number of bytes in @a in, set to the number
+ *        of bytes consumed
+ * @param out buffer for the compressed data
+ * @param[in,out] out_len size of @a out, set to the number of bytes
+ *        produced
+ * @param flush how much of the output to produce
+ * @return #MHD_YES if the stream is finished (only with
+ *         #MHD_COMPRESS_FINISH), #MHD_NO if not, -1 on error
+ */
+int
+MHD_compressor_run_ (struct MHD_Compressor *comp,
+                     const char *in,
+                     size_t *in_len,
+                     char *out,
+                     size_t *out_len,
+                     enum MHD_CompressFlush flush);
+
+
+/**
+ * Release a compressor obtained with #MHD_compressor_get_(),
+ * keeping it for reuse if @a daemon has room for it.
+ *
+ * @param daemon daemon the compressor was used by
+ * @param comp compressor to release
+ */
+void
+MHD_compressor_release_ (struct MHD_Daemon *daemon,
+                         struct MHD_Compressor *comp);
+
+
+/**
+ * Obtain a decompressor, reusing an idle one of @a daemon if
+ * possible.
+ *
+ * @param daemon daemon the decompressor is used by
+ * @param gzip #MHD_YES for the "gzip" format, #MHD_NO for "deflate"
+ * @return NULL on error (out of memory)
+ */
+struct MHD_Inflater *
+MHD_inflater_get_ (struct MHD_Daemon *daemon,
+                   int gzip);
+
+
+/**
+ * Decompress data.
+ *
+ * @param inf decompressor to use
+ * @param in compressed data
+ * @param[in,out] in_len number of bytes in @a in, set to the number
+ *        of bytes consumed
+ * @param out buffer for the decompressed data
+ * @param[in,out] out_len size of @a out, set to the number of bytes
+ *        produced
+ * @return #MHD_YES if the end of the stream was reached, #MHD_NO if
+ *         not, -1 on error (corrupt data)
+ */
+int
+MHD_inflater_run_ (struct MHD_Inflater *inf,
+                   const char *in,
+                   size_t *in_len,
+                   char *out,
+                   size_t *out_len);
+
+
+/**
+ * Release a decompressor obtained with #MHD_inflater_get_(),
+ * keeping it for reuse if @a daemon has room for it.
+ *
+ * @param daemon daemon the decompressor was used by
+ * @param inf decompressor to release
+ */
+void
+MHD_inflater_release_ (struct MHD_Daemon *daemon,
+                       struct MHD_Inflater *inf);
+
+
+/**
+ * Destroy the idle compressors and decompressors of @a daemon.
+ *
+ * @param daemon daemon to clean up
+ */
+void
+MHD_compressor_cache_flush_ (struct MHD_Daemon *daemon);
+
+#endif /* HAVE_ZLIB */
+
+#endif /* MHD_COMPRESS_H */
+
+/* end of mhd_compress.h */
@@ -0,0 +1,867 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_hpack.c
+ * @brief  HPACK header compression for HTTP/2 (RFC 7541)
+ * @author Christian Grothoff
+ */
+
+#include "mhd_hpack.h"
+#include "memorypool.h"
+
+
+/**
+ * Largest integer we accept in a header block; larger values can
+ * only be lengths or indices that are invalid anyway.
+ */
+#define HPACK_INT_MAX (1U << 28)
+
+
+/**
+ * Entry of the static table.
+ */
+struct StaticEntry
+{
+  /**
+   * Name of the field.
+   */
+  const char *name;
+
+  /**
+   * Value of the field.
+   */
+  const char *value;
+};
+
+
+/**
+ * The static table of RFC 7541, Appendix A; index 1 is the first
+ * entry.
+ */
+static const struct StaticEntry static_table[] = {
+  { ":authority", "" },
+  { ":method", "GET" },
+  { ":method", "POST" },
+  { ":path", "/" },
+  { ":path", "/index.html" },
+  { ":scheme", "http" },
+  { ":scheme", "https" },
+  { ":status", "200" },
+  { ":status", "204" },
+  { ":status", "206" },
+  { ":status", "304" },
+  { ":status", "400" },
+  { ":status", "404" },
+  { ":status", "500" },
+  { "accept-charset", "" },
+  { "accept-encoding", "gzip, deflate" },
+  { "accept-language", "" },
+  { "accept-ranges", "" },
+  { "accept", "" },
+  { "access-control-allow-origin", "" },
+  { "age", "" },
+  { "allow", "" },
+  { "authorization", "" },
+  { "cache-control", "" },
+  { "content-disposition", "" },
+  { "content-encoding", "" },
+  { "content-language", "" },
+  { "content-length", "" },
+  { "content-location", "" },
+  { "content-range", "" },
+  { "content-type", "" },
+  { "cookie", "" },
+  { "date", "" },
+  { "etag", "" },
+  { "expect", "" },
+  { "expires", "" },
+  { "from", "" },
+  { "host", "" },
+  { "if-match", "" },
+  { "if-modified-since", "" },
+  { "if-none-match", "" },
+  { "if-range", "" },
+  { "if-unmodified-since", "" },
+  { "last-modified", "" },
+  { "link", "" },
+  { "location", "" },
+  { "max-forwards", "" },
+  { "proxy-authenticate", "" },
+  { "proxy-authorization", "" },
+  { "range", "" },
+  { "referer", "" },
+  { "refresh", "" },
+  { "retry-after", "" },
+  { "server", "" },
+  { "set-cookie", "" },
+  { "strict-transport-security", "" },
+  { "transfer-encoding", "" },
+  { "user-agent", "" },
+  { "vary", "" },
+  { "via", "" },
+  { "www-authenticate", "" }
+};
+
+
+/**
+ * Number of entries in #static_table.
+ */
+#define STATIC_TABLE_LEN (sizeof (static_table) / sizeof (static_table[0]))
+
+
+/**
+ * Symbols of the Huffman code of RFC 7541, Appendix B, sorted by
+ * code.  The code is canonical, so the codes of each length are
+ * consecutive numbers (see #huffman_first).
+ */
+static const uint8_t huffman_symbols[256] = {
+  48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37, 45, 46, 47, 51,
+  52, 53, 54, 55, 56, 57, 61, 65, 95, 98, 100, 102, 103, 104, 108, 109,
+  110, 112, 114, 117, 58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+  77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89, 106, 107, 113, 118,
+  119, 120, 121, 122, 38, 42, 44, 59, 88, 90, 33, 34, 40, 41, 63, 39,
+  43, 124, 35, 62, 0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+  195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161, 167, 172,
+  176, 177, 179, 209, 216, 217, 227, 229, 230, 129, 132, 133, 134, 136,
+  146, 154, 156, 160, 163, 164, 169, 170, 173, 178, 181, 185, 186, 187,
+  189, 190, 196, 198, 228, 232, 233, 1, 135, 137, 138, 139, 140, 141,
+  143, 147, 149, 150, 151, 152, 155, 157, 158, 165, 166, 168, 174, 175,
+  180, 182, 183, 188, 191, 197, 231, 239, 9, 142, 144, 145, 148, 159,
+  171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193, 200, 201,
+  202, 205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211,
+  212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252,
+  253, 254, 2, 3, 4, 5, 6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+  21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220, 249, 10, 13, 22
+};
+
+
+/**
+ * First Huffman code of each length (index), 0 for unused lengths.
+ */
+static const uint32_t huffman_first[31] = {
+  0, 0, 0, 0, 0, 0x0, 0x14, 0x5c, 0xf8, 0, 0x3f8, 0x7fa, 0xffa,
+  0x1ff8, 0x3ffc, 0x7ffc, 0, 0, 0, 0x7fff0, 0xfffe6, 0x1fffdc,
+  0x3fffd2, 0x7fffd8, 0xffffea, 0x1ffffec, 0x3ffffe0, 0x7ffffde,
+  0xfffffe2, 0, 0x3ffffffc
+};
+
+
+/**
+ * Number of Huffman codes of each length (index).  EOS, the last
+ * code of length 30, is not included: it must not be decoded.
+ */
+static const uint8_t huffman_count[31] = {
+  0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3, 0, 0, 0, 3, 8,
+  13, 26, 29, 12, 4, 15, 19, 29, 0, 3
+};
+
+
+/**
+ * Position in #huffman_symbols of the symbol of the first code of
+ * each length (index).
+ */
+static const uint8_t huffman_offset[31] = {
+  0, 0, 0, 0, 0, 0, 10, 36, 68, 0, 74, 79, 82, 84, 90, 92, 0, 0, 0,
+  95, 98, 106, 119, 145, 174, 186, 190, 205, 224, 0, 253
+};
+
+
+/**
+ * Decode a Huffman encoded string.
+ *
+ * @param in the encoded string
+ * @param in_len number of bytes in @a in
+ * @param out where to write the decoded string, NULL to only
+ *        determine its length
+ * @return length of the decoded string, (size_t) -1 if @a in is
+ *         not a valid encoding
+ */
+static size_t
+huffman_decode (const uint8_t *in,
+                size_t in_len,
+                char *out)
+{
+  size_t i;
+  size_t len;
+  uint32_t code;
+  unsigned int bits;
+  unsigned int bit;
+
+  len = 0;
+  code = 0;
+  bits = 0;
+  for (i = 0; i < in_len; i++)
+    {
+      for (bit = 0; bit < 8; bit++)
+        {
+          code = (code << 1) | ((in[i] >> (7 - bit)) & 1);
+          bits++;
+          if (bits > 30)
+            return (size_t) -1;
+          if ( (0 != huffman_count[bits]) &&
+               (code >= huffman_first[bits]) &&
+               (code - huffman_first[bits] < huffman_count[bits]) )
+            {
+              if (NULL != out)
+                out[len] = (char) huffman_symbols[huffman_offset[bits]
+                                                  + code - huffman_first[bits]];
+              len++;
+              code = 0;
+              bits = 0;
+            }
+        }
+    }
+  /* padding: at most 7 bits of the (all ones) EOS code */
+  if ( (bits > 7) ||
+       (code != (1U << bits) - 1) )
+    return (size_t) -1;
+  return len;
+}
+
+
+/**
+ * Decode an integer with an @a prefix bit prefix (RFC 7541,
+ * section 5.1).
+ *
+ * @param in the header block
+ * @param in_len number of bytes in @a in
+ * @param[in,out] pos position of the first byte of the integer,
+ *        set to the position after it
+ * @param prefix number of bits of the integer in the first byte
+ * @param[out] val set to the integer
+ * @return #MHD_YES on success, #MHD_NO if the integer is truncated
+ *         or too large
+ */
+static int
+decode_int (const uint8_t *in,
+            size_t in_len,
+            size_t *pos,
+            unsigned int prefix,
+            uint32_t *val)
+{
+  uint32_t mask = (1U << prefix) - 1;
+  uint32_t v;
+  unsigned int shift;
+  uint8_t b;
+
+  if (*pos >= in_len)
+    return MHD_NO;
+  v = in[(*pos)++] & mask;
+  if (v < mask)
+    {
+      *val = v;
+      return MHD_YES;
+    }
+  shift = 0;
+  do
+    {
+      if (*pos >= in_len)
+        return MHD_NO;
+      /* a value up to #HPACK_INT_MAX needs at most five continuation
+         bytes; more could only be padding and would overflow @a v */
+      if (shift > 28)
+        return MHD_NO;
+      b = in[(*pos)++];
+      if ((uint32_t) (b & 0x7f) > ((HPACK_INT_MAX - v) >> shift))
+        return MHD_NO;
+      v += (uint32_t) (b & 0x7f) << shift;
+      shift += 7;
+    }
+  while (0 != (b & 0x80));
+  *val = v;
+  return MHD_YES;
+}
+
+
+/**
+ * Decode a string literal (RFC 7541, section 5.2) into memory from
+ * @a pool, or into memory from malloc() if the pool is exhausted.
+ *
+ * @param in the header block
+ * @param in_len number of bytes in @a in
+ * @param[in,out] pos position of the string, set to the position
+ *        after it
+ * @param pool pool to allocate from
+ * @param[out] str set to the 0-terminated string
+ * @param[out] str_len set to the length of @a str
+ * @param[out] heap set to #MHD_YES if @a str must be freed,
+ *        because the pool was exhausted
+ * @return #MHD_YES on success, #MHD_NO if the string is malformed
+ *         or no memory is left at all
+ */
+static int
+decode_string (const uint8_t *in,
+               size_t in_len,
+               size_t *pos,
+               struct MemoryPool *pool,
+               char **str,
+               size_t *str_len,
+               int *heap)
+{
+  int huffman;
+  uint32_t len;
+  size_t out_len;
+  char *out;
+
+  if (*pos >= in_len)
+    return MHD_NO;
+  huffman = (0 != (in[*pos] & 0x80));
+  if (MHD_NO == decode_int (in, in_len, pos, 7, &len))
+    return MHD_NO;
+  if (len > in_len - *pos)
+    return MHD_NO;
+  if (huffman)
+    {
+      out_len = huffman_decode (&in[*pos], len, NULL);
+      if ((size_t) -1 == out_len)
+        return MHD_NO;
+    }
+  else
+    out_len = len;
+  *heap = MHD_NO;
+  out = MHD_pool_allocate (pool, out_len + 1, MHD_YES);
+  if (NULL == out)
+    {
+      out = malloc (out_len + 1);
+      if (NULL == out)
+        return MHD_NO;
+      *heap = MHD_YES;
+    }
+  if (huffman)
+    (void) huffman_decode (&in[*pos], len, out);
+  else
+    memcpy (out, &in[*pos], len);
+  out[out_len] = '\0';
+  *pos += len;
+  *str = out;
+  *str_len = out_len;
+  return MHD_YES;
+}
+
+
+/**
+ * Get an entry of the dynamic table.
+ *
+ * @param dec the decoder
+ * @param i position of the entry, 0 for the newest
+ * @return the entry
+ */
+static struct MHD_HpackEntry *
+dynamic_entry (struct MHD_HpackDecoder *dec,
+               unsigned int i)
+{
+  return &dec->entries[(dec->newest + MHD_HPACK_MAX_ENTRIES - i)
+                       % MHD_HPACK_MAX_ENTRIES];
+}
+
+
+/**
+ * Evict the oldest entries of the dynamic table until its size is
+ * at most @a size.
+ *
+ * @param dec the decoder
+ * @param size size to shrink the table to
+ */
+static void
+evict (struct MHD_HpackDecoder *dec,
+       size_t size)
+{
+  struct MHD_HpackEntry *e;
+
+  while ( (dec->size > size) &&
+          (0 != dec->count) )
+    {
+      e = dynamic_entry (dec, dec->count - 1);
+      dec->size -= e->name_len + e->value_len + 32;
+      free (e->name);
+      e->name = NULL;
+      dec->count--;
+    }
+}
+
+
+/**
+ * Add an entry to the dynamic table (RFC 7541, section 4.4).
+ *
+ * @param dec the decoder
+ * @param name name of the field
+ * @param name_len length of @a name
+ * @param value value of the field
+ * @param value_len length of @a value
+ * @return #MHD_YES on success, #MHD_NO if out of memory
+ */
+static int
+insert (struct MHD_HpackDecoder *dec,
+        const char *name,
+        size_t name_len,
+        const char *value,
+        size_t value_len)
+{
+  struct MHD_HpackEntry *e;
+  size_t esize = name_len + value_len + 32;
+  char *copy;
+
+  if (esize > dec->max_size)
+    {
+      /* not an error, the table is just emptied */
+      evict (dec, 0);
+      return MHD_YES;
+    }
+  /* copy first, @a name may point into an entry that is evicted */
+  copy = malloc (name_len + value_len + 2);
+  if (NULL == copy)
+    return MHD_NO;
+  memcpy (copy, name, name_len);
+  copy[name_len] = '\0';
+  memcpy (&copy[name_len + 1], value, value_len);
+  copy[name_len + 1 + value_len] = '\0';
+  evict (dec, dec->max_size - esize);
+  dec->newest = (dec->newest + 1) % MHD_HPACK_MAX_ENTRIES;
+  dec->count++;
+  e = dynamic_entry (dec, 0);
+  e->name = copy;
+  e->name_len = name_len;
+  e->value = &copy[name_len + 1];
+  e->value_len = value_len;
+  dec->size += esize;
+  return MHD_YES;
+}
+
+
+/**
+ * Look up an entry of the static or dynamic table.
+ *
+ * @param dec the decoder
+ * @param index index of the entry (RFC 7541, section 2.3.3)
+ * @param[out] name set to the name of the entry
+ * @param[out] name_len set to the length of @a name
+ * @param[out] value set to the value of the entry
+ * @param[out] value_len set to the length of @a value
+ * @param[out] dynamic set to #MHD_YES if the entry is in the
+ *        dynamic table (and may be evicted)
+ * @return #MHD_YES on success, #MHD_NO if there is no such entry
+ */
+static int
+lookup (struct MHD_HpackDecoder *dec,
+        uint32_t index,
+        const char **name,
+        size_t *name_len,
+        const char **value,
+        size_t *value_len,
+        int *dynamic)
+{
+  struct MHD_HpackEntry *e;
+
+  if (0 == index)
+    return MHD_NO;
+  if (index <= STATIC_TABLE_LEN)
+    {
+      *name = static_table[index - 1].name;
+      *name_len = strlen (*name);
+      *value = static_table[index - 1].value;
+      *value_len = strlen (*value);
+      *dynamic = MHD_NO;
+      return MHD_YES;
+    }
+  index -= STATIC_TABLE_LEN + 1;
+  if (index >= dec->count)
+    return MHD_NO;
+  e = dynamic_entry (dec, index);
+  *name = e->name;
+  *name_len = e->name_len;
+  *value = e->value;
+  *value_len = e->value_len;
+  *dynamic = MHD_YES;
+  return MHD_YES;
+}
+
+
+/**
+ * Copy a string into memory from @a pool.
+ *
+ * @param pool pool to allocate from
+ * @param str string to copy
+ * @param len length of @a str
+ * @return the 0-terminated copy, NULL if the pool is exhausted
+ */
+static char *
+pool_strdup (struct MemoryPool *pool,
+             const char *str,
+             size_t len)
+{
+  char *copy;
+
+  copy = MHD_pool_allocate (pool, len + 1, MHD_YES);
+  if (NULL == copy)
+    return NULL;
+  memcpy (copy, str, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+
+/**
+ * Initialize an HPACK decoder.
+ *
+ * @param dec decoder to initialize
+ */
+void
+MHD_hpack_decoder_init_ (struct MHD_HpackDecoder *dec)
+{
+  memset (dec, 0, sizeof (struct MHD_HpackDecoder));
+  dec->max_size = MHD_HPACK_TABLE_SIZE;
+}
+
+
+/**
+ * Release the dynamic table of an HPACK decoder.
+ *
+ * @param dec decoder to release
+ */
+void
+MHD_hpack_decoder_destroy_ (struct MHD_HpackDecoder *dec)
+{
+  evict (dec, 0);
+}
+
+
+/**
+ * Decode a complete header block.
+ *
+ * @param dec decoder of the connection
+ * @param block the header block
+ * @param block_len number of bytes in @a block
+ * @param pool memory pool to allocate the decoded strings from
+ * @param cb function to call for each field
+ * @param cb_cls closure for @a cb
+ * @return result of the decoding
+ */
+enum MHD_HpackResult
+MHD_hpack_decode_ (struct MHD_HpackDecoder *dec,
+                   const uint8_t *block,
+                   size_t block_len,
+                   struct MemoryPool *pool,
+                   MHD_HpackFieldCallback cb,
+                   void *cb_cls)
+{
+  enum MHD_HpackResult ret;
+  size_t pos;
+  uint32_t index;
+  uint8_t b;
+  const char *name;
+  const char *value;
+  char *lname;
+  char *lvalue;
+  size_t name_len;
+  size_t value_len;
+  int dynamic;
+  int name_heap;
+  int value_heap;
+  int fields;
+
+  ret = MHD_HPACK_OK;
+  pos = 0;
+  fields = MHD_NO;
+  while (pos < block_len)
+    {
+      b = block[pos];
+      if (0 != (b & 0x80))
+        {
+          /* indexed field */
+          if ( (MHD_NO == decode_int (block, block_len, &pos, 7, &index)) ||
+               (MHD_NO == lookup (dec, index,
+                                  &name, &name_len,
+                                  &value, &value_len,
+                                  &dynamic)) )
+            return MHD_HPACK_ERROR;
+          fields = MHD_YES;
+          if (MHD_YES == dynamic)
+            {
+              name = pool_strdup (pool, name, name_len);
+              value = pool_strdup (pool, value, value_len);
+              if ( (NULL == name) ||
+                   (NULL == value) )
+                {
+                  ret = MHD_HPACK_NO_MEMORY;
+                  continue;
+                }
+            }
+          if (MHD_NO == cb (cb_cls, name, name_len, value, value_len))
+            ret = MHD_HPACK_NO_MEMORY;
+          continue;
+        }
+      if (0x20 == (b & 0xe0))
+        {
+          /* dynamic table size update, only before the first field */
+          if ( (MHD_YES == fields) ||
+               (MHD_NO == decode_int (block, block_len, &pos, 5, &index)) ||
+               (index > MHD_HPACK_TABLE_SIZE) )
+            return MHD_HPACK_ERROR;
+          dec->max_size = index;
+          evict (dec, dec->max_size);
+          continue;
+        }
+      /* literal field, with incremental indexing (01), without
+         indexing (0000) or never indexed (0001) */
+      fields = MHD_YES;
+      if (MHD_NO == decode_int (block, block_len, &pos,
+                                (0 != (b & 0x40)) ? 6 : 4,
+                                &index))
+        return MHD_HPACK_ERROR;
+      name_heap = MHD_NO;
+      value_heap = MHD_NO;
+      dynamic = MHD_NO;
+      lname = NULL;
+      if (0 != index)
+        {
+          if (MHD_NO == lookup (dec, index,
+                                &name, &name_len,
+                                &value, &value_len,
+                                &dynamic))
+            return MHD_HPACK_ERROR;
+          if (MHD_YES == dynamic)
+            {
+              lname = pool_strdup (pool, name, name_len);
+              if (NULL == lname)
+                ret = MHD_HPACK_NO_MEMORY;
+              else
+                name = lname;
+            }
+        }
+      else
+        {
+          if (MHD_NO == decode_string (block, block_len, &pos, pool,
+                                       &lname, &name_len, &name_heap))
+            return MHD_HPACK_ERROR;
+          name = lname;
+        }
+      if (MHD_NO == decode_string (block, block_len, &pos, pool,
+                                   &lvalue, &value_len, &value_heap))
+        {
+          if (MHD_YES == name_heap)
+            free (lname);
+          return MHD_HPACK_ERROR;
+        }
+      /* the table must be kept in sync even if we drop the field */
+      if ( (0 != (b & 0x40)) &&
+           (MHD_NO == insert (dec, name, name_len, lvalue, value_len)) )
+        {
+          if (MHD_YES == name_heap)
+            free (lname);
+          if (MHD_YES == value_heap)
+            free (lvalue);
+          return MHD_HPACK_ERROR;
+        }
+      if ( (MHD_YES == name_heap) ||
+           (MHD_YES == value_heap) ||
+           ( (0 != index) &&
+             (MHD_YES == dynamic) &&
+             (name != lname) ) )
+        ret = MHD_HPACK_NO_MEMORY;
+      else if (MHD_NO == cb (cb_cls, name, name_len, lvalue, value_len))
+        ret = MHD_HPACK_NO_MEMORY;
+      if (MHD_YES == name_heap)
+        free (lname);
+      if (MHD_YES == value_heap)
+        free (lvalue);
+    }
+  return ret;
+}
+
+
+/**
+ * Encode an integer with an @a prefix bit prefix (RFC 7541,
+ * section 5.1).
+ *
+ * @param buf where to write the integer
+ * @param size number of bytes available in @a buf
+ * @param flags bits of the first byte above the prefix
+ * @param prefix number of bits of the integer in the first byte
+ * @param val the integer
+ * @return number of bytes written, 0 if @a size is too small
+ */
+static size_t
+encode_int (uint8_t *buf,
+            size_t size,
+            uint8_t flags,
+            unsigned int prefix,
+            size_t val)
+{
+  size_t mask = ((size_t) 1 << prefix) - 1;
+  size_t pos;
+
+  if (0 == size)
+    return 0;
+  if (val < mask)
+    {
+      buf[0] = flags | (uint8_t) val;
+      return 1;
+    }
+  buf[0] = flags | (uint8_t) mask;
+  val -= mask;
+  pos = 1;
+  while (val >= 128)
+    {
+      if (pos >= size)
+        return 0;
+      buf[pos++] = (uint8_t) (0x80 | (val & 0x7f));
+      val >>= 7;
+    }
+  if (pos >= size)
+    return 0;
+  buf[pos++] = (uint8_t) val;
+  return pos;
+}
+
+
+/**
+ * Encode a string literal without Huffman coding.
+ *
+ * @param buf where to write the string
+ * @param size number of bytes available in @a buf
+ * @param str the string
+ * @param len length of @a str
+ * @param lower #MHD_YES to convert the string to lower case
+ * @return number of bytes written, 0 if @a size is too small
+ */
+static size_t
+encode_string (uint8_t *buf,
+               size_t size,
+               const char *str,
+               size_t len,
+               int lower)
+{
+  size_t pos;
+  size_t i;
+  char c;
+
+  pos = encode_int (buf, size, 0x00, 7, len);
+  if ( (0 == pos) ||
+       (len > size - pos) )
+    return 0;
+  if (MHD_NO == lower)
+    {
+      memcpy (&buf[pos], str, len);
+      return pos + len;
+    }
+  for (i = 0; i < len; i++)
+    {
+      c = str[i];
+      if ( (c >= 'A') && (c <= 'Z') )
+        c += 'a' - 'A';
+      buf[pos + i] = (uint8_t) c;
+    }
+  return pos + len;
+}
+
+
+/**
+ * Encode the ":status" pseudo-header field.
+ *
+ * @param buf where to write the field
+ * @param size number of bytes available in @a buf
+ * @param status the HTTP status code (100-999)
+ * @return number of bytes written, 0 if @a size is too small
+ */
+size_t
+MHD_hpack_encode_status_ (uint8_t *buf,
+                          size_t size,
+                          unsigned int status)
+{
+  char digits[3];
+  unsigned int i;
+
+  for (i = 8; i <= 14; i++)
+    {
+      if (status == (unsigned int) atoi (static_table[i - 1].value))
+        return encode_int (buf, size, 0x80, 7, i);
+    }
+  if (size < 2)
+    return 0;
+  digits[0] = '0' + (status / 100) % 10;
+  digits[1] = '0' + (status / 10) % 10;
+  digits[2] = '0' + status % 10;
+  /* literal without indexing, name ":status" */
+  buf[0] = 0x08;
+  i = encode_string (&buf[1], size - 1, digits, 3, MHD_NO);
+  if (0 == i)
+    return 0;
+  return 1 + i;
+}
+
+
+/**
+ * Encode a header field as a literal that is not added to the
+ * dynamic table of the peer (we never change the dynamic table, so
+ * that the encoder needs no state).  The name is converted to lower
+ * case, as HTTP/2 requires.
+ *
+ * @param buf where to write the field
+ * @param size number of bytes available in @a buf
+ * @param name name of the field
+ * @param name_len length of @a name
+ * @param value value of the field
+ * @param value_len length of @a value
+ * @return number of bytes written, 0 if @a size is too small
+ */
+size_t
+MHD_hpack_encode_field_ (uint8_t *buf,
+                         size_t size,
+                         const char *name,
+                         size_t name_len,
+                         const char *value,
+                         size_t value_len)
+{
+  size_t pos;
+  size_t n;
+  unsigned int i;
+
+  /* pseudo-headers are set by us, not taken from the response */
+  for (i = 15; i <= STATIC_TABLE_LEN; i++)
+    {
+      if ( (strlen (static_table[i - 1].name) == name_len) &&
+           (MHD_str_equal_caseless_n_ (static_table[i - 1].name,
+                                       name,
+                                       name_len)) )
+        break;
+    }
+  if (i <= STATIC_TABLE_LEN)
+    {
+      pos = encode_int (buf, size, 0x00, 4, i);
+      if (0 == pos)
+        return 0;
+    }
+  else
+    {
+      if (size < 1)
+        return 0;
+      buf[0] = 0x00;
+      n = encode_string (&buf[1], size - 1, name, name_len, MHD_YES);
+      if (0 == n)
+        return 0;
+      pos = 1 + n;
+    }
+  n = encode_string (&buf[pos], size - pos, value, value_len, MHD_NO);
+  if (0 == n)
+    return 0;
+  return pos + n;
+}
+
+/* end of mhd_hpack.c */
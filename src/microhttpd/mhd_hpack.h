@@ -0,0 +1,224 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_hpack.h
+ * @brief  HPACK header compression for HTTP/2 (RFC 7541)
+ * @author Christian Grothoff
+ */
+
+#ifndef MHD_HPACK_H
+#define MHD_HPACK_H 1
+#include "internal.h"
+
+/**
+ * Size of the dynamic table of the decoder.  We do not announce a
+ * different SETTINGS_HEADER_TABLE_SIZE, so this is the protocol
+ * default.
+ */
+#define MHD_HPACK_TABLE_SIZE 4096
+
+/**
+ * Maximum number of entries in the dynamic table; each entry
+ * takes at least 32 bytes of the table size.
+ */
+#define MHD_HPACK_MAX_ENTRIES (MHD_HPACK_TABLE_SIZE / 32)
+
+
+/**
+ * Result of #MHD_hpack_decode_().
+ */
+enum MHD_HpackResult
+{
+  /**
+   * The header block was decoded.
+   */
+  MHD_HPACK_OK = 0,
+
+  /**
+   * The header block is malformed; the state of the decoder is lost,
+   * so the HTTP/2 connection must be closed (COMPRESSION_ERROR).
+   */
+  MHD_HPACK_ERROR = 1,
+
+  /**
+   * The header block was decoded and the dynamic table updated, but
+   * some fields did not fit into the memory pool (or were rejected by
+   * the callback) and were dropped.
+   */
+  MHD_HPACK_NO_MEMORY = 2
+};
+
+
+/**
+ * Entry of the dynamic table of an HPACK decoder.
+ */
+struct MHD_HpackEntry
+{
+  /**
+   * Name of the field, followed by the value; one allocation.
+   */
+  char *name;
+
+  /**
+   * Value of the field, points into the allocation of @e name.
+   */
+  char *value;
+
+  /**
+   * Length of @e name.
+   */
+  size_t name_len;
+
+  /**
+   * Length of @e value.
+   */
+  size_t value_len;
+};
+
+
+/**
+ * State of the HPACK decoder of one HTTP/2 connection.
+ */
+struct MHD_HpackDecoder
+{
+  /**
+   * Ring of the entries of the dynamic table.
+   */
+  struct MHD_HpackEntry entries[MHD_HPACK_MAX_ENTRIES];
+
+  /**
+   * Position of the newest entry in @e entries.
+   */
+  unsigned int newest;
+
+  /**
+   * Number of entries in the dynamic table.
+   */
+  unsigned int count;
+
+  /**
+   * Size of the dynamic table as defined in RFC 7541, section 4.1.
+   */
+  size_t size;
+
+  /**
+   * Maximum size of the dynamic table, as last set by the encoder
+   * (at most #MHD_HPACK_TABLE_SIZE).
+   */
+  size_t max_size;
+};
+
+
+/**
+ * Function called by #MHD_hpack_decode_() for each decoded field.
+ * The strings are 0-terminated and allocated from the memory pool
+ * given to #MHD_hpack_decode_() (or static).
+ *
+ * @param cls closure
+ * @param name name of the field
+ * @param name_len length of @a name
+ * @param value value of the field
+ * @param value_len length of @a value
+ * @return #MHD_YES to continue, #MHD_NO if the field was rejected
+ *         (decoding continues, but the result is #MHD_HPACK_NO_MEMORY)
+ */
+typedef int
+(*MHD_HpackFieldCallback) (void *cls,
+                           const char *name,
+                           size_t name_len,
+                           const char *value,
+                           size_t value_len);
+
+
+/**
+ * Initialize an HPACK decoder.
+ *
+ * @param dec decoder to initialize
+ */
+void
+MHD_hpack_decoder_init_ (struct MHD_HpackDecoder *dec);
+
+
+/**
+ * Release the dynamic table of an HPACK decoder.
+ *
+ * @param dec decoder to release
+ */
+void
+MHD_hpack_decoder_destroy_ (struct MHD_HpackDecoder *dec);
+
+
+/**
+ * Decode a complete header block.
+ *
+ * @param dec decoder of the connection
+ * @param block the header block
+ * @param block_len number of bytes in @a block
+ * @param pool memory pool to allocate the decoded strings from
+ * @param cb function to call for each field
+ * @param cb_cls closure for @a cb
+ * @return result of the decoding
+ */
+enum MHD_HpackResult
+MHD_hpack_decode_ (struct MHD_HpackDecoder *dec,
+                   const uint8_t *block,
+                   size_t block_len,
+                   struct MemoryPool *pool,
+                   MHD_HpackFieldCallback cb,
+                   void *cb_cls);
+
+
+/**
+ * Encode the ":status" pseudo-header field.
+ *
+ * @param buf where to write the field
+ * @param size number of bytes available in @a buf
+ * @param status the HTTP status code (100-999)
+ * @return number of bytes written, 0 if @a size is too small
+ */
+size_t
+MHD_hpack_encode_status_ (uint8_t *buf,
+                          size_t size,
+                          unsigned int status);
+
+
+/**
+ * Encode a header field as a literal that is not added to the
+ * dynamic table of the peer (we never change the dynamic table, so
+ * that the encoder needs no state).  The name is converted to lower
+ * case, as HTTP/2 requires.
+ *
+ * @param buf where to write the field
+ * @param size number of bytes available in @a buf
+ * @param name name of the field
+ * @param name_len length of @a name
+ * @param value value of the field
+ * @param value_len length of @a value
+ * @return number of bytes written, 0 if @a size is too small
+ */
+size_t
+MHD_hpack_encode_field_ (uint8_t *buf,
+                         size_t size,
+                         const char *name,
+                         size_t name_len,
+                         const char *value,
+                         size_t value_len);
+
+#endif
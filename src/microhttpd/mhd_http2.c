@@ -0,0 +1,2549 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_http2.c
+ * @brief  HTTP/2 sessions (RFC 7540), see #MHD_USE_HTTP2
+ * @author Christian Grothoff
+ *
+ * An HTTP/2 connection stays in #MHD_CONNECTION_HTTP2 state.  The
+ * session replaces the memory pool of the connection by two fixed
+ * buffers for the frames, and each stream gets a `struct
+ * MHD_Connection` of its own (with a memory pool of the usual size)
+ * that the application sees as the connection of the request.  The
+ * access handler runs in the thread of the event loop.
+ */
+
+#include "mhd_http2.h"
+#include "mhd_hpack.h"
+#include "connection.h"
+#include "memorypool.h"
+#include "response.h"
+#include "mhd_mono_clock.h"
+#include "mhd_probes.h"
+#include "mhd_access_log.h"
+
+/**
+ * The connection preface of the client.
+ */
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+
+/**
+ * Length of #H2_PREFACE.
+ */
+#define H2_PREFACE_LEN 24
+
+/**
+ * Size of a frame header.
+ */
+#define H2_FRAME_HEADER_SIZE 9
+
+/**
+ * Size of the input and of the output buffer of a session; a frame
+ * of the default SETTINGS_MAX_FRAME_SIZE (which we do not change)
+ * always fits.
+ */
+#define H2_BUFFER_SIZE 32768
+
+/**
+ * Maximum payload of the frames we receive (the protocol default).
+ */
+#define H2_MAX_FRAME_SIZE 16384
+
+/**
+ * Initial flow control window of the protocol.
+ */
+#define H2_DEFAULT_WINDOW 65535
+
+/**
+ * Flow control window of the connection that we grant the peer, to
+ * allow uploads on several streams at once.
+ */
+#define H2_CONNECTION_WINDOW (1024 * 1024)
+
+/**
+ * Maximum flow control window of the protocol.
+ */
+#define H2_MAX_WINDOW 0x7fffffff
+
+/**
+ * Free space we keep in the output buffer for the control frames
+ * (SETTINGS and PING acknowledgements, WINDOW_UPDATE, RST_STREAM)
+ * that processing a frame may cause.
+ */
+#define H2_CONTROL_RESERVE 512
+
+/**
+ * Maximum size of a header block spread over several frames.
+ */
+#define H2_MAX_HEADER_BLOCK (64 * 1024)
+
+/* frame types */
+#define H2_DATA 0x0
+#define H2_HEADERS 0x1
+#define H2_PRIORITY 0x2
+#define H2_RST_STREAM 0x3
+#define H2_SETTINGS 0x4
+#define H2_PUSH_PROMISE 0x5
+#define H2_PING 0x6
+#define H2_GOAWAY 0x7
+#define H2_WINDOW_UPDATE 0x8
+#define H2_CONTINUATION 0x9
+
+/* frame flags */
+#define H2_FLAG_END_STREAM 0x1
+#define H2_FLAG_ACK 0x1
+#define H2_FLAG_END_HEADERS 0x4
+#define H2_FLAG_PADDED 0x8
+#define H2_FLAG_PRIORITY 0x20
+
+/* error codes */
+#define H2_NO_ERROR 0x0
+#define H2_PROTOCOL_ERROR 0x1
+#define H2_INTERNAL_ERROR 0x2
+#define H2_FLOW_CONTROL_ERROR 0x3
+#define H2_STREAM_CLOSED 0x5
+#define H2_FRAME_SIZE_ERROR 0x6
+#define H2_REFUSED_STREAM 0x7
+#define H2_COMPRESSION_ERROR 0x9
+#define H2_ENHANCE_YOUR_CALM 0xb
+
+/* settings */
+#define H2_SETTINGS_ENABLE_PUSH 0x2
+#define H2_SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define H2_SETTINGS_INITIAL_WINDOW_SIZE 0x4
+#define H2_SETTINGS_MAX_FRAME_SIZE 0x5
+
+
+/**
+ * State of an HTTP/2 connection.
+ */
+struct MHD_Http2Session
+{
+  /**
+   * The connection.
+   */
+  struct MHD_Connection *connection;
+
+  /**
+   * Head of the list of open streams.
+   */
+  struct MHD_Http2Stream *streams_head;
+
+  /**
+   * Tail of the list of open streams.
+   */
+  struct MHD_Http2Stream *streams_tail;
+
+  /**
+   * Header block spread over several frames, allocated with
+   * malloc() while the CONTINUATION frames are received.
+   */
+  char *hblock;
+
+  /**
+   * Number of bytes in @e hblock.
+   */
+  size_t hblock_len;
+
+  /**
+   * Stream the CONTINUATION frames are for, 0 if none are expected.
+   */
+  uint32_t hblock_stream;
+
+  /**
+   * #MHD_YES if the HEADERS frame of @e hblock ended the stream.
+   */
+  int hblock_end_stream;
+
+  /**
+   * Number of streams in the list.
+   */
+  unsigned int num_streams;
+
+  /**
+   * Highest stream identifier the client used.
+   */
+  uint32_t last_stream_id;
+
+  /**
+   * How many bytes of DATA we may send on the connection.
+   */
+  int64_t send_window;
+
+  /**
+   * How many bytes of DATA the peer may still send on the connection.
+   */
+  uint32_t recv_window;
+
+  /**
+   * Bytes of DATA consumed that were not yet returned to the peer with
+   * a WINDOW_UPDATE for the connection.
+   */
+  uint32_t recv_credit;
+
+  /**
+   * SETTINGS_INITIAL_WINDOW_SIZE of the peer.
+   */
+  uint32_t peer_initial_window;
+
+  /**
+   * SETTINGS_MAX_FRAME_SIZE of the peer.
+   */
+  uint32_t peer_max_frame;
+
+  /**
+   * #MHD_YES once the preface of the client was received.
+   */
+  int preface_done;
+
+  /**
+   * #MHD_YES once we sent GOAWAY because of a connection error; the
+   * connection is closed once the output is sent.
+   */
+  int goaway_sent;
+
+  /**
+   * #MHD_YES once the client sent GOAWAY; the connection is closed
+   * once the open streams are done.
+   */
+  int goaway_received;
+
+  /**
+   * #MHD_YES if the socket failed; the connection is closed without
+   * sending the output.
+   */
+  int dead;
+
+  /**
+   * #MHD_YES if a stream polls its content reader (see @e
+   * body_unready of `struct MHD_Http2Stream`).
+   */
+  int body_blocked;
+
+  /**
+   * HPACK decoder for the header blocks of the client.
+   */
+  struct MHD_HpackDecoder hpack;
+
+  /**
+   * Frames received; the read buffer of the connection.
+   */
+  char in[H2_BUFFER_SIZE];
+
+  /**
+   * Frames to send; the write buffer of the connection.
+   */
+  char out[H2_BUFFER_SIZE];
+};
+
+
+/**
+ * State of #decode_field() while decoding a header block.
+ */
+struct FieldContext
+{
+  /**
+   * Stream the header block is for, NULL to drop the fields.
+   */
+  struct MHD_Http2Stream *stream;
+
+  /**
+   * Value of ":path".
+   */
+  const char *path;
+
+  /**
+   * Value of ":authority".
+   */
+  const char *authority;
+
+  /**
+   * Length of @e authority.
+   */
+  size_t authority_len;
+
+  /**
+   * The cookie fields, joined with "; ".
+   */
+  char *cookie;
+
+  /**
+   * Length of @e cookie.
+   */
+  size_t cookie_len;
+
+  /**
+   * #MHD_YES if the block is a trailer.
+   */
+  int trailers;
+
+  /**
+   * #MHD_YES once a regular field was decoded.
+   */
+  int regular;
+
+  /**
+   * #MHD_YES if the block is malformed (RFC 7540, section 8.1.2.6).
+   */
+  int malformed;
+};
+
+
+/**
+ * Check if @a buf starts with the HTTP/2 connection preface of a
+ * client ("prior knowledge", RFC 7540, section 3.5).
+ *
+ * @param buf data received on the connection
+ * @param len number of bytes in @a buf
+ * @return what the data says about the preface
+ */
+enum MHD_Http2Preface
+MHD_http2_check_preface_ (const char *buf,
+                          size_t len)
+{
+  if (0 != memcmp (buf,
+                   H2_PREFACE,
+                   MHD_MIN (len, H2_PREFACE_LEN)))
+    return MHD_HTTP2_PREFACE_NONE;
+  if (len < H2_PREFACE_LEN)
+    return MHD_HTTP2_PREFACE_PARTIAL;
+  return MHD_HTTP2_PREFACE_FOUND;
+}
+
+
+/**
+ * Read a 32-bit number in network byte order.
+ *
+ * @param p where to read
+ * @return the number
+ */
+static uint32_t
+get_u32 (const uint8_t *p)
+{
+  return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+    ((uint32_t) p[2] << 8) | (uint32_t) p[3];
+}
+
+
+/**
+ * Write a 32-bit number in network byte order.
+ *
+ * @param p where to write
+ * @param v the number
+ */
+static void
+put_u32 (uint8_t *p,
+         uint32_t v)
+{
+  p[0] = (uint8_t) (v >> 24);
+  p[1] = (uint8_t) (v >> 16);
+  p[2] = (uint8_t) (v >> 8);
+  p[3] = (uint8_t) v;
+}
+
+
+/**
+ * Write a frame header.
+ *
+ * @param p where to write the header
+ * @param len length of the payload
+ * @param type type of the frame
+ * @param flags flags of the frame
+ * @param stream_id stream of the frame, 0 for the connection
+ */
+static void
+put_frame_header (uint8_t *p,
+                  size_t len,
+                  uint8_t type,
+                  uint8_t flags,
+                  uint32_t stream_id)
+{
+  p[0] = (uint8_t) (len >> 16);
+  p[1] = (uint8_t) (len >> 8);
+  p[2] = (uint8_t) len;
+  p[3] = type;
+  p[4] = flags;
+  put_u32 (&p[5],
+           stream_id & 0x7fffffff);
+}
+
+
+/**
+ * Create the memory pool of a request.  With
+ * #MHD_USE_THREAD_PER_CONNECTION, the pool cache of the daemon
+ * belongs to the thread of the daemon and is not used.
+ *
+ * @param daemon daemon of the connection
+ * @return the pool, NULL if out of memory (or out of the memory
+ *         budget of the daemon)
+ */
+static struct MemoryPool *
+request_pool_create (struct MHD_Daemon *daemon)
+{
+  struct MemoryPool *pool;
+
+  if (MHD_NO == MHD_memory_budget_take_ (daemon))
+    return NULL;
+  if (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
+    pool = MHD_pool_create (daemon->pool_size);
+  else
+    pool = MHD_pool_create_cached (&daemon->pool_cache,
+                                   &daemon->pool_cache_len,
+                                   daemon->pool_size);
+  if (NULL == pool)
+    MHD_memory_budget_return_ (daemon);
+  return pool;
+}
+
+
+/**
+ * Release a pool created with request_pool_create().
+ *
+ * @param daemon daemon of the connection
+ * @param pool pool to release
+ */
+static void
+request_pool_destroy (struct MHD_Daemon *daemon,
+                      struct MemoryPool *pool)
+{
+  if (NULL == pool)
+    return;
+  MHD_memory_budget_return_ (daemon);
+  if (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
+    {
+      MHD_pool_destroy (pool);
+      return;
+    }
+  MHD_pool_destroy_cached (&daemon->pool_cache,
+                           &daemon->pool_cache_len,
+                           daemon->pool_cache_max,
+                           pool);
+}
+
+
+/**
+ * Get space at the end of the output buffer, moving the data not
+ * yet sent to the front if needed.
+ *
+ * @param session the session
+ * @param size number of bytes needed
+ * @return where to write, NULL if the buffer is too full
+ */
+static uint8_t *
+out_reserve (struct MHD_Http2Session *session,
+             size_t size)
+{
+  struct MHD_Connection *connection = session->connection;
+
+  if ( (H2_BUFFER_SIZE - connection->write_buffer_append_offset < size) &&
+       (0 != connection->write_buffer_send_offset) )
+    {
+      memmove (session->out,
+               &session->out[connection->write_buffer_send_offset],
+               connection->write_buffer_append_offset
+               - connection->write_buffer_send_offset);
+      connection->write_buffer_append_offset
+        -= connection->write_buffer_send_offset;
+      connection->write_buffer_send_offset = 0;
+    }
+  if (H2_BUFFER_SIZE - connection->write_buffer_append_offset < size)
+    return NULL;
+  return (uint8_t *) &session->out[connection->write_buffer_append_offset];
+}
+
+
+/**
+ * Get the number of bytes that can be added to the output buffer.
+ *
+ * @param session the session
+ * @return free space in the output buffer
+ */
+static size_t
+out_space (struct MHD_Http2Session *session)
+{
+  struct MHD_Connection *connection = session->connection;
+
+  return H2_BUFFER_SIZE - connection->write_buffer_append_offset
+    + connection->write_buffer_send_offset;
+}
+
+
+/**
+ * Queue a frame with a small payload.  If the output buffer is full
+ * (which #H2_CONTROL_RESERVE makes unlikely), the connection cannot
+ * be kept in a consistent state and is dropped.
+ *
+ * @param session the session
+ * @param type type of the frame
+ * @param flags flags of the frame
+ * @param stream_id stream of the frame
+ * @param payload the payload
+ * @param len length of @a payload
+ */
+static void
+queue_frame (struct MHD_Http2Session *session,
+             uint8_t type,
+             uint8_t flags,
+             uint32_t stream_id,
+             const void *payload,
+             size_t len)
+{
+  uint8_t *p;
+
+  p = out_reserve (session,
+                   H2_FRAME_HEADER_SIZE + len);
+  if (NULL == p)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (session->connection->daemon,
+                "HTTP/2 output buffer exhausted, closing connection\n");
+#endif
+      session->dead = MHD_YES;
+      return;
+    }
+  put_frame_header (p,
+                    len,
+                    type,
+                    flags,
+                    stream_id);
+  if (0 != len)
+    memcpy (&p[H2_FRAME_HEADER_SIZE],
+            payload,
+            len);
+  session->connection->write_buffer_append_offset
+    += H2_FRAME_HEADER_SIZE + len;
+}
+
+
+/**
+ * Queue a frame with a 32-bit payload (RST_STREAM, WINDOW_UPDATE).
+ *
+ * @param session the session
+ * @param type type of the frame
+ * @param stream_id stream of the frame
+ * @param value the payload
+ */
+static void
+queue_u32_frame (struct MHD_Http2Session *session,
+                 uint8_t type,
+                 uint32_t stream_id,
+                 uint32_t value)
+{
+  uint8_t payload[4];
+
+  put_u32 (payload,
+           value);
+  queue_frame (session,
+               type,
+               0,
+               stream_id,
+               payload,
+               sizeof (payload));
+}
+
+
+/**
+ * Handle a connection error (RFC 7540, section 5.4.1): send GOAWAY
+ * and stop processing the input; the connection is closed once the
+ * output is sent.
+ *
+ * @param session the session
+ * @param code the error code
+ */
+static void
+connection_error (struct MHD_Http2Session *session,
+                  uint32_t code)
+{
+  uint8_t payload[8];
+
+  if (MHD_YES == session->goaway_sent)
+    return;
+  session->goaway_sent = MHD_YES;
+  put_u32 (payload,
+           session->last_stream_id);
+  put_u32 (&payload[4],
+           code);
+  queue_frame (session,
+               H2_GOAWAY,
+               0,
+               0,
+               payload,
+               sizeof (payload));
+}
+
+
+/**
+ * Find an open stream.
+ *
+ * @param session the session
+ * @param id identifier of the stream
+ * @return the stream, NULL if it is not open
+ */
+static struct MHD_Http2Stream *
+find_stream (struct MHD_Http2Session *session,
+             uint32_t id)
+{
+  struct MHD_Http2Stream *stream;
+
+  for (stream = session->streams_head; NULL != stream; stream = stream->next)
+    if (id == stream->id)
+      return stream;
+  return NULL;
+}
+
+
+/**
+ * Reset a stream (RFC 7540, section 5.4.2).  The stream is freed
+ * once the application is done with it.
+ *
+ * @param stream the stream
+ * @param code the error code to send, or #H2_NO_ERROR to send none
+ *        (if the peer reset the stream)
+ * @param termination code for the #MHD_RequestCompletedCallback
+ */
+static void
+reset_stream (struct MHD_Http2Stream *stream,
+              uint32_t code,
+              enum MHD_RequestTerminationCode termination)
+{
+  if (MHD_YES == stream->reset)
+    return;
+  stream->reset = MHD_YES;
+  stream->termination = termination;
+  if (H2_NO_ERROR != code)
+    queue_u32_frame (stream->session,
+                     H2_RST_STREAM,
+                     stream->id,
+                     code);
+}
+
+
+/**
+ * Return DATA the application processed (or that we dropped) to the
+ * peer with WINDOW_UPDATE frames, once enough came together.
+ *
+ * @param session the session
+ * @param stream stream the data was for, NULL if it is closed
+ * @param n number of bytes
+ */
+static void
+credit (struct MHD_Http2Session *session,
+        struct MHD_Http2Stream *stream,
+        size_t n)
+{
+  session->recv_credit += (uint32_t) n;
+  if (session->recv_credit >= H2_CONNECTION_WINDOW / 4)
+    {
+      queue_u32_frame (session,
+                       H2_WINDOW_UPDATE,
+                       0,
+                       session->recv_credit);
+      session->recv_window += session->recv_credit;
+      session->recv_credit = 0;
+    }
+  if (NULL == stream)
+    return;
+  stream->recv_credit += (uint32_t) n;
+  if ( (stream->recv_credit >= H2_DEFAULT_WINDOW / 4) &&
+       (MHD_NO == stream->remote_closed) )
+    {
+      queue_u32_frame (session,
+                       H2_WINDOW_UPDATE,
+                       stream->id,
+                       stream->recv_credit);
+      stream->recv_window += stream->recv_credit;
+      stream->recv_credit = 0;
+    }
+}
+
+
+/**
+ * Free a stream and end its request.
+ *
+ * @param stream the stream
+ * @param termination code for the #MHD_RequestCompletedCallback
+ */
+static void
+free_stream (struct MHD_Http2Stream *stream,
+             enum MHD_RequestTerminationCode termination)
+{
+  struct MHD_Http2Session *session = stream->session;
+  struct MHD_Connection *request = stream->request;
+  struct MHD_Daemon *daemon = request->daemon;
+
+  if ( (NULL != daemon->notify_completed) &&
+       (MHD_YES == request->client_aware) )
+    daemon->notify_completed (daemon->notify_completed_cls,
+                              request,
+                              &request->client_context,
+                              termination);
+  if (NULL != request->response)
+    MHD_destroy_response (request->response);
+  /* the data never reaches the application */
+  if (0 != stream->upload_len)
+    credit (session,
+            NULL,
+            stream->upload_len);
+  free (stream->upload);
+  request_pool_destroy (daemon,
+                        request->pool);
+  free (request);
+  DLL_remove (session->streams_head,
+              session->streams_tail,
+              stream);
+  session->num_streams--;
+  free (stream);
+}
+
+
+/**
+ * Call the access handler for the request of a stream.
+ *
+ * @param stream the stream
+ * @param upload_data the upload data, NULL if none
+ * @param[in,out] upload_data_size number of bytes in @a upload_data,
+ *        set to the number of bytes not processed
+ */
+static void
+call_handler (struct MHD_Http2Stream *stream,
+              const char *upload_data,
+              size_t *upload_data_size)
+{
+  struct MHD_Connection *request = stream->request;
+  struct MHD_Daemon *daemon = request->daemon;
+
+  request->client_aware = MHD_YES;
+  if (0 == request->request_times.handler_called)
+    request->request_times.handler_called = MHD_monotonic_usec_counter ();
+  if (MHD_NO ==
+      daemon->default_handler (daemon->default_handler_cls,
+                               request,
+                               request->url,
+                               request->method,
+                               request->version,
+                               upload_data,
+                               upload_data_size,
+                               &request->client_context))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Internal application error, resetting HTTP/2 stream.\n");
+#endif
+      reset_stream (stream,
+                    H2_INTERNAL_ERROR,
+                    MHD_REQUEST_TERMINATED_WITH_ERROR);
+    }
+}
+
+
+/**
+ * Check if the access handler may be called for a stream.
+ *
+ * @param stream the stream
+ * @return #MHD_YES if the handler is to be called
+ */
+static int
+handler_ready (struct MHD_Http2Stream *stream)
+{
+  return ( (MHD_NO == stream->reset) &&
+           (MHD_NO == stream->request->suspended) &&
+           (NULL == stream->request->response) ) ? MHD_YES : MHD_NO;
+}
+
+
+/**
+ * Give the upload data of a stream to the access handler: first the
+ * data buffered earlier, then @a data (without copying it if
+ * possible).  What the handler does not process is buffered.
+ * Finally, call the handler once more when the upload is complete.
+ *
+ * @param stream the stream
+ * @param data data just received, NULL if none
+ * @param len number of bytes in @a data
+ */
+static void
+run_handler (struct MHD_Http2Stream *stream,
+             const char *data,
+             size_t len)
+{
+  struct MHD_Http2Session *session = stream->session;
+  struct MHD_Connection *request = stream->request;
+  size_t left;
+  size_t used;
+  char *upload;
+
+  if (MHD_NO == stream->handler_called)
+    {
+      if (MHD_NO == handler_ready (stream))
+        goto keep;
+      stream->handler_called = MHD_YES;
+      left = 0;
+      call_handler (stream,
+                    NULL,
+                    &left);
+    }
+  while ( (0 != stream->upload_len) &&
+          (MHD_YES == handler_ready (stream)) )
+    {
+      left = stream->upload_len;
+      call_handler (stream,
+                    stream->upload,
+                    &left);
+      if (left >= stream->upload_len)
+        break; /* the handler waits for more data */
+      used = stream->upload_len - left;
+      memmove (stream->upload,
+               &stream->upload[used],
+               left);
+      stream->upload_len = left;
+      credit (session,
+              stream,
+              used);
+    }
+  while ( (0 != len) &&
+          (0 == stream->upload_len) &&
+          (MHD_YES == handler_ready (stream)) )
+    {
+      left = len;
+      call_handler (stream,
+                    data,
+                    &left);
+      if (left >= len)
+        break;
+      credit (session,
+              stream,
+              len - left);
+      data += len - left;
+      len = left;
+    }
+ keep:
+  if ( (0 != len) &&
+       (MHD_NO == stream->reset) &&
+       (NULL == request->response) )
+    {
+      /* the flow control window limits the buffer */
+      if (stream->upload_len + len > stream->upload_size)
+        {
+          upload = realloc (stream->upload,
+                            stream->upload_len + len);
+          if (NULL == upload)
+            {
+              reset_stream (stream,
+                            H2_INTERNAL_ERROR,
+                            MHD_REQUEST_TERMINATED_WITH_ERROR);
+              credit (session,
+                      NULL,
+                      len);
+              return;
+            }
+          stream->upload = upload;
+          stream->upload_size = stream->upload_len + len;
+        }
+      memcpy (&stream->upload[stream->upload_len],
+              data,
+              len);
+      stream->upload_len += len;
+      len = 0;
+    }
+  if (0 != len)
+    {
+      /* dropped, the request is over */
+      credit (session,
+              stream,
+              len);
+    }
+  /* called again until a response is queued, as in the
+     #MHD_CONNECTION_FOOTERS_RECEIVED state of HTTP/1.x */
+  if ( (MHD_YES == stream->handler_called) &&
+       (MHD_YES == stream->remote_closed) &&
+       (0 == stream->upload_len) &&
+       (MHD_YES == handler_ready (stream)) )
+    {
+      request->state = MHD_CONNECTION_FOOTERS_RECEIVED;
+      left = 0;
+      call_handler (stream,
+                    NULL,
+                    &left);
+    }
+}
+
+
+/**
+ * Add a decoded header field to the request of a stream.
+ *
+ * @param cls the `struct FieldContext`
+ * @param name name of the field
+ * @param name_len length of @a name
+ * @param value value of the field
+ * @param value_len length of @a value
+ * @return #MHD_YES to continue, #MHD_NO if out of memory
+ */
+static int
+decode_field (void *cls,
+              const char *name,
+              size_t name_len,
+              const char *value,
+              size_t value_len)
+{
+  struct FieldContext *fc = cls;
+  struct MHD_Connection *request;
+  char *path;
+  char *cookie;
+
+  if (NULL == fc->stream)
+    return MHD_YES;
+  request = fc->stream->request;
+  if (':' == name[0])
+    {
+      if ( (MHD_YES == fc->trailers) ||
+           (MHD_YES == fc->regular) )
+        {
+          fc->malformed = MHD_YES;
+          return MHD_YES;
+        }
+      if (0 == strcmp (name, ":method"))
+        {
+          request->method = (char *) value;
+        }
+      else if (0 == strcmp (name, ":path"))
+        {
+          /* may be static and is unescaped in place */
+          path = MHD_pool_allocate (request->pool,
+                                    value_len + 1,
+                                    MHD_YES);
+          if (NULL == path)
+            return MHD_NO;
+          memcpy (path,
+                  value,
+                  value_len + 1);
+          fc->path = path;
+        }
+      else if (0 == strcmp (name, ":authority"))
+        {
+          fc->authority = value;
+          fc->authority_len = value_len;
+        }
+      else if (0 != strcmp (name, ":scheme"))
+        {
+          fc->malformed = MHD_YES;
+        }
+      return MHD_YES;
+    }
+  fc->regular = MHD_YES;
+  if ( (MHD_NO == fc->trailers) &&
+       (0 == strcmp (name, "cookie")) )
+    {
+      /* may be split into several fields, RFC 7540, section 8.1.2.5 */
+      if (NULL == fc->cookie)
+        {
+          fc->cookie = (char *) value;
+          fc->cookie_len = value_len;
+          return MHD_YES;
+        }
+      cookie = MHD_pool_allocate (request->pool,
+                                  fc->cookie_len + 2 + value_len + 1,
+                                  MHD_YES);
+      if (NULL == cookie)
+        return MHD_NO;
+      memcpy (cookie,
+              fc->cookie,
+              fc->cookie_len);
+      memcpy (&cookie[fc->cookie_len],
+              "; ",
+              2);
+      memcpy (&cookie[fc->cookie_len + 2],
+              value,
+              value_len + 1);
+      fc->cookie = cookie;
+      fc->cookie_len += 2 + value_len;
+      return MHD_YES;
+    }
+  return MHD_set_connection_value_n (request,
+                                     (MHD_YES == fc->trailers)
+                                     ? MHD_FOOTER_KIND
+                                     : MHD_HEADER_KIND,
+                                     name,
+                                     name_len,
+                                     value,
+                                     value_len);
+}
+
+
+/**
+ * Decode a header block that is dropped, to keep the state of the
+ * HPACK decoder in sync.
+ *
+ * @param session the session
+ * @param block the header block
+ * @param len length of @a block
+ * @return #MHD_YES on success, #MHD_NO if the connection failed
+ */
+static int
+drop_header_block (struct MHD_Http2Session *session,
+                   const uint8_t *block,
+                   size_t len)
+{
+  struct MHD_Daemon *daemon = session->connection->daemon;
+  struct MemoryPool *pool;
+  struct FieldContext fc;
+  enum MHD_HpackResult res;
+
+  pool = request_pool_create (daemon);
+  if (NULL == pool)
+    {
+      connection_error (session,
+                        H2_INTERNAL_ERROR);
+      return MHD_NO;
+    }
+  memset (&fc, 0, sizeof (fc));
+  res = MHD_hpack_decode_ (&session->hpack,
+                           block,
+                           len,
+                           pool,
+                           &decode_field,
+                           &fc);
+  request_pool_destroy (daemon,
+                        pool);
+  if (MHD_HPACK_ERROR == res)
+    {
+      connection_error (session,
+                        H2_COMPRESSION_ERROR);
+      return MHD_NO;
+    }
+  return MHD_YES;
+}
+
+
+/**
+ * Open a stream for a request.
+ *
+ * @param session the session
+ * @param id identifier of the stream
+ * @return the stream, NULL if out of memory
+ */
+static struct MHD_Http2Stream *
+open_stream (struct MHD_Http2Session *session,
+             uint32_t id)
+{
+  struct MHD_Connection *connection = session->connection;
+  struct MHD_Daemon *daemon = connection->daemon;
+  struct MHD_Http2Stream *stream;
+  struct MHD_Connection *request;
+
+  stream = calloc (1, sizeof (struct MHD_Http2Stream));
+  if (NULL == stream)
+    return NULL;
+  request = calloc (1, sizeof (struct MHD_Connection));
+  if (NULL == request)
+    {
+      free (stream);
+      return NULL;
+    }
+  request->pool = request_pool_create (daemon);
+  if (NULL == request->pool)
+    {
+      free (request);
+      free (stream);
+      return NULL;
+    }
+  request->daemon = daemon;
+  request->addr = connection->addr;
+  request->addr_len = connection->addr_len;
+  request->socket_fd = connection->socket_fd;
+  request->socket_context = connection->socket_context;
+  request->connection_timeout = connection->connection_timeout;
+  request->last_activity = connection->last_activity;
+#if HTTPS_SUPPORT
+  request->tls_session = connection->tls_session;
+#endif
+  request->version = MHD_HTTP_VERSION_2;
+  request->state = MHD_CONNECTION_HEADERS_PROCESSED;
+  request->event_loop_info = MHD_EVENT_LOOP_INFO_BLOCK;
+  request->h2_stream = stream;
+  request->request_times.accepted = connection->request_times.accepted;
+  request->request_times.first_byte = MHD_monotonic_usec_counter ();
+  request->request_times.headers_received = request->request_times.first_byte;
+  stream->session = session;
+  stream->request = request;
+  stream->id = id;
+  stream->send_window = session->peer_initial_window;
+  stream->recv_window = H2_DEFAULT_WINDOW;
+  DLL_insert (session->streams_head,
+              session->streams_tail,
+              stream);
+  session->num_streams++;
+  MHD_STATS_ADD_ (daemon, requests, 1);
+  MHD_STATS_ADD_ (daemon, http2_streams, 1);
+  return stream;
+}
+
+
+/**
+ * Process a complete header block: open a stream for a request, or
+ * add the trailers of a request.
+ *
+ * @param session the session
+ * @param id stream the block is for
+ * @param block the header block
+ * @param len length of @a block
+ * @param end_stream #MHD_YES if the HEADERS frame ended the stream
+ */
+static void
+process_header_block (struct MHD_Http2Session *session,
+                      uint32_t id,
+                      const uint8_t *block,
+                      size_t len,
+                      int end_stream)
+{
+  struct MHD_Daemon *daemon = session->connection->daemon;
+  struct MHD_Http2Stream *stream;
+  struct MHD_Connection *request;
+  struct FieldContext fc;
+  enum MHD_HpackResult res;
+
+  stream = find_stream (session,
+                        id);
+  if (NULL != stream)
+    {
+      /* trailers */
+      if ( (MHD_YES == stream->remote_closed) ||
+           (MHD_NO == end_stream) )
+        {
+          (void) drop_header_block (session,
+                                    block,
+                                    len);
+          connection_error (session,
+                            (MHD_YES == stream->remote_closed)
+                            ? H2_STREAM_CLOSED
+                            : H2_PROTOCOL_ERROR);
+          return;
+        }
+      memset (&fc, 0, sizeof (fc));
+      if (MHD_NO == stream->reset)
+        fc.stream = stream;
+      fc.trailers = MHD_YES;
+      res = MHD_hpack_decode_ (&session->hpack,
+                               block,
+                               len,
+                               stream->request->pool,
+                               &decode_field,
+                               &fc);
+      if (MHD_HPACK_ERROR == res)
+        {
+          /* the GOAWAY ends the stream, no RST_STREAM needed */
+          reset_stream (stream,
+                        H2_NO_ERROR,
+                        MHD_REQUEST_TERMINATED_WITH_ERROR);
+          connection_error (session,
+                            H2_COMPRESSION_ERROR);
+          return;
+        }
+      stream->remote_closed = MHD_YES;
+      if (MHD_YES == fc.malformed)
+        reset_stream (stream,
+                      H2_PROTOCOL_ERROR,
+                      MHD_REQUEST_TERMINATED_WITH_ERROR);
+      else if (MHD_HPACK_NO_MEMORY == res)
+        {
+          MHD_STATS_ADD_ (daemon, pool_exhaustions, 1);
+          reset_stream (stream,
+                        H2_INTERNAL_ERROR,
+                        MHD_REQUEST_TERMINATED_WITH_ERROR);
+        }
+      else
+        run_handler (stream,
+                     NULL,
+                     0);
+      return;
+    }
+  if ( (0 == (id & 1)) ||
+       (id <= session->last_stream_id) )
+    {
+      /* closed (or never opened by the client) */
+      if (MHD_YES == drop_header_block (session,
+                                        block,
+                                        len))
+        connection_error (session,
+                          (id <= session->last_stream_id)
+                          ? H2_STREAM_CLOSED
+                          : H2_PROTOCOL_ERROR);
+      return;
+    }
+  session->last_stream_id = id;
+  if ( (session->num_streams >= daemon->http2_max_streams) ||
+       (NULL == (stream = open_stream (session,
+                                       id))) )
+    {
+      if (MHD_YES == drop_header_block (session,
+                                        block,
+                                        len))
+        queue_u32_frame (session,
+                         H2_RST_STREAM,
+                         id,
+                         H2_REFUSED_STREAM);
+      return;
+    }
+  request = stream->request;
+  memset (&fc, 0, sizeof (fc));
+  fc.stream = stream;
+  res = MHD_hpack_decode_ (&session->hpack,
+                           block,
+                           len,
+                           request->pool,
+                           &decode_field,
+                           &fc);
+  if (MHD_HPACK_ERROR == res)
+    {
+      /* never call the handler for a request without headers */
+      reset_stream (stream,
+                    H2_NO_ERROR,
+                    MHD_REQUEST_TERMINATED_WITH_ERROR);
+      connection_error (session,
+                        H2_COMPRESSION_ERROR);
+      return;
+    }
+  stream->remote_closed = end_stream;
+  if ( (MHD_YES == fc.malformed) ||
+       (NULL == request->method) ||
+       (NULL == fc.path) )
+    {
+      reset_stream (stream,
+                    H2_PROTOCOL_ERROR,
+                    MHD_REQUEST_TERMINATED_WITH_ERROR);
+      return;
+    }
+  if ( (MHD_HPACK_NO_MEMORY == res) ||
+       ( (NULL != fc.authority) &&
+         (NULL == MHD_lookup_connection_value (request,
+                                               MHD_HEADER_KIND,
+                                               MHD_HTTP_HEADER_HOST)) &&
+         (MHD_NO == MHD_set_connection_value_n (request,
+                                                MHD_HEADER_KIND,
+                                                "host",
+                                                4,
+                                                fc.authority,
+                                                fc.authority_len)) ) ||
+       ( (NULL != fc.cookie) &&
+         (MHD_NO == MHD_set_connection_value_n (request,
+                                                MHD_HEADER_KIND,
+                                                "cookie",
+                                                6,
+                                                fc.cookie,
+                                                fc.cookie_len)) ) )
+    {
+      MHD_STATS_ADD_ (daemon, pool_exhaustions, 1);
+      reset_stream (stream,
+                    H2_INTERNAL_ERROR,
+                    MHD_REQUEST_TERMINATED_WITH_ERROR);
+      return;
+    }
+  MHD_connection_parse_cookies_ (request);
+  MHD_connection_set_target_ (request,
+                              (char *) fc.path);
+  run_handler (stream,
+               NULL,
+               0);
+}
+
+
+/**
+ * Add a fragment of a header block; process the block once it is
+ * complete.
+ *
+ * @param session the session
+ * @param id stream the block is for
+ * @param fragment the fragment
+ * @param len length of @a fragment
+ * @param flags flags of the HEADERS or CONTINUATION frame
+ */
+static void
+header_fragment (struct MHD_Http2Session *session,
+                 uint32_t id,
+                 const uint8_t *fragment,
+                 size_t len,
+                 uint8_t flags)
+{
+  char *hblock;
+
+  if ( (0 == session->hblock_len) &&
+       (0 != (flags & H2_FLAG_END_HEADERS)) )
+    {
+      /* common case, decode from the input buffer */
+      session->hblock_stream = 0;
+      process_header_block (session,
+                            id,
+                            fragment,
+                            len,
+                            session->hblock_end_stream);
+      return;
+    }
+  if (session->hblock_len + len > H2_MAX_HEADER_BLOCK)
+    {
+      connection_error (session,
+                        H2_ENHANCE_YOUR_CALM);
+      return;
+    }
+  hblock = realloc (session->hblock,
+                    session->hblock_len + len);
+  if (NULL == hblock)
+    {
+      connection_error (session,
+                        H2_INTERNAL_ERROR);
+      return;
+    }
+  memcpy (&hblock[session->hblock_len],
+          fragment,
+          len);
+  session->hblock = hblock;
+  session->hblock_len += len;
+  session->hblock_stream = id;
+  if (0 == (flags & H2_FLAG_END_HEADERS))
+    return;
+  session->hblock_stream = 0;
+  process_header_block (session,
+                        id,
+                        (const uint8_t *) session->hblock,
+                        session->hblock_len,
+                        session->hblock_end_stream);
+  free (session->hblock);
+  session->hblock = NULL;
+  session->hblock_len = 0;
+}
+
+
+/**
+ * Process a DATA frame.
+ *
+ * @param session the session
+ * @param id stream of the frame
+ * @param flags flags of the frame
+ * @param payload payload of the frame
+ * @param len length of @a payload
+ */
+static void
+handle_data (struct MHD_Http2Session *session,
+             uint32_t id,
+             uint8_t flags,
+             const uint8_t *payload,
+             size_t len)
+{
+  struct MHD_Http2Stream *stream;
+  size_t pad;
+
+  if (0 == id)
+    {
+      connection_error (session,
+                        H2_PROTOCOL_ERROR);
+      return;
+    }
+  if (len > session->recv_window)
+    {
+      connection_error (session,
+                        H2_FLOW_CONTROL_ERROR);
+      return;
+    }
+  session->recv_window -= (uint32_t) len;
+  pad = 0;
+  if (0 != (flags & H2_FLAG_PADDED))
+    {
+      if ( (0 == len) ||
+           (payload[0] >= len) )
+        {
+          connection_error (session,
+                            H2_PROTOCOL_ERROR);
+          return;
+        }
+      pad = 1 + payload[0];
+    }
+  stream = find_stream (session,
+                        id);
+  if (NULL == stream)
+    {
+      if (id > session->last_stream_id)
+        connection_error (session,
+                          H2_PROTOCOL_ERROR);
+      else
+        credit (session,
+                NULL,
+                len); /* stream was reset meanwhile */
+      return;
+    }
+  if (MHD_YES == stream->remote_closed)
+    {
+      credit (session,
+              NULL,
+              len);
+      reset_stream (stream,
+                    H2_STREAM_CLOSED,
+                    MHD_REQUEST_TERMINATED_WITH_ERROR);
+      return;
+    }
+  if (len > stream->recv_window)
+    {
+      credit (session,
+              NULL,
+              len);
+      reset_stream (stream,
+                    H2_FLOW_CONTROL_ERROR,
+                    MHD_REQUEST_TERMINATED_WITH_ERROR);
+      return;
+    }
+  stream->recv_window -= (uint32_t) len;
+  if (0 != (flags & H2_FLAG_END_STREAM))
+    stream->remote_closed = MHD_YES;
+  /* padding is returned right away */
+  if (0 != pad)
+    credit (session,
+            stream,
+            pad);
+  run_handler (stream,
+               (const char *) &payload[pad],
+               len - pad);
+}
+
+
+/**
+ * Process a SETTINGS frame.
+ *
+ * @param session the session
+ * @param flags flags of the frame
+ * @param payload payload of the frame
+ * @param len length of @a payload
+ */
+static void
+handle_settings (struct MHD_Http2Session *session,
+                 uint8_t flags,
+                 const uint8_t *payload,
+                 size_t len)
+{
+  struct MHD_Http2Stream *stream;
+  uint32_t value;
+  unsigned int id;
+  size_t pos;
+
+  if (0 != (flags & H2_FLAG_ACK))
+    {
+      if (0 != len)
+        connection_error (session,
+                          H2_FRAME_SIZE_ERROR);
+      return;
+    }
+  if (0 != len % 6)
+    {
+      connection_error (session,
+                        H2_FRAME_SIZE_ERROR);
+      return;
+    }
+  for (pos = 0; pos < len; pos += 6)
+    {
+      id = ((unsigned int) payload[pos] << 8) | payload[pos + 1];
+      value = get_u32 (&payload[pos + 2]);
+      switch (id)
+        {
+        case H2_SETTINGS_ENABLE_PUSH:
+          if (value > 1)
+            {
+              connection_error (session,
+                                H2_PROTOCOL_ERROR);
+              return;
+            }
+          break;
+        case H2_SETTINGS_INITIAL_WINDOW_SIZE:
+          if (value > H2_MAX_WINDOW)
+            {
+              connection_error (session,
+                                H2_FLOW_CONTROL_ERROR);
+              return;
+            }
+          for (stream = session->streams_head; NULL != stream; stream = stream->next)
+            {
+              stream->send_window += (int64_t) value - session->peer_initial_window;
+              /* RFC 7540, section 6.9.2 */
+              if (stream->send_window > H2_MAX_WINDOW)
+                {
+                  connection_error (session,
+                                    H2_FLOW_CONTROL_ERROR);
+                  return;
+                }
+            }
+          session->peer_initial_window = value;
+          break;
+        case H2_SETTINGS_MAX_FRAME_SIZE:
+          if ( (value < 16384) ||
+               (value > 16777215) )
+            {
+              connection_error (session,
+                                H2_PROTOCOL_ERROR);
+              return;
+            }
+          session->peer_max_frame = value;
+          break;
+        default:
+          /* not relevant for us, or unknown */
+          break;
+        }
+    }
+  queue_frame (session,
+               H2_SETTINGS,
+               H2_FLAG_ACK,
+               0,
+               NULL,
+               0);
+}
+
+
+/**
+ * Process a WINDOW_UPDATE frame.
+ *
+ * @param session the session
+ * @param id stream of the frame
+ * @param payload payload of the frame
+ * @param len length of @a payload
+ */
+static void
+handle_window_update (struct MHD_Http2Session *session,
+                      uint32_t id,
+                      const uint8_t *payload,
+                      size_t len)
+{
+  struct MHD_Http2Stream *stream;
+  uint32_t inc;
+
+  if (4 != len)
+    {
+      connection_error (session,
+                        H2_FRAME_SIZE_ERROR);
+      return;
+    }
+  inc = get_u32 (payload) & 0x7fffffff;
+  if (0 == id)
+    {
+      session->send_window += inc;
+      if ( (0 == inc) ||
+           (session->send_window > H2_MAX_WINDOW) )
+        connection_error (session,
+                          (0 == inc)
+                          ? H2_PROTOCOL_ERROR
+                          : H2_FLOW_CONTROL_ERROR);
+      return;
+    }
+  stream = find_stream (session,
+                        id);
+  if (NULL == stream)
+    {
+      if (id > session->last_stream_id)
+        connection_error (session,
+                          H2_PROTOCOL_ERROR);
+      return;
+    }
+  stream->send_window += inc;
+  if (0 == inc)
+    reset_stream (stream,
+                  H2_PROTOCOL_ERROR,
+                  MHD_REQUEST_TERMINATED_WITH_ERROR);
+  else if (stream->send_window > H2_MAX_WINDOW)
+    reset_stream (stream,
+                  H2_FLOW_CONTROL_ERROR,
+                  MHD_REQUEST_TERMINATED_WITH_ERROR);
+}
+
+
+/**
+ * Process a frame.
+ *
+ * @param session the session
+ * @param type type of the frame
+ * @param flags flags of the frame
+ * @param id stream of the frame
+ * @param payload payload of the frame
+ * @param len length of @a payload
+ */
+static void
+handle_frame (struct MHD_Http2Session *session,
+              uint8_t type,
+              uint8_t flags,
+              uint32_t id,
+              const uint8_t *payload,
+              size_t len)
+{
+  struct MHD_Http2Stream *stream;
+  size_t off;
+  size_t pad;
+
+  if ( (0 != session->hblock_stream) &&
+       ( (H2_CONTINUATION != type) ||
+         (id != session->hblock_stream) ) )
+    {
+      connection_error (session,
+                        H2_PROTOCOL_ERROR);
+      return;
+    }
+  switch (type)
+    {
+    case H2_DATA:
+      handle_data (session,
+                   id,
+                   flags,
+                   payload,
+                   len);
+      break;
+    case H2_HEADERS:
+      if (0 == id)
+        {
+          connection_error (session,
+                            H2_PROTOCOL_ERROR);
+          return;
+        }
+      off = 0;
+      pad = 0;
+      if (0 != (flags & H2_FLAG_PADDED))
+        {
+          if (0 == len)
+            {
+              connection_error (session,
+                                H2_FRAME_SIZE_ERROR);
+              return;
+            }
+          pad = payload[0];
+          off = 1;
+        }
+      if (0 != (flags & H2_FLAG_PRIORITY))
+        off += 5;
+      if (off + pad > len)
+        {
+          connection_error (session,
+                            H2_PROTOCOL_ERROR);
+          return;
+        }
+      session->hblock_end_stream = (0 != (flags & H2_FLAG_END_STREAM))
+        ? MHD_YES
+        : MHD_NO;
+      header_fragment (session,
+                       id,
+                       &payload[off],
+                       len - off - pad,
+                       flags);
+      break;
+    case H2_CONTINUATION:
+      if (0 == session->hblock_stream)
+        {
+          connection_error (session,
+                            H2_PROTOCOL_ERROR);
+          return;
+        }
+      header_fragment (session,
+                       id,
+                       payload,
+                       len,
+                       flags);
+      break;
+    case H2_PRIORITY:
+      /* we do not prioritize */
+      if (5 != len)
+        connection_error (session,
+                          H2_FRAME_SIZE_ERROR);
+      break;
+    case H2_RST_STREAM:
+      if ( (4 != len) ||
+           (0 == id) ||
+           (id > session->last_stream_id) )
+        {
+          connection_error (session,
+                            (4 != len)
+                            ? H2_FRAME_SIZE_ERROR
+                            : H2_PROTOCOL_ERROR);
+          return;
+        }
+      stream = find_stream (session,
+                            id);
+      if (NULL == stream)
+        break;
+      stream->remote_closed = MHD_YES;
+      reset_stream (stream,
+                    H2_NO_ERROR,
+                    MHD_REQUEST_TERMINATED_CLIENT_ABORT);
+      break;
+    case H2_SETTINGS:
+      if (0 != id)
+        {
+          connection_error (session,
+                            H2_PROTOCOL_ERROR);
+          return;
+        }
+      handle_settings (session,
+                       flags,
+                       payload,
+                       len);
+      break;
+    case H2_PING:
+      if ( (8 != len) ||
+           (0 != id) )
+        {
+          connection_error (session,
+                            (8 != len)
+                            ? H2_FRAME_SIZE_ERROR
+                            : H2_PROTOCOL_ERROR);
+          return;
+        }
+      if (0 == (flags & H2_FLAG_ACK))
+        queue_frame (session,
+                     H2_PING,
+                     H2_FLAG_ACK,
+                     0,
+                     payload,
+                     len);
+      break;
+    case H2_GOAWAY:
+      if (0 != id)
+        {
+          connection_error (session,
+                            H2_PROTOCOL_ERROR);
+          return;
+        }
+      session->goaway_received = MHD_YES;
+      break;
+    case H2_WINDOW_UPDATE:
+      handle_window_update (session,
+                            id,
+                            payload,
+                            len);
+      break;
+    case H2_PUSH_PROMISE:
+      connection_error (session,
+                        H2_PROTOCOL_ERROR);
+      break;
+    default:
+      /* unknown frame types are ignored, RFC 7540, section 4.1 */
+      break;
+    }
+}
+
+
+/**
+ * Process the frames in the input buffer, as long as there is room
+ * for the frames they cause.
+ *
+ * @param session the session
+ */
+static void
+process_input (struct MHD_Http2Session *session)
+{
+  struct MHD_Connection *connection = session->connection;
+  const uint8_t *in = (const uint8_t *) session->in;
+  size_t avail = connection->read_buffer_offset;
+  size_t pos;
+  size_t len;
+
+  pos = 0;
+  if (MHD_NO == session->preface_done)
+    {
+      /* with ALPN, the preface was not checked yet */
+      if (avail < H2_PREFACE_LEN)
+        {
+          if (MHD_HTTP2_PREFACE_NONE ==
+              MHD_http2_check_preface_ (session->in,
+                                        avail))
+            connection_error (session,
+                              H2_PROTOCOL_ERROR);
+          return;
+        }
+      if (MHD_HTTP2_PREFACE_FOUND !=
+          MHD_http2_check_preface_ (session->in,
+                                    avail))
+        {
+          connection_error (session,
+                            H2_PROTOCOL_ERROR);
+          return;
+        }
+      session->preface_done = MHD_YES;
+      pos = H2_PREFACE_LEN;
+    }
+  while ( (MHD_NO == session->goaway_sent) &&
+          (MHD_NO == session->dead) &&
+          (avail - pos >= H2_FRAME_HEADER_SIZE) &&
+          (out_space (session) >= H2_CONTROL_RESERVE) )
+    {
+      len = ((size_t) in[pos] << 16) | ((size_t) in[pos + 1] << 8) | in[pos + 2];
+      if (len > H2_MAX_FRAME_SIZE)
+        {
+          connection_error (session,
+                            H2_FRAME_SIZE_ERROR);
+          break;
+        }
+      if (avail - pos - H2_FRAME_HEADER_SIZE < len)
+        break;
+      handle_frame (session,
+                    in[pos + 3],
+                    in[pos + 4],
+                    get_u32 (&in[pos + 5]) & 0x7fffffff,
+                    &in[pos + H2_FRAME_HEADER_SIZE],
+                    len);
+      pos += H2_FRAME_HEADER_SIZE + len;
+    }
+  if ( (MHD_YES == session->goaway_sent) ||
+       (MHD_YES == session->dead) )
+    pos = avail; /* nothing more is processed */
+  memmove (session->in,
+           &session->in[pos],
+           avail - pos);
+  connection->read_buffer_offset = avail - pos;
+}
+
+
+/**
+ * The response of a stream was sent completely: end the request.
+ *
+ * @param stream the stream
+ */
+static void
+complete_stream (struct MHD_Http2Stream *stream)
+{
+  struct MHD_Connection *request = stream->request;
+
+  request->request_times.body_sent = MHD_monotonic_usec_counter ();
+  if (MHD_access_log_enabled_ (request->daemon))
+    MHD_access_log_add_ (request);
+  if (MHD_NO == stream->remote_closed)
+    {
+      /* the client need not send the rest of the upload,
+         RFC 7540, section 8.1 */
+      queue_u32_frame (stream->session,
+                       H2_RST_STREAM,
+                       stream->id,
+                       H2_NO_ERROR);
+    }
+  free_stream (stream,
+               MHD_REQUEST_TERMINATED_COMPLETED_OK);
+}
+
+
+/**
+ * Check if a response header must not be sent with HTTP/2 (RFC 7540,
+ * section 8.1.2.2).
+ *
+ * @param pos the header
+ * @return #MHD_YES if the header is connection-specific
+ */
+static int
+is_connection_header (const struct MHD_HTTP_Header *pos)
+{
+  switch (pos->token)
+    {
+    case MHD_HEADER_TOKEN_CONNECTION:
+    case MHD_HEADER_TOKEN_TRANSFER_ENCODING:
+    case MHD_HEADER_TOKEN_UPGRADE:
+      return MHD_YES;
+    default:
+      break;
+    }
+  if ( (MHD_str_equal_caseless_ (pos->header,
+                                 "Keep-Alive")) ||
+       (MHD_str_equal_caseless_ (pos->header,
+                                 "Proxy-Connection")) )
+    return MHD_YES;
+  return MHD_NO;
+}
+
+
+/**
+ * Encode the header block of the response of a stream.
+ *
+ * @param stream the stream
+ * @param buf where to write the header block
+ * @param size number of bytes available in @a buf
+ * @return length of the block, 0 if @a size is too small
+ */
+static size_t
+encode_response_headers (struct MHD_Http2Stream *stream,
+                         uint8_t *buf,
+                         size_t size)
+{
+  struct MHD_Connection *request = stream->request;
+  struct MHD_Response *response = request->response;
+  struct MHD_HTTP_Header *pos;
+  char date[128];
+  char clen[32];
+  size_t off;
+  size_t n;
+  int have_date;
+  int have_clen;
+  unsigned int code;
+
+  code = request->responseCode & (~MHD_ICY_FLAG);
+  off = MHD_hpack_encode_status_ (buf,
+                                  size,
+                                  code);
+  if (0 == off)
+    return 0;
+  have_date = MHD_NO;
+  have_clen = MHD_NO;
+  for (pos = response->first_header; NULL != pos; pos = pos->next)
+    {
+      if ( (MHD_HEADER_KIND != pos->kind) ||
+           (MHD_YES == is_connection_header (pos)) )
+        continue;
+      if (MHD_HEADER_TOKEN_DATE == pos->token)
+        have_date = MHD_YES;
+      if (MHD_HEADER_TOKEN_CONTENT_LENGTH == pos->token)
+        have_clen = MHD_YES;
+      n = MHD_hpack_encode_field_ (&buf[off],
+                                   size - off,
+                                   pos->header,
+                                   pos->header_size,
+                                   pos->value,
+                                   pos->value_size);
+      if (0 == n)
+        return 0;
+      off += n;
+    }
+  if ( (MHD_NO == have_clen) &&
+       (MHD_SIZE_UNKNOWN != response->total_size) &&
+       (code >= 200) &&
+       (MHD_HTTP_NO_CONTENT != code) &&
+       (MHD_HTTP_NOT_MODIFIED != code) )
+    {
+      n = MHD_snprintf_ (clen,
+                         sizeof (clen),
+                         MHD_UNSIGNED_LONG_LONG_PRINTF,
+                         (MHD_UNSIGNED_LONG_LONG) response->total_size);
+      n = MHD_hpack_encode_field_ (&buf[off],
+                                   size - off,
+                                   "content-length",
+                                   14,
+                                   clen,
+                                   n);
+      if (0 == n)
+        return 0;
+      off += n;
+    }
+  if ( (MHD_NO == have_date) &&
+       (0 == (request->daemon->options & MHD_SUPPRESS_DATE_NO_CLOCK)) )
+    {
+      MHD_get_cached_date_string_ (request->daemon,
+                                   date);
+      /* "Date: " ... "\r\n" */
+      n = MHD_hpack_encode_field_ (&buf[off],
+                                   size - off,
+                                   "date",
+                                   4,
+                                   &date[6],
+                                   strlen (date) - 8);
+      if (0 == n)
+        return 0;
+      off += n;
+    }
+  return off;
+}
+
+
+/**
+ * Queue the HEADERS (and CONTINUATION) frames of the response of a
+ * stream.
+ *
+ * @param stream the stream
+ * @param end_stream #MHD_YES if the response has no body
+ * @return #MHD_YES if the frames were queued, #MHD_NO if the output
+ *         buffer is too full
+ */
+static int
+send_headers (struct MHD_Http2Stream *stream,
+              int end_stream)
+{
+  struct MHD_Http2Session *session = stream->session;
+  struct MHD_Connection *connection = session->connection;
+  uint8_t *p;
+  size_t space;
+  size_t block_len;
+  size_t frames;
+  size_t max;
+  size_t i;
+  size_t chunk;
+
+  space = out_space (session);
+  if (space < H2_CONTROL_RESERVE + H2_FRAME_HEADER_SIZE)
+    return MHD_NO;
+  space -= H2_CONTROL_RESERVE;
+  p = out_reserve (session,
+                   space);
+  block_len = encode_response_headers (stream,
+                                       &p[H2_FRAME_HEADER_SIZE],
+                                       space - H2_FRAME_HEADER_SIZE);
+  if (0 == block_len)
+    {
+      if (connection->write_buffer_send_offset !=
+          connection->write_buffer_append_offset)
+        return MHD_NO; /* try again with an empty buffer */
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (connection->daemon,
+                "Response headers too large for HTTP/2 stream\n");
+#endif
+      reset_stream (stream,
+                    H2_INTERNAL_ERROR,
+                    MHD_REQUEST_TERMINATED_WITH_ERROR);
+      return MHD_YES;
+    }
+  max = session->peer_max_frame;
+  frames = (block_len + max - 1) / max;
+  if (H2_FRAME_HEADER_SIZE + block_len + (frames - 1) * H2_FRAME_HEADER_SIZE > space)
+    return MHD_NO;
+  /* make room for the headers of the CONTINUATION frames, starting
+     with the last fragment */
+  for (i = frames - 1; i > 0; i--)
+    {
+      chunk = MHD_MIN (max, block_len - i * max);
+      memmove (&p[(i + 1) * H2_FRAME_HEADER_SIZE + i * max],
+               &p[H2_FRAME_HEADER_SIZE + i * max],
+               chunk);
+      put_frame_header (&p[i * (H2_FRAME_HEADER_SIZE + max)],
+                        chunk,
+                        H2_CONTINUATION,
+                        (i == frames - 1) ? H2_FLAG_END_HEADERS : 0,
+                        stream->id);
+    }
+  put_frame_header (p,
+                    MHD_MIN (max, block_len),
+                    H2_HEADERS,
+                    ((1 == frames) ? H2_FLAG_END_HEADERS : 0) |
+                    ((MHD_YES == end_stream) ? H2_FLAG_END_STREAM : 0),
+                    stream->id);
+  connection->write_buffer_append_offset
+    += block_len + frames * H2_FRAME_HEADER_SIZE;
+  stream->headers_sent = MHD_YES;
+  stream->request->request_times.headers_sent = MHD_monotonic_usec_counter ();
+  return MHD_YES;
+}
+
+
+/**
+ * Send as much of the response of a stream as the flow control
+ * windows and the output buffer allow.
+ *
+ * @param stream the stream
+ * @return #MHD_YES if the stream was freed
+ */
+static int
+send_response (struct MHD_Http2Stream *stream)
+{
+  struct MHD_Http2Session *session = stream->session;
+  struct MHD_Connection *connection = session->connection;
+  struct MHD_Connection *request = stream->request;
+  struct MHD_Response *response = request->response;
+  unsigned int code;
+  uint8_t *p;
+  int64_t max;
+  size_t space;
+  ssize_t ret;
+  int end;
+
+  code = request->responseCode & (~MHD_ICY_FLAG);
+  if (MHD_NO == stream->headers_sent)
+    {
+      end = ( (code < 200) ||
+              (MHD_HTTP_NO_CONTENT == code) ||
+              (MHD_HTTP_NOT_MODIFIED == code) ||
+              (request->response_write_position == response->total_size) )
+        ? MHD_YES
+        : MHD_NO;
+      if (MHD_NO == send_headers (stream,
+                                  end))
+        return MHD_NO;
+      if (MHD_YES == stream->reset)
+        return MHD_NO;
+      if (MHD_YES == end)
+        {
+          complete_stream (stream);
+          return MHD_YES;
+        }
+    }
+  stream->body_unready = MHD_NO;
+  while (1)
+    {
+      space = out_space (session);
+      if (space < H2_CONTROL_RESERVE + H2_FRAME_HEADER_SIZE)
+        return MHD_NO;
+      max = space - H2_CONTROL_RESERVE - H2_FRAME_HEADER_SIZE;
+      max = MHD_MIN (max, stream->send_window);
+      max = MHD_MIN (max, session->send_window);
+      max = MHD_MIN (max, (int64_t) session->peer_max_frame);
+      if (MHD_SIZE_UNKNOWN != response->total_size)
+        max = MHD_MIN ((uint64_t) max,
+                       response->total_size - request->response_write_position);
+      if ( (max <= 0) &&
+           (MHD_SIZE_UNKNOWN == response->total_size) )
+        return MHD_NO; /* flow control */
+      if ( (max <= 0) &&
+           (request->response_write_position != response->total_size) )
+        return MHD_NO; /* flow control */
+      p = out_reserve (session,
+                       H2_FRAME_HEADER_SIZE + (size_t) max);
+      if (0 == max)
+        ret = 0;
+      else if (NULL == response->crc)
+        {
+          memcpy (&p[H2_FRAME_HEADER_SIZE],
+                  &response->data[request->response_write_position
+                                  - response->data_start],
+                  (size_t) max);
+          ret = (ssize_t) max;
+        }
+      else
+        {
+          (void) MHD_mutex_lock_ (&response->mutex);
+          ret = response->crc (response->crc_cls,
+                               request->response_write_position,
+                               (char *) &p[H2_FRAME_HEADER_SIZE],
+                               (size_t) max);
+          (void) MHD_mutex_unlock_ (&response->mutex);
+          if ( ( ((ssize_t) MHD_CONTENT_READER_END_OF_STREAM) == ret) &&
+               (MHD_SIZE_UNKNOWN == response->total_size) )
+            {
+              /* end of a body of unknown size */
+              response->total_size = request->response_write_position;
+              ret = 0;
+            }
+          else if ( (((ssize_t) MHD_CONTENT_READER_END_OF_STREAM) == ret) ||
+                    (((ssize_t) MHD_CONTENT_READER_END_WITH_ERROR) == ret) )
+            {
+              reset_stream (stream,
+                            H2_INTERNAL_ERROR,
+                            MHD_REQUEST_TERMINATED_WITH_ERROR);
+              return MHD_NO;
+            }
+          else if (((ssize_t) MHD_CONTENT_READER_PENDING) == ret)
+            {
+              if (0 != (request->daemon->options & MHD_USE_SUSPEND_RESUME))
+                {
+                  /* MHD_response_data_ready() resumes the stream */
+                  MHD_connection_wait_for_data_ (request);
+                  if (MHD_YES == request->suspended)
+                    return MHD_NO;
+                  continue;
+                }
+              stream->body_unready = MHD_YES;
+              return MHD_NO;
+            }
+          else if (0 == ret)
+            {
+              stream->body_unready = MHD_YES;
+              return MHD_NO;
+            }
+        }
+      request->response_write_position += ret;
+      end = (request->response_write_position == response->total_size)
+        ? MHD_YES
+        : MHD_NO;
+      put_frame_header (p,
+                        (size_t) ret,
+                        H2_DATA,
+                        (MHD_YES == end) ? H2_FLAG_END_STREAM : 0,
+                        stream->id);
+      connection->write_buffer_append_offset
+        += H2_FRAME_HEADER_SIZE + (size_t) ret;
+      stream->send_window -= ret;
+      session->send_window -= ret;
+      if (MHD_YES == end)
+        {
+          complete_stream (stream);
+          return MHD_YES;
+        }
+    }
+}
+
+
+/**
+ * Run the access handler and send the responses of the streams that
+ * are not suspended; free the streams that were reset.
+ *
+ * @param session the session
+ */
+static void
+run_streams (struct MHD_Http2Session *session)
+{
+  struct MHD_Http2Stream *stream;
+  struct MHD_Http2Stream *next;
+
+  session->body_blocked = MHD_NO;
+  next = session->streams_head;
+  while (NULL != (stream = next))
+    {
+      next = stream->next;
+      if (MHD_YES == stream->request->suspended)
+        continue;
+      if (MHD_NO == stream->reset)
+        run_handler (stream,
+                     NULL,
+                     0);
+      if (MHD_YES == stream->request->suspended)
+        continue;
+      if ( (MHD_NO == stream->reset) &&
+           (NULL != stream->request->response) &&
+           (MHD_YES == send_response (stream)) )
+        continue;
+      if (MHD_YES == stream->reset)
+        {
+          free_stream (stream,
+                       stream->termination);
+          continue;
+        }
+      if (MHD_YES == stream->body_unready)
+        session->body_blocked = MHD_YES;
+    }
+}
+
+
+/**
+ * Switch @a connection to HTTP/2: set up the session, take over the
+ * data received so far and queue our SETTINGS.  The connection then
+ * is in #MHD_CONNECTION_HTTP2 state.
+ *
+ * @param connection connection that negotiated HTTP/2
+ * @return #MHD_YES on success, #MHD_NO if out of memory (the
+ *         connection must be closed)
+ */
+int
+MHD_http2_start_ (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+  struct MHD_Http2Session *session;
+  uint8_t settings[6];
+
+  if (connection->read_buffer_offset > H2_BUFFER_SIZE)
+    return MHD_NO;
+  session = malloc (sizeof (struct MHD_Http2Session));
+  if (NULL == session)
+    return MHD_NO;
+  memset (session,
+          0,
+          offsetof (struct MHD_Http2Session, in));
+  session->connection = connection;
+  MHD_hpack_decoder_init_ (&session->hpack);
+  session->send_window = H2_DEFAULT_WINDOW;
+  session->recv_window = H2_DEFAULT_WINDOW;
+  session->peer_initial_window = H2_DEFAULT_WINDOW;
+  session->peer_max_frame = H2_MAX_FRAME_SIZE;
+  if (0 != connection->read_buffer_offset)
+    memcpy (session->in,
+            connection->read_buffer,
+            connection->read_buffer_offset);
+  /* the requests have pools of their own */
+  if (NULL != connection->pool)
+    {
+      MHD_connection_record_pool_peak_ (connection);
+      request_pool_destroy (daemon,
+                            connection->pool);
+      connection->pool = NULL;
+    }
+  connection->read_buffer = session->in;
+  connection->read_buffer_size = H2_BUFFER_SIZE;
+  connection->write_buffer = session->out;
+  connection->write_buffer_size = H2_BUFFER_SIZE;
+  connection->write_buffer_send_offset = 0;
+  connection->write_buffer_append_offset = 0;
+  connection->h2 = session;
+  connection->version = MHD_HTTP_VERSION_2;
+  connection->state = MHD_CONNECTION_HTTP2;
+  MHD_STATS_ADD_ (daemon, http2_sessions, 1);
+  settings[0] = 0;
+  settings[1] = H2_SETTINGS_MAX_CONCURRENT_STREAMS;
+  put_u32 (&settings[2],
+           daemon->http2_max_streams);
+  queue_frame (session,
+               H2_SETTINGS,
+               0,
+               0,
+               settings,
+               sizeof (settings));
+  queue_u32_frame (session,
+                   H2_WINDOW_UPDATE,
+                   0,
+                   H2_CONNECTION_WINDOW - H2_DEFAULT_WINDOW);
+  session->recv_window = H2_CONNECTION_WINDOW;
+  return MHD_YES;
+}
+
+
+/**
+ * Read from the socket of an HTTP/2 connection.
+ *
+ * @param connection connection in #MHD_CONNECTION_HTTP2 state
+ */
+void
+MHD_http2_handle_read_ (struct MHD_Connection *connection)
+{
+  struct MHD_Http2Session *session = connection->h2;
+  ssize_t ret;
+  int err;
+
+  if ( (MHD_YES == session->dead) ||
+       (MHD_YES == connection->read_closed) ||
+       (H2_BUFFER_SIZE == connection->read_buffer_offset) )
+    return;
+  ret = connection->recv_cls (connection,
+                              &session->in[connection->read_buffer_offset],
+                              H2_BUFFER_SIZE - connection->read_buffer_offset);
+  if (ret < 0)
+    {
+      err = MHD_socket_errno_;
+      if ( (EINTR == err) ||
+           (EAGAIN == err) ||
+           (EWOULDBLOCK == err) )
+        return;
+      session->dead = MHD_YES;
+      return;
+    }
+  if (0 == ret)
+    {
+      connection->read_closed = MHD_YES;
+      return;
+    }
+  MHD_PROBE2 (read, connection, ret);
+  connection->read_buffer_offset += ret;
+}
+
+
+/**
+ * Write to the socket of an HTTP/2 connection.
+ *
+ * @param connection connection in #MHD_CONNECTION_HTTP2 state
+ */
+void
+MHD_http2_handle_write_ (struct MHD_Connection *connection)
+{
+  struct MHD_Http2Session *session = connection->h2;
+  ssize_t ret;
+  int err;
+
+  if ( (MHD_YES == session->dead) ||
+       (connection->write_buffer_send_offset ==
+        connection->write_buffer_append_offset) )
+    return;
+  ret = connection->send_cls (connection,
+                              &session->out[connection->write_buffer_send_offset],
+                              connection->write_buffer_append_offset
+                              - connection->write_buffer_send_offset);
+  if (ret < 0)
+    {
+      err = MHD_socket_errno_;
+      if ( (EINTR == err) ||
+           (EAGAIN == err) ||
+           (EWOULDBLOCK == err) )
+        return;
+      session->dead = MHD_YES;
+      return;
+    }
+  connection->write_buffer_send_offset += ret;
+  if (connection->write_buffer_send_offset ==
+      connection->write_buffer_append_offset)
+    {
+      connection->write_buffer_send_offset = 0;
+      connection->write_buffer_append_offset = 0;
+    }
+}
+
+
+/**
+ * Process the frames received on an HTTP/2 connection, run the
+ * access handler for its streams and queue the responses.  May close
+ * the connection.
+ *
+ * @param connection connection in #MHD_CONNECTION_HTTP2 state
+ */
+void
+MHD_http2_handle_idle_ (struct MHD_Connection *connection)
+{
+  struct MHD_Http2Session *session = connection->h2;
+  struct MHD_Http2Stream *stream;
+  struct MHD_Http2Stream *next;
+  int closing;
+
+  /* polling a content reader, the event loop does not read */
+  if (MHD_YES == session->body_blocked)
+    MHD_http2_handle_read_ (connection);
+  if ( (MHD_NO == session->dead) &&
+       (MHD_NO == session->goaway_sent) )
+    process_input (session);
+  if (MHD_NO == session->dead)
+    run_streams (session);
+  closing = ( (MHD_YES == session->dead) ||
+              (MHD_YES == session->goaway_sent) ||
+              ( (MHD_YES == connection->read_closed) &&
+                (MHD_NO == session->goaway_received) ) )
+    ? MHD_YES
+    : MHD_NO;
+  if (MHD_YES == closing)
+    {
+      /* abort the requests the application is not working on */
+      next = session->streams_head;
+      while (NULL != (stream = next))
+        {
+          next = stream->next;
+          if (MHD_YES != stream->request->suspended)
+            free_stream (stream,
+                         (MHD_YES == stream->reset)
+                         ? stream->termination
+                         : MHD_REQUEST_TERMINATED_CLIENT_ABORT);
+        }
+    }
+  else if ( (MHD_NO == session->goaway_received) ||
+            (0 != session->num_streams) )
+    {
+      return;
+    }
+  if (0 != session->num_streams)
+    {
+      /* nothing to do until the application resumes a stream */
+      if (MHD_YES == MHD_http2_has_suspended_ (connection,
+                                               MHD_YES))
+        (void) MHD_http2_park_ (connection);
+      return;
+    }
+  if ( (MHD_NO == session->dead) &&
+       (connection->write_buffer_send_offset !=
+        connection->write_buffer_append_offset) )
+    return; /* send the GOAWAY (or the last responses) first */
+  MHD_connection_close_ (connection,
+                         (MHD_YES == session->dead)
+                         ? MHD_REQUEST_TERMINATED_READ_ERROR
+                         : MHD_REQUEST_TERMINATED_COMPLETED_OK);
+}
+
+
+/**
+ * Determine what the event loop should wait for on an HTTP/2
+ * connection.
+ *
+ * @param connection connection in #MHD_CONNECTION_HTTP2 state
+ * @return #MHD_EVENT_LOOP_INFO_WRITE if there is output to send,
+ *         #MHD_EVENT_LOOP_INFO_BLOCK if a response body must be
+ *         polled, #MHD_EVENT_LOOP_INFO_READ otherwise
+ */
+enum MHD_ConnectionEventLoopInfo
+MHD_http2_event_loop_info_ (struct MHD_Connection *connection)
+{
+  struct MHD_Http2Session *session = connection->h2;
+
+  if ( (MHD_NO == session->dead) &&
+       (connection->write_buffer_send_offset !=
+        connection->write_buffer_append_offset) )
+    return MHD_EVENT_LOOP_INFO_WRITE;
+  if (MHD_YES == session->body_blocked)
+    return MHD_EVENT_LOOP_INFO_BLOCK;
+  return MHD_EVENT_LOOP_INFO_READ;
+}
+
+
+/**
+ * Check if a stream of an HTTP/2 connection is suspended, so that
+ * the connection must not time out (like a suspended connection).
+ *
+ * @param connection connection in #MHD_CONNECTION_HTTP2 state
+ * @param only_parked #MHD_YES to ignore streams being resumed
+ * @return #MHD_YES if a stream is suspended
+ */
+int
+MHD_http2_has_suspended_ (struct MHD_Connection *connection,
+                          int only_parked)
+{
+  struct MHD_Http2Stream *stream;
+
+  for (stream = connection->h2->streams_head; NULL != stream; stream = stream->next)
+    {
+      if (MHD_YES != stream->request->suspended)
+        continue;
+      if ( (MHD_NO == only_parked) ||
+           (MHD_YES != stream->request->resuming) )
+        return MHD_YES;
+    }
+  return MHD_NO;
+}
+
+
+/**
+ * Make the streams of an HTTP/2 connection that were resumed (see
+ * #MHD_resume_connection()) active again.  Called by the event loop
+ * with the cleanup mutex of the daemon held.
+ *
+ * @param connection connection in #MHD_CONNECTION_HTTP2 state
+ */
+void
+MHD_http2_resume_streams_ (struct MHD_Connection *connection)
+{
+  struct MHD_Http2Stream *stream;
+  struct MHD_Connection *request;
+
+  for (stream = connection->h2->streams_head; NULL != stream; stream = stream->next)
+    {
+      request = stream->request;
+      if ( (MHD_YES != request->suspended) ||
+           (MHD_YES != request->resuming) )
+        continue;
+      request->suspended = MHD_NO;
+      request->resuming = MHD_NO;
+      MHD_STATS_SUB_ (connection->daemon, suspended, 1);
+      MHD_PROBE1 (resume, request);
+    }
+}
+
+
+/**
+ * Get the connection an HTTP/2 request was received on.
+ *
+ * @param request the request of a stream
+ * @return connection of the session of the stream
+ */
+struct MHD_Connection *
+MHD_http2_parent_ (struct MHD_Connection *request)
+{
+  return request->h2_stream->session->connection;
+}
+
+
+/**
+ * Release the HTTP/2 session of a connection that is being cleaned
+ * up, ending the requests of all its streams.
+ *
+ * @param connection connection to release the session of
+ */
+void
+MHD_http2_destroy_ (struct MHD_Connection *connection)
+{
+  struct MHD_Http2Session *session = connection->h2;
+
+  while (NULL != session->streams_head)
+    {
+      if (MHD_YES == session->streams_head->request->suspended)
+        MHD_STATS_SUB_ (connection->daemon, suspended, 1);
+      free_stream (session->streams_head,
+                   MHD_REQUEST_TERMINATED_DAEMON_SHUTDOWN);
+    }
+  MHD_hpack_decoder_destroy_ (&session->hpack);
+  free (session->hblock);
+  free (session);
+  connection->h2 = NULL;
+  connection->read_buffer = NULL;
+  connection->read_buffer_size = 0;
+  connection->read_buffer_offset = 0;
+  connection->write_buffer = NULL;
+  connection->write_buffer_size = 0;
+  connection->write_buffer_send_offset = 0;
+  connection->write_buffer_append_offset = 0;
+}
+
+/* end of mhd_http2.c */
@@ -0,0 +1,276 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_http2.h
+ * @brief  HTTP/2 sessions (RFC 7540), see #MHD_USE_HTTP2
+ * @author Christian Grothoff
+ */
+
+#ifndef MHD_HTTP2_H
+#define MHD_HTTP2_H 1
+#include "internal.h"
+
+/**
+ * Default for #MHD_OPTION_HTTP2_MAX_CONCURRENT_STREAMS.
+ */
+#define MHD_HTTP2_MAX_STREAMS_DEFAULT 100
+
+
+/**
+ * What the beginning of the data of a connection says about the
+ * HTTP/2 connection preface.
+ */
+enum MHD_Http2Preface
+{
+  /**
+   * The data does not start with the preface, the client speaks
+   * HTTP/1.x.
+   */
+  MHD_HTTP2_PREFACE_NONE = 0,
+
+  /**
+   * The data is a (possibly empty) prefix of the preface; more data
+   * is needed to tell.
+   */
+  MHD_HTTP2_PREFACE_PARTIAL = 1,
+
+  /**
+   * The data starts with the complete preface.
+   */
+  MHD_HTTP2_PREFACE_FOUND = 2
+};
+
+
+struct MHD_Http2Session;
+
+
+/**
+ * A stream of an HTTP/2 session: one request and its response.  The
+ * request is represented to the application by a `struct
+ * MHD_Connection` of its own (the @e request), so that the
+ * #MHD_AccessHandlerCallback and the response API work unchanged.
+ */
+struct MHD_Http2Stream
+{
+  /**
+   * Next stream of the session.
+   */
+  struct MHD_Http2Stream *next;
+
+  /**
+   * Previous stream of the session.
+   */
+  struct MHD_Http2Stream *prev;
+
+  /**
+   * Session the stream belongs to.
+   */
+  struct MHD_Http2Session *session;
+
+  /**
+   * The request, given to the application as the connection.
+   */
+  struct MHD_Connection *request;
+
+  /**
+   * Identifier of the stream.
+   */
+  uint32_t id;
+
+  /**
+   * How many bytes of DATA we may send on the stream (may become
+   * negative if the peer lowers SETTINGS_INITIAL_WINDOW_SIZE).
+   */
+  int64_t send_window;
+
+  /**
+   * How many bytes of DATA the peer may still send on the stream.
+   */
+  uint32_t recv_window;
+
+  /**
+   * Bytes of DATA the application processed (or we discarded) that
+   * were not yet returned to the peer with a WINDOW_UPDATE.
+   */
+  uint32_t recv_credit;
+
+  /**
+   * Upload data the application did not process yet, allocated
+   * with malloc() when needed; NULL if none.
+   */
+  char *upload;
+
+  /**
+   * Number of bytes in @e upload.
+   */
+  size_t upload_len;
+
+  /**
+   * Allocated size of @e upload.
+   */
+  size_t upload_size;
+
+  /**
+   * #MHD_YES once the access handler was called for the headers.
+   */
+  int handler_called;
+
+  /**
+   * #MHD_YES once the peer sent END_STREAM.
+   */
+  int remote_closed;
+
+  /**
+   * #MHD_YES once we sent the HEADERS of the response.
+   */
+  int headers_sent;
+
+  /**
+   * #MHD_YES if the stream was reset (by either side); it is freed
+   * as soon as the application is done with it.
+   */
+  int reset;
+
+  /**
+   * #MHD_YES if the content reader of the response returned no data
+   * without #MHD_USE_SUSPEND_RESUME, so that we must poll it.
+   */
+  int body_unready;
+
+  /**
+   * Code given to the #MHD_RequestCompletedCallback once a @e reset
+   * stream is freed.
+   */
+  enum MHD_RequestTerminationCode termination;
+};
+
+
+/**
+ * Check if @a buf starts with the HTTP/2 connection preface of a
+ * client ("prior knowledge", RFC 7540, section 3.5).
+ *
+ * @param buf data received on the connection
+ * @param len number of bytes in @a buf
+ * @return what the data says about the preface
+ */
+enum MHD_Http2Preface
+MHD_http2_check_preface_ (const char *buf,
+                          size_t len);
+
+
+/**
+ * Switch @a connection to HTTP/2: set up the session, take over the
+ * data received so far and queue our SETTINGS.  The connection then
+ * is in #MHD_CONNECTION_HTTP2 state.
+ *
+ * @param connection connection that negotiated HTTP/2
+ * @return #MHD_YES on success, #MHD_NO if out of memory (the
+ *         connection must be closed)
+ */
+int
+MHD_http2_start_ (struct MHD_Connection *connection);
+
+
+/**
+ * Read from the socket of an HTTP/2 connection.
+ *
+ * @param connection connection in #MHD_CONNECTION_HTTP2 state
+ */
+void
+MHD_http2_handle_read_ (struct MHD_Connection *connection);
+
+
+/**
+ * Write to the socket of an HTTP/2 connection.
+ *
+ * @param connection connection in #MHD_CONNECTION_HTTP2 state
+ */
+void
+MHD_http2_handle_write_ (struct MHD_Connection *connection);
+
+
+/**
+ * Process the frames received on an HTTP/2 connection, run the
+ * access handler for its streams and queue the responses.  May close
+ * the connection.
+ *
+ * @param connection connection in #MHD_CONNECTION_HTTP2 state
+ */
+void
+MHD_http2_handle_idle_ (struct MHD_Connection *connection);
+
+
+/**
+ * Determine what the event loop should wait for on an HTTP/2
+ * connection.
+ *
+ * @param connection connection in #MHD_CONNECTION_HTTP2 state
+ * @return #MHD_EVENT_LOOP_INFO_WRITE if there is output to send,
+ *         #MHD_EVENT_LOOP_INFO_BLOCK if a response body must be
+ *         polled, #MHD_EVENT_LOOP_INFO_READ otherwise
+ */
+enum MHD_ConnectionEventLoopInfo
+MHD_http2_event_loop_info_ (struct MHD_Connection *connection);
+
+
+/**
+ * Check if a stream of an HTTP/2 connection is suspended, so that
+ * the connection must not time out (like a suspended connection).
+ *
+ * @param connection connection in #MHD_CONNECTION_HTTP2 state
+ * @param only_parked #MHD_YES to ignore streams being resumed
+ * @return #MHD_YES if a stream is suspended
+ */
+int
+MHD_http2_has_suspended_ (struct MHD_Connection *connection,
+                          int only_parked);
+
+
+/**
+ * Make the streams of an HTTP/2 connection that were resumed (see
+ * #MHD_resume_connection()) active again.  Called by the event loop
+ * with the cleanup mutex of the daemon held.
+ *
+ * @param connection connection in #MHD_CONNECTION_HTTP2 state
+ */
+void
+MHD_http2_resume_streams_ (struct MHD_Connection *connection);
+
+
+/**
+ * Get the connection an HTTP/2 request was received on.
+ *
+ * @param request the request of a stream
+ * @return connection of the session of the stream
+ */
+struct MHD_Connection *
+MHD_http2_parent_ (struct MHD_Connection *request);
+
+
+/**
+ * Release the HTTP/2 session of a connection that is being cleaned
+ * up, ending the requests of all its streams.
+ *
+ * @param connection connection to release the session of
+ */
+void
+MHD_http2_destroy_ (struct MHD_Connection *connection);
+
+#endif
@@ -0,0 +1,353 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_io_uring.c
+ * @brief  minimal io_uring wrapper (without liburing) used by the
+ *         io_uring event loop
+ * @author Christian Grothoff
+ */
+
+#include "mhd_io_uring.h"
+#include "microhttpd.h"
+#include <sys/syscall.h>
+#include <sys/mman.h>
+
+/**
+ * Load a value written by the kernel.
+ */
+#define RING_LOAD_ACQUIRE(p) __atomic_load_n ((p), __ATOMIC_ACQUIRE)
+
+/**
+ * Publish a value to the kernel.
+ */
+#define RING_STORE_RELEASE(p,v) __atomic_store_n ((p), (v), __ATOMIC_RELEASE)
+
+
+static int
+sys_io_uring_setup (unsigned int entries,
+                    struct io_uring_params *p)
+{
+  return (int) syscall (__NR_io_uring_setup, entries, p);
+}
+
+
+static int
+sys_io_uring_enter (int fd,
+                    unsigned int to_submit,
+                    unsigned int min_complete,
+                    unsigned int flags,
+                    void *arg,
+                    size_t argsz)
+{
+  return (int) syscall (__NR_io_uring_enter,
+                        fd,
+                        to_submit,
+                        min_complete,
+                        flags,
+                        arg,
+                        argsz);
+}
+
+
+/**
+ * Create an io_uring instance.  Fails if the kernel lacks the
+ * features we rely on (waiting with a timeout, no dropped
+ * completions).
+ *
+ * @param ring ring to initialize
+ * @param entries requested size of the submission queue
+ * @return #MHD_YES on success, #MHD_NO on failure (errno is set)
+ */
+int
+MHD_io_uring_init_ (struct MHD_IoUring *ring,
+                    unsigned int entries)
+{
+  struct io_uring_params p;
+  unsigned char *sq;
+  unsigned char *cq;
+
+  memset (ring, 0, sizeof (struct MHD_IoUring));
+  ring->fd = -1;
+  memset (&p, 0, sizeof (p));
+  ring->fd = sys_io_uring_setup (entries, &p);
+  if (-1 == ring->fd)
+    return MHD_NO;
+  if ( (0 == (p.features & IORING_FEAT_EXT_ARG)) ||
+       (0 == (p.features & IORING_FEAT_NODROP)) )
+    {
+      (void) close (ring->fd);
+      ring->fd = -1;
+      errno = ENOSYS;
+      return MHD_NO;
+    }
+  ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof (unsigned int);
+  ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+  if (0 != (p.features & IORING_FEAT_SINGLE_MMAP))
+    {
+      if (ring->cq_ring_size > ring->sq_ring_size)
+        ring->sq_ring_size = ring->cq_ring_size;
+      ring->cq_ring_size = ring->sq_ring_size;
+    }
+  ring->sq_ring = mmap (NULL,
+                        ring->sq_ring_size,
+                        PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE,
+                        ring->fd,
+                        IORING_OFF_SQ_RING);
+  if (MAP_FAILED == ring->sq_ring)
+    {
+      ring->sq_ring = NULL;
+      MHD_io_uring_deinit_ (ring);
+      return MHD_NO;
+    }
+  if (0 != (p.features & IORING_FEAT_SINGLE_MMAP))
+    {
+      ring->cq_ring = ring->sq_ring;
+    }
+  else
+    {
+      ring->cq_ring = mmap (NULL,
+                            ring->cq_ring_size,
+                            PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE,
+                            ring->fd,
+                            IORING_OFF_CQ_RING);
+      if (MAP_FAILED == ring->cq_ring)
+        {
+          ring->cq_ring = NULL;
+          MHD_io_uring_deinit_ (ring);
+          return MHD_NO;
+        }
+    }
+  ring->sqes_size = p.sq_entries * sizeof (struct io_uring_sqe);
+  ring->sqes = mmap (NULL,
+                     ring->sqes_size,
+                     PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE,
+                     ring->fd,
+                     IORING_OFF_SQES);
+  if (MAP_FAILED == ring->sqes)
+    {
+      ring->sqes = NULL;
+      MHD_io_uring_deinit_ (ring);
+      return MHD_NO;
+    }
+  sq = ring->sq_ring;
+  cq = ring->cq_ring;
+  ring->sq_entries = p.sq_entries;
+  ring->sq_khead = (unsigned int *) (sq + p.sq_off.head);
+  ring->sq_ktail = (unsigned int *) (sq + p.sq_off.tail);
+  ring->sq_mask = *(unsigned int *) (sq + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned int *) (sq + p.sq_off.array);
+  ring->sq_tail = *ring->sq_ktail;
+  ring->cq_khead = (unsigned int *) (cq + p.cq_off.head);
+  ring->cq_ktail = (unsigned int *) (cq + p.cq_off.tail);
+  ring->cq_mask = *(unsigned int *) (cq + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+  return MHD_YES;
+}
+
+
+/**
+ * Destroy an io_uring instance, cancelling all pending requests.
+ * Does nothing if @a ring was not initialized.
+ *
+ * @param ring ring to destroy
+ */
+void
+MHD_io_uring_deinit_ (struct MHD_IoUring *ring)
+{
+  if (NULL != ring->sqes)
+    (void) munmap (ring->sqes, ring->sqes_size);
+  if ( (NULL != ring->cq_ring) &&
+       (ring->cq_ring != ring->sq_ring) )
+    (void) munmap (ring->cq_ring, ring->cq_ring_size);
+  if (NULL != ring->sq_ring)
+    (void) munmap (ring->sq_ring, ring->sq_ring_size);
+  if (-1 != ring->fd)
+    (void) close (ring->fd);
+  memset (ring, 0, sizeof (struct MHD_IoUring));
+  ring->fd = -1;
+}
+
+
+/**
+ * Obtain a free submission queue entry, submitting the queued
+ * entries first if the queue is full.
+ *
+ * @param ring ring to use
+ * @return NULL if the queue is still full
+ */
+static struct io_uring_sqe *
+get_sqe (struct MHD_IoUring *ring)
+{
+  struct io_uring_sqe *sqe;
+
+  if (ring->sq_tail - RING_LOAD_ACQUIRE (ring->sq_khead) >= ring->sq_entries)
+    {
+      (void) MHD_io_uring_enter_ (ring, 0);
+      if (ring->sq_tail - RING_LOAD_ACQUIRE (ring->sq_khead) >= ring->sq_entries)
+        return NULL;
+    }
+  sqe = &ring->sqes[ring->sq_tail & ring->sq_mask];
+  memset (sqe, 0, sizeof (struct io_uring_sqe));
+  ring->sq_array[ring->sq_tail & ring->sq_mask] = ring->sq_tail & ring->sq_mask;
+  ring->sq_tail++;
+  return sqe;
+}
+
+
+/**
+ * Queue a multishot poll request on @a fd.  The request is only
+ * submitted to the kernel on the next #MHD_io_uring_enter_().
+ *
+ * @param ring ring to queue the request on
+ * @param fd file descriptor to poll
+ * @param events poll events to wait for, edge-triggered
+ * @param user_data value to report with each completion
+ * @return #MHD_YES on success, #MHD_NO if the submission queue is full
+ */
+int
+MHD_io_uring_poll_add_ (struct MHD_IoUring *ring,
+                        int fd,
+                        unsigned int events,
+                        uint64_t user_data)
+{
+  struct io_uring_sqe *sqe;
+
+  if (NULL == (sqe = get_sqe (ring)))
+    return MHD_NO;
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = events;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->user_data = user_data;
+  return MHD_YES;
+}
+
+
+/**
+ * Queue cancellation of the poll request with the given @a user_data.
+ * The cancelled request will complete with `-ECANCELED`.
+ *
+ * @param ring ring to queue the request on
+ * @param user_data user data of the poll request to cancel
+ * @return #MHD_YES on success, #MHD_NO if the submission queue is full
+ */
+int
+MHD_io_uring_poll_remove_ (struct MHD_IoUring *ring,
+                           uint64_t user_data)
+{
+  struct io_uring_sqe *sqe;
+
+  if (NULL == (sqe = get_sqe (ring)))
+    return MHD_NO;
+  sqe->opcode = IORING_OP_POLL_REMOVE;
+  sqe->fd = -1;
+  sqe->addr = user_data;
+  sqe->user_data = MHD_IO_URING_DATA_IGNORE;
+  return MHD_YES;
+}
+
+
+/**
+ * Submit all queued requests and optionally wait for completions.
+ *
+ * @param ring ring to use
+ * @param timeout_ms 0 to not wait, -1 to wait without timeout,
+ *        otherwise maximum time to wait for a completion
+ * @return #MHD_YES on success (including timeout and interruption
+ *         by a signal), #MHD_NO on hard errors (errno is set)
+ */
+int
+MHD_io_uring_enter_ (struct MHD_IoUring *ring,
+                     int timeout_ms)
+{
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+  unsigned int to_submit;
+  unsigned int flags;
+  int ret;
+
+  RING_STORE_RELEASE (ring->sq_ktail, ring->sq_tail);
+  to_submit = ring->sq_tail - RING_LOAD_ACQUIRE (ring->sq_khead);
+  if ( (0 == to_submit) &&
+       (0 == timeout_ms) )
+    return MHD_YES;
+  flags = 0;
+  memset (&arg, 0, sizeof (arg));
+  if (0 != timeout_ms)
+    {
+      flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+      if (timeout_ms > 0)
+        {
+          ts.tv_sec = timeout_ms / 1000;
+          ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+          arg.ts = (uint64_t) (uintptr_t) &ts;
+        }
+    }
+  ret = sys_io_uring_enter (ring->fd,
+                            to_submit,
+                            (0 != timeout_ms) ? 1 : 0,
+                            flags,
+                            (0 != timeout_ms) ? &arg : NULL,
+                            (0 != timeout_ms) ? sizeof (arg) : 0);
+  if (ret >= 0)
+    return MHD_YES;
+  if ( (EINTR == errno) ||
+       (ETIME == errno) ||
+       (EBUSY == errno) ||
+       (EAGAIN == errno) )
+    return MHD_YES; /* caller will look at the completion queue */
+  return MHD_NO;
+}
+
+
+/**
+ * Obtain the next completion, if any.  The returned entry must be
+ * released with #MHD_io_uring_cqe_seen_() before calling this again.
+ *
+ * @param ring ring to use
+ * @return NULL if the completion queue is empty
+ */
+struct io_uring_cqe *
+MHD_io_uring_peek_cqe_ (struct MHD_IoUring *ring)
+{
+  unsigned int head;
+
+  head = *ring->cq_khead;
+  if (head == RING_LOAD_ACQUIRE (ring->cq_ktail))
+    return NULL;
+  return &ring->cqes[head & ring->cq_mask];
+}
+
+
+/**
+ * Release the completion returned by #MHD_io_uring_peek_cqe_().
+ *
+ * @param ring ring to use
+ */
+void
+MHD_io_uring_cqe_seen_ (struct MHD_IoUring *ring)
+{
+  RING_STORE_RELEASE (ring->cq_khead, *ring->cq_khead + 1);
+}
+
+/* end of mhd_io_uring.c */
@@ -0,0 +1,221 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_io_uring.h
+ * @brief  minimal io_uring wrapper (without liburing) used by the
+ *         io_uring event loop
+ * @author Christian Grothoff
+ */
+
+#ifndef MHD_IO_URING_H
+#define MHD_IO_URING_H 1
+#include "platform.h"
+#include <linux/io_uring.h>
+
+/**
+ * User data of requests whose completion is of no interest.
+ */
+#define MHD_IO_URING_DATA_IGNORE ((uint64_t) 0)
+
+
+/**
+ * Submission and completion rings of an io_uring instance,
+ * mapped into our address space.  Only ever used by a single
+ * thread, so no locking is required.
+ */
+struct MHD_IoUring
+{
+  /**
+   * File descriptor of the ring, -1 if not initialized.
+   */
+  int fd;
+
+  /**
+   * Number of entries in the submission queue.
+   */
+  unsigned int sq_entries;
+
+  /**
+   * Our tail pointer of the submission queue, published to the
+   * kernel on #MHD_io_uring_enter_().
+   */
+  unsigned int sq_tail;
+
+  /**
+   * Kernel's submission queue head.
+   */
+  unsigned int *sq_khead;
+
+  /**
+   * Kernel's view of the submission queue tail.
+   */
+  unsigned int *sq_ktail;
+
+  /**
+   * Mask for submission queue indices.
+   */
+  unsigned int sq_mask;
+
+  /**
+   * Indirection array of the submission queue.
+   */
+  unsigned int *sq_array;
+
+  /**
+   * Submission queue entries.
+   */
+  struct io_uring_sqe *sqes;
+
+  /**
+   * Completion queue head (we advance it).
+   */
+  unsigned int *cq_khead;
+
+  /**
+   * Completion queue tail (the kernel advances it).
+   */
+  unsigned int *cq_ktail;
+
+  /**
+   * Mask for completion queue indices.
+   */
+  unsigned int cq_mask;
+
+  /**
+   * Completion queue entries.
+   */
+  struct io_uring_cqe *cqes;
+
+  /**
+   * Mapping of the submission ring.
+   */
+  void *sq_ring;
+
+  /**
+   * Size of @e sq_ring.
+   */
+  size_t sq_ring_size;
+
+  /**
+   * Mapping of the completion ring, equal to @e sq_ring
+   * if the kernel supports a single mapping for both.
+   */
+  void *cq_ring;
+
+  /**
+   * Size of @e cq_ring.
+   */
+  size_t cq_ring_size;
+
+  /**
+   * Size of the mapping of @e sqes.
+   */
+  size_t sqes_size;
+};
+
+
+/**
+ * Create an io_uring instance.  Fails if the kernel lacks the
+ * features we rely on (waiting with a timeout, no dropped
+ * completions).
+ *
+ * @param ring ring to initialize
+ * @param entries requested size of the submission queue
+ * @return #MHD_YES on success, #MHD_NO on failure (errno is set)
+ */
+int
+MHD_io_uring_init_ (struct MHD_IoUring *ring,
+                    unsigned int entries);
+
+
+/**
+ * Destroy an io_uring instance, cancelling all pending requests.
+ * Does nothing if @a ring was not initialized.
+ *
+ * @param ring ring to destroy
+ */
+void
+MHD_io_uring_deinit_ (struct MHD_IoUring *ring);
+
+
+/**
+ * Queue a multishot poll request on @a fd.  The request is only
+ * submitted to the kernel on the next #MHD_io_uring_enter_().
+ *
+ * @param ring ring to queue the request on
+ * @param fd file descriptor to poll
+ * @param events poll events to wait for, edge-triggered
+ * @param user_data value to report with each completion
+ * @return #MHD_YES on success, #MHD_NO if the submission queue is full
+ */
+int
+MHD_io_uring_poll_add_ (struct MHD_IoUring *ring,
+                        int fd,
+                        unsigned int events,
+                        uint64_t user_data);
+
+
+/**
+ * Queue cancellation of the poll request with the given @a user_data.
+ * The cancelled request will complete with `-ECANCELED`.
+ *
+ * @param ring ring to queue the request on
+ * @param user_data user data of the poll request to cancel
+ * @return #MHD_YES on success, #MHD_NO if the submission queue is full
+ */
+int
+MHD_io_uring_poll_remove_ (struct MHD_IoUring *ring,
+                           uint64_t user_data);
+
+
+/**
+ * Submit all queued requests and optionally wait for completions.
+ *
+ * @param ring ring to use
+ * @param timeout_ms 0 to not wait, -1 to wait without timeout,
+ *        otherwise maximum time to wait for a completion
+ * @return #MHD_YES on success (including timeout and interruption
+ *         by a signal), #MHD_NO on hard errors (errno is set)
+ */
+int
+MHD_io_uring_enter_ (struct MHD_IoUring *ring,
+                     int timeout_ms);
+
+
+/**
+ * Obtain the next completion, if any.  The returned entry must be
+ * released with #MHD_io_uring_cqe_seen_() before calling this again.
+ *
+ * @param ring ring to use
+ * @return NULL if the completion queue is empty
+ */
+struct io_uring_cqe *
+MHD_io_uring_peek_cqe_ (struct MHD_IoUring *ring);
+
+
+/**
+ * Release the completion returned by #MHD_io_uring_peek_cqe_().
+ *
+ * @param ring ring to use
+ */
+void
+MHD_io_uring_cqe_seen_ (struct MHD_IoUring *ring);
+
+#endif /* MHD_IO_URING_H */
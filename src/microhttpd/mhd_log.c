@@ -0,0 +1,476 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_log.c
+ * @brief  queue passing log messages to a background thread, and
+ *         rate limits for repeated messages
+ * @author Christian Grothoff
+ *
+ * The ring is a bounded multi-producer queue: a thread logging a
+ * message claims a slot by advancing @e head with a compare-and-swap,
+ * formats the message into the slot and then publishes it by setting
+ * the sequence number of the slot.  Only the log thread consumes, so
+ * it needs no atomic operation on @e tail.  If the ring is full, the
+ * message is dropped and counted instead of waiting for the log
+ * thread.
+ */
+
+#include "mhd_log.h"
+#include "mhd_mono_clock.h"
+
+#ifdef HAVE_MESSAGES
+
+/**
+ * Maximum length of a queued message, including the 0-terminator.
+ * Longer messages are truncated.
+ */
+#define MHD_LOG_ENTRY_SIZE 256
+
+/**
+ * Number of format strings the rate limit tracks at the same time.
+ * Must be a power of two.
+ */
+#define MHD_LOG_RATE_SLOTS 64
+
+/**
+ * Microseconds the log thread sleeps when the ring is empty.
+ */
+#define MHD_LOG_DRAIN_INTERVAL (10 * 1000)
+
+
+/**
+ * Slot of the ring of a log queue.
+ */
+struct MHD_LogEntry
+{
+  /**
+   * Position in the ring plus one once the message is published,
+   * position in the ring if the slot is free.
+   */
+  uint64_t seq;
+
+  /**
+   * The formatted message.
+   */
+  char msg[MHD_LOG_ENTRY_SIZE];
+};
+
+
+/**
+ * Number of messages logged with one format string in the current
+ * second, see #MHD_OPTION_LOG_RATE_LIMIT.  Threads update the slots
+ * without locking, so the limit is approximate.
+ */
+struct MHD_LogRate
+{
+  /**
+   * Format string counted by this slot.
+   */
+  const char *format;
+
+  /**
+   * Second (see #MHD_monotonic_sec_counter()) counted in @e count.
+   */
+  time_t second;
+
+  /**
+   * Messages logged with @e format in @e second.
+   */
+  unsigned int count;
+};
+
+
+/**
+ * Log queue of a daemon, shared by the threads of its thread pool.
+ */
+struct MHD_LogQueue
+{
+  /**
+   * Ring of messages, NULL to log synchronously.
+   */
+  struct MHD_LogEntry *ring;
+
+  /**
+   * Number of slots of @e ring, a power of two.
+   */
+  uint64_t size;
+
+  /**
+   * Position of the next slot to claim by a producer.
+   */
+  uint64_t head;
+
+  /**
+   * Position of the next slot to write by the log thread.
+   */
+  uint64_t tail;
+
+  /**
+   * Function to write the messages with.
+   */
+  MHD_LogCallback log;
+
+  /**
+   * Closure for @e log.
+   */
+  void *log_cls;
+
+  /**
+   * Maximum number of messages per format string and second, 0 for
+   * no limit.
+   */
+  unsigned int rate_limit;
+
+  /**
+   * Messages dropped because the ring was full.
+   */
+  uint64_t dropped;
+
+  /**
+   * Messages suppressed by the rate limit.
+   */
+  uint64_t suppressed;
+
+  /**
+   * Set to #MHD_YES to make the log thread return.
+   */
+  int shutdown;
+
+  /**
+   * Rate limits by format string.
+   */
+  struct MHD_LogRate rates[MHD_LOG_RATE_SLOTS];
+};
+
+
+#ifdef HAVE_ATOMIC_BUILTINS
+
+/**
+ * Create the log queue of a daemon.
+ *
+ * @param size number of messages the queue holds, 0 to log
+ *        synchronously and only apply @a rate_limit
+ * @param rate_limit maximum number of messages per second with the
+ *        same format string, 0 for no limit
+ * @param log function to write the messages with
+ * @param log_cls closure for @a log
+ * @return NULL on error (or if not supported on this platform)
+ */
+struct MHD_LogQueue *
+MHD_log_queue_create_ (unsigned int size,
+                       unsigned int rate_limit,
+                       MHD_LogCallback log,
+                       void *log_cls)
+{
+  struct MHD_LogQueue *queue;
+  uint64_t i;
+
+  queue = calloc (1, sizeof (struct MHD_LogQueue));
+  if (NULL == queue)
+    return NULL;
+  queue->log = log;
+  queue->log_cls = log_cls;
+  queue->rate_limit = rate_limit;
+  queue->shutdown = MHD_NO;
+  if (0 == size)
+    return queue;
+  queue->size = 1;
+  while (queue->size < size)
+    queue->size *= 2;
+  queue->ring = malloc (queue->size * sizeof (struct MHD_LogEntry));
+  if (NULL == queue->ring)
+    {
+      free (queue);
+      return NULL;
+    }
+  for (i = 0; i < queue->size; i++)
+    queue->ring[i].seq = i;
+  return queue;
+}
+
+
+/**
+ * Check if @a queue has a ring of messages for a background thread.
+ *
+ * @param queue queue to check
+ * @return #MHD_YES if #MHD_log_queue_run_() has to be started
+ */
+int
+MHD_log_queue_is_async_ (const struct MHD_LogQueue *queue)
+{
+  return (NULL != queue->ring) ? MHD_YES : MHD_NO;
+}
+
+
+/**
+ * Check the rate limit of @a format and count the message.
+ *
+ * @param queue queue with the rate limits
+ * @param format format string of the message
+ * @return #MHD_YES if the message may be logged
+ */
+static int
+rate_check (struct MHD_LogQueue *queue,
+            const char *format)
+{
+  struct MHD_LogRate *rate;
+  time_t now;
+
+  if (0 == queue->rate_limit)
+    return MHD_YES;
+  rate = &queue->rates[((uintptr_t) format >> 3) & (MHD_LOG_RATE_SLOTS - 1)];
+  now = MHD_monotonic_sec_counter ();
+  if ( (format != __atomic_load_n (&rate->format, __ATOMIC_RELAXED)) ||
+       (now != __atomic_load_n (&rate->second, __ATOMIC_RELAXED)) )
+    {
+      /* a new second, or another message took over the slot */
+      __atomic_store_n (&rate->format, format, __ATOMIC_RELAXED);
+      __atomic_store_n (&rate->second, now, __ATOMIC_RELAXED);
+      __atomic_store_n (&rate->count, 0, __ATOMIC_RELAXED);
+    }
+  if (__atomic_add_fetch (&rate->count, 1, __ATOMIC_RELAXED) <= queue->rate_limit)
+    return MHD_YES;
+  __atomic_add_fetch (&queue->suppressed, 1, __ATOMIC_RELAXED);
+  return MHD_NO;
+}
+
+
+/**
+ * Log a message through @a queue: drop it if its format was logged
+ * too often in the current second, or put it into the ring (dropping
+ * it if the ring is full).  Never blocks.
+ *
+ * @param queue queue to log to
+ * @param format format string of the message
+ * @param va arguments for @a format
+ */
+void
+MHD_log_queue_add_ (struct MHD_LogQueue *queue,
+                    const char *format,
+                    va_list va)
+{
+  struct MHD_LogEntry *entry;
+  uint64_t pos;
+  uint64_t seq;
+  int len;
+
+  if (MHD_YES != rate_check (queue, format))
+    return;
+  if (NULL == queue->ring)
+    {
+      queue->log (queue->log_cls, format, va);
+      return;
+    }
+  pos = __atomic_load_n (&queue->head, __ATOMIC_RELAXED);
+  while (1)
+    {
+      entry = &queue->ring[pos & (queue->size - 1)];
+      seq = __atomic_load_n (&entry->seq, __ATOMIC_ACQUIRE);
+      if (seq == pos)
+        {
+          if (__atomic_compare_exchange_n (&queue->head, &pos, pos + 1,
+                                           0,
+                                           __ATOMIC_RELAXED,
+                                           __ATOMIC_RELAXED))
+            break;
+          /* another thread claimed the slot, @a pos was updated */
+          continue;
+        }
+      if (seq < pos)
+        {
+          /* the log thread did not write this slot yet */
+          __atomic_add_fetch (&queue->dropped, 1, __ATOMIC_RELAXED);
+          return;
+        }
+      pos = __atomic_load_n (&queue->head, __ATOMIC_RELAXED);
+    }
+  len = vsnprintf (entry->msg,
+                   MHD_LOG_ENTRY_SIZE,
+                   format,
+                   va);
+  if (len >= MHD_LOG_ENTRY_SIZE)
+    memcpy (&entry->msg[MHD_LOG_ENTRY_SIZE - 5], "...\n", 5);
+  else if (len < 0)
+    entry->msg[0] = '\0';
+  __atomic_store_n (&entry->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * Write @a msg with the log function of @a queue, which takes a
+ * `va_list`.
+ *
+ * @param queue queue to write for
+ * @param format "%s"
+ */
+static void
+write_message (struct MHD_LogQueue *queue,
+               const char *format,
+               ...)
+{
+  va_list va;
+
+  va_start (va, format);
+  queue->log (queue->log_cls, format, va);
+  va_end (va);
+}
+
+
+/**
+ * Write the published messages of @a queue.
+ *
+ * @param queue queue to drain
+ * @return number of messages written
+ */
+static unsigned int
+drain (struct MHD_LogQueue *queue)
+{
+  struct MHD_LogEntry *entry;
+  unsigned int count;
+
+  count = 0;
+  while (1)
+    {
+      entry = &queue->ring[queue->tail & (queue->size - 1)];
+      if (queue->tail + 1 != __atomic_load_n (&entry->seq, __ATOMIC_ACQUIRE))
+        return count;
+      if ('\0' != entry->msg[0])
+        write_message (queue,
+                       "%s",
+                       entry->msg);
+      /* free the slot for the next round of the ring */
+      __atomic_store_n (&entry->seq, queue->tail + queue->size, __ATOMIC_RELEASE);
+      queue->tail++;
+      count++;
+    }
+}
+
+
+/**
+ * Write the messages of @a queue until #MHD_log_queue_stop_() is
+ * called, then write the messages left.  Main function of the log
+ * thread.
+ *
+ * @param queue queue to drain
+ */
+void
+MHD_log_queue_run_ (struct MHD_LogQueue *queue)
+{
+  while (MHD_YES != __atomic_load_n (&queue->shutdown, __ATOMIC_ACQUIRE))
+    {
+      if (0 == drain (queue))
+        usleep (MHD_LOG_DRAIN_INTERVAL);
+    }
+  (void) drain (queue);
+}
+
+
+/**
+ * Tell #MHD_log_queue_run_() to return once the queue is empty.
+ *
+ * @param queue queue to stop
+ */
+void
+MHD_log_queue_stop_ (struct MHD_LogQueue *queue)
+{
+  __atomic_store_n (&queue->shutdown, MHD_YES, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * Add the number of messages @a queue dropped because the ring was
+ * full and suppressed due to the rate limit to @a stats.
+ *
+ * @param queue queue to read
+ * @param stats statistics to add to
+ */
+void
+MHD_log_queue_stats_ (struct MHD_LogQueue *queue,
+                      struct MHD_DaemonStats *stats)
+{
+  stats->log_dropped += __atomic_load_n (&queue->dropped, __ATOMIC_RELAXED);
+  stats->log_suppressed += __atomic_load_n (&queue->suppressed, __ATOMIC_RELAXED);
+}
+
+#else
+
+struct MHD_LogQueue *
+MHD_log_queue_create_ (unsigned int size,
+                       unsigned int rate_limit,
+                       MHD_LogCallback log,
+                       void *log_cls)
+{
+  /* the ring and the rate limits need atomic operations */
+  return NULL;
+}
+
+
+int
+MHD_log_queue_is_async_ (const struct MHD_LogQueue *queue)
+{
+  return MHD_NO;
+}
+
+
+void
+MHD_log_queue_add_ (struct MHD_LogQueue *queue,
+                    const char *format,
+                    va_list va)
+{
+  queue->log (queue->log_cls, format, va);
+}
+
+
+void
+MHD_log_queue_run_ (struct MHD_LogQueue *queue)
+{
+}
+
+
+void
+MHD_log_queue_stop_ (struct MHD_LogQueue *queue)
+{
+}
+
+
+void
+MHD_log_queue_stats_ (struct MHD_LogQueue *queue,
+                      struct MHD_DaemonStats *stats)
+{
+}
+
+#endif
+
+
+/**
+ * Destroy @a queue, after the log thread was joined.
+ *
+ * @param queue queue to destroy
+ */
+void
+MHD_log_queue_destroy_ (struct MHD_LogQueue *queue)
+{
+  free (queue->ring);
+  free (queue);
+}
+
+#endif
+
+/* end of mhd_log.c */
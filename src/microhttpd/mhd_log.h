@@ -0,0 +1,118 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_log.h
+ * @brief  queue passing log messages to a background thread, and
+ *         rate limits for repeated messages
+ * @author Christian Grothoff
+ */
+
+#ifndef MHD_LOG_H
+#define MHD_LOG_H 1
+#include "internal.h"
+
+#ifdef HAVE_MESSAGES
+
+/**
+ * Create the log queue of a daemon.
+ *
+ * @param size number of messages the queue holds, 0 to log
+ *        synchronously and only apply @a rate_limit
+ * @param rate_limit maximum number of messages per second with the
+ *        same format string, 0 for no limit
+ * @param log function to write the messages with
+ * @param log_cls closure for @a log
+ * @return NULL on error (or if not supported on this platform)
+ */
+struct MHD_LogQueue *
+MHD_log_queue_create_ (unsigned int size,
+                       unsigned int rate_limit,
+                       MHD_LogCallback log,
+                       void *log_cls);
+
+
+/**
+ * Check if @a queue has a ring of messages for a background thread.
+ *
+ * @param queue queue to check
+ * @return #MHD_YES if #MHD_log_queue_run_() has to be started
+ */
+int
+MHD_log_queue_is_async_ (const struct MHD_LogQueue *queue);
+
+
+/**
+ * Log a message through @a queue: drop it if its format was logged
+ * too often in the current second, or put it into the ring (dropping
+ * it if the ring is full).  Never blocks.
+ *
+ * @param queue queue to log to
+ * @param format format string of the message
+ * @param va arguments for @a format
+ */
+void
+MHD_log_queue_add_ (struct MHD_LogQueue *queue,
+                    const char *format,
+                    va_list va);
+
+
+/**
+ * Write the messages of @a queue until #MHD_log_queue_stop_() is
+ * called, then write the messages left.  Main function of the log
+ * thread.
+ *
+ * @param queue queue to drain
+ */
+void
+MHD_log_queue_run_ (struct MHD_LogQueue *queue);
+
+
+/**
+ * Tell #MHD_log_queue_run_() to return once the queue is empty.
+ *
+ * @param queue queue to stop
+ */
+void
+MHD_log_queue_stop_ (struct MHD_LogQueue *queue);
+
+
+/**
+ * Destroy @a queue, after the log thread was joined.
+ *
+ * @param queue queue to destroy
+ */
+void
+MHD_log_queue_destroy_ (struct MHD_LogQueue *queue);
+
+
+/**
+ * Add the number of messages @a queue dropped because the ring was
+ * full and suppressed due to the rate limit to @a stats.
+ *
+ * @param queue queue to read
+ * @param stats statistics to add to
+ */
+void
+MHD_log_queue_stats_ (struct MHD_LogQueue *queue,
+                      struct MHD_DaemonStats *stats);
+
+#endif
+
+#endif
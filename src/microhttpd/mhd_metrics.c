@@ -0,0 +1,689 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_metrics.c
+ * @brief  statistics of a daemon in the OpenMetrics text format
+ * @author Christian Grothoff
+ *
+ * A scrape reads the counters and histograms with relaxed atomic
+ * loads, just like #MHD_DAEMON_INFO_STATS, so the threads serving
+ * requests are never locked.  The text is rendered into a buffer
+ * that goes back to the daemon when the response is destroyed and
+ * is reused by the next scrape, so once it grew to the size of the
+ * document, scrapes allocate nothing but the response itself.
+ */
+
+#include "mhd_metrics.h"
+#include <stddef.h>
+#include <stdarg.h>
+
+/**
+ * Initial size of the text buffer of a metrics response.
+ */
+#define MHD_METRICS_INITIAL_SIZE (16 * 1024)
+
+/**
+ * Block size of a metrics response.
+ */
+#define MHD_METRICS_BLOCK_SIZE (16 * 1024)
+
+/**
+ * Number of finite buckets of the exported histograms: one per
+ * doubling of the value, from 31 to 2^36-1 microseconds (or bytes).
+ */
+#define MHD_METRICS_HISTOGRAM_BUCKETS 32
+
+/**
+ * Content type of the OpenMetrics text format.
+ */
+#define MHD_METRICS_CONTENT_TYPE \
+  "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+#ifdef HAVE_ATOMIC_BUILTINS
+#define METRICS_GET(value) \
+  __atomic_load_n (&(value), __ATOMIC_RELAXED)
+#else
+#define METRICS_GET(value) (value)
+#endif
+
+
+/**
+ * Buffer of a metrics response.
+ */
+struct MHD_MetricsBuffer
+{
+  /**
+   * Daemon to return the buffer to.
+   */
+  struct MHD_Daemon *daemon;
+
+  /**
+   * Statistics of the scrape.
+   */
+  struct MHD_DaemonStats stats;
+
+  /**
+   * Histogram of the scrape being rendered.
+   */
+  struct MHD_LatencyHistogram histogram;
+
+  /**
+   * The rendered text.
+   */
+  char *text;
+
+  /**
+   * Number of bytes allocated for @e text.
+   */
+  size_t size;
+
+  /**
+   * Length of the text; may exceed @e size while rendering, when the
+   * buffer was too small.
+   */
+  size_t len;
+};
+
+
+/**
+ * Counter or gauge taken from `struct MHD_DaemonStats`.
+ */
+struct MetricsField
+{
+  /**
+   * Name of the metric family.
+   */
+  const char *name;
+
+  /**
+   * Labels of the sample, NULL for none.
+   */
+  const char *labels;
+
+  /**
+   * Help text of the family.
+   */
+  const char *help;
+
+  /**
+   * Offset of the value in `struct MHD_DaemonStats`.
+   */
+  size_t offset;
+
+  /**
+   * #MHD_YES for gauges, #MHD_NO for counters.
+   */
+  int gauge;
+
+  /**
+   * #MHD_YES if the value is in microseconds and the metric in
+   * seconds.
+   */
+  int usec;
+};
+
+
+#define STATS_OFF(field) offsetof (struct MHD_DaemonStats, field)
+
+/**
+ * Metrics taken from `struct MHD_DaemonStats`; samples of the same
+ * family must follow each other.
+ */
+static const struct MetricsField fields[] = {
+  { "mhd_accepts", NULL,
+    "Connections accepted from the listen socket",
+    STATS_OFF (accepts), MHD_NO, MHD_NO },
+  { "mhd_accept_errors", NULL,
+    "Calls to accept() that failed",
+    STATS_OFF (accept_errors), MHD_NO, MHD_NO },
+  { "mhd_requests", NULL,
+    "Requests whose headers were received",
+    STATS_OFF (requests), MHD_NO, MHD_NO },
+  { "mhd_received_bytes", NULL,
+    "Bytes received from clients",
+    STATS_OFF (bytes_received), MHD_NO, MHD_NO },
+  { "mhd_sent_bytes", NULL,
+    "Bytes sent to clients",
+    STATS_OFF (bytes_sent), MHD_NO, MHD_NO },
+  { "mhd_keep_alive_reuses", NULL,
+    "Connections kept alive for another request",
+    STATS_OFF (keep_alive_reuses), MHD_NO, MHD_NO },
+  { "mhd_timeouts", NULL,
+    "Connections closed because they were idle for too long",
+    STATS_OFF (timeouts), MHD_NO, MHD_NO },
+  { "mhd_header_timeouts", NULL,
+    "Requests closed because their headers arrived too slowly",
+    STATS_OFF (header_timeouts), MHD_NO, MHD_NO },
+  { "mhd_slow_transfers", NULL,
+    "Connections closed because they transferred a body too slowly",
+    STATS_OFF (slow_transfers), MHD_NO, MHD_NO },
+  { "mhd_tls_handshakes", NULL,
+    "TLS handshakes completed",
+    STATS_OFF (tls_handshakes), MHD_NO, MHD_NO },
+  { "mhd_http2_sessions", NULL,
+    "Connections that switched to HTTP/2",
+    STATS_OFF (http2_sessions), MHD_NO, MHD_NO },
+  { "mhd_http2_streams", NULL,
+    "Streams opened on HTTP/2 connections",
+    STATS_OFF (http2_streams), MHD_NO, MHD_NO },
+  { "mhd_migrations", NULL,
+    "Idle connections handed over to another thread",
+    STATS_OFF (migrations), MHD_NO, MHD_NO },
+  { "mhd_pool_exhaustions", NULL,
+    "Requests rejected because they did not fit into the memory pool",
+    STATS_OFF (pool_exhaustions), MHD_NO, MHD_NO },
+  { "mhd_pool_allocation_failures", "site=\"read_buffer\"",
+    "Failed allocations from the memory pools of connections",
+    STATS_OFF (pool_fail_read_buffer), MHD_NO, MHD_NO },
+  { "mhd_pool_allocation_failures", "site=\"headers\"",
+    NULL,
+    STATS_OFF (pool_fail_headers), MHD_NO, MHD_NO },
+  { "mhd_pool_allocation_failures", "site=\"write_buffer\"",
+    NULL,
+    STATS_OFF (pool_fail_write_buffer), MHD_NO, MHD_NO },
+  { "mhd_pool_allocation_failures", "site=\"other\"",
+    NULL,
+    STATS_OFF (pool_fail_other), MHD_NO, MHD_NO },
+  { "mhd_header_overflows", NULL,
+    "Requests whose headers borrowed memory from the overflow arena",
+    STATS_OFF (header_overflows), MHD_NO, MHD_NO },
+  { "mhd_loop_iterations", NULL,
+    "Iterations of the event loops",
+    STATS_OFF (loop_iterations), MHD_NO, MHD_NO },
+  { "mhd_loop_wakeups", NULL,
+    "Returns from the wait system call of the event loops",
+    STATS_OFF (loop_wakeups), MHD_NO, MHD_NO },
+  { "mhd_loop_events", NULL,
+    "Events returned by the wait system call of the event loops",
+    STATS_OFF (loop_events), MHD_NO, MHD_NO },
+  { "mhd_loop_wait_seconds", NULL,
+    "Time the event loops spent blocked waiting for events",
+    STATS_OFF (loop_wait_usec), MHD_NO, MHD_YES },
+  { "mhd_loop_dispatch_seconds", NULL,
+    "Time the event loops spent processing events",
+    STATS_OFF (loop_dispatch_usec), MHD_NO, MHD_YES },
+  { "mhd_log_messages_dropped", NULL,
+    "Log messages dropped because the log queue was full",
+    STATS_OFF (log_dropped), MHD_NO, MHD_NO },
+  { "mhd_log_messages_suppressed", NULL,
+    "Log messages suppressed by the rate limit",
+    STATS_OFF (log_suppressed), MHD_NO, MHD_NO },
+  { "mhd_suspended_connections", NULL,
+    "Connections currently suspended",
+    STATS_OFF (suspended), MHD_YES, MHD_NO },
+  { "mhd_parked_connections", NULL,
+    "Connections currently parked without a thread",
+    STATS_OFF (parked), MHD_YES, MHD_NO }
+};
+
+
+/**
+ * Append formatted text to @a mb.  If the buffer is too small, only
+ * the length is counted.
+ *
+ * @param mb buffer to append to
+ * @param format format string
+ * @param ... arguments for @a format
+ */
+static void
+emit (struct MHD_MetricsBuffer *mb,
+      const char *format,
+      ...)
+{
+  va_list ap;
+  int ret;
+
+  va_start (ap, format);
+  if (mb->len < mb->size)
+    ret = vsnprintf (&mb->text[mb->len],
+                     mb->size - mb->len,
+                     format,
+                     ap);
+  else
+    ret = vsnprintf (NULL,
+                     0,
+                     format,
+                     ap);
+  va_end (ap);
+  if (ret > 0)
+    mb->len += ret;
+}
+
+
+/**
+ * Append the header lines of a metric family to @a mb.
+ *
+ * @param mb buffer to append to
+ * @param name name of the family
+ * @param type OpenMetrics type of the family
+ * @param unit unit of the family, NULL for none
+ * @param help help text
+ */
+static void
+emit_family (struct MHD_MetricsBuffer *mb,
+             const char *name,
+             const char *type,
+             const char *unit,
+             const char *help)
+{
+  emit (mb, "# TYPE %s %s\n", name, type);
+  if (NULL != unit)
+    emit (mb, "# UNIT %s %s\n", name, unit);
+  emit (mb, "# HELP %s %s.\n", name, help);
+}
+
+
+/**
+ * Append a histogram, read into @a mb's @e histogram, to @a mb.
+ *
+ * @param mb buffer to append to
+ * @param name name of the family
+ * @param usec #MHD_YES if the values are microseconds to export
+ *        in seconds, #MHD_NO for bytes
+ * @param help help text
+ */
+static void
+emit_histogram (struct MHD_MetricsBuffer *mb,
+                const char *name,
+                int usec,
+                const char *help)
+{
+  const struct MHD_LatencyHistogram *h = &mb->histogram;
+  unsigned long long total;
+  unsigned long long limit;
+  unsigned int next;
+  unsigned int group;
+  unsigned int i;
+
+  emit_family (mb,
+               name,
+               "histogram",
+               (MHD_YES == usec) ? "seconds" : "bytes",
+               help);
+  /* cumulative counts at the end of each doubling; the bucket
+     counts, not @e count, so that they stay consistent */
+  total = 0;
+  i = 0;
+  for (group = 1; group <= MHD_METRICS_HISTOGRAM_BUCKETS; group++)
+    {
+      next = 16 * group + 15;
+      for (; i <= next; i++)
+        total += h->buckets[i];
+      limit = (unsigned long long) MHD_latency_bucket_limit (next);
+      if (MHD_YES == usec)
+        emit (mb,
+              "%s_bucket{le=\"%llu.%06llu\"} %llu\n",
+              name,
+              limit / 1000000,
+              limit % 1000000,
+              total);
+      else
+        emit (mb,
+              "%s_bucket{le=\"%llu\"} %llu\n",
+              name,
+              limit,
+              total);
+    }
+  for (; i < MHD_LATENCY_BUCKETS; i++)
+    total += h->buckets[i];
+  emit (mb,
+        "%s_bucket{le=\"+Inf\"} %llu\n"
+        "%s_count %llu\n",
+        name,
+        total,
+        name,
+        total);
+  if (MHD_YES == usec)
+    emit (mb,
+          "%s_sum %llu.%06llu\n",
+          name,
+          (unsigned long long) (h->sum / 1000000),
+          (unsigned long long) (h->sum % 1000000));
+  else
+    emit (mb,
+          "%s_sum %llu\n",
+          name,
+          (unsigned long long) h->sum);
+}
+
+
+/**
+ * Append the metrics of each thread of the thread pool of @a daemon
+ * to @a mb.
+ *
+ * @param mb buffer to append to
+ * @param daemon master daemon with a thread pool
+ */
+static void
+emit_workers (struct MHD_MetricsBuffer *mb,
+              struct MHD_Daemon *daemon)
+{
+  struct MHD_Daemon *worker;
+  unsigned long long usec;
+  unsigned int i;
+
+  emit_family (mb,
+               "mhd_worker_connections",
+               "gauge",
+               NULL,
+               "Connections currently served by a thread of the pool");
+  for (i = 0; i < daemon->worker_pool_size; i++)
+    emit (mb,
+          "mhd_worker_connections{worker=\"%u\"} %u\n",
+          i,
+          METRICS_GET (daemon->worker_pool[i].connections));
+  emit_family (mb,
+               "mhd_worker_requests",
+               "counter",
+               NULL,
+               "Requests whose headers were received by a thread of the pool");
+  for (i = 0; i < daemon->worker_pool_size; i++)
+    emit (mb,
+          "mhd_worker_requests_total{worker=\"%u\"} %llu\n",
+          i,
+          (unsigned long long)
+          METRICS_GET (daemon->worker_pool[i].stats->requests));
+  emit_family (mb,
+               "mhd_worker_loop_dispatch_seconds",
+               "counter",
+               "seconds",
+               "Time a thread of the pool spent processing events");
+  for (i = 0; i < daemon->worker_pool_size; i++)
+    {
+      worker = &daemon->worker_pool[i];
+      usec = (unsigned long long)
+        METRICS_GET (worker->stats->loop_dispatch_usec);
+      emit (mb,
+            "mhd_worker_loop_dispatch_seconds_total{worker=\"%u\"} %llu.%06llu\n",
+            i,
+            usec / 1000000,
+            usec % 1000000);
+    }
+}
+
+
+/**
+ * Render the metrics of @a daemon into @a mb.
+ *
+ * @param mb buffer to render into
+ * @param daemon the (master) daemon
+ */
+static void
+render (struct MHD_MetricsBuffer *mb,
+        struct MHD_Daemon *daemon)
+{
+  const struct MetricsField *f;
+  unsigned long long value;
+  unsigned int connections;
+  unsigned int i;
+
+  mb->len = 0;
+  for (i = 0; i < sizeof (fields) / sizeof (fields[0]); i++)
+    {
+      f = &fields[i];
+      value = (unsigned long long)
+        *(const uint64_t *) ((const char *) &mb->stats + f->offset);
+      if (NULL != f->help)
+        emit_family (mb,
+                     f->name,
+                     (MHD_YES == f->gauge) ? "gauge" : "counter",
+                     (MHD_YES == f->usec) ? "seconds" : NULL,
+                     f->help);
+      emit (mb,
+            "%s%s%s%s%s ",
+            f->name,
+            (MHD_YES == f->gauge) ? "" : "_total",
+            (NULL != f->labels) ? "{" : "",
+            (NULL != f->labels) ? f->labels : "",
+            (NULL != f->labels) ? "}" : "");
+      if (MHD_YES == f->usec)
+        emit (mb,
+              "%llu.%06llu\n",
+              value / 1000000,
+              value % 1000000);
+      else
+        emit (mb,
+              "%llu\n",
+              value);
+    }
+
+  if (NULL == daemon->worker_pool)
+    connections = METRICS_GET (daemon->connections);
+  else
+    for (connections = 0, i = 0; i < daemon->worker_pool_size; i++)
+      connections += METRICS_GET (daemon->worker_pool[i].connections);
+  emit_family (mb,
+               "mhd_connections",
+               "gauge",
+               NULL,
+               "Connections currently open");
+  emit (mb,
+        "mhd_connections %u\n",
+        connections);
+  if (0 != daemon->memory_budget)
+    {
+      emit_family (mb,
+                   "mhd_pool_memory_bytes",
+                   "gauge",
+                   "bytes",
+                   "Memory of the pools of all connections");
+      emit (mb,
+            "mhd_pool_memory_bytes %llu\n",
+            (unsigned long long) METRICS_GET (daemon->memory_used));
+      emit_family (mb,
+                   "mhd_pool_memory_budget_bytes",
+                   "gauge",
+                   "bytes",
+                   "Bound for the memory of the pools of all connections");
+      emit (mb,
+            "mhd_pool_memory_budget_bytes %llu\n",
+            (unsigned long long) daemon->memory_budget);
+    }
+  if ( (NULL != daemon->worker_pool) &&
+       (NULL == daemon->prefork) )
+    emit_workers (mb,
+                  daemon);
+
+  MHD_get_latency_histogram (daemon,
+                             MHD_LATENCY_FIRST_BYTE,
+                             &mb->histogram);
+  emit_histogram (mb,
+                  "mhd_request_first_byte_seconds",
+                  MHD_YES,
+                  "Time from the first byte of a request to the response headers being sent");
+  MHD_get_latency_histogram (daemon,
+                             MHD_LATENCY_TOTAL,
+                             &mb->histogram);
+  emit_histogram (mb,
+                  "mhd_request_duration_seconds",
+                  MHD_YES,
+                  "Time from the first byte of a request to the complete response being sent");
+  MHD_get_pool_usage_histogram (daemon,
+                                &mb->histogram);
+  emit_histogram (mb,
+                  "mhd_connection_pool_usage_bytes",
+                  MHD_NO,
+                  "Peak memory pool usage of closed connections");
+  emit (mb,
+        "# EOF\n");
+}
+
+
+/**
+ * Copy the rendered metrics into the response.
+ *
+ * @param cls the `struct MHD_MetricsBuffer`
+ * @param pos position in the text
+ * @param buf where to copy the text to
+ * @param max size of @a buf
+ * @return number of bytes copied
+ */
+static ssize_t
+metrics_reader (void *cls,
+                uint64_t pos,
+                char *buf,
+                size_t max)
+{
+  struct MHD_MetricsBuffer *mb = cls;
+  size_t n;
+
+  if (pos >= mb->len)
+    return MHD_CONTENT_READER_END_OF_STREAM;
+  n = mb->len - (size_t) pos;
+  if (n > max)
+    n = max;
+  memcpy (buf,
+          &mb->text[pos],
+          n);
+  return n;
+}
+
+
+/**
+ * Free @a mb.
+ *
+ * @param mb buffer to free, may be NULL
+ */
+static void
+free_buffer (struct MHD_MetricsBuffer *mb)
+{
+  if (NULL == mb)
+    return;
+  free (mb->text);
+  free (mb);
+}
+
+
+/**
+ * Return the buffer of a destroyed metrics response to its daemon
+ * for the next scrape.
+ *
+ * @param cls the `struct MHD_MetricsBuffer`
+ */
+static void
+metrics_release (void *cls)
+{
+  struct MHD_MetricsBuffer *mb = cls;
+#ifdef HAVE_ATOMIC_BUILTINS
+  struct MHD_MetricsBuffer *expected = NULL;
+
+  if (__atomic_compare_exchange_n (&mb->daemon->metrics_cache,
+                                   &expected,
+                                   mb,
+                                   0,
+                                   __ATOMIC_RELEASE,
+                                   __ATOMIC_RELAXED))
+    return;
+#endif
+  /* another scrape returned its buffer first */
+  free_buffer (mb);
+}
+
+
+/**
+ * Create a response with the statistics of @a daemon in the
+ * OpenMetrics text format.
+ *
+ * @param daemon daemon to export the statistics of
+ * @return NULL on error (out of memory)
+ * @ingroup specialized
+ */
+struct MHD_Response *
+MHD_create_metrics_response (struct MHD_Daemon *daemon)
+{
+  struct MHD_MetricsBuffer *mb;
+  struct MHD_Response *response;
+  char *text;
+
+  mb = NULL;
+#ifdef HAVE_ATOMIC_BUILTINS
+  mb = __atomic_exchange_n (&daemon->metrics_cache,
+                            NULL,
+                            __ATOMIC_ACQUIRE);
+#endif
+  if (NULL == mb)
+    {
+      mb = malloc (sizeof (struct MHD_MetricsBuffer));
+      if (NULL == mb)
+        return NULL;
+      mb->daemon = daemon;
+      mb->size = MHD_METRICS_INITIAL_SIZE;
+      mb->text = malloc (mb->size);
+      if (NULL == mb->text)
+        {
+          free (mb);
+          return NULL;
+        }
+    }
+  MHD_collect_stats_ (daemon,
+                      &mb->stats);
+  render (mb,
+          daemon);
+  if (mb->len >= mb->size)
+    {
+      /* grow once to what the document needs, with some room to spare */
+      text = realloc (mb->text,
+                      mb->len + mb->len / 4 + 1);
+      if (NULL == text)
+        {
+          free_buffer (mb);
+          return NULL;
+        }
+      mb->text = text;
+      mb->size = mb->len + mb->len / 4 + 1;
+      render (mb,
+              daemon);
+      if (mb->len >= mb->size)
+        mb->len = mb->size - 1;
+    }
+  response = MHD_create_response_from_callback (mb->len,
+                                                MHD_METRICS_BLOCK_SIZE,
+                                                &metrics_reader,
+                                                mb,
+                                                &metrics_release);
+  if (NULL == response)
+    {
+      free_buffer (mb);
+      return NULL;
+    }
+  if (MHD_NO == MHD_add_response_header (response,
+                                         MHD_HTTP_HEADER_CONTENT_TYPE,
+                                         MHD_METRICS_CONTENT_TYPE))
+    {
+      MHD_destroy_response (response);
+      return NULL;
+    }
+  return response;
+}
+
+
+/**
+ * Free the buffer kept for the next metrics response of @a daemon.
+ *
+ * @param daemon the (master) daemon that stopped
+ */
+void
+MHD_metrics_free_ (struct MHD_Daemon *daemon)
+{
+  free_buffer (daemon->metrics_cache);
+  daemon->metrics_cache = NULL;
+}
+
+/* end of mhd_metrics.c */
@@ -0,0 +1,39 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_metrics.h
+ * @brief  statistics of a daemon in the OpenMetrics text format
+ * @author Christian Grothoff
+ */
+
+#ifndef MHD_METRICS_H
+#define MHD_METRICS_H 1
+#include "internal.h"
+
+
+/**
+ * Free the buffer kept for the next metrics response of @a daemon.
+ *
+ * @param daemon the (master) daemon that stopped
+ */
+void
+MHD_metrics_free_ (struct MHD_Daemon *daemon);
+
+#endif
@@ -317,3 +317,102 @@ MHD_monotonic_sec_counter (void)
 
   return time (NULL) - sys_clock_start;
 }
+
+
+/**
+ * Monotonic milliseconds counter, for timing that needs a finer
+ * resolution than #MHD_monotonic_sec_counter().  Uses the same clock
+ * source.
+ *
+ * @return number of milliseconds from some fixed moment
+ */
+uint64_t
+MHD_monotonic_msec_counter (void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+  struct timespec ts;
+
+  if (_MHD_UNWANTED_CLOCK != mono_clock_id &&
+      0 == clock_gettime (mono_clock_id , &ts))
+    return ((uint64_t) (ts.tv_sec - mono_clock_start)) * 1000
+      + ts.tv_nsec / 1000000;
+#endif /* HAVE_CLOCK_GETTIME */
+#ifdef HAVE_CLOCK_GET_TIME
+  if (_MHD_INVALID_CLOCK_SERV != mono_clock_service)
+    {
+      mach_timespec_t cur_time;
+      if (KERN_SUCCESS == clock_get_time(mono_clock_service, &cur_time))
+        return ((uint64_t) (cur_time.tv_sec - mono_clock_start)) * 1000
+          + cur_time.tv_nsec / 1000000;
+    }
+#endif /* HAVE_CLOCK_GET_TIME */
+#if defined(_WIN32)
+#if _WIN32_WINNT >= 0x0600
+  if (1)
+    return (uint64_t)(GetTickCount64() - tick_start);
+#else  /* _WIN32_WINNT < 0x0600 */
+  if (0 != perf_freq)
+    {
+      LARGE_INTEGER perf_counter;
+      QueryPerformanceCounter(&perf_counter); /* never fail on XP and later */
+      return ((uint64_t)(perf_counter.QuadPart - perf_start)) * 1000 / perf_freq;
+    }
+#endif /* _WIN32_WINNT < 0x0600 */
+#endif /* _WIN32 */
+#ifdef HAVE_GETHRTIME
+  if (1)
+    return ((uint64_t)(gethrtime() - hrtime_start)) / 1000000;
+#endif /* HAVE_GETHRTIME */
+
+  return ((uint64_t) (time (NULL) - sys_clock_start)) * 1000;
+}
+
+
+/**
+ * Monotonic microseconds counter, for timing single requests.  Uses
+ * CLOCK_MONOTONIC where available, as the coarse clocks preferred by
+ * #MHD_monotonic_sec_counter() only tick every few milliseconds;
+ * otherwise the same clock source as #MHD_monotonic_msec_counter().
+ * Sources without a finer resolution give whole milliseconds.
+ *
+ * @return number of microseconds from some fixed moment
+ */
+uint64_t
+MHD_monotonic_usec_counter (void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+  struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC
+  if (0 == clock_gettime (CLOCK_MONOTONIC, &ts))
+    return ((uint64_t) ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+#endif /* CLOCK_MONOTONIC */
+  if (_MHD_UNWANTED_CLOCK != mono_clock_id &&
+      0 == clock_gettime (mono_clock_id , &ts))
+    return ((uint64_t) (ts.tv_sec - mono_clock_start)) * 1000000
+      + ts.tv_nsec / 1000;
+#endif /* HAVE_CLOCK_GETTIME */
+#ifdef HAVE_CLOCK_GET_TIME
+  if (_MHD_INVALID_CLOCK_SERV != mono_clock_service)
+    {
+      mach_timespec_t cur_time;
+      if (KERN_SUCCESS == clock_get_time(mono_clock_service, &cur_time))
+        return ((uint64_t) (cur_time.tv_sec - mono_clock_start)) * 1000000
+          + cur_time.tv_nsec / 1000;
+    }
+#endif /* HAVE_CLOCK_GET_TIME */
+#if defined(_WIN32) && _WIN32_WINNT < 0x0600
+  if (0 != perf_freq)
+    {
+      LARGE_INTEGER perf_counter;
+      QueryPerformanceCounter(&perf_counter); /* never fail on XP and later */
+      return ((uint64_t)(perf_counter.QuadPart - perf_start)) * 1000000 / perf_freq;
+    }
+#endif /* _WIN32 && _WIN32_WINNT < 0x0600 */
+#ifdef HAVE_GETHRTIME
+  if (1)
+    return ((uint64_t)(gethrtime() - hrtime_start)) / 1000;
+#endif /* HAVE_GETHRTIME */
+
+  return MHD_monotonic_msec_counter () * 1000;
+}
@@ -51,4 +51,24 @@ MHD_monotonic_sec_counter_finish(void);
 time_t
 MHD_monotonic_sec_counter(void);
 
+
+/**
+ * Monotonic milliseconds counter, for timing that needs a finer
+ * resolution than #MHD_monotonic_sec_counter().
+ *
+ * @return number of milliseconds from some fixed moment
+ */
+uint64_t
+MHD_monotonic_msec_counter(void);
+
+
+/**
+ * Monotonic microseconds counter, for timing single requests.
+ * Its origin may differ from #MHD_monotonic_msec_counter().
+ *
+ * @return number of microseconds from some fixed moment
+ */
+uint64_t
+MHD_monotonic_usec_counter(void);
+
 #endif /* MHD_MONO_CLOCK_H */
@@ -0,0 +1,1104 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_prefork.c
+ * @brief  Worker processes and their shared memory for
+ *         #MHD_OPTION_PREFORK_WORKERS
+ * @author Christian Grothoff
+ *
+ * The master process (the one calling MHD_start_daemon()) maps an
+ * anonymous shared memory segment, binds the listen socket and forks
+ * a supervisor process right before the threads of the daemon would
+ * be started.  The supervisor stays single-threaded: it forks the
+ * workers, each of which returns from MHD_prefork_start_() to
+ * complete the start of its copy of the daemon, and forks a new
+ * worker whenever one exits.  All of them watch the read end of a
+ * pipe whose write end only the master holds; once the master closes
+ * it (or exits), the workers stop their daemons and the supervisor
+ * waits for them.
+ *
+ * The segment holds the per-IP connection counts, the nonce-nc map
+ * of digest authentication and one `struct MHD_DaemonStats` for each
+ * thread of each worker.  The counts of an IP address are kept per
+ * worker, so that those of a worker that crashed can be removed, and
+ * its statistics are added to a total of exited workers.  The locks
+ * are process-shared, and robust where supported, so that a worker
+ * dying while holding one does not block the others.
+ */
+
+#include "mhd_prefork.h"
+
+#if PREFORK_SUPPORT
+#include <sys/wait.h>
+#include <poll.h>
+#include <limits.h>
+#include "mhd_mono_clock.h"
+#include "mhd_siphash.h"
+
+/**
+ * Milliseconds between the checks of the supervisor for workers
+ * that exited.
+ */
+#define MHD_PREFORK_SUPERVISE_INTERVAL 100
+
+/**
+ * Minimum number of milliseconds between forking the same worker
+ * twice, so that a worker failing right away is not forked in a
+ * tight loop.
+ */
+#define MHD_PREFORK_RESPAWN_DELAY 1000
+
+/**
+ * Number of independently locked shards of the table of per-IP
+ * connection counts.  Must be a power of two.
+ */
+#define MHD_PREFORK_IP_SHARDS 64
+
+/**
+ * Alignment of the parts of the shared memory.
+ */
+#define MHD_PREFORK_ALIGN(n) (((n) + 63) & ~((size_t) 63))
+
+
+/**
+ * State of a worker process.
+ */
+enum MHD_PreforkState
+{
+  /**
+   * Forked, completing the start of its daemon.
+   */
+  MHD_PREFORK_STARTING = 0,
+
+  /**
+   * Serving connections.
+   */
+  MHD_PREFORK_RUNNING = 1,
+
+  /**
+   * Failed to start its daemon and exited.
+   */
+  MHD_PREFORK_FAILED = 2
+};
+
+
+/**
+ * Start of the shared memory.
+ */
+struct MHD_PreforkShared
+{
+  /**
+   * Protects @e retired and the clearing of the statistics of a
+   * worker that exited.
+   */
+  MHD_mutex_ stats_lock;
+
+  /**
+   * Statistics of the workers that exited.
+   */
+  struct MHD_DaemonStats retired;
+};
+
+
+/**
+ * Head of a shard of the table of per-IP connection counts, followed
+ * by its entries.  The entries form an open addressing hash table
+ * with linear probing.
+ */
+struct MHD_PreforkIPShard
+{
+  /**
+   * Protects the entries of the shard.
+   */
+  MHD_mutex_ mutex;
+
+  /**
+   * Number of entries in use.
+   */
+  unsigned int used;
+};
+
+
+/**
+ * Connection counts of an IP address.
+ */
+struct MHD_PreforkIPEntry
+{
+  /**
+   * Sum of @e count, 0 for an unused entry.
+   */
+  unsigned int total;
+
+  /**
+   * Address family.
+   */
+  int family;
+
+  /**
+   * Number of bytes in @e addr.
+   */
+  size_t len;
+
+  /**
+   * The IP address.
+   */
+  unsigned char addr[16];
+
+  /**
+   * Connections of each worker process (the entry is allocated for
+   * all workers).
+   */
+  unsigned int count[1];
+};
+
+
+/**
+ * Worker processes of a daemon and their shared memory.
+ */
+struct MHD_Prefork
+{
+  /**
+   * The shared memory.
+   */
+  struct MHD_PreforkShared *shm;
+
+  /**
+   * Number of bytes of @e shm.
+   */
+  size_t shm_size;
+
+  /**
+   * State of each worker, in @e shm.
+   */
+  volatile int *states;
+
+  /**
+   * Statistics of each thread of each worker, in @e shm.
+   */
+  struct MHD_DaemonStats *slots;
+
+  /**
+   * Shards of the table of per-IP connection counts, in @e shm;
+   * NULL without per-IP limit.
+   */
+  char *ip_table;
+
+  /**
+   * Locks of the nonce-nc map, in @e shm.
+   */
+  struct MHD_NonceNcLocks *nnc_locks;
+
+  /**
+   * The nonce-nc map, in @e shm; NULL without map.
+   */
+  struct MHD_NonceNc *nnc;
+
+  /**
+   * Number of bytes of a shard of @e ip_table.
+   */
+  size_t ip_shard_size;
+
+  /**
+   * Number of bytes of an entry of @e ip_table.
+   */
+  size_t ip_entry_size;
+
+  /**
+   * Number of entries of each shard, a power of two.
+   */
+  unsigned int ip_entries;
+
+  /**
+   * Key of the hash of @e ip_table, the same in all workers.
+   */
+  uint64_t ip_key[2];
+
+  /**
+   * Number of worker processes.
+   */
+  unsigned int workers;
+
+  /**
+   * Number of threads (daemons) of each worker with statistics.
+   */
+  unsigned int threads;
+
+  /**
+   * Index of the worker running in this process, `UINT_MAX` in the
+   * master and in the supervisor process.
+   */
+  unsigned int worker;
+
+  /**
+   * The supervisor process, -1 if none.
+   */
+  pid_t supervisor;
+
+  /**
+   * Pipe closed by the master process to stop the others.
+   */
+  int ctl[2];
+};
+
+
+/**
+ * State of this worker process while it completes the start of its
+ * daemon, NULL otherwise.
+ */
+static volatile int *starting_state;
+
+
+/**
+ * Create a mutex shared by processes.
+ *
+ * @param mutex mutex in the shared memory
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+static int
+shared_mutex_create (MHD_mutex_ *mutex)
+{
+  pthread_mutexattr_t attr;
+  int ret;
+
+  if (0 != pthread_mutexattr_init (&attr))
+    return MHD_NO;
+  ret = pthread_mutexattr_setpshared (&attr,
+                                      PTHREAD_PROCESS_SHARED);
+#ifdef HAVE_PTHREAD_MUTEXATTR_SETROBUST
+  if (0 == ret)
+    ret = pthread_mutexattr_setrobust (&attr,
+                                       PTHREAD_MUTEX_ROBUST);
+#endif
+  if (0 == ret)
+    ret = pthread_mutex_init (mutex,
+                              &attr);
+  (void) pthread_mutexattr_destroy (&attr);
+  return (0 == ret) ? MHD_YES : MHD_NO;
+}
+
+
+/**
+ * Lock a mutex in the shared memory, recovering it if a worker
+ * process died while holding it.  The data it protects is used as
+ * it is: at worst a count is off.
+ *
+ * @param mutex mutex to lock
+ */
+void
+MHD_prefork_mutex_lock_ (MHD_mutex_ *mutex)
+{
+  int ret;
+
+  ret = pthread_mutex_lock (mutex);
+#ifdef HAVE_PTHREAD_MUTEXATTR_SETROBUST
+  if (EOWNERDEAD == ret)
+    ret = pthread_mutex_consistent (mutex);
+#endif
+  if (0 != ret)
+    MHD_PANIC ("Failed to acquire shared mutex\n");
+}
+
+
+/**
+ * Unlock a mutex in the shared memory.
+ *
+ * @param mutex mutex to unlock
+ */
+static void
+shared_mutex_unlock (MHD_mutex_ *mutex)
+{
+  if (MHD_YES != MHD_mutex_unlock_ (mutex))
+    MHD_PANIC ("Failed to release shared mutex\n");
+}
+
+
+/**
+ * Map the memory shared by the worker processes of @a daemon, sized
+ * for its options, and set @e prefork of @a daemon.
+ *
+ * @param daemon the (master) daemon, with its options parsed
+ * @return #MHD_YES on success, #MHD_NO on error (logged)
+ */
+int
+MHD_prefork_init_ (struct MHD_Daemon *daemon)
+{
+  struct MHD_Prefork *pf;
+  struct MHD_PreforkIPShard *shard;
+  char *base;
+  size_t states_off;
+  size_t slots_off;
+  size_t ip_off;
+  size_t nnc_locks_off;
+  size_t nnc_off;
+  size_t nnc_entries;
+  uint64_t conns;
+  unsigned int i;
+
+  pf = calloc (1, sizeof (struct MHD_Prefork));
+  if (NULL == pf)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to allocate memory for worker processes: %s\n",
+                MHD_strerror_ (errno));
+#endif
+      return MHD_NO;
+    }
+  pf->workers = daemon->prefork_workers;
+  pf->threads = 1 + daemon->worker_pool_size;
+  pf->worker = UINT_MAX;
+  pf->supervisor = -1;
+  pf->ctl[0] = -1;
+  pf->ctl[1] = -1;
+  if (0 != daemon->per_ip_connection_limit)
+    {
+      /* room for as many addresses as the workers may have
+         connections, at most half of each shard in use */
+      conns = (uint64_t) daemon->connection_limit * pf->workers;
+      MHD_siphash_key_ (pf->ip_key);
+      pf->ip_entries = 8;
+      while ( ( (uint64_t) pf->ip_entries * MHD_PREFORK_IP_SHARDS < 2 * conns) &&
+              (pf->ip_entries < (1U << 20)) )
+        pf->ip_entries *= 2;
+      pf->ip_entry_size =
+        MHD_PREFORK_ALIGN (offsetof (struct MHD_PreforkIPEntry, count)
+                           + pf->workers * sizeof (unsigned int));
+      pf->ip_shard_size =
+        MHD_PREFORK_ALIGN (sizeof (struct MHD_PreforkIPShard))
+        + pf->ip_entries * pf->ip_entry_size;
+    }
+  nnc_entries = 0;
+#ifdef DAUTH_SUPPORT
+  nnc_entries = ((daemon->nonce_nc_size + MHD_NONCE_NC_WAYS - 1)
+                 / MHD_NONCE_NC_WAYS) * MHD_NONCE_NC_WAYS;
+#endif
+  states_off = MHD_PREFORK_ALIGN (sizeof (struct MHD_PreforkShared));
+  slots_off = states_off
+    + MHD_PREFORK_ALIGN (pf->workers * sizeof (int));
+  ip_off = slots_off
+    + MHD_PREFORK_ALIGN ((size_t) pf->workers * pf->threads
+                         * sizeof (struct MHD_DaemonStats));
+  nnc_locks_off = ip_off + MHD_PREFORK_IP_SHARDS * pf->ip_shard_size;
+  nnc_off = nnc_locks_off
+    + MHD_PREFORK_ALIGN (sizeof (struct MHD_NonceNcLocks));
+  pf->shm_size = nnc_off + nnc_entries * sizeof (struct MHD_NonceNc);
+  base = mmap (NULL,
+               pf->shm_size,
+               PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_ANONYMOUS,
+               -1,
+               0);
+  if (MAP_FAILED == base)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to map memory for worker processes: %s\n",
+                MHD_strerror_ (errno));
+#endif
+      free (pf);
+      return MHD_NO;
+    }
+  /* the mapping is zero-filled */
+  pf->shm = (struct MHD_PreforkShared *) base;
+  pf->states = (volatile int *) (base + states_off);
+  pf->slots = (struct MHD_DaemonStats *) (base + slots_off);
+  if (0 != pf->ip_entries)
+    pf->ip_table = base + ip_off;
+  pf->nnc_locks = (struct MHD_NonceNcLocks *) (base + nnc_locks_off);
+  if (0 != nnc_entries)
+    pf->nnc = (struct MHD_NonceNc *) (base + nnc_off);
+  if (MHD_YES != shared_mutex_create (&pf->shm->stats_lock))
+    goto mutex_failed;
+  for (i = 0; (NULL != pf->ip_table) && (i < MHD_PREFORK_IP_SHARDS); i++)
+    {
+      shard = (struct MHD_PreforkIPShard *) (pf->ip_table + i * pf->ip_shard_size);
+      if (MHD_YES != shared_mutex_create (&shard->mutex))
+        goto mutex_failed;
+    }
+  for (i = 0; i < MHD_NONCE_NC_LOCKS; i++)
+    if (MHD_YES != shared_mutex_create (&pf->nnc_locks->locks[i]))
+      goto mutex_failed;
+  daemon->prefork = pf;
+  return MHD_YES;
+
+ mutex_failed:
+#ifdef HAVE_MESSAGES
+  MHD_DLOG (daemon,
+            "Failed to create a process-shared mutex\n");
+#endif
+  (void) munmap (base,
+                 pf->shm_size);
+  free (pf);
+  return MHD_NO;
+}
+
+
+/**
+ * Release what #MHD_prefork_init_() created.  Only the master
+ * process unmaps the shared memory, worker processes keep it until
+ * they exit.
+ *
+ * @param daemon the (master) daemon
+ */
+void
+MHD_prefork_destroy_ (struct MHD_Daemon *daemon)
+{
+  struct MHD_Prefork *pf = daemon->prefork;
+
+  if (NULL == pf)
+    return;
+  daemon->prefork = NULL;
+  if (UINT_MAX == pf->worker)
+    {
+      if ( (-1 != pf->ctl[1]) &&
+           (0 != close (pf->ctl[1])) )
+        MHD_PANIC ("close failed\n");
+      (void) munmap (pf->shm,
+                     pf->shm_size);
+    }
+  free (pf);
+}
+
+
+/**
+ * Is this the process that started @a daemon?
+ *
+ * @param daemon the (master) daemon
+ * @return #MHD_YES in the master process, #MHD_NO in a worker
+ *         process or without #MHD_OPTION_PREFORK_WORKERS
+ */
+int
+MHD_prefork_is_master_ (const struct MHD_Daemon *daemon)
+{
+  if ( (NULL == daemon->prefork) ||
+       (UINT_MAX != daemon->prefork->worker) )
+    return MHD_NO;
+  return MHD_YES;
+}
+
+
+/**
+ * Get the index of the worker process running @a daemon.
+ *
+ * @param daemon the (master) daemon
+ * @return index from 0, `UINT_MAX` in the master process
+ */
+unsigned int
+MHD_prefork_worker_ (const struct MHD_Daemon *daemon)
+{
+  return daemon->prefork->worker;
+}
+
+
+/**
+ * Get the entry @a i of a shard of the per-IP table.
+ *
+ * @param pf the worker processes
+ * @param shard the shard
+ * @param i index of the entry
+ * @return the entry
+ */
+static struct MHD_PreforkIPEntry *
+ip_entry (struct MHD_Prefork *pf,
+          struct MHD_PreforkIPShard *shard,
+          unsigned int i)
+{
+  return (struct MHD_PreforkIPEntry *)
+    ((char *) shard + MHD_PREFORK_ALIGN (sizeof (struct MHD_PreforkIPShard))
+     + i * pf->ip_entry_size);
+}
+
+
+/**
+ * Hash an IP address (SipHash of its bytes, keyed per daemon).
+ *
+ * @param pf the worker processes
+ * @param ip the IP address
+ * @param len number of bytes in @a ip
+ * @return the hash; the low bits select the shard
+ */
+static uint32_t
+ip_hash (const struct MHD_Prefork *pf,
+         const void *ip,
+         size_t len)
+{
+  return (uint32_t) MHD_siphash_ (pf->ip_key,
+                                  ip,
+                                  len);
+}
+
+
+/**
+ * Find the entry of an IP address, or the free entry where it
+ * belongs.  The caller holds the lock of the shard.
+ *
+ * @param pf the worker processes
+ * @param shard shard of the address
+ * @param hash hash of the address
+ * @param family address family of @a ip
+ * @param ip the IP address
+ * @param len number of bytes in @a ip
+ * @return the entry, unused if the address has none
+ */
+static struct MHD_PreforkIPEntry *
+ip_find (struct MHD_Prefork *pf,
+         struct MHD_PreforkIPShard *shard,
+         uint32_t hash,
+         int family,
+         const void *ip,
+         size_t len)
+{
+  struct MHD_PreforkIPEntry *entry;
+  unsigned int i;
+
+  i = (hash / MHD_PREFORK_IP_SHARDS) & (pf->ip_entries - 1);
+  while (0 != (entry = ip_entry (pf, shard, i))->total)
+    {
+      if ( (family == entry->family) &&
+           (len == entry->len) &&
+           (0 == memcmp (entry->addr, ip, len)) )
+        break;
+      i = (i + 1) & (pf->ip_entries - 1);
+    }
+  return entry;
+}
+
+
+/**
+ * Remove the entry @a i, whose total dropped to 0, and move the
+ * entries after it that would no longer be found.  The caller holds
+ * the lock of the shard.
+ *
+ * @param pf the worker processes
+ * @param shard the shard
+ * @param i index of the entry
+ */
+static void
+ip_remove (struct MHD_Prefork *pf,
+           struct MHD_PreforkIPShard *shard,
+           unsigned int i)
+{
+  struct MHD_PreforkIPEntry *entry;
+  unsigned int mask = pf->ip_entries - 1;
+  unsigned int j;
+  unsigned int home;
+
+  j = i;
+  for (;;)
+    {
+      j = (j + 1) & mask;
+      entry = ip_entry (pf, shard, j);
+      if (0 == entry->total)
+        break;
+      home = (ip_hash (pf, entry->addr, entry->len) / MHD_PREFORK_IP_SHARDS) & mask;
+      /* stays if its home is cyclically in (i, j] */
+      if ( (i <= j)
+           ? ( (i < home) && (home <= j) )
+           : ( (i < home) || (home <= j) ) )
+        continue;
+      memcpy (ip_entry (pf, shard, i),
+              entry,
+              pf->ip_entry_size);
+      i = j;
+    }
+  memset (ip_entry (pf, shard, i),
+          0,
+          pf->ip_entry_size);
+  shard->used--;
+}
+
+
+/**
+ * Count a connection from an IP address in the shared table, see
+ * #MHD_OPTION_PER_IP_CONNECTION_LIMIT.
+ *
+ * @param daemon the (master) daemon
+ * @param family address family of @a ip
+ * @param ip the IP address
+ * @param len number of bytes in @a ip
+ * @return #MHD_YES if the address is below its limit, #MHD_NO if not
+ *         (or if the table is full)
+ */
+int
+MHD_prefork_ip_limit_add_ (struct MHD_Daemon *daemon,
+                           int family,
+                           const void *ip,
+                           size_t len)
+{
+  struct MHD_Prefork *pf = daemon->prefork;
+  struct MHD_PreforkIPShard *shard;
+  struct MHD_PreforkIPEntry *entry;
+  uint32_t hash;
+  int result;
+
+  hash = ip_hash (pf, ip, len);
+  shard = (struct MHD_PreforkIPShard *)
+    (pf->ip_table + (hash & (MHD_PREFORK_IP_SHARDS - 1)) * pf->ip_shard_size);
+  MHD_prefork_mutex_lock_ (&shard->mutex);
+  entry = ip_find (pf, shard, hash, family, ip, len);
+  if (0 == entry->total)
+    {
+      /* keep an unused entry to end the searches */
+      if (shard->used + 1 >= pf->ip_entries)
+        {
+          shared_mutex_unlock (&shard->mutex);
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Shared table of IP connection counts is full\n");
+#endif
+          return MHD_NO;
+        }
+      shard->used++;
+      entry->family = family;
+      entry->len = len;
+      memcpy (entry->addr, ip, len);
+    }
+  result = (entry->total < daemon->per_ip_connection_limit) ? MHD_YES : MHD_NO;
+  if (MHD_YES == result)
+    {
+      entry->total++;
+      entry->count[pf->worker]++;
+    }
+  shared_mutex_unlock (&shard->mutex);
+  return result;
+}
+
+
+/**
+ * Remove a connection counted by #MHD_prefork_ip_limit_add_().
+ *
+ * @param daemon the (master) daemon
+ * @param family address family of @a ip
+ * @param ip the IP address
+ * @param len number of bytes in @a ip
+ */
+void
+MHD_prefork_ip_limit_del_ (struct MHD_Daemon *daemon,
+                           int family,
+                           const void *ip,
+                           size_t len)
+{
+  struct MHD_Prefork *pf = daemon->prefork;
+  struct MHD_PreforkIPShard *shard;
+  struct MHD_PreforkIPEntry *entry;
+  uint32_t hash;
+
+  hash = ip_hash (pf, ip, len);
+  shard = (struct MHD_PreforkIPShard *)
+    (pf->ip_table + (hash & (MHD_PREFORK_IP_SHARDS - 1)) * pf->ip_shard_size);
+  MHD_prefork_mutex_lock_ (&shard->mutex);
+  entry = ip_find (pf, shard, hash, family, ip, len);
+  /* unlike with a table of our own, a worker that died while
+     updating the entry may have lost the count, so do not panic */
+  if ( (0 != entry->total) &&
+       (0 != entry->count[pf->worker]) )
+    {
+      entry->count[pf->worker]--;
+      if (0 == --entry->total)
+        ip_remove (pf,
+                   shard,
+                   (unsigned int) (((char *) entry - (char *) ip_entry (pf, shard, 0))
+                                   / pf->ip_entry_size));
+    }
+  shared_mutex_unlock (&shard->mutex);
+}
+
+
+/**
+ * Get the shared statistics of a thread of this worker process.
+ *
+ * @param daemon the (master) daemon
+ * @param thread 0 for @a daemon, i + 1 for its worker daemon i
+ * @return statistics to count in
+ */
+struct MHD_DaemonStats *
+MHD_prefork_stats_ (struct MHD_Daemon *daemon,
+                    unsigned int thread)
+{
+  struct MHD_Prefork *pf = daemon->prefork;
+
+  return &pf->slots[pf->worker * pf->threads + thread];
+}
+
+
+/**
+ * Add the counters of @a src to @a dst.  All members of
+ * `struct MHD_DaemonStats` are `uint64_t` counters.
+ *
+ * @param dst statistics to add to
+ * @param src statistics to add, updated concurrently
+ */
+static void
+add_counters (struct MHD_DaemonStats *dst,
+              const struct MHD_DaemonStats *src)
+{
+  uint64_t *d = (uint64_t *) dst;
+  const uint64_t *s = (const uint64_t *) src;
+  size_t i;
+
+  for (i = 0; i < sizeof (struct MHD_DaemonStats) / sizeof (uint64_t); i++)
+#ifdef HAVE_ATOMIC_BUILTINS
+    d[i] += __atomic_load_n (&s[i], __ATOMIC_RELAXED);
+#else
+    d[i] += s[i];
+#endif
+}
+
+
+/**
+ * Add the statistics of all worker processes, including those that
+ * exited, to @a sum.
+ *
+ * @param daemon the (master) daemon
+ * @param sum statistics to add to
+ */
+void
+MHD_prefork_add_stats_ (struct MHD_Daemon *daemon,
+                        struct MHD_DaemonStats *sum)
+{
+  struct MHD_Prefork *pf = daemon->prefork;
+  unsigned int i;
+
+  MHD_prefork_mutex_lock_ (&pf->shm->stats_lock);
+  add_counters (sum,
+                &pf->shm->retired);
+  for (i = 0; i < pf->workers * pf->threads; i++)
+    add_counters (sum,
+                  &pf->slots[i]);
+  shared_mutex_unlock (&pf->shm->stats_lock);
+}
+
+
+/**
+ * Set the nonce-nc map and its locks of @a daemon to the ones in
+ * the shared memory.
+ *
+ * @param daemon the (master) daemon
+ */
+void
+MHD_prefork_nonce_nc_ (struct MHD_Daemon *daemon)
+{
+  daemon->nnc = daemon->prefork->nnc;
+  daemon->nnc_locks = daemon->prefork->nnc_locks;
+}
+
+
+/**
+ * Remove what the worker @a worker, which exited, left in the shared
+ * memory: its connections from the per-IP counts, and its statistics,
+ * which are added to those of the exited workers (except for the
+ * connections it had suspended).
+ *
+ * @param pf the worker processes
+ * @param worker index of the worker
+ */
+static void
+release_worker (struct MHD_Prefork *pf,
+                unsigned int worker)
+{
+  struct MHD_PreforkIPShard *shard;
+  struct MHD_PreforkIPEntry *entry;
+  struct MHD_DaemonStats *slot;
+  unsigned int i;
+  unsigned int j;
+
+  for (i = 0; (NULL != pf->ip_table) && (i < MHD_PREFORK_IP_SHARDS); i++)
+    {
+      shard = (struct MHD_PreforkIPShard *) (pf->ip_table + i * pf->ip_shard_size);
+      MHD_prefork_mutex_lock_ (&shard->mutex);
+      j = 0;
+      while (j < pf->ip_entries)
+        {
+          entry = ip_entry (pf, shard, j);
+          if ( (0 == entry->total) ||
+               (0 == entry->count[worker]) )
+            {
+              j++;
+              continue;
+            }
+          entry->total -= MHD_MIN (entry->total,
+                                   entry->count[worker]);
+          entry->count[worker] = 0;
+          /* removing moves another entry to j, check it as well */
+          if (0 == entry->total)
+            ip_remove (pf,
+                       shard,
+                       j);
+          else
+            j++;
+        }
+      shared_mutex_unlock (&shard->mutex);
+    }
+  MHD_prefork_mutex_lock_ (&pf->shm->stats_lock);
+  for (i = 0; i < pf->threads; i++)
+    {
+      slot = &pf->slots[worker * pf->threads + i];
+      slot->suspended = 0;
+      add_counters (&pf->shm->retired,
+                    slot);
+      memset (slot,
+              0,
+              sizeof (struct MHD_DaemonStats));
+    }
+  shared_mutex_unlock (&pf->shm->stats_lock);
+}
+
+
+/**
+ * Run the supervisor process: fork the workers and fork them again
+ * when they exit, until the master closes the control pipe.
+ *
+ * @param daemon the (master) daemon
+ * @return index of the worker, only in a new worker process
+ */
+static unsigned int
+supervise (struct MHD_Daemon *daemon)
+{
+  struct MHD_Prefork *pf = daemon->prefork;
+  struct pollfd pfd;
+  pid_t *pids;
+  uint64_t *forked;
+  uint64_t now;
+  pid_t pid;
+  int status;
+  unsigned int i;
+
+  pids = calloc (pf->workers, sizeof (pid_t));
+  forked = calloc (pf->workers, sizeof (uint64_t));
+  if ( (NULL == pids) ||
+       (NULL == forked) )
+    _exit (1);
+  for (;;)
+    {
+      now = MHD_monotonic_msec_counter ();
+      for (i = 0; i < pf->workers; i++)
+        {
+          if ( (0 != pids[i]) ||
+               ( (0 != forked[i]) &&
+                 (now < forked[i] + MHD_PREFORK_RESPAWN_DELAY) ) )
+            continue;
+          pf->states[i] = MHD_PREFORK_STARTING;
+          forked[i] = now;
+          pid = fork ();
+          if (0 == pid)
+            {
+              free (pids);
+              free (forked);
+              return i;
+            }
+          if (-1 == pid)
+            {
+#ifdef HAVE_MESSAGES
+              MHD_DLOG (daemon,
+                        "Failed to fork worker process: %s\n",
+                        MHD_strerror_ (errno));
+#endif
+              continue;
+            }
+          pids[i] = pid;
+        }
+      pfd.fd = pf->ctl[0];
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      if (0 < poll (&pfd, 1, MHD_PREFORK_SUPERVISE_INTERVAL))
+        break; /* nothing is written, so the master closed it */
+      while (0 < (pid = waitpid (-1, &status, WNOHANG)))
+        {
+          for (i = 0; i < pf->workers; i++)
+            if (pid == pids[i])
+              break;
+          if (i == pf->workers)
+            continue;
+          pids[i] = 0;
+#ifdef HAVE_MESSAGES
+          if (WIFSIGNALED (status))
+            MHD_DLOG (daemon,
+                      "Worker process %u was killed by signal %d\n",
+                      i,
+                      WTERMSIG (status));
+          else
+            MHD_DLOG (daemon,
+                      "Worker process %u exited with status %d\n",
+                      i,
+                      WEXITSTATUS (status));
+#endif
+          release_worker (pf,
+                          i);
+        }
+    }
+  /* the workers see the closed pipe as well and stop */
+  for (i = 0; i < pf->workers; i++)
+    while ( (0 != pids[i]) &&
+            (-1 == waitpid (pids[i], &status, 0)) &&
+            (EINTR == errno) )
+      ;
+  _exit (0);
+}
+
+
+/**
+ * Fork the supervisor process, which forks the worker processes.
+ * Returns in the master process once all workers started, and in
+ * each worker process, which then has to complete the start of the
+ * daemon and call #MHD_prefork_worker_run_().
+ *
+ * @param daemon the (master) daemon, with its listen socket
+ * @return #MHD_YES on success, #MHD_NO if the workers failed to
+ *         start (only in the master process)
+ */
+int
+MHD_prefork_start_ (struct MHD_Daemon *daemon)
+{
+  struct MHD_Prefork *pf = daemon->prefork;
+  unsigned int running;
+  unsigned int i;
+  int status;
+
+  if (0 != pipe (pf->ctl))
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to create pipe for worker processes: %s\n",
+                MHD_strerror_ (errno));
+#endif
+      return MHD_NO;
+    }
+  pf->supervisor = fork ();
+  if (0 == pf->supervisor)
+    {
+      (void) close (pf->ctl[1]);
+      pf->ctl[1] = -1;
+      pf->worker = supervise (daemon);
+      starting_state = &pf->states[pf->worker];
+      return MHD_YES;
+    }
+  if (0 != close (pf->ctl[0]))
+    MHD_PANIC ("close failed\n");
+  pf->ctl[0] = -1;
+  if (-1 == pf->supervisor)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to fork supervisor process: %s\n",
+                MHD_strerror_ (errno));
+#endif
+      return MHD_NO;
+    }
+  /* wait until all workers serve, so that errors are reported */
+  for (;;)
+    {
+      running = 0;
+      for (i = 0; i < pf->workers; i++)
+        {
+          if (MHD_PREFORK_FAILED == pf->states[i])
+            break;
+          if (MHD_PREFORK_RUNNING == pf->states[i])
+            running++;
+        }
+      if (i < pf->workers)
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Worker process %u failed to start\n",
+                    i);
+#endif
+          break;
+        }
+      if (running == pf->workers)
+        return MHD_YES;
+      if (pf->supervisor == waitpid (pf->supervisor, &status, WNOHANG))
+        {
+          pf->supervisor = -1;
+          break;
+        }
+      usleep (1000);
+    }
+  MHD_prefork_stop_ (daemon);
+  return MHD_NO;
+}
+
+
+/**
+ * Exit if called in a worker process that failed to complete the
+ * start of the daemon, so that it does not return to the
+ * application; does nothing otherwise.
+ */
+void
+MHD_prefork_startup_failed_ (void)
+{
+  if (NULL == starting_state)
+    return;
+  *starting_state = MHD_PREFORK_FAILED;
+  _exit (1);
+}
+
+
+/**
+ * Serve connections in a worker process until the master stops
+ * the daemon, then stop it and exit.
+ *
+ * @param daemon the (master) daemon, with its threads running
+ */
+void
+MHD_prefork_worker_run_ (struct MHD_Daemon *daemon)
+{
+  struct pollfd pfd;
+
+  *starting_state = MHD_PREFORK_RUNNING;
+  starting_state = NULL;
+  pfd.fd = daemon->prefork->ctl[0];
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  while ( (0 > poll (&pfd, 1, -1)) &&
+          (EINTR == errno) )
+    ;
+  MHD_stop_daemon (daemon);
+  _exit (0);
+}
+
+
+/**
+ * Stop the worker processes and the supervisor and wait for them.
+ *
+ * @param daemon the (master) daemon
+ */
+void
+MHD_prefork_stop_ (struct MHD_Daemon *daemon)
+{
+  struct MHD_Prefork *pf = daemon->prefork;
+  int status;
+
+  if (-1 != pf->ctl[1])
+    {
+      if (0 != close (pf->ctl[1]))
+        MHD_PANIC ("close failed\n");
+      pf->ctl[1] = -1;
+    }
+  if (-1 == pf->supervisor)
+    return;
+  while ( (-1 == waitpid (pf->supervisor, &status, 0)) &&
+          (EINTR == errno) )
+    ;
+  pf->supervisor = -1;
+}
+
+#endif
+
+/* end of mhd_prefork.c */
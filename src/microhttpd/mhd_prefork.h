@@ -0,0 +1,214 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_prefork.h
+ * @brief  Worker processes and their shared memory for
+ *         #MHD_OPTION_PREFORK_WORKERS
+ * @author Christian Grothoff
+ */
+
+#ifndef MHD_PREFORK_H
+#define MHD_PREFORK_H 1
+#include "internal.h"
+
+#if defined(HAVE_FORK) && defined(HAVE_MMAP) && defined(MAP_ANONYMOUS) && \
+  defined(SO_REUSEPORT) && defined(HAVE_POLL) && defined(HAVE_SYS_WAIT_H) && \
+  defined(MHD_PTHREAD_MUTEX_) && defined(HAVE_PTHREAD_MUTEXATTR_SETPSHARED)
+#define PREFORK_SUPPORT 1
+#else
+#define PREFORK_SUPPORT 0
+#endif
+
+
+#if PREFORK_SUPPORT
+
+/**
+ * Map the memory shared by the worker processes of @a daemon, sized
+ * for its options, and set @e prefork of @a daemon.
+ *
+ * @param daemon the (master) daemon, with its options parsed
+ * @return #MHD_YES on success, #MHD_NO on error (logged)
+ */
+int
+MHD_prefork_init_ (struct MHD_Daemon *daemon);
+
+
+/**
+ * Release what #MHD_prefork_init_() created.  Only the master
+ * process unmaps the shared memory, worker processes keep it until
+ * they exit.
+ *
+ * @param daemon the (master) daemon
+ */
+void
+MHD_prefork_destroy_ (struct MHD_Daemon *daemon);
+
+
+/**
+ * Fork the supervisor process, which forks the worker processes.
+ * Returns in the master process once all workers started, and in
+ * each worker process, which then has to complete the start of the
+ * daemon and call #MHD_prefork_worker_run_().
+ *
+ * @param daemon the (master) daemon, with its listen socket
+ * @return #MHD_YES on success, #MHD_NO if the workers failed to
+ *         start (only in the master process)
+ */
+int
+MHD_prefork_start_ (struct MHD_Daemon *daemon);
+
+
+/**
+ * Is this the process that started @a daemon?
+ *
+ * @param daemon the (master) daemon
+ * @return #MHD_YES in the master process, #MHD_NO in a worker
+ *         process or without #MHD_OPTION_PREFORK_WORKERS
+ */
+int
+MHD_prefork_is_master_ (const struct MHD_Daemon *daemon);
+
+
+/**
+ * Get the index of the worker process running @a daemon.
+ *
+ * @param daemon the (master) daemon
+ * @return index from 0, `UINT_MAX` in the master process
+ */
+unsigned int
+MHD_prefork_worker_ (const struct MHD_Daemon *daemon);
+
+
+/**
+ * Serve connections in a worker process until the master stops
+ * the daemon, then stop it and exit.
+ *
+ * @param daemon the (master) daemon, with its threads running
+ */
+void
+MHD_prefork_worker_run_ (struct MHD_Daemon *daemon);
+
+
+/**
+ * Exit if called in a worker process that failed to complete the
+ * start of the daemon, so that it does not return to the
+ * application; does nothing otherwise.
+ */
+void
+MHD_prefork_startup_failed_ (void);
+
+
+/**
+ * Stop the worker processes and the supervisor and wait for them.
+ *
+ * @param daemon the (master) daemon
+ */
+void
+MHD_prefork_stop_ (struct MHD_Daemon *daemon);
+
+
+/**
+ * Get the shared statistics of a thread of this worker process.
+ *
+ * @param daemon the (master) daemon
+ * @param thread 0 for @a daemon, i + 1 for its worker daemon i
+ * @return statistics to count in
+ */
+struct MHD_DaemonStats *
+MHD_prefork_stats_ (struct MHD_Daemon *daemon,
+                    unsigned int thread);
+
+
+/**
+ * Add the statistics of all worker processes, including those that
+ * exited, to @a sum.
+ *
+ * @param daemon the (master) daemon
+ * @param sum statistics to add to
+ */
+void
+MHD_prefork_add_stats_ (struct MHD_Daemon *daemon,
+                        struct MHD_DaemonStats *sum);
+
+
+/**
+ * Set the nonce-nc map and its locks of @a daemon to the ones in
+ * the shared memory.
+ *
+ * @param daemon the (master) daemon
+ */
+void
+MHD_prefork_nonce_nc_ (struct MHD_Daemon *daemon);
+
+
+/**
+ * Lock a mutex in the shared memory, recovering it if a worker
+ * process died while holding it.
+ *
+ * @param mutex mutex to lock
+ */
+void
+MHD_prefork_mutex_lock_ (MHD_mutex_ *mutex);
+
+
+/**
+ * Count a connection from an IP address in the shared table, see
+ * #MHD_OPTION_PER_IP_CONNECTION_LIMIT.
+ *
+ * @param daemon the (master) daemon
+ * @param family address family of @a ip
+ * @param ip the IP address
+ * @param len number of bytes in @a ip
+ * @return #MHD_YES if the address is below its limit, #MHD_NO if not
+ *         (or if the table is full)
+ */
+int
+MHD_prefork_ip_limit_add_ (struct MHD_Daemon *daemon,
+                           int family,
+                           const void *ip,
+                           size_t len);
+
+
+/**
+ * Remove a connection counted by #MHD_prefork_ip_limit_add_().
+ *
+ * @param daemon the (master) daemon
+ * @param family address family of @a ip
+ * @param ip the IP address
+ * @param len number of bytes in @a ip
+ */
+void
+MHD_prefork_ip_limit_del_ (struct MHD_Daemon *daemon,
+                           int family,
+                           const void *ip,
+                           size_t len);
+
+#else
+
+#define MHD_prefork_destroy_(daemon) ((void) (daemon))
+
+#define MHD_prefork_startup_failed_() ((void) 0)
+
+#define MHD_prefork_mutex_lock_(mutex) \
+  ((void) MHD_mutex_lock_ (mutex))
+
+#endif
+
+#endif
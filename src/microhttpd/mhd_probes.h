@@ -0,0 +1,80 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_probes.h
+ * @brief  USDT static probes for DTrace, SystemTap and bpftrace
+ * @author Christian Grothoff
+ *
+ * Probes are only compiled in with "configure --enable-dtrace".  An
+ * inactive probe is a single "nop" instruction; without
+ * --enable-dtrace the macros expand to nothing.  All probes belong to
+ * the provider "libmicrohttpd":
+ *
+ * - accept (connection, fd): #internal_add_connection() added a
+ *   connection
+ * - state_change (connection, old_state, new_state): the state
+ *   machine of #MHD_connection_handle_idle() moved on
+ * - read (connection, bytes): data was received into the read buffer
+ * - write (connection, bytes): data was sent on the socket, from the
+ *   write buffer or the response
+ * - sendfile_fallback (connection, errno): sendfile() failed and
+ *   send() is used instead
+ * - pool_exhausted (pool, size): a memory pool could not satisfy an
+ *   allocation
+ * - suspend (connection), resume (connection)
+ * - tls_handshake_start (connection): the TLS session was set up,
+ *   the handshake begins with the first data from the client
+ * - tls_handshake_done (connection, result): result is 0 on success,
+ *   negative on errors (see mhd_tls.h)
+ */
+
+#ifndef MHD_PROBES_H
+#define MHD_PROBES_H 1
+#include "platform.h"
+
+#if defined(MHD_USE_DTRACE_PROBES) && defined(HAVE_SYS_SDT_H)
+#include <sys/sdt.h>
+
+#define MHD_PROBE1(name,a) \
+  DTRACE_PROBE1 (libmicrohttpd, name, a)
+#define MHD_PROBE2(name,a,b) \
+  DTRACE_PROBE2 (libmicrohttpd, name, a, b)
+#define MHD_PROBE3(name,a,b,c) \
+  DTRACE_PROBE3 (libmicrohttpd, name, a, b, c)
+
+/**
+ * Fire the "state_change" probe if the state of @a c changed since
+ * the last time.
+ *
+ * @param c the connection
+ */
+#define MHD_PROBE_STATE_CHANGE(c) do { \
+    if ((c)->probe_state != (c)->state) { \
+      MHD_PROBE3 (state_change, (c), (int) (c)->probe_state, (int) (c)->state); \
+      (c)->probe_state = (c)->state; \
+    } } while (0)
+#else
+#define MHD_PROBE1(name,a) ((void) 0)
+#define MHD_PROBE2(name,a,b) ((void) 0)
+#define MHD_PROBE3(name,a,b,c) ((void) 0)
+#define MHD_PROBE_STATE_CHANGE(c) ((void) 0)
+#endif
+
+#endif /* MHD_PROBES_H */
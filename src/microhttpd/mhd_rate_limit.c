@@ -0,0 +1,355 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_rate_limit.c
+ * @brief  token buckets limiting the send and receive rate of
+ *         connections and daemons
+ * @author Christian Grothoff
+ *
+ * A bucket holds at most a tenth of a second worth of data; once it
+ * is empty, the connection is taken out of the event loop (see
+ * #MHD_EVENT_LOOP_INFO_THROTTLED) until the bucket is full again,
+ * so that a throttled connection costs one wakeup per tenth of a
+ * second instead of a busy loop on a writable socket.
+ */
+
+#include "mhd_rate_limit.h"
+#include "mhd_mono_clock.h"
+
+
+/**
+ * Get the maximum number of tokens of @a bucket.
+ *
+ * @param bucket bucket with a rate
+ * @return burst size in bytes
+ */
+static uint64_t
+bucket_burst (const struct MHD_TokenBucket *bucket)
+{
+  if (bucket->rate < 10)
+    return 1;
+  return bucket->rate / 10;
+}
+
+
+/**
+ * Add the tokens for the time passed since the last refill.
+ *
+ * @param bucket bucket to refill
+ * @param now current #MHD_monotonic_msec_counter() value
+ */
+static void
+bucket_refill (struct MHD_TokenBucket *bucket,
+               uint64_t now)
+{
+  const uint64_t burst = bucket_burst (bucket);
+  uint64_t add;
+
+  if (0 == bucket->rate)
+    return;
+  if ( (now < bucket->last_refill) ||
+       (now - bucket->last_refill >= 1000) )
+    {
+      bucket->tokens = burst;
+      bucket->last_refill = now;
+      return;
+    }
+  add = (now - bucket->last_refill) * bucket->rate / 1000;
+  if (0 == add)
+    return; /* keep accumulating time */
+  bucket->tokens += add;
+  if (bucket->tokens >= burst)
+    {
+      bucket->tokens = burst;
+      bucket->last_refill = now;
+      return;
+    }
+  /* only account for the time the tokens were added for */
+  bucket->last_refill += add * 1000 / bucket->rate;
+}
+
+
+/**
+ * Get the time at which an empty bucket is full again.
+ *
+ * @param bucket bucket to check (refilled)
+ * @param now current #MHD_monotonic_msec_counter() value
+ * @return 0 if the bucket is not empty (or there is no limit)
+ */
+static uint64_t
+bucket_wake (const struct MHD_TokenBucket *bucket,
+             uint64_t now)
+{
+  uint64_t wake;
+
+  if ( (0 == bucket->rate) ||
+       (0 != bucket->tokens) )
+    return 0;
+  wake = bucket->last_refill
+    + (bucket_burst (bucket) * 1000 + bucket->rate - 1) / bucket->rate;
+  if (wake <= now)
+    wake = now + 1;
+  return wake;
+}
+
+
+/**
+ * Set the rate of @a bucket and fill it.
+ *
+ * @param bucket bucket to initialize
+ * @param rate bytes per second, 0 for no limit
+ */
+void
+MHD_bucket_init_ (struct MHD_TokenBucket *bucket,
+                  uint64_t rate)
+{
+  bucket->rate = rate;
+  bucket->tokens = (0 == rate) ? 0 : bucket_burst (bucket);
+  bucket->last_refill = MHD_monotonic_msec_counter ();
+}
+
+
+/**
+ * Check if sending (or receiving) on @a connection is rate limited
+ * at all.
+ *
+ * @param connection connection to check
+ * @param send #MHD_YES for sending, #MHD_NO for receiving
+ * @return #MHD_YES if a limit applies
+ */
+int
+MHD_rate_limited_ (struct MHD_Connection *connection,
+                   int send)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+
+  if (MHD_YES == send)
+    return ( (0 != connection->send_bucket.rate) ||
+             (0 != daemon->send_bucket.rate) ) ? MHD_YES : MHD_NO;
+  return ( (0 != connection->recv_bucket.rate) ||
+           (0 != daemon->recv_bucket.rate) ) ? MHD_YES : MHD_NO;
+}
+
+
+/**
+ * Get the number of bytes the rate limits of @a connection and its
+ * daemon allow to send (or receive) right now.
+ *
+ * @param connection connection to transfer data on
+ * @param send #MHD_YES for sending, #MHD_NO for receiving
+ * @param want number of bytes to transfer
+ * @return at most @a want, 0 if the connection has to wait
+ */
+size_t
+MHD_rate_limit_allowance_ (struct MHD_Connection *connection,
+                           int send,
+                           size_t want)
+{
+  struct MHD_TokenBucket *cb;
+  struct MHD_TokenBucket *db;
+  uint64_t now;
+
+  if (MHD_NO == MHD_rate_limited_ (connection, send))
+    return want;
+  cb = (MHD_YES == send) ? &connection->send_bucket : &connection->recv_bucket;
+  db = (MHD_YES == send) ? &connection->daemon->send_bucket : &connection->daemon->recv_bucket;
+  now = MHD_monotonic_msec_counter ();
+  bucket_refill (cb, now);
+  bucket_refill (db, now);
+  if ( (0 != cb->rate) &&
+       (cb->tokens < want) )
+    want = (size_t) cb->tokens;
+  if ( (0 != db->rate) &&
+       (db->tokens < want) )
+    want = (size_t) db->tokens;
+  return want;
+}
+
+
+/**
+ * Take the bytes transferred from the buckets of @a connection and
+ * its daemon.
+ *
+ * @param connection connection data was transferred on
+ * @param send #MHD_YES for sending, #MHD_NO for receiving
+ * @param used number of bytes transferred
+ */
+void
+MHD_rate_limit_charge_ (struct MHD_Connection *connection,
+                        int send,
+                        size_t used)
+{
+  struct MHD_TokenBucket *cb;
+  struct MHD_TokenBucket *db;
+
+  cb = (MHD_YES == send) ? &connection->send_bucket : &connection->recv_bucket;
+  db = (MHD_YES == send) ? &connection->daemon->send_bucket : &connection->daemon->recv_bucket;
+  if (0 != cb->rate)
+    cb->tokens -= (cb->tokens < used) ? cb->tokens : used;
+  if (0 != db->rate)
+    db->tokens -= (db->tokens < used) ? db->tokens : used;
+}
+
+
+/**
+ * Remove @a connection from the throttled connections of its
+ * daemon, if it is there.
+ *
+ * @param connection connection to remove
+ */
+void
+MHD_rate_limit_remove_ (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+
+  if (0 == connection->throttle_wake)
+    return;
+  connection->throttle_wake = 0;
+  if (0 != (daemon->options & MHD_USE_THREAD_PER_CONNECTION))
+    return; /* the connection's thread waits itself */
+  if (NULL == connection->throttle_prev)
+    daemon->throttled_head = connection->throttle_next;
+  else
+    connection->throttle_prev->throttle_next = connection->throttle_next;
+  if (NULL == connection->throttle_next)
+    daemon->throttled_tail = connection->throttle_prev;
+  else
+    connection->throttle_next->throttle_prev = connection->throttle_prev;
+  connection->throttle_next = NULL;
+  connection->throttle_prev = NULL;
+}
+
+
+/**
+ * Check if @a connection has to wait for its rate limit before it
+ * can send (or receive) again; if so, remember when to have another
+ * look at it.  Otherwise the connection is no longer throttled.
+ *
+ * @param connection connection to check
+ * @param send #MHD_YES for sending, #MHD_NO for receiving
+ * @return #MHD_YES if the connection is throttled
+ */
+int
+MHD_rate_limit_check_ (struct MHD_Connection *connection,
+                       int send)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+  struct MHD_TokenBucket *cb;
+  struct MHD_TokenBucket *db;
+  uint64_t now;
+  uint64_t wake;
+  uint64_t dwake;
+
+  if (MHD_NO == MHD_rate_limited_ (connection, send))
+    {
+      MHD_rate_limit_remove_ (connection);
+      return MHD_NO;
+    }
+  now = MHD_monotonic_msec_counter ();
+  if (connection->throttle_wake > now)
+    return MHD_YES; /* wait for the full burst, not for a few bytes */
+  cb = (MHD_YES == send) ? &connection->send_bucket : &connection->recv_bucket;
+  db = (MHD_YES == send) ? &daemon->send_bucket : &daemon->recv_bucket;
+  bucket_refill (cb, now);
+  bucket_refill (db, now);
+  wake = bucket_wake (cb, now);
+  dwake = bucket_wake (db, now);
+  if (dwake > wake)
+    wake = dwake;
+  if (0 == wake)
+    {
+      MHD_rate_limit_remove_ (connection);
+      return MHD_NO;
+    }
+  if ( (0 == connection->throttle_wake) &&
+       (0 == (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) )
+    {
+      connection->throttle_prev = NULL;
+      connection->throttle_next = daemon->throttled_head;
+      if (NULL == daemon->throttled_tail)
+        daemon->throttled_tail = connection;
+      else
+        daemon->throttled_head->throttle_prev = connection;
+      daemon->throttled_head = connection;
+    }
+  connection->throttle_wake = wake;
+  return MHD_YES;
+}
+
+
+/**
+ * Run the idle handler of the throttled connections of @a daemon
+ * whose rate limit allows more data again.  Must be called from the
+ * thread running the event loop.
+ *
+ * @param daemon daemon to process
+ */
+void
+MHD_rate_limit_process_ (struct MHD_Daemon *daemon)
+{
+  struct MHD_Connection *pos;
+  struct MHD_Connection *next;
+  uint64_t now;
+
+  if (NULL == daemon->throttled_head)
+    return;
+  now = MHD_monotonic_msec_counter ();
+  next = daemon->throttled_head;
+  while (NULL != (pos = next))
+    {
+      next = pos->throttle_next;
+      if (pos->throttle_wake > now)
+        continue;
+      /* connections throttled again are put at the head and not
+         visited again in this round */
+      MHD_rate_limit_remove_ (pos);
+      if (MHD_YES == pos->suspended)
+        continue; /* the idle handler runs again on resume */
+      pos->idle_handler (pos);
+    }
+}
+
+
+/**
+ * Get the time until the first throttled connection of @a daemon
+ * may continue.
+ *
+ * @param daemon daemon to check
+ * @param[out] timeout set to the time left in milliseconds
+ * @return #MHD_YES if there are throttled connections
+ */
+int
+MHD_rate_limit_timeout_ (struct MHD_Daemon *daemon,
+                         uint64_t *timeout)
+{
+  struct MHD_Connection *pos;
+  uint64_t earliest;
+  uint64_t now;
+
+  if (NULL == daemon->throttled_head)
+    return MHD_NO;
+  earliest = daemon->throttled_head->throttle_wake;
+  for (pos = daemon->throttled_head; NULL != pos; pos = pos->throttle_next)
+    if (pos->throttle_wake < earliest)
+      earliest = pos->throttle_wake;
+  now = MHD_monotonic_msec_counter ();
+  *timeout = (earliest > now) ? earliest - now : 0;
+  return MHD_YES;
+}
@@ -0,0 +1,132 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_rate_limit.h
+ * @brief  token buckets limiting the send and receive rate of
+ *         connections and daemons
+ * @author Christian Grothoff
+ */
+
+#ifndef MHD_RATE_LIMIT_H
+#define MHD_RATE_LIMIT_H 1
+#include "internal.h"
+
+
+/**
+ * Set the rate of @a bucket and fill it.
+ *
+ * @param bucket bucket to initialize
+ * @param rate bytes per second, 0 for no limit
+ */
+void
+MHD_bucket_init_ (struct MHD_TokenBucket *bucket,
+                  uint64_t rate);
+
+
+/**
+ * Check if sending (or receiving) on @a connection is rate limited
+ * at all.
+ *
+ * @param connection connection to check
+ * @param send #MHD_YES for sending, #MHD_NO for receiving
+ * @return #MHD_YES if a limit applies
+ */
+int
+MHD_rate_limited_ (struct MHD_Connection *connection,
+                   int send);
+
+
+/**
+ * Get the number of bytes the rate limits of @a connection and its
+ * daemon allow to send (or receive) right now.
+ *
+ * @param connection connection to transfer data on
+ * @param send #MHD_YES for sending, #MHD_NO for receiving
+ * @param want number of bytes to transfer
+ * @return at most @a want, 0 if the connection has to wait
+ */
+size_t
+MHD_rate_limit_allowance_ (struct MHD_Connection *connection,
+                           int send,
+                           size_t want);
+
+
+/**
+ * Take the bytes transferred from the buckets of @a connection and
+ * its daemon.
+ *
+ * @param connection connection data was transferred on
+ * @param send #MHD_YES for sending, #MHD_NO for receiving
+ * @param used number of bytes transferred
+ */
+void
+MHD_rate_limit_charge_ (struct MHD_Connection *connection,
+                        int send,
+                        size_t used);
+
+
+/**
+ * Check if @a connection has to wait for its rate limit before it
+ * can send (or receive) again; if so, remember when to have another
+ * look at it.  Otherwise the connection is no longer throttled.
+ *
+ * @param connection connection to check
+ * @param send #MHD_YES for sending, #MHD_NO for receiving
+ * @return #MHD_YES if the connection is throttled
+ */
+int
+MHD_rate_limit_check_ (struct MHD_Connection *connection,
+                       int send);
+
+
+/**
+ * Remove @a connection from the throttled connections of its
+ * daemon, if it is there.
+ *
+ * @param connection connection to remove
+ */
+void
+MHD_rate_limit_remove_ (struct MHD_Connection *connection);
+
+
+/**
+ * Run the idle handler of the throttled connections of @a daemon
+ * whose rate limit allows more data again.  Must be called from the
+ * thread running the event loop.
+ *
+ * @param daemon daemon to process
+ */
+void
+MHD_rate_limit_process_ (struct MHD_Daemon *daemon);
+
+
+/**
+ * Get the time until the first throttled connection of @a daemon
+ * may continue.
+ *
+ * @param daemon daemon to check
+ * @param[out] timeout set to the time left in milliseconds
+ * @return #MHD_YES if there are throttled connections
+ */
+int
+MHD_rate_limit_timeout_ (struct MHD_Daemon *daemon,
+                         uint64_t *timeout);
+
+#endif
@@ -0,0 +1,675 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_router.c
+ * @brief  dispatching requests to access handlers by path and method,
+ *         see #MHD_router_add()
+ * @author Christian Grothoff
+ *
+ * The routes form a trie with one node per path segment.  The literal
+ * children of a node are kept sorted, so that each segment of the
+ * path of a request is looked up with a binary search; a node has
+ * at most one child for ":name" segments, whose names are kept by
+ * the routes, as different routes may name the same segment
+ * differently.  Lookups only read the trie, so that all threads of
+ * the daemons can use it without locking.
+ */
+
+#include "internal.h"
+#include "memorypool.h"
+
+
+/**
+ * Maximum number of parameters (":name" and "*") of a route.
+ */
+#define MHD_ROUTER_MAX_PARAMS 16
+
+
+/**
+ * A route: the handler for some methods of a path.
+ */
+struct MHD_Route
+{
+
+  /**
+   * Next route of the same node.
+   */
+  struct MHD_Route *next;
+
+  /**
+   * Handler for the requests of this route.
+   */
+  MHD_AccessHandlerCallback handler;
+
+  /**
+   * Extra argument to @e handler.
+   */
+  void *handler_cls;
+
+  /**
+   * Methods of the route, bitmask of `enum MHD_RouteMethod`.
+   */
+  unsigned int methods;
+
+  /**
+   * Number of entries in @e params.
+   */
+  unsigned int params_count;
+
+  /**
+   * Names of the parameters of the route in the order of the path,
+   * the last one is "*" for routes ending with "*".
+   */
+  char *params[MHD_ROUTER_MAX_PARAMS];
+};
+
+
+/**
+ * A node of the trie: a path segment.
+ */
+struct MHD_RouteNode
+{
+
+  /**
+   * The literal segment, empty for the root and ":name" nodes.
+   */
+  char *segment;
+
+  /**
+   * Number of bytes in @e segment.
+   */
+  size_t segment_len;
+
+  /**
+   * Literal children, sorted by their segment.
+   */
+  struct MHD_RouteNode **children;
+
+  /**
+   * Number of entries in @e children.
+   */
+  unsigned int children_count;
+
+  /**
+   * Child for ":name" segments, NULL if none.
+   */
+  struct MHD_RouteNode *param;
+
+  /**
+   * Routes of paths ending at this node.
+   */
+  struct MHD_Route *routes;
+
+  /**
+   * Routes of patterns ending with "*" after this node.
+   */
+  struct MHD_Route *wildcards;
+};
+
+
+/**
+ * A routing table.
+ */
+struct MHD_Router
+{
+
+  /**
+   * Root of the trie, for the path "/".
+   */
+  struct MHD_RouteNode root;
+
+  /**
+   * Route used if no other route matches.
+   */
+  struct MHD_Route fallback;
+};
+
+
+/**
+ * State of a lookup.
+ */
+struct RouteMatch
+{
+
+  /**
+   * Method of the request, one bit of `enum MHD_RouteMethod`.
+   */
+  unsigned int method;
+
+  /**
+   * Number of values in @e values.
+   */
+  unsigned int count;
+
+  /**
+   * Values of the parameters matched so far.
+   */
+  const char *values[MHD_ROUTER_MAX_PARAMS];
+
+  /**
+   * Lengths of the values in @e values.
+   */
+  size_t values_len[MHD_ROUTER_MAX_PARAMS];
+};
+
+
+/**
+ * Get the bit of `enum MHD_RouteMethod` for @a method.
+ *
+ * @param method the HTTP method of a request
+ * @return the bit for @a method
+ */
+static unsigned int
+method_bit (const char *method)
+{
+  static const struct
+  {
+    const char *name;
+    unsigned int bit;
+  } methods[] = {
+    { MHD_HTTP_METHOD_GET, MHD_ROUTE_GET },
+    { MHD_HTTP_METHOD_POST, MHD_ROUTE_POST },
+    { MHD_HTTP_METHOD_HEAD, MHD_ROUTE_HEAD },
+    { MHD_HTTP_METHOD_PUT, MHD_ROUTE_PUT },
+    { MHD_HTTP_METHOD_DELETE, MHD_ROUTE_DELETE },
+    { MHD_HTTP_METHOD_OPTIONS, MHD_ROUTE_OPTIONS },
+    { MHD_HTTP_METHOD_PATCH, MHD_ROUTE_PATCH },
+    { MHD_HTTP_METHOD_CONNECT, MHD_ROUTE_CONNECT },
+    { MHD_HTTP_METHOD_TRACE, MHD_ROUTE_TRACE }
+  };
+  unsigned int i;
+
+  for (i = 0; i < sizeof (methods) / sizeof (methods[0]); i++)
+    if (0 == strcmp (method, methods[i].name))
+      return methods[i].bit;
+  return MHD_ROUTE_OTHER;
+}
+
+
+/**
+ * Compare the segment of @a node with @a segment.
+ *
+ * @return <0, 0 or >0 like memcmp()
+ */
+static int
+segment_cmp (const struct MHD_RouteNode *node,
+             const char *segment,
+             size_t segment_len)
+{
+  int ret;
+
+  ret = memcmp (node->segment,
+                segment,
+                (node->segment_len < segment_len)
+                ? node->segment_len : segment_len);
+  if (0 != ret)
+    return ret;
+  if (node->segment_len == segment_len)
+    return 0;
+  return (node->segment_len < segment_len) ? -1 : 1;
+}
+
+
+/**
+ * Find the literal child of @a node for @a segment.
+ *
+ * @param node node to search
+ * @param segment segment to look for
+ * @param segment_len number of bytes in @a segment
+ * @param[out] pos set to the index of the child, or where it would
+ *             have to be inserted
+ * @return the child, NULL if there is none
+ */
+static struct MHD_RouteNode *
+find_child (const struct MHD_RouteNode *node,
+            const char *segment,
+            size_t segment_len,
+            unsigned int *pos)
+{
+  unsigned int lo;
+  unsigned int hi;
+  unsigned int mid;
+  int cmp;
+
+  lo = 0;
+  hi = node->children_count;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      cmp = segment_cmp (node->children[mid],
+                         segment,
+                         segment_len);
+      if (0 == cmp)
+        {
+          *pos = mid;
+          return node->children[mid];
+        }
+      if (cmp < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  *pos = lo;
+  return NULL;
+}
+
+
+/**
+ * Get the child of @a node for @a segment, creating it if needed.
+ *
+ * @param node parent node
+ * @param segment the segment, ":name" for a parameter
+ * @param segment_len number of bytes in @a segment
+ * @return NULL on error (out of memory)
+ */
+static struct MHD_RouteNode *
+add_child (struct MHD_RouteNode *node,
+           const char *segment,
+           size_t segment_len)
+{
+  struct MHD_RouteNode *child;
+  struct MHD_RouteNode **children;
+  unsigned int pos;
+
+  if ( (0 < segment_len) &&
+       (':' == segment[0]) )
+    {
+      if (NULL == node->param)
+        node->param = calloc (1, sizeof (struct MHD_RouteNode));
+      return node->param;
+    }
+  child = find_child (node,
+                      segment,
+                      segment_len,
+                      &pos);
+  if (NULL != child)
+    return child;
+  if (NULL == (child = calloc (1, sizeof (struct MHD_RouteNode))))
+    return NULL;
+  if (NULL == (child->segment = malloc (segment_len + 1)))
+    {
+      free (child);
+      return NULL;
+    }
+  memcpy (child->segment,
+          segment,
+          segment_len);
+  child->segment[segment_len] = '\0';
+  child->segment_len = segment_len;
+  children = realloc (node->children,
+                      (node->children_count + 1) * sizeof (struct MHD_RouteNode *));
+  if (NULL == children)
+    {
+      free (child->segment);
+      free (child);
+      return NULL;
+    }
+  memmove (&children[pos + 1],
+           &children[pos],
+           (node->children_count - pos) * sizeof (struct MHD_RouteNode *));
+  children[pos] = child;
+  node->children = children;
+  node->children_count++;
+  return child;
+}
+
+
+/**
+ * Find the route for the rest of a path with a route for the method
+ * of the request, preferring literal segments over ":name" segments
+ * over "*".
+ *
+ * @param node node matching the path before @a path
+ * @param path rest of the path after a '/'
+ * @param match state of the lookup, the parameters are added to it
+ * @return the route, NULL if there is none
+ */
+static const struct MHD_Route *
+match_node (const struct MHD_RouteNode *node,
+            const char *path,
+            struct RouteMatch *match)
+{
+  const struct MHD_Route *route;
+  const struct MHD_RouteNode *child;
+  const char *end;
+  unsigned int count;
+  unsigned int pos;
+  size_t len;
+
+  end = strchr (path, '/');
+  len = (NULL == end) ? strlen (path) : (size_t) (end - path);
+  count = match->count;
+  child = find_child (node,
+                      path,
+                      len,
+                      &pos);
+  if (NULL != child)
+    {
+      if (NULL == end)
+        {
+          for (route = child->routes; NULL != route; route = route->next)
+            if (0 != (route->methods & match->method))
+              return route;
+        }
+      else if (NULL != (route = match_node (child,
+                                            end + 1,
+                                            match)))
+        return route;
+      match->count = count;
+    }
+  if ( (NULL != node->param) &&
+       (0 != len) &&
+       (count < MHD_ROUTER_MAX_PARAMS) )
+    {
+      match->values[count] = path;
+      match->values_len[count] = len;
+      match->count = count + 1;
+      if (NULL == end)
+        {
+          for (route = node->param->routes; NULL != route; route = route->next)
+            if (0 != (route->methods & match->method))
+              return route;
+        }
+      else if (NULL != (route = match_node (node->param,
+                                            end + 1,
+                                            match)))
+        return route;
+      match->count = count;
+    }
+  for (route = node->wildcards; NULL != route; route = route->next)
+    if ( (0 != (route->methods & match->method)) &&
+         (count < MHD_ROUTER_MAX_PARAMS) )
+      {
+        match->values[count] = path;
+        match->values_len[count] = strlen (path);
+        match->count = count + 1;
+        return route;
+      }
+  return NULL;
+}
+
+
+/**
+ * Free @a node and all nodes and routes below it.
+ *
+ * @param node node to free
+ */
+static void
+free_node (struct MHD_RouteNode *node)
+{
+  struct MHD_Route *route;
+  unsigned int i;
+
+  for (i = 0; i < node->children_count; i++)
+    {
+      free_node (node->children[i]);
+      free (node->children[i]);
+    }
+  free (node->children);
+  if (NULL != node->param)
+    {
+      free_node (node->param);
+      free (node->param);
+    }
+  while (NULL != (route = node->routes))
+    {
+      node->routes = route->next;
+      for (i = 0; i < route->params_count; i++)
+        free (route->params[i]);
+      free (route);
+    }
+  while (NULL != (route = node->wildcards))
+    {
+      node->wildcards = route->next;
+      for (i = 0; i < route->params_count; i++)
+        free (route->params[i]);
+      free (route);
+    }
+  free (node->segment);
+}
+
+
+/**
+ * Create an empty routing table.
+ *
+ * @param fallback access handler for requests no route matches
+ * @param fallback_cls extra argument to @a fallback
+ * @return NULL on error (i.e. out of memory)
+ * @ingroup request
+ */
+struct MHD_Router *
+MHD_router_create (MHD_AccessHandlerCallback fallback,
+                   void *fallback_cls)
+{
+  struct MHD_Router *router;
+
+  if (NULL == fallback)
+    return NULL;
+  if (NULL == (router = calloc (1, sizeof (struct MHD_Router))))
+    return NULL;
+  router->fallback.handler = fallback;
+  router->fallback.handler_cls = fallback_cls;
+  router->fallback.methods = MHD_ROUTE_ANY;
+  return router;
+}
+
+
+/**
+ * Add a route to @a router.
+ *
+ * @param router router to add to
+ * @param methods methods the route is used for, a bitmask of
+ *        `enum MHD_RouteMethod`; #MHD_ROUTE_GET includes HEAD
+ * @param pattern path pattern, i.e. "/users/:id"
+ * @param handler access handler for the matching requests
+ * @param handler_cls extra argument to @a handler
+ * @return #MHD_YES on success, #MHD_NO on error (i.e. invalid
+ *         pattern, out of memory)
+ * @ingroup request
+ */
+int
+MHD_router_add (struct MHD_Router *router,
+                unsigned int methods,
+                const char *pattern,
+                MHD_AccessHandlerCallback handler,
+                void *handler_cls)
+{
+  struct MHD_RouteNode *node;
+  struct MHD_Route *route;
+  struct MHD_Route **tail;
+  const char *pos;
+  const char *end;
+  size_t len;
+  unsigned int i;
+
+  if ( (NULL == router) ||
+       (NULL == pattern) ||
+       (NULL == handler) ||
+       ('/' != pattern[0]) ||
+       (0 == (methods & MHD_ROUTE_ANY)) )
+    return MHD_NO;
+  if (NULL == (route = calloc (1, sizeof (struct MHD_Route))))
+    return MHD_NO;
+  route->handler = handler;
+  route->handler_cls = handler_cls;
+  route->methods = methods & MHD_ROUTE_ANY;
+  if (0 != (methods & MHD_ROUTE_GET))
+    route->methods |= MHD_ROUTE_HEAD;
+  /* validate and collect the names of the parameters first */
+  for (pos = &pattern[1]; ; pos = end + 1)
+    {
+      end = strchr (pos, '/');
+      len = (NULL == end) ? strlen (pos) : (size_t) (end - pos);
+      if ( (':' == pos[0]) ||
+           ( (1 == len) &&
+             ('*' == pos[0]) ) )
+        {
+          if ( (MHD_ROUTER_MAX_PARAMS == route->params_count) ||
+               ( ('*' == pos[0]) &&
+                 (NULL != end) ) ||
+               ( (':' == pos[0]) &&
+                 (1 == len) ) )
+            goto error;
+          if (':' == pos[0])
+            {
+              pos++;
+              len--;
+            }
+          if (NULL == (route->params[route->params_count] = malloc (len + 1)))
+            goto error;
+          memcpy (route->params[route->params_count],
+                  pos,
+                  len);
+          route->params[route->params_count][len] = '\0';
+          route->params_count++;
+        }
+      if (NULL == end)
+        break;
+    }
+  node = &router->root;
+  for (pos = &pattern[1]; ; pos = end + 1)
+    {
+      end = strchr (pos, '/');
+      len = (NULL == end) ? strlen (pos) : (size_t) (end - pos);
+      if ( (NULL == end) &&
+           (1 == len) &&
+           ('*' == pos[0]) )
+        {
+          tail = &node->wildcards;
+          break;
+        }
+      if (NULL == (node = add_child (node,
+                                     pos,
+                                     len)))
+        goto error;
+      if (NULL == end)
+        {
+          tail = &node->routes;
+          break;
+        }
+    }
+  /* routes added first take precedence */
+  while (NULL != *tail)
+    tail = &(*tail)->next;
+  *tail = route;
+  return MHD_YES;
+ error:
+  for (i = 0; i < route->params_count; i++)
+    free (route->params[i]);
+  free (route);
+  return MHD_NO;
+}
+
+
+/**
+ * Destroy a routing table.
+ *
+ * @param router router to destroy
+ * @ingroup request
+ */
+void
+MHD_router_destroy (struct MHD_Router *router)
+{
+  if (NULL == router)
+    return;
+  free_node (&router->root);
+  free (router);
+}
+
+
+/**
+ * Access handler dispatching the requests of a connection to the
+ * handler of the matching route.
+ *
+ * @param cls the `struct MHD_Router`
+ * @param connection the connection identifying the client
+ * @param url the requested url
+ * @param method the HTTP method used
+ * @param version the HTTP version string
+ * @param upload_data the data being uploaded
+ * @param upload_data_size set to the size of @a upload_data
+ * @param con_cls pointer for the handler of the route
+ * @return what the handler of the route returned; #MHD_NO if the
+ *         parameters do not fit into the memory of the connection
+ * @ingroup request
+ */
+int
+MHD_router_access_handler (void *cls,
+                           struct MHD_Connection *connection,
+                           const char *url,
+                           const char *method,
+                           const char *version,
+                           const char *upload_data,
+                           size_t *upload_data_size,
+                           void **con_cls)
+{
+  const struct MHD_Router *router = cls;
+  const struct MHD_Route *route;
+  struct RouteMatch match;
+  char *value;
+  unsigned int i;
+
+  route = connection->route;
+  if (NULL == route)
+    {
+      match.method = method_bit (method);
+      match.count = 0;
+      route = NULL;
+      if ('/' == url[0])
+        route = match_node (&router->root,
+                            &url[1],
+                            &match);
+      if (NULL == route)
+        {
+          route = &router->fallback;
+          match.count = 0;
+        }
+      for (i = 0; i < match.count; i++)
+        {
+          value = MHD_pool_allocate (connection->pool,
+                                     match.values_len[i] + 1,
+                                     MHD_YES);
+          if (NULL == value)
+            return MHD_NO;
+          memcpy (value,
+                  match.values[i],
+                  match.values_len[i]);
+          value[match.values_len[i]] = '\0';
+          if (MHD_NO == MHD_set_connection_value_n (connection,
+                                                    MHD_ROUTE_PARAMETER_KIND,
+                                                    route->params[i],
+                                                    strlen (route->params[i]),
+                                                    value,
+                                                    match.values_len[i]))
+            return MHD_NO;
+        }
+      connection->route = route;
+    }
+  return route->handler (route->handler_cls,
+                         connection,
+                         url,
+                         method,
+                         version,
+                         upload_data,
+                         upload_data_size,
+                         con_cls);
+}
+
+/* end of mhd_router.c */
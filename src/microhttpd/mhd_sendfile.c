@@ -0,0 +1,221 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_sendfile.c
+ * @brief  sendfile() variants of the BSDs, Darwin and Solaris, which
+ *         send a header together with the file, and read-ahead hints
+ *         for file responses
+ * @author Christian Grothoff
+ *
+ * W32 has TransmitFile(), but it blocks on non-overlapped sockets
+ * until the whole range is sent (and client editions of W32 run at
+ * most two transmissions at once), so file responses keep using the
+ * content reader there.
+ */
+
+#include "mhd_sendfile.h"
+#include "mhd_limits.h"
+#if HAVE_FREEBSD_SENDFILE || HAVE_DARWIN_SENDFILE
+/* for sendfile() and 'struct sf_hdtr' */
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+#if HAVE_SENDFILEV
+#include <sys/sendfile.h>
+#endif
+#if HAVE_POSIX_FADVISE || HAVE_READAHEAD
+#include <fcntl.h>
+#endif
+
+
+#if HAVE_FREEBSD_SENDFILE && defined(SF_NODISKIO)
+/**
+ * Maximum number of bytes sent with a sendfile() that may wait for
+ * the disk, after one with SF_NODISKIO found the data missing from
+ * the page cache.
+ */
+#define MHD_SENDFILE_DISK_CHUNK (64 * 1024)
+#endif
+
+
+#if MHD_SENDFILE_WITH_HEADER_
+/**
+ * Send @a header_len bytes from @a header followed by up to @a len
+ * bytes of the file @a fd starting at @a offset to @a sock, with a
+ * single system call and without copying the file through user
+ * space.  Where the platform can tell, file data that is not in the
+ * page cache is first requested with a read-ahead hint and then
+ * sent in a bounded chunk, so that the event loop blocks on the
+ * disk for a short while at most.
+ *
+ * @param sock non-blocking socket to send to
+ * @param fd file to send from
+ * @param offset offset in @a fd, at most `OFF_T_MAX`
+ * @param len number of bytes of @a fd to send, must not be zero
+ * @param header data to send first, may be NULL if @a header_len is 0
+ * @param header_len number of bytes in @a header
+ * @return number of bytes sent (header included), -1 on error with
+ *         errno set; EAGAIN if nothing could be sent
+ */
+ssize_t
+MHD_sendfile_with_header_ (MHD_socket sock,
+                           int fd,
+                           uint64_t offset,
+                           size_t len,
+                           const void *header,
+                           size_t header_len)
+{
+#if HAVE_FREEBSD_SENDFILE || HAVE_DARWIN_SENDFILE
+  struct sf_hdtr hdtr;
+  struct iovec hiov;
+#endif
+#if HAVE_FREEBSD_SENDFILE
+  off_t sent;
+  int ret;
+#elif HAVE_DARWIN_SENDFILE
+  off_t sent;
+#elif HAVE_SENDFILEV
+  struct sendfilevec vec[2];
+  size_t sent;
+  int cnt;
+#endif
+
+  if (len > (size_t) (SSIZE_MAX - header_len))
+    len = SSIZE_MAX - header_len; /* return value limit */
+#if HAVE_FREEBSD_SENDFILE || HAVE_DARWIN_SENDFILE
+  hiov.iov_base = (void *) header;
+  hiov.iov_len = header_len;
+  hdtr.headers = &hiov;
+  hdtr.hdr_cnt = (0 != header_len) ? 1 : 0;
+  hdtr.trailers = NULL;
+  hdtr.trl_cnt = 0;
+#endif
+#if HAVE_FREEBSD_SENDFILE
+  /* with a non-blocking socket, a partial write fails with EAGAIN
+     but still reports the bytes sent */
+  sent = 0;
+#ifdef SF_NODISKIO
+  ret = sendfile (fd, sock, (off_t) offset, len,
+                  &hdtr, &sent, SF_NODISKIO);
+  if ( (0 != ret) &&
+       (0 == sent) &&
+       (EBUSY == errno) )
+    {
+      /* not cached: start reading the rest, wait for a little only */
+      MHD_file_readahead_ (fd, offset, len);
+      if (len > MHD_SENDFILE_DISK_CHUNK)
+        len = MHD_SENDFILE_DISK_CHUNK;
+      ret = sendfile (fd, sock, (off_t) offset, len,
+                      &hdtr, &sent, 0);
+    }
+#else
+  ret = sendfile (fd, sock, (off_t) offset, len,
+                  &hdtr, &sent, 0);
+#endif
+  if ( (0 != ret) &&
+       (0 == sent) )
+    return -1;
+  return (ssize_t) sent;
+#elif HAVE_DARWIN_SENDFILE
+  /* the length is passed in and out; zero would mean "until EOF" */
+  sent = (off_t) len;
+  if ( (0 != sendfile (fd, sock, (off_t) offset, &sent,
+                       (0 != header_len) ? &hdtr : NULL, 0)) &&
+       (0 == sent) )
+    return -1;
+  return (ssize_t) sent;
+#elif HAVE_SENDFILEV
+  cnt = 0;
+  if (0 != header_len)
+    {
+      vec[cnt].sfv_fd = SFV_FD_SELF;
+      vec[cnt].sfv_flag = 0;
+      vec[cnt].sfv_off = (off_t) (intptr_t) header;
+      vec[cnt].sfv_len = header_len;
+      cnt++;
+    }
+  vec[cnt].sfv_fd = fd;
+  vec[cnt].sfv_flag = 0;
+  vec[cnt].sfv_off = (off_t) offset;
+  vec[cnt].sfv_len = len;
+  cnt++;
+  sent = 0;
+  if ( (-1 == sendfilev (sock, vec, cnt, &sent)) &&
+       (0 == sent) )
+    return -1;
+  return (ssize_t) sent;
+#endif
+}
+#endif
+
+
+/**
+ * Ask the kernel to start reading @a len bytes of @a fd at @a offset
+ * into the page cache, without waiting for it.  Does nothing where
+ * no such hint exists.
+ *
+ * @param fd file to read ahead
+ * @param offset offset of the data in @a fd
+ * @param len number of bytes
+ */
+void
+MHD_file_readahead_ (int fd,
+                     uint64_t offset,
+                     uint64_t len)
+{
+  if ( (offset > (uint64_t) OFF_T_MAX) ||
+       (len > (uint64_t) OFF_T_MAX - offset) )
+    return;
+#if HAVE_POSIX_FADVISE && defined(POSIX_FADV_WILLNEED)
+  (void) posix_fadvise (fd,
+                        (off_t) offset,
+                        (off_t) len,
+                        POSIX_FADV_WILLNEED);
+#elif HAVE_READAHEAD
+  (void) readahead (fd,
+                    (off_t) offset,
+                    (size_t) len);
+#else
+  (void) fd;
+#endif
+}
+
+
+/**
+ * Tell the kernel that @a fd will be read sequentially, so that it
+ * reads ahead more aggressively.  Does nothing where no such hint
+ * exists.
+ *
+ * @param fd file of a response
+ */
+void
+MHD_file_sequential_ (int fd)
+{
+#if HAVE_POSIX_FADVISE && defined(POSIX_FADV_SEQUENTIAL)
+  (void) posix_fadvise (fd,
+                        0,
+                        0,
+                        POSIX_FADV_SEQUENTIAL);
+#else
+  (void) fd;
+#endif
+}
+
+/* end of mhd_sendfile.c */
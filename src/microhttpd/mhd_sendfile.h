@@ -0,0 +1,104 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_sendfile.h
+ * @brief  sendfile() variants of the BSDs, Darwin and Solaris, which
+ *         send a header together with the file, and read-ahead hints
+ *         for file responses
+ * @author Christian Grothoff
+ */
+
+#ifndef MHD_SENDFILE_H
+#define MHD_SENDFILE_H 1
+#include "internal.h"
+
+#if HAVE_FREEBSD_SENDFILE || HAVE_DARWIN_SENDFILE || HAVE_SENDFILEV
+/**
+ * Defined if MHD_sendfile_with_header_() is available.  Linux has
+ * sendfile() as well, but cannot pass a header along; it is used
+ * directly by send_param_adapter().
+ */
+#define MHD_SENDFILE_WITH_HEADER_ 1
+#endif
+
+/**
+ * Number of bytes at the start of the body of a file response that
+ * the kernel is asked to read ahead while the header is sent.  Also
+ * the minimum size of a body for which the hint is given: smaller
+ * files are read with a single call anyway.
+ */
+#define MHD_FILE_READAHEAD_SIZE (128 * 1024)
+
+
+#if MHD_SENDFILE_WITH_HEADER_
+/**
+ * Send @a header_len bytes from @a header followed by up to @a len
+ * bytes of the file @a fd starting at @a offset to @a sock, with a
+ * single system call and without copying the file through user
+ * space.  Where the platform can tell, file data that is not in the
+ * page cache is first requested with a read-ahead hint and then
+ * sent in a bounded chunk, so that the event loop blocks on the
+ * disk for a short while at most.
+ *
+ * @param sock non-blocking socket to send to
+ * @param fd file to send from
+ * @param offset offset in @a fd, at most `OFF_T_MAX`
+ * @param len number of bytes of @a fd to send, must not be zero
+ * @param header data to send first, may be NULL if @a header_len is 0
+ * @param header_len number of bytes in @a header
+ * @return number of bytes sent (header included), -1 on error with
+ *         errno set; EAGAIN if nothing could be sent
+ */
+ssize_t
+MHD_sendfile_with_header_ (MHD_socket sock,
+                           int fd,
+                           uint64_t offset,
+                           size_t len,
+                           const void *header,
+                           size_t header_len);
+#endif
+
+
+/**
+ * Ask the kernel to start reading @a len bytes of @a fd at @a offset
+ * into the page cache, without waiting for it.  Does nothing where
+ * no such hint exists.
+ *
+ * @param fd file to read ahead
+ * @param offset offset of the data in @a fd
+ * @param len number of bytes
+ */
+void
+MHD_file_readahead_ (int fd,
+                     uint64_t offset,
+                     uint64_t len);
+
+
+/**
+ * Tell the kernel that @a fd will be read sequentially, so that it
+ * reads ahead more aggressively.  Does nothing where no such hint
+ * exists.
+ *
+ * @param fd file of a response
+ */
+void
+MHD_file_sequential_ (int fd);
+
+#endif
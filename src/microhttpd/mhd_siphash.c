@@ -0,0 +1,188 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_siphash.c
+ * @brief  keyed hash for tables indexed by data of the clients
+ * @author Christian Grothoff
+ *
+ * With an unkeyed hash, a client that can pick the values (say, by
+ * connecting from many addresses of its network) can put all of
+ * them into the same bucket and turn each lookup into a walk over
+ * all entries.  SipHash-2-4 with a random key per table prevents
+ * that.
+ */
+
+#include "mhd_siphash.h"
+#include "microhttpd.h"
+#include "mhd_mono_clock.h"
+
+
+/**
+ * Rotate @a x left by @a b bits.
+ */
+#define ROTL(x,b) (uint64_t) (((x) << (b)) | ((x) >> (64 - (b))))
+
+/**
+ * One SipRound on the state @a v.
+ */
+#define SIPROUND(v)                                                     \
+  do {                                                                  \
+    v[0] += v[1]; v[1] = ROTL (v[1], 13); v[1] ^= v[0];                 \
+    v[0] = ROTL (v[0], 32);                                             \
+    v[2] += v[3]; v[3] = ROTL (v[3], 16); v[3] ^= v[2];                 \
+    v[0] += v[3]; v[3] = ROTL (v[3], 21); v[3] ^= v[0];                 \
+    v[2] += v[1]; v[1] = ROTL (v[1], 17); v[1] ^= v[2];                 \
+    v[2] = ROTL (v[2], 32);                                             \
+  } while (0)
+
+
+/**
+ * Fill @a key with random bytes, so that clients cannot predict
+ * which of their values collide in a hash table.
+ *
+ * @param[out] key key to generate
+ */
+void
+MHD_siphash_key_ (uint64_t key[2])
+{
+#ifndef _WIN32
+  int fd;
+  ssize_t got;
+
+  fd = open ("/dev/urandom", O_RDONLY);
+  if (-1 != fd)
+    {
+      got = read (fd, key, 2 * sizeof (uint64_t));
+      close (fd);
+      if ((ssize_t) (2 * sizeof (uint64_t)) == got)
+        return;
+    }
+#endif
+  /* no random device; the time and the address of the stack are
+     still not known to a remote client */
+  key[0] = ((uint64_t) time (NULL) << 32) ^ MHD_monotonic_msec_counter ();
+  key[1] = (uint64_t) (uintptr_t) &fd;
+#ifndef _WIN32
+  key[1] ^= (uint64_t) getpid () << 32;
+#endif
+  key[0] = MHD_siphash_ (key, key, 2 * sizeof (uint64_t));
+  key[1] = MHD_siphash_ (key, key, 2 * sizeof (uint64_t));
+}
+
+
+/**
+ * Compute SipHash-2-4 of @a data, optionally folding ASCII letters
+ * to lower case while loading the message words.
+ *
+ * @param key key from #MHD_siphash_key_()
+ * @param data data to hash
+ * @param len number of bytes in @a data
+ * @param caseless #MHD_YES to hash @a data as if it were in lower case
+ * @return the hash
+ */
+static uint64_t
+siphash (const uint64_t key[2],
+         const void *data,
+         size_t len,
+         int caseless)
+{
+  const uint8_t *in = data;
+  uint64_t v[4];
+  uint64_t m;
+  uint8_t c;
+  size_t left;
+  unsigned int i;
+
+  v[0] = key[0] ^ 0x736f6d6570736575ULL;
+  v[1] = key[1] ^ 0x646f72616e646f6dULL;
+  v[2] = key[0] ^ 0x6c7967656e657261ULL;
+  v[3] = key[1] ^ 0x7465646279746573ULL;
+  for (left = len; left >= 8; left -= 8)
+    {
+      m = 0;
+      for (i = 0; i < 8; i++)
+        {
+          c = in[i];
+          if ( (MHD_YES == caseless) &&
+               (c >= 'A') && (c <= 'Z') )
+            c += 'a' - 'A';
+          m |= (uint64_t) c << (8 * i);
+        }
+      in += 8;
+      v[3] ^= m;
+      SIPROUND (v);
+      SIPROUND (v);
+      v[0] ^= m;
+    }
+  m = (uint64_t) len << 56;
+  for (i = 0; i < left; i++)
+    {
+      c = in[i];
+      if ( (MHD_YES == caseless) &&
+           (c >= 'A') && (c <= 'Z') )
+        c += 'a' - 'A';
+      m |= (uint64_t) c << (8 * i);
+    }
+  v[3] ^= m;
+  SIPROUND (v);
+  SIPROUND (v);
+  v[0] ^= m;
+  v[2] ^= 0xff;
+  for (i = 0; i < 4; i++)
+    SIPROUND (v);
+  return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+
+/**
+ * Compute SipHash-2-4 of @a data.
+ *
+ * @param key key from #MHD_siphash_key_()
+ * @param data data to hash
+ * @param len number of bytes in @a data
+ * @return the hash
+ */
+uint64_t
+MHD_siphash_ (const uint64_t key[2],
+              const void *data,
+              size_t len)
+{
+  return siphash (key, data, len, MHD_NO);
+}
+
+
+/**
+ * Compute SipHash-2-4 of @a data with ASCII letters folded to lower
+ * case, so that names differing only in case hash the same.
+ *
+ * @param key key from #MHD_siphash_key_()
+ * @param data data to hash
+ * @param len number of bytes in @a data
+ * @return the hash
+ */
+uint64_t
+MHD_siphash_caseless_ (const uint64_t key[2],
+                       const void *data,
+                       size_t len)
+{
+  return siphash (key, data, len, MHD_YES);
+}
+
+/* end of mhd_siphash.c */
@@ -0,0 +1,69 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_siphash.h
+ * @brief  keyed hash for tables indexed by data of the clients
+ * @author Christian Grothoff
+ */
+
+#ifndef MHD_SIPHASH_H
+#define MHD_SIPHASH_H 1
+#include "platform.h"
+
+
+/**
+ * Fill @a key with random bytes, so that clients cannot predict
+ * which of their values collide in a hash table.
+ *
+ * @param[out] key key to generate
+ */
+void
+MHD_siphash_key_ (uint64_t key[2]);
+
+
+/**
+ * Compute SipHash-2-4 of @a data.
+ *
+ * @param key key from #MHD_siphash_key_()
+ * @param data data to hash
+ * @param len number of bytes in @a data
+ * @return the hash
+ */
+uint64_t
+MHD_siphash_ (const uint64_t key[2],
+              const void *data,
+              size_t len);
+
+
+/**
+ * Compute SipHash-2-4 of @a data with ASCII letters folded to lower
+ * case, so that names differing only in case hash the same.
+ *
+ * @param key key from #MHD_siphash_key_()
+ * @param data data to hash
+ * @param len number of bytes in @a data
+ * @return the hash
+ */
+uint64_t
+MHD_siphash_caseless_ (const uint64_t key[2],
+                       const void *data,
+                       size_t len);
+
+#endif
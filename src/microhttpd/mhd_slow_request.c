@@ -0,0 +1,192 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_slow_request.c
+ * @brief  timelines of slow requests
+ * @author Christian Grothoff
+ *
+ * Each state a request enters in MHD_connection_handle_idle() is
+ * recorded with a timestamp and the counters of the request into a
+ * ring in the connection; the byte and call counters are kept up by
+ * #MHD_COUNT_IO_().  Only once a request turns out to be slow is the
+ * ring put in order and passed to the application.
+ */
+
+#include "mhd_slow_request.h"
+#include "memorypool.h"
+#include "mhd_mono_clock.h"
+
+
+/**
+ * Record the state @a connection entered as a step of the timeline
+ * of its request.
+ *
+ * @param connection connection being processed
+ */
+void
+MHD_slow_request_step_ (struct MHD_Connection *connection)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+  struct MHD_SlowRequestState *sr = connection->slow_request;
+  struct MHD_SlowRequestStep *step;
+
+  if (NULL == sr)
+    {
+      sr = malloc (sizeof (struct MHD_SlowRequestState));
+      if (NULL == sr)
+        return;
+      connection->slow_request = sr;
+      MHD_slow_request_reset_ (connection);
+    }
+  sr->state = connection->state;
+  step = &sr->steps[sr->num_steps % MHD_SLOW_REQUEST_STEPS];
+  sr->num_steps++;
+  step->state = MHD_state_to_string (connection->state);
+  step->time = MHD_monotonic_usec_counter ();
+  if ( (0 == (daemon->options & MHD_USE_THREAD_PER_CONNECTION)) &&
+       (0 != daemon->loop_woke_usec) &&
+       (step->time > daemon->loop_woke_usec) )
+    step->loop_lag = step->time - daemon->loop_woke_usec;
+  else
+    step->loop_lag = 0;
+  step->bytes_received = sr->bytes_received;
+  step->bytes_sent = sr->bytes_sent;
+  step->reads = sr->bytes_received_calls;
+  step->writes = sr->bytes_sent_calls;
+  step->pool_used = (NULL != connection->pool)
+    ? daemon->pool_size - MHD_pool_get_free (connection->pool)
+    : 0;
+}
+
+
+/**
+ * Start the timeline of the next request of @a connection.
+ *
+ * @param connection connection whose request completed
+ */
+void
+MHD_slow_request_reset_ (struct MHD_Connection *connection)
+{
+  struct MHD_SlowRequestState *sr = connection->slow_request;
+
+  if (NULL == sr)
+    return;
+  sr->bytes_received = 0;
+  sr->bytes_sent = 0;
+  sr->bytes_received_calls = 0;
+  sr->bytes_sent_calls = 0;
+  sr->sendfile_fallbacks = 0;
+  sr->num_steps = 0;
+  /* the next round of MHD_connection_handle_idle() records a step */
+  sr->state = MHD_CONNECTION_CLOSED;
+}
+
+
+/**
+ * Pass the timeline of the request of @a connection to the
+ * #MHD_OPTION_SLOW_REQUEST_CALLBACK if it was slow: called when
+ * the response was sent completely or the connection is closed.
+ *
+ * @param connection connection of the request
+ * @param aborted #MHD_YES if the connection is closed before the
+ *        response was sent completely
+ * @param termination_code why the connection is closed
+ */
+void
+MHD_slow_request_done_ (struct MHD_Connection *connection,
+                        int aborted,
+                        enum MHD_RequestTerminationCode termination_code)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+  struct MHD_SlowRequestState *sr = connection->slow_request;
+  struct MHD_SlowRequest report;
+  unsigned int first;
+  unsigned int i;
+  uint64_t end;
+
+  if ( (NULL == sr) ||
+       (NULL == daemon->slow_request_callback) ||
+       (0 == connection->request_times.first_byte) )
+    return;
+  end = (MHD_YES == aborted)
+    ? MHD_monotonic_usec_counter ()
+    : connection->request_times.body_sent;
+  if (end < connection->request_times.first_byte)
+    end = connection->request_times.first_byte;
+  if ( (MHD_YES == aborted) &&
+       (sr->state != connection->state) )
+    MHD_slow_request_step_ (connection);
+  if ( ( (MHD_NO == aborted) ||
+         (MHD_REQUEST_TERMINATED_TIMEOUT_REACHED != termination_code) ) &&
+       ( (0 == daemon->slow_request_threshold) ||
+         (end - connection->request_times.first_byte
+          < (uint64_t) daemon->slow_request_threshold * 1000) ) )
+    return;
+  report.times = connection->request_times;
+  report.duration = end - connection->request_times.first_byte;
+  report.tls_handshake = connection->tls_handshake_usec;
+  report.bytes_received = sr->bytes_received;
+  report.bytes_sent = sr->bytes_sent;
+  report.reads = sr->bytes_received_calls;
+  report.writes = sr->bytes_sent_calls;
+  report.sendfile_fallbacks = sr->sendfile_fallbacks;
+  report.pool_peak = (NULL != connection->pool)
+    ? MHD_pool_get_peak (connection->pool)
+    : 0;
+  report.method = connection->method;
+  report.url = connection->url;
+  report.status = (NULL != connection->response)
+    ? connection->responseCode
+    : 0;
+  report.aborted = aborted;
+  report.termination_code = termination_code;
+  if (sr->num_steps <= MHD_SLOW_REQUEST_STEPS)
+    {
+      report.num_steps = sr->num_steps;
+      report.steps_dropped = 0;
+      first = 0;
+    }
+  else
+    {
+      report.num_steps = MHD_SLOW_REQUEST_STEPS;
+      report.steps_dropped = sr->num_steps - MHD_SLOW_REQUEST_STEPS;
+      first = sr->num_steps % MHD_SLOW_REQUEST_STEPS;
+    }
+  for (i = 0; i < report.num_steps; i++)
+    report.steps[i] = sr->steps[(first + i) % MHD_SLOW_REQUEST_STEPS];
+  daemon->slow_request_callback (daemon->slow_request_callback_cls,
+                                 connection,
+                                 &report);
+}
+
+
+/**
+ * Free the timeline of @a connection.
+ *
+ * @param connection connection that is freed
+ */
+void
+MHD_slow_request_free_ (struct MHD_Connection *connection)
+{
+  free (connection->slow_request);
+  connection->slow_request = NULL;
+}
+
+/* end of mhd_slow_request.c */
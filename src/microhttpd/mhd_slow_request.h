@@ -0,0 +1,87 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_slow_request.h
+ * @brief  timelines of slow requests
+ * @author Christian Grothoff
+ */
+
+#ifndef MHD_SLOW_REQUEST_H
+#define MHD_SLOW_REQUEST_H 1
+#include "internal.h"
+
+
+/**
+ * Record a step if the state of @a connection changed since the last
+ * one and its daemon samples slow requests.
+ *
+ * @param c connection being processed
+ */
+#define MHD_SLOW_REQUEST_STEP_(c) do { \
+    if ( (NULL != (c)->daemon->slow_request_callback) && \
+         ( (NULL == (c)->slow_request) || \
+           ((c)->slow_request->state != (c)->state) ) ) \
+      MHD_slow_request_step_ (c); } while (0)
+
+
+/**
+ * Record the state @a connection entered as a step of the timeline
+ * of its request.
+ *
+ * @param connection connection being processed
+ */
+void
+MHD_slow_request_step_ (struct MHD_Connection *connection);
+
+
+/**
+ * Start the timeline of the next request of @a connection.
+ *
+ * @param connection connection whose request completed
+ */
+void
+MHD_slow_request_reset_ (struct MHD_Connection *connection);
+
+
+/**
+ * Pass the timeline of the request of @a connection to the
+ * #MHD_OPTION_SLOW_REQUEST_CALLBACK if it was slow: called when
+ * the response was sent completely or the connection is closed.
+ *
+ * @param connection connection of the request
+ * @param aborted #MHD_YES if the connection is closed before the
+ *        response was sent completely
+ * @param termination_code why the connection is closed
+ */
+void
+MHD_slow_request_done_ (struct MHD_Connection *connection,
+                        int aborted,
+                        enum MHD_RequestTerminationCode termination_code);
+
+
+/**
+ * Free the timeline of @a connection.
+ *
+ * @param connection connection that is freed
+ */
+void
+MHD_slow_request_free_ (struct MHD_Connection *connection);
+
+#endif
@@ -0,0 +1,759 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+/**
+ * @file microhttpd/mhd_stream.c
+ * @brief  responses whose body the application pushes, see
+ *         #MHD_create_response_stream()
+ * @author Christian Grothoff
+ *
+ * The application hands its buffers to the stream, which keeps them
+ * in a queue bounded by the number of bytes not sent yet; they are
+ * copied only if the application does not pass a free callback.  The
+ * connection sends the queued buffers straight from the application
+ * memory, with sendmsg() several at once, and waits (suspended) for
+ * the next write once the queue is empty.  The application learns
+ * that the queue has room again, or that the connection is gone,
+ * from the callback of the stream.
+ */
+
+#include "mhd_stream.h"
+
+
+/**
+ * Maximum length of the chunk-size line of a buffer: 16 hex digits
+ * and CRLF.
+ */
+#define MHD_STREAM_HEADER_MAX 18
+
+
+/**
+ * A buffer written to a stream.
+ */
+struct MHD_StreamBuffer
+{
+
+  /**
+   * Next buffer in the queue.
+   */
+  struct MHD_StreamBuffer *next;
+
+  /**
+   * The data, owned by the application if @e free_cb is set,
+   * otherwise a copy following this struct.
+   */
+  const char *data;
+
+  /**
+   * Number of bytes in @e data.
+   */
+  size_t size;
+
+  /**
+   * Called to release @e data once it was sent, may be NULL.
+   */
+  MHD_ContentReaderFreeCallback free_cb;
+
+  /**
+   * Closure for @e free_cb.
+   */
+  void *free_cls;
+
+  /**
+   * Number of bytes in @e header.
+   */
+  size_t header_len;
+
+  /**
+   * Chunk-size line sent before @e data if the body is chunked.
+   */
+  char header[MHD_STREAM_HEADER_MAX];
+};
+
+
+/**
+ * The body of a response pushed by the application.
+ */
+struct MHD_ResponseStream
+{
+
+  /**
+   * Protects all the fields below except @e ended.
+   */
+  MHD_mutex_ mutex;
+
+  /**
+   * First buffer not sent completely.
+   */
+  struct MHD_StreamBuffer *head;
+
+  /**
+   * Last buffer written.
+   */
+  struct MHD_StreamBuffer *tail;
+
+  /**
+   * Connection sending the stream, NULL before the response was
+   * queued and after the connection is done with it.
+   */
+  struct MHD_Connection *connection;
+
+  /**
+   * Called when the queue has room again or the connection is gone.
+   */
+  MHD_StreamWritableCallback wc;
+
+  /**
+   * Closure for @e wc.
+   */
+  void *wc_cls;
+
+  /**
+   * Number of bytes of the queued buffers (without framing).
+   */
+  size_t queued;
+
+  /**
+   * Limit for @e queued.
+   */
+  size_t max_queued;
+
+  /**
+   * Number of bytes of the framed @e head that were sent.
+   */
+  size_t offset;
+
+  /**
+   * Number of references: one of the application until
+   * #MHD_response_stream_close() and one of the response.
+   */
+  unsigned int refs;
+
+  /**
+   * #MHD_YES once the response was queued.
+   */
+  int attached;
+
+  /**
+   * #MHD_YES once the connection is done with the stream (or the
+   * response was destroyed), writes fail from then on.
+   */
+  int detached;
+
+  /**
+   * #MHD_YES once #MHD_response_stream_close() was called.
+   */
+  int closed;
+
+  /**
+   * #MHD_YES if the connection waits for the next write.
+   */
+  int waiting;
+
+  /**
+   * #MHD_YES if a write was refused as the queue was full, so that
+   * @e wc is to be called once it has room again.
+   */
+  int full;
+
+  /**
+   * #MHD_YES once the connection found the stream closed and empty.
+   * Only used by the thread of the connection.
+   */
+  int ended;
+};
+
+
+/**
+ * Release the buffers in the list @a head.  Must be called without
+ * holding the mutex of the stream, as the free callbacks may write.
+ *
+ * @param head first buffer to release
+ */
+static void
+buffers_free (struct MHD_StreamBuffer *head)
+{
+  struct MHD_StreamBuffer *next;
+
+  for (; NULL != head; head = next)
+    {
+      next = head->next;
+      if (NULL != head->free_cb)
+        head->free_cb (head->free_cls);
+      free (head);
+    }
+}
+
+
+/**
+ * Drop a reference to @a stream.
+ *
+ * @param stream stream to release
+ */
+static void
+stream_release (struct MHD_ResponseStream *stream)
+{
+  struct MHD_StreamBuffer *head;
+  unsigned int refs;
+
+  (void) MHD_mutex_lock_ (&stream->mutex);
+  refs = --stream->refs;
+  (void) MHD_mutex_unlock_ (&stream->mutex);
+  if (0 != refs)
+    return;
+  head = stream->head;
+  (void) MHD_mutex_destroy_ (&stream->mutex);
+  free (stream);
+  buffers_free (head);
+}
+
+
+/**
+ * Take the connection waiting for the next write, if any.  Assumes
+ * that the mutex of the stream is held.
+ *
+ * @param stream stream that was written to
+ * @return the connection to wake up, NULL if none
+ */
+static struct MHD_Connection *
+take_waiting (struct MHD_ResponseStream *stream)
+{
+  if (MHD_NO == stream->waiting)
+    return NULL;
+  stream->waiting = MHD_NO;
+  return stream->connection;
+}
+
+
+/**
+ * Get the number of bytes of @a buf with the framing of the
+ * connection.
+ *
+ * @param buf buffer to send
+ * @param chunked #MHD_YES if the body is chunked
+ * @return number of bytes to send for @a buf
+ */
+static size_t
+frame_len (const struct MHD_StreamBuffer *buf,
+           int chunked)
+{
+  if (MHD_YES == chunked)
+    return buf->header_len + buf->size + 2;
+  return buf->size;
+}
+
+
+/**
+ * Content reader of stream responses, never called as the buffers
+ * are sent directly from the stream.
+ *
+ * @param cls the stream
+ * @param pos position in the body
+ * @param buf where to store the data
+ * @param max size of @a buf
+ * @return #MHD_CONTENT_READER_END_WITH_ERROR
+ */
+static ssize_t
+stream_reader (void *cls,
+               uint64_t pos,
+               char *buf,
+               size_t max)
+{
+  (void) cls;
+  (void) pos;
+  (void) buf;
+  (void) max;
+  return MHD_CONTENT_READER_END_WITH_ERROR;
+}
+
+
+/**
+ * Release the reference of a response to its stream.  Nothing is
+ * sent any more, so the buffers are discarded.
+ *
+ * @param cls the stream
+ */
+static void
+stream_response_free (void *cls)
+{
+  struct MHD_ResponseStream *stream = cls;
+  struct MHD_StreamBuffer *head;
+
+  (void) MHD_mutex_lock_ (&stream->mutex);
+  stream->detached = MHD_YES;
+  head = stream->head;
+  stream->head = NULL;
+  stream->tail = NULL;
+  stream->queued = 0;
+  (void) MHD_mutex_unlock_ (&stream->mutex);
+  buffers_free (head);
+  stream_release (stream);
+}
+
+
+/**
+ * Create a response whose body the application writes with
+ * #MHD_response_stream_write() once it has the data, instead of MHD
+ * asking for it with a #MHD_ContentReaderCallback.  The body has no
+ * known size: it is sent chunked to HTTP/1.1 clients; for HTTP/1.0
+ * clients, the connection is closed after the stream was closed and
+ * all data was sent.  The response can be queued on one connection
+ * only.  While the connection has sent all data, it is suspended if
+ * the daemon was started with #MHD_USE_SUSPEND_RESUME (recommended),
+ * otherwise it is polled.  Stream responses cannot be queued for
+ * HTTP/2 requests.
+ *
+ * @param max_queued maximum number of bytes written but not sent
+ *        yet; writes beyond fail with #MHD_STREAM_WRITE_FULL
+ * @param wc called when the queue has room again after a write
+ *        failed with #MHD_STREAM_WRITE_FULL, and when the connection
+ *        is done with the stream (writes then fail with
+ *        #MHD_STREAM_WRITE_CLOSED); called from a thread of MHD
+ *        while the stream is locked, so it must not use the stream
+ *        itself but only signal the writer; may be NULL
+ * @param wc_cls closure for @a wc
+ * @param[out] stream set to the stream to write the body to, valid
+ *        until #MHD_response_stream_close() is called for it
+ * @return NULL on error (i.e. invalid arguments, out of memory)
+ * @ingroup response
+ */
+struct MHD_Response *
+MHD_create_response_stream (size_t max_queued,
+                            MHD_StreamWritableCallback wc,
+                            void *wc_cls,
+                            struct MHD_ResponseStream **stream)
+{
+  struct MHD_ResponseStream *s;
+  struct MHD_Response *response;
+
+  if ( (0 == max_queued) ||
+       (NULL == stream) )
+    return NULL;
+  if (NULL == (s = malloc (sizeof (struct MHD_ResponseStream))))
+    return NULL;
+  memset (s, 0, sizeof (struct MHD_ResponseStream));
+  if (MHD_YES != MHD_mutex_create_ (&s->mutex))
+    {
+      free (s);
+      return NULL;
+    }
+  s->max_queued = max_queued;
+  s->wc = wc;
+  s->wc_cls = wc_cls;
+  s->refs = 2;
+  response = MHD_create_response_from_callback (MHD_SIZE_UNKNOWN,
+                                                1,
+                                                &stream_reader,
+                                                s,
+                                                &stream_response_free);
+  if (NULL == response)
+    {
+      (void) MHD_mutex_destroy_ (&s->mutex);
+      free (s);
+      return NULL;
+    }
+  response->stream = s;
+  *stream = s;
+  return response;
+}
+
+
+/**
+ * Append @a size bytes at @a data to the body of the response of
+ * @a stream.  Can be called from any thread, but not while or after
+ * #MHD_stop_daemon() is called for the daemon of the connection.
+ *
+ * @param stream stream to write to
+ * @param data the data to append
+ * @param size number of bytes in @a data, must not be 0
+ * @param free_cb called with @a free_cls once @a data was sent or
+ *        discarded, if this function returned #MHD_STREAM_WRITE_OK;
+ *        @a data is then sent without copying it.  If NULL, the data
+ *        is copied
+ * @param free_cls closure for @a free_cb
+ * @return #MHD_STREAM_WRITE_OK if the data was queued, otherwise
+ *         the caller keeps @a data and @a free_cb is not called
+ * @ingroup response
+ */
+enum MHD_StreamWriteResult
+MHD_response_stream_write (struct MHD_ResponseStream *stream,
+                           const void *data,
+                           size_t size,
+                           MHD_ContentReaderFreeCallback free_cb,
+                           void *free_cls)
+{
+  struct MHD_StreamBuffer *buf;
+  struct MHD_Connection *waiting;
+  char hex[MHD_STREAM_HEADER_MAX];
+  size_t len;
+  size_t n;
+
+  if ( (NULL == stream) ||
+       (NULL == data) ||
+       (0 == size) ||
+       ( (NULL == free_cb) &&
+         (size > SIZE_MAX - sizeof (struct MHD_StreamBuffer)) ) )
+    return MHD_STREAM_WRITE_ERROR;
+  buf = malloc (sizeof (struct MHD_StreamBuffer)
+                + ((NULL == free_cb) ? size : 0));
+  if (NULL == buf)
+    return MHD_STREAM_WRITE_ERROR;
+  buf->next = NULL;
+  buf->size = size;
+  buf->free_cb = free_cb;
+  buf->free_cls = free_cls;
+  if (NULL == free_cb)
+    {
+      memcpy (&buf[1],
+              data,
+              size);
+      buf->data = (const char *) &buf[1];
+    }
+  else
+    {
+      buf->data = data;
+    }
+  /* chunk-size line, the size in hex (without leading zeros) */
+  len = 0;
+  n = size;
+  do
+    {
+      hex[len++] = "0123456789ABCDEF"[n & 0xF];
+      n >>= 4;
+    }
+  while (0 != n);
+  for (n = 0; n < len; n++)
+    buf->header[n] = hex[len - 1 - n];
+  memcpy (&buf->header[len],
+          "\r\n",
+          2);
+  buf->header_len = len + 2;
+  (void) MHD_mutex_lock_ (&stream->mutex);
+  if (MHD_YES == stream->detached)
+    {
+      (void) MHD_mutex_unlock_ (&stream->mutex);
+      free (buf);
+      return MHD_STREAM_WRITE_CLOSED;
+    }
+  /* a buffer larger than the limit is taken into an empty queue */
+  if ( (0 != stream->queued) &&
+       (size > stream->max_queued - MHD_MIN (stream->queued,
+                                             stream->max_queued)) )
+    {
+      stream->full = MHD_YES;
+      (void) MHD_mutex_unlock_ (&stream->mutex);
+      free (buf);
+      return MHD_STREAM_WRITE_FULL;
+    }
+  if (NULL == stream->tail)
+    stream->head = buf;
+  else
+    stream->tail->next = buf;
+  stream->tail = buf;
+  stream->queued += size;
+  waiting = take_waiting (stream);
+  (void) MHD_mutex_unlock_ (&stream->mutex);
+  if (NULL != waiting)
+    MHD_response_data_ready (waiting);
+  return MHD_STREAM_WRITE_OK;
+}
+
+
+/**
+ * Close @a stream: the body of its response ends after the data
+ * written so far.  Must be called exactly once for each stream, also
+ * if the response was never queued; @a stream must not be used
+ * afterwards.  The same restrictions as for
+ * #MHD_response_stream_write() apply.
+ *
+ * @param stream stream to close
+ * @ingroup response
+ */
+void
+MHD_response_stream_close (struct MHD_ResponseStream *stream)
+{
+  struct MHD_Connection *waiting;
+
+  if (NULL == stream)
+    return;
+  (void) MHD_mutex_lock_ (&stream->mutex);
+  stream->closed = MHD_YES;
+  waiting = take_waiting (stream);
+  (void) MHD_mutex_unlock_ (&stream->mutex);
+  /* the waiting connection holds a reference */
+  if (NULL != waiting)
+    MHD_response_data_ready (waiting);
+  stream_release (stream);
+}
+
+
+/**
+ * Attach the stream of @a response to @a connection, which sends
+ * what is written from now on.  A stream is sent on one connection
+ * only.
+ *
+ * @param connection connection the response is queued on
+ * @param response response created with #MHD_create_response_stream()
+ * @return #MHD_YES on success, #MHD_NO if the response was queued
+ *         before
+ */
+int
+MHD_stream_attach_ (struct MHD_Connection *connection,
+                    struct MHD_Response *response)
+{
+  struct MHD_ResponseStream *stream = response->stream;
+  int ret;
+
+  (void) MHD_mutex_lock_ (&stream->mutex);
+  ret = (MHD_YES == stream->attached) ? MHD_NO : MHD_YES;
+  if (MHD_YES == ret)
+    {
+      stream->attached = MHD_YES;
+      stream->connection = connection;
+    }
+  (void) MHD_mutex_unlock_ (&stream->mutex);
+  return ret;
+}
+
+
+/**
+ * Check whether the stream of the response of @a connection has
+ * data to send.
+ *
+ * @param connection connection the response was queued on
+ * @param park #MHD_YES to register the connection for a wakeup
+ *        with #MHD_response_data_ready() on the next write if
+ *        there is no data now
+ * @return what the connection should do next
+ */
+enum MHD_StreamState
+MHD_stream_ready_ (struct MHD_Connection *connection,
+                   int park)
+{
+  struct MHD_ResponseStream *stream = connection->response->stream;
+  enum MHD_StreamState ret;
+
+  (void) MHD_mutex_lock_ (&stream->mutex);
+  if (NULL != stream->head)
+    {
+      ret = MHD_STREAM_READY;
+    }
+  else if (MHD_YES == stream->closed)
+    {
+      stream->ended = MHD_YES;
+      ret = MHD_STREAM_END;
+    }
+  else
+    {
+      if (MHD_YES == park)
+        stream->waiting = MHD_YES;
+      ret = MHD_STREAM_WAIT;
+    }
+  (void) MHD_mutex_unlock_ (&stream->mutex);
+  return ret;
+}
+
+
+/**
+ * Add the part of a segment after the first @a skip bytes to the
+ * segments to send.
+ *
+ * @param seg start of the segment
+ * @param seg_len number of bytes in @a seg
+ * @param[in,out] skip number of bytes still to skip
+ * @param[out] data array of segment starts
+ * @param[out] len array of segment lengths
+ * @param[in,out] cnt number of segments in @a data and @a len
+ */
+static void
+add_segment (const char *seg,
+             size_t seg_len,
+             size_t *skip,
+             const char **data,
+             size_t *len,
+             unsigned int *cnt)
+{
+  if (*skip >= seg_len)
+    {
+      *skip -= seg_len;
+      return;
+    }
+  data[*cnt] = &seg[*skip];
+  len[*cnt] = seg_len - *skip;
+  *skip = 0;
+  (*cnt)++;
+}
+
+
+/**
+ * Get the segments of the queued buffers of the stream of the
+ * response of @a connection that are left to send, with the chunk
+ * framing if the body of the response is chunked.  The buffers
+ * stay valid until MHD_stream_sent_() is called.
+ *
+ * @param connection connection the response was queued on
+ * @param[out] data where to store the start of each segment
+ * @param[out] len where to store the length of each segment
+ * @param max size of @a data and @a len, at least 1
+ * @return number of segments stored, 0 if nothing is queued
+ */
+unsigned int
+MHD_stream_peek_ (struct MHD_Connection *connection,
+                  const char **data,
+                  size_t *len,
+                  unsigned int max)
+{
+  struct MHD_ResponseStream *stream = connection->response->stream;
+  const struct MHD_StreamBuffer *buf;
+  unsigned int cnt;
+  size_t skip;
+
+  cnt = 0;
+  (void) MHD_mutex_lock_ (&stream->mutex);
+  skip = stream->offset;
+  for (buf = stream->head;
+       (NULL != buf) && (cnt < max);
+       buf = buf->next)
+    {
+      if (MHD_NO == connection->have_chunked_upload)
+        {
+          add_segment (buf->data, buf->size, &skip, data, len, &cnt);
+          continue;
+        }
+      /* only whole buffers, apart from the first one */
+      if ( (0 == skip) &&
+           (cnt + 3 > max) )
+        break;
+      add_segment (buf->header, buf->header_len, &skip, data, len, &cnt);
+      add_segment (buf->data, buf->size, &skip, data, len, &cnt);
+      add_segment ("\r\n", 2, &skip, data, len, &cnt);
+    }
+  (void) MHD_mutex_unlock_ (&stream->mutex);
+  return cnt;
+}
+
+
+/**
+ * Account for @a sent bytes of the segments returned by
+ * MHD_stream_peek_(), release the buffers sent completely and
+ * tell the application if the queue has room again.
+ *
+ * @param connection connection the response was queued on
+ * @param sent number of bytes sent, may be 0
+ * @return #MHD_YES if data is left to send, #MHD_NO if not
+ */
+int
+MHD_stream_sent_ (struct MHD_Connection *connection,
+                  size_t sent)
+{
+  struct MHD_ResponseStream *stream = connection->response->stream;
+  struct MHD_StreamBuffer *done;
+  struct MHD_StreamBuffer **done_tail;
+  struct MHD_StreamBuffer *buf;
+  size_t left;
+  int ret;
+
+  done = NULL;
+  done_tail = &done;
+  (void) MHD_mutex_lock_ (&stream->mutex);
+  while (NULL != (buf = stream->head))
+    {
+      left = frame_len (buf, connection->have_chunked_upload) - stream->offset;
+      if (sent < left)
+        {
+          stream->offset += sent;
+          break;
+        }
+      sent -= left;
+      stream->offset = 0;
+      stream->queued -= buf->size;
+      stream->head = buf->next;
+      if (NULL == stream->head)
+        stream->tail = NULL;
+      buf->next = NULL;
+      *done_tail = buf;
+      done_tail = &buf->next;
+    }
+  ret = (NULL != stream->head) ? MHD_YES : MHD_NO;
+  if ( (MHD_YES == stream->full) &&
+       (stream->queued <= stream->max_queued / 2) )
+    {
+      stream->full = MHD_NO;
+      if (NULL != stream->wc)
+        stream->wc (stream->wc_cls);
+    }
+  (void) MHD_mutex_unlock_ (&stream->mutex);
+  buffers_free (done);
+  return ret;
+}
+
+
+/**
+ * Check whether the connection is sending the last chunk after the
+ * stream ended (see #MHD_STREAM_END).
+ *
+ * @param connection connection the response was queued on
+ * @return #MHD_YES if the stream ended
+ */
+int
+MHD_stream_ended_ (struct MHD_Connection *connection)
+{
+  return connection->response->stream->ended;
+}
+
+
+/**
+ * Detach the stream from @a connection and discard the data not
+ * sent.  Called when the response is done with; later writes fail
+ * with #MHD_STREAM_WRITE_CLOSED.
+ *
+ * @param connection connection the response was queued on
+ */
+void
+MHD_stream_detach_ (struct MHD_Connection *connection)
+{
+  struct MHD_ResponseStream *stream = connection->response->stream;
+  struct MHD_StreamBuffer *head;
+
+  (void) MHD_mutex_lock_ (&stream->mutex);
+  if (connection != stream->connection)
+    {
+      (void) MHD_mutex_unlock_ (&stream->mutex);
+      return;
+    }
+  stream->connection = NULL;
+  stream->detached = MHD_YES;
+  stream->waiting = MHD_NO;
+  stream->full = MHD_NO;
+  head = stream->head;
+  stream->head = NULL;
+  stream->tail = NULL;
+  stream->queued = 0;
+  stream->offset = 0;
+  /* tell a writer that is still around */
+  if ( (MHD_NO == stream->closed) &&
+       (NULL != stream->wc) )
+    stream->wc (stream->wc_cls);
+  (void) MHD_mutex_unlock_ (&stream->mutex);
+  buffers_free (head);
+}
+
+
+/* end of mhd_stream.c */
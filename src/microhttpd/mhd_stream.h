@@ -0,0 +1,146 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+/**
+ * @file microhttpd/mhd_stream.h
+ * @brief  responses whose body the application pushes, see
+ *         #MHD_create_response_stream()
+ * @author Christian Grothoff
+ */
+
+#ifndef MHD_STREAM_H
+#define MHD_STREAM_H 1
+#include "internal.h"
+
+/**
+ * Maximum number of buffers of a stream sent with one system call;
+ * each takes up to three segments with chunk framing.
+ */
+#define MHD_STREAM_MAX_BUFFERS 16
+
+
+/**
+ * What the connection sending a stream should do next.
+ */
+enum MHD_StreamState
+{
+  /**
+   * Data is queued, see MHD_stream_peek_().
+   */
+  MHD_STREAM_READY = 0,
+
+  /**
+   * All data was sent, wait for the application to write more.
+   */
+  MHD_STREAM_WAIT = 1,
+
+  /**
+   * All data was sent and the application closed the stream, the
+   * body is complete.
+   */
+  MHD_STREAM_END = 2
+};
+
+
+/**
+ * Attach the stream of @a response to @a connection, which sends
+ * what is written from now on.  A stream is sent on one connection
+ * only.
+ *
+ * @param connection connection the response is queued on
+ * @param response response created with #MHD_create_response_stream()
+ * @return #MHD_YES on success, #MHD_NO if the response was queued
+ *         before
+ */
+int
+MHD_stream_attach_ (struct MHD_Connection *connection,
+                    struct MHD_Response *response);
+
+
+/**
+ * Check whether the stream of the response of @a connection has
+ * data to send.
+ *
+ * @param connection connection the response was queued on
+ * @param park #MHD_YES to register the connection for a wakeup
+ *        with #MHD_response_data_ready() on the next write if
+ *        there is no data now
+ * @return what the connection should do next
+ */
+enum MHD_StreamState
+MHD_stream_ready_ (struct MHD_Connection *connection,
+                   int park);
+
+
+/**
+ * Get the segments of the queued buffers of the stream of the
+ * response of @a connection that are left to send, with the chunk
+ * framing if the body of the response is chunked.  The buffers
+ * stay valid until MHD_stream_sent_() is called.
+ *
+ * @param connection connection the response was queued on
+ * @param[out] data where to store the start of each segment
+ * @param[out] len where to store the length of each segment
+ * @param max size of @a data and @a len, at least 1
+ * @return number of segments stored, 0 if nothing is queued
+ */
+unsigned int
+MHD_stream_peek_ (struct MHD_Connection *connection,
+                  const char **data,
+                  size_t *len,
+                  unsigned int max);
+
+
+/**
+ * Account for @a sent bytes of the segments returned by
+ * MHD_stream_peek_(), release the buffers sent completely and
+ * tell the application if the queue has room again.
+ *
+ * @param connection connection the response was queued on
+ * @param sent number of bytes sent, may be 0
+ * @return #MHD_YES if data is left to send, #MHD_NO if not
+ */
+int
+MHD_stream_sent_ (struct MHD_Connection *connection,
+                  size_t sent);
+
+
+/**
+ * Check whether the connection is sending the last chunk after the
+ * stream ended (see #MHD_STREAM_END).
+ *
+ * @param connection connection the response was queued on
+ * @return #MHD_YES if the stream ended
+ */
+int
+MHD_stream_ended_ (struct MHD_Connection *connection);
+
+
+/**
+ * Detach the stream from @a connection and discard the data not
+ * sent.  Called when the response is done with; later writes fail
+ * with #MHD_STREAM_WRITE_CLOSED.
+ *
+ * @param connection connection the response was queued on
+ */
+void
+MHD_stream_detach_ (struct MHD_Connection *connection);
+
+#endif
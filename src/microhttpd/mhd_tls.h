@@ -0,0 +1,322 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_tls.h
+ * @brief  Interface of the TLS library (GnuTLS or OpenSSL) used for
+ *         HTTPS, chosen with "configure --with-tls"
+ * @author Christian Grothoff
+ */
+
+#ifndef MHD_TLS_H
+#define MHD_TLS_H 1
+#include "internal.h"
+
+#if HTTPS_SUPPORT
+
+/**
+ * Result of an operation of the TLS library that went well; the
+ * other results are negative.
+ */
+#define MHD_TLS_OK 0
+
+/**
+ * The operation has to be repeated once the socket is ready (see
+ * #MHD_tls_wants_write_()).
+ */
+#define MHD_TLS_AGAIN (-1)
+
+/**
+ * Fatal error, the connection must be closed.
+ */
+#define MHD_TLS_ERROR (-2)
+
+/**
+ * The handshake did not complete within the connection timeout
+ * (only set by the handshake threads, not by the TLS library).
+ */
+#define MHD_TLS_TIMEDOUT (-3)
+
+/**
+ * Value of #MHD_OPTION_HTTPS_CRED_TYPE for certificates, the only
+ * type supported (equal to `GNUTLS_CRD_CERTIFICATE`).
+ */
+#define MHD_TLS_CRD_CERTIFICATE 1
+
+/**
+ * Can the TLS library send the body of a response from a file with
+ * sendfile() once the kernel encrypts the data (see
+ * #MHD_tls_send_file_())?
+ */
+#if ! HTTPS_OPENSSL && HAVE_GNUTLS_RECORD_SEND_FILE
+#define MHD_TLS_HAVE_SEND_FILE 1
+#else
+#define MHD_TLS_HAVE_SEND_FILE 0
+#endif
+
+
+/**
+ * Initialize the TLS library, called once by MHD_init().
+ */
+void
+MHD_tls_global_init_ (void);
+
+
+/**
+ * Release the TLS library, called once by MHD_fini().
+ */
+void
+MHD_tls_global_deinit_ (void);
+
+
+/**
+ * Set the cipher suites and protocol versions offered by @a daemon
+ * (see #MHD_OPTION_HTTPS_PRIORITIES).
+ *
+ * @param daemon the (master) daemon
+ * @param priorities GnuTLS priority string, or OpenSSL cipher list
+ * @return #MHD_YES on success, #MHD_NO if @a priorities is invalid
+ */
+int
+MHD_tls_set_priorities_ (struct MHD_Daemon *daemon,
+                         const char *priorities);
+
+
+/**
+ * Set the Diffie-Hellman parameters of @a daemon (see
+ * #MHD_OPTION_HTTPS_MEM_DHPARAMS).
+ *
+ * @param daemon the (master) daemon
+ * @param pem parameters in PKCS#3 PEM format
+ * @return #MHD_YES on success, #MHD_NO if @a pem is invalid
+ */
+int
+MHD_tls_set_dh_params_ (struct MHD_Daemon *daemon,
+                        const char *pem);
+
+
+/**
+ * Enable or disable session tickets for @a daemon (see
+ * #MHD_OPTION_HTTPS_SESSION_TICKETS).
+ *
+ * @param daemon the (master) daemon
+ * @param enable #MHD_YES to issue and accept tickets
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+int
+MHD_tls_set_session_tickets_ (struct MHD_Daemon *daemon,
+                              int enable);
+
+
+/**
+ * Set the size of the session cache of @a daemon (see
+ * #MHD_OPTION_HTTPS_SESSION_CACHE_SIZE).
+ *
+ * @param daemon the (master) daemon
+ * @param size number of sessions to store, 0 for no cache
+ * @return #MHD_YES on success, #MHD_NO on error (out of memory)
+ */
+int
+MHD_tls_set_session_cache_ (struct MHD_Daemon *daemon,
+                            unsigned int size);
+
+
+/**
+ * Set up the credentials of @a daemon from the certificates and
+ * keys given as options.  The worker daemons share them.
+ *
+ * @param daemon the (master) daemon
+ * @return #MHD_YES on success, #MHD_NO on error (logged)
+ */
+int
+MHD_tls_daemon_init_ (struct MHD_Daemon *daemon);
+
+
+/**
+ * Release everything the TLS library holds for @a daemon, including
+ * what options set before #MHD_tls_daemon_init_() was called (or if
+ * it failed).
+ *
+ * @param daemon the (master) daemon
+ */
+void
+MHD_tls_daemon_deinit_ (struct MHD_Daemon *daemon);
+
+
+/**
+ * Create the TLS session of a new connection.  The TLS library
+ * reads and writes the socket only with @a pull and @a push.
+ *
+ * @param connection the new connection
+ * @param pull function to receive from the socket
+ * @param push function to send to the socket
+ * @return #MHD_YES on success, #MHD_NO on error (out of memory)
+ */
+int
+MHD_tls_session_init_ (struct MHD_Connection *connection,
+                       ReceiveCallback pull,
+                       TransmitCallback push);
+
+
+/**
+ * Destroy the TLS session of @a connection, if it has one.
+ *
+ * @param connection the connection
+ */
+void
+MHD_tls_session_deinit_ (struct MHD_Connection *connection);
+
+
+/**
+ * Continue the handshake of @a connection.
+ *
+ * @param connection the connection
+ * @return #MHD_TLS_OK once complete, #MHD_TLS_AGAIN or #MHD_TLS_ERROR
+ */
+int
+MHD_tls_handshake_ (struct MHD_Connection *connection);
+
+
+/**
+ * Does the last operation that returned #MHD_TLS_AGAIN wait for the
+ * socket to become writable (rather than readable)?
+ *
+ * @param connection the connection
+ * @return #MHD_YES to wait for writing, #MHD_NO to wait for reading
+ */
+int
+MHD_tls_wants_write_ (struct MHD_Connection *connection);
+
+
+/**
+ * Receive application data.
+ *
+ * @param connection the connection
+ * @param buf where to store the data
+ * @param size size of @a buf
+ * @return number of bytes received (0 at the end of the stream),
+ *         #MHD_TLS_AGAIN or #MHD_TLS_ERROR
+ */
+ssize_t
+MHD_tls_recv_ (struct MHD_Connection *connection,
+               void *buf,
+               size_t size);
+
+
+/**
+ * Send application data.  After #MHD_TLS_AGAIN the call must be
+ * repeated with the same data.
+ *
+ * @param connection the connection
+ * @param buf data to send
+ * @param size number of bytes in @a buf
+ * @return number of bytes sent, #MHD_TLS_AGAIN or #MHD_TLS_ERROR
+ */
+ssize_t
+MHD_tls_send_ (struct MHD_Connection *connection,
+               const void *buf,
+               size_t size);
+
+
+/**
+ * Does the TLS library hold received data that was not returned by
+ * #MHD_tls_recv_() yet?
+ *
+ * @param connection the connection
+ * @return #MHD_YES if so
+ */
+int
+MHD_tls_pending_ (struct MHD_Connection *connection);
+
+
+#if MHD_TLS_HAVE_SEND_FILE
+/**
+ * Send data from a file with sendfile(), only if
+ * #MHD_tls_ktls_send_() returned #MHD_YES.
+ *
+ * @param connection the connection
+ * @param fd file to send from
+ * @param offset offset in @a fd, advanced by the bytes sent
+ * @param size number of bytes to send
+ * @return number of bytes sent, #MHD_TLS_AGAIN or #MHD_TLS_ERROR
+ */
+ssize_t
+MHD_tls_send_file_ (struct MHD_Connection *connection,
+                    int fd,
+                    off_t *offset,
+                    size_t size);
+#endif
+
+
+/**
+ * Does the kernel encrypt what we send on @a connection (kTLS), so
+ * that #MHD_tls_send_file_() can be used?
+ *
+ * @param connection connection that completed the handshake
+ * @return #MHD_YES if so
+ */
+int
+MHD_tls_ktls_send_ (struct MHD_Connection *connection);
+
+
+/**
+ * Did the client and @a connection agree on HTTP/2 using ALPN?
+ *
+ * @param connection connection that completed the handshake
+ * @return #MHD_YES if so
+ */
+int
+MHD_tls_alpn_h2_ (struct MHD_Connection *connection);
+
+
+/**
+ * Try to tell the client that we close the connection.
+ *
+ * @param connection the connection
+ */
+void
+MHD_tls_bye_ (struct MHD_Connection *connection);
+
+
+/**
+ * Get the cipher used by @a connection, for
+ * #MHD_CONNECTION_INFO_CIPHER_ALGO.
+ *
+ * @param connection the connection
+ * @return the `enum gnutls_cipher_algorithm` with GnuTLS, the
+ *         cipher suite number with OpenSSL
+ */
+int
+MHD_tls_get_cipher_ (struct MHD_Connection *connection);
+
+
+/**
+ * Get the protocol version used by @a connection, for
+ * #MHD_CONNECTION_INFO_PROTOCOL.
+ *
+ * @param connection the connection
+ * @return the `enum gnutls_protocol` with GnuTLS, the version
+ *         number from the protocol (0x0303 for TLS 1.2) with OpenSSL
+ */
+int
+MHD_tls_get_protocol_ (struct MHD_Connection *connection);
+
+#endif
+
+#endif
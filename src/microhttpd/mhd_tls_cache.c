@@ -0,0 +1,284 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_tls_cache.c
+ * @brief  TLS session cache shared by all threads of a daemon
+ * @author Christian Grothoff
+ *
+ * The cache is a direct-mapped table of sessions: a new session
+ * replaces the one stored in its slot.  The slots are divided into
+ * #MHD_TLS_CACHE_STRIPES stripes with a lock each, so that the
+ * threads of a daemon rarely wait for each other.
+ */
+
+#include "mhd_tls_cache.h"
+
+
+/**
+ * Session stored in the cache.
+ */
+struct CacheEntry
+{
+  /**
+   * Session ID.
+   */
+  unsigned char key[MHD_TLS_CACHE_MAX_KEY];
+
+  /**
+   * Length of @e key.
+   */
+  unsigned int key_size;
+
+  /**
+   * Serialized session, NULL if the slot is free.
+   */
+  unsigned char *data;
+
+  /**
+   * Length of @e data.
+   */
+  unsigned int data_size;
+};
+
+
+/**
+ * TLS session cache.
+ */
+struct MHD_TlsSessionCache
+{
+  /**
+   * Locks of the stripes; slot @e i belongs to stripe
+   * @e i % #MHD_TLS_CACHE_STRIPES.
+   */
+  MHD_mutex_ locks[MHD_TLS_CACHE_STRIPES];
+
+  /**
+   * Slots of the table.
+   */
+  struct CacheEntry *entries;
+
+  /**
+   * Number of slots in @e entries.
+   */
+  unsigned int size;
+};
+
+
+/**
+ * Find the slot of a session ID.
+ *
+ * @param cache cache to use
+ * @param key session ID
+ * @return index of the slot
+ */
+static unsigned int
+slot_of (const struct MHD_TlsSessionCache *cache,
+         const gnutls_datum_t *key)
+{
+  uint32_t hash = 2166136261u;
+  unsigned int i;
+
+  /* FNV-1a */
+  for (i = 0; i < key->size; i++)
+    hash = (hash ^ key->data[i]) * 16777619u;
+  return hash % cache->size;
+}
+
+
+/**
+ * Store a session, called by GnuTLS.
+ *
+ * @param cls the cache
+ * @param key session ID
+ * @param data serialized session
+ * @return 0 on success, -1 on error
+ */
+static int
+cache_store (void *cls,
+             gnutls_datum_t key,
+             gnutls_datum_t data)
+{
+  struct MHD_TlsSessionCache *cache = cls;
+  struct CacheEntry *entry;
+  unsigned char *copy;
+  unsigned int slot;
+
+  if ( (0 == key.size) ||
+       (key.size > MHD_TLS_CACHE_MAX_KEY) )
+    return -1;
+  copy = malloc (data.size);
+  if (NULL == copy)
+    return -1;
+  memcpy (copy, data.data, data.size);
+  slot = slot_of (cache, &key);
+  entry = &cache->entries[slot];
+  (void) MHD_mutex_lock_ (&cache->locks[slot % MHD_TLS_CACHE_STRIPES]);
+  free (entry->data);
+  memcpy (entry->key, key.data, key.size);
+  entry->key_size = key.size;
+  entry->data = copy;
+  entry->data_size = data.size;
+  (void) MHD_mutex_unlock_ (&cache->locks[slot % MHD_TLS_CACHE_STRIPES]);
+  return 0;
+}
+
+
+/**
+ * Look up a session, called by GnuTLS.
+ *
+ * @param cls the cache
+ * @param key session ID
+ * @return serialized session allocated with gnutls_malloc(),
+ *         data is NULL if the session is not known
+ */
+static gnutls_datum_t
+cache_retrieve (void *cls,
+                gnutls_datum_t key)
+{
+  struct MHD_TlsSessionCache *cache = cls;
+  struct CacheEntry *entry;
+  gnutls_datum_t res = { NULL, 0 };
+  unsigned int slot;
+
+  if ( (0 == key.size) ||
+       (key.size > MHD_TLS_CACHE_MAX_KEY) )
+    return res;
+  slot = slot_of (cache, &key);
+  entry = &cache->entries[slot];
+  (void) MHD_mutex_lock_ (&cache->locks[slot % MHD_TLS_CACHE_STRIPES]);
+  if ( (NULL != entry->data) &&
+       (entry->key_size == key.size) &&
+       (0 == memcmp (entry->key, key.data, key.size)) &&
+       (NULL != (res.data = gnutls_malloc (entry->data_size))) )
+    {
+      memcpy (res.data, entry->data, entry->data_size);
+      res.size = entry->data_size;
+    }
+  (void) MHD_mutex_unlock_ (&cache->locks[slot % MHD_TLS_CACHE_STRIPES]);
+  return res;
+}
+
+
+/**
+ * Remove a session, called by GnuTLS.
+ *
+ * @param cls the cache
+ * @param key session ID
+ * @return 0 on success, -1 if the session is not known
+ */
+static int
+cache_remove (void *cls,
+              gnutls_datum_t key)
+{
+  struct MHD_TlsSessionCache *cache = cls;
+  struct CacheEntry *entry;
+  unsigned int slot;
+  int ret = -1;
+
+  if ( (0 == key.size) ||
+       (key.size > MHD_TLS_CACHE_MAX_KEY) )
+    return -1;
+  slot = slot_of (cache, &key);
+  entry = &cache->entries[slot];
+  (void) MHD_mutex_lock_ (&cache->locks[slot % MHD_TLS_CACHE_STRIPES]);
+  if ( (NULL != entry->data) &&
+       (entry->key_size == key.size) &&
+       (0 == memcmp (entry->key, key.data, key.size)) )
+    {
+      free (entry->data);
+      entry->data = NULL;
+      ret = 0;
+    }
+  (void) MHD_mutex_unlock_ (&cache->locks[slot % MHD_TLS_CACHE_STRIPES]);
+  return ret;
+}
+
+
+/**
+ * Create a TLS session cache.
+ *
+ * @param size number of sessions to store
+ * @return NULL on error (out of memory)
+ */
+struct MHD_TlsSessionCache *
+MHD_tls_session_cache_create_ (unsigned int size)
+{
+  struct MHD_TlsSessionCache *cache;
+  unsigned int i;
+
+  if (0 == size)
+    return NULL;
+  cache = malloc (sizeof (struct MHD_TlsSessionCache));
+  if (NULL == cache)
+    return NULL;
+  cache->entries = calloc (size, sizeof (struct CacheEntry));
+  if (NULL == cache->entries)
+    {
+      free (cache);
+      return NULL;
+    }
+  cache->size = size;
+  for (i = 0; i < MHD_TLS_CACHE_STRIPES; i++)
+    if (MHD_YES != MHD_mutex_create_ (&cache->locks[i]))
+      {
+        while (i > 0)
+          (void) MHD_mutex_destroy_ (&cache->locks[--i]);
+        free (cache->entries);
+        free (cache);
+        return NULL;
+      }
+  return cache;
+}
+
+
+/**
+ * Destroy a TLS session cache.
+ *
+ * @param cache cache to destroy
+ */
+void
+MHD_tls_session_cache_destroy_ (struct MHD_TlsSessionCache *cache)
+{
+  unsigned int i;
+
+  for (i = 0; i < cache->size; i++)
+    free (cache->entries[i].data);
+  for (i = 0; i < MHD_TLS_CACHE_STRIPES; i++)
+    (void) MHD_mutex_destroy_ (&cache->locks[i]);
+  free (cache->entries);
+  free (cache);
+}
+
+
+/**
+ * Let @a session store sessions in and resume sessions from @a cache.
+ *
+ * @param cache cache to use
+ * @param session TLS session of a new connection
+ */
+void
+MHD_tls_session_cache_attach_ (struct MHD_TlsSessionCache *cache,
+                               gnutls_session_t session)
+{
+  gnutls_db_set_retrieve_function (session, &cache_retrieve);
+  gnutls_db_set_store_function (session, &cache_store);
+  gnutls_db_set_remove_function (session, &cache_remove);
+  gnutls_db_set_ptr (session, cache);
+}
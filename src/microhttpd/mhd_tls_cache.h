@@ -0,0 +1,74 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_tls_cache.h
+ * @brief  TLS session cache shared by all threads of a daemon
+ * @author Christian Grothoff
+ */
+
+#ifndef MHD_TLS_CACHE_H
+#define MHD_TLS_CACHE_H 1
+#include "internal.h"
+
+#if HTTPS_SUPPORT
+
+/**
+ * Number of independently locked parts of a session cache.
+ */
+#define MHD_TLS_CACHE_STRIPES 16
+
+/**
+ * Maximum length of a session ID (TLS 1.2).
+ */
+#define MHD_TLS_CACHE_MAX_KEY 32
+
+
+/**
+ * Create a TLS session cache.
+ *
+ * @param size number of sessions to store
+ * @return NULL on error (out of memory)
+ */
+struct MHD_TlsSessionCache *
+MHD_tls_session_cache_create_ (unsigned int size);
+
+
+/**
+ * Destroy a TLS session cache.
+ *
+ * @param cache cache to destroy
+ */
+void
+MHD_tls_session_cache_destroy_ (struct MHD_TlsSessionCache *cache);
+
+
+/**
+ * Let @a session store sessions in and resume sessions from @a cache.
+ *
+ * @param cache cache to use
+ * @param session TLS session of a new connection
+ */
+void
+MHD_tls_session_cache_attach_ (struct MHD_TlsSessionCache *cache,
+                               gnutls_session_t session);
+
+#endif
+
+#endif
@@ -0,0 +1,735 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_tls_gnutls.c
+ * @brief  HTTPS with GnuTLS
+ * @author Christian Grothoff
+ */
+
+#include "mhd_tls.h"
+#include "mhd_tls_cache.h"
+#include "mhd_tls_sni.h"
+#include <gcrypt.h>
+
+
+#if GCRYPT_VERSION_NUMBER < 0x010600
+#if defined(MHD_USE_POSIX_THREADS)
+GCRY_THREAD_OPTION_PTHREAD_IMPL;
+#elif defined(MHD_W32_MUTEX_)
+
+static int
+gcry_w32_mutex_init (void **ppmtx)
+{
+  *ppmtx = malloc (sizeof (MHD_mutex_));
+
+  if (NULL == *ppmtx)
+    return ENOMEM;
+  if (MHD_YES != MHD_mutex_create_ ((MHD_mutex_*)*ppmtx))
+    {
+      free (*ppmtx);
+      *ppmtx = NULL;
+      return EPERM;
+    }
+
+  return 0;
+}
+
+
+static int
+gcry_w32_mutex_destroy (void **ppmtx)
+{
+  int res = (MHD_YES == MHD_mutex_destroy_ ((MHD_mutex_*)*ppmtx)) ? 0 : 1;
+  free (*ppmtx);
+  return res;
+}
+
+
+static int
+gcry_w32_mutex_lock (void **ppmtx)
+{
+  return (MHD_YES == MHD_mutex_lock_ ((MHD_mutex_*)*ppmtx)) ? 0 : 1;
+}
+
+
+static int
+gcry_w32_mutex_unlock (void **ppmtx)
+{
+  return (MHD_YES == MHD_mutex_unlock_ ((MHD_mutex_*)*ppmtx)) ? 0 : 1;
+}
+
+
+static struct gcry_thread_cbs gcry_threads_w32 = {
+  (GCRY_THREAD_OPTION_USER | (GCRY_THREAD_OPTION_VERSION << 8)),
+  NULL, gcry_w32_mutex_init, gcry_w32_mutex_destroy,
+  gcry_w32_mutex_lock, gcry_w32_mutex_unlock,
+  NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL };
+
+#endif /* defined(MHD_W32_MUTEX_) */
+#endif /* GCRYPT_VERSION_NUMBER < 0x010600 */
+
+
+/**
+ * Initialize the TLS library, called once by MHD_init().
+ */
+void
+MHD_tls_global_init_ (void)
+{
+#if GCRYPT_VERSION_NUMBER < 0x010600
+#if defined(MHD_USE_POSIX_THREADS)
+  if (0 != gcry_control (GCRYCTL_SET_THREAD_CBS, &gcry_threads_pthread))
+    MHD_PANIC ("Failed to initialise multithreading in libgcrypt\n");
+#elif defined(MHD_W32_MUTEX_)
+  if (0 != gcry_control (GCRYCTL_SET_THREAD_CBS, &gcry_threads_w32))
+    MHD_PANIC ("Failed to initialise multithreading in libgcrypt\n");
+#endif /* defined(MHD_W32_MUTEX_) */
+  gcry_check_version (NULL);
+#else
+  if (NULL == gcry_check_version ("1.6.0"))
+    MHD_PANIC ("libgcrypt is too old. MHD was compiled for libgcrypt 1.6.0 or newer\n");
+#endif
+  gnutls_global_init ();
+}
+
+
+/**
+ * Release the TLS library, called once by MHD_fini().
+ */
+void
+MHD_tls_global_deinit_ (void)
+{
+  gnutls_global_deinit ();
+}
+
+
+/**
+ * Set the cipher suites and protocol versions offered by @a daemon
+ * (see #MHD_OPTION_HTTPS_PRIORITIES).
+ *
+ * @param daemon the (master) daemon
+ * @param priorities GnuTLS priority string
+ * @return #MHD_YES on success, #MHD_NO if @a priorities is invalid
+ */
+int
+MHD_tls_set_priorities_ (struct MHD_Daemon *daemon,
+                         const char *priorities)
+{
+  int ret;
+
+  if (NULL != daemon->priority_cache)
+    gnutls_priority_deinit (daemon->priority_cache);
+  ret = gnutls_priority_init (&daemon->priority_cache,
+                              priorities,
+                              NULL);
+  if (GNUTLS_E_SUCCESS != ret)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Setting priorities to `%s' failed: %s\n",
+                priorities,
+                gnutls_strerror (ret));
+#endif
+      daemon->priority_cache = NULL;
+      return MHD_NO;
+    }
+  return MHD_YES;
+}
+
+
+/**
+ * Set the Diffie-Hellman parameters of @a daemon (see
+ * #MHD_OPTION_HTTPS_MEM_DHPARAMS).
+ *
+ * @param daemon the (master) daemon
+ * @param pem parameters in PKCS#3 PEM format
+ * @return #MHD_YES on success, #MHD_NO if @a pem is invalid
+ */
+int
+MHD_tls_set_dh_params_ (struct MHD_Daemon *daemon,
+                        const char *pem)
+{
+  gnutls_datum_t dhpar;
+
+  if (MHD_YES == daemon->have_dhparams)
+    {
+      gnutls_dh_params_deinit (daemon->https_mem_dhparams);
+      daemon->have_dhparams = MHD_NO;
+    }
+  if (gnutls_dh_params_init (&daemon->https_mem_dhparams) < 0)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG(daemon,
+               "Error initializing DH parameters\n");
+#endif
+      return MHD_NO;
+    }
+  dhpar.data = (unsigned char *) pem;
+  dhpar.size = strlen (pem);
+  if (gnutls_dh_params_import_pkcs3 (daemon->https_mem_dhparams, &dhpar,
+                                     GNUTLS_X509_FMT_PEM) < 0)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG(daemon,
+               "Bad Diffie-Hellman parameters format\n");
+#endif
+      gnutls_dh_params_deinit (daemon->https_mem_dhparams);
+      return MHD_NO;
+    }
+  daemon->have_dhparams = MHD_YES;
+  return MHD_YES;
+}
+
+
+/**
+ * Enable or disable session tickets for @a daemon (see
+ * #MHD_OPTION_HTTPS_SESSION_TICKETS).
+ *
+ * @param daemon the (master) daemon
+ * @param enable #MHD_YES to issue and accept tickets
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+int
+MHD_tls_set_session_tickets_ (struct MHD_Daemon *daemon,
+                              int enable)
+{
+  int ret;
+
+  if (MHD_NO == enable)
+    {
+      if (NULL != daemon->tls_ticket_key.data)
+        gnutls_free (daemon->tls_ticket_key.data);
+      daemon->tls_ticket_key.data = NULL;
+      return MHD_YES;
+    }
+  if ( (NULL == daemon->tls_ticket_key.data) &&
+       (GNUTLS_E_SUCCESS !=
+        (ret = gnutls_session_ticket_key_generate (&daemon->tls_ticket_key))) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to generate TLS session ticket key: %s\n",
+                gnutls_strerror (ret));
+#endif
+      daemon->tls_ticket_key.data = NULL;
+      return MHD_NO;
+    }
+  return MHD_YES;
+}
+
+
+/**
+ * Set the size of the session cache of @a daemon (see
+ * #MHD_OPTION_HTTPS_SESSION_CACHE_SIZE).
+ *
+ * @param daemon the (master) daemon
+ * @param size number of sessions to store, 0 for no cache
+ * @return #MHD_YES on success, #MHD_NO on error (out of memory)
+ */
+int
+MHD_tls_set_session_cache_ (struct MHD_Daemon *daemon,
+                            unsigned int size)
+{
+  if (NULL != daemon->tls_session_cache)
+    MHD_tls_session_cache_destroy_ (daemon->tls_session_cache);
+  daemon->tls_session_cache = NULL;
+  if (0 == size)
+    return MHD_YES;
+  daemon->tls_session_cache = MHD_tls_session_cache_create_ (size);
+  if (NULL == daemon->tls_session_cache)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to allocate TLS session cache: %s\n",
+                MHD_strerror_ (errno));
+#endif
+      return MHD_NO;
+    }
+  return MHD_YES;
+}
+
+
+/**
+ * Read and setup our certificate and key.
+ *
+ * @param daemon handle to daemon to initialize
+ * @return 0 on success
+ */
+static int
+init_daemon_certificate (struct MHD_Daemon *daemon)
+{
+  gnutls_datum_t key;
+  gnutls_datum_t cert;
+  int ret;
+
+#if GNUTLS_VERSION_MAJOR >= 3
+  if (NULL != daemon->cert_callback)
+    {
+      gnutls_certificate_set_retrieve_function2 (daemon->x509_cred,
+                                                 daemon->cert_callback);
+    }
+#endif
+  if (NULL != daemon->https_mem_trust)
+    {
+      cert.data = (unsigned char *) daemon->https_mem_trust;
+      cert.size = strlen (daemon->https_mem_trust);
+      if (gnutls_certificate_set_x509_trust_mem (daemon->x509_cred, &cert,
+						 GNUTLS_X509_FMT_PEM) < 0)
+	{
+#ifdef HAVE_MESSAGES
+	  MHD_DLOG(daemon,
+		   "Bad trust certificate format\n");
+#endif
+	  return -1;
+	}
+    }
+
+  if (MHD_YES == daemon->have_dhparams)
+    {
+      gnutls_certificate_set_dh_params (daemon->x509_cred,
+                                        daemon->https_mem_dhparams);
+    }
+  if (0 != daemon->https_cert_table_size)
+    {
+      daemon->sni_table = MHD_tls_sni_table_create_ (daemon);
+      if (NULL == daemon->sni_table)
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Failed to set up the certificate table\n");
+#endif
+          return -1;
+        }
+    }
+  /* certificate & key loaded from memory */
+  if ( (NULL != daemon->https_mem_cert) &&
+       (NULL != daemon->https_mem_key) )
+    {
+      key.data = (unsigned char *) daemon->https_mem_key;
+      key.size = strlen (daemon->https_mem_key);
+      cert.data = (unsigned char *) daemon->https_mem_cert;
+      cert.size = strlen (daemon->https_mem_cert);
+
+      if (NULL != daemon->https_key_password) {
+#if GNUTLS_VERSION_NUMBER >= 0x030111
+        ret = gnutls_certificate_set_x509_key_mem2 (daemon->x509_cred,
+                                                    &cert, &key,
+                                                    GNUTLS_X509_FMT_PEM,
+                                                    daemon->https_key_password,
+                                                    0);
+#else
+#ifdef HAVE_MESSAGES
+	MHD_DLOG (daemon,
+                  "Failed to setup x509 certificate/key: pre 3.X.X version " \
+		  "of GnuTLS does not support setting key password");
+#endif
+	return -1;
+#endif
+      }
+      else
+        ret = gnutls_certificate_set_x509_key_mem (daemon->x509_cred,
+                                                   &cert, &key,
+                                                   GNUTLS_X509_FMT_PEM);
+#ifdef HAVE_MESSAGES
+      if (0 != ret)
+        MHD_DLOG (daemon,
+                  "GnuTLS failed to setup x509 certificate/key: %s\n",
+                  gnutls_strerror (ret));
+#endif
+      return ret;
+    }
+#if GNUTLS_VERSION_MAJOR >= 3
+  if (NULL != daemon->cert_callback)
+    return 0;
+#endif
+  if (NULL != daemon->sni_table)
+    return 0;
+#ifdef HAVE_MESSAGES
+  MHD_DLOG (daemon,
+            "You need to specify a certificate and key location\n");
+#endif
+  return -1;
+}
+
+
+/**
+ * Set up the credentials of @a daemon from the certificates and
+ * keys given as options.  The worker daemons share them.
+ *
+ * @param daemon the (master) daemon
+ * @return #MHD_YES on success, #MHD_NO on error (logged)
+ */
+int
+MHD_tls_daemon_init_ (struct MHD_Daemon *daemon)
+{
+  if ( (NULL == daemon->priority_cache) &&
+       (MHD_YES != MHD_tls_set_priorities_ (daemon,
+                                            "NORMAL")) )
+    return MHD_NO;
+  switch (daemon->cred_type)
+    {
+    case GNUTLS_CRD_CERTIFICATE:
+      if (0 !=
+          gnutls_certificate_allocate_credentials (&daemon->x509_cred))
+        return MHD_NO;
+      if (0 != init_daemon_certificate (daemon))
+        return MHD_NO;
+      return MHD_YES;
+    default:
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Error: invalid credentials type %d specified.\n",
+                daemon->cred_type);
+#endif
+      return MHD_NO;
+    }
+}
+
+
+/**
+ * Release everything the TLS library holds for @a daemon, including
+ * what options set before #MHD_tls_daemon_init_() was called (or if
+ * it failed).
+ *
+ * @param daemon the (master) daemon
+ */
+void
+MHD_tls_daemon_deinit_ (struct MHD_Daemon *daemon)
+{
+  if (MHD_YES == daemon->have_dhparams)
+    {
+      gnutls_dh_params_deinit (daemon->https_mem_dhparams);
+      daemon->have_dhparams = MHD_NO;
+    }
+  if (NULL != daemon->priority_cache)
+    {
+      gnutls_priority_deinit (daemon->priority_cache);
+      daemon->priority_cache = NULL;
+    }
+  if (NULL != daemon->x509_cred)
+    {
+      gnutls_certificate_free_credentials (daemon->x509_cred);
+      daemon->x509_cred = NULL;
+    }
+  if (NULL != daemon->sni_table)
+    {
+      MHD_tls_sni_table_destroy_ (daemon->sni_table);
+      daemon->sni_table = NULL;
+    }
+  (void) MHD_tls_set_session_tickets_ (daemon,
+                                       MHD_NO);
+  (void) MHD_tls_set_session_cache_ (daemon,
+                                     0);
+}
+
+
+/**
+ * Create the TLS session of a new connection.  GnuTLS reads and
+ * writes the socket only with @a pull and @a push.
+ *
+ * @param connection the new connection
+ * @param pull function to receive from the socket
+ * @param push function to send to the socket
+ * @return #MHD_YES on success, #MHD_NO on error (out of memory)
+ */
+int
+MHD_tls_session_init_ (struct MHD_Connection *connection,
+                       ReceiveCallback pull,
+                       TransmitCallback push)
+{
+  struct MHD_Daemon *daemon = connection->daemon;
+
+  if (GNUTLS_E_SUCCESS != gnutls_init (&connection->tls_session,
+                                       GNUTLS_SERVER))
+    {
+      connection->tls_session = NULL;
+      return MHD_NO;
+    }
+  gnutls_priority_set (connection->tls_session,
+                       daemon->priority_cache);
+  /* set needed credentials for certificate authentication. */
+  gnutls_credentials_set (connection->tls_session,
+                          GNUTLS_CRD_CERTIFICATE,
+                          daemon->x509_cred);
+  gnutls_transport_set_ptr (connection->tls_session,
+                            (gnutls_transport_ptr_t) connection);
+  gnutls_transport_set_pull_function (connection->tls_session,
+                                      (gnutls_pull_func) pull);
+  gnutls_transport_set_push_function (connection->tls_session,
+                                      (gnutls_push_func) push);
+  if (NULL != daemon->https_mem_trust)
+    gnutls_certificate_server_set_request (connection->tls_session,
+                                           GNUTLS_CERT_REQUEST);
+  if (NULL != daemon->tls_ticket_key.data)
+    gnutls_session_ticket_enable_server (connection->tls_session,
+                                         &daemon->tls_ticket_key);
+  if (NULL != daemon->tls_session_cache)
+    MHD_tls_session_cache_attach_ (daemon->tls_session_cache,
+                                   connection->tls_session);
+  if (NULL != daemon->sni_table)
+    MHD_tls_sni_table_attach_ (daemon->sni_table,
+                               connection->tls_session);
+#if HAVE_GNUTLS_ALPN_SET_PROTOCOLS
+  if (0 != (daemon->options & MHD_USE_HTTP2))
+    {
+      static const gnutls_datum_t protocols[2] = {
+        { (unsigned char *) "h2", 2 },
+        { (unsigned char *) "http/1.1", 8 }
+      };
+
+      (void) gnutls_alpn_set_protocols (connection->tls_session,
+                                        protocols,
+                                        2,
+                                        0);
+    }
+#endif
+  return MHD_YES;
+}
+
+
+/**
+ * Destroy the TLS session of @a connection, if it has one.
+ *
+ * @param connection the connection
+ */
+void
+MHD_tls_session_deinit_ (struct MHD_Connection *connection)
+{
+  if (NULL == connection->tls_session)
+    return;
+  gnutls_deinit (connection->tls_session);
+  connection->tls_session = NULL;
+}
+
+
+/**
+ * Map the result of a GnuTLS function to ours.
+ *
+ * @param ret result of GnuTLS, negative on errors
+ * @return @a ret, #MHD_TLS_AGAIN or #MHD_TLS_ERROR
+ */
+static ssize_t
+map_result (ssize_t ret)
+{
+  if (0 <= ret)
+    return ret;
+  if ( (GNUTLS_E_AGAIN == ret) ||
+       (GNUTLS_E_INTERRUPTED == ret) )
+    return MHD_TLS_AGAIN;
+  return MHD_TLS_ERROR;
+}
+
+
+/**
+ * Continue the handshake of @a connection.
+ *
+ * @param connection the connection
+ * @return #MHD_TLS_OK once complete, #MHD_TLS_AGAIN or #MHD_TLS_ERROR
+ */
+int
+MHD_tls_handshake_ (struct MHD_Connection *connection)
+{
+  return (int) map_result (gnutls_handshake (connection->tls_session));
+}
+
+
+/**
+ * Does the last operation that returned #MHD_TLS_AGAIN wait for the
+ * socket to become writable (rather than readable)?
+ *
+ * @param connection the connection
+ * @return #MHD_YES to wait for writing, #MHD_NO to wait for reading
+ */
+int
+MHD_tls_wants_write_ (struct MHD_Connection *connection)
+{
+  return (1 == gnutls_record_get_direction (connection->tls_session))
+    ? MHD_YES
+    : MHD_NO;
+}
+
+
+/**
+ * Receive application data.
+ *
+ * @param connection the connection
+ * @param buf where to store the data
+ * @param size size of @a buf
+ * @return number of bytes received (0 at the end of the stream),
+ *         #MHD_TLS_AGAIN or #MHD_TLS_ERROR
+ */
+ssize_t
+MHD_tls_recv_ (struct MHD_Connection *connection,
+               void *buf,
+               size_t size)
+{
+  return map_result (gnutls_record_recv (connection->tls_session,
+                                         buf,
+                                         size));
+}
+
+
+/**
+ * Send application data.  After #MHD_TLS_AGAIN the call must be
+ * repeated with the same data.
+ *
+ * @param connection the connection
+ * @param buf data to send
+ * @param size number of bytes in @a buf
+ * @return number of bytes sent, #MHD_TLS_AGAIN or #MHD_TLS_ERROR
+ */
+ssize_t
+MHD_tls_send_ (struct MHD_Connection *connection,
+               const void *buf,
+               size_t size)
+{
+  return map_result (gnutls_record_send (connection->tls_session,
+                                         buf,
+                                         size));
+}
+
+
+/**
+ * Does GnuTLS hold received data that was not returned by
+ * #MHD_tls_recv_() yet?
+ *
+ * @param connection the connection
+ * @return #MHD_YES if so
+ */
+int
+MHD_tls_pending_ (struct MHD_Connection *connection)
+{
+  return (0 != gnutls_record_check_pending (connection->tls_session))
+    ? MHD_YES
+    : MHD_NO;
+}
+
+
+#if MHD_TLS_HAVE_SEND_FILE
+/**
+ * Send data from a file with sendfile(), only if
+ * #MHD_tls_ktls_send_() returned #MHD_YES.
+ *
+ * @param connection the connection
+ * @param fd file to send from
+ * @param offset offset in @a fd, advanced by the bytes sent
+ * @param size number of bytes to send
+ * @return number of bytes sent, #MHD_TLS_AGAIN or #MHD_TLS_ERROR
+ */
+ssize_t
+MHD_tls_send_file_ (struct MHD_Connection *connection,
+                    int fd,
+                    off_t *offset,
+                    size_t size)
+{
+  return map_result (gnutls_record_send_file (connection->tls_session,
+                                              fd,
+                                              offset,
+                                              size));
+}
+#endif
+
+
+/**
+ * Does the kernel encrypt what we send on @a connection (kTLS), so
+ * that #MHD_tls_send_file_() can be used?
+ *
+ * @param connection connection that completed the handshake
+ * @return #MHD_YES if so
+ */
+int
+MHD_tls_ktls_send_ (struct MHD_Connection *connection)
+{
+#if HAVE_GNUTLS_TRANSPORT_IS_KTLS_ENABLED && MHD_TLS_HAVE_SEND_FILE
+  /* GnuTLS hands the session keys to the kernel if kTLS is enabled
+     in its configuration */
+  if (0 != (gnutls_transport_is_ktls_enabled (connection->tls_session) &
+            GNUTLS_KTLS_SEND))
+    return MHD_YES;
+#else
+  (void) connection;
+#endif
+  return MHD_NO;
+}
+
+
+/**
+ * Did the client and @a connection agree on HTTP/2 using ALPN?
+ *
+ * @param connection connection that completed the handshake
+ * @return #MHD_YES if so
+ */
+int
+MHD_tls_alpn_h2_ (struct MHD_Connection *connection)
+{
+#if HAVE_GNUTLS_ALPN_SET_PROTOCOLS
+  gnutls_datum_t proto;
+
+  if ( (GNUTLS_E_SUCCESS ==
+        gnutls_alpn_get_selected_protocol (connection->tls_session,
+                                           &proto)) &&
+       (2 == proto.size) &&
+       (0 == memcmp (proto.data, "h2", 2)) )
+    return MHD_YES;
+#else
+  (void) connection;
+#endif
+  return MHD_NO;
+}
+
+
+/**
+ * Try to tell the client that we close the connection.
+ *
+ * @param connection the connection
+ */
+void
+MHD_tls_bye_ (struct MHD_Connection *connection)
+{
+  gnutls_bye (connection->tls_session, GNUTLS_SHUT_RDWR);
+}
+
+
+/**
+ * Get the cipher used by @a connection, for
+ * #MHD_CONNECTION_INFO_CIPHER_ALGO.
+ *
+ * @param connection the connection
+ * @return the `enum gnutls_cipher_algorithm`
+ */
+int
+MHD_tls_get_cipher_ (struct MHD_Connection *connection)
+{
+  return gnutls_cipher_get (connection->tls_session);
+}
+
+
+/**
+ * Get the protocol version used by @a connection, for
+ * #MHD_CONNECTION_INFO_PROTOCOL.
+ *
+ * @param connection the connection
+ * @return the `enum gnutls_protocol`
+ */
+int
+MHD_tls_get_protocol_ (struct MHD_Connection *connection)
+{
+  return gnutls_protocol_get_version (connection->tls_session);
+}
+
+/* end of mhd_tls_gnutls.c */
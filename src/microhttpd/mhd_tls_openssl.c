@@ -0,0 +1,939 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_tls_openssl.c
+ * @brief  HTTPS with OpenSSL (1.1.1 or later) or BoringSSL
+ * @author Christian Grothoff
+ *
+ * All sessions of a daemon share one SSL_CTX, which holds the
+ * credentials and the settings given as options.  Sessions read and
+ * write the socket through a BIO calling the transport functions of
+ * MHD, so that rate limits and statistics apply as with GnuTLS.
+ */
+
+#include "mhd_tls.h"
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+
+/**
+ * BIO method for the sockets of connections, created by
+ * #MHD_tls_global_init_().
+ */
+static BIO_METHOD *bio_method;
+
+
+/**
+ * Log the first error of OpenSSL of this thread and clear them.
+ *
+ * @param daemon daemon to log for
+ * @param what what failed
+ */
+static void
+log_error (struct MHD_Daemon *daemon,
+           const char *what)
+{
+#ifdef HAVE_MESSAGES
+  char buf[256];
+
+  ERR_error_string_n (ERR_get_error (),
+                      buf,
+                      sizeof (buf));
+  MHD_DLOG (daemon,
+            "%s: %s\n",
+            what,
+            buf);
+#endif
+  ERR_clear_error ();
+}
+
+
+/**
+ * Write encrypted data of a session to its connection.
+ *
+ * @param bio the BIO of the session
+ * @param buf data to write
+ * @param size number of bytes in @a buf
+ * @return number of bytes written, -1 on error
+ */
+static int
+bio_write (BIO *bio,
+           const char *buf,
+           int size)
+{
+  struct MHD_Connection *connection = BIO_get_data (bio);
+  ssize_t ret;
+  int err;
+
+  BIO_clear_retry_flags (bio);
+  ret = connection->tls_push (connection,
+                              buf,
+                              (size_t) size);
+  if (ret >= 0)
+    return (int) ret;
+  err = MHD_socket_errno_;
+  if ( (EINTR == err) || (EAGAIN == err) || (EWOULDBLOCK == err) )
+    BIO_set_retry_write (bio);
+  return -1;
+}
+
+
+/**
+ * Read encrypted data for a session from its connection.
+ *
+ * @param bio the BIO of the session
+ * @param buf where to store the data
+ * @param size size of @a buf
+ * @return number of bytes read, 0 at the end of the stream, -1 on
+ *         error
+ */
+static int
+bio_read (BIO *bio,
+          char *buf,
+          int size)
+{
+  struct MHD_Connection *connection = BIO_get_data (bio);
+  ssize_t ret;
+  int err;
+
+  BIO_clear_retry_flags (bio);
+  ret = connection->tls_pull (connection,
+                              buf,
+                              (size_t) size);
+  if (ret >= 0)
+    return (int) ret;
+  err = MHD_socket_errno_;
+  if ( (EINTR == err) || (EAGAIN == err) || (EWOULDBLOCK == err) )
+    BIO_set_retry_read (bio);
+  return -1;
+}
+
+
+/**
+ * Control function of the BIO; the socket needs no flushing.
+ *
+ * @param bio the BIO of a session
+ * @param cmd what to do
+ * @param num numeric argument of @a cmd
+ * @param ptr pointer argument of @a cmd
+ * @return 1 for #BIO_CTRL_FLUSH, 0 for everything else
+ */
+static long
+bio_ctrl (BIO *bio,
+          int cmd,
+          long num,
+          void *ptr)
+{
+  (void) bio;
+  (void) num;
+  (void) ptr;
+  if (BIO_CTRL_FLUSH == cmd)
+    return 1;
+  return 0;
+}
+
+
+/**
+ * Mark a new BIO as initialized.
+ *
+ * @param bio the new BIO
+ * @return 1
+ */
+static int
+bio_create (BIO *bio)
+{
+  BIO_set_init (bio, 1);
+  return 1;
+}
+
+
+/**
+ * Initialize the TLS library, called once by MHD_init().
+ */
+void
+MHD_tls_global_init_ (void)
+{
+  if (1 != OPENSSL_init_ssl (0, NULL))
+    MHD_PANIC ("Failed to initialise OpenSSL\n");
+  bio_method = BIO_meth_new (BIO_TYPE_SOURCE_SINK | BIO_get_new_index (),
+                             "MHD connection");
+  if ( (NULL == bio_method) ||
+       (1 != BIO_meth_set_write (bio_method, &bio_write)) ||
+       (1 != BIO_meth_set_read (bio_method, &bio_read)) ||
+       (1 != BIO_meth_set_ctrl (bio_method, &bio_ctrl)) ||
+       (1 != BIO_meth_set_create (bio_method, &bio_create)) )
+    MHD_PANIC ("Failed to initialise OpenSSL\n");
+}
+
+
+/**
+ * Release the TLS library, called once by MHD_fini().
+ */
+void
+MHD_tls_global_deinit_ (void)
+{
+  BIO_meth_free (bio_method);
+  bio_method = NULL;
+}
+
+
+/**
+ * Set the cipher suites offered by @a daemon (see
+ * #MHD_OPTION_HTTPS_PRIORITIES).  They are checked by
+ * #MHD_tls_daemon_init_().
+ *
+ * @param daemon the (master) daemon
+ * @param priorities OpenSSL cipher list (TLS 1.2 and older)
+ * @return #MHD_YES
+ */
+int
+MHD_tls_set_priorities_ (struct MHD_Daemon *daemon,
+                         const char *priorities)
+{
+  daemon->tls_cipher_list = priorities;
+  return MHD_YES;
+}
+
+
+/**
+ * Set the Diffie-Hellman parameters of @a daemon (see
+ * #MHD_OPTION_HTTPS_MEM_DHPARAMS).
+ *
+ * @param daemon the (master) daemon
+ * @param pem parameters in PKCS#3 PEM format
+ * @return #MHD_YES on success, #MHD_NO if @a pem is invalid
+ */
+int
+MHD_tls_set_dh_params_ (struct MHD_Daemon *daemon,
+                        const char *pem)
+{
+#ifdef OPENSSL_IS_BORINGSSL
+  (void) pem;
+#ifdef HAVE_MESSAGES
+  MHD_DLOG (daemon,
+            "BoringSSL does not support Diffie-Hellman parameters\n");
+#endif
+  return MHD_NO;
+#else
+  BIO *bio;
+  EVP_PKEY *params;
+
+  bio = BIO_new_mem_buf (pem, -1);
+  if (NULL == bio)
+    {
+      log_error (daemon,
+                 "Error initializing DH parameters");
+      return MHD_NO;
+    }
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  params = PEM_read_bio_Parameters (bio, NULL);
+#else
+  {
+    DH *dh;
+
+    params = NULL;
+    dh = PEM_read_bio_DHparams (bio, NULL, NULL, NULL);
+    if ( (NULL != dh) &&
+         ( (NULL == (params = EVP_PKEY_new ())) ||
+           (1 != EVP_PKEY_assign_DH (params, dh)) ) )
+      {
+        EVP_PKEY_free (params);
+        DH_free (dh);
+        params = NULL;
+      }
+  }
+#endif
+  BIO_free (bio);
+  if (NULL == params)
+    {
+      log_error (daemon,
+                 "Bad Diffie-Hellman parameters format");
+      return MHD_NO;
+    }
+  EVP_PKEY_free (daemon->tls_dh_params);
+  daemon->tls_dh_params = params;
+  return MHD_YES;
+#endif
+}
+
+
+/**
+ * Enable or disable session tickets for @a daemon (see
+ * #MHD_OPTION_HTTPS_SESSION_TICKETS).  OpenSSL generates and rotates
+ * the ticket keys itself.
+ *
+ * @param daemon the (master) daemon
+ * @param enable #MHD_YES to issue and accept tickets
+ * @return #MHD_YES
+ */
+int
+MHD_tls_set_session_tickets_ (struct MHD_Daemon *daemon,
+                              int enable)
+{
+  daemon->tls_session_tickets = enable;
+  return MHD_YES;
+}
+
+
+/**
+ * Set the size of the session cache of @a daemon (see
+ * #MHD_OPTION_HTTPS_SESSION_CACHE_SIZE).  The cache of OpenSSL in
+ * the shared SSL_CTX is used.
+ *
+ * @param daemon the (master) daemon
+ * @param size number of sessions to store, 0 for no cache
+ * @return #MHD_YES
+ */
+int
+MHD_tls_set_session_cache_ (struct MHD_Daemon *daemon,
+                            unsigned int size)
+{
+  daemon->tls_session_cache_size = size;
+  return MHD_YES;
+}
+
+
+/**
+ * Get the password of an encrypted private key.
+ *
+ * @param buf where to store the password
+ * @param size size of @a buf
+ * @param rwflag 0 for decryption
+ * @param cls the 0-terminated password, NULL if none was given
+ * @return length of the password, 0 if none fits
+ */
+static int
+key_password (char *buf,
+              int size,
+              int rwflag,
+              void *cls)
+{
+  const char *password = cls;
+  size_t len;
+
+  (void) rwflag;
+  if (NULL == password)
+    return 0;
+  len = strlen (password);
+  if (len > (size_t) size)
+    return 0;
+  memcpy (buf, password, len);
+  return (int) len;
+}
+
+
+/**
+ * Verification callback for client certificates: the handshake
+ * continues with any certificate, as with GnuTLS the application
+ * checks it.
+ *
+ * @param preverify_ok result of the verification by OpenSSL
+ * @param ctx certificate store context
+ * @return 1
+ */
+static int
+accept_any_certificate (int preverify_ok,
+                        X509_STORE_CTX *ctx)
+{
+  (void) preverify_ok;
+  (void) ctx;
+  return 1;
+}
+
+
+/**
+ * Request client certificates and trust the certificates of
+ * #MHD_OPTION_HTTPS_MEM_TRUST.
+ *
+ * @param daemon the (master) daemon
+ * @param ctx context to set up
+ * @return #MHD_YES on success
+ */
+static int
+set_trust (struct MHD_Daemon *daemon,
+           SSL_CTX *ctx)
+{
+  STACK_OF(X509_NAME) *names;
+  X509_STORE *store;
+  BIO *bio;
+  X509 *cert;
+  int ok;
+
+  names = sk_X509_NAME_new_null ();
+  bio = BIO_new_mem_buf (daemon->https_mem_trust, -1);
+  if ( (NULL == names) ||
+       (NULL == bio) )
+    {
+      sk_X509_NAME_free (names);
+      BIO_free (bio);
+      return MHD_NO;
+    }
+  store = SSL_CTX_get_cert_store (ctx);
+  ok = MHD_YES;
+  while (NULL != (cert = PEM_read_bio_X509 (bio, NULL, NULL, NULL)))
+    {
+      if ( (1 != X509_STORE_add_cert (store, cert)) ||
+           (0 == sk_X509_NAME_push (names,
+                                    X509_NAME_dup (X509_get_subject_name (cert)))) )
+        ok = MHD_NO;
+      X509_free (cert);
+    }
+  /* reading stops with an error at the end */
+  ERR_clear_error ();
+  BIO_free (bio);
+  if ( (MHD_YES != ok) ||
+       (0 == sk_X509_NAME_num (names)) )
+    {
+      sk_X509_NAME_pop_free (names, &X509_NAME_free);
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Bad trust certificate format\n");
+#endif
+      return MHD_NO;
+    }
+  SSL_CTX_set_client_CA_list (ctx, names);
+  SSL_CTX_set_verify (ctx,
+                      SSL_VERIFY_PEER,
+                      &accept_any_certificate);
+  return MHD_YES;
+}
+
+
+/**
+ * Load the certificate (followed by its chain) and the private key
+ * of @a daemon.
+ *
+ * @param daemon the (master) daemon
+ * @param ctx context to set up
+ * @return #MHD_YES on success
+ */
+static int
+set_certificate (struct MHD_Daemon *daemon,
+                 SSL_CTX *ctx)
+{
+  BIO *bio;
+  X509 *cert;
+  EVP_PKEY *key;
+  int ok;
+
+  if ( (NULL == daemon->https_mem_cert) ||
+       (NULL == daemon->https_mem_key) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "You need to specify a certificate and key location\n");
+#endif
+      return MHD_NO;
+    }
+  bio = BIO_new_mem_buf (daemon->https_mem_cert, -1);
+  if (NULL == bio)
+    return MHD_NO;
+  cert = PEM_read_bio_X509_AUX (bio, NULL, NULL, NULL);
+  ok = ( (NULL != cert) &&
+         (1 == SSL_CTX_use_certificate (ctx, cert)) );
+  X509_free (cert);
+  while ( (ok) &&
+          (NULL != (cert = PEM_read_bio_X509 (bio, NULL, NULL, NULL))) )
+    {
+      if (1 != SSL_CTX_add0_chain_cert (ctx, cert))
+        {
+          X509_free (cert);
+          ok = 0;
+        }
+    }
+  BIO_free (bio);
+  if (! ok)
+    {
+      log_error (daemon,
+                 "OpenSSL failed to setup x509 certificate");
+      return MHD_NO;
+    }
+  /* reading the chain stops with an error at the end */
+  ERR_clear_error ();
+  bio = BIO_new_mem_buf (daemon->https_mem_key, -1);
+  if (NULL == bio)
+    return MHD_NO;
+  key = PEM_read_bio_PrivateKey (bio,
+                                 NULL,
+                                 &key_password,
+                                 (void *) daemon->https_key_password);
+  BIO_free (bio);
+  ok = ( (NULL != key) &&
+         (1 == SSL_CTX_use_PrivateKey (ctx, key)) &&
+         (1 == SSL_CTX_check_private_key (ctx)) );
+  EVP_PKEY_free (key);
+  if (! ok)
+    {
+      log_error (daemon,
+                 "OpenSSL failed to setup x509 key");
+      return MHD_NO;
+    }
+  return MHD_YES;
+}
+
+
+/**
+ * Select HTTP/2 with ALPN if the client offers it.
+ *
+ * @param ssl the session
+ * @param out set to the selected protocol
+ * @param outlen set to the length of @a out
+ * @param in protocols offered by the client
+ * @param inlen length of @a in
+ * @param arg unused
+ * @return #SSL_TLSEXT_ERR_OK if a protocol was selected
+ */
+static int
+select_alpn (SSL *ssl,
+             const unsigned char **out,
+             unsigned char *outlen,
+             const unsigned char *in,
+             unsigned int inlen,
+             void *arg)
+{
+  static const unsigned char protocols[] = "\x02h2\x08http/1.1";
+
+  (void) ssl;
+  (void) arg;
+  if (OPENSSL_NPN_NEGOTIATED !=
+      SSL_select_next_proto ((unsigned char **) out,
+                             outlen,
+                             protocols,
+                             sizeof (protocols) - 1,
+                             in,
+                             inlen))
+    return SSL_TLSEXT_ERR_NOACK;
+  return SSL_TLSEXT_ERR_OK;
+}
+
+
+/**
+ * Set up the credentials of @a daemon from the certificates and
+ * keys given as options.  The worker daemons share them.
+ *
+ * @param daemon the (master) daemon
+ * @return #MHD_YES on success, #MHD_NO on error (logged)
+ */
+int
+MHD_tls_daemon_init_ (struct MHD_Daemon *daemon)
+{
+  static const unsigned char session_id_context[] = "MHD";
+  SSL_CTX *ctx;
+
+  if (MHD_TLS_CRD_CERTIFICATE != daemon->cred_type)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Error: invalid credentials type %d specified.\n",
+                daemon->cred_type);
+#endif
+      return MHD_NO;
+    }
+  if (0 != daemon->https_cert_table_size)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "MHD_OPTION_HTTPS_CERT_TABLE requires building MHD with GnuTLS\n");
+#endif
+      return MHD_NO;
+    }
+  ctx = SSL_CTX_new (TLS_server_method ());
+  if (NULL == ctx)
+    {
+      log_error (daemon,
+                 "Failed to create TLS context");
+      return MHD_NO;
+    }
+  /* like gnutls_record_send(), return once a record was sent;
+     the buffer moves when the write buffer is reallocated */
+  SSL_CTX_set_mode (ctx,
+                    SSL_MODE_ENABLE_PARTIAL_WRITE |
+                    SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+  if ( (NULL != daemon->tls_cipher_list) &&
+       (1 != SSL_CTX_set_cipher_list (ctx,
+                                      daemon->tls_cipher_list)) )
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Setting priorities to `%s' failed\n",
+                daemon->tls_cipher_list);
+#endif
+      goto fail;
+    }
+#ifndef OPENSSL_IS_BORINGSSL
+  if (NULL != daemon->tls_dh_params)
+    {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+      if ( (1 != EVP_PKEY_up_ref (daemon->tls_dh_params)) ||
+           (1 != SSL_CTX_set0_tmp_dh_pkey (ctx,
+                                           daemon->tls_dh_params)) )
+#else
+      if (1 != SSL_CTX_set_tmp_dh (ctx,
+                                   EVP_PKEY_get0_DH (daemon->tls_dh_params)))
+#endif
+        {
+          log_error (daemon,
+                     "Failed to set Diffie-Hellman parameters");
+          goto fail;
+        }
+    }
+#endif
+  if ( (NULL != daemon->https_mem_trust) &&
+       (MHD_YES != set_trust (daemon, ctx)) )
+    goto fail;
+  if (MHD_YES != set_certificate (daemon, ctx))
+    goto fail;
+  if (MHD_YES != daemon->tls_session_tickets)
+    SSL_CTX_set_options (ctx,
+                         SSL_OP_NO_TICKET);
+  if (0 != daemon->tls_session_cache_size)
+    {
+      SSL_CTX_set_session_cache_mode (ctx,
+                                      SSL_SESS_CACHE_SERVER);
+      SSL_CTX_sess_set_cache_size (ctx,
+                                   daemon->tls_session_cache_size);
+      (void) SSL_CTX_set_session_id_context (ctx,
+                                             session_id_context,
+                                             sizeof (session_id_context) - 1);
+    }
+  else
+    {
+      SSL_CTX_set_session_cache_mode (ctx,
+                                      SSL_SESS_CACHE_OFF);
+      /* no stateful tickets of TLS 1.3 either */
+      if (MHD_YES != daemon->tls_session_tickets)
+        (void) SSL_CTX_set_num_tickets (ctx,
+                                        0);
+    }
+  if (0 != (daemon->options & MHD_USE_HTTP2))
+    SSL_CTX_set_alpn_select_cb (ctx,
+                                &select_alpn,
+                                NULL);
+  daemon->tls_ctx = ctx;
+  return MHD_YES;
+fail:
+  SSL_CTX_free (ctx);
+  ERR_clear_error ();
+  return MHD_NO;
+}
+
+
+/**
+ * Release everything OpenSSL holds for @a daemon.
+ *
+ * @param daemon the (master) daemon
+ */
+void
+MHD_tls_daemon_deinit_ (struct MHD_Daemon *daemon)
+{
+  if (NULL != daemon->tls_ctx)
+    {
+      SSL_CTX_free (daemon->tls_ctx);
+      daemon->tls_ctx = NULL;
+    }
+  if (NULL != daemon->tls_dh_params)
+    {
+      EVP_PKEY_free (daemon->tls_dh_params);
+      daemon->tls_dh_params = NULL;
+    }
+}
+
+
+/**
+ * Create the TLS session of a new connection.  OpenSSL reads and
+ * writes the socket only with @a pull and @a push.
+ *
+ * @param connection the new connection
+ * @param pull function to receive from the socket
+ * @param push function to send to the socket
+ * @return #MHD_YES on success, #MHD_NO on error (out of memory)
+ */
+int
+MHD_tls_session_init_ (struct MHD_Connection *connection,
+                       ReceiveCallback pull,
+                       TransmitCallback push)
+{
+  SSL *ssl;
+  BIO *bio;
+
+  ssl = SSL_new (connection->daemon->tls_ctx);
+  if (NULL == ssl)
+    {
+      ERR_clear_error ();
+      return MHD_NO;
+    }
+  bio = BIO_new (bio_method);
+  if (NULL == bio)
+    {
+      SSL_free (ssl);
+      ERR_clear_error ();
+      return MHD_NO;
+    }
+  BIO_set_data (bio, connection);
+  /* the session owns the BIO */
+  SSL_set_bio (ssl, bio, bio);
+  SSL_set_accept_state (ssl);
+  connection->tls_pull = pull;
+  connection->tls_push = push;
+  connection->tls_session = ssl;
+  return MHD_YES;
+}
+
+
+/**
+ * Destroy the TLS session of @a connection, if it has one.
+ *
+ * @param connection the connection
+ */
+void
+MHD_tls_session_deinit_ (struct MHD_Connection *connection)
+{
+  if (NULL == connection->tls_session)
+    return;
+  SSL_free (connection->tls_session);
+  connection->tls_session = NULL;
+}
+
+
+/**
+ * Map the result of an operation of OpenSSL to ours.
+ *
+ * @param connection the connection
+ * @param ret result of the operation, not positive
+ * @param eof value to return at the end of the stream
+ * @return @a eof, #MHD_TLS_AGAIN or #MHD_TLS_ERROR
+ */
+static int
+map_error (struct MHD_Connection *connection,
+           int ret,
+           int eof)
+{
+  switch (SSL_get_error (connection->tls_session, ret))
+    {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+      return MHD_TLS_AGAIN;
+    case SSL_ERROR_ZERO_RETURN:
+      return eof;
+    default:
+      ERR_clear_error ();
+      return MHD_TLS_ERROR;
+    }
+}
+
+
+/**
+ * Continue the handshake of @a connection.
+ *
+ * @param connection the connection
+ * @return #MHD_TLS_OK once complete, #MHD_TLS_AGAIN or #MHD_TLS_ERROR
+ */
+int
+MHD_tls_handshake_ (struct MHD_Connection *connection)
+{
+  int ret;
+
+  ERR_clear_error ();
+  ret = SSL_do_handshake (connection->tls_session);
+  if (1 == ret)
+    return MHD_TLS_OK;
+  return map_error (connection,
+                    ret,
+                    MHD_TLS_ERROR);
+}
+
+
+/**
+ * Does the last operation that returned #MHD_TLS_AGAIN wait for the
+ * socket to become writable (rather than readable)?
+ *
+ * @param connection the connection
+ * @return #MHD_YES to wait for writing, #MHD_NO to wait for reading
+ */
+int
+MHD_tls_wants_write_ (struct MHD_Connection *connection)
+{
+  return SSL_want_write (connection->tls_session)
+    ? MHD_YES
+    : MHD_NO;
+}
+
+
+/**
+ * Receive application data.
+ *
+ * @param connection the connection
+ * @param buf where to store the data
+ * @param size size of @a buf
+ * @return number of bytes received (0 at the end of the stream),
+ *         #MHD_TLS_AGAIN or #MHD_TLS_ERROR
+ */
+ssize_t
+MHD_tls_recv_ (struct MHD_Connection *connection,
+               void *buf,
+               size_t size)
+{
+  int ret;
+
+  if (size > INT_MAX)
+    size = INT_MAX;
+  ERR_clear_error ();
+  ret = SSL_read (connection->tls_session,
+                  buf,
+                  (int) size);
+  if (ret > 0)
+    return ret;
+  return map_error (connection,
+                    ret,
+                    0);
+}
+
+
+/**
+ * Send application data.  After #MHD_TLS_AGAIN the call must be
+ * repeated with the same data.
+ *
+ * @param connection the connection
+ * @param buf data to send
+ * @param size number of bytes in @a buf
+ * @return number of bytes sent, #MHD_TLS_AGAIN or #MHD_TLS_ERROR
+ */
+ssize_t
+MHD_tls_send_ (struct MHD_Connection *connection,
+               const void *buf,
+               size_t size)
+{
+  int ret;
+
+  if (size > INT_MAX)
+    size = INT_MAX;
+  ERR_clear_error ();
+  ret = SSL_write (connection->tls_session,
+                   buf,
+                   (int) size);
+  if (ret > 0)
+    return ret;
+  return map_error (connection,
+                    ret,
+                    MHD_TLS_ERROR);
+}
+
+
+/**
+ * Does OpenSSL hold received data that was not returned by
+ * #MHD_tls_recv_() yet?
+ *
+ * @param connection the connection
+ * @return #MHD_YES if so
+ */
+int
+MHD_tls_pending_ (struct MHD_Connection *connection)
+{
+  return (0 < SSL_pending (connection->tls_session))
+    ? MHD_YES
+    : MHD_NO;
+}
+
+
+/**
+ * Does the kernel encrypt what we send on @a connection?  Never, the
+ * data goes through the transport functions of MHD.
+ *
+ * @param connection connection that completed the handshake
+ * @return #MHD_NO
+ */
+int
+MHD_tls_ktls_send_ (struct MHD_Connection *connection)
+{
+  (void) connection;
+  return MHD_NO;
+}
+
+
+/**
+ * Did the client and @a connection agree on HTTP/2 using ALPN?
+ *
+ * @param connection connection that completed the handshake
+ * @return #MHD_YES if so
+ */
+int
+MHD_tls_alpn_h2_ (struct MHD_Connection *connection)
+{
+  const unsigned char *proto;
+  unsigned int len;
+
+  SSL_get0_alpn_selected (connection->tls_session,
+                          &proto,
+                          &len);
+  if ( (2 == len) &&
+       (0 == memcmp (proto, "h2", 2)) )
+    return MHD_YES;
+  return MHD_NO;
+}
+
+
+/**
+ * Try to tell the client that we close the connection.
+ *
+ * @param connection the connection
+ */
+void
+MHD_tls_bye_ (struct MHD_Connection *connection)
+{
+  if (SSL_is_init_finished (connection->tls_session))
+    (void) SSL_shutdown (connection->tls_session);
+  ERR_clear_error ();
+}
+
+
+/**
+ * Get the cipher used by @a connection, for
+ * #MHD_CONNECTION_INFO_CIPHER_ALGO.
+ *
+ * @param connection the connection
+ * @return the number of the cipher suite, 0 before the handshake
+ */
+int
+MHD_tls_get_cipher_ (struct MHD_Connection *connection)
+{
+  const SSL_CIPHER *cipher;
+
+  cipher = SSL_get_current_cipher (connection->tls_session);
+  if (NULL == cipher)
+    return 0;
+  return SSL_CIPHER_get_protocol_id (cipher);
+}
+
+
+/**
+ * Get the protocol version used by @a connection, for
+ * #MHD_CONNECTION_INFO_PROTOCOL.
+ *
+ * @param connection the connection
+ * @return the version number from the protocol (0x0303 for TLS 1.2)
+ */
+int
+MHD_tls_get_protocol_ (struct MHD_Connection *connection)
+{
+  return SSL_version (connection->tls_session);
+}
+
+/* end of mhd_tls_openssl.c */
@@ -0,0 +1,736 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_tls_sni.c
+ * @brief  TLS credentials selected by the SNI host name
+ * @author Christian Grothoff
+ *
+ * The certificates are parsed once when the daemon starts.  All
+ * certificates that share the same set of host names end up in one
+ * GnuTLS credentials structure, so that GnuTLS can pick the key type
+ * the client supports.  The names (wildcard names are stored as they
+ * are, "*.example.com") are kept in an open addressing hash table;
+ * after the client hello, the session gets the credentials of the
+ * exact name or, failing that, of the wildcard name for its parent
+ * domain.  The table is read-only after it was built.
+ */
+
+#include "mhd_tls_sni.h"
+#include <gnutls/x509.h>
+
+
+/**
+ * Host name of a certificate, used while building the table.
+ */
+struct NameOfCert
+{
+  /**
+   * Host name in lower case.
+   */
+  char *name;
+
+  /**
+   * Index of the certificate in #MHD_OPTION_HTTPS_CERT_TABLE.
+   */
+  unsigned int cert;
+};
+
+
+/**
+ * Credentials for the certificates of a set of host names.
+ */
+struct Credentials
+{
+  /**
+   * The credentials.
+   */
+  gnutls_certificate_credentials_t cred;
+
+  /**
+   * First host name (of the sorted list of names) whose certificates
+   * are in @e cred; only valid while building the table.
+   */
+  const struct NameOfCert *first;
+
+  /**
+   * Number of certificates in @e cred.
+   */
+  unsigned int num_certs;
+};
+
+
+/**
+ * Slot of the hash table.
+ */
+struct SniEntry
+{
+  /**
+   * Host name, NULL if the slot is free.
+   */
+  char *name;
+
+  /**
+   * Credentials for @e name.
+   */
+  struct Credentials *credentials;
+};
+
+
+/**
+ * Credentials by host name.
+ */
+struct MHD_TlsSniTable
+{
+  /**
+   * Slots of the hash table.
+   */
+  struct SniEntry *entries;
+
+  /**
+   * Number of slots in @e entries, a power of two.
+   */
+  unsigned int size;
+
+  /**
+   * All credentials of the table.
+   */
+  struct Credentials **credentials;
+
+  /**
+   * Number of entries in @e credentials.
+   */
+  unsigned int num_credentials;
+};
+
+
+/**
+ * Convert an ASCII letter to lower case, host names are not case
+ * sensitive.
+ *
+ * @param c character to convert
+ * @return @a c in lower case
+ */
+static char
+to_lower (char c)
+{
+  if ( (c >= 'A') && (c <= 'Z') )
+    c += 'a' - 'A';
+  return c;
+}
+
+
+/**
+ * Compute the hash of a host name (FNV-1a).
+ *
+ * @param name the host name
+ * @return the hash
+ */
+static uint32_t
+name_hash (const char *name)
+{
+  uint32_t hash = 2166136261U;
+
+  while ('\0' != *name)
+    {
+      hash ^= (unsigned char) *name++;
+      hash *= 16777619U;
+    }
+  return hash;
+}
+
+
+/**
+ * Compute the hash of the certificates of host names @a first.
+ *
+ * @param first first of the names
+ * @param num number of names (with the same name)
+ * @return the hash
+ */
+static uint32_t
+certs_hash (const struct NameOfCert *first,
+            unsigned int num)
+{
+  uint32_t hash = 2166136261U;
+  unsigned int i;
+
+  for (i = 0; i < num; i++)
+    {
+      hash ^= first[i].cert;
+      hash *= 16777619U;
+    }
+  return hash;
+}
+
+
+/**
+ * Order host names by name, then by certificate.
+ *
+ * @param a first `struct NameOfCert`
+ * @param b second `struct NameOfCert`
+ * @return comparison result for qsort()
+ */
+static int
+compare_names (const void *a,
+               const void *b)
+{
+  const struct NameOfCert *na = a;
+  const struct NameOfCert *nb = b;
+  int ret;
+
+  ret = strcmp (na->name, nb->name);
+  if (0 != ret)
+    return ret;
+  if (na->cert != nb->cert)
+    return (na->cert < nb->cert) ? -1 : 1;
+  return 0;
+}
+
+
+/**
+ * Find the slot of @a name in @a table.
+ *
+ * @param table table to search
+ * @param name host name in lower case
+ * @return the slot, with a NULL name if @a name is not in the table
+ */
+static struct SniEntry *
+find_entry (const struct MHD_TlsSniTable *table,
+            const char *name)
+{
+  struct SniEntry *entry;
+  unsigned int slot;
+
+  slot = name_hash (name) & (table->size - 1);
+  while (1)
+    {
+      entry = &table->entries[slot];
+      if ( (NULL == entry->name) ||
+           (0 == strcmp (entry->name, name)) )
+        return entry;
+      slot = (slot + 1) & (table->size - 1);
+    }
+}
+
+
+/**
+ * Add @a name as a host name of certificate @a cert.
+ *
+ * @param[in,out] names array of host names
+ * @param[in,out] num_names number of entries in @a names
+ * @param[in,out] alloc_names allocated entries of @a names
+ * @param name host name as found in the certificate
+ * @param cert index of the certificate
+ * @return #MHD_YES on success, #MHD_NO if out of memory
+ */
+static int
+add_name (struct NameOfCert **names,
+          unsigned int *num_names,
+          unsigned int *alloc_names,
+          const char *name,
+          unsigned int cert)
+{
+  struct NameOfCert *grown;
+  size_t len;
+  size_t i;
+  char *copy;
+
+  len = strlen (name);
+  /* a trailing dot names the same host */
+  if ( (0 < len) &&
+       ('.' == name[len - 1]) )
+    len--;
+  if ( (0 == len) ||
+       (MHD_TLS_SNI_MAX_NAME < len) )
+    return MHD_YES; /* can never match */
+  if (*num_names == *alloc_names)
+    {
+      grown = realloc (*names,
+                       (2 * *alloc_names + 16) * sizeof (struct NameOfCert));
+      if (NULL == grown)
+        return MHD_NO;
+      *names = grown;
+      *alloc_names = 2 * *alloc_names + 16;
+    }
+  copy = malloc (len + 1);
+  if (NULL == copy)
+    return MHD_NO;
+  for (i = 0; i < len; i++)
+    copy[i] = to_lower (name[i]);
+  copy[len] = '\0';
+  (*names)[*num_names].name = copy;
+  (*names)[*num_names].cert = cert;
+  (*num_names)++;
+  return MHD_YES;
+}
+
+
+/**
+ * Add the host names of a certificate: the DNS names of its subject
+ * alternative name extension or, if there are none, its common name.
+ *
+ * @param daemon daemon (for logging)
+ * @param[in,out] names array of host names
+ * @param[in,out] num_names number of entries in @a names
+ * @param[in,out] alloc_names allocated entries of @a names
+ * @param cert index of the certificate
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+static int
+add_names_of_cert (struct MHD_Daemon *daemon,
+                   struct NameOfCert **names,
+                   unsigned int *num_names,
+                   unsigned int *alloc_names,
+                   unsigned int cert)
+{
+  const struct MHD_HttpsCertificate *hc = &daemon->https_cert_table[cert];
+  gnutls_x509_crt_t crt;
+  gnutls_datum_t data;
+  char buf[MHD_TLS_SNI_MAX_NAME + 2];
+  size_t size;
+  unsigned int seq;
+  unsigned int found;
+  int ret;
+
+  if ( (NULL == hc->mem_cert) ||
+       (NULL == hc->mem_key) )
+    return MHD_NO;
+  if (GNUTLS_E_SUCCESS != gnutls_x509_crt_init (&crt))
+    return MHD_NO;
+  data.data = (unsigned char *) hc->mem_cert;
+  data.size = strlen (hc->mem_cert);
+  ret = gnutls_x509_crt_import (crt,
+                                &data,
+                                GNUTLS_X509_FMT_PEM);
+  if (GNUTLS_E_SUCCESS != ret)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "Failed to parse certificate %u of the certificate table: %s\n",
+                cert,
+                gnutls_strerror (ret));
+#endif
+      gnutls_x509_crt_deinit (crt);
+      return MHD_NO;
+    }
+  found = 0;
+  for (seq = 0; ; seq++)
+    {
+      size = sizeof (buf);
+      ret = gnutls_x509_crt_get_subject_alt_name (crt,
+                                                  seq,
+                                                  buf,
+                                                  &size,
+                                                  NULL);
+      if (GNUTLS_E_SHORT_MEMORY_BUFFER == ret)
+        continue; /* too long for a host name */
+      if (0 > ret)
+        break;
+      if (GNUTLS_SAN_DNSNAME != ret)
+        continue;
+      found++;
+      if (MHD_YES != add_name (names,
+                               num_names,
+                               alloc_names,
+                               buf,
+                               cert))
+        {
+          gnutls_x509_crt_deinit (crt);
+          return MHD_NO;
+        }
+    }
+  if (0 == found)
+    {
+      size = sizeof (buf);
+      if ( (GNUTLS_E_SUCCESS ==
+            gnutls_x509_crt_get_dn_by_oid (crt,
+                                           GNUTLS_OID_X520_COMMON_NAME,
+                                           0,
+                                           0,
+                                           buf,
+                                           &size)) &&
+           (MHD_YES != add_name (names,
+                                 num_names,
+                                 alloc_names,
+                                 buf,
+                                 cert)) )
+        {
+          gnutls_x509_crt_deinit (crt);
+          return MHD_NO;
+        }
+    }
+  gnutls_x509_crt_deinit (crt);
+  return MHD_YES;
+}
+
+
+/**
+ * Create the credentials for the certificates of @a first.
+ *
+ * @param daemon the (master) daemon
+ * @param first first of the host names with the same name
+ * @param num number of such host names
+ * @return NULL on error
+ */
+static struct Credentials *
+create_credentials (struct MHD_Daemon *daemon,
+                    const struct NameOfCert *first,
+                    unsigned int num)
+{
+  const struct MHD_HttpsCertificate *hc;
+  struct Credentials *credentials;
+  gnutls_datum_t cert;
+  gnutls_datum_t key;
+  unsigned int i;
+  int ret;
+
+  credentials = malloc (sizeof (struct Credentials));
+  if (NULL == credentials)
+    return NULL;
+  credentials->first = first;
+  credentials->num_certs = num;
+  if (GNUTLS_E_SUCCESS !=
+      gnutls_certificate_allocate_credentials (&credentials->cred))
+    {
+      free (credentials);
+      return NULL;
+    }
+  if (NULL != daemon->https_mem_trust)
+    {
+      cert.data = (unsigned char *) daemon->https_mem_trust;
+      cert.size = strlen (daemon->https_mem_trust);
+      if (0 > gnutls_certificate_set_x509_trust_mem (credentials->cred,
+                                                     &cert,
+                                                     GNUTLS_X509_FMT_PEM))
+        goto fail;
+    }
+  if (MHD_YES == daemon->have_dhparams)
+    gnutls_certificate_set_dh_params (credentials->cred,
+                                      daemon->https_mem_dhparams);
+  for (i = 0; i < num; i++)
+    {
+      hc = &daemon->https_cert_table[first[i].cert];
+      cert.data = (unsigned char *) hc->mem_cert;
+      cert.size = strlen (hc->mem_cert);
+      key.data = (unsigned char *) hc->mem_key;
+      key.size = strlen (hc->mem_key);
+      if (NULL != hc->key_password)
+        {
+#if GNUTLS_VERSION_NUMBER >= 0x030111
+          ret = gnutls_certificate_set_x509_key_mem2 (credentials->cred,
+                                                      &cert,
+                                                      &key,
+                                                      GNUTLS_X509_FMT_PEM,
+                                                      hc->key_password,
+                                                      0);
+#else
+          ret = GNUTLS_E_UNIMPLEMENTED_FEATURE;
+#endif
+        }
+      else
+        ret = gnutls_certificate_set_x509_key_mem (credentials->cred,
+                                                   &cert,
+                                                   &key,
+                                                   GNUTLS_X509_FMT_PEM);
+      if (0 > ret)
+        {
+#ifdef HAVE_MESSAGES
+          MHD_DLOG (daemon,
+                    "Failed to set up certificate %u of the certificate table: %s\n",
+                    first[i].cert,
+                    gnutls_strerror (ret));
+#endif
+          goto fail;
+        }
+    }
+  return credentials;
+ fail:
+  gnutls_certificate_free_credentials (credentials->cred);
+  free (credentials);
+  return NULL;
+}
+
+
+/**
+ * Find the credentials for the certificates of @a first, create
+ * them if no other name has the same certificates.
+ *
+ * @param daemon the (master) daemon
+ * @param table table being built
+ * @param slots hash table of the credentials by their certificates
+ * @param num_slots number of @a slots, a power of two
+ * @param first first of the host names with the same name
+ * @param num number of such host names
+ * @return NULL on error
+ */
+static struct Credentials *
+get_credentials (struct MHD_Daemon *daemon,
+                 struct MHD_TlsSniTable *table,
+                 struct Credentials **slots,
+                 unsigned int num_slots,
+                 const struct NameOfCert *first,
+                 unsigned int num)
+{
+  struct Credentials *credentials;
+  unsigned int slot;
+  unsigned int i;
+
+  slot = certs_hash (first, num) & (num_slots - 1);
+  while (NULL != (credentials = slots[slot]))
+    {
+      if (credentials->num_certs == num)
+        {
+          for (i = 0; i < num; i++)
+            if (credentials->first[i].cert != first[i].cert)
+              break;
+          if (i == num)
+            return credentials;
+        }
+      slot = (slot + 1) & (num_slots - 1);
+    }
+  credentials = create_credentials (daemon,
+                                    first,
+                                    num);
+  if (NULL == credentials)
+    return NULL;
+  slots[slot] = credentials;
+  table->credentials[table->num_credentials++] = credentials;
+  return credentials;
+}
+
+
+/**
+ * Build the table of credentials for the certificates of
+ * #MHD_OPTION_HTTPS_CERT_TABLE of @a daemon.  The trust list and the
+ * Diffie-Hellman parameters of @a daemon are set up for each of them.
+ *
+ * @param daemon the (master) daemon
+ * @return NULL on error (bad certificate or key, out of memory)
+ */
+struct MHD_TlsSniTable *
+MHD_tls_sni_table_create_ (struct MHD_Daemon *daemon)
+{
+  struct MHD_TlsSniTable *table;
+  struct NameOfCert *names;
+  struct Credentials **slots;
+  struct Credentials *credentials;
+  struct SniEntry *entry;
+  unsigned int num_names;
+  unsigned int alloc_names;
+  unsigned int num_hosts;
+  unsigned int num_slots;
+  unsigned int i;
+  unsigned int j;
+  unsigned int k;
+
+  names = NULL;
+  num_names = 0;
+  alloc_names = 0;
+  slots = NULL;
+  table = calloc (1, sizeof (struct MHD_TlsSniTable));
+  if (NULL == table)
+    return NULL;
+  for (i = 0; i < daemon->https_cert_table_size; i++)
+    if (MHD_YES != add_names_of_cert (daemon,
+                                      &names,
+                                      &num_names,
+                                      &alloc_names,
+                                      i))
+      goto fail;
+  if (0 == num_names)
+    {
+#ifdef HAVE_MESSAGES
+      MHD_DLOG (daemon,
+                "No host names found in the certificate table\n");
+#endif
+      goto fail;
+    }
+  qsort (names,
+         num_names,
+         sizeof (struct NameOfCert),
+         &compare_names);
+  /* drop names listed twice in the same certificate */
+  j = 0;
+  for (i = 0; i < num_names; i++)
+    {
+      if ( (0 < j) &&
+           (0 == compare_names (&names[j - 1], &names[i])) )
+        {
+          free (names[i].name);
+          continue;
+        }
+      names[j++] = names[i];
+    }
+  num_names = j;
+  num_hosts = 0;
+  for (i = 0; i < num_names; i++)
+    if ( (0 == i) ||
+         (0 != strcmp (names[i - 1].name, names[i].name)) )
+      num_hosts++;
+  /* at most half full */
+  table->size = 16;
+  while (table->size < 2 * num_hosts)
+    table->size *= 2;
+  num_slots = table->size;
+  table->entries = calloc (table->size, sizeof (struct SniEntry));
+  table->credentials = calloc (num_hosts, sizeof (struct Credentials *));
+  slots = calloc (num_slots, sizeof (struct Credentials *));
+  if ( (NULL == table->entries) ||
+       (NULL == table->credentials) ||
+       (NULL == slots) )
+    goto fail;
+  for (i = 0; i < num_names; i = j)
+    {
+      for (j = i + 1; j < num_names; j++)
+        if (0 != strcmp (names[i].name, names[j].name))
+          break;
+      credentials = get_credentials (daemon,
+                                     table,
+                                     slots,
+                                     num_slots,
+                                     &names[i],
+                                     j - i);
+      if (NULL == credentials)
+        goto fail;
+      entry = find_entry (table,
+                          names[i].name);
+      entry->name = names[i].name;
+      entry->credentials = credentials;
+      names[i].name = NULL;
+      for (k = i + 1; k < j; k++)
+        {
+          free (names[k].name);
+          names[k].name = NULL;
+        }
+    }
+  for (i = 0; i < table->num_credentials; i++)
+    table->credentials[i]->first = NULL;
+  free (slots);
+  free (names);
+  return table;
+ fail:
+  for (i = 0; i < num_names; i++)
+    free (names[i].name);
+  free (names);
+  free (slots);
+  MHD_tls_sni_table_destroy_ (table);
+  return NULL;
+}
+
+
+/**
+ * Destroy a table of credentials.
+ *
+ * @param table table to destroy
+ */
+void
+MHD_tls_sni_table_destroy_ (struct MHD_TlsSniTable *table)
+{
+  unsigned int i;
+
+  if (NULL != table->entries)
+    for (i = 0; i < table->size; i++)
+      free (table->entries[i].name);
+  if (NULL != table->credentials)
+    for (i = 0; i < table->num_credentials; i++)
+      {
+        gnutls_certificate_free_credentials (table->credentials[i]->cred);
+        free (table->credentials[i]);
+      }
+  free (table->entries);
+  free (table->credentials);
+  free (table);
+}
+
+
+/**
+ * Set the credentials for the host name sent by the client, called
+ * by GnuTLS after the client hello was received.
+ *
+ * @param session TLS session of the connection
+ * @return 0 to continue the handshake
+ */
+static int
+select_credentials (gnutls_session_t session)
+{
+  const struct MHD_TlsSniTable *table = gnutls_session_get_ptr (session);
+  const struct SniEntry *entry;
+  char name[MHD_TLS_SNI_MAX_NAME + 2];
+  const char *dot;
+  size_t len;
+  size_t i;
+  unsigned int type;
+
+  len = sizeof (name) - 1;
+  if ( (GNUTLS_E_SUCCESS !=
+        gnutls_server_name_get (session,
+                                name,
+                                &len,
+                                &type,
+                                0)) ||
+       (GNUTLS_NAME_DNS != type) )
+    return 0; /* keep the default credentials */
+  if ( (0 < len) &&
+       ('.' == name[len - 1]) )
+    len--;
+  if ( (0 == len) ||
+       (MHD_TLS_SNI_MAX_NAME < len) )
+    return 0;
+  name[len] = '\0';
+  for (i = 0; i < len; i++)
+    name[i] = to_lower (name[i]);
+  entry = find_entry (table,
+                      name);
+  if ( (NULL == entry->name) &&
+       (NULL != (dot = strchr (name, '.'))) )
+    {
+      /* "*" replaces the first label */
+      memmove (&name[1],
+               dot,
+               len - (dot - name) + 1);
+      name[0] = '*';
+      entry = find_entry (table,
+                          name);
+    }
+  if (NULL != entry->name)
+    gnutls_credentials_set (session,
+                            GNUTLS_CRD_CERTIFICATE,
+                            entry->credentials->cred);
+  return 0;
+}
+
+
+/**
+ * Let @a session use the credentials of @a table that match the
+ * host name sent by the client.
+ *
+ * @param table table to use
+ * @param session TLS session of a new connection
+ */
+void
+MHD_tls_sni_table_attach_ (struct MHD_TlsSniTable *table,
+                           gnutls_session_t session)
+{
+  gnutls_session_set_ptr (session,
+                          table);
+  gnutls_handshake_set_post_client_hello_function (session,
+                                                   &select_credentials);
+}
+
+/* end of mhd_tls_sni.c */
@@ -0,0 +1,73 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * @file microhttpd/mhd_tls_sni.h
+ * @brief  TLS credentials selected by the SNI host name
+ * @author Christian Grothoff
+ */
+
+#ifndef MHD_TLS_SNI_H
+#define MHD_TLS_SNI_H 1
+#include "internal.h"
+
+#if HTTPS_SUPPORT
+
+/**
+ * Maximum length of a host name (RFC 1035), longer names are not
+ * looked up.
+ */
+#define MHD_TLS_SNI_MAX_NAME 253
+
+
+/**
+ * Build the table of credentials for the certificates of
+ * #MHD_OPTION_HTTPS_CERT_TABLE of @a daemon.  The trust list and the
+ * Diffie-Hellman parameters of @a daemon are set up for each of them.
+ *
+ * @param daemon the (master) daemon
+ * @return NULL on error (bad certificate or key, out of memory)
+ */
+struct MHD_TlsSniTable *
+MHD_tls_sni_table_create_ (struct MHD_Daemon *daemon);
+
+
+/**
+ * Destroy a table of credentials.
+ *
+ * @param table table to destroy
+ */
+void
+MHD_tls_sni_table_destroy_ (struct MHD_TlsSniTable *table);
+
+
+/**
+ * Let @a session use the credentials of @a table that match the
+ * host name sent by the client.
+ *
+ * @param table table to use
+ * @param session TLS session of a new connection
+ */
+void
+MHD_tls_sni_table_attach_ (struct MHD_TlsSniTable *table,
+                           gnutls_session_t session);
+
+#endif
+
+#endif
@@ -24,6 +24,7 @@
  */
 
 #include "internal.h"
+#include "memorypool.h"
 
 /**
  * Size of on-stack buffer that we use for un-escaping of the value.
@@ -32,6 +33,12 @@
  */
 #define XBUF_SIZE 512
 
+/**
+ * Number of bytes in the delimiter ("\r\n--") that precedes
+ * a boundary in the body of a multipart entry.
+ */
+#define DELIM_PREFIX_LEN 4
+
 /**
  * States in the PP parser's state machine.
  */
@@ -175,6 +182,18 @@ struct MHD_PostProcessor
    */
   char xbuf[8];
 
+  /**
+   * Horspool shift table for finding "\r\n--" followed by
+   * the primary boundary.
+   */
+  unsigned char bskip[256];
+
+  /**
+   * Horspool shift table for finding "\r\n--" followed by
+   * the nested boundary (valid while @e nested_boundary is set).
+   */
+  unsigned char nskip[256];
+
   /**
    * Size of our buffer for the key.
    */
@@ -215,6 +234,50 @@ struct MHD_PostProcessor
    */
   int must_ikvi;
 
+  /**
+   * Pass values directly from the data given to
+   * #MHD_post_process() where possible?  (#MHD_YES or #MHD_NO,
+   * see #MHD_POST_PROCESSOR_OPTION_ZERO_COPY).
+   */
+  int zero_copy;
+
+  /**
+   * Callback to decide where to spool file parts, NULL
+   * if file parts are not spooled.
+   */
+  MHD_PostSpoolOpenCallback spool_open;
+
+  /**
+   * Callback to call once a file part was spooled.
+   */
+  MHD_PostSpoolDoneCallback spool_done;
+
+  /**
+   * Closure for @e spool_open and @e spool_done.
+   */
+  void *spool_cls;
+
+  /**
+   * File descriptor the current part is spooled to, -1 if the
+   * part is passed to @e ikvi.
+   */
+  int spool_fd;
+
+  /**
+   * #MHD_YES if @e spool_fd is a temporary file created by us.
+   */
+  int spool_temp;
+
+  /**
+   * Callback for url-encoded fields, NULL to use @e ikvi.
+   */
+  MHD_PostBatchCallback batch;
+
+  /**
+   * Closure for @e batch.
+   */
+  void *batch_cls;
+
   /**
    * State of the parser.
    */
@@ -243,6 +306,48 @@ struct MHD_PostProcessor
 };
 
 
+/**
+ * Get the character at position @a i of the delimiter
+ * "\r\n--" followed by @a boundary.
+ *
+ * @param boundary the boundary
+ * @param i offset into the delimiter
+ * @return character at offset @a i
+ */
+static unsigned char
+delim_char (const char *boundary,
+            size_t i)
+{
+  if (i < DELIM_PREFIX_LEN)
+    return (unsigned char) "\r\n--"[i];
+  return (unsigned char) boundary[i - DELIM_PREFIX_LEN];
+}
+
+
+/**
+ * Initialize the Horspool shift table for finding the delimiter
+ * "\r\n--" followed by @a boundary.  Shifts are capped at 255,
+ * which only makes longer boundaries advance more slowly.
+ *
+ * @param skip table to initialize
+ * @param boundary the boundary
+ * @param blen number of bytes in @a boundary
+ */
+static void
+delim_skip_init (unsigned char *skip,
+                 const char *boundary,
+                 size_t blen)
+{
+  size_t dlen = blen + DELIM_PREFIX_LEN;
+  size_t i;
+
+  memset (skip, (dlen > 255) ? 255 : (int) dlen, 256);
+  for (i = 0; i < dlen - 1; i++)
+    if (dlen - 1 - i <= 255)
+      skip[delim_char (boundary, i)] = (unsigned char) (dlen - 1 - i);
+}
+
+
 /**
  * Create a `struct MHD_PostProcessor`.
  *
@@ -325,7 +430,253 @@ MHD_create_post_processor (struct MHD_Connection *connection,
   ret->state = PP_Init;
   ret->blen = blen;
   ret->boundary = boundary;
+  if (NULL != boundary)
+    delim_skip_init (ret->bskip,
+                     boundary,
+                     blen);
   ret->skip_rn = RN_Inactive;
+  ret->zero_copy = MHD_NO;
+  ret->spool_fd = -1;
+  return ret;
+}
+
+
+/**
+ * Set a custom option for the given PostProcessor.  Should be
+ * called before the first call to #MHD_post_process.
+ *
+ * @param pp the post processor
+ * @param option option to set
+ * @param ... arguments to the option, depending on the option type
+ * @return #MHD_YES on success, #MHD_NO if setting the option failed
+ * @ingroup request
+ */
+int
+MHD_set_post_processor_option (struct MHD_PostProcessor *pp,
+                               enum MHD_POST_PROCESSOR_OPTION option,
+                               ...)
+{
+  va_list ap;
+
+  switch (option)
+    {
+    case MHD_POST_PROCESSOR_OPTION_ZERO_COPY:
+      va_start (ap, option);
+      pp->zero_copy = (MHD_NO != va_arg (ap, int)) ? MHD_YES : MHD_NO;
+      va_end (ap);
+      return MHD_YES;
+    case MHD_POST_PROCESSOR_OPTION_SPOOL:
+      va_start (ap, option);
+      pp->spool_open = va_arg (ap, MHD_PostSpoolOpenCallback);
+      pp->spool_done = va_arg (ap, MHD_PostSpoolDoneCallback);
+      pp->spool_cls = va_arg (ap, void *);
+      va_end (ap);
+      return MHD_YES;
+    case MHD_POST_PROCESSOR_OPTION_BATCH:
+      va_start (ap, option);
+      pp->batch = va_arg (ap, MHD_PostBatchCallback);
+      pp->batch_cls = va_arg (ap, void *);
+      va_end (ap);
+      if (NULL != pp->boundary)
+        pp->batch = NULL; /* only used for url-encoded data */
+      return MHD_YES;
+    default:
+      return MHD_NO;
+    }
+}
+
+
+/**
+ * Find the end of an url-encoded field.
+ *
+ * @param data data to search
+ * @param size number of bytes in @a data
+ * @return offset of the first '&', '\r' or '\n', @a size if none
+ */
+static size_t
+find_field_end (const char *data,
+                size_t size)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    if ( ('&' == data[i]) ||
+         ('\r' == data[i]) ||
+         ('\n' == data[i]) )
+      break;
+  return i;
+}
+
+
+/**
+ * Decode an url-encoded field and append it to @a fields.
+ *
+ * @param field raw "key=value" data
+ * @param size number of bytes in @a field
+ * @param fields array to append to
+ * @param num_fields number of entries in @a fields, incremented
+ * @param strs where to put the decoded strings, advanced
+ */
+static void
+batch_add_field (const char *field,
+                 size_t size,
+                 struct MHD_PostField *fields,
+                 unsigned int *num_fields,
+                 char **strs)
+{
+  struct MHD_PostField *f = &fields[*num_fields];
+  const char *equals;
+  size_t klen;
+
+  equals = memchr (field, '=', size);
+  klen = (NULL == equals) ? size : (size_t) (equals - field);
+  memcpy (*strs, field, klen);
+  (*strs)[klen] = '\0';
+  f->key = *strs;
+  f->key_size = MHD_http_unescape_plus_ (*strs);
+  *strs += klen + 1;
+  if (NULL == equals)
+    {
+      f->value = NULL;
+      f->value_size = 0;
+    }
+  else
+    {
+      memcpy (*strs, &equals[1], size - klen - 1);
+      (*strs)[size - klen - 1] = '\0';
+      f->value = *strs;
+      f->value_size = MHD_http_unescape_plus_ (*strs);
+      *strs += size - klen;
+    }
+  (*num_fields)++;
+}
+
+
+/**
+ * Process url-encoded POST data, passing all fields completed by
+ * @a post_data to the batch callback at once.  The decoded fields
+ * are allocated from the connection's memory pool if possible
+ * (and released again before returning).
+ *
+ * @param pp post processor context
+ * @param post_data upload data
+ * @param post_data_len number of bytes in @a post_data
+ * @return #MHD_YES on success, #MHD_NO if there was an error processing the data
+ */
+static int
+post_process_urlencoded_batch (struct MHD_PostProcessor *pp,
+                               const char *post_data,
+                               size_t post_data_len)
+{
+  struct MemoryPool *pool;
+  char *buf = (char *) &pp[1];
+  struct MHD_PostField *fields;
+  unsigned int num_fields;
+  unsigned int max_fields;
+  void *block;
+  size_t block_size;
+  char *strs;
+  const char *amp;
+  size_t poff;
+  size_t end;
+  int ret;
+
+  if (PP_Error == pp->state)
+    return MHD_NO;
+  if (PP_Done == pp->state)
+    {
+      /* did not expect to receive more data */
+      pp->state = PP_Error;
+      return MHD_NO;
+    }
+  /* bound the number of fields and the decoded size */
+  max_fields = 1;
+  poff = 0;
+  while (NULL != (amp = memchr (&post_data[poff], '&', post_data_len - poff)))
+    {
+      max_fields++;
+      poff = amp - post_data + 1;
+    }
+  block_size = max_fields * sizeof (struct MHD_PostField)
+    + pp->buffer_pos + post_data_len + 2 * max_fields;
+  pool = pp->connection->pool;
+  block = NULL;
+  if (NULL != pool)
+    block = MHD_pool_allocate (pool, block_size, MHD_NO);
+  if (NULL == block)
+    {
+      pool = NULL;
+      if (NULL == (block = malloc (block_size)))
+        {
+          pp->state = PP_Error;
+          return MHD_NO; /* out of memory */
+        }
+    }
+  fields = block;
+  strs = (char *) &fields[max_fields];
+  num_fields = 0;
+  poff = 0;
+  ret = MHD_YES;
+  while (poff < post_data_len)
+    {
+      end = poff + find_field_end (&post_data[poff],
+                                   post_data_len - poff);
+      if (end == post_data_len)
+        {
+          /* incomplete field, keep for the next call */
+          if (end - poff > pp->buffer_size - pp->buffer_pos)
+            {
+              pp->state = PP_Error; /* out of memory */
+              ret = MHD_NO;
+              break;
+            }
+          memcpy (&buf[pp->buffer_pos], &post_data[poff], end - poff);
+          pp->buffer_pos += end - poff;
+          if (NULL != memchr (buf, '=', pp->buffer_pos))
+            pp->state = PP_ProcessValue;
+          break;
+        }
+      if (0 != pp->buffer_pos)
+        {
+          /* completes the field kept from the last call */
+          if (end - poff > pp->buffer_size - pp->buffer_pos)
+            {
+              pp->state = PP_Error; /* out of memory */
+              ret = MHD_NO;
+              break;
+            }
+          memcpy (&buf[pp->buffer_pos], &post_data[poff], end - poff);
+          batch_add_field (buf, pp->buffer_pos + end - poff,
+                           fields, &num_fields, &strs);
+          pp->buffer_pos = 0;
+        }
+      else if (end != poff)
+        {
+          batch_add_field (&post_data[poff], end - poff,
+                           fields, &num_fields, &strs);
+        }
+      pp->state = PP_Init;
+      poff = end + 1;
+      if ('&' != post_data[end])
+        {
+          /* newline, we are done */
+          pp->state = PP_Done;
+          break;
+        }
+    }
+  if ( (MHD_YES == ret) &&
+       (num_fields > 0) &&
+       (MHD_NO == pp->batch (pp->batch_cls,
+                             fields,
+                             num_fields)) )
+    {
+      pp->state = PP_Error;
+      ret = MHD_NO;
+    }
+  if (NULL != pool)
+    (void) MHD_pool_reallocate (pool, block, block_size, 0);
+  else
+    free (block);
   return ret;
 }
 
@@ -352,6 +703,8 @@ post_process_urlencoded (struct MHD_PostProcessor *pp,
   char *buf;
   char xbuf[XBUF_SIZE + 1];
 
+  if (NULL != pp->batch)
+    return post_process_urlencoded_batch (pp, post_data, post_data_len);
   buf = (char *) &pp[1];
   poff = 0;
   while (poff < post_data_len)
@@ -380,8 +733,7 @@ post_process_urlencoded (struct MHD_PostProcessor *pp,
             return MHD_YES;     /* no '=' yet */
           buf[pp->buffer_pos] = '\0';   /* 0-terminate key */
           pp->buffer_pos = 0;   /* reset for next key */
-	  MHD_unescape_plus (buf);
-          MHD_http_unescape (buf);
+          MHD_http_unescape_plus_ (buf);
           poff += equals + 1;
           pp->state = PP_ProcessValue;
           pp->value_offset = 0;
@@ -441,8 +793,7 @@ post_process_urlencoded (struct MHD_PostProcessor *pp,
 
           /* unescape */
           xbuf[xoff] = '\0';    /* 0-terminate in preparation */
-	  MHD_unescape_plus (xbuf);
-          xoff = MHD_http_unescape (xbuf);
+          xoff = MHD_http_unescape_plus_ (xbuf);
           /* finally: call application! */
 	  pp->must_ikvi = MHD_NO;
           if (MHD_NO == pp->ikvi (pp->cls, MHD_POSTDATA_KIND, (const char *) &pp[1],    /* key */
@@ -681,14 +1032,199 @@ process_multipart_headers (struct MHD_PostProcessor *pp,
 }
 
 
+/**
+ * Find the delimiter "\r\n--" followed by @a boundary in @a buf.
+ *
+ * @param buf data to search
+ * @param size number of bytes in @a buf
+ * @param boundary the boundary
+ * @param blen number of bytes in @a boundary
+ * @param skip shift table from #delim_skip_init()
+ * @param[out] found set to #MHD_YES if the complete delimiter
+ *             was found, #MHD_NO otherwise
+ * @return offset of the delimiter if found, otherwise the
+ *         offset at which a partial delimiter starts at the end
+ *         of @a buf, or @a size if there is none; all bytes
+ *         before the returned offset are not part of a delimiter
+ */
+static size_t
+find_delimiter (const char *buf,
+                size_t size,
+                const char *boundary,
+                size_t blen,
+                const unsigned char *skip,
+                int *found)
+{
+  size_t dlen = blen + DELIM_PREFIX_LEN;
+  unsigned char last = delim_char (boundary, dlen - 1);
+  unsigned char c;
+  const char *r;
+  size_t pos;
+
+  *found = MHD_NO;
+  pos = 0;
+  while (pos + dlen <= size)
+    {
+      c = (unsigned char) buf[pos + dlen - 1];
+      if ( (c == last) &&
+           (0 == memcmp (&buf[pos], "\r\n--", DELIM_PREFIX_LEN)) &&
+           (0 == memcmp (&buf[pos + DELIM_PREFIX_LEN],
+                         boundary,
+                         blen)) )
+        {
+          *found = MHD_YES;
+          return pos;
+        }
+      pos += skip[c];
+    }
+  /* the delimiter may start within the last (dlen - 1) bytes */
+  if (size + 1 > dlen)
+    pos = size + 1 - dlen;
+  else
+    pos = 0;
+  while (NULL != (r = memchr (&buf[pos], '\r', size - pos)))
+    {
+      pos = r - buf;
+      if ( (size - pos < DELIM_PREFIX_LEN) &&
+           (0 == memcmp (&buf[pos], "\r\n--", size - pos)) )
+        return pos;
+      if ( (size - pos >= DELIM_PREFIX_LEN) &&
+           (0 == memcmp (&buf[pos], "\r\n--", DELIM_PREFIX_LEN)) &&
+           (0 == memcmp (&buf[pos + DELIM_PREFIX_LEN],
+                         boundary,
+                         size - pos - DELIM_PREFIX_LEN)) )
+        return pos;
+      pos++;
+    }
+  return size;
+}
+
+
+/**
+ * Create an unlinked temporary file to spool a part to.
+ *
+ * @return file descriptor, -1 on error
+ */
+static int
+spool_create_temp (void)
+{
+#ifdef HAVE_MKSTEMP
+  char fn[256];
+  const char *dir;
+  int fd;
+
+  dir = getenv ("TMPDIR");
+  if ( (NULL == dir) ||
+       (strlen (dir) + sizeof ("/mhd-spool-XXXXXX") > sizeof (fn)) )
+    dir = "/tmp";
+  strcpy (fn, dir);
+  strcat (fn, "/mhd-spool-XXXXXX");
+  fd = mkstemp (fn);
+  if (-1 == fd)
+    return -1;
+  (void) unlink (fn);
+  return fd;
+#else
+  return -1;
+#endif
+}
+
+
+/**
+ * A new part starts; ask the application if it should be spooled
+ * to a file (only parts carrying a filename are offered).
+ *
+ * @param pp post processor context
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+static int
+spool_begin (struct MHD_PostProcessor *pp)
+{
+  int fd;
+
+  if ( (NULL == pp->spool_open) ||
+       (NULL == pp->content_filename) )
+    return MHD_YES;
+  fd = pp->spool_open (pp->spool_cls,
+                       pp->content_name,
+                       pp->content_filename,
+                       pp->content_type,
+                       pp->content_transfer_encoding);
+  if (MHD_POST_SPOOL_TEMP_FILE == fd)
+    {
+      fd = spool_create_temp ();
+      if (-1 == fd)
+        {
+          pp->state = PP_Error;
+          return MHD_NO;
+        }
+      pp->spool_temp = MHD_YES;
+    }
+  pp->spool_fd = fd;
+  return MHD_YES;
+}
+
+
+/**
+ * Append @a size bytes of @a data to the spool file.
+ *
+ * @param pp post processor context
+ * @param data data to write
+ * @param size number of bytes in @a data
+ * @return #MHD_YES on success, #MHD_NO on error
+ */
+static int
+spool_write (struct MHD_PostProcessor *pp,
+             const char *data,
+             size_t size)
+{
+  ssize_t ret;
+
+  while (size > 0)
+    {
+      ret = write (pp->spool_fd, data, size);
+      if (-1 == ret)
+        {
+          if (EINTR == errno)
+            continue;
+          return MHD_NO;
+        }
+      data += ret;
+      size -= ret;
+    }
+  return MHD_YES;
+}
+
+
+/**
+ * Stop spooling the current part, closing temporary files.
+ *
+ * @param pp post processor context
+ */
+static void
+spool_close (struct MHD_PostProcessor *pp)
+{
+  if ( (-1 != pp->spool_fd) &&
+       (MHD_YES == pp->spool_temp) )
+    (void) close (pp->spool_fd);
+  pp->spool_fd = -1;
+  pp->spool_temp = MHD_NO;
+}
+
+
 /**
  * We have the value until we hit the given boundary;
- * process accordingly.
+ * process accordingly.  The value is either in our buffer,
+ * or (with #MHD_POST_PROCESSOR_OPTION_ZERO_COPY) still in the
+ * data given to #MHD_post_process().
  *
  * @param pp post processor context
+ * @param data the data to process
+ * @param size number of bytes in @a data
  * @param ioffptr incremented based on the number of bytes processed
  * @param boundary the boundary to look for
  * @param blen strlen(boundary)
+ * @param skip shift table for @a boundary
  * @param next_state what state to go into after the
  *        boundary was found
  * @param next_dash_state state to go into if the next
@@ -699,71 +1235,78 @@ process_multipart_headers (struct MHD_PostProcessor *pp,
  */
 static int
 process_value_to_boundary (struct MHD_PostProcessor *pp,
+                           const char *data,
+                           size_t size,
                            size_t *ioffptr,
                            const char *boundary,
                            size_t blen,
+                           const unsigned char *skip,
                            enum PP_State next_state,
                            enum PP_State next_dash_state)
 {
   char *buf = (char *) &pp[1];
   size_t newline;
-  const char *r;
+  int found;
 
   /* all data in buf until the boundary
-     (\r\n--+boundary) is part of the value */
-  newline = 0;
-  while (1)
+     (\r\n--+boundary) is part of the value; a partial
+     delimiter at the end stays in the buffer and is
+     searched again once more data arrives */
+  newline = find_delimiter (data,
+                            size,
+                            boundary,
+                            blen,
+                            skip,
+                            &found);
+  if (MHD_YES == found)
     {
-      while (newline + 4 < pp->buffer_pos)
-        {
-          r = memchr (&buf[newline], '\r', pp->buffer_pos - newline - 4);
-          if (NULL == r)
-          {
-            newline = pp->buffer_pos - 4;
-            break;
-          }
-          newline = r - buf;
-          if (0 == memcmp ("\r\n--", &buf[newline], 4))
-            break;
-          newline++;
-        }
-      if (newline + pp->blen + 4 <= pp->buffer_pos)
+      /* boundary found, process until newline then
+         skip boundary and go back to init */
+      pp->skip_rn = RN_Dash;
+      pp->state = next_state;
+      pp->dash_state = next_dash_state;
+      (*ioffptr) += blen + DELIM_PREFIX_LEN;       /* skip boundary as well */
+      if (data == buf)
+        buf[newline] = '\0'; /* only our own buffer can be terminated */
+    }
+  else if ( (0 == newline) &&
+            (data == buf) &&
+            (pp->buffer_pos == pp->buffer_size) )
+    {
+      /* cannot check for boundary and no content
+         to process (out of memory) */
+      pp->state = PP_Error;
+      return MHD_NO;
+    }
+  /* newline is either at beginning of boundary or
+     at least at the last character that we are sure
+     is not part of the boundary */
+  if (-1 != pp->spool_fd)
+    {
+      if (MHD_NO == spool_write (pp, data, newline))
         {
-          /* can check boundary */
-          if (0 != memcmp (&buf[newline + 4], boundary, pp->blen))
-            {
-              /* no boundary, "\r\n--" is part of content, skip */
-              newline += 4;
-              continue;
-            }
-          else
-            {
-              /* boundary found, process until newline then
-                 skip boundary and go back to init */
-              pp->skip_rn = RN_Dash;
-              pp->state = next_state;
-              pp->dash_state = next_dash_state;
-              (*ioffptr) += pp->blen + 4;       /* skip boundary as well */
-              buf[newline] = '\0';
-              break;
-            }
+          pp->state = PP_Error;
+          return MHD_NO;
         }
-      else
+      pp->value_offset += newline;
+      (*ioffptr) += newline;
+      if (MHD_YES != found)
+        return MHD_YES;
+      if (MHD_NO == pp->spool_done (pp->spool_cls,
+                                    pp->content_name,
+                                    pp->content_filename,
+                                    pp->content_type,
+                                    pp->content_transfer_encoding,
+                                    pp->spool_fd,
+                                    pp->value_offset))
         {
-          /* cannot check for boundary, process content that
-             we have and check again later; except, if we have
-             no content, abort (out of memory) */
-          if ((0 == newline) && (pp->buffer_pos == pp->buffer_size))
-            {
-              pp->state = PP_Error;
-              return MHD_NO;
-            }
-          break;
+          spool_close (pp);
+          pp->state = PP_Error;
+          return MHD_NO;
         }
+      spool_close (pp);
+      return MHD_YES;
     }
-  /* newline is either at beginning of boundary or
-     at least at the last character that we are sure
-     is not part of the boundary */
   if ( ( (MHD_YES == pp->must_ikvi) ||
 	 (0 != newline) ) &&
        (MHD_NO == pp->ikvi (pp->cls,
@@ -772,7 +1315,7 @@ process_value_to_boundary (struct MHD_PostProcessor *pp,
 			    pp->content_filename,
 			    pp->content_type,
 			    pp->content_transfer_encoding,
-			    buf, pp->value_offset, newline)) )
+			    data, pp->value_offset, newline)) )
     {
       pp->state = PP_Error;
       return MHD_NO;
@@ -842,6 +1385,39 @@ post_process_multipart (struct MHD_PostProcessor *pp,
   while ((poff < post_data_len) ||
          ((pp->buffer_pos > 0) && (state_changed != 0)))
     {
+      /* if we are inside of a value and have nothing buffered,
+         pass the value on without copying it; only a partial
+         boundary at the end of the input is left to buffer */
+      if ( (MHD_YES == pp->zero_copy) &&
+           (0 == pp->buffer_pos) &&
+           (RN_Inactive == pp->skip_rn) &&
+           (poff < post_data_len) )
+        {
+          if ( (PP_ProcessValueToBoundary == pp->state) &&
+               (MHD_NO == process_value_to_boundary (pp,
+                                                     &post_data[poff],
+                                                     post_data_len - poff,
+                                                     &poff,
+                                                     pp->boundary,
+                                                     pp->blen,
+                                                     pp->bskip,
+                                                     PP_PerformCleanup,
+                                                     PP_Done)) )
+            return MHD_NO;
+          if ( (PP_Nested_ProcessValueToBoundary == pp->state) &&
+               (MHD_NO == process_value_to_boundary (pp,
+                                                     &post_data[poff],
+                                                     post_data_len - poff,
+                                                     &poff,
+                                                     pp->nested_boundary,
+                                                     pp->nlen,
+                                                     pp->nskip,
+                                                     PP_Nested_PerformCleanup,
+                                                     PP_NextBoundary)) )
+            return MHD_NO;
+          if (poff == post_data_len)
+            break; /* consumed all input without buffering */
+        }
       /* first, move as much input data
          as possible to our internal buffer */
       max = pp->buffer_size - pp->buffer_pos;
@@ -991,19 +1567,27 @@ post_process_multipart (struct MHD_PostProcessor *pp,
               free (pp->content_type);
               pp->content_type = NULL;
               pp->nlen = strlen (pp->nested_boundary);
+              delim_skip_init (pp->nskip,
+                               pp->nested_boundary,
+                               pp->nlen);
               pp->state = PP_Nested_Init;
               state_changed = 1;
               break;
             }
           pp->state = PP_ProcessValueToBoundary;
           pp->value_offset = 0;
+          if (MHD_NO == spool_begin (pp))
+            return MHD_NO;
           state_changed = 1;
           break;
         case PP_ProcessValueToBoundary:
           if (MHD_NO == process_value_to_boundary (pp,
+                                                   buf,
+                                                   pp->buffer_pos,
                                                    &ioff,
                                                    pp->boundary,
                                                    pp->blen,
+                                                   pp->bskip,
                                                    PP_PerformCleanup,
                                                    PP_Done))
             {
@@ -1068,13 +1652,18 @@ post_process_multipart (struct MHD_PostProcessor *pp,
               else
                 goto END;
             }
+          if (MHD_NO == spool_begin (pp))
+            return MHD_NO;
           state_changed = 1;
           break;
         case PP_Nested_ProcessValueToBoundary:
           if (MHD_NO == process_value_to_boundary (pp,
+                                                   buf,
+                                                   pp->buffer_pos,
                                                    &ioff,
                                                    pp->nested_boundary,
                                                    pp->nlen,
+                                                   pp->nskip,
                                                    PP_Nested_PerformCleanup,
                                                    PP_NextBoundary))
             {
@@ -1164,7 +1753,9 @@ MHD_destroy_post_processor (struct MHD_PostProcessor *pp)
 
   if (NULL == pp)
     return MHD_YES;
-  if (PP_ProcessValue == pp->state)
+  if ( (PP_ProcessValue == pp->state) ||
+       ( (NULL != pp->batch) &&
+         (0 != pp->buffer_pos) ) )
   {
     /* key without terminated value left at the end of the
        buffer; fake receiving a termination character to
@@ -1182,6 +1773,7 @@ MHD_destroy_post_processor (struct MHD_PostProcessor *pp)
     ret = MHD_YES;
   pp->have = NE_none;
   free_unmarked (pp);
+  spool_close (pp);
   if (pp->nested_boundary != NULL)
     free (pp->nested_boundary);
   free (pp);
@@ -35,7 +35,8 @@ static const char *invalid_hundred[] = { NULL };
 static const char *const one_hundred[] = {
   "Continue",
   "Switching Protocols",
-  "Processing"
+  "Processing",
+  "Early Hints"
 };
 
 static const char *const two_hundred[] = {
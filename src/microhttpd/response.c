@@ -29,6 +29,7 @@
 #include "internal.h"
 #include "response.h"
 #include "mhd_limits.h"
+#include "mhd_sendfile.h"
 
 #if defined(_WIN32) && defined(MHD_W32_MUTEX_)
 #ifndef WIN32_LEAN_AND_MEAN
@@ -41,6 +42,80 @@
 #endif /* _WIN32 */
 
 
+/**
+ * Discard the serialized header of @a response, as the headers
+ * changed.  Headers must not be changed while the response is
+ * being sent.
+ *
+ * @param response response to update
+ */
+static void
+drop_header_cache (struct MHD_Response *response)
+{
+  if (NULL == response->header_cache)
+    return;
+  free (response->header_cache);
+  response->header_cache = NULL;
+}
+
+
+/**
+ * Minimum number of bytes of data in a block of the header arena
+ * of a response; enough for the typical headers of a dynamic
+ * response, so that they need a single malloc().
+ */
+#define MHD_HEADER_ARENA_MIN_SIZE 1024
+
+/**
+ * Round up @a n to the alignment of a `struct MHD_HTTP_Header`.
+ */
+#define MHD_HEADER_ARENA_ALIGN(n) \
+  (((n) + (2 * sizeof (void *) - 1)) & ~(2 * sizeof (void *) - 1))
+
+
+/**
+ * Allocate @a size bytes from the header arena of @a response.
+ *
+ * @param response response to allocate for
+ * @param size number of bytes to allocate
+ * @return NULL if out of memory
+ */
+static void *
+header_arena_alloc (struct MHD_Response *response,
+                    size_t size)
+{
+  struct MHD_HeaderArena *arena;
+  size_t block_size;
+  void *ret;
+
+  size = MHD_HEADER_ARENA_ALIGN (size);
+  arena = response->header_arena;
+  if ( (NULL == arena) ||
+       (arena->size - arena->used < size) )
+    {
+      /* double the blocks, so that many headers need few of them */
+      block_size = (NULL == arena)
+        ? MHD_HEADER_ARENA_MIN_SIZE
+        : 2 * arena->size;
+      if (block_size < size)
+        block_size = size;
+      arena = malloc (MHD_HEADER_ARENA_ALIGN (sizeof (struct MHD_HeaderArena))
+                      + block_size);
+      if (NULL == arena)
+        return NULL;
+      arena->size = block_size;
+      arena->used = 0;
+      arena->next = response->header_arena;
+      response->header_arena = arena;
+    }
+  ret = ((char *) arena)
+    + MHD_HEADER_ARENA_ALIGN (sizeof (struct MHD_HeaderArena))
+    + arena->used;
+  arena->used += size;
+  return ret;
+}
+
+
 /**
  * Add a header or footer line to the response.
  *
@@ -57,35 +132,38 @@ add_response_entry (struct MHD_Response *response,
 		    const char *content)
 {
   struct MHD_HTTP_Header *hdr;
+  size_t header_size;
+  size_t value_size;
 
   if ( (NULL == response) ||
        (NULL == header) ||
-       (NULL == content) ||
-       (0 == strlen (header)) ||
-       (0 == strlen (content)) ||
-       (NULL != strchr (header, '\t')) ||
-       (NULL != strchr (header, '\r')) ||
-       (NULL != strchr (header, '\n')) ||
-       (NULL != strchr (content, '\t')) ||
-       (NULL != strchr (content, '\r')) ||
-       (NULL != strchr (content, '\n')) )
+       (NULL == content) )
     return MHD_NO;
-  if (NULL == (hdr = malloc (sizeof (struct MHD_HTTP_Header))))
+  header_size = strlen (header);
+  value_size = strlen (content);
+  if ( (0 == header_size) ||
+       (0 == value_size) ||
+       (header_size != strcspn (header, "\t\r\n")) ||
+       (value_size != strcspn (content, "\t\r\n")) )
     return MHD_NO;
-  if (NULL == (hdr->header = strdup (header)))
-    {
-      free (hdr);
-      return MHD_NO;
-    }
-  if (NULL == (hdr->value = strdup (content)))
-    {
-      free (hdr->header);
-      free (hdr);
-      return MHD_NO;
-    }
+  /* the entry, its name and its value in one piece */
+  hdr = header_arena_alloc (response,
+                            sizeof (struct MHD_HTTP_Header)
+                            + header_size + value_size + 2);
+  if (NULL == hdr)
+    return MHD_NO;
+  hdr->header = (char *) &hdr[1];
+  memcpy (hdr->header, header, header_size + 1);
+  hdr->value = hdr->header + header_size + 1;
+  memcpy (hdr->value, content, value_size + 1);
+  hdr->header_size = header_size;
+  hdr->value_size = value_size;
   hdr->kind = kind;
+  hdr->token = MHD_get_header_token_ (hdr->header,
+                                      hdr->header_size);
   hdr->next = response->first_header;
   response->first_header = hdr;
+  drop_header_cache (response);
   return MHD_YES;
 }
 
@@ -156,13 +234,11 @@ MHD_del_response_header (struct MHD_Response *response,
       if ((0 == strcmp (header, pos->header)) &&
           (0 == strcmp (content, pos->value)))
         {
-          free (pos->header);
-          free (pos->value);
           if (NULL == prev)
             response->first_header = pos->next;
           else
             prev->next = pos->next;
-          free (pos);
+          drop_header_cache (response);
           return MHD_YES;
         }
       prev = pos;
@@ -224,6 +300,125 @@ MHD_get_response_header (struct MHD_Response *response,
 }
 
 
+/**
+ * Get a well-known header (or footer) from the response.
+ *
+ * @param response response to query
+ * @param token which header to get
+ * @return NULL if header does not exist
+ */
+const char *
+MHD_get_response_token_header_ (struct MHD_Response *response,
+                                enum MHD_HeaderToken token)
+{
+  struct MHD_HTTP_Header *pos;
+
+  for (pos = response->first_header; NULL != pos; pos = pos->next)
+    if (token == pos->token)
+      return pos->value;
+  return NULL;
+}
+
+
+/**
+ * Copy the headers from @a pos to the end of the header list of a
+ * response to @a variant, keeping their order.  Headers describing
+ * the body of the response are not copied.
+ *
+ * @param variant response to add the headers to
+ * @param pos first header to copy
+ * @return #MHD_NO on error (out of memory)
+ */
+static int
+copy_variant_headers (struct MHD_Response *variant,
+                      const struct MHD_HTTP_Header *pos)
+{
+  if (NULL == pos)
+    return MHD_YES;
+  /* the list is in inverse order, add the later headers first */
+  if (MHD_YES != copy_variant_headers (variant,
+                                       pos->next))
+    return MHD_NO;
+  if ( (MHD_HEADER_KIND != pos->kind) ||
+       (MHD_HEADER_TOKEN_CONTENT_LENGTH == pos->token) ||
+       (MHD_HEADER_TOKEN_CONTENT_ENCODING == pos->token) )
+    return MHD_YES;
+  return add_response_entry (variant,
+                             MHD_HEADER_KIND,
+                             pos->header,
+                             pos->value);
+}
+
+
+/**
+ * Add an alternative encoding of the body of a response, such as a
+ * precompressed copy.  When the response is queued, MHD sends the
+ * variant with the highest quality in the "Accept-Encoding" header of
+ * the request instead of @a response (variants added first win ties;
+ * @a response itself is only sent if the client prefers "identity"
+ * explicitly).  The headers of @a response are copied to @a variant,
+ * which also gets a "Content-Encoding" header; @a response gets a
+ * "Vary: Accept-Encoding" header unless it already has a "Vary"
+ * header.  Variants must be added before the response is queued and
+ * after its headers were added.
+ *
+ * @param response response to add the variant to
+ * @param encoding content coding of the body of @a variant,
+ *        i.e. "gzip" or "br"
+ * @param variant response with the encoded body; @a response keeps
+ *        a reference, the caller must still destroy its own
+ * @return #MHD_NO on error (invalid arguments or out of memory)
+ * @ingroup response
+ */
+int
+MHD_add_response_variant (struct MHD_Response *response,
+                          const char *encoding,
+                          struct MHD_Response *variant)
+{
+  struct MHD_ResponseVariant *rv;
+  struct MHD_ResponseVariant **tail;
+  size_t len;
+
+  if ( (NULL == response) ||
+       (NULL == variant) ||
+       (NULL == encoding) ||
+       (response == variant) ||
+       (NULL != variant->variants) ||
+       (NULL != response->upgrade_handler) ||
+       (NULL != variant->upgrade_handler) ||
+       (0 == (len = strlen (encoding))) ||
+       (len != strcspn (encoding, " \t\r\n,;")) ||
+       (MHD_str_equal_caseless_ (encoding, "identity")) )
+    return MHD_NO;
+  if ( (NULL == MHD_get_response_header (response,
+                                         MHD_HTTP_HEADER_VARY)) &&
+       (MHD_YES != add_response_entry (response,
+                                       MHD_HEADER_KIND,
+                                       MHD_HTTP_HEADER_VARY,
+                                       "Accept-Encoding")) )
+    return MHD_NO;
+  if ( (MHD_YES != copy_variant_headers (variant,
+                                         response->first_header)) ||
+       (MHD_YES != add_response_entry (variant,
+                                       MHD_HEADER_KIND,
+                                       MHD_HTTP_HEADER_CONTENT_ENCODING,
+                                       encoding)) )
+    return MHD_NO;
+  if (NULL == (rv = malloc (sizeof (struct MHD_ResponseVariant) + len + 1)))
+    return MHD_NO;
+  memcpy (&rv[1], encoding, len + 1);
+  rv->encoding = (const char *) &rv[1];
+  rv->next = NULL;
+  rv->response = variant;
+  variant->flags = response->flags;
+  MHD_increment_response_rc (variant);
+  for (tail = &response->variants; NULL != *tail; tail = &(*tail)->next)
+    ;
+  *tail = rv;
+  return MHD_YES;
+}
+
+
 /**
  * Create a response object.  The response object can be extended with
  * header information and then be used any number of times.
@@ -286,6 +481,7 @@ MHD_set_response_options (struct MHD_Response *response,
 {
   va_list ap;
   int ret;
+  int level;
   enum MHD_ResponseOptions ro;
 
   ret = MHD_YES;
@@ -295,6 +491,38 @@ MHD_set_response_options (struct MHD_Response *response,
   {
     switch (ro)
     {
+    case MHD_RO_COMPRESSION_LEVEL:
+      level = va_arg (ap, int);
+#if HAVE_ZLIB
+      if ( (level < 0) ||
+           (level > 9) ||
+           (NULL == response->crc) )
+        {
+          ret = MHD_NO;
+          break;
+        }
+      if ( (0 != level) &&
+           (NULL == MHD_get_response_header (response,
+                                             MHD_HTTP_HEADER_VARY)) &&
+           (MHD_YES != add_response_entry (response,
+                                           MHD_HEADER_KIND,
+                                           MHD_HTTP_HEADER_VARY,
+                                           "Accept-Encoding")) )
+        {
+          ret = MHD_NO;
+          break;
+        }
+      response->compression_level = level;
+#else
+      ret = MHD_NO;
+#endif
+      break;
+    case MHD_RO_CACHE_TTL:
+      response->cache_ttl = va_arg (ap, unsigned int);
+      break;
+    case MHD_RO_CACHE_STALE_WHILE_REVALIDATE:
+      response->cache_stale = va_arg (ap, unsigned int);
+      break;
     default:
       ret = MHD_NO;
       break;
@@ -442,7 +670,212 @@ MHD_create_response_from_fd_at_offset64 (uint64_t size,
   response->fd = fd;
   response->fd_off = offset;
   response->crc_cls = response;
+  MHD_file_sequential_ (fd);
+  return response;
+}
+
+
+/**
+ * Given a pipe descriptor, read data from the pipe
+ * to generate the response.
+ *
+ * @param cls pointer to the response
+ * @param pos offset in the pipe to access (ignored)
+ * @param buf where to write the data
+ * @param max number of bytes to write at most
+ * @return number of bytes written
+ */
+static ssize_t
+pipe_reader (void *cls,
+             uint64_t pos,
+             char *buf,
+             size_t max)
+{
+  struct MHD_Response *response = cls;
+  ssize_t n;
+
+#ifndef _WIN32
+  if (max > SSIZE_MAX)
+    max = SSIZE_MAX;
+
+  n = read (response->fd, buf, max);
+#else  /* _WIN32 */
+  if (max > INT32_MAX)
+    max = INT32_MAX;
+
+  n = read (response->fd, buf, (unsigned int)max);
+#endif /* _WIN32 */
+
+  if (0 == n)
+    return MHD_CONTENT_READER_END_OF_STREAM;
+  if (n < 0)
+    return MHD_CONTENT_READER_END_WITH_ERROR;
+  return n;
+}
+
+
+/**
+ * Create a response object with the body read from a pipe (or a
+ * socket) until the end of the stream.  On Linux, the body is moved
+ * into the socket of the connection with splice(), without copying
+ * it into user space; it is then sent without chunked encoding and
+ * the connection is closed after the response.  The response object
+ * can be extended with header information, but can only be used once,
+ * as the data is consumed from @a fd.
+ *
+ * @param fd read end of a pipe or a socket providing the data; will
+ *        be closed when response is destroyed; fd should be in
+ *        'blocking' mode
+ * @return NULL on error (i.e. invalid arguments, out of memory)
+ * @ingroup response
+ */
+_MHD_EXTERN struct MHD_Response *
+MHD_create_response_from_pipe (int fd)
+{
+  struct MHD_Response *response;
+
+  if (-1 == fd)
+    return NULL;
+  response = MHD_create_response_from_callback (MHD_SIZE_UNKNOWN,
+						4 * 1024,
+						&pipe_reader,
+						NULL,
+						&free_callback);
+  if (NULL == response)
+    return NULL;
+  response->fd = fd;
+  response->is_pipe = MHD_YES;
+  response->crc_cls = response;
+  return response;
+}
+
+
+#if HAVE_MEMFD_CREATE && HAVE_MMAP
+/**
+ * Copy data from the mapping of the memfd of a response created
+ * with #MHD_create_response_from_memfd(), for connections that do
+ * not use sendfile() (HTTPS, compression).
+ *
+ * @param cls pointer to the response
+ * @param pos offset in the response body to access
+ * @param buf where to write the data
+ * @param max number of bytes to write at most
+ * @return number of bytes written
+ */
+static ssize_t
+memfd_reader (void *cls,
+              uint64_t pos,
+              char *buf,
+              size_t max)
+{
+  struct MHD_Response *response = cls;
+
+  if (pos >= response->total_size)
+    return MHD_CONTENT_READER_END_OF_STREAM;
+  if (max > response->total_size - pos)
+    max = (size_t) (response->total_size - pos);
+  if (max > SSIZE_MAX)
+    max = SSIZE_MAX;
+  memcpy (buf,
+          &((const char *) response->memfd_map)[(size_t) pos],
+          max);
+  return (ssize_t) max;
+}
+
+
+/**
+ * Destroy memfd reader context.  Unmaps and closes the memfd.
+ *
+ * @param cls pointer to the response
+ */
+static void
+memfd_free_callback (void *cls)
+{
+  struct MHD_Response *response = cls;
+
+  (void) munmap (response->memfd_map,
+                 (size_t) response->total_size);
+  response->memfd_map = NULL;
+  free_callback (response);
+}
+#endif
+
+
+/**
+ * Create a response object with a copy of @a buffer kept in a sealed
+ * in-memory file (memfd), which plain connections send with
+ * sendfile().  The response object can be extended with header
+ * information and then be used any number of times.
+ *
+ * @param size size of the data portion of the response
+ * @param buffer @a size bytes with the data, copied right away
+ * @return NULL on error (i.e. invalid arguments, out of memory)
+ * @ingroup response
+ */
+struct MHD_Response *
+MHD_create_response_from_memfd (size_t size,
+                                const void *buffer)
+{
+#if HAVE_MEMFD_CREATE && HAVE_MMAP
+  struct MHD_Response *response;
+  void *map;
+  size_t off;
+  ssize_t n;
+  int fd;
+
+  if ( (NULL == buffer) && (0 < size) )
+    return NULL;
+  if ( (0 == size) ||
+       (-1 == (fd = memfd_create ("libmicrohttpd",
+                                  MFD_CLOEXEC | MFD_ALLOW_SEALING))) )
+    goto copy; /* nothing to map, or a kernel before 3.17 */
+  for (off = 0; off < size; off += n)
+    {
+      n = write (fd,
+                 &((const char *) buffer)[off],
+                 MHD_MIN (size - off, (size_t) SSIZE_MAX));
+      if ( (0 > n) &&
+           (EINTR == errno) )
+        n = 0;
+      else if (0 >= n)
+        {
+          (void) close (fd);
+          return NULL;
+        }
+    }
+#ifdef F_ADD_SEALS
+  /* connections may be sending the body while the application
+     still holds the response, nobody may change it */
+  (void) fcntl (fd,
+                F_ADD_SEALS,
+                F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
+  map = mmap (NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (MAP_FAILED == map)
+    {
+      (void) close (fd);
+      return NULL;
+    }
+  response = MHD_create_response_from_callback (size,
+						4 * 1024,
+						&memfd_reader,
+						NULL,
+						&memfd_free_callback);
+  if (NULL == response)
+    {
+      (void) munmap (map, size);
+      (void) close (fd);
+      return NULL;
+    }
+  response->fd = fd;
+  response->memfd_map = map;
+  response->crc_cls = response;
   return response;
+ copy:
+#endif
+  return MHD_create_response_from_buffer (size,
+                                          (void *) buffer,
+                                          MHD_RESPMEM_MUST_COPY);
 }
 
 
@@ -573,10 +1006,19 @@ MHD_create_response_from_buffer (size_t size,
 void
 MHD_destroy_response (struct MHD_Response *response)
 {
-  struct MHD_HTTP_Header *pos;
+  struct MHD_HeaderArena *arena;
+  struct MHD_ResponseVariant *rv;
 
   if (NULL == response)
     return;
+#ifdef HAVE_ATOMIC_BUILTINS
+  /* release our accesses to the response, acquire those of the
+     other holders before we free it */
+  if (0 != __atomic_sub_fetch (&response->reference_count,
+                               1,
+                               __ATOMIC_ACQ_REL))
+    return;
+#else
   (void) MHD_mutex_lock_ (&response->mutex);
   if (0 != --(response->reference_count))
     {
@@ -584,27 +1026,240 @@ MHD_destroy_response (struct MHD_Response *response)
       return;
     }
   (void) MHD_mutex_unlock_ (&response->mutex);
+#endif
   (void) MHD_mutex_destroy_ (&response->mutex);
+  drop_header_cache (response);
   if (response->crfc != NULL)
     response->crfc (response->crc_cls);
-  while (NULL != response->first_header)
+  while (NULL != (arena = response->header_arena))
     {
-      pos = response->first_header;
-      response->first_header = pos->next;
-      free (pos->header);
-      free (pos->value);
-      free (pos);
+      response->header_arena = arena->next;
+      free (arena);
+    }
+  while (NULL != (rv = response->variants))
+    {
+      response->variants = rv->next;
+      MHD_destroy_response (rv->response);
+      free (rv);
     }
   free (response);
 }
 
 
+/**
+ * Copy data from the fragments of an iovec-based response
+ * (used for HTTPS and chunked encoding, where the fragments
+ * cannot be handed to the socket directly).
+ *
+ * @param cls pointer to the response
+ * @param pos offset in the response body to access
+ * @param buf where to write the data
+ * @param max number of bytes to write at most
+ * @return number of bytes written
+ */
+static ssize_t
+iovec_reader (void *cls, uint64_t pos, char *buf, size_t max)
+{
+  struct MHD_Response *response = cls;
+  unsigned int i;
+  size_t off;
+  size_t n;
+
+  if (pos >= response->total_size)
+    return MHD_CONTENT_READER_END_OF_STREAM;
+  if (max > SSIZE_MAX)
+    max = SSIZE_MAX;
+  /* find the fragment containing 'pos' */
+  for (i = 0; i < response->data_iovcnt; i++)
+    {
+      if (pos < response->data_iov[i].iov_len)
+        break;
+      pos -= response->data_iov[i].iov_len;
+    }
+  off = 0;
+  for (; (i < response->data_iovcnt) && (off < max); i++)
+    {
+      n = MHD_MIN (response->data_iov[i].iov_len - (size_t) pos,
+                   max - off);
+      memcpy (&buf[off],
+              &((const char *) response->data_iov[i].iov_base)[(size_t) pos],
+              n);
+      off += n;
+      pos = 0;
+    }
+  return (ssize_t) off;
+}
+
+
+/**
+ * Destroy iovec reader context.  Releases the copy of the
+ * fragment array and calls the application's free callback.
+ *
+ * @param cls pointer to the response
+ */
+static void
+iovec_free_callback (void *cls)
+{
+  struct MHD_Response *response = cls;
+
+  if (NULL != response->data_iov_free_cb)
+    response->data_iov_free_cb (response->data_iov_free_cls);
+  free (response->data_iov);
+  response->data_iov = NULL;
+}
+
+
+/**
+ * Create a response object from an array of memory fragments.  The
+ * response object can be extended with header information and then
+ * be used any number of times.
+ *
+ * @param iov the array of fragments; the array itself is copied
+ * @param iovcnt number of elements in @a iov
+ * @param free_cb function to call when the response is destroyed
+ *        to release the fragments, can be NULL
+ * @param cls closure for @a free_cb
+ * @return NULL on error (i.e. invalid arguments, out of memory)
+ * @ingroup response
+ */
+struct MHD_Response *
+MHD_create_response_from_iovec (const struct MHD_IoVec *iov,
+                                unsigned int iovcnt,
+                                MHD_ContentReaderFreeCallback free_cb,
+                                void *cls)
+{
+  struct MHD_Response *response;
+  struct MHD_IoVec *copy;
+  uint64_t total;
+  unsigned int i;
+
+  if ( (NULL == iov) &&
+       (0 != iovcnt) )
+    return NULL;
+#if SIZEOF_UNSIGNED_INT >= SIZEOF_SIZE_T
+  if (iovcnt > SIZE_MAX / sizeof (struct MHD_IoVec))
+    return NULL;
+#endif
+  total = 0;
+  for (i = 0; i < iovcnt; i++)
+    {
+      if ( (NULL == iov[i].iov_base) &&
+           (0 != iov[i].iov_len) )
+        return NULL;
+      if (total + iov[i].iov_len < total)
+        return NULL; /* overflow */
+      total += iov[i].iov_len;
+    }
+  if ((int64_t) total < 0)
+    return NULL;
+  copy = NULL;
+  if ( (0 != iovcnt) &&
+       (NULL == (copy = malloc (iovcnt * sizeof (struct MHD_IoVec)))) )
+    return NULL;
+  if (0 != iovcnt)
+    memcpy (copy, iov, iovcnt * sizeof (struct MHD_IoVec));
+  response = MHD_create_response_from_callback (total,
+						4 * 1024,
+						&iovec_reader,
+						NULL,
+						&iovec_free_callback);
+  if (NULL == response)
+    {
+      free (copy);
+      return NULL;
+    }
+  response->data_iov = copy;
+  response->data_iovcnt = iovcnt;
+  response->data_iov_free_cb = free_cb;
+  response->data_iov_free_cls = cls;
+  response->crc_cls = response;
+  return response;
+}
+
+
+/**
+ * Create a response object that can be used for 101 UPGRADE
+ * responses, for example to implement WebSockets.  After sending the
+ * response, control over the data stream is given to the callback.
+ *
+ * @param upgrade_handler function to call with the 'upgraded' socket
+ * @param upgrade_handler_cls closure for @a upgrade_handler
+ * @return NULL on error (i.e. invalid arguments, out of memory)
+ */
+struct MHD_Response *
+MHD_create_response_for_upgrade (MHD_UpgradeHandler upgrade_handler,
+				 void *upgrade_handler_cls)
+{
+  struct MHD_Response *response;
+
+  if (NULL == upgrade_handler)
+    return NULL; /* invalid request */
+  if (NULL == (response = malloc (sizeof (struct MHD_Response))))
+    return NULL;
+  memset (response, 0, sizeof (struct MHD_Response));
+  response->fd = -1;
+  if (MHD_YES != MHD_mutex_create_ (&response->mutex))
+    {
+      free (response);
+      return NULL;
+    }
+  response->upgrade_handler = upgrade_handler;
+  response->upgrade_handler_cls = upgrade_handler_cls;
+  response->total_size = 0;
+  response->reference_count = 1;
+  return response;
+}
+
+
+/**
+ * This connection-specific callback is provided by MHD to
+ * applications (unusual) during the #MHD_UpgradeHandler.
+ * It allows applications to perform 'special' actions on
+ * the underlying socket from the upgrade.
+ *
+ * @param urh the handle identifying the connection to perform
+ *            the upgrade @a action on.
+ * @param action which action should be performed
+ * @param ... arguments to the action (depends on the action)
+ * @return #MHD_NO on error, #MHD_YES on success
+ */
+int
+MHD_upgrade_action (struct MHD_UpgradeResponseHandle *urh,
+                    enum MHD_UpgradeAction action,
+                    ...)
+{
+  if (NULL == urh)
+    return MHD_NO;
+  switch (action)
+    {
+    case MHD_UPGRADE_ACTION_CLOSE:
+      if (MHD_YES == urh->was_closed)
+        return MHD_NO; /* already closed */
+      /* the daemon's event loop finishes the connection once it
+         is resumed, see #MHD_CONNECTION_UPGRADE */
+      urh->was_closed = MHD_YES;
+      MHD_resume_connection (urh->connection);
+      return MHD_YES;
+    default:
+      /* we don't understand this one */
+      return MHD_NO;
+    }
+}
+
+
 void
 MHD_increment_response_rc (struct MHD_Response *response)
 {
+#ifdef HAVE_ATOMIC_BUILTINS
+  /* the caller already holds a reference, no ordering needed */
+  (void) __atomic_add_fetch (&response->reference_count,
+                             1,
+                             __ATOMIC_RELAXED);
+#else
   (void) MHD_mutex_lock_ (&response->mutex);
   (response->reference_count)++;
   (void) MHD_mutex_unlock_ (&response->mutex);
+#endif
 }
 
 
@@ -35,4 +35,16 @@ void
 MHD_increment_response_rc (struct MHD_Response *response);
 
 
+/**
+ * Get a well-known header (or footer) from the response.
+ *
+ * @param response response to query
+ * @param token which header to get
+ * @return NULL if header does not exist
+ */
+const char *
+MHD_get_response_token_header_ (struct MHD_Response *response,
+                                enum MHD_HeaderToken token);
+
+
 #endif
@@ -0,0 +1,211 @@
+/*
+ * This code implements the SHA-256 message-digest algorithm
+ * (FIPS 180-4).  This code is in the public domain; do with it
+ * what you wish.
+ *
+ * To compute the message digest of a chunk of bytes, declare a
+ * SHA256Context structure, pass it to SHA256Init, call SHA256Update
+ * as needed on buffers full of bytes, and then call SHA256Final,
+ * which will fill a supplied 32-byte array with the digest.
+ */
+
+/* Structured like md5.c */
+
+#include "sha256.h"
+
+#define PUT_64BIT_BE(cp, value) do {					\
+	(cp)[0] = (uint8_t)((value) >> 56);				\
+	(cp)[1] = (uint8_t)((value) >> 48);				\
+	(cp)[2] = (uint8_t)((value) >> 40);				\
+	(cp)[3] = (uint8_t)((value) >> 32);				\
+	(cp)[4] = (uint8_t)((value) >> 24);				\
+	(cp)[5] = (uint8_t)((value) >> 16);				\
+	(cp)[6] = (uint8_t)((value) >> 8);				\
+	(cp)[7] = (uint8_t)((value)); } while (0)
+
+#define PUT_32BIT_BE(cp, value) do {					\
+	(cp)[0] = (uint8_t)((value) >> 24);				\
+	(cp)[1] = (uint8_t)((value) >> 16);				\
+	(cp)[2] = (uint8_t)((value) >> 8);				\
+	(cp)[3] = (uint8_t)((value)); } while (0)
+
+static const uint8_t PADDING[SHA256_BLOCK_SIZE] = {
+  0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+/* Round constants */
+static const uint32_t K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+  0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+  0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+  0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+  0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+  0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define CH(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define MAJ(x, y, z) (((x) & (y)) | ((z) & ((x) | (y))))
+#define S0(x) (ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define S1(x) (ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define s0(x) (ROTR(x, 7) ^ ROTR(x, 18) ^ ((x) >> 3))
+#define s1(x) (ROTR(x, 17) ^ ROTR(x, 19) ^ ((x) >> 10))
+
+/*
+ * The core of the SHA-256 algorithm, this alters an existing hash to
+ * reflect the addition of 16 longwords of new data.
+ */
+static void
+SHA256Transform(uint32_t state[8], const uint8_t block[SHA256_BLOCK_SIZE])
+{
+  uint32_t w[64];
+  uint32_t a, b, c, d, e, f, g, h, t1, t2;
+  unsigned int i;
+
+  for (i = 0; i < 16; i++)
+    w[i] = (uint32_t)block[i * 4 + 0] << 24 |
+      (uint32_t)block[i * 4 + 1] << 16 |
+      (uint32_t)block[i * 4 + 2] << 8 |
+      (uint32_t)block[i * 4 + 3];
+  for (i = 16; i < 64; i++)
+    w[i] = s1(w[i - 2]) + w[i - 7] + s0(w[i - 15]) + w[i - 16];
+
+  a = state[0];
+  b = state[1];
+  c = state[2];
+  d = state[3];
+  e = state[4];
+  f = state[5];
+  g = state[6];
+  h = state[7];
+
+  for (i = 0; i < 64; i++)
+  {
+    t1 = h + S1(e) + CH(e, f, g) + K[i] + w[i];
+    t2 = S0(a) + MAJ(a, b, c);
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+/*
+ * Start SHA-256 accumulation.  Set bit count to 0 and the state to
+ * the initial hash value.
+ */
+void
+SHA256Init(struct SHA256Context *ctx)
+{
+  if (!ctx)
+    return;
+
+  ctx->count = 0;
+  ctx->state[0] = 0x6a09e667;
+  ctx->state[1] = 0xbb67ae85;
+  ctx->state[2] = 0x3c6ef372;
+  ctx->state[3] = 0xa54ff53a;
+  ctx->state[4] = 0x510e527f;
+  ctx->state[5] = 0x9b05688c;
+  ctx->state[6] = 0x1f83d9ab;
+  ctx->state[7] = 0x5be0cd19;
+}
+
+/*
+ * Update context to reflect the concatenation of another buffer full
+ * of bytes.
+ */
+void
+SHA256Update(struct SHA256Context *ctx, const unsigned char *input, size_t len)
+{
+  size_t have, need;
+
+  if (!ctx || !input)
+    return;
+
+  /* Check how many bytes we already have and how many more we need. */
+  have = (size_t)((ctx->count >> 3) & (SHA256_BLOCK_SIZE - 1));
+  need = SHA256_BLOCK_SIZE - have;
+
+  /* Update bitcount */
+  ctx->count += (uint64_t)len << 3;
+
+  if (len >= need)
+  {
+    if (have != 0)
+    {
+      memcpy(ctx->buffer + have, input, need);
+      SHA256Transform(ctx->state, ctx->buffer);
+      input += need;
+      len -= need;
+      have = 0;
+    }
+
+    /* Process data in SHA256_BLOCK_SIZE-byte chunks. */
+    while (len >= SHA256_BLOCK_SIZE)
+    {
+      SHA256Transform(ctx->state, input);
+      input += SHA256_BLOCK_SIZE;
+      len -= SHA256_BLOCK_SIZE;
+    }
+  }
+
+  /* Handle any remaining bytes of data. */
+  if (len != 0)
+    memcpy(ctx->buffer + have, input, len);
+}
+
+/*
+ * Final wrapup--pad, fill in digest and zero out ctx.
+ */
+void
+SHA256Final(unsigned char digest[SHA256_DIGEST_SIZE], struct SHA256Context *ctx)
+{
+  uint8_t count[8];
+  size_t padlen;
+  int i;
+
+  if (!ctx || !digest)
+    return;
+
+  /* Convert count to 8 bytes in big endian order. */
+  PUT_64BIT_BE(count, ctx->count);
+
+  /* Pad out to 56 mod 64. */
+  padlen = SHA256_BLOCK_SIZE -
+    ((ctx->count >> 3) & (SHA256_BLOCK_SIZE - 1));
+  if (padlen < 1 + 8)
+    padlen += SHA256_BLOCK_SIZE;
+  SHA256Update(ctx, PADDING, padlen - 8);	/* padlen - 8 <= 64 */
+  SHA256Update(ctx, count, 8);
+
+  for (i = 0; i < 8; i++)
+    PUT_32BIT_BE(digest + i * 4, ctx->state[i]);
+
+  memset(ctx, 0, sizeof(*ctx));
+}
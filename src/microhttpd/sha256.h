@@ -0,0 +1,44 @@
+/*
+ * This code implements the SHA-256 message-digest algorithm
+ * (FIPS 180-4).  This code is in the public domain; do with it
+ * what you wish.
+ *
+ * To compute the message digest of a chunk of bytes, declare a
+ * SHA256Context structure, pass it to SHA256Init, call SHA256Update
+ * as needed on buffers full of bytes, and then call SHA256Final,
+ * which will fill a supplied 32-byte array with the digest.
+ */
+
+#ifndef MHD_SHA256_H
+#define MHD_SHA256_H
+
+#include "platform.h"
+
+#define	SHA256_BLOCK_SIZE           64
+#define	SHA256_DIGEST_SIZE          32
+
+struct SHA256Context
+{
+  uint32_t state[8];			/* state */
+  uint64_t count;			/* number of bits, mod 2^64 */
+  uint8_t buffer[SHA256_BLOCK_SIZE];	/* input buffer */
+};
+
+/*
+ * Start SHA-256 accumulation.  Set bit count to 0 and the state to
+ * the initial hash value.
+ */
+void SHA256Init(struct SHA256Context *ctx);
+
+/*
+ * Update context to reflect the concatenation of another buffer full
+ * of bytes.
+ */
+void SHA256Update(struct SHA256Context *ctx, const unsigned char *input, size_t len);
+
+/*
+ * Final wrapup--pad, fill in digest and zero out ctx.
+ */
+void SHA256Final(unsigned char digest[SHA256_DIGEST_SIZE], struct SHA256Context *ctx);
+
+#endif /* !MHD_SHA256_H */
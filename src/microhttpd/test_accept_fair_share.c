@@ -0,0 +1,238 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_accept_fair_share.c
+ * @brief  Testcase for #MHD_OPTION_ACCEPT_FAIR_SHARE: connections
+ *         kept open are spread evenly over the threads of a pool
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1200
+
+/**
+ * Number of threads in the pool.
+ */
+#define WORKERS 4
+
+/**
+ * Connections a thread may have above the average.
+ */
+#define FAIR_SHARE 1
+
+/**
+ * Number of connections kept open.
+ */
+#define CONNECTIONS 24
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  const union MHD_ConnectionInfo *info;
+  struct MHD_Response *response;
+  char worker[32];
+  int ret;
+
+  info = MHD_get_connection_info (connection,
+                                  MHD_CONNECTION_INFO_DAEMON);
+  snprintf (worker, sizeof (worker), "%p", (void *) info->daemon);
+  response = MHD_create_response_from_buffer (strlen (worker),
+                                              worker,
+                                              MHD_RESPMEM_MUST_COPY);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Open a connection to the daemon and send a request on it, leaving
+ * the connection open.
+ *
+ * @param sock set to the socket
+ * @param worker set to the worker that answered, of @a size bytes
+ * @param size size of @a worker
+ * @return 0 on success
+ */
+static int
+request (MHD_socket *sock,
+         char *worker,
+         size_t size)
+{
+  static const char req[] =
+    "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  struct sockaddr_in sa;
+  struct timeval tv;
+  char buf[512];
+  size_t off;
+  ssize_t got;
+  const char *body;
+
+  *sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == *sock)
+    abort ();
+  /* a worker that never resumed accepting would leave us waiting */
+  tv.tv_sec = 5;
+  tv.tv_usec = 0;
+  setsockopt (*sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (*sock,
+                    (struct sockaddr *) &sa,
+                    sizeof (sa)))
+    abort ();
+  if (sizeof (req) - 1 != (size_t) send (*sock, req, sizeof (req) - 1, 0))
+    abort ();
+  /* the body is a pointer, so the response is complete once the
+     headers are followed by a short body */
+  off = 0;
+  body = NULL;
+  while ( (off < sizeof (buf) - 1) &&
+          (0 < (got = recv (*sock, &buf[off], sizeof (buf) - 1 - off, 0))) )
+    {
+      off += got;
+      buf[off] = '\0';
+      if ( (NULL != (body = strstr (buf, "\r\n\r\n"))) &&
+           (NULL != strstr (buf, "Content-Length: ")) &&
+           (strlen (body + 4) == (size_t) atol (strstr (buf, "Content-Length: ")
+                                                + strlen ("Content-Length: "))) )
+        break;
+      body = NULL;
+    }
+  if ( (NULL == body) ||
+       (0 != strncmp (buf, "HTTP/1.1 200", strlen ("HTTP/1.1 200"))) )
+    return 1;
+  snprintf (worker, size, "%s", body + 4);
+  return 0;
+}
+
+
+/**
+ * Open #CONNECTIONS connections one after the other and check that
+ * no thread of the pool got much more than its share of them.
+ *
+ * @param flags event loop flags for the daemon
+ * @return 0 on success
+ */
+static int
+check_fair_share (unsigned int flags)
+{
+  struct MHD_Daemon *d;
+  MHD_socket socks[CONNECTIONS];
+  char workers[CONNECTIONS][32];
+  unsigned int count;
+  unsigned int max;
+  unsigned int opened;
+  unsigned int i;
+  unsigned int j;
+  int ret;
+
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_THREAD_POOL_SIZE, (unsigned int) WORKERS,
+                        MHD_OPTION_ACCEPT_FAIR_SHARE, (unsigned int) FAIR_SHARE,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  for (opened = 0; opened < CONNECTIONS; opened++)
+    if (0 != request (&socks[opened],
+                      workers[opened],
+                      sizeof (workers[opened])))
+      {
+        fprintf (stderr,
+                 "Request %u failed\n",
+                 opened);
+        ret = 2;
+        break;
+      }
+  /* each connection was accepted by a thread with at most
+     FAIR_SHARE + 1 connections above the average at the time */
+  max = 0;
+  for (i = 0; i < opened; i++)
+    {
+      count = 0;
+      for (j = 0; j < opened; j++)
+        if (0 == strcmp (workers[i], workers[j]))
+          count++;
+      if (count > max)
+        max = count;
+    }
+  if ( (0 == ret) &&
+       (max > CONNECTIONS / WORKERS + FAIR_SHARE + 1) )
+    {
+      fprintf (stderr,
+               "A thread has %u of %u connections\n",
+               max,
+               CONNECTIONS);
+      ret = 4;
+    }
+  for (i = 0; i < opened; i++)
+    MHD_socket_close_ (socks[i]);
+  MHD_stop_daemon (d);
+  if (0 != ret)
+    fprintf (stderr,
+             "Check with flags %u failed\n",
+             flags);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += check_fair_share (MHD_USE_SELECT_INTERNALLY);
+  errorCount += check_fair_share (MHD_USE_POLL_INTERNALLY);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_EPOLL))
+    errorCount += check_fair_share (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
+
+/* end of test_accept_fair_share.c */
@@ -0,0 +1,244 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_access_log.c
+ * @brief  Testcase for #MHD_OPTION_ACCESS_LOG_CALLBACK and
+ *         #MHD_OPTION_ACCESS_LOG_FD: completed requests are passed on
+ *         in batches
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+
+/**
+ * Number of requests sent on one keep-alive connection.
+ */
+#define NUM_REQUESTS 10
+
+/**
+ * Records per batch.
+ */
+#define BATCH_SIZE 4
+
+#define REQUEST "GET /log?x=1 HTTP/1.1\r\nHost: localhost\r\n\r\n"
+
+#define PAGE "access log"
+
+
+static unsigned int records;
+
+static unsigned int batches;
+
+static int bad_record;
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_buffer (strlen (PAGE),
+                                              (void *) PAGE,
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection,
+                            MHD_HTTP_OK,
+                            response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+static void
+access_log (void *cls,
+            const struct MHD_AccessLogRecord *rec,
+            unsigned int num_records)
+{
+  unsigned int i;
+
+  if ( (0 == num_records) ||
+       (BATCH_SIZE < num_records) )
+    bad_record = 1;
+  for (i = 0; i < num_records; i++)
+    if ( (0 != strcmp (rec[i].method, "GET")) ||
+         (0 != strcmp (rec[i].url, "/log")) ||
+         (MHD_HTTP_OK != rec[i].status) ||
+         (strlen (PAGE) != rec[i].bytes_sent) ||
+         (AF_INET != rec[i].addr.ss_family) ||
+         (0 == rec[i].time) ||
+         (rec[i].times.body_sent < rec[i].times.first_byte) )
+      bad_record = 1;
+  records += num_records;
+  batches++;
+}
+
+
+/**
+ * Send @a req on @a sock and wait for a response that contains
+ * @a expect, or for the daemon to close the connection if @a expect
+ * is NULL.
+ *
+ * @return 0 on success
+ */
+static int
+exchange (MHD_socket sock,
+          const char *req,
+          size_t req_size,
+          const char *expect)
+{
+  char buf[1024];
+  size_t off;
+  ssize_t got;
+  fd_set rs;
+  struct timeval tv;
+
+  if (req_size != (size_t) write (sock, req, req_size))
+    return 1;
+  off = 0;
+  buf[0] = '\0';
+  while ( (NULL == expect) ||
+          (NULL == strstr (buf, expect)) )
+    {
+      FD_ZERO (&rs);
+      FD_SET (sock, &rs);
+      tv.tv_sec = 5;
+      tv.tv_usec = 0;
+      if (1 != select (sock + 1, &rs, NULL, NULL, &tv))
+        return 2;
+      got = read (sock, &buf[off], sizeof (buf) - 1 - off);
+      if (0 >= got)
+        return (NULL == expect) ? 0 : 4;
+      off += got;
+      buf[off] = '\0';
+      if (sizeof (buf) - 1 == off)
+        off = 0;
+    }
+  return 0;
+}
+
+
+static int
+test_access_log (unsigned int flags,
+                 uint16_t port)
+{
+  struct MHD_Daemon *d;
+  MHD_socket sock;
+  int fds[2];
+  char lines[4096];
+  char *pos;
+  ssize_t got;
+  unsigned int i;
+  int ret;
+
+  records = 0;
+  batches = 0;
+  bad_record = 0;
+  if (0 != pipe (fds))
+    return 1;
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        port,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_ACCESS_LOG_CALLBACK, &access_log, NULL,
+                        MHD_OPTION_ACCESS_LOG_FD, fds[1],
+                        MHD_OPTION_ACCESS_LOG_BATCH_SIZE, (unsigned int) BATCH_SIZE,
+                        MHD_OPTION_ACCESS_LOG_INTERVAL, (unsigned int) 50,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  sock = connect_to (port);
+  for (i = 0; i < NUM_REQUESTS; i++)
+    ret |= exchange (sock, REQUEST, strlen (REQUEST), PAGE) << 1;
+  MHD_socket_close_ (sock);
+  /* full batches are passed on right away */
+  usleep (100 * 1000);
+  if (NUM_REQUESTS / BATCH_SIZE * BATCH_SIZE > records)
+    ret |= 8;
+  /* the rest is passed on when the daemon stops */
+  MHD_stop_daemon (d);
+  if (NUM_REQUESTS != records)
+    ret |= 16;
+  if (0 != bad_record)
+    ret |= 32;
+  (void) close (fds[1]);
+  got = read (fds[0], lines, sizeof (lines) - 1);
+  (void) close (fds[0]);
+  if (got <= 0)
+    return ret | 64;
+  lines[got] = '\0';
+  i = 0;
+  for (pos = lines; NULL != (pos = strstr (pos, " 127.0.0.1 \"GET /log\" 200 10 ")); pos++)
+    i++;
+  if (NUM_REQUESTS != i)
+    ret |= 128;
+  if (0 != ret)
+    fprintf (stderr,
+             "%u records in %u batches, lines:\n%s",
+             records,
+             batches,
+             lines);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += test_access_log (MHD_USE_SELECT_INTERNALLY,
+                                 1162);
+#ifdef HAVE_POLL
+  errorCount += test_access_log (MHD_USE_POLL_INTERNALLY,
+                                 1163);
+#endif
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
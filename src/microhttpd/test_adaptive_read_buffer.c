@@ -0,0 +1,237 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_adaptive_read_buffer.c
+ * @brief  Testcase for #MHD_OPTION_ADAPTIVE_READ_BUFFER: once small
+ *         requests were seen, their read buffers leave most of the
+ *         pool to the application, and larger requests still work
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1202
+
+/**
+ * Memory limit of the connections.
+ */
+#define POOL_SIZE 16384
+
+/**
+ * Bytes the handler tries to allocate from the pool; more than is
+ * left next to a read buffer of half the pool.
+ */
+#define ALLOC_SIZE 10000
+
+/**
+ * Number of small requests sent on one connection.
+ */
+#define REQUESTS 40
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  struct MHD_Response *response;
+  const char *answer;
+  int ret;
+
+  answer = (NULL != MHD_connection_alloc (connection,
+                                          ALLOC_SIZE))
+    ? "yes" : "no";
+  response = MHD_create_response_from_buffer (strlen (answer),
+                                              (void *) answer,
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Receive one response with a body of "yes" or "no".
+ *
+ * @param sock socket to read from
+ * @return 1 for "yes", 0 for "no", -1 on error
+ */
+static int
+get_answer (MHD_socket sock)
+{
+  char buf[1024];
+  size_t off;
+  ssize_t got;
+  const char *body;
+
+  off = 0;
+  while (off < sizeof (buf) - 1)
+    {
+      /* read byte by byte, a pipelined response may follow */
+      got = recv (sock, &buf[off], 1, 0);
+      if (1 != got)
+        return -1;
+      off++;
+      buf[off] = '\0';
+      if (NULL == (body = strstr (buf, "\r\n\r\n")))
+        continue;
+      if (0 != strncmp (buf, "HTTP/1.1 200", strlen ("HTTP/1.1 200")))
+        return -1;
+      if (0 == strcmp (body + 4, "yes"))
+        return 1;
+      if ( (0 == strcmp (body + 4, "no")) &&
+           (NULL != strstr (buf, "Content-Length: 2\r\n")) )
+        return 0;
+    }
+  return -1;
+}
+
+
+/**
+ * Send @a req on @a sock.
+ *
+ * @param sock the socket
+ * @param req the request(s)
+ */
+static void
+send_request (MHD_socket sock,
+              const char *req)
+{
+  if (strlen (req) != (size_t) send (sock, req, strlen (req), 0))
+    abort ();
+}
+
+
+/**
+ * Send small requests on one connection, then one with large headers
+ * and two pipelined ones.
+ *
+ * @param percentile value of #MHD_OPTION_ADAPTIVE_READ_BUFFER
+ * @return 0 on success
+ */
+static int
+check_read_buffer (unsigned int percentile)
+{
+  static const char req[] =
+    "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  struct MHD_Daemon *d;
+  MHD_socket sock;
+  char large[8192];
+  unsigned int i;
+  int first;
+  int last;
+  int ret;
+
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_CONNECTION_MEMORY_LIMIT, (size_t) POOL_SIZE,
+                        MHD_OPTION_CONNECTION_ALLOC_RESERVE, (size_t) 1024,
+                        MHD_OPTION_ADAPTIVE_READ_BUFFER, percentile,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  sock = connect_to_timeout (PORT, 5);
+  first = -1;
+  last = -1;
+  for (i = 0; i < REQUESTS; i++)
+    {
+      send_request (sock, req);
+      last = get_answer (sock);
+      if (-1 == last)
+        break;
+      if (0 == i)
+        first = last;
+    }
+  /* without the estimate, the read buffer takes half of the pool */
+  if ( (0 != first) ||
+       (last != ((0 != percentile) ? 1 : 0)) )
+    ret |= 2;
+  /* a request with headers above the estimate grows the buffer */
+  snprintf (large,
+            sizeof (large),
+            "GET / HTTP/1.1\r\nHost: localhost\r\nX-Large: %06000d\r\n\r\n",
+            0);
+  send_request (sock, large);
+  if (-1 == get_answer (sock))
+    ret |= 4;
+  /* pipelined requests are kept across the reset of the buffer */
+  snprintf (large,
+            sizeof (large),
+            "%s%s",
+            req,
+            req);
+  send_request (sock, large);
+  if ( (-1 == get_answer (sock)) ||
+       (-1 == get_answer (sock)) )
+    ret |= 8;
+  MHD_socket_close_ (sock);
+  MHD_stop_daemon (d);
+  if (0 != ret)
+    fprintf (stderr,
+             "Check with percentile %u failed (%d)\n",
+             percentile,
+             ret);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += check_read_buffer (0);
+  errorCount += check_read_buffer (99);
+  /* values above 100 are refused */
+  if (NULL != MHD_start_daemon (MHD_USE_SELECT_INTERNALLY,
+                                PORT,
+                                NULL, NULL,
+                                &ahc_echo, NULL,
+                                MHD_OPTION_ADAPTIVE_READ_BUFFER, 101,
+                                MHD_OPTION_END))
+    errorCount++;
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
+
+/* end of test_adaptive_read_buffer.c */
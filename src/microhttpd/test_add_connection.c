@@ -0,0 +1,215 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_add_connection.c
+ * @brief  Testcase for #MHD_add_connection() and
+ *         #MHD_add_connections() waking up the internal event loop
+ *         of a daemon
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1114
+
+/**
+ * Number of connections added to each daemon.
+ */
+#define CONNECTIONS 32
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_buffer (strlen (url),
+                                              (void *) url,
+                                              MHD_RESPMEM_MUST_COPY);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Add connections accepted by ourselves to a daemon, all before
+ * sending any request, and check the replies.
+ *
+ * @param flags event loop flags for the daemon
+ * @param threads number of threads of a thread pool, 0 for none
+ * @param batch #MHD_YES to add all connections with one call of
+ *        #MHD_add_connections()
+ * @return 0 on success
+ */
+static int
+check_add (unsigned int flags,
+           unsigned int threads,
+           int batch)
+{
+  struct MHD_NewConnection added[CONNECTIONS];
+  struct sockaddr_in addrs[CONNECTIONS];
+  struct MHD_Daemon *d;
+  MHD_socket lsock;
+  MHD_socket csocks[CONNECTIONS];
+  MHD_socket ssock;
+  struct sockaddr_in sa;
+  struct sockaddr_in ca;
+  socklen_t ca_len;
+  socklen_t sa_len;
+  char request[128];
+  char reply[512];
+  char url[16];
+  const char *body;
+  size_t have;
+  ssize_t got;
+  unsigned int i;
+  int ret;
+
+  d = MHD_start_daemon (flags | MHD_USE_PIPE_FOR_SHUTDOWN | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_THREAD_POOL_SIZE, threads,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  lsock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == lsock)
+    abort ();
+  /* the connections are accepted on a port of our own */
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  sa_len = sizeof (sa);
+  if ( (0 != bind (lsock, (struct sockaddr *) &sa, sizeof (sa))) ||
+       (0 != listen (lsock, CONNECTIONS)) ||
+       (0 != getsockname (lsock, (struct sockaddr *) &sa, &sa_len)) )
+    abort ();
+  for (i = 0; i < CONNECTIONS; i++)
+    {
+      csocks[i] = socket (AF_INET, SOCK_STREAM, 0);
+      if ( (MHD_INVALID_SOCKET == csocks[i]) ||
+           (0 != connect (csocks[i], (struct sockaddr *) &sa, sizeof (sa))) )
+        abort ();
+      ca_len = sizeof (ca);
+      ssock = accept (lsock, (struct sockaddr *) &ca, &ca_len);
+      if (MHD_INVALID_SOCKET == ssock)
+        abort ();
+      if (MHD_YES == batch)
+        {
+          addrs[i] = ca;
+          added[i].socket = ssock;
+          added[i].addr = (struct sockaddr *) &addrs[i];
+          added[i].addrlen = ca_len;
+          continue;
+        }
+      if (MHD_YES != MHD_add_connection (d,
+                                         ssock,
+                                         (struct sockaddr *) &ca,
+                                         ca_len))
+        abort ();
+    }
+  if ( (MHD_YES == batch) &&
+       (CONNECTIONS != MHD_add_connections (d,
+                                            added,
+                                            CONNECTIONS)) )
+    abort ();
+  MHD_socket_close_ (lsock);
+  ret = 0;
+  for (i = 0; i < CONNECTIONS; i++)
+    {
+      snprintf (request,
+                sizeof (request),
+                "GET /%u HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+                i);
+      if (strlen (request) !=
+          (size_t) write (csocks[i], request, strlen (request)))
+        abort ();
+      have = 0;
+      while ( (have < sizeof (reply) - 1) &&
+              (0 < (got = read (csocks[i],
+                                &reply[have],
+                                sizeof (reply) - 1 - have))) )
+        have += got;
+      reply[have] = '\0';
+      MHD_socket_close_ (csocks[i]);
+      snprintf (url, sizeof (url), "/%u", i);
+      if ( (NULL == (body = strstr (reply, "\r\n\r\n"))) ||
+           (0 != strcmp (body + 4, url)) )
+        ret = 2;
+    }
+  MHD_stop_daemon (d);
+  if (0 != ret)
+    fprintf (stderr,
+             "Added connections not served with flags %u, %u threads%s\n",
+             flags,
+             threads,
+             (MHD_YES == batch) ? " (batch)" : "");
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += check_add (MHD_USE_SELECT_INTERNALLY, 0, MHD_NO);
+  errorCount += check_add (MHD_USE_POLL_INTERNALLY, 0, MHD_NO);
+#if EPOLL_SUPPORT
+  errorCount += check_add (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY, 0, MHD_NO);
+#endif
+  errorCount += check_add (MHD_USE_SELECT_INTERNALLY, 0, MHD_YES);
+  errorCount += check_add (MHD_USE_SELECT_INTERNALLY, 4, MHD_YES);
+#if EPOLL_SUPPORT
+  errorCount += check_add (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY, 4, MHD_YES);
+#endif
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
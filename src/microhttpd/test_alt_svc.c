@@ -0,0 +1,169 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_alt_svc.c
+ * @brief  Testcase for #MHD_OPTION_ALT_SVC: the header is added to
+ *         HTTP/1.x responses unless they set one themselves
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1201
+
+#define ALT_SVC "h3=\":4433\"; ma=3600"
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  struct MHD_Response *response;
+  int ret;
+
+  response = MHD_create_response_from_buffer (strlen ("hello"),
+                                              "hello",
+                                              MHD_RESPMEM_PERSISTENT);
+  if (0 == strcmp (url, "/own"))
+    MHD_add_response_header (response,
+                             MHD_HTTP_HEADER_ALT_SVC,
+                             "clear");
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Send a request and get the response.
+ *
+ * @param req the request
+ * @param buf set to the response
+ * @param size size of @a buf
+ * @return 0 on success
+ */
+static int
+request (const char *req,
+         char *buf,
+         size_t size)
+{
+  struct sockaddr_in sa;
+  MHD_socket sock;
+  size_t off;
+  ssize_t got;
+
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sock)
+    abort ();
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (sock,
+                    (struct sockaddr *) &sa,
+                    sizeof (sa)))
+    abort ();
+  if (strlen (req) != (size_t) send (sock, req, strlen (req), 0))
+    abort ();
+  off = 0;
+  while ( (off < size - 1) &&
+          (0 < (got = recv (sock, &buf[off], size - 1 - off, 0))) )
+    off += got;
+  buf[off] = '\0';
+  MHD_socket_close_ (sock);
+  if (0 != strncmp (buf, "HTTP/1.", strlen ("HTTP/1.")))
+    return 1;
+  return 0;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  struct MHD_Daemon *d;
+  char buf[1024];
+  unsigned int errorCount;
+
+  /* values that would break the header are refused */
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_ALT_SVC, "h3=\":443\"\r\nX-Injected: 1",
+                        MHD_OPTION_END);
+  if (NULL != d)
+    {
+      MHD_stop_daemon (d);
+      return 1;
+    }
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_ALT_SVC, ALT_SVC,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 2;
+  errorCount = 0;
+  if ( (0 != request ("GET / HTTP/1.1\r\nHost: localhost\r\n"
+                      "Connection: close\r\n\r\n",
+                      buf,
+                      sizeof (buf))) ||
+       (NULL == strstr (buf, "\r\n" MHD_HTTP_HEADER_ALT_SVC ": " ALT_SVC "\r\n")) )
+    errorCount |= 4;
+  if ( (0 != request ("GET / HTTP/1.0\r\n\r\n",
+                      buf,
+                      sizeof (buf))) ||
+       (NULL == strstr (buf, "\r\n" MHD_HTTP_HEADER_ALT_SVC ": " ALT_SVC "\r\n")) )
+    errorCount |= 8;
+  /* the header of the response replaces the one of the daemon */
+  if ( (0 != request ("GET /own HTTP/1.1\r\nHost: localhost\r\n"
+                      "Connection: close\r\n\r\n",
+                      buf,
+                      sizeof (buf))) ||
+       (NULL == strstr (buf, "\r\n" MHD_HTTP_HEADER_ALT_SVC ": clear\r\n")) ||
+       (NULL != strstr (buf, ALT_SVC)) )
+    errorCount |= 16;
+  MHD_stop_daemon (d);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
+
+/* end of test_alt_svc.c */
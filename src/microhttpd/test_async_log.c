@@ -0,0 +1,242 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_async_log.c
+ * @brief  Testcase for #MHD_OPTION_LOG_QUEUE_SIZE and
+ *         #MHD_OPTION_LOG_RATE_LIMIT: a slow logger does not block
+ *         the daemon, and repeated messages are suppressed
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+
+/**
+ * Number of requests that do not fit into the memory pool, each
+ * of them is logged.
+ */
+#define NUM_BAD 10
+
+/**
+ * Size of the requests that do not fit.
+ */
+#define BAD_SIZE 8192
+
+#define PAGE "log"
+
+
+/**
+ * Messages written by the logger.
+ */
+static volatile unsigned int logged;
+
+/**
+ * Microseconds the logger takes per message.
+ */
+static unsigned int log_delay;
+
+
+static void
+slow_logger (void *cls,
+             const char *fmt,
+             va_list ap)
+{
+  char buf[512];
+
+  vsnprintf (buf, sizeof (buf), fmt, ap);
+  if (0 != log_delay)
+    usleep (log_delay);
+  logged++;
+}
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_buffer (strlen (PAGE),
+                                              (void *) PAGE,
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection,
+                            MHD_HTTP_OK,
+                            response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Send @a req on @a sock and wait for a response that contains
+ * @a expect, or for the daemon to close the connection if @a expect
+ * is NULL.
+ *
+ * @return 0 on success
+ */
+static int
+exchange (MHD_socket sock,
+          const char *req,
+          size_t req_size,
+          const char *expect)
+{
+  char buf[1024];
+  size_t off;
+  ssize_t got;
+  fd_set rs;
+  struct timeval tv;
+
+  if (req_size != (size_t) write (sock, req, req_size))
+    return 1;
+  off = 0;
+  buf[0] = '\0';
+  while ( (NULL == expect) ||
+          (NULL == strstr (buf, expect)) )
+    {
+      FD_ZERO (&rs);
+      FD_SET (sock, &rs);
+      tv.tv_sec = 5;
+      tv.tv_usec = 0;
+      if (1 != select (sock + 1, &rs, NULL, NULL, &tv))
+        return 2;
+      got = read (sock, &buf[off], sizeof (buf) - 1 - off);
+      if (0 >= got)
+        return (NULL == expect) ? 0 : 4;
+      off += got;
+      buf[off] = '\0';
+      if (sizeof (buf) - 1 == off)
+        off = 0;
+    }
+  return 0;
+}
+
+
+static int
+test_log (unsigned int queue_size,
+          unsigned int rate_limit,
+          unsigned int delay,
+          uint16_t port)
+{
+  struct MHD_Daemon *d;
+  const union MHD_DaemonInfo *info;
+  MHD_socket sock;
+  char *big;
+  unsigned int i;
+  int ret;
+
+  logged = 0;
+  log_delay = delay;
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        port,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_CONNECTION_MEMORY_LIMIT, (size_t) (BAD_SIZE / 2),
+                        MHD_OPTION_EXTERNAL_LOGGER, &slow_logger, NULL,
+                        MHD_OPTION_LOG_QUEUE_SIZE, queue_size,
+                        MHD_OPTION_LOG_RATE_LIMIT, rate_limit,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  big = malloc (BAD_SIZE);
+  if (NULL == big)
+    abort ();
+  memset (big, 'a', BAD_SIZE);
+  memcpy (big, "GET /", strlen ("GET /"));
+  for (i = 0; i < NUM_BAD; i++)
+    {
+      sock = connect_to (port);
+      ret |= exchange (sock, big, BAD_SIZE, NULL) << 1;
+      MHD_socket_close_ (sock);
+    }
+  free (big);
+  info = MHD_get_daemon_info (d,
+                              MHD_DAEMON_INFO_STATS);
+  if (NULL == info)
+    abort ();
+  if (0 != delay)
+    {
+      /* the logger is too slow for the requests, the ring
+         overflows instead of blocking the daemon */
+      if (0 == info->stats.log_dropped)
+        ret |= 8;
+    }
+  if (0 != rate_limit)
+    {
+      if (0 == info->stats.log_suppressed)
+        ret |= 16;
+    }
+  MHD_stop_daemon (d);
+  /* the messages left are written when the daemon stops */
+  if (0 == logged)
+    ret |= 32;
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += test_log (4,
+                          0,
+                          100 * 1000,
+                          1159);
+  errorCount += test_log (0,
+                          1,
+                          0,
+                          1160);
+  errorCount += test_log (16,
+                          1,
+                          0,
+                          1161);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,287 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_basic_auth.c
+ * @brief  Testcase for the base64 decoder, #MHD_basic_auth_get_credentials()
+ *         and the cache of verified Basic authorization headers
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "base64.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1197
+
+#define USER "Aladdin"
+
+#define PASS "open sesame"
+
+/**
+ * "Aladdin:open sesame" in base64.
+ */
+#define CREDENTIALS "QWxhZGRpbjpvcGVuIHNlc2FtZQ=="
+
+/**
+ * "Aladdin:wrong" in base64.
+ */
+#define WRONG_CREDENTIALS "QWxhZGRpbjp3cm9uZw=="
+
+
+/**
+ * Number of times the access handler checked a password.
+ */
+static unsigned int password_checks;
+
+
+/**
+ * Check the credentials of the request with the realm given by the
+ * URL, using the cache of verified headers.
+ */
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  const char *user;
+  const char *pass;
+  int ok;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  ok = MHD_basic_auth_check_cached (connection, url);
+  if ( (MHD_YES != ok) &&
+       (MHD_YES == MHD_basic_auth_get_credentials (connection,
+                                                   &user,
+                                                   &pass)) )
+    {
+      password_checks++;
+      if ( (0 == strcmp (user, USER)) &&
+           (0 == strcmp (pass, PASS)) )
+        {
+          ok = MHD_YES;
+          MHD_basic_auth_cache_verified (connection, url);
+        }
+    }
+  response = MHD_create_response_from_buffer (strlen ("ok"),
+                                              "ok",
+                                              MHD_RESPMEM_PERSISTENT);
+  if (MHD_YES == ok)
+    ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  else
+    ret = MHD_queue_basic_auth_fail_response (connection,
+                                              url,
+                                              response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Send a request for @a url and return the status code of the reply.
+ *
+ * @param url URL to request
+ * @param credentials base64 credentials to send, NULL for none
+ * @return the status code, 0 on errors
+ */
+static unsigned int
+query (const char *url,
+       const char *credentials)
+{
+  struct sockaddr_in sa;
+  char request[1024];
+  char reply[2048];
+  MHD_socket sock;
+  size_t have;
+  ssize_t got;
+  unsigned int status;
+
+  if (NULL == credentials)
+    snprintf (request,
+              sizeof (request),
+              "GET %s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+              url);
+  else
+    snprintf (request,
+              sizeof (request),
+              "GET %s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n"
+              "Authorization: Basic %s\r\n\r\n",
+              url, credentials);
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if ( (MHD_INVALID_SOCKET == sock) ||
+       (0 != connect (sock, (struct sockaddr *) &sa, sizeof (sa))) )
+    abort ();
+  if (strlen (request) !=
+      (size_t) write (sock, request, strlen (request)))
+    abort ();
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          (0 < (got = read (sock, &reply[have], sizeof (reply) - 1 - have))) )
+    have += got;
+  reply[have] = '\0';
+  MHD_socket_close_ (sock);
+  if (1 != sscanf (reply, "HTTP/1.1 %u", &status))
+    return 0;
+  return status;
+}
+
+
+/**
+ * Check that @a src decodes to @a expected.
+ *
+ * @param src base64 to decode
+ * @param expected expected result, NULL if @a src is invalid
+ * @return 0 on success
+ */
+static int
+check_decode (const char *src,
+              const char *expected)
+{
+  char buf[64];
+  size_t len;
+
+  len = BASE64DecodeTo (src, strlen (src), buf);
+  if (NULL == expected)
+    {
+      if ((size_t) -1 == len)
+        return 0;
+    }
+  else if ( (strlen (expected) == len) &&
+            (0 == memcmp (buf, expected, len)) )
+    return 0;
+  fprintf (stderr,
+           "Decoding `%s' failed\n",
+           src);
+  return 1;
+}
+
+
+/**
+ * Authenticate requests against a daemon with the given cache.
+ *
+ * @param cache_size number of entries of the cache
+ * @return 0 on success
+ */
+static int
+check_cache (unsigned int cache_size)
+{
+  struct MHD_Daemon *d;
+  unsigned int cached;
+  int ret;
+
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_BASIC_AUTH_CACHE_SIZE, cache_size,
+                        MHD_OPTION_BASIC_AUTH_CACHE_TTL, 1,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  password_checks = 0;
+  if (MHD_HTTP_UNAUTHORIZED != query ("/a", NULL))
+    ret |= 1;
+  if (MHD_HTTP_UNAUTHORIZED != query ("/a", "QWxhZGRpbg=="))
+    ret |= 1;
+  if (MHD_HTTP_UNAUTHORIZED != query ("/a", "QWxh!GRpbg=="))
+    ret |= 1;
+  if (MHD_HTTP_UNAUTHORIZED != query ("/a", WRONG_CREDENTIALS))
+    ret |= 1;
+  if (MHD_HTTP_UNAUTHORIZED != query ("/a", WRONG_CREDENTIALS))
+    ret |= 1;
+  if (2 != password_checks)
+    ret |= 2;
+  /* only the first request with the right password is checked */
+  password_checks = 0;
+  if (MHD_HTTP_OK != query ("/a", CREDENTIALS))
+    ret |= 4;
+  if (MHD_HTTP_OK != query ("/a", CREDENTIALS))
+    ret |= 4;
+  if (MHD_HTTP_OK != query ("/b", CREDENTIALS))
+    ret |= 4;
+  cached = (0 == cache_size) ? 3 : 2;
+  if (cached != password_checks)
+    ret |= 8;
+  /* entries expire */
+  password_checks = 0;
+  sleep (2);
+  if (MHD_HTTP_OK != query ("/a", CREDENTIALS))
+    ret |= 16;
+  if (1 != password_checks)
+    ret |= 16;
+  MHD_stop_daemon (d);
+  if (0 != ret)
+    fprintf (stderr,
+             "Basic authentication checks failed with a cache of %u entries: %d\n",
+             cache_size, ret);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += check_decode ("", "");
+  errorCount += check_decode ("Zg==", "f");
+  errorCount += check_decode ("Zm8=", "fo");
+  errorCount += check_decode ("Zm9v", "foo");
+  errorCount += check_decode ("Zm9vYmFy", "foobar");
+  errorCount += check_decode ("Zm9vYg==", "foob");
+  errorCount += check_decode ("Zm9", NULL);
+  errorCount += check_decode ("Zm9v!A==", NULL);
+  errorCount += check_decode ("Zg==Zm9v", NULL);
+  errorCount += check_decode ("Z===", NULL);
+  errorCount += check_decode ("Zg=v", NULL);
+  errorCount += check_cache (0);
+  errorCount += check_cache (16);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,365 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_broadcast.c
+ * @brief  Testcase for #MHD_create_response_from_broadcast(): events
+ *         published on one broadcast reach several HTTP/1.1 (chunked)
+ *         and HTTP/1.0 subscribers, which finish once the broadcast
+ *         is destroyed
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+/**
+ * Number of subscribers, see #requests.
+ */
+#define SUBSCRIBERS 4
+
+/**
+ * Size of the large event, larger than the socket buffers.
+ */
+#define LARGE_SIZE 300000
+
+
+/**
+ * Broadcast the responses are created for.
+ */
+static struct MHD_Broadcast *bc;
+
+/**
+ * Requests of the subscribers: the first ones get a chunked body on
+ * a persistent connection, the others one that ends when the
+ * connection is closed.
+ */
+static const char *requests[SUBSCRIBERS] = {
+  "GET /events HTTP/1.1\r\nHost: localhost\r\n\r\n",
+  "GET /events HTTP/1.1\r\nHost: localhost\r\n\r\n",
+  "GET /events HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+  "GET /events HTTP/1.0\r\n\r\n"
+};
+
+/**
+ * Number of the first #requests that get a chunked body.
+ */
+#define CHUNKED_SUBSCRIBERS 2
+
+
+static int
+ahc_events (void *cls,
+            struct MHD_Connection *connection,
+            const char *url,
+            const char *method,
+            const char *version,
+            const char *upload_data,
+            size_t *upload_data_size,
+            void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_broadcast (bc);
+  if (NULL == response)
+    return MHD_NO;
+  MHD_add_response_header (response,
+                           MHD_HTTP_HEADER_CONTENT_TYPE,
+                           "text/event-stream");
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+static void
+completed_cb (void *cls,
+              struct MHD_Connection *connection,
+              void **con_cls,
+              enum MHD_RequestTerminationCode toe)
+{
+  unsigned int *completed = cls;
+
+  if (MHD_REQUEST_TERMINATED_COMPLETED_OK == toe)
+    (*completed)++;
+}
+
+
+/**
+ * Read the header of the response from @a sock.
+ *
+ * @return 0 if it is a "200 OK" header
+ */
+static int
+read_header (MHD_socket sock)
+{
+  char buf[1024];
+  size_t have;
+  ssize_t got;
+
+  have = 0;
+  while (have < sizeof (buf) - 1)
+    {
+      /* byte by byte, not to consume the body */
+      got = read (sock, &buf[have], 1);
+      if (got <= 0)
+        return 1;
+      have++;
+      buf[have] = '\0';
+      if ( (have >= 4) &&
+           (0 == memcmp (&buf[have - 4], "\r\n\r\n", 4)) )
+        break;
+    }
+  if ( (NULL == strstr (buf, " 200 ")) ||
+       (NULL == strstr (buf, "text/event-stream")) )
+    return 1;
+  return 0;
+}
+
+
+/**
+ * Read the body of the response from @a sock until the server closes
+ * the connection or, if it is chunked, until the last chunk and
+ * decode it.
+ *
+ * @param sock socket to read from
+ * @param chunked non-zero to decode the chunked encoding
+ * @param[out] len set to the length of the body
+ * @return the body, NULL on error
+ */
+static char *
+read_body (MHD_socket sock,
+           int chunked,
+           size_t *len)
+{
+  char *buf;
+  char *body;
+  size_t size;
+  size_t have;
+  size_t pos;
+  size_t n;
+  ssize_t got;
+  char *end;
+
+  size = 2 * LARGE_SIZE;
+  if (NULL == (buf = malloc (size)))
+    return NULL;
+  have = 0;
+  while ( (have < size) &&
+          (0 < (got = read (sock, &buf[have], size - have))) )
+    {
+      have += got;
+      /* the events do not contain the last chunk */
+      if ( (chunked) &&
+           (have >= 7) &&
+           (0 == memcmp (&buf[have - 7], "\r\n0\r\n\r\n", 7)) )
+        break;
+    }
+  if (! chunked)
+    {
+      *len = have;
+      return buf;
+    }
+  if (NULL == (body = malloc (have)))
+    {
+      free (buf);
+      return NULL;
+    }
+  *len = 0;
+  pos = 0;
+  while (pos < have)
+    {
+      n = strtoul (&buf[pos], &end, 16);
+      if ( (end == &buf[pos]) ||
+           (end + 2 > &buf[have]) ||
+           (0 != memcmp (end, "\r\n", 2)) )
+        break;
+      pos = end - buf + 2;
+      if (0 == n)
+        {
+          /* last chunk, no trailer */
+          if ( (pos + 2 == have) &&
+               (0 == memcmp (&buf[pos], "\r\n", 2)) )
+            {
+              free (buf);
+              return body;
+            }
+          break;
+        }
+      if ( (pos + n + 2 > have) ||
+           (0 != memcmp (&buf[pos + n], "\r\n", 2)) )
+        break;
+      memcpy (&body[*len], &buf[pos], n);
+      *len += n;
+      pos += n + 2;
+    }
+  free (buf);
+  free (body);
+  return NULL;
+}
+
+
+/**
+ * Subscribe #SUBSCRIBERS clients, publish some events including a
+ * large one, destroy the broadcast and check what each client got.
+ *
+ * @param flags daemon flags to use
+ * @param pool size of the thread pool, 0 for none
+ * @param port port to use
+ * @return 0 on success
+ */
+static int
+test_broadcast (unsigned int flags,
+                unsigned int pool,
+                uint16_t port)
+{
+  static const char *small[] = {
+    "data: one\n\n",
+    "data: two\n\n",
+    "data: three\n\n"
+  };
+  struct MHD_Daemon *d;
+  MHD_socket socks[SUBSCRIBERS];
+  char *expected;
+  char *body;
+  size_t expected_len;
+  size_t len;
+  unsigned int completed;
+  unsigned int i;
+  int ret;
+
+  bc = MHD_broadcast_create (8);
+  if (NULL == bc)
+    return 1;
+  expected = malloc (LARGE_SIZE + 64);
+  if (NULL == expected)
+    abort ();
+  completed = 0;
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        port,
+                        NULL, NULL,
+                        &ahc_events, NULL,
+                        MHD_OPTION_NOTIFY_COMPLETED, &completed_cb, &completed,
+                        MHD_OPTION_THREAD_POOL_SIZE, pool,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    {
+      MHD_broadcast_destroy (bc);
+      free (expected);
+      return 2;
+    }
+  ret = 0;
+  for (i = 0; i < SUBSCRIBERS; i++)
+    {
+      socks[i] = connect_to (port);
+      if ( (strlen (requests[i]) != (size_t) write (socks[i],
+                                                     requests[i],
+                                                     strlen (requests[i]))) ||
+           (0 != read_header (socks[i])) )
+        ret |= 4;
+    }
+  /* all clients are subscribed once their header was sent */
+  expected_len = 0;
+  for (i = 0; i < 2; i++)
+    {
+      if (MHD_YES != MHD_broadcast_publish (bc,
+                                            small[i],
+                                            strlen (small[i])))
+        ret |= 8;
+      memcpy (&expected[expected_len], small[i], strlen (small[i]));
+      expected_len += strlen (small[i]);
+    }
+  memset (&expected[expected_len], 'x', LARGE_SIZE);
+  if (MHD_YES != MHD_broadcast_publish (bc,
+                                        &expected[expected_len],
+                                        LARGE_SIZE))
+    ret |= 8;
+  expected_len += LARGE_SIZE;
+  if (MHD_YES != MHD_broadcast_publish (bc,
+                                        small[2],
+                                        strlen (small[2])))
+    ret |= 8;
+  memcpy (&expected[expected_len], small[2], strlen (small[2]));
+  expected_len += strlen (small[2]);
+  if (MHD_NO != MHD_broadcast_publish (bc, "", 0))
+    ret |= 8;
+  MHD_broadcast_destroy (bc);
+  bc = NULL;
+  for (i = 0; i < SUBSCRIBERS; i++)
+    {
+      body = read_body (socks[i],
+                        i < CHUNKED_SUBSCRIBERS,
+                        &len);
+      if ( (NULL == body) ||
+           (len != expected_len) ||
+           (0 != memcmp (body, expected, len)) )
+        ret |= 16;
+      free (body);
+      MHD_socket_close_ (socks[i]);
+    }
+  MHD_stop_daemon (d);
+  free (expected);
+  if (SUBSCRIBERS != completed)
+    ret |= 32;
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += test_broadcast (MHD_USE_SELECT_INTERNALLY | MHD_USE_SUSPEND_RESUME,
+                                0, 1181);
+  errorCount += test_broadcast (MHD_USE_SELECT_INTERNALLY | MHD_USE_SUSPEND_RESUME,
+                                2, 1181);
+  errorCount += test_broadcast (MHD_USE_SELECT_INTERNALLY, 0, 1181);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_POLL))
+    errorCount += test_broadcast (MHD_USE_SELECT_INTERNALLY | MHD_USE_POLL |
+                                  MHD_USE_SUSPEND_RESUME,
+                                  0, 1181);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_EPOLL))
+    errorCount += test_broadcast (MHD_USE_SELECT_INTERNALLY |
+                                  MHD_USE_EPOLL_LINUX_ONLY |
+                                  MHD_USE_SUSPEND_RESUME,
+                                  2, 1181);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,212 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_busy_poll.c
+ * @brief  Testcase for MHD_OPTION_EPOLL_BUSY_POLL: requests are
+ *         served and the event loop spins for the busy-poll window
+ *         after a request before it blocks again
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+
+#define REQUEST "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n"
+
+#define PAGE "busy poll"
+
+/**
+ * Busy-poll window used by the test, in microseconds.
+ */
+#define WINDOW_USEC 200000
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_buffer (strlen (PAGE),
+                                              (void *) PAGE,
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection,
+                            MHD_HTTP_OK,
+                            response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Send a request on @a sock and check that the complete response
+ * arrives within a second.
+ *
+ * @return 0 on success
+ */
+static int
+request (MHD_socket sock)
+{
+  char buf[1024];
+  size_t off;
+  ssize_t got;
+  fd_set rs;
+  struct timeval tv;
+
+  if (strlen (REQUEST) != (size_t) write (sock, REQUEST, strlen (REQUEST)))
+    return 1;
+  off = 0;
+  buf[0] = '\0';
+  while (NULL == strstr (buf, PAGE))
+    {
+      FD_ZERO (&rs);
+      FD_SET (sock, &rs);
+      tv.tv_sec = 1;
+      tv.tv_usec = 0;
+      if (1 != select (sock + 1, &rs, NULL, NULL, &tv))
+        return 2;
+      got = read (sock, &buf[off], sizeof (buf) - 1 - off);
+      if (0 >= got)
+        return 4;
+      off += got;
+      buf[off] = '\0';
+      if (sizeof (buf) - 1 == off)
+        return 8;
+    }
+  if (0 != strncmp (buf, "HTTP/1.1 200", strlen ("HTTP/1.1 200")))
+    return 16;
+  return 0;
+}
+
+
+/**
+ * @return CPU time used by the process so far, in microseconds
+ */
+static uint64_t
+cpu_usec (void)
+{
+  struct timespec ts;
+
+  if (0 != clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &ts))
+    abort ();
+  return ((uint64_t) ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/**
+ * Run a few requests and measure the CPU time used while the
+ * connection is idle for the busy-poll window.
+ *
+ * @param busy_poll value for #MHD_OPTION_EPOLL_BUSY_POLL
+ * @param port port to use
+ * @param[out] idle_cpu CPU time used while idle, in microseconds
+ * @return 0 on success
+ */
+static int
+test_busy_poll (unsigned int busy_poll,
+                uint16_t port,
+                uint64_t *idle_cpu)
+{
+  struct MHD_Daemon *d;
+  MHD_socket sock;
+  unsigned int i;
+  uint64_t start;
+  int ret;
+
+  d = MHD_start_daemon (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY | MHD_USE_DEBUG,
+                        port,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_EPOLL_BUSY_POLL, busy_poll,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  sock = connect_to (port);
+  for (i = 0; i < 10; i++)
+    ret |= request (sock) << 1;
+  start = cpu_usec ();
+  usleep (WINDOW_USEC / 2);
+  *idle_cpu = cpu_usec () - start;
+  ret |= request (sock) << 6;
+  MHD_socket_close_ (sock);
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+  uint64_t blocking;
+  uint64_t spinning;
+
+  if (MHD_YES != MHD_is_feature_supported (MHD_FEATURE_EPOLL))
+    return 0;
+  errorCount += test_busy_poll (0,
+                                1122,
+                                &blocking);
+  errorCount += test_busy_poll (WINDOW_USEC,
+                                1123,
+                                &spinning);
+  /* the spinning thread must have used a good part of the idle time;
+     leave plenty of slack for busy test machines */
+  if ( (0 == errorCount) &&
+       (spinning < blocking + WINDOW_USEC / 20) )
+    {
+      fprintf (stderr,
+               "Event loop did not busy poll: %u us CPU (%u us without)\n",
+               (unsigned int) spinning,
+               (unsigned int) blocking);
+      errorCount++;
+    }
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,203 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_chunked_coalesce.c
+ * @brief  Testcase for chunked uploads with
+ *         #MHD_OPTION_COALESCE_CHUNKED_UPLOAD
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+
+#define REQUEST_HEADER "PUT /upload HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\nTransfer-Encoding: chunked\r\n\r\n"
+
+#define REQUEST_BODY "5\r\nHello\r\n1\r\n,\r\n1\r\n \r\na\r\nIoT world!\r\n0\r\n\r\n"
+
+#define EXPECTED "Hello, IoT world!"
+
+
+/**
+ * State of the upload, shared with the handler.
+ */
+struct Upload
+{
+  /**
+   * Data received so far.
+   */
+  char buf[64];
+
+  /**
+   * Number of bytes in @e buf.
+   */
+  size_t pos;
+
+  /**
+   * Number of handler calls that had upload data.
+   */
+  unsigned int calls;
+};
+
+
+static int
+ahc_upload (void *cls,
+            struct MHD_Connection *connection,
+            const char *url,
+            const char *method,
+            const char *version,
+            const char *upload_data,
+            size_t *upload_data_size,
+            void **con_cls)
+{
+  static int marker;
+  struct Upload *up = cls;
+  struct MHD_Response *response;
+  size_t n;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  if (0 != *upload_data_size)
+    {
+      n = *upload_data_size;
+      if (up->pos + n > sizeof (up->buf))
+        return MHD_NO;
+      memcpy (&up->buf[up->pos], upload_data, n);
+      up->pos += n;
+      up->calls++;
+      *upload_data_size = 0;
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_buffer (0,
+                                              NULL,
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Upload #REQUEST_BODY, sending it in pieces of @a split bytes
+ * (or at once if @a split is 0).
+ *
+ * @param coalesce value for #MHD_OPTION_COALESCE_CHUNKED_UPLOAD
+ * @param split size of the pieces to send
+ * @param up upload state to use
+ * @param port port to use
+ * @return 0 on success
+ */
+static int
+test_upload (unsigned int coalesce,
+             size_t split,
+             struct Upload *up,
+             uint16_t port)
+{
+  struct MHD_Daemon *d;
+  MHD_socket sock;
+  char reply[256];
+  size_t off;
+  size_t n;
+  ssize_t got;
+  size_t have;
+  int ret;
+
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        port,
+                        NULL, NULL,
+                        &ahc_upload, up,
+                        MHD_OPTION_COALESCE_CHUNKED_UPLOAD, coalesce,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  sock = connect_to (port);
+  if (strlen (REQUEST_HEADER) !=
+      (size_t) write (sock, REQUEST_HEADER, strlen (REQUEST_HEADER)))
+    ret |= 2;
+  off = 0;
+  while (off < strlen (REQUEST_BODY))
+    {
+      n = strlen (REQUEST_BODY) - off;
+      if ( (0 != split) &&
+           (n > split) )
+        n = split;
+      if (n != (size_t) write (sock, &REQUEST_BODY[off], n))
+        ret |= 2;
+      off += n;
+      if (0 != split)
+        usleep (10000);
+    }
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          (0 < (got = read (sock, &reply[have], sizeof (reply) - 1 - have))) )
+    have += got;
+  reply[have] = '\0';
+  if (0 != strncmp (reply, "HTTP/1.1 200", strlen ("HTTP/1.1 200")))
+    ret |= 4;
+  MHD_socket_close_ (sock);
+  MHD_stop_daemon (d);
+  if ( (up->pos != strlen (EXPECTED)) ||
+       (0 != memcmp (up->buf, EXPECTED, up->pos)) )
+    ret |= 8;
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  struct Upload up;
+  int errorCount = 0;
+
+  /* all chunks at once: a single call with coalescing */
+  memset (&up, 0, sizeof (up));
+  errorCount += test_upload (MHD_YES, 0, &up, 1094);
+  if (1 != up.calls)
+    errorCount += 16;
+  /* without coalescing, at least one call per chunk */
+  memset (&up, 0, sizeof (up));
+  errorCount += test_upload (MHD_NO, 0, &up, 1094);
+  if (4 > up.calls)
+    errorCount += 32;
+  /* chunk framing split across reads */
+  memset (&up, 0, sizeof (up));
+  errorCount += test_upload (MHD_YES, 3, &up, 1094);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,219 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_chunked_send.c
+ * @brief  Testcase for sending chunks larger than the memory pool
+ *         of the connection, with partial writes
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1109
+
+/**
+ * Size of the data buffer of the response, and thus of the chunks.
+ */
+#define BLOCK_SIZE (256 * 1024)
+
+/**
+ * Size of the body.
+ */
+#define BODY_SIZE (2 * BLOCK_SIZE + 1000)
+
+
+static ssize_t
+body_reader (void *cls,
+             uint64_t pos,
+             char *buf,
+             size_t max)
+{
+  size_t i;
+
+  if (pos >= BODY_SIZE)
+    return MHD_CONTENT_READER_END_OF_STREAM;
+  if (max > BODY_SIZE - pos)
+    max = BODY_SIZE - pos;
+  for (i = 0; i < max; i++)
+    buf[i] = 'a' + (pos + i) % 23;
+  return max;
+}
+
+
+static int
+ahc_chunked (void *cls,
+             struct MHD_Connection *connection,
+             const char *url,
+             const char *method,
+             const char *version,
+             const char *upload_data,
+             size_t *upload_data_size,
+             void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_callback (MHD_SIZE_UNKNOWN,
+                                                BLOCK_SIZE,
+                                                &body_reader,
+                                                NULL,
+                                                NULL);
+  if (NULL == response)
+    return MHD_NO;
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Fetch the body and check its chunks.
+ *
+ * @return 0 on success
+ */
+static int
+check_chunks ()
+{
+  static char reply[BODY_SIZE + 4096];
+  char expected[1024];
+  MHD_socket sock;
+  struct sockaddr_in sa;
+  /* no "Connection: close", MHD would close instead of using chunks */
+  const char *request = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  const char *pos;
+  char *end;
+  unsigned long chunk;
+  unsigned long chunks;
+  uint64_t body;
+  size_t have;
+  size_t i;
+  ssize_t got;
+  int rcvbuf;
+
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sock)
+    abort ();
+  /* force partial writes on the server side */
+  rcvbuf = 4096;
+  (void) setsockopt (sock, SOL_SOCKET, SO_RCVBUF,
+                     (const void *) &rcvbuf, sizeof (rcvbuf));
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (sock,
+                    (struct sockaddr *) &sa,
+                    sizeof (sa)))
+    abort ();
+  if (strlen (request) !=
+      (size_t) write (sock, request, strlen (request)))
+    abort ();
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          ( (have < 7) ||
+            (0 != memcmp (&reply[have - 7], "\r\n0\r\n\r\n", 7)) ) &&
+          (0 < (got = read (sock, &reply[have], (sizeof (reply) - 1 - have > 1000) ? 1000 : sizeof (reply) - 1 - have))) )
+    have += got;
+  reply[have] = '\0';
+  MHD_socket_close_ (sock);
+  pos = strstr (reply, "\r\n\r\n");
+  if ( (NULL == pos) ||
+       (NULL == strstr (reply, "\r\nTransfer-Encoding: chunked\r\n")) )
+    return 1;
+  pos += 4;
+  body = 0;
+  chunks = 0;
+  while (1)
+    {
+      chunk = strtoul (pos, &end, 16);
+      if ( (end == pos) ||
+           (0 != strncmp (end, "\r\n", 2)) )
+        return 2;
+      pos = end + 2;
+      if (0 == chunk)
+        break;
+      if (pos + chunk + 2 > &reply[have])
+        return 4;
+      for (i = 0; i < chunk; i++)
+        {
+          if (0 == (body + i) % sizeof (expected))
+            (void) body_reader (NULL, body + i, expected, sizeof (expected));
+          if (pos[i] != expected[(body + i) % sizeof (expected)])
+            return 8;
+        }
+      body += chunk;
+      pos += chunk;
+      if (0 != strncmp (pos, "\r\n", 2))
+        return 16;
+      pos += 2;
+      chunks++;
+    }
+  if ( (BODY_SIZE != body) ||
+       (0 != strcmp (pos, "\r\n")) )
+    return 32;
+  /* chunks are as large as the data buffer of the response */
+  if (3 != chunks)
+    {
+      fprintf (stderr, "Expected 3 chunks, got %lu\n", chunks);
+      return 64;
+    }
+  return 0;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  struct MHD_Daemon *d;
+  int errorCount = 0;
+
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_chunked, NULL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  errorCount += check_chunks ();
+  errorCount += check_chunks ();
+  MHD_stop_daemon (d);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,301 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_compress.c
+ * @brief  Testcase for compressing callback responses on the fly
+ *         with #MHD_RO_COMPRESSION_LEVEL
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <zlib.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1107
+
+/**
+ * Size of the body of the responses.
+ */
+#define BODY_SIZE 100000
+
+
+/**
+ * Produce the body: lines of text that compress well.
+ */
+static ssize_t
+body_reader (void *cls,
+             uint64_t pos,
+             char *buf,
+             size_t max)
+{
+  size_t i;
+
+  if (pos >= BODY_SIZE)
+    return MHD_CONTENT_READER_END_OF_STREAM;
+  if (max > BODY_SIZE - pos)
+    max = BODY_SIZE - pos;
+  /* return short reads to exercise multiple calls */
+  if (max > 1000)
+    max = 1000;
+  for (i = 0; i < max; i++)
+    buf[i] = (0 == (pos + i) % 64) ? '\n' : 'a' + (pos + i) % 26;
+  return max;
+}
+
+
+static int
+ahc_compress (void *cls,
+              struct MHD_Connection *connection,
+              const char *url,
+              const char *method,
+              const char *version,
+              const char *upload_data,
+              size_t *upload_data_size,
+              void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_callback ((0 == strcmp (url, "/unknown"))
+                                                ? MHD_SIZE_UNKNOWN
+                                                : BODY_SIZE,
+                                                4096,
+                                                &body_reader,
+                                                NULL,
+                                                NULL);
+  if (NULL == response)
+    return MHD_NO;
+  if (MHD_YES != MHD_set_response_options (response,
+                                           MHD_RF_NONE,
+                                           MHD_RO_COMPRESSION_LEVEL, 6,
+                                           MHD_RO_END))
+    abort ();
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Decode a chunked body in place.
+ *
+ * @param body the chunked body
+ * @param[in,out] len length of @a body, set to the decoded length
+ * @return 0 on success
+ */
+static int
+dechunk (char *body,
+         size_t *len)
+{
+  size_t in = 0;
+  size_t out = 0;
+  unsigned long chunk;
+  char *end;
+
+  while (1)
+    {
+      chunk = strtoul (&body[in], &end, 16);
+      if ( (end == &body[in]) ||
+           (0 != strncmp (end, "\r\n", 2)) )
+        return 1;
+      in = (end - body) + 2;
+      if (0 == chunk)
+        break;
+      if (in + chunk + 2 > *len)
+        return 1;
+      memmove (&body[out], &body[in], chunk);
+      out += chunk;
+      in += chunk;
+      if (0 != strncmp (&body[in], "\r\n", 2))
+        return 1;
+      in += 2;
+    }
+  if ( (in + 2 != *len) ||
+       (0 != strncmp (&body[in], "\r\n", 2)) )
+    return 1;
+  *len = out;
+  return 0;
+}
+
+
+/**
+ * Request @a url with the given "Accept-Encoding" header and
+ * check the reply.
+ *
+ * @param url URL to request
+ * @param accept value of the "Accept-Encoding" header, NULL for none
+ * @param encoding expected "Content-Encoding", NULL for none
+ * @return 0 on success
+ */
+static int
+check_compress (const char *url,
+                const char *accept,
+                const char *encoding)
+{
+  static char reply[2 * BODY_SIZE];
+  static char body[BODY_SIZE];
+  static char expected[BODY_SIZE];
+  MHD_socket sock;
+  struct sockaddr_in sa;
+  char request[256];
+  char header[64];
+  char *end;
+  size_t have;
+  size_t len;
+  ssize_t got;
+  z_stream strm;
+  int ret;
+
+  snprintf (request,
+            sizeof (request),
+            "GET %s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n%s%s%s\r\n",
+            url,
+            (NULL == accept) ? "" : "Accept-Encoding: ",
+            (NULL == accept) ? "" : accept,
+            (NULL == accept) ? "" : "\r\n");
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sock)
+    abort ();
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (sock,
+                    (struct sockaddr *) &sa,
+                    sizeof (sa)))
+    abort ();
+  if (strlen (request) !=
+      (size_t) write (sock, request, strlen (request)))
+    abort ();
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          (0 < (got = read (sock, &reply[have], sizeof (reply) - 1 - have))) )
+    have += got;
+  reply[have] = '\0';
+  MHD_socket_close_ (sock);
+  for (len = 0; len < BODY_SIZE; len += got)
+    got = body_reader (NULL, len, &expected[len], BODY_SIZE - len);
+  end = strstr (reply, "\r\n\r\n");
+  if ( (NULL == end) ||
+       (0 != strncmp (reply, "HTTP/1.1 200 OK\r\n", strlen ("HTTP/1.1 200 OK\r\n"))) ||
+       (NULL == strstr (reply, "\r\nVary: Accept-Encoding\r\n")) )
+    {
+      fprintf (stderr, "Unexpected reply for `%s'\n", accept);
+      return 1;
+    }
+  end[2] = '\0';
+  end += 4;
+  len = have - (end - reply);
+  if (NULL == encoding)
+    {
+      if (NULL != strstr (reply, "Content-Encoding"))
+        return 2;
+      if ( (NULL != strstr (reply, "\r\nTransfer-Encoding: chunked\r\n")) &&
+           (0 != dechunk (end, &len)) )
+        return 4;
+      if ( (BODY_SIZE != len) ||
+           (0 != memcmp (end, expected, BODY_SIZE)) )
+        return 8;
+      return 0;
+    }
+  snprintf (header,
+            sizeof (header),
+            "\r\nContent-Encoding: %s\r\n",
+            encoding);
+  if ( (NULL == strstr (reply, header)) ||
+       (NULL == strstr (reply, "\r\nTransfer-Encoding: chunked\r\n")) ||
+       (NULL != strstr (reply, "Content-Length")) )
+    {
+      fprintf (stderr, "Wrong headers for `%s': `%s'\n", accept, reply);
+      return 16;
+    }
+  if (0 != dechunk (end, &len))
+    return 32;
+  if (len >= BODY_SIZE / 4)
+    return 64; /* not compressed */
+  memset (&strm, 0, sizeof (strm));
+  /* 15 + 32: detect zlib or gzip header */
+  if (Z_OK != inflateInit2 (&strm, 15 + 32))
+    abort ();
+  strm.next_in = (Bytef *) end;
+  strm.avail_in = len;
+  strm.next_out = (Bytef *) body;
+  strm.avail_out = sizeof (body);
+  ret = inflate (&strm, Z_FINISH);
+  len = sizeof (body) - strm.avail_out;
+  inflateEnd (&strm);
+  if ( (Z_STREAM_END != ret) ||
+       (BODY_SIZE != len) ||
+       (0 != memcmp (body, expected, BODY_SIZE)) )
+    {
+      fprintf (stderr, "Failed to decompress body for `%s'\n", accept);
+      return 128;
+    }
+  return 0;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  struct MHD_Daemon *d;
+  int errorCount = 0;
+
+  if (MHD_YES != MHD_is_feature_supported (MHD_FEATURE_COMPRESSION))
+    return 77;
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_compress, NULL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  errorCount += check_compress ("/", NULL, NULL);
+  errorCount += check_compress ("/", "gzip", "gzip");
+  errorCount += check_compress ("/", "deflate, gzip", "gzip");
+  errorCount += check_compress ("/", "gzip;q=0.5, deflate", "deflate");
+  errorCount += check_compress ("/", "gzip;q=0, br", NULL);
+  errorCount += check_compress ("/unknown", "gzip", "gzip");
+  errorCount += check_compress ("/unknown", "br", NULL);
+  /* compressors are reused */
+  errorCount += check_compress ("/", "gzip", "gzip");
+  MHD_stop_daemon (d);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,262 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_conditional.c
+ * @brief  Testcase for answering conditional requests with 304
+ *         (#MHD_RF_CONDITIONAL)
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1108
+
+#define ETAG "\"v1\""
+
+#define LAST_MODIFIED "Sun, 06 Nov 1994 08:49:37 GMT"
+
+#define BODY "0123456789"
+
+/**
+ * Number of calls to the content reader.
+ */
+static unsigned int reader_calls;
+
+
+static ssize_t
+body_reader (void *cls,
+             uint64_t pos,
+             char *buf,
+             size_t max)
+{
+  reader_calls++;
+  if (max > strlen (BODY) - pos)
+    max = strlen (BODY) - pos;
+  memcpy (buf, &BODY[pos], max);
+  return max;
+}
+
+
+static int
+ahc_conditional (void *cls,
+                 struct MHD_Connection *connection,
+                 const char *url,
+                 const char *method,
+                 const char *version,
+                 const char *upload_data,
+                 size_t *upload_data_size,
+                 void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  *con_cls = NULL;
+  response = MHD_create_response_from_callback (strlen (BODY),
+                                                64,
+                                                &body_reader,
+                                                NULL,
+                                                NULL);
+  if (NULL == response)
+    return MHD_NO;
+  if ( (MHD_YES != MHD_add_response_header (response,
+                                            MHD_HTTP_HEADER_ETAG,
+                                            ETAG)) ||
+       (MHD_YES != MHD_add_response_header (response,
+                                            MHD_HTTP_HEADER_LAST_MODIFIED,
+                                            LAST_MODIFIED)) ||
+       (MHD_YES != MHD_set_response_options (response,
+                                             MHD_RF_CONDITIONAL,
+                                             MHD_RO_END)) )
+    abort ();
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Send the given requests on one connection and return the reply.
+ *
+ * @param requests the requests to send
+ * @param reply where to store the reply
+ * @param reply_size size of @a reply
+ */
+static void
+do_requests (const char *requests,
+             char *reply,
+             size_t reply_size)
+{
+  MHD_socket sock;
+  struct sockaddr_in sa;
+  size_t have;
+  ssize_t got;
+
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sock)
+    abort ();
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (sock,
+                    (struct sockaddr *) &sa,
+                    sizeof (sa)))
+    abort ();
+  if (strlen (requests) !=
+      (size_t) write (sock, requests, strlen (requests)))
+    abort ();
+  have = 0;
+  while ( (have < reply_size - 1) &&
+          (0 < (got = read (sock, &reply[have], reply_size - 1 - have))) )
+    have += got;
+  reply[have] = '\0';
+  MHD_socket_close_ (sock);
+}
+
+
+/**
+ * Request the resource with the given conditional headers and check
+ * the status of the reply.
+ *
+ * @param headers request headers to add
+ * @param not_modified #MHD_YES if a 304 is expected, #MHD_NO for a 200
+ * @return 0 on success
+ */
+static int
+check_conditional (const char *headers,
+                   int not_modified)
+{
+  char request[256];
+  char reply[1024];
+  const char *end;
+
+  snprintf (request,
+            sizeof (request),
+            "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n%s\r\n",
+            headers);
+  reader_calls = 0;
+  do_requests (request,
+               reply,
+               sizeof (reply));
+  end = strstr (reply, "\r\n\r\n");
+  if ( (NULL == end) ||
+       (NULL == strstr (reply, "\r\nETag: " ETAG "\r\n")) )
+    return 1;
+  if (MHD_YES == not_modified)
+    {
+      if ( (0 != strncmp (reply, "HTTP/1.1 304 ", strlen ("HTTP/1.1 304 "))) ||
+           ('\0' != end[4]) ||
+           (0 != reader_calls) ||
+           (NULL != strstr (reply, "Content-Length")) )
+        {
+          fprintf (stderr, "Expected 304 for `%s', got `%s'\n", headers, reply);
+          return 2;
+        }
+      return 0;
+    }
+  if ( (0 != strncmp (reply, "HTTP/1.1 200 ", strlen ("HTTP/1.1 200 "))) ||
+       (0 != strcmp (end + 4, BODY)) )
+    {
+      fprintf (stderr, "Expected 200 for `%s', got `%s'\n", headers, reply);
+      return 4;
+    }
+  return 0;
+}
+
+
+/**
+ * Check that a connection is kept alive after a 304.
+ *
+ * @return 0 on success
+ */
+static int
+check_keep_alive ()
+{
+  char reply[1024];
+  const char *second;
+
+  do_requests ("GET / HTTP/1.1\r\nHost: localhost\r\nIf-None-Match: " ETAG "\r\n\r\n"
+               "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+               reply,
+               sizeof (reply));
+  if (0 != strncmp (reply, "HTTP/1.1 304 ", strlen ("HTTP/1.1 304 ")))
+    return 8;
+  second = strstr (reply, "\r\n\r\n");
+  if ( (NULL == second) ||
+       (0 != strncmp (second + 4, "HTTP/1.1 200 ", strlen ("HTTP/1.1 200 "))) )
+    return 16;
+  second = strstr (second + 4, "\r\n\r\n");
+  if ( (NULL == second) ||
+       (0 != strcmp (second + 4, BODY)) )
+    return 32;
+  return 0;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  struct MHD_Daemon *d;
+  int errorCount = 0;
+
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_conditional, NULL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  errorCount += check_conditional ("", MHD_NO);
+  errorCount += check_conditional ("If-None-Match: " ETAG "\r\n", MHD_YES);
+  errorCount += check_conditional ("If-None-Match: \"v0\", W/" ETAG "\r\n", MHD_YES);
+  errorCount += check_conditional ("If-None-Match: *\r\n", MHD_YES);
+  errorCount += check_conditional ("If-None-Match: \"v0\"\r\n", MHD_NO);
+  errorCount += check_conditional ("If-Modified-Since: " LAST_MODIFIED "\r\n", MHD_YES);
+  errorCount += check_conditional ("If-Modified-Since: Mon, 01 Jan 2001 00:00:00 GMT\r\n", MHD_YES);
+  errorCount += check_conditional ("If-Modified-Since: Sat, 05 Nov 1994 08:49:37 GMT\r\n", MHD_NO);
+  errorCount += check_conditional ("If-Modified-Since: garbage\r\n", MHD_NO);
+  /* "If-None-Match" takes precedence */
+  errorCount += check_conditional ("If-None-Match: \"v0\"\r\n"
+                                   "If-Modified-Since: " LAST_MODIFIED "\r\n", MHD_NO);
+  errorCount += check_keep_alive ();
+  MHD_stop_daemon (d);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,230 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_connection_alloc.c
+ * @brief  Testcase for #MHD_connection_alloc(): handler state lives in
+ *         the pool until the request completed, the reserve is kept
+ *         free and the memory is available again for the next request
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1192
+
+/**
+ * Memory limit of a connection.
+ */
+#define POOL_SIZE (32 * 1024)
+
+/**
+ * Reserve for MHD.
+ */
+#define RESERVE (8 * 1024)
+
+/**
+ * Size of the state of a request.
+ */
+#define STATE_SIZE 2048
+
+/**
+ * Set on errors in the callbacks.
+ */
+static int failed;
+
+/**
+ * Number of requests completed with intact state.
+ */
+static unsigned int completed;
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  struct MHD_Response *response;
+  char *state;
+  int ret;
+
+  if (NULL == *con_cls)
+    {
+      /* beyond the reserve */
+      if (NULL != MHD_connection_alloc (connection,
+                                        POOL_SIZE - RESERVE))
+        failed |= 1;
+      state = MHD_connection_alloc (connection,
+                                    STATE_SIZE);
+      if (NULL == state)
+        {
+          failed |= 2;
+          return MHD_NO;
+        }
+      if (0 != ((uintptr_t) state) % sizeof (void *))
+        failed |= 4;
+      memset (state, 'S', STATE_SIZE);
+      *con_cls = state;
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_buffer (2,
+                                              (void *) "ok",
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+static void
+completed_cb (void *cls,
+              struct MHD_Connection *connection,
+              void **con_cls,
+              enum MHD_RequestTerminationCode toe)
+{
+  const char *state = *con_cls;
+  unsigned int i;
+
+  if (NULL == state)
+    return;
+  for (i = 0; i < STATE_SIZE; i++)
+    if ('S' != state[i])
+      {
+        failed |= 8;
+        return;
+      }
+  completed++;
+}
+
+
+/**
+ * Send a request on @a sock and check the reply.
+ *
+ * @param sock socket to use
+ * @return 0 on success
+ */
+static int
+check_request (MHD_socket sock)
+{
+  static const char request[] =
+    "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  char reply[512];
+  const char *body;
+  size_t have;
+  ssize_t got;
+
+  if (strlen (request) !=
+      (size_t) write (sock, request, strlen (request)))
+    return 16;
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          (0 < (got = read (sock,
+                            &reply[have],
+                            sizeof (reply) - 1 - have))) )
+    {
+      have += got;
+      reply[have] = '\0';
+      if ( (NULL != (body = strstr (reply, "\r\n\r\n"))) &&
+           (0 == strcmp (body + 4, "ok")) )
+        return 0;
+    }
+  return 32;
+}
+
+
+static int
+check_alloc (unsigned int flags)
+{
+  struct MHD_Daemon *d;
+  struct sockaddr_in sa;
+  struct timeval tv;
+  MHD_socket sock;
+  unsigned int i;
+  int ret;
+
+  failed = 0;
+  completed = 0;
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_CONNECTION_MEMORY_LIMIT, (size_t) POOL_SIZE,
+                        MHD_OPTION_CONNECTION_ALLOC_RESERVE, (size_t) RESERVE,
+                        MHD_OPTION_NOTIFY_COMPLETED, &completed_cb, NULL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 64;
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if ( (MHD_INVALID_SOCKET == sock) ||
+       (0 != connect (sock, (struct sockaddr *) &sa, sizeof (sa))) )
+    abort ();
+  tv.tv_sec = 5;
+  tv.tv_usec = 0;
+  (void) setsockopt (sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+  ret = 0;
+  /* more than fits into the pool at once, so it must be released */
+  for (i = 0; i < 2 * POOL_SIZE / STATE_SIZE; i++)
+    ret |= check_request (sock);
+  MHD_socket_close_ (sock);
+  MHD_stop_daemon (d);
+  ret |= failed;
+  if (2 * POOL_SIZE / STATE_SIZE != completed)
+    ret |= 128;
+  if (0 != ret)
+    fprintf (stderr,
+             "Request allocation failed with flags %u: %d\n",
+             flags,
+             ret);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += check_alloc (MHD_USE_SELECT_INTERNALLY);
+  errorCount += check_alloc (MHD_USE_THREAD_PER_CONNECTION);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,224 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_cpu_affinity.c
+ * @brief  Testcase for pinning the threads of a daemon to CPUs
+ *         (#MHD_OPTION_THREAD_POOL_CPU_AFFINITY)
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+#include <sched.h>
+#endif
+
+#define PORT 1117
+
+/**
+ * Number of requests sent to each daemon.
+ */
+#define REQUESTS 8
+
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+/**
+ * CPUs the process may run on.
+ */
+static cpu_set_t process_cpus;
+
+
+/**
+ * Reply with the CPUs the thread running the handler may run on:
+ * the CPU it is pinned to, or -1 if it may run on several.
+ */
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  cpu_set_t set;
+  char body[16];
+  int cpu;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  cpu = -1;
+  CPU_ZERO (&set);
+  if ( (0 == pthread_getaffinity_np (pthread_self (), sizeof (set), &set)) &&
+       (1 == CPU_COUNT (&set)) )
+    for (cpu = 0; ! CPU_ISSET (cpu, &set); cpu++) ;
+  snprintf (body, sizeof (body), "%d", cpu);
+  response = MHD_create_response_from_buffer (strlen (body),
+                                              body,
+                                              MHD_RESPMEM_MUST_COPY);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Send a request and return the CPU reported by the handler.
+ *
+ * @return the CPU, -1 if the thread was not pinned, -2 on errors
+ */
+static int
+query_cpu ()
+{
+  struct sockaddr_in sa;
+  const char *request =
+    "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+  char reply[512];
+  const char *body;
+  MHD_socket sock;
+  size_t have;
+  ssize_t got;
+
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if ( (MHD_INVALID_SOCKET == sock) ||
+       (0 != connect (sock, (struct sockaddr *) &sa, sizeof (sa))) )
+    abort ();
+  if (strlen (request) !=
+      (size_t) write (sock, request, strlen (request)))
+    abort ();
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          (0 < (got = read (sock, &reply[have], sizeof (reply) - 1 - have))) )
+    have += got;
+  reply[have] = '\0';
+  MHD_socket_close_ (sock);
+  if (NULL == (body = strstr (reply, "\r\n\r\n")))
+    return -2;
+  return atoi (body + 4);
+}
+
+
+/**
+ * Check that the handler always runs on a thread pinned to one of
+ * the given CPUs.
+ *
+ * @param pool_size size of the thread pool, 0 for none
+ * @param num_cpus number of entries in @a cpus
+ * @param cpus CPUs to pin the threads to, NULL for the process CPUs
+ * @return 0 on success
+ */
+static int
+check_affinity (unsigned int pool_size,
+                unsigned int num_cpus,
+                const unsigned int *cpus)
+{
+  struct MHD_Daemon *d;
+  unsigned int i;
+  unsigned int j;
+  int cpu;
+  int ret;
+
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_THREAD_POOL_SIZE, pool_size,
+                        MHD_OPTION_THREAD_POOL_CPU_AFFINITY, num_cpus, cpus,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  for (i = 0; i < REQUESTS; i++)
+    {
+      cpu = query_cpu ();
+      if (cpu < 0)
+        {
+          ret = 2;
+          continue;
+        }
+      if (NULL == cpus)
+        {
+          if (! CPU_ISSET (cpu, &process_cpus))
+            ret = 4;
+          continue;
+        }
+      for (j = 0; j < num_cpus; j++)
+        if ((unsigned int) cpu == cpus[j])
+          break;
+      if (j == num_cpus)
+        ret = 4;
+    }
+  MHD_stop_daemon (d);
+  if (0 != ret)
+    fprintf (stderr,
+             "Threads not pinned with %u workers: %d\n",
+             pool_size,
+             ret);
+  return ret;
+}
+#endif
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+  unsigned int cpu;
+
+  CPU_ZERO (&process_cpus);
+  if (0 != sched_getaffinity (0, sizeof (process_cpus), &process_cpus))
+    return 77;
+  for (cpu = 0; ! CPU_ISSET (cpu, &process_cpus); cpu++) ;
+  errorCount += check_affinity (0, 1, &cpu);
+  errorCount += check_affinity (2, 1, &cpu);
+  errorCount += check_affinity (4, 0, NULL);
+#else
+  return 77;
+#endif
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -152,6 +152,55 @@ testMultithread ()
   return 0;
 }
 
+#ifndef WINDOWS
+static int
+testExternalBatchedAccept ()
+{
+  struct MHD_Daemon *d;
+  struct sockaddr_in sin;
+  const union MHD_DaemonInfo *info;
+  int fds[4];
+  int ret;
+  int i;
+
+  d = MHD_start_daemon (MHD_USE_DEBUG,
+                        1084,
+                        &apc_all, NULL, &ahc_nothing, NULL,
+                        MHD_OPTION_ACCEPT_BATCH_SIZE, (unsigned int) 8,
+                        MHD_OPTION_END);
+  if (d == NULL)
+    return 512;
+  memset (&sin, 0, sizeof (sin));
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons (1084);
+  sin.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  ret = 0;
+  for (i = 0; i < 4; i++)
+    {
+      fds[i] = socket (PF_INET, SOCK_STREAM, 0);
+      if ( (-1 == fds[i]) ||
+           (0 != connect (fds[i], (struct sockaddr *) &sin, sizeof (sin))) )
+        ret = 1024;
+    }
+  /* all pending connections must be taken in a single pass */
+  if ( (0 == ret) &&
+       (MHD_YES != MHD_run (d)) )
+    ret = 2048;
+  if (0 == ret)
+    {
+      info = MHD_get_daemon_info (d, MHD_DAEMON_INFO_CURRENT_CONNECTIONS);
+      if ( (NULL == info) ||
+           (4 != info->num_connections) )
+        ret = 4096;
+    }
+  for (i = 0; i < 4; i++)
+    if (-1 != fds[i])
+      close (fds[i]);
+  MHD_stop_daemon (d);
+  return ret;
+}
+#endif
+
 int
 main (int argc, char *const *argv)
 {
@@ -161,6 +210,9 @@ main (int argc, char *const *argv)
   errorCount += testExternalRun ();
   errorCount += testThread ();
   errorCount += testMultithread ();
+#ifndef WINDOWS
+  errorCount += testExternalBatchedAccept ();
+#endif
   if (errorCount != 0)
     fprintf (stderr, "Error (code: %u)\n", errorCount);
   return errorCount != 0;       /* 0 == pass */
@@ -0,0 +1,247 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_daemon_stats.c
+ * @brief  Testcase for #MHD_DAEMON_INFO_STATS: the counters of the
+ *         workers of a thread pool are summed up
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+
+/**
+ * Number of requests sent on one keep-alive connection.
+ */
+#define NUM_REQUESTS 5
+
+#define REQUEST "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n"
+
+#define PAGE "statistics"
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_buffer (strlen (PAGE),
+                                              (void *) PAGE,
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection,
+                            MHD_HTTP_OK,
+                            response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Send @a req on @a sock and wait for a response that contains
+ * @a expect, or for the daemon to close the connection if @a expect
+ * is NULL.
+ *
+ * @return 0 on success
+ */
+static int
+exchange (MHD_socket sock,
+          const char *req,
+          size_t req_size,
+          const char *expect)
+{
+  char buf[1024];
+  size_t off;
+  ssize_t got;
+  fd_set rs;
+  struct timeval tv;
+
+  if (req_size != (size_t) write (sock, req, req_size))
+    return 1;
+  off = 0;
+  buf[0] = '\0';
+  while ( (NULL == expect) ||
+          (NULL == strstr (buf, expect)) )
+    {
+      FD_ZERO (&rs);
+      FD_SET (sock, &rs);
+      tv.tv_sec = 5;
+      tv.tv_usec = 0;
+      if (1 != select (sock + 1, &rs, NULL, NULL, &tv))
+        return 2;
+      got = read (sock, &buf[off], sizeof (buf) - 1 - off);
+      if (0 >= got)
+        return (NULL == expect) ? 0 : 4;
+      off += got;
+      buf[off] = '\0';
+      if (sizeof (buf) - 1 == off)
+        off = 0;
+    }
+  return 0;
+}
+
+
+/**
+ * Get the statistics of @a d.
+ */
+static struct MHD_DaemonStats
+get_stats (struct MHD_Daemon *d)
+{
+  const union MHD_DaemonInfo *info;
+
+  info = MHD_get_daemon_info (d,
+                              MHD_DAEMON_INFO_STATS);
+  if (NULL == info)
+    abort ();
+  return info->stats;
+}
+
+
+static int
+test_stats (unsigned int flags,
+            unsigned int pool_size,
+            uint16_t port)
+{
+  struct MHD_Daemon *d;
+  struct MHD_DaemonStats stats;
+  MHD_socket sock;
+  char *big;
+  unsigned int i;
+  int ret;
+
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        port,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_THREAD_POOL_SIZE, pool_size,
+                        MHD_OPTION_CONNECTION_MEMORY_LIMIT, (size_t) 4096,
+                        MHD_OPTION_CONNECTION_TIMEOUT, (unsigned int) 1,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  stats = get_stats (d);
+  if ( (0 != stats.accepts) ||
+       (0 != stats.requests) )
+    ret |= 2;
+  /* requests on a keep-alive connection */
+  sock = connect_to (port);
+  for (i = 0; i < NUM_REQUESTS; i++)
+    ret |= exchange (sock, REQUEST, strlen (REQUEST), PAGE) << 2;
+  MHD_socket_close_ (sock);
+  /* a request that does not fit into the memory pool */
+  big = malloc (8192);
+  if (NULL == big)
+    abort ();
+  memset (big, 'a', 8192);
+  memcpy (big, "GET /", strlen ("GET /"));
+  sock = connect_to (port);
+  ret |= exchange (sock, big, 8192, NULL) << 2;
+  MHD_socket_close_ (sock);
+  free (big);
+  /* an idle connection that times out */
+  sock = connect_to (port);
+  ret |= exchange (sock, "GET", strlen ("GET"), NULL) << 2;
+  MHD_socket_close_ (sock);
+  /* the counters are updated by the worker threads */
+  usleep (100 * 1000);
+  stats = get_stats (d);
+  if (3 != stats.accepts)
+    ret |= 32;
+  if (NUM_REQUESTS != stats.requests)
+    ret |= 64;
+  if (NUM_REQUESTS - 1 > stats.keep_alive_reuses)
+    ret |= 128;
+  /* the daemon stops reading the big request when the pool is full */
+  if (NUM_REQUESTS * strlen (REQUEST) + strlen ("GET") > stats.bytes_received)
+    ret |= 256;
+  if (NUM_REQUESTS * strlen (PAGE) > stats.bytes_sent)
+    ret |= 512;
+  if (1 != stats.pool_exhaustions)
+    ret |= 1024;
+  if (1 != stats.timeouts)
+    ret |= 2048;
+  if ( (0 == stats.loop_iterations) ||
+       (0 != stats.suspended) ||
+       (0 != stats.accept_errors) ||
+       (0 != stats.tls_handshakes) )
+    ret |= 4096;
+  MHD_stop_daemon (d);
+  if (0 != ret)
+    fprintf (stderr,
+             "accepts %llu, requests %llu, reuses %llu, in %llu, out %llu, too big %llu, timeouts %llu\n",
+             (unsigned long long) stats.accepts,
+             (unsigned long long) stats.requests,
+             (unsigned long long) stats.keep_alive_reuses,
+             (unsigned long long) stats.bytes_received,
+             (unsigned long long) stats.bytes_sent,
+             (unsigned long long) stats.pool_exhaustions,
+             (unsigned long long) stats.timeouts);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += test_stats (MHD_USE_SELECT_INTERNALLY,
+                            0,
+                            1145);
+  errorCount += test_stats (MHD_USE_SELECT_INTERNALLY,
+                            2,
+                            1146);
+#if EPOLL_SUPPORT
+  errorCount += test_stats (MHD_USE_SELECT_INTERNALLY | MHD_USE_EPOLL_LINUX_ONLY,
+                            2,
+                            1147);
+#endif
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,279 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_data_ready.c
+ * @brief  Testcase for content readers returning
+ *         #MHD_CONTENT_READER_PENDING and #MHD_response_data_ready()
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1110
+
+/**
+ * Number of pieces the producer generates.
+ */
+#define PIECES 5
+
+/**
+ * Length of each piece.
+ */
+#define PIECE_SIZE 10
+
+
+/**
+ * State of the body of one request.
+ */
+struct Stream
+{
+  /**
+   * Connection the body is sent on.
+   */
+  struct MHD_Connection *connection;
+
+  /**
+   * Protects @e available.
+   */
+  pthread_mutex_t lock;
+
+  /**
+   * Number of bytes of the body generated by the producer.
+   */
+  size_t available;
+
+  /**
+   * Number of calls of the content reader.
+   */
+  unsigned int calls;
+
+  /**
+   * Producer thread.
+   */
+  pthread_t producer;
+
+  /**
+   * #MHD_YES if @e producer was started.
+   */
+  int started;
+};
+
+
+static ssize_t
+stream_reader (void *cls,
+               uint64_t pos,
+               char *buf,
+               size_t max)
+{
+  struct Stream *stream = cls;
+  size_t i;
+  size_t n;
+
+  stream->calls++;
+  pthread_mutex_lock (&stream->lock);
+  n = stream->available - (size_t) pos;
+  pthread_mutex_unlock (&stream->lock);
+  if (0 == n)
+    {
+      if (PIECES * PIECE_SIZE == pos)
+        return MHD_CONTENT_READER_END_OF_STREAM;
+      return MHD_CONTENT_READER_PENDING;
+    }
+  if (n > max)
+    n = max;
+  for (i = 0; i < n; i++)
+    buf[i] = 'a' + (pos + i) / PIECE_SIZE;
+  return n;
+}
+
+
+static void *
+producer (void *cls)
+{
+  struct Stream *stream = cls;
+  unsigned int i;
+
+  for (i = 0; i < PIECES; i++)
+    {
+      usleep (50000);
+      pthread_mutex_lock (&stream->lock);
+      stream->available += PIECE_SIZE;
+      pthread_mutex_unlock (&stream->lock);
+      MHD_response_data_ready (stream->connection);
+    }
+  return NULL;
+}
+
+
+static int
+ahc_stream (void *cls,
+            struct MHD_Connection *connection,
+            const char *url,
+            const char *method,
+            const char *version,
+            const char *upload_data,
+            size_t *upload_data_size,
+            void **con_cls)
+{
+  static int marker;
+  struct Stream *stream = cls;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_callback ((0 == strcmp (url, "/sized"))
+                                                ? PIECES * PIECE_SIZE
+                                                : MHD_SIZE_UNKNOWN,
+                                                1024,
+                                                &stream_reader,
+                                                stream,
+                                                NULL);
+  if (NULL == response)
+    return MHD_NO;
+  stream->connection = connection;
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  if (0 != pthread_create (&stream->producer,
+                           NULL,
+                           &producer,
+                           stream))
+    abort ();
+  stream->started = MHD_YES;
+  return ret;
+}
+
+
+/**
+ * Fetch @a url and check the body.
+ *
+ * @param url URL to request
+ * @param daemon_flags flags for the daemon
+ * @return 0 on success
+ */
+static int
+check_stream (const char *url,
+              unsigned int daemon_flags)
+{
+  struct MHD_Daemon *d;
+  struct Stream stream;
+  MHD_socket sock;
+  struct sockaddr_in sa;
+  char request[128];
+  char reply[1024];
+  const char *body;
+  char expected[PIECES * PIECE_SIZE + 1];
+  size_t have;
+  ssize_t got;
+  unsigned int i;
+  int ret;
+
+  memset (&stream, 0, sizeof (stream));
+  pthread_mutex_init (&stream.lock, NULL);
+  d = MHD_start_daemon (daemon_flags | MHD_USE_SUSPEND_RESUME | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_stream, &stream,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  snprintf (request,
+            sizeof (request),
+            "GET %s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+            url);
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sock)
+    abort ();
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (sock,
+                    (struct sockaddr *) &sa,
+                    sizeof (sa)))
+    abort ();
+  if (strlen (request) !=
+      (size_t) write (sock, request, strlen (request)))
+    abort ();
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          (0 < (got = read (sock, &reply[have], sizeof (reply) - 1 - have))) )
+    have += got;
+  reply[have] = '\0';
+  MHD_socket_close_ (sock);
+  if (MHD_YES == stream.started)
+    pthread_join (stream.producer, NULL);
+  MHD_stop_daemon (d);
+  pthread_mutex_destroy (&stream.lock);
+  for (i = 0; i < PIECES * PIECE_SIZE; i++)
+    expected[i] = 'a' + i / PIECE_SIZE;
+  expected[PIECES * PIECE_SIZE] = '\0';
+  body = strstr (reply, "\r\n\r\n");
+  ret = 0;
+  if ( (NULL == body) ||
+       (0 != strcmp (body + 4, expected)) )
+    {
+      fprintf (stderr, "Unexpected reply for `%s': `%s'\n", url, reply);
+      ret |= 2;
+    }
+  /* one call per piece and one for each wait, plus the end; the
+     reader must not be polled while the producer is sleeping */
+  if (stream.calls > 2 * PIECES + 2)
+    {
+      fprintf (stderr, "Content reader called %u times for `%s'\n",
+               stream.calls, url);
+      ret |= 4;
+    }
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += check_stream ("/", MHD_USE_SELECT_INTERNALLY);
+  errorCount += check_stream ("/sized", MHD_USE_SELECT_INTERNALLY);
+  errorCount += check_stream ("/", MHD_USE_POLL_INTERNALLY);
+#if EPOLL_SUPPORT
+  errorCount += check_stream ("/sized", MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY);
+#endif
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,191 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_defer_accept.c
+ * @brief  Testcase for #MHD_OPTION_TCP_DEFER_ACCEPT: requests sent
+ *         right after connecting, after a delay and pipelined ones
+ *         are all answered with each event loop
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+
+#define REQUEST "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n"
+
+#define PAGE "deferred"
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_buffer (strlen (PAGE),
+                                              (void *) PAGE,
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection,
+                            MHD_HTTP_OK,
+                            response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Send @a num requests at once on @a sock and check that all
+ * responses arrive within a second.
+ *
+ * @return 0 on success
+ */
+static int
+request (MHD_socket sock,
+         unsigned int num)
+{
+  char buf[2048];
+  size_t off;
+  ssize_t got;
+  fd_set rs;
+  struct timeval tv;
+  unsigned int i;
+  unsigned int seen;
+  const char *pos;
+
+  for (i = 0; i < num; i++)
+    if (strlen (REQUEST) != (size_t) write (sock, REQUEST, strlen (REQUEST)))
+      return 1;
+  off = 0;
+  buf[0] = '\0';
+  seen = 0;
+  while (seen < num)
+    {
+      FD_ZERO (&rs);
+      FD_SET (sock, &rs);
+      tv.tv_sec = 1;
+      tv.tv_usec = 0;
+      if (1 != select (sock + 1, &rs, NULL, NULL, &tv))
+        return 2;
+      got = read (sock, &buf[off], sizeof (buf) - 1 - off);
+      if (0 >= got)
+        return 4;
+      off += got;
+      buf[off] = '\0';
+      if (sizeof (buf) - 1 == off)
+        return 8;
+      seen = 0;
+      for (pos = strstr (buf, PAGE); NULL != pos; pos = strstr (pos + 1, PAGE))
+        seen++;
+    }
+  if (0 != strncmp (buf, "HTTP/1.1 200", strlen ("HTTP/1.1 200")))
+    return 16;
+  return 0;
+}
+
+
+static int
+test_defer_accept (unsigned int flags,
+                   unsigned int pool_size,
+                   uint16_t port)
+{
+  struct MHD_Daemon *d;
+  MHD_socket sock;
+  int ret;
+
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        port,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_THREAD_POOL_SIZE, pool_size,
+                        MHD_OPTION_TCP_DEFER_ACCEPT, 5,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  /* request in the first packet */
+  sock = connect_to (port);
+  ret |= request (sock, 1);
+  ret |= request (sock, 1) << 5;
+  MHD_socket_close_ (sock);
+  /* request some time after the handshake */
+  sock = connect_to (port);
+  usleep (100000);
+  ret |= request (sock, 1) << 10;
+  MHD_socket_close_ (sock);
+  /* pipelined requests, all read by the first recv() */
+  sock = connect_to (port);
+  ret |= request (sock, 3) << 15;
+  MHD_socket_close_ (sock);
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += test_defer_accept (MHD_USE_SELECT_INTERNALLY,
+                                   0,
+                                   1124);
+  errorCount += test_defer_accept (MHD_USE_SELECT_INTERNALLY,
+                                   2,
+                                   1125);
+#ifdef HAVE_POLL
+  errorCount += test_defer_accept (MHD_USE_POLL_INTERNALLY,
+                                   0,
+                                   1126);
+#endif
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_EPOLL))
+    errorCount += test_defer_accept (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY,
+                                     0,
+                                     1127);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,276 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_defer_response.c
+ * @brief  Testcase for #MHD_defer_response() and #MHD_complete_response():
+ *         requests answered from another thread and from the handler
+ *         itself, without further calls of the access handler
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1193
+
+/**
+ * Number of requests of each kind sent on the connection.
+ */
+#define ROUNDS 4
+
+/**
+ * Set on errors in the callbacks.
+ */
+static int failed;
+
+/**
+ * Number of calls of the access handler.
+ */
+static unsigned int calls;
+
+/**
+ * Thread completing the current request, if any.
+ */
+static pthread_t worker;
+
+/**
+ * #MHD_YES if @e worker was started and not joined yet.
+ */
+static int worker_started;
+
+
+static void *
+complete_later (void *cls)
+{
+  struct MHD_Connection *connection = cls;
+  struct MHD_Response *response;
+
+  usleep (20000);
+  response = MHD_create_response_from_buffer (5,
+                                              (void *) "later",
+                                              MHD_RESPMEM_PERSISTENT);
+  if (MHD_YES != MHD_complete_response (connection,
+                                        MHD_HTTP_OK,
+                                        response))
+    failed |= 1;
+  /* the request is answered already */
+  if (MHD_NO != MHD_complete_response (connection,
+                                       MHD_HTTP_OK,
+                                       response))
+    failed |= 2;
+  MHD_destroy_response (response);
+  return NULL;
+}
+
+
+static int
+ahc_defer (void *cls,
+           struct MHD_Connection *connection,
+           const char *url,
+           const char *method,
+           const char *version,
+           const char *upload_data,
+           size_t *upload_data_size,
+           void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+
+  calls++;
+  if (0 != *upload_data_size)
+    {
+      /* the upload is not processed yet */
+      if (MHD_NO != MHD_defer_response (connection))
+        failed |= 4;
+      *upload_data_size = 0;
+      return MHD_YES;
+    }
+  if ( (0 == strcmp (method, MHD_HTTP_METHOD_POST)) &&
+       (&marker != *con_cls) )
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  *con_cls = NULL;
+  if (MHD_YES != MHD_defer_response (connection))
+    {
+      failed |= 8;
+      return MHD_NO;
+    }
+  if (MHD_NO != MHD_defer_response (connection))
+    failed |= 16;
+  if (0 == strcmp (url, "/now"))
+    {
+      /* completed before the handler returns */
+      response = MHD_create_response_from_buffer (3,
+                                                  (void *) "now",
+                                                  MHD_RESPMEM_PERSISTENT);
+      if (MHD_YES != MHD_complete_response (connection,
+                                            MHD_HTTP_OK,
+                                            response))
+        failed |= 32;
+      MHD_destroy_response (response);
+      return MHD_YES;
+    }
+  if (0 != pthread_create (&worker,
+                           NULL,
+                           &complete_later,
+                           connection))
+    abort ();
+  worker_started = MHD_YES;
+  return MHD_YES;
+}
+
+
+/**
+ * Send @a request on @a sock and check that the body of the reply is
+ * @a body.
+ *
+ * @param sock socket to use
+ * @param request the request
+ * @param expected expected body
+ * @return 0 on success
+ */
+static int
+check_request (MHD_socket sock,
+               const char *request,
+               const char *expected)
+{
+  char reply[512];
+  const char *body;
+  size_t have;
+  ssize_t got;
+  int ret;
+
+  if (strlen (request) !=
+      (size_t) write (sock, request, strlen (request)))
+    return 64;
+  ret = 128;
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          (0 < (got = read (sock,
+                            &reply[have],
+                            sizeof (reply) - 1 - have))) )
+    {
+      have += got;
+      reply[have] = '\0';
+      if ( (NULL != (body = strstr (reply, "\r\n\r\n"))) &&
+           (0 == strcmp (body + 4, expected)) )
+        {
+          ret = 0;
+          break;
+        }
+    }
+  if (MHD_YES == worker_started)
+    {
+      pthread_join (worker, NULL);
+      worker_started = MHD_NO;
+    }
+  return ret;
+}
+
+
+static int
+check_defer (unsigned int flags)
+{
+  struct MHD_Daemon *d;
+  struct sockaddr_in sa;
+  struct timeval tv;
+  MHD_socket sock;
+  unsigned int i;
+  int ret;
+
+  failed = 0;
+  calls = 0;
+  d = MHD_start_daemon (flags | MHD_USE_SUSPEND_RESUME | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_defer, NULL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 256;
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if ( (MHD_INVALID_SOCKET == sock) ||
+       (0 != connect (sock, (struct sockaddr *) &sa, sizeof (sa))) )
+    abort ();
+  tv.tv_sec = 5;
+  tv.tv_usec = 0;
+  (void) setsockopt (sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+  ret = 0;
+  for (i = 0; i < ROUNDS; i++)
+    {
+      ret |= check_request (sock,
+                            "GET /later HTTP/1.1\r\nHost: localhost\r\n\r\n",
+                            "later");
+      ret |= check_request (sock,
+                            "GET /now HTTP/1.1\r\nHost: localhost\r\n\r\n",
+                            "now");
+      ret |= check_request (sock,
+                            "POST /later HTTP/1.1\r\nHost: localhost\r\n"
+                            "Content-Length: 5\r\n\r\nhello",
+                            "later");
+    }
+  MHD_socket_close_ (sock);
+  MHD_stop_daemon (d);
+  ret |= failed;
+  /* one call per GET, three per POST: never after deferring */
+  if (ROUNDS * 5 != calls)
+    ret |= 512;
+  if (0 != ret)
+    fprintf (stderr,
+             "Deferred responses failed with flags %u: %d (%u calls)\n",
+             flags,
+             ret,
+             calls);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += check_defer (MHD_USE_SELECT_INTERNALLY);
+  errorCount += check_defer (MHD_USE_POLL_INTERNALLY);
+#if EPOLL_SUPPORT
+  errorCount += check_defer (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY);
+#endif
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
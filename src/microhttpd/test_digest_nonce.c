@@ -0,0 +1,272 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_digest_nonce.c
+ * @brief  Testcase for the nonce-nc map of digest authentication:
+ *         nonces sharing a set, replacement of the least recently
+ *         used nonce and replays
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "md5.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1118
+
+#define REALM "test@example.com"
+
+#define USER "user"
+
+#define PASS "secret"
+
+/**
+ * Number of nonces in the map, all of them in the same set.
+ */
+#define NONCES 4
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int check;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  check = MHD_digest_auth_check (connection, REALM, USER, PASS, 300);
+  response = MHD_create_response_from_buffer (strlen ("ok"),
+                                              "ok",
+                                              MHD_RESPMEM_PERSISTENT);
+  if (MHD_YES == check)
+    ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  else
+    ret = MHD_queue_auth_fail_response (connection,
+                                        REALM,
+                                        "opaque",
+                                        response,
+                                        (MHD_INVALID_NONCE == check)
+                                        ? MHD_YES : MHD_NO);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Hex-encoded MD5 hash of the concatenation of the given strings,
+ * separated by colons.
+ *
+ * @param[out] hex set to the hash
+ * @param parts strings to hash, terminated by NULL
+ */
+static void
+md5_hex (char hex[MD5_DIGEST_STRING_LENGTH],
+         const char **parts)
+{
+  struct MD5Context md5;
+  unsigned char digest[MD5_DIGEST_SIZE];
+  unsigned int i;
+
+  MD5Init (&md5);
+  for (i = 0; NULL != parts[i]; i++)
+    {
+      if (0 != i)
+        MD5Update (&md5, (const unsigned char *) ":", 1);
+      MD5Update (&md5,
+                 (const unsigned char *) parts[i],
+                 strlen (parts[i]));
+    }
+  MD5Final (digest, &md5);
+  for (i = 0; i < MD5_DIGEST_SIZE; i++)
+    sprintf (&hex[2 * i], "%02x", digest[i]);
+}
+
+
+/**
+ * Send a request for @a url and return the status code of the reply.
+ *
+ * @param url URL to request
+ * @param nonce nonce to authenticate with, NULL for none
+ * @param nc nonce counter to authenticate with
+ * @param[out] new_nonce set to the nonce offered in the reply, if any
+ * @return the status code, 0 on errors
+ */
+static unsigned int
+query (const char *url,
+       const char *nonce,
+       unsigned int nc,
+       char *new_nonce)
+{
+  struct sockaddr_in sa;
+  char request[1024];
+  char reply[2048];
+  char ha1[MD5_DIGEST_STRING_LENGTH];
+  char ha2[MD5_DIGEST_STRING_LENGTH];
+  char response[MD5_DIGEST_STRING_LENGTH];
+  char ncs[9];
+  const char *parts[7];
+  const char *pos;
+  const char *end;
+  MHD_socket sock;
+  size_t have;
+  ssize_t got;
+  unsigned int status;
+
+  if (NULL == nonce)
+    snprintf (request,
+              sizeof (request),
+              "GET %s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+              url);
+  else
+    {
+      snprintf (ncs, sizeof (ncs), "%08x", nc);
+      parts[0] = USER;
+      parts[1] = REALM;
+      parts[2] = PASS;
+      parts[3] = NULL;
+      md5_hex (ha1, parts);
+      parts[0] = "GET";
+      parts[1] = url;
+      parts[2] = NULL;
+      md5_hex (ha2, parts);
+      parts[0] = ha1;
+      parts[1] = nonce;
+      parts[2] = ncs;
+      parts[3] = "0a4f113b";
+      parts[4] = "auth";
+      parts[5] = ha2;
+      parts[6] = NULL;
+      md5_hex (response, parts);
+      snprintf (request,
+                sizeof (request),
+                "GET %s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n"
+                "Authorization: Digest username=\"%s\", realm=\"%s\", "
+                "nonce=\"%s\", uri=\"%s\", qop=auth, nc=%s, "
+                "cnonce=\"0a4f113b\", response=\"%s\", opaque=\"opaque\"\r\n\r\n",
+                url, USER, REALM, nonce, url, ncs, response);
+    }
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if ( (MHD_INVALID_SOCKET == sock) ||
+       (0 != connect (sock, (struct sockaddr *) &sa, sizeof (sa))) )
+    abort ();
+  if (strlen (request) !=
+      (size_t) write (sock, request, strlen (request)))
+    abort ();
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          (0 < (got = read (sock, &reply[have], sizeof (reply) - 1 - have))) )
+    have += got;
+  reply[have] = '\0';
+  MHD_socket_close_ (sock);
+  if (1 != sscanf (reply, "HTTP/1.1 %u", &status))
+    return 0;
+  if ( (NULL != new_nonce) &&
+       (NULL != (pos = strstr (reply, "nonce=\""))) &&
+       (NULL != (end = strchr (pos + strlen ("nonce=\""), '"'))) )
+    {
+      pos += strlen ("nonce=\"");
+      memcpy (new_nonce, pos, end - pos);
+      new_nonce[end - pos] = '\0';
+    }
+  return status;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  struct MHD_Daemon *d;
+  char nonces[NONCES + 1][128];
+  char url[16];
+  unsigned int i;
+  int errorCount = 0;
+
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_NONCE_NC_SIZE, NONCES,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  /* every nonce is kept, none replaces another */
+  memset (nonces, 0, sizeof (nonces));
+  for (i = 0; i < NONCES; i++)
+    {
+      snprintf (url, sizeof (url), "/%u", i);
+      if (MHD_HTTP_UNAUTHORIZED != query (url, NULL, 0, nonces[i]))
+        errorCount |= 1;
+    }
+  for (i = 0; i < NONCES; i++)
+    {
+      snprintf (url, sizeof (url), "/%u", i);
+      if (MHD_HTTP_OK != query (url, nonces[i], 1, NULL))
+        errorCount |= 2;
+    }
+  /* a new nonce replaces the least recently used one, "/0" */
+  if (MHD_HTTP_UNAUTHORIZED != query ("/4", NULL, 0, nonces[NONCES]))
+    errorCount |= 4;
+  for (i = 1; i <= NONCES; i++)
+    {
+      snprintf (url, sizeof (url), "/%u", i);
+      if (MHD_HTTP_OK != query (url,
+                                nonces[i],
+                                (NONCES == i) ? 1 : 2,
+                                NULL))
+        errorCount |= 8;
+    }
+  /* each failure offers a nonce again, so these come last */
+  if (MHD_HTTP_UNAUTHORIZED != query ("/0", nonces[0], 2, NULL))
+    errorCount |= 16;
+  if (MHD_HTTP_UNAUTHORIZED != query ("/2", nonces[2], 2, NULL))
+    errorCount |= 32;
+  MHD_stop_daemon (d);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
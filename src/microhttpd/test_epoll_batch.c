@@ -0,0 +1,193 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_epoll_batch.c
+ * @brief  Testcase for #MHD_OPTION_EPOLL_MAX_EVENTS: with a batch of
+ *         a few events, requests on many connections that become
+ *         ready at once are all served
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1186
+
+/**
+ * Number of connections used.
+ */
+#define CONNECTIONS 32
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_buffer (strlen (url),
+                                              (void *) url,
+                                              MHD_RESPMEM_MUST_COPY);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Read the reply for "/<n>" from @a sock.
+ *
+ * @param sock socket to read from
+ * @param n number that was requested
+ * @return 0 on success
+ */
+static int
+check_reply (MHD_socket sock,
+             unsigned int n)
+{
+  char reply[512];
+  char url[16];
+  const char *body;
+  size_t have;
+  ssize_t got;
+  size_t len;
+
+  snprintf (url, sizeof (url), "/%u", n);
+  len = strlen (url);
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          (0 < (got = read (sock,
+                            &reply[have],
+                            sizeof (reply) - 1 - have))) )
+    {
+      have += got;
+      reply[have] = '\0';
+      if ( (NULL != (body = strstr (reply, "\r\n\r\n"))) &&
+           (strlen (body + 4) >= len) )
+        break;
+    }
+  reply[have] = '\0';
+  if ( (NULL == (body = strstr (reply, "\r\n\r\n"))) ||
+       (0 != strcmp (body + 4, url)) )
+    return 1;
+  return 0;
+}
+
+
+static int
+check_batch (unsigned int max_events)
+{
+  struct MHD_Daemon *d;
+  MHD_socket csocks[CONNECTIONS];
+  struct sockaddr_in sa;
+  char request[128];
+  unsigned int i;
+  unsigned int round;
+  int ret;
+
+  d = MHD_start_daemon (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_EPOLL_MAX_EVENTS, max_events,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  for (i = 0; i < CONNECTIONS; i++)
+    {
+      csocks[i] = socket (AF_INET, SOCK_STREAM, 0);
+      if ( (MHD_INVALID_SOCKET == csocks[i]) ||
+           (0 != connect (csocks[i], (struct sockaddr *) &sa, sizeof (sa))) )
+        abort ();
+    }
+  ret = 0;
+  for (round = 0; round < 3; round++)
+    {
+      /* all requests first, so that the connections are ready at
+         the same time */
+      for (i = 0; i < CONNECTIONS; i++)
+        {
+          snprintf (request,
+                    sizeof (request),
+                    "GET /%u HTTP/1.1\r\nHost: localhost\r\n\r\n",
+                    round * CONNECTIONS + i);
+          if (strlen (request) !=
+              (size_t) write (csocks[i], request, strlen (request)))
+            abort ();
+        }
+      for (i = 0; i < CONNECTIONS; i++)
+        if (0 != check_reply (csocks[i], round * CONNECTIONS + i))
+          ret |= 2;
+    }
+  for (i = 0; i < CONNECTIONS; i++)
+    MHD_socket_close_ (csocks[i]);
+  MHD_stop_daemon (d);
+  if (0 != ret)
+    fprintf (stderr,
+             "Batch of %u events failed: %d\n",
+             max_events,
+             ret);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  if (MHD_YES != MHD_is_feature_supported (MHD_FEATURE_EPOLL))
+    return 77;
+  errorCount += check_batch (1);
+  errorCount += check_batch (3);
+  errorCount += check_batch (0);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,220 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_file_cache.c
+ * @brief  Testcase for the cache of static file responses
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define FILE_A "test_file_cache_a.tmp"
+
+#define FILE_B "test_file_cache_b.tmp"
+
+/**
+ * Cache used by the access handler.
+ */
+static struct MHD_FileCache *cache;
+
+
+static int
+init_response (void *cls,
+               const char *path,
+               struct MHD_Response *response)
+{
+  unsigned int *created = cls;
+
+  (*created)++;
+  return MHD_add_response_header (response,
+                                  MHD_HTTP_HEADER_CONTENT_TYPE,
+                                  "text/plain");
+}
+
+
+static int
+ahc_file (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  response = MHD_file_cache_get_response (cache,
+                                          &url[1]);
+  if (NULL == response)
+    return MHD_NO;
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+static int
+write_file (const char *path,
+            const char *data)
+{
+  FILE *f;
+
+  f = fopen (path, "wb");
+  if (NULL == f)
+    return 1;
+  if (strlen (data) != fwrite (data, 1, strlen (data), f))
+    {
+      fclose (f);
+      return 1;
+    }
+  return (0 != fclose (f));
+}
+
+
+/**
+ * Request @a path from the daemon and check the reply.
+ *
+ * @param path file to request
+ * @param expected expected body
+ * @return 0 on success
+ */
+static int
+check_get (const char *path,
+           const char *expected)
+{
+  MHD_socket sock;
+  char req[256];
+  char reply[1024];
+  const char *body;
+  size_t have;
+  ssize_t got;
+
+  snprintf (req,
+            sizeof (req),
+            "GET /%s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+            path);
+  sock = connect_to (1104);
+  if (strlen (req) != (size_t) write (sock, req, strlen (req)))
+    abort ();
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          (0 < (got = read (sock, &reply[have], sizeof (reply) - 1 - have))) )
+    have += got;
+  reply[have] = '\0';
+  MHD_socket_close_ (sock);
+  if (0 != strncmp (reply, "HTTP/1.1 200", strlen ("HTTP/1.1 200")))
+    return 1;
+  if (NULL == strstr (reply, "\r\nContent-Type: text/plain\r\n"))
+    return 1;
+  body = strstr (reply, "\r\n\r\n");
+  if ( (NULL == body) ||
+       (0 != strcmp (body + 4, expected)) )
+    return 1;
+  return 0;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  struct MHD_Daemon *d;
+  struct MHD_Response *r1;
+  struct MHD_Response *r2;
+  unsigned int created;
+  int errorCount = 0;
+
+  if ( (0 != write_file (FILE_A, "small")) ||
+       (0 != write_file (FILE_B, "a somewhat larger file")) )
+    return 1;
+  created = 0;
+  /* files of more than 8 bytes are sent from the file descriptor,
+     at most one file is cached, check for changes every time */
+  cache = MHD_file_cache_create (1, 8, 0, &init_response, &created);
+  if (NULL == cache)
+    return 1;
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        1104,
+                        NULL, NULL,
+                        &ahc_file, NULL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+
+  /* cached file is shared */
+  r1 = MHD_file_cache_get_response (cache, FILE_A);
+  r2 = MHD_file_cache_get_response (cache, FILE_A);
+  if ( (NULL == r1) ||
+       (r1 != r2) ||
+       (1 != created) )
+    errorCount |= 2;
+  MHD_destroy_response (r1);
+  MHD_destroy_response (r2);
+  errorCount |= check_get (FILE_A, "small") ? 4 : 0;
+
+  /* cache is full: second file gets a fresh response each time */
+  r1 = MHD_file_cache_get_response (cache, FILE_B);
+  r2 = MHD_file_cache_get_response (cache, FILE_B);
+  if ( (NULL == r1) ||
+       (NULL == r2) ||
+       (r1 == r2) )
+    errorCount |= 8;
+  MHD_destroy_response (r1);
+  MHD_destroy_response (r2);
+  errorCount |= check_get (FILE_B, "a somewhat larger file") ? 16 : 0;
+
+  /* changed file is detected */
+  if (0 != write_file (FILE_A, "now sent from the file"))
+    errorCount |= 32;
+  errorCount |= check_get (FILE_A, "now sent from the file") ? 64 : 0;
+
+  /* missing file */
+  if (NULL != MHD_file_cache_get_response (cache, "test_file_cache_none.tmp"))
+    errorCount |= 128;
+
+  MHD_stop_daemon (d);
+  MHD_file_cache_destroy (cache);
+  (void) unlink (FILE_A);
+  (void) unlink (FILE_B);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
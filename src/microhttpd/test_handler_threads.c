@@ -0,0 +1,320 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_handler_threads.c
+ * @brief  Testcase for running the access handler on handler threads
+ *         (#MHD_OPTION_HANDLER_THREADS)
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1115
+
+/**
+ * How long the handler blocks for "/slow" (in microseconds).
+ */
+#define SLOW_USEC 500000
+
+/**
+ * Size of the body uploaded to "/upload".
+ */
+#define UPLOAD_SIZE (256 * 1024)
+
+
+/**
+ * Per-request state.
+ */
+struct Request
+{
+  /**
+   * Number of bytes of the body received so far.
+   */
+  size_t received;
+
+  /**
+   * #MHD_YES once the request suspended itself.
+   */
+  int suspended;
+};
+
+
+/**
+ * Thread resuming a connection the handler suspended.
+ *
+ * @param cls the connection
+ * @return NULL
+ */
+static void *
+resumer (void *cls)
+{
+  struct MHD_Connection *connection = cls;
+
+  usleep (100000);
+  MHD_resume_connection (connection);
+  return NULL;
+}
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  struct Request *req = *con_cls;
+  struct MHD_Response *response;
+  pthread_t thread;
+  char body[64];
+  int ret;
+
+  if (NULL == req)
+    {
+      req = calloc (1, sizeof (struct Request));
+      if (NULL == req)
+        return MHD_NO;
+      *con_cls = req;
+      return MHD_YES;
+    }
+  if (0 != *upload_data_size)
+    {
+      req->received += *upload_data_size;
+      *upload_data_size = 0;
+      return MHD_YES;
+    }
+  if (0 == strcmp (url, "/slow"))
+    usleep (SLOW_USEC);
+  if ( (0 == strcmp (url, "/suspend")) &&
+       (MHD_NO == req->suspended) )
+    {
+      /* suspend from the handler thread, resumed by another one */
+      req->suspended = MHD_YES;
+      MHD_suspend_connection (connection);
+      if (0 != pthread_create (&thread, NULL, &resumer, connection))
+        abort ();
+      pthread_detach (thread);
+      return MHD_YES;
+    }
+  snprintf (body,
+            sizeof (body),
+            "%s %u",
+            url,
+            (unsigned int) req->received);
+  response = MHD_create_response_from_buffer (strlen (body),
+                                              body,
+                                              MHD_RESPMEM_MUST_COPY);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+static void
+request_completed (void *cls,
+                   struct MHD_Connection *connection,
+                   void **con_cls,
+                   enum MHD_RequestTerminationCode toe)
+{
+  free (*con_cls);
+  *con_cls = NULL;
+}
+
+
+/**
+ * Current time in milliseconds.
+ */
+static unsigned long long
+now_ms ()
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+
+/**
+ * Connect to the daemon and send a request.
+ *
+ * @param url URL to request
+ * @param upload number of bytes to upload
+ * @return the socket
+ */
+static MHD_socket
+send_request (const char *url,
+              size_t upload)
+{
+  static char data[UPLOAD_SIZE];
+  struct sockaddr_in sa;
+  char request[256];
+  MHD_socket sock;
+  size_t off;
+  ssize_t done;
+
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if ( (MHD_INVALID_SOCKET == sock) ||
+       (0 != connect (sock, (struct sockaddr *) &sa, sizeof (sa))) )
+    abort ();
+  snprintf (request,
+            sizeof (request),
+            "%s %s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n"
+            "Content-Length: %u\r\n\r\n",
+            (0 == upload) ? "GET" : "PUT",
+            url,
+            (unsigned int) upload);
+  if (strlen (request) !=
+      (size_t) write (sock, request, strlen (request)))
+    abort ();
+  memset (data, 'x', sizeof (data));
+  for (off = 0; off < upload; off += done)
+    if (0 >= (done = write (sock, &data[off], upload - off)))
+      abort ();
+  return sock;
+}
+
+
+/**
+ * Read the reply on a connection and check its body.
+ *
+ * @param sock connection to read from
+ * @param expect expected body
+ * @return 0 on success
+ */
+static int
+check_reply (MHD_socket sock,
+             const char *expect)
+{
+  char reply[1024];
+  const char *body;
+  size_t have;
+  ssize_t got;
+
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          (0 < (got = read (sock, &reply[have], sizeof (reply) - 1 - have))) )
+    have += got;
+  reply[have] = '\0';
+  MHD_socket_close_ (sock);
+  if ( (NULL == (body = strstr (reply, "\r\n\r\n"))) ||
+       (0 != strcmp (body + 4, expect)) )
+    {
+      fprintf (stderr, "Unexpected reply `%s'\n", reply);
+      return 1;
+    }
+  return 0;
+}
+
+
+/**
+ * Check that a slow handler does not delay other requests, that
+ * uploads reach the handler, and that the handler can suspend the
+ * connection itself.
+ *
+ * @param flags event loop flags for the daemon
+ * @return 0 on success
+ */
+static int
+check_handler_threads (unsigned int flags)
+{
+  struct MHD_Daemon *d;
+  MHD_socket slow;
+  MHD_socket fast;
+  MHD_socket sock;
+  unsigned long long start;
+  unsigned long long elapsed;
+  char expect[64];
+  int ret;
+
+  d = MHD_start_daemon (flags | MHD_USE_SUSPEND_RESUME | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_NOTIFY_COMPLETED, &request_completed, NULL,
+                        MHD_OPTION_HANDLER_THREADS, 2,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  start = now_ms ();
+  slow = send_request ("/slow", 0);
+  usleep (50000);
+  fast = send_request ("/fast", 0);
+  ret |= check_reply (fast, "/fast 0");
+  elapsed = now_ms () - start;
+  if (elapsed >= SLOW_USEC / 1000)
+    {
+      fprintf (stderr,
+               "Fast request took %llu ms with flags %u\n",
+               elapsed,
+               flags);
+      ret |= 2;
+    }
+  ret |= check_reply (slow, "/slow 0");
+  sock = send_request ("/upload", UPLOAD_SIZE);
+  snprintf (expect, sizeof (expect), "/upload %u", UPLOAD_SIZE);
+  ret |= 4 * check_reply (sock, expect);
+  sock = send_request ("/suspend", 0);
+  ret |= 8 * check_reply (sock, "/suspend 0");
+  MHD_stop_daemon (d);
+  if (0 != ret)
+    fprintf (stderr,
+             "Handler threads failed with flags %u: %d\n",
+             flags, ret);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += check_handler_threads (MHD_USE_SELECT_INTERNALLY);
+  errorCount += check_handler_threads (MHD_USE_POLL_INTERNALLY);
+#if EPOLL_SUPPORT
+  errorCount += check_handler_threads (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY);
+#endif
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
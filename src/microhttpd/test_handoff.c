@@ -0,0 +1,334 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_handoff.c
+ * @brief  Testcase for #MHD_handoff_listen_socket() and
+ *         #MHD_OPTION_LISTEN_SOCKET_SYSTEMD: after the handoff the
+ *         successor accepts new connections while the old daemon
+ *         answers pending requests and closes idle keep-alive
+ *         connections
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1187
+
+#define SYSTEMD_PORT 1188
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  const char *body = cls;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_buffer (strlen (body),
+                                              (void *) body,
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Connect to @a port on the loopback interface.
+ *
+ * @param port port to connect to
+ * @return the socket
+ */
+static MHD_socket
+connect_to (uint16_t port)
+{
+  struct sockaddr_in sa;
+  struct timeval tv;
+  MHD_socket sock;
+
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (port);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if ( (MHD_INVALID_SOCKET == sock) ||
+       (0 != connect (sock, (struct sockaddr *) &sa, sizeof (sa))) )
+    abort ();
+  /* do not hang if the server misbehaves */
+  tv.tv_sec = 5;
+  tv.tv_usec = 0;
+  (void) setsockopt (sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+  return sock;
+}
+
+
+/**
+ * Send a request on @a sock and check that the body of the reply
+ * is @a expected.
+ *
+ * @param sock socket to use
+ * @param expected expected body
+ * @param must_close #MHD_YES if the reply must close the connection
+ * @return 0 on success
+ */
+static int
+check_request (MHD_socket sock,
+               const char *expected,
+               int must_close)
+{
+  static const char request[] =
+    "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  char reply[512];
+  const char *body;
+  size_t have;
+  ssize_t got;
+
+  if (strlen (request) !=
+      (size_t) write (sock, request, strlen (request)))
+    return 1;
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          (0 < (got = read (sock,
+                            &reply[have],
+                            sizeof (reply) - 1 - have))) )
+    {
+      have += got;
+      reply[have] = '\0';
+      if ( (NULL != (body = strstr (reply, "\r\n\r\n"))) &&
+           (strlen (body + 4) >= strlen (expected)) )
+        break;
+    }
+  reply[have] = '\0';
+  if ( (NULL == (body = strstr (reply, "\r\n\r\n"))) ||
+       (0 != strcmp (body + 4, expected)) )
+    return 2;
+  if ( (MHD_YES == must_close) !=
+       (NULL != strstr (reply, "Connection: close")) )
+    return 4;
+  return 0;
+}
+
+
+/**
+ * Check that the server closes @a sock.
+ *
+ * @param sock socket to check
+ * @return 0 on success
+ */
+static int
+check_closed (MHD_socket sock)
+{
+  char buf[16];
+
+  if (0 != read (sock, buf, sizeof (buf)))
+    return 8;
+  return 0;
+}
+
+
+static int
+check_handoff (unsigned int flags)
+{
+  const union MHD_DaemonInfo *info;
+  struct MHD_Daemon *d1;
+  struct MHD_Daemon *d2;
+  MHD_socket idle;
+  MHD_socket fresh;
+  MHD_socket sock;
+  MHD_socket old;
+  MHD_socket lsock;
+  MHD_socket sp[2];
+  unsigned int i;
+  int ret;
+
+  d1 = MHD_start_daemon (flags | MHD_USE_PIPE_FOR_SHUTDOWN | MHD_USE_DEBUG,
+                         PORT,
+                         NULL, NULL,
+                         &ahc_echo, "old",
+                         MHD_OPTION_END);
+  if (NULL == d1)
+    return 16;
+  ret = 0;
+  idle = connect_to (PORT);
+  ret |= check_request (idle, "old", MHD_NO);
+  /* accepted, but without a request before the handoff */
+  fresh = connect_to (PORT);
+  usleep (100000);
+
+  if (0 != socketpair (AF_UNIX, SOCK_STREAM, 0, sp))
+    abort ();
+  old = MHD_handoff_listen_socket (d1, sp[0]);
+  if (MHD_INVALID_SOCKET == old)
+    abort ();
+  lsock = MHD_receive_listen_socket (sp[1]);
+  if (MHD_INVALID_SOCKET == lsock)
+    abort ();
+  MHD_socket_close_ (sp[0]);
+  MHD_socket_close_ (sp[1]);
+  d2 = MHD_start_daemon (flags | MHD_USE_PIPE_FOR_SHUTDOWN | MHD_USE_DEBUG,
+                         0,
+                         NULL, NULL,
+                         &ahc_echo, "new",
+                         MHD_OPTION_LISTEN_SOCKET, lsock,
+                         MHD_OPTION_END);
+  if (NULL == d2)
+    abort ();
+
+  /* the old daemon answers the pending connection once */
+  ret |= check_request (fresh, "old", MHD_YES);
+  ret |= check_closed (fresh);
+  ret |= check_closed (idle);
+  sock = connect_to (PORT);
+  ret |= check_request (sock, "new", MHD_NO);
+  MHD_socket_close_ (sock);
+  MHD_socket_close_ (fresh);
+  MHD_socket_close_ (idle);
+
+  /* drained */
+  for (i = 0; i < 50; i++)
+    {
+      info = MHD_get_daemon_info (d1,
+                                  MHD_DAEMON_INFO_CURRENT_CONNECTIONS);
+      if ( (NULL != info) &&
+           (0 == info->num_connections) )
+        break;
+      usleep (10000);
+    }
+  if (50 == i)
+    ret |= 32;
+  MHD_stop_daemon (d1);
+  MHD_socket_close_ (old);
+  MHD_stop_daemon (d2);
+  if (0 != ret)
+    fprintf (stderr,
+             "Handoff failed with flags %u: %d\n",
+             flags,
+             ret);
+  return ret;
+}
+
+
+static int
+check_systemd ()
+{
+  struct MHD_Daemon *d;
+  struct sockaddr_in sa;
+  MHD_socket lsock;
+  MHD_socket sock;
+  char pid[32];
+  int ret;
+
+  /* systemd passes its sockets starting with descriptor 3 */
+  if (-1 != fcntl (3, F_GETFD))
+    return 0;
+  lsock = socket (AF_INET, SOCK_STREAM, 0);
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (SYSTEMD_PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if ( (MHD_INVALID_SOCKET == lsock) ||
+       (0 != bind (lsock, (struct sockaddr *) &sa, sizeof (sa))) ||
+       (0 != listen (lsock, 16)) ||
+       (3 != dup2 (lsock, 3)) )
+    abort ();
+  if (3 != lsock)
+    MHD_socket_close_ (lsock);
+  snprintf (pid,
+            sizeof (pid),
+            "%u",
+            (unsigned int) getpid ());
+  setenv ("LISTEN_PID", pid, 1);
+  setenv ("LISTEN_FDS", "1", 1);
+  ret = 0;
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        0,
+                        NULL, NULL,
+                        &ahc_echo, "systemd",
+                        MHD_OPTION_LISTEN_SOCKET_SYSTEMD, (unsigned int) 1,
+                        MHD_OPTION_END);
+  if (NULL != d)
+    {
+      MHD_stop_daemon (d);
+      ret |= 64;
+    }
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        0,
+                        NULL, NULL,
+                        &ahc_echo, "systemd",
+                        MHD_OPTION_LISTEN_SOCKET_SYSTEMD, (unsigned int) 0,
+                        MHD_OPTION_END);
+  unsetenv ("LISTEN_PID");
+  unsetenv ("LISTEN_FDS");
+  if (NULL == d)
+    return ret | 128;
+  sock = connect_to (SYSTEMD_PORT);
+  ret |= check_request (sock, "systemd", MHD_NO);
+  MHD_socket_close_ (sock);
+  MHD_stop_daemon (d);
+  if (0 != ret)
+    fprintf (stderr,
+             "Socket activation failed: %d\n",
+             ret);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  if (MHD_YES != MHD_is_feature_supported (MHD_FEATURE_SOCKET_HANDOFF))
+    return 77;
+  errorCount += check_handoff (MHD_USE_SELECT_INTERNALLY);
+  errorCount += check_handoff (MHD_USE_POLL_INTERNALLY);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_EPOLL))
+    errorCount += check_handoff (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY);
+  errorCount += check_systemd ();
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,213 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_header_cache.c
+ * @brief  Testcase for the serialized header of responses shared
+ *         between requests, including MHD's own error responses
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+/**
+ * Response shared by all requests.
+ */
+static struct MHD_Response *shared;
+
+
+static int
+ahc_shared (void *cls,
+            struct MHD_Connection *connection,
+            const char *url,
+            const char *method,
+            const char *version,
+            const char *upload_data,
+            size_t *upload_data_size,
+            void **con_cls)
+{
+  static int marker;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  return MHD_queue_response (connection,
+                             (0 == strcmp (url, "/missing"))
+                             ? MHD_HTTP_NOT_FOUND
+                             : MHD_HTTP_OK,
+                             shared);
+}
+
+
+/**
+ * Send @a req and return the reply.
+ *
+ * @param port port to use
+ * @param req request to send
+ * @param reply where to store the reply
+ * @param reply_size number of bytes in @a reply
+ */
+static void
+do_raw_request (uint16_t port,
+                const char *req,
+                char *reply,
+                size_t reply_size)
+{
+  MHD_socket sock;
+  size_t have;
+  ssize_t got;
+
+  sock = connect_to (port);
+  if (strlen (req) != (size_t) write (sock, req, strlen (req)))
+    abort ();
+  have = 0;
+  while ( (have < reply_size - 1) &&
+          (0 < (got = read (sock, &reply[have], reply_size - 1 - have))) )
+    have += got;
+  reply[have] = '\0';
+  MHD_socket_close_ (sock);
+}
+
+
+/**
+ * Send a request for @a url and return the reply.
+ *
+ * @param port port to use
+ * @param url path to request
+ * @param version HTTP version to use
+ * @param reply where to store the reply
+ * @param reply_size number of bytes in @a reply
+ */
+static void
+do_request (uint16_t port,
+            const char *url,
+            const char *version,
+            char *reply,
+            size_t reply_size)
+{
+  char req[256];
+
+  snprintf (req,
+            sizeof (req),
+            "GET %s %s\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+            url,
+            version);
+  do_raw_request (port, req, reply, reply_size);
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  struct MHD_Daemon *d;
+  char reply[1024];
+  char name[16];
+  char value[100];
+  unsigned int i;
+  int errorCount = 0;
+
+  shared = MHD_create_response_from_buffer (strlen ("shared"),
+                                            "shared",
+                                            MHD_RESPMEM_PERSISTENT);
+  if (NULL == shared)
+    return 1;
+  if (MHD_YES != MHD_add_response_header (shared, "X-Test", "one"))
+    return 1;
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        1103,
+                        NULL, NULL,
+                        &ahc_shared, NULL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  /* first use creates the serialized header, second one reuses it */
+  do_request (1103, "/", MHD_HTTP_VERSION_1_1, reply, sizeof (reply));
+  do_request (1103, "/", MHD_HTTP_VERSION_1_1, reply, sizeof (reply));
+  if ( (0 != strncmp (reply, "HTTP/1.1 200 OK\r\n", strlen ("HTTP/1.1 200 OK\r\n"))) ||
+       (NULL == strstr (reply, "\r\nX-Test: one\r\n")) ||
+       (NULL == strstr (reply, "\r\nContent-Length: 6\r\n")) ||
+       (NULL == strstr (reply, "\r\n\r\nshared")) )
+    errorCount |= 2;
+  /* different status line, same headers */
+  do_request (1103, "/missing", MHD_HTTP_VERSION_1_0, reply, sizeof (reply));
+  if ( (0 != strncmp (reply, "HTTP/1.0 404 Not Found\r\n", strlen ("HTTP/1.0 404 Not Found\r\n"))) ||
+       (NULL == strstr (reply, "\r\nX-Test: one\r\n")) )
+    errorCount |= 4;
+  /* changing the headers invalidates the serialized header */
+  if ( (MHD_YES != MHD_del_response_header (shared, "X-Test", "one")) ||
+       (MHD_YES != MHD_add_response_header (shared, "X-Test", "two")) )
+    errorCount |= 8;
+  do_request (1103, "/", MHD_HTTP_VERSION_1_1, reply, sizeof (reply));
+  if ( (NULL != strstr (reply, "X-Test: one")) ||
+       (NULL == strstr (reply, "\r\nX-Test: two\r\n")) )
+    errorCount |= 16;
+  MHD_stop_daemon (d);
+  /* errors detected by MHD use responses created at startup */
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG | MHD_USE_PEDANTIC_CHECKS,
+                        1103,
+                        NULL, NULL,
+                        &ahc_shared, NULL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  do_raw_request (1103, "GET / HTTP/1.1\r\n\r\n", reply, sizeof (reply));
+  do_raw_request (1103, "GET / HTTP/1.1\r\n\r\n", reply, sizeof (reply));
+  if ( (0 != strncmp (reply, "HTTP/1.1 400 Bad Request\r\n", strlen ("HTTP/1.1 400 Bad Request\r\n"))) ||
+       (NULL == strstr (reply, "\r\nConnection: close\r\n")) ||
+       (NULL == strstr (reply, "\r\nContent-Length: ")) )
+    errorCount |= 32;
+  MHD_stop_daemon (d);
+  /* enough headers to need several blocks of header memory */
+  for (i = 0; i < 64; i++)
+    {
+      snprintf (name, sizeof (name), "X-Many-%u", i);
+      memset (value, 'a' + i % 26, sizeof (value) - 1);
+      value[sizeof (value) - 1] = '\0';
+      if (MHD_YES != MHD_add_response_header (shared, name, value))
+        errorCount |= 64;
+    }
+  /* value of the last one */
+  if (MHD_YES != MHD_del_response_header (shared, "X-Many-63", value))
+    errorCount |= 128;
+  if ( (NULL != MHD_get_response_header (shared, "X-Many-63")) ||
+       (NULL == MHD_get_response_header (shared, "X-Many-0")) ||
+       ('a' != MHD_get_response_header (shared, "X-Many-0")[0]) ||
+       (NULL == MHD_get_response_header (shared, "X-Test")) )
+    errorCount |= 128;
+  MHD_destroy_response (shared);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,269 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_header_index.c
+ * @brief  Testcase for the lookup of request values through the
+ *         header index, including values added by the application
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1213
+
+/**
+ * Number of values added by the application, enough to fill the
+ * index beyond its load limit.
+ */
+#define ADDED 64
+
+/**
+ * Error bits set by the access handler.
+ */
+static unsigned int handler_errors;
+
+/**
+ * Names of the values added by the application; these must stay
+ * valid until the connection is closed.
+ */
+static char added_names[ADDED][16];
+
+
+/**
+ * Check that looking up @a key of @a kind yields @a expected.
+ *
+ * @param connection connection to look up in
+ * @param kind kind of value to look for
+ * @param key name to look for
+ * @param expected expected value, NULL for none
+ * @return 0 on success, 1 on mismatch
+ */
+static unsigned int
+check_value (struct MHD_Connection *connection,
+             enum MHD_ValueKind kind,
+             const char *key,
+             const char *expected)
+{
+  const char *value;
+
+  value = MHD_lookup_connection_value (connection, kind, key);
+  if (NULL == expected)
+    return (NULL == value) ? 0 : 1;
+  if ( (NULL == value) ||
+       (0 != strcmp (value, expected)) )
+    {
+      fprintf (stderr,
+               "Lookup of `%s' gave `%s', expected `%s'\n",
+               key,
+               (NULL == value) ? "(null)" : value,
+               expected);
+      return 1;
+    }
+  return 0;
+}
+
+
+static int
+ahc_lookup (void *cls,
+            struct MHD_Connection *connection,
+            const char *url,
+            const char *method,
+            const char *version,
+            const char *upload_data,
+            size_t *upload_data_size,
+            void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  unsigned int i;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  /* the first lookup builds the index; duplicates in list order,
+     names differing only in case are the same */
+  if ( (0 != check_value (connection, MHD_HEADER_KIND, "X-Dup", "first")) ||
+       (0 != check_value (connection, MHD_HEADER_KIND, "x-dup", "first")) ||
+       (0 != check_value (connection, MHD_HEADER_KIND, "X-CASE", "upper")) ||
+       (0 != check_value (connection, MHD_HEADER_KIND, "X-None", NULL)) )
+    handler_errors |= 1;
+  /* the same name in different kinds */
+  if ( (0 != check_value (connection, MHD_GET_ARGUMENT_KIND, "x-dup", "arg")) ||
+       (0 != check_value (connection, MHD_COOKIE_KIND, "X-Dup", "cookie")) ||
+       (0 != check_value (connection, MHD_FOOTER_KIND, "X-Dup", NULL)) ||
+       (0 != check_value (connection, MHD_GET_ARGUMENT_KIND, "X-Case", NULL)) )
+    handler_errors |= 2;
+  /* values added once the index exists, beyond its load limit */
+  for (i = 0; i < ADDED; i++)
+    {
+      snprintf (added_names[i],
+                sizeof (added_names[i]),
+                "X-Added-%u",
+                i);
+      if (MHD_YES != MHD_set_connection_value (connection,
+                                               MHD_HEADER_KIND,
+                                               added_names[i],
+                                               added_names[i]))
+        handler_errors |= 4;
+    }
+  if ( (MHD_YES != MHD_set_connection_value (connection,
+                                             MHD_HEADER_KIND,
+                                             "X-Dup",
+                                             "added")) ||
+       (MHD_YES != MHD_set_connection_value (connection,
+                                             MHD_FOOTER_KIND,
+                                             "X-Dup",
+                                             "footer")) ||
+       (MHD_YES != MHD_set_connection_value (connection,
+                                             MHD_HEADER_KIND,
+                                             "X-Late",
+                                             "one")) ||
+       (MHD_YES != MHD_set_connection_value (connection,
+                                             MHD_HEADER_KIND,
+                                             "x-late",
+                                             "two")) )
+    handler_errors |= 4;
+  for (i = 0; i < ADDED; i++)
+    if (0 != check_value (connection,
+                          MHD_HEADER_KIND,
+                          added_names[i],
+                          added_names[i]))
+      handler_errors |= 8;
+  if ( (0 != check_value (connection, MHD_HEADER_KIND, "X-Dup", "first")) ||
+       (0 != check_value (connection, MHD_FOOTER_KIND, "x-dup", "footer")) ||
+       (0 != check_value (connection, MHD_HEADER_KIND, "X-LATE", "one")) ||
+       (0 != check_value (connection, MHD_HEADER_KIND, "Host", "localhost")) )
+    handler_errors |= 16;
+  if (ADDED + 14 != MHD_get_connection_values (connection,
+                                               MHD_HEADER_KIND,
+                                               NULL,
+                                               NULL))
+    handler_errors |= 32;
+  response = MHD_create_response_from_buffer (strlen ("ok"),
+                                              "ok",
+                                              MHD_RESPMEM_PERSISTENT);
+  if (NULL == response)
+    return MHD_NO;
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Send a request with many values to the daemon and wait for the
+ * reply.
+ *
+ * @return 0 on success
+ */
+static unsigned int
+do_request (void)
+{
+  static const char req[] =
+    "GET /?x-dup=arg HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "X-Dup: first\r\n"
+    "X-Case: upper\r\n"
+    "x-dup: second\r\n"
+    "x-case: lower\r\n"
+    "X-One: 1\r\n"
+    "X-Two: 2\r\n"
+    "X-Three: 3\r\n"
+    "X-DUP: third\r\n"
+    "Cookie: X-Dup=cookie\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+  char reply[1024];
+  MHD_socket sock;
+  size_t have;
+  ssize_t got;
+
+  sock = connect_to (PORT);
+  if (strlen (req) != (size_t) write (sock, req, strlen (req)))
+    abort ();
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          (0 < (got = read (sock, &reply[have], sizeof (reply) - 1 - have))) )
+    have += got;
+  reply[have] = '\0';
+  MHD_socket_close_ (sock);
+  if (0 != strncmp (reply, "HTTP/1.1 200 OK\r\n", strlen ("HTTP/1.1 200 OK\r\n")))
+    return 1;
+  return 0;
+}
+
+
+/**
+ * Run the lookups against a daemon.
+ *
+ * @param lazy value for #MHD_OPTION_LAZY_VALUE_PARSING
+ * @return 0 on success
+ */
+static unsigned int
+test_lookup (unsigned int lazy)
+{
+  struct MHD_Daemon *d;
+  unsigned int ret;
+
+  handler_errors = 0;
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_lookup, NULL,
+                        MHD_OPTION_LAZY_VALUE_PARSING, lazy,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 256;
+  ret = do_request ();
+  MHD_stop_daemon (d);
+  return ret | (handler_errors << 1);
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  unsigned int errorCount = 0;
+
+  errorCount |= test_lookup (MHD_NO);
+  errorCount |= test_lookup (MHD_YES);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
+
+/* end of test_header_index.c */
@@ -0,0 +1,234 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_header_overflow.c
+ * @brief  Testcase for #MHD_OPTION_HEADER_OVERFLOW_ARENA: requests
+ *         with headers larger than the memory pool are served from
+ *         the arena, which gets its memory back afterwards
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1203
+
+/**
+ * Memory limit of the connections.
+ */
+#define POOL_SIZE 8192
+
+/**
+ * Size of the arena.
+ */
+#define ARENA_SIZE (128 * 1024)
+
+/**
+ * Size of the large header value.
+ */
+#define LARGE 20000
+
+/**
+ * Number of large requests, more than the arena could hold at once.
+ */
+#define REQUESTS 6
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  struct MHD_Response *response;
+  const char *value;
+  char len[32];
+  int ret;
+
+  /* answer with the length of the header, to check it is intact */
+  value = MHD_lookup_connection_value (connection,
+                                       MHD_HEADER_KIND,
+                                       "X-Large");
+  snprintf (len,
+            sizeof (len),
+            "%u",
+            (NULL == value) ? 0 : (unsigned int) strlen (value));
+  response = MHD_create_response_from_buffer (strlen (len),
+                                              len,
+                                              MHD_RESPMEM_MUST_COPY);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Send a request with an "X-Large" header of @a size bytes on
+ * @a sock, optionally followed by a pipelined small request.
+ *
+ * @param sock the socket
+ * @param size size of the header value
+ * @param pipelined non-zero to append a small request
+ */
+static void
+send_request (MHD_socket sock,
+              size_t size,
+              int pipelined)
+{
+  static const char small[] =
+    "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  char *req;
+  size_t off;
+  ssize_t sent;
+
+  req = malloc (size + 128);
+  if (NULL == req)
+    abort ();
+  off = sprintf (req,
+                 "GET / HTTP/1.1\r\nHost: localhost\r\nX-Large: ");
+  memset (&req[off], 'a', size);
+  off += size;
+  off += sprintf (&req[off],
+                  "\r\n\r\n%s",
+                  pipelined ? small : "");
+  while (off > 0)
+    {
+      sent = send (sock, req, off, 0);
+      if (sent <= 0)
+        break; /* the server closed after a 413 */
+      memmove (req, &req[sent], off - sent);
+      off -= sent;
+    }
+  free (req);
+}
+
+
+/**
+ * Receive one response.
+ *
+ * @param sock socket to read from
+ * @return the status code, with the body length as 1000 times the
+ *         status plus the echoed length if 200; 0 on error
+ */
+static unsigned long
+get_response (MHD_socket sock)
+{
+  char buf[1024];
+  size_t off;
+  const char *body;
+  const char *cl;
+
+  off = 0;
+  while (off < sizeof (buf) - 1)
+    {
+      /* read byte by byte, a pipelined response may follow */
+      if (1 != recv (sock, &buf[off], 1, 0))
+        return 0;
+      off++;
+      buf[off] = '\0';
+      if ( (NULL == (body = strstr (buf, "\r\n\r\n"))) ||
+           (NULL == (cl = strstr (buf, "Content-Length: "))) ||
+           (strlen (body + 4) <
+            (size_t) atol (cl + strlen ("Content-Length: "))) )
+        continue;
+      if (0 != strncmp (buf, "HTTP/1.1 200", strlen ("HTTP/1.1 200")))
+        return atol (buf + strlen ("HTTP/1.1 "));
+      return 200000000UL + atol (body + 4);
+    }
+  return 0;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  struct MHD_Daemon *d;
+  const union MHD_DaemonInfo *info;
+  MHD_socket sock;
+  unsigned int i;
+  unsigned long r;
+  int errorCount;
+
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_CONNECTION_MEMORY_LIMIT, (size_t) POOL_SIZE,
+                        MHD_OPTION_HEADER_OVERFLOW_ARENA, (size_t) ARENA_SIZE,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  errorCount = 0;
+  /* the arena gets its memory back after each request */
+  sock = connect_to_timeout (PORT, 5);
+  for (i = 0; i < REQUESTS; i++)
+    {
+      send_request (sock, LARGE, 0);
+      if (200000000UL + LARGE != (r = get_response (sock)))
+        {
+          fprintf (stderr,
+                   "Large request %u failed: %lu\n",
+                   i,
+                   r);
+          errorCount |= 2;
+          break;
+        }
+    }
+  /* a request pipelined behind a large one is kept */
+  send_request (sock, LARGE, 1);
+  if ( (200000000UL + LARGE != get_response (sock)) ||
+       (200000000UL != get_response (sock)) )
+    errorCount |= 4;
+  MHD_socket_close_ (sock);
+  /* headers larger than the arena are still refused */
+  sock = connect_to_timeout (PORT, 5);
+  send_request (sock, 2 * ARENA_SIZE, 0);
+  if (413 != get_response (sock))
+    errorCount |= 8;
+  MHD_socket_close_ (sock);
+  info = MHD_get_daemon_info (d,
+                              MHD_DAEMON_INFO_STATS);
+  if ( (NULL == info) ||
+       (REQUESTS + 2 != info->stats.header_overflows) )
+    errorCount |= 16;
+  MHD_stop_daemon (d);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %d)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
+
+/* end of test_header_overflow.c */
@@ -0,0 +1,61 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_helpers.h
+ * @brief  helpers shared by the unit tests
+ * @author Christian Grothoff
+ */
+
+#ifndef TEST_HELPERS_H
+#define TEST_HELPERS_H
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+
+
+/**
+ * Open a TCP connection to @a port on the loopback address.
+ * Aborts the test on failure.
+ *
+ * @param port port to connect to
+ * @return the connected socket
+ */
+MHD_socket
+connect_to (uint16_t port);
+
+
+/**
+ * Open a TCP connection to @a port on the loopback address whose
+ * reads fail after @a seconds without data, so that a test does not
+ * hang if MHD misbehaves.  Aborts the test on failure.
+ *
+ * @param port port to connect to
+ * @param seconds receive timeout
+ * @return the connected socket
+ */
+MHD_socket
+connect_to_timeout (uint16_t port,
+                    unsigned int seconds);
+
+#endif
+
+/* end of test_helpers.h */
@@ -0,0 +1,512 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_http2.c
+ * @brief  Testcase for #MHD_USE_HTTP2 with "prior knowledge" (h2c):
+ *         a GET and a POST multiplexed on one connection, and an
+ *         HTTP/1.1 request to the same daemon
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+/**
+ * Size of the upload of the POST request; larger than the initial
+ * flow control window of a stream.
+ */
+#define UPLOAD_SIZE 100000
+
+/**
+ * Size of a DATA frame of the upload.
+ */
+#define CHUNK_SIZE 16384
+
+
+/**
+ * Reply with the version, the URL and the number of bytes uploaded.
+ */
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  size_t *total = *con_cls;
+  struct MHD_Response *response;
+  char reply[256];
+  int ret;
+
+  if (NULL == total)
+    {
+      total = calloc (1, sizeof (size_t));
+      if (NULL == total)
+        return MHD_NO;
+      *con_cls = total;
+      return MHD_YES;
+    }
+  if (0 != *upload_data_size)
+    {
+      *total += *upload_data_size;
+      *upload_data_size = 0;
+      return MHD_YES;
+    }
+  snprintf (reply,
+            sizeof (reply),
+            "%s %s %s %u",
+            version,
+            method,
+            url,
+            (unsigned int) *total);
+  response = MHD_create_response_from_buffer (strlen (reply),
+                                              reply,
+                                              MHD_RESPMEM_MUST_COPY);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+static void
+completed_cb (void *cls,
+              struct MHD_Connection *connection,
+              void **con_cls,
+              enum MHD_RequestTerminationCode toe)
+{
+  unsigned int *completed = cls;
+
+  if (MHD_REQUEST_TERMINATED_COMPLETED_OK == toe)
+    (*completed)++;
+  free (*con_cls);
+  *con_cls = NULL;
+}
+
+
+/**
+ * Append a frame to @a buf.
+ *
+ * @return new length of @a buf
+ */
+static size_t
+add_frame (unsigned char *buf,
+           size_t off,
+           unsigned char type,
+           unsigned char flags,
+           unsigned int stream_id,
+           const void *payload,
+           size_t len)
+{
+  buf[off++] = (unsigned char) (len >> 16);
+  buf[off++] = (unsigned char) (len >> 8);
+  buf[off++] = (unsigned char) len;
+  buf[off++] = type;
+  buf[off++] = flags;
+  buf[off++] = (unsigned char) (stream_id >> 24);
+  buf[off++] = (unsigned char) (stream_id >> 16);
+  buf[off++] = (unsigned char) (stream_id >> 8);
+  buf[off++] = (unsigned char) stream_id;
+  if (0 != len)
+    memcpy (&buf[off], payload, len);
+  return off + len;
+}
+
+
+static int
+write_all (MHD_socket sock,
+           const unsigned char *buf,
+           size_t len)
+{
+  ssize_t ret;
+
+  while (0 != len)
+    {
+      ret = write (sock, buf, len);
+      if (ret <= 0)
+        return 1;
+      buf += ret;
+      len -= ret;
+    }
+  return 0;
+}
+
+
+/**
+ * Send as much of the upload of stream 3 as its flow control window
+ * allows.
+ *
+ * @param sock socket to write to
+ * @param[in,out] sent bytes of the upload sent so far
+ * @param[in,out] window flow control window of the stream
+ * @return 0 on success
+ */
+static int
+send_upload (MHD_socket sock,
+             size_t *sent,
+             size_t *window)
+{
+  unsigned char chunk[CHUNK_SIZE];
+  unsigned char frame[CHUNK_SIZE + 9];
+  size_t n;
+  size_t off;
+
+  memset (chunk, 'u', sizeof (chunk));
+  while (*sent < UPLOAD_SIZE)
+    {
+      n = UPLOAD_SIZE - *sent;
+      if (n > CHUNK_SIZE)
+        n = CHUNK_SIZE;
+      if (n > *window)
+        break;
+      off = add_frame (frame, 0, 0x0 /* DATA */,
+                       (*sent + n == UPLOAD_SIZE) ? 0x1 : 0x0,
+                       3, chunk, n);
+      if (0 != write_all (sock, frame, off))
+        return 1;
+      *sent += n;
+      *window -= n;
+    }
+  return 0;
+}
+
+
+/**
+ * Open stream 1 with a GET of "/get" and stream 3 with a POST of
+ * #UPLOAD_SIZE bytes to "/post", and check both responses.
+ *
+ * @param flags daemon flags to use
+ * @param port port to use
+ * @return 0 on success
+ */
+static int
+test_h2c (unsigned int flags,
+          uint16_t port)
+{
+  /* :method GET, :scheme http, :path /get, :authority localhost */
+  static const unsigned char get_block[] = {
+    0x82, 0x86, 0x44, 4, '/', 'g', 'e', 't',
+    0x41, 9, 'l', 'o', 'c', 'a', 'l', 'h', 'o', 's', 't' };
+  /* :method POST, :scheme http, :path /post, :authority localhost
+     (from the dynamic table) */
+  static const unsigned char post_block[] = {
+    0x83, 0x86, 0x44, 5, '/', 'p', 'o', 's', 't', 0xbe };
+  static const char *const expect[] = {
+    "HTTP/2 GET /get 0",
+    "HTTP/2 POST /post 100000"
+  };
+  struct MHD_Daemon *d;
+  MHD_socket sock;
+  unsigned char out[256];
+  unsigned char in[65536];
+  char body[2][64];
+  size_t body_len[2];
+  int status_ok[2];
+  size_t off;
+  size_t have;
+  size_t pos;
+  size_t len;
+  size_t sent;
+  size_t window;
+  ssize_t got;
+  unsigned int id;
+  unsigned int i;
+  unsigned int done;
+  unsigned int completed;
+  int ret;
+
+  completed = 0;
+  d = MHD_start_daemon (flags | MHD_USE_HTTP2 | MHD_USE_DEBUG,
+                        port,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_NOTIFY_COMPLETED, &completed_cb, &completed,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  memcpy (out, "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n", 24);
+  off = add_frame (out, 24, 0x4 /* SETTINGS */, 0, 0, NULL, 0);
+  off = add_frame (out, off, 0x1 /* HEADERS */, 0x5, 1,
+                   get_block, sizeof (get_block));
+  off = add_frame (out, off, 0x1 /* HEADERS */, 0x4, 3,
+                   post_block, sizeof (post_block));
+  sock = connect_to (port);
+  if (0 != write_all (sock, out, off))
+    ret |= 2;
+  sent = 0;
+  window = 65535;
+  have = 0;
+  done = 0;
+  memset (status_ok, 0, sizeof (status_ok));
+  memset (body_len, 0, sizeof (body_len));
+  while (2 != done)
+    {
+      /* the connection window is raised by the server right away */
+      if (0 != send_upload (sock, &sent, &window))
+        ret |= 2;
+      got = read (sock, &in[have], sizeof (in) - have);
+      if (got <= 0)
+        {
+          ret |= 4;
+          break;
+        }
+      have += got;
+      pos = 0;
+      while (have - pos >= 9)
+        {
+          len = ((size_t) in[pos] << 16) | ((size_t) in[pos + 1] << 8) | in[pos + 2];
+          if (have - pos - 9 < len)
+            break;
+          id = ((unsigned int) (in[pos + 5] & 0x7f) << 24)
+            | ((unsigned int) in[pos + 6] << 16)
+            | ((unsigned int) in[pos + 7] << 8)
+            | in[pos + 8];
+          i = id / 2;
+          if ( (0x1 == in[pos + 3]) && /* HEADERS */
+               ( (1 == id) || (3 == id) ) &&
+               (0 != len) &&
+               (0x88 == in[pos + 9]) ) /* :status 200 */
+            status_ok[i] = 1;
+          if ( (0x0 == in[pos + 3]) && /* DATA */
+               ( (1 == id) || (3 == id) ) )
+            {
+              if (body_len[i] + len < sizeof (body[0]))
+                {
+                  memcpy (&body[i][body_len[i]], &in[pos + 9], len);
+                  body_len[i] += len;
+                }
+              if (0 != (in[pos + 4] & 0x1)) /* END_STREAM */
+                done++;
+            }
+          if ( (0x8 == in[pos + 3]) && /* WINDOW_UPDATE */
+               (3 == id) &&
+               (4 == len) )
+            window += ((size_t) (in[pos + 9] & 0x7f) << 24)
+              | ((size_t) in[pos + 10] << 16)
+              | ((size_t) in[pos + 11] << 8)
+              | in[pos + 12];
+          pos += 9 + len;
+        }
+      memmove (in, &in[pos], have - pos);
+      have -= pos;
+    }
+  MHD_socket_close_ (sock);
+  MHD_stop_daemon (d);
+  for (i = 0; i < 2; i++)
+    {
+      if (! status_ok[i])
+        ret |= 8;
+      if ( (strlen (expect[i]) != body_len[i]) ||
+           (0 != memcmp (body[i], expect[i], body_len[i])) )
+        ret |= 16;
+    }
+  if (2 != completed)
+    ret |= 32;
+  return ret;
+}
+
+
+/**
+ * Access handler for requests that must not reach the application.
+ *
+ * @param cls pointer to an int set to 1
+ */
+static int
+ahc_never (void *cls,
+           struct MHD_Connection *connection,
+           const char *url,
+           const char *method,
+           const char *version,
+           const char *upload_data,
+           size_t *upload_data_size,
+           void **con_cls)
+{
+  int *called = cls;
+
+  *called = 1;
+  return MHD_NO;
+}
+
+
+/**
+ * Send a header block with an integer followed by a long run of
+ * continuation bytes and check that the server closes the
+ * connection with a COMPRESSION_ERROR, without calling the access
+ * handler.
+ *
+ * @param flags daemon flags to use
+ * @param port port to use
+ * @return 0 on success
+ */
+static int
+test_long_int (unsigned int flags,
+               uint16_t port)
+{
+  struct MHD_Daemon *d;
+  MHD_socket sock;
+  unsigned char block[64];
+  unsigned char out[256];
+  unsigned char in[4096];
+  size_t off;
+  size_t have;
+  size_t pos;
+  size_t len;
+  ssize_t got;
+  int goaway;
+  int called;
+  int ret;
+
+  called = 0;
+  d = MHD_start_daemon (flags | MHD_USE_HTTP2 | MHD_USE_DEBUG,
+                        port,
+                        NULL, NULL,
+                        &ahc_never, &called,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  /* indexed header field with all prefix bits set, then only
+     continuation bytes */
+  block[0] = 0xff;
+  memset (&block[1], 0x80, sizeof (block) - 2);
+  block[sizeof (block) - 1] = 0x01;
+  memcpy (out, "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n", 24);
+  off = add_frame (out, 24, 0x4 /* SETTINGS */, 0, 0, NULL, 0);
+  off = add_frame (out, off, 0x1 /* HEADERS */, 0x5, 1,
+                   block, sizeof (block));
+  sock = connect_to (port);
+  if (0 != write_all (sock, out, off))
+    ret |= 2;
+  have = 0;
+  goaway = 0;
+  while ( (! goaway) &&
+          (have < sizeof (in)) &&
+          (0 < (got = read (sock, &in[have], sizeof (in) - have))) )
+    {
+      have += got;
+      pos = 0;
+      while (have - pos >= 9)
+        {
+          len = ((size_t) in[pos] << 16) | ((size_t) in[pos + 1] << 8) | in[pos + 2];
+          if (have - pos - 9 < len)
+            break;
+          if ( (0x7 == in[pos + 3]) && /* GOAWAY */
+               (8 <= len) &&
+               (0x9 == in[pos + 9 + 7]) ) /* COMPRESSION_ERROR */
+            goaway = 1;
+          pos += 9 + len;
+        }
+      memmove (in, &in[pos], have - pos);
+      have -= pos;
+    }
+  MHD_socket_close_ (sock);
+  MHD_stop_daemon (d);
+  if (! goaway)
+    ret |= 4;
+  if (called)
+    ret |= 8;
+  return ret;
+}
+
+
+/**
+ * Check that a daemon with #MHD_USE_HTTP2 still serves HTTP/1.1.
+ *
+ * @param flags daemon flags to use
+ * @param port port to use
+ * @return 0 on success
+ */
+static int
+test_http1 (unsigned int flags,
+            uint16_t port)
+{
+  static const char req[] =
+    "GET /old HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+  struct MHD_Daemon *d;
+  MHD_socket sock;
+  char reply[1024];
+  size_t have;
+  ssize_t got;
+  unsigned int completed;
+  int ret;
+
+  completed = 0;
+  d = MHD_start_daemon (flags | MHD_USE_HTTP2 | MHD_USE_DEBUG,
+                        port,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_NOTIFY_COMPLETED, &completed_cb, &completed,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  sock = connect_to (port);
+  if (0 != write_all (sock, (const unsigned char *) req, strlen (req)))
+    ret |= 2;
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          (0 < (got = read (sock, &reply[have], sizeof (reply) - 1 - have))) )
+    have += got;
+  reply[have] = '\0';
+  MHD_socket_close_ (sock);
+  MHD_stop_daemon (d);
+  if ( (0 != strncmp (reply, "HTTP/1.1 200", strlen ("HTTP/1.1 200"))) ||
+       (NULL == strstr (reply, "\r\n\r\nHTTP/1.1 GET /old 0")) )
+    ret |= 4;
+  if (1 != completed)
+    ret |= 8;
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += test_h2c (MHD_USE_SELECT_INTERNALLY, 1180);
+  errorCount += test_h2c (MHD_USE_THREAD_PER_CONNECTION, 1180);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_POLL))
+    errorCount += test_h2c (MHD_USE_SELECT_INTERNALLY | MHD_USE_POLL, 1180);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_EPOLL))
+    errorCount += test_h2c (MHD_USE_SELECT_INTERNALLY | MHD_USE_EPOLL_LINUX_ONLY,
+                            1180);
+  errorCount += test_long_int (MHD_USE_SELECT_INTERNALLY, 1180);
+  errorCount += test_http1 (MHD_USE_SELECT_INTERNALLY, 1180);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,135 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_http_unescape.c
+ * @brief  Testcase for #MHD_http_unescape()
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+
+/**
+ * Input and expected output of #MHD_http_unescape().
+ */
+struct TestVector
+{
+  const char *in;
+  const char *out;
+  size_t out_len;
+};
+
+
+static const struct TestVector vectors[] = {
+  { "", "", 0 },
+  { "plain text", "plain text", 10 },
+  { "a%20b", "a b", 3 },
+  { "%41%42%43", "ABC", 3 },
+  { "%4a%4A", "JJ", 2 },
+  { "a+b", "a+b", 3 },
+  { "%2B", "+", 1 },
+  { "100%", "100", 3 },
+  { "100%4", "100", 3 },
+  { "%zz%", "%zz", 3 },
+  { "%%41", "%A", 2 },
+  { "% 41", "% 41", 4 },
+  { "x%00y", "x\0y", 3 },
+  { "%e2%82%ac euro", "\xe2\x82\xac euro", 8 },
+  { NULL, NULL, 0 }
+};
+
+
+static int
+test_vectors ()
+{
+  char buf[64];
+  size_t len;
+  unsigned int i;
+  int ret;
+
+  ret = 0;
+  for (i = 0; NULL != vectors[i].in; i++)
+    {
+      strcpy (buf, vectors[i].in);
+      len = MHD_http_unescape (buf);
+      if ( (len != vectors[i].out_len) ||
+           (0 != memcmp (buf, vectors[i].out, len)) ||
+           ('\0' != buf[len]) )
+        {
+          fprintf (stderr,
+                   "Unescaping `%s' failed\n",
+                   vectors[i].in);
+          ret = 1;
+        }
+    }
+  return ret;
+}
+
+
+/**
+ * Long input with escapes at the start, in the middle and at the
+ * end, so that long runs without escapes are moved.
+ */
+static int
+test_long ()
+{
+  char buf[4096 + 10];
+  size_t len;
+  unsigned int i;
+
+  buf[0] = '%';
+  buf[1] = '4';
+  buf[2] = '1';
+  for (i = 3; i < 4096; i++)
+    buf[i] = 'a' + (i % 26);
+  memcpy (&buf[2000], "%42", 3);
+  strcpy (&buf[4096], "%43");
+  len = MHD_http_unescape (buf);
+  if (4096 + 3 - 6 != len)
+    return 2;
+  if ( ('A' != buf[0]) ||
+       ('B' != buf[2000 - 2]) ||
+       ('C' != buf[len - 1]) ||
+       ('a' + (2003 % 26) != buf[2000 - 1]) ||
+       ('a' + (4095 % 26) != buf[len - 2]) )
+    return 4;
+  return 0;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += test_vectors ();
+  errorCount += test_long ();
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
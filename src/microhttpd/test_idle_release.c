@@ -0,0 +1,184 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_idle_release.c
+ * @brief  Testcase for keep-alive connections that release their
+ *         memory pool while idle (#MHD_OPTION_CONNECTION_IDLE_RELEASE_TIMEOUT)
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+
+/**
+ * Request sent (twice) on the keep-alive connection.
+ */
+#define REQUEST "GET /hello HTTP/1.1\r\nHost: localhost\r\n\r\n"
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int ptr;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&ptr != *con_cls)
+    {
+      *con_cls = &ptr;
+      return MHD_YES;
+    }
+  *con_cls = NULL;
+  response = MHD_create_response_from_buffer (strlen (url),
+                                              (void *) url,
+                                              MHD_RESPMEM_MUST_COPY);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Send #REQUEST on @a sock and check that the complete response
+ * (which ends with the URL as its body) arrives.
+ *
+ * @return 0 on success
+ */
+static int
+do_request (MHD_socket sock)
+{
+  char buf[1024];
+  size_t off;
+  ssize_t got;
+  fd_set rs;
+  struct timeval tv;
+
+  if (strlen (REQUEST) != (size_t) write (sock, REQUEST, strlen (REQUEST)))
+    return 1;
+  off = 0;
+  while ( (off < strlen ("/hello")) ||
+          (0 != memcmp (&buf[off - strlen ("/hello")],
+                        "/hello",
+                        strlen ("/hello"))) )
+    {
+      FD_ZERO (&rs);
+      FD_SET (sock, &rs);
+      tv.tv_sec = 5;
+      tv.tv_usec = 0;
+      if (1 != select (sock + 1, &rs, NULL, NULL, &tv))
+        return 2;
+      got = read (sock, &buf[off], sizeof (buf) - off);
+      if (got <= 0)
+        return 4;
+      off += got;
+      if (off == sizeof (buf))
+        return 8;
+    }
+  return 0;
+}
+
+
+static int
+test_idle_release (int flags,
+                   uint16_t port)
+{
+  struct MHD_Daemon *d;
+  MHD_socket sock;
+  struct sockaddr_in sa;
+  const union MHD_DaemonInfo *dinfo;
+  int ret;
+
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        port,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_CONNECTION_MEMORY_LIMIT, (size_t) (256 * 1024),
+                        MHD_OPTION_CONNECTION_IDLE_RELEASE_TIMEOUT, (unsigned int) 1,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sock)
+    abort ();
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (port);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (sock,
+                    (struct sockaddr *) &sa,
+                    sizeof (sa)))
+    abort ();
+  ret = 0;
+  if (0 != do_request (sock))
+    ret |= 2;
+  /* stay idle long enough for the pool to be released */
+  sleep (3);
+  if (0 != do_request (sock))
+    ret |= 4;
+  dinfo = MHD_get_daemon_info (d,
+                               MHD_DAEMON_INFO_CURRENT_CONNECTIONS);
+  if ( (NULL == dinfo) ||
+       (1 != dinfo->num_connections) )
+    ret |= 8;
+  MHD_socket_close_ (sock);
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += test_idle_release (MHD_USE_SELECT_INTERNALLY,
+                                   1088);
+#ifdef HAVE_POLL
+  errorCount += test_idle_release (MHD_USE_POLL_INTERNALLY,
+                                   1089);
+#endif
+#if EPOLL_SUPPORT
+  errorCount += test_idle_release (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY,
+                                   1093);
+#endif
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
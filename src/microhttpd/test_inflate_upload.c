@@ -0,0 +1,386 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_inflate_upload.c
+ * @brief  Testcase for decompressing request bodies with
+ *         #MHD_OPTION_INFLATE_REQUEST_BODY
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <signal.h>
+#include <zlib.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1212
+
+/**
+ * Size of the decompressed body of the uploads.
+ */
+#define BODY_SIZE 200000
+
+/**
+ * Size of the zeros of the upload that decompresses too much.
+ */
+#define BOMB_SIZE (8 * 1024 * 1024)
+
+/**
+ * Maximum ratio of decompressed to received bytes.
+ */
+#define RATIO 100
+
+
+/**
+ * Byte @a pos of the decompressed body: lines of scrambled letters,
+ * which compress to less than #RATIO.
+ */
+static char
+body_byte (size_t pos)
+{
+  return (0 == pos % 64) ? '\n' : 'a' + ((pos * 2654435761u) >> 13) % 26;
+}
+
+
+/**
+ * State of an upload in the access handler.
+ */
+struct Upload
+{
+  /**
+   * Number of bytes received.
+   */
+  size_t len;
+
+  /**
+   * Non-zero if a byte differed from the expected body.
+   */
+  int bad;
+};
+
+
+static int
+ahc_upload (void *cls,
+            struct MHD_Connection *connection,
+            const char *url,
+            const char *method,
+            const char *version,
+            const char *upload_data,
+            size_t *upload_data_size,
+            void **con_cls)
+{
+  struct Upload *up = *con_cls;
+  struct MHD_Response *response;
+  size_t n;
+  size_t i;
+  int ret;
+
+  if (NULL == up)
+    {
+      up = calloc (1, sizeof (struct Upload));
+      if (NULL == up)
+        return MHD_NO;
+      *con_cls = up;
+      return MHD_YES;
+    }
+  if (0 != *upload_data_size)
+    {
+      n = *upload_data_size;
+      /* "/records" only processes whole records of 100 bytes and
+         leaves the rest for the next call */
+      if (0 == strcmp (url, "/records"))
+        n -= n % 100;
+      for (i = 0; i < n; i++)
+        if ( (up->len + i >= BODY_SIZE) ||
+             (upload_data[i] != body_byte (up->len + i)) )
+          up->bad = 1;
+      up->len += n;
+      *upload_data_size -= n;
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_buffer (0,
+                                              NULL,
+                                              MHD_RESPMEM_PERSISTENT);
+  if (NULL == response)
+    return MHD_NO;
+  ret = MHD_queue_response (connection,
+                            ( (0 == up->bad) &&
+                              (BODY_SIZE == up->len) )
+                            ? MHD_HTTP_OK
+                            : MHD_HTTP_NOT_ACCEPTABLE,
+                            response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+static void
+request_completed (void *cls,
+                   struct MHD_Connection *connection,
+                   void **con_cls,
+                   enum MHD_RequestTerminationCode toe)
+{
+  free (*con_cls);
+  *con_cls = NULL;
+}
+
+
+/**
+ * Compress @a size bytes of the body (or zeros).
+ *
+ * @param gzip non-zero for the "gzip" format, 0 for "deflate"
+ * @param zeros non-zero to compress zeros instead of the body
+ * @param size number of bytes to compress
+ * @param[out] out_len set to the size of the result
+ * @return the compressed data
+ */
+static char *
+compress_body (int gzip,
+               int zeros,
+               size_t size,
+               size_t *out_len)
+{
+  char *in;
+  char *out;
+  size_t i;
+  z_stream strm;
+
+  in = malloc (size);
+  out = malloc (size + 1024);
+  if ( (NULL == in) ||
+       (NULL == out) )
+    abort ();
+  for (i = 0; i < size; i++)
+    in[i] = zeros ? 0 : body_byte (i);
+  memset (&strm, 0, sizeof (strm));
+  /* window bits + 16 selects the gzip wrapper */
+  if (Z_OK != deflateInit2 (&strm,
+                            9,
+                            Z_DEFLATED,
+                            gzip ? 15 + 16 : 15,
+                            8,
+                            Z_DEFAULT_STRATEGY))
+    abort ();
+  strm.next_in = (Bytef *) in;
+  strm.avail_in = size;
+  strm.next_out = (Bytef *) out;
+  strm.avail_out = size + 1024;
+  if (Z_STREAM_END != deflate (&strm, Z_FINISH))
+    abort ();
+  *out_len = size + 1024 - strm.avail_out;
+  deflateEnd (&strm);
+  free (in);
+  return out;
+}
+
+
+/**
+ * Upload @a body to @a url and return the status code of the reply.
+ *
+ * @param url URL to upload to
+ * @param encoding value of the "Content-Encoding" header
+ * @param chunked non-zero to send the body chunked
+ * @param body body to send
+ * @param len number of bytes in @a body
+ * @return status code, 0 if there was no reply
+ */
+static unsigned int
+upload (const char *url,
+        const char *encoding,
+        int chunked,
+        const char *body,
+        size_t len)
+{
+  MHD_socket sock;
+  struct sockaddr_in sa;
+  char request[256];
+  char reply[1024];
+  size_t off;
+  size_t n;
+  size_t have;
+  ssize_t got;
+  unsigned int status;
+
+  if (chunked)
+    snprintf (request,
+              sizeof (request),
+              "POST %s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\nContent-Encoding: %s\r\nTransfer-Encoding: chunked\r\n\r\n",
+              url,
+              encoding);
+  else
+    snprintf (request,
+              sizeof (request),
+              "POST %s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\nContent-Encoding: %s\r\nContent-Length: %u\r\n\r\n",
+              url,
+              encoding,
+              (unsigned int) len);
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sock)
+    abort ();
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (sock,
+                    (struct sockaddr *) &sa,
+                    sizeof (sa)))
+    abort ();
+  if (strlen (request) !=
+      (size_t) write (sock, request, strlen (request)))
+    abort ();
+  /* the server may reply before it read all of the body */
+  for (off = 0; off < len; off += n)
+    {
+      n = len - off;
+      if (chunked)
+        {
+          char line[32];
+
+          /* odd chunk sizes split the compressed blocks */
+          if (n > 777)
+            n = 777;
+          snprintf (line, sizeof (line), "%x\r\n", (unsigned int) n);
+          if (strlen (line) != (size_t) write (sock, line, strlen (line)))
+            break;
+        }
+      got = write (sock, &body[off], n);
+      if (got <= 0)
+        break;
+      n = got;
+      if ( (chunked) &&
+           (2 != write (sock, "\r\n", 2)) )
+        break;
+    }
+  if ( (off == len) &&
+       (chunked) )
+    (void) write (sock, "0\r\n\r\n", 5);
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          (0 < (got = read (sock, &reply[have], sizeof (reply) - 1 - have))) )
+    have += got;
+  reply[have] = '\0';
+  MHD_socket_close_ (sock);
+  if (1 != sscanf (reply, "HTTP/1.1 %u ", &status))
+    return 0;
+  return status;
+}
+
+
+/**
+ * Upload @a body and check the status code of the reply.
+ *
+ * @return 0 on success
+ */
+static int
+check_upload (const char *url,
+              const char *encoding,
+              int chunked,
+              const char *body,
+              size_t len,
+              unsigned int expected)
+{
+  unsigned int status;
+
+  status = upload (url,
+                   encoding,
+                   chunked,
+                   body,
+                   len);
+  if (status == expected)
+    return 0;
+  fprintf (stderr,
+           "Upload to `%s' with `%s'%s: got %u, expected %u\n",
+           url,
+           encoding,
+           chunked ? " (chunked)" : "",
+           status,
+           expected);
+  return 1;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  struct MHD_Daemon *d;
+  char *gz;
+  char *df;
+  char *bomb;
+  size_t gz_len;
+  size_t df_len;
+  size_t bomb_len;
+  int errorCount = 0;
+
+  if (MHD_YES != MHD_is_feature_supported (MHD_FEATURE_COMPRESSION))
+    return 77;
+#ifdef SIGPIPE
+  signal (SIGPIPE, SIG_IGN);
+#endif
+  gz = compress_body (1, 0, BODY_SIZE, &gz_len);
+  df = compress_body (0, 0, BODY_SIZE, &df_len);
+  bomb = compress_body (1, 1, BOMB_SIZE, &bomb_len);
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_upload, NULL,
+                        MHD_OPTION_NOTIFY_COMPLETED, &request_completed, NULL,
+                        MHD_OPTION_INFLATE_REQUEST_BODY, (unsigned int) RATIO,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  errorCount += check_upload ("/", "gzip", 0, gz, gz_len, MHD_HTTP_OK);
+  errorCount += check_upload ("/", "deflate", 0, df, df_len, MHD_HTTP_OK);
+  errorCount += check_upload ("/", "x-gzip", 1, gz, gz_len, MHD_HTTP_OK);
+  /* decompressed bytes the handler leaves are passed again */
+  errorCount += check_upload ("/records", "gzip", 0, gz, gz_len, MHD_HTTP_OK);
+  errorCount += check_upload ("/records", "deflate", 1, df, df_len, MHD_HTTP_OK);
+  /* other codings are passed as received */
+  errorCount += check_upload ("/", "br", 0, gz, gz_len, MHD_HTTP_NOT_ACCEPTABLE);
+  /* a body that decompresses to too much */
+  errorCount += check_upload ("/", "gzip", 0, bomb, bomb_len,
+                              MHD_HTTP_REQUEST_ENTITY_TOO_LARGE);
+  /* truncated and corrupt bodies */
+  errorCount += check_upload ("/", "gzip", 0, gz, gz_len - 16,
+                              MHD_HTTP_BAD_REQUEST);
+  errorCount += check_upload ("/", "deflate", 0, gz, gz_len,
+                              MHD_HTTP_BAD_REQUEST);
+  /* decompressors are reused */
+  errorCount += check_upload ("/", "gzip", 1, gz, gz_len, MHD_HTTP_OK);
+  MHD_stop_daemon (d);
+  free (gz);
+  free (df);
+  free (bomb);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
+
+/* end of test_inflate_upload.c */
@@ -0,0 +1,298 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_interim.c
+ * @brief  Testcase for #MHD_queue_interim_response(): "103 Early
+ *         Hints" are sent before the final response, also while the
+ *         connection is suspended and together with "100 Continue"
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+/**
+ * The interim response the handler queues.
+ */
+#define EARLY_HINTS "HTTP/1.1 103 Early Hints\r\n" \
+  "Link: </style.css>; rel=preload; as=style\r\n\r\n"
+
+/**
+ * Body of the final response.
+ */
+#define BODY "final"
+
+
+/**
+ * Connection suspended by the handler, NULL if none.
+ */
+static struct MHD_Connection *volatile suspended;
+
+/**
+ * Set if an unexpected call of #MHD_queue_interim_response()
+ * succeeded or an expected one failed.
+ */
+static int api_errors;
+
+
+static int
+ahc_hints (void *cls,
+           struct MHD_Connection *connection,
+           const char *url,
+           const char *method,
+           const char *version,
+           const char *upload_data,
+           size_t *upload_data_size,
+           void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *hints;
+  struct MHD_Response *response;
+  int http_1_1;
+  int ret;
+
+  http_1_1 = (0 == strcmp (version, MHD_HTTP_VERSION_1_1));
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      if (0 == strcmp (url, "/suspend"))
+        {
+          /* before the hints, which the client waits for */
+          MHD_suspend_connection (connection);
+          suspended = connection;
+        }
+      hints = MHD_create_response_from_buffer (0, NULL,
+                                               MHD_RESPMEM_PERSISTENT);
+      MHD_add_response_header (hints,
+                               MHD_HTTP_HEADER_LINK,
+                               "</style.css>; rel=preload; as=style");
+      if (MHD_NO != MHD_queue_interim_response (connection,
+                                                MHD_HTTP_OK,
+                                                hints))
+        api_errors++;
+      if (http_1_1 != (MHD_YES == MHD_queue_interim_response (connection,
+                                                              MHD_HTTP_EARLY_HINTS,
+                                                              hints)))
+        api_errors++;
+      MHD_destroy_response (hints);
+      return MHD_YES;
+    }
+  if (0 != *upload_data_size)
+    {
+      *upload_data_size = 0;
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_buffer (strlen (BODY),
+                                              BODY,
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  /* too late now */
+  if (MHD_NO != MHD_queue_interim_response (connection,
+                                            MHD_HTTP_EARLY_HINTS,
+                                            response))
+    api_errors++;
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Read exactly @a len bytes from @a sock.
+ *
+ * @return 0 on success
+ */
+static int
+read_exactly (MHD_socket sock,
+              char *buf,
+              size_t len)
+{
+  size_t have;
+  ssize_t got;
+
+  have = 0;
+  while (have < len)
+    {
+      got = read (sock, &buf[have], len - have);
+      if (got <= 0)
+        return 1;
+      have += got;
+    }
+  buf[len] = '\0';
+  return 0;
+}
+
+
+/**
+ * Read from @a sock until the server closes the connection.
+ *
+ * @return 0 if the data ends with the final response
+ */
+static int
+read_final (MHD_socket sock)
+{
+  char buf[2048];
+  size_t have;
+  ssize_t got;
+
+  have = 0;
+  while ( (have < sizeof (buf) - 1) &&
+          (0 < (got = read (sock, &buf[have], sizeof (buf) - 1 - have))) )
+    have += got;
+  buf[have] = '\0';
+  if ( (0 != strncmp (buf, "HTTP/1.", strlen ("HTTP/1."))) ||
+       (0 != strncmp (&buf[strlen ("HTTP/1.x")], " 200 ", 5)) ||
+       (NULL != strstr (buf, "Early Hints")) ||
+       (have < strlen (BODY)) ||
+       (0 != strcmp (&buf[have - strlen (BODY)], BODY)) )
+    return 1;
+  return 0;
+}
+
+
+/**
+ * Send @a request and check that the response is preceded by
+ * @a interim.
+ *
+ * @param port port of the daemon
+ * @param request request to send, the connection is closed after it
+ * @param interim interim responses expected before the final one
+ * @param body request body to send after @a interim was read, or NULL
+ * @return 0 on success
+ */
+static int
+check_request (uint16_t port,
+               const char *request,
+               const char *interim,
+               const char *body)
+{
+  MHD_socket sock;
+  char buf[1024];
+  int ret;
+
+  ret = 0;
+  sock = connect_to (port);
+  if (strlen (request) != (size_t) write (sock,
+                                          request,
+                                          strlen (request)))
+    ret |= 1;
+  if ( (0 != read_exactly (sock,
+                           buf,
+                           strlen (interim))) ||
+       (0 != strcmp (buf, interim)) )
+    ret |= 2;
+  if (NULL != suspended)
+    {
+      /* the hints arrived while the handler keeps the connection */
+      MHD_resume_connection (suspended);
+      suspended = NULL;
+    }
+  if ( (NULL != body) &&
+       (strlen (body) != (size_t) write (sock,
+                                         body,
+                                         strlen (body))) )
+    ret |= 1;
+  if (0 != read_final (sock))
+    ret |= 4;
+  MHD_socket_close_ (sock);
+  return ret;
+}
+
+
+/**
+ * Check the interim responses with a daemon using @a flags.
+ *
+ * @param flags daemon flags to use
+ * @param port port to use
+ * @return 0 on success
+ */
+static int
+test_interim (unsigned int flags,
+              uint16_t port)
+{
+  struct MHD_Daemon *d;
+  int ret;
+
+  api_errors = 0;
+  suspended = NULL;
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG | MHD_USE_SUSPEND_RESUME,
+                        port,
+                        NULL, NULL,
+                        &ahc_hints, NULL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  ret |= check_request (port,
+                        "GET /plain HTTP/1.1\r\nHost: localhost\r\n"
+                        "Connection: close\r\n\r\n",
+                        EARLY_HINTS,
+                        NULL);
+  ret |= check_request (port,
+                        "GET /suspend HTTP/1.1\r\nHost: localhost\r\n"
+                        "Connection: close\r\n\r\n",
+                        EARLY_HINTS,
+                        NULL) << 4;
+  ret |= check_request (port,
+                        "POST /upload HTTP/1.1\r\nHost: localhost\r\n"
+                        "Connection: close\r\nContent-Length: 4\r\n"
+                        "Expect: 100-continue\r\n\r\n",
+                        EARLY_HINTS "HTTP/1.1 100 Continue\r\n\r\n",
+                        "data") << 8;
+  ret |= check_request (port,
+                        "GET /plain HTTP/1.0\r\n\r\n",
+                        "",
+                        NULL) << 12;
+  MHD_stop_daemon (d);
+  if (0 != api_errors)
+    ret |= 1 << 16;
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += test_interim (MHD_USE_SELECT_INTERNALLY, 1182);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_POLL))
+    errorCount += test_interim (MHD_USE_SELECT_INTERNALLY | MHD_USE_POLL,
+                                1182);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_EPOLL))
+    errorCount += test_interim (MHD_USE_SELECT_INTERNALLY |
+                                MHD_USE_EPOLL_LINUX_ONLY,
+                                1182);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
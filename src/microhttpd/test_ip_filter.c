@@ -0,0 +1,236 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_ip_filter.c
+ * @brief  Testcase for #MHD_set_ip_filter(): connection attempts
+ *         from filtered addresses never complete
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1208
+
+#define BODY "not filtered"
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  struct MHD_Response *response;
+  int ret;
+
+  response = MHD_create_response_from_buffer (strlen (BODY),
+                                              BODY,
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Try to connect to the daemon and fetch a page.
+ *
+ * @param wait_ms how long to wait for the connection to be established
+ * @return 0 if the page was served, 1 if the connection did not
+ *         complete in time, 2 on other errors
+ */
+static int
+try_request (int wait_ms)
+{
+  static const char req[] =
+    "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+  struct sockaddr_in sa;
+  struct pollfd pfd;
+  struct timeval tv;
+  char buf[1024];
+  MHD_socket sock;
+  socklen_t len;
+  ssize_t got;
+  size_t off;
+  int err;
+  int ret;
+
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sock)
+    abort ();
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  (void) fcntl (sock, F_SETFL, fcntl (sock, F_GETFL) | O_NONBLOCK);
+  ret = 2;
+  if ( (0 != connect (sock,
+                      (struct sockaddr *) &sa,
+                      sizeof (sa))) &&
+       (EINPROGRESS != errno) )
+    goto done;
+  pfd.fd = sock;
+  pfd.events = POLLOUT;
+  ret = 1;
+  if (1 != poll (&pfd, 1, wait_ms))
+    goto done;
+  ret = 2;
+  err = 0;
+  len = sizeof (err);
+  if ( (0 != getsockopt (sock, SOL_SOCKET, SO_ERROR, &err, &len)) ||
+       (0 != err) )
+    goto done;
+  (void) fcntl (sock, F_SETFL, fcntl (sock, F_GETFL) & ~O_NONBLOCK);
+  tv.tv_sec = 5;
+  tv.tv_usec = 0;
+  setsockopt (sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+  if (sizeof (req) - 1 != send (sock, req, sizeof (req) - 1, 0))
+    goto done;
+  off = 0;
+  while (off < sizeof (buf) - 1)
+    {
+      got = recv (sock, &buf[off], sizeof (buf) - 1 - off, 0);
+      if (got <= 0)
+        break;
+      off += got;
+    }
+  buf[off] = '\0';
+  if ( (0 == strncmp (buf, "HTTP/1.1 200", strlen ("HTTP/1.1 200"))) &&
+       (NULL != strstr (buf, BODY)) )
+    ret = 0;
+ done:
+  MHD_socket_close_ (sock);
+  return ret;
+}
+
+
+/**
+ * Install a single-rule filter on @a d.
+ *
+ * @return result of #MHD_set_ip_filter()
+ */
+static int
+set_filter (struct MHD_Daemon *d,
+            enum MHD_IpFilterPolicy policy,
+            const char *ip,
+            unsigned int prefix_len)
+{
+  struct sockaddr_in sa;
+  struct MHD_IpFilterRule rule;
+
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = inet_addr (ip);
+  rule.addr = (const struct sockaddr *) &sa;
+  rule.prefix_len = prefix_len;
+  return MHD_set_ip_filter (d, policy, &rule, 1);
+}
+
+
+static int
+test_daemon (unsigned int flags,
+             unsigned int threads)
+{
+  struct MHD_Daemon *d;
+  int ret;
+
+  d = MHD_start_daemon (flags,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_THREAD_POOL_SIZE, threads,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  if (0 != try_request (5000))
+    ret |= 2;
+  /* denied clients are dropped before accept() */
+  if (MHD_YES != set_filter (d, MHD_IP_FILTER_DENY_LISTED, "127.0.0.1", 32))
+    ret |= 4;
+  else if (1 != try_request (500))
+    ret |= 8;
+  /* other ranges are not affected */
+  if (MHD_YES != set_filter (d, MHD_IP_FILTER_DENY_LISTED, "10.0.0.0", 8))
+    ret |= 4;
+  else if (0 != try_request (5000))
+    ret |= 16;
+  /* only listed clients get through */
+  if (MHD_YES != set_filter (d, MHD_IP_FILTER_ALLOW_LISTED, "10.0.0.0", 8))
+    ret |= 4;
+  else if (1 != try_request (500))
+    ret |= 32;
+  if (MHD_YES != set_filter (d, MHD_IP_FILTER_ALLOW_LISTED, "127.0.0.0", 8))
+    ret |= 4;
+  else if (0 != try_request (5000))
+    ret |= 64;
+  /* an empty deny list removes the filter */
+  if (MHD_YES != set_filter (d, MHD_IP_FILTER_DENY_LISTED, "127.0.0.1", 32))
+    ret |= 4;
+  if (MHD_YES != MHD_set_ip_filter (d, MHD_IP_FILTER_DENY_LISTED, NULL, 0))
+    ret |= 4;
+  else if (0 != try_request (5000))
+    ret |= 128;
+  /* invalid rules leave the filter alone */
+  if (MHD_NO != set_filter (d, MHD_IP_FILTER_DENY_LISTED, "127.0.0.1", 33))
+    ret |= 256;
+  else if (0 != try_request (5000))
+    ret |= 512;
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount;
+
+  if (MHD_YES != MHD_is_feature_supported (MHD_FEATURE_IP_FILTER))
+    return 77;
+  errorCount = 0;
+  errorCount |= test_daemon (MHD_USE_SELECT_INTERNALLY, 0);
+  errorCount |= test_daemon (MHD_USE_SELECT_INTERNALLY, 2) << 10;
+  errorCount |= test_daemon (MHD_USE_THREAD_PER_CONNECTION, 0) << 20;
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %d)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
+
+/* end of test_ip_filter.c */
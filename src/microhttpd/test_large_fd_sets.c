@@ -0,0 +1,204 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_large_fd_sets.c
+ * @brief  Testcase for #MHD_USE_LARGE_FD_SETS: a select() daemon
+ *         serves connections whose sockets are beyond FD_SETSIZE
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1207
+
+/**
+ * Number of keep-alive connections of the test.
+ */
+#define NUM_CONNECTIONS 8
+
+#define BODY "beyond FD_SETSIZE"
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  struct MHD_Response *response;
+  int ret;
+
+  response = MHD_create_response_from_buffer (strlen (BODY),
+                                              BODY,
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+static int
+send_request (MHD_socket sock)
+{
+  static const char req[] =
+    "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+  if (sizeof (req) - 1 != send (sock, req, sizeof (req) - 1, 0))
+    return 1;
+  return 0;
+}
+
+
+/**
+ * Receive a response on the keep-alive connection @a sock.
+ *
+ * @return 0 if the response arrived intact
+ */
+static int
+receive_response (MHD_socket sock)
+{
+  char buf[1024];
+  size_t off;
+  ssize_t got;
+
+  off = 0;
+  while (off < sizeof (buf) - 1)
+    {
+      got = recv (sock, &buf[off], sizeof (buf) - 1 - off, 0);
+      if (got <= 0)
+        return 1;
+      off += got;
+      buf[off] = '\0';
+      if ( (off > strlen (BODY)) &&
+           (0 == strcmp (&buf[off - strlen (BODY)], BODY)) )
+        break;
+    }
+  if (0 != strncmp (buf, "HTTP/1.1 200", strlen ("HTTP/1.1 200")))
+    return 1;
+  return 0;
+}
+
+
+static int
+test_daemon (unsigned int threads)
+{
+  struct MHD_Daemon *d;
+  MHD_socket socks[NUM_CONNECTIONS];
+  unsigned int i;
+  unsigned int round;
+  int ret;
+
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_LARGE_FD_SETS,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_THREAD_POOL_SIZE, threads,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  for (i = 0; i < NUM_CONNECTIONS; i++)
+    socks[i] = connect_to_timeout (PORT, 5);
+  /* all connections wait in the same select() */
+  for (round = 0; round < 3; round++)
+    {
+      for (i = round; i < NUM_CONNECTIONS; i++)
+        if (0 != send_request (socks[i]))
+          ret |= 2;
+      for (i = round; i < NUM_CONNECTIONS; i++)
+        if (0 != receive_response (socks[i]))
+          ret |= 4;
+      /* connections leaving must not disturb the others */
+      MHD_socket_close_ (socks[round]);
+    }
+  for (i = round; i < NUM_CONNECTIONS; i++)
+    MHD_socket_close_ (socks[i]);
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  struct rlimit rl;
+  int fds[FD_SETSIZE + 16];
+  unsigned int num_fds;
+  int errorCount;
+
+  /* make room for sockets beyond FD_SETSIZE and use up the ones below */
+  if (0 != getrlimit (RLIMIT_NOFILE, &rl))
+    return 77;
+  if (rl.rlim_cur < FD_SETSIZE + 64)
+    {
+      if ( (RLIM_INFINITY != rl.rlim_max) &&
+           (rl.rlim_max < FD_SETSIZE + 64) )
+        return 77;
+      rl.rlim_cur = FD_SETSIZE + 64;
+      if (0 != setrlimit (RLIMIT_NOFILE, &rl))
+        return 77;
+    }
+  num_fds = 0;
+  do
+    {
+      fds[num_fds] = open ("/dev/null", O_RDONLY);
+      if (-1 == fds[num_fds])
+        abort ();
+    }
+  while (fds[num_fds++] < FD_SETSIZE);
+
+  errorCount = 0;
+  /* plain select() cannot handle the listen socket */
+  if (NULL != MHD_start_daemon (MHD_USE_SELECT_INTERNALLY,
+                                PORT,
+                                NULL, NULL,
+                                &ahc_echo, NULL,
+                                MHD_OPTION_END))
+    errorCount |= 1;
+  errorCount |= test_daemon (0) << 4;
+  errorCount |= test_daemon (2) << 8;
+  while (num_fds > 0)
+    (void) close (fds[--num_fds]);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %d)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
+
+/* end of test_large_fd_sets.c */
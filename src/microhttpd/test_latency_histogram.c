@@ -0,0 +1,255 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_latency_histogram.c
+ * @brief  Testcase for #MHD_get_latency_histogram(): fast and slow
+ *         requests land in the right part of the histogram, which is
+ *         summed up over a thread pool
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+
+/**
+ * Time the handler takes for a slow request, in microseconds.
+ */
+#define SLOW_DELAY 20000
+
+/**
+ * Number of fast and of slow requests.
+ */
+#define NUM_REQUESTS 5
+
+#define PAGE "latency"
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  if (0 == strcmp (url, "/slow"))
+    usleep (SLOW_DELAY);
+  response = MHD_create_response_from_buffer (strlen (PAGE),
+                                              (void *) PAGE,
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection,
+                            MHD_HTTP_OK,
+                            response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Request @a url on a new connection and read the response until
+ * the daemon closes the connection.
+ *
+ * @return 0 on success
+ */
+static int
+request (uint16_t port,
+         const char *url)
+{
+  MHD_socket sock;
+  struct sockaddr_in sa;
+  char buf[1024];
+  ssize_t got;
+  fd_set rs;
+  struct timeval tv;
+
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sock)
+    abort ();
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (port);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (sock,
+                    (struct sockaddr *) &sa,
+                    sizeof (sa)))
+    abort ();
+  snprintf (buf,
+            sizeof (buf),
+            "GET %s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+            url);
+  if (strlen (buf) != (size_t) write (sock, buf, strlen (buf)))
+    abort ();
+  while (1)
+    {
+      FD_ZERO (&rs);
+      FD_SET (sock, &rs);
+      tv.tv_sec = 2;
+      tv.tv_usec = 0;
+      if (1 != select (sock + 1, &rs, NULL, NULL, &tv))
+        break;
+      got = read (sock, buf, sizeof (buf));
+      if (0 > got)
+        break;
+      if (0 == got)
+        {
+          MHD_socket_close_ (sock);
+          return 0;
+        }
+    }
+  MHD_socket_close_ (sock);
+  return 1;
+}
+
+
+/**
+ * Check that the bucket limits increase steadily and keep an error
+ * of at most 1/16th.
+ *
+ * @return 0 if they do
+ */
+static int
+test_buckets ()
+{
+  unsigned int i;
+  uint64_t prev;
+  uint64_t limit;
+
+  if ( (0 != MHD_latency_bucket_limit (0)) ||
+       (31 != MHD_latency_bucket_limit (31)) ||
+       (33 != MHD_latency_bucket_limit (32)) ||
+       (63 != MHD_latency_bucket_limit (47)) ||
+       (67 != MHD_latency_bucket_limit (48)) )
+    return 1;
+  prev = 0;
+  for (i = 1; i < MHD_LATENCY_BUCKETS - 1; i++)
+    {
+      limit = MHD_latency_bucket_limit (i);
+      if ( (limit <= prev) ||
+           ( (i >= 32) &&
+             (limit - prev > (prev + 1) / 16 + 1) ) )
+        return 2;
+      prev = limit;
+    }
+  return 0;
+}
+
+
+static int
+test_histogram (unsigned int flags,
+                unsigned int pool_size,
+                uint16_t port)
+{
+  struct MHD_Daemon *d;
+  struct MHD_LatencyHistogram total;
+  struct MHD_LatencyHistogram first_byte;
+  unsigned int i;
+  int ret;
+
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        port,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_THREAD_POOL_SIZE, pool_size,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  for (i = 0; i < NUM_REQUESTS; i++)
+    {
+      ret |= request (port, "/fast");
+      ret |= request (port, "/slow");
+    }
+  /* the histograms are updated before the connection is closed */
+  if ( (MHD_YES != MHD_get_latency_histogram (d,
+                                              MHD_LATENCY_TOTAL,
+                                              &total)) ||
+       (MHD_YES != MHD_get_latency_histogram (d,
+                                              MHD_LATENCY_FIRST_BYTE,
+                                              &first_byte)) ||
+       (MHD_NO != MHD_get_latency_histogram (d,
+                                             (enum MHD_LatencyType) 42,
+                                             &total)) )
+    ret |= 2;
+  MHD_stop_daemon (d);
+  if ( (2 * NUM_REQUESTS != total.count) ||
+       (2 * NUM_REQUESTS != first_byte.count) ||
+       (total.sum < NUM_REQUESTS * SLOW_DELAY) )
+    return ret | 4;
+  /* half of the requests are fast, the slow ones are at least as slow
+     as the handler */
+  if (MHD_latency_histogram_percentile (&total, 50.0) >= SLOW_DELAY)
+    ret |= 8;
+  if ( (MHD_latency_histogram_percentile (&total, 60.0) < SLOW_DELAY) ||
+       (MHD_latency_histogram_percentile (&first_byte, 100.0) < SLOW_DELAY) )
+    ret |= 16;
+  if (MHD_latency_histogram_percentile (&total, 100.0) > 2000000)
+    ret |= 32;
+  MHD_latency_histogram_merge (&total,
+                               &first_byte);
+  if ( (4 * NUM_REQUESTS != total.count) ||
+       (MHD_latency_histogram_percentile (&total, 50.0) >= SLOW_DELAY) )
+    ret |= 64;
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += test_buckets ();
+  errorCount += test_histogram (MHD_USE_SELECT_INTERNALLY,
+                                0,
+                                1151);
+  errorCount += test_histogram (MHD_USE_SELECT_INTERNALLY,
+                                2,
+                                1152);
+  errorCount += test_histogram (MHD_USE_THREAD_PER_CONNECTION,
+                                0,
+                                1153);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
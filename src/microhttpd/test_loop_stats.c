@@ -0,0 +1,250 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_loop_stats.c
+ * @brief  Testcase for the event loop profile: the
+ *         #MHD_OPTION_LOOP_STATS_CALLBACK is called periodically by
+ *         each thread, and an idle loop is mostly blocked
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+
+/**
+ * Interval of the callback in milliseconds.
+ */
+#define INTERVAL 50
+
+/**
+ * Number of threads in the thread pool.
+ */
+#define POOL_SIZE 2
+
+#define PAGE "loop"
+
+/**
+ * Sums of the reports per worker; each worker only writes its own.
+ */
+static struct MHD_LoopStats reports[POOL_SIZE];
+
+static unsigned int calls[POOL_SIZE];
+
+static int bad_report;
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_buffer (strlen (PAGE),
+                                              (void *) PAGE,
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection,
+                            MHD_HTTP_OK,
+                            response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+static void
+loop_stats (void *cls,
+            const struct MHD_LoopStats *stats)
+{
+  if (stats->worker >= POOL_SIZE)
+    {
+      bad_report = 1;
+      return;
+    }
+  /* the loop cannot have been busier than the interval was long, and
+     the callback is not called early */
+  if ( (stats->wait_usec + stats->dispatch_usec > stats->interval_usec) ||
+       (stats->interval_usec < INTERVAL * 1000) ||
+       (0 == stats->iterations) ||
+       (stats->wakeups < stats->iterations) )
+    bad_report = 1;
+  reports[stats->worker].interval_usec += stats->interval_usec;
+  reports[stats->worker].iterations += stats->iterations;
+  reports[stats->worker].wakeups += stats->wakeups;
+  reports[stats->worker].events += stats->events;
+  reports[stats->worker].wait_usec += stats->wait_usec;
+  reports[stats->worker].dispatch_usec += stats->dispatch_usec;
+  calls[stats->worker]++;
+}
+
+
+/**
+ * Request "/" on a new connection and read the response until the
+ * daemon closes the connection.
+ *
+ * @return 0 on success
+ */
+static int
+request (uint16_t port)
+{
+  MHD_socket sock;
+  struct sockaddr_in sa;
+  char buf[1024];
+  ssize_t got;
+  fd_set rs;
+  struct timeval tv;
+  const char *req =
+    "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sock)
+    abort ();
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (port);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (sock,
+                    (struct sockaddr *) &sa,
+                    sizeof (sa)))
+    abort ();
+  if (strlen (req) != (size_t) write (sock, req, strlen (req)))
+    abort ();
+  while (1)
+    {
+      FD_ZERO (&rs);
+      FD_SET (sock, &rs);
+      tv.tv_sec = 2;
+      tv.tv_usec = 0;
+      if (1 != select (sock + 1, &rs, NULL, NULL, &tv))
+        break;
+      got = read (sock, buf, sizeof (buf));
+      if (0 > got)
+        break;
+      if (0 == got)
+        {
+          MHD_socket_close_ (sock);
+          return 0;
+        }
+    }
+  MHD_socket_close_ (sock);
+  return 1;
+}
+
+
+static int
+test_loop_stats (unsigned int flags,
+                 uint16_t port)
+{
+  struct MHD_Daemon *d;
+  const union MHD_DaemonInfo *info;
+  unsigned int i;
+  int ret;
+
+  memset (reports, 0, sizeof (reports));
+  memset (calls, 0, sizeof (calls));
+  bad_report = 0;
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        port,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_THREAD_POOL_SIZE, (unsigned int) POOL_SIZE,
+                        MHD_OPTION_LOOP_STATS_CALLBACK, &loop_stats, NULL,
+                        MHD_OPTION_LOOP_STATS_INTERVAL, (unsigned int) INTERVAL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  for (i = 0; i < 10; i++)
+    {
+      ret |= request (port);
+      usleep (INTERVAL * 1000 / 2);
+    }
+  /* let every worker wake up for its timeout at least once more */
+  usleep (INTERVAL * 1000 * 2);
+  info = MHD_get_daemon_info (d,
+                              MHD_DAEMON_INFO_STATS);
+  if ( (NULL == info) ||
+       (info->stats.loop_wakeups < info->stats.loop_iterations) ||
+       (0 == info->stats.loop_events) ||
+       (info->stats.loop_wait_usec < info->stats.loop_dispatch_usec) )
+    ret |= 2;
+  MHD_stop_daemon (d);
+  if (0 != bad_report)
+    ret |= 4;
+  /* a worker that never got an event blocks without a timeout and
+     does not report */
+  if (0 == calls[0] + calls[1])
+    ret |= 8;
+  for (i = 0; i < POOL_SIZE; i++)
+    {
+      /* idle most of the time */
+      if ( (0 != calls[i]) &&
+           (reports[i].wait_usec < reports[i].interval_usec / 2) )
+        ret |= 16;
+    }
+  if (0 == reports[0].events + reports[1].events)
+    ret |= 32;
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += test_loop_stats (MHD_USE_SELECT_INTERNALLY,
+                                 1154);
+#ifdef HAVE_POLL
+  errorCount += test_loop_stats (MHD_USE_POLL_INTERNALLY,
+                                 1155);
+#endif
+#if EPOLL_SUPPORT
+  errorCount += test_loop_stats (MHD_USE_SELECT_INTERNALLY | MHD_USE_EPOLL_LINUX_ONLY,
+                                 1156);
+#endif
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
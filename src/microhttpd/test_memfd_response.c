@@ -0,0 +1,217 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_memfd_response.c
+ * @brief  Testcase for responses created with
+ *         #MHD_create_response_from_memfd()
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1211
+
+/**
+ * Size of the body; larger than the write buffer of a connection.
+ */
+#define BODY_SIZE (1024 * 1024)
+
+/**
+ * Response shared by all requests.
+ */
+static struct MHD_Response *response;
+
+
+static char
+body_byte (size_t pos)
+{
+  return 'a' + pos % 23;
+}
+
+
+static int
+ahc_memfd (void *cls,
+           struct MHD_Connection *connection,
+           const char *url,
+           const char *method,
+           const char *version,
+           const char *upload_data,
+           size_t *upload_data_size,
+           void **con_cls)
+{
+  static int marker;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  return MHD_queue_response (connection, MHD_HTTP_OK, response);
+}
+
+
+/**
+ * Fetch the body and check the reply.
+ *
+ * @return 0 on success
+ */
+static int
+check_get ()
+{
+  static char reply[BODY_SIZE + 1024];
+  const char *request =
+    "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+  MHD_socket sock;
+  struct sockaddr_in sa;
+  const char *body;
+  size_t have;
+  size_t i;
+  ssize_t got;
+
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sock)
+    abort ();
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (sock,
+                    (struct sockaddr *) &sa,
+                    sizeof (sa)))
+    abort ();
+  if (strlen (request) !=
+      (size_t) write (sock, request, strlen (request)))
+    abort ();
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          (0 < (got = read (sock, &reply[have], sizeof (reply) - 1 - have))) )
+    have += got;
+  reply[have] = '\0';
+  MHD_socket_close_ (sock);
+  body = strstr (reply, "\r\n\r\n");
+  if ( (NULL == body) ||
+       (0 != strncmp (reply, "HTTP/1.1 200 OK\r\n", strlen ("HTTP/1.1 200 OK\r\n"))) ||
+       (NULL == strstr (reply, "\r\nContent-Length: 1048576\r\n")) )
+    return 1;
+  body += 4;
+  if (BODY_SIZE != &reply[have] - body)
+    {
+      fprintf (stderr, "Got %u bytes of body\n",
+               (unsigned int) (&reply[have] - body));
+      return 2;
+    }
+  for (i = 0; i < BODY_SIZE; i++)
+    if (body[i] != body_byte (i))
+      return 4;
+  return 0;
+}
+
+
+#if defined(LINUX) && defined(F_GET_SEALS)
+/**
+ * Find the memfd of the response among the descriptors of the
+ * process and check that it is sealed against writes.
+ *
+ * @return 0 if it is, 1 if it is missing or writable
+ */
+static int
+check_sealed ()
+{
+  char path[64];
+  char target[128];
+  ssize_t len;
+  int seals;
+  int fd;
+
+  for (fd = 0; fd < 1024; fd++)
+    {
+      snprintf (path, sizeof (path), "/proc/self/fd/%d", fd);
+      len = readlink (path, target, sizeof (target) - 1);
+      if (0 > len)
+        continue;
+      target[len] = '\0';
+      if (0 != strncmp (target, "/memfd:libmicrohttpd", strlen ("/memfd:libmicrohttpd")))
+        continue;
+      seals = fcntl (fd, F_GET_SEALS);
+      if ( (-1 == seals) ||
+           (0 == (seals & F_SEAL_WRITE)) ||
+           (0 == (seals & F_SEAL_SHRINK)) )
+        return 1;
+      return 0;
+    }
+  return 1;
+}
+#endif
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  struct MHD_Daemon *d;
+  char *buf;
+  size_t i;
+  int errorCount = 0;
+
+  buf = malloc (BODY_SIZE);
+  if (NULL == buf)
+    return 1;
+  for (i = 0; i < BODY_SIZE; i++)
+    buf[i] = body_byte (i);
+  response = MHD_create_response_from_memfd (BODY_SIZE, buf);
+  if (NULL == response)
+    return 1;
+  /* the response holds its own copy */
+  memset (buf, 'X', BODY_SIZE);
+  free (buf);
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_memfd, NULL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  errorCount += check_get ();
+  errorCount += 8 * check_get ();
+#if defined(LINUX) && defined(F_GET_SEALS)
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_MEMFD_RESPONSE))
+    errorCount += 64 * check_sealed ();
+#endif
+  MHD_stop_daemon (d);
+  MHD_destroy_response (response);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
+
+/* end of test_memfd_response.c */
@@ -0,0 +1,273 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_memory_budget.c
+ * @brief  Testcase for #MHD_OPTION_MEMORY_BUDGET: the pools of idle
+ *         keep-alive connections are released for new connections,
+ *         and accepting pauses while busy connections hold the budget
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <poll.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1191
+
+/**
+ * Memory limit of a connection.
+ */
+#define POOL_SIZE (32 * 1024)
+
+/**
+ * Connections suspended by the handler for "/hold".
+ */
+static struct MHD_Connection *volatile held[2];
+
+/**
+ * Number of entries in #held.
+ */
+static volatile unsigned int num_held;
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  static int held_marker;
+  struct MHD_Response *response;
+  int ret;
+
+  if (NULL == *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  if ( (&marker == *con_cls) &&
+       (0 == strcmp (url, "/hold")) )
+    {
+      *con_cls = &held_marker;
+      MHD_suspend_connection (connection);
+      held[num_held] = connection;
+      num_held++;
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_buffer (2,
+                                              (void *) "ok",
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Send a request for @a url on @a sock.
+ *
+ * @param sock socket to use
+ * @param url URL to request
+ * @param must_close #MHD_YES to ask for the connection to be closed
+ * @return 0 on success
+ */
+static int
+send_request (MHD_socket sock,
+              const char *url,
+              int must_close)
+{
+  char request[256];
+  size_t len;
+
+  len = snprintf (request,
+                  sizeof (request),
+                  "GET %s HTTP/1.1\r\nHost: localhost\r\n%s\r\n",
+                  url,
+                  (MHD_YES == must_close) ? "Connection: close\r\n" : "");
+  if (len != (size_t) write (sock, request, len))
+    return 1;
+  return 0;
+}
+
+
+/**
+ * Read the reply to a request from @a sock and check it.
+ *
+ * @param sock socket to use
+ * @return 0 on success
+ */
+static int
+check_reply (MHD_socket sock)
+{
+  char reply[512];
+  const char *body;
+  size_t have;
+  ssize_t got;
+
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          (0 < (got = read (sock,
+                            &reply[have],
+                            sizeof (reply) - 1 - have))) )
+    {
+      have += got;
+      reply[have] = '\0';
+      if ( (NULL != (body = strstr (reply, "\r\n\r\n"))) &&
+           (0 == strcmp (body + 4, "ok")) )
+        return 0;
+    }
+  return 2;
+}
+
+
+/**
+ * Check that @a sock got no reply within a little while.
+ *
+ * @param sock socket to check
+ * @return 0 on success
+ */
+static int
+check_no_reply (MHD_socket sock)
+{
+  struct pollfd pfd;
+
+  pfd.fd = sock;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  if (0 != poll (&pfd, 1, 300))
+    return 8;
+  return 0;
+}
+
+
+static int
+check_budget (unsigned int flags)
+{
+  const union MHD_DaemonInfo *info;
+  struct MHD_Daemon *d;
+  MHD_socket idle1;
+  MHD_socket idle2;
+  MHD_socket sock;
+  MHD_socket hold1;
+  MHD_socket hold2;
+  MHD_socket waiting;
+  unsigned int i;
+  int ret;
+
+  d = MHD_start_daemon (flags | MHD_USE_SUSPEND_RESUME
+                        | MHD_USE_PIPE_FOR_SHUTDOWN | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_CONNECTION_MEMORY_LIMIT, (size_t) POOL_SIZE,
+                        MHD_OPTION_MEMORY_BUDGET, (size_t) (2 * POOL_SIZE),
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 16;
+  ret = 0;
+  num_held = 0;
+
+  /* two idle keep-alive connections take the whole budget ... */
+  idle1 = connect_to_timeout (PORT, 5);
+  ret |= send_request (idle1, "/", MHD_NO);
+  ret |= check_reply (idle1);
+  idle2 = connect_to_timeout (PORT, 5);
+  ret |= send_request (idle2, "/", MHD_NO);
+  ret |= check_reply (idle2);
+  /* ... but give it up for a new one, and get it back when needed */
+  sock = connect_to_timeout (PORT, 5);
+  ret |= send_request (sock, "/", MHD_NO);
+  ret |= check_reply (sock);
+  ret |= send_request (idle1, "/", MHD_YES);
+  ret |= check_reply (idle1);
+  ret |= send_request (idle2, "/", MHD_YES);
+  ret |= check_reply (idle2);
+  ret |= send_request (sock, "/", MHD_YES);
+  ret |= check_reply (sock);
+  MHD_socket_close_ (sock);
+  MHD_socket_close_ (idle1);
+  MHD_socket_close_ (idle2);
+
+  /* two suspended requests hold the budget, no accept meanwhile */
+  hold1 = connect_to_timeout (PORT, 5);
+  ret |= send_request (hold1, "/hold", MHD_YES);
+  hold2 = connect_to_timeout (PORT, 5);
+  ret |= send_request (hold2, "/hold", MHD_YES);
+  for (i = 0; (i < 500) && (num_held < 2); i++)
+    usleep (10000);
+  if (num_held < 2)
+    abort ();
+  waiting = connect_to_timeout (PORT, 5);
+  ret |= send_request (waiting, "/", MHD_YES);
+  ret |= check_no_reply (waiting);
+  info = MHD_get_daemon_info (d,
+                              MHD_DAEMON_INFO_CURRENT_CONNECTIONS);
+  if ( (NULL == info) ||
+       (2 != info->num_connections) )
+    ret |= 32;
+  MHD_resume_connection (held[0]);
+  MHD_resume_connection (held[1]);
+  ret |= check_reply (hold1);
+  ret |= check_reply (hold2);
+  ret |= check_reply (waiting);
+  MHD_socket_close_ (hold1);
+  MHD_socket_close_ (hold2);
+  MHD_socket_close_ (waiting);
+  MHD_stop_daemon (d);
+  if (0 != ret)
+    fprintf (stderr,
+             "Memory budget failed with flags %u: %d\n",
+             flags,
+             ret);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += check_budget (MHD_USE_SELECT_INTERNALLY);
+  errorCount += check_budget (MHD_USE_POLL_INTERNALLY);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_EPOLL))
+    errorCount += check_budget (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
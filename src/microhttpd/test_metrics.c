@@ -0,0 +1,219 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_metrics.c
+ * @brief  Testcase for #MHD_create_metrics_response()
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1209
+
+#define BODY "hello"
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  struct MHD_Daemon *d = *(struct MHD_Daemon **) cls;
+  struct MHD_Response *response;
+  int ret;
+
+  if (0 == strcmp (url, "/metrics"))
+    response = MHD_create_metrics_response (d);
+  else
+    response = MHD_create_response_from_buffer (strlen (BODY),
+                                                BODY,
+                                                MHD_RESPMEM_PERSISTENT);
+  if (NULL == response)
+    return MHD_NO;
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Fetch @a url from the daemon on a new connection.
+ *
+ * @param url the URL to get
+ * @param buf where to store the response (headers and body)
+ * @param buf_size size of @a buf
+ * @return 0 on success
+ */
+static int
+fetch (const char *url,
+       char *buf,
+       size_t buf_size)
+{
+  struct sockaddr_in sa;
+  struct timeval tv;
+  char req[256];
+  MHD_socket sock;
+  ssize_t got;
+  size_t off;
+  int ret;
+
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sock)
+    abort ();
+  tv.tv_sec = 5;
+  tv.tv_usec = 0;
+  setsockopt (sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  ret = 1;
+  if (0 != connect (sock,
+                    (struct sockaddr *) &sa,
+                    sizeof (sa)))
+    goto done;
+  snprintf (req,
+            sizeof (req),
+            "GET %s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+            url);
+  if ((ssize_t) strlen (req) != send (sock, req, strlen (req), 0))
+    goto done;
+  off = 0;
+  while (off < buf_size - 1)
+    {
+      got = recv (sock, &buf[off], buf_size - 1 - off, 0);
+      if (got <= 0)
+        break;
+      off += got;
+    }
+  buf[off] = '\0';
+  if (0 == strncmp (buf, "HTTP/1.1 200", strlen ("HTTP/1.1 200")))
+    ret = 0;
+ done:
+  MHD_socket_close_ (sock);
+  return ret;
+}
+
+
+/**
+ * Get the value of the sample @a name from the metrics in @a text.
+ *
+ * @return the value, -1 if the sample is missing
+ */
+static long long
+sample (const char *text,
+        const char *name)
+{
+  const char *pos;
+  size_t len = strlen (name);
+
+  for (pos = strstr (text, name); NULL != pos; pos = strstr (pos + 1, name))
+    if ( ('\n' == pos[-1]) &&
+         (' ' == pos[len]) )
+      return atoll (&pos[len + 1]);
+  return -1;
+}
+
+
+static int
+test_daemon (unsigned int threads)
+{
+  struct MHD_Daemon *d;
+  static char buf[256 * 1024];
+  unsigned int i;
+  long long count;
+  int ret;
+
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, &d,
+                        MHD_OPTION_THREAD_POOL_SIZE, threads,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  for (i = 0; i < 5; i++)
+    if (0 != fetch ("/", buf, sizeof (buf)))
+      ret |= 2;
+  /* the second scrape reuses the buffer of the first one */
+  for (i = 0; i < 2; i++)
+    {
+      if (0 != fetch ("/metrics", buf, sizeof (buf)))
+        {
+          ret |= 4;
+          break;
+        }
+      if (NULL == strstr (buf, "Content-Type: application/openmetrics-text"))
+        ret |= 8;
+      if (NULL == strstr (buf, "# TYPE mhd_requests counter\n"))
+        ret |= 16;
+      /* five requests before and the scrapes themselves */
+      if (5 + i + 1 != sample (buf, "mhd_requests_total"))
+        ret |= 32;
+      if (5 + i != sample (buf, "mhd_request_duration_seconds_count"))
+        ret |= 64;
+      count = sample (buf, "mhd_request_duration_seconds_bucket{le=\"+Inf\"}");
+      if (count != sample (buf, "mhd_request_duration_seconds_count"))
+        ret |= 128;
+      if ( (0 != threads) &&
+           (-1 == sample (buf, "mhd_worker_requests_total{worker=\"1\"}")) )
+        ret |= 256;
+      if ( (strlen (buf) < strlen ("# EOF\n")) ||
+           (0 != strcmp (&buf[strlen (buf) - strlen ("# EOF\n")], "# EOF\n")) )
+        ret |= 512;
+    }
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount;
+
+  errorCount = 0;
+  errorCount |= test_daemon (0);
+  errorCount |= test_daemon (2) << 10;
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %d)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
+
+/* end of test_metrics.c */
@@ -0,0 +1,343 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_notify_socket.c
+ * @brief  Testcase for #MHD_OPTION_NOTIFY_SOCKET: a poll() loop of
+ *         the application only learns about the sockets of the
+ *         daemon from the callback and drives it with MHD_run_socket()
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+
+
+#define PORT 1128
+
+#define PAGE "notify socket"
+
+#define MAX_WATCHES 16
+
+
+/**
+ * A socket the application's event loop watches for the daemon.
+ */
+struct Watch
+{
+  MHD_socket fd;
+  unsigned int interest;
+  void *handle;
+  int used;
+};
+
+static struct Watch watches[MAX_WATCHES];
+
+static unsigned int num_watched;
+
+static unsigned int errors;
+
+static struct MHD_Connection *suspended;
+
+static int suspend_done;
+
+
+static void
+notify_cb (void *cls,
+           MHD_socket sock,
+           unsigned int interest,
+           void *handle,
+           void **sock_cls)
+{
+  struct Watch *w = *sock_cls;
+  unsigned int i;
+
+  if (NULL == w)
+    {
+      if (MHD_SOCKET_INTEREST_REMOVE == interest)
+        {
+          errors++; /* never reported before */
+          return;
+        }
+      for (i = 0; i < MAX_WATCHES; i++)
+        if (! watches[i].used)
+          break;
+      if (MAX_WATCHES == i)
+        abort ();
+      w = &watches[i];
+      w->used = 1;
+      w->fd = sock;
+      w->handle = handle;
+      *sock_cls = w;
+      num_watched++;
+    }
+  if ( (w->fd != sock) ||
+       (w->handle != handle) )
+    errors++;
+  if (MHD_SOCKET_INTEREST_REMOVE == interest)
+    {
+      w->used = 0;
+      num_watched--;
+      return;
+    }
+  w->interest = interest;
+}
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  if ( (0 == strcmp (url, "/suspend")) &&
+       (! suspend_done) )
+    {
+      MHD_suspend_connection (connection);
+      suspended = connection;
+      suspend_done = 1;
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_buffer (strlen (PAGE),
+                                              (void *) PAGE,
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection,
+                            MHD_HTTP_OK,
+                            response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Wait once for the sockets of the daemon and @a client and run the
+ * daemon for the ready ones.
+ *
+ * @return 1 if @a client is readable
+ */
+static int
+run_loop (struct MHD_Daemon *d,
+          MHD_socket client)
+{
+  struct pollfd fds[MAX_WATCHES + 1];
+  unsigned int idx[MAX_WATCHES + 1];
+  unsigned int num;
+  unsigned int i;
+  unsigned int ready;
+  struct Watch *w;
+
+  num = 0;
+  for (i = 0; i < MAX_WATCHES; i++)
+    {
+      if ( (! watches[i].used) ||
+           (MHD_SOCKET_INTEREST_NONE == watches[i].interest) )
+        continue;
+      fds[num].fd = watches[i].fd;
+      fds[num].events = 0;
+      if (0 != (watches[i].interest & MHD_SOCKET_INTEREST_READ))
+        fds[num].events |= POLLIN;
+      if (0 != (watches[i].interest & MHD_SOCKET_INTEREST_WRITE))
+        fds[num].events |= POLLOUT;
+      fds[num].revents = 0;
+      idx[num++] = i;
+    }
+  fds[num].fd = client;
+  fds[num].events = POLLIN;
+  fds[num].revents = 0;
+  if (0 > poll (fds, num + 1, 100))
+    abort ();
+  for (i = 0; i < num; i++)
+    {
+      w = &watches[idx[i]];
+      /* may have been removed while running the daemon for another
+         socket */
+      if ( (! w->used) ||
+           (w->fd != fds[i].fd) )
+        continue;
+      ready = 0;
+      if (0 != (fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+        ready |= MHD_SOCKET_INTEREST_READ;
+      if (0 != (fds[i].revents & (POLLOUT | POLLERR)))
+        ready |= MHD_SOCKET_INTEREST_WRITE;
+      if ( (0 != ready) &&
+           (MHD_YES != MHD_run_socket (d, w->handle, ready)) )
+        errors++;
+    }
+  return (0 != (fds[num].revents & POLLIN)) ? 1 : 0;
+}
+
+
+/**
+ * Send a request for @a url and run the daemon until the response
+ * arrived.
+ *
+ * @return 0 on success
+ */
+static int
+request (struct MHD_Daemon *d,
+         MHD_socket sock,
+         const char *url)
+{
+  char buf[1024];
+  size_t off;
+  ssize_t got;
+  unsigned int rounds;
+
+  snprintf (buf,
+            sizeof (buf),
+            "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n",
+            url);
+  if (strlen (buf) != (size_t) write (sock, buf, strlen (buf)))
+    return 1;
+  off = 0;
+  buf[0] = '\0';
+  rounds = 0;
+  while (NULL == strstr (buf, PAGE))
+    {
+      if (50 < rounds++)
+        return 2;
+      if ( (NULL != suspended) &&
+           (0 == strcmp (url, "/suspend")) )
+        {
+          /* nothing to wait for on the socket while suspended */
+          if (MHD_SOCKET_INTEREST_NONE != watches[1].interest)
+            return 4;
+          MHD_resume_connection (suspended);
+          suspended = NULL;
+          if (MHD_YES != MHD_run_socket (d, NULL, 0))
+            return 8;
+        }
+      if (! run_loop (d, sock))
+        continue;
+      got = read (sock, &buf[off], sizeof (buf) - 1 - off);
+      if (0 >= got)
+        return 16;
+      off += got;
+      buf[off] = '\0';
+      if (sizeof (buf) - 1 == off)
+        return 32;
+    }
+  if (0 != strncmp (buf, "HTTP/1.1 200", strlen ("HTTP/1.1 200")))
+    return 64;
+  return 0;
+}
+
+
+static int
+test_notify_socket ()
+{
+  struct MHD_Daemon *d;
+  MHD_socket sock;
+  unsigned int rounds;
+  int ret;
+
+  d = MHD_start_daemon (MHD_USE_SUSPEND_RESUME | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_NOTIFY_SOCKET, &notify_cb, NULL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  /* only the listen socket so far */
+  if ( (1 != num_watched) ||
+       (MHD_SOCKET_INTEREST_READ != watches[0].interest) )
+    ret |= 2;
+  sock = connect_to (PORT);
+  ret |= request (d, sock, "/") << 2;
+  ret |= request (d, sock, "/") << 9;
+  if (2 != num_watched)
+    ret |= 1 << 16;
+  ret |= request (d, sock, "/suspend") << 17;
+  /* closing the connection removes its socket */
+  MHD_socket_close_ (sock);
+  for (rounds = 0; (2 == num_watched) && (rounds < 10); rounds++)
+    (void) run_loop (d, MHD_INVALID_SOCKET);
+  if (1 != num_watched)
+    ret |= 1 << 24;
+  MHD_stop_daemon (d);
+  if ( (0 != num_watched) ||
+       (0 != errors) )
+    ret |= 1 << 25;
+  return ret;
+}
+
+
+static int
+test_internal_thread_rejected ()
+{
+  struct MHD_Daemon *d;
+
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_NOTIFY_SOCKET, &notify_cb, NULL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 0;
+  MHD_stop_daemon (d);
+  return 1;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+#ifdef HAVE_POLL
+  errorCount += test_notify_socket ();
+  errorCount += test_internal_thread_rejected ();
+#endif
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,241 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_overload.c
+ * @brief  Testcase for #MHD_OPTION_OVERLOAD_LATENCY: requests are
+ *         rejected with a 503 while the access handler is slow, without
+ *         calling it, and accepted again afterwards
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+
+/**
+ * Milliseconds of latency from which the daemon is overloaded.
+ */
+#define LATENCY 50
+
+#define PAGE "overload"
+
+/**
+ * Number of requests the access handler was called for.
+ */
+static unsigned int handled;
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      handled++;
+      if (0 == strcmp (url, "/slow"))
+        usleep (4 * LATENCY * 1000);
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_buffer (strlen (PAGE),
+                                              (void *) PAGE,
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection,
+                            MHD_HTTP_OK,
+                            response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Request @a url and read the response into @a buf until the daemon
+ * closes the connection.
+ *
+ * @return 0 on success
+ */
+static int
+request (uint16_t port,
+         const char *url,
+         char *buf,
+         size_t buf_size)
+{
+  MHD_socket sock;
+  struct sockaddr_in sa;
+  char req[256];
+  size_t off;
+  ssize_t got;
+  fd_set rs;
+  struct timeval tv;
+
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sock)
+    abort ();
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (port);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (sock,
+                    (struct sockaddr *) &sa,
+                    sizeof (sa)))
+    abort ();
+  snprintf (req,
+            sizeof (req),
+            "GET %s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+            url);
+  if (strlen (req) != (size_t) write (sock, req, strlen (req)))
+    abort ();
+  off = 0;
+  while (1)
+    {
+      FD_ZERO (&rs);
+      FD_SET (sock, &rs);
+      tv.tv_sec = 5;
+      tv.tv_usec = 0;
+      if (1 != select (sock + 1, &rs, NULL, NULL, &tv))
+        break;
+      got = read (sock, &buf[off], buf_size - 1 - off);
+      if (0 >= got)
+        break;
+      off += got;
+    }
+  buf[off] = '\0';
+  MHD_socket_close_ (sock);
+  return (0 == off) ? 1 : 0;
+}
+
+
+static int
+test_overload (unsigned int flags,
+               uint16_t port)
+{
+  struct MHD_Daemon *d;
+  char buf[2048];
+  unsigned int i;
+  unsigned int before;
+  int ret;
+
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        port,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_OVERLOAD_LATENCY, (unsigned int) LATENCY,
+                        MHD_OPTION_OVERLOAD_RETRY_AFTER, (unsigned int) 3,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  /* a slow handler raises the average latency until requests are
+     rejected */
+  for (i = 0; i < 20; i++)
+    {
+      before = handled;
+      if (0 != request (port, "/slow", buf, sizeof (buf)))
+        ret |= 2;
+      if (0 == strncmp (buf, "HTTP/1.1 503", strlen ("HTTP/1.1 503")))
+        break;
+    }
+  if ( (i < 2) ||
+       (20 == i) )
+    ret |= 4;
+  if (NULL == strstr (buf, MHD_HTTP_HEADER_RETRY_AFTER ": 3\r\n"))
+    ret |= 8;
+  /* the handler is not called for rejected requests */
+  if (before != handled)
+    ret |= 16;
+  /* rejecting requests brings the average down again */
+  for (i = 0; i < 50; i++)
+    {
+      if (0 != request (port, "/fast", buf, sizeof (buf)))
+        ret |= 32;
+      if (0 == strncmp (buf, "HTTP/1.1 200", strlen ("HTTP/1.1 200")))
+        break;
+    }
+  if ( (50 == i) ||
+       (NULL == strstr (buf, PAGE)) )
+    ret |= 64;
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+/**
+ * Overload detection cannot be used with a thread per connection.
+ */
+static int
+test_thread_per_connection (uint16_t port)
+{
+  struct MHD_Daemon *d;
+
+  d = MHD_start_daemon (MHD_USE_THREAD_PER_CONNECTION,
+                        port,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_OVERLOAD_LATENCY, (unsigned int) LATENCY,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 0;
+  MHD_stop_daemon (d);
+  return 1;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += test_overload (MHD_USE_SELECT_INTERNALLY,
+                               1138);
+#ifdef HAVE_POLL
+  errorCount += test_overload (MHD_USE_POLL_INTERNALLY,
+                               1139);
+#endif
+#if EPOLL_SUPPORT
+  errorCount += test_overload (MHD_USE_SELECT_INTERNALLY | MHD_USE_EPOLL_LINUX_ONLY,
+                               1140);
+#endif
+  errorCount += test_thread_per_connection (1141);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,230 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_park_idle.c
+ * @brief  Testcase for #MHD_OPTION_PARK_IDLE_CONNECTIONS: idle
+ *         keep-alive connections are parked, come back for their next
+ *         request, and are closed when the client leaves or they time
+ *         out
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1206
+
+/**
+ * Number of keep-alive connections of the test.
+ */
+#define NUM_CONNECTIONS 4
+
+/**
+ * Milliseconds a connection is idle before it is parked.
+ */
+#define PARK_DELAY 50
+
+#define BODY "parked and back"
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  struct MHD_Response *response;
+  int ret;
+
+  response = MHD_create_response_from_buffer (strlen (BODY),
+                                              BODY,
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Send a request on the keep-alive connection @a sock and receive
+ * the response.
+ *
+ * @return 0 if the response arrived intact
+ */
+static int
+request (MHD_socket sock)
+{
+  static const char req[] =
+    "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  char buf[1024];
+  size_t off;
+  ssize_t got;
+
+  if (sizeof (req) - 1 != send (sock, req, sizeof (req) - 1, 0))
+    return 1;
+  off = 0;
+  while (off < sizeof (buf) - 1)
+    {
+      got = recv (sock, &buf[off], sizeof (buf) - 1 - off, 0);
+      if (got <= 0)
+        return 1;
+      off += got;
+      buf[off] = '\0';
+      if ( (off > strlen (BODY)) &&
+           (0 == strcmp (&buf[off - strlen (BODY)], BODY)) )
+        break;
+    }
+  if (0 != strncmp (buf, "HTTP/1.1 200", strlen ("HTTP/1.1 200")))
+    return 1;
+  return 0;
+}
+
+
+static uint64_t
+num_parked (struct MHD_Daemon *d)
+{
+  const union MHD_DaemonInfo *info;
+
+  info = MHD_get_daemon_info (d,
+                              MHD_DAEMON_INFO_STATS);
+  if (NULL == info)
+    abort ();
+  return info->stats.parked;
+}
+
+
+static int
+test_park (unsigned int flags)
+{
+  struct MHD_Daemon *d;
+  MHD_socket socks[NUM_CONNECTIONS];
+  unsigned int i;
+  int ret;
+
+  d = MHD_start_daemon (flags | MHD_USE_THREAD_PER_CONNECTION,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_THREAD_CACHE_SIZE, (unsigned int) 2,
+                        MHD_OPTION_PARK_IDLE_CONNECTIONS,
+                        (unsigned int) PARK_DELAY,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  for (i = 0; i < NUM_CONNECTIONS; i++)
+    {
+      socks[i] = connect_to_timeout (PORT, 5);
+      if (0 != request (socks[i]))
+        ret |= 2;
+    }
+  usleep (10 * PARK_DELAY * 1000);
+  if (NUM_CONNECTIONS != num_parked (d))
+    ret |= 4;
+  /* the parked connections serve their next request */
+  for (i = 0; i < NUM_CONNECTIONS; i++)
+    if (0 != request (socks[i]))
+      ret |= 8;
+  usleep (10 * PARK_DELAY * 1000);
+  if (NUM_CONNECTIONS != num_parked (d))
+    ret |= 16;
+  /* a client leaving is noticed while parked */
+  MHD_socket_close_ (socks[0]);
+  usleep (10 * PARK_DELAY * 1000);
+  if (NUM_CONNECTIONS - 1 != num_parked (d))
+    ret |= 32;
+  /* the remaining ones are still parked on shutdown */
+  MHD_stop_daemon (d);
+  for (i = 1; i < NUM_CONNECTIONS; i++)
+    MHD_socket_close_ (socks[i]);
+  return ret;
+}
+
+
+static int
+test_timeout (void)
+{
+  struct MHD_Daemon *d;
+  MHD_socket sock;
+  char c;
+  int ret;
+
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY |
+                        MHD_USE_THREAD_PER_CONNECTION,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_THREAD_CACHE_SIZE, (unsigned int) 2,
+                        MHD_OPTION_PARK_IDLE_CONNECTIONS,
+                        (unsigned int) PARK_DELAY,
+                        MHD_OPTION_CONNECTION_TIMEOUT, (unsigned int) 1,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  sock = connect_to_timeout (PORT, 5);
+  if (0 != request (sock))
+    ret |= 2;
+  usleep (10 * PARK_DELAY * 1000);
+  if (1 != num_parked (d))
+    ret |= 4;
+  /* the daemon closes the parked connection once it timed out */
+  if (0 != recv (sock, &c, 1, 0))
+    ret |= 8;
+  if (0 != num_parked (d))
+    ret |= 16;
+  MHD_socket_close_ (sock);
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount;
+
+  errorCount = 0;
+  errorCount |= test_park (MHD_USE_SELECT_INTERNALLY);
+  errorCount |= test_park (MHD_USE_POLL_INTERNALLY) << 8;
+  errorCount |= test_timeout () << 16;
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %d)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
+
+/* end of test_park_idle.c */
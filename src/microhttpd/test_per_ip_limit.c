@@ -0,0 +1,266 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_per_ip_limit.c
+ * @brief  Testcase for #MHD_OPTION_PER_IP_CONNECTION_LIMIT with many
+ *         client addresses connecting concurrently to a thread pool
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <poll.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1112
+
+/**
+ * Connection limit per client address.
+ */
+#define LIMIT 2
+
+/**
+ * Number of client threads.
+ */
+#define CLIENTS 4
+
+/**
+ * Number of client addresses used by each client thread.
+ */
+#define ADDRESSES 16
+
+/**
+ * Number of times each client thread runs over its addresses.
+ */
+#define ROUNDS 3
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  return MHD_NO;
+}
+
+
+/**
+ * Create a socket bound to a loopback address.
+ *
+ * @param host last byte of the 127.0.0.0/8 client address
+ * @return the socket, #MHD_INVALID_SOCKET if the address cannot be used
+ */
+static MHD_socket
+bind_to (unsigned int host)
+{
+  struct sockaddr_in sa;
+  MHD_socket sock;
+
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sock)
+    abort ();
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK + host);
+  if (0 != bind (sock, (struct sockaddr *) &sa, sizeof (sa)))
+    {
+      MHD_socket_close_ (sock);
+      return MHD_INVALID_SOCKET;
+    }
+  return sock;
+}
+
+
+/**
+ * Open a connection to the daemon from a loopback address.
+ *
+ * @param host last byte of the 127.0.0.0/8 client address
+ * @return the socket
+ */
+static MHD_socket
+connect_from (unsigned int host)
+{
+  struct sockaddr_in sa;
+  MHD_socket sock;
+
+  if (MHD_INVALID_SOCKET == (sock = bind_to (host)))
+    abort ();
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (sock,
+                    (struct sockaddr *) &sa,
+                    sizeof (sa)))
+    abort ();
+  return sock;
+}
+
+
+/**
+ * Check whether the daemon has closed a connection by now.
+ *
+ * @param sock the connection
+ * @return #MHD_YES if the connection was closed by the daemon
+ */
+static int
+is_closed (MHD_socket sock)
+{
+  struct pollfd p;
+  char c;
+
+  p.fd = sock;
+  p.events = POLLIN;
+  p.revents = 0;
+  if (1 != poll (&p, 1, 0))
+    return MHD_NO;
+  return (0 >= recv (sock, &c, 1, 0)) ? MHD_YES : MHD_NO;
+}
+
+
+/**
+ * Open connections beyond the limit from the addresses of one
+ * client thread and check that exactly the excess ones are refused.
+ * Which connections of an address are refused is not checked, as
+ * the worker threads accept connections concurrently.
+ *
+ * @param cls pointer to the number of the client thread, replaced
+ *        by the number of errors
+ * @return NULL
+ */
+static void *
+client (void *cls)
+{
+  unsigned int *id = cls;
+  MHD_socket socks[ADDRESSES][LIMIT + 1];
+  unsigned int round;
+  unsigned int closed;
+  unsigned int i;
+  unsigned int j;
+  unsigned int errors;
+
+  errors = 0;
+  for (round = 0; round < ROUNDS; round++)
+    {
+      for (i = 0; i < ADDRESSES; i++)
+        for (j = 0; j < LIMIT + 1; j++)
+          socks[i][j] = connect_from (1 + *id * ADDRESSES + i);
+      /* give the daemon time to accept or refuse the connections */
+      usleep (250000);
+      for (i = 0; i < ADDRESSES; i++)
+        {
+          closed = 0;
+          for (j = 0; j < LIMIT + 1; j++)
+            {
+              if (MHD_YES == is_closed (socks[i][j]))
+                closed++;
+              MHD_socket_close_ (socks[i][j]);
+            }
+          if (1 != closed)
+            errors++;
+        }
+      /* give the daemon time to notice that the connections are gone */
+      usleep (200000);
+    }
+  *id = errors;
+  return NULL;
+}
+
+
+/**
+ * Run all client threads against a daemon.
+ *
+ * @param pool_size number of worker threads of the daemon
+ * @return 0 on success
+ */
+static int
+check_limit (unsigned int pool_size)
+{
+  struct MHD_Daemon *d;
+  pthread_t clients[CLIENTS];
+  unsigned int ids[CLIENTS];
+  unsigned int i;
+  int ret;
+
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_PER_IP_CONNECTION_LIMIT, LIMIT,
+                        MHD_OPTION_THREAD_POOL_SIZE, pool_size,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  for (i = 0; i < CLIENTS; i++)
+    {
+      ids[i] = i;
+      if (0 != pthread_create (&clients[i], NULL, &client, &ids[i]))
+        abort ();
+    }
+  ret = 0;
+  for (i = 0; i < CLIENTS; i++)
+    {
+      pthread_join (clients[i], NULL);
+      if (0 != ids[i])
+        {
+          fprintf (stderr,
+                   "Client %u saw %u addresses with wrong limits with %u workers\n",
+                   i, ids[i], pool_size);
+          ret = 2;
+        }
+    }
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+  MHD_socket sock;
+
+  /* only some platforms route all of 127.0.0.0/8 to the loopback */
+  if (MHD_INVALID_SOCKET == (sock = bind_to (CLIENTS * ADDRESSES)))
+    return 77;
+  MHD_socket_close_ (sock);
+  errorCount += check_limit (4);
+  errorCount += check_limit (0);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,218 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_pipe_response.c
+ * @brief  Testcase for responses created with
+ *         #MHD_create_response_from_pipe()
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1111
+
+/**
+ * Size of the body; larger than the capacity of a pipe.
+ */
+#define BODY_SIZE (200 * 1024)
+
+/**
+ * Read end of the pipe or socket the body is read from.
+ */
+static int body_fd;
+
+
+static char
+body_byte (size_t pos)
+{
+  return 'a' + pos % 23;
+}
+
+
+/**
+ * Write the body into the descriptor given as @a cls in small
+ * pieces, then close it.
+ */
+static void *
+producer (void *cls)
+{
+  int fd = *(int *) cls;
+  char buf[1000];
+  size_t pos;
+  size_t i;
+  size_t n;
+  ssize_t got;
+
+  for (pos = 0; pos < BODY_SIZE; pos += n)
+    {
+      n = BODY_SIZE - pos;
+      if (n > sizeof (buf))
+        n = sizeof (buf);
+      for (i = 0; i < n; i++)
+        buf[i] = body_byte (pos + i);
+      got = write (fd, buf, n);
+      if (got <= 0)
+        break;
+      n = got;
+    }
+  (void) close (fd);
+  return NULL;
+}
+
+
+static int
+ahc_pipe (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_pipe (body_fd);
+  if (NULL == response)
+    return MHD_NO;
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Fetch the body produced into @a fds and check the reply.
+ *
+ * @param fds pipe or socket pair to produce the body with
+ * @return 0 on success
+ */
+static int
+check_pipe (int fds[2])
+{
+  static char reply[BODY_SIZE + 1024];
+  /* no "Connection: close", the body must not be chunked anyway */
+  const char *request = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  MHD_socket sock;
+  struct sockaddr_in sa;
+  pthread_t thread;
+  const char *body;
+  size_t have;
+  size_t i;
+  ssize_t got;
+
+  body_fd = fds[0];
+  if (0 != pthread_create (&thread, NULL, &producer, &fds[1]))
+    abort ();
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sock)
+    abort ();
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (sock,
+                    (struct sockaddr *) &sa,
+                    sizeof (sa)))
+    abort ();
+  if (strlen (request) !=
+      (size_t) write (sock, request, strlen (request)))
+    abort ();
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          (0 < (got = read (sock, &reply[have], sizeof (reply) - 1 - have))) )
+    have += got;
+  reply[have] = '\0';
+  MHD_socket_close_ (sock);
+  pthread_join (thread, NULL);
+  body = strstr (reply, "\r\n\r\n");
+  if ( (NULL == body) ||
+       (0 != strncmp (reply, "HTTP/1.1 200 OK\r\n", strlen ("HTTP/1.1 200 OK\r\n"))) )
+    return 1;
+  if ( (NULL != strstr (reply, "Transfer-Encoding")) ||
+       (NULL == strstr (reply, "\r\nConnection: close\r\n")) )
+    {
+      fprintf (stderr, "Unexpected header: `%.*s'\n",
+               (int) (body - reply), reply);
+      return 2;
+    }
+  body += 4;
+  if (BODY_SIZE != &reply[have] - body)
+    {
+      fprintf (stderr, "Got %u bytes of body\n",
+               (unsigned int) (&reply[have] - body));
+      return 4;
+    }
+  for (i = 0; i < BODY_SIZE; i++)
+    if (body[i] != body_byte (i))
+      return 8;
+  return 0;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  struct MHD_Daemon *d;
+  int fds[2];
+  int errorCount = 0;
+
+#if ! HAVE_SPLICE
+  return 77;
+#endif
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_pipe, NULL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  if (0 != pipe (fds))
+    abort ();
+  errorCount += check_pipe (fds);
+  if (0 != socketpair (AF_UNIX, SOCK_STREAM, 0, fds))
+    abort ();
+  errorCount += 16 * check_pipe (fds);
+  MHD_stop_daemon (d);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,173 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_pipeline.c
+ * @brief  Testcase for pipelined HTTP/1.1 requests, with and without
+ *         #MHD_OPTION_PIPELINE_CORK
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+/**
+ * Number of pipelined requests to send.
+ */
+#define NUM_REQUESTS 16
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  unsigned int *calls = cls;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  (*calls)++;
+  response = MHD_create_response_from_buffer (strlen (url),
+                                              (void *) url,
+                                              MHD_RESPMEM_MUST_COPY);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Send #NUM_REQUESTS requests with a single write and check that
+ * all responses arrive, in order.
+ *
+ * @param flags daemon flags to use
+ * @param cork value for #MHD_OPTION_PIPELINE_CORK
+ * @param port port to use
+ * @return 0 on success
+ */
+static int
+test_pipeline (unsigned int flags,
+               unsigned int cork,
+               uint16_t port)
+{
+  struct MHD_Daemon *d;
+  MHD_socket sock;
+  char req[NUM_REQUESTS * 128];
+  char reply[NUM_REQUESTS * 256];
+  char url[32];
+  const char *pos;
+  size_t len;
+  size_t have;
+  ssize_t got;
+  unsigned int calls;
+  unsigned int i;
+  int ret;
+
+  calls = 0;
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        port,
+                        NULL, NULL,
+                        &ahc_echo, &calls,
+                        MHD_OPTION_PIPELINE_CORK, cork,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  len = 0;
+  for (i = 0; i < NUM_REQUESTS; i++)
+    len += snprintf (&req[len],
+                     sizeof (req) - len,
+                     "GET /r%u HTTP/1.1\r\nHost: localhost\r\n%s\r\n",
+                     i,
+                     (NUM_REQUESTS - 1 == i) ? "Connection: close\r\n" : "");
+  sock = connect_to (port);
+  if (len != (size_t) write (sock, req, len))
+    ret |= 2;
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          (0 < (got = read (sock, &reply[have], sizeof (reply) - 1 - have))) )
+    have += got;
+  reply[have] = '\0';
+  MHD_socket_close_ (sock);
+  MHD_stop_daemon (d);
+  if (NUM_REQUESTS != calls)
+    ret |= 4;
+  pos = reply;
+  for (i = 0; i < NUM_REQUESTS; i++)
+    {
+      if (0 != strncmp (pos, "HTTP/1.1 200", strlen ("HTTP/1.1 200")))
+        {
+          ret |= 8;
+          break;
+        }
+      snprintf (url, sizeof (url), "\r\n\r\n/r%u", i);
+      if (NULL == (pos = strstr (pos, url)))
+        {
+          ret |= 16;
+          break;
+        }
+      pos += strlen (url);
+    }
+  if ( (NUM_REQUESTS == i) &&
+       ('\0' != *pos) )
+    ret |= 32;
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += test_pipeline (MHD_USE_SELECT_INTERNALLY, MHD_NO, 1102);
+  errorCount += test_pipeline (MHD_USE_SELECT_INTERNALLY, MHD_YES, 1102);
+  errorCount += test_pipeline (MHD_USE_THREAD_PER_CONNECTION, MHD_YES, 1102);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_EPOLL))
+    errorCount += test_pipeline (MHD_USE_SELECT_INTERNALLY | MHD_USE_EPOLL_LINUX_ONLY,
+                                 MHD_YES,
+                                 1102);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,183 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_poll_set.c
+ * @brief  Testcase for the poll set kept across iterations of the
+ *         poll() event loop: connections are added beyond its initial
+ *         size and removed from its middle while others stay open
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+
+/**
+ * Number of connections to open, more than the initial size of the
+ * poll set.
+ */
+#define NUM_CONNECTIONS 70
+
+#define REQUEST "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n"
+
+#define PAGE "poll set"
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_buffer (strlen (PAGE),
+                                              (void *) PAGE,
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection,
+                            MHD_HTTP_OK,
+                            response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Send a request on @a sock and check that the complete response
+ * arrives within a second.
+ *
+ * @return 0 on success
+ */
+static int
+request (MHD_socket sock)
+{
+  char buf[1024];
+  size_t off;
+  ssize_t got;
+  fd_set rs;
+  struct timeval tv;
+
+  if (strlen (REQUEST) != (size_t) write (sock, REQUEST, strlen (REQUEST)))
+    return 1;
+  off = 0;
+  buf[0] = '\0';
+  while (NULL == strstr (buf, PAGE))
+    {
+      FD_ZERO (&rs);
+      FD_SET (sock, &rs);
+      tv.tv_sec = 1;
+      tv.tv_usec = 0;
+      if (1 != select (sock + 1, &rs, NULL, NULL, &tv))
+        return 2;
+      got = read (sock, &buf[off], sizeof (buf) - 1 - off);
+      if (0 >= got)
+        return 4;
+      off += got;
+      buf[off] = '\0';
+      if (sizeof (buf) - 1 == off)
+        return 8;
+    }
+  if (0 != strncmp (buf, "HTTP/1.1 200", strlen ("HTTP/1.1 200")))
+    return 16;
+  return 0;
+}
+
+
+static int
+test_poll_set (unsigned int pool_size,
+               uint16_t port)
+{
+  struct MHD_Daemon *d;
+  MHD_socket socks[NUM_CONNECTIONS];
+  unsigned int i;
+  unsigned int round;
+  int ret;
+
+  d = MHD_start_daemon (MHD_USE_POLL_INTERNALLY | MHD_USE_DEBUG,
+                        port,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_THREAD_POOL_SIZE, pool_size,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  for (i = 0; i < NUM_CONNECTIONS; i++)
+    socks[i] = connect_to (port);
+  for (i = 0; i < NUM_CONNECTIONS; i++)
+    ret |= request (socks[i]);
+  /* close every third connection, the entries of the remaining ones
+     are moved around in the poll set */
+  for (i = 0; i < NUM_CONNECTIONS; i += 3)
+    {
+      MHD_socket_close_ (socks[i]);
+      socks[i] = MHD_INVALID_SOCKET;
+    }
+  for (round = 0; round < 2; round++)
+    for (i = NUM_CONNECTIONS; i > 0; i--)
+      if (MHD_INVALID_SOCKET != socks[i - 1])
+        ret |= request (socks[i - 1]) << 5;
+  for (i = 0; i < NUM_CONNECTIONS; i++)
+    if (MHD_INVALID_SOCKET != socks[i])
+      MHD_socket_close_ (socks[i]);
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+#ifdef HAVE_POLL
+  errorCount += test_poll_set (0,
+                               1120);
+  errorCount += test_poll_set (2,
+                               1121);
+#endif
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
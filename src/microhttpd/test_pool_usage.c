@@ -0,0 +1,236 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_pool_usage.c
+ * @brief  Testcase for the memory pool telemetry: the peak pool usage
+ *         of closed connections is recorded, and failed allocations
+ *         are counted by call site
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+
+/**
+ * Memory limit of the connections.
+ */
+#define POOL_LIMIT 4096
+
+/**
+ * Number of requests sent on one keep-alive connection.
+ */
+#define NUM_REQUESTS 3
+
+/**
+ * Number of headers of a request that does not fit into the memory
+ * pool once the headers are parsed.
+ */
+#define NUM_HEADERS 200
+
+#define REQUEST "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n"
+
+#define PAGE "pool usage"
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_buffer (strlen (PAGE),
+                                              (void *) PAGE,
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection,
+                            MHD_HTTP_OK,
+                            response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Send @a req on @a sock and wait for a response that contains
+ * @a expect, or for the daemon to close the connection if @a expect
+ * is NULL.
+ *
+ * @return 0 on success
+ */
+static int
+exchange (MHD_socket sock,
+          const char *req,
+          size_t req_size,
+          const char *expect)
+{
+  char buf[1024];
+  size_t off;
+  ssize_t got;
+  fd_set rs;
+  struct timeval tv;
+
+  if (req_size != (size_t) write (sock, req, req_size))
+    return 1;
+  off = 0;
+  buf[0] = '\0';
+  while ( (NULL == expect) ||
+          (NULL == strstr (buf, expect)) )
+    {
+      FD_ZERO (&rs);
+      FD_SET (sock, &rs);
+      tv.tv_sec = 5;
+      tv.tv_usec = 0;
+      if (1 != select (sock + 1, &rs, NULL, NULL, &tv))
+        return 2;
+      got = read (sock, &buf[off], sizeof (buf) - 1 - off);
+      if (0 >= got)
+        return (NULL == expect) ? 0 : 4;
+      off += got;
+      buf[off] = '\0';
+      if (sizeof (buf) - 1 == off)
+        off = 0;
+    }
+  return 0;
+}
+
+
+static int
+test_pool_usage (unsigned int pool_size,
+                 uint16_t port)
+{
+  struct MHD_Daemon *d;
+  const union MHD_DaemonInfo *info;
+  struct MHD_LatencyHistogram histogram;
+  MHD_socket sock;
+  char *big;
+  size_t off;
+  unsigned int i;
+  int ret;
+
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        port,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_THREAD_POOL_SIZE, pool_size,
+                        MHD_OPTION_CONNECTION_MEMORY_LIMIT, (size_t) POOL_LIMIT,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  /* requests on a keep-alive connection */
+  sock = connect_to (port);
+  for (i = 0; i < NUM_REQUESTS; i++)
+    ret |= exchange (sock, REQUEST, strlen (REQUEST), PAGE) << 1;
+  MHD_socket_close_ (sock);
+  /* a request line that does not fit into the read buffer */
+  big = malloc (2 * POOL_LIMIT);
+  if (NULL == big)
+    abort ();
+  memset (big, 'a', 2 * POOL_LIMIT);
+  memcpy (big, "GET /", strlen ("GET /"));
+  sock = connect_to (port);
+  ret |= exchange (sock, big, 2 * POOL_LIMIT, NULL) << 1;
+  MHD_socket_close_ (sock);
+  /* headers that fit into the read buffer, but not into the pool
+     once they are parsed */
+  off = sprintf (big, "GET / HTTP/1.1\r\nHost: localhost\r\n");
+  for (i = 0; i < NUM_HEADERS; i++)
+    off += sprintf (&big[off], "X-%u: a\r\n", i);
+  off += sprintf (&big[off], "\r\n");
+  sock = connect_to (port);
+  ret |= exchange (sock, big, off, NULL) << 1;
+  MHD_socket_close_ (sock);
+  free (big);
+  /* the connections are cleaned up by the worker threads */
+  usleep (100 * 1000);
+  info = MHD_get_daemon_info (d,
+                              MHD_DAEMON_INFO_STATS);
+  if (NULL == info)
+    abort ();
+  if (0 == info->stats.pool_fail_read_buffer)
+    ret |= 16;
+  if (0 == info->stats.pool_fail_headers)
+    ret |= 32;
+  /* the error responses may not fit either, so write buffer failures
+     are possible, but nothing else was allocated */
+  if (0 != info->stats.pool_fail_other)
+    ret |= 64;
+  MHD_get_pool_usage_histogram (d,
+                                &histogram);
+  if (3 != histogram.count)
+    ret |= 128;
+  /* every connection used its pool, none beyond the limit */
+  if ( (0 == MHD_latency_histogram_percentile (&histogram, 0.0)) ||
+       (MHD_latency_histogram_percentile (&histogram, 100.0) >
+        POOL_LIMIT + POOL_LIMIT / 16) )
+    ret |= 256;
+  MHD_stop_daemon (d);
+  if (0 != ret)
+    fprintf (stderr,
+             "read %llu, headers %llu, write %llu, other %llu, connections %llu, peak %llu\n",
+             (unsigned long long) info->stats.pool_fail_read_buffer,
+             (unsigned long long) info->stats.pool_fail_headers,
+             (unsigned long long) info->stats.pool_fail_write_buffer,
+             (unsigned long long) info->stats.pool_fail_other,
+             (unsigned long long) histogram.count,
+             (unsigned long long) MHD_latency_histogram_percentile (&histogram, 100.0));
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += test_pool_usage (0,
+                                 1157);
+  errorCount += test_pool_usage (2,
+                                 1158);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
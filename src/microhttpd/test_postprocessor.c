@@ -27,6 +27,7 @@
 #include "platform.h"
 #include "microhttpd.h"
 #include "internal.h"
+#include "memorypool.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -66,6 +67,11 @@ const char *want[] = {
   "key2", NULL, NULL, NULL, "",
   "key3", NULL, NULL, NULL, "",
 #define URL_EMPTY_VALUE_END (URL_EMPTY_VALUE_START + 15)
+  NULL, NULL, NULL, NULL, NULL,
+#define FORM_DASHES_DATA "--AaB03x\r\ncontent-disposition: form-data; name=\"dashes\"\r\n\r\n---\r\n--\r\n--AaB03\r\n--AaB03y--\r\n-AaB03x\r\n--AaB03x--\r\n"
+#define FORM_DASHES_START (URL_EMPTY_VALUE_END + 5)
+  "dashes", NULL, NULL, NULL, "---\r\n--\r\n--AaB03\r\n--AaB03y--\r\n-AaB03x",
+#define FORM_DASHES_END (FORM_DASHES_START + 5)
   NULL, NULL, NULL, NULL, NULL
 };
 
@@ -134,6 +140,8 @@ test_urlencoding ()
   connection.headers_received = &header;
   header.header = MHD_HTTP_HEADER_CONTENT_TYPE;
   header.value = MHD_HTTP_POST_ENCODING_FORM_URLENCODED;
+  header.header_size = strlen (header.header);
+  header.value_size = strlen (header.value);
   header.kind = MHD_HEADER_KIND;
   pp = MHD_create_post_processor (&connection,
                                   1024, &value_checker, &want_off);
@@ -180,6 +188,8 @@ test_multipart_garbage ()
     header.header = MHD_HTTP_HEADER_CONTENT_TYPE;
     header.value =
       MHD_HTTP_POST_ENCODING_MULTIPART_FORMDATA ", boundary=AaB03x";
+    header.header_size = strlen (header.header);
+    header.value_size = strlen (header.value);
     header.kind = MHD_HEADER_KIND;
     pp = MHD_create_post_processor (&connection,
                                     1024, &value_checker, &want_off);
@@ -213,6 +223,8 @@ test_multipart_splits ()
     header.header = MHD_HTTP_HEADER_CONTENT_TYPE;
     header.value =
       MHD_HTTP_POST_ENCODING_MULTIPART_FORMDATA ", boundary=AaB03x";
+    header.header_size = strlen (header.header);
+    header.value_size = strlen (header.value);
     header.kind = MHD_HEADER_KIND;
     pp = MHD_create_post_processor (&connection,
                                     1024, &value_checker, &want_off);
@@ -226,6 +238,321 @@ test_multipart_splits ()
 }
 
 
+/**
+ * Check that near-misses of the boundary inside a value
+ * are passed on as data, for all ways of splitting the input.
+ */
+static int
+test_multipart_dashes ()
+{
+  struct MHD_Connection connection;
+  struct MHD_HTTP_Header header;
+  struct MHD_PostProcessor *pp;
+  unsigned int want_off;
+  size_t size;
+  size_t splitpoint;
+
+  size = strlen (FORM_DASHES_DATA);
+  for (splitpoint = 1; splitpoint < size; splitpoint++)
+  {
+    want_off = FORM_DASHES_START;
+    memset (&connection, 0, sizeof (struct MHD_Connection));
+    memset (&header, 0, sizeof (struct MHD_HTTP_Header));
+    connection.headers_received = &header;
+    header.header = MHD_HTTP_HEADER_CONTENT_TYPE;
+    header.value =
+      MHD_HTTP_POST_ENCODING_MULTIPART_FORMDATA ", boundary=AaB03x";
+    header.header_size = strlen (header.header);
+    header.value_size = strlen (header.value);
+    header.kind = MHD_HEADER_KIND;
+    pp = MHD_create_post_processor (&connection,
+                                    1024, &value_checker, &want_off);
+    MHD_post_process (pp, FORM_DASHES_DATA, splitpoint);
+    MHD_post_process (pp, &FORM_DASHES_DATA[splitpoint], size - splitpoint);
+    MHD_destroy_post_processor (pp);
+    if (want_off != FORM_DASHES_END)
+      return 64;
+  }
+  return 0;
+}
+
+
+/**
+ * Feed @a data to a post processor with
+ * #MHD_POST_PROCESSOR_OPTION_ZERO_COPY in two parts,
+ * for all ways of splitting it.
+ *
+ * @return 0 on success
+ */
+static int
+test_zero_copy_splits (const char *data,
+                       unsigned int start,
+                       unsigned int end)
+{
+  struct MHD_Connection connection;
+  struct MHD_HTTP_Header header;
+  struct MHD_PostProcessor *pp;
+  unsigned int want_off;
+  size_t size;
+  size_t splitpoint;
+
+  size = strlen (data);
+  for (splitpoint = 1; splitpoint < size; splitpoint++)
+  {
+    want_off = start;
+    memset (&connection, 0, sizeof (struct MHD_Connection));
+    memset (&header, 0, sizeof (struct MHD_HTTP_Header));
+    connection.headers_received = &header;
+    header.header = MHD_HTTP_HEADER_CONTENT_TYPE;
+    header.value =
+      MHD_HTTP_POST_ENCODING_MULTIPART_FORMDATA ", boundary=AaB03x";
+    header.header_size = strlen (header.header);
+    header.value_size = strlen (header.value);
+    header.kind = MHD_HEADER_KIND;
+    pp = MHD_create_post_processor (&connection,
+                                    1024, &value_checker, &want_off);
+    if (MHD_YES != MHD_set_post_processor_option (pp,
+                                                  MHD_POST_PROCESSOR_OPTION_ZERO_COPY,
+                                                  MHD_YES))
+      return 1;
+    MHD_post_process (pp, data, splitpoint);
+    MHD_post_process (pp, &data[splitpoint], size - splitpoint);
+    MHD_destroy_post_processor (pp);
+    if (want_off != end)
+      return 1;
+  }
+  return 0;
+}
+
+
+static int
+test_zero_copy ()
+{
+  if (0 != test_zero_copy_splits (FORM_DATA, FORM_START, FORM_END))
+    return 128;
+  if (0 != test_zero_copy_splits (FORM_NESTED_DATA,
+                                  FORM_NESTED_START,
+                                  FORM_NESTED_END))
+    return 256;
+  if (0 != test_zero_copy_splits (FORM_DASHES_DATA,
+                                  FORM_DASHES_START,
+                                  FORM_DASHES_END))
+    return 512;
+  return 0;
+}
+
+
+/**
+ * File #spool_open spools to, NULL to ask for a temporary file.
+ */
+static FILE *spool_file;
+
+/**
+ * Number of parts for which #spool_done was called with the
+ * expected content.
+ */
+static unsigned int spool_ok;
+
+
+static int
+spool_open (void *cls,
+            const char *key,
+            const char *filename,
+            const char *content_type,
+            const char *transfer_encoding)
+{
+  if ( (0 != strcmp (key, "pics")) ||
+       (0 != strcmp (filename, "file1.txt")) )
+    return -1;
+  if (NULL == spool_file)
+    return MHD_POST_SPOOL_TEMP_FILE;
+  return fileno (spool_file);
+}
+
+
+static int
+spool_done (void *cls,
+            const char *key,
+            const char *filename,
+            const char *content_type,
+            const char *transfer_encoding,
+            int fd,
+            uint64_t size)
+{
+  char buf[16];
+
+  if ( (size != strlen ("filedata")) ||
+       (0 != strcmp (content_type, "text/plain")) ||
+       (-1 == fd) ||
+       ( (NULL != spool_file) &&
+         (fd != fileno (spool_file)) ) ||
+       ((off_t) -1 == lseek (fd, 0, SEEK_SET)) ||
+       (size != read (fd, buf, sizeof (buf))) ||
+       (0 != memcmp (buf, "filedata", size)) )
+    return MHD_NO;
+  spool_ok++;
+  return MHD_YES;
+}
+
+
+/**
+ * Spool the file part of #FORM_DATA, either to a temporary file
+ * created by MHD (if @a temp is non-zero) or to our own file.
+ *
+ * @return 0 on success
+ */
+static int
+test_spool_file (int temp)
+{
+  struct MHD_Connection connection;
+  struct MHD_HTTP_Header header;
+  struct MHD_PostProcessor *pp;
+  unsigned int want_off;
+  int i;
+  int delta;
+  size_t size;
+  int ret;
+
+  spool_file = NULL;
+  if ( (0 == temp) &&
+       (NULL == (spool_file = tmpfile ())) )
+    return 1;
+  spool_ok = 0;
+  want_off = FORM_START;
+  memset (&connection, 0, sizeof (struct MHD_Connection));
+  memset (&header, 0, sizeof (struct MHD_HTTP_Header));
+  connection.headers_received = &header;
+  header.header = MHD_HTTP_HEADER_CONTENT_TYPE;
+  header.value =
+    MHD_HTTP_POST_ENCODING_MULTIPART_FORMDATA ", boundary=AaB03x";
+  header.header_size = strlen (header.header);
+  header.value_size = strlen (header.value);
+  header.kind = MHD_HEADER_KIND;
+  pp = MHD_create_post_processor (&connection,
+                                  1024, &value_checker, &want_off);
+  if (MHD_YES != MHD_set_post_processor_option (pp,
+                                                MHD_POST_PROCESSOR_OPTION_SPOOL,
+                                                &spool_open,
+                                                &spool_done,
+                                                NULL))
+    return 1;
+  i = 0;
+  size = strlen (FORM_DATA);
+  while (i < size)
+    {
+      delta = 1 + MHD_random_ () % (size - i);
+      MHD_post_process (pp, &FORM_DATA[i], delta);
+      i += delta;
+    }
+  ret = MHD_destroy_post_processor (pp);
+  if (NULL != spool_file)
+    fclose (spool_file);
+  /* only "field1" goes to the iterator */
+  if ( (MHD_YES != ret) ||
+       (want_off != FORM_START + 5) ||
+       (1 != spool_ok) )
+    return 1;
+  return 0;
+}
+
+
+static int
+test_spool ()
+{
+  if (0 != test_spool_file (0))
+    return 1024;
+#ifdef HAVE_MKSTEMP
+  if (0 != test_spool_file (1))
+    return 2048;
+#endif
+  return 0;
+}
+
+
+#define URL_BATCH_DATA "abc=def&x=5&y=%41+b&z\r\n"
+
+/**
+ * Fields expected from #URL_BATCH_DATA.
+ */
+static const char *const want_batch[] = {
+  "abc", "def",
+  "x", "5",
+  "y", "A b",
+  "z", NULL
+};
+
+
+static int
+batch_checker (void *cls,
+               const struct MHD_PostField *fields,
+               unsigned int num_fields)
+{
+  unsigned int *batch_off = cls;
+  unsigned int i;
+
+  for (i = 0; i < num_fields; i++)
+    {
+      if ( (*batch_off >= sizeof (want_batch) / sizeof (want_batch[0])) ||
+           (fields[i].key_size != strlen (fields[i].key)) ||
+           (0 != strcmp (fields[i].key, want_batch[*batch_off])) ||
+           (mismatch (fields[i].value, want_batch[*batch_off + 1])) ||
+           ( (NULL != fields[i].value) &&
+             (fields[i].value_size != strlen (fields[i].value)) ) )
+        return MHD_NO;
+      *batch_off += 2;
+    }
+  return MHD_YES;
+}
+
+
+/**
+ * Check #MHD_POST_PROCESSOR_OPTION_BATCH for all ways of
+ * splitting the input in two parts.
+ */
+static int
+test_urlencoding_batch ()
+{
+  struct MHD_Connection connection;
+  struct MHD_HTTP_Header header;
+  struct MHD_PostProcessor *pp;
+  unsigned int want_off;
+  unsigned int batch_off;
+  size_t size;
+  size_t splitpoint;
+
+  size = strlen (URL_BATCH_DATA);
+  for (splitpoint = 1; splitpoint <= size; splitpoint++)
+  {
+    want_off = URL_START;
+    batch_off = 0;
+    memset (&connection, 0, sizeof (struct MHD_Connection));
+    memset (&header, 0, sizeof (struct MHD_HTTP_Header));
+    connection.pool = MHD_pool_create (512);
+    connection.headers_received = &header;
+    header.header = MHD_HTTP_HEADER_CONTENT_TYPE;
+    header.value = MHD_HTTP_POST_ENCODING_FORM_URLENCODED;
+    header.header_size = strlen (header.header);
+    header.value_size = strlen (header.value);
+    header.kind = MHD_HEADER_KIND;
+    pp = MHD_create_post_processor (&connection,
+                                    1024, &value_checker, &want_off);
+    if (MHD_YES != MHD_set_post_processor_option (pp,
+                                                  MHD_POST_PROCESSOR_OPTION_BATCH,
+                                                  &batch_checker,
+                                                  &batch_off))
+      return 4096;
+    MHD_post_process (pp, URL_BATCH_DATA, splitpoint);
+    MHD_post_process (pp, &URL_BATCH_DATA[splitpoint], size - splitpoint);
+    MHD_destroy_post_processor (pp);
+    MHD_pool_destroy (connection.pool);
+    if ( (want_off != URL_START) ||
+         (batch_off != sizeof (want_batch) / sizeof (want_batch[0])) )
+      return 4096;
+  }
+  return 0;
+}
+
+
 static int
 test_multipart ()
 {
@@ -243,6 +570,8 @@ test_multipart ()
   header.header = MHD_HTTP_HEADER_CONTENT_TYPE;
   header.value =
     MHD_HTTP_POST_ENCODING_MULTIPART_FORMDATA ", boundary=AaB03x";
+  header.header_size = strlen (header.header);
+  header.value_size = strlen (header.value);
   header.kind = MHD_HEADER_KIND;
   pp = MHD_create_post_processor (&connection,
                                   1024, &value_checker, &want_off);
@@ -278,6 +607,8 @@ test_nested_multipart ()
   header.header = MHD_HTTP_HEADER_CONTENT_TYPE;
   header.value =
     MHD_HTTP_POST_ENCODING_MULTIPART_FORMDATA ", boundary=AaB03x";
+  header.header_size = strlen (header.header);
+  header.value_size = strlen (header.value);
   header.kind = MHD_HEADER_KIND;
   pp = MHD_create_post_processor (&connection,
                                   1024, &value_checker, &want_off);
@@ -312,6 +643,8 @@ test_empty_value ()
   connection.headers_received = &header;
   header.header = MHD_HTTP_HEADER_CONTENT_TYPE;
   header.value = MHD_HTTP_POST_ENCODING_FORM_URLENCODED;
+  header.header_size = strlen (header.header);
+  header.value_size = strlen (header.value);
   header.kind = MHD_HEADER_KIND;
   pp = MHD_create_post_processor (&connection,
                                   1024, &value_checker, &want_off);
@@ -339,7 +672,11 @@ main (int argc, char *const *argv)
 
   errorCount += test_multipart_splits ();
   errorCount += test_multipart_garbage ();
+  errorCount += test_multipart_dashes ();
+  errorCount += test_zero_copy ();
+  errorCount += test_spool ();
   errorCount += test_urlencoding ();
+  errorCount += test_urlencoding_batch ();
   errorCount += test_multipart ();
   errorCount += test_nested_multipart ();
   errorCount += test_empty_value ();
@@ -0,0 +1,282 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_prefetch.c
+ * @brief  Testcase for #MHD_RF_PREFETCH: blocks of the body are read
+ *         ahead on the handler threads, arrive intact and in order,
+ *         and connections closed by the client meanwhile are cleaned
+ *         up safely
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1205
+
+/**
+ * Size of the response body.
+ */
+#define BODY_SIZE (1024 * 1024)
+
+/**
+ * Size of the blocks of the body.
+ */
+#define BLOCK_SIZE (16 * 1024)
+
+/**
+ * State of the content reader of one response.
+ */
+struct Reader
+{
+  /**
+   * Thread the first block was read on (the event loop).
+   */
+  pthread_t event_loop;
+
+  /**
+   * Position the next call must ask for.
+   */
+  uint64_t next;
+
+  /**
+   * Non-zero while the reader runs.
+   */
+  int busy;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Number of blocks read on other threads than the event loop.
+ */
+static unsigned int prefetched;
+
+/**
+ * Non-zero if the reader was called out of order or concurrently.
+ */
+static int reader_error;
+
+
+static ssize_t
+slow_reader (void *cls,
+             uint64_t pos,
+             char *buf,
+             size_t max)
+{
+  struct Reader *r = cls;
+  size_t i;
+
+  pthread_mutex_lock (&lock);
+  if ( (r->busy) ||
+       (pos != r->next) )
+    reader_error = 1;
+  r->busy = 1;
+  if (0 == pos)
+    r->event_loop = pthread_self ();
+  else if (! pthread_equal (r->event_loop, pthread_self ()))
+    prefetched++;
+  pthread_mutex_unlock (&lock);
+  /* pretend to wait for the disk */
+  usleep (1000);
+  if (max > BODY_SIZE - pos)
+    max = BODY_SIZE - pos;
+  for (i = 0; i < max; i++)
+    buf[i] = (char) ('a' + (pos + i) % 26);
+  pthread_mutex_lock (&lock);
+  r->next = pos + max;
+  r->busy = 0;
+  pthread_mutex_unlock (&lock);
+  return max;
+}
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  struct MHD_Response *response;
+  struct Reader *r;
+  int ret;
+
+  r = calloc (1, sizeof (struct Reader));
+  if (NULL == r)
+    return MHD_NO;
+  response = MHD_create_response_from_callback (BODY_SIZE,
+                                                BLOCK_SIZE,
+                                                &slow_reader,
+                                                r,
+                                                &free);
+  MHD_set_response_options (response,
+                            MHD_RF_PREFETCH,
+                            MHD_RO_END);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Open a connection to the daemon and send a request.
+ *
+ * @return the socket
+ */
+static MHD_socket
+send_request (void)
+{
+  static const char req[] =
+    "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  struct sockaddr_in sa;
+  struct timeval tv;
+  MHD_socket sock;
+
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sock)
+    abort ();
+  tv.tv_sec = 5;
+  tv.tv_usec = 0;
+  setsockopt (sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (sock,
+                    (struct sockaddr *) &sa,
+                    sizeof (sa)))
+    abort ();
+  if (sizeof (req) - 1 != send (sock, req, sizeof (req) - 1, 0))
+    abort ();
+  return sock;
+}
+
+
+/**
+ * Receive the response to a request sent with send_request().
+ *
+ * @param sock socket to read from
+ * @param limit number of bytes after which to stop reading
+ * @return 0 if the body arrived intact (or the first @a limit
+ *         bytes were received)
+ */
+static int
+get_response (MHD_socket sock,
+              size_t limit)
+{
+  char *buf;
+  char *body;
+  size_t off;
+  size_t i;
+  ssize_t got;
+  int ret;
+
+  buf = malloc (BODY_SIZE + 1024);
+  if (NULL == buf)
+    abort ();
+  off = 0;
+  body = NULL;
+  ret = 1;
+  while (off < BODY_SIZE + 1023)
+    {
+      got = recv (sock, &buf[off], BODY_SIZE + 1023 - off, 0);
+      if (got <= 0)
+        break;
+      off += got;
+      if (off >= limit)
+        {
+          ret = 0;
+          break;
+        }
+      buf[off] = '\0';
+      if ( (NULL == body) &&
+           (NULL != (body = strstr (buf, "\r\n\r\n"))) )
+        body += 4;
+      if ( (NULL != body) &&
+           (&buf[off] - body == BODY_SIZE) )
+        {
+          ret = 0;
+          for (i = 0; i < BODY_SIZE; i++)
+            if (body[i] != (char) ('a' + i % 26))
+              ret = 1;
+          break;
+        }
+    }
+  free (buf);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  struct MHD_Daemon *d;
+  MHD_socket sock;
+  int errorCount;
+
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_SUSPEND_RESUME,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_CONNECTION_MEMORY_LIMIT, (size_t) (64 * 1024),
+                        MHD_OPTION_HANDLER_THREADS, (unsigned int) 2,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  errorCount = 0;
+  sock = send_request ();
+  if (0 != get_response (sock, BODY_SIZE + 1024))
+    errorCount |= 2;
+  MHD_socket_close_ (sock);
+  /* the first block is read in the event loop, the others ahead */
+  if (0 == prefetched)
+    errorCount |= 4;
+  /* close while a block is being read ahead */
+  sock = send_request ();
+  if (0 != get_response (sock, 4 * BLOCK_SIZE))
+    errorCount |= 8;
+  MHD_socket_close_ (sock);
+  usleep (100000);
+  MHD_stop_daemon (d);
+  if (reader_error)
+    errorCount |= 16;
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %d)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
+
+/* end of test_prefetch.c */
@@ -0,0 +1,291 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_prefork.c
+ * @brief  Testcase for #MHD_OPTION_PREFORK_WORKERS: the per-IP limit
+ *         and the statistics span the worker processes, which are
+ *         respawned when they die
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <poll.h>
+#include <signal.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1198
+
+/**
+ * Number of worker processes.
+ */
+#define WORKERS 2
+
+/**
+ * Connection limit per client address.
+ */
+#define LIMIT 3
+
+/**
+ * Number of connections opened to check the limit; with a limit per
+ * process more than #LIMIT of them would be accepted.
+ */
+#define CONNECTIONS (LIMIT * WORKERS + 2)
+
+/**
+ * Number of requests sent to check the statistics.
+ */
+#define REQUESTS 20
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  struct MHD_Response *response;
+  char pid[32];
+  int ret;
+
+  snprintf (pid, sizeof (pid), "%ld", (long) getpid ());
+  response = MHD_create_response_from_buffer (strlen (pid),
+                                              pid,
+                                              MHD_RESPMEM_MUST_COPY);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Send a request on a new connection and get the process id of the
+ * worker that answered it.
+ *
+ * @return the process id, 0 on error
+ */
+static pid_t
+request (void)
+{
+  static const char req[] =
+    "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+  char buf[512];
+  size_t off;
+  ssize_t got;
+  MHD_socket sock;
+  const char *body;
+
+  /* a request queued for a respawning worker waits up to a second */
+  sock = connect_to_timeout (PORT, 5);
+  if (sizeof (req) - 1 != (size_t) send (sock, req, sizeof (req) - 1, 0))
+    abort ();
+  off = 0;
+  while ( (off < sizeof (buf) - 1) &&
+          (0 < (got = recv (sock, &buf[off], sizeof (buf) - 1 - off, 0))) )
+    off += got;
+  buf[off] = '\0';
+  MHD_socket_close_ (sock);
+  if ( (0 != strncmp (buf, "HTTP/1.1 200", strlen ("HTTP/1.1 200"))) ||
+       (NULL == (body = strstr (buf, "\r\n\r\n"))) )
+    return 0;
+  return (pid_t) atol (body + 4);
+}
+
+
+/**
+ * Check whether the daemon has closed a connection by now.
+ *
+ * @param sock the connection
+ * @return #MHD_YES if the connection was closed by the daemon
+ */
+static int
+is_closed (MHD_socket sock)
+{
+  struct pollfd p;
+  char c;
+
+  p.fd = sock;
+  p.events = POLLIN;
+  p.revents = 0;
+  if (1 != poll (&p, 1, 0))
+    return MHD_NO;
+  return (0 >= recv (sock, &c, 1, 0)) ? MHD_YES : MHD_NO;
+}
+
+
+/**
+ * Open more connections than allowed from the loopback address,
+ * which the workers accept in turn, and check that the limit holds
+ * for all of them together.
+ *
+ * @return 0 on success
+ */
+static int
+check_limit (void)
+{
+  MHD_socket socks[CONNECTIONS];
+  unsigned int closed;
+  unsigned int i;
+
+  for (i = 0; i < CONNECTIONS; i++)
+    socks[i] = connect_to_timeout (PORT, 5);
+  /* give the workers time to accept or refuse the connections */
+  usleep (250000);
+  closed = 0;
+  for (i = 0; i < CONNECTIONS; i++)
+    {
+      if (MHD_YES == is_closed (socks[i]))
+        closed++;
+      MHD_socket_close_ (socks[i]);
+    }
+  /* give the workers time to notice that the connections are gone */
+  usleep (200000);
+  if (CONNECTIONS - LIMIT != closed)
+    {
+      fprintf (stderr,
+               "%u of %u connections refused, expected %u\n",
+               closed, CONNECTIONS, CONNECTIONS - LIMIT);
+      return 1;
+    }
+  return 0;
+}
+
+
+/**
+ * Get the requests counted by all workers of @a d.
+ */
+static unsigned long long
+get_requests (struct MHD_Daemon *d)
+{
+  const union MHD_DaemonInfo *info;
+
+  info = MHD_get_daemon_info (d,
+                              MHD_DAEMON_INFO_STATS);
+  if (NULL == info)
+    abort ();
+  return info->stats.requests;
+}
+
+
+/**
+ * Send requests, which are answered by the worker processes, kill
+ * one of them and check that it is replaced and that the statistics
+ * still count all requests.
+ *
+ * @param d the daemon
+ * @return 0 on success
+ */
+static int
+check_workers (struct MHD_Daemon *d)
+{
+  pid_t pid;
+  pid_t victim;
+  unsigned int i;
+
+  victim = 0;
+  for (i = 0; i < REQUESTS; i++)
+    {
+      pid = request ();
+      if ( (0 == pid) ||
+           (getpid () == pid) )
+        {
+          fprintf (stderr,
+                   "Request %u not answered by a worker process\n",
+                   i);
+          return 4;
+        }
+      victim = pid;
+    }
+  /* the counters are updated after the response was sent */
+  usleep (100000);
+  if (REQUESTS != get_requests (d))
+    {
+      fprintf (stderr,
+               "%llu requests counted, expected %u\n",
+               get_requests (d), REQUESTS);
+      return 8;
+    }
+  if (0 != kill (victim, SIGKILL))
+    abort ();
+  /* let the listen socket of the worker go away with it */
+  usleep (200000);
+  for (i = 0; i < REQUESTS; i++)
+    {
+      pid = request ();
+      if ( (0 == pid) ||
+           (victim == pid) )
+        {
+          fprintf (stderr,
+                   "Request %u not answered after a worker died\n",
+                   i);
+          return 16;
+        }
+    }
+  usleep (100000);
+  if (2 * REQUESTS != get_requests (d))
+    {
+      fprintf (stderr,
+               "%llu requests counted after a worker died, expected %u\n",
+               get_requests (d), 2 * REQUESTS);
+      return 32;
+    }
+  return 0;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  struct MHD_Daemon *d;
+  int errorCount = 0;
+
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_PREFORK_WORKERS, (unsigned int) WORKERS,
+                        MHD_OPTION_PER_IP_CONNECTION_LIMIT, (unsigned int) LIMIT,
+                        MHD_OPTION_END);
+  /* not supported on this platform */
+  if (NULL == d)
+    return 77;
+  errorCount += check_limit ();
+  errorCount += check_workers (d);
+  MHD_stop_daemon (d);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,270 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_priority.c
+ * @brief  Testcase for the priority classes of connections: requests
+ *         of #MHD_PRIORITY_HIGH, assigned by #MHD_OPTION_PRIORITY_CALLBACK
+ *         or #MHD_CONNECTION_OPTION_PRIORITY, are still served while
+ *         the daemon rejects others due to overload
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+
+/**
+ * Milliseconds of latency from which the daemon is overloaded.
+ */
+#define LATENCY 50
+
+#define PAGE "priority"
+
+/**
+ * Header marking the requests of #MHD_PRIORITY_HIGH.
+ */
+#define HEALTH_HEADER "X-Health-Check"
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      if (0 == strcmp (url, "/slow"))
+        usleep (8 * LATENCY * 1000);
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_buffer (strlen (PAGE),
+                                              (void *) PAGE,
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection,
+                            MHD_HTTP_OK,
+                            response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+static enum MHD_ConnectionPriority
+classify (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method)
+{
+  if (NULL != MHD_lookup_connection_value (connection,
+                                           MHD_HEADER_KIND,
+                                           HEALTH_HEADER))
+    return MHD_PRIORITY_HIGH;
+  return MHD_PRIORITY_NORMAL;
+}
+
+
+static void
+notify_connection (void *cls,
+                   struct MHD_Connection *connection,
+                   void **socket_context,
+                   enum MHD_ConnectionNotificationCode toe)
+{
+  if (MHD_CONNECTION_NOTIFY_STARTED == toe)
+    MHD_set_connection_option (connection,
+                               MHD_CONNECTION_OPTION_PRIORITY,
+                               MHD_PRIORITY_HIGH);
+}
+
+
+/**
+ * Request @a url, with the #HEALTH_HEADER if @a health is set, and
+ * return the status code of the response.
+ *
+ * @return the status code, 0 on error
+ */
+static unsigned int
+request (uint16_t port,
+         const char *url,
+         int health)
+{
+  MHD_socket sock;
+  struct sockaddr_in sa;
+  char buf[2048];
+  size_t off;
+  ssize_t got;
+  fd_set rs;
+  struct timeval tv;
+  unsigned int status;
+
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sock)
+    abort ();
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (port);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (sock,
+                    (struct sockaddr *) &sa,
+                    sizeof (sa)))
+    abort ();
+  snprintf (buf,
+            sizeof (buf),
+            "GET %s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n%s\r\n",
+            url,
+            health ? HEALTH_HEADER ": 1\r\n" : "");
+  if (strlen (buf) != (size_t) write (sock, buf, strlen (buf)))
+    abort ();
+  off = 0;
+  while (1)
+    {
+      FD_ZERO (&rs);
+      FD_SET (sock, &rs);
+      tv.tv_sec = 5;
+      tv.tv_usec = 0;
+      if (1 != select (sock + 1, &rs, NULL, NULL, &tv))
+        break;
+      got = read (sock, &buf[off], sizeof (buf) - 1 - off);
+      if (0 >= got)
+        break;
+      off += got;
+    }
+  buf[off] = '\0';
+  MHD_socket_close_ (sock);
+  if (1 != sscanf (buf, "HTTP/1.1 %u", &status))
+    return 0;
+  return status;
+}
+
+
+/**
+ * Overload the daemon on @a port with slow requests.
+ *
+ * @return 0 once requests are rejected
+ */
+static int
+overload (uint16_t port)
+{
+  unsigned int i;
+
+  for (i = 0; i < 20; i++)
+    if (MHD_HTTP_SERVICE_UNAVAILABLE == request (port, "/slow", 0))
+      return 0;
+  return 1;
+}
+
+
+/**
+ * Requests classified by #MHD_OPTION_PRIORITY_CALLBACK.
+ */
+static int
+test_callback (unsigned int flags,
+               uint16_t port)
+{
+  struct MHD_Daemon *d;
+  int ret;
+
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        port,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_OVERLOAD_LATENCY, (unsigned int) LATENCY,
+                        MHD_OPTION_PRIORITY_CALLBACK, &classify, NULL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = overload (port) << 1;
+  if (MHD_HTTP_OK != request (port, "/fast", 1))
+    ret |= 4;
+  /* the health check did not make the daemon accept others */
+  if (MHD_HTTP_SERVICE_UNAVAILABLE != request (port, "/fast", 0))
+    ret |= 8;
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+/**
+ * All connections get #MHD_PRIORITY_HIGH with
+ * #MHD_CONNECTION_OPTION_PRIORITY, none is rejected.
+ */
+static int
+test_connection_option (unsigned int flags,
+                        uint16_t port)
+{
+  struct MHD_Daemon *d;
+  unsigned int i;
+  int ret;
+
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        port,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_OVERLOAD_LATENCY, (unsigned int) LATENCY,
+                        MHD_OPTION_NOTIFY_CONNECTION, &notify_connection, NULL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  for (i = 0; i < 5; i++)
+    if (MHD_HTTP_OK != request (port, "/slow", 0))
+      ret |= 2;
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += test_callback (MHD_USE_SELECT_INTERNALLY,
+                               1142);
+#if EPOLL_SUPPORT
+  errorCount += test_callback (MHD_USE_SELECT_INTERNALLY | MHD_USE_EPOLL_LINUX_ONLY,
+                               1143);
+#endif
+  errorCount += test_connection_option (MHD_USE_SELECT_INTERNALLY,
+                                        1144);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
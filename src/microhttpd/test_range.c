@@ -0,0 +1,389 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_range.c
+ * @brief  Testcase for range requests with #MHD_RF_ACCEPT_RANGES
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1105
+
+#define BODY "0123456789abcdefghij"
+
+/**
+ * Name of the file with #BODY for the fd-backed response.
+ */
+static char file_name[64];
+
+
+static int
+ahc_range (void *cls,
+           struct MHD_Connection *connection,
+           const char *url,
+           const char *method,
+           const char *version,
+           const char *upload_data,
+           size_t *upload_data_size,
+           void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int fd;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  if (0 == strcmp (url, "/fd"))
+    {
+      fd = open (file_name, O_RDONLY);
+      if (-1 == fd)
+        return MHD_NO;
+      response = MHD_create_response_from_fd (strlen (BODY),
+                                              fd);
+    }
+  else
+    {
+      response = MHD_create_response_from_buffer (strlen (BODY),
+                                                  BODY,
+                                                  MHD_RESPMEM_PERSISTENT);
+    }
+  if (NULL == response)
+    return MHD_NO;
+  if (0 != strcmp (url, "/plain"))
+    (void) MHD_set_response_options (response,
+                                     MHD_RF_ACCEPT_RANGES,
+                                     MHD_RO_END);
+  (void) MHD_add_response_header (response,
+                                  MHD_HTTP_HEADER_CONTENT_TYPE,
+                                  "text/plain");
+  (void) MHD_add_response_header (response,
+                                  MHD_HTTP_HEADER_ETAG,
+                                  "\"v1\"");
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Send @a request on a new connection and read the reply until the
+ * server closes the connection.
+ *
+ * @param request request to send
+ * @param reply buffer for the reply
+ * @param size size of @a reply
+ * @return number of bytes in @a reply, 0 on error
+ */
+static size_t
+query (const char *request,
+       char *reply,
+       size_t size)
+{
+  MHD_socket sock;
+  struct sockaddr_in sa;
+  size_t have;
+  ssize_t got;
+
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sock)
+    abort ();
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (sock,
+                    (struct sockaddr *) &sa,
+                    sizeof (sa)))
+    abort ();
+  if (strlen (request) !=
+      (size_t) write (sock, request, strlen (request)))
+    {
+      MHD_socket_close_ (sock);
+      return 0;
+    }
+  have = 0;
+  while ( (have < size - 1) &&
+          (0 < (got = read (sock, &reply[have], size - 1 - have))) )
+    have += got;
+  reply[have] = '\0';
+  MHD_socket_close_ (sock);
+  return have;
+}
+
+
+/**
+ * Split the first reply in @a reply into header and body, using
+ * the "Content-Length" of the reply.
+ *
+ * @param reply replies received
+ * @param len number of bytes in @a reply
+ * @param body set to the body of the first reply
+ * @param body_len set to the length of @a body
+ * @return 0 on success
+ */
+static int
+split_reply (const char *reply,
+             size_t len,
+             const char **body,
+             size_t *body_len)
+{
+  const char *end;
+  const char *cl;
+
+  end = strstr (reply, "\r\n\r\n");
+  if (NULL == end)
+    return 1;
+  cl = strstr (reply, "\r\nContent-Length: ");
+  if ( (NULL == cl) ||
+       (cl > end) )
+    return 1;
+  *body_len = (size_t) strtoul (cl + strlen ("\r\nContent-Length: "),
+                                NULL,
+                                10);
+  *body = end + 4;
+  if (*body + *body_len > reply + len)
+    return 1;
+  return 0;
+}
+
+
+/**
+ * Request @a range of @a url and check the reply.
+ *
+ * @param url resource to request
+ * @param range value of the "Range" header
+ * @param status expected status line
+ * @param expected expected body, or string that the body must contain
+ *        in order (separated by '|') for multipart bodies
+ * @return 0 on success
+ */
+static int
+check_range (const char *url,
+             const char *range,
+             const char *status,
+             const char *expected)
+{
+  char request[256];
+  char reply[2048];
+  char part[256];
+  const char *body;
+  const char *pos;
+  const char *sep;
+  size_t body_len;
+  size_t len;
+
+  snprintf (request,
+            sizeof (request),
+            "GET %s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\nRange: %s\r\n\r\n",
+            url,
+            range);
+  len = query (request, reply, sizeof (reply));
+  if (0 != strncmp (reply, status, strlen (status)))
+    {
+      fprintf (stderr, "Unexpected reply to `%s': `%s'\n", range, reply);
+      return 1;
+    }
+  if (0 != split_reply (reply, len, &body, &body_len))
+    return 2;
+  if (NULL == strchr (expected, '|'))
+    {
+      if ( (body_len != strlen (expected)) ||
+           (0 != memcmp (body, expected, body_len)) )
+        {
+          fprintf (stderr, "Unexpected body for `%s': `%s'\n", range, body);
+          return 4;
+        }
+      return 0;
+    }
+  if (body + body_len != reply + len)
+    return 8; /* Content-Length must match the multipart body */
+  pos = body;
+  while ('\0' != *expected)
+    {
+      sep = strchr (expected, '|');
+      if (NULL == sep)
+        sep = expected + strlen (expected);
+      memcpy (part, expected, sep - expected);
+      part[sep - expected] = '\0';
+      pos = strstr (pos, part);
+      if (NULL == pos)
+        {
+          fprintf (stderr, "Missing `%s' for `%s'\n", part, range);
+          return 16;
+        }
+      pos += strlen (part);
+      expected = ('\0' == *sep) ? sep : sep + 1;
+    }
+  /* closing delimiter after the boundary */
+  if ( (strlen (pos) < 4) ||
+       (0 != strcmp (pos + strlen (pos) - 4, "--\r\n")) ||
+       (NULL == strstr (reply, "Content-Type: multipart/byteranges; boundary=")) )
+    return 32;
+  return 0;
+}
+
+
+/**
+ * Check that several ranged responses on one connection are
+ * framed correctly.
+ *
+ * @return 0 on success
+ */
+static int
+check_keep_alive ()
+{
+  char reply[2048];
+  const char *body;
+  size_t body_len;
+  size_t len;
+  size_t off;
+
+  len = query ("GET /fd HTTP/1.1\r\nHost: localhost\r\nRange: bytes=0-0,-1\r\n\r\n"
+               "GET /buf HTTP/1.1\r\nHost: localhost\r\nRange: bytes=4-6\r\n\r\n"
+               "GET /buf HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+               reply,
+               sizeof (reply));
+  if (0 != split_reply (reply, len, &body, &body_len))
+    return 1;
+  off = (body - reply) + body_len;
+  if (0 != split_reply (&reply[off], len - off, &body, &body_len))
+    return 2;
+  if ( (0 != strncmp (&reply[off], "HTTP/1.1 206", strlen ("HTTP/1.1 206"))) ||
+       (3 != body_len) ||
+       (0 != memcmp (body, "456", 3)) )
+    return 4;
+  off = (body - reply) + body_len;
+  if (0 != split_reply (&reply[off], len - off, &body, &body_len))
+    return 8;
+  if ( (0 != strncmp (&reply[off], "HTTP/1.1 200", strlen ("HTTP/1.1 200"))) ||
+       (strlen (BODY) != body_len) ||
+       (0 != memcmp (body, BODY, body_len)) )
+    return 16;
+  return 0;
+}
+
+
+/**
+ * Run the range tests for the resource @a url.
+ *
+ * @param url resource to request
+ * @return 0 on success
+ */
+static int
+test_url (const char *url)
+{
+  int errorCount = 0;
+
+  errorCount += check_range (url, "bytes=2-5", "HTTP/1.1 206", "2345");
+  errorCount += check_range (url, "bytes=15-", "HTTP/1.1 206", "fghij");
+  errorCount += check_range (url, "bytes=-3", "HTTP/1.1 206", "hij");
+  errorCount += check_range (url, "bytes=18-100", "HTTP/1.1 206", "ij");
+  errorCount += check_range (url, "bytes=0-1, 5-6,-2",
+                             "HTTP/1.1 206",
+                             "Content-Type: text/plain\r\nContent-Range: bytes 0-1/20\r\n\r\n01\r\n--|"
+                             "Content-Range: bytes 5-6/20\r\n\r\n56\r\n--|"
+                             "Content-Range: bytes 18-19/20\r\n\r\nij\r\n--");
+  errorCount += check_range (url, "bytes=20-", "HTTP/1.1 416", "");
+  /* invalid ranges and mismatching validators are ignored */
+  errorCount += check_range (url, "bytes=5-2", "HTTP/1.1 200", BODY);
+  errorCount += check_range (url, "lines=1-2", "HTTP/1.1 200", BODY);
+  return errorCount;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  struct MHD_Daemon *d;
+  char reply[1024];
+  int errorCount = 0;
+  int fd;
+
+  snprintf (file_name,
+            sizeof (file_name),
+            "test_range_%u.tmp",
+            (unsigned int) getpid ());
+  fd = open (file_name, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (-1 == fd)
+    return 77;
+  if (strlen (BODY) != (size_t) write (fd, BODY, strlen (BODY)))
+    {
+      close (fd);
+      unlink (file_name);
+      return 77;
+    }
+  close (fd);
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_range, NULL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    {
+      unlink (file_name);
+      return 1;
+    }
+  errorCount += test_url ("/buf");
+  errorCount += test_url ("/fd");
+  errorCount += check_keep_alive ();
+  /* ranges are only sent if the application allows them */
+  errorCount += check_range ("/plain", "bytes=2-5", "HTTP/1.1 200", BODY);
+  query ("GET /buf HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\nRange: bytes=-4\r\nIf-Range: \"v2\"\r\n\r\n",
+         reply,
+         sizeof (reply));
+  if (0 != strncmp (reply, "HTTP/1.1 200", strlen ("HTTP/1.1 200")))
+    errorCount += 64;
+  query ("GET /buf HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\nRange: bytes=-4\r\nIf-Range: \"v1\"\r\n\r\n",
+         reply,
+         sizeof (reply));
+  if ( (0 != strncmp (reply, "HTTP/1.1 206", strlen ("HTTP/1.1 206"))) ||
+       (NULL == strstr (reply, "Accept-Ranges: bytes\r\n")) ||
+       (NULL == strstr (reply, "Content-Range: bytes 16-19/20\r\n")) )
+    errorCount += 128;
+  query ("GET /buf HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\nRange: bytes=50-60\r\n\r\n",
+         reply,
+         sizeof (reply));
+  if (NULL == strstr (reply, "Content-Range: bytes */20\r\n"))
+    errorCount += 256;
+  MHD_stop_daemon (d);
+  unlink (file_name);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
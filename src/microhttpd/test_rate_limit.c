@@ -0,0 +1,360 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_rate_limit.c
+ * @brief  Testcase for the send and receive rate limits of
+ *         connections and daemons: a limited transfer takes about as
+ *         long as the rate says, an unlimited one stays fast
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+
+/**
+ * Size of the response body.
+ */
+#define BODY_SIZE (64 * 1024)
+
+/**
+ * Size of the uploads.
+ */
+#define UPLOAD_SIZE (30 * 1000)
+
+/**
+ * Rate used for the limits, in bytes per second.
+ */
+#define RATE 100000
+
+static char body[BODY_SIZE];
+
+
+/**
+ * Current time in milliseconds.
+ */
+static unsigned long long
+now_ms ()
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      if (0 == strcmp (url, "/slow"))
+        MHD_set_connection_option (connection,
+                                   MHD_CONNECTION_OPTION_SEND_RATE_LIMIT,
+                                   (unsigned int) RATE);
+      return MHD_YES;
+    }
+  if (0 != *upload_data_size)
+    {
+      *upload_data_size = 0;
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_buffer (sizeof (body),
+                                              body,
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection,
+                            MHD_HTTP_OK,
+                            response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Send a request for @a url, upload @a upload bytes and read the
+ * response until the daemon closes the connection.
+ *
+ * @return milliseconds the request took, 0 on error
+ */
+static unsigned long long
+request (uint16_t port,
+         const char *url,
+         size_t upload)
+{
+  MHD_socket sock;
+  struct sockaddr_in sa;
+  char buf[4096];
+  size_t total;
+  size_t off;
+  ssize_t got;
+  fd_set rs;
+  struct timeval tv;
+  unsigned long long start;
+
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sock)
+    abort ();
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (port);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  start = now_ms ();
+  if (0 != connect (sock,
+                    (struct sockaddr *) &sa,
+                    sizeof (sa)))
+    abort ();
+  snprintf (buf,
+            sizeof (buf),
+            "%s %s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n"
+            "Content-Length: %u\r\n\r\n",
+            (0 == upload) ? "GET" : "POST",
+            url,
+            (unsigned int) upload);
+  if (strlen (buf) != (size_t) write (sock, buf, strlen (buf)))
+    abort ();
+  memset (buf, 'u', sizeof (buf));
+  for (off = 0; off < upload; off += got)
+    {
+      got = write (sock,
+                   buf,
+                   (upload - off < sizeof (buf)) ? upload - off : sizeof (buf));
+      if (0 >= got)
+        abort ();
+    }
+  total = 0;
+  while (1)
+    {
+      FD_ZERO (&rs);
+      FD_SET (sock, &rs);
+      tv.tv_sec = 5;
+      tv.tv_usec = 0;
+      if (1 != select (sock + 1, &rs, NULL, NULL, &tv))
+        {
+          MHD_socket_close_ (sock);
+          return 0;
+        }
+      got = read (sock, buf, sizeof (buf));
+      if (0 > got)
+        {
+          MHD_socket_close_ (sock);
+          return 0;
+        }
+      if (0 == got)
+        break;
+      total += got;
+    }
+  MHD_socket_close_ (sock);
+  if (total < BODY_SIZE)
+    return 0;
+  return now_ms () - start + 1;
+}
+
+
+/**
+ * Check that a transfer of @a size bytes that took @a ms
+ * milliseconds was limited to @a rate: the first tenth of a second
+ * comes for free.
+ *
+ * @return 0 if it was
+ */
+static int
+check_limited (unsigned long long ms,
+               size_t size,
+               unsigned int rate)
+{
+  const unsigned long long expected = (size - rate / 10) * 1000ULL / rate;
+
+  if (0 == ms)
+    return 1;
+  if ( (ms < expected * 3 / 4) ||
+       (ms > expected * 4 + 1000) )
+    {
+      fprintf (stderr,
+               "Transfer took %llu ms, expected about %llu ms\n",
+               ms,
+               expected);
+      return 2;
+    }
+  return 0;
+}
+
+
+/**
+ * Check that a transfer that took @a ms milliseconds was not
+ * limited.
+ *
+ * @return 0 if it was not
+ */
+static int
+check_fast (unsigned long long ms)
+{
+  if (0 == ms)
+    return 1;
+  if (ms > 300)
+    {
+      fprintf (stderr,
+               "Unlimited transfer took %llu ms\n",
+               ms);
+      return 2;
+    }
+  return 0;
+}
+
+
+/**
+ * Limit one connection with #MHD_CONNECTION_OPTION_SEND_RATE_LIMIT.
+ */
+static int
+test_connection_limit (unsigned int flags,
+                       uint16_t port)
+{
+  struct MHD_Daemon *d;
+  int ret;
+
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        port,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = check_limited (request (port, "/slow", 0),
+                       BODY_SIZE,
+                       RATE);
+  ret |= check_fast (request (port, "/fast", 0)) << 2;
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+/**
+ * Limit all connections with #MHD_OPTION_SEND_RATE_LIMIT and
+ * #MHD_OPTION_RECV_RATE_LIMIT.
+ */
+static int
+test_daemon_limit (unsigned int flags,
+                   uint16_t port)
+{
+  struct MHD_Daemon *d;
+  int ret;
+
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        port,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_SEND_RATE_LIMIT,
+                        (unsigned int) RATE,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = check_limited (request (port, "/fast", 0),
+                       BODY_SIZE,
+                       RATE);
+  MHD_stop_daemon (d);
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        port,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_RECV_RATE_LIMIT,
+                        (unsigned int) RATE / 4,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  /* only the upload is limited */
+  ret |= check_limited (request (port, "/fast", UPLOAD_SIZE),
+                        UPLOAD_SIZE,
+                        RATE / 4) << 2;
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+/**
+ * Daemon rate limits cannot be used with a thread per connection.
+ */
+static int
+test_thread_per_connection (uint16_t port)
+{
+  struct MHD_Daemon *d;
+
+  d = MHD_start_daemon (MHD_USE_THREAD_PER_CONNECTION,
+                        port,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_SEND_RATE_LIMIT,
+                        (unsigned int) RATE,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 0;
+  MHD_stop_daemon (d);
+  return 1;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  memset (body, 'b', sizeof (body));
+  errorCount += test_connection_limit (MHD_USE_SELECT_INTERNALLY,
+                                       1129);
+  errorCount += test_connection_limit (MHD_USE_THREAD_PER_CONNECTION,
+                                       1130);
+#ifdef HAVE_POLL
+  errorCount += test_connection_limit (MHD_USE_POLL_INTERNALLY,
+                                       1131);
+#endif
+#if EPOLL_SUPPORT
+  errorCount += test_connection_limit (MHD_USE_SELECT_INTERNALLY | MHD_USE_EPOLL_LINUX_ONLY,
+                                       1132);
+#endif
+  errorCount += test_daemon_limit (MHD_USE_SELECT_INTERNALLY,
+                                   1133);
+  errorCount += test_thread_per_connection (1134);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,260 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_rebalance.c
+ * @brief  Testcase for #MHD_OPTION_CONNECTION_REBALANCE: idle
+ *         keep-alive connections all added to one worker of a thread
+ *         pool are handed over to the other one and keep working
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1185
+
+/**
+ * Number of connections added to the daemon.
+ */
+#define CONNECTIONS 8
+
+/**
+ * Number of #MHD_CONNECTION_NOTIFY_STARTED notifications.
+ */
+static unsigned int started;
+
+
+static void
+notify_connection (void *cls,
+                   struct MHD_Connection *connection,
+                   void **socket_context,
+                   enum MHD_ConnectionNotificationCode toe)
+{
+  /* all connections start on the first worker */
+  if (MHD_CONNECTION_NOTIFY_STARTED == toe)
+    started++;
+}
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_buffer (strlen (url),
+                                              (void *) url,
+                                              MHD_RESPMEM_MUST_COPY);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Send a request for "/<n>" on @a sock, keeping the connection
+ * alive, and check the reply.
+ *
+ * @param sock socket to use
+ * @param n number to request
+ * @return 0 on success
+ */
+static int
+check_request (MHD_socket sock,
+               unsigned int n)
+{
+  char request[128];
+  char reply[512];
+  char url[16];
+  const char *body;
+  size_t have;
+  ssize_t got;
+  size_t len;
+
+  snprintf (request,
+            sizeof (request),
+            "GET /%u HTTP/1.1\r\nHost: localhost\r\n\r\n",
+            n);
+  if (strlen (request) !=
+      (size_t) write (sock, request, strlen (request)))
+    abort ();
+  snprintf (url, sizeof (url), "/%u", n);
+  len = strlen (url);
+  /* the body is the last part of the response */
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          (0 < (got = read (sock,
+                            &reply[have],
+                            sizeof (reply) - 1 - have))) )
+    {
+      have += got;
+      reply[have] = '\0';
+      if ( (NULL != (body = strstr (reply, "\r\n\r\n"))) &&
+           (strlen (body + 4) >= len) )
+        break;
+    }
+  reply[have] = '\0';
+  if ( (NULL == (body = strstr (reply, "\r\n\r\n"))) ||
+       (0 != strcmp (body + 4, url)) )
+    return 1;
+  return 0;
+}
+
+
+/**
+ * Add connections to the first worker of a pool of two, check that
+ * some of them are handed over to the second one and that all of
+ * them are served afterwards.
+ *
+ * @param flags event loop flags for the daemon
+ * @return 0 on success
+ */
+static int
+check_rebalance (unsigned int flags)
+{
+  struct MHD_Daemon *d;
+  const union MHD_DaemonInfo *info;
+  MHD_socket lsock;
+  MHD_socket csocks[CONNECTIONS];
+  MHD_socket ssock;
+  int fd;
+  struct sockaddr_in sa;
+  struct sockaddr_in ca;
+  socklen_t ca_len;
+  socklen_t sa_len;
+  unsigned int i;
+  unsigned int round;
+  int ret;
+
+  started = 0;
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_THREAD_POOL_SIZE, (unsigned int) 2,
+                        MHD_OPTION_CONNECTION_REBALANCE, (unsigned int) 2,
+                        MHD_OPTION_NOTIFY_CONNECTION, &notify_connection, NULL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  lsock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == lsock)
+    abort ();
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  sa_len = sizeof (sa);
+  if ( (0 != bind (lsock, (struct sockaddr *) &sa, sizeof (sa))) ||
+       (0 != listen (lsock, CONNECTIONS)) ||
+       (0 != getsockname (lsock, (struct sockaddr *) &sa, &sa_len)) )
+    abort ();
+  for (i = 0; i < CONNECTIONS; i++)
+    {
+      csocks[i] = socket (AF_INET, SOCK_STREAM, 0);
+      if ( (MHD_INVALID_SOCKET == csocks[i]) ||
+           (0 != connect (csocks[i], (struct sockaddr *) &sa, sizeof (sa))) )
+        abort ();
+      ca_len = sizeof (ca);
+      ssock = accept (lsock, (struct sockaddr *) &ca, &ca_len);
+      if (MHD_INVALID_SOCKET == ssock)
+        abort ();
+      /* MHD_add_connection() picks the worker by the socket number,
+         an even one goes to the first of two */
+      fd = fcntl (ssock, F_DUPFD, 512 + 2 * i);
+      if (512 + 2 * (int) i != fd)
+        abort ();
+      MHD_socket_close_ (ssock);
+      if (MHD_YES != MHD_add_connection (d,
+                                         fd,
+                                         (struct sockaddr *) &ca,
+                                         ca_len))
+        abort ();
+    }
+  MHD_socket_close_ (lsock);
+  ret = 0;
+  for (i = 0; i < 1000; i++)
+    {
+      info = MHD_get_daemon_info (d,
+                                  MHD_DAEMON_INFO_STATS);
+      if (NULL == info)
+        abort ();
+      if (0 != info->stats.migrations)
+        break;
+      (void) usleep (1000);
+    }
+  if (0 == info->stats.migrations)
+    ret |= 2;
+  for (round = 0; round < 2; round++)
+    for (i = 0; i < CONNECTIONS; i++)
+      if (0 != check_request (csocks[i], round * CONNECTIONS + i))
+        ret |= 4;
+  for (i = 0; i < CONNECTIONS; i++)
+    MHD_socket_close_ (csocks[i]);
+  MHD_stop_daemon (d);
+  if (CONNECTIONS != started)
+    ret |= 8;
+  if (0 != ret)
+    fprintf (stderr,
+             "Rebalancing failed with flags %u: %d\n",
+             flags,
+             ret);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += check_rebalance (MHD_USE_SELECT_INTERNALLY);
+  errorCount += check_rebalance (MHD_USE_POLL_INTERNALLY);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_EPOLL))
+    errorCount += check_rebalance (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
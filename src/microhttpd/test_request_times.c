@@ -0,0 +1,248 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_request_times.c
+ * @brief  Testcase for #MHD_CONNECTION_INFO_REQUEST_TIMES: all phases
+ *         of a request are timed in order, and a keep-alive request
+ *         is timed on its own
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+
+/**
+ * Time the handler takes before queueing the response, in
+ * microseconds.
+ */
+#define HANDLER_DELAY 20000
+
+#define REQUEST "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n"
+
+#define PAGE "timed"
+
+/**
+ * Times of the completed requests, as seen by the completion callback.
+ */
+static struct MHD_RequestTimes times[2];
+
+static unsigned int completed;
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  usleep (HANDLER_DELAY);
+  response = MHD_create_response_from_buffer (strlen (PAGE),
+                                              (void *) PAGE,
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection,
+                            MHD_HTTP_OK,
+                            response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+static void
+request_completed (void *cls,
+                   struct MHD_Connection *connection,
+                   void **con_cls,
+                   enum MHD_RequestTerminationCode toe)
+{
+  const union MHD_ConnectionInfo *info;
+
+  if (MHD_REQUEST_TERMINATED_COMPLETED_OK != toe)
+    return;
+  info = MHD_get_connection_info (connection,
+                                  MHD_CONNECTION_INFO_REQUEST_TIMES);
+  if ( (NULL != info) &&
+       (completed < 2) )
+    times[completed] = info->request_times;
+  completed++;
+}
+
+
+/**
+ * Send a request on @a sock and wait for the complete response.
+ *
+ * @return 0 on success
+ */
+static int
+request (MHD_socket sock)
+{
+  char buf[1024];
+  size_t off;
+  ssize_t got;
+  fd_set rs;
+  struct timeval tv;
+
+  if (strlen (REQUEST) != (size_t) write (sock, REQUEST, strlen (REQUEST)))
+    return 1;
+  off = 0;
+  buf[0] = '\0';
+  while (NULL == strstr (buf, PAGE))
+    {
+      FD_ZERO (&rs);
+      FD_SET (sock, &rs);
+      tv.tv_sec = 2;
+      tv.tv_usec = 0;
+      if (1 != select (sock + 1, &rs, NULL, NULL, &tv))
+        return 2;
+      got = read (sock, &buf[off], sizeof (buf) - 1 - off);
+      if (0 >= got)
+        return 4;
+      off += got;
+      buf[off] = '\0';
+      if (sizeof (buf) - 1 == off)
+        return 8;
+    }
+  return 0;
+}
+
+
+/**
+ * Check that all phases of @a t were reached, in order, and that the
+ * handler delay is between queueing and the first handler call.
+ *
+ * @return 0 if they were
+ */
+static int
+check_times (const struct MHD_RequestTimes *t)
+{
+  if ( (0 == t->accepted) ||
+       (t->first_byte < t->accepted) ||
+       (t->headers_received < t->first_byte) ||
+       (t->handler_called < t->headers_received) ||
+       (t->response_queued < t->handler_called) ||
+       (t->headers_sent < t->response_queued) ||
+       (t->body_sent < t->headers_sent) )
+    {
+      fprintf (stderr,
+               "Phases out of order: %llu %llu %llu %llu %llu %llu %llu\n",
+               (unsigned long long) t->accepted,
+               (unsigned long long) t->first_byte,
+               (unsigned long long) t->headers_received,
+               (unsigned long long) t->handler_called,
+               (unsigned long long) t->response_queued,
+               (unsigned long long) t->headers_sent,
+               (unsigned long long) t->body_sent);
+      return 1;
+    }
+  if (t->response_queued - t->handler_called < HANDLER_DELAY)
+    return 2;
+  return 0;
+}
+
+
+static int
+test_request_times (unsigned int flags,
+                    uint16_t port)
+{
+  struct MHD_Daemon *d;
+  struct sockaddr_in sa;
+  MHD_socket sock;
+  int ret;
+
+  completed = 0;
+  memset (times, 0, sizeof (times));
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        port,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_NOTIFY_COMPLETED, &request_completed, NULL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sock)
+    abort ();
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (port);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (sock,
+                    (struct sockaddr *) &sa,
+                    sizeof (sa)))
+    abort ();
+  ret = request (sock);
+  ret |= request (sock) << 4;
+  MHD_socket_close_ (sock);
+  MHD_stop_daemon (d);
+  if (2 != completed)
+    return ret | 256;
+  ret |= check_times (&times[0]) << 8;
+  ret |= check_times (&times[1]) << 10;
+  /* the connection was accepted once, the second request started
+     after the first one was done */
+  if (times[0].accepted != times[1].accepted)
+    ret |= 4096;
+  if (times[1].first_byte < times[0].body_sent)
+    ret |= 8192;
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += test_request_times (MHD_USE_SELECT_INTERNALLY,
+                                    1148);
+  errorCount += test_request_times (MHD_USE_THREAD_PER_CONNECTION,
+                                    1149);
+#if EPOLL_SUPPORT
+  errorCount += test_request_times (MHD_USE_SELECT_INTERNALLY | MHD_USE_EPOLL_LINUX_ONLY,
+                                    1150);
+#endif
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
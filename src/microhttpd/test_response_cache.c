@@ -0,0 +1,382 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_response_cache.c
+ * @brief  Testcase for #MHD_OPTION_RESPONSE_CACHE_SIZE: cacheable
+ *         responses are served again without calling the access
+ *         handler until they expire, by the values of the headers
+ *         they vary by, and concurrent requests for the same target
+ *         wait for the one calling the handler
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+/**
+ * Number of requests waiting for the slow handler.
+ */
+#define WAITERS 4
+
+/**
+ * Number of responses the access handler created.
+ */
+static volatile unsigned int produced;
+
+/**
+ * Connection suspended by the handler of "/slow", NULL if none.
+ */
+static struct MHD_Connection *volatile slow_connection;
+
+/**
+ * Set to let the handler of "/slow" answer once resumed.
+ */
+static volatile int slow_release;
+
+
+/**
+ * Handler answering with the path, the number of responses produced
+ * so far and the "Accept-Language" of "/vary".  "/nocache" is not
+ * cacheable, "/short" only for 100 ms, "/stale" and "/slow" for
+ * 100 ms and stale for ten more seconds, the others for a minute.
+ */
+static int
+ahc_cached (void *cls,
+            struct MHD_Connection *connection,
+            const char *url,
+            const char *method,
+            const char *version,
+            const char *upload_data,
+            size_t *upload_data_size,
+            void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  const char *lang;
+  char body[256];
+  unsigned int ttl;
+  unsigned int stale;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  if ( (0 == strcmp (url, "/slow")) &&
+       (! slow_release) )
+    {
+      MHD_suspend_connection (connection);
+      slow_connection = connection;
+      return MHD_YES;
+    }
+  lang = MHD_lookup_connection_value (connection,
+                                      MHD_HEADER_KIND,
+                                      MHD_HTTP_HEADER_ACCEPT_LANGUAGE);
+  snprintf (body,
+            sizeof (body),
+            "%s %u %s",
+            url,
+            ++produced,
+            (0 == strcmp (url, "/vary")) && (NULL != lang) ? lang : "-");
+  response = MHD_create_response_from_buffer (strlen (body),
+                                              body,
+                                              MHD_RESPMEM_MUST_COPY);
+  ttl = 60000;
+  stale = 0;
+  if (0 == strcmp (url, "/nocache"))
+    ttl = 0;
+  if (0 == strcmp (url, "/short"))
+    ttl = 100;
+  if ( (0 == strcmp (url, "/stale")) ||
+       (0 == strcmp (url, "/slow")) )
+    {
+      ttl = 100;
+      stale = 10000;
+    }
+  if (0 == strcmp (url, "/vary"))
+    MHD_add_response_header (response,
+                             MHD_HTTP_HEADER_VARY,
+                             MHD_HTTP_HEADER_ACCEPT_LANGUAGE);
+  MHD_set_response_options (response,
+                            MHD_RF_NONE,
+                            MHD_RO_CACHE_TTL, ttl,
+                            MHD_RO_CACHE_STALE_WHILE_REVALIDATE, stale,
+                            MHD_RO_END);
+  ret = MHD_queue_response (connection,
+                            MHD_HTTP_OK,
+                            response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Send a request for @a path on a new connection.
+ *
+ * @param port port of the daemon
+ * @param path path to request
+ * @param lang value of the "Accept-Language" header, NULL for none
+ * @return the socket to read the response from
+ */
+static MHD_socket
+send_request (uint16_t port,
+              const char *path,
+              const char *lang)
+{
+  MHD_socket sock;
+  char buf[512];
+
+  sock = connect_to (port);
+  snprintf (buf,
+            sizeof (buf),
+            "GET %s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n"
+            "%s%s%s\r\n",
+            path,
+            (NULL != lang) ? "Accept-Language: " : "",
+            (NULL != lang) ? lang : "",
+            (NULL != lang) ? "\r\n" : "");
+  if (strlen (buf) != (size_t) write (sock, buf, strlen (buf)))
+    abort ();
+  return sock;
+}
+
+
+/**
+ * Read the response from @a sock, close it and compare the body.
+ *
+ * @param sock socket a request was sent on
+ * @param expected expected body
+ * @return 0 on success
+ */
+static int
+check_response (MHD_socket sock,
+                const char *expected)
+{
+  char buf[2048];
+  size_t have;
+  ssize_t got;
+  char *body;
+
+  have = 0;
+  while ( (have < sizeof (buf) - 1) &&
+          (0 < (got = read (sock, &buf[have], sizeof (buf) - 1 - have))) )
+    have += got;
+  buf[have] = '\0';
+  MHD_socket_close_ (sock);
+  body = strstr (buf, "\r\n\r\n");
+  if ( (NULL == body) ||
+       (0 != strcmp (body + 4, expected)) )
+    {
+      fprintf (stderr,
+               "Expected `%s', got `%s'\n",
+               expected,
+               (NULL == body) ? buf : body + 4);
+      return 1;
+    }
+  return 0;
+}
+
+
+/**
+ * Request @a path and compare the body of the response.
+ *
+ * @param port port of the daemon
+ * @param path path to request
+ * @param lang value of the "Accept-Language" header, NULL for none
+ * @param expected expected body
+ * @return 0 on success
+ */
+static int
+check_request (uint16_t port,
+               const char *path,
+               const char *lang,
+               const char *expected)
+{
+  return check_response (send_request (port,
+                                       path,
+                                       lang),
+                         expected);
+}
+
+
+/**
+ * Check hits, expiry, stale responses and "Vary".
+ *
+ * @param flags daemon flags to use
+ * @param port port to use
+ * @return 0 on success
+ */
+static int
+test_cache (unsigned int flags,
+            uint16_t port)
+{
+  struct MHD_Daemon *d;
+  int ret;
+
+  produced = 0;
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        port,
+                        NULL, NULL,
+                        &ahc_cached, NULL,
+                        MHD_OPTION_RESPONSE_CACHE_SIZE, (unsigned int) 16,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  ret |= check_request (port, "/a", NULL, "/a 1 -");
+  ret |= check_request (port, "/a", NULL, "/a 1 -");
+  ret |= check_request (port, "/a?x=1", NULL, "/a 2 -");
+  ret |= check_request (port, "/a?x=1", NULL, "/a 2 -");
+  ret |= check_request (port, "/nocache", NULL, "/nocache 3 -");
+  ret |= check_request (port, "/nocache", NULL, "/nocache 4 -");
+  ret |= check_request (port, "/vary", "de", "/vary 5 de");
+  ret |= check_request (port, "/vary", "fr", "/vary 6 fr");
+  ret |= check_request (port, "/vary", "de", "/vary 5 de");
+  ret |= check_request (port, "/vary", NULL, "/vary 7 -");
+  ret |= check_request (port, "/vary", "fr", "/vary 6 fr");
+  ret |= check_request (port, "/short", NULL, "/short 8 -");
+  ret |= check_request (port, "/short", NULL, "/short 8 -");
+  ret |= check_request (port, "/stale", NULL, "/stale 9 -");
+  (void) usleep (200000);
+  ret |= check_request (port, "/short", NULL, "/short 10 -");
+  /* stale, but no other request refreshes it */
+  ret |= check_request (port, "/stale", NULL, "/stale 11 -");
+  ret |= check_request (port, "/stale", NULL, "/stale 11 -");
+  MHD_stop_daemon (d);
+  return (0 == ret) ? 0 : 2;
+}
+
+
+/**
+ * Request "/slow" and wait until its handler suspended the
+ * connection.
+ *
+ * @param port port of the daemon
+ * @param[out] sock set to the socket of the request
+ * @return 0 on success
+ */
+static int
+wait_slow (uint16_t port,
+           MHD_socket *sock)
+{
+  unsigned int i;
+
+  slow_connection = NULL;
+  slow_release = 0;
+  *sock = send_request (port, "/slow", NULL);
+  for (i = 0; (i < 1000) && (NULL == slow_connection); i++)
+    (void) usleep (1000);
+  return (NULL == slow_connection) ? 1 : 0;
+}
+
+
+/**
+ * Check that requests for the same target wait for the one calling
+ * the access handler, or get the stale response meanwhile.
+ *
+ * @param flags daemon flags to use
+ * @param port port to use
+ * @return 0 on success
+ */
+static int
+test_coalesce (unsigned int flags,
+               uint16_t port)
+{
+  struct MHD_Daemon *d;
+  MHD_socket leader;
+  MHD_socket waiters[WAITERS];
+  unsigned int i;
+  int ret;
+
+  produced = 0;
+  d = MHD_start_daemon (flags | MHD_USE_SUSPEND_RESUME | MHD_USE_DEBUG,
+                        port,
+                        NULL, NULL,
+                        &ahc_cached, NULL,
+                        MHD_OPTION_RESPONSE_CACHE_SIZE, (unsigned int) 16,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 4;
+  if (0 != wait_slow (port, &leader))
+    {
+      MHD_socket_close_ (leader);
+      MHD_stop_daemon (d);
+      return 8;
+    }
+  ret = 0;
+  for (i = 0; i < WAITERS; i++)
+    waiters[i] = send_request (port, "/slow", NULL);
+  /* let the waiters reach the cache */
+  (void) usleep (200000);
+  if (0 != produced)
+    ret = 1;
+  slow_release = 1;
+  MHD_resume_connection (slow_connection);
+  ret |= check_response (leader, "/slow 1 -");
+  for (i = 0; i < WAITERS; i++)
+    ret |= check_response (waiters[i], "/slow 1 -");
+  /* once stale, the old response is served while one request
+     refreshes it */
+  (void) usleep (200000);
+  if (0 != wait_slow (port, &leader))
+    {
+      MHD_socket_close_ (leader);
+      MHD_stop_daemon (d);
+      return 8;
+    }
+  ret |= check_request (port, "/slow", NULL, "/slow 1 -");
+  slow_release = 1;
+  MHD_resume_connection (slow_connection);
+  ret |= check_response (leader, "/slow 2 -");
+  ret |= check_request (port, "/slow", NULL, "/slow 2 -");
+  MHD_stop_daemon (d);
+  return (0 == ret) ? 0 : 16;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += test_cache (MHD_USE_SELECT_INTERNALLY, 1184);
+  errorCount += test_cache (MHD_USE_THREAD_PER_CONNECTION, 1184);
+  errorCount += test_coalesce (MHD_USE_SELECT_INTERNALLY, 1184);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_EPOLL))
+    errorCount += test_coalesce (MHD_USE_SELECT_INTERNALLY |
+                                 MHD_USE_EPOLL_LINUX_ONLY, 1184);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,275 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_resume_queue.c
+ * @brief  Testcase for #MHD_resume_connection() called concurrently
+ *         from several threads while other connections stay suspended
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1113
+
+/**
+ * Number of connections.
+ */
+#define CONNECTIONS 128
+
+/**
+ * Number of threads resuming connections.
+ */
+#define RESUMERS 4
+
+
+/**
+ * Suspended connections, by the number in their URL.
+ */
+static struct MHD_Connection *suspended[CONNECTIONS];
+
+/**
+ * Number of suspended connections.
+ */
+static unsigned int num_suspended;
+
+/**
+ * Protects #suspended and #num_suspended.
+ */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static int
+ahc_suspend (void *cls,
+             struct MHD_Connection *connection,
+             const char *url,
+             const char *method,
+             const char *version,
+             const char *upload_data,
+             size_t *upload_data_size,
+             void **con_cls)
+{
+  static int seen;
+  static int marker;
+  struct MHD_Response *response;
+  unsigned int n;
+  int ret;
+
+  if (NULL == *con_cls)
+    {
+      *con_cls = &seen;
+      return MHD_YES;
+    }
+  if (&seen == *con_cls)
+    {
+      *con_cls = &marker;
+      n = (unsigned int) atoi (url + 1);
+      if (n >= CONNECTIONS)
+        return MHD_NO;
+      pthread_mutex_lock (&lock);
+      suspended[n] = connection;
+      num_suspended++;
+      MHD_suspend_connection (connection);
+      pthread_mutex_unlock (&lock);
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_buffer (strlen (url),
+                                              (void *) url,
+                                              MHD_RESPMEM_MUST_COPY);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Resume every #RESUMERS-th connection of the first half; the
+ * second half stays suspended meanwhile.
+ *
+ * @param cls pointer to the number of the resumer
+ * @return NULL
+ */
+static void *
+resumer (void *cls)
+{
+  unsigned int *id = cls;
+  unsigned int i;
+
+  for (i = *id; i < CONNECTIONS / 2; i += RESUMERS)
+    MHD_resume_connection (suspended[i]);
+  return NULL;
+}
+
+
+/**
+ * Read the reply on a connection and check that it echoes the URL.
+ *
+ * @param sock connection to read from
+ * @param n number in the URL
+ * @return 0 on success
+ */
+static int
+check_reply (MHD_socket sock,
+             unsigned int n)
+{
+  char reply[512];
+  char url[16];
+  const char *body;
+  size_t have;
+  ssize_t got;
+
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          (0 < (got = read (sock, &reply[have], sizeof (reply) - 1 - have))) )
+    have += got;
+  reply[have] = '\0';
+  snprintf (url, sizeof (url), "/%u", n);
+  if ( (NULL == (body = strstr (reply, "\r\n\r\n"))) ||
+       (0 != strcmp (body + 4, url)) )
+    return 1;
+  return 0;
+}
+
+
+/**
+ * Suspend all connections, resume half of them from several threads
+ * at once, then the rest.
+ *
+ * @param flags event loop flags for the daemon
+ * @param pool_size size of the thread pool, 0 for none
+ * @return 0 on success
+ */
+static int
+check_resume (unsigned int flags,
+              unsigned int pool_size)
+{
+  struct MHD_Daemon *d;
+  MHD_socket socks[CONNECTIONS];
+  struct sockaddr_in sa;
+  pthread_t threads[RESUMERS];
+  unsigned int ids[RESUMERS];
+  char request[128];
+  unsigned int i;
+  unsigned int waited;
+  int ret;
+
+  num_suspended = 0;
+  d = MHD_start_daemon (flags | MHD_USE_SUSPEND_RESUME | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_suspend, NULL,
+                        MHD_OPTION_THREAD_POOL_SIZE, pool_size,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  for (i = 0; i < CONNECTIONS; i++)
+    {
+      socks[i] = socket (AF_INET, SOCK_STREAM, 0);
+      if ( (MHD_INVALID_SOCKET == socks[i]) ||
+           (0 != connect (socks[i],
+                          (struct sockaddr *) &sa,
+                          sizeof (sa))) )
+        abort ();
+      snprintf (request,
+                sizeof (request),
+                "GET /%u HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+                i);
+      if (strlen (request) !=
+          (size_t) write (socks[i], request, strlen (request)))
+        abort ();
+    }
+  for (waited = 0; waited < 5000; waited++)
+    {
+      pthread_mutex_lock (&lock);
+      i = num_suspended;
+      pthread_mutex_unlock (&lock);
+      if (CONNECTIONS == i)
+        break;
+      usleep (1000);
+    }
+  if (CONNECTIONS != i)
+    {
+      fprintf (stderr, "Only %u connections were suspended\n", i);
+      abort ();
+    }
+  for (i = 0; i < RESUMERS; i++)
+    {
+      ids[i] = i;
+      if (0 != pthread_create (&threads[i], NULL, &resumer, &ids[i]))
+        abort ();
+    }
+  for (i = 0; i < RESUMERS; i++)
+    pthread_join (threads[i], NULL);
+  ret = 0;
+  for (i = 0; i < CONNECTIONS / 2; i++)
+    if (0 != check_reply (socks[i], i))
+      ret |= 2;
+  for (i = CONNECTIONS / 2; i < CONNECTIONS; i++)
+    MHD_resume_connection (suspended[i]);
+  for (i = CONNECTIONS / 2; i < CONNECTIONS; i++)
+    if (0 != check_reply (socks[i], i))
+      ret |= 4;
+  for (i = 0; i < CONNECTIONS; i++)
+    MHD_socket_close_ (socks[i]);
+  MHD_stop_daemon (d);
+  if (0 != ret)
+    fprintf (stderr,
+             "Resumed connections not served with flags %u and %u workers: %d\n",
+             flags, pool_size, ret);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+#if 0
+  errorCount += check_resume (MHD_USE_SELECT_INTERNALLY, 0);
+#endif
+  errorCount += check_resume (MHD_USE_SELECT_INTERNALLY, 4);
+#if 0
+  errorCount += check_resume (MHD_USE_POLL_INTERNALLY, 0);
+#endif
+#if EPOLL_SUPPORT
+  errorCount += check_resume (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY, 2);
+#endif
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,280 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_router.c
+ * @brief  Testcase for #MHD_router_access_handler(): requests reach
+ *         the handler of the route matching their path and method,
+ *         with the parameters captured from the path
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+
+/**
+ * A request and the body the handler of its route answers with.
+ */
+struct Check
+{
+  const char *method;
+  const char *path;
+  const char *expected;
+};
+
+
+static int
+append_value (void *cls,
+              enum MHD_ValueKind kind,
+              const char *key,
+              const char *value)
+{
+  char *body = cls;
+
+  if (MHD_ROUTE_PARAMETER_KIND != kind)
+    return MHD_NO;
+  strcat (body, " ");
+  strcat (body, key);
+  strcat (body, "=");
+  strcat (body, value);
+  return MHD_YES;
+}
+
+
+/**
+ * Handler of all routes: answers with its closure and the parameters
+ * of the route.
+ */
+static int
+ahc_route (void *cls,
+           struct MHD_Connection *connection,
+           const char *url,
+           const char *method,
+           const char *version,
+           const char *upload_data,
+           size_t *upload_data_size,
+           void **con_cls)
+{
+  static int marker;
+  const char *name = cls;
+  struct MHD_Response *response;
+  char body[1024];
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  strcpy (body, name);
+  MHD_get_connection_values (connection,
+                             MHD_ROUTE_PARAMETER_KIND,
+                             &append_value,
+                             body);
+  response = MHD_create_response_from_buffer (strlen (body),
+                                              body,
+                                              MHD_RESPMEM_MUST_COPY);
+  ret = MHD_queue_response (connection,
+                            (0 == strcmp (name, "fallback"))
+                            ? MHD_HTTP_NOT_FOUND : MHD_HTTP_OK,
+                            response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Send the request of @a check and compare the body of the response.
+ *
+ * @param port port of the daemon
+ * @param check request to send
+ * @return 0 on success
+ */
+static int
+check_route (uint16_t port,
+             const struct Check *check)
+{
+  MHD_socket sock;
+  char buf[2048];
+  size_t have;
+  ssize_t got;
+  char *body;
+
+  sock = connect_to (port);
+  snprintf (buf,
+            sizeof (buf),
+            "%s %s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n"
+            "Content-Length: 0\r\n\r\n",
+            check->method,
+            check->path);
+  if (strlen (buf) != (size_t) write (sock, buf, strlen (buf)))
+    abort ();
+  have = 0;
+  while ( (have < sizeof (buf) - 1) &&
+          (0 < (got = read (sock, &buf[have], sizeof (buf) - 1 - have))) )
+    have += got;
+  buf[have] = '\0';
+  MHD_socket_close_ (sock);
+  body = strstr (buf, "\r\n\r\n");
+  if ( (NULL == body) ||
+       (0 != strcmp (body + 4, check->expected)) )
+    {
+      fprintf (stderr,
+               "%s %s: expected `%s', got `%s'\n",
+               check->method,
+               check->path,
+               check->expected,
+               (NULL == body) ? buf : body + 4);
+      return 1;
+    }
+  return 0;
+}
+
+
+/**
+ * Check the patterns #MHD_router_add() refuses.
+ *
+ * @return 0 on success
+ */
+static int
+test_invalid (void)
+{
+  struct MHD_Router *router;
+  int ret;
+
+  router = MHD_router_create (&ahc_route, "fallback");
+  if (NULL == router)
+    return 1;
+  ret = 0;
+  if ( (MHD_NO != MHD_router_add (router, MHD_ROUTE_GET, "users",
+                                  &ahc_route, "x")) ||
+       (MHD_NO != MHD_router_add (router, MHD_ROUTE_GET, "/a/*/b",
+                                  &ahc_route, "x")) ||
+       (MHD_NO != MHD_router_add (router, MHD_ROUTE_GET, "/a/:",
+                                  &ahc_route, "x")) ||
+       (MHD_NO != MHD_router_add (router, 0, "/a",
+                                  &ahc_route, "x")) )
+    ret = 2;
+  MHD_router_destroy (router);
+  return ret;
+}
+
+
+/**
+ * Dispatch requests through a router.
+ *
+ * @param flags daemon flags to use
+ * @param port port to use
+ * @return 0 on success
+ */
+static int
+test_routes (unsigned int flags,
+             uint16_t port)
+{
+  static const struct Check checks[] = {
+    { "GET", "/", "root" },
+    { "GET", "/users", "users" },
+    { "GET", "/users/42", "user id=42" },
+    { "POST", "/users/42", "update id=42" },
+    { "DELETE", "/users/42", "fallback" },
+    { "GET", "/users/me", "me" },
+    { "GET", "/users/", "fallback" },
+    { "GET", "/users/7/posts/9", "post id=7 post=9" },
+    { "GET", "/users/7/posts", "fallback" },
+    { "GET", "/static/css/site.css", "static *=css/site.css" },
+    { "GET", "/static/", "static *=" },
+    { "GET", "/unknown", "fallback" },
+    { "PATCH", "/anything/at/all", "any *=anything/at/all" }
+  };
+  struct MHD_Router *router;
+  struct MHD_Daemon *d;
+  unsigned int i;
+  int ret;
+
+  router = MHD_router_create (&ahc_route, "fallback");
+  if (NULL == router)
+    return 1;
+  if ( (MHD_YES != MHD_router_add (router, MHD_ROUTE_GET, "/",
+                                   &ahc_route, "root")) ||
+       (MHD_YES != MHD_router_add (router, MHD_ROUTE_GET, "/users",
+                                   &ahc_route, "users")) ||
+       (MHD_YES != MHD_router_add (router, MHD_ROUTE_GET, "/users/:id",
+                                   &ahc_route, "user")) ||
+       (MHD_YES != MHD_router_add (router, MHD_ROUTE_POST | MHD_ROUTE_PUT,
+                                   "/users/:id",
+                                   &ahc_route, "update")) ||
+       (MHD_YES != MHD_router_add (router, MHD_ROUTE_GET, "/users/me",
+                                   &ahc_route, "me")) ||
+       (MHD_YES != MHD_router_add (router, MHD_ROUTE_GET,
+                                   "/users/:id/posts/:post",
+                                   &ahc_route, "post")) ||
+       (MHD_YES != MHD_router_add (router, MHD_ROUTE_GET, "/static/*",
+                                   &ahc_route, "static")) ||
+       (MHD_YES != MHD_router_add (router, MHD_ROUTE_PATCH, "/*",
+                                   &ahc_route, "any")) )
+    {
+      MHD_router_destroy (router);
+      return 2;
+    }
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        port,
+                        NULL, NULL,
+                        &MHD_router_access_handler, router,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    {
+      MHD_router_destroy (router);
+      return 4;
+    }
+  ret = 0;
+  for (i = 0; i < sizeof (checks) / sizeof (checks[0]); i++)
+    if (0 != check_route (port, &checks[i]))
+      ret = 8;
+  MHD_stop_daemon (d);
+  MHD_router_destroy (router);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += test_invalid ();
+  errorCount += test_routes (MHD_USE_SELECT_INTERNALLY, 1183);
+  errorCount += test_routes (MHD_USE_THREAD_PER_CONNECTION, 1183);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,328 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_shutdown_grace.c
+ * @brief  Testcase for #MHD_OPTION_SHUTDOWN_GRACE_MS: a request in
+ *         flight is completed with "Connection: close", an idle
+ *         keep-alive connection is closed and #MHD_stop_daemon()
+ *         returns once both are gone
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1196
+
+/**
+ * Grace period for the shutdown, in milliseconds.
+ */
+#define GRACE 3000
+
+/**
+ * How long the slow request takes, in milliseconds.
+ */
+#define SLOW 300
+
+/**
+ * Set on errors in the callbacks.
+ */
+static int failed;
+
+/**
+ * Number of requests terminated by the shutdown.
+ */
+static unsigned int killed;
+
+/**
+ * #MHD_YES once the slow request is suspended.
+ */
+static volatile int slow_started;
+
+/**
+ * Thread resuming the slow request.
+ */
+static pthread_t worker;
+
+
+static void *
+resume_later (void *cls)
+{
+  struct MHD_Connection *connection = cls;
+
+  usleep (SLOW * 1000);
+  MHD_resume_connection (connection);
+  return NULL;
+}
+
+
+static int
+ahc_slow (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int headers;
+  static int suspended;
+  struct MHD_Response *response;
+  int ret;
+
+  if (NULL == *con_cls)
+    {
+      *con_cls = &headers;
+      return MHD_YES;
+    }
+  if ( (&headers == *con_cls) &&
+       (0 == strcmp (url, "/slow")) )
+    {
+      *con_cls = &suspended;
+      MHD_suspend_connection (connection);
+      if (0 != pthread_create (&worker,
+                               NULL,
+                               &resume_later,
+                               connection))
+        abort ();
+      slow_started = MHD_YES;
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_buffer (strlen (url),
+                                              (void *) url,
+                                              MHD_RESPMEM_MUST_COPY);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+static void
+completed_cb (void *cls,
+              struct MHD_Connection *connection,
+              void **con_cls,
+              enum MHD_RequestTerminationCode toe)
+{
+  *con_cls = NULL;
+  if (MHD_REQUEST_TERMINATED_DAEMON_SHUTDOWN == toe)
+    killed++;
+}
+
+
+static unsigned long long
+now_ms (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec * 1000LLU + tv.tv_usec / 1000;
+}
+
+
+/**
+ * Reply received on a connection.
+ */
+struct Reply
+{
+  /**
+   * Socket to read from.
+   */
+  MHD_socket sock;
+
+  /**
+   * Data received until the connection was closed.
+   */
+  char data[512];
+
+  /**
+   * Number of bytes in @e data.
+   */
+  size_t have;
+
+  /**
+   * #MHD_YES if the connection was closed by MHD.
+   */
+  int closed;
+};
+
+
+/**
+ * Read on @a cls until the connection is closed.
+ *
+ * @param cls the `struct Reply`
+ * @return NULL
+ */
+static void *
+read_reply (void *cls)
+{
+  struct Reply *reply = cls;
+  ssize_t got;
+
+  reply->have = 0;
+  reply->closed = MHD_NO;
+  while (reply->have < sizeof (reply->data) - 1)
+    {
+      got = read (reply->sock,
+                  &reply->data[reply->have],
+                  sizeof (reply->data) - 1 - reply->have);
+      if (0 == got)
+        reply->closed = MHD_YES;
+      if (0 >= got)
+        break;
+      reply->have += got;
+    }
+  reply->data[reply->have] = '\0';
+  return NULL;
+}
+
+
+/**
+ * Send a request for @a url on @a sock.
+ *
+ * @return 0 on success
+ */
+static int
+send_request (MHD_socket sock,
+              const char *url)
+{
+  char request[128];
+
+  snprintf (request,
+            sizeof (request),
+            "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n",
+            url);
+  if (strlen (request) !=
+      (size_t) write (sock, request, strlen (request)))
+    return 1;
+  return 0;
+}
+
+
+static int
+check_shutdown_grace (unsigned int flags,
+                      unsigned int threads)
+{
+  struct MHD_Daemon *d;
+  struct Reply slow;
+  struct Reply idle;
+  pthread_t reader;
+  unsigned long long start;
+  unsigned long long ms;
+  char buf[512];
+  ssize_t got;
+  int ret;
+
+  failed = 0;
+  killed = 0;
+  slow_started = MHD_NO;
+  d = MHD_start_daemon (flags | MHD_USE_SUSPEND_RESUME |
+                        MHD_USE_PIPE_FOR_SHUTDOWN | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_slow, NULL,
+                        MHD_OPTION_NOTIFY_COMPLETED, &completed_cb, NULL,
+                        MHD_OPTION_THREAD_POOL_SIZE, threads,
+                        MHD_OPTION_SHUTDOWN_GRACE_MS, (unsigned int) GRACE,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  /* a keep-alive connection waiting for its next request */
+  idle.sock = connect_to_timeout (PORT, 5);
+  ret |= send_request (idle.sock, "/idle");
+  got = read (idle.sock, buf, sizeof (buf));
+  if ( (0 >= got) ||
+       (NULL == strstr (buf, "/idle")) )
+    ret |= 2;
+  /* a request in flight */
+  slow.sock = connect_to_timeout (PORT, 5);
+  ret |= send_request (slow.sock, "/slow");
+  if (0 != pthread_create (&reader,
+                           NULL,
+                           &read_reply,
+                           &slow))
+    abort ();
+  while (MHD_YES != slow_started)
+    usleep (1000);
+  start = now_ms ();
+  MHD_stop_daemon (d);
+  ms = now_ms () - start;
+  pthread_join (worker, NULL);
+  pthread_join (reader, NULL);
+  (void) read_reply (&idle);
+  MHD_socket_close_ (slow.sock);
+  MHD_socket_close_ (idle.sock);
+  /* waited for the slow request, but not for the idle connection */
+  if ( (ms < SLOW / 2) ||
+       (ms >= GRACE) )
+    ret |= 4;
+  if ( (MHD_YES != slow.closed) ||
+       (NULL == strstr (slow.data, "Connection: close")) ||
+       (NULL == strstr (slow.data, "\r\n\r\n/slow")) )
+    ret |= 8;
+  if ( (MHD_YES != idle.closed) ||
+       (0 != idle.have) )
+    ret |= 16;
+  if (0 != killed)
+    ret |= 32;
+  ret |= failed;
+  if (0 != ret)
+    fprintf (stderr,
+             "Shutdown grace failed with flags %u and %u threads: %d (stop took %llu ms)\n",
+             flags,
+             threads,
+             ret,
+             ms);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += check_shutdown_grace (MHD_USE_SELECT_INTERNALLY, 0);
+  errorCount += check_shutdown_grace (MHD_USE_SELECT_INTERNALLY, 2);
+  errorCount += check_shutdown_grace (MHD_USE_POLL_INTERNALLY, 2);
+#if EPOLL_SUPPORT
+  errorCount += check_shutdown_grace (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY, 0);
+  errorCount += check_shutdown_grace (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY, 2);
+#endif
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
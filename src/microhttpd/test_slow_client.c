@@ -0,0 +1,311 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_slow_client.c
+ * @brief  Testcase for #MHD_OPTION_HEADER_TIMEOUT_MS and
+ *         #MHD_OPTION_MIN_DATA_RATE: clients trickling in a header or
+ *         a body are closed although they are never idle, clients at
+ *         normal speed are served
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <signal.h>
+#include <sys/time.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1194
+
+/**
+ * Deadline for the header, in milliseconds.
+ */
+#define HEADER_TIMEOUT 300
+
+/**
+ * Minimum upload rate, in bytes per second.
+ */
+#define MIN_RATE 2000
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  if (0 != *upload_data_size)
+    {
+      *upload_data_size = 0;
+      return MHD_YES;
+    }
+  *con_cls = NULL;
+  response = MHD_create_response_from_buffer (2,
+                                              (void *) "ok",
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Get the statistics of @a d.
+ */
+static struct MHD_DaemonStats
+get_stats (struct MHD_Daemon *d)
+{
+  const union MHD_DaemonInfo *info;
+
+  info = MHD_get_daemon_info (d,
+                              MHD_DAEMON_INFO_STATS);
+  if (NULL == info)
+    abort ();
+  return info->stats;
+}
+
+
+static unsigned long long
+now_ms (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec * 1000LLU + tv.tv_usec / 1000;
+}
+
+
+/**
+ * Send @a start on a new connection, then keep sending @a chunk bytes
+ * every 100 ms until MHD closes the connection.
+ *
+ * @param start data to send at once
+ * @param chunk number of bytes to trickle per step
+ * @param limit give up after this many milliseconds
+ * @return milliseconds until the connection was closed, 0 if it
+ *         was still open at @a limit
+ */
+static unsigned long long
+trickle (const char *start,
+         size_t chunk,
+         unsigned long long limit)
+{
+  char buf[512];
+  unsigned long long begin;
+  unsigned long long ret;
+  MHD_socket sock;
+  ssize_t got;
+
+  sock = connect_to_timeout (PORT, 5);
+  memset (buf, 'a', sizeof (buf));
+  begin = now_ms ();
+  ret = 0;
+  if (strlen (start) !=
+      (size_t) write (sock, start, strlen (start)))
+    abort ();
+  while (now_ms () - begin < limit)
+    {
+      usleep (100000);
+      got = recv (sock, buf, sizeof (buf), MSG_DONTWAIT);
+      if ( (0 == got) ||
+           ( (0 > got) &&
+             (EAGAIN != errno) &&
+             (EWOULDBLOCK != errno) ) ||
+           ((ssize_t) chunk != write (sock, buf, chunk)) )
+        {
+          ret = now_ms () - begin;
+          break;
+        }
+    }
+  MHD_socket_close_ (sock);
+  return ret;
+}
+
+
+/**
+ * Send @a request on a new connection and check that the reply is
+ * "ok".
+ *
+ * @return 0 on success
+ */
+static int
+check_request (const char *request)
+{
+  char reply[512];
+  const char *body;
+  MHD_socket sock;
+  size_t have;
+  ssize_t got;
+  int ret;
+
+  sock = connect_to_timeout (PORT, 5);
+  ret = 1;
+  if (strlen (request) ==
+      (size_t) write (sock, request, strlen (request)))
+    {
+      have = 0;
+      while ( (have < sizeof (reply) - 1) &&
+              (0 < (got = read (sock,
+                                &reply[have],
+                                sizeof (reply) - 1 - have))) )
+        {
+          have += got;
+          reply[have] = '\0';
+          if ( (NULL != (body = strstr (reply, "\r\n\r\n"))) &&
+               (0 == strcmp (body + 4, "ok")) )
+            {
+              ret = 0;
+              break;
+            }
+        }
+    }
+  MHD_socket_close_ (sock);
+  return ret;
+}
+
+
+static int
+check_header_timeout (unsigned int flags)
+{
+  struct MHD_Daemon *d;
+  unsigned long long closed;
+  int ret;
+
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_HEADER_TIMEOUT_MS,
+                        (unsigned int) HEADER_TIMEOUT,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  if (0 != check_request ("GET / HTTP/1.1\r\nHost: localhost\r\n\r\n"))
+    ret |= 2;
+  /* a never-ending header line, one byte at a time */
+  closed = trickle ("GET / HTTP/1.1\r\nHost: localhost\r\nX-Slow: ",
+                    1,
+                    10 * HEADER_TIMEOUT);
+  if ( (closed < HEADER_TIMEOUT) ||
+       (closed > 5 * HEADER_TIMEOUT) )
+    ret |= 4;
+  if (1 != get_stats (d).header_timeouts)
+    ret |= 8;
+  if (0 != get_stats (d).slow_transfers)
+    ret |= 16;
+  MHD_stop_daemon (d);
+  if (0 != ret)
+    fprintf (stderr,
+             "Header deadline failed with flags %u: %d (closed after %llu ms)\n",
+             flags,
+             ret,
+             closed);
+  return ret;
+}
+
+
+static int
+check_min_rate (unsigned int flags)
+{
+  struct MHD_Daemon *d;
+  unsigned long long closed;
+  int ret;
+
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_MIN_DATA_RATE,
+                        (unsigned int) MIN_RATE,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 32;
+  ret = 0;
+  if (0 != check_request ("POST / HTTP/1.1\r\nHost: localhost\r\n"
+                          "Content-Length: 5\r\n\r\nhello"))
+    ret |= 64;
+  /* half the minimum rate; closed at the end of the first window */
+  closed = trickle ("POST / HTTP/1.1\r\nHost: localhost\r\n"
+                    "Content-Length: 1000000\r\n\r\n",
+                    MIN_RATE / 20,
+                    15000);
+  if ( (0 == closed) ||
+       (closed < 4000) )
+    ret |= 128;
+  if (1 != get_stats (d).slow_transfers)
+    ret |= 256;
+  if (0 != get_stats (d).header_timeouts)
+    ret |= 512;
+  MHD_stop_daemon (d);
+  if (0 != ret)
+    fprintf (stderr,
+             "Minimum data rate failed with flags %u: %d (closed after %llu ms)\n",
+             flags,
+             ret,
+             closed);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+#ifndef WINDOWS
+  signal (SIGPIPE, SIG_IGN);
+#endif
+  errorCount += check_header_timeout (MHD_USE_SELECT_INTERNALLY);
+  errorCount += check_header_timeout (MHD_USE_THREAD_PER_CONNECTION);
+#if EPOLL_SUPPORT
+  errorCount += check_header_timeout (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY);
+#endif
+  errorCount += check_min_rate (MHD_USE_SELECT_INTERNALLY);
+  errorCount += check_min_rate (MHD_USE_THREAD_PER_CONNECTION);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,259 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_slow_request.c
+ * @brief  Testcase for #MHD_OPTION_SLOW_REQUEST_CALLBACK
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1210
+
+#define BODY "done"
+
+/**
+ * Number of slow requests reported.
+ */
+static volatile unsigned int reports;
+
+/**
+ * Errors found in the reports.
+ */
+static volatile int report_errors;
+
+/**
+ * Whether the last report was for an aborted request.
+ */
+static volatile int last_aborted;
+
+
+static void
+sleep_ms (unsigned int ms)
+{
+  struct timespec ts;
+
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (ms % 1000) * 1000000L;
+  nanosleep (&ts, NULL);
+}
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  struct MHD_Response *response;
+  int ret;
+
+  if (0 == strcmp (url, "/slow"))
+    sleep_ms (300);
+  response = MHD_create_response_from_buffer (strlen (BODY),
+                                              BODY,
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+static void
+slow_cb (void *cls,
+         struct MHD_Connection *connection,
+         const struct MHD_SlowRequest *request)
+{
+  unsigned int i;
+  int seen_headers;
+
+  last_aborted = request->aborted;
+  if (MHD_YES == request->aborted)
+    {
+      if ( (MHD_REQUEST_TERMINATED_TIMEOUT_REACHED != request->termination_code) ||
+           (0 == request->bytes_received) ||
+           (0 != request->status) ||
+           (0 == request->num_steps) ||
+           (0 != strcmp ("closed",
+                         request->steps[request->num_steps - 1].state)) )
+        report_errors |= 1;
+    }
+  else
+    {
+      if ( (NULL == request->url) ||
+           (0 != strcmp ("/slow", request->url)) ||
+           (MHD_HTTP_OK != request->status) ||
+           (request->duration < 300000) ||
+           (0 == request->reads) ||
+           (0 == request->writes) ||
+           (0 == request->bytes_sent) ||
+           (0 == request->pool_peak) )
+        report_errors |= 2;
+      seen_headers = 0;
+      for (i = 0; i < request->num_steps; i++)
+        {
+          if (0 == strcmp ("headers received", request->steps[i].state))
+            seen_headers = 1;
+          if ( (i > 0) &&
+               (request->steps[i].time < request->steps[i - 1].time) )
+            report_errors |= 4;
+        }
+      if (! seen_headers)
+        report_errors |= 8;
+    }
+  reports++;
+}
+
+
+/**
+ * Get @a url on a new connection.
+ *
+ * @return 0 if the response arrived
+ */
+static int
+fetch (const char *url)
+{
+  char req[256];
+  char buf[1024];
+  MHD_socket sock;
+  size_t off;
+  ssize_t got;
+
+  sock = connect_to_timeout (PORT, 5);
+  snprintf (req,
+            sizeof (req),
+            "GET %s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+            url);
+  if ((ssize_t) strlen (req) != send (sock, req, strlen (req), 0))
+    abort ();
+  off = 0;
+  while (off < sizeof (buf) - 1)
+    {
+      got = recv (sock, &buf[off], sizeof (buf) - 1 - off, 0);
+      if (got <= 0)
+        break;
+      off += got;
+    }
+  buf[off] = '\0';
+  MHD_socket_close_ (sock);
+  if (NULL == strstr (buf, BODY))
+    return 1;
+  return 0;
+}
+
+
+/**
+ * Wait until @a count reports were made.
+ *
+ * @return 0 if they were
+ */
+static int
+wait_reports (unsigned int count)
+{
+  unsigned int i;
+
+  for (i = 0; i < 300; i++)
+    {
+      if (reports >= count)
+        return 0;
+      sleep_ms (10);
+    }
+  return 1;
+}
+
+
+static int
+test_daemon (unsigned int flags)
+{
+  struct MHD_Daemon *d;
+  MHD_socket sock;
+  int ret;
+
+  reports = 0;
+  report_errors = 0;
+  d = MHD_start_daemon (flags,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_SLOW_REQUEST_CALLBACK, &slow_cb, NULL,
+                        MHD_OPTION_SLOW_REQUEST_THRESHOLD_MS, 200,
+                        MHD_OPTION_CONNECTION_TIMEOUT, 1,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  /* fast requests are not reported */
+  if ( (0 != fetch ("/fast")) ||
+       (0 != fetch ("/fast")) )
+    ret |= 2;
+  if (0 != fetch ("/slow"))
+    ret |= 2;
+  if ( (0 != wait_reports (1)) ||
+       (MHD_NO != last_aborted) )
+    ret |= 4;
+  /* a request whose headers never complete times out */
+  sock = connect_to_timeout (PORT, 5);
+  if (5 != send (sock, "GET /", 5, 0))
+    ret |= 8;
+  if ( (0 != wait_reports (2)) ||
+       (MHD_YES != last_aborted) )
+    ret |= 16;
+  MHD_socket_close_ (sock);
+  if (2 != reports)
+    ret |= 32;
+  ret |= report_errors << 6;
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount;
+
+  errorCount = 0;
+  errorCount |= test_daemon (MHD_USE_SELECT_INTERNALLY);
+  errorCount |= test_daemon (MHD_USE_THREAD_PER_CONNECTION) << 12;
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %d)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
+
+/* end of test_slow_request.c */
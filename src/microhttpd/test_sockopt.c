@@ -0,0 +1,297 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_sockopt.c
+ * @brief  Testcase for the socket option handling: responses from
+ *         memory, from a callback and from a file sent on a keep-alive
+ *         connection must all be pushed out right away and must not
+ *         leave the socket corked
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#include <netinet/tcp.h>
+#endif
+
+#define BODY "Hello, world!"
+
+/**
+ * Maximum time a response may take, in ms; a response that stays
+ * corked is only sent after 200 ms.
+ */
+#define MAX_DELAY 150
+
+/**
+ * File descriptor of the file with #BODY.
+ */
+static int body_fd;
+
+
+static ssize_t
+body_reader (void *cls,
+             uint64_t pos,
+             char *buf,
+             size_t max)
+{
+  size_t left = strlen (BODY) - (size_t) pos;
+
+  if (0 == left)
+    return MHD_CONTENT_READER_END_OF_STREAM;
+  if (left > max)
+    left = max;
+  memcpy (buf, &BODY[pos], left);
+  return left;
+}
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  if (0 == strcmp (url, "/callback"))
+    response = MHD_create_response_from_callback (MHD_SIZE_UNKNOWN,
+                                                  1024,
+                                                  &body_reader,
+                                                  NULL,
+                                                  NULL);
+  else if (0 == strcmp (url, "/file"))
+    response = MHD_create_response_from_fd_at_offset64 (strlen (BODY),
+                                                        dup (body_fd),
+                                                        0);
+  else
+    response = MHD_create_response_from_buffer (strlen (BODY),
+                                                BODY,
+                                                MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+static uint64_t
+now_ms ()
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return (uint64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+
+/**
+ * Request @a url on @a sock, keeping the connection alive, and check
+ * that the reply arrives in time.
+ *
+ * @param sock socket to use
+ * @param url URL to request
+ * @return 0 on success
+ */
+static int
+check_request (MHD_socket sock,
+               const char *url)
+{
+  char request[128];
+  char reply[512];
+  const char *body;
+  uint64_t start;
+  size_t have;
+  ssize_t got;
+
+  snprintf (request,
+            sizeof (request),
+            "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n",
+            url);
+  start = now_ms ();
+  if (strlen (request) !=
+      (size_t) write (sock, request, strlen (request)))
+    abort ();
+  /* the body ends with the (possibly chunked) reply */
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          (0 < (got = read (sock,
+                            &reply[have],
+                            sizeof (reply) - 1 - have))) )
+    {
+      have += got;
+      reply[have] = '\0';
+      if ( (NULL != (body = strstr (reply, "\r\n\r\n"))) &&
+           (NULL != strstr (body, BODY)) &&
+           ( (NULL == strstr (reply, "chunked")) ||
+             (NULL != strstr (body, "\r\n0\r\n\r\n")) ) )
+        break;
+    }
+  reply[have] = '\0';
+  if ( (NULL == (body = strstr (reply, "\r\n\r\n"))) ||
+       (NULL == strstr (body, BODY)) )
+    return 1;
+  if (now_ms () - start > MAX_DELAY)
+    {
+      fprintf (stderr,
+               "Response for `%s' took %u ms\n",
+               url,
+               (unsigned int) (now_ms () - start));
+      return 2;
+    }
+  return 0;
+}
+
+
+/**
+ * Check that @a ssock is not left corked.
+ *
+ * @param ssock server side of the connection
+ * @return 0 on success
+ */
+static int
+check_uncorked (MHD_socket ssock)
+{
+#ifdef TCP_CORK
+  int val;
+  socklen_t len;
+
+  len = sizeof (val);
+  if (0 != getsockopt (ssock,
+                       IPPROTO_TCP,
+                       TCP_CORK,
+                       &val,
+                       &len))
+    return 0;
+  if (0 != val)
+    return 4;
+#endif
+  return 0;
+}
+
+
+static int
+check_sockopt (unsigned int flags)
+{
+  static const char *const urls[] = {
+    "/memory", "/callback", "/file", "/memory", "/file", "/callback"
+  };
+  struct MHD_Daemon *d;
+  MHD_socket lsock;
+  MHD_socket csock;
+  MHD_socket ssock;
+  struct sockaddr_in sa;
+  struct sockaddr_in ca;
+  socklen_t ca_len;
+  socklen_t sa_len;
+  unsigned int i;
+  int ret;
+
+  d = MHD_start_daemon (flags | MHD_USE_PIPE_FOR_SHUTDOWN | MHD_USE_DEBUG,
+                        0,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  lsock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == lsock)
+    abort ();
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  sa_len = sizeof (sa);
+  if ( (0 != bind (lsock, (struct sockaddr *) &sa, sizeof (sa))) ||
+       (0 != listen (lsock, 1)) ||
+       (0 != getsockname (lsock, (struct sockaddr *) &sa, &sa_len)) )
+    abort ();
+  csock = socket (AF_INET, SOCK_STREAM, 0);
+  if ( (MHD_INVALID_SOCKET == csock) ||
+       (0 != connect (csock, (struct sockaddr *) &sa, sizeof (sa))) )
+    abort ();
+  ca_len = sizeof (ca);
+  ssock = accept (lsock, (struct sockaddr *) &ca, &ca_len);
+  if (MHD_INVALID_SOCKET == ssock)
+    abort ();
+  MHD_socket_close_ (lsock);
+  if (MHD_YES != MHD_add_connection (d,
+                                     ssock,
+                                     (struct sockaddr *) &ca,
+                                     ca_len))
+    abort ();
+  ret = 0;
+  for (i = 0; i < sizeof (urls) / sizeof (urls[0]); i++)
+    {
+      ret |= check_request (csock, urls[i]);
+      ret |= check_uncorked (ssock);
+    }
+  MHD_socket_close_ (csock);
+  MHD_stop_daemon (d);
+  if (0 != ret)
+    fprintf (stderr,
+             "Socket options check failed with flags %u: %d\n",
+             flags,
+             ret);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  char tmpl[] = "/tmp/test-sockopt-XXXXXX";
+  int errorCount = 0;
+
+  body_fd = mkstemp (tmpl);
+  if (-1 == body_fd)
+    return 77;
+  (void) unlink (tmpl);
+  if (strlen (BODY) != (size_t) write (body_fd, BODY, strlen (BODY)))
+    abort ();
+  errorCount += check_sockopt (MHD_USE_SELECT_INTERNALLY);
+  errorCount += check_sockopt (MHD_USE_POLL_INTERNALLY);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_EPOLL))
+    errorCount += check_sockopt (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY);
+  close (body_fd);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
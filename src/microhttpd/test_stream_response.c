@@ -0,0 +1,521 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_stream_response.c
+ * @brief  Testcase for #MHD_create_response_stream(): a writer thread
+ *         pushes the body faster than the client reads it and is
+ *         throttled by the bounded queue; a writer whose client went
+ *         away learns so from the writable callback
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <errno.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1199
+
+/**
+ * Size of each buffer written.
+ */
+#define BUF_SIZE 8192
+
+/**
+ * Number of buffers written.
+ */
+#define BUFFERS 64
+
+/**
+ * Limit of the queue of the stream.
+ */
+#define MAX_QUEUED (4 * BUF_SIZE)
+
+
+/**
+ * Stream of the response of the last request.
+ */
+static struct MHD_ResponseStream *stream;
+
+/**
+ * Protects the fields below.
+ */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Signalled when #writable or #stream is set.
+ */
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+/**
+ * Set by the writable callback.
+ */
+static int writable;
+
+/**
+ * Number of buffers released by MHD.
+ */
+static unsigned int freed;
+
+/**
+ * Set once the queue was full or all buffers were written, so that
+ * the reader may start.
+ */
+static int may_read;
+
+/**
+ * Signalled when #may_read is set.
+ */
+static pthread_cond_t may_read_cond = PTHREAD_COND_INITIALIZER;
+
+
+static void
+writable_cb (void *cls)
+{
+  pthread_mutex_lock (&lock);
+  writable = 1;
+  pthread_cond_signal (&cond);
+  pthread_mutex_unlock (&lock);
+}
+
+
+static void
+free_cb (void *cls)
+{
+  pthread_mutex_lock (&lock);
+  freed++;
+  pthread_mutex_unlock (&lock);
+}
+
+
+static int
+ahc_stream (void *cls,
+            struct MHD_Connection *connection,
+            const char *url,
+            const char *method,
+            const char *version,
+            const char *upload_data,
+            size_t *upload_data_size,
+            void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  struct MHD_ResponseStream *s;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  response = MHD_create_response_stream (MAX_QUEUED,
+                                         &writable_cb,
+                                         NULL,
+                                         &s);
+  if (NULL == response)
+    return MHD_NO;
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  pthread_mutex_lock (&lock);
+  stream = s;
+  pthread_cond_signal (&cond);
+  pthread_mutex_unlock (&lock);
+  return ret;
+}
+
+
+static MHD_socket
+connect_to (uint16_t port)
+{
+  MHD_socket sock;
+  struct sockaddr_in sa;
+  int rcvbuf;
+
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sock)
+    abort ();
+  /* keep the kernel from absorbing the whole body before the reader
+     starts, so that the queue of the stream fills up even when MHD
+     outpaces the writer */
+  rcvbuf = BUF_SIZE;
+  setsockopt (sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof (rcvbuf));
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (port);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (sock,
+                    (struct sockaddr *) &sa,
+                    sizeof (sa)))
+    abort ();
+  return sock;
+}
+
+
+/**
+ * Send @a req and wait for the handler to create the stream.
+ *
+ * @param req the request
+ * @return the connection
+ */
+static MHD_socket
+open_stream (const char *req)
+{
+  MHD_socket sock;
+
+  pthread_mutex_lock (&lock);
+  stream = NULL;
+  freed = 0;
+  pthread_mutex_unlock (&lock);
+  sock = connect_to (PORT);
+  if (strlen (req) != (size_t) write (sock, req, strlen (req)))
+    abort ();
+  pthread_mutex_lock (&lock);
+  while (NULL == stream)
+    pthread_cond_wait (&cond, &lock);
+  pthread_mutex_unlock (&lock);
+  return sock;
+}
+
+
+/**
+ * Let the reader start.
+ */
+static void
+allow_reading (void)
+{
+  pthread_mutex_lock (&lock);
+  may_read = 1;
+  pthread_cond_signal (&may_read_cond);
+  pthread_mutex_unlock (&lock);
+}
+
+
+/**
+ * Write a buffer to the stream, waiting for the writable callback
+ * while the queue is full.
+ *
+ * @param data the buffer
+ * @param[in,out] fulls incremented for each full queue
+ * @return result of the last write
+ */
+static enum MHD_StreamWriteResult
+write_buffer (const char *data,
+              unsigned int *fulls)
+{
+  enum MHD_StreamWriteResult r;
+  struct timespec until;
+
+  for (;;)
+    {
+      pthread_mutex_lock (&lock);
+      writable = 0;
+      pthread_mutex_unlock (&lock);
+      r = MHD_response_stream_write (stream,
+                                     data,
+                                     BUF_SIZE,
+                                     &free_cb,
+                                     NULL);
+      if (MHD_STREAM_WRITE_FULL != r)
+        return r;
+      (*fulls)++;
+      allow_reading ();
+      clock_gettime (CLOCK_REALTIME, &until);
+      until.tv_sec += 5;
+      pthread_mutex_lock (&lock);
+      while ( (0 == writable) &&
+              (ETIMEDOUT != pthread_cond_timedwait (&cond, &lock, &until)) )
+        ;
+      if (0 == writable)
+        {
+          pthread_mutex_unlock (&lock);
+          return MHD_STREAM_WRITE_ERROR;
+        }
+      pthread_mutex_unlock (&lock);
+    }
+}
+
+
+/**
+ * Arguments of #reader.
+ */
+struct ReaderArgs
+{
+  MHD_socket sock;
+  char *buf;
+  size_t size;
+  size_t have;
+  int chunked;
+};
+
+
+/**
+ * Read the whole response once the queue of the stream filled up
+ * (or all buffers were written).
+ *
+ * @param cls the `struct ReaderArgs`
+ * @return NULL
+ */
+static void *
+reader (void *cls)
+{
+  struct ReaderArgs *args = cls;
+  ssize_t got;
+
+  pthread_mutex_lock (&lock);
+  while (0 == may_read)
+    pthread_cond_wait (&may_read_cond, &lock);
+  pthread_mutex_unlock (&lock);
+  while ( (args->have < args->size) &&
+          (0 < (got = read (args->sock,
+                            &args->buf[args->have],
+                            args->size - args->have))) )
+    {
+      args->have += got;
+      /* a chunked body does not end the connection */
+      if ( (args->chunked) &&
+           (args->have >= 7) &&
+           (0 == memcmp (&args->buf[args->have - 7], "\r\n0\r\n\r\n", 7)) )
+        break;
+    }
+  return NULL;
+}
+
+
+/**
+ * Check that @a resp is the header and the body written by
+ * test_stream(), decoding the chunked encoding if @a chunked.
+ *
+ * @return 0 if it is
+ */
+static int
+check_body (const char *resp,
+            size_t have,
+            const char *expected,
+            int chunked)
+{
+  const char *pos;
+  const char *end;
+  size_t len;
+  size_t n;
+  char *stop;
+
+  end = &resp[have];
+  if (NULL == (pos = strstr (resp, "\r\n\r\n")))
+    return 1;
+  if (0 != strncmp (resp, "HTTP/1.", strlen ("HTTP/1.")))
+    return 1;
+  pos += 4;
+  if (! chunked)
+    {
+      if ( ((size_t) (end - pos) != BUFFERS * BUF_SIZE) ||
+           (0 != memcmp (pos, expected, BUFFERS * BUF_SIZE)) )
+        return 2;
+      return 0;
+    }
+  len = 0;
+  for (;;)
+    {
+      n = strtoul (pos, &stop, 16);
+      if ( (stop == pos) ||
+           (stop + 2 > end) ||
+           (0 != memcmp (stop, "\r\n", 2)) )
+        return 4;
+      pos = stop + 2;
+      if (0 == n)
+        break;
+      if ( (pos + n + 2 > end) ||
+           (len + n > BUFFERS * BUF_SIZE) ||
+           (0 != memcmp (pos, &expected[len], n)) ||
+           (0 != memcmp (&pos[n], "\r\n", 2)) )
+        return 4;
+      len += n;
+      pos += n + 2;
+    }
+  if ( (BUFFERS * BUF_SIZE != len) ||
+       (pos + 2 != end) ||
+       (0 != memcmp (pos, "\r\n", 2)) )
+    return 4;
+  return 0;
+}
+
+
+/**
+ * Push #BUFFERS buffers to a client that starts reading late and
+ * check that the writer was throttled, that all buffers were
+ * released and that the client got them all.
+ *
+ * @param req the request to send
+ * @param chunked non-zero if the body is chunked
+ * @param data the body to send
+ * @return 0 on success
+ */
+static int
+test_stream (const char *req,
+             int chunked,
+             const char *data)
+{
+  struct ReaderArgs args;
+  pthread_t pt;
+  unsigned int fulls;
+  unsigned int i;
+  int ret;
+
+  pthread_mutex_lock (&lock);
+  may_read = 0;
+  pthread_mutex_unlock (&lock);
+  args.sock = open_stream (req);
+  args.size = BUFFERS * (BUF_SIZE + 16) + 1024;
+  args.have = 0;
+  args.chunked = chunked;
+  if (NULL == (args.buf = malloc (args.size + 1)))
+    abort ();
+  if (0 != pthread_create (&pt, NULL, &reader, &args))
+    abort ();
+  ret = 0;
+  fulls = 0;
+  for (i = 0; i < BUFFERS; i++)
+    if (MHD_STREAM_WRITE_OK != write_buffer (&data[i * BUF_SIZE],
+                                             &fulls))
+      ret |= 1;
+  allow_reading ();
+  MHD_response_stream_close (stream);
+  pthread_join (pt, NULL);
+  args.buf[args.have] = '\0';
+  ret |= check_body (args.buf, args.have, data, chunked) << 1;
+  /* the queue holds a few buffers only */
+  if (0 == fulls)
+    ret |= 16;
+  /* the connection may still be releasing the last buffer */
+  usleep (100000);
+  pthread_mutex_lock (&lock);
+  if (BUFFERS != freed)
+    ret |= 32;
+  pthread_mutex_unlock (&lock);
+  MHD_socket_close_ (args.sock);
+  free (args.buf);
+  return ret;
+}
+
+
+/**
+ * Write to a stream whose client closes the connection without
+ * reading and check that the writer learns that it is gone.
+ *
+ * @param data data to write
+ * @return 0 on success
+ */
+static int
+test_client_gone (const char *data)
+{
+  MHD_socket sock;
+  enum MHD_StreamWriteResult r;
+  unsigned int fulls;
+  unsigned int written;
+  int ret;
+
+  sock = open_stream ("GET /stream HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  MHD_socket_close_ (sock);
+  ret = 0;
+  fulls = 0;
+  written = 0;
+  /* the connection is closed once MHD fails to send */
+  while (MHD_STREAM_WRITE_OK == (r = write_buffer (data, &fulls)))
+    {
+      written++;
+      usleep (10000);
+      if (written > 1000)
+        break;
+    }
+  if (MHD_STREAM_WRITE_CLOSED != r)
+    ret |= 64;
+  MHD_response_stream_close (stream);
+  pthread_mutex_lock (&lock);
+  if (written != freed)
+    ret |= 128;
+  pthread_mutex_unlock (&lock);
+  return ret;
+}
+
+
+static int
+test_daemon (unsigned int flags,
+             unsigned int pool,
+             const char *data)
+{
+  struct MHD_Daemon *d;
+  int ret;
+
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_stream, NULL,
+                        MHD_OPTION_THREAD_POOL_SIZE, pool,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 256;
+  ret = 0;
+  ret |= test_stream ("GET /stream HTTP/1.1\r\nHost: localhost\r\n\r\n",
+                      1,
+                      data);
+  ret |= test_stream ("GET /stream HTTP/1.0\r\n\r\n",
+                      0,
+                      data);
+  ret |= test_client_gone (data);
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  char *data;
+  unsigned int i;
+  int errorCount = 0;
+
+  if (NULL == (data = malloc (BUFFERS * BUF_SIZE)))
+    return 99;
+  for (i = 0; i < BUFFERS * BUF_SIZE; i++)
+    data[i] = 'a' + (i / BUF_SIZE + i) % 26;
+  errorCount += test_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_SUSPEND_RESUME,
+                             0, data);
+  errorCount += test_daemon (MHD_USE_SELECT_INTERNALLY, 0, data);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_EPOLL))
+    errorCount += test_daemon (MHD_USE_SELECT_INTERNALLY |
+                               MHD_USE_EPOLL_LINUX_ONLY |
+                               MHD_USE_SUSPEND_RESUME,
+                               2, data);
+  free (data);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,291 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_suspend_timeout.c
+ * @brief  Testcase for #MHD_suspend_connection_with_timeout(): expired
+ *         suspensions are resumed or closed, suspensions resumed by
+ *         the application before their deadline are not affected
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1195
+
+/**
+ * Deadline of the suspensions, in milliseconds.
+ */
+#define SUSPEND_TIMEOUT 300
+
+/**
+ * Set on errors in the callbacks.
+ */
+static int failed;
+
+/**
+ * Number of requests closed due to their deadline.
+ */
+static unsigned int timed_out;
+
+/**
+ * Thread resuming a connection early, if any.
+ */
+static pthread_t worker;
+
+/**
+ * #MHD_YES if @e worker was started and not joined yet.
+ */
+static int worker_started;
+
+
+static void *
+resume_early (void *cls)
+{
+  struct MHD_Connection *connection = cls;
+
+  usleep (50000);
+  MHD_resume_connection (connection);
+  return NULL;
+}
+
+
+static int
+ahc_suspend (void *cls,
+             struct MHD_Connection *connection,
+             const char *url,
+             const char *method,
+             const char *version,
+             const char *upload_data,
+             size_t *upload_data_size,
+             void **con_cls)
+{
+  static int headers;
+  static int suspended;
+  struct MHD_Response *response;
+  int ret;
+
+  if (NULL == *con_cls)
+    {
+      *con_cls = &headers;
+      return MHD_YES;
+    }
+  if (&headers == *con_cls)
+    {
+      *con_cls = &suspended;
+      if (0 == strcmp (url, "/close"))
+        {
+          if (MHD_YES !=
+              MHD_suspend_connection_with_timeout (connection,
+                                                   SUSPEND_TIMEOUT,
+                                                   MHD_SUSPEND_TIMEOUT_CLOSE))
+            failed |= 1;
+          return MHD_YES;
+        }
+      if (MHD_YES !=
+          MHD_suspend_connection_with_timeout (connection,
+                                               (0 == strcmp (url, "/early"))
+                                               ? 10 * SUSPEND_TIMEOUT
+                                               : SUSPEND_TIMEOUT,
+                                               MHD_SUSPEND_TIMEOUT_RESUME))
+        failed |= 2;
+      if (0 == strcmp (url, "/early"))
+        {
+          if (0 != pthread_create (&worker,
+                                   NULL,
+                                   &resume_early,
+                                   connection))
+            abort ();
+          worker_started = MHD_YES;
+        }
+      return MHD_YES;
+    }
+  if (0 == strcmp (url, "/close"))
+    failed |= 4; /* must not be called again */
+  response = MHD_create_response_from_buffer (strlen (url),
+                                              (void *) url,
+                                              MHD_RESPMEM_MUST_COPY);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+static void
+completed_cb (void *cls,
+              struct MHD_Connection *connection,
+              void **con_cls,
+              enum MHD_RequestTerminationCode toe)
+{
+  *con_cls = NULL;
+  if (MHD_REQUEST_TERMINATED_TIMEOUT_REACHED == toe)
+    timed_out++;
+}
+
+
+static unsigned long long
+now_ms (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec * 1000LLU + tv.tv_usec / 1000;
+}
+
+
+/**
+ * Request @a url on @a sock and wait for the reply.
+ *
+ * @param sock socket to use
+ * @param url URL to request
+ * @param expected expected body, NULL if the connection is to be closed
+ * @param[out] ms set to the milliseconds it took
+ * @return 0 on success
+ */
+static int
+check_request (MHD_socket sock,
+               const char *url,
+               const char *expected,
+               unsigned long long *ms)
+{
+  char request[128];
+  char reply[512];
+  const char *body;
+  unsigned long long start;
+  size_t have;
+  ssize_t got;
+  int ret;
+
+  snprintf (request,
+            sizeof (request),
+            "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n",
+            url);
+  start = now_ms ();
+  if (strlen (request) !=
+      (size_t) write (sock, request, strlen (request)))
+    return 8;
+  ret = 16;
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          (0 < (got = read (sock,
+                            &reply[have],
+                            sizeof (reply) - 1 - have))) )
+    {
+      have += got;
+      reply[have] = '\0';
+      if ( (NULL != expected) &&
+           (NULL != (body = strstr (reply, "\r\n\r\n"))) &&
+           (0 == strcmp (body + 4, expected)) )
+        {
+          ret = 0;
+          break;
+        }
+    }
+  if ( (NULL == expected) &&
+       (0 == have) &&
+       (0 == got) )
+    ret = 0; /* closed without a reply */
+  *ms = now_ms () - start;
+  if (MHD_YES == worker_started)
+    {
+      pthread_join (worker, NULL);
+      worker_started = MHD_NO;
+    }
+  return ret;
+}
+
+
+static int
+check_suspend_timeout (unsigned int flags)
+{
+  struct MHD_Daemon *d;
+  MHD_socket sock;
+  unsigned long long ms;
+  int ret;
+
+  failed = 0;
+  timed_out = 0;
+  d = MHD_start_daemon (flags | MHD_USE_SUSPEND_RESUME | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_suspend, NULL,
+                        MHD_OPTION_NOTIFY_COMPLETED, &completed_cb, NULL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 32;
+  ret = 0;
+  sock = connect_to_timeout (PORT, 5);
+  /* resumed by the application long before the deadline */
+  ret |= check_request (sock, "/early", "/early", &ms);
+  if (ms >= SUSPEND_TIMEOUT)
+    ret |= 64;
+  /* resumed by the deadline */
+  ret |= check_request (sock, "/resume", "/resume", &ms);
+  if ( (ms < SUSPEND_TIMEOUT) ||
+       (ms > 5 * SUSPEND_TIMEOUT) )
+    ret |= 128;
+  /* closed by the deadline */
+  ret |= check_request (sock, "/close", NULL, &ms);
+  if ( (ms < SUSPEND_TIMEOUT) ||
+       (ms > 5 * SUSPEND_TIMEOUT) )
+    ret |= 256;
+  MHD_socket_close_ (sock);
+  MHD_stop_daemon (d);
+  ret |= failed;
+  if (1 != timed_out)
+    ret |= 512;
+  if (0 != ret)
+    fprintf (stderr,
+             "Suspend timeouts failed with flags %u: %d\n",
+             flags,
+             ret);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += check_suspend_timeout (MHD_USE_SELECT_INTERNALLY);
+  errorCount += check_suspend_timeout (MHD_USE_POLL_INTERNALLY);
+#if EPOLL_SUPPORT
+  errorCount += check_suspend_timeout (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY);
+#endif
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,271 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_thread_cache.c
+ * @brief  Testcase for reusing threads in #MHD_USE_THREAD_PER_CONNECTION
+ *         mode (#MHD_OPTION_THREAD_CACHE_SIZE)
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1116
+
+/**
+ * Number of requests sent one after the other.
+ */
+#define REQUESTS 32
+
+/**
+ * Number of connections open at the same time.
+ */
+#define CONCURRENT 4
+
+
+/**
+ * Marks the threads that already handled a request.
+ */
+static pthread_key_t seen;
+
+/**
+ * Number of threads that handled a request.
+ */
+static unsigned int num_threads;
+
+/**
+ * Protects #num_threads.
+ */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  if (NULL == pthread_getspecific (seen))
+    {
+      (void) pthread_setspecific (seen, &marker);
+      pthread_mutex_lock (&lock);
+      num_threads++;
+      pthread_mutex_unlock (&lock);
+    }
+  response = MHD_create_response_from_buffer (strlen (url),
+                                              (void *) url,
+                                              MHD_RESPMEM_MUST_COPY);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Connect to the daemon and send a request.
+ *
+ * @param n number in the URL
+ * @return the socket
+ */
+static MHD_socket
+send_request (unsigned int n)
+{
+  struct sockaddr_in sa;
+  char request[128];
+  MHD_socket sock;
+
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if ( (MHD_INVALID_SOCKET == sock) ||
+       (0 != connect (sock, (struct sockaddr *) &sa, sizeof (sa))) )
+    abort ();
+  snprintf (request,
+            sizeof (request),
+            "GET /%u HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+            n);
+  if (strlen (request) !=
+      (size_t) write (sock, request, strlen (request)))
+    abort ();
+  return sock;
+}
+
+
+/**
+ * Read the reply on a connection and check that it echoes the URL.
+ *
+ * @param sock connection to read from
+ * @param n number in the URL
+ * @return 0 on success
+ */
+static int
+check_reply (MHD_socket sock,
+             unsigned int n)
+{
+  char reply[512];
+  char url[16];
+  const char *body;
+  size_t have;
+  ssize_t got;
+
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          (0 < (got = read (sock, &reply[have], sizeof (reply) - 1 - have))) )
+    have += got;
+  reply[have] = '\0';
+  MHD_socket_close_ (sock);
+  snprintf (url, sizeof (url), "/%u", n);
+  if ( (NULL == (body = strstr (reply, "\r\n\r\n"))) ||
+       (0 != strcmp (body + 4, url)) )
+    return 1;
+  return 0;
+}
+
+
+/**
+ * Current number of threads that handled a request.
+ *
+ * @return #num_threads
+ */
+static unsigned int
+get_num_threads ()
+{
+  unsigned int ret;
+
+  pthread_mutex_lock (&lock);
+  ret = num_threads;
+  pthread_mutex_unlock (&lock);
+  return ret;
+}
+
+
+/**
+ * Check that requests one after the other reuse a thread, that
+ * concurrent connections are served, that parked threads time out
+ * and that the daemon stops with both parked and busy threads.
+ *
+ * @return 0 on success
+ */
+static int
+check_cache ()
+{
+  struct MHD_Daemon *d;
+  MHD_socket socks[CONCURRENT];
+  MHD_socket idle;
+  struct sockaddr_in sa;
+  unsigned int i;
+  unsigned int before;
+  int ret;
+
+  num_threads = 0;
+  d = MHD_start_daemon (MHD_USE_THREAD_PER_CONNECTION | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_THREAD_CACHE_SIZE, CONCURRENT,
+                        MHD_OPTION_THREAD_CACHE_TIMEOUT, 1,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  for (i = 0; i < REQUESTS; i++)
+    ret |= check_reply (send_request (i), i);
+  /* a connection may be accepted before the previous thread parked */
+  if (get_num_threads () > REQUESTS / 4)
+    {
+      fprintf (stderr,
+               "%u threads for %u requests in a row\n",
+               get_num_threads (),
+               REQUESTS);
+      ret |= 2;
+    }
+  for (i = 0; i < CONCURRENT; i++)
+    socks[i] = send_request (i);
+  for (i = 0; i < CONCURRENT; i++)
+    ret |= check_reply (socks[i], i);
+  /* let all parked threads time out */
+  sleep (3);
+  before = get_num_threads ();
+  ret |= check_reply (send_request (0), 0);
+  if (get_num_threads () == before)
+    {
+      fprintf (stderr, "Parked thread did not time out\n");
+      ret |= 4;
+    }
+  /* stop with a parked thread and one waiting for a request */
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  idle = socket (AF_INET, SOCK_STREAM, 0);
+  if ( (MHD_INVALID_SOCKET == idle) ||
+       (0 != connect (idle, (struct sockaddr *) &sa, sizeof (sa))) )
+    abort ();
+  usleep (100000);
+  MHD_stop_daemon (d);
+  MHD_socket_close_ (idle);
+  if (0 != ret)
+    fprintf (stderr,
+             "Thread cache failed: %d\n",
+             ret);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  if (0 != pthread_key_create (&seen, NULL))
+    return 99;
+  errorCount += check_cache ();
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
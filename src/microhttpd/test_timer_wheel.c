@@ -0,0 +1,270 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_timer_wheel.c
+ * @brief  Testcase for custom connection timeouts (set with
+ *         #MHD_CONNECTION_OPTION_TIMEOUT) and for timeouts of less
+ *         than a second
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include "test_helpers.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+
+/**
+ * Custom timeout (in seconds) set for each new connection.
+ */
+#define CUSTOM_TIMEOUT 1
+
+
+static int
+ahc_never (void *cls,
+           struct MHD_Connection *connection,
+           const char *url,
+           const char *method,
+           const char *version,
+           const char *upload_data,
+           size_t *upload_data_size,
+           void **con_cls)
+{
+  abort ();
+  return MHD_NO;
+}
+
+
+/**
+ * Set a custom timeout on each new connection: #CUSTOM_TIMEOUT, or
+ * the number of milliseconds @a cls points to.
+ */
+static void
+notify_cb (void *cls,
+           struct MHD_Connection *connection,
+           void **socket_context,
+           enum MHD_ConnectionNotificationCode toe)
+{
+  const unsigned int *ms = cls;
+
+  if (MHD_CONNECTION_NOTIFY_STARTED != toe)
+    return;
+  if (NULL != ms)
+    {
+      if (MHD_YES != MHD_set_connection_option (connection,
+                                                MHD_CONNECTION_OPTION_TIMEOUT_MS,
+                                                *ms))
+        abort ();
+      return;
+    }
+  if (MHD_YES != MHD_set_connection_option (connection,
+                                            MHD_CONNECTION_OPTION_TIMEOUT,
+                                            (unsigned int) CUSTOM_TIMEOUT))
+    abort ();
+}
+
+
+/**
+ * Check if MHD closed @a sock, waiting at most @a ms milliseconds.
+ *
+ * @return 1 if closed, 0 if not
+ */
+static int
+is_closed (MHD_socket sock,
+           int ms)
+{
+  fd_set rs;
+  struct timeval tv;
+  char c;
+
+  FD_ZERO (&rs);
+  FD_SET (sock, &rs);
+  tv.tv_sec = ms / 1000;
+  tv.tv_usec = (ms % 1000) * 1000;
+  if (1 != select (sock + 1, &rs, NULL, NULL, &tv))
+    return 0;
+  return (0 >= read (sock, &c, 1)) ? 1 : 0;
+}
+
+
+static int
+test_timeout (int flags,
+              uint16_t port)
+{
+  struct MHD_Daemon *d;
+  MHD_socket idle;
+  MHD_socket busy;
+  unsigned int i;
+  time_t start;
+  int ret;
+
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        port,
+                        NULL, NULL,
+                        &ahc_never, NULL,
+                        MHD_OPTION_NOTIFY_CONNECTION, &notify_cb, NULL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  start = time (NULL);
+  idle = connect_to (port);
+  busy = connect_to (port);
+  /* keep 'busy' active well past its original deadline by sending
+     a partial request line, the wheel must reschedule it */
+  for (i = 0; i < 6; i++)
+    {
+      if (1 != write (busy, "G", 1))
+        ret |= 2;
+      if (is_closed (busy, 400))
+        ret |= 4;
+    }
+  if (! is_closed (idle, 0))
+    ret |= 8;
+  /* once idle, 'busy' must time out as well */
+  if (! is_closed (busy, 5000))
+    ret |= 16;
+  if (time (NULL) - start > 3 + 2 * CUSTOM_TIMEOUT)
+    ret |= 32;
+  MHD_socket_close_ (idle);
+  MHD_socket_close_ (busy);
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+static uint64_t
+now_ms ()
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return (uint64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+
+/**
+ * Check a timeout of less than a second, either as the default
+ * timeout of the daemon or as a custom timeout (in the timer wheel).
+ *
+ * @param flags event loop flags for the daemon
+ * @param port port to use
+ * @param custom non-zero to set the timeout per connection
+ * @return 0 on success
+ */
+static int
+test_timeout_ms (int flags,
+                 uint16_t port,
+                 int custom)
+{
+  static unsigned int timeout_ms = 300;
+  struct MHD_Daemon *d;
+  MHD_socket sock;
+  uint64_t start;
+  uint64_t took;
+  int ret;
+
+  if (custom)
+    d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                          port,
+                          NULL, NULL,
+                          &ahc_never, NULL,
+                          MHD_OPTION_CONNECTION_TIMEOUT, (unsigned int) 10,
+                          MHD_OPTION_NOTIFY_CONNECTION, &notify_cb, &timeout_ms,
+                          MHD_OPTION_END);
+  else
+    d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                          port,
+                          NULL, NULL,
+                          &ahc_never, NULL,
+                          MHD_OPTION_CONNECTION_TIMEOUT_MS, timeout_ms,
+                          MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  start = now_ms ();
+  sock = connect_to (port);
+  if (is_closed (sock, 100))
+    ret |= 64;
+  if (! is_closed (sock, 2000))
+    ret |= 128;
+  took = now_ms () - start;
+  /* the timer wheel has a granularity of 100 ms */
+  if ( (took < timeout_ms) ||
+       (took > timeout_ms + 500) )
+    {
+      fprintf (stderr,
+               "Timeout of %u ms took %u ms\n",
+               timeout_ms,
+               (unsigned int) took);
+      ret |= 256;
+    }
+  MHD_socket_close_ (sock);
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += test_timeout (MHD_USE_SELECT_INTERNALLY,
+                              1085);
+#ifdef HAVE_POLL
+  errorCount += test_timeout (MHD_USE_POLL_INTERNALLY,
+                              1086);
+#endif
+#if EPOLL_SUPPORT
+  errorCount += test_timeout (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY,
+                              1087);
+#endif
+  errorCount += test_timeout_ms (MHD_USE_SELECT_INTERNALLY,
+                                 1085,
+                                 0);
+  errorCount += test_timeout_ms (MHD_USE_SELECT_INTERNALLY,
+                                 1085,
+                                 1);
+  errorCount += test_timeout_ms (MHD_USE_THREAD_PER_CONNECTION,
+                                 1085,
+                                 0);
+#if EPOLL_SUPPORT
+  errorCount += test_timeout_ms (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY,
+                                 1087,
+                                 1);
+#endif
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,244 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_unix_socket.c
+ * @brief  Testcase for AF_UNIX listen sockets: requests are served,
+ *         the client address has the family AF_UNIX and the peer
+ *         credentials are those of this process
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#if HAVE_SYS_UN_H
+
+/**
+ * Path of the socket.
+ */
+static char sock_path[64];
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  const union MHD_ConnectionInfo *info;
+  struct MHD_Response *response;
+  const char *body;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  body = "ok";
+  info = MHD_get_connection_info (connection,
+                                  MHD_CONNECTION_INFO_CLIENT_ADDRESS);
+  if ( (NULL == info) ||
+       (AF_UNIX != info->client_addr->sa_family) )
+    body = "bad address";
+  info = MHD_get_connection_info (connection,
+                                  MHD_CONNECTION_INFO_PEER_CREDENTIALS);
+  if (NULL != info)
+    {
+      if ( (getuid () != (uid_t) info->peer_credentials.uid) ||
+           (getgid () != (gid_t) info->peer_credentials.gid) ||
+           ( (-1 != info->peer_credentials.pid) &&
+             (getpid () != (pid_t) info->peer_credentials.pid) ) )
+        body = "bad credentials";
+    }
+#ifdef SO_PEERCRED
+  else
+    body = "no credentials";
+#endif
+  response = MHD_create_response_from_buffer (strlen (body),
+                                              (void *) body,
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Send a request to the daemon listening on #sock_path and check
+ * the reply.
+ *
+ * @return 0 on success
+ */
+static int
+check_request ()
+{
+  static const char request[] =
+    "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+  struct sockaddr_un sa;
+  char reply[512];
+  const char *body;
+  MHD_socket sock;
+  size_t have;
+  ssize_t got;
+
+  memset (&sa, 0, sizeof (sa));
+  sa.sun_family = AF_UNIX;
+  strcpy (sa.sun_path, sock_path);
+  sock = socket (AF_UNIX, SOCK_STREAM, 0);
+  if ( (MHD_INVALID_SOCKET == sock) ||
+       (0 != connect (sock, (struct sockaddr *) &sa, sizeof (sa))) )
+    abort ();
+  if (strlen (request) !=
+      (size_t) write (sock, request, strlen (request)))
+    abort ();
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          (0 < (got = read (sock,
+                            &reply[have],
+                            sizeof (reply) - 1 - have))) )
+    have += got;
+  reply[have] = '\0';
+  MHD_socket_close_ (sock);
+  if (NULL == (body = strstr (reply, "\r\n\r\n")))
+    return 1;
+  if (0 != strcmp (body + 4, "ok"))
+    {
+      fprintf (stderr,
+               "Unexpected reply `%s'\n",
+               body + 4);
+      return 2;
+    }
+  return 0;
+}
+
+
+/**
+ * Run a daemon on #sock_path with the given @a flags and send it
+ * a few requests.
+ *
+ * @param flags flags for the daemon
+ * @param own_socket use a listen socket created here with
+ *        #MHD_OPTION_LISTEN_SOCKET instead of #MHD_OPTION_SOCK_ADDR
+ * @return 0 on success
+ */
+static int
+check_unix (unsigned int flags,
+            int own_socket)
+{
+  struct MHD_Daemon *d;
+  struct sockaddr_un sa;
+  MHD_socket lsock;
+  unsigned int i;
+  int ret;
+
+  memset (&sa, 0, sizeof (sa));
+  sa.sun_family = AF_UNIX;
+  strcpy (sa.sun_path, sock_path);
+  (void) unlink (sock_path);
+  if (own_socket)
+    {
+      lsock = socket (AF_UNIX, SOCK_STREAM, 0);
+      if ( (MHD_INVALID_SOCKET == lsock) ||
+           (0 != bind (lsock, (struct sockaddr *) &sa, sizeof (sa))) ||
+           (0 != listen (lsock, 16)) )
+        abort ();
+      d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                            0,
+                            NULL, NULL,
+                            &ahc_echo, NULL,
+                            MHD_OPTION_LISTEN_SOCKET, lsock,
+                            MHD_OPTION_END);
+    }
+  else
+    d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                          0,
+                          NULL, NULL,
+                          &ahc_echo, NULL,
+                          MHD_OPTION_SOCK_ADDR, &sa,
+                          MHD_OPTION_END);
+  if (NULL == d)
+    {
+      (void) unlink (sock_path);
+      return 16;
+    }
+  ret = 0;
+  for (i = 0; i < 3; i++)
+    ret |= check_request ();
+  MHD_stop_daemon (d);
+  (void) unlink (sock_path);
+  if (0 != ret)
+    fprintf (stderr,
+             "AF_UNIX check failed with flags %u: %d\n",
+             flags,
+             ret);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  if (MHD_YES != MHD_is_feature_supported (MHD_FEATURE_UNIX_SOCKETS))
+    return 77;
+  snprintf (sock_path,
+            sizeof (sock_path),
+            "/tmp/test-unix-socket-%u",
+            (unsigned int) getpid ());
+  errorCount += check_unix (MHD_USE_SELECT_INTERNALLY, 0);
+  errorCount += check_unix (MHD_USE_POLL_INTERNALLY, 0);
+  errorCount += check_unix (MHD_USE_THREAD_PER_CONNECTION, 0);
+  errorCount += check_unix (MHD_USE_SELECT_INTERNALLY, 1);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_EPOLL))
+    errorCount += check_unix (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY, 0);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
+
+#else
+
+int
+main (int argc,
+      char *const *argv)
+{
+  return 77;
+}
+
+#endif
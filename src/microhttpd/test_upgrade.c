@@ -0,0 +1,332 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_upgrade.c
+ * @brief  Testcase for libmicrohttpd upgrading a connection
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+
+/**
+ * Thread we use to run the interaction with the upgraded socket.
+ */
+static pthread_t pt;
+
+/**
+ * Will be set to the upgraded socket.
+ */
+static MHD_socket usock;
+
+/**
+ * Set to 1 once the upgrade handler was called.
+ */
+static int done;
+
+
+/**
+ * Send @a text to @a sock, fail hard on errors.
+ */
+static int
+send_all (MHD_socket sock,
+          const char *text)
+{
+  size_t len = strlen (text);
+  size_t off;
+  ssize_t ret;
+
+  for (off = 0; off < len; off += ret)
+    {
+      ret = write (sock, &text[off], len - off);
+      if ( (-1 == ret) &&
+           (EAGAIN == errno) )
+        {
+          usleep (10000);
+          ret = 0;
+          continue;
+        }
+      if (ret <= 0)
+        return -1;
+    }
+  return 0;
+}
+
+
+/**
+ * Read character-by-character until we get an empty line, making
+ * sure that all of the lines in @a expect were seen (in order).
+ * Lines not listed in @a expect (i.e. "Date:") are ignored.
+ */
+static int
+recv_hdr (MHD_socket sock,
+          const char **expect)
+{
+  char buf[256];
+  size_t off;
+  ssize_t ret;
+  char c;
+
+  off = 0;
+  while (off < sizeof (buf) - 1)
+    {
+      ret = read (sock, &c, 1);
+      if ( (-1 == ret) &&
+           (EAGAIN == errno) )
+        {
+          usleep (10000);
+          continue;
+        }
+      if (1 != ret)
+        return -1;
+      if ('\r' == c)
+        continue;
+      if ('\n' == c)
+        {
+          buf[off] = '\0';
+          if (0 == off)
+            return (NULL == *expect) ? 0 : -1;
+          if ( (NULL != *expect) &&
+               (0 == strncmp (buf, *expect, strlen (*expect))) )
+            expect++;
+          off = 0;
+          continue;
+        }
+      buf[off++] = c;
+    }
+  return -1;
+}
+
+
+/**
+ * Read exactly @a text from @a sock.
+ */
+static int
+recv_all (MHD_socket sock,
+          const char *text)
+{
+  size_t len = strlen (text);
+  char buf[len];
+  size_t off;
+  ssize_t ret;
+
+  for (off = 0; off < len; off += ret)
+    {
+      ret = read (sock, &buf[off], len - off);
+      if ( (-1 == ret) &&
+           (EAGAIN == errno) )
+        {
+          usleep (10000);
+          ret = 0;
+          continue;
+        }
+      if (ret <= 0)
+        return -1;
+    }
+  if (0 != strncmp (text, buf, len))
+    return -1;
+  return 0;
+}
+
+
+/**
+ * Main function for the thread that runs the interaction with
+ * the upgraded socket.
+ *
+ * @param cls the handle for the upgrade
+ */
+static void *
+run_usock (void *cls)
+{
+  struct MHD_UpgradeResponseHandle *urh = cls;
+
+  if ( (0 != send_all (usock, "Hello")) ||
+       (0 != recv_all (usock, "World")) )
+    abort ();
+  if (MHD_YES != MHD_upgrade_action (urh,
+                                     MHD_UPGRADE_ACTION_CLOSE))
+    abort ();
+  return NULL;
+}
+
+
+/**
+ * Function called after a protocol "upgrade" response was sent
+ * successfully and the socket should now be controlled by some
+ * protocol other than HTTP.
+ *
+ * @param cls closure
+ * @param connection original HTTP connection handle
+ * @param con_cls value as set by the last call to the
+ *        MHD_AccessHandlerCallback
+ * @param extra_in bytes already read from @a sock by MHD
+ * @param extra_in_size number of bytes in @a extra_in
+ * @param sock socket to use for bi-directional communication
+ *        with the client.
+ * @param urh argument for #MHD_upgrade_action()s on this @a connection.
+ */
+static void
+upgrade_cb (void *cls,
+            struct MHD_Connection *connection,
+            void *con_cls,
+            const char *extra_in,
+            size_t extra_in_size,
+            MHD_socket sock,
+            struct MHD_UpgradeResponseHandle *urh)
+{
+  usock = sock;
+  if (0 != extra_in_size)
+    abort ();
+  if (0 != pthread_create (&pt,
+                           NULL,
+                           &run_usock,
+                           urh))
+    abort ();
+  done = 1;
+}
+
+
+/**
+ * A client has requested the given url using the given method.
+ * Queue an upgrade response for it.
+ */
+static int
+ahc_upgrade (void *cls,
+             struct MHD_Connection *connection,
+             const char *url,
+             const char *method,
+             const char *version,
+             const char *upload_data,
+             size_t *upload_data_size,
+             void **con_cls)
+{
+  struct MHD_Response *resp;
+  int ret;
+
+  resp = MHD_create_response_for_upgrade (&upgrade_cb,
+                                          NULL);
+  MHD_add_response_header (resp,
+                           MHD_HTTP_HEADER_UPGRADE,
+                           "Hello World Protocol");
+  ret = MHD_queue_response (connection,
+                            MHD_HTTP_SWITCHING_PROTOCOLS,
+                            resp);
+  MHD_destroy_response (resp);
+  return ret;
+}
+
+
+static int
+test_upgrade_internal (int flags,
+                       uint16_t port)
+{
+  struct MHD_Daemon *d;
+  MHD_socket sock;
+  struct sockaddr_in sa;
+  const char *expect[] = {
+    "HTTP/1.1 101 Switching Protocols",
+    "Upgrade: Hello World Protocol",
+    NULL
+  };
+
+  done = 0;
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG | MHD_USE_SUSPEND_RESUME,
+                        port,
+                        NULL, NULL,
+                        &ahc_upgrade, NULL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 2;
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sock)
+    abort ();
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (port);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (sock,
+                    (struct sockaddr *) &sa,
+                    sizeof (sa)))
+    abort ();
+  if (0 != send_all (sock,
+                     "GET / HTTP/1.1\r\n"
+                     "Host: localhost\r\n"
+                     "Connection: Upgrade\r\n"
+                     "Upgrade: Hello World Protocol\r\n"
+                     "\r\n"))
+    abort ();
+  if (0 != recv_hdr (sock, expect))
+    abort ();
+  if ( (0 != recv_all (sock, "Hello")) ||
+       (0 != send_all (sock, "World")) )
+    abort ();
+  pthread_join (pt, NULL);
+  if (1 != done)
+    abort ();
+  /* MHD must close the connection after MHD_UPGRADE_ACTION_CLOSE */
+  {
+    char c;
+
+    if (0 != read (sock, &c, 1))
+      {
+        MHD_socket_close_ (sock);
+        MHD_stop_daemon (d);
+        return 8;
+      }
+  }
+  MHD_socket_close_ (sock);
+  MHD_stop_daemon (d);
+  return 0;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += test_upgrade_internal (MHD_USE_SELECT_INTERNALLY,
+                                       1090);
+#ifdef HAVE_POLL
+  errorCount += test_upgrade_internal (MHD_USE_POLL_INTERNALLY,
+                                       1091);
+#endif
+#if EPOLL_SUPPORT
+  errorCount += test_upgrade_internal (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY,
+                                       1092);
+#endif
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,301 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_upload_buffer.c
+ * @brief  Testcase for #MHD_OPTION_UPLOAD_BUFFER_CALLBACK: the body
+ *         is received into the buffer of the application (or spliced
+ *         into a file) and passed to the access handler completely
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1190
+
+/**
+ * Size of the upload.
+ */
+#define UPLOAD_SIZE 100000
+
+/**
+ * Size of the buffer of the application.
+ */
+#define BUFFER_SIZE 4096
+
+/**
+ * Buffer the body is received into.
+ */
+static char app_buffer[BUFFER_SIZE];
+
+/**
+ * File the body is spliced into, -1 to use #app_buffer.
+ */
+static int app_fd;
+
+/**
+ * Number of body bytes the handler got so far.
+ */
+static size_t received;
+
+/**
+ * Number of body bytes spliced into #app_fd so far.
+ */
+static size_t spliced_size;
+
+/**
+ * Number of calls of the handler with data in #app_buffer.
+ */
+static unsigned int buffer_calls;
+
+/**
+ * Number of calls of the handler for data spliced to #app_fd.
+ */
+static unsigned int splice_calls;
+
+/**
+ * Set if the handler got wrong data.
+ */
+static int corrupt;
+
+
+static void *
+upload_buffer_cb (void *cls,
+                  struct MHD_Connection *connection,
+                  void **con_cls,
+                  uint64_t remaining,
+                  size_t *size,
+                  int *fd)
+{
+  if (-1 != app_fd)
+    {
+      *fd = app_fd;
+      *size = BUFFER_SIZE * 4;
+      return NULL;
+    }
+  *size = BUFFER_SIZE;
+  return app_buffer;
+}
+
+
+/**
+ * Check that @a data holds the bytes of the body starting at
+ * #received.
+ */
+static void
+check_data (const char *data,
+            size_t size)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    if ((char) ((received + i) % 251) != data[i])
+      corrupt = 1;
+  received += size;
+}
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  static char spliced[BUFFER_SIZE * 4];
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  if (0 != *upload_data_size)
+    {
+      if (NULL == upload_data)
+        {
+          /* spliced into the file */
+          if ( (*upload_data_size > sizeof (spliced)) ||
+               (*upload_data_size != (size_t) pread (app_fd,
+                                                     spliced,
+                                                     *upload_data_size,
+                                                     spliced_size)) )
+            corrupt = 1;
+          else
+            check_data (spliced, *upload_data_size);
+          spliced_size += *upload_data_size;
+          splice_calls++;
+        }
+      else
+        {
+          if (app_buffer == upload_data)
+            buffer_calls++;
+          check_data (upload_data, *upload_data_size);
+        }
+      *upload_data_size = 0;
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_buffer (2,
+                                              (void *) "ok",
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+static int
+check_upload (unsigned int flags,
+              int use_file)
+{
+  static char body[UPLOAD_SIZE];
+  struct MHD_Daemon *d;
+  struct sockaddr_in sa;
+  struct timeval tv;
+  char request[256];
+  char reply[512];
+  char path[64];
+  MHD_socket sock;
+  size_t len;
+  size_t have;
+  ssize_t got;
+  size_t i;
+  int ret;
+
+  app_fd = -1;
+  if (use_file)
+    {
+      snprintf (path,
+                sizeof (path),
+                "/tmp/test-upload-buffer-XXXXXX");
+      app_fd = mkstemp (path);
+      if (-1 == app_fd)
+        abort ();
+      (void) unlink (path);
+    }
+  received = 0;
+  spliced_size = 0;
+  buffer_calls = 0;
+  splice_calls = 0;
+  corrupt = 0;
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_UPLOAD_BUFFER_CALLBACK,
+                        &upload_buffer_cb, NULL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 16;
+  for (i = 0; i < UPLOAD_SIZE; i++)
+    body[i] = (char) (i % 251);
+  len = snprintf (request,
+                  sizeof (request),
+                  "PUT / HTTP/1.1\r\nHost: localhost\r\n"
+                  "Content-Length: %u\r\nConnection: close\r\n\r\n",
+                  (unsigned int) UPLOAD_SIZE);
+
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if ( (MHD_INVALID_SOCKET == sock) ||
+       (0 != connect (sock, (struct sockaddr *) &sa, sizeof (sa))) )
+    abort ();
+  tv.tv_sec = 5;
+  tv.tv_usec = 0;
+  (void) setsockopt (sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+  /* some of the body arrives with the headers */
+  if ( (len != (size_t) write (sock, request, len)) ||
+       (100 != write (sock, body, 100)) )
+    abort ();
+  usleep (50000);
+  if (UPLOAD_SIZE - 100 != write (sock, &body[100], UPLOAD_SIZE - 100))
+    abort ();
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          (0 < (got = read (sock,
+                            &reply[have],
+                            sizeof (reply) - 1 - have))) )
+    have += got;
+  reply[have] = '\0';
+  MHD_socket_close_ (sock);
+  MHD_stop_daemon (d);
+  if (-1 != app_fd)
+    (void) close (app_fd);
+  ret = 0;
+  if ( (UPLOAD_SIZE != received) ||
+       (corrupt) )
+    ret |= 1;
+#if HAVE_SPLICE
+  if ( (use_file) &&
+       (0 == splice_calls) )
+    ret |= 2;
+#endif
+  if ( (! use_file) &&
+       (0 == buffer_calls) )
+    ret |= 4;
+  if ( (NULL == strstr (reply, " 200 ")) ||
+       (NULL == strstr (reply, "\r\n\r\nok")) )
+    ret |= 8;
+  if (0 != ret)
+    fprintf (stderr,
+             "Upload into application buffer failed with flags %u: %d\n",
+             flags,
+             ret);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += check_upload (MHD_USE_SELECT_INTERNALLY, 0);
+  errorCount += check_upload (MHD_USE_SELECT_INTERNALLY, 1);
+  errorCount += check_upload (MHD_USE_THREAD_PER_CONNECTION, 0);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_EPOLL))
+    {
+      errorCount += check_upload (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY, 0);
+      errorCount += check_upload (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY, 1);
+    }
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
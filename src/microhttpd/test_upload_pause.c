@@ -0,0 +1,224 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_upload_pause.c
+ * @brief  Testcase for #MHD_pause_upload() and #MHD_resume_upload():
+ *         the access handler is not called while the upload is
+ *         paused and receives all of the data after resuming
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1189
+
+/**
+ * Size of the upload.
+ */
+#define UPLOAD_SIZE 32768
+
+/**
+ * How many bytes the handler consumes per call.
+ */
+#define CONSUME_SIZE 1000
+
+/**
+ * Number of calls of the handler with upload data.
+ */
+static volatile unsigned int upload_calls;
+
+/**
+ * Number of upload bytes the handler consumed.
+ */
+static volatile size_t received;
+
+/**
+ * Connection whose upload is paused, NULL if none.
+ */
+static struct MHD_Connection *volatile paused;
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  size_t consume;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  if (0 != *upload_data_size)
+    {
+      /* take a little and ask for a break every time */
+      consume = *upload_data_size;
+      if (consume > CONSUME_SIZE)
+        consume = CONSUME_SIZE;
+      *upload_data_size -= consume;
+      upload_calls++;
+      MHD_pause_upload (connection);
+      paused = connection;
+      received += consume;
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_buffer (2,
+                                              (void *) "ok",
+                                              MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+static int
+check_pause (unsigned int flags)
+{
+  static char request[UPLOAD_SIZE + 128];
+  struct MHD_Daemon *d;
+  struct MHD_Connection *connection;
+  struct sockaddr_in sa;
+  struct timeval tv;
+  char reply[512];
+  MHD_socket sock;
+  size_t len;
+  size_t have;
+  ssize_t got;
+  unsigned int calls;
+  unsigned int pauses;
+  int ret;
+
+  d = MHD_start_daemon (flags | MHD_USE_SUSPEND_RESUME | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 16;
+  upload_calls = 0;
+  received = 0;
+  paused = NULL;
+  len = snprintf (request,
+                  sizeof (request),
+                  "PUT / HTTP/1.1\r\nHost: localhost\r\n"
+                  "Content-Length: %u\r\nConnection: close\r\n\r\n",
+                  (unsigned int) UPLOAD_SIZE);
+  memset (&request[len], 'x', UPLOAD_SIZE);
+  len += UPLOAD_SIZE;
+
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if ( (MHD_INVALID_SOCKET == sock) ||
+       (0 != connect (sock, (struct sockaddr *) &sa, sizeof (sa))) )
+    abort ();
+  tv.tv_sec = 5;
+  tv.tv_usec = 0;
+  (void) setsockopt (sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+  if (len != (size_t) write (sock, request, len))
+    abort ();
+
+  ret = 0;
+  pauses = 0;
+  while (received < UPLOAD_SIZE)
+    {
+      if (NULL == (connection = paused))
+        {
+          usleep (1000);
+          continue;
+        }
+      /* the handler must not be called while the upload is paused */
+      calls = upload_calls;
+      usleep (20000);
+      if (calls != upload_calls)
+        ret |= 1;
+      paused = NULL;
+      MHD_resume_upload (connection);
+      if (++pauses > UPLOAD_SIZE)
+        break;
+    }
+  /* the last call paused as well */
+  if (NULL != (connection = paused))
+    {
+      paused = NULL;
+      MHD_resume_upload (connection);
+    }
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          (0 < (got = read (sock,
+                            &reply[have],
+                            sizeof (reply) - 1 - have))) )
+    have += got;
+  reply[have] = '\0';
+  MHD_socket_close_ (sock);
+  MHD_stop_daemon (d);
+  if (UPLOAD_SIZE != received)
+    ret |= 2;
+  if (upload_calls < UPLOAD_SIZE / CONSUME_SIZE)
+    ret |= 4;
+  if ( (NULL == strstr (reply, " 200 ")) ||
+       (NULL == strstr (reply, "\r\n\r\nok")) )
+    ret |= 8;
+  if (0 != ret)
+    fprintf (stderr,
+             "Upload pause failed with flags %u: %d\n",
+             flags,
+             ret);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+
+  errorCount += check_pause (MHD_USE_SELECT_INTERNALLY);
+  errorCount += check_pause (MHD_USE_POLL_INTERNALLY);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_EPOLL))
+    errorCount += check_pause (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
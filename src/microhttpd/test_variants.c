@@ -0,0 +1,222 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_variants.c
+ * @brief  Testcase for selecting encoded variants of a response
+ *         with #MHD_add_response_variant()
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1106
+
+
+static int
+ahc_variants (void *cls,
+              struct MHD_Connection *connection,
+              const char *url,
+              const char *method,
+              const char *version,
+              const char *upload_data,
+              size_t *upload_data_size,
+              void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response = cls;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  return MHD_queue_response (connection, MHD_HTTP_OK, response);
+}
+
+
+/**
+ * Request the resource with the given "Accept-Encoding" header and
+ * check the reply.
+ *
+ * @param accept value of the "Accept-Encoding" header, NULL for none
+ * @param encoding expected "Content-Encoding", NULL for none
+ * @param body expected body
+ * @return 0 on success
+ */
+static int
+check_variant (const char *accept,
+               const char *encoding,
+               const char *body)
+{
+  MHD_socket sock;
+  struct sockaddr_in sa;
+  char request[256];
+  char reply[1024];
+  char expected[128];
+  const char *end;
+  size_t have;
+  ssize_t got;
+
+  snprintf (request,
+            sizeof (request),
+            "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n%s%s%s\r\n",
+            (NULL == accept) ? "" : "Accept-Encoding: ",
+            (NULL == accept) ? "" : accept,
+            (NULL == accept) ? "" : "\r\n");
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sock)
+    abort ();
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (sock,
+                    (struct sockaddr *) &sa,
+                    sizeof (sa)))
+    abort ();
+  if (strlen (request) !=
+      (size_t) write (sock, request, strlen (request)))
+    abort ();
+  have = 0;
+  while ( (have < sizeof (reply) - 1) &&
+          (0 < (got = read (sock, &reply[have], sizeof (reply) - 1 - have))) )
+    have += got;
+  reply[have] = '\0';
+  MHD_socket_close_ (sock);
+  end = strstr (reply, "\r\n\r\n");
+  if ( (NULL == end) ||
+       (0 != strcmp (end + 4, body)) ||
+       (NULL == strstr (reply, "\r\nVary: Accept-Encoding\r\n")) ||
+       (NULL == strstr (reply, "\r\nContent-Type: text/plain\r\n")) )
+    {
+      fprintf (stderr, "Unexpected reply for `%s': `%s'\n", accept, reply);
+      return 1;
+    }
+  snprintf (expected,
+            sizeof (expected),
+            "\r\nContent-Length: %u\r\n",
+            (unsigned int) strlen (body));
+  if (NULL == strstr (reply, expected))
+    return 2;
+  if (NULL == encoding)
+    return (NULL == strstr (reply, "Content-Encoding")) ? 0 : 4;
+  snprintf (expected,
+            sizeof (expected),
+            "\r\nContent-Encoding: %s\r\n",
+            encoding);
+  if (NULL == strstr (reply, expected))
+    {
+      fprintf (stderr, "Missing encoding for `%s': `%s'\n", accept, reply);
+      return 8;
+    }
+  return 0;
+}
+
+
+/**
+ * Create a response with a variant.
+ *
+ * @param response response to add the variant to
+ * @param encoding content coding of the variant
+ * @param body body of the variant
+ * @return 0 on success
+ */
+static int
+add_variant (struct MHD_Response *response,
+             const char *encoding,
+             const char *body)
+{
+  struct MHD_Response *variant;
+  int ret;
+
+  variant = MHD_create_response_from_buffer (strlen (body),
+                                             (void *) body,
+                                             MHD_RESPMEM_PERSISTENT);
+  if (NULL == variant)
+    return 1;
+  ret = MHD_add_response_variant (response,
+                                  encoding,
+                                  variant);
+  MHD_destroy_response (variant);
+  return (MHD_YES == ret) ? 0 : 1;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  struct MHD_Daemon *d;
+  struct MHD_Response *response;
+  int errorCount = 0;
+
+  response = MHD_create_response_from_buffer (strlen ("plain text"),
+                                              "plain text",
+                                              MHD_RESPMEM_PERSISTENT);
+  if (NULL == response)
+    return 1;
+  (void) MHD_add_response_header (response,
+                                  MHD_HTTP_HEADER_CONTENT_TYPE,
+                                  "text/plain");
+  errorCount += add_variant (response, "gzip", "GZ");
+  errorCount += add_variant (response, "br", "BROTLI");
+  /* invalid content codings */
+  if (MHD_NO != MHD_add_response_variant (response, "identity", response))
+    errorCount++;
+  if (MHD_NO != MHD_add_response_variant (response, "gzip, br", response))
+    errorCount++;
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_variants, response,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    {
+      MHD_destroy_response (response);
+      return 1;
+    }
+  errorCount += check_variant (NULL, NULL, "plain text");
+  errorCount += check_variant ("gzip", "gzip", "GZ");
+  errorCount += check_variant ("GZIP, deflate", "gzip", "GZ");
+  errorCount += check_variant ("gzip, br", "gzip", "GZ");
+  errorCount += check_variant ("gzip;q=0.5, br", "br", "BROTLI");
+  errorCount += check_variant ("br;q=0, gzip; q=0.1", "gzip", "GZ");
+  errorCount += check_variant ("*", "gzip", "GZ");
+  errorCount += check_variant ("deflate", NULL, "plain text");
+  errorCount += check_variant ("gzip;q=0", NULL, "plain text");
+  errorCount += check_variant ("gzip;q=0.2, identity;q=0.8", NULL, "plain text");
+  MHD_stop_daemon (d);
+  MHD_destroy_response (response);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -0,0 +1,249 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_write_quantum.c
+ * @brief  Testcase for #MHD_OPTION_WRITE_QUANTUM: big responses
+ *         written in small steps arrive complete, and a small request
+ *         is answered while a big download is still running
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+
+/**
+ * Size of the big response.
+ */
+#define BIG_SIZE (4 * 1024 * 1024)
+
+/**
+ * Write quantum to use.
+ */
+#define QUANTUM 4096
+
+#define PAGE "small"
+
+static char *big;
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  static int marker;
+  struct MHD_Response *response;
+  int ret;
+
+  if (&marker != *con_cls)
+    {
+      *con_cls = &marker;
+      return MHD_YES;
+    }
+  if (0 == strcmp (url, "/big"))
+    response = MHD_create_response_from_buffer (BIG_SIZE,
+                                                big,
+                                                MHD_RESPMEM_PERSISTENT);
+  else
+    response = MHD_create_response_from_buffer (strlen (PAGE),
+                                                (void *) PAGE,
+                                                MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection,
+                            MHD_HTTP_OK,
+                            response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Connect to the daemon and request @a url, closing the connection
+ * after the response.
+ */
+static MHD_socket
+start_request (uint16_t port,
+               const char *url)
+{
+  MHD_socket sock;
+  struct sockaddr_in sa;
+  char req[256];
+
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sock)
+    abort ();
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (port);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (sock,
+                    (struct sockaddr *) &sa,
+                    sizeof (sa)))
+    abort ();
+  snprintf (req,
+            sizeof (req),
+            "GET %s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+            url);
+  if (strlen (req) != (size_t) write (sock, req, strlen (req)))
+    abort ();
+  return sock;
+}
+
+
+/**
+ * Read from @a sock until it is closed and check that the body is
+ * @a body_size bytes long and, for the big response, intact.
+ *
+ * @return 0 on success
+ */
+static int
+finish_request (MHD_socket sock,
+                size_t body_size)
+{
+  char buf[16 * 1024];
+  size_t body_off;
+  size_t hdr;
+  ssize_t got;
+  ssize_t i;
+  fd_set rs;
+  struct timeval tv;
+  int ret;
+
+  body_off = 0;
+  hdr = 0;
+  ret = 0;
+  while (1)
+    {
+      FD_ZERO (&rs);
+      FD_SET (sock, &rs);
+      tv.tv_sec = 5;
+      tv.tv_usec = 0;
+      if (1 != select (sock + 1, &rs, NULL, NULL, &tv))
+        {
+          ret = 1;
+          break;
+        }
+      got = read (sock, buf, sizeof (buf));
+      if (0 > got)
+        {
+          ret = 2;
+          break;
+        }
+      if (0 == got)
+        break;
+      for (i = 0; i < got; i++)
+        {
+          if (hdr < 4)
+            {
+              /* skip the header up to the empty line */
+              if ( ('\r' == buf[i]) || ('\n' == buf[i]) )
+                hdr++;
+              else
+                hdr = 0;
+              continue;
+            }
+          if ( (BIG_SIZE == body_size) &&
+               (body_off < BIG_SIZE) &&
+               (big[body_off] != buf[i]) )
+            ret |= 4;
+          body_off++;
+        }
+    }
+  MHD_socket_close_ (sock);
+  if (body_off != body_size)
+    ret |= 8;
+  return ret;
+}
+
+
+static int
+test_quantum (unsigned int flags,
+              uint16_t port)
+{
+  struct MHD_Daemon *d;
+  MHD_socket big1;
+  MHD_socket big2;
+  int ret;
+
+  d = MHD_start_daemon (flags | MHD_USE_DEBUG,
+                        port,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_WRITE_QUANTUM, (size_t) QUANTUM,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  big1 = start_request (port, "/big");
+  big2 = start_request (port, "/big");
+  /* served while the big responses are still being written */
+  ret = finish_request (start_request (port, "/small"),
+                        strlen (PAGE));
+  ret |= finish_request (big1,
+                         BIG_SIZE) << 4;
+  ret |= finish_request (big2,
+                         BIG_SIZE) << 8;
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount = 0;
+  size_t i;
+
+  big = malloc (BIG_SIZE);
+  if (NULL == big)
+    return 77;
+  for (i = 0; i < BIG_SIZE; i++)
+    big[i] = 'a' + (i * 7) % 26;
+  errorCount += test_quantum (MHD_USE_SELECT_INTERNALLY,
+                              1135);
+#ifdef HAVE_POLL
+  errorCount += test_quantum (MHD_USE_POLL_INTERNALLY,
+                              1136);
+#endif
+#if EPOLL_SUPPORT
+  errorCount += test_quantum (MHD_USE_SELECT_INTERNALLY | MHD_USE_EPOLL_LINUX_ONLY,
+                              1137);
+#endif
+  free (big);
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %u)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
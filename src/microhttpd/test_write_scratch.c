@@ -0,0 +1,273 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 3, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+     Boston, MA 02111-1307, USA.
+*/
+
+/**
+ * @file test_write_scratch.c
+ * @brief  Testcase for #MHD_OPTION_WRITE_SCRATCH_BUFFER: chunked
+ *         responses read into the shared scratch buffer arrive intact
+ *         at fast and slow clients alike
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include "platform_interface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+#define PORT 1204
+
+/**
+ * Memory limit of the connections, smaller than the scratch buffer.
+ */
+#define POOL_SIZE 16384
+
+/**
+ * Size of the scratch buffer.
+ */
+#define SCRATCH_SIZE (64 * 1024)
+
+/**
+ * Size of the response body.
+ */
+#define BODY_SIZE (1024 * 1024)
+
+
+static ssize_t
+fill_pattern (void *cls,
+              uint64_t pos,
+              char *buf,
+              size_t max)
+{
+  size_t i;
+
+  if (pos >= BODY_SIZE)
+    return MHD_CONTENT_READER_END_OF_STREAM;
+  if (max > BODY_SIZE - pos)
+    max = BODY_SIZE - pos;
+  for (i = 0; i < max; i++)
+    buf[i] = (char) ('a' + (pos + i) % 26);
+  return max;
+}
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data,
+          size_t *upload_data_size,
+          void **con_cls)
+{
+  struct MHD_Response *response;
+  int ret;
+
+  response = MHD_create_response_from_callback (MHD_SIZE_UNKNOWN,
+                                                32 * 1024,
+                                                &fill_pattern,
+                                                NULL,
+                                                NULL);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Open a connection to the daemon, send a request and receive the
+ * response, reading slowly if @a slow is set.
+ *
+ * @param slow non-zero to read in small pieces with pauses
+ * @return 0 if the body arrived intact
+ */
+static int
+fetch (int slow)
+{
+  static const char req[] =
+    "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  struct sockaddr_in sa;
+  struct timeval tv;
+  MHD_socket sock;
+  char *buf;
+  size_t off;
+  size_t pos;
+  size_t body;
+  ssize_t got;
+  char *end;
+  unsigned long chunk;
+  int rcvbuf;
+  int ret;
+
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (MHD_INVALID_SOCKET == sock)
+    abort ();
+  tv.tv_sec = 5;
+  tv.tv_usec = 0;
+  setsockopt (sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+  if (slow)
+    {
+      /* make the server run into partial writes */
+      rcvbuf = 4096;
+      setsockopt (sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof (rcvbuf));
+    }
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (sock,
+                    (struct sockaddr *) &sa,
+                    sizeof (sa)))
+    abort ();
+  if (sizeof (req) - 1 != send (sock, req, sizeof (req) - 1, 0))
+    abort ();
+  buf = malloc (2 * BODY_SIZE);
+  if (NULL == buf)
+    abort ();
+  off = 0;
+  while (off < 2 * BODY_SIZE - 1)
+    {
+      got = recv (sock,
+                  &buf[off],
+                  slow ? 2048 : 2 * BODY_SIZE - 1 - off,
+                  0);
+      if (got <= 0)
+        break;
+      off += got;
+      /* the connection stays open after the last chunk */
+      if ( (off > 5) &&
+           (0 == memcmp (&buf[off - 5], "0\r\n\r\n", 5)) )
+        break;
+      if (slow)
+        usleep (200);
+    }
+  MHD_socket_close_ (sock);
+  buf[off] = '\0';
+  ret = 1;
+  /* decode the chunks and check the pattern */
+  if (NULL == (end = strstr (buf, "\r\n\r\n")))
+    goto cleanup;
+  pos = end + 4 - buf;
+  body = 0;
+  while (pos < off)
+    {
+      chunk = strtoul (&buf[pos], &end, 16);
+      if ( (end == &buf[pos]) ||
+           (0 != strncmp (end, "\r\n", 2)) )
+        goto cleanup;
+      pos = end + 2 - buf;
+      if (0 == chunk)
+        break;
+      if (pos + chunk + 2 > off)
+        goto cleanup;
+      while (chunk-- > 0)
+        {
+          if (buf[pos] != (char) ('a' + body % 26))
+            goto cleanup;
+          pos++;
+          body++;
+        }
+      if (0 != strncmp (&buf[pos], "\r\n", 2))
+        goto cleanup;
+      pos += 2;
+    }
+  if (BODY_SIZE == body)
+    ret = 0;
+ cleanup:
+  free (buf);
+  return ret;
+}
+
+
+/**
+ * Fetch the body with a slow client in a thread while a fast client
+ * fetches it as well, so both share the scratch buffer.
+ */
+static void *
+slow_fetch (void *cls)
+{
+  int *result = cls;
+
+  *result = fetch (1);
+  return NULL;
+}
+
+
+static int
+test_daemon (unsigned int flags,
+             unsigned int threads)
+{
+  struct MHD_Daemon *d;
+  pthread_t pt;
+  int slow_result;
+  int ret;
+
+  d = MHD_start_daemon (flags,
+                        PORT,
+                        NULL, NULL,
+                        &ahc_echo, NULL,
+                        MHD_OPTION_CONNECTION_MEMORY_LIMIT, (size_t) POOL_SIZE,
+                        MHD_OPTION_WRITE_SCRATCH_BUFFER, (size_t) SCRATCH_SIZE,
+                        MHD_OPTION_THREAD_POOL_SIZE, threads,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  slow_result = 1;
+  if (0 != pthread_create (&pt, NULL, &slow_fetch, &slow_result))
+    abort ();
+  if (0 != fetch (0))
+    ret |= 2;
+  if (0 != pthread_join (pt, NULL))
+    abort ();
+  if (0 != slow_result)
+    ret |= 4;
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+int
+main (int argc,
+      char *const *argv)
+{
+  int errorCount;
+
+  errorCount = 0;
+  errorCount |= test_daemon (MHD_USE_SELECT_INTERNALLY, 0);
+  errorCount |= test_daemon (MHD_USE_SELECT_INTERNALLY, 2) << 4;
+  /* the option is ignored with a thread per connection */
+  errorCount |= test_daemon (MHD_USE_SELECT_INTERNALLY |
+                             MHD_USE_THREAD_PER_CONNECTION, 0) << 8;
+  if (0 != errorCount)
+    fprintf (stderr,
+             "Error (code: %d)\n",
+             errorCount);
+  return errorCount != 0;       /* 0 == pass */
+}
+
+/* end of test_write_scratch.c */
@@ -0,0 +1,258 @@
+/*
+ This file is part of libmicrohttpd
+ Copyright (C) 2016 Christian Grothoff
+
+ libmicrohttpd is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published
+ by the Free Software Foundation; either version 2, or (at your
+ option) any later version.
+
+ libmicrohttpd is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with libmicrohttpd; see the file COPYING.  If not, write to the
+ Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+ */
+
+/**
+ * @file test_https_handshake_threads.c
+ * @brief  Testcase for running TLS handshakes on handshake threads
+ *         (#MHD_OPTION_HTTPS_HANDSHAKE_THREADS)
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include <gcrypt.h>
+#include <poll.h>
+#include "tls_test_common.h"
+
+extern const char srv_key_pem[];
+extern const char srv_self_signed_cert_pem[];
+
+
+static int
+hs_ahc (void *cls, struct MHD_Connection *connection,
+        const char *url, const char *method,
+        const char *upload_data, const char *version,
+        size_t *upload_data_size, void **ptr)
+{
+  struct MHD_Response *response;
+  int ret;
+
+  if (NULL == *ptr)
+    {
+      *ptr = &hs_ahc;
+      return MHD_YES;
+    }
+  response = MHD_create_response_from_buffer (strlen (EMPTY_PAGE),
+					      (void *) EMPTY_PAGE,
+					      MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Open a TCP connection to the daemon.
+ *
+ * @return the socket, -1 on error
+ */
+static int
+connect_daemon ()
+{
+  struct sockaddr_in sa;
+  int sock;
+
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (-1 == sock)
+    return -1;
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (DEAMON_TEST_PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (sock, (struct sockaddr *) &sa, sizeof (sa)))
+    {
+      close (sock);
+      return -1;
+    }
+  return sock;
+}
+
+
+/**
+ * Make a request on a new TLS connection.
+ *
+ * @return 0 on success
+ */
+static int
+do_request ()
+{
+  const char *request = "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+  gnutls_certificate_credentials_t xcred;
+  gnutls_session_t session;
+  char reply[1024];
+  const char *body;
+  size_t have;
+  ssize_t got;
+  int sock;
+  int ret;
+
+  if (-1 == (sock = connect_daemon ()))
+    return 1;
+  gnutls_certificate_allocate_credentials (&xcred);
+  gnutls_init (&session, GNUTLS_CLIENT);
+  gnutls_priority_set_direct (session, "NORMAL", NULL);
+  gnutls_credentials_set (session, GNUTLS_CRD_CERTIFICATE, xcred);
+  gnutls_transport_set_int (session, sock);
+  do
+    ret = gnutls_handshake (session);
+  while ( (GNUTLS_E_AGAIN == ret) || (GNUTLS_E_INTERRUPTED == ret) );
+  if (GNUTLS_E_SUCCESS == ret)
+    ret = (strlen (request) == (size_t) gnutls_record_send (session,
+                                                            request,
+                                                            strlen (request)))
+      ? 0 : 2;
+  else
+    ret = 2;
+  have = 0;
+  while ( (0 == ret) &&
+          (have < sizeof (reply) - 1) &&
+          (0 < (got = gnutls_record_recv (session,
+                                          &reply[have],
+                                          sizeof (reply) - 1 - have))) )
+    have += got;
+  reply[have] = '\0';
+  if ( (0 == ret) &&
+       ( (0 != strncmp (reply, "HTTP/1.1 200 ", strlen ("HTTP/1.1 200 "))) ||
+         (NULL == (body = strstr (reply, "\r\n\r\n"))) ||
+         (0 != strcmp (body + 4, EMPTY_PAGE)) ) )
+    ret = 4;
+  gnutls_deinit (session);
+  gnutls_certificate_free_credentials (xcred);
+  close (sock);
+  return ret;
+}
+
+
+/**
+ * Check that the daemon closes a connection that does not start
+ * its handshake, once the connection timeout is reached.
+ *
+ * @param sock the connection
+ * @return 0 on success
+ */
+static int
+check_timed_out (int sock)
+{
+  struct pollfd p;
+  char c;
+
+  p.fd = sock;
+  p.events = POLLIN;
+  p.revents = 0;
+  /* the connection timeout is 1s */
+  if (1 != poll (&p, 1, 5000))
+    return 16;
+  if (0 < recv (sock, &c, 1, 0))
+    return 32;
+  return 0;
+}
+
+
+/**
+ * Run requests while other connections stall in their handshakes.
+ *
+ * @param flags event loop flags for the daemon
+ * @param pool_size size of the thread pool, 0 for none
+ * @return 0 on success
+ */
+static int
+test_handshake_threads (unsigned int flags,
+                        unsigned int pool_size)
+{
+  struct MHD_Daemon *d;
+  unsigned int i;
+  int stalled;
+  int ret;
+
+  d = MHD_start_daemon (flags | MHD_USE_SSL | MHD_USE_SUSPEND_RESUME |
+                        MHD_USE_DEBUG,
+                        DEAMON_TEST_PORT,
+                        NULL, NULL, &hs_ahc, NULL,
+                        MHD_OPTION_THREAD_POOL_SIZE, pool_size,
+                        MHD_OPTION_CONNECTION_TIMEOUT, 1,
+                        MHD_OPTION_HTTPS_MEM_KEY, srv_key_pem,
+                        MHD_OPTION_HTTPS_MEM_CERT, srv_self_signed_cert_pem,
+                        MHD_OPTION_HTTPS_HANDSHAKE_THREADS, 2,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  if (-1 == (stalled = connect_daemon ()))
+    ret = 64;
+  /* the stalled connection is handed to a handshake thread as soon
+     as it sends anything */
+  if ( (0 == ret) &&
+       (1 != write (stalled, "\x16", 1)) )
+    ret = 64;
+  for (i = 0; (i < 4) && (0 == ret); i++)
+    ret = do_request ();
+  if (0 == ret)
+    ret = check_timed_out (stalled);
+  if (-1 != stalled)
+    close (stalled);
+  /* stop while a handshake is in progress */
+  if ( (0 == ret) &&
+       ( (-1 == (stalled = connect_daemon ())) ||
+         (1 != write (stalled, "\x16", 1)) ) )
+    ret = 128;
+  usleep (100000);
+  MHD_stop_daemon (d);
+  if (-1 != stalled)
+    close (stalled);
+  if (0 != ret)
+    fprintf (stderr,
+             "Handshake threads failed with flags %u and %u worker threads\n",
+             flags, pool_size);
+  return ret;
+}
+
+
+int
+main (int argc, char *const *argv)
+{
+  unsigned int errorCount = 0;
+  struct MHD_Daemon *d;
+
+  gcry_control (GCRYCTL_ENABLE_QUICK_RANDOM, 0);
+#ifdef GCRYCTL_INITIALIZATION_FINISHED
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+#endif
+  /* suspend/resume is required */
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_SSL,
+                        DEAMON_TEST_PORT,
+                        NULL, NULL, &hs_ahc, NULL,
+                        MHD_OPTION_HTTPS_MEM_KEY, srv_key_pem,
+                        MHD_OPTION_HTTPS_MEM_CERT, srv_self_signed_cert_pem,
+                        MHD_OPTION_HTTPS_HANDSHAKE_THREADS, 2,
+                        MHD_OPTION_END);
+  if (NULL != d)
+    {
+      MHD_stop_daemon (d);
+      errorCount++;
+    }
+  errorCount += test_handshake_threads (MHD_USE_SELECT_INTERNALLY, 4);
+  errorCount += test_handshake_threads (MHD_USE_POLL_INTERNALLY, 0);
+  if (MHD_YES == MHD_is_feature_supported (MHD_FEATURE_EPOLL))
+    errorCount += test_handshake_threads (MHD_USE_EPOLL_INTERNALLY_LINUX_ONLY, 0);
+  print_test_result (errorCount, argv[0]);
+  if (errorCount > 0)
+    fprintf (stderr, "Error (code: %u)\n", errorCount);
+  return errorCount;
+}
@@ -0,0 +1,245 @@
+/*
+ This file is part of libmicrohttpd
+ Copyright (C) 2016 Christian Grothoff
+
+ libmicrohttpd is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published
+ by the Free Software Foundation; either version 2, or (at your
+ option) any later version.
+
+ libmicrohttpd is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with libmicrohttpd; see the file COPYING.  If not, write to the
+ Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+ */
+
+/**
+ * @file test_https_record_size.c
+ * @brief  Testcase for the dynamic sizing of TLS records
+ *         (#MHD_OPTION_HTTPS_DYNAMIC_RECORD_SIZE)
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include <gcrypt.h>
+#include "tls_test_common.h"
+
+extern const char srv_key_pem[];
+extern const char srv_self_signed_cert_pem[];
+
+/**
+ * Size of the body of the response.
+ */
+#define BODY_SIZE (100 * 1024)
+
+/**
+ * Number of bytes to send in small records.
+ */
+#define SMALL_BYTES (8 * 1024)
+
+/**
+ * Maximum payload of a small record (see daemon.c).
+ */
+#define SMALL_RECORD 1360
+
+static char body[BODY_SIZE];
+
+
+static int
+record_ahc (void *cls, struct MHD_Connection *connection,
+            const char *url, const char *method,
+            const char *upload_data, const char *version,
+            size_t *upload_data_size, void **ptr)
+{
+  struct MHD_Response *response;
+  int ret;
+
+  if (NULL == *ptr)
+    {
+      *ptr = &record_ahc;
+      return MHD_YES;
+    }
+  *ptr = NULL;
+  response = MHD_create_response_from_buffer (sizeof (body),
+					      body,
+					      MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Make a request on an established session and check the sizes of
+ * the records of the reply.  gnutls_record_recv() returns the data
+ * of at most one record.
+ *
+ * @param session the session
+ * @param small #MHD_YES if the reply must start with small records
+ * @param coalesced #MHD_YES if the first record must contain the
+ *        header and the beginning of the body
+ * @return 0 on success
+ */
+static int
+check_reply (gnutls_session_t session,
+             int small,
+             int coalesced)
+{
+  const char *request = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  static char reply[BODY_SIZE + 1024];
+  const char *end;
+  size_t have;
+  size_t max_record;
+  size_t first;
+  ssize_t got;
+
+  if (strlen (request) != (size_t) gnutls_record_send (session,
+                                                       request,
+                                                       strlen (request)))
+    return 1;
+  have = 0;
+  first = 0;
+  max_record = 0;
+  end = NULL;
+  while ( (have < sizeof (reply) - 1) &&
+          ( (NULL == end) ||
+            (&reply[have] - (end + 4) < BODY_SIZE) ) )
+    {
+      got = gnutls_record_recv (session,
+                                &reply[have],
+                                sizeof (reply) - 1 - have);
+      if (got <= 0)
+        return 2;
+      if (0 == first)
+        first = got;
+      if ( (MHD_YES == small) &&
+           (have < SMALL_BYTES) &&
+           (got > SMALL_RECORD) )
+        {
+          fprintf (stderr, "Record of %d bytes at %u\n",
+                   (int) got, (unsigned int) have);
+          return 4;
+        }
+      if ((size_t) got > max_record)
+        max_record = got;
+      have += got;
+      reply[have] = '\0';
+      if (NULL == end)
+        end = strstr (reply, "\r\n\r\n");
+    }
+  if ( (NULL == end) ||
+       (&reply[have] - (end + 4) != BODY_SIZE) ||
+       (0 != memcmp (end + 4, body, BODY_SIZE)) )
+    return 8;
+  /* where did the first record end? */
+  if ( (MHD_YES == coalesced) !=
+       (first > (size_t) (end + 4 - reply)) )
+    {
+      fprintf (stderr, "First record has %u bytes, header %u\n",
+               (unsigned int) first,
+               (unsigned int) (end + 4 - reply));
+      return 16;
+    }
+  /* the rest is sent in full-size records */
+  if (max_record <= 4 * SMALL_RECORD)
+    return 32;
+  return 0;
+}
+
+
+/**
+ * Run requests on one connection.
+ *
+ * @param limit value for #MHD_OPTION_HTTPS_DYNAMIC_RECORD_SIZE
+ * @return 0 on success
+ */
+static int
+test_record_size (size_t limit)
+{
+  gnutls_certificate_credentials_t xcred;
+  gnutls_session_t session;
+  struct MHD_Daemon *d;
+  struct sockaddr_in sa;
+  int enabled = (0 != limit) ? MHD_YES : MHD_NO;
+  int sock;
+  int ret;
+
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_SSL |
+                        MHD_USE_DEBUG, DEAMON_TEST_PORT,
+                        NULL, NULL, &record_ahc, NULL,
+                        MHD_OPTION_HTTPS_MEM_KEY, srv_key_pem,
+                        MHD_OPTION_HTTPS_MEM_CERT, srv_self_signed_cert_pem,
+                        MHD_OPTION_HTTPS_DYNAMIC_RECORD_SIZE, limit,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (DEAMON_TEST_PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if ( (-1 == sock) ||
+       (0 != connect (sock, (struct sockaddr *) &sa, sizeof (sa))) )
+    {
+      MHD_stop_daemon (d);
+      return 1;
+    }
+  gnutls_certificate_allocate_credentials (&xcred);
+  gnutls_init (&session, GNUTLS_CLIENT);
+  gnutls_priority_set_direct (session, "NORMAL", NULL);
+  gnutls_credentials_set (session, GNUTLS_CRD_CERTIFICATE, xcred);
+  gnutls_transport_set_int (session, sock);
+  do
+    ret = gnutls_handshake (session);
+  while ( (GNUTLS_E_AGAIN == ret) || (GNUTLS_E_INTERRUPTED == ret) );
+  if (GNUTLS_E_SUCCESS != ret)
+    ret = 64;
+  else
+    ret = check_reply (session, enabled, enabled);
+  /* no idle time: full-size records right away */
+  if (0 == ret)
+    ret = check_reply (session, MHD_NO, enabled);
+  /* after being idle, small records again */
+  if ( (0 == ret) &&
+       (MHD_YES == enabled) )
+    {
+      sleep (3);
+      ret = check_reply (session, MHD_YES, MHD_YES);
+    }
+  gnutls_deinit (session);
+  gnutls_certificate_free_credentials (xcred);
+  close (sock);
+  MHD_stop_daemon (d);
+  if (0 != ret)
+    fprintf (stderr,
+             "Record sizes wrong with limit %u: %d\n",
+             (unsigned int) limit, ret);
+  return ret;
+}
+
+
+int
+main (int argc, char *const *argv)
+{
+  unsigned int errorCount = 0;
+  size_t i;
+
+  gcry_control (GCRYCTL_ENABLE_QUICK_RANDOM, 0);
+#ifdef GCRYCTL_INITIALIZATION_FINISHED
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+#endif
+  for (i = 0; i < sizeof (body); i++)
+    body[i] = 'a' + i % 26;
+  errorCount += (0 != test_record_size (0));
+  errorCount += (0 != test_record_size (SMALL_BYTES));
+  print_test_result (errorCount, argv[0]);
+  if (errorCount > 0)
+    fprintf (stderr, "Error (code: %u)\n", errorCount);
+  return errorCount;
+}
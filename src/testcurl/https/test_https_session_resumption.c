@@ -0,0 +1,230 @@
+/*
+ This file is part of libmicrohttpd
+ Copyright (C) 2016 Christian Grothoff
+
+ libmicrohttpd is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published
+ by the Free Software Foundation; either version 2, or (at your
+ option) any later version.
+
+ libmicrohttpd is distributed in the hope that it will be useful, but
+ WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with libmicrohttpd; see the file COPYING.  If not, write to the
+ Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+ */
+
+/**
+ * @file test_https_session_resumption.c
+ * @brief  Testcase for resuming TLS sessions with session tickets
+ *         and with the session cache of the daemon
+ * @author Christian Grothoff
+ */
+
+#include "platform.h"
+#include "microhttpd.h"
+#include <gcrypt.h>
+#include "tls_test_common.h"
+
+extern const char srv_key_pem[];
+extern const char srv_self_signed_cert_pem[];
+
+/**
+ * Number of requests for which the TLS session was resumed.
+ */
+static unsigned int resumed;
+
+
+static int
+resume_ahc (void *cls, struct MHD_Connection *connection,
+            const char *url, const char *method,
+            const char *upload_data, const char *version,
+            size_t *upload_data_size, void **ptr)
+{
+  struct MHD_Response *response;
+  gnutls_session_t session;
+  int ret;
+
+  if (NULL == *ptr)
+    {
+      *ptr = &resume_ahc;
+      return MHD_YES;
+    }
+  session = MHD_get_connection_info (connection,
+                                     MHD_CONNECTION_INFO_GNUTLS_SESSION)->tls_session;
+  if (0 != gnutls_session_is_resumed (session))
+    resumed++;
+  response = MHD_create_response_from_buffer (strlen (EMPTY_PAGE),
+					      (void *) EMPTY_PAGE,
+					      MHD_RESPMEM_PERSISTENT);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  return ret;
+}
+
+
+/**
+ * Make a request on a new connection, resuming @a data if given.
+ *
+ * @param[in,out] data session to resume, replaced with the new session
+ * @param priorities TLS priorities of the client
+ * @return 0 on success
+ */
+static int
+do_request (gnutls_datum_t *data,
+            const char *priorities)
+{
+  const char *request = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  gnutls_certificate_credentials_t xcred;
+  gnutls_session_t session;
+  struct sockaddr_in sa;
+  char reply[1024];
+  const char *body;
+  size_t have;
+  ssize_t got;
+  int sock;
+  int ret;
+
+  sock = socket (AF_INET, SOCK_STREAM, 0);
+  if (-1 == sock)
+    return 1;
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (DEAMON_TEST_PORT);
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (0 != connect (sock, (struct sockaddr *) &sa, sizeof (sa)))
+    {
+      close (sock);
+      return 1;
+    }
+  gnutls_certificate_allocate_credentials (&xcred);
+  gnutls_init (&session, GNUTLS_CLIENT);
+  gnutls_priority_set_direct (session, priorities, NULL);
+  gnutls_credentials_set (session, GNUTLS_CRD_CERTIFICATE, xcred);
+  if (NULL != data->data)
+    gnutls_session_set_data (session, data->data, data->size);
+  gnutls_transport_set_int (session, sock);
+  do
+    ret = gnutls_handshake (session);
+  while ( (GNUTLS_E_AGAIN == ret) || (GNUTLS_E_INTERRUPTED == ret) );
+  if (GNUTLS_E_SUCCESS == ret)
+    ret = (strlen (request) == (size_t) gnutls_record_send (session,
+                                                            request,
+                                                            strlen (request)))
+      ? 0 : 2;
+  else
+    ret = 2;
+  /* read the whole reply (a TLS 1.3 ticket arrives after the
+     handshake), but do not wait for the connection to be closed: a
+     session that ends with an error cannot be resumed */
+  have = 0;
+  body = NULL;
+  while ( (0 == ret) &&
+          ( (NULL == body) ||
+            (&reply[have] - body < (ssize_t) strlen (EMPTY_PAGE)) ) &&
+          (have < sizeof (reply) - 1) &&
+          (0 < (got = gnutls_record_recv (session,
+                                          &reply[have],
+                                          sizeof (reply) - 1 - have))) )
+    {
+      have += got;
+      reply[have] = '\0';
+      if (NULL != (body = strstr (reply, "\r\n\r\n")))
+        body += 4;
+    }
+  if ( (0 == ret) &&
+       ( (NULL == body) ||
+         (0 != strncmp (reply, "HTTP/1.1 200 ", strlen ("HTTP/1.1 200 "))) ) )
+    ret = 4;
+  if (0 == ret)
+    {
+      gnutls_bye (session, GNUTLS_SHUT_WR);
+      gnutls_free (data->data);
+      data->data = NULL;
+      if (GNUTLS_E_SUCCESS != gnutls_session_get_data2 (session, data))
+        data->data = NULL;
+    }
+  gnutls_deinit (session);
+  gnutls_certificate_free_credentials (xcred);
+  close (sock);
+  return ret;
+}
+
+
+/**
+ * Make three requests, each on a new connection, and count how
+ * many resumed the TLS session of the previous one.
+ *
+ * @param priorities TLS priorities of the client
+ * @param tickets value for #MHD_OPTION_HTTPS_SESSION_TICKETS
+ * @param cache_size value for #MHD_OPTION_HTTPS_SESSION_CACHE_SIZE
+ * @param expected number of resumed sessions expected
+ * @return 0 on success
+ */
+static int
+test_resumption (const char *priorities,
+                 unsigned int tickets,
+                 unsigned int cache_size,
+                 unsigned int expected)
+{
+  struct MHD_Daemon *d;
+  gnutls_datum_t data = { NULL, 0 };
+  unsigned int i;
+  int ret;
+
+  resumed = 0;
+  /* several threads, they have to share the ticket key and cache */
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_SSL |
+                        MHD_USE_DEBUG, DEAMON_TEST_PORT,
+                        NULL, NULL, &resume_ahc, NULL,
+                        MHD_OPTION_THREAD_POOL_SIZE, 4,
+                        MHD_OPTION_HTTPS_MEM_KEY, srv_key_pem,
+                        MHD_OPTION_HTTPS_MEM_CERT, srv_self_signed_cert_pem,
+                        MHD_OPTION_HTTPS_SESSION_TICKETS, tickets,
+                        MHD_OPTION_HTTPS_SESSION_CACHE_SIZE, cache_size,
+                        MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  ret = 0;
+  for (i = 0; (i < 3) && (0 == ret); i++)
+    ret = do_request (&data, priorities);
+  gnutls_free (data.data);
+  MHD_stop_daemon (d);
+  if (0 != ret)
+    {
+      fprintf (stderr, "Request with `%s' failed\n", priorities);
+      return ret;
+    }
+  if (expected != resumed)
+    {
+      fprintf (stderr,
+               "Expected %u resumed sessions with `%s', got %u\n",
+               expected, priorities, resumed);
+      return 8;
+    }
+  return 0;
+}
+
+
+int
+main (int argc, char *const *argv)
+{
+  unsigned int errorCount = 0;
+
+  gcry_control (GCRYCTL_ENABLE_QUICK_RANDOM, 0);
+#ifdef GCRYCTL_INITIALIZATION_FINISHED
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+#endif
+  errorCount += test_resumption ("NORMAL:-VERS-TLS1.3", MHD_NO, 0, 0);
+  errorCount += test_resumption ("NORMAL:-VERS-TLS1.3:%NO_TICKETS", MHD_NO, 64, 2);
+  errorCount += test_resumption ("NORMAL:-VERS-TLS1.3", MHD_YES, 0, 2);
+  errorCount += test_resumption ("NORMAL", MHD_YES, 0, 2);
+  print_test_result (errorCount, argv[0]);
+  if (errorCount > 0)
+    fprintf (stderr, "Error (code: %u)\n", errorCount);
+  return errorCount;
+}
@@ -0,0 +1,253 @@
+/*
+  This file is part of libmicrohttpd
+  Copyright (C) 2016 Christian Grothoff
+
+  libmicrohttpd is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published
+  by the Free Software Foundation; either version 3, or (at your
+  option) any later version.
+
+  libmicrohttpd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with libmicrohttpd; see the file COPYING.  If not, write to the
+  Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file test_https_sni_table.c
+ * @brief  Testcase for #MHD_OPTION_HTTPS_CERT_TABLE: certificates
+ *         selected by exact and wildcard host names and by key type
+ * @author Christian Grothoff
+ */
+#include "platform.h"
+#include "microhttpd.h"
+#include <limits.h>
+#include <sys/stat.h>
+#include <curl/curl.h>
+#include <gcrypt.h>
+#include "tls_test_common.h"
+#include <gnutls/gnutls.h>
+
+#define PORT 4234
+
+/**
+ * Cipher suites of TLS 1.2 forcing an RSA or an ECDSA certificate.
+ */
+#define RSA_CIPHERS "ECDHE-RSA-AES128-GCM-SHA256"
+#define ECDSA_CIPHERS "ECDHE-ECDSA-AES128-GCM-SHA256"
+
+
+/**
+ * Load a PEM file.
+ *
+ * @param name file name relative to the source directory
+ * @return the contents, 0-terminated
+ */
+static char *
+load_pem (const char *name)
+{
+  char path[PATH_MAX];
+  gnutls_datum_t data;
+
+  snprintf (path,
+            sizeof (path),
+            "%s/%s",
+            ABS_SRCDIR,
+            name);
+  if (0 > gnutls_load_file (path, &data))
+    {
+      fprintf (stderr,
+               "*** Error loading file %s.\n",
+               path);
+      exit (1);
+    }
+  return (char *) data.data;
+}
+
+
+/**
+ * Get @a url, offering only @a ciphers, and check the subject and
+ * the key type of the certificate the server sent.
+ *
+ * @param url URL to get
+ * @param ciphers cipher suites to offer
+ * @param subject expected common name, NULL if the handshake must fail
+ * @param key_type expected public key algorithm
+ * @return 0 on success
+ */
+static int
+check_get (const char *url,
+           const char *ciphers,
+           const char *subject,
+           const char *key_type)
+{
+  CURL *c;
+  struct CBC cbc;
+  CURLcode errornum;
+  struct curl_slist *dns_info;
+  struct curl_certinfo *certinfo;
+  struct curl_slist *pos;
+  char expected[64];
+  int have_subject;
+  int have_key_type;
+  int ret;
+
+  if (NULL == (cbc.buf = malloc (strlen (test_data))))
+    {
+      fprintf (stderr, MHD_E_MEM);
+      return 1;
+    }
+  cbc.size = strlen (test_data);
+  cbc.pos = 0;
+  c = curl_easy_init ();
+#if DEBUG_HTTPS_TEST
+  curl_easy_setopt (c, CURLOPT_VERBOSE, 1);
+#endif
+  curl_easy_setopt (c, CURLOPT_URL, url);
+  curl_easy_setopt (c, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_0);
+  curl_easy_setopt (c, CURLOPT_TIMEOUT, 10L);
+  curl_easy_setopt (c, CURLOPT_CONNECTTIMEOUT, 10L);
+  curl_easy_setopt (c, CURLOPT_WRITEFUNCTION, &copyBuffer);
+  curl_easy_setopt (c, CURLOPT_FILE, &cbc);
+  curl_easy_setopt (c, CURLOPT_SSL_VERIFYPEER, 0);
+  curl_easy_setopt (c, CURLOPT_SSL_VERIFYHOST, 0);
+  curl_easy_setopt (c, CURLOPT_SSLVERSION,
+                    CURL_SSLVERSION_TLSv1_2 | CURL_SSLVERSION_MAX_TLSv1_2);
+  curl_easy_setopt (c, CURLOPT_SSL_CIPHER_LIST, ciphers);
+  curl_easy_setopt (c, CURLOPT_CERTINFO, 1L);
+  dns_info = curl_slist_append (NULL, "host1:4234:127.0.0.1");
+  dns_info = curl_slist_append (dns_info, "host2:4234:127.0.0.1");
+  dns_info = curl_slist_append (dns_info, "a.wild.test:4234:127.0.0.1");
+  dns_info = curl_slist_append (dns_info, "a.b.wild.test:4234:127.0.0.1");
+  curl_easy_setopt (c, CURLOPT_RESOLVE, dns_info);
+  curl_easy_setopt (c, CURLOPT_FAILONERROR, 1);
+  curl_easy_setopt (c, CURLOPT_NOSIGNAL, 1);
+  errornum = curl_easy_perform (c);
+  ret = 0;
+  if (NULL == subject)
+    {
+      /* no certificate for this name */
+      if (CURLE_OK == errornum)
+        ret = 1;
+    }
+  else if (CURLE_OK != errornum)
+    {
+      fprintf (stderr,
+               "curl_easy_perform failed for %s: `%s'\n",
+               url,
+               curl_easy_strerror (errornum));
+      ret = 1;
+    }
+  else
+    {
+      snprintf (expected,
+                sizeof (expected),
+                "CN = %s",
+                subject);
+      have_subject = 0;
+      have_key_type = 0;
+      if ( (CURLE_OK == curl_easy_getinfo (c,
+                                           CURLINFO_CERTINFO,
+                                           &certinfo)) &&
+           (0 < certinfo->num_of_certs) )
+        for (pos = certinfo->certinfo[0]; NULL != pos; pos = pos->next)
+          {
+            if ( (0 == strncmp (pos->data, "Subject:", 8)) &&
+                 (NULL != strstr (pos->data, expected)) )
+              have_subject = 1;
+            if ( (0 == strncmp (pos->data, "Public Key Algorithm:", 21)) &&
+                 (NULL != strstr (pos->data, key_type)) )
+              have_key_type = 1;
+          }
+      if ( (! have_subject) ||
+           (! have_key_type) ||
+           (0 != memcmp (cbc.buf, test_data, strlen (test_data))) )
+        {
+          fprintf (stderr,
+                   "Wrong certificate or reply for %s with %s\n",
+                   url,
+                   ciphers);
+          ret = 1;
+        }
+    }
+  curl_easy_cleanup (c);
+  curl_slist_free_all (dns_info);
+  free (cbc.buf);
+  return ret;
+}
+
+
+int
+main (int argc, char *const *argv)
+{
+  unsigned int error_count = 0;
+  struct MHD_HttpsCertificate certs[4];
+  struct MHD_Daemon *d;
+  unsigned int i;
+
+  gcry_control (GCRYCTL_ENABLE_QUICK_RANDOM, 0);
+#ifdef GCRYCTL_INITIALIZATION_FINISHED
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+#endif
+  if (0 != curl_global_init (CURL_GLOBAL_ALL))
+    {
+      fprintf (stderr, "Error: %s\n", strerror (errno));
+      return -1;
+    }
+  memset (certs, 0, sizeof (certs));
+  certs[0].mem_cert = load_pem ("host1.crt");
+  certs[0].mem_key = load_pem ("host1.key");
+  certs[1].mem_cert = load_pem ("host2.crt");
+  certs[1].mem_key = load_pem ("host2.key");
+  certs[2].mem_cert = load_pem ("host1_ec.crt");
+  certs[2].mem_key = load_pem ("host1_ec.key");
+  certs[3].mem_cert = load_pem ("wildcard.crt");
+  certs[3].mem_key = load_pem ("wildcard.key");
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_SSL | MHD_USE_DEBUG,
+                        PORT,
+                        NULL, NULL,
+                        &http_ahc, NULL,
+                        MHD_OPTION_HTTPS_CERT_TABLE, 4, certs,
+                        MHD_OPTION_END);
+  /* only used while starting */
+  for (i = 0; i < 4; i++)
+    {
+      gnutls_free ((void *) certs[i].mem_cert);
+      gnutls_free ((void *) certs[i].mem_key);
+    }
+  if (NULL == d)
+    {
+      fprintf (stderr, MHD_E_SERVER_INIT);
+      return -1;
+    }
+  /* both key types for host1 */
+  error_count += check_get ("https://host1:4234/",
+                            RSA_CIPHERS,
+                            "host1",
+                            "rsaEncryption");
+  error_count += check_get ("https://host1:4234/",
+                            ECDSA_CIPHERS,
+                            "host1",
+                            "id-ecPublicKey");
+  error_count += check_get ("https://host2:4234/",
+                            RSA_CIPHERS,
+                            "host2",
+                            "rsaEncryption");
+  error_count += check_get ("https://a.wild.test:4234/",
+                            ECDSA_CIPHERS,
+                            "*.wild.test",
+                            "id-ecPublicKey");
+  /* a wildcard matches a single label only */
+  error_count += check_get ("https://a.b.wild.test:4234/",
+                            ECDSA_CIPHERS,
+                            NULL,
+                            NULL);
+  MHD_stop_daemon (d);
+  curl_global_cleanup ();
+  return error_count != 0;
+}
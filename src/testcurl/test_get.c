@@ -85,6 +85,7 @@ ahc_echo (void *cls,
 {
   static int ptr;
   const char *me = cls;
+  const char *host;
   struct MHD_Response *response;
   int ret;
 
@@ -96,6 +97,14 @@ ahc_echo (void *cls,
       return MHD_YES;
     }
   *unused = NULL;
+  host = MHD_lookup_connection_token_value (connection,
+                                            MHD_HEADER_KIND,
+                                            MHD_HEADER_TOKEN_HOST);
+  if ( (NULL == host) ||
+       (host != MHD_lookup_connection_value (connection,
+                                             MHD_HEADER_KIND,
+                                             "host")) )
+    abort ();
   response = MHD_create_response_from_buffer (strlen (url),
 					      (void *) url,
 					      MHD_RESPMEM_MUST_COPY);
@@ -601,6 +610,30 @@ testEmptyGet (int poll_flag)
 }
 
 
+/**
+ * Check if io_uring is supported by the build and usable with the
+ * running kernel.
+ */
+static int
+have_io_uring ()
+{
+  struct MHD_Daemon *d;
+
+  if (MHD_YES != MHD_is_feature_supported (MHD_FEATURE_IO_URING))
+    return MHD_NO;
+  d = MHD_start_daemon (MHD_USE_IO_URING_INTERNALLY_LINUX_ONLY,
+                        1083, NULL, NULL, &ahc_echo, "GET", MHD_OPTION_END);
+  if (NULL == d)
+    {
+      fprintf (stderr,
+               "io_uring not usable with this kernel, skipping tests\n");
+      return MHD_NO;
+    }
+  MHD_stop_daemon (d);
+  return MHD_YES;
+}
+
+
 int
 main (int argc, char *const *argv)
 {
@@ -633,6 +666,27 @@ main (int argc, char *const *argv)
       errorCount += testUnknownPortGet(MHD_USE_EPOLL_LINUX_ONLY);
       errorCount += testEmptyGet(MHD_USE_EPOLL_LINUX_ONLY);
     }
+  if (MHD_YES == have_io_uring ())
+    {
+      errorCount += testInternalGet(MHD_USE_IO_URING_LINUX_ONLY);
+      errorCount += testMultithreadedPoolGet(MHD_USE_IO_URING_LINUX_ONLY);
+      errorCount += testUnknownPortGet(MHD_USE_IO_URING_LINUX_ONLY);
+      errorCount += testEmptyGet(MHD_USE_IO_URING_LINUX_ONLY);
+    }
+  if (MHD_YES == MHD_is_feature_supported(MHD_FEATURE_KQUEUE))
+    {
+      errorCount += testInternalGet(MHD_USE_KQUEUE);
+      errorCount += testMultithreadedPoolGet(MHD_USE_KQUEUE);
+      errorCount += testUnknownPortGet(MHD_USE_KQUEUE);
+      errorCount += testEmptyGet(MHD_USE_KQUEUE);
+    }
+#ifdef LINUX
+  /* Linux >= 3.9 load-balances accepts among SO_REUSEPORT sockets */
+  errorCount += testMultithreadedPoolGet (MHD_USE_THREAD_POOL_REUSEPORT);
+  if (MHD_YES == MHD_is_feature_supported(MHD_FEATURE_EPOLL))
+    errorCount += testMultithreadedPoolGet (MHD_USE_THREAD_POOL_REUSEPORT |
+                                            MHD_USE_EPOLL_LINUX_ONLY);
+#endif
   if (errorCount != 0)
     fprintf (stderr, "Error (code: %u)\n", errorCount);
   curl_global_cleanup ();
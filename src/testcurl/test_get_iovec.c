@@ -0,0 +1,236 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2007, 2009, 2011, 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file test_get_iovec.c
+ * @brief  Testcase for libmicrohttpd GET operations with responses
+ *         created by MHD_create_response_from_iovec()
+ * @author Christian Grothoff
+ */
+
+#include "MHD_config.h"
+#include "platform.h"
+#include <curl/curl.h>
+#include <microhttpd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+/**
+ * Size of the response body.
+ */
+#define BODY_SIZE (256 * 1024)
+
+/**
+ * Maximum number of fragments we split the body into.
+ */
+#define MAX_FRAGMENTS 512
+
+static int oneone;
+
+/**
+ * Body of the response, the fragments point into this.
+ */
+static char body[BODY_SIZE];
+
+/**
+ * Number of times the free callback was called.
+ */
+static unsigned int freed;
+
+struct CBC
+{
+  char *buf;
+  size_t pos;
+  size_t size;
+};
+
+
+static size_t
+copyBuffer (void *ptr, size_t size, size_t nmemb, void *ctx)
+{
+  struct CBC *cbc = ctx;
+
+  if (cbc->pos + size * nmemb > cbc->size)
+    return 0;                   /* overflow */
+  memcpy (&cbc->buf[cbc->pos], ptr, size * nmemb);
+  cbc->pos += size * nmemb;
+  return size * nmemb;
+}
+
+
+static void
+free_cb (void *cls)
+{
+  unsigned int *cnt = cls;
+
+  (*cnt)++;
+}
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data, size_t *upload_data_size,
+          void **unused)
+{
+  static int ptr;
+  const char *me = cls;
+  struct MHD_IoVec iov[MAX_FRAGMENTS];
+  struct MHD_Response *response;
+  unsigned int cnt;
+  size_t off;
+  size_t len;
+  int ret;
+
+  if (0 != strcmp (me, method))
+    return MHD_NO;              /* unexpected method */
+  if (&ptr != *unused)
+    {
+      *unused = &ptr;
+      return MHD_YES;
+    }
+  *unused = NULL;
+  /* split the body into fragments of varying size, including
+     an empty one */
+  cnt = 0;
+  for (off = 0; off < BODY_SIZE; off += len)
+    {
+      len = (cnt * 977) % 1500;
+      if (len > BODY_SIZE - off)
+        len = BODY_SIZE - off;
+      if (MAX_FRAGMENTS - 1 == cnt)
+        len = BODY_SIZE - off;
+      iov[cnt].iov_base = &body[off];
+      iov[cnt].iov_len = len;
+      cnt++;
+    }
+  response = MHD_create_response_from_iovec (iov,
+                                             cnt,
+                                             &free_cb,
+                                             &freed);
+  if (NULL == response)
+    abort ();
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  if (ret == MHD_NO)
+    abort ();
+  return ret;
+}
+
+
+static int
+testInternalGet (int poll_flag, int port)
+{
+  struct MHD_Daemon *d;
+  CURL *c;
+  char *buf;
+  struct CBC cbc;
+  CURLcode errornum;
+  char url[64];
+
+  buf = malloc (BODY_SIZE);
+  if (NULL == buf)
+    return 1;
+  cbc.buf = buf;
+  cbc.size = BODY_SIZE;
+  cbc.pos = 0;
+  freed = 0;
+  d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG  | poll_flag,
+                        port, NULL, NULL, &ahc_echo, "GET", MHD_OPTION_END);
+  if (d == NULL)
+    {
+      free (buf);
+      return 1;
+    }
+  sprintf (url, "http://127.0.0.1:%d/hello_world", port);
+  c = curl_easy_init ();
+  curl_easy_setopt (c, CURLOPT_URL, url);
+  curl_easy_setopt (c, CURLOPT_WRITEFUNCTION, &copyBuffer);
+  curl_easy_setopt (c, CURLOPT_WRITEDATA, &cbc);
+  curl_easy_setopt (c, CURLOPT_FAILONERROR, 1);
+  curl_easy_setopt (c, CURLOPT_TIMEOUT, 150L);
+  curl_easy_setopt (c, CURLOPT_CONNECTTIMEOUT, 150L);
+  if (oneone)
+    curl_easy_setopt (c, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+  else
+    curl_easy_setopt (c, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_0);
+  /* NOTE: use of CONNECTTIMEOUT without also
+     setting NOSIGNAL results in really weird
+     crashes on my system!*/
+  curl_easy_setopt (c, CURLOPT_NOSIGNAL, 1);
+  if (CURLE_OK != (errornum = curl_easy_perform (c)))
+    {
+      fprintf (stderr,
+               "curl_easy_perform failed: `%s'\n",
+               curl_easy_strerror (errornum));
+      curl_easy_cleanup (c);
+      MHD_stop_daemon (d);
+      free (buf);
+      return 2;
+    }
+  curl_easy_cleanup (c);
+  MHD_stop_daemon (d);
+  if (cbc.pos != BODY_SIZE)
+    {
+      free (buf);
+      return 4;
+    }
+  if (0 != memcmp (body, cbc.buf, BODY_SIZE))
+    {
+      free (buf);
+      return 8;
+    }
+  free (buf);
+  if (1 != freed)
+    return 16;
+  return 0;
+}
+
+
+int
+main (int argc, char *const *argv)
+{
+  unsigned int errorCount = 0;
+  unsigned int i;
+
+  oneone = (NULL != strrchr (argv[0], (int) '/')) ?
+    (NULL != strstr (strrchr (argv[0], (int) '/'), "11")) : 0;
+  for (i = 0; i < BODY_SIZE; i++)
+    body[i] = (char) ('a' + (i * 7 + i / 251) % 26);
+  if (0 != curl_global_init (CURL_GLOBAL_WIN32))
+    return 2;
+  errorCount += testInternalGet (0, 1095);
+  if (MHD_YES == MHD_is_feature_supported(MHD_FEATURE_POLL))
+    errorCount += testInternalGet (MHD_USE_POLL, 1096);
+  if (MHD_YES == MHD_is_feature_supported(MHD_FEATURE_EPOLL))
+    errorCount += testInternalGet (MHD_USE_EPOLL_LINUX_ONLY, 1097);
+  if (errorCount != 0)
+    fprintf (stderr, "Error (code: %u)\n", errorCount);
+  curl_global_cleanup ();
+  return errorCount != 0;       /* 0 == pass */
+}
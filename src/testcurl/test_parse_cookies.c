@@ -106,7 +106,7 @@ ahc_echo (void *cls,
 }
 
 static int
-testExternalGet ()
+testExternalGet (unsigned int lazy)
 {
   struct MHD_Daemon *d;
   CURL *c;
@@ -128,7 +128,9 @@ testExternalGet ()
   cbc.size = 2048;
   cbc.pos = 0;
   d = MHD_start_daemon (MHD_USE_DEBUG,
-                        21080, NULL, NULL, &ahc_echo, "GET", MHD_OPTION_END);
+                        21080, NULL, NULL, &ahc_echo, "GET",
+                        MHD_OPTION_LAZY_VALUE_PARSING, lazy,
+                        MHD_OPTION_END);
   if (d == NULL)
     return 256;
   c = curl_easy_init ();
@@ -242,7 +244,8 @@ main (int argc, char *const *argv)
     (NULL != strstr (strrchr (argv[0], (int) '/'), "11")) : 0;
   if (0 != curl_global_init (CURL_GLOBAL_WIN32))
     return 2;
-  errorCount += testExternalGet ();
+  errorCount += testExternalGet (MHD_NO);
+  errorCount += testExternalGet (MHD_YES);
   if (errorCount != 0)
     fprintf (stderr, "Error (code: %u)\n", errorCount);
   curl_global_cleanup ();
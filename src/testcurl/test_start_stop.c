@@ -123,6 +123,11 @@ main (int argc, char *const *argv)
       errorCount += testInternalGet(MHD_USE_EPOLL_LINUX_ONLY);
       errorCount += testMultithreadedPoolGet(MHD_USE_EPOLL_LINUX_ONLY);
     }
+  if (MHD_YES == MHD_is_feature_supported(MHD_FEATURE_KQUEUE))
+    {
+      errorCount += testInternalGet(MHD_USE_KQUEUE);
+      errorCount += testMultithreadedPoolGet(MHD_USE_KQUEUE);
+    }
   if (errorCount != 0)
     fprintf (stderr, "Error (code: %u)\n", errorCount);
   return errorCount != 0;       /* 0 == pass */
@@ -0,0 +1,272 @@
+/*
+     This file is part of libmicrohttpd
+     Copyright (C) 2016 Christian Grothoff
+
+     libmicrohttpd is free software; you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published
+     by the Free Software Foundation; either version 2, or (at your
+     option) any later version.
+
+     libmicrohttpd is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with libmicrohttpd; see the file COPYING.  If not, write to the
+     Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+     Boston, MA 02110-1301, USA.
+*/
+
+/**
+ * @file test_suspend_resume.c
+ * @brief  Testcase for suspending many connections and resuming
+ *         them from another thread in a different order
+ * @author Christian Grothoff
+ */
+
+#include "MHD_config.h"
+#include "platform.h"
+#include "platform_interface.h"
+#include <curl/curl.h>
+#include <microhttpd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#endif
+
+/**
+ * Number of concurrent requests.
+ */
+#define NUM_REQUESTS 16
+
+/**
+ * Values for the per-connection state kept in `con_cls`.
+ */
+static int state_seen;
+static int state_suspended;
+
+/**
+ * Connections that were suspended, protected by #lock.
+ */
+static struct MHD_Connection *suspended[NUM_REQUESTS];
+
+/**
+ * Number of elements in #suspended, protected by #lock.
+ */
+static unsigned int num_suspended;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct CBC
+{
+  char buf[64];
+  size_t pos;
+};
+
+
+static size_t
+copyBuffer (void *ptr, size_t size, size_t nmemb, void *ctx)
+{
+  struct CBC *cbc = ctx;
+
+  if (cbc->pos + size * nmemb > sizeof (cbc->buf))
+    return 0;                   /* overflow */
+  memcpy (&cbc->buf[cbc->pos], ptr, size * nmemb);
+  cbc->pos += size * nmemb;
+  return size * nmemb;
+}
+
+
+static int
+ahc_echo (void *cls,
+          struct MHD_Connection *connection,
+          const char *url,
+          const char *method,
+          const char *version,
+          const char *upload_data, size_t *upload_data_size,
+          void **con_cls)
+{
+  struct MHD_Response *response;
+  int ret;
+
+  if (NULL == *con_cls)
+    {
+      *con_cls = &state_seen;
+      return MHD_YES;
+    }
+  if (&state_seen == *con_cls)
+    {
+      *con_cls = &state_suspended;
+      pthread_mutex_lock (&lock);
+      if (num_suspended >= NUM_REQUESTS)
+        abort ();
+      suspended[num_suspended++] = connection;
+      MHD_suspend_connection (connection);
+      pthread_mutex_unlock (&lock);
+      return MHD_YES;
+    }
+  /* resumed */
+  response = MHD_create_response_from_buffer (strlen (url),
+					      (void *) url,
+					      MHD_RESPMEM_MUST_COPY);
+  ret = MHD_queue_response (connection, MHD_HTTP_OK, response);
+  MHD_destroy_response (response);
+  if (ret == MHD_NO)
+    abort ();
+  return ret;
+}
+
+
+/**
+ * Wait until all requests were suspended, then resume them
+ * in reverse order.
+ */
+static void *
+resumer (void *cls)
+{
+  unsigned int i;
+
+  while (1)
+    {
+      pthread_mutex_lock (&lock);
+      if (NUM_REQUESTS == num_suspended)
+        break;
+      pthread_mutex_unlock (&lock);
+      usleep (1000);
+    }
+  for (i = NUM_REQUESTS; i > 0; i--)
+    {
+      MHD_resume_connection (suspended[i - 1]);
+      if (0 == i % 4)
+        usleep (1000);
+    }
+  pthread_mutex_unlock (&lock);
+  return NULL;
+}
+
+
+static int
+testSuspendResume (int flags, int port)
+{
+  struct MHD_Daemon *d;
+  CURLM *multi;
+  CURL *c[NUM_REQUESTS];
+  struct CBC cbc[NUM_REQUESTS];
+  CURLMsg *msg;
+  pthread_t pt;
+  fd_set rs;
+  fd_set ws;
+  fd_set es;
+  MHD_socket max;
+  struct timeval tv;
+  int running;
+  unsigned int i;
+  unsigned int done;
+  time_t start;
+  char url[64];
+  int ret;
+
+  num_suspended = 0;
+  d = MHD_start_daemon (flags | MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG | MHD_USE_SUSPEND_RESUME,
+                        port, NULL, NULL, &ahc_echo, NULL, MHD_OPTION_END);
+  if (NULL == d)
+    return 1;
+  if (0 != pthread_create (&pt, NULL, &resumer, NULL))
+    {
+      MHD_stop_daemon (d);
+      return 2;
+    }
+  multi = curl_multi_init ();
+  if (NULL == multi)
+    abort ();
+  sprintf (url, "http://127.0.0.1:%d/hello_world", port);
+  for (i = 0; i < NUM_REQUESTS; i++)
+    {
+      cbc[i].pos = 0;
+      c[i] = curl_easy_init ();
+      curl_easy_setopt (c[i], CURLOPT_URL, url);
+      curl_easy_setopt (c[i], CURLOPT_WRITEFUNCTION, &copyBuffer);
+      curl_easy_setopt (c[i], CURLOPT_WRITEDATA, &cbc[i]);
+      curl_easy_setopt (c[i], CURLOPT_FAILONERROR, 1);
+      curl_easy_setopt (c[i], CURLOPT_TIMEOUT, 150L);
+      curl_easy_setopt (c[i], CURLOPT_CONNECTTIMEOUT, 150L);
+      curl_easy_setopt (c[i], CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+      curl_easy_setopt (c[i], CURLOPT_FORBID_REUSE, 1L);
+      curl_easy_setopt (c[i], CURLOPT_NOSIGNAL, 1);
+      curl_multi_add_handle (multi, c[i]);
+    }
+  ret = 0;
+  done = 0;
+  start = time (NULL);
+  while ( (done < NUM_REQUESTS) &&
+          (time (NULL) - start < 10) )
+    {
+      max = 0;
+      FD_ZERO (&rs);
+      FD_ZERO (&ws);
+      FD_ZERO (&es);
+      curl_multi_perform (multi, &running);
+      if (CURLM_OK != curl_multi_fdset (multi, &rs, &ws, &es, &max))
+        {
+          ret = 4;
+          break;
+        }
+      tv.tv_sec = 0;
+      tv.tv_usec = 1000;
+      select (max + 1, &rs, &ws, &es, &tv);
+      curl_multi_perform (multi, &running);
+      while (NULL != (msg = curl_multi_info_read (multi, &running)))
+        {
+          if (CURLMSG_DONE != msg->msg)
+            continue;
+          if (CURLE_OK != msg->data.result)
+            {
+              fprintf (stderr,
+                       "curl_multi_perform failed: `%s'\n",
+                       curl_easy_strerror (msg->data.result));
+              ret = 8;
+            }
+          done++;
+        }
+    }
+  if (done < NUM_REQUESTS)
+    ret |= 16;
+  for (i = 0; i < NUM_REQUESTS; i++)
+    {
+      curl_multi_remove_handle (multi, c[i]);
+      curl_easy_cleanup (c[i]);
+      if ( (cbc[i].pos != strlen ("/hello_world")) ||
+           (0 != strncmp ("/hello_world", cbc[i].buf, cbc[i].pos)) )
+        ret |= 32;
+    }
+  curl_multi_cleanup (multi);
+  pthread_join (pt, NULL);
+  MHD_stop_daemon (d);
+  return ret;
+}
+
+
+int
+main (int argc, char *const *argv)
+{
+  unsigned int errorCount = 0;
+
+  if (0 != curl_global_init (CURL_GLOBAL_WIN32))
+    return 2;
+  errorCount += testSuspendResume (0, 1098);
+  if (MHD_YES == MHD_is_feature_supported(MHD_FEATURE_POLL))
+    errorCount += testSuspendResume (MHD_USE_POLL, 1099);
+  if (MHD_YES == MHD_is_feature_supported(MHD_FEATURE_EPOLL))
+    errorCount += testSuspendResume (MHD_USE_EPOLL_LINUX_ONLY, 1100);
+  if (MHD_YES == MHD_is_feature_supported(MHD_FEATURE_IO_URING))
+    errorCount += testSuspendResume (MHD_USE_IO_URING_LINUX_ONLY, 1101);
+  if (errorCount != 0)
+    fprintf (stderr, "Error (code: %u)\n", errorCount);
+  curl_global_cleanup ();
+  return errorCount != 0;       /* 0 == pass */
+}
@@ -85,6 +85,25 @@ test_values (void *cls,
   return MHD_YES;
 }
 
+static int
+test_values_n (void *cls,
+	       enum MHD_ValueKind kind,
+	       const char *key,
+	       size_t key_size,
+	       const char *value,
+	       size_t value_size)
+{
+  if ( (strlen (key) != key_size) ||
+       ( (NULL == value) && (0 != value_size) ) )
+    abort ();
+  if ( (1 == key_size) &&
+       ('e' == key[0]) &&
+       (3 == value_size) &&
+       (0 == memcmp (value, "x\0y", 3)) )
+    matches += 8;
+  return MHD_YES;
+}
+
 static int
 ahc_echo (void *cls,
           struct MHD_Connection *connection,
@@ -97,6 +116,8 @@ ahc_echo (void *cls,
   static int ptr;
   const char *me = cls;
   struct MHD_Response *response;
+  const char *value;
+  size_t value_size;
   int ret;
 
   if (0 != strcmp (me, method))
@@ -110,6 +131,19 @@ ahc_echo (void *cls,
 			     MHD_GET_ARGUMENT_KIND,
 			     &test_values,
 			     NULL);
+  MHD_get_connection_values_n (connection,
+			       MHD_GET_ARGUMENT_KIND,
+			       &test_values_n,
+			       NULL);
+  if ( (MHD_YES != MHD_lookup_connection_value_n (connection,
+                                                  MHD_GET_ARGUMENT_KIND,
+                                                  "a",
+                                                  1,
+                                                  &value,
+                                                  &value_size)) ||
+       (1 != value_size) ||
+       (0 != strcmp (value, "b")) )
+    abort ();
   *unused = NULL;
   response = MHD_create_response_from_buffer (strlen (url),
 					      (void *) url,
@@ -123,7 +157,7 @@ ahc_echo (void *cls,
 
 
 static int
-testInternalGet (int poll_flag)
+testInternalGet (int poll_flag, unsigned int lazy)
 {
   struct MHD_Daemon *d;
   CURL *c;
@@ -134,12 +168,15 @@ testInternalGet (int poll_flag)
   cbc.buf = buf;
   cbc.size = 2048;
   cbc.pos = 0;
+  matches = 0;
   d = MHD_start_daemon (MHD_USE_SELECT_INTERNALLY | MHD_USE_DEBUG  | poll_flag,
-                        11080, NULL, NULL, &ahc_echo, "GET", MHD_OPTION_END);
+                        11080, NULL, NULL, &ahc_echo, "GET",
+                        MHD_OPTION_LAZY_VALUE_PARSING, lazy,
+                        MHD_OPTION_END);
   if (d == NULL)
     return 1;
   c = curl_easy_init ();
-  curl_easy_setopt (c, CURLOPT_URL, "http://127.0.0.1:11080/hello_world?a=b&c=&d");
+  curl_easy_setopt (c, CURLOPT_URL, "http://127.0.0.1:11080/hello_world?a=b&c=&d&e=x%00y");
   curl_easy_setopt (c, CURLOPT_WRITEFUNCTION, &copyBuffer);
   curl_easy_setopt (c, CURLOPT_WRITEDATA, &cbc);
   curl_easy_setopt (c, CURLOPT_FAILONERROR, 1);
@@ -168,7 +205,7 @@ testInternalGet (int poll_flag)
     return 4;
   if (0 != strncmp ("/hello_world", cbc.buf, strlen ("/hello_world")))
     return 8;
-  if (matches != 7)
+  if (matches != 15)
     return 16;
   return 0;
 }
@@ -183,7 +220,8 @@ main (int argc, char *const *argv)
     (NULL != strstr (strrchr (argv[0], (int) '/'), "11")) : 0;
   if (0 != curl_global_init (CURL_GLOBAL_WIN32))
     return 2;
-  errorCount += testInternalGet (0);
+  errorCount += testInternalGet (0, MHD_NO);
+  errorCount += testInternalGet (0, MHD_YES);
   if (errorCount != 0)
     fprintf (stderr, "Error (code: %u)\n", errorCount);
   curl_global_cleanup ();